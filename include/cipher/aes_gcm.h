@@ -6,8 +6,13 @@
 #ifndef AES_GCM_H
 #define AES_GCM_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "cipher/cipher.h"
+
 /// Length of the AES/GCM tag.
 /// We hard code 16 byte tags, which is the longest length supported by AES/GCM
 #define GCM_TAG_LEN 16
@@ -17,6 +22,29 @@
 /// (see NIST SP 800-38D, section 5.2.1.1) length for AES/GCM IVs.
 #define GCM_IV_LEN 12
 
+/// Largest plaintext AES/GCM encrypts under one IV, 2^39 - 256 bits
+/// (see NIST SP 800-38D, section 5.2.1.1)
+#define GCM_MAX_DATA_LEN ((((size_t) 1) << 36) - 32)
+
+/// Plaintext chunk size used by the streaming (segmented) AES/GCM mode.
+/// Memory use of a streaming encrypt/decrypt is a small multiple of this.
+#define AES_GCM_STREAM_CHUNK_LEN 65536
+
+/// Largest chunk size accepted from a stream header (bounds the buffers a
+/// crafted header can make the decryptor allocate)
+#define AES_GCM_STREAM_MAX_CHUNK_LEN (1 << 24)
+
+/// Chunks given to each thread per batch when a stream is processed by
+/// several threads (see set_cipher_threads()); a batch holds this many
+/// chunks per thread in memory
+#define AES_GCM_STREAM_CHUNKS_PER_THREAD 16
+
+/// Length of the header that starts every AES/GCM stream
+#define AES_GCM_STREAM_HEADER_LEN 16
+
+/// Length of the random nonce prefix held in the stream header
+#define AES_GCM_STREAM_NONCE_PREFIX_LEN 7
+
 /**
  * @brief This function uses the AES-GCM implementation from OpenSSL to
  *        encrypt data.
@@ -54,6 +82,54 @@ int aes_gcm_encrypt(unsigned char *key,
                     size_t inData_len, unsigned char **outData,
                     size_t * outData_len);
 
+/**
+ * @brief Same as aes_gcm_encrypt(), but reuses the OpenSSL state held by a
+ *        cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         aes_gcm_encrypt()
+ *
+ * The other parameters and the return value are those of aes_gcm_encrypt().
+ */
+int aes_gcm_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                        unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData,
+                        size_t inData_len, unsigned char **outData,
+                        size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_encrypt_ctx(), but writes the result into a buffer
+ *        supplied by the caller instead of allocating one.
+ *
+ * @param[in]  cctx         Cipher context, or NULL
+ *
+ * @param[in]  key          The hex bytes containing the key
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *
+ * @param[in]  inData       The plaintext data to be encrypted
+ *
+ * @param[in]  inData_len   The length, in bytes, of the plaintext data
+ *
+ * @param[out] outData      Buffer receiving IV||ciphertext||tag. Its
+ *                          ciphertext part may be the inData buffer itself
+ *                          (outData + GCM_IV_LEN == inData).
+ *
+ * @param[in]  outData_size Size of outData, at least
+ *                          inData_len + GCM_IV_LEN + GCM_TAG_LEN
+ *
+ * @param[out] outData_len  The length in bytes of the result
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_encrypt_into(kmyth_cipher_ctx * cctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData, size_t inData_len,
+                         unsigned char *outData, size_t outData_size,
+                         size_t * outData_len);
+
 /**
  * @brief This function uses the AES-GCM implementation from OpenSSL to
  *        decrypt data.
@@ -84,4 +160,269 @@ int aes_gcm_decrypt(unsigned char *key,
                     size_t inData_len, unsigned char **outData,
                     size_t * outData_len);
 
+/**
+ * @brief Same as aes_gcm_decrypt(), but reuses the OpenSSL state held by a
+ *        cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         aes_gcm_decrypt()
+ *
+ * The other parameters and the return value are those of aes_gcm_decrypt().
+ */
+int aes_gcm_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                        unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData,
+                        size_t inData_len, unsigned char **outData,
+                        size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_decrypt_ctx(), but writes the plaintext into a buffer
+ *        supplied by the caller instead of allocating one. If the tag does
+ *        not verify, the plaintext part of outData is cleared.
+ *
+ * @param[in]  cctx         Cipher context, or NULL
+ *
+ * @param[in]  key          The hex bytes containing the key
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *
+ * @param[in]  inData       The input, formatted IV||ciphertext||tag
+ *
+ * @param[in]  inData_len   The length in bytes of inData
+ *
+ * @param[out] outData      Buffer receiving the plaintext. It may be the
+ *                          ciphertext part of inData itself
+ *                          (outData == inData + GCM_IV_LEN).
+ *
+ * @param[in]  outData_size Size of outData, at least
+ *                          inData_len - (GCM_IV_LEN + GCM_TAG_LEN)
+ *
+ * @param[out] outData_len  The length in bytes of the plaintext
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_decrypt_into(kmyth_cipher_ctx * cctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData, size_t inData_len,
+                         unsigned char *outData, size_t outData_size,
+                         size_t * outData_len);
+
+/**
+ * @brief Decrypts IV||ciphertext||tag over its own buffer, leaving the
+ *        plaintext at the start of it, so no second buffer of the size of
+ *        the data is needed. If the tag does not verify, the ciphertext part
+ *        of the buffer is cleared.
+ *
+ * @param[in]     cctx          Cipher context, or NULL
+ *
+ * @param[in]     key           The hex bytes containing the key
+ *
+ * @param[in]     key_len       The length of the key in bytes
+ *
+ * @param[in,out] data          The input, replaced by the plaintext
+ *
+ * @param[in]     data_len      The length in bytes of the input
+ *
+ * @param[out]    plaintext_len The length in bytes of the plaintext
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_decrypt_in_place(kmyth_cipher_ctx * cctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *data, size_t data_len,
+                             size_t * plaintext_len);
+
+/**
+ * @brief Creates the header of a new streaming AES/GCM encryption: a fresh
+ *        random nonce prefix and the chunk size.
+ *
+ * <pre>
+ * A stream is laid out as
+ *    header||chunk_0||chunk_1||...||chunk_n
+ * where the header (AES_GCM_STREAM_HEADER_LEN bytes) is
+ *    magic "KGS1" (4) || chunk size, big-endian (4) ||
+ *    nonce prefix (7) || reserved, zero (1)
+ * and each chunk is the AES/GCM ciphertext and tag of chunk size bytes of
+ * plaintext (the final chunk may be shorter, even empty). The 12 byte IV of
+ * chunk i is
+ *    nonce prefix (7) || i, big-endian (4) || final chunk flag (1)
+ * and the header is the additional authenticated data of every chunk, so
+ * chunks cannot be reordered, dropped, truncated after a chunk boundary,
+ * or moved to another stream without failing authentication.
+ * </pre>
+ *
+ * @param[in]  chunk_len   Plaintext chunk size, at most
+ *                         AES_GCM_STREAM_MAX_CHUNK_LEN
+ *
+ * @param[out] header      Buffer of AES_GCM_STREAM_HEADER_LEN bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_init_header(size_t chunk_len, unsigned char *header);
+
+/**
+ * @brief Checks an AES/GCM stream header (see aes_gcm_stream_init_header())
+ *        and returns its chunk size, so that a reader can locate chunk i of
+ *        the stream at i * (chunk size + GCM_TAG_LEN) without reading the
+ *        chunks before it.
+ *
+ * @param[in]  header      Stream header (AES_GCM_STREAM_HEADER_LEN bytes)
+ *
+ * @param[out] chunk_len   Plaintext chunk size of the stream
+ *
+ * @return 0 on success, 1 if header is not a valid stream header
+ */
+int aes_gcm_stream_parse_header(const unsigned char *header,
+                                size_t *chunk_len);
+
+/**
+ * @brief Encrypts a file as an AES/GCM stream (see
+ *        aes_gcm_stream_init_header()) one chunk at a time, so memory use
+ *        does not depend on the size of the input. Only the chunks are
+ *        written; the caller stores the header. With more than one cipher
+ *        thread (see set_cipher_threads()), batches of chunks are encrypted
+ *        in parallel and written in order.
+ *
+ * @param[in]  key         The hex bytes containing the key
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  header      Stream header from aes_gcm_stream_init_header()
+ *                         (must not be reused for another stream)
+ *
+ * @param[in]  in          Plaintext input, read until end of file
+ *
+ * @param[in]  out         Destination of the encrypted chunks
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_encrypt_file(unsigned char *key, size_t key_len,
+                                const unsigned char *header,
+                                FILE * in, FILE * out);
+
+/**
+ * @brief Decrypts the chunks of an AES/GCM stream one at a time. Each
+ *        chunk is authenticated before its plaintext is written, but the
+ *        stream as a whole is only known to be complete when this returns
+ *        0, so on error the caller must discard everything written to out.
+ *        Uses the cipher threads like aes_gcm_stream_encrypt_file().
+ *
+ * @param[in]  key         The hex bytes containing the key
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  header      Stream header the chunks were encrypted under
+ *
+ * @param[in]  in          Encrypted chunks, read until end of file
+ *
+ * @param[in]  out         Destination of the plaintext
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_decrypt_file(unsigned char *key, size_t key_len,
+                                const unsigned char *header,
+                                FILE * in, FILE * out);
+
+/**
+ * @brief In-memory form of the AES/GCM stream encryption, matching the
+ *        kmyth cipher interface. The outData block has the form
+ *        header||chunks, so it can also be decrypted a chunk at a time.
+ *        Unlike aes_gcm_encrypt(), the input is not limited to
+ *        GCM_MAX_DATA_LEN bytes, and its chunks are spread across the cipher
+ *        threads.
+ *
+ * Parameters are as described for aes_gcm_encrypt().
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_encrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData,
+                           size_t inData_len, unsigned char **outData,
+                           size_t * outData_len);
+
+/**
+ * @brief In-memory form of the AES/GCM stream decryption, matching the
+ *        kmyth cipher interface. inData holds header||chunks.
+ *
+ * Parameters are as described for aes_gcm_decrypt().
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_decrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData,
+                           size_t inData_len, unsigned char **outData,
+                           size_t * outData_len);
+
+/**
+ * @brief Encrypts a run of consecutive chunks of an AES/GCM stream (see
+ *        aes_gcm_stream_init_header()) from one caller buffer into
+ *        another, on the calling thread and without allocating any buffer
+ *        of the size of the data. A stream can be encrypted in any number
+ *        of such calls, each starting where the last one ended, so that a
+ *        caller only ever needs a run's worth of data at hand.
+ *
+ * @param[in]  key         The hex bytes containing the key
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  header      Stream header from aes_gcm_stream_init_header()
+ *
+ * @param[in]  first_chunk Index in the stream of the run's first chunk
+ *
+ * @param[in]  final       Whether the run ends the stream. Only then may
+ *                         in_len be other than a multiple of the chunk size
+ *                         (or 0).
+ *
+ * @param[in]  in          The plaintext of the run
+ *
+ * @param[in]  in_len      The length in bytes of in
+ *
+ * @param[out] out         Buffer receiving the encrypted chunks
+ *
+ * @param[in]  out_size    Size of out, at least in_len plus GCM_TAG_LEN per
+ *                         chunk
+ *
+ * @param[out] out_len     The length in bytes of the encrypted chunks
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_encrypt_chunks(unsigned char *key, size_t key_len,
+                                  const unsigned char *header,
+                                  uint32_t first_chunk, bool final,
+                                  const unsigned char *in, size_t in_len,
+                                  unsigned char *out, size_t out_size,
+                                  size_t * out_len);
+
+/**
+ * @brief Decrypts a run of consecutive chunks of an AES/GCM stream, as
+ *        encrypted by aes_gcm_stream_encrypt_chunks() or any of the other
+ *        stream functions. Every chunk of the run is authenticated, and if
+ *        any fails out is cleared. As for aes_gcm_stream_decrypt_file(), the
+ *        stream is only known to be complete once its final run decrypts.
+ *
+ * @param[in]  in          The encrypted chunks of the run (each chunk
+ *                         size plus GCM_TAG_LEN bytes, but for a shorter
+ *                         final chunk)
+ *
+ * @param[in]  out_size    Size of out, at least in_len less GCM_TAG_LEN per
+ *                         chunk
+ *
+ * The other parameters and the return value are those of
+ * aes_gcm_stream_encrypt_chunks().
+ */
+int aes_gcm_stream_decrypt_chunks(unsigned char *key, size_t key_len,
+                                  const unsigned char *header,
+                                  uint32_t first_chunk, bool final,
+                                  const unsigned char *in, size_t in_len,
+                                  unsigned char *out, size_t out_size,
+                                  size_t * out_len);
+
 #endif
@@ -0,0 +1,136 @@
+/**
+ * @file aes_gcm_siv.h
+ *
+ * @brief Provides access to OpenSSL's AES-GCM-SIV (RFC 8452) implementation
+ *        for kmyth, used as a deterministic, nonce-misuse-resistant cipher.
+ */
+#ifndef AES_GCM_SIV_H
+#define AES_GCM_SIV_H
+
+#include <stdlib.h>
+
+#include <openssl/opensslv.h>
+
+#include "cipher/cipher.h"
+
+/// Defined when the OpenSSL in use provides AES-GCM-SIV (3.2 and newer)
+#if OPENSSL_VERSION_NUMBER >= 0x30200000L
+#define KMYTH_HAVE_AES_GCM_SIV 1
+#endif
+
+/// Length of the AES-GCM-SIV key (only the 256-bit variant is offered)
+#define AES_GCM_SIV_KEY_LEN 32
+
+/// Length of the AES-GCM-SIV nonce
+#define AES_GCM_SIV_NONCE_LEN 12
+
+/// Length of the AES-GCM-SIV authentication tag
+#define AES_GCM_SIV_TAG_LEN 16
+
+/**
+ * @brief This function uses the AES-GCM-SIV implementation from OpenSSL to
+ *        encrypt data deterministically: the nonce is fixed (all zero), so
+ *        encrypting the same data under the same key always produces the
+ *        same output. GCM-SIV stays secure under nonce reuse, leaking only
+ *        whether two plaintexts are equal, which is what allows sealed
+ *        payloads to be deduplicated.
+ *
+ * <pre>
+ * The outData block has the form
+ *    nonce||data||tag
+ * where
+ *      the nonce is 12 (AES_GCM_SIV_NONCE_LEN) bytes in length and
+ *      the tag is 16 (AES_GCM_SIV_TAG_LEN) bytes in length.
+ * </pre>
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData      The plaintext data to be encrypted -
+ *                         pass in pointer to input plaintext data buffer
+ *
+ * @param[in]  inData_len  The length, in bytes, of the plaintext data
+ *                         (must not be zero)
+ *
+ * @param[out] outData     The output ciphertext (including the nonce and
+ *                         tag) - pass in pointer to address of ciphertext
+ *                         buffer
+ *
+ * @param[out] outData_len The length in bytes of outData -
+ *                         pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error (including an OpenSSL without
+ *         AES-GCM-SIV)
+ */
+int aes_gcm_siv_encrypt(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData,
+                        size_t inData_len, unsigned char **outData,
+                        size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_siv_encrypt(), but reuses the OpenSSL state held
+ *        by a cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         aes_gcm_siv_encrypt()
+ *
+ * The other parameters and the return value are those of
+ * aes_gcm_siv_encrypt().
+ */
+int aes_gcm_siv_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                            unsigned char *key,
+                            size_t key_len,
+                            unsigned char *inData,
+                            size_t inData_len, unsigned char **outData,
+                            size_t * outData_len);
+
+/**
+ * @brief This function uses the AES-GCM-SIV implementation from OpenSSL to
+ *        decrypt data. Any nonce carried by the input is accepted.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData      The nonce, ciphertext, and tag,
+ *                         formatted nonce||ciphertext||tag -
+ *                         pass in pointer to input values
+ *
+ * @param[in]  inData_len  The length in bytes of inData
+ *
+ * @param[out] outData     The output plaintext -
+ *                         passed as pointer to address of output buffer
+ *
+ * @param[out] outData_len The length in bytes of outData
+ *                         passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_siv_decrypt(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData,
+                        size_t inData_len, unsigned char **outData,
+                        size_t * outData_len);
+
+/**
+ * @brief Same as aes_gcm_siv_decrypt(), but reuses the OpenSSL state held
+ *        by a cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         aes_gcm_siv_decrypt()
+ *
+ * The other parameters and the return value are those of
+ * aes_gcm_siv_decrypt().
+ */
+int aes_gcm_siv_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                            unsigned char *key,
+                            size_t key_len,
+                            unsigned char *inData,
+                            size_t inData_len, unsigned char **outData,
+                            size_t * outData_len);
+
+#endif
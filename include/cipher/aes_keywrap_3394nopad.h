@@ -8,6 +8,8 @@
 
 #include <stdlib.h>
 
+#include "cipher/cipher.h"
+
 /**
  * @brief This function uses OpenSSL to perform AES key wrap without padding
  *        (RFC 3394).
@@ -37,6 +39,24 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
                                   size_t inData_len, unsigned char **outData,
                                   size_t * outData_len);
 
+/**
+ * @brief Same as aes_keywrap_3394nopad_encrypt(), but reuses the OpenSSL
+ *        state held by a cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         aes_keywrap_3394nopad_encrypt()
+ *
+ * The other parameters and the return value are those of
+ * aes_keywrap_3394nopad_encrypt().
+ */
+int aes_keywrap_3394nopad_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      unsigned char *inData,
+                                      size_t inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len);
+
 /**
  * @brief This function uses OpenSSL to perform AES key unwrap without padding
  *        (RFC 3394).
@@ -66,4 +86,86 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
                                   size_t inData_len, unsigned char **outData,
                                   size_t * outData_len);
 
+/**
+ * @brief Same as aes_keywrap_3394nopad_decrypt(), but reuses the OpenSSL
+ *        state held by a cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         aes_keywrap_3394nopad_decrypt()
+ *
+ * The other parameters and the return value are those of
+ * aes_keywrap_3394nopad_decrypt().
+ */
+int aes_keywrap_3394nopad_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      unsigned char *inData,
+                                      size_t inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len);
+
+/**
+ * @brief Wraps a batch of inputs under the same key (RFC 3394). The key
+ *        schedule is set up once for the whole batch instead of once per
+ *        input, which matters when many data keys share one KEK.
+ *
+ * @param[in]  key         The AES key (KEK) - pass in pointer to key value
+ *
+ * @param[in]  key_len     The length (in bytes) of the AES key
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  count       The number of inputs in the batch
+ *
+ * @param[in]  inData      Array of count plaintext buffers to be wrapped
+ *
+ * @param[in]  inData_len  Array of count plaintext lengths (in bytes), each
+ *                         subject to the rules of aes_keywrap_3394nopad_encrypt()
+ *
+ * @param[out] outData     Array of count entries, each set to a newly
+ *                         allocated buffer holding the wrapped input
+ *
+ * @param[out] outData_len Array of count entries, each set to the length of
+ *                         the matching outData buffer
+ *
+ * @return 0 on success, 1 on error. On error no output buffer is returned:
+ *         the whole batch fails if any of its inputs cannot be wrapped.
+ */
+int aes_keywrap_3394nopad_encrypt_batch(unsigned char *key, size_t key_len,
+                                        size_t count, unsigned char **inData,
+                                        size_t *inData_len,
+                                        unsigned char **outData,
+                                        size_t *outData_len);
+
+/**
+ * @brief Unwraps a batch of inputs under the same key (RFC 3394), setting up
+ *        the key schedule once for the whole batch.
+ *
+ * @param[in]  key         The AES key (KEK) - pass in pointer to key value
+ *
+ * @param[in]  key_len     The length (in bytes) of the AES key
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  count       The number of inputs in the batch
+ *
+ * @param[in]  inData      Array of count wrapped buffers to be unwrapped
+ *
+ * @param[in]  inData_len  Array of count wrapped lengths (in bytes), each
+ *                         subject to the rules of aes_keywrap_3394nopad_decrypt()
+ *
+ * @param[out] outData     Array of count entries, each set to a newly
+ *                         allocated buffer holding the unwrapped input
+ *
+ * @param[out] outData_len Array of count entries, each set to the length of
+ *                         the matching outData buffer
+ *
+ * @return 0 on success, 1 on error. On error no output buffer is returned:
+ *         the whole batch fails if any of its inputs does not unwrap (for
+ *         example because its integrity check fails).
+ */
+int aes_keywrap_3394nopad_decrypt_batch(unsigned char *key, size_t key_len,
+                                        size_t count, unsigned char **inData,
+                                        size_t *inData_len,
+                                        unsigned char **outData,
+                                        size_t *outData_len);
+
 #endif
@@ -0,0 +1,221 @@
+/**
+ * @file chacha20_poly1305.h
+ *
+ * @brief Provides access to OpenSSL's ChaCha20-Poly1305 (RFC 8439)
+ *        implementation for kmyth.
+ */
+#ifndef CHACHA20_POLY1305_H
+#define CHACHA20_POLY1305_H
+
+#include <stdlib.h>
+
+#include "cipher/cipher.h"
+
+/// Length of the ChaCha20-Poly1305 key (256 bits, the only size defined)
+#define CHACHA20_POLY1305_KEY_LEN 32
+
+/// Length of the Poly1305 authentication tag
+#define CHACHA20_POLY1305_TAG_LEN 16
+
+/// Length of the ChaCha20-Poly1305 nonce (96 bits, as specified by RFC 8439)
+#define CHACHA20_POLY1305_NONCE_LEN 12
+
+/// Largest plaintext encrypted under one nonce, 2^32 64-byte blocks less
+/// the one used for the Poly1305 key (see RFC 8439, section 2.8)
+#define CHACHA20_POLY1305_MAX_DATA_LEN ((((size_t) 1) << 38) - 64)
+
+/**
+ * @brief This function uses the ChaCha20-Poly1305 implementation from
+ *        OpenSSL to encrypt data. On hosts without AES hardware support it
+ *        is considerably faster than AES/GCM.
+ *
+ * <pre>
+ * The outData block has the form
+ *    nonce||data||tag
+ * where
+ *      the nonce is 12 (CHACHA20_POLY1305_NONCE_LEN) bytes in length and
+ *      the tag is 16 (CHACHA20_POLY1305_TAG_LEN) bytes in length.
+ * </pre>
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData      The plaintext data to be encrypted -
+ *                         pass in pointer to input plaintext data buffer
+ *
+ * @param[in]  inData_len  The length, in bytes, of the plaintext data
+ *
+ * @param[out] outData     The output ciphertext (including the nonce and
+ *                         tag) - pass in pointer to address of ciphertext
+ *                         buffer
+ *
+ * @param[out] outData_len The length in bytes of outData -
+ *                         pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_encrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData,
+                              size_t inData_len, unsigned char **outData,
+                              size_t * outData_len);
+
+/**
+ * @brief Same as chacha20_poly1305_encrypt(), but reuses the OpenSSL state
+ *        held by a cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         chacha20_poly1305_encrypt()
+ *
+ * The other parameters and the return value are those of
+ * chacha20_poly1305_encrypt().
+ */
+int chacha20_poly1305_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                                  unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData,
+                                  size_t inData_len, unsigned char **outData,
+                                  size_t * outData_len);
+
+/**
+ * @brief Same as chacha20_poly1305_encrypt_ctx(), but writes the result
+ *        into a buffer supplied by the caller instead of allocating one.
+ *
+ * @param[in]  cctx         Cipher context, or NULL
+ *
+ * @param[in]  key          The hex bytes containing the key
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *
+ * @param[in]  inData       The plaintext data to be encrypted
+ *
+ * @param[in]  inData_len   The length, in bytes, of the plaintext data
+ *
+ * @param[out] outData      Buffer receiving nonce||ciphertext||tag. Its
+ *                          ciphertext part may be the inData buffer itself
+ *                          (outData + CHACHA20_POLY1305_NONCE_LEN == inData).
+ *
+ * @param[in]  outData_size Size of outData, at least
+ *                          inData_len + CHACHA20_POLY1305_NONCE_LEN +
+ *                          CHACHA20_POLY1305_TAG_LEN
+ *
+ * @param[out] outData_len  The length in bytes of the result
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_encrypt_into(kmyth_cipher_ctx * cctx,
+                                   unsigned char *key,
+                                   size_t key_len,
+                                   unsigned char *inData, size_t inData_len,
+                                   unsigned char *outData, size_t outData_size,
+                                   size_t * outData_len);
+
+/**
+ * @brief This function uses the ChaCha20-Poly1305 implementation from
+ *        OpenSSL to decrypt data.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData      The nonce, ciphertext, and tag,
+ *                         formatted nonce||ciphertext||tag -
+ *                         pass in pointer to input values
+ *
+ * @param[in]  inData_len  The length in bytes of inData
+ *
+ * @param[out] outData     The output plaintext -
+ *                         passed as pointer to address of output buffer
+ *
+ * @param[out] outData_len The length in bytes of outData
+ *                         passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_decrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData,
+                              size_t inData_len, unsigned char **outData,
+                              size_t * outData_len);
+
+/**
+ * @brief Same as chacha20_poly1305_decrypt(), but reuses the OpenSSL state
+ *        held by a cipher context (see kmyth_cipher_ctx in cipher.h).
+ *
+ * @param[in]  cctx        Cipher context, or NULL for the behavior of
+ *                         chacha20_poly1305_decrypt()
+ *
+ * The other parameters and the return value are those of
+ * chacha20_poly1305_decrypt().
+ */
+int chacha20_poly1305_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                                  unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData,
+                                  size_t inData_len, unsigned char **outData,
+                                  size_t * outData_len);
+
+/**
+ * @brief Same as chacha20_poly1305_decrypt_ctx(), but writes the plaintext
+ *        into a buffer supplied by the caller instead of allocating one. If
+ *        the tag does not verify, the plaintext part of outData is cleared.
+ *
+ * @param[in]  cctx         Cipher context, or NULL
+ *
+ * @param[in]  key          The hex bytes containing the key
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *
+ * @param[in]  inData       The input, formatted nonce||ciphertext||tag
+ *
+ * @param[in]  inData_len   The length in bytes of inData
+ *
+ * @param[out] outData      Buffer receiving the plaintext. It may be the
+ *                          ciphertext part of inData itself
+ *                          (outData == inData + CHACHA20_POLY1305_NONCE_LEN).
+ *
+ * @param[in]  outData_size Size of outData, at least
+ *                          inData_len - (CHACHA20_POLY1305_NONCE_LEN +
+ *                          CHACHA20_POLY1305_TAG_LEN)
+ *
+ * @param[out] outData_len  The length in bytes of the plaintext
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_decrypt_into(kmyth_cipher_ctx * cctx,
+                                   unsigned char *key,
+                                   size_t key_len,
+                                   unsigned char *inData, size_t inData_len,
+                                   unsigned char *outData, size_t outData_size,
+                                   size_t * outData_len);
+
+/**
+ * @brief Decrypts nonce||ciphertext||tag over its own buffer, leaving the
+ *        plaintext at the start of it, so no second buffer of the size of
+ *        the data is needed. If the tag does not verify, the ciphertext part
+ *        of the buffer is cleared.
+ *
+ * @param[in]     cctx          Cipher context, or NULL
+ *
+ * @param[in]     key           The hex bytes containing the key
+ *
+ * @param[in]     key_len       The length of the key in bytes
+ *
+ * @param[in,out] data          The input, replaced by the plaintext
+ *
+ * @param[in]     data_len      The length in bytes of the input
+ *
+ * @param[out]    plaintext_len The length in bytes of the plaintext
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_decrypt_in_place(kmyth_cipher_ctx * cctx,
+                                       unsigned char *key,
+                                       size_t key_len,
+                                       unsigned char *data, size_t data_len,
+                                       size_t * plaintext_len);
+
+#endif
@@ -8,11 +8,59 @@
 #ifndef CIPHER_H
 #define CIPHER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+#include <openssl/evp.h>
+
 // default cipher option used if the user does not specify symmetric cipher
 #define KMYTH_DEFAULT_CIPHER "AES/GCM/NoPadding/256"
 
+// cipher option that picks the fastest authenticated cipher for the host CPU
+// (see kmyth_select_auto_cipher())
+#define KMYTH_AUTO_CIPHER "auto"
+
+// default cipher used when sealing a file as a stream (see aes_gcm.h)
+#define KMYTH_DEFAULT_STREAM_CIPHER "AES/GCM-STREAM/NoPadding/256"
+
+// largest number of threads a streaming cipher may use
+#define KMYTH_MAX_CIPHER_THREADS 64
+
+// CPU crypto acceleration reported by kmyth_cpu_crypto_features()
+#define KMYTH_CPU_AES        0x1 // AES rounds (AES-NI, ARMv8 AES)
+#define KMYTH_CPU_CLMUL      0x2 // carry-less multiply (PCLMULQDQ, PMULL)
+#define KMYTH_CPU_VAES       0x4 // vector AES (VAES)
+#define KMYTH_CPU_VPCLMULQDQ 0x8 // vector carry-less multiply (VPCLMULQDQ)
+
+/**
+ * OpenSSL cipher implementations used by the kmyth ciphers. Each one is
+ * resolved (fetched from the default provider) once per process, see
+ * kmyth_get_evp_cipher().
+ */
+typedef enum
+{
+  KMYTH_EVP_AES_128_GCM,
+  KMYTH_EVP_AES_192_GCM,
+  KMYTH_EVP_AES_256_GCM,
+  KMYTH_EVP_AES_128_WRAP,
+  KMYTH_EVP_AES_192_WRAP,
+  KMYTH_EVP_AES_256_WRAP,
+  KMYTH_EVP_AES_128_WRAP_PAD,
+  KMYTH_EVP_AES_192_WRAP_PAD,
+  KMYTH_EVP_AES_256_WRAP_PAD,
+  KMYTH_EVP_CHACHA20_POLY1305,
+  KMYTH_EVP_AES_256_GCM_SIV,
+  KMYTH_EVP_CIPHER_COUNT
+} kmyth_evp_cipher_id;
+
+/**
+ * Reusable cipher state (an OpenSSL EVP_CIPHER_CTX) shared by successive
+ * encrypt/decrypt calls, so that decrypting many small secrets back to back
+ * does not allocate and set up a new OpenSSL context for each of them. A
+ * cipher context must not be used by more than one thread at a time.
+ */
+typedef struct kmyth_cipher_ctx kmyth_cipher_ctx;
+
 /**
  * All data encryption methods must be implemented with encrypt/decrypt
  * functions matching this declaration.
@@ -45,6 +93,44 @@ typedef int (*cipher) (unsigned char *key,
                        size_t inData_len,
                        unsigned char **outData, size_t * outData_len);
 
+/**
+ * Encryption/decryption functions that can reuse the state held by a cipher
+ * context take it as an additional first parameter. A NULL cipher context
+ * gives the behavior of the corresponding cipher function.
+ */
+typedef int (*cipher_with_ctx) (kmyth_cipher_ctx * cctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len,
+                                unsigned char **outData,
+                                size_t * outData_len);
+
+/**
+ * Ciphers that can decrypt over the input buffer itself (see
+ * aes_gcm_decrypt_in_place()) implement this declaration. The plaintext
+ * replaces the input, starting at its first byte.
+ *
+ * @param[in]     cctx       Cipher context, or NULL
+ *
+ * @param[in]     key        The hex bytes containing the key
+ *
+ * @param[in]     key_len    The length of the key in bytes
+ *
+ * @param[in,out] data       The data to be decrypted, replaced by the result
+ *
+ * @param[in]     data_len   The length of the data in bytes
+ *
+ * @param[out]    result_len The length of the result in bytes
+ *
+ * @return 0 on success, 1 on error.
+ */
+typedef int (*cipher_in_place) (kmyth_cipher_ctx * cctx,
+                                unsigned char *key,
+                                size_t key_len,
+                                unsigned char *data,
+                                size_t data_len, size_t * result_len);
+
 /**
  * cipher_t:
  *
@@ -64,6 +150,26 @@ typedef struct
 
   /** @brief A pointer to the appropriate decryption function. */
   cipher decrypt_fn;
+
+  /**
+   * @brief Variants of encrypt_fn/decrypt_fn taking a cipher context, or
+   *        NULL for ciphers that manage their own OpenSSL state.
+   */
+  cipher_with_ctx encrypt_ctx_fn;
+  cipher_with_ctx decrypt_ctx_fn;
+
+  /**
+   * @brief A pointer to the in-place decryption function, or NULL for
+   *        ciphers that cannot decrypt over their input.
+   */
+  cipher_in_place decrypt_in_place_fn;
+
+  /**
+   * @brief Cipher context used by kmyth_encrypt_data() and
+   *        kmyth_decrypt_data(), or NULL. Set by the caller; it is never
+   *        part of a .ski file.
+   */
+  kmyth_cipher_ctx *ctx;
 } cipher_t;
 
 /**
@@ -74,7 +180,9 @@ typedef struct
  *                           that was used to encrypt the data
  * 
  * @return The appropriate cipher_t structure, which has
- *         NULL cipher_name on failure.
+ *         NULL cipher_name on failure. KMYTH_AUTO_CIPHER ("auto") yields
+ *         the cipher chosen by kmyth_select_auto_cipher(), so the concrete
+ *         cipher name is what gets recorded with the encrypted data.
  */
 cipher_t kmyth_get_cipher_t_from_string(char *cipher_string);
 
@@ -88,6 +196,151 @@ cipher_t kmyth_get_cipher_t_from_string(char *cipher_string);
  */
 size_t get_key_len_from_cipher(cipher_t cipher);
 
+/**
+ * @brief Tells whether a cipher is a streaming (chunked) cipher, whose
+ *        encrypted data can be produced and consumed a chunk at a time
+ *        (see aes_gcm_stream_encrypt_file()).
+ *
+ * @param[in]  cipher The relevant cipher_t structure
+ *
+ * @return true for a streaming cipher, false otherwise
+ */
+bool kmyth_cipher_is_stream(cipher_t cipher);
+
+/**
+ * @brief Returns the OpenSSL implementation of a cipher. It is fetched the
+ *        first time it is needed and then held for the life of the process,
+ *        so later calls cost no provider lookup (on OpenSSL 3, the implicit
+ *        fetch done by EVP_aes_256_gcm() and friends on every
+ *        EVP_EncryptInit_ex() is comparatively expensive). Safe to call from
+ *        several threads.
+ *
+ * @param[in]  id            The cipher implementation wanted
+ *
+ * @return The EVP_CIPHER, or NULL if it is not available
+ */
+const EVP_CIPHER *kmyth_get_evp_cipher(kmyth_evp_cipher_id id);
+
+/**
+ * @brief Creates a cipher context (see kmyth_cipher_ctx).
+ *
+ * @param[out] cctx          Pointer to the new cipher context handle
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_cipher_ctx_create(kmyth_cipher_ctx ** cctx);
+
+/**
+ * @brief Releases a cipher context and sets its handle to NULL. A NULL
+ *        handle is ignored.
+ *
+ * @param[in,out] cctx       Pointer to the cipher context handle
+ */
+void kmyth_cipher_ctx_destroy(kmyth_cipher_ctx ** cctx);
+
+/**
+ * @brief Provides the OpenSSL context a cipher function works with: the
+ *        one held by cctx, or a newly allocated one if cctx is NULL. Must
+ *        be paired with kmyth_cipher_ctx_release().
+ *
+ * @param[in]  cctx          Cipher context, or NULL
+ *
+ * @return The OpenSSL context (uninitialized), or NULL on error
+ */
+EVP_CIPHER_CTX *kmyth_cipher_ctx_acquire(kmyth_cipher_ctx * cctx);
+
+/**
+ * @brief Runs EVP_CipherUpdate() over a buffer of any size, in pieces of
+ *        at most KMYTH_MAX_IO_CHUNK bytes. For the AEAD ciphers (one call
+ *        or several makes no difference to the result) this lifts the
+ *        INT_MAX limit of a single update.
+ *
+ * @param[in]  ctx           Initialized OpenSSL cipher context
+ *
+ * @param[out] out           Output buffer (may be the same as in)
+ *
+ * @param[in]  in            Input data
+ *
+ * @param[in]  in_len        Number of bytes of input
+ *
+ * @param[out] out_len       Number of bytes written to out
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_cipher_update(EVP_CIPHER_CTX * ctx, unsigned char *out,
+                        const unsigned char *in, size_t in_len,
+                        size_t * out_len);
+
+/**
+ * @brief Ends the use of an OpenSSL context obtained from
+ *        kmyth_cipher_ctx_acquire(). A context held by cctx is reset, which
+ *        also clears the key schedule, and kept for the next call; any
+ *        other one is freed.
+ *
+ * @param[in]  cctx          Cipher context passed to
+ *                           kmyth_cipher_ctx_acquire(), or NULL
+ *
+ * @param[in]  evp_ctx       OpenSSL context to release
+ */
+void kmyth_cipher_ctx_release(kmyth_cipher_ctx * cctx,
+                              EVP_CIPHER_CTX * evp_ctx);
+
+/**
+ * @brief Sets the number of threads used by streaming (segmented) ciphers
+ *        to encrypt and decrypt chunks in parallel, for this process. The
+ *        other ciphers encrypt their input as one unit and always use a
+ *        single thread. Should be set before any encryption is started.
+ *
+ * @param[in]  threads       Number of threads (1 to KMYTH_MAX_CIPHER_THREADS),
+ *                           or 0 for one per online CPU
+ *
+ * @return 0 on success, 1 on error
+ */
+int set_cipher_threads(size_t threads);
+
+/**
+ * @brief Retrieves the number of threads used by streaming ciphers (see
+ *        set_cipher_threads()). Defaults to 1.
+ *
+ * @return The number of threads
+ */
+size_t get_cipher_threads(void);
+
+/**
+ * @brief Probes the CPU for the instructions that accelerate the kmyth
+ *        ciphers (AES-NI, PCLMULQDQ, VAES and VPCLMULQDQ on x86, the ARMv8
+ *        Crypto Extensions AES and PMULL on ARM). The probe runs once per
+ *        process.
+ *
+ * @return Bitwise OR of the KMYTH_CPU_* flags found, 0 if none (or on an
+ *         architecture that is not probed)
+ */
+unsigned int kmyth_cpu_crypto_features(void);
+
+/**
+ * @brief Formats CPU crypto features as a human-readable list using the
+ *        instruction names of the host architecture, e.g. "AES-NI
+ *        PCLMULQDQ" on x86 or "AES PMULL" on ARM.
+ *
+ * @param[in]  features          Bitwise OR of KMYTH_CPU_* flags
+ *
+ * @param[out] buf               Buffer receiving the NUL-terminated list
+ *                               ("none" if no flag is set)
+ *
+ * @param[in]  buf_len           Size of buf in bytes
+ */
+void kmyth_cpu_crypto_features_string(unsigned int features, char *buf,
+                                      size_t buf_len);
+
+/**
+ * @brief Picks the fastest authenticated cipher in cipher_list for the
+ *        host CPU: AES-256-GCM when both AES and carry-less multiply are
+ *        accelerated, ChaCha20-Poly1305 (which needs neither) otherwise.
+ *
+ * @return The cipher name, from cipher_list
+ */
+const char *kmyth_select_auto_cipher(void);
+
 /**
  * @brief Performs the symmetric encryption specified by the caller.
  *
@@ -121,6 +374,34 @@ int kmyth_encrypt_data(unsigned char *data,
                        size_t * enc_data_size, unsigned char **enc_key,
                        size_t * enc_key_size);
 
+/**
+ * @brief Performs the symmetric encryption specified by the caller, under a
+ *        key supplied by the caller instead of a newly generated one.
+ *
+ * @param[in]  data          Input data to be encrypted
+ *
+ * @param[in]  data_size     Size, in bytes, of the input data
+ *
+ * @param[in]  cipher_spec   Struct (cipher_t) specifying cipher to use
+ *
+ * @param[in]  key           Key to encrypt the data with
+ *
+ * @param[in]  key_size      Size, in bytes, of the key
+ *
+ * @param[out] enc_data      Output (encrypted) result
+ *
+ * @param[out] enc_data_size Size, in bytes, of the encrypted result
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_encrypt_data_with_key(unsigned char *data,
+                                size_t data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size,
+                                unsigned char **enc_data,
+                                size_t * enc_data_size);
+
 /**
  * @brief Performs the symmetric decryption specified by the caller.
  *
@@ -147,4 +428,32 @@ int kmyth_decrypt_data(unsigned char *enc_data,
                        size_t key_size,
                        unsigned char **result, size_t * result_size);
 
+/**
+ * @brief Performs the symmetric decryption specified by the caller over the
+ *        encrypted data buffer itself, so that decrypting a large payload
+ *        needs no second buffer of its size. On success the plaintext
+ *        occupies the first result_size bytes of enc_data.
+ *
+ * @param[in,out] enc_data      Input data to be decrypted, replaced by the
+ *                              decrypted data
+ *
+ * @param[in]     enc_data_size Size, in bytes, of the input data
+ *
+ * @param[in]     cipher_spec   Struct (cipher_t) specifying cipher to use.
+ *                              Its decrypt_in_place_fn must be set.
+ *
+ * @param[in]     key           Key that was used to encrypt enc_data
+ *
+ * @param[in]     key_size      Size, in bytes, of the key
+ *
+ * @param[out]    result_size   Size of the decrypted data
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_decrypt_data_in_place(unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size, size_t * result_size);
+
 #endif /* CIPHER_H */
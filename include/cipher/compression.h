@@ -0,0 +1,171 @@
+/**
+ * @file  compression.h
+ *
+ * @brief Provides the optional compression stage of the seal pipeline:
+ *        data is compressed before it is encrypted and decompressed after
+ *        it is decrypted, and the algorithm used is recorded in the .ski.
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Compression algorithms. The value is recorded (by name) in the
+ *        .ski of compressed data only, so a .ski without one is never
+ *        compressed.
+ */
+typedef enum
+{
+  KMYTH_COMPRESSION_NONE = 0,
+
+  // zlib format deflate (RFC 1950), which carries its own checksum
+  KMYTH_COMPRESSION_DEFLATE = 1
+} kmyth_compression;
+
+// name of KMYTH_COMPRESSION_DEFLATE in .ski files and on command lines
+#define KMYTH_COMPRESSION_DEFLATE_NAME "deflate"
+
+// name of KMYTH_COMPRESSION_NONE on command lines
+#define KMYTH_COMPRESSION_NONE_NAME "none"
+
+/**
+ * @brief Sets the compression applied to data sealed by this process (data
+ *        already sealed always unseals with the compression its .ski
+ *        records).
+ *
+ * @param[in]  compression   Compression algorithm
+ *
+ * @return 0 on success, 1 on error
+ */
+int set_compression(kmyth_compression compression);
+
+/**
+ * @brief Retrieves the compression applied to sealed data (see
+ *        set_compression()). Defaults to KMYTH_COMPRESSION_NONE.
+ *
+ * @return The compression algorithm
+ */
+kmyth_compression get_compression(void);
+
+/**
+ * @brief Retrieves the name of a compression algorithm.
+ *
+ * @param[in]  compression   Compression algorithm
+ *
+ * @return The name, or NULL for an unknown algorithm
+ */
+const char *kmyth_compression_name(kmyth_compression compression);
+
+/**
+ * @brief Looks up a compression algorithm by name.
+ *
+ * @param[in]  name          Name of the algorithm (see
+ *                           KMYTH_COMPRESSION_DEFLATE_NAME)
+ *
+ * @param[out] compression   The algorithm
+ *
+ * @return 0 on success, 1 if the name is unknown
+ */
+int kmyth_compression_from_name(const char *name,
+                                kmyth_compression * compression);
+
+/**
+ * @brief Compresses a buffer as a whole.
+ *
+ * @param[in]  compression   Compression algorithm (not
+ *                           KMYTH_COMPRESSION_NONE)
+ *
+ * @param[in]  in            The data to compress
+ *
+ * @param[in]  in_len        The length in bytes of in
+ *
+ * @param[out] out           The compressed data (allocated here)
+ *
+ * @param[out] out_len       The length in bytes of out
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_compress_data(kmyth_compression compression,
+                        const uint8_t * in, size_t in_len,
+                        uint8_t ** out, size_t *out_len);
+
+/**
+ * @brief Decompresses a buffer compressed by kmyth_compress_data(). Every
+ *        intermediate output buffer is cleared before it is freed, as the
+ *        output is (sealed) plaintext.
+ *
+ * @param[in]  compression   Compression algorithm the data was compressed
+ *                           with (not KMYTH_COMPRESSION_NONE)
+ *
+ * @param[in]  in            The compressed data
+ *
+ * @param[in]  in_len        The length in bytes of in
+ *
+ * @param[out] out           The decompressed data (allocated here)
+ *
+ * @param[out] out_len       The length in bytes of out
+ *
+ * @return 0 on success, 1 on error (including truncated or trailing data)
+ */
+int kmyth_decompress_data(kmyth_compression compression,
+                          const uint8_t * in, size_t in_len,
+                          uint8_t ** out, size_t *out_len);
+
+/**
+ * @brief Opaque handle of a compression stage run on its own thread between
+ *        a file and a streaming cipher (see kmyth_compression_pipe_start()).
+ */
+typedef struct kmyth_compression_pipe kmyth_compression_pipe;
+
+/**
+ * @brief Starts a thread that compresses or decompresses a file through a
+ *        pipe, so that a streaming cipher (see aes_gcm_stream_encrypt_file())
+ *        can read or write the other end of the pipe as if it were the file
+ *        itself. The (de)compression then runs alongside the cipher
+ *        threads, and neither side is ever held in memory as a whole.
+ *
+ * @param[in]  compression   Compression algorithm (not
+ *                           KMYTH_COMPRESSION_NONE)
+ *
+ * @param[in]  compress      true to compress file (read until end of file)
+ *                           into the pipe, false to decompress what is
+ *                           written to the pipe into file
+ *
+ * @param[in]  file          The plaintext input (compress) or output
+ *                           (decompress). It remains the caller's to close
+ *                           after kmyth_compression_pipe_finish().
+ *
+ * @param[out] pipe_end      The end of the pipe for the caller: the
+ *                           compressed data to read (compress), or the
+ *                           destination of the compressed data
+ *                           (decompress). Closed by
+ *                           kmyth_compression_pipe_finish().
+ *
+ * @param[out] stage         Handle of the running stage
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_compression_pipe_start(kmyth_compression compression,
+                                 bool compress, FILE * file,
+                                 FILE ** pipe_end,
+                                 kmyth_compression_pipe ** stage);
+
+/**
+ * @brief Closes the caller's end of the pipe, waits for the stage to end,
+ *        and releases it. Must be called once the caller is done with the
+ *        pipe, whether or not it succeeded. A decompressing stage fails
+ *        unless it was given exactly one complete compressed stream, so a
+ *        truncated stream is never taken for a whole one.
+ *
+ * @param[in,out] stage      Handle of the stage, set to NULL
+ *
+ * @return 0 if the whole file was (de)compressed, 1 on error
+ */
+int kmyth_compression_pipe_finish(kmyth_compression_pipe ** stage);
+
+#endif /* COMPRESSION_H */
@@ -75,6 +75,33 @@
 #define KMYTH_DEFAULT_SEAL_OUT_EXT "ski"
 #define KMYTH_DEFAULT_SEAL_OUT_EXT_LEN 3
 
+/**
+ * @brief Default and maximum number of files kmyth-reseal reads or writes
+ *        at once when re-sealing a directory of .ski files (-d/--dir).
+ */
+#define KMYTH_RESEAL_DEFAULT_JOBS 16
+#define KMYTH_RESEAL_MAX_JOBS 64
+
+/**
+ * @brief Maximum number of files kmyth-verify checks at once (-j/--jobs).
+ *        It defaults to the number of online CPUs.
+ */
+#define KMYTH_VERIFY_MAX_JOBS 1024
+
+/**
+ * @brief Number of re-sealed files kmyth-reseal -d writes out between
+ *        flushes to disk (see commit_write_batch() in file_io.h).
+ */
+#define KMYTH_RESEAL_WRITE_BATCH 64
+
+/**
+ * @brief Largest number of bytes passed to a single OpenSSL call taking an
+ *        int length (BIO_read(), BIO_write(), EVP_CipherUpdate()). Larger
+ *        buffers are processed in pieces of (at most) this size, so data
+ *        sizes are not limited to INT_MAX.
+ */
+#define KMYTH_MAX_IO_CHUNK (1 << 30)
+
 
 /**
  * For TPM 2.0 Software Stack (TSS2) library calls where retries might be
@@ -145,6 +172,14 @@
  */
 #define KMYTH_DIGEST_SIZE TPM2_SHA256_DIGEST_SIZE
 
+/**
+ * @brief Number of PCRs assumed when authorization policies are computed
+ *        without a TPM (the PC Client platform specification requires 24
+ *        PCRs in a bank). The PCR count sets the size of the PCR selection
+ *        hashed into a PolicyPCR digest.
+ */
+#define KMYTH_DEFAULT_PCR_COUNT 24
+
 /**
  * TPM 2.0 public key algorithm options:
  * <UL>
@@ -324,4 +359,318 @@
  */
 #define KMYTH_GETKEY_RX_BUFFER_SIZE 16384
 
+/**
+ * @brief largest KMIP response message (in bytes) kmyth-getkey accepts
+ */
+#define KMYTH_KMIP_MAX_RESPONSE_SIZE (1024 * 1024)
+
+/**
+ * @brief length (in bytes) of a KMIP TTLV item header: a 3-byte tag, a
+ *        1-byte type and the 4-byte (big endian) length of the value
+ */
+#define KMIP_TTLV_HEADER_LEN 8
+
+/**
+ * @brief TTLV type code of a KMIP Structure (every KMIP message is one)
+ */
+#define KMIP_TTLV_TYPE_STRUCTURE 0x01
+
+/**
+ * @brief how long (in milliseconds) to wait for a key server's complete
+ *        response before giving up on it
+ */
+#define KMYTH_TLS_READ_TIMEOUT_MS 30000
+
+/**
+ * @brief how long (in milliseconds) to keep trying to connect to a key
+ *        server (or to any of a list of them) before giving up
+ */
+#define KMYTH_TLS_CONNECT_TIMEOUT_MS 15000
+
+/**
+ * @brief delay (in milliseconds) before kmyth-getkey, given several key
+ *        servers, starts connecting to the next one while earlier attempts
+ *        are still outstanding (see create_tls_connection_race())
+ */
+#define KMYTH_TLS_CONNECT_STAGGER_MS 250
+
+/**
+ * @brief most key servers kmyth-getkey accepts in its -c/--conn_addr list
+ */
+#define KMYTH_GETKEY_MAX_SERVERS 16
+
+/**
+ * @brief default time (in milliseconds) setup_client_socket() waits for a
+ *        connection to be established
+ */
+#define KMYTH_SOCKET_CONNECT_TIMEOUT_MS 15000
+
+/**
+ * @brief default time (in milliseconds) a blocking send or receive on a
+ *        socket from socket_util waits before failing
+ */
+#define KMYTH_SOCKET_IO_TIMEOUT_MS 30000
+
+/**
+ * @brief default idle time (in seconds) before a socket from socket_util
+ *        starts sending keepalive probes
+ */
+#define KMYTH_SOCKET_KEEPALIVE_IDLE 60
+
+/**
+ * @brief Number of key servers whose TLS sessions are kept for resumption
+ *        (see tls_load_session_cache())
+ */
+#define KMYTH_TLS_SESSION_CACHE_SIZE 16
+
+/**
+ * @brief Name of the environment variable that, if set, supplies the path
+ *        to kmyth-getkey's TLS session cache file (see the -r/--session_cache
+ *        option)
+ */
+#define KMYTH_TLS_SESSION_CACHE_ENV "KMYTH_TLS_SESSION_CACHE"
+
+/**
+ * @brief Name of the environment variable that, if set, supplies the path
+ *        to kmyth-getkey's local key cache file (see the --key_cache
+ *        option)
+ */
+#define KMYTH_KEY_CACHE_ENV "KMYTH_KEY_CACHE"
+
+/**
+ * @brief Lifetime (in seconds) of a key in kmyth-getkey's key cache unless
+ *        --key_cache_ttl gives another one
+ */
+#define KMYTH_KEY_CACHE_DEFAULT_TTL 3600
+
+/**
+ * @brief Name of the environment variable that, if set, supplies the path
+ *        to an SRK handle hint file. The hint lets a new process find the
+ *        storage root key with a single ReadPublic check instead of
+ *        scanning every persistent handle. The hint is only ever trusted
+ *        after it has been verified against the TPM.
+ */
+#define KMYTH_SRK_HINT_ENV "KMYTH_SRK_HINT_FILE"
+
+/**
+ * @brief Name of the environment variable that, if set, selects the TCTI
+ *        (TPM Command Transmission Interface) used to reach the TPM, using
+ *        the same "<name>[:<config>]" syntax as the -T/--tcti option (see
+ *        set_tcti_spec()). Defaults to KMYTH_DEFAULT_TCTI.
+ */
+#define KMYTH_TCTI_ENV "KMYTH_TCTI"
+
+/**
+ * @brief Name of the environment variable that, if set, selects the kernel
+ *        keyring unsealed data is cached in across processes, using the
+ *        same "<keyring>[:<timeout>]" syntax as the --keyring option (see
+ *        set_keyring_spec()). No caching is done by default.
+ */
+#define KMYTH_KEYRING_ENV "KMYTH_KEYRING"
+
+/**
+ * @brief Lifetime, in seconds, of unsealed data cached in a kernel keyring
+ *        unless the keyring selection gives one
+ */
+#define KMYTH_KEYRING_DEFAULT_TIMEOUT 60
+
+/**
+ * @brief Name of the environment variable that, if set, supplies the signed
+ *        policy file (or directory of them) used to unseal data sealed to
+ *        an authorizing key (see set_signed_policy_path())
+ */
+#define KMYTH_SIGNED_POLICY_ENV "KMYTH_SIGNED_POLICY"
+
+/**
+ * @brief Name of the environment variable that, if set, selects the TPM
+ *        scheduling class ("interactive", "normal" or "bulk") of threads
+ *        that have not chosen one (see set_default_tpm_priority()).
+ *        Defaults to "normal".
+ */
+#define KMYTH_TPM_PRIORITY_ENV "KMYTH_TPM_PRIORITY"
+
+/**
+ * @brief Longest time, in milliseconds, a normal priority TPM command waits
+ *        behind interactive ones before it is served anyway
+ */
+#define KMYTH_DEFAULT_NORMAL_MAX_WAIT_MS 250
+
+/**
+ * @brief Longest time, in milliseconds, a bulk priority TPM command waits
+ *        behind higher priority ones (of this or any other process) before
+ *        it is served anyway
+ */
+#define KMYTH_DEFAULT_BULK_MAX_WAIT_MS 2000
+
+/**
+ * @brief Name of the environment variable that, if set, names the directory
+ *        holding the lock files through which bulk TPM work of one process
+ *        yields to interactive and normal work of the others. Defaults to
+ *        KMYTH_DEFAULT_TPM_GATE_DIR.
+ */
+#define KMYTH_TPM_GATE_DIR_ENV "KMYTH_TPM_GATE_DIR"
+
+/**
+ * @brief Directory of the TPM scheduling lock files unless
+ *        KMYTH_TPM_GATE_DIR_ENV names another one
+ */
+#define KMYTH_DEFAULT_TPM_GATE_DIR "/tmp"
+
+/**
+ * @brief TCTI used when none is selected. "auto" talks directly to the
+ *        kernel resource manager (KMYTH_TPMRM_DEVICE) when it is accessible,
+ *        avoiding the D-Bus hop through tpm2-abrmd, and falls back to abrmd
+ *        otherwise.
+ */
+#define KMYTH_DEFAULT_TCTI "auto"
+
+/**
+ * @brief Kernel TPM 2.0 resource manager device node, used by the "device"
+ *        TCTI when no other device path is configured
+ */
+#define KMYTH_TPMRM_DEVICE "/dev/tpmrm0"
+
+/**
+ * @brief getopt_long() value of the long-only --stats option of the
+ *        command line tools (outside the range of short option characters)
+ */
+#define KMYTH_STATS_OPTION 0x100
+
+/**
+ * @brief getopt_long() value of the long-only --stream option of kmyth-seal
+ *        and kmyth-unseal
+ */
+#define KMYTH_STREAM_OPTION 0x101
+
+/**
+ * @brief getopt_long() value of the long-only --threads option of
+ *        kmyth-seal and kmyth-unseal
+ */
+#define KMYTH_THREADS_OPTION 0x102
+
+/**
+ * @brief getopt_long() value of the long-only --ski_v2 option of
+ *        kmyth-seal and kmyth-reseal
+ */
+#define KMYTH_SKI_V2_OPTION 0x103
+
+/**
+ * @brief getopt_long() value of the long-only --derive option of
+ *        kmyth-unseal
+ */
+#define KMYTH_DERIVE_OPTION 0x104
+
+/**
+ * @brief getopt_long() value of the long-only --derive_len option of
+ *        kmyth-unseal
+ */
+#define KMYTH_DERIVE_LEN_OPTION 0x105
+
+/**
+ * @brief getopt_long() value of the long-only --compress option of
+ *        kmyth-seal
+ */
+#define KMYTH_COMPRESS_OPTION 0x106
+
+/**
+ * @brief getopt_long() value of the long-only --exec option of
+ *        kmyth-unseal and kmyth-getkey
+ */
+#define KMYTH_EXEC_OPTION 0x107
+
+/**
+ * @brief getopt_long() value of the long-only --fd option of kmyth-unseal
+ *        and kmyth-getkey
+ */
+#define KMYTH_FD_OPTION 0x108
+
+/**
+ * @brief Descriptor on which a command run with --exec finds the unsealed
+ *        data (or key) unless --fd selects another one
+ */
+#define KMYTH_EXEC_DEFAULT_FD 3
+
+/**
+ * @brief getopt_long() value of the long-only --keyring option of
+ *        kmyth-unseal
+ */
+#define KMYTH_KEYRING_OPTION 0x109
+
+/**
+ * @brief getopt_long() value of the long-only --authorizing_key option of
+ *        kmyth-seal and kmyth-reseal
+ */
+#define KMYTH_AUTHORIZING_KEY_OPTION 0x10A
+
+/**
+ * @brief getopt_long() value of the long-only --signed_policy option of
+ *        kmyth-unseal and kmyth-reseal
+ */
+#define KMYTH_SIGNED_POLICY_OPTION 0x10B
+
+/**
+ * @brief getopt_long() value of the long-only --priority option of
+ *        kmyth-seal, kmyth-unseal and kmyth-reseal
+ */
+#define KMYTH_PRIORITY_OPTION 0x10C
+
+/**
+ * @brief getopt_long() values of the long-only --key_cache and
+ *        --key_cache_ttl options of kmyth-getkey
+ */
+#define KMYTH_KEY_CACHE_OPTION 0x10D
+#define KMYTH_KEY_CACHE_TTL_OPTION 0x10E
+
+/**
+ * @brief getopt_long() values of the long-only --incremental, --pcr_values
+ *        and --plan_only options of kmyth-reseal
+ */
+#define KMYTH_INCREMENTAL_OPTION 0x10F
+#define KMYTH_PCR_VALUES_OPTION 0x110
+#define KMYTH_PLAN_ONLY_OPTION 0x111
+
+/**
+ * @brief getopt_long() value of the long-only --policy_only option of
+ *        kmyth-reseal
+ */
+#define KMYTH_POLICY_ONLY_OPTION 0x112
+
+/**
+ * @brief Name of the environment variable that tells a command run with
+ *        --exec which descriptor holds the unsealed data (or key)
+ */
+#define KMYTH_EXEC_FD_ENV "KMYTH_FD"
+
+/**
+ * @brief Default length, in bytes, of the keys derived by
+ *        'kmyth-unseal --derive'
+ */
+#define KMYTH_DERIVE_DEFAULT_KEY_LEN 32
+
+/**
+ * @brief Largest .ski section accepted at the start of a streamed sealed
+ *        file (the .ski of a stream only holds keys, policy data and the
+ *        stream header, so it is small)
+ */
+#define KMYTH_STREAM_MAX_SKI_LEN 65536
+
+/**
+ * @brief Most key requests one NSL session key protects; the client runs a
+ *        new NSL handshake (rekeys) on the same connection before this many
+ *        requests have been sent under the current key
+ */
+#define KMYTH_NSL_SESSION_MAX_REQUESTS 1024
+
+/**
+ * @brief Longest time (in seconds) one NSL session key is used before the
+ *        client rekeys
+ */
+#define KMYTH_NSL_SESSION_MAX_AGE 600
+
+/**
+ * @brief Most key requests a client keeps outstanding (sent, with the
+ *        response not yet read) on one NSL session
+ */
+#define KMYTH_NSL_PIPELINE_DEPTH 16
+
 #endif // DEFINES_H
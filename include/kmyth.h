@@ -3,19 +3,172 @@
  *
  * @brief Provides library headers for Kmyth seal/unseal functionality using
  *        TPM 2.0. Provides library headers for Kmyth logging.
+ *
+ * Output buffers that the caller frees come from the allocation hooks set
+ * by kmyth_set_allocator() (see memory_util.h), and are released with
+ * kmyth_free() or kmyth_clear_and_free().
+
+ *
+ * The seal/unseal functions may be called from several threads at once.
+ * Each call (or Kmyth context) holds its own TPM connection, and the
+ * connections to one TPM take turns in a submission queue, so that only
+ * TPM commands are serialized; cipher, encoding and file work proceed in
+ * parallel on the calling threads. Process-wide settings (set_tcti_spec(),
+ * set_srk_hint_path(), set_signed_policy_path(), ...) are meant to be made
+ * before such calls start; set_tcti_spec() alone may be called at any time.
  */
 
 #ifndef KMYTH_H
 #define KMYTH_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
+
+/**
+ * @brief Opaque handle to a reusable Kmyth context.
+ *
+ * A context holds an open connection to the TPM 2.0 resource manager.
+ * Applications that seal or unseal many objects can create one context,
+ * pass it to the *_ctx variants of the seal/unseal functions below, and
+ * destroy it when done, rather than connecting to (and disconnecting
+ * from) the TPM on every call. A context must not be used by more than
+ * one thread at a time, but each thread may hold its own context, bound
+ * to the same or to a different TPM (see kmyth_ctx_create_tcti()).
+ */
+  typedef struct kmyth_ctx kmyth_ctx_t;
+
+/**
+ * @brief Creates a Kmyth context and opens its TPM 2.0 connection.
+ *
+ * @param[out] ctx               Pointer to the context handle to be created.
+ *                               Set to NULL on error. The caller must
+ *                               release it with kmyth_ctx_destroy().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_create(kmyth_ctx_t ** ctx);
+
+/**
+ * @brief Creates a Kmyth context whose TPM 2.0 connection uses the given
+ *        TCTI specification, so that one process can use several TPMs.
+ *
+ * @param[out] ctx               Pointer to the context handle to be created.
+ *                               Set to NULL on error. The caller must
+ *                               release it with kmyth_ctx_destroy().
+ *
+ * @param[in]  tcti_spec         TCTI specification (e.g., "device:/dev/tpmrm1"
+ *                               or "mssim:host=localhost,port=2421"), or
+ *                               NULL for the process default (as used by
+ *                               kmyth_ctx_create())
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_create_tcti(kmyth_ctx_t ** ctx, const char *tcti_spec);
+
+/**
+ * @brief Closes the TPM 2.0 connection held by a Kmyth context and frees
+ *        the context. A NULL context is ignored.
+ *
+ * @param[in,out] ctx            Pointer to the context handle to be
+ *                               destroyed. Set to NULL on return.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_destroy(kmyth_ctx_t ** ctx);
+
+/**
+ * @brief Selects how seal operations on a Kmyth context compute the
+ *        authorization policy digest for the objects they create.
+ *
+ * By default the digest is obtained from a TPM trial session. When
+ * software computation is enabled it is instead computed on the host
+ * from the PCR values returned by TPM2_PCR_Read, which avoids starting
+ * a session. Either way, the result is cached per context, keyed by
+ * PCR selection, PCR values and policy-OR branch.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  bool_software     1 to compute policy digests in software,
+ *                               0 to use TPM trial sessions (default)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_software_policy(kmyth_ctx_t * ctx, uint8_t bool_software);
+
+/**
+ * @brief Enables (or disables) a bounded cache of unsealed secrets on a
+ *        Kmyth context, for workloads that unseal the same .ski repeatedly.
+ *
+ * Entries are keyed by a digest of the .ski bytes and the authorization
+ * values, held in mlock()ed memory, and wiped when they are evicted, when
+ * they expire, when the PCR values of their .ski change, and when the
+ * context is destroyed. Only tpm2_kmyth_unseal_ctx() consults the cache.
+ * Changing the settings discards any cached secrets.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  max_entries       Maximum number of cached secrets
+ *                               (0 disables the cache)
+ *
+ * @param[in]  max_bytes         Maximum total size of the cached secrets
+ *
+ * @param[in]  ttl_seconds       Lifetime of a cached secret in seconds
+ *                               (0 for no time limit)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_secret_cache(kmyth_ctx_t * ctx, size_t max_entries,
+                                 size_t max_bytes, unsigned int ttl_seconds);
+
+/**
+ * @brief Sets the wrapping key used by seal operations on a Kmyth context,
+ *        instead of a fresh random key per seal.
+ *
+ * With a deterministic cipher (AES/GCM-SIV/NoPadding/256 or AES key wrap),
+ * sealing the same data twice under the same wrapping key yields the same
+ * encrypted payload, so a content-addressed store can deduplicate it. The
+ * rest of the .ski (the TPM-sealed copy of the key) still differs between
+ * seals. Only use a shared key for data that may be linked this way, such
+ * as the blobs of one tenant. Re-seals keep the key they find, and
+ * tpm2_kmyth_seal_stream() always uses a random key.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  key               Wrapping key, copied into the context, or
+ *                               NULL to go back to random keys
+ *
+ * @param[in]  key_len           Length of key in bytes, which must match the
+ *                               key length of the cipher used to seal
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_wrapping_key(kmyth_ctx_t * ctx, const uint8_t * key,
+                                 size_t key_len);
+
 /**
- * @brief High-level function implementing kmyth-seal using TPM 2.0.
+ * @brief Retrieves the hit and miss counts of a context's secret cache.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[out] hits              Number of unseals served from the cache
+ *
+ * @param[out] misses            Number of unseals that went to the TPM
+ *                               while the cache was enabled
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_get_secret_cache_stats(kmyth_ctx_t * ctx,
+                                       uint64_t * hits, uint64_t * misses);
+/**
+ * @brief High-level function implementing kmyth-seal using TPM 2.0. If a
+ *        compression is set (see set_compression() in
+ *        cipher/compression.h), the input is compressed before it is
+ *        encrypted, and is decompressed again when it is unsealed.
  *
  * @param[in]  input             Raw bytes to be kmyth-sealed
  *
@@ -52,9 +205,10 @@ extern "C"
  *                               for encrypting the input data. Must be NULL 
  *                               or '\0' terminated
  *
- * @param[in]  expected_policy   Optional string indicating an alternative
- *                               policy digest to be used for authorizing
- *                               actions
+ * @param[in]  expected_policy   Optional string indicating alternative
+ *                               policy digests to be used for authorizing
+ *                               actions (hex, comma-separated, at most
+ *                               KMYTH_MAX_POLICY_BRANCHES - 1 of them)
  *
  *
  * @return 0 on success, 1 on error
@@ -67,7 +221,12 @@ extern "C"
                       char *expected_policy, uint8_t bool_trial_only);
 
 /**
- * @brief High-level function implementing kmyth-unseal using TPM 2.0.
+ * @brief High-level function implementing kmyth-unseal using TPM 2.0. If
+ *        a kernel keyring is selected (see set_keyring_spec() in
+ *        tpm/kmyth_keyring.h), a result cached there by any process of the
+ *        user is returned without connecting to the TPM, and a result from
+ *        the TPM is cached there for the next caller. The PCR policy is
+ *        not checked again while a cached result lasts.
  *
  *
  * @param[in]  input             Raw data to be kmyth-sealed
@@ -100,6 +259,58 @@ extern "C"
                         uint8_t * owner_auth_bytes, size_t oa_bytes_len,
                         uint8_t bool_policy_or);
 
+/**
+ * @brief High-level function implementing kmyth-reseal using TPM 2.0.
+ *        Re-seals existing .ski data to a new storage key and authorization
+ *        policy (e.g., a new PCR selection) using a single TPM connection.
+ *
+ * When the cipher is unchanged, only the symmetric wrapping key is
+ * unsealed and re-sealed; the encrypted data is carried over as is, so
+ * the cost does not depend on the size of the sealed data and no
+ * plaintext copy of it is made.
+ *
+ * @param[in]  input             Bytes in .ski format to be re-sealed
+ *
+ * @param[in]  input_len         Number of bytes in input
+ *
+ * @param[out] output            Re-sealed result in .ski format
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * @param[in]  auth_bytes        Authorization bytes for both the existing
+ *                               and the new Kmyth TPM objects
+ *
+ * @param[in]  auth_bytes_len    Number of bytes in auth_bytes
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @param[in]  pcrs              Array containing the PCR index selections,
+ *                               if any, for the new authorization policy
+ *
+ * @param[in]  pcrs_len          The length of pcrs
+ *
+ * @param[in]  cipher_string     Symmetric cipher for the re-sealed data.
+ *                               NULL keeps the input's cipher (and its
+ *                               encrypted data); any other cipher causes
+ *                               the data to be decrypted and re-encrypted.
+ *
+ * @param[in]  expected_policy   Optional alternative policy digests for the
+ *                               new authorization policy (policy-OR)
+ *
+ * @param[in]  bool_policy_or    1 if the input was sealed with a policy-OR
+ *                               (expected policy), 0 otherwise
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_reseal(uint8_t * input, size_t input_len,
+                        uint8_t ** output, size_t *output_len,
+                        uint8_t * auth_bytes, size_t auth_bytes_len,
+                        uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                        int *pcrs, size_t pcrs_len, char *cipher_string,
+                        char *expected_policy, uint8_t bool_policy_or);
+
 /**
  * @brief High-level function implementing kmyth-seal for files using TPM 2.0.
  *        The kmyth-seal input data is read from the specified file.
@@ -135,9 +346,10 @@ extern "C"
  *                               for encrypting the input data. Must be NULL
  *                               or '\0' terminated
  *
- * @param[in]  expected_policy   Optional string indicating an alternative
- *                               policy digest to be used for authorizing
- *                               actions
+ * @param[in]  expected_policy   Optional string indicating alternative
+ *                               policy digests to be used for authorizing
+ *                               actions (hex, comma-separated, at most
+ *                               KMYTH_MAX_POLICY_BRANCHES - 1 of them)
  *
  * @return 0 on success, 1 on error
  */
@@ -148,9 +360,175 @@ extern "C"
                            int *pcrs, size_t pcrs_len, char *cipher_string,
                            char *expected_policy, uint8_t bool_trial_only);
 
+/**
+ * @brief High-level function implementing kmyth-seal for a batch of inputs
+ *        using TPM 2.0. A single storage key, authorization policy, and
+ *        policy session are shared by all of the inputs, which avoids
+ *        repeating the (slow) storage key creation for every input. Each
+ *        input still gets its own wrapping key and its own .ski output.
+ *
+ * @param[in]  count             Number of inputs to be kmyth-sealed
+ *
+ * @param[in]  inputs            Array of count raw byte buffers to be
+ *                               kmyth-sealed
+ *
+ * @param[in]  input_lens        Array of count input buffer sizes
+ *
+ * @param[out] outputs           Array of count buffers that receive the
+ *                               sealed data in ski format (caller frees)
+ *
+ * @param[out] output_lens       Array of count output buffer sizes
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error (on error, no outputs are returned)
+ */
+  int tpm2_kmyth_seal_batch(size_t count,
+                            uint8_t ** inputs, size_t *input_lens,
+                            uint8_t ** outputs, size_t *output_lens,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len, char *cipher_string,
+                            char *expected_policy);
+
+/**
+ * @brief High-level function implementing kmyth-unseal for a batch of .ski
+ *        inputs using TPM 2.0. Inputs sealed under the same authorization
+ *        policy share a single policy session, and inputs sealed under the
+ *        same storage key share a single load of that key. A failure to
+ *        unseal one item does not abort the rest of the batch.
+ *
+ * @param[in]  count             Number of .ski inputs to be kmyth-unsealed
+ *
+ * @param[in]  inputs            Array of count buffers holding .ski bytes
+ *
+ * @param[in]  input_lens        Array of count input buffer sizes
+ *
+ * @param[out] outputs           Array of count buffers that receive the
+ *                               decrypted results (caller frees). Failed
+ *                               items are set to NULL.
+ *
+ * @param[out] output_lens       Array of count decrypted result sizes
+ *
+ * @param[out] results           Array of count per-item status values
+ *                               (0 if that item was unsealed, 1 if not)
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 if every item was unsealed, 1 if any item (or the batch) failed
+ */
+  int tpm2_kmyth_unseal_batch(size_t count,
+                              uint8_t ** inputs, size_t *input_lens,
+                              uint8_t ** outputs, size_t *output_lens,
+                              int *results,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              uint8_t bool_policy_or);
+
+/**
+ * @brief Computes, entirely in software, the authorization policy digest
+ *        that kmyth-seal gives objects sealed to a set of PCRs, from PCR
+ *        values supplied by the caller (e.g., the known-good values of a
+ *        remote host). No TPM is needed, so a central server can compute
+ *        (-g) or check (-e) the policies of many hosts quickly.
+ *
+ * @param[in]  pcrs              Array of PCRs the policy is bound to (as
+ *                               for tpm2_kmyth_seal()), NULL for none
+ *
+ * @param[in]  pcrs_len          Length of the pcrs array
+ *
+ * @param[in]  pcr_values        Concatenated SHA-256 values of the selected
+ *                               PCRs (32 bytes each), in ascending PCR
+ *                               order, NULL if no PCR is selected
+ *
+ * @param[in]  pcr_values_len    Number of bytes in pcr_values
+ *
+ * @param[in]  expected_policy   Optional further policy-OR branches (hex
+ *                               string, as for tpm2_kmyth_seal()), or NULL
+ *
+ * @param[out] policy_string     Hex string of the resulting policy digest
+ *                               (caller frees). Without expected_policy this
+ *                               is the digest printed by kmyth-seal -g;
+ *                               with it, the compound (PolicyOR) digest.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_compute_policy(int *pcrs, size_t pcrs_len,
+                           uint8_t * pcr_values, size_t pcr_values_len,
+                           char *expected_policy, char **policy_string);
+
+/**
+ * @brief Endpoint affinity value for a sharded unseal job that may run on
+ *        any TPM endpoint
+ */
+#define KMYTH_ANY_ENDPOINT SIZE_MAX
+
+/**
+ * @brief Seals a batch of inputs across several TPMs. Each TPM endpoint is
+ *        served by its own thread and Kmyth context; inputs are spread
+ *        evenly over the endpoints, and an endpoint that runs out of work
+ *        takes queued inputs from the others. A failure to seal one item
+ *        does not abort the rest of the batch.
+ *
+ * @param[in]  endpoint_count    Number of TPM endpoints
+ *
+ * @param[in]  tcti_specs        Array of endpoint_count TCTI specifications
+ *                               (see kmyth_ctx_create_tcti())
+ *
+ * @param[out] results           Array of count per-item status values
+ *                               (0 if that item was sealed, 1 if not)
+ *
+ * @param[out] endpoints         Array of count endpoint indices, set to the
+ *                               TPM endpoint that sealed each item (only
+ *                               that TPM can unseal it), or NULL
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_batch().
+ *
+ * @return 0 if every item was sealed, 1 if any item (or the batch) failed
+ */
+  int tpm2_kmyth_seal_sharded(size_t endpoint_count, const char **tcti_specs,
+                              size_t count,
+                              uint8_t ** inputs, size_t *input_lens,
+                              uint8_t ** outputs, size_t *output_lens,
+                              int *results, size_t *endpoints,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              int *pcrs, size_t pcrs_len, char *cipher_string,
+                              char *expected_policy);
+
+/**
+ * @brief Unseals a batch of .ski inputs across several TPMs, as for
+ *        tpm2_kmyth_seal_sharded(). Inputs with an endpoint affinity are
+ *        only ever unsealed by that TPM; the others may run on any of them.
+ *
+ * @param[in]  endpoint_count    Number of TPM endpoints
+ *
+ * @param[in]  tcti_specs        Array of endpoint_count TCTI specifications
+ *                               (see kmyth_ctx_create_tcti())
+ *
+ * @param[in]  endpoints         Array of count endpoint indices (e.g., as
+ *                               returned by tpm2_kmyth_seal_sharded()), or
+ *                               KMYTH_ANY_ENDPOINT for items that may run
+ *                               anywhere. NULL if no item has an affinity.
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_batch().
+ *
+ * @return 0 if every item was unsealed, 1 if any item (or the batch) failed
+ */
+  int tpm2_kmyth_unseal_sharded(size_t endpoint_count,
+                                const char **tcti_specs, size_t count,
+                                uint8_t ** inputs, size_t *input_lens,
+                                uint8_t ** outputs, size_t *output_lens,
+                                int *results, const size_t *endpoints,
+                                uint8_t * auth_bytes, size_t auth_bytes_len,
+                                uint8_t * owner_auth_bytes,
+                                size_t oa_bytes_len, uint8_t bool_policy_or);
+
 /**
  * @brief High-level function implementing kmyth-unseal for files using TPM 2.0.
- *        The kmyth-unseal input data is read from the specified file.
+ *        The kmyth-unseal input data is read from the specified file, then
+ *        unsealed as by tpm2_kmyth_unseal() (kernel keyring cache
+ *        included).
  *
  * @param[in]  input_path        Path to input .ski file
  *                               (passed as a string)
@@ -180,6 +558,453 @@ extern "C"
                              uint8_t * auth_bytes, size_t auth_bytes_len,
                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
                              uint8_t policy_or);
+
+/**
+ * @brief Same as tpm2_kmyth_seal(), but uses the TPM 2.0 connection held
+ *        by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_ctx(kmyth_ctx_t * ctx,
+                          uint8_t * input, size_t input_len,
+                          uint8_t ** output, size_t *output_len,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                          int *pcrs, size_t pcrs_len, char *cipher_string,
+                          char *expected_policy, uint8_t bool_trial_only);
+
+/**
+ * @brief Same as tpm2_kmyth_seal_batch(), but uses the TPM 2.0 connection
+ *        held by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_batch().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_batch_ctx(kmyth_ctx_t * ctx, size_t count,
+                                uint8_t ** inputs, size_t *input_lens,
+                                uint8_t ** outputs, size_t *output_lens,
+                                uint8_t * auth_bytes, size_t auth_bytes_len,
+                                uint8_t * owner_auth_bytes,
+                                size_t oa_bytes_len, int *pcrs,
+                                size_t pcrs_len, char *cipher_string,
+                                char *expected_policy);
+
+/**
+ * @brief Same as tpm2_kmyth_unseal(), but uses the TPM 2.0 connection held
+ *        by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_ctx(kmyth_ctx_t * ctx,
+                            uint8_t * input, size_t input_len,
+                            uint8_t ** output, size_t *output_len,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            uint8_t bool_policy_or);
+
+/**
+ * @brief Same as tpm2_kmyth_reseal(), but uses the TPM 2.0 connection held
+ *        by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_reseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_reseal_ctx(kmyth_ctx_t * ctx,
+                            uint8_t * input, size_t input_len,
+                            uint8_t ** output, size_t *output_len,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len, char *cipher_string,
+                            char *expected_policy, uint8_t bool_policy_or);
+
+/**
+ * @brief Same as tpm2_kmyth_unseal_batch(), but uses the TPM 2.0 connection
+ *        held by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_batch().
+ *
+ * @return 0 if every item was unsealed, 1 if any item (or the batch) failed
+ */
+  int tpm2_kmyth_unseal_batch_ctx(kmyth_ctx_t * ctx, size_t count,
+                                  uint8_t ** inputs, size_t *input_lens,
+                                  uint8_t ** outputs, size_t *output_lens,
+                                  int *results,
+                                  uint8_t * auth_bytes, size_t auth_bytes_len,
+                                  uint8_t * owner_auth_bytes,
+                                  size_t oa_bytes_len,
+                                  uint8_t bool_policy_or);
+
+/**
+ * @brief Same as tpm2_kmyth_seal_file(), but uses the TPM 2.0 connection
+ *        held by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_file().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_file_ctx(kmyth_ctx_t * ctx, char *input_path,
+                               uint8_t ** output, size_t *output_len,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len, int *pcrs,
+                               size_t pcrs_len, char *cipher_string,
+                               char *expected_policy, uint8_t bool_trial_only);
+
+/**
+ * @brief Same as tpm2_kmyth_unseal_file(), but uses the TPM 2.0 connection
+ *        held by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_file().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_file_ctx(kmyth_ctx_t * ctx, char *input_path,
+                                 uint8_t ** output, size_t *output_length,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t policy_or);
+
+/**
+ * @brief Implements kmyth-seal for files too large to hold in memory. The
+ *        input file is encrypted a chunk at a time with a streaming cipher
+ *        (AES/GCM-STREAM, see aes_gcm.h), so memory use does not depend on
+ *        the file size and there is no 2 GB limit. The output file holds a
+ *        .ski whose encrypted data is only the stream header, followed by
+ *        the encrypted chunks, each written as soon as it is produced (the
+ *        last one is flagged as final). It can only be unsealed with
+ *        tpm2_kmyth_unseal_stream(). Either end may be a pipe, so sealing
+ *        e.g. a database dump on its way to storage needs constant memory.
+ *        A compression set with set_compression() runs on its own thread,
+ *        ahead of the cipher threads.
+ *
+ * @param[in]  input_path        Path to input data file, or NULL to read
+ *                               stdin
+ *
+ * @param[in]  output_path       Path of the sealed output file (created or
+ *                               replaced; removed again on error), or NULL
+ *                               to write to stdout (on error, whatever was
+ *                               already written lacks its final chunk and
+ *                               will not unseal)
+ *
+ * @param[in]  cipher_string     Streaming cipher to use, or NULL for
+ *                               KMYTH_DEFAULT_STREAM_CIPHER
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_stream(char *input_path, char *output_path,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len, char *cipher_string,
+                             char *expected_policy);
+
+/**
+ * @brief Unseals a file sealed by tpm2_kmyth_seal_stream(), decrypting it a
+ *        chunk at a time. Every chunk is authenticated before it is
+ *        written, and a truncated or altered file is reported as an error
+ *        (and the partial output file is removed).
+ *
+ * @param[in]  input_path        Path to the sealed input file, or NULL to
+ *                               read it from stdin
+ *
+ * @param[in]  output_path       Path of the unsealed output file (created or
+ *                               replaced), or NULL to write to stdout
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_stream(char *input_path, char *output_path,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len, uint8_t bool_policy_or);
+
+/**
+ * @brief Same as tpm2_kmyth_seal_stream(), but uses the TPM 2.0 connection
+ *        held by an existing Kmyth context instead of opening a new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_stream().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_stream_ctx(kmyth_ctx_t * ctx,
+                                 char *input_path, char *output_path,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, int *pcrs,
+                                 size_t pcrs_len, char *cipher_string,
+                                 char *expected_policy);
+
+/**
+ * @brief Same as tpm2_kmyth_unseal_stream(), but uses the TPM 2.0
+ *        connection held by an existing Kmyth context instead of opening a
+ *        new one.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_stream().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_stream_ctx(kmyth_ctx_t * ctx,
+                                   char *input_path, char *output_path,
+                                   uint8_t * auth_bytes,
+                                   size_t auth_bytes_len,
+                                   uint8_t * owner_auth_bytes,
+                                   size_t oa_bytes_len,
+                                   uint8_t bool_policy_or);
+
+/**
+ * @brief Opaque handle to an open envelope key (see kmyth_envelope_open()).
+ *
+ * In envelope mode a single TPM-sealed key encryption key (KEK) protects
+ * any number of data files. Each file carries its own random data
+ * encryption key (DEK), wrapped under the KEK with AES key wrap (RFC 5649),
+ * alongside its encrypted payload, so once the KEK has been unsealed,
+ * opening a file costs a software key unwrap instead of a TPM operation.
+ * An open envelope key must not be used by more than one thread at a time.
+ */
+  typedef struct kmyth_envelope kmyth_envelope_t;
+
+/**
+ * @brief Generates a new random envelope key encryption key (KEK) and
+ *        seals it to the TPM, as tpm2_kmyth_seal_ctx() does any input.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[out] output            The sealed KEK (.ski bytes, caller frees)
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_envelope_create_kek(kmyth_ctx_t * ctx,
+                                uint8_t ** output, size_t *output_len,
+                                uint8_t * auth_bytes, size_t auth_bytes_len,
+                                uint8_t * owner_auth_bytes,
+                                size_t oa_bytes_len, int *pcrs,
+                                size_t pcrs_len, char *expected_policy);
+
+/**
+ * @brief Unseals an envelope key encryption key (KEK) created by
+ *        kmyth_envelope_create_kek(), with a single TPM unseal, and keeps
+ *        it (in locked memory where possible) for kmyth_envelope_seal()
+ *        and kmyth_envelope_unseal() until kmyth_envelope_close().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *                               (only used during this call)
+ *
+ * @param[in]  kek_ski           The sealed KEK (.ski bytes)
+ *
+ * @param[in]  kek_ski_len       Number of bytes in kek_ski
+ *
+ * @param[out] env               The open envelope key
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_envelope_open(kmyth_ctx_t * ctx,
+                          uint8_t * kek_ski, size_t kek_ski_len,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                          uint8_t bool_policy_or, kmyth_envelope_t ** env);
+
+/**
+ * @brief Wipes and releases an open envelope key, and sets its handle to
+ *        NULL. A NULL handle is ignored.
+ *
+ * @param[in,out] env            Pointer to the envelope key handle
+ */
+  void kmyth_envelope_close(kmyth_envelope_t ** env);
+
+/**
+ * @brief Encrypts data under a new random data encryption key (DEK) and
+ *        wraps the DEK under an open envelope key. No TPM is involved.
+ *
+ * @param[in]  env               Envelope key from kmyth_envelope_open()
+ *
+ * @param[in]  input             The data to protect
+ *
+ * @param[in]  input_len         Number of bytes in input
+ *
+ * @param[in]  cipher_string     Cipher for the data (NULL for
+ *                               KMYTH_DEFAULT_CIPHER)
+ *
+ * @param[out] output            The enveloped data (caller frees)
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_envelope_seal(kmyth_envelope_t * env,
+                          uint8_t * input, size_t input_len,
+                          char *cipher_string,
+                          uint8_t ** output, size_t *output_len);
+
+/**
+ * @brief Recovers data protected by kmyth_envelope_seal() under the same
+ *        envelope key. No TPM is involved.
+ *
+ * @param[in]  env               Envelope key from kmyth_envelope_open()
+ *
+ * @param[in]  input             The enveloped data
+ *
+ * @param[in]  input_len         Number of bytes in input
+ *
+ * @param[out] output            The data (caller frees, see
+ *                               kmyth_clear_and_free())
+ *
+ * @param[out] output_len        Number of bytes in output
+ *
+ * @return 0 on success, 1 on error (including data enveloped under another
+ *         KEK, or altered)
+ */
+  int kmyth_envelope_unseal(kmyth_envelope_t * env,
+                            uint8_t * input, size_t input_len,
+                            uint8_t ** output, size_t *output_len);
+
+/**
+ * @brief Largest key kmyth_derive_key() can derive (255 SHA-256 blocks,
+ *        the HKDF limit)
+ */
+#define KMYTH_DERIVE_MAX_KEY_LEN (255 * 32)
+
+/**
+ * @brief Derives a key from a sealed master secret with HKDF-SHA256
+ *        (RFC 5869), using label as the HKDF info, so that one sealed
+ *        master can stand in for many separately sealed keys (per table,
+ *        per tenant, ...). The same master and label always give the same
+ *        key, and different labels give independent keys.
+ *
+ * The master is unsealed on first use and then kept by the context (in
+ * its secure arena where it fits) for later calls with the same .ski and
+ * authorization, which need no TPM operation. PCR policy is therefore
+ * only checked when the master is unsealed. Calling with another master
+ * replaces the one held; kmyth_ctx_destroy() wipes it.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  sealed_master     The sealed master secret (.ski bytes)
+ *
+ * @param[in]  sealed_master_len Number of bytes in sealed_master
+ *
+ * @param[in]  label             Purpose of the key (NUL terminated, may be
+ *                               empty)
+ *
+ * @param[out] key               Buffer receiving the derived key
+ *
+ * @param[in]  key_len           Number of bytes of key to derive (1 to
+ *                               KMYTH_DERIVE_MAX_KEY_LEN)
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_derive_key(kmyth_ctx_t * ctx,
+                       uint8_t * sealed_master, size_t sealed_master_len,
+                       uint8_t * auth_bytes, size_t auth_bytes_len,
+                       uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                       uint8_t bool_policy_or, const char *label,
+                       uint8_t * key, size_t key_len);
+
+/**
+ * @brief Opaque handle to an open streamed sealed file (see
+ *        kmyth_sealed_reader_open()). A reader is not safe for concurrent
+ *        use: threads reading the same file should each open their own.
+ */
+  typedef struct kmyth_sealed_reader kmyth_sealed_reader_t;
+
+/**
+ * @brief Opens a file sealed by tpm2_kmyth_seal_stream() for random access
+ *        reads, so that a range of a large sealed file can be read without
+ *        decrypting everything before it.
+ *
+ * The wrapping key is unsealed once, here, and held (in locked memory
+ * where possible) until kmyth_sealed_reader_close(). Each chunk of the
+ * stream sits at a fixed offset in the file, so a read only decrypts the
+ * chunks it covers, and the few most recently read are kept decrypted for
+ * the reads that follow. The final chunk is decrypted here, so a file
+ * that has been truncated or extended fails to open, as does a file sealed
+ * with compression (see set_compression()), whose chunks do not map to
+ * plaintext offsets.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  input_path        Path to the sealed file (a regular file:
+ *                               not a pipe)
+ *
+ * @param[out] reader            The open reader (release it with
+ *                               kmyth_sealed_reader_close())
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_sealed_reader_open(kmyth_ctx_t * ctx, char *input_path,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len, uint8_t bool_policy_or,
+                               kmyth_sealed_reader_t ** reader);
+
+/**
+ * @brief Returns the size of the plaintext sealed in the file an open
+ *        reader reads (0 for a NULL reader).
+ */
+  uint64_t kmyth_sealed_reader_size(kmyth_sealed_reader_t * reader);
+
+/**
+ * @brief Reads up to len bytes of plaintext, starting at offset, from an
+ *        open sealed file. Every chunk read is authenticated; if one fails,
+ *        nothing is returned.
+ *
+ * @param[in]  reader            Reader opened by kmyth_sealed_reader_open()
+ *
+ * @param[out] buf               Buffer of at least len bytes
+ *
+ * @param[in]  len               Number of bytes to read
+ *
+ * @param[in]  offset            Offset in the plaintext of the first byte
+ *
+ * @param[out] read_len          Number of bytes read: len, or less if the
+ *                               plaintext ends first (0 at or past its end)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_sealed_reader_pread(kmyth_sealed_reader_t * reader,
+                                uint8_t * buf, size_t len, uint64_t offset,
+                                size_t *read_len);
+
+/**
+ * @brief Closes a reader opened by kmyth_sealed_reader_open(), wiping its
+ *        key and the plaintext it holds, and sets *reader to NULL.
+ */
+  void kmyth_sealed_reader_close(kmyth_sealed_reader_t ** reader);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,505 @@
+/**
+ * @file  kmyth.hpp
+ *
+ * @brief Provides a header-only C++20 interface to the Kmyth library
+ *        (kmyth.h): a RAII Kmyth context, and move-only buffers that wipe
+ *        the secrets they hold when they are destroyed.
+ *
+ * Inputs are taken as std::span, so any contiguous bytes (a std::vector, a
+ * std::array, a mapped file, ...) are passed to the library where they lie,
+ * without a copy. Results are handed over in the buffer the library
+ * allocated, also without a copy; SecureBuffer::rebind() moves one into a
+ * std::pmr memory resource when it should live elsewhere (e.g., an arena).
+ * Errors are reported by throwing kmyth::Error; the library logs the
+ * details.
+ */
+
+#ifndef KMYTH_HPP
+#define KMYTH_HPP
+
+#if __cplusplus < 202002L
+#error "kmyth.hpp requires C++20 (std::span)"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "kmyth.h"
+#include "memory_util.h"
+
+namespace kmyth
+{
+
+/**
+ * @brief Error reported by a Kmyth library call
+ */
+  class Error:public std::runtime_error
+  {
+  public:
+    explicit Error(const char *what):std::runtime_error(what)
+    {
+    }
+  };
+
+/**
+ * @brief Move-only byte buffer that is wiped (see kmyth_clear()) before its
+ *        memory is released. It either owns a buffer allocated by the Kmyth
+ *        library, or one allocated from a std::pmr memory resource.
+ */
+  class SecureBuffer
+  {
+  public:
+    SecureBuffer() noexcept = default;
+
+    /**
+     * @brief Allocates a zero-filled buffer from a memory resource.
+     */
+    explicit SecureBuffer(std::size_t size,
+                          std::pmr::memory_resource * mr =
+                          std::pmr::get_default_resource()):mr_(mr)
+    {
+      if (size > 0)
+      {
+        data_ = static_cast < std::uint8_t * >(mr_->allocate(size, 1));
+        size_ = size;
+        std::memset(data_, 0, size_);
+      }
+    }
+
+    SecureBuffer(const SecureBuffer &) = delete;
+    SecureBuffer & operator=(const SecureBuffer &) = delete;
+
+    SecureBuffer(SecureBuffer && other) noexcept
+      :data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      mr_(std::exchange(other.mr_, nullptr))
+    {
+    }
+
+    SecureBuffer & operator=(SecureBuffer && other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        mr_ = std::exchange(other.mr_, nullptr);
+      }
+      return *this;
+    }
+
+    ~SecureBuffer()
+    {
+      reset();
+    }
+
+    /**
+     * @brief Takes ownership of a buffer allocated by the Kmyth library
+     *        (e.g., the output of tpm2_kmyth_unseal_ctx()).
+     */
+    static SecureBuffer adopt(std::uint8_t * data, std::size_t size) noexcept
+    {
+      SecureBuffer buffer;
+
+      buffer.data_ = data;
+      buffer.size_ = (data == nullptr) ? 0 : size;
+      return buffer;
+    }
+
+    /**
+     * @brief Copies bytes into a buffer allocated from a memory resource.
+     */
+    static SecureBuffer copy_of(std::span < const std::uint8_t > bytes,
+                                std::pmr::memory_resource * mr =
+                                std::pmr::get_default_resource())
+    {
+      SecureBuffer buffer(bytes.size(), mr);
+
+      if (!bytes.empty())
+      {
+        std::memcpy(buffer.data_, bytes.data(), bytes.size());
+      }
+      return buffer;
+    }
+
+    /**
+     * @brief Moves the contents into a buffer allocated from a memory
+     *        resource, wiping and releasing the current one.
+     */
+    SecureBuffer rebind(std::pmr::memory_resource * mr) &&
+    {
+      SecureBuffer moved = copy_of(span(), mr);
+
+      reset();
+      return moved;
+    }
+
+    /**
+     * @brief Wipes and releases the buffer, leaving it empty.
+     */
+    void reset() noexcept
+    {
+      if (data_ == nullptr)
+      {
+        return;
+      }
+      if (mr_ == nullptr)
+      {
+        kmyth_clear_and_free(data_, size_);
+      }
+      else
+      {
+        kmyth_clear(data_, size_);
+        mr_->deallocate(data_, size_, 1);
+      }
+      data_ = nullptr;
+      size_ = 0;
+      mr_ = nullptr;
+    }
+
+    std::uint8_t *data() noexcept
+    {
+      return data_;
+    }
+    const std::uint8_t *data() const noexcept
+    {
+      return data_;
+    }
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    std::uint8_t *begin() noexcept
+    {
+      return data_;
+    }
+    std::uint8_t *end() noexcept
+    {
+      return data_ + size_;
+    }
+    const std::uint8_t *begin() const noexcept
+    {
+      return data_;
+    }
+    const std::uint8_t *end() const noexcept
+    {
+      return data_ + size_;
+    }
+
+    std::span < std::uint8_t > span() noexcept
+    {
+      return {data_, size_};
+    }
+    std::span < const std::uint8_t > span() const noexcept
+    {
+      return {data_, size_};
+    }
+    operator std::span < const std::uint8_t > () const noexcept
+    {
+      return span();
+    }
+
+  private:
+    std::uint8_t * data_ = nullptr;
+    std::size_t size_ = 0;
+
+    // resource the buffer came from, or nullptr for the Kmyth library
+    std::pmr::memory_resource * mr_ = nullptr;
+  };
+
+/**
+ * @brief Options of a seal (see tpm2_kmyth_seal())
+ */
+  struct SealOptions
+  {
+    std::span < const std::uint8_t > auth {};
+    std::span < const std::uint8_t > owner_auth {};
+    std::span < const int >pcrs {};
+
+    // cipher name, or nullptr for the default
+    const char *cipher = nullptr;
+
+    // comma-separated policy-OR branches, or nullptr for none
+    const char *expected_policy = nullptr;
+  };
+
+/**
+ * @brief Options of an unseal (see tpm2_kmyth_unseal())
+ */
+  struct UnsealOptions
+  {
+    std::span < const std::uint8_t > auth {};
+    std::span < const std::uint8_t > owner_auth {};
+    bool policy_or = false;
+  };
+
+  namespace detail
+  {
+    // the library reads, but never writes, the buffers it is given
+    inline std::uint8_t *in(std::span < const std::uint8_t > bytes) noexcept
+    {
+      return const_cast < std::uint8_t * >(bytes.data());
+    }
+    inline int *in(std::span < const int >values) noexcept
+    {
+      return const_cast < int *>(values.data());
+    }
+  }
+
+/**
+ * @brief Move-only owner of a Kmyth context (see kmyth_ctx_create()) and
+ *        the TPM 2.0 connection it holds. Like the context, an object must
+ *        not be used by more than one thread at a time.
+ */
+  class Context
+  {
+  public:
+    /**
+     * @brief Opens a context on the default TPM connection.
+     */
+    Context()
+    {
+      if (kmyth_ctx_create(&ctx_))
+      {
+        throw Error("unable to create Kmyth context");
+      }
+    }
+
+    /**
+     * @brief Opens a context on the TPM connection selected by a TCTI
+     *        specification (see kmyth_ctx_create_tcti()).
+     */
+    explicit Context(const char *tcti_spec)
+    {
+      if (kmyth_ctx_create_tcti(&ctx_, tcti_spec))
+      {
+        throw Error("unable to create Kmyth context");
+      }
+    }
+
+    Context(const Context &) = delete;
+    Context & operator=(const Context &) = delete;
+
+    Context(Context && other) noexcept
+      :ctx_(std::exchange(other.ctx_, nullptr))
+    {
+    }
+
+    Context & operator=(Context && other) noexcept
+    {
+      if (this != &other)
+      {
+        kmyth_ctx_destroy(&ctx_);
+        ctx_ = std::exchange(other.ctx_, nullptr);
+      }
+      return *this;
+    }
+
+    ~Context()
+    {
+      kmyth_ctx_destroy(&ctx_);
+    }
+
+    /**
+     * @brief Underlying context, for the calls not wrapped here
+     */
+    kmyth_ctx_t *get() const noexcept
+    {
+      return ctx_;
+    }
+
+    void set_software_policy(bool software)
+    {
+      check(kmyth_ctx_set_software_policy(ctx_, software ? 1 : 0),
+            "unable to set policy computation");
+    }
+
+    void set_secret_cache(std::size_t max_entries, std::size_t max_bytes,
+                          unsigned int ttl_seconds)
+    {
+      check(kmyth_ctx_set_secret_cache(ctx_, max_entries, max_bytes,
+                                       ttl_seconds),
+            "unable to set secret cache");
+    }
+
+    void set_wrapping_key(std::span < const std::uint8_t > key)
+    {
+      check(kmyth_ctx_set_wrapping_key(ctx_, key.data(), key.size()),
+            "unable to set wrapping key");
+    }
+
+    /**
+     * @brief Seals data (see tpm2_kmyth_seal_ctx()).
+     *
+     * @return the .ski bytes
+     */
+    SecureBuffer seal(std::span < const std::uint8_t > input,
+                      const SealOptions & options = {})
+    {
+      std::uint8_t * output = nullptr;
+      std::size_t output_len = 0;
+
+      check(tpm2_kmyth_seal_ctx(ctx_, detail::in(input), input.size(),
+                                &output, &output_len,
+                                detail::in(options.auth),
+                                options.auth.size(),
+                                detail::in(options.owner_auth),
+                                options.owner_auth.size(),
+                                detail::in(options.pcrs),
+                                options.pcrs.size(),
+                                const_cast < char *>(options.cipher),
+                                const_cast < char *>(options.expected_policy),
+                                0), "unable to seal data");
+      return SecureBuffer::adopt(output, output_len);
+    }
+
+    /**
+     * @brief Seals a file (see tpm2_kmyth_seal_file_ctx()).
+     *
+     * @return the .ski bytes
+     */
+    SecureBuffer seal_file(const char *input_path,
+                           const SealOptions & options = {})
+    {
+      std::uint8_t * output = nullptr;
+      std::size_t output_len = 0;
+
+      check(tpm2_kmyth_seal_file_ctx(ctx_, const_cast < char *>(input_path),
+                                     &output, &output_len,
+                                     detail::in(options.auth),
+                                     options.auth.size(),
+                                     detail::in(options.owner_auth),
+                                     options.owner_auth.size(),
+                                     detail::in(options.pcrs),
+                                     options.pcrs.size(),
+                                     const_cast < char *>(options.cipher),
+                                     const_cast <
+                                     char *>(options.expected_policy), 0),
+            "unable to seal file");
+      return SecureBuffer::adopt(output, output_len);
+    }
+
+    /**
+     * @brief Unseals .ski bytes (see tpm2_kmyth_unseal_ctx()).
+     *
+     * @return the unsealed data
+     */
+    SecureBuffer unseal(std::span < const std::uint8_t > ski,
+                        const UnsealOptions & options = {})
+    {
+      std::uint8_t * output = nullptr;
+      std::size_t output_len = 0;
+
+      check(tpm2_kmyth_unseal_ctx(ctx_, detail::in(ski), ski.size(),
+                                  &output, &output_len,
+                                  detail::in(options.auth),
+                                  options.auth.size(),
+                                  detail::in(options.owner_auth),
+                                  options.owner_auth.size(),
+                                  options.policy_or ? 1 : 0),
+            "unable to unseal data");
+      return SecureBuffer::adopt(output, output_len);
+    }
+
+    /**
+     * @brief Unseals a .ski file (see tpm2_kmyth_unseal_file_ctx()).
+     *
+     * @return the unsealed data
+     */
+    SecureBuffer unseal_file(const char *input_path,
+                             const UnsealOptions & options = {})
+    {
+      std::uint8_t * output = nullptr;
+      std::size_t output_len = 0;
+
+      check(tpm2_kmyth_unseal_file_ctx(ctx_,
+                                       const_cast < char *>(input_path),
+                                       &output, &output_len,
+                                       detail::in(options.auth),
+                                       options.auth.size(),
+                                       detail::in(options.owner_auth),
+                                       options.owner_auth.size(),
+                                       options.policy_or ? 1 : 0),
+            "unable to unseal file");
+      return SecureBuffer::adopt(output, output_len);
+    }
+
+    /**
+     * @brief Re-seals .ski bytes to a new storage key and policy (see
+     *        tpm2_kmyth_reseal_ctx()). The authorization values of the
+     *        options apply to both the input and the output.
+     *
+     * @return the new .ski bytes
+     */
+    SecureBuffer reseal(std::span < const std::uint8_t > ski,
+                        const SealOptions & options = {},
+                        bool input_policy_or = false)
+    {
+      std::uint8_t * output = nullptr;
+      std::size_t output_len = 0;
+
+      check(tpm2_kmyth_reseal_ctx(ctx_, detail::in(ski), ski.size(),
+                                  &output, &output_len,
+                                  detail::in(options.auth),
+                                  options.auth.size(),
+                                  detail::in(options.owner_auth),
+                                  options.owner_auth.size(),
+                                  detail::in(options.pcrs),
+                                  options.pcrs.size(),
+                                  const_cast < char *>(options.cipher),
+                                  const_cast <
+                                  char *>(options.expected_policy),
+                                  input_policy_or ? 1 : 0),
+            "unable to reseal data");
+      return SecureBuffer::adopt(output, output_len);
+    }
+
+    /**
+     * @brief Derives a key from a sealed master secret (see
+     *        kmyth_derive_key()), into a buffer allocated from a memory
+     *        resource.
+     *
+     * @return the derived key
+     */
+    SecureBuffer derive_key(std::span < const std::uint8_t > sealed_master,
+                            const char *label, std::size_t key_len,
+                            const UnsealOptions & options = {},
+                            std::pmr::memory_resource * mr =
+                            std::pmr::get_default_resource())
+    {
+      SecureBuffer key(key_len, mr);
+
+      check(kmyth_derive_key(ctx_, detail::in(sealed_master),
+                             sealed_master.size(),
+                             detail::in(options.auth), options.auth.size(),
+                             detail::in(options.owner_auth),
+                             options.owner_auth.size(),
+                             options.policy_or ? 1 : 0, label, key.data(),
+                             key.size()), "unable to derive key");
+      return key;
+    }
+
+  private:
+    static void check(int retval, const char *what)
+    {
+      if (retval != 0)
+      {
+        throw Error(what);
+      }
+    }
+
+    kmyth_ctx_t *ctx_ = nullptr;
+  };
+
+}                               // namespace kmyth
+
+#endif                          /* KMYTH_HPP */
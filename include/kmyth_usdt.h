@@ -0,0 +1,70 @@
+/**
+ * @file  kmyth_usdt.h
+ *
+ * @brief Provides the USDT (user-level statically defined tracing) probes
+ *        placed on Kmyth's hot paths, so that their latency can be measured
+ *        in production with bpftrace, perf or SystemTap, e.g.:
+ *
+ *          bpftrace -e 'usdt:./lib/libkmyth-tpm.so:kmyth:seal_data__entry
+ *                       { @start[tid] = nsecs; }
+ *                       usdt:./lib/libkmyth-tpm.so:kmyth:seal_data__return
+ *                       { @us = hist((nsecs - @start[tid]) / 1000); }'
+ *
+ *        A probe that is not being traced is a single nop instruction. The
+ *        probes are compiled in when <sys/sdt.h> (e.g., from the
+ *        systemtap-sdt-dev package) is available, unless KMYTH_NO_USDT is
+ *        defined ('make KMYTH_USDT=0'), and compile to nothing otherwise.
+ *
+ *        Probes (provider "kmyth") and their arguments:
+ *
+ *          seal_data__entry(sk_handle, data_len), seal_data__return(rc)
+ *          unseal_data__entry(sk_handle)
+ *          unseal_data__submit(rc, sdo_handle)
+ *          unseal_data__return(rc, sdo_handle, result_len)
+ *          tpm_command__entry(command_code, command_len)
+ *          tpm_command__return(command_code, response_code)
+ *          encrypt_data__entry(cipher_name, data_len)
+ *          encrypt_data__return(rc, enc_data_len)
+ *          decrypt_data__entry(cipher_name, enc_data_len)
+ *          decrypt_data__return(rc, result_len)
+ *          parse_ski__entry(ski_len), parse_ski__return(rc)
+ *          tls_connect__entry(server), tls_connect__return(rc)
+ *            (server is the first one raced, for a connection race)
+ *          nsl_client_handshake__entry(socket_fd)
+ *          nsl_client_handshake__return(rc)
+ *          nsl_server_handshake__entry(socket_fd)
+ *          nsl_server_handshake__return(rc)
+ *          nsl_server_respond__entry(request_len)
+ *          nsl_server_respond__return(rc)
+ *          nsl_server_finish__entry(confirmation_len)
+ *          nsl_server_finish__return(rc)
+ *
+ *        Unseals are split at the TPM so that several can be in flight on
+ *        one thread: pair unseal_data__submit with unseal_data__return by
+ *        sdo_handle rather than by thread. Every TPM 2.0 command (each
+ *        Tss2_Sys_* call) passes the tpm_command probes, which fire once the
+ *        command has its turn at the TPM, so they time the TPM alone.
+ */
+
+#ifndef KMYTH_USDT_H
+#define KMYTH_USDT_H
+
+#if !defined(KMYTH_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define KMYTH_USDT_ENABLED 1
+#endif
+#endif
+
+#ifdef KMYTH_USDT_ENABLED
+#define KMYTH_PROBE1(name, a) DTRACE_PROBE1(kmyth, name, a)
+#define KMYTH_PROBE2(name, a, b) DTRACE_PROBE2(kmyth, name, a, b)
+#define KMYTH_PROBE3(name, a, b, c) DTRACE_PROBE3(kmyth, name, a, b, c)
+#else
+#define KMYTH_PROBE1(name, a) do { (void) (a); } while (0)
+#define KMYTH_PROBE2(name, a, b) do { (void) (a); (void) (b); } while (0)
+#define KMYTH_PROBE3(name, a, b, c) \
+  do { (void) (a); (void) (b); (void) (c); } while (0)
+#endif
+
+#endif /* KMYTH_USDT_H */
@@ -7,6 +7,75 @@
 #ifndef SOCKET_UTIL_H
 #define SOCKET_UTIL_H
 
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Options for the TCP sockets made by setup_client_socket() and
+ *        setup_server_socket() (and for the connections a server accepts,
+ *        see apply_socket_options()). socket_options_init() fills in the
+ *        defaults, which are also used wherever no options are given.
+ */
+typedef struct socket_options
+{
+  /// send small messages at once (TCP_NODELAY), rather than holding them
+  /// back (Nagle's algorithm) until the last one is acknowledged
+  bool nodelay;
+
+  /// probe idle connections (SO_KEEPALIVE), so a peer that has gone away
+  /// is noticed
+  bool keepalive;
+
+  /// seconds a connection is idle before the first keepalive probe
+  unsigned int keepalive_idle;
+
+  /// milliseconds to wait for a connection to be established (0 to wait
+  /// as long as the system does)
+  unsigned int connect_timeout_ms;
+
+  /// milliseconds a blocking send or receive waits (SO_SNDTIMEO and
+  /// SO_RCVTIMEO) before failing (0 to wait indefinitely); not applied to
+  /// a listening socket
+  unsigned int io_timeout_ms;
+
+  /// let several processes bind the same port (SO_REUSEPORT), with the
+  /// system spreading connections across them
+  bool reuseport;
+
+  /// server: listen on one IPv6 socket that also accepts IPv4 connections
+  /// (falling back to IPv4 if IPv6 is unavailable); client: connect over
+  /// whichever of IPv6 and IPv4 the node resolves to, rather than only IPv4
+  bool dual_stack;
+} socket_options;
+
+/**
+ * <pre>
+ * This function fills in the default socket options: TCP_NODELAY,
+ * keepalive (probing after KMYTH_SOCKET_KEEPALIVE_IDLE seconds), connect
+ * and send/receive timeouts of KMYTH_SOCKET_CONNECT_TIMEOUT_MS and
+ * KMYTH_SOCKET_IO_TIMEOUT_MS, IPv6 dual-stack, and no SO_REUSEPORT.
+ * </pre>
+ *
+ * @param[out] opts  The options to fill in.
+ */
+void socket_options_init(socket_options * opts);
+
+/**
+ * <pre>
+ * This function applies the per-connection options (TCP_NODELAY,
+ * keepalive and send/receive timeouts) to a connected socket, e.g. one a
+ * server has accepted.
+ * </pre>
+ *
+ * @param[in]  socket_fd  Connected socket file descriptor.
+ *
+ * @param[in]  opts       The options to apply (NULL for the defaults).
+ *
+ * @return 0 on success, 1 on error
+ */
+int apply_socket_options(int socket_fd, const socket_options * opts);
+
 /**
  * <pre>
  * This function sets up a client socket for sending messages.
@@ -16,23 +85,114 @@
  *
  * @param[in]  service    The port number or service to bind to.
  *
+ * @param[in]  opts       Socket options (NULL for the defaults).
+ *
  * @param[out] socket_fd  The new socket file descriptor.
  *
  * @return 0 on success, 1 on error
  */
-int setup_client_socket(const char *node, const char *service, int *socket_fd);
+int setup_client_socket(const char *node, const char *service,
+                        const socket_options * opts, int *socket_fd);
 
 /**
  * <pre>
- * This function sets up a server socket for receiving connections.
+ * This function sets up a server socket for receiving connections. The
+ * caller puts it in the listening state, and applies the per-connection
+ * options to the connections it accepts (see apply_socket_options()).
  * </pre>
  *
  * @param[in]  service    The port number to bind to.
  *
+ * @param[in]  opts       Socket options (NULL for the defaults).
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_server_socket(const char *service, const socket_options * opts,
+                        int *socket_fd);
+
+/**
+ * <pre>
+ * This function connects a client socket to a local (UNIX domain) socket.
+ * </pre>
+ *
+ * @param[in]  path       Filesystem path of the server socket.
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_unix_client_socket(const char *path, int *socket_fd);
+
+/**
+ * <pre>
+ * This function sets up a listening local (UNIX domain) server socket.
+ * A stale socket file left at path is replaced, and the socket file is
+ * given the requested permission bits.
+ * </pre>
+ *
+ * @param[in]  path       Filesystem path to bind the socket to.
+ *
+ * @param[in]  mode       Permission bits for the socket file (e.g., 0660).
+ *
  * @param[out] socket_fd  The new socket file descriptor.
  *
  * @return 0 on success, 1 on error
  */
-int setup_server_socket(const char *service, int *socket_fd);
+int setup_unix_server_socket(const char *path, mode_t mode, int *socket_fd);
+
+/**
+ * <pre>
+ * This function retrieves the credentials of the process connected to
+ * the other end of a local (UNIX domain) socket (SO_PEERCRED).
+ * </pre>
+ *
+ * @param[in]  socket_fd  Connected socket file descriptor.
+ *
+ * @param[out] uid        User ID of the peer process.
+ *
+ * @param[out] pid        Process ID of the peer process.
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_unix_peer_credentials(int socket_fd, uid_t * uid, pid_t * pid);
+
+/**
+ * <pre>
+ * This function reads exactly len bytes from a socket, reading again
+ * after short reads (and reads interrupted by a signal) until they have
+ * all arrived.
+ * </pre>
+ *
+ * @param[in]  socket_fd  Connected socket file descriptor.
+ *
+ * @param[out] buf        Buffer for the bytes read (at least len bytes).
+ *
+ * @param[in]  len        Number of bytes to read.
+ *
+ * @return 0 on success, 1 if the connection closed, timed out or failed
+ *         first
+ */
+int socket_read_full(int socket_fd, void *buf, size_t len);
+
+/**
+ * <pre>
+ * This function writes a message made of several buffers (e.g., a framing
+ * header and a payload) to a socket with a single writev() call, so that
+ * they go out together, writing again after partial writes until they
+ * have all been sent. The iovec array is updated as it goes.
+ * </pre>
+ *
+ * @param[in]  socket_fd  Connected socket file descriptor.
+ *
+ * @param[in]  iov        The buffers to write, in order.
+ *
+ * @param[in]  iovcnt     Number of buffers in iov.
+ *
+ * @return 0 on success, 1 if the connection closed, timed out or failed
+ *         first
+ */
+int socket_writev_full(int socket_fd, struct iovec *iov, int iovcnt);
 
 #endif
@@ -10,6 +10,22 @@
 /* // OpenSSL libraries for TLS connection */
 #include <openssl/bio.h>
 
+#include <kmip/kmip.h>
+
+#include "kmip_util.h"
+
+/**
+ * @brief length (in bytes) of the key protecting a TLS session cache file
+ *        (see tls_derive_session_cache_key())
+ */
+#define TLS_SESSION_CACHE_KEY_LEN 32
+
+/**
+ * @brief size of the buffer holding a cached session's server name
+ *        ("ip:port", including the null terminator)
+ */
+#define TLS_SESSION_SERVER_LEN 256
+
 /**
  * <pre>
  * This function creates a mutually authenticated TLS connection and provides
@@ -47,6 +63,123 @@ int create_tls_connection(char **server_ip,
                           char *client_cert_path, char *ca_cert_path,
                           BIO ** tls_bio, SSL_CTX ** tls_ctx);
 
+/**
+ * <pre>
+ * This function creates a mutually authenticated TLS connection to the
+ * first of several (equivalent) key servers to answer. Connection attempts
+ * are started in list order, one every stagger_ms milliseconds (or as soon
+ * as every attempt so far has failed), and run in parallel; the first to
+ * complete its handshake (authenticating the server) wins and the others
+ * are abandoned. A slow or unreachable server therefore costs a stagger
+ * delay rather than a connect timeout.
+ * </pre>
+ *
+ * @param[in]  servers                 server addresses, "ip:port", in order
+ *                                     of preference
+ *
+ * @param[in]  server_count            number of servers
+ *
+ * @param[in]  client_private_key      client's private key
+ *
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ *
+ * @param[in]  client_cert_path        path to the client's certificate
+ *
+ * @param[in]  ca_cert_path            path to the certificate for the CA that
+ *                                     issued the server certificates
+ *
+ * @param[in]  stagger_ms              delay (in milliseconds) between the
+ *                                     starts of successive attempts
+ *
+ * @param[out] tls_bio                 BIO containing the TLS connection
+ *
+ * @param[out] tls_ctx                 SSL_CTX containing TLS context info
+ *                                     (set even if no connection is made)
+ *
+ * @param[out] winner                  index (into servers) of the server
+ *                                     connected to
+ *
+ * @return 0 on success, 1 on error (including no server answering within
+ *         KMYTH_TLS_CONNECT_TIMEOUT_MS)
+ */
+int create_tls_connection_race(char **servers, size_t server_count,
+                               unsigned char *client_private_key,
+                               size_t client_private_key_len,
+                               char *client_cert_path, char *ca_cert_path,
+                               unsigned int stagger_ms,
+                               BIO ** tls_bio, SSL_CTX ** tls_ctx,
+                               size_t *winner);
+
+/**
+ * @brief The client's private key for connections started before it is
+ *        available (e.g., while it is still being unsealed), so that name
+ *        lookup, the TCP connect and certificate loading overlap with
+ *        producing it (see create_tls_connection_race_deferred()). One
+ *        thread sets the key; the thread connecting waits for it.
+ */
+typedef struct tls_deferred_key tls_deferred_key;
+
+/**
+ * <pre>
+ * This function creates a deferred key, not yet set.
+ * </pre>
+ *
+ * @return the deferred key (free it with tls_deferred_key_free()), or NULL
+ *         on error
+ */
+tls_deferred_key *tls_deferred_key_new(void);
+
+/**
+ * <pre>
+ * This function sets a deferred key (only the first call has any effect),
+ * waking any connection waiting for it. It may be called from any thread.
+ * </pre>
+ *
+ * @param[in]  dk                      deferred key
+ *
+ * @param[in]  client_private_key      client's private key (PEM), copied;
+ *                                     NULL if it couldn't be had, which
+ *                                     fails connections waiting for it
+ *
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ */
+void tls_deferred_key_set(tls_deferred_key * dk,
+                          unsigned char *client_private_key,
+                          size_t client_private_key_len);
+
+/**
+ * <pre>
+ * This function clears and frees a deferred key. No connection may still
+ * be waiting for it.
+ * </pre>
+ *
+ * @param[in]  dk  deferred key to free (NULL is ignored)
+ */
+void tls_deferred_key_free(tls_deferred_key * dk);
+
+/**
+ * <pre>
+ * This function is create_tls_connection_race() for a client private key
+ * that may not be available yet. The certificates are loaded and the
+ * servers' names looked up and TCP connections made straight away; the TLS
+ * handshakes (which need the key, and offer the cached sessions) start
+ * once it is set. The connect timeout runs from then.
+ * </pre>
+ *
+ * @param[in]  client_key  the client's private key, set now or later
+ *
+ * All other parameters are as described for create_tls_connection_race().
+ *
+ * @return 0 on success, 1 on error (including the key being set to NULL)
+ */
+int create_tls_connection_race_deferred(char **servers, size_t server_count,
+                                        tls_deferred_key * client_key,
+                                        char *client_cert_path,
+                                        char *ca_cert_path,
+                                        unsigned int stagger_ms,
+                                        BIO ** tls_bio, SSL_CTX ** tls_ctx,
+                                        size_t *winner);
+
 /**
  * <pre>
  * This function populates an SSL_CTX* structure with necessary data to 
@@ -78,13 +211,163 @@ int tls_set_context(unsigned char *client_private_key,
 
 /**
  * <pre>
- * This function handles generic OpenSSL cleanup boilerplate.
+ * This function empties the TLS session cache, and handles generic OpenSSL
+ * cleanup boilerplate for OpenSSL versions before 1.1.0 (later versions
+ * clean up at exit). It may be called while other threads use TLS.
  * </pre>
  *
  * @return 0;
  */
 int tls_cleanup(void);
 
+/**
+ * <pre>
+ * Connections made with a context from tls_set_context() offer the session
+ * last negotiated with the same server (ip:port), so repeated connections
+ * resume with an abbreviated handshake. The sessions are kept in memory,
+ * for the life of the process (or until tls_cleanup()); these functions
+ * carry them from one run of a tool to the next, in a file encrypted
+ * (AES-256-GCM) under a key derived from the client's private key. Only a
+ * process that can unseal that key can read or use the sessions.
+ *
+ * This function derives that key.
+ * </pre>
+ *
+ * @param[in]  client_private_key      client's private key
+ *
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ *
+ * @param[out] cache_key               buffer of TLS_SESSION_CACHE_KEY_LEN
+ *                                     bytes for the key
+ *
+ * @return 0 on success, 1 on error
+ */
+int tls_derive_session_cache_key(unsigned char *client_private_key,
+                                 size_t client_private_key_len,
+                                 unsigned char *cache_key);
+
+/**
+ * <pre>
+ * This function adds the sessions saved in a cache file to the in-memory
+ * cache, leaving out any that have expired. A missing file is not an
+ * error (there is nothing to resume yet).
+ * </pre>
+ *
+ * @param[in]  path       path to the cache file
+ *
+ * @param[in]  cache_key  key from tls_derive_session_cache_key()
+ *
+ * @return 0 on success, 1 on error (e.g., the file was written under a
+ *         different key)
+ */
+int tls_load_session_cache(char *path, unsigned char *cache_key);
+
+/**
+ * <pre>
+ * This function replaces a cache file (atomically, with owner-only
+ * permissions if it is new) with the sessions in the in-memory cache.
+ * </pre>
+ *
+ * @param[in]  path       path to the cache file
+ *
+ * @param[in]  cache_key  key from tls_derive_session_cache_key()
+ *
+ * @return 0 on success, 1 on error
+ */
+int tls_save_session_cache(char *path, unsigned char *cache_key);
+
+/**
+ * <pre>
+ * This function empties the in-memory session cache.
+ * </pre>
+ */
+void tls_clear_session_cache(void);
+
+/**
+ * @brief A pool of TLS connections to key servers, kept open between
+ *        requests so that a process fetching many keys (e.g., a daemon)
+ *        pays for the TCP connect and TLS handshake once per server rather
+ *        than once per key. Connections are keyed by server (ip:port) and
+ *        client identity (private key, certificate and CA certificate), and
+ *        are safe to get and put from any thread.
+ */
+typedef struct tls_conn_pool tls_conn_pool;
+
+/**
+ * <pre>
+ * This function creates an empty connection pool.
+ * </pre>
+ *
+ * @param[in]  max_conns     most connections (idle and in use) the pool
+ *                           holds open at once
+ *
+ * @param[in]  idle_timeout  seconds an idle connection is kept before it is
+ *                           closed (0 to keep idle connections open until
+ *                           the server closes them or the pool is freed)
+ *
+ * @return the pool (free it with tls_conn_pool_free()), or NULL on error
+ */
+tls_conn_pool *tls_conn_pool_new(size_t max_conns, unsigned int idle_timeout);
+
+/**
+ * <pre>
+ * This function closes all of a pool's connections and frees it. No
+ * connection from the pool may still be in use.
+ * </pre>
+ *
+ * @param[in]  pool  pool to free (NULL is ignored)
+ */
+void tls_conn_pool_free(tls_conn_pool * pool);
+
+/**
+ * <pre>
+ * This function provides a mutually authenticated TLS connection to a
+ * server: an idle pooled one made with the same client identity if there
+ * is one (idle connections that have timed out, or that the server has
+ * closed, are dropped on the way), else a new one. A new connection
+ * replaces the pool's least recently used idle connection if the pool is
+ * full; if every connection is in use, this is an error.
+ * </pre>
+ *
+ * @param[in]  pool                    connection pool
+ *
+ * @param[in]  server                  server address, "ip:port"
+ *
+ * @param[in]  client_private_key      client's private key
+ *
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ *
+ * @param[in]  client_cert_path        path to the client's certificate
+ *
+ * @param[in]  ca_cert_path            path to the certificate for the CA that
+ *                                     issued the server certificate
+ *
+ * @param[out] tls_bio                 BIO containing the TLS connection,
+ *                                     to be returned with tls_conn_pool_put()
+ *
+ * @return 0 on success, 1 on error
+ */
+int tls_conn_pool_get(tls_conn_pool * pool, char *server,
+                      unsigned char *client_private_key,
+                      size_t client_private_key_len,
+                      char *client_cert_path, char *ca_cert_path,
+                      BIO ** tls_bio);
+
+/**
+ * <pre>
+ * This function returns a connection from tls_conn_pool_get() to the pool.
+ * </pre>
+ *
+ * @param[in]  pool      connection pool the connection came from
+ *
+ * @param[in]  tls_bio   the connection
+ *
+ * @param[in]  reusable  non-zero if the request made on the connection
+ *                       completed, so it can carry another; zero (e.g.,
+ *                       after an error) to close it
+ */
+void tls_conn_pool_put(tls_conn_pool * pool, BIO * tls_bio, int reusable);
+
 /**
  * <pre>
  * This function takes an existing TLS connection (in the form of OpenSSL BIO and SSL_CTX 
@@ -135,4 +418,176 @@ int get_resp_from_tls_server(BIO * bio,
 int get_key_from_kmip_server(BIO * bio,
                              char *message, size_t message_length,
                              unsigned char **key, size_t * key_size);
+
+/**
+ * <pre>
+ * This function takes an existing TLS connection and fetches several keys
+ * from the KMIP server in one round trip (a single request with one Get
+ * batch item per key ID).
+ * </pre>
+ *
+ * @param[in]  bio       OpenSSL BIO structure with the connection already
+ *                       instantiated
+ *
+ * @param[in]  ids       the key IDs
+ *
+ * @param[in]  id_lens   lengths (in bytes) of the key IDs
+ *
+ * @param[in]  id_count  number of key IDs (1 to KMYTH_KMIP_MAX_BATCH_COUNT)
+ *
+ * @param[out] results   one result per key ID, in the order requested (see
+ *                       parse_kmip_batch_get_response()), to be freed with
+ *                       free_kmip_key_results()
+ *
+ * @return 0 if the server answered (each result says whether its key came
+ *         back), 1 if error
+ */
+int get_keys_from_kmip_server(BIO * bio,
+                              unsigned char **ids, size_t *id_lens,
+                              size_t id_count, kmip_key_result ** results);
+
+/**
+ * @brief An asynchronous fetch of one key from a KMIP server, for callers
+ *        with an event loop: the connection, TLS handshake, request and
+ *        response all run on a non-blocking socket, a step at a time, so
+ *        that one thread can have many fetches in flight. Each step is
+ *        taken when the fetch's socket is ready (see
+ *        tls_key_fetch_poll_fd()) or its deadline has passed; the fetch
+ *        finishes, running its callback, on the step that completes or
+ *        fails it. The connection is closed once the fetch finishes.
+ */
+typedef struct tls_key_fetch tls_key_fetch;
+
+/**
+ * @brief Callback run when a key fetch finishes
+ *
+ * @param[in]  fetch    the fetch
+ *
+ * @param[in]  status   0 if the key was fetched, 1 if not
+ *
+ * @param[in]  key      the key (NULL if not fetched), owned by the fetch
+ *                      (take it with tls_key_fetch_take_key(), or copy it)
+ *
+ * @param[in]  key_len  length (in bytes) of the key
+ *
+ * @param[in]  arg      the argument given to tls_key_fetch_start()
+ */
+typedef void (*tls_key_fetch_cb) (tls_key_fetch * fetch, int status,
+                                  unsigned char *key, size_t key_len,
+                                  void *arg);
+
+/**
+ * <pre>
+ * This function starts fetching a key from a KMIP server, taking the first
+ * step right away (so the callback runs before this returns if that step
+ * fails).
+ * </pre>
+ *
+ * @param[in]  ctx         SSL_CTX for the connection, from
+ *                         tls_set_context() (it may be shared by many
+ *                         fetches, and must outlive them)
+ *
+ * @param[in]  server      server address, "ip:port"
+ *
+ * @param[in]  key_id      the ID of the key to fetch
+ *
+ * @param[in]  key_id_len  length (in bytes) of the key ID
+ *
+ * @param[in]  timeout_ms  time (in milliseconds) the whole fetch may take,
+ *                         0 for KMYTH_TLS_CONNECT_TIMEOUT_MS +
+ *                         KMYTH_TLS_READ_TIMEOUT_MS
+ *
+ * @param[in]  cb          callback run when the fetch finishes (NULL for
+ *                         none)
+ *
+ * @param[in]  arg         argument passed to the callback
+ *
+ * @return the fetch (free it with tls_key_fetch_free()), or NULL on error
+ */
+tls_key_fetch *tls_key_fetch_start(SSL_CTX * ctx, char *server,
+                                   unsigned char *key_id, size_t key_id_len,
+                                   unsigned int timeout_ms,
+                                   tls_key_fetch_cb cb, void *arg);
+
+/**
+ * <pre>
+ * This function moves a key fetch along as far as it can go without
+ * waiting, finishing it if its deadline has passed.
+ * </pre>
+ *
+ * @param[in]  fetch  the fetch
+ *
+ * @return -1 if the fetch is still under way, 0 if it has fetched the key,
+ *         1 if it failed
+ */
+int tls_key_fetch_step(tls_key_fetch * fetch);
+
+/**
+ * <pre>
+ * This function gives the socket a key fetch under way is waiting on, and
+ * what for.
+ * </pre>
+ *
+ * @param[in]  fetch   the fetch
+ *
+ * @param[out] events  poll() events to wait for (POLLIN or POLLOUT); NULL
+ *                     if not wanted
+ *
+ * @return the socket, or -1 if the fetch has finished
+ */
+int tls_key_fetch_poll_fd(tls_key_fetch * fetch, short *events);
+
+/**
+ * <pre>
+ * This function gives the time left until a key fetch's deadline.
+ * </pre>
+ *
+ * @param[in]  fetch  the fetch
+ *
+ * @return milliseconds left (rounded up), 0 if the deadline has passed or
+ *         the fetch has finished
+ */
+int tls_key_fetch_timeout_ms(tls_key_fetch * fetch);
+
+/**
+ * <pre>
+ * This function takes the key from a fetch that has fetched it.
+ * </pre>
+ *
+ * @param[in]  fetch    the fetch
+ *
+ * @param[out] key      the key, to be freed (cleared) by the caller
+ *
+ * @param[out] key_len  length (in bytes) of the key
+ *
+ * @return 0 on success, 1 if there is no key (the fetch failed, is under
+ *         way, or the key was already taken)
+ */
+int tls_key_fetch_take_key(tls_key_fetch * fetch,
+                           unsigned char **key, size_t *key_len);
+
+/**
+ * <pre>
+ * This function frees a key fetch (closing its connection if it is still
+ * under way, without running its callback), clearing any key not taken.
+ * </pre>
+ *
+ * @param[in]  fetch  the fetch to free (NULL is ignored)
+ */
+void tls_key_fetch_free(tls_key_fetch * fetch);
+
+/**
+ * <pre>
+ * This function runs key fetches to completion: a simple event loop that
+ * polls the sockets of all those still under way and steps each one whose
+ * socket is ready or whose deadline has passed.
+ * </pre>
+ *
+ * @param[in]  fetches  the fetches
+ *
+ * @param[in]  count    number of fetches
+ *
+ * @return 0 if every key was fetched, 1 if not
+ */
+int tls_key_fetch_run(tls_key_fetch ** fetches, size_t count);
 #endif
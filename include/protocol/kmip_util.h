@@ -7,6 +7,63 @@
 #ifndef KMYTH_KMIP_UTIL_H
 #define KMYTH_KMIP_UTIL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief most keys a KMIP batch Get request may ask for
+ */
+#define KMYTH_KMIP_MAX_BATCH_COUNT 256
+
+/**
+ * @brief default initial size (in bytes) of a KMIP codec's encoding buffer
+ */
+#define KMYTH_KMIP_CODEC_BUFFER_SIZE 1024
+
+/**
+ * @brief One key from a KMIP batch Get response (see
+ *        parse_kmip_batch_get_response()). If the server could not return
+ *        the key, id and key are NULL.
+ */
+typedef struct kmip_key_result
+{
+  unsigned char *id;
+  size_t id_len;
+  unsigned char *key;
+  size_t key_len;
+} kmip_key_result;
+
+/**
+ * @brief A reusable KMIP encoder/decoder, for servers and clients that
+ *        handle many messages: the KMIP context and the encoding buffer
+ *        are set up once (the buffer growing as needed, up to the maximum
+ *        KMIP message size) rather than for every message, and messages
+ *        are returned in place rather than copied out.
+ *
+ *        A message built with a codec is its encoding buffer, valid until
+ *        the next message is built or the codec is reset. The ID and key
+ *        returned by a parse point into the decoded message, valid until
+ *        the next message of the same kind (request or response) is parsed
+ *        or the codec is reset. A request parsed by a codec may so be
+ *        answered with a response built by the same codec.
+ *
+ *        Set up with kmip_codec_init(), released with kmip_codec_free().
+ *        The fields are internal.
+ */
+typedef struct kmip_codec
+{
+  KMIP ctx;
+
+  uint8 *buffer;
+  size_t buffer_size;
+  size_t encoded_len;
+
+  RequestMessage request;
+  ResponseMessage response;
+  bool has_request;
+  bool has_response;
+} kmip_codec;
+
 /**
  * <pre>
  * This function builds a basic KMIP Get request message.
@@ -101,4 +158,262 @@ int parse_kmip_get_response(KMIP * ctx,
                             unsigned char **id, size_t *id_len,
                             unsigned char **key, size_t *key_len);
 
+/**
+ * <pre>
+ * This function builds a KMIP request message with one Get batch item per
+ * key ID, so that many keys can be fetched in one round trip.
+ * </pre>
+ *
+ * @param[in]  ctx          the KMIP context used to build the message
+ *
+ * @param[in]  ids          the IDs of the KMIP objects to retrieve
+ *
+ * @param[in]  id_lens      lengths (in bytes) of the IDs
+ *
+ * @param[in]  id_count     number of IDs (1 to KMYTH_KMIP_MAX_BATCH_COUNT)
+ *
+ * @param[out] request      the KMIP batch Get request message
+ *
+ * @param[out] request_len  length (in bytes) of the request message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_batch_get_request(KMIP * ctx,
+                                 unsigned char **ids, size_t *id_lens,
+                                 size_t id_count,
+                                 unsigned char **request, size_t *request_len);
+
+/**
+ * <pre>
+ * This function parses the response to a request from
+ * build_kmip_batch_get_request(). The results are in the order the IDs
+ * were requested; a Get that failed leaves its result empty (and is
+ * logged) without failing the others.
+ * </pre>
+ *
+ * @param[in]  ctx           the KMIP context used to parse the message
+ *
+ * @param[in]  response      the KMIP batch Get response message
+ *
+ * @param[in]  response_len  length (in bytes) of the response message
+ *
+ * @param[in]  id_count      number of IDs requested
+ *
+ * @param[out] results       id_count results, to be freed with
+ *                           free_kmip_key_results()
+ *
+ * @return 0 on success, 1 on error (e.g., a malformed response, or one
+ *         with the wrong number of batch items)
+ */
+int parse_kmip_batch_get_response(KMIP * ctx,
+                                  unsigned char *response,
+                                  size_t response_len, size_t id_count,
+                                  kmip_key_result ** results);
+
+/**
+ * <pre>
+ * This function parses a KMIP request message made up of Get batch items,
+ * such as one from build_kmip_get_request() or
+ * build_kmip_batch_get_request(). The IDs are returned in the order of
+ * the batch items.
+ * </pre>
+ *
+ * @param[in]  ctx          the KMIP context used to parse the message
+ *
+ * @param[in]  request      the KMIP Get request message
+ *
+ * @param[in]  request_len  length (in bytes) of the request message
+ *
+ * @param[out] ids          the requested IDs (id and id_len set, key NULL),
+ *                          to be freed with free_kmip_key_results()
+ *
+ * @param[out] id_count     number of IDs (1 to KMYTH_KMIP_MAX_BATCH_COUNT)
+ *
+ * @return 0 on success, 1 on error (e.g., a malformed request, or one
+ *         with an item that is not a Get)
+ */
+int parse_kmip_batch_get_request(KMIP * ctx,
+                                 unsigned char *request, size_t request_len,
+                                 kmip_key_result ** ids, size_t *id_count);
+
+/**
+ * <pre>
+ * This function builds the response to a request parsed by
+ * parse_kmip_batch_get_request(): one Get batch item per result, in the
+ * same order. A result without a key becomes a failed item (Item Not
+ * Found). With more than one result, the items carry the unique batch
+ * item IDs build_kmip_batch_get_request() gives its items (their index).
+ * </pre>
+ *
+ * @param[in]  ctx           the KMIP context used to build the message
+ *
+ * @param[in]  results       the IDs and keys to return
+ *
+ * @param[in]  count         number of results
+ *                           (1 to KMYTH_KMIP_MAX_BATCH_COUNT)
+ *
+ * @param[out] response      the KMIP batch Get response message
+ *
+ * @param[out] response_len  length (in bytes) of the response message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_batch_get_response(KMIP * ctx,
+                                  kmip_key_result * results, size_t count,
+                                  unsigned char **response,
+                                  size_t *response_len);
+
+/**
+ * <pre>
+ * This function sets up a KMIP codec.
+ * </pre>
+ *
+ * @param[out] codec        the codec
+ *
+ * @param[in]  version      the KMIP version of the messages built
+ *
+ * @param[in]  buffer_size  initial size (in bytes) of the encoding buffer,
+ *                          0 for KMYTH_KMIP_CODEC_BUFFER_SIZE
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmip_codec_init(kmip_codec * codec, enum kmip_version version,
+                    size_t buffer_size);
+
+/**
+ * <pre>
+ * This function ends the current message exchange on a KMIP codec: the
+ * last message built is cleared and the messages parsed are freed, so
+ * that nothing returned by the codec stays valid. The encoding buffer is
+ * kept for the next messages.
+ * </pre>
+ *
+ * @param[in]  codec  the codec (NULL is ignored)
+ */
+void kmip_codec_reset(kmip_codec * codec);
+
+/**
+ * <pre>
+ * This function resets a KMIP codec and releases its buffer and context.
+ * </pre>
+ *
+ * @param[in]  codec  the codec (NULL is ignored)
+ */
+void kmip_codec_free(kmip_codec * codec);
+
+/**
+ * <pre>
+ * This function builds a basic KMIP Get request message with a codec, as
+ * build_kmip_get_request() does.
+ * </pre>
+ *
+ * @param[in]  codec        the codec
+ *
+ * @param[in]  id           the ID of the KMIP object to retrieve
+ *
+ * @param[in]  id_len       length (in bytes) of the ID to retrieve
+ *
+ * @param[out] request      the KMIP Get request message (owned by the
+ *                          codec)
+ *
+ * @param[out] request_len  length (in bytes) of the request message
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmip_codec_build_get_request(kmip_codec * codec,
+                                 unsigned char *id, size_t id_len,
+                                 unsigned char **request, size_t *request_len);
+
+/**
+ * <pre>
+ * This function parses a basic KMIP Get request message with a codec, as
+ * parse_kmip_get_request() does.
+ * </pre>
+ *
+ * @param[in]  codec        the codec
+ *
+ * @param[in]  request      the KMIP Get request message
+ *
+ * @param[in]  request_len  length (in bytes) of the request message
+ *
+ * @param[out] id           the ID of the KMIP object to retrieve (owned by
+ *                          the codec)
+ *
+ * @param[out] id_len       length (in bytes) of the ID to retrieve
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmip_codec_parse_get_request(kmip_codec * codec,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char **id, size_t *id_len);
+
+/**
+ * <pre>
+ * This function builds a KMIP Get response message with a codec, as
+ * build_kmip_get_response() does.
+ * </pre>
+ *
+ * @param[in]  codec         the codec
+ *
+ * @param[in]  id            the key ID
+ *
+ * @param[in]  id_len        length (in bytes) of the key ID
+ *
+ * @param[in]  key           the symmetric key
+ *
+ * @param[in]  key_len       length (in bytes) of the key
+ *
+ * @param[out] response      the KMIP Get response message (owned by the
+ *                           codec)
+ *
+ * @param[out] response_len  length (in bytes) of the response message
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmip_codec_build_get_response(kmip_codec * codec,
+                                  unsigned char *id, size_t id_len,
+                                  unsigned char *key, size_t key_len,
+                                  unsigned char **response,
+                                  size_t *response_len);
+
+/**
+ * <pre>
+ * This function parses a KMIP Get response message with a codec, as
+ * parse_kmip_get_response() does.
+ * </pre>
+ *
+ * @param[in]  codec         the codec
+ *
+ * @param[in]  response      the KMIP Get response message
+ *
+ * @param[in]  response_len  length (in bytes) of the response message
+ *
+ * @param[out] id            the retrieved key ID (owned by the codec)
+ *
+ * @param[out] id_len        length (in bytes) of the retrieved key ID
+ *
+ * @param[out] key           the retrieved key (owned by the codec)
+ *
+ * @param[out] key_len       length (in bytes) of the retrieved key
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmip_codec_parse_get_response(kmip_codec * codec,
+                                  unsigned char *response,
+                                  size_t response_len,
+                                  unsigned char **id, size_t *id_len,
+                                  unsigned char **key, size_t *key_len);
+
+/**
+ * <pre>
+ * This function clears the keys in, and frees, the results of
+ * parse_kmip_batch_get_response().
+ * </pre>
+ *
+ * @param[in]  results  the results (NULL is ignored)
+ *
+ * @param[in]  count    number of results
+ */
+void free_kmip_key_results(kmip_key_result * results, size_t count);
+
 #endif
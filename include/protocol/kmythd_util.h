@@ -0,0 +1,149 @@
+/**
+ * @file kmythd_util.h
+ *
+ * @brief Message framing and encoding for the local socket protocol spoken
+ *        between kmythd and its clients.
+ *
+ * Every message is a 4-byte, big-endian length followed by that many bytes.
+ * An unseal request holds a flags byte and three length-prefixed fields
+ * (the .ski bytes, the authorization string and the owner authorization).
+ * A response holds a status byte followed, on success, by the unsealed data.
+ */
+
+#ifndef KMYTHD_UTIL_H
+#define KMYTHD_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Default path of the kmythd socket, and the environment variable
+ *        that overrides it.
+ */
+#define KMYTHD_DEFAULT_SOCKET_PATH "/run/kmyth/kmythd.sock"
+#define KMYTHD_SOCKET_ENV "KMYTHD_SOCKET"
+
+/**
+ * @brief Largest message (request or response) either side will accept.
+ */
+#define KMYTHD_MAX_MSG_LEN (16 * 1024 * 1024)
+
+/**
+ * @brief Seconds a connected client may take to send its request before
+ *        kmythd drops the connection.
+ */
+#define KMYTHD_CLIENT_TIMEOUT 5
+
+/**
+ * @brief Total size limit of the kmythd secret cache (-C), chosen to fit
+ *        within a typical RLIMIT_MEMLOCK since cached secrets are mlock()ed.
+ */
+#define KMYTHD_SECRET_CACHE_MAX_BYTES (64 * 1024)
+
+/**
+ * @brief Unseal request flag: the .ski was sealed using a policy-OR.
+ */
+#define KMYTHD_FLAG_POLICY_OR 0x01
+
+/**
+ * @brief Response status values.
+ */
+#define KMYTHD_STATUS_OK 0x00
+#define KMYTHD_STATUS_ERROR 0x01
+#define KMYTHD_STATUS_DENIED 0x02
+
+/**
+ * <pre>
+ * This function sends one length-prefixed message over a socket.
+ * </pre>
+ *
+ * @param[in]  socket_fd  Connected socket file descriptor
+ *
+ * @param[in]  msg        Message bytes
+ *
+ * @param[in]  msg_len    Number of message bytes (at most KMYTHD_MAX_MSG_LEN)
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmythd_send_msg(int socket_fd, const uint8_t * msg, size_t msg_len);
+
+/**
+ * <pre>
+ * This function receives one length-prefixed message from a socket.
+ * </pre>
+ *
+ * @param[in]  socket_fd  Connected socket file descriptor
+ *
+ * @param[out] msg        Message bytes (allocated here, caller frees)
+ *
+ * @param[out] msg_len    Number of message bytes
+ *
+ * @return 0 on success, 1 on error (including messages that are too long)
+ */
+int kmythd_recv_msg(int socket_fd, uint8_t ** msg, size_t *msg_len);
+
+/**
+ * <pre>
+ * This function encodes an unseal request.
+ * </pre>
+ *
+ * @param[in]  ski        .ski bytes to be unsealed
+ *
+ * @param[in]  ski_len    Number of .ski bytes
+ *
+ * @param[in]  auth       Authorization string bytes (may be NULL)
+ *
+ * @param[in]  auth_len   Number of authorization string bytes
+ *
+ * @param[in]  oa         Owner (storage) hierarchy authorization (may be NULL)
+ *
+ * @param[in]  oa_len     Number of owner authorization bytes
+ *
+ * @param[in]  flags      Request flags (e.g., KMYTHD_FLAG_POLICY_OR)
+ *
+ * @param[out] req        Encoded request (allocated here, caller clears and
+ *                        frees, since it holds authorization data)
+ *
+ * @param[out] req_len    Number of encoded request bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmythd_build_unseal_request(const uint8_t * ski, size_t ski_len,
+                                const uint8_t * auth, size_t auth_len,
+                                const uint8_t * oa, size_t oa_len,
+                                uint8_t flags,
+                                uint8_t ** req, size_t *req_len);
+
+/**
+ * <pre>
+ * This function decodes an unseal request. The returned field pointers
+ * point into the request buffer; nothing is copied.
+ * </pre>
+ *
+ * @param[in]  req        Encoded request
+ *
+ * @param[in]  req_len    Number of encoded request bytes
+ *
+ * @param[out] ski        .ski bytes
+ *
+ * @param[out] ski_len    Number of .ski bytes
+ *
+ * @param[out] auth       Authorization string bytes (NULL if empty)
+ *
+ * @param[out] auth_len   Number of authorization string bytes
+ *
+ * @param[out] oa         Owner authorization bytes (NULL if empty)
+ *
+ * @param[out] oa_len     Number of owner authorization bytes
+ *
+ * @param[out] flags      Request flags
+ *
+ * @return 0 on success, 1 on error (malformed request)
+ */
+int kmythd_parse_unseal_request(uint8_t * req, size_t req_len,
+                                uint8_t ** ski, size_t *ski_len,
+                                uint8_t ** auth, size_t *auth_len,
+                                uint8_t ** oa, size_t *oa_len,
+                                uint8_t * flags);
+
+#endif
@@ -7,9 +7,66 @@
 #ifndef NSL_UTIL_H
 #define NSL_UTIL_H
 
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Largest session record (length prefix excluded) accepted from the
+ *        peer
+ */
+#define NSL_MAX_RECORD_LEN (1024 * 1024)
+
+/**
+ * @brief Length of the (big-endian) length prefix of a session record
+ */
+#define NSL_RECORD_PREFIX_LEN 4
+
+/**
+ * @brief Bytes of randomness the nonce pool holds (see
+ *        nsl_nonce_pool_start())
+ */
+#define NSL_NONCE_POOL_LEN 4096
+
+/**
+ * @brief Types of the records exchanged over an established NSL session
+ */
+typedef enum nsl_record_type
+{
+  NSL_RECORD_DATA = 1,          ///< a key request or response
+  NSL_RECORD_REKEY = 2,         ///< client: an NSL handshake follows
+  NSL_RECORD_CLOSE = 3,         ///< client: no more requests
+} nsl_record_type;
+
+/**
+ * @brief State of one side of an established NSL session. Each record sent
+ *        over the session is framed as a 4-byte (big-endian) length
+ *        followed by an AES-GCM ciphertext (IV||data||tag, under the session
+ *        key) of
+ *
+ *           type (1 byte) || sender (1 byte) || sequence (8 bytes) || payload
+ *
+ *        Each side numbers the records it sends from zero, so a record
+ *        that is replayed, reordered, dropped or reflected back to its
+ *        sender fails to open. The sequence numbers restart when the
+ *        session is rekeyed.
+ */
+typedef struct nsl_session
+{
+  unsigned char *key;           ///< session key (owned by the session)
+  size_t key_len;               ///< length (in bytes) of key
+  int is_server;                ///< non-zero on the server side
+  uint64_t send_seq;            ///< sequence number of the next record sent
+  uint64_t recv_seq;            ///< sequence number of the next record read
+  uint64_t requests;            ///< data records sent client to server
+  time_t established;           ///< time the session key was negotiated
+} nsl_session;
+
 /**
  * <pre>
- * This function encrypts plaintext using the provided EVP keypair context.
+ * This function encrypts plaintext using the provided EVP keypair context
+ * (with RSA-OAEP, SHA-256, for an RSA key). The context is not used
+ * directly: each thread keeps a context initialized for encryption with
+ * the same key, reused from one call to the next.
  * </pre>
  *
  * @param[in]  ctx    EVP keypair context used for encryption
@@ -24,13 +81,15 @@
  *
  * @return 0 on success, 1 on error
  */
-int encrypt_with_key_pair(EVP_PKEY_CTX ctx,
+int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *p, size_t p_len,
                           unsigned char **c, size_t *c_len);
 
 /**
  * <pre>
- * This function decrypts ciphertext using the provided EVP keypair context.
+ * This function decrypts ciphertext using the provided EVP keypair context
+ * (with RSA-OAEP, SHA-256, for an RSA key), by way of the calling thread's
+ * prepared context for the same key (see encrypt_with_key_pair()).
  * </pre>
  *
  * @param[in]  ctx    EVP keypair context used for decryption
@@ -45,7 +104,7 @@ int encrypt_with_key_pair(EVP_PKEY_CTX ctx,
  *
  * @return 0 on success, 1 on error
  */
-int decrypt_with_key_pair(EVP_PKEY_CTX ctx,
+int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *c, size_t c_len,
                           unsigned char **p, size_t *p_len);
 
@@ -267,6 +326,26 @@ int generate_session_key(unsigned char *nonce_a, size_t nonce_a_len,
 int generate_nonce(size_t desired_min_nonce_len, unsigned char **nonce,
                    size_t *nonce_len);
 
+/**
+ * <pre>
+ * This function starts a background thread that keeps a pool of random
+ * bytes (NSL_NONCE_POOL_LEN) filled, so that generate_nonce() takes its
+ * bytes from memory instead of drawing them from the random number
+ * generator on a handshake's critical path. Without the pool (or when it
+ * runs dry), generate_nonce() draws them itself.
+ * </pre>
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_nonce_pool_start(void);
+
+/**
+ * <pre>
+ * This function stops the nonce pool thread and clears the pool.
+ * </pre>
+ */
+void nsl_nonce_pool_stop(void);
+
 /**
  * <pre>
  * This function runs the client side NSL negotation to obtain a shared session key.
@@ -328,4 +407,241 @@ int negotiate_server_session_key(int socket_fd,
                                  unsigned char *id, size_t id_len,
                                  unsigned char **session_key,
                                  size_t *session_key_len);
+
+/**
+ * <pre>
+ * This function runs the first server side step of the NSL negotiation
+ * without doing any I/O (so that an event-driven server can run it on a
+ * worker thread): it opens the client's nonce request and builds the
+ * nonce response.
+ *
+ * negotiate_server_session_key() is this function and
+ * nsl_server_handshake_finish() with blocking socket I/O around them.
+ * </pre>
+ *
+ * @param[in]  public_key_ctx   the EVP_PKEY_CTX containing the remote public
+ *                              key
+ *
+ * @param[in]  private_key_ctx  the EVP_PKEY_CTX containing the local private
+ *                              key
+ *
+ * @param[in]  id               the local ID
+ *
+ * @param[in]  id_len           length (in bytes) of the local ID
+ *
+ * @param[in]  request          the nonce request received
+ *
+ * @param[in]  request_len      length (in bytes) of the nonce request
+ *
+ * @param[out] nonce_a          nonce A (the client's)
+ *
+ * @param[out] nonce_a_len      length (in bytes) of nonce A
+ *
+ * @param[out] nonce_b          nonce B (the server's)
+ *
+ * @param[out] nonce_b_len      length (in bytes) of nonce B
+ *
+ * @param[out] response         the nonce response to send
+ *
+ * @param[out] response_len     length (in bytes) of the nonce response
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_server_handshake_respond(EVP_PKEY_CTX * public_key_ctx,
+                                 EVP_PKEY_CTX * private_key_ctx,
+                                 unsigned char *id, size_t id_len,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char **nonce_a, size_t *nonce_a_len,
+                                 unsigned char **nonce_b, size_t *nonce_b_len,
+                                 unsigned char **response,
+                                 size_t *response_len);
+
+/**
+ * <pre>
+ * This function runs the last server side step of the NSL negotiation
+ * without doing any I/O: it checks the client's nonce confirmation and
+ * derives the session key.
+ * </pre>
+ *
+ * @param[in]  private_key_ctx   the EVP_PKEY_CTX containing the local
+ *                               private key
+ *
+ * @param[in]  confirmation      the nonce confirmation received
+ *
+ * @param[in]  confirmation_len  length (in bytes) of the confirmation
+ *
+ * @param[in]  nonce_a           nonce A, from nsl_server_handshake_respond()
+ *
+ * @param[in]  nonce_a_len       length (in bytes) of nonce A
+ *
+ * @param[in]  nonce_b           nonce B, from nsl_server_handshake_respond()
+ *
+ * @param[in]  nonce_b_len       length (in bytes) of nonce B
+ *
+ * @param[out] session_key       the session key
+ *
+ * @param[out] session_key_len   length (in bytes) of the session key
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_server_handshake_finish(EVP_PKEY_CTX * private_key_ctx,
+                                unsigned char *confirmation,
+                                size_t confirmation_len,
+                                unsigned char *nonce_a, size_t nonce_a_len,
+                                unsigned char *nonce_b, size_t nonce_b_len,
+                                unsigned char **session_key,
+                                size_t *session_key_len);
+
+/**
+ * <pre>
+ * This function starts a session over a negotiated session key (or
+ * replaces the key of a session being rekeyed), with both sequence numbers
+ * at zero.
+ * </pre>
+ *
+ * @param[in]  session      the session
+ *
+ * @param[in]  key          the session key, from
+ *                          negotiate_client_session_key() or
+ *                          negotiate_server_session_key() (the session
+ *                          takes ownership of it)
+ *
+ * @param[in]  key_len      length (in bytes) of the session key
+ *
+ * @param[in]  is_server    non-zero on the server side
+ */
+void nsl_session_init(nsl_session * session,
+                      unsigned char *key, size_t key_len, int is_server);
+
+/**
+ * <pre>
+ * This function clears and frees a session's key.
+ * </pre>
+ *
+ * @param[in]  session      the session
+ */
+void nsl_session_clear(nsl_session * session);
+
+/**
+ * <pre>
+ * This function says whether a session key has reached the end of its
+ * life: KMYTH_NSL_SESSION_MAX_REQUESTS requests, or
+ * KMYTH_NSL_SESSION_MAX_AGE seconds. The client rekeys before sending a
+ * request over such a session; the server refuses requests over one.
+ * </pre>
+ *
+ * @param[in]  session      the session
+ *
+ * @return 1 if the session key must be replaced, 0 otherwise
+ */
+int nsl_session_expired(nsl_session * session);
+
+/**
+ * <pre>
+ * This function seals a record under the session key, without sending it.
+ * </pre>
+ *
+ * @param[in]  session      the session
+ *
+ * @param[in]  type         the record type
+ *
+ * @param[in]  payload      the record payload (can be NULL if payload_len
+ *                          is 0)
+ *
+ * @param[in]  payload_len  length (in bytes) of the payload
+ *
+ * @param[out] record       the record, length prefix included
+ *
+ * @param[out] record_len   length (in bytes) of the record
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_seal_record(nsl_session * session, nsl_record_type type,
+                    unsigned char *payload, size_t payload_len,
+                    unsigned char **record, size_t *record_len);
+
+/**
+ * <pre>
+ * This function decodes and checks the length prefix of a record.
+ * </pre>
+ *
+ * @param[in]  prefix       NSL_RECORD_PREFIX_LEN bytes of record prefix
+ *
+ * @param[out] sealed_len   length (in bytes) of the sealed record that
+ *                          follows the prefix
+ *
+ * @return 0 on success, 1 if the length is out of bounds
+ */
+int nsl_record_sealed_len(unsigned char *prefix, size_t *sealed_len);
+
+/**
+ * <pre>
+ * This function opens a sealed record (the part after its length prefix),
+ * checking its sender and sequence number. The sealed buffer is
+ * overwritten.
+ * </pre>
+ *
+ * @param[in]  session      the session
+ *
+ * @param[in]  sealed       the sealed record
+ *
+ * @param[in]  sealed_len   length (in bytes) of the sealed record
+ *
+ * @param[out] type         the record type
+ *
+ * @param[out] payload      the record payload (NULL if it is empty)
+ *
+ * @param[out] payload_len  length (in bytes) of the payload
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_open_record(nsl_session * session,
+                    unsigned char *sealed, size_t sealed_len,
+                    nsl_record_type * type,
+                    unsigned char **payload, size_t *payload_len);
+
+/**
+ * <pre>
+ * This function seals a record under the session key and sends it.
+ * </pre>
+ *
+ * @param[in]  socket_fd    the open socket file descriptor
+ *
+ * @param[in]  session      the session
+ *
+ * @param[in]  type         the record type
+ *
+ * @param[in]  payload      the record payload (can be NULL if payload_len
+ *                          is 0)
+ *
+ * @param[in]  payload_len  length (in bytes) of the payload
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_send_record(int socket_fd, nsl_session * session,
+                    nsl_record_type type,
+                    unsigned char *payload, size_t payload_len);
+
+/**
+ * <pre>
+ * This function reads the next record from the peer and opens it,
+ * checking its sender and sequence number.
+ * </pre>
+ *
+ * @param[in]  socket_fd    the open socket file descriptor
+ *
+ * @param[in]  session      the session
+ *
+ * @param[out] type         the record type
+ *
+ * @param[out] payload      the record payload (NULL if it is empty)
+ *
+ * @param[out] payload_len  length (in bytes) of the payload
+ *
+ * @return 0 on success, 1 on error (including the peer closing the
+ *         connection)
+ */
+int nsl_recv_record(int socket_fd, nsl_session * session,
+                    nsl_record_type * type,
+                    unsigned char **payload, size_t *payload_len);
 #endif
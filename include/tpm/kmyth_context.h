@@ -0,0 +1,372 @@
+/**
+ * @file  kmyth_context.h
+ *
+ * @brief Provides the internal definition of the reusable Kmyth context
+ *        (kmyth_ctx_t) declared in kmyth.h. A context owns a single,
+ *        long-lived connection to the TPM 2.0 resource manager so that
+ *        callers performing many seal/unseal operations do not pay the
+ *        TCTI/SAPI setup and teardown cost on every call.
+ */
+
+#ifndef KMYTH_CONTEXT_H
+#define KMYTH_CONTEXT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "cipher/cipher.h"
+#include "kmyth.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+/**
+ * @brief Maximum number of storage keys (SKs) a Kmyth context keeps in its
+ *        SK pool, whether loaded or swapped out to a saved context.
+ */
+#define KMYTH_SK_CACHE_SIZE 16
+
+/**
+ * @brief Maximum number of pooled storage keys (SKs) kept loaded at once.
+ *        TPMs offer as few as three transient object slots, and an unseal
+ *        also needs one for the sealed data object, so the remaining SKs
+ *        are swapped out with TPM2_ContextSave and swapped back in with
+ *        TPM2_ContextLoad when next used.
+ */
+#define KMYTH_SK_CACHE_LOADED_MAX 2
+
+/**
+ * @brief A storage key (SK) that has been loaded into the TPM and can be
+ *        shared by later unseal operations on the same Kmyth context.
+ */
+typedef struct
+{
+  // TPM 2.0 name of the SK, computed from the .ski sk_pub (cache key)
+  TPM2B_NAME name;
+
+  // transient handle of the loaded SK, zero while swapped out (an entry
+  // that is neither loaded nor swapped out is empty)
+  TPM2_HANDLE handle;
+
+  // saved context of the SK while it is swapped out
+  TPMS_CONTEXT saved;
+  bool swapped_out;
+
+  // use counter value of the last lookup or insert, for LRU eviction
+  uint64_t last_used;
+} kmyth_sk_cache_entry;
+
+/**
+ * @brief Size of the secure arena (see kmyth_arena in memory_util.h) a
+ *        Kmyth context draws its short-lived wrapping keys from.
+ */
+#define KMYTH_CTX_ARENA_SIZE 4096
+
+/**
+ * @brief Maximum number of authorization policy digests a Kmyth context
+ *        keeps cached.
+ */
+#define KMYTH_POLICY_CACHE_SIZE 8
+
+/**
+ * @brief An authorization policy digest computed for a seal, and the inputs
+ *        it was computed from. An entry only matches while the selected PCRs
+ *        still hold the values it was computed with.
+ */
+typedef struct
+{
+  // PCR selection the policy was computed for (cache key)
+  TPML_PCR_SELECTION pcrList;
+
+  // digest of the selected PCR values at computation time (cache key)
+  TPM2B_DIGEST pcrDigest;
+
+  // expected policy-OR branches following the first one, count of 0 if
+  // none (cache key)
+  TPML_DIGEST expectedBranches;
+
+  // PolicyAuthValue/PolicyPCR digest (the first policy-OR branch)
+  TPM2B_DIGEST basePolicy;
+
+  // digest to use as the authPolicy of new objects
+  TPM2B_DIGEST authPolicy;
+
+  // entry holds a computed policy
+  bool valid;
+} kmyth_policy_cache_entry;
+
+/**
+ * @brief An unsealed secret kept by the optional secret cache (see
+ *        kmyth_ctx_set_secret_cache()). The data lives in mlock()ed memory
+ *        and only matches while the selected PCRs still hold the values
+ *        they had when it was unsealed.
+ */
+typedef struct
+{
+  // digest of the .ski bytes and authorization values (cache key)
+  TPM2B_DIGEST key;
+
+  // PCR selection of the .ski and its PCR value digest at unseal time
+  TPML_PCR_SELECTION pcrList;
+  TPM2B_DIGEST pcrDigest;
+
+  // unsealed data (NULL marks an empty entry)
+  uint8_t *data;
+  size_t data_len;
+
+  // CLOCK_MONOTONIC time (seconds) after which the entry is stale, or
+  // zero if it does not expire
+  time_t expires;
+
+  // use counter value of the last hit, for LRU eviction
+  uint64_t last_used;
+} kmyth_secret_cache_entry;
+
+/**
+ * @brief Internal state held by a kmyth_ctx_t handle.
+ */
+struct kmyth_ctx
+{
+  // System API (SAPI) context, kept open for the lifetime of the handle
+  TSS2_SYS_CONTEXT *sapi_ctx;
+
+  // OpenSSL cipher state reused by every encrypt/decrypt of the handle
+  kmyth_cipher_ctx *cipher_ctx;
+
+  // locked memory for the wrapping keys of seal calls (empty, and the heap
+  // is used instead, if it could not be mapped)
+  kmyth_arena arena;
+
+  // loaded storage keys, keyed by name, reused across unseal calls
+  kmyth_sk_cache_entry sk_cache[KMYTH_SK_CACHE_SIZE];
+
+  // SK pool use counter (see kmyth_sk_cache_entry.last_used)
+  uint64_t sk_cache_uses;
+
+  // policy digests computed by earlier seal calls
+  kmyth_policy_cache_entry policy_cache[KMYTH_POLICY_CACHE_SIZE];
+
+  // next entry to replace when the policy cache is full (round robin)
+  size_t policy_cache_next;
+
+  // compute policy digests in software instead of with trial sessions
+  bool software_policy;
+
+  // wrapping key used by every seal (NULL for a random key per seal)
+  uint8_t *wrap_key;
+  size_t wrap_key_len;
+
+  // policy session kept open (continueSession) across seal/unseal calls
+  SESSION session;
+  bool have_session;
+
+  // optional unsealed-secret cache (secret_cache_size zero when disabled)
+  kmyth_secret_cache_entry *secret_cache;
+  size_t secret_cache_size;
+  size_t secret_cache_max_bytes;
+  size_t secret_cache_bytes;
+  unsigned int secret_cache_ttl;
+  uint64_t secret_cache_uses;
+  uint64_t secret_cache_hits;
+  uint64_t secret_cache_misses;
+
+  // master secret held for kmyth_derive_key() (NULL when none is held),
+  // from the context's arena where it fits, and the secret cache key (see
+  // kmyth_secret_cache_key()) of the .ski and authorization it came from
+  uint8_t *derive_master;
+  size_t derive_master_len;
+  TPM2B_DIGEST derive_master_key;
+};
+
+/**
+ * @brief Flushes a transient object or session handle from the TPM.
+ *
+ * Because a Kmyth context keeps its TPM connection open across calls,
+ * transient objects (e.g., a loaded storage key or sealed data object)
+ * are no longer cleaned up implicitly when the connection is torn down.
+ * Callers use this to release them explicitly once they are done.
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, must be initialized
+ *                       and passed in as pointer to the SAPI context
+ *
+ * @param[in]  handle    TPM 2.0 handle to be flushed. A zero handle is
+ *                       ignored (treated as "nothing loaded").
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_flush_handle(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle);
+
+/**
+ * @brief Looks up a storage key (SK) in the context's SK pool. An SK that
+ *        was swapped out is loaded back from its saved context, swapping
+ *        out the least recently used loaded SK if necessary. If the saved
+ *        context can no longer be loaded (e.g., after a TPM reset), the
+ *        entry is dropped and the SK is reported as not cached.
+ *
+ * @param[in]  ctx       Kmyth context, must be initialized
+ *
+ * @param[in]  sk_name   TPM 2.0 name of the SK (see
+ *                       compute_kmyth_object_name())
+ *
+ * @return transient handle of the cached SK, or zero if it is not cached
+ */
+TPM2_HANDLE kmyth_sk_cache_lookup(kmyth_ctx_t * ctx, TPM2B_NAME * sk_name);
+
+/**
+ * @brief Adds a loaded storage key (SK) to the context's SK pool. If the
+ *        pool is full, the least recently used SK is dropped, and if too
+ *        many SKs are loaded, the least recently used loaded SK is swapped
+ *        out. After a successful insert the pool owns (and will flush) the
+ *        SK, so its handle is only valid until the next pool operation.
+ *
+ * @param[in]  ctx       Kmyth context, must be initialized
+ *
+ * @param[in]  sk_name   TPM 2.0 name of the SK
+ *
+ * @param[in]  sk_handle Transient handle of the loaded SK
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_sk_cache_insert(kmyth_ctx_t * ctx,
+                          TPM2B_NAME * sk_name, TPM2_HANDLE sk_handle);
+
+/**
+ * @brief Removes a storage key (SK) from the context's SK cache and
+ *        flushes it from the TPM (e.g., when its handle is found to be
+ *        no longer usable).
+ *
+ * @param[in]  ctx       Kmyth context, must be initialized
+ *
+ * @param[in]  sk_name   TPM 2.0 name of the SK
+ */
+void kmyth_sk_cache_remove(kmyth_ctx_t * ctx, TPM2B_NAME * sk_name);
+
+/**
+ * @brief Flushes every loaded storage key (SK), discards the saved contexts
+ *        of swapped out SKs, and empties the SK pool.
+ *
+ * @param[in]  ctx       Kmyth context, must be initialized
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_sk_cache_clear(kmyth_ctx_t * ctx);
+
+/**
+ * @brief Returns the context's policy session, starting it on first use.
+ *        The session is continued across commands and calls (the TPM
+ *        resets its policy digest after each authorized command), so
+ *        later operations on the context skip TPM2_StartAuthSession.
+ *
+ * @param[in]  ctx       Kmyth context, must be initialized
+ *
+ * @return pointer to the context's session, or NULL if none could be
+ *         started
+ */
+SESSION *kmyth_ctx_get_session(kmyth_ctx_t * ctx);
+
+/**
+ * @brief Flushes the context's policy session and forgets it. Called when
+ *        a command authorized by the session failed, leaving its policy
+ *        and nonce state unknown; the next kmyth_ctx_get_session() call
+ *        starts a fresh one.
+ *
+ * @param[in]  ctx       Kmyth context, must be initialized
+ */
+void kmyth_ctx_drop_session(kmyth_ctx_t * ctx);
+
+/**
+ * @brief Looks up a cached authorization policy digest.
+ *
+ * @param[in]  ctx            Kmyth context, must be initialized
+ *
+ * @param[in]  key            Entry whose pcrList, pcrDigest, and
+ *                            expectedBranches fields are to be matched
+ *
+ * @param[out] result         Matching entry (all fields) if one is cached
+ *
+ * @return true if a matching entry was found, false otherwise
+ */
+bool kmyth_policy_cache_lookup(kmyth_ctx_t * ctx,
+                               kmyth_policy_cache_entry * key,
+                               kmyth_policy_cache_entry * result);
+
+/**
+ * @brief Adds a computed authorization policy digest to the context's
+ *        policy cache, replacing the oldest entry if the cache is full.
+ *
+ * @param[in]  ctx            Kmyth context, must be initialized
+ *
+ * @param[in]  entry          Entry to cache (marked valid when stored)
+ */
+void kmyth_policy_cache_insert(kmyth_ctx_t * ctx,
+                               kmyth_policy_cache_entry * entry);
+
+/**
+ * @brief Computes the secret cache key for an unseal request: a digest of
+ *        the .ski bytes and both authorization values, so that a cached
+ *        secret is only returned to a caller that could unseal it.
+ *
+ * @param[in]  ski            .ski bytes
+ *
+ * @param[in]  ski_len        Number of .ski bytes
+ *
+ * @param[in]  objAuthVal     Authorization value for the Kmyth objects
+ *
+ * @param[in]  ownerAuth      Owner (storage) hierarchy authorization
+ *
+ * @param[out] key            Resulting cache key
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_secret_cache_key(uint8_t * ski, size_t ski_len,
+                           TPM2B_AUTH * objAuthVal, TPM2B_AUTH * ownerAuth,
+                           TPM2B_DIGEST * key);
+
+/**
+ * @brief Looks up an unsealed secret in the context's secret cache. Stale
+ *        entries (expired, or whose PCR values have changed) are wiped
+ *        instead of being returned.
+ *
+ * @param[in]  ctx            Kmyth context, must be initialized
+ *
+ * @param[in]  key            Cache key (see kmyth_secret_cache_key())
+ *
+ * @param[out] output         Copy of the cached secret (caller frees)
+ *
+ * @param[out] output_len     Size of the cached secret
+ *
+ * @return true on a cache hit, false otherwise
+ */
+bool kmyth_secret_cache_lookup(kmyth_ctx_t * ctx, TPM2B_DIGEST * key,
+                               uint8_t ** output, size_t *output_len);
+
+/**
+ * @brief Adds an unsealed secret to the context's secret cache, evicting
+ *        stale and then least recently used entries as needed. Secrets
+ *        that do not fit, or that cannot be locked in memory, are simply
+ *        not cached.
+ *
+ * @param[in]  ctx            Kmyth context, must be initialized
+ *
+ * @param[in]  key            Cache key (see kmyth_secret_cache_key())
+ *
+ * @param[in]  pcrList        PCR selection of the .ski the secret came from
+ *
+ * @param[in]  data           Unsealed secret (copied)
+ *
+ * @param[in]  data_len       Size of the unsealed secret
+ */
+void kmyth_secret_cache_insert(kmyth_ctx_t * ctx, TPM2B_DIGEST * key,
+                               TPML_PCR_SELECTION pcrList,
+                               uint8_t * data, size_t data_len);
+
+/**
+ * @brief Wipes (kmyth_clear()) and releases every cached secret.
+ *
+ * @param[in]  ctx            Kmyth context, must be initialized
+ */
+void kmyth_secret_cache_clear(kmyth_ctx_t * ctx);
+
+#endif /* KMYTH_CONTEXT_H */
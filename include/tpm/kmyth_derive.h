@@ -0,0 +1,43 @@
+/**
+ * @file  kmyth_derive.h
+ *
+ * @brief Provides the key derivation behind kmyth_derive_key() (declared
+ *        in kmyth.h): keys are derived in software, with HKDF-SHA256, from
+ *        a master secret that is sealed once and held by a Kmyth context
+ *        after its first unseal.
+ */
+
+#ifndef KMYTH_DERIVE_H
+#define KMYTH_DERIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Derives key material with HKDF-SHA256 (RFC 5869, extract and
+ *        expand, with no salt).
+ *
+ * @param[in]  ikm           Input keying material (e.g., a master secret)
+ *
+ * @param[in]  ikm_len       Length of ikm in bytes
+ *
+ * @param[in]  info          Context and application specific information
+ *                           (e.g., a purpose label), may be NULL if
+ *                           info_len is 0
+ *
+ * @param[in]  info_len      Length of info in bytes
+ *
+ * @param[out] out           Buffer for the derived bytes
+ *
+ * @param[in]  out_len       Number of bytes to derive, at most
+ *                           KMYTH_DERIVE_MAX_KEY_LEN
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_hkdf_sha256(const uint8_t * ikm, size_t ikm_len,
+                      const uint8_t * info, size_t info_len,
+                      uint8_t * out, size_t out_len);
+
+#endif /* KMYTH_DERIVE_H */
@@ -0,0 +1,145 @@
+/**
+ * @file  kmyth_dispatch.h
+ *
+ * @brief Provides the internals of the multi-TPM job dispatcher behind
+ *        tpm2_kmyth_seal_sharded() and tpm2_kmyth_unseal_sharded(). Each
+ *        TPM endpoint gets a worker thread with its own Kmyth context and
+ *        its own job queue; a worker that runs out of work steals from the
+ *        back of another worker's queue, so a slow endpoint does not hold
+ *        back the rest of the batch.
+ */
+
+#ifndef KMYTH_DISPATCH_H
+#define KMYTH_DISPATCH_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Maximum number of TPM endpoints a single dispatch can use
+ */
+#define KMYTH_DISPATCH_MAX_ENDPOINTS 64
+
+/**
+ * @brief Operation applied to every job of a dispatch
+ */
+typedef enum
+{
+  KMYTH_DISPATCH_SEAL,
+  KMYTH_DISPATCH_UNSEAL
+} kmyth_dispatch_op;
+
+/**
+ * @brief Per-endpoint job queue (job indices into the dispatch arrays)
+ */
+typedef struct
+{
+  pthread_mutex_t lock;
+
+  // jobs that must run on this endpoint, taken in order by its worker
+  size_t *pinned;
+  size_t pinned_count;
+  size_t pinned_next;
+
+  // jobs any endpoint may run: the owner takes them from the head, other
+  // workers steal them from the tail
+  size_t *shared;
+  size_t shared_head;
+  size_t shared_tail;
+} kmyth_dispatch_queue;
+
+/**
+ * @brief A batch of seal or unseal jobs spread across several TPM endpoints
+ */
+typedef struct
+{
+  kmyth_dispatch_op op;
+
+  // TPM endpoints (TCTI specifications) and their job queues
+  size_t endpoint_count;
+  const char **tcti_specs;
+  kmyth_dispatch_queue *queues;
+
+  // jobs (see tpm2_kmyth_seal_sharded())
+  size_t count;
+  uint8_t **inputs;
+  size_t *input_lens;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  size_t *endpoints;
+
+  // parameters shared by every job
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+  int *pcrs;
+  size_t pcrs_len;
+  char *cipher_string;
+  char *expected_policy;
+  uint8_t bool_policy_or;
+} kmyth_dispatch;
+
+/**
+ * @brief Builds the job queues of a dispatch. Jobs with an endpoint
+ *        affinity are pinned to that endpoint's queue; the others are
+ *        spread round robin over the shared queues.
+ *
+ * @param[in,out] dispatch       Dispatch whose endpoint_count and count
+ *                               fields are set. Its queues are allocated.
+ *
+ * @param[in]  affinity          Array of count endpoint indices, with
+ *                               KMYTH_ANY_ENDPOINT for jobs that may run
+ *                               anywhere, or NULL if no job has one
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_dispatch_init_queues(kmyth_dispatch * dispatch,
+                               const size_t *affinity);
+
+/**
+ * @brief Releases the job queues of a dispatch.
+ *
+ * @param[in,out] dispatch       Dispatch initialized by
+ *                               kmyth_dispatch_init_queues()
+ */
+void kmyth_dispatch_free_queues(kmyth_dispatch * dispatch);
+
+/**
+ * @brief Takes the next job for a worker: its own pinned jobs first, then
+ *        the head of its shared queue, and finally the tail of the shared
+ *        queue of another endpoint (work stealing).
+ *
+ * @param[in]  dispatch          Dispatch with initialized queues
+ *
+ * @param[in]  worker            Endpoint index of the calling worker
+ *
+ * @param[in]  steal             Whether the worker may take jobs queued for
+ *                               other endpoints
+ *
+ * @param[out] job               Index of the job taken
+ *
+ * @return true if a job was taken, false if there is no work left
+ */
+bool kmyth_dispatch_next_job(kmyth_dispatch * dispatch, size_t worker,
+                             bool steal, size_t *job);
+
+/**
+ * @brief Runs every job of a dispatch, with one worker thread (and Kmyth
+ *        context) per endpoint, and waits for all of them to finish.
+ *        A worker that cannot connect to its endpoint leaves its shared
+ *        jobs to be stolen by the others; its pinned jobs fail.
+ *
+ * @param[in,out] dispatch       Dispatch with initialized queues. Every
+ *                               results entry is set.
+ *
+ * @return 0 if every job succeeded, 1 otherwise
+ */
+int kmyth_dispatch_run(kmyth_dispatch * dispatch);
+
+#endif /* KMYTH_DISPATCH_H */
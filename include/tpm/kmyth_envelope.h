@@ -0,0 +1,81 @@
+/**
+ * @file  kmyth_envelope.h
+ *
+ * @brief Provides the internal definition of the envelope key handle
+ *        (kmyth_envelope_t) declared in kmyth.h.
+ *
+ * Enveloped data is a text block file:
+ *
+ *   KMYTH_DELIM_ENVELOPE_KEK_ID   identifier of the KEK (base64)
+ *   KMYTH_DELIM_CIPHER_SUITE      cipher name of the encrypted data
+ *   KMYTH_DELIM_WRAPPED_DEK       DEK wrapped under the KEK (base64)
+ *   KMYTH_DELIM_ENC_DATA          encrypted data (base64)
+ *   KMYTH_DELIM_END_FILE
+ */
+
+#ifndef KMYTH_ENVELOPE_H
+#define KMYTH_ENVELOPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cipher/cipher.h"
+#include "kmyth.h"
+#include "memory_util.h"
+
+/**
+ * @brief Size, in bytes, of an envelope key encryption key (KEK)
+ */
+#define KMYTH_ENVELOPE_KEK_LEN 32
+
+/**
+ * @brief Size, in bytes, of the KEK identifier recorded with enveloped
+ *        data: a truncated SHA-256 digest of the KEK, so that data
+ *        enveloped under another KEK is reported as such rather than as
+ *        a failed unwrap
+ */
+#define KMYTH_ENVELOPE_KEK_ID_LEN 16
+
+/**
+ * @brief Size of the secure arena (see kmyth_arena in memory_util.h) an
+ *        envelope key holds its KEK, and the DEK in use, in.
+ */
+#define KMYTH_ENVELOPE_ARENA_SIZE 4096
+
+/**
+ * @brief Internal state held by a kmyth_envelope_t handle.
+ */
+struct kmyth_envelope
+{
+  // locked memory for the KEK and DEKs (empty, and the heap is used
+  // instead, if it could not be mapped)
+  kmyth_arena arena;
+
+  // the unsealed KEK
+  uint8_t *kek;
+  size_t kek_len;
+
+  // identifier of the KEK, recorded with and checked against each envelope
+  uint8_t kek_id[KMYTH_ENVELOPE_KEK_ID_LEN];
+
+  // OpenSSL cipher state reused by every wrap, unwrap, encrypt and decrypt
+  kmyth_cipher_ctx *cipher_ctx;
+};
+
+/**
+ * @brief Opens an envelope key from an unsealed key encryption key (KEK).
+ *        kmyth_envelope_open() calls this after its TPM unseal.
+ *
+ * @param[in]  kek           The KEK (copied)
+ *
+ * @param[in]  kek_len       Number of bytes in kek (16, 24, or 32)
+ *
+ * @param[out] env           The open envelope key (release it with
+ *                           kmyth_envelope_close())
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_envelope_open_kek(const uint8_t * kek, size_t kek_len,
+                            kmyth_envelope_t ** env);
+
+#endif /* KMYTH_ENVELOPE_H */
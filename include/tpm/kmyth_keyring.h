@@ -0,0 +1,106 @@
+/**
+ * @file  kmyth_keyring.h
+ *
+ * @brief Provides the optional cross-process cache of unsealed data in the
+ *        Linux kernel keyring. Unlike the per-context secret cache (see
+ *        kmyth_ctx_set_secret_cache()), entries outlive the process that
+ *        unsealed them, so short-lived processes on the same host unsealing
+ *        the same .ski only go to the TPM once per timeout.
+ *
+ * An entry is a "user" key whose description is derived from the .ski
+ * bytes and the authorization values (see kmyth_secret_cache_key()), so it
+ * is only found by a caller that could unseal the .ski. It can be read by
+ * processes of the same user only, and the kernel drops it once its
+ * timeout expires. Within that window the PCR policy of the .ski is not
+ * checked again, which is why the cache is off unless selected.
+ */
+
+#ifndef KMYTH_KEYRING_H
+#define KMYTH_KEYRING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+/**
+ * @brief Type of the keys holding cached unsealed data
+ */
+#define KMYTH_KEYRING_KEY_TYPE "user"
+
+/**
+ * @brief Prefix of the description of the keys holding cached unsealed
+ *        data (followed by the hex encoded cache key)
+ */
+#define KMYTH_KEYRING_DESC_PREFIX "kmyth:"
+
+/**
+ * @brief Largest unsealed result cached (the payload limit of a "user"
+ *        key); larger results are simply not cached
+ */
+#define KMYTH_KEYRING_MAX_DATA 32767
+
+/**
+ * @brief Selects the kernel keyring that unsealed data is cached in.
+ *
+ * The specification has the form "<keyring>[:<timeout>]", where keyring
+ * is one of:
+ *   - user    : the keyring shared by all processes of the user
+ *   - session : the session keyring of the process (e.g., a login session
+ *               or a service), shared with the processes it starts
+ *   - none    : no caching
+ * and timeout is the lifetime of each entry in seconds (defaults to
+ * KMYTH_KEYRING_DEFAULT_TIMEOUT).
+ *
+ * If never called (or called with NULL), the specification is taken from
+ * the KMYTH_KEYRING_ENV environment variable, and otherwise no caching is
+ * done.
+ *
+ * @param[in]  spec       Keyring specification string, or NULL to revert
+ *                        to the environment selection
+ *
+ * @return 0 if success, 1 if error (invalid specification)
+ */
+int set_keyring_spec(const char *spec);
+
+/**
+ * @brief Reports whether unsealed data is cached in a kernel keyring (see
+ *        set_keyring_spec()).
+ *
+ * @return true if a keyring is selected
+ */
+bool kmyth_keyring_enabled(void);
+
+/**
+ * @brief Looks up unsealed data in the selected kernel keyring.
+ *
+ * @param[in]  key            Cache key (see kmyth_secret_cache_key())
+ *
+ * @param[out] output         Copy of the cached data (caller frees)
+ *
+ * @param[out] output_len     Size of the cached data
+ *
+ * @return true on a cache hit, false otherwise (including when no keyring
+ *         is selected)
+ */
+bool kmyth_keyring_lookup(TPM2B_DIGEST * key, uint8_t ** output,
+                          size_t *output_len);
+
+/**
+ * @brief Adds unsealed data to the selected kernel keyring, readable by
+ *        processes of the same user only and dropped by the kernel once
+ *        the timeout expires. Data that does not fit a key, or that the
+ *        kernel refuses (e.g., over the user's key quota), is simply not
+ *        cached.
+ *
+ * @param[in]  key            Cache key (see kmyth_secret_cache_key())
+ *
+ * @param[in]  data           Unsealed data (copied)
+ *
+ * @param[in]  data_len       Size of the unsealed data
+ */
+void kmyth_keyring_insert(TPM2B_DIGEST * key, uint8_t * data,
+                          size_t data_len);
+
+#endif /* KMYTH_KEYRING_H */
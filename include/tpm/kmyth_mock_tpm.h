@@ -0,0 +1,120 @@
+/**
+ * @file  kmyth_mock_tpm.h
+ *
+ * @brief Provides an in-process mock TPM, reached through the "mock" TCTI
+ *        (e.g., '-T mock' or KMYTH_TCTI=mock), so that the software side of
+ *        Kmyth (parsing, encoding, ciphers, file I/O) can be benchmarked
+ *        without the noise of a real TPM or simulator. Each command can be
+ *        given a fixed latency, with an optional jitter drawn from a seeded
+ *        generator, so that runs are repeatable; commands without one are
+ *        answered right away.
+ *
+ * The mock answers the commands Kmyth issues (CreatePrimary, Create, Load,
+ * Unseal, the policy session commands, context management, PCR access and
+ * GetCapability). It keeps persistent objects and PCRs for the life of the
+ * process, and transient objects and sessions per connection, as a
+ * resource manager would. Policy sessions are enforced (policy digests,
+ * command and response HMACs) so that the Kmyth code paths run as they do
+ * against a TPM.
+ *
+ * The mock offers NO protection: sealed data is kept in the clear in the
+ * private blobs (which are only integrity protected, with a key built into
+ * Kmyth, so that data sealed by one process can be unsealed by another),
+ * hierarchy authorization is not checked and objects are not real keys. It
+ * is for benchmarks and tests only, and so is not part of libkmyth-tpm: it
+ * is linked into kmyth-test and kmyth-bench, which make it selectable with
+ * kmyth_mock_tpm_register().
+ *
+ * The configuration (the part of the TCTI specification after "mock:") is
+ * a comma separated list of settings:
+ *   - <command>=<latency>  : latency of a command, named as in the TPM
+ *                            statistics (e.g., Unseal, PolicyPCR; case is
+ *                            ignored)
+ *   - default=<latency>    : latency of the commands not named
+ *   - seed=<number>        : seed of the jitter generator (default 1)
+ * where a latency is "<time>[~<jitter>]", and a time is a decimal number
+ * with an optional unit (ns, us, ms or s, default ms). A jitter spreads
+ * each latency uniformly over time +/- jitter, e.g.:
+ *
+ *   mock:default=2ms,Create=150ms~20ms,Unseal=25ms,seed=7
+ */
+
+#ifndef KMYTH_MOCK_TPM_H
+#define KMYTH_MOCK_TPM_H
+
+#include <stddef.h>
+
+#include <tss2/tss2_sys.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Name the mock TCTI is selected by
+ */
+#define KMYTH_MOCK_TCTI_NAME "mock"
+
+/**
+ * @brief Manufacturer (TPM2_PT_MANUFACTURER) reported by the mock TPM
+ */
+#define KMYTH_MOCK_MANUFACTURER "KMCK"
+
+/**
+ * @brief Number of transient objects, and of sessions, a connection to the
+ *        mock TPM can hold at once
+ */
+#define KMYTH_MOCK_MAX_OBJECTS 32
+#define KMYTH_MOCK_MAX_SESSIONS 16
+
+/**
+ * @brief Number of persistent objects the mock TPM can hold
+ */
+#define KMYTH_MOCK_MAX_PERSISTENT 16
+
+/**
+ * @brief Number of PCRs of the mock TPM (a single SHA-256 bank)
+ */
+#define KMYTH_MOCK_PCR_COUNT 24
+
+/**
+ * @brief Initializes a connection to the mock TPM, following the
+ *        Tss2_Tcti_*_Init() convention: called with a NULL context, it
+ *        returns the size of the context to allocate; called again with
+ *        that memory, it initializes the connection.
+ *
+ * @param[in]     tcti_ctx  The context to initialize (NULL to query size)
+ *
+ * @param[in,out] size      Size of the context
+ *
+ * @param[in]     conf      Latency configuration (see above), or NULL for
+ *                          none
+ *
+ * @return TSS2_RC_SUCCESS on success, TSS2_TCTI_RC_BAD_VALUE for an
+ *         invalid configuration, another TSS2_TCTI_RC_* code on error
+ */
+TSS2_RC kmyth_mock_tcti_init(TSS2_TCTI_CONTEXT * tcti_ctx, size_t *size,
+                             const char *conf);
+
+/**
+ * @brief Makes the mock TCTI selectable (with set_tcti_spec() or the
+ *        KMYTH_TCTI environment variable) in the calling program. Each
+ *        connection to the mock TPM logs a warning, as it offers no
+ *        protection.
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_mock_tpm_register(void);
+
+/**
+ * @brief Returns the mock TPM to its initial state: persistent objects are
+ *        removed and PCRs are cleared. Connections already open keep their
+ *        transient objects and sessions.
+ */
+void kmyth_mock_tpm_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KMYTH_MOCK_TPM_H */
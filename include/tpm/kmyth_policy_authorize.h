@@ -0,0 +1,147 @@
+/**
+ * @file  kmyth_policy_authorize.h
+ *
+ * @brief Provides sealing to signed policies (TPM2_PolicyAuthorize). Data
+ *        sealed to an authorizing key can be unsealed under any PCR policy
+ *        that key has signed an approval of, so a planned PCR change (e.g.,
+ *        a kernel or firmware update) only requires distributing a new
+ *        signed policy rather than resealing every .ski.
+ *
+ * The authorizing key is an RSA key (RSASSA with SHA-256). Its public part
+ * is recorded in the .ski; its private part stays with whoever approves
+ * policies (see kmyth-sign-policy). A signed policy is a text block file:
+ *
+ *   KMYTH_DELIM_APPROVED_POLICY       approved policy digest (base64
+ *                                     marshalled TPM2B_DIGEST)
+ *   KMYTH_DELIM_AUTHORIZING_KEY_NAME  name of the signing key (base64
+ *                                     marshalled TPM2B_NAME)
+ *   KMYTH_DELIM_POLICY_SIGNATURE      signature over the approved policy
+ *                                     (base64 marshalled TPMT_SIGNATURE)
+ *   KMYTH_DELIM_END_FILE
+ *
+ * The approved policy is the digest kmyth-seal -g reports for a PCR state
+ * (PolicyAuthValue followed by PolicyPCR), and the policyRef is empty.
+ */
+
+#ifndef KMYTH_POLICY_AUTHORIZE_H
+#define KMYTH_POLICY_AUTHORIZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+/**
+ * @brief Smallest RSA modulus, in bits, accepted for an authorizing key
+ */
+#define KMYTH_AUTHORIZING_KEY_MIN_BITS 2048
+
+/**
+ * @brief Converts a PEM encoded RSA key (a public key, or a private key of
+ *        which only the public part is used) to the TPM 2.0 public area
+ *        that is loaded to check its signatures.
+ *
+ * @param[in]  pem        PEM encoded key
+ *
+ * @param[in]  pem_len    Size of the PEM encoded key
+ *
+ * @param[out] key        TPM 2.0 public area of the key
+ *
+ * @return 0 on success, 1 on error (including a key that is not RSA, is
+ *         smaller than KMYTH_AUTHORIZING_KEY_MIN_BITS, or has a public
+ *         exponent other than 65537)
+ */
+int kmyth_pem_to_authorizing_key(const uint8_t * pem, size_t pem_len,
+                                 TPM2B_PUBLIC * key);
+
+/**
+ * @brief Selects the authorizing key that data is sealed to (instead of its
+ *        PCR policy).
+ *
+ * @param[in]  pem_path   Path of the PEM encoded RSA public key, or NULL to
+ *                        seal to PCR policies directly (the default)
+ *
+ * @return 0 if success, 1 if error (unreadable or unsupported key)
+ */
+int set_authorizing_key(const char *pem_path);
+
+/**
+ * @brief Retrieves the authorizing key selected by set_authorizing_key().
+ *
+ * @return the key's public area, or NULL if none is selected
+ */
+const TPM2B_PUBLIC *get_authorizing_key(void);
+
+/**
+ * @brief Signs an approval of a policy digest with an authorizing key,
+ *        producing a signed policy file.
+ *
+ * @param[in]  approvedPolicy  Policy digest to approve
+ *
+ * @param[in]  pem             PEM encoded RSA private key
+ *
+ * @param[in]  pem_len         Size of the PEM encoded key
+ *
+ * @param[out] output          Signed policy file contents (caller frees)
+ *
+ * @param[out] output_len      Size of the signed policy file
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_sign_policy(TPM2B_DIGEST * approvedPolicy,
+                      const uint8_t * pem, size_t pem_len,
+                      uint8_t ** output, size_t *output_len);
+
+/**
+ * @brief Parses a signed policy file. The signature is not checked here:
+ *        the TPM checks it when the approval is used.
+ *
+ * @param[in]  input           Signed policy file contents
+ *
+ * @param[in]  input_len       Size of the signed policy file
+ *
+ * @param[out] approvedPolicy  Approved policy digest
+ *
+ * @param[out] keyName         Name of the key that signed the approval
+ *
+ * @param[out] signature       Signature over the approved policy
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_signed_policy(uint8_t * input, size_t input_len,
+                        TPM2B_DIGEST * approvedPolicy, TPM2B_NAME * keyName,
+                        TPMT_SIGNATURE * signature);
+
+/**
+ * @brief Selects where signed policies are looked up at unseal.
+ *
+ * If never called (or called with NULL), the path is taken from the
+ * KMYTH_SIGNED_POLICY_ENV environment variable.
+ *
+ * @param[in]  path       Signed policy file, or directory holding any
+ *                        number of them, or NULL to revert to the
+ *                        environment selection
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_signed_policy_path(const char *path);
+
+/**
+ * @brief Finds the signed policy approving a policy digest, signed by a
+ *        given key, among those selected by set_signed_policy_path().
+ *        Files in a directory that are not signed policies are skipped.
+ *
+ * @param[in]  policy      Policy digest that must be approved (the one the
+ *                         current PCR values satisfy)
+ *
+ * @param[in]  keyName     Name of the authorizing key
+ *
+ * @param[out] signature   Signature of the matching approval
+ *
+ * @return 0 if found, 1 otherwise
+ */
+int kmyth_find_signed_policy(TPM2B_DIGEST * policy, TPM2B_NAME * keyName,
+                             TPMT_SIGNATURE * signature);
+
+#endif /* KMYTH_POLICY_AUTHORIZE_H */
@@ -0,0 +1,121 @@
+/**
+ * @file  kmyth_prewarm.h
+ *
+ * @brief Provides secret cache prewarming: the .ski files listed in a
+ *        manifest are unsealed ahead of time, on a Kmyth context with its
+ *        secret cache enabled (see kmyth_ctx_set_secret_cache()), so that
+ *        the services asking for them after boot find them cached instead
+ *        of contending for the TPM all at once.
+ *
+ *        A manifest lists one .ski path per line, optionally preceded by a
+ *        priority (a number followed by white space); entries without one
+ *        get KMYTH_PREWARM_DEFAULT_PRIORITY. Empty lines and lines starting
+ *        with '#' are ignored. Entries are unsealed in increasing order of
+ *        priority and, within a priority, those sealed under the same
+ *        storage key and policy are unsealed one after the other, while the
+ *        context still holds the loaded storage key and policy digests.
+ */
+
+#ifndef KMYTH_PREWARM_H
+#define KMYTH_PREWARM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Priority of manifest entries that do not give one
+ */
+#define KMYTH_PREWARM_DEFAULT_PRIORITY 100
+
+/**
+ * @brief Maximum number of entries in a prewarm manifest
+ */
+#define KMYTH_PREWARM_MAX_ENTRIES 4096
+
+/**
+ * @brief One manifest entry
+ */
+typedef struct
+{
+  // .ski path, and the manifest line it came from
+  char *path;
+  size_t line;
+
+  // lower priorities are unsealed first
+  long priority;
+
+  // .ski contents (see kmyth_prewarm_load())
+  uint8_t *ski;
+  size_t ski_len;
+
+  // name of the storage key and authorization policy of the sealed data,
+  // and whether it is sealed to a compound "policy or"
+  TPM2B_NAME sk_name;
+  TPM2B_DIGEST policy;
+  uint8_t policy_or;
+} kmyth_prewarm_item;
+
+/**
+ * @brief Parses a prewarm manifest.
+ *
+ * @param[in]  manifest      Manifest contents
+ *
+ * @param[in]  manifest_len  Length of the manifest in bytes
+ *
+ * @param[out] items         Entries, in manifest order, to be released
+ *                           with kmyth_prewarm_free()
+ *
+ * @param[out] count         Number of entries
+ *
+ * @return 0 on success, 1 on error (e.g., an invalid priority)
+ */
+int kmyth_prewarm_parse_manifest(const uint8_t * manifest,
+                                 size_t manifest_len,
+                                 kmyth_prewarm_item ** items, size_t *count);
+
+/**
+ * @brief Reads the .ski of an entry and finds its storage key and policy.
+ *
+ * @param[in,out] item       Entry whose path is set
+ *
+ * @return 0 on success, 1 on error (the entry can't be prewarmed)
+ */
+int kmyth_prewarm_load(kmyth_prewarm_item * item);
+
+/**
+ * @brief Sorts loaded entries into the order they are unsealed in: by
+ *        priority, then (keeping the order the groups first appear in)
+ *        grouped by storage key and policy, then in manifest order.
+ *
+ * @param[in,out] items      Entries
+ *
+ * @param[in]     count      Number of entries
+ */
+void kmyth_prewarm_order(kmyth_prewarm_item * items, size_t count);
+
+/**
+ * @brief Unseals a loaded entry (with empty authorization values) into the
+ *        secret cache of a Kmyth context, discarding the result.
+ *
+ * @param[in]  ctx           Kmyth context with its secret cache enabled
+ *
+ * @param[in]  item          Loaded entry
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_prewarm_unseal(kmyth_ctx_t * ctx, kmyth_prewarm_item * item);
+
+/**
+ * @brief Releases manifest entries.
+ *
+ * @param[in]  items         Entries from kmyth_prewarm_parse_manifest()
+ *
+ * @param[in]  count         Number of entries
+ */
+void kmyth_prewarm_free(kmyth_prewarm_item * items, size_t count);
+
+#endif /* KMYTH_PREWARM_H */
@@ -0,0 +1,111 @@
+/**
+ * @file  kmyth_reseal_plan.h
+ *
+ * @brief Provides incremental reseal planning: from the headers of .ski
+ *        files alone, and a prediction of the PCR values (the current ones,
+ *        a manifest of the values expected after an update, or both), the
+ *        files whose authorization policy will no longer be satisfied are
+ *        found, so that only those need re-sealing.
+ *
+ *        A PCR values manifest gives one SHA-256 PCR value per line, as the
+ *        PCR index followed by white space (or '=' or ':') and 64 hex
+ *        digits, e.g. "7 3d458cfe55cc03ea1f443f1562beec8df51c75e14a9fcf9a"
+ *        "7234a13f198e7969". Empty lines and lines starting with '#' are
+ *        ignored. PCRs the manifest does not list keep their current value
+ *        (see kmyth_pcr_values_read()).
+ */
+
+#ifndef KMYTH_RESEAL_PLAN_H
+#define KMYTH_RESEAL_PLAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "defines.h"
+#include "kmyth.h"
+
+/**
+ * @brief Predicted SHA-256 PCR values (of PCRs 0 to
+ *        KMYTH_DEFAULT_PCR_COUNT - 1)
+ */
+typedef struct
+{
+  // whether a value is known for each PCR, and the value
+  bool known[KMYTH_DEFAULT_PCR_COUNT];
+  uint8_t value[KMYTH_DEFAULT_PCR_COUNT][KMYTH_DIGEST_SIZE];
+} kmyth_pcr_values;
+
+/**
+ * @brief What an incremental reseal does with a .ski file
+ */
+typedef enum
+{
+  // the policy is satisfied by the predicted PCR values: leave it alone
+  KMYTH_RESEAL_PLAN_KEEP = 0,
+
+  // the policy is not satisfied by the predicted PCR values: re-seal it
+  KMYTH_RESEAL_PLAN_RESEAL,
+
+  // sealed to an authorizing key: re-sealing does not help, a signed
+  // policy approving the new PCR values is needed instead
+  KMYTH_RESEAL_PLAN_SIGNED,
+} kmyth_reseal_plan_action;
+
+/**
+ * @brief Parses a PCR values manifest into a set of predicted PCR values.
+ *        Values already known are replaced by those in the manifest.
+ *
+ * @param[in]     manifest      Manifest contents
+ *
+ * @param[in]     manifest_len  Length of the manifest in bytes
+ *
+ * @param[in,out] values        Predicted PCR values
+ *
+ * @return 0 on success, 1 on error (e.g., a PCR listed twice; values is
+ *         then left as it was)
+ */
+int kmyth_pcr_values_parse(const uint8_t * manifest, size_t manifest_len,
+                           kmyth_pcr_values * values);
+
+/**
+ * @brief Fills in, from the TPM of a Kmyth context, the current value of
+ *        every PCR whose value is not known yet. Nothing is read when all
+ *        of them are known.
+ *
+ * @param[in]     ctx           Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in,out] values        Predicted PCR values
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_pcr_values_read(kmyth_ctx_t * ctx, kmyth_pcr_values * values);
+
+/**
+ * @brief Decides, from the header of a .ski file, whether its policy is
+ *        satisfied by a set of predicted PCR values: the policy digest
+ *        that kmyth-seal would give an object sealed to the file's PCR
+ *        selection under those values is computed in software, and
+ *        compared with the file's policy (or with each of its policy-OR
+ *        branches). No TPM is needed.
+ *
+ * @param[in]  ski              The .ski file contents (or a prefix that
+ *                              reaches the encrypted data)
+ *
+ * @param[in]  ski_len          Number of bytes in ski
+ *
+ * @param[in]  values           Predicted PCR values (every PCR the file
+ *                              selects must be known)
+ *
+ * @param[out] action           What to do with the file
+ *
+ * @return 0 on success, 1 on error (e.g., an invalid .ski, or a PCR
+ *         selection outside the SHA-256 bank)
+ */
+int kmyth_reseal_plan_check(uint8_t * ski, size_t ski_len,
+                            const kmyth_pcr_values * values,
+                            kmyth_reseal_plan_action * action);
+
+#endif /* KMYTH_RESEAL_PLAN_H */
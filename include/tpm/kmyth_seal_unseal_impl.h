@@ -10,11 +10,18 @@
 #ifndef KMYTH_SEAL_UNSEAL_IMPL_H
 #define KMYTH_SEAL_UNSEAL_IMPL_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <tss2/tss2_sys.h>
 
+#include "kmyth.h"
+#include "cipher/compression.h"
+#include "object_tools.h"
+#include "tpm2_interface.h"
+
 /**
  * @brief Seal data using TPM 2.0.
  *
@@ -52,11 +59,10 @@
  *                               sealed data object's auth policy completely and
  *                               correctly
  *
- * @param[in]  sdo_policyBranch1 Optional policy branch to be used in the
- *                               calculation of a compound "policy or" policy
- *
- * @param[in]  sdo_policyBranch2 Second optional policy branch to be used in the
+ * @param[in]  sdo_policyBranches Optional policy branches (2 to
+ *                               KMYTH_MAX_POLICY_BRANCHES) to be used in the
  *                               calculation of a compound "policy or" policy
+ *                               (a count of 0 for a simple policy)
  *
  * @param[out] sdo_public        TPM 2.0 sized buffer to hold the returned 'public
  *                               area' structure for the sealed data object
@@ -75,10 +81,45 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                          TPM2B_AUTH sdo_authVal,
                          TPML_PCR_SELECTION sdo_pcrList,
                          TPM2B_DIGEST sdo_authPolicy,
-                         TPM2B_DIGEST sdo_policyBranch1,
-                         TPM2B_DIGEST sdo_policyBranch2,
+                         TPML_DIGEST sdo_policyBranches,
                          TPM2B_PUBLIC * sdo_public,
                          TPM2B_PRIVATE * sdo_private);
+/**
+ * @brief Same as tpm2_kmyth_seal_data(), but authorizes use of the storage
+ *        key with a policy session supplied (and later flushed) by the
+ *        caller. The session's policy is (re-)applied before the create, so
+ *        one session can be continued across many seal operations.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be initialized
+ *                               and passed in as pointer to the SAPI context
+ *
+ * @param[in]  sealData_session  Started TPM2_SE_POLICY session used to
+ *                               authorize the use of the storage key
+ *
+ * @param[in]  sk_policyBranches Policy branches of the storage key's policy
+ *                               (tpm2_kmyth_seal_data() uses
+ *                               sdo_policyBranches), a count of 0 if it is
+ *                               a simple policy
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_data().
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_seal_data_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 SESSION * sealData_session,
+                                 uint8_t * sdo_data,
+                                 size_t sdo_dataSize,
+                                 TPM2_HANDLE sk_handle,
+                                 TPM2B_AUTH sk_authVal,
+                                 TPML_PCR_SELECTION sk_pcrList,
+                                 TPML_DIGEST sk_policyBranches,
+                                 TPM2B_AUTH sdo_authVal,
+                                 TPML_PCR_SELECTION sdo_pcrList,
+                                 TPM2B_DIGEST sdo_authPolicy,
+                                 TPML_DIGEST sdo_policyBranches,
+                                 TPM2B_PUBLIC * sdo_public,
+                                 TPM2B_PRIVATE * sdo_private);
+
 /**
  * @brief Unseal data using TPM 2.0.
  *
@@ -112,11 +153,15 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
  *                            loading the input 'data' blob under the SK and
  *                            then unsealing it.
  *
- * @param[in]  policyBranch1  1 of 2 optional policy branch arguments
- *                            needed for compound policy calculations
+ * @param[in]  policyBranches Optional policy branches needed for compound
+ *                            policy calculations (a count of 0 for a
+ *                            simple policy)
  *
- * @param[in]  policyBranch2  2 of 2 optional policy branch arguments
- *                            needed for compound policy calculations
+ * @param[in]  authorization  Signed approval of the PCR policy (see
+ *                            verify_policy_signature()) for data sealed to
+ *                            signed policies, or NULL. The storage key of
+ *                            such data only requires the authorization
+ *                            value, the signed policy gating the unseal.
  *
  * @param[out] result         The kmyth-unsealed result
  *                            (passed as pointer to byte buffer)
@@ -133,8 +178,147 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                            TPM2B_AUTH authVal,
                            TPML_PCR_SELECTION pcrList,
                            TPM2B_DIGEST authPolicy,
-                           TPM2B_DIGEST policyBranch1,
-                           TPM2B_DIGEST policyBranch2,
+                           TPML_DIGEST policyBranches,
+                           POLICY_AUTHORIZATION * authorization,
                            uint8_t ** result, size_t *result_size);
 
+/**
+ * @brief Same as tpm2_kmyth_unseal_data(), but authorizes the load and
+ *        unseal with a policy session supplied (and later flushed) by the
+ *        caller. The session's policy is (re-)applied before each command,
+ *        so one session can be continued across many unseal operations.
+ *
+ * @param[in]  sapi_ctx            System API (SAPI) context, must be
+ *                                 initialized and passed in as a pointer to
+ *                                 the SAPI context
+ *
+ * @param[in]  unsealData_session  Started TPM2_SE_POLICY session used to
+ *                                 authorize the load and unseal
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_data().
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_unseal_data_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                   SESSION * unsealData_session,
+                                   TPM2_HANDLE sk_handle,
+                                   TPM2B_PUBLIC sdo_public,
+                                   TPM2B_PRIVATE sdo_private,
+                                   TPM2B_AUTH authVal,
+                                   TPML_PCR_SELECTION pcrList,
+                                   TPM2B_DIGEST authPolicy,
+                                   TPML_DIGEST policyBranches,
+                                   POLICY_AUTHORIZATION * authorization,
+                                   uint8_t ** result, size_t *result_size);
+
+/**
+ * @brief First half of tpm2_kmyth_unseal_data_session(): applies the policy,
+ *        loads the sealed data object, and submits its TPM2_Unseal without
+ *        waiting for the TPM's response, so the caller can overlap CPU work
+ *        (e.g., decrypting a previously unsealed item) with the TPM command.
+ *
+ * No other command may be issued on sapi_ctx until
+ * tpm2_kmyth_unseal_data_finish() has been called.
+ *
+ * @param[in]  sk_auth_only  Set if the storage key only requires its
+ *                          authorization value, so its use is authorized
+ *                          without pcrList and policyBranches (as it is for
+ *                          data sealed to signed policies)
+ *
+ * @param[out] sdo_handle  Handle of the loaded sealed data object
+ *
+ * @param[out] pending     State of the submitted unseal command
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_data_session().
+ *
+ * @return 0 on success, 1 on error (nothing left loaded or pending)
+ */
+int tpm2_kmyth_unseal_data_start(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 SESSION * unsealData_session,
+                                 TPM2_HANDLE sk_handle,
+                                 TPM2B_PUBLIC sdo_public,
+                                 TPM2B_PRIVATE sdo_private,
+                                 TPM2B_AUTH authVal,
+                                 TPML_PCR_SELECTION pcrList,
+                                 TPM2B_DIGEST authPolicy,
+                                 TPML_DIGEST policyBranches,
+                                 POLICY_AUTHORIZATION * authorization,
+                                 bool sk_auth_only,
+                                 TPM2_HANDLE * sdo_handle,
+                                 ASYNC_UNSEAL * pending);
+
+/**
+ * @brief Second half of tpm2_kmyth_unseal_data_session(): waits for the
+ *        unseal submitted by tpm2_kmyth_unseal_data_start(), flushes the
+ *        sealed data object, and returns the unsealed data.
+ *
+ * @param[in]  sapi_ctx     System API (SAPI) context the unseal was
+ *                          submitted on
+ *
+ * @param[in]  sdo_handle   Handle returned by tpm2_kmyth_unseal_data_start()
+ *
+ * @param[in]  pending      State returned by tpm2_kmyth_unseal_data_start()
+ *
+ * @param[out] result       The kmyth-unsealed result (allocated here)
+ *
+ * @param[out] result_size  The size of the kmyth-unsealed result
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_unseal_data_finish(TSS2_SYS_CONTEXT * sapi_ctx,
+                                  TPM2_HANDLE sdo_handle,
+                                  ASYNC_UNSEAL * pending,
+                                  uint8_t ** result, size_t *result_size);
+
+/**
+ * @brief Tells whether a sealed file was sealed as a stream (see
+ *        tpm2_kmyth_seal_stream()), from its .ski section alone (no TPM
+ *        operation), for callers that accept both kinds.
+ *
+ * @param[in]  input_path      Path to the sealed file
+ *
+ * @param[in]  bool_policy_or  As described for tpm2_kmyth_unseal()
+ *
+ * @param[out] is_stream       true for a streamed file, false otherwise
+ *                             (including files that are not valid .ski)
+ *
+ * @return 0 on success, 1 if the file cannot be opened
+ */
+int tpm2_kmyth_is_stream_file(char *input_path, uint8_t bool_policy_or,
+                              bool *is_stream);
+
+/**
+ * @brief Reads the .ski section at the start of a streamed sealed file (see
+ *        tpm2_kmyth_seal_stream()) and unseals its wrapping key, leaving
+ *        the file positioned at the first encrypted chunk.
+ *
+ * @param[in]  ctx          Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  in           Streamed sealed file
+ *
+ * @param[in]  input_name   Name of the file, for log messages
+ *
+ * @param[out] header       Buffer of AES_GCM_STREAM_HEADER_LEN bytes
+ *                          receiving the stream header
+ *
+ * @param[out] compression  Compression of the plaintext the chunks hold
+ *
+ * @param[out] key          The wrapping key (allocated here, caller clears
+ *                          and frees)
+ *
+ * @param[out] key_len      Size of the wrapping key
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_unseal_stream_key(kmyth_ctx_t * ctx, FILE * in,
+                                 const char *input_name,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t bool_policy_or,
+                                 uint8_t * header,
+                                 kmyth_compression * compression,
+                                 uint8_t ** key, size_t *key_len);
+
 #endif /* KMYTH_SEAL_UNSEAL_IMPL_H */
@@ -0,0 +1,86 @@
+/**
+ * @file  kmyth_sealed_reader.h
+ *
+ * @brief Provides the internal definition of the random access reader of
+ *        streamed sealed files (kmyth_sealed_reader_t) declared in kmyth.h.
+ *
+ * The chunks of a stream all hold the same amount of plaintext (but for
+ * the final one), so chunk i is found at a fixed offset from the end of
+ * the .ski, and only the chunks covering a read need to be decrypted.
+ */
+
+#ifndef KMYTH_SEALED_READER_H
+#define KMYTH_SEALED_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cipher/aes_gcm.h"
+#include "kmyth.h"
+#include "memory_util.h"
+
+/**
+ * @brief Number of decrypted chunks a reader keeps, least recently used
+ *        first out, so that small reads next to each other (or repeated)
+ *        do not decrypt the same chunk again.
+ */
+#define KMYTH_READER_CACHE_CHUNKS 4
+
+/**
+ * @brief Size of the secure arena (see kmyth_arena in memory_util.h) a
+ *        reader holds its wrapping key in.
+ */
+#define KMYTH_READER_ARENA_SIZE 4096
+
+/**
+ * @brief A decrypted chunk kept by a reader.
+ */
+typedef struct
+{
+  // index of the chunk in the stream
+  uint32_t index;
+
+  // plaintext (chunk size bytes allocated and mlock()ed where possible,
+  // NULL marks an empty entry)
+  uint8_t *data;
+  size_t data_len;
+
+  // use counter value of the last hit, for LRU eviction
+  uint64_t last_used;
+} kmyth_reader_chunk;
+
+/**
+ * @brief Internal state held by a kmyth_sealed_reader_t handle.
+ */
+struct kmyth_sealed_reader
+{
+  // the sealed file, read with pread()
+  FILE *file;
+
+  // offset of the first encrypted chunk (the size of the .ski section)
+  uint64_t data_offset;
+
+  // stream header, plaintext chunk size, and number of chunks
+  uint8_t header[AES_GCM_STREAM_HEADER_LEN];
+  size_t chunk_len;
+  uint64_t chunks;
+
+  // size of the plaintext of the whole stream
+  uint64_t size;
+
+  // locked memory for the wrapping key (empty, and the heap is used
+  // instead, if it could not be mapped)
+  kmyth_arena arena;
+  uint8_t *key;
+  size_t key_len;
+
+  // one encrypted chunk, as read from the file
+  uint8_t *enc_chunk;
+
+  // recently decrypted chunks
+  kmyth_reader_chunk cache[KMYTH_READER_CACHE_CHUNKS];
+  uint64_t cache_uses;
+};
+
+#endif /* KMYTH_SEALED_READER_H */
@@ -8,6 +8,7 @@
 #ifndef MARSHALLING_TOOLS_H
 #define MARSHALLING_TOOLS_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -16,6 +17,7 @@
 #include "formatting_tools.h"
 
 #include "cipher/cipher.h"
+#include "cipher/compression.h"
 
 typedef struct Ski_s
 {
@@ -26,12 +28,21 @@ typedef struct Ski_s
   TPM2B_PUBLIC sk_pub;
   TPM2B_PRIVATE sk_priv;
 
-  TPM2B_DIGEST policyBranch1;
-  TPM2B_DIGEST policyBranch2;
+  //Policy branches of a compound "policy or" policy (count of 0 if the
+  //data is sealed to a single policy)
+  TPML_DIGEST policyBranches;
+
+  //Public key whose signed approvals of PCR policies authorize the data to
+  //be unsealed (see kmyth_policy_authorize.h), size 0 if the data is
+  //sealed to its PCR policy directly
+  TPM2B_PUBLIC authorizing_key;
 
   //The cipher used to encrypt the data
   cipher_t cipher;
 
+  //The compression applied to the data before it was encrypted
+  kmyth_compression compression;
+
   //Wrapping key pub/priv TPM2 components
   TPM2B_PUBLIC wk_pub;
   TPM2B_PRIVATE wk_priv;
@@ -40,12 +51,87 @@ typedef struct Ski_s
   uint8_t *enc_data;
   size_t enc_data_size;
 
+  //Whether enc_data points into a buffer owned by someone else (e.g., the
+  //.ski it was parsed from, see parse_ski_bytes_borrowed()), which
+  //free_ski() then leaves alone
+  bool enc_data_borrowed;
+
 } Ski;
 
+/**
+ * @brief Layout of the .ski files written by create_ski_bytes()
+ */
+typedef enum
+{
+  // PEM-style text: base64 sections between KMYTH_DELIM_* lines
+  KMYTH_SKI_FORMAT_TEXT,
+
+  // compact binary container (see KMYTH_SKI_V2_MAGIC)
+  KMYTH_SKI_FORMAT_V2
+} kmyth_ski_format;
+
+/**
+ * <pre>
+ * A binary (v2) .ski is laid out as follows, all integers big-endian:
+ *
+ *   magic          4 bytes   KMYTH_SKI_V2_MAGIC
+ *   version        2 bytes   KMYTH_SKI_V2_VERSION
+ *   section count  2 bytes
+ *   table length   4 bytes   size of the section table in bytes
+ *   payload length 8 bytes   size of the encrypted data in bytes
+ *   section table            section count entries of
+ *                              type   2 bytes (kmyth_ski_v2_section)
+ *                              length 4 bytes
+ *                              value  length bytes (TPM 2.0 marshalled
+ *                                     structure, or cipher or
+ *                                     compression name)
+ *   payload                  the encrypted data, as is
+ * </pre>
+ */
+#define KMYTH_SKI_V2_MAGIC "\x89SKI"
+
+/// Length of KMYTH_SKI_V2_MAGIC
+#define KMYTH_SKI_V2_MAGIC_LEN 4
+
+/// Version number of the binary .ski format
+#define KMYTH_SKI_V2_VERSION 2
+
+/// Length of the fixed header of a binary .ski
+#define KMYTH_SKI_V2_HEADER_LEN 20
+
+/// Length of the type and length fields of a binary .ski section
+#define KMYTH_SKI_V2_SECTION_HEADER_LEN 6
+
+/**
+ * @brief Section types of a binary (v2) .ski. Every type appears at most
+ *        once, and the compression is only present for compressed data.
+ *        A compound "policy or" is stored as the two POLICY_BRANCH_1 and
+ *        POLICY_BRANCH_2 sections when it has two branches (as readers
+ *        limited to two branches expect), and as a single POLICY_BRANCHES
+ *        list when it has more; a .ski without one has none of them.
+ *        The authorizing key is only present for data sealed to signed
+ *        policies (see kmyth_policy_authorize.h).
+ */
+typedef enum
+{
+  KMYTH_SKI_V2_PCR_SELECTION_LIST = 1,
+  KMYTH_SKI_V2_POLICY_BRANCH_1 = 2,
+  KMYTH_SKI_V2_POLICY_BRANCH_2 = 3,
+  KMYTH_SKI_V2_STORAGE_KEY_PUBLIC = 4,
+  KMYTH_SKI_V2_STORAGE_KEY_PRIVATE = 5,
+  KMYTH_SKI_V2_CIPHER_SUITE = 6,
+  KMYTH_SKI_V2_SYM_KEY_PUBLIC = 7,
+  KMYTH_SKI_V2_SYM_KEY_PRIVATE = 8,
+  KMYTH_SKI_V2_COMPRESSION = 9,
+  KMYTH_SKI_V2_POLICY_BRANCHES = 10,
+  KMYTH_SKI_V2_AUTHORIZING_KEY = 11
+} kmyth_ski_v2_section;
+
 /**
  * @brief Parses a .ski formatted byte array into a ski struct. 
  *        The output is only modified on success, otherwise the 
- *        pointer is untouched
+ *        pointer is untouched. Both the text and the binary (v2)
+ *        formats are accepted, told apart by the v2 magic number.
  *
  * @param[in]  input          The bytes in .ski format
  *
@@ -53,13 +139,56 @@ typedef struct Ski_s
  *
  * @param[out] output         The new ski struct
  *
+ * @param[in]  bool_policy_or Whether a text .ski holds policy branches
+ *                            (binary .ski files describe their sections,
+ *                            so it is ignored for them)
+ *
  * @return 0 on success, 1 on error
  */
 int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
                     uint8_t bool_policy_or);
 
 /**
- * @brief Creates a byte array in .ski format from a ski struct
+ * @brief Parses a .ski formatted byte array into a ski struct like
+ *        parse_ski_bytes(), but without copying the encrypted data of a
+ *        binary (v2) .ski: output->enc_data then points into input and
+ *        output->enc_data_borrowed is set, so input must stay valid (and
+ *        unchanged) for as long as output is used. It may be read-only
+ *        (e.g., a mapped file), as borrowed data is never written to.
+ *
+ *        The encrypted data of a text .ski has to be base64 decoded, so
+ *        for that format the output owns a decoded copy as usual.
+ *
+ * Parameters and return value are as described for parse_ski_bytes().
+ */
+int parse_ski_bytes_borrowed(uint8_t * input, size_t input_length,
+                             Ski * output, uint8_t bool_policy_or);
+
+/**
+ * @brief Parses everything in a .ski except its encrypted data: the PCR
+ *        selection, policy branches, keys and cipher suite. Parsing stops
+ *        where the encrypted data begins, which is neither decoded nor
+ *        copied, so input may be just a prefix of the .ski (e.g., of a
+ *        streamed sealed file). Either format is accepted, and whether a
+ *        text .ski holds policy branches is read from the file itself.
+ *
+ *        On success, output->enc_data is NULL and output->enc_data_size
+ *        is 0. The output is only modified on success.
+ *
+ * @param[in]  input          The bytes in .ski format (or a prefix that
+ *                            reaches the encrypted data)
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] output         The new ski struct
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_ski_header(uint8_t * input, size_t input_length, Ski * output);
+
+/**
+ * @brief Creates a byte array in .ski format from a ski struct, in the
+ *        format selected by set_ski_format()
  *
  * @param[in]  input          The ski struct to be converted
  *
@@ -72,7 +201,83 @@ int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
 int create_ski_bytes(Ski input, uint8_t ** output, size_t *output_length);
 
 /**
- * @brief Frees the contents of a ski struct
+ * @brief Tells whether a byte array starts like a binary (v2) .ski.
+ *
+ * @param[in]  input          The bytes to check
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @return true if input begins with KMYTH_SKI_V2_MAGIC, false otherwise
+ */
+bool is_ski_v2(const uint8_t * input, size_t input_length);
+
+/**
+ * @brief Computes the total size of a binary (v2) .ski from its header,
+ *        e.g., to read one from the start of a streamed sealed file.
+ *
+ * @param[in]  header         The first KMYTH_SKI_V2_HEADER_LEN bytes
+ *
+ * @param[in]  header_length  The number of bytes in header
+ *
+ * @param[out] ski_length     The size of the whole .ski in bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_ski_v2_length(const uint8_t * header, size_t header_length,
+                      size_t *ski_length);
+
+/**
+ * @brief Parses a binary (v2) .ski into a ski struct. Called by
+ *        parse_ski_bytes() for input in that format. The output is only
+ *        modified on success.
+ *
+ * @param[in]  input          The bytes in binary .ski format
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] output         The new ski struct
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_ski_bytes_v2(uint8_t * input, size_t input_length, Ski * output);
+
+/**
+ * @brief Creates a byte array in binary (v2) .ski format from a ski
+ *        struct. Unlike the text format, the encrypted data is stored as
+ *        is rather than base64 encoded.
+ *
+ * @param[in]  input          The ski struct to be converted
+ *
+ * @param[out] output         The bytes in binary .ski format
+ *
+ * @param[out] output_length  The number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_ski_bytes_v2(Ski input, uint8_t ** output, size_t *output_length);
+
+/**
+ * @brief Selects, for this process, the format in which create_ski_bytes()
+ *        writes .ski files. Parsing accepts either format regardless.
+ *
+ * @param[in]  format         The .ski format (defaults to
+ *                            KMYTH_SKI_FORMAT_TEXT)
+ *
+ * @return 0 on success, 1 on error
+ */
+int set_ski_format(kmyth_ski_format format);
+
+/**
+ * @brief Retrieves the format in which create_ski_bytes() writes .ski
+ *        files (see set_ski_format()).
+ *
+ * @return The .ski format
+ */
+kmyth_ski_format get_ski_format(void);
+
+/**
+ * @brief Frees the contents of a ski struct (borrowed encrypted data is
+ *        only let go of, not freed)
  *
  * @param[in] ski				The struct to be freed
  */
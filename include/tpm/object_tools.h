@@ -374,12 +374,6 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
  *                                   being loaded or SK if a data object is
  *                                   being loaded) was sealed to.
  *
- * @param[in]  policyBranch1         1 of 2 optional policy branch arguments
- *                                   needed for compound policy calculations
- *
- * @param[in]  policyBranch2         2 of 2 optional policy branch arguments
- *                                   needed for compound policy calculations
- *
  * @param[in]  in_private            Encrypted TPM 2.0 "private blob" for
  *                                   object to be loaded - passed as a pointer
  *                                   to the TPM2B_PRIVATE sized buffer
@@ -405,6 +399,29 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                       TPM2B_PRIVATE * in_private,
                       TPM2B_PUBLIC * in_public, TPM2_HANDLE * object_handle);
 
+/**
+ * @brief State of a TPM2_Unseal command submitted asynchronously by
+ *        unseal_kmyth_object_start(), needed by unseal_kmyth_object_finish()
+ *        to collect and validate the response.
+ */
+typedef struct
+{
+  // session authorizing the unseal (its nonces are updated on completion)
+  SESSION *session;
+
+  // handle of the data object being unsealed
+  TPM2_HANDLE object_handle;
+
+  // object authorization value used for the response HMAC check
+  TPM2B_AUTH object_auth;
+
+  // command code used in the response authorization computation
+  TPM2_CC command_code;
+
+  // response authorization structure, filled in when the command completes
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+} ASYNC_UNSEAL;
+
 /**
  * @brief Unseals a Kmyth TPM data object 
  *
@@ -426,11 +443,13 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
  *                                        the default all-zero hash associated
  *                                        with empty authorization bytes.
  *
- * @param[in]  policyBranch1              1 of 2 optional policy branch arguments
- *                                        needed for compound policy calculations
+ * @param[in]  policyBranches             Optional policy branches needed for
+ *                                        compound policy calculations (count
+ *                                        of 0 if none)
  *
- * @param[in]  policyBranch2              2 of 2 optional policy branch arguments
- *                                        needed for compound policy calculations
+ * @param[in]  authorization              Signed approval of the PCR policy
+ *                                        for an object sealed to signed
+ *                                        policies, or NULL
  *
  * @param[in]  object_pcrList             PCR List structure indicating the PCR
  *                                        values to which the data object was
@@ -444,9 +463,69 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                         SESSION * unsealObjectAuthSession,
                         TPM2_HANDLE object_handle,
                         TPM2B_AUTH object_auth,
-                        TPM2B_DIGEST policyBranch1,
-                        TPM2B_DIGEST policyBranch2,
+                        TPML_DIGEST policyBranches,
+                        POLICY_AUTHORIZATION * authorization,
                         TPML_PCR_SELECTION object_pcrList,
                         TPM2B_SENSITIVE_DATA * object_sensitive);
 
+/**
+ * @brief Applies the unseal policy to the session, prepares the TPM2_Unseal
+ *        command for a Kmyth data object, and submits it to the TPM without
+ *        waiting for the response. The caller is free to do other (non-TPM)
+ *        work until it calls unseal_kmyth_object_finish().
+ *
+ * No other command may be issued on sapi_ctx while the unseal is pending.
+ * After a successful return, unseal_kmyth_object_finish() must be called.
+ *
+ * @param[out] pending  State of the submitted command, passed to
+ *                      unseal_kmyth_object_finish()
+ *
+ * All other parameters are as described for unseal_kmyth_object().
+ *
+ * @return 0 if success, 1 if error (no command left pending)
+ */
+int unseal_kmyth_object_start(TSS2_SYS_CONTEXT * sapi_ctx,
+                              SESSION * unsealObjectAuthSession,
+                              TPM2_HANDLE object_handle,
+                              TPM2B_AUTH object_auth,
+                              TPML_DIGEST policyBranches,
+                              POLICY_AUTHORIZATION * authorization,
+                              TPML_PCR_SELECTION object_pcrList,
+                              ASYNC_UNSEAL * pending);
+
+/**
+ * @brief Waits for a TPM2_Unseal command submitted by
+ *        unseal_kmyth_object_start() to complete, then retrieves the
+ *        unsealed data and validates the response authorization.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context the command was
+ *                               submitted on
+ *
+ * @param[in/out] pending        State returned by unseal_kmyth_object_start()
+ *                               (the saved authorization value is cleared)
+ *
+ * @param[out] object_sensitive  The unsealed (unencrypted) result.
+ *
+ * @return 0 if success, 1 if error.
+ */
+int unseal_kmyth_object_finish(TSS2_SYS_CONTEXT * sapi_ctx,
+                               ASYNC_UNSEAL * pending,
+                               TPM2B_SENSITIVE_DATA * object_sensitive);
+
+/**
+ * @brief Computes the TPM 2.0 name of an object from its public area
+ *        (the nameAlg identifier followed by the nameAlg digest of the
+ *        marshalled TPMT_PUBLIC structure), without involving the TPM.
+ *
+ * @param[in]  object_public  TPM 2.0 "public blob" for the object - passed
+ *                            as a pointer to the TPM2B_PUBLIC sized buffer
+ *
+ * @param[out] object_name    Computed object name - passed as a pointer to
+ *                            the TPM2B_NAME sized buffer
+ *
+ * @return 0 if success, 1 if error (e.g., unsupported nameAlg)
+ */
+int compute_kmyth_object_name(TPM2B_PUBLIC * object_public,
+                              TPM2B_NAME * object_name);
+
 #endif /* OBJECT_TOOLS_H */
@@ -12,6 +12,36 @@
 
 #include <tss2/tss2_sys.h>
 
+/**
+ * @brief Most PCR values a PCR snapshot holds (every PCR of one bank)
+ */
+#define KMYTH_PCR_SNAPSHOT_MAX_VALUES TPM2_MAX_PCRS
+
+/**
+ * @brief The values of a PCR selection read at one point in time (see
+ *        kmyth_pcr_snapshot()), kept by the caller so that later changes
+ *        can be detected cheaply (see kmyth_pcr_snapshot_refresh()).
+ */
+typedef struct
+{
+  // PCRs read, and their values in selection order (each bank in turn,
+  // ascending PCR index within a bank)
+  TPML_PCR_SELECTION pcrList;
+  uint32_t count;
+  TPM2B_DIGEST values[KMYTH_PCR_SNAPSHOT_MAX_VALUES];
+
+  // digest of the values, as get_pcr_digest() computes it
+  TPM2B_DIGEST digest;
+
+  // TPM PCR update counter when the values were read
+  uint32_t pcrUpdateCounter;
+
+  // whether the selection holds a PCR that the update counter does not
+  // count (TPM2_PT_PCR_NO_INCREMENT), which is only known once checked
+  bool uncounted_checked;
+  bool uncounted;
+} kmyth_pcr_snapshot_t;
+
 /**
  * @brief Converts a PCR selection input string, from the user, into the
  *        TPM 2.0 struct used to specify which PCRs to use in a sealing
@@ -37,6 +67,26 @@ int init_pcr_selection(TSS2_SYS_CONTEXT * sapi_ctx,
                        int *pcrs,
                        size_t pcrs_len, TPML_PCR_SELECTION * pcrs_struct);
 
+/**
+ * @brief Builds the TPM 2.0 PCR selection struct for a set of PCRs, as
+ *        init_pcr_selection() does, but for a given PCR count instead of
+ *        the one reported by a TPM (so it needs no TPM access).
+ *
+ * @param[in]  numPCRs     Number of PCRs implemented (see
+ *                         KMYTH_DEFAULT_PCR_COUNT)
+ *
+ * @param[in]  pcrs        An array containing integers specifying which
+ *                         PCRs to apply.
+ *
+ * @param[in]  pcrs_len    The length of the PCRs array.
+ *
+ * @param[out] pcrs_struct TPM 2.0 PCR Selection List struct
+ *
+ * @return 0 if success, 1 if error
+ */
+int build_pcr_selection(int numPCRs, int *pcrs, size_t pcrs_len,
+                        TPML_PCR_SELECTION * pcrs_struct);
+
 /**
  * @brief Obtains the total count of available PCRs by reading the
  *        TPM2_PT_PCR_COUNT property from the TPM.
@@ -51,4 +101,100 @@ int init_pcr_selection(TSS2_SYS_CONTEXT * sapi_ctx,
  */
 int get_pcr_count(TSS2_SYS_CONTEXT * sapi_ctx, int *pcrCount);
 
+/**
+ * @brief Reads the current values of the selected PCRs (TPM2_PCR_Read) and
+ *        computes the digest of their concatenation, in selection order.
+ *        This is the PCR digest a TPM2_PolicyPCR command with an empty
+ *        pcrDigest parameter would use.
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, must be initialized
+ *                       and passed in as pointer to the SAPI context
+ *
+ * @param[in]  pcrList   PCR Selection List struct to read (an empty
+ *                       selection needs no TPM access)
+ *
+ * @param[out] pcrDigest Digest (KMYTH_HASH_ALG) of the selected PCR values
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_pcr_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                   TPML_PCR_SELECTION pcrList, TPM2B_DIGEST * pcrDigest);
+
+/**
+ * @brief Reads the current values of the selected PCRs in as few
+ *        TPM2_PCR_Read commands as the TPM allows (each returns up to
+ *        eight values), along with the PCR update counter. If a PCR is
+ *        updated between two of the reads (the counter moves), the
+ *        selection is read again, so that the values always belong
+ *        together.
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, must be initialized
+ *                       and passed in as pointer to the SAPI context
+ *
+ * @param[in]  pcrList   PCR Selection List struct to read (an empty
+ *                       selection needs no TPM access)
+ *
+ * @param[out] snapshot  The PCR values, their digest and the update
+ *                       counter
+ *
+ * @return 0 if success, 1 if error
+ */
+int kmyth_pcr_snapshot(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPML_PCR_SELECTION pcrList,
+                       kmyth_pcr_snapshot_t * snapshot);
+
+/**
+ * @brief Brings a PCR snapshot up to date, and reports whether the values
+ *        of its PCRs changed. While the TPM's PCR update counter has not
+ *        moved, this costs a single TPM2_PCR_Read command that reads no
+ *        PCR. Once it has moved (any PCR was updated), the selection is
+ *        read again and compared. A selection holding a PCR the counter
+ *        does not count (TPM2_PT_PCR_NO_INCREMENT, e.g. the debug PCR) is
+ *        always read again.
+ *
+ * @param[in]     sapi_ctx  System API (SAPI) context, must be initialized
+ *                          and passed in as pointer to the SAPI context
+ *                          (on the TPM the snapshot was taken from)
+ *
+ * @param[in,out] snapshot  Snapshot taken by kmyth_pcr_snapshot()
+ *
+ * @param[out]    changed   true if any of the PCR values changed
+ *
+ * @return 0 if success, 1 if error (the snapshot is then left as it was)
+ */
+int kmyth_pcr_snapshot_refresh(TSS2_SYS_CONTEXT * sapi_ctx,
+                               kmyth_pcr_snapshot_t * snapshot,
+                               bool *changed);
+
+/**
+ * @brief Computes the digest of a set of PCR values supplied by the caller,
+ *        the same digest get_pcr_digest() computes from PCR values read
+ *        from a TPM.
+ *
+ * @param[in]  pcr_values     Concatenated values (each KMYTH_DIGEST_SIZE
+ *                            bytes) of the selected PCRs, in ascending PCR
+ *                            order. May be NULL if no PCR is selected.
+ *
+ * @param[in]  pcr_values_len Number of bytes in pcr_values (a multiple of
+ *                            KMYTH_DIGEST_SIZE)
+ *
+ * @param[out] pcrDigest      Digest (KMYTH_HASH_ALG) of the PCR values
+ *
+ * @return 0 if success, 1 if error
+ */
+int compute_pcr_digest(uint8_t * pcr_values, size_t pcr_values_len,
+                       TPM2B_DIGEST * pcrDigest);
+
+/**
+ * @brief Checks whether two PCR Selection List structs select the same PCRs
+ *        (including bank and select size).
+ *
+ * @param[in]  a         First PCR Selection List struct
+ *
+ * @param[in]  b         Second PCR Selection List struct
+ *
+ * @return true if the selections are identical, false otherwise
+ */
+bool pcr_selection_equal(TPML_PCR_SELECTION * a, TPML_PCR_SELECTION * b);
+
 #endif /* PRCS_H */
@@ -38,6 +38,105 @@ int get_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
                    TPM2_HANDLE * srk_handle,
                    TPM2B_AUTH * storage_hierarchy_auth);
 
+/**
+ * @brief Looks up the storage root key (SRK) handle from the process-level
+ *        cache or, failing that, from the optional on-disk hint file.
+ *
+ * A candidate handle is only returned after a single check_if_srk() call
+ *        (one ReadPublic) confirms that it still references the Kmyth SRK.
+ *        A stale or invalid candidate is discarded and is not an error.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context,
+ *                           must be initialized and
+ *                           passed in as pointer to the SAPI context
+ *
+ * @param[out] srk_handle    Verified SRK handle, or zero if no valid cached
+ *                           handle was available - passed as pointer to
+ *                           SRK handle value
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_cached_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPM2_HANDLE * srk_handle);
+
+/**
+ * @brief Records an SRK handle in the process-level cache and, if a hint
+ *        file is configured, persists it there as well.
+ *
+ * @param[in]  srk_handle    Verified SRK handle to remember
+ *
+ * @return 0 if success, 1 if error (e.g., hint file could not be written;
+ *         the in-memory cache is still updated)
+ */
+int set_cached_srk_handle(TPM2_HANDLE srk_handle);
+
+/**
+ * @brief Forgets any cached SRK handle (the hint file is left unchanged).
+ */
+void clear_cached_srk_handle(void);
+
+/**
+ * @brief Configures the path of the on-disk SRK handle hint file.
+ *
+ * If never called, the path is taken from the KMYTH_SRK_HINT_ENV
+ * environment variable, when set. Passing NULL disables the hint file.
+ *
+ * @param[in]  path          Path to the hint file, or NULL to disable it
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_srk_hint_path(const char *path);
+
+/**
+ * @brief Selects the public key algorithm used for newly created storage
+ *        keys (SKs). The SRK is not affected and remains an RSA key.
+ *
+ * ECC P-256 keys are generated by the TPM much faster than RSA-2048 keys,
+ * which shortens every seal. An unseal always uses the algorithm recorded
+ * in the SK public area stored in the .ski file, so this setting only
+ * matters when sealing.
+ *
+ * @param[in]  alg_name      "rsa" or "ecc", or NULL to restore the default
+ *                           (KMYTH_KEY_PUBKEY_ALG)
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_sk_alg(const char *alg_name);
+
+/**
+ * @brief Retrieves the public key algorithm currently selected for newly
+ *        created storage keys (see set_sk_alg()).
+ *
+ * @return TPM2_ALG_RSA or TPM2_ALG_ECC
+ */
+TPMI_ALG_PUBLIC get_sk_alg(void);
+
+/**
+ * @brief Enables (or disables) policy-only reseals. A reseal then keeps the
+ *        storage key (SK) of its input, rather than creating a new one,
+ *        whenever that SK only requires its authorization value (i.e., its
+ *        policy does not depend on the PCR policy being changed), and only
+ *        the sealed wrapping key is rewritten.
+ *
+ * The SK of data sealed to PCRs normally shares the wrapping key's policy,
+ * so it can not be kept across a change of that policy. Storage keys a
+ * policy-only reseal has to create are therefore given a policy that only
+ * requires their authorization value, so that later policy-only reseals of
+ * the output can keep them. The wrapping key remains bound to the PCR
+ * policy, which is checked when it is unsealed.
+ *
+ * @param[in]  enable        true to keep storage keys where possible
+ */
+void set_sk_reuse(bool enable);
+
+/**
+ * @brief Retrieves whether policy-only reseals are enabled (see
+ *        set_sk_reuse()).
+ *
+ * @return true if reseals keep storage keys where possible
+ */
+bool get_sk_reuse(void);
+
 /**
  * @brief Try to get handle of a Storage Root Key (SRK) that is already loaded
  *        into the TPM's persistent storage.
@@ -127,6 +226,9 @@ int put_srk_into_persistent_storage(TSS2_SYS_CONTEXT * sapi_ctx,
  * @param[in]  sk_authPolicy Authorization policy digest to be associated
  *                           with the created storage key
  *
+ * @param[in]  sk_alg        Public key algorithm of the storage key
+ *                           (TPM2_ALG_RSA or TPM2_ALG_ECC)
+ *
  * @param[out] sk_handle     TPM 2.0 handle that references the created
  *                           and loaded storage key (SK) -
  *                           passed as a pointer to the handle value
@@ -145,6 +247,7 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
                        TPM2B_AUTH sk_authVal,
                        TPML_PCR_SELECTION sk_pcrList,
                        TPM2B_DIGEST sk_authPolicy,
+                       TPMI_ALG_PUBLIC sk_alg,
                        TPM2_HANDLE * sk_handle,
                        TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public);
 
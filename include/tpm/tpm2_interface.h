@@ -11,6 +11,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <tss2/tss2_sys.h>
 
@@ -19,6 +20,40 @@
  */
 extern const char *simulator_manufacturers[];
 
+/**
+ * @brief Maximum number of TPM connections (SAPI contexts) whose fixed
+ *        capability properties are cached at one time.
+ */
+#define KMYTH_CAP_CACHE_SIZE 4
+
+/**
+ * @brief Fewest policy branches a compound (PolicyOR) policy is made of
+ */
+#define KMYTH_MIN_POLICY_BRANCHES 2
+
+/**
+ * @brief Most policy branches a compound (PolicyOR) policy is made of: the
+ *        capacity of the TPML_DIGEST that a single TPM2_PolicyOR takes
+ */
+#define KMYTH_MAX_POLICY_BRANCHES 8
+
+/**
+ * @brief A signed approval of a PCR policy, checked by the TPM, that lets a
+ *        policy session satisfy the PolicyAuthorize policy of an object
+ *        sealed to the signing key (see verify_policy_signature())
+ */
+typedef struct
+{
+  // digest of the approved policy, that the session must have reached
+  TPM2B_DIGEST approvedPolicy;
+
+  // name of the key that signed the approval
+  TPM2B_NAME keySign;
+
+  // ticket from TPM2_VerifySignature() showing the signature is valid
+  TPMT_TK_VERIFIED checkTicket;
+} POLICY_AUTHORIZATION;
+
 /**
  * @brief TPM2 sessions are the vehicle for authorizations and maintain state
  *        between subsequent commands. This struct serves as a "container"  to
@@ -79,17 +114,276 @@ typedef struct
 
 } SESSION;
 
+/**
+ * @brief Selects the TCTI (TPM Command Transmission Interface) that
+ *        init_tpm2_connection() uses for new connections.
+ *
+ * The specification has the form "<name>[:<config>]", where name is one of:
+ *   - auto   : "device" if KMYTH_TPMRM_DEVICE is accessible, else "abrmd"
+ *   - device : in-kernel resource manager (config: device path, defaults to
+ *              KMYTH_TPMRM_DEVICE)
+ *   - abrmd  : tpm2-abrmd access broker/resource manager over D-Bus
+ *   - mssim  : Microsoft/IBM TPM 2.0 simulator (config: e.g.,
+ *              "host=localhost,port=2321")
+ *   - swtpm  : swtpm software TPM (config: e.g., "host=localhost,port=2321")
+ *   - mock   : in-process mock TPM for benchmarks and tests (config: e.g.,
+ *              "default=2ms,Unseal=25ms"; see kmyth_mock_tpm.h), only in
+ *              programs that register it (see register_tcti_init())
+ *
+ * If never called (or called with NULL), the specification is taken from
+ * the KMYTH_TCTI_ENV environment variable, and otherwise defaults to
+ * KMYTH_DEFAULT_TCTI.
+ *
+ * @param[in]  tcti_spec  TCTI specification string, or NULL to revert to
+ *                        the environment/default selection
+ *
+ * @return 0 if success, 1 if error (unrecognized or unavailable TCTI)
+ */
+int set_tcti_spec(const char *tcti_spec);
+
+/**
+ * @brief Makes a TCTI that is built into the calling program, rather than
+ *        loaded from a tss2 library, selectable by name. Only the mock TPM
+ *        is such a TCTI; it is linked into the test and benchmark programs,
+ *        never into the library, so the production tools cannot select it
+ *        (see kmyth_mock_tpm_register()).
+ *
+ * @param[in]  name       Name of the built-in TCTI (KMYTH_MOCK_TCTI_NAME)
+ *
+ * @param[in]  init       Its Tss2_Tcti_*_Init() style initialization
+ *                        function
+ *
+ * @return 0 if success, 1 if error (not a built-in TCTI name)
+ */
+int register_tcti_init(const char *name,
+                       TSS2_RC(*init) (TSS2_TCTI_CONTEXT *, size_t *,
+                                       const char *));
+
+/**
+ * @brief Scheduling classes of TPM commands. When commands of several
+ *        threads wait for the same TPM (see init_tpm2_connection()), the
+ *        next one served is the oldest of the most urgent class, unless a
+ *        less urgent command has waited longer than its class allows (see
+ *        set_tpm_priority_max_wait()), in which case the longest waiting
+ *        such command goes first.
+ */
+typedef enum
+{
+  // someone is waiting on the result (kmyth-unseal, kmythd requests)
+  KMYTH_TPM_PRIORITY_INTERACTIVE = 0,
+
+  // default class
+  KMYTH_TPM_PRIORITY_NORMAL = 1,
+
+  // background maintenance (kmyth-reseal): also yields to interactive and
+  // normal commands of other processes using the same TCTI specification
+  KMYTH_TPM_PRIORITY_BULK = 2,
+} kmyth_tpm_priority;
+
+/**
+ * @brief Number of TPM scheduling classes
+ */
+#define KMYTH_TPM_PRIORITY_COUNT 3
+
+/**
+ * @brief Selects the scheduling class of the TPM commands issued by the
+ *        calling thread from now on (whichever connection they go through).
+ *
+ * @param[in]  priority  Scheduling class
+ *
+ * @return The class the thread used before the call
+ */
+kmyth_tpm_priority set_tpm_priority(kmyth_tpm_priority priority);
+
+/**
+ * @brief Selects the scheduling class of threads that have not called
+ *        set_tpm_priority(). If never called, it is taken from the
+ *        KMYTH_TPM_PRIORITY_ENV environment variable, and otherwise is
+ *        KMYTH_TPM_PRIORITY_NORMAL. Meant to be called at startup.
+ *
+ * @param[in]  priority  Scheduling class
+ *
+ * @return 0 if success, 1 if error (unknown class)
+ */
+int set_default_tpm_priority(kmyth_tpm_priority priority);
+
+/**
+ * @brief Gets the scheduling class of the TPM commands of the calling
+ *        thread.
+ *
+ * @return set_tpm_priority() choice of the thread, else the default class
+ */
+kmyth_tpm_priority get_tpm_priority(void);
+
+/**
+ * @brief Sets how long a command of the given class may wait behind more
+ *        urgent ones before it is served anyway, so that a steady stream
+ *        of urgent work cannot starve the rest. The defaults are
+ *        KMYTH_DEFAULT_NORMAL_MAX_WAIT_MS and KMYTH_DEFAULT_BULK_MAX_WAIT_MS;
+ *        interactive commands, the most urgent, have no bound.
+ *
+ * @param[in]  priority     KMYTH_TPM_PRIORITY_NORMAL or
+ *                          KMYTH_TPM_PRIORITY_BULK
+ *
+ * @param[in]  max_wait_ms  Maximum wait in milliseconds (0 for no bound)
+ *
+ * @return 0 if success, 1 if error (unknown or interactive class)
+ */
+int set_tpm_priority_max_wait(kmyth_tpm_priority priority,
+                              unsigned int max_wait_ms);
+
+/**
+ * @brief Parses the name of a scheduling class ("interactive", "normal" or
+ *        "bulk").
+ *
+ * @param[in]  name      Class name
+ *
+ * @param[out] priority  Parsed class
+ *
+ * @return 0 if success, 1 if error (unknown name)
+ */
+int parse_tpm_priority(const char *name, kmyth_tpm_priority * priority);
+
+/**
+ * @brief Number of latency histogram buckets kept per TPM command. Bucket 0
+ *        counts commands that completed in under 2 microseconds, bucket i
+ *        (0 < i < KMYTH_TPM_STATS_BUCKETS - 1) those that took [2^i, 2^(i+1))
+ *        microseconds, and the last bucket everything slower.
+ */
+#define KMYTH_TPM_STATS_BUCKETS 24
+
+/**
+ * @brief Latency and error statistics collected for one TPM command code
+ *        (see set_tpm_stats()). Latency is measured from handing the
+ *        command to the TCTI until its response has been received, so it
+ *        includes any resource manager (e.g., tpm2-abrmd) overhead.
+ */
+typedef struct
+{
+  // TPM 2.0 command code
+  TPM2_CC commandCode;
+
+  // number of commands issued, and how many of them failed (TCTI error or
+  // a response code other than TPM2_RC_SUCCESS)
+  uint64_t count;
+  uint64_t errors;
+
+  // total and worst-case latency, in microseconds
+  uint64_t total_us;
+  uint64_t max_us;
+
+  // latency histogram (see KMYTH_TPM_STATS_BUCKETS)
+  uint64_t histogram[KMYTH_TPM_STATS_BUCKETS];
+} kmyth_tpm_cmd_stats;
+
+/**
+ * @brief Enables or disables per-command TPM latency statistics.
+ *
+ * init_tpm2_connection() interposes a thin TCTI layer on every new
+ * connection, which always counts failed commands by response code (see
+ * metrics.h). While enabled, that layer also times every command sent to
+ * the TPM, by command code. Connections opened before enabling are not
+ * timed. The statistics are process wide and are kept until
+ * reset_tpm_stats() is called.
+ *
+ * @param[in]  enable     true to time new connections, false to stop
+ */
+void set_tpm_stats(bool enable);
+
+/**
+ * @brief Discards all collected TPM command statistics.
+ */
+void reset_tpm_stats(void);
+
+/**
+ * @brief Retrieves the collected TPM command statistics.
+ *
+ * @param[out] stats      Array with one entry per command code that has
+ *                        been issued, in command code order (caller frees).
+ *                        Set to NULL if no commands have been recorded.
+ *
+ * @param[out] stats_count Number of entries in stats
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_tpm_stats(kmyth_tpm_cmd_stats ** stats, size_t *stats_count);
+
+/**
+ * @brief Returns the name of a TPM 2.0 command that Kmyth issues (e.g.,
+ *        "Unseal" for TPM2_CC_Unseal), for reporting statistics.
+ *
+ * @param[in]  commandCode  TPM 2.0 command code
+ *
+ * @return command name, or NULL if the command code is not one Kmyth uses
+ */
+const char *get_tpm_cc_name(TPM2_CC commandCode);
+
+/**
+ * @brief Writes a human readable summary of the collected TPM command
+ *        statistics (one line per command code, followed by its non-empty
+ *        latency histogram buckets).
+ *
+ * @param[in]  out        Output stream (e.g., stderr)
+ */
+void print_tpm_stats(FILE * out);
+
+/**
+ * @brief Initializes a TCTI context using the TCTI selected by
+ *        set_tcti_spec() (or the environment/default selection).
+ *
+ * @param[out] tcti_ctx  TPM Command Transmission Interface (TCTI) context,
+ *                       must be passed in as a NULL
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_tcti(TSS2_TCTI_CONTEXT ** tcti_ctx);
+
+/**
+ * @brief Initializes a TCTI context using the given TCTI specification,
+ *        independent of the process-wide selection made by set_tcti_spec().
+ *
+ * @param[out] tcti_ctx  TPM Command Transmission Interface (TCTI) context,
+ *                       must be passed in as a NULL
+ *
+ * @param[in]  tcti_spec TCTI specification in the set_tcti_spec() syntax
+ *                       (e.g., "mssim:host=localhost,port=2331"), or NULL
+ *                       to behave like init_tcti()
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_tcti_spec(TSS2_TCTI_CONTEXT ** tcti_ctx, const char *tcti_spec);
+
 /**
  * @brief Initializes TPM 2.0 connection to resource manager. 
  *
  * Will error if resource manager is not running. 
  *
+ * Connections opened with the same (resolved) TCTI specification share a
+ * submission queue: whichever thread they are used from, they take turns
+ * to have a command in flight on the TPM, in the order set by the
+ * scheduling class of the issuing threads (see kmyth_tpm_priority).
+ *
  * @param[out] sapi_ctx  System API context, must be initialized to NULL
  *
  * @return 0 if success, 1 if error
  */
 int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx);
 
+/**
+ * @brief Same as init_tpm2_connection(), but connects through the given
+ *        TCTI specification (see init_tcti_spec()), so that one process can
+ *        talk to several TPMs or simulators at once.
+ *
+ * @param[out] sapi_ctx  System API context, must be initialized to NULL
+ *
+ * @param[in]  tcti_spec TCTI specification, or NULL for the process-wide
+ *                       selection
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_tpm2_connection_tcti(TSS2_SYS_CONTEXT ** sapi_ctx,
+                              const char *tcti_spec);
+
 /**
  * @brief Initializes a TCTI context to talk to resource manager.
  *        Will not work if resource manager is not turned on and connected
@@ -172,6 +466,36 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
  */
 int get_tpm2_impl_type(TSS2_SYS_CONTEXT * sapi_ctx, bool *isEmulator);
 
+/**
+ * @brief Get the value of a fixed (TPM2_PT_FIXED group) TPM 2.0 property,
+ *        such as TPM2_PT_MANUFACTURER or TPM2_PT_PCR_COUNT.
+ *
+ * These values never change for a given TPM, so the whole group is read
+ * with one TPM2_GetCapability command the first time it is needed on a
+ * connection and is answered from a per-connection cache after that. The
+ * cache entry is dropped when the connection is freed (see
+ * free_tpm2_resources()).
+ *
+ * @param[in]  sapi_ctx   System API (SAPI) context, must be initialized -
+ *                        passed in as a pointer to the context struct
+ *
+ * @param[in]  property   Fixed property to look up
+ *
+ * @param[out] value      Value of the requested property
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_tpm2_fixed_property(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2_PT property, uint32_t * value);
+
+/**
+ * @brief Drops any cached capability properties for a TPM connection.
+ *
+ * @param[in]  sapi_ctx   System API (SAPI) context whose cache entry
+ *                        should be removed
+ */
+void clear_tpm2_capability_cache(TSS2_SYS_CONTEXT * sapi_ctx);
+
 /**
  * @brief Translates error string from hex into human readable.
  *
@@ -477,6 +801,104 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
                          TPML_PCR_SELECTION tp_pcrList,
                          TPM2B_DIGEST * policyDigest_out);
 
+/**
+ * @brief Uses a trial policy session to compute the compound (PolicyOR)
+ *        authorization policy digest that is satisfied by any of a list of
+ *        policy branches.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be initialized
+ *                               and passed in as pointer to the SAPI context
+ *
+ * @param[in]  policyBranches    Policy branches (KMYTH_MIN_POLICY_BRANCHES
+ *                               to KMYTH_MAX_POLICY_BRANCHES of them)
+ *
+ * @param[out] policyDigest_out  Compound authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int create_policy_or_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPML_DIGEST * policyBranches,
+                            TPM2B_DIGEST * policyDigest_out);
+
+/**
+ * @brief Computes, in software, the same authorization policy digest that
+ *        create_policy_digest() obtains from a trial session (PolicyAuthValue
+ *        followed, for a non-empty PCR Selection List, by PolicyPCR).
+ *
+ * @param[in]  pcrList           PCR Selection List structure specifying
+ *                               which PCRs to apply to authorization policy
+ *
+ * @param[in]  pcrDigest         Digest of the selected PCR values (see
+ *                               get_pcr_digest())
+ *
+ * @param[out] policyDigest_out  Authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int compute_policy_digest(TPML_PCR_SELECTION pcrList,
+                          TPM2B_DIGEST pcrDigest,
+                          TPM2B_DIGEST * policyDigest_out);
+
+/**
+ * @brief Computes, in software, the same compound (PolicyOR) authorization
+ *        policy digest that create_policy_or_digest() obtains from a trial
+ *        session.
+ *
+ * @param[in]  policyBranches    Policy branches (KMYTH_MIN_POLICY_BRANCHES
+ *                               to KMYTH_MAX_POLICY_BRANCHES of them)
+ *
+ * @param[out] policyDigest_out  Compound authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int compute_policy_or_digest(TPML_DIGEST * policyBranches,
+                             TPM2B_DIGEST * policyDigest_out);
+
+/**
+ * @brief Computes, in software, the authorization policy digest of an
+ *        object sealed to signed policies: a single PolicyAuthorize, with
+ *        an empty policyRef, naming the key whose signatures approve the
+ *        policies that may be used.
+ *
+ * @param[in]  keySign           Name of the authorizing (signing) key
+ *
+ * @param[out] policyDigest_out  Authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int compute_policy_authorize_digest(TPM2B_NAME * keySign,
+                                    TPM2B_DIGEST * policyDigest_out);
+
+/**
+ * @brief Has the TPM check a signed approval of a policy digest, producing
+ *        the ticket that PolicyAuthorize requires. The public key is loaded
+ *        (without its private part) for the check and flushed afterwards.
+ *
+ * @param[in]  sapi_ctx        Pointer to the System API (SAPI) context
+ *
+ * @param[in]  authorizingKey  Public area of the authorizing key
+ *
+ * @param[in]  approvedPolicy  Approved policy digest
+ *
+ * @param[in]  signature       Signature over the approved policy digest
+ *                             (with an empty policyRef)
+ *
+ * @param[out] authorization   Signed approval ready for
+ *                             apply_policy_authorize()
+ *
+ * @return 0 if success, 1 if error (including an invalid signature).
+ */
+int verify_policy_signature(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2B_PUBLIC * authorizingKey,
+                            TPM2B_DIGEST * approvedPolicy,
+                            TPMT_SIGNATURE * signature,
+                            POLICY_AUTHORIZATION * authorization);
+
+
 /**
  * @brief Creates a session used to authorize kmyth objects
  *
@@ -537,7 +959,9 @@ int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
 /**
  * @brief Extension of apply_policy for unsealing. Only calls apply policy
  * if the user has not elected to use a "policy or". If the user has elected
- * to use "policy or" it performs the calculations necessary to authorize an action
+ * to use "policy or" it performs the calculations necessary to authorize an action.
+ * For data sealed to signed policies, the PCR policy reached is then
+ * replaced by the authorizing key's policy through PolicyAuthorize.
  *
  * @param[in]  sapi_ctx              Pointer to the System API (SAPI) context
  *
@@ -548,44 +972,87 @@ int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
  * @param[in]  policySession_pcrList PCR Selection structure for session to
  *                                   be updated
  *
- * @param[in]  policy1               one of two policy branches capable of
- *                                   satisfying the compound policy
+ * @param[in]  policyBranches        Policy branches capable of satisfying
+ *                                   the compound policy (count of 0 when no
+ *                                   "policy or" is used)
  *
- * @param[in]  policy2               The second of two policy branches capable
- *                                   of satisfying the compound policy
+ * @param[in]  authorization         Signed approval of the PCR policy (see
+ *                                   verify_policy_signature()), or NULL for
+ *                                   data sealed to its PCR policy directly
  *
  * @return 0 if success, 1 if error.
  */
 int unseal_apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
                         TPM2_HANDLE policySessionHandle,
                         TPML_PCR_SELECTION policySession_pcrList,
-                        TPM2B_DIGEST policy1, TPM2B_DIGEST policy2);
+                        TPML_DIGEST policyBranches,
+                        POLICY_AUTHORIZATION * authorization);
 
 /**
  * @brief Executes the Kmyth-specific authorization policy steps and updates
  *        the authorization policy session context for the specified TPM 2.0
  *        session handle.
  *
+ * The session's current policy digest must be one of the branches. All of
+ * them fit a single TPM2_PolicyOR, as the TPM accepts up to eight.
+ *
  * @param[in]  sapi_ctx              Pointer to the System API (SAPI) context
  *
  * @param[in]  policySessionHandle   Handle referencing authorization policy
  *                                   session whose context will be updated
  *                                   by applying these policy commands.
  *
- * @param[in]  policy1               one of two policy branches capable of
- *                                   satisfying the compound policy
+ * @param[in]  policyBranches        Policy branches capable of satisfying
+ *                                   the compound policy
+ *                                   (KMYTH_MIN_POLICY_BRANCHES to
+ *                                   KMYTH_MAX_POLICY_BRANCHES of them)
  *
- * @param[in]  policy2               The second of two policy branches capable
- *                                   of satisfying the compound policy
+ * @return 0 if success, 1 if error.
+ */
+int apply_policy_or(TSS2_SYS_CONTEXT * sapi_ctx,
+                    TPM2_HANDLE policySessionHandle,
+                    TPML_DIGEST * policyBranches);
+
+/**
+ * @brief Replaces the policy digest of a session that has reached an
+ *        approved policy by the digest of the authorizing key's
+ *        PolicyAuthorize policy (see compute_policy_authorize_digest()).
+ *
+ * @param[in]  sapi_ctx              Pointer to the System API (SAPI) context
+ *
+ * @param[in]  policySessionHandle   Handle referencing authorization policy
+ *                                   session whose context will be updated
  *
- * @param[out] pHashList            Pointer to a structure containing each policy
- *                                  hash branch. 2 supported, 8 possible.
+ * @param[in]  authorization         Signed approval of the session's current
+ *                                   policy digest
  *
  * @return 0 if success, 1 if error.
  */
-int apply_policy_or(TSS2_SYS_CONTEXT * sapi_ctx,
-                    TPM2_HANDLE policySessionHandle, TPM2B_DIGEST * policy1,
-                    TPM2B_DIGEST * policy2, TPML_DIGEST * pHashList);
+int apply_policy_authorize(TSS2_SYS_CONTEXT * sapi_ctx,
+                           TPM2_HANDLE policySessionHandle,
+                           POLICY_AUTHORIZATION * authorization);
+
+/**
+ * @brief Checks that a list of policy branches can make up a compound
+ *        (PolicyOR) policy: KMYTH_MIN_POLICY_BRANCHES to
+ *        KMYTH_MAX_POLICY_BRANCHES digests, none of them empty.
+ *
+ * @param[in]  policyBranches  Policy branches to check
+ *
+ * @return true if valid, false otherwise
+ */
+bool valid_policy_branches(const TPML_DIGEST * policyBranches);
+
+/**
+ * @brief Compares two lists of digests (e.g., policy branches), in order.
+ *
+ * @param[in]  a  First list
+ *
+ * @param[in]  b  Second list
+ *
+ * @return true if both lists hold the same digests, false otherwise
+ */
+bool digest_list_equal(const TPML_DIGEST * a, const TPML_DIGEST * b);
 
 /**
  * @brief Creates a random initial nonce value that the caller can send to the
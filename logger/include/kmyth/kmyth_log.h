@@ -8,8 +8,11 @@
 #ifndef KMYTH_LOG_H
 #define KMYTH_LOG_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <syslog.h>
+#include <time.h>
 
 //--------------------------Macros--------------------------------------------
 
@@ -94,6 +97,25 @@
  */
 #define KMYTH_APPLOG_OUTPUT_MODE_DEFAULT 1
 
+/**
+ * @brief Kmyth logging "format" specifies how application log entries are
+ *        written - options:
+ *        <UL>
+ *          <LI> 0 (0x00) = free-text lines (the default) </LI>
+ *          <LI> 1 (0x01) = one JSON object per line, with the fields
+ *               "timestamp" (UTC, ISO 8601), "app", "version", "severity",
+ *               "file", "func", "line" and "message", plus "op_id" and
+ *               "duration_us" within an operation (see kmyth_log_op_begin())
+ *               </LI>
+ *        </UL>
+ *
+ * The format applies to both the log file and stddest; syslog entries are
+ * unaffected.
+ */
+#define KMYTH_APPLOG_FORMAT_TEXT 0
+#define KMYTH_APPLOG_FORMAT_JSON 1
+#define KMYTH_APPLOG_FORMAT_DEFAULT KMYTH_APPLOG_FORMAT_TEXT
+
 /**
  * @brief sets the default "severity threshold" for logging to the Kmyth
  *        application log file globally - options (in order of least to
@@ -122,8 +144,64 @@
  */
 #define DEFAULT_MAX_LOG_MSG_LEN 128
 
+/**
+ * @brief largest message length set_applog_max_msg_len() accepts
+ */
+#define MAX_APPLOG_MSG_LEN 16384
+
+/**
+ * @brief length of the messages formatted without a heap allocation (in a
+ *        per-thread buffer, or in place in the asynchronous logger's queue);
+ *        longer ones, up to the maximum message length, spill to the heap
+ */
+#define KMYTH_LOG_INLINE_MSG_LEN 256
+
+/**
+ * @brief maximum length of an operation ID (see kmyth_log_op_begin())
+ */
+#define MAX_LOG_OP_ID_LEN 63
+
+/**
+ * @brief default number of messages the asynchronous logger can hold
+ *        before its overflow policy applies (see kmyth_log_start_async())
+ */
+#define KMYTH_LOG_ASYNC_DEFAULT_CAPACITY 1024
+
+/**
+ * @brief largest number of messages the asynchronous logger can hold
+ */
+#define KMYTH_LOG_ASYNC_MAX_CAPACITY 65536
+
+/**
+ * @brief least severe level of the kmyth_log() calls that are compiled in:
+ *        calls with a (constant) severity above it are removed entirely.
+ *        Defaults to LOG_DEBUG (keep every call); e.g., building with
+ *        -DKMYTH_LOG_COMPILE_LEVEL=LOG_INFO strips all debug logging.
+ */
+#ifndef KMYTH_LOG_COMPILE_LEVEL
+#define KMYTH_LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+/**
+ * @brief number of distinct call sites (source file and line) whose
+ *        messages can be rate limited and deduplicated at once (see
+ *        set_log_rate_limit()); messages from further sites are not limited
+ */
+#define KMYTH_LOG_LIMIT_MAX_SITES 256
+
 //--------------------------Templates-----------------------------------------
 
+/**
+ * @brief Rate limiting and deduplication applied to the messages of one
+ *        severity (see set_log_rate_limit()). An interval of 0 turns both off.
+ */
+struct log_rate_limit
+{
+  unsigned int burst;           // messages per call site and interval (0 = any)
+  unsigned int interval;        // length of the interval, in seconds
+  int dedup;                    // suppress repeats of a call site's last message
+};
+
 struct log_params
 {
   char app_name[MAX_APP_NAME_LEN + 1];
@@ -134,11 +212,43 @@ struct log_params
   size_t applog_path_len;
   int applog_max_msg_len;
   int applog_output_mode;
+  int applog_format;
   int applog_severity_threshold;
   int syslog_facility;
   int syslog_severity_threshold;
+  struct log_rate_limit rate_limit[LOG_DEBUG + 1];
 };
 
+/**
+ * @brief What the asynchronous logger does with a message when its queue
+ *        is full (see kmyth_log_start_async())
+ */
+typedef enum
+{
+  // discard the message and count it (see kmyth_log_async_dropped())
+  KMYTH_LOG_OVERFLOW_DROP,
+
+  // wait until the writer thread has made room
+  KMYTH_LOG_OVERFLOW_BLOCK
+} kmyth_log_overflow;
+
+/**
+ * @brief A timed step of an operation (see kmyth_log_span_begin()). Spans
+ *        begun while another is current in the same thread are its
+ *        children, and share its trace ID.
+ */
+typedef struct kmyth_log_span
+{
+  const char *name;
+  uint64_t trace_id[2];
+  uint64_t span_id;
+  uint64_t parent_id;           // 0 for the root span of a trace
+  struct kmyth_log_span *parent;
+  struct kmyth_log_span *prev_current;  // made current again at the end
+  struct timespec start;        // CLOCK_MONOTONIC
+  int64_t start_unix_ns;
+} kmyth_log_span;
+
 //--------------------------Function Declarations-----------------------------
 #ifdef __cplusplus
 extern "C" {
@@ -197,6 +307,94 @@ void set_applog_max_msg_len(int new_max_log_msg_len);
  */
 void set_applog_output_mode(int new_output_mode);
 
+/**
+ * @brief sets the "format" of application log entries
+ *
+ * @param[in]  new_format  KMYTH_APPLOG_FORMAT_TEXT or KMYTH_APPLOG_FORMAT_JSON
+ *
+ * @return None
+ */
+void set_applog_format(int new_format);
+
+/**
+ * @brief Marks the start of an operation (e.g., serving one request) in the
+ *        calling thread. Until kmyth_log_op_end(), JSON log entries from
+ *        this thread carry its ID ("op_id") and the microseconds elapsed
+ *        since it started ("duration_us"), so the latency of each step can
+ *        be read straight off the log.
+ *
+ * @param[in]  op_id  string identifying the operation (truncated to
+ *                    MAX_LOG_OP_ID_LEN characters)
+ *
+ * @return None
+ */
+void kmyth_log_op_begin(const char *op_id);
+
+/**
+ * @brief Marks the end of the calling thread's current operation (see
+ *        kmyth_log_op_begin()).
+ *
+ * @return None
+ */
+void kmyth_log_op_end(void);
+
+/**
+ * @brief Begins a span, which becomes the calling thread's current span
+ *        until it is ended. While it is current, JSON log entries from this
+ *        thread carry its "trace_id" and "span_id", so the entries of one
+ *        run can be told apart and grouped by step.
+ *
+ * @param[out] span  span to begin (caller-owned, e.g., a local variable)
+ *
+ * @param[in]  name  name of the step, e.g. the function name (not copied)
+ *
+ * @return None
+ */
+void kmyth_log_span_begin(kmyth_log_span * span, const char *name);
+
+/**
+ * @brief Begins a span, as kmyth_log_span_begin() does, but as a child of
+ *        the given span rather than of the calling thread's current one.
+ *        This ties a step run by a helper thread to the operation it is
+ *        part of. The parent must not end before the child does.
+ *
+ * @param[out] span    span to begin (caller-owned, e.g., a local variable)
+ *
+ * @param[in]  name    name of the step (not copied)
+ *
+ * @param[in]  parent  span (possibly another thread's) this step is part of,
+ *                     or NULL to begin a new trace
+ *
+ * @return None
+ */
+void kmyth_log_span_begin_child(kmyth_log_span * span, const char *name,
+                                kmyth_log_span * parent);
+
+/**
+ * @brief Ends a span (this must be the calling thread's current span) and
+ *        makes its parent current again. Logs (at LOG_DEBUG) how long the
+ *        span took and, if an export file is set, appends the span to it.
+ *
+ * @param[in]  span    span to end
+ *
+ * @param[in]  status  0 if the step succeeded, nonzero if it failed
+ *
+ * @return None
+ */
+void kmyth_log_span_end(kmyth_log_span * span, int status);
+
+/**
+ * @brief Sets a file to which every ended span is appended, in the
+ *        OpenTelemetry protocol's JSON encoding (one ExportTraceServiceRequest
+ *        per line, as read by the OpenTelemetry Collector's "otlpjsonfile"
+ *        receiver).
+ *
+ * @param[in]  path  file to append to, or NULL to stop exporting
+ *
+ * @return 0 on success, 1 if the file couldn't be opened
+ */
+int kmyth_log_set_span_export_path(const char *path);
+
 /**
  * @brief sets "severity threshold" for application logging
  *
@@ -248,6 +446,42 @@ void set_applog_severity_threshold(int new_syslog_facility);
  */
 void set_syslog_severity_threshold(int new_severity_threshold);
 
+/**
+ * @brief Limits how often messages of a severity are recorded, so that a
+ *        failure that makes every request log the same chain of errors
+ *        (e.g., the TPM or the key server going away) doesn't flood the
+ *        logs. Limits apply to each call site (source file and line) on its
+ *        own, over fixed intervals:
+ *        <UL>
+ *          <LI> with burst > 0, at most burst messages are recorded per
+ *               interval; the number suppressed is then reported ("N log
+ *               message(s) suppressed") by the site's first message of a
+ *               later interval </LI>
+ *          <LI> with dedup, a message identical to the last one recorded
+ *               from the same site is suppressed; the repeats are reported
+ *               ("last message repeated N time(s)") before the site's next
+ *               different message, or by its first message of a later
+ *               interval </LI>
+ *        </UL>
+ *        Counts still pending at exit are reported then. The limits are off
+ *        by default.
+ *
+ * @param[in]  severity  severity the limits apply to (LOG_EMERG - LOG_DEBUG)
+ *
+ * @param[in]  burst     messages recorded per call site and interval
+ *                       (0 for no limit)
+ *
+ * @param[in]  interval  length of the interval, in seconds (must be nonzero
+ *                       unless burst and dedup are both 0, which turns the
+ *                       limits for severity off)
+ *
+ * @param[in]  dedup     nonzero to suppress repeated messages
+ *
+ * @return None
+ */
+void set_log_rate_limit(int severity, unsigned int burst,
+                        unsigned int interval, int dedup);
+
 /**
  * @brief 
  *
@@ -276,6 +510,53 @@ void get_severity_str(int severity_val_in, char **severity_str_out);
  */
 FILE *get_stddest(int severity_val_in);
 
+/**
+ * @brief Asks for the log sinks (the application log file and the syslog
+ *        connection) to be reopened. They are otherwise opened by the
+ *        first message and kept open for the life of the process; after
+ *        this call, they are closed and reopened before the next message
+ *        is recorded. Only sets a flag, so it may be called from a signal
+ *        handler (e.g., on SIGHUP, once logrotate has moved the log file).
+ */
+void kmyth_log_reopen(void);
+
+/**
+ * @brief Switches the logger to asynchronous mode. log_event() then only
+ *        formats the message into a lock-free queue (safe for any number of
+ *        threads) and returns; a background writer thread adds the prefix
+ *        and timestamp and writes it to syslog and the application log, so
+ *        the caller never waits on disk or the syslog daemon. Dropped
+ *        messages are reported by the writer in a warning of their own.
+ *
+ *        Messages still queued when the process exits are written out (the
+ *        writer is stopped from an atexit() handler if it is still running).
+ *        Starting and stopping must not race with each other.
+ *
+ * @param[in]  capacity  Number of messages the queue holds (rounded up to a
+ *                       power of two, at most KMYTH_LOG_ASYNC_MAX_CAPACITY)
+ *
+ * @param[in]  overflow  What to do with a message when the queue is full
+ *
+ * @return 0 on success, 1 on error (e.g., already started), in which case
+ *         logging stays synchronous
+ */
+int kmyth_log_start_async(size_t capacity, kmyth_log_overflow overflow);
+
+/**
+ * @brief Writes out every queued message, stops the writer thread and
+ *        returns the logger to synchronous mode. Does nothing if the logger
+ *        is not in asynchronous mode.
+ */
+void kmyth_log_stop_async(void);
+
+/**
+ * @brief Retrieves the number of messages the asynchronous logger has
+ *        discarded (KMYTH_LOG_OVERFLOW_DROP) since it was started.
+ *
+ * @return The number of dropped messages
+ */
+uint64_t kmyth_log_async_dropped(void);
+
 /**
  * @brief Records a log for kmyth (appends a newline to the log entry).
  *
@@ -332,9 +613,30 @@ void log_event(const char *src_file,
                const char *message, ...);
 
 /**
- * @brief macro used to specify common initial three kmyth_log() parameters
+ * @brief least severe level that is recorded by the application log or
+ *        syslog (the larger of their severity thresholds), kept up to date
+ *        by the set_*_severity_threshold() functions. kmyth_log() checks it
+ *        so that a message no sink would record costs neither a call nor
+ *        the evaluation (and formatting) of its arguments. It is read
+ *        and written atomically (it may change while other threads log).
+ */
+extern int kmyth_log_max_severity;
+
+/**
+ * @brief macro used to specify common initial three kmyth_log() parameters,
+ *        skipping messages below KMYTH_LOG_COMPILE_LEVEL (at compile time)
+ *        or kmyth_log_max_severity (at run time)
  */
-#define kmyth_log(...) log_event(__FILE__, __func__, __LINE__, __VA_ARGS__)
+#define kmyth_log(severity, ...)                                        \
+  do                                                                    \
+  {                                                                     \
+    if ((severity) <= KMYTH_LOG_COMPILE_LEVEL &&                        \
+        (severity) <=                                                   \
+        __atomic_load_n(&kmyth_log_max_severity, __ATOMIC_RELAXED))     \
+    {                                                                   \
+      log_event(__FILE__, __func__, __LINE__, (severity), __VA_ARGS__); \
+    }                                                                   \
+  } while (0)
 
 #ifdef __cplusplus
 }
@@ -6,29 +6,195 @@
 
 #include "kmyth_log.h"
 
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
+#include <unistd.h>
 
+#include <sys/random.h>
 
-static struct log_params log_settings = {
-  .app_name = DEFAULT_APP_NAME,
-  .app_name_len = strlen(DEFAULT_APP_NAME),
-  .app_version = DEFAULT_APP_VERSION,
-  .app_version_len = strlen(DEFAULT_APP_VERSION),
-  .applog_path = DEFAULT_APPLOG_PATH,
-  .applog_path_len = strlen(DEFAULT_APPLOG_PATH),
-  .applog_max_msg_len = DEFAULT_MAX_LOG_MSG_LEN,
-  .applog_output_mode = KMYTH_APPLOG_OUTPUT_MODE_DEFAULT,
-  .applog_severity_threshold = KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT,
-  .syslog_facility = SYSLOG_FACILITY_DEFAULT,
-  .syslog_severity_threshold = SYSLOG_SEVERITY_THRESHOLD_DEFAULT,
+
+// The settings are kept in immutable snapshots. A setter copies the current
+// snapshot, changes the copy and publishes it, so every message is recorded
+// with one consistent set of settings without taking a lock to read them.
+// A replaced snapshot may still be in use by another thread, so it is never
+// freed; each one keeps the one it replaced reachable (settings change only
+// a handful of times in a program's life).
+struct log_settings_snapshot
+{
+  struct log_params params;
+  const struct log_settings_snapshot *prev;
+};
+
+static const struct log_settings_snapshot default_log_settings = {
+  .params = {
+    .app_name = DEFAULT_APP_NAME,
+    .app_name_len = strlen(DEFAULT_APP_NAME),
+    .app_version = DEFAULT_APP_VERSION,
+    .app_version_len = strlen(DEFAULT_APP_VERSION),
+    .applog_path = DEFAULT_APPLOG_PATH,
+    .applog_path_len = strlen(DEFAULT_APPLOG_PATH),
+    .applog_max_msg_len = DEFAULT_MAX_LOG_MSG_LEN,
+    .applog_output_mode = KMYTH_APPLOG_OUTPUT_MODE_DEFAULT,
+    .applog_format = KMYTH_APPLOG_FORMAT_DEFAULT,
+    .applog_severity_threshold = KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT,
+    .syslog_facility = SYSLOG_FACILITY_DEFAULT,
+    .syslog_severity_threshold = SYSLOG_SEVERITY_THRESHOLD_DEFAULT,
+  },
+  .prev = NULL,
 };
 
+static const struct log_settings_snapshot *_Atomic log_settings_current =
+  &default_log_settings;
+
+// serializes the setters (readers never take it)
+static pthread_mutex_t log_settings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The log sinks are opened on first use and then kept open, rather than
+// opened and closed for every message (see kmyth_log_reopen()). The lock
+// guards them and keeps messages from different threads whole.
+static pthread_mutex_t log_sink_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *applog_file = NULL;
+static bool applog_file_tried = false;
+static bool syslog_opened = false;
+static int log_reopen_requested = 0;
+
+// the defaults: the larger of the application log and syslog thresholds
+int kmyth_log_max_severity =
+  (KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT > SYSLOG_SEVERITY_THRESHOLD_DEFAULT) ?
+  KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT : SYSLOG_SEVERITY_THRESHOLD_DEFAULT;
+
+//############################################################################
+// get_log_settings()
+//############################################################################
+static const struct log_params *get_log_settings(void)
+{
+  return &atomic_load_explicit(&log_settings_current,
+                               memory_order_acquire)->params;
+}
+
+//############################################################################
+// begin_log_settings_update()
+//############################################################################
+/**
+ * @brief Starts a change to the logger settings: locks out the other setters
+ *        and returns a copy of the current settings to be changed and then
+ *        passed to end_log_settings_update().
+ *
+ * @return The copy, or NULL (with nothing locked) if it couldn't be allocated
+ */
+static struct log_settings_snapshot *begin_log_settings_update(void)
+{
+  struct log_settings_snapshot *next = malloc(sizeof(*next));
+
+  if (next == NULL)
+  {
+    fprintf(stderr, "unable to allocate logger settings - unchanged\n");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&log_settings_lock);
+  next->prev = atomic_load(&log_settings_current);
+  next->params = next->prev->params;
+  return next;
+}
+
+//############################################################################
+// end_log_settings_update()
+//############################################################################
+static void end_log_settings_update(struct log_settings_snapshot *next)
+{
+  // the larger of the application log and syslog thresholds
+  int max_severity =
+    (next->params.applog_severity_threshold >
+     next->params.syslog_severity_threshold) ?
+    next->params.applog_severity_threshold :
+    next->params.syslog_severity_threshold;
+
+  atomic_store_explicit(&log_settings_current, next, memory_order_release);
+  __atomic_store_n(&kmyth_log_max_severity, max_severity, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&log_settings_lock);
+}
+
+//############################################################################
+// severity_name()
+//############################################################################
+static const char *severity_name(int severity)
+{
+  static const char *const names[] = {
+    "EMERGENCY", "ALERT", "CRITICAL", "ERROR",
+    "WARNING", "NOTICE", "INFO", "DEBUG"
+  };
+
+  return names[LOG_PRI(severity)];
+}
+
+//############################################################################
+// format_timestamp()
+//############################################################################
+/**
+ * @brief Formats a log timestamp: local time as yyyy-mm-dd hh:mm:ss, or UTC
+ *        as yyyy-mm-ddThh:mm:ssZ (ISO 8601). The results are cached per
+ *        thread, so the formatting is only done once a second.
+ *
+ * @return The timestamp, valid until the calling thread's next call
+ */
+static const char *format_timestamp(time_t ts, bool iso_utc)
+{
+  static _Thread_local time_t cached_ts[2] = { (time_t) -1, (time_t) -1 };
+  static _Thread_local char cached[2][21];
+  int i = iso_utc ? 1 : 0;
+
+  if (ts != cached_ts[i])
+  {
+    struct tm tm;
+    struct tm *tm_ok = iso_utc ? gmtime_r(&ts, &tm) : localtime_r(&ts, &tm);
+
+    if (tm_ok == NULL ||
+        strftime(cached[i], sizeof(cached[i]), iso_utc ? "%FT%TZ" : "%F %T",
+                 &tm) == 0)
+    {
+      cached[i][0] = '\0';
+    }
+    cached_ts[i] = ts;
+  }
+
+  return cached[i];
+}
+
+//############################################################################
+// close_applog_file()
+//############################################################################
+static void close_applog_file(void)
+{
+  if (applog_file != NULL)
+  {
+    fclose(applog_file);
+    applog_file = NULL;
+  }
+  applog_file_tried = false;
+}
+
+//############################################################################
+// close_syslog()
+//############################################################################
+static void close_syslog(void)
+{
+  if (syslog_opened)
+  {
+    closelog();
+    syslog_opened = false;
+  }
+}
+
 //############################################################################
 // set_app_name()
 //############################################################################
@@ -36,29 +202,42 @@ void set_app_name(const char *new_app_name)
 {
   bool truncated = false;
   size_t temp_len = 0;
+  struct log_settings_snapshot *next = begin_log_settings_update();
+
+  if (next == NULL)
+  {
+    return;
+  }
 
   temp_len = strnlen(new_app_name, MAX_APP_NAME_LEN + 1);
   if (temp_len <= MAX_APP_NAME_LEN)
   {
-    log_settings.app_name_len = temp_len;
+    next->params.app_name_len = temp_len;
   }
   else
   {
     // truncate application name if it is too long
-    log_settings.app_name_len = MAX_APP_NAME_LEN;
+    next->params.app_name_len = MAX_APP_NAME_LEN;
     truncated = true;
   }
 
-  strncpy(log_settings.app_name, new_app_name, log_settings.app_name_len);
+  strncpy(next->params.app_name, new_app_name, next->params.app_name_len);
 
   // ensure application name string is null terminated
-  log_settings.app_name[log_settings.app_name_len] = '\0';
+  next->params.app_name[next->params.app_name_len] = '\0';
+
+  end_log_settings_update(next);
+
+  // syslog picks up the new name when it is next opened
+  pthread_mutex_lock(&log_sink_lock);
+  close_syslog();
+  pthread_mutex_unlock(&log_sink_lock);
 
   // if application name was truncated, notify user 
   if (truncated == true)
   {
     fprintf(stderr, "set_app_name(): input \"%s\" ", new_app_name);
-    fprintf(stderr, "truncated to \"%s\"\n", log_settings.app_name);
+    fprintf(stderr, "truncated to \"%s\"\n", next->params.app_name);
   }
 }
 
@@ -69,30 +248,38 @@ void set_app_version(const char *new_app_version)
 {
   bool truncated = false;
   size_t temp_len = 0;
+  struct log_settings_snapshot *next = begin_log_settings_update();
+
+  if (next == NULL)
+  {
+    return;
+  }
 
   temp_len = strnlen(new_app_version, MAX_APP_VERSION_LEN + 1);
   if (temp_len <= MAX_APP_VERSION_LEN)
   {
-    log_settings.app_version_len = temp_len;
+    next->params.app_version_len = temp_len;
   }
   else
   {
     // truncate application version string if it is too long
-    log_settings.app_version_len = MAX_APP_VERSION_LEN;
+    next->params.app_version_len = MAX_APP_VERSION_LEN;
     truncated = true;
   }
 
-  strncpy(log_settings.app_version,
-          new_app_version, log_settings.app_version_len);
+  strncpy(next->params.app_version,
+          new_app_version, next->params.app_version_len);
 
   // ensure application name string is null terminated
-  log_settings.app_version[log_settings.app_version_len] = '\0';
+  next->params.app_version[next->params.app_version_len] = '\0';
+
+  end_log_settings_update(next);
 
   // if application name was truncated, notify user 
   if (truncated == true)
   {
     fprintf(stderr, "set_app_version(): input \"%s\" ", new_app_version);
-    fprintf(stderr, "truncated to \"%s\"\n", log_settings.app_version);
+    fprintf(stderr, "truncated to \"%s\"\n", next->params.app_version);
   }
 }
 
@@ -106,12 +293,26 @@ void set_applog_path(const char *new_applog_path)
   temp_len = strnlen(new_applog_path, MAX_APPLOG_PATH_LEN + 1);
   if (temp_len <= MAX_APPLOG_PATH_LEN)
   {
-    log_settings.applog_path_len = temp_len;
-    strncpy(log_settings.applog_path,
-            new_applog_path, log_settings.applog_path_len);
+    struct log_settings_snapshot *next = begin_log_settings_update();
+
+    if (next == NULL)
+    {
+      return;
+    }
+
+    next->params.applog_path_len = temp_len;
+    strncpy(next->params.applog_path,
+            new_applog_path, next->params.applog_path_len);
 
     // ensure log directory string is null terminated
-    log_settings.applog_path[log_settings.applog_path_len] = '\0';
+    next->params.applog_path[next->params.applog_path_len] = '\0';
+
+    end_log_settings_update(next);
+
+    // the new file is opened with the next message
+    pthread_mutex_lock(&log_sink_lock);
+    close_applog_file();
+    pthread_mutex_unlock(&log_sink_lock);
   }
   else
   {
@@ -119,27 +320,36 @@ void set_applog_path(const char *new_applog_path)
     fprintf(stderr, "set_applog_path(): ");
     fprintf(stderr, "input \"%s\" exceeds maximum length ", new_applog_path);
     fprintf(stderr, "(%d) - application log path ", MAX_APPLOG_PATH_LEN);
-    fprintf(stderr, "remains \"%s\"\n", log_settings.applog_path);
+    fprintf(stderr, "remains \"%s\"\n", get_log_settings()->applog_path);
   }
 }
 
 
 //############################################################################
 // set_applog_max_msg_len()
-//   - valid values: 0 thru 1024
+//   - valid values: 0 thru MAX_APPLOG_MSG_LEN (16384)
 //############################################################################
 void set_applog_max_msg_len(int new_max_log_msg_len)
 {
-  if ((new_max_log_msg_len >= 0) && (new_max_log_msg_len <= 1024))
+  if ((new_max_log_msg_len >= 0) &&
+      (new_max_log_msg_len <= MAX_APPLOG_MSG_LEN))
   {
-    log_settings.applog_max_msg_len = new_max_log_msg_len;
+    struct log_settings_snapshot *next = begin_log_settings_update();
+
+    if (next == NULL)
+    {
+      return;
+    }
+
+    next->params.applog_max_msg_len = new_max_log_msg_len;
+    end_log_settings_update(next);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_applog_max_msg_len(): ");
     fprintf(stderr, "input (%d) invalid ", new_max_log_msg_len);
-    fprintf(stderr, "- unchanged (%d)\n", log_settings.applog_max_msg_len);
+    fprintf(stderr, "- unchanged (%d)\n", get_log_settings()->applog_max_msg_len);
   }
 }
 
@@ -151,14 +361,50 @@ void set_applog_output_mode(int new_output_mode)
 {
   if ((new_output_mode >= 0) && (new_output_mode <= 2))
   {
-    log_settings.applog_output_mode = new_output_mode;
+    struct log_settings_snapshot *next = begin_log_settings_update();
+
+    if (next == NULL)
+    {
+      return;
+    }
+
+    next->params.applog_output_mode = new_output_mode;
+    end_log_settings_update(next);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_applog_output_mode(): ");
     fprintf(stderr, "input (%d) invalid ", new_output_mode);
-    fprintf(stderr, "- unchanged (%d)\n", log_settings.applog_output_mode);
+    fprintf(stderr, "- unchanged (%d)\n", get_log_settings()->applog_output_mode);
+  }
+}
+
+//############################################################################
+// set_applog_format()
+//   - valid values: KMYTH_APPLOG_FORMAT_TEXT (0) or KMYTH_APPLOG_FORMAT_JSON (1)
+//############################################################################
+void set_applog_format(int new_format)
+{
+  if ((new_format == KMYTH_APPLOG_FORMAT_TEXT) ||
+      (new_format == KMYTH_APPLOG_FORMAT_JSON))
+  {
+    struct log_settings_snapshot *next = begin_log_settings_update();
+
+    if (next == NULL)
+    {
+      return;
+    }
+
+    next->params.applog_format = new_format;
+    end_log_settings_update(next);
+  }
+  else
+  {
+    // do nothing if invalid, but warn user
+    fprintf(stderr, "set_applog_format(): ");
+    fprintf(stderr, "input (%d) invalid ", new_format);
+    fprintf(stderr, "- unchanged (%d)\n", get_log_settings()->applog_format);
   }
 }
 
@@ -170,14 +416,22 @@ void set_applog_severity_threshold(int new_severity_threshold)
 {
   if ((new_severity_threshold >= 0) && (new_severity_threshold <= 7))
   {
-    log_settings.applog_severity_threshold = new_severity_threshold;
+    struct log_settings_snapshot *next = begin_log_settings_update();
+
+    if (next == NULL)
+    {
+      return;
+    }
+
+    next->params.applog_severity_threshold = new_severity_threshold;
+    end_log_settings_update(next);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_applog_severity_threshold(): ");
     fprintf(stderr, "input (%d) invalid - unchanged ", new_severity_threshold);
-    fprintf(stderr, "(%d)\n", log_settings.applog_severity_threshold);
+    fprintf(stderr, "(%d)\n", get_log_settings()->applog_severity_threshold);
   }
 }
 
@@ -192,7 +446,19 @@ void set_syslog_facility(int new_syslog_facility)
   if ((LOG_FAC(new_syslog_facility) >= 0) &&
       (LOG_FAC(new_syslog_facility) <= (LOG_NFACILITIES - 1)))
   {
-    log_settings.syslog_facility = new_syslog_facility;
+    struct log_settings_snapshot *next = begin_log_settings_update();
+
+    if (next == NULL)
+    {
+      return;
+    }
+
+    next->params.syslog_facility = new_syslog_facility;
+    end_log_settings_update(next);
+
+    pthread_mutex_lock(&log_sink_lock);
+    close_syslog();
+    pthread_mutex_unlock(&log_sink_lock);
   }
   else
   {
@@ -200,7 +466,7 @@ void set_syslog_facility(int new_syslog_facility)
     fprintf(stderr, "set_syslog_facility(): ");
     fprintf(stderr, "input (%d) ", LOG_FAC(new_syslog_facility));
     fprintf(stderr, "invalid - unchanged ");
-    fprintf(stderr, "(%d)\n", LOG_FAC(log_settings.syslog_facility));
+    fprintf(stderr, "(%d)\n", LOG_FAC(get_log_settings()->syslog_facility));
   }
 }
 
@@ -212,17 +478,73 @@ void set_syslog_severity_threshold(int new_severity_threshold)
 {
   if ((new_severity_threshold >= 0) && (new_severity_threshold <= 7))
   {
-    log_settings.syslog_severity_threshold = new_severity_threshold;
+    struct log_settings_snapshot *next = begin_log_settings_update();
+
+    if (next == NULL)
+    {
+      return;
+    }
+
+    next->params.syslog_severity_threshold = new_severity_threshold;
+    end_log_settings_update(next);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_syslog_severity_threshold(): ");
     fprintf(stderr, "input (%d) invalid - unchanged ", new_severity_threshold);
-    fprintf(stderr, "(%d)\n", log_settings.syslog_severity_threshold);
+    fprintf(stderr, "(%d)\n", get_log_settings()->syslog_severity_threshold);
   }
 }
 
+//############################################################################
+// kmyth_log_reopen()
+//############################################################################
+void kmyth_log_reopen(void)
+{
+  // only a flag is set here (a lock-free atomic store), so this is safe in
+  // a signal handler or any thread; the sinks are reopened by the next
+  // log_event()
+  __atomic_store_n(&log_reopen_requested, 1, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_log_op_begin()
+//############################################################################
+
+// the calling thread's current operation (no operation if the ID is empty)
+static _Thread_local char log_op_id[MAX_LOG_OP_ID_LEN + 1] = "";
+static _Thread_local struct timespec log_op_start;
+
+// the calling thread's innermost span (see kmyth_log_span_begin())
+static _Thread_local kmyth_log_span *log_current_span = NULL;
+
+void kmyth_log_op_begin(const char *op_id)
+{
+  snprintf(log_op_id, sizeof(log_op_id), "%s", (op_id != NULL) ? op_id : "");
+  clock_gettime(CLOCK_MONOTONIC, &log_op_start);
+}
+
+//############################################################################
+// kmyth_log_op_end()
+//############################################################################
+void kmyth_log_op_end(void)
+{
+  log_op_id[0] = '\0';
+}
+
+//############################################################################
+// log_op_elapsed_us()
+//############################################################################
+static int64_t log_op_elapsed_us(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t) (now.tv_sec - log_op_start.tv_sec) * 1000000 +
+    (now.tv_nsec - log_op_start.tv_nsec) / 1000;
+}
+
 //############################################################################
 // get_severity_str()
 //############################################################################
@@ -285,55 +607,186 @@ FILE *get_stddest(int severity_val_in)
   return stddest_out;
 }
 
+// A message to be recorded, with everything the sinks need to know about it
+typedef struct log_record
+{
+  const char *src_file;
+  const char *src_func;
+  int src_line;
+  int severity;
+  time_t ts;
+  const char *op_id;            // empty outside an operation
+  int64_t duration_us;          // time since the operation began
+  uint64_t trace_id[2];         // current span (span_id is 0 outside one)
+  uint64_t span_id;
+  const char *out;              // the formatted message
+} log_record;
+
 //############################################################################
-// log_event()
+// put_json_string()
 //############################################################################
-void log_event(const char *src_file,
-               const char *src_func,
-               const int src_line, int severity, const char *message, ...)
+static void put_json_string(FILE * dest, const char *str)
 {
+  putc_unlocked('"', dest);
+  for (const unsigned char *c = (const unsigned char *) str; *c != '\0'; c++)
+  {
+    switch (*c)
+    {
+    case '"':
+    case '\\':
+      putc_unlocked('\\', dest);
+      putc_unlocked(*c, dest);
+      break;
+    case '\n':
+      fputs("\\n", dest);
+      break;
+    case '\r':
+      fputs("\\r", dest);
+      break;
+    case '\t':
+      fputs("\\t", dest);
+      break;
+    default:
+      if (*c < 0x20)
+      {
+        fprintf(dest, "\\u%04x", *c);
+      }
+      else
+      {
+        putc_unlocked(*c, dest);
+      }
+    }
+  }
+  putc_unlocked('"', dest);
+}
 
-  // format log message (vsnprintf() count parameter includes null terminator)
-  char out[log_settings.applog_max_msg_len + 1];
-  va_list args;
+//############################################################################
+// write_applog_entry()
+//############################################################################
+/**
+ * @brief Writes one application log entry, in the configured format.
+ *
+ * @param[in]  dest      stddest or the log file
+ *
+ * @param[in]  to_file   whether dest is the log file (text entries on the
+ *                       screen omit the timestamp, and may be simplified)
+ *
+ * @param[in]  settings  logger settings
+ *
+ * @param[in]  rec       the message
+ */
+static void write_applog_entry(FILE * dest, bool to_file,
+                               const struct log_params *settings,
+                               const log_record * rec)
+{
+  const char *severity_string = severity_name(rec->severity);
 
-  va_start(args, message);
-  vsnprintf(out, (size_t)log_settings.applog_max_msg_len + 1, message, args);
-  va_end(args);
+  if (settings->applog_format == KMYTH_APPLOG_FORMAT_JSON)
+  {
+    flockfile(dest);
+    fprintf(dest, "{\"timestamp\":\"%s\",\"app\":",
+            format_timestamp(rec->ts, true));
+    put_json_string(dest, settings->app_name);
+    fputs(",\"version\":", dest);
+    put_json_string(dest, settings->app_version);
+    fprintf(dest, ",\"severity\":\"%s\",\"file\":", severity_string);
+    put_json_string(dest, rec->src_file);
+    fputs(",\"func\":", dest);
+    put_json_string(dest, rec->src_func);
+    fprintf(dest, ",\"line\":%d,\"message\":", rec->src_line);
+    put_json_string(dest, rec->out);
+    if (rec->op_id[0] != '\0')
+    {
+      fputs(",\"op_id\":", dest);
+      put_json_string(dest, rec->op_id);
+      fprintf(dest, ",\"duration_us\":%" PRId64, rec->duration_us);
+    }
+    if (rec->span_id != 0)
+    {
+      fprintf(dest, ",\"trace_id\":\"%016" PRIx64 "%016" PRIx64 "\","
+              "\"span_id\":\"%016" PRIx64 "\"", rec->trace_id[0],
+              rec->trace_id[1], rec->span_id);
+    }
+    fputs("}\n", dest);
+    funlockfile(dest);
+  }
+  else if (to_file)
+  {
+    fprintf(dest, "%s-%s %s %s - %s(%s:%d) %s\n",
+            settings->app_name, settings->app_version, severity_string,
+            format_timestamp(rec->ts, false), rec->src_file, rec->src_func,
+            rec->src_line, rec->out);
+  }
+  else if (settings->applog_severity_threshold > LOG_INFO)
+  {
+    fprintf(dest, "%s-%s %s - %s(%s:%d) %s\n",
+            settings->app_name, settings->app_version, severity_string,
+            rec->src_file, rec->src_func, rec->src_line, rec->out);
+  }
+  else
+  {
+    fprintf(dest, "%s - %s\n", severity_string, rec->out);
+  }
+}
 
-  // force severity to a valid value by masking (only use three lowest bits)
-  severity = LOG_PRI(severity);
+//############################################################################
+// write_log_record()
+//############################################################################
+/**
+ * @brief Records a formatted message to syslog and the application log
+ *        (see log_event()). Called by log_event() itself, or by the writer
+ *        thread in asynchronous mode.
+ */
+static void write_log_record(const log_record * rec)
+{
+  pthread_mutex_lock(&log_sink_lock);
 
-  // log to centralized syslog facility
-  setlogmask(LOG_UPTO(log_settings.syslog_severity_threshold));
-  openlog(log_settings.app_name,
-          LOG_CONS | LOG_PID | LOG_NDELAY, log_settings.syslog_facility);
-  syslog(severity, "%s", out);
-  closelog();
+  // the settings are read once, and under the lock, so a setter that closes
+  // a sink after publishing new settings can't race with it being reopened
+  const struct log_params *settings = get_log_settings();
 
-  // application logging
-  if (severity <= log_settings.applog_severity_threshold)
+  // close the sinks if asked to (e.g., the log file was rotated), so they
+  // are opened afresh below
+  if (__atomic_exchange_n(&log_reopen_requested, 0, __ATOMIC_RELAXED))
   {
-    char *severity_string = NULL;
-
-    // set 'severity string' and 'stddest' based on severity of log message
-    get_severity_str(severity, &severity_string);
-    FILE *stddest = get_stddest(severity);
+    close_applog_file();
+    close_syslog();
+  }
 
-    char timestamp[20];
-    time_t ts = time(0);
+  // log to centralized syslog facility
+  if (!syslog_opened)
+  {
+    openlog(settings->app_name,
+            LOG_CONS | LOG_PID | LOG_NDELAY, settings->syslog_facility);
+    syslog_opened = true;
+  }
+  setlogmask(LOG_UPTO(settings->syslog_severity_threshold));
+  syslog(rec->severity, "%s", rec->out);
 
-    // Populate the timestamp string
-    // yyyy-mm-dd hh:mm:ss
-    strftime(timestamp, 20, "%F %T", localtime(&ts));
+  // application logging
+  if (rec->severity <= settings->applog_severity_threshold)
+  {
+    // set 'stddest' based on severity of log message
+    FILE *stddest = get_stddest(rec->severity);
 
-    // open log file for writing -- logfile is NULL if not available to user
-    FILE *logfile = fopen(log_settings.applog_path, "a");
+    // open log file for writing (once) -- logfile is NULL if not available
+    // to user. It is line buffered, so each message is still written out
+    // as it is logged.
+    if (!applog_file_tried)
+    {
+      applog_file = fopen(settings->applog_path, "a");
+      if (applog_file != NULL)
+      {
+        setvbuf(applog_file, NULL, _IOLBF, 0);
+      }
+      applog_file_tried = true;
+    }
+    FILE *logfile = applog_file;
 
     // This switch decides what to print and where.
     // When printing to logfile, timestamps are included, when printing to
-    // stddest, they are not.
-    switch (log_settings.applog_output_mode)
+    // stddest, they are not (unless the format is JSON).
+    switch (settings->applog_output_mode)
     {
       // output mode 0:
       //   print to both stddest (stdout/stderr) and log file (if available)
@@ -348,23 +801,10 @@ void log_event(const char *src_file,
       //       with source location information. User can turn on detailed
       //       logging by using the --verbose (or -v) command line option.
     case 0:
-      if (log_settings.applog_severity_threshold > LOG_INFO)
-      {
-        fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, src_file, src_func, src_line, out);
-      }
-      else
-      {
-        fprintf(stddest, "%s - %s\n", severity_string, out);
-      }
-
+      write_applog_entry(stddest, false, settings, rec);
       if (logfile != NULL)
       {
-        fprintf(logfile, "%s-%s %s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, timestamp, src_file, src_func, src_line, out);
-        fclose(logfile);
+        write_applog_entry(logfile, true, settings, rec);
       }
       break;
 
@@ -382,39 +822,1005 @@ void log_event(const char *src_file,
       //   print to log file only (if available) or stddest (stdout/stderr)
       //   otherwise (never both)
       //
-      //   for stddest:
-      //     - timestamp is always omitted
-      //     - if logging severity threshold is <= LOG_INFO (<= 6), simplify
-      //       prefix to the severity level and content to the actual message
-      //       (routine logging to a user's screen will be simplified).
-      //     - if logging severity threshold is > LOG_INFO (> 6), include the
-      //       full prefix (with application name/version) and enhance message
-      //       with source location information. User can turn on detailed
-      //       logging by using the --verbose (or -v) command line option.
+      //   for stddest: as for output mode 0
     default:
       if (logfile == NULL)
       {
-        if (log_settings.applog_severity_threshold > LOG_INFO)
-        {
-          fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
-                  log_settings.app_name, log_settings.app_version,
-                  severity_string, src_file, src_func, src_line, out);
-        }
-        else
-        {
-          fprintf(stddest, "%s - %s\n", severity_string, out);
-        }
+        write_applog_entry(stddest, false, settings, rec);
       }
       else
       {
-        fprintf(logfile, "%s-%s %s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, timestamp, src_file, src_func, src_line, out);
-        fclose(logfile);
+        write_applog_entry(logfile, true, settings, rec);
       }
     }
+  }
+
+  pthread_mutex_unlock(&log_sink_lock);
+}
+
+//############################################################################
+// format_log_message()
+//############################################################################
+/**
+ * @brief Formats a message into a caller-supplied buffer, or (if it is
+ *        longer than the buffer holds) into one allocated for it.
+ *
+ * @param[in]  buf      buffer of buf_len + 1 bytes
+ *
+ * @param[in]  buf_len  length of the longest message buf holds
+ *
+ * @param[in]  max_len  the maximum message length (longer messages are
+ *                      truncated)
+ *
+ * @param[in]  message  format specification of the message, with its
+ *                      arguments in *args, or (if args is NULL) the
+ *                      message itself
+ *
+ * @param[in]  args     arguments for message (left for the caller to end)
+ *
+ * @return The message: buf, or a buffer the caller must free(). If that
+ *         can't be allocated, the message is truncated to fit buf.
+ */
+static char *format_log_message(char *buf, size_t buf_len, size_t max_len,
+                                const char *message, va_list * args)
+{
+  size_t fit_len = (max_len < buf_len) ? max_len : buf_len;
+
+  // nothing to format: copy it (most messages are constant strings)
+  if (args == NULL)
+  {
+    size_t len = strnlen(message, max_len);
+    char *out = (len > buf_len) ? malloc(len + 1) : NULL;
+
+    if (out == NULL)
+    {
+      out = buf;
+      len = (len < fit_len) ? len : fit_len;
+    }
+    memcpy(out, message, len);
+    out[len] = '\0';
+    return out;
+  }
+
+  // vsnprintf() count parameter includes null terminator
+  va_list fit_args;
+
+  va_copy(fit_args, *args);
+
+  int len = vsnprintf(buf, fit_len + 1, message, fit_args);
+
+  va_end(fit_args);
+  if (len < 0 || (size_t) len <= fit_len)
+  {
+    return buf;
+  }
+
+  // too long for buf: format it again, into a buffer of its own
+  size_t spill_len = ((size_t) len < max_len) ? (size_t) len : max_len;
+
+  if (spill_len <= fit_len)
+  {
+    return buf;
+  }
 
-    // clean-up
-    free(severity_string);
+  char *spill = malloc(spill_len + 1);
+
+  if (spill == NULL)
+  {
+    return buf;
+  }
+  vsnprintf(spill, spill_len + 1, message, *args);
+  return spill;
+}
+
+//############################################################################
+// Spans
+//############################################################################
+
+// the file spans are exported to (see kmyth_log_set_span_export_path())
+static pthread_mutex_t span_export_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *span_export_file = NULL;
+
+// span (and trace) IDs are a counter run through a mixing function, from a
+// random starting point, so they are unique within a run and unlikely to
+// collide across runs
+static pthread_once_t span_id_once = PTHREAD_ONCE_INIT;
+static uint64_t span_id_seed = 0;
+static atomic_uint_least64_t span_id_counter;
+
+//############################################################################
+// seed_span_ids()
+//############################################################################
+static void seed_span_ids(void)
+{
+  if (getrandom(&span_id_seed, sizeof(span_id_seed), 0) !=
+      (ssize_t) sizeof(span_id_seed))
+  {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    span_id_seed = ((uint64_t) now.tv_sec << 32) ^ (uint64_t) now.tv_nsec ^
+      ((uint64_t) getpid() << 16);
+  }
+}
+
+//############################################################################
+// new_span_id()
+//############################################################################
+static uint64_t new_span_id(void)
+{
+  pthread_once(&span_id_once, seed_span_ids);
+
+  // splitmix64 - never returns the same value for two counter values
+  uint64_t id = span_id_seed +
+    (atomic_fetch_add(&span_id_counter, 1) + 1) * 0x9e3779b97f4a7c15ULL;
+
+  id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  id = (id ^ (id >> 27)) * 0x94d049bb133111ebULL;
+  id ^= id >> 31;
+
+  // 0 means "none"
+  return (id != 0) ? id : 1;
+}
+
+//############################################################################
+// kmyth_log_span_begin()
+//############################################################################
+void kmyth_log_span_begin(kmyth_log_span * span, const char *name)
+{
+  kmyth_log_span_begin_child(span, name, log_current_span);
+}
+
+//############################################################################
+// kmyth_log_span_begin_child()
+//############################################################################
+void kmyth_log_span_begin_child(kmyth_log_span * span, const char *name,
+                                kmyth_log_span * parent)
+{
+  span->name = name;
+  span->parent = parent;
+  span->prev_current = log_current_span;
+  span->span_id = new_span_id();
+  if (span->parent != NULL)
+  {
+    span->trace_id[0] = span->parent->trace_id[0];
+    span->trace_id[1] = span->parent->trace_id[1];
+    span->parent_id = span->parent->span_id;
+  }
+  else
+  {
+    span->trace_id[0] = new_span_id();
+    span->trace_id[1] = new_span_id();
+    span->parent_id = 0;
+  }
+
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  span->start_unix_ns = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  clock_gettime(CLOCK_MONOTONIC, &span->start);
+
+  log_current_span = span;
+}
+
+//############################################################################
+// export_span()
+//############################################################################
+static void export_span(const kmyth_log_span * span, int64_t duration_ns,
+                        int status)
+{
+  pthread_mutex_lock(&span_export_lock);
+  if (span_export_file != NULL)
+  {
+    const struct log_params *settings = get_log_settings();
+    FILE *dest = span_export_file;
+
+    flockfile(dest);
+    fputs("{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+          "{\"key\":\"service.name\",\"value\":{\"stringValue\":", dest);
+    put_json_string(dest, settings->app_name);
+    fputs("}},{\"key\":\"service.version\",\"value\":{\"stringValue\":",
+          dest);
+    put_json_string(dest, settings->app_version);
+    fputs("}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"kmyth-logger\"},"
+          "\"spans\":[{", dest);
+    fprintf(dest, "\"traceId\":\"%016" PRIx64 "%016" PRIx64 "\","
+            "\"spanId\":\"%016" PRIx64 "\",", span->trace_id[0],
+            span->trace_id[1], span->span_id);
+    if (span->parent_id != 0)
+    {
+      fprintf(dest, "\"parentSpanId\":\"%016" PRIx64 "\",",
+              span->parent_id);
+    }
+    fputs("\"name\":", dest);
+    put_json_string(dest, span->name);
+
+    // kind 1 = SPAN_KIND_INTERNAL; status code 1 = OK, 2 = ERROR
+    fprintf(dest, ",\"kind\":1,\"startTimeUnixNano\":\"%" PRId64 "\","
+            "\"endTimeUnixNano\":\"%" PRId64 "\",",
+            span->start_unix_ns, span->start_unix_ns + duration_ns);
+    fprintf(dest, "\"status\":{\"code\":%d}}]}]}]}\n", status ? 2 : 1);
+    funlockfile(dest);
+  }
+  pthread_mutex_unlock(&span_export_lock);
+}
+
+//############################################################################
+// kmyth_log_span_end()
+//############################################################################
+void kmyth_log_span_end(kmyth_log_span * span, int status)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int64_t duration_ns = (int64_t) (now.tv_sec - span->start.tv_sec) *
+    1000000000 + (now.tv_nsec - span->start.tv_nsec);
+
+  // logged while the span is still current, so the entry carries its IDs
+  kmyth_log(LOG_DEBUG, "span %s %s after %" PRId64 " us", span->name,
+            status ? "failed" : "finished", duration_ns / 1000);
+  export_span(span, duration_ns, status);
+
+  log_current_span = span->prev_current;
+}
+
+//############################################################################
+// kmyth_log_set_span_export_path()
+//############################################################################
+int kmyth_log_set_span_export_path(const char *path)
+{
+  FILE *file = NULL;
+
+  if (path != NULL)
+  {
+    file = fopen(path, "a");
+    if (file == NULL)
+    {
+      fprintf(stderr, "kmyth_log_set_span_export_path(): ");
+      fprintf(stderr, "unable to open \"%s\"\n", path);
+      return 1;
+    }
+    setvbuf(file, NULL, _IOLBF, 0);
+  }
+
+  pthread_mutex_lock(&span_export_lock);
+  if (span_export_file != NULL)
+  {
+    fclose(span_export_file);
+  }
+  span_export_file = file;
+  pthread_mutex_unlock(&span_export_lock);
+
+  return 0;
+}
+
+//############################################################################
+// Asynchronous logging
+//############################################################################
+
+// length of the source file and function names kept with a queued message
+#define ASYNC_SRC_NAME_LEN 64
+
+// how long the writer sleeps at most when it finds the queue empty, and a
+// blocked producer between checks for room
+#define ASYNC_WRITER_WAIT_NS 100000000L
+#define ASYNC_PRODUCER_WAIT_NS 50000L
+
+// A message waiting in the queue. The queue is a bounded MPSC ring in which
+// every slot carries a sequence number: a slot at ring position pos may be
+// filled when its sequence is pos, and read once it is pos + 1.
+typedef struct async_log_slot
+{
+  atomic_size_t seq;
+  int src_line;
+  int severity;
+  time_t ts;
+  char src_file[ASYNC_SRC_NAME_LEN];
+  char src_func[ASYNC_SRC_NAME_LEN];
+  char op_id[MAX_LOG_OP_ID_LEN + 1];
+  int64_t duration_us;
+  uint64_t trace_id[2];
+  uint64_t span_id;
+  char out[KMYTH_LOG_INLINE_MSG_LEN + 1];
+  char *spill;                  // the message instead, if too long for out
+} async_log_slot;
+
+static async_log_slot *async_ring = NULL;
+static size_t async_mask = 0;
+static kmyth_log_overflow async_overflow = KMYTH_LOG_OVERFLOW_DROP;
+static atomic_size_t async_enqueue_pos;
+static size_t async_dequeue_pos = 0;    // used by the writer only
+
+// producers check in before looking at async_active, so that stopping can
+// wait for those already past the check
+static atomic_bool async_active;
+static atomic_int async_producers;
+static atomic_bool async_stopping;
+static atomic_uint_least64_t async_dropped;
+
+// the writer sleeps on async_wake when the queue is empty, flagging this
+// in async_writer_idle so producers know to signal it
+static pthread_t async_writer;
+static pthread_mutex_t async_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_wake = PTHREAD_COND_INITIALIZER;
+static atomic_bool async_writer_idle;
+
+//############################################################################
+// wake_async_writer()
+//############################################################################
+static void wake_async_writer(void)
+{
+  pthread_mutex_lock(&async_wake_lock);
+  pthread_cond_signal(&async_wake);
+  pthread_mutex_unlock(&async_wake_lock);
+}
+
+//############################################################################
+// async_slot_ready()
+//############################################################################
+static bool async_slot_ready(void)
+{
+  async_log_slot *slot = &async_ring[async_dequeue_pos & async_mask];
+
+  return atomic_load_explicit(&slot->seq, memory_order_acquire) ==
+    async_dequeue_pos + 1;
+}
+
+//############################################################################
+// async_writer_main()
+//############################################################################
+static void *async_writer_main(void *arg)
+{
+  (void) arg;
+  uint64_t reported = 0;
+
+  while (true)
+  {
+    if (async_slot_ready())
+    {
+      async_log_slot *slot = &async_ring[async_dequeue_pos & async_mask];
+
+      log_record rec = {
+        .src_file = slot->src_file,
+        .src_func = slot->src_func,
+        .src_line = slot->src_line,
+        .severity = slot->severity,
+        .ts = slot->ts,
+        .op_id = slot->op_id,
+        .duration_us = slot->duration_us,
+        .trace_id = {slot->trace_id[0], slot->trace_id[1]},
+        .span_id = slot->span_id,
+        .out = (slot->spill != NULL) ? slot->spill : slot->out,
+      };
+
+      write_log_record(&rec);
+      free(slot->spill);
+      slot->spill = NULL;
+
+      // hand the slot back for the producers' next lap around the ring
+      atomic_store_explicit(&slot->seq, async_dequeue_pos + async_mask + 1,
+                            memory_order_release);
+      async_dequeue_pos++;
+      continue;
+    }
+
+    // the queue is empty, so this is a good time to own up to any drops
+    uint64_t dropped = atomic_load(&async_dropped);
+
+    if (dropped != reported)
+    {
+      char out[64];
+
+      snprintf(out, sizeof(out), "%" PRIu64 " log message(s) dropped "
+               "(log queue full)", dropped - reported);
+      log_record rec = {
+        .src_file = __FILE__,
+        .src_func = __func__,
+        .src_line = __LINE__,
+        .severity = LOG_WARNING,
+        .ts = time(0),
+        .op_id = "",
+        .out = out,
+      };
+
+      write_log_record(&rec);
+      reported = dropped;
+      continue;
+    }
+
+    // stopping is only set once no producer can add anything, so an empty
+    // queue now stays empty
+    if (atomic_load(&async_stopping))
+    {
+      if (async_slot_ready())
+      {
+        continue;
+      }
+      break;
+    }
+
+    // sleep until a producer signals (or, as a fallback, a timeout)
+    pthread_mutex_lock(&async_wake_lock);
+    atomic_store(&async_writer_idle, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!async_slot_ready() && !atomic_load(&async_stopping))
+    {
+      struct timespec until;
+
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += ASYNC_WRITER_WAIT_NS;
+      if (until.tv_nsec >= 1000000000L)
+      {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&async_wake, &async_wake_lock, &until);
+    }
+    atomic_store(&async_writer_idle, false);
+    pthread_mutex_unlock(&async_wake_lock);
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// async_log_event()
+//############################################################################
+/**
+ * @brief Queues a message for the writer thread if the logger is in
+ *        asynchronous mode.
+ *
+ * @param[in]  message  format specification of the message, with its
+ *                      arguments in *args, or (if args is NULL) the
+ *                      message itself, already formatted
+ *
+ * @return true if the message was dealt with (queued or dropped), false if
+ *         the logger is synchronous and the caller must record it (args is
+ *         untouched in that case)
+ */
+static bool async_log_event(const char *src_file, const char *src_func,
+                            int src_line, int severity, const char *message,
+                            va_list * args)
+{
+  atomic_fetch_add(&async_producers, 1);
+  if (!atomic_load(&async_active))
+  {
+    atomic_fetch_sub(&async_producers, 1);
+    return false;
+  }
+
+  // claim the next free slot
+  size_t pos = atomic_load_explicit(&async_enqueue_pos, memory_order_relaxed);
+  async_log_slot *slot = NULL;
+
+  while (true)
+  {
+    slot = &async_ring[pos & async_mask];
+
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+    if (seq == pos)
+    {
+      if (atomic_compare_exchange_weak_explicit(&async_enqueue_pos, &pos,
+                                                pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (seq < pos + 1)
+    {
+      // full: the writer has not yet read this slot on the previous lap
+      if (async_overflow == KMYTH_LOG_OVERFLOW_DROP)
+      {
+        atomic_fetch_add(&async_dropped, 1);
+        atomic_fetch_sub(&async_producers, 1);
+        return true;
+      }
+
+      struct timespec pause = {.tv_sec = 0,.tv_nsec = ASYNC_PRODUCER_WAIT_NS };
+
+      wake_async_writer();
+      nanosleep(&pause, NULL);
+      pos = atomic_load_explicit(&async_enqueue_pos, memory_order_relaxed);
+    }
+    else
+    {
+      // another producer took this slot first
+      pos = atomic_load_explicit(&async_enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  slot->src_line = src_line;
+  slot->severity = severity;
+  slot->ts = time(0);
+  snprintf(slot->src_file, sizeof(slot->src_file), "%s", src_file);
+  snprintf(slot->src_func, sizeof(slot->src_func), "%s", src_func);
+  memcpy(slot->op_id, log_op_id, sizeof(slot->op_id));
+  slot->duration_us = (log_op_id[0] != '\0') ? log_op_elapsed_us() : 0;
+  if (log_current_span != NULL)
+  {
+    slot->trace_id[0] = log_current_span->trace_id[0];
+    slot->trace_id[1] = log_current_span->trace_id[1];
+    slot->span_id = log_current_span->span_id;
+  }
+  else
+  {
+    slot->span_id = 0;
+  }
+  char *out = format_log_message(slot->out, KMYTH_LOG_INLINE_MSG_LEN,
+                                 (size_t) get_log_settings()->
+                                 applog_max_msg_len, message, args);
+
+  slot->spill = (out != slot->out) ? out : NULL;
+
+  // publish it, and wake the writer if it is waiting for work
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&async_writer_idle))
+  {
+    wake_async_writer();
+  }
+
+  atomic_fetch_sub(&async_producers, 1);
+  return true;
+}
+
+//############################################################################
+// kmyth_log_start_async()
+//############################################################################
+int kmyth_log_start_async(size_t capacity, kmyth_log_overflow overflow)
+{
+  if (capacity == 0 || capacity > KMYTH_LOG_ASYNC_MAX_CAPACITY ||
+      (overflow != KMYTH_LOG_OVERFLOW_DROP &&
+       overflow != KMYTH_LOG_OVERFLOW_BLOCK))
+  {
+    fprintf(stderr, "kmyth_log_start_async(): invalid capacity (%zu) ",
+            capacity);
+    fprintf(stderr, "or overflow policy (%d)\n", (int) overflow);
+    return 1;
+  }
+  if (async_ring != NULL)
+  {
+    fprintf(stderr, "kmyth_log_start_async(): already started\n");
+    return 1;
+  }
+
+  size_t size = 1;
+
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+
+  async_ring = calloc(size, sizeof(async_log_slot));
+  if (async_ring == NULL)
+  {
+    fprintf(stderr, "kmyth_log_start_async(): unable to allocate queue\n");
+    return 1;
+  }
+  for (size_t i = 0; i < size; i++)
+  {
+    atomic_init(&async_ring[i].seq, i);
+  }
+  async_mask = size - 1;
+  async_overflow = overflow;
+  async_dequeue_pos = 0;
+  atomic_store(&async_enqueue_pos, 0);
+  atomic_store(&async_dropped, 0);
+  atomic_store(&async_stopping, false);
+  atomic_store(&async_writer_idle, false);
+
+  if (pthread_create(&async_writer, NULL, async_writer_main, NULL))
+  {
+    fprintf(stderr, "kmyth_log_start_async(): unable to start writer\n");
+    free(async_ring);
+    async_ring = NULL;
+    return 1;
+  }
+
+  // queued messages are still written out if the process just exits
+  static bool exit_handler_set = false;
+
+  if (!exit_handler_set)
+  {
+    atexit(kmyth_log_stop_async);
+    exit_handler_set = true;
+  }
+
+  atomic_store(&async_active, true);
+  return 0;
+}
+
+//############################################################################
+// kmyth_log_stop_async()
+//############################################################################
+void kmyth_log_stop_async(void)
+{
+  if (!atomic_exchange(&async_active, false))
+  {
+    return;
+  }
+
+  // new messages now go straight to the sinks; wait for the producers that
+  // were already queueing, then let the writer drain the queue and exit
+  while (atomic_load(&async_producers) > 0)
+  {
+    sched_yield();
+  }
+  pthread_mutex_lock(&async_wake_lock);
+  atomic_store(&async_stopping, true);
+  pthread_cond_signal(&async_wake);
+  pthread_mutex_unlock(&async_wake_lock);
+  pthread_join(async_writer, NULL);
+
+  free(async_ring);
+  async_ring = NULL;
+}
+
+//############################################################################
+// kmyth_log_async_dropped()
+//############################################################################
+uint64_t kmyth_log_async_dropped(void)
+{
+  return atomic_load(&async_dropped);
+}
+
+//############################################################################
+// Rate limiting and deduplication
+//############################################################################
+
+// What is known about the recent messages of one call site. Sites are
+// found by a hash of their source file name and line (the names are
+// copied: log_events_ocall() passes them in a transient buffer).
+typedef struct log_limit_site
+{
+  bool in_use;
+  uint64_t key;
+  int src_line;
+  char src_file[ASYNC_SRC_NAME_LEN];
+  char src_func[ASYNC_SRC_NAME_LEN];
+  int severity;
+  time_t window_start;          // CLOCK_MONOTONIC seconds
+  unsigned int count;           // messages recorded in the current interval
+  uint64_t suppressed;          // rate limited, not yet reported
+  bool has_last;
+  uint64_t last_hash;           // hash of the last message recorded
+  uint64_t repeats;             // repeats of it, not yet reported
+} log_limit_site;
+
+// The sites form an open-addressed hash table. Sites are never removed;
+// once it is full, messages from new sites are recorded unlimited.
+static pthread_mutex_t log_limit_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_limit_site log_limit_sites[KMYTH_LOG_LIMIT_MAX_SITES];
+static pthread_once_t log_limit_once = PTHREAD_ONCE_INIT;
+
+//############################################################################
+// log_hash()
+//############################################################################
+/**
+ * @brief Continues a 64-bit FNV-1a hash over a string.
+ */
+static uint64_t log_hash(uint64_t hash, const char *str)
+{
+  for (const unsigned char *c = (const unsigned char *) str; *c != '\0'; c++)
+  {
+    hash ^= *c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+#define LOG_HASH_INIT 0xcbf29ce484222325ULL
+
+//############################################################################
+// record_log_message()
+//############################################################################
+/**
+ * @brief Writes out a formatted message, with the calling thread's current
+ *        operation and span (synchronous mode).
+ */
+static void record_log_message(const char *src_file, const char *src_func,
+                               int src_line, int severity, const char *out)
+{
+  log_record rec = {
+    .src_file = src_file,
+    .src_func = src_func,
+    .src_line = src_line,
+    .severity = severity,
+    .ts = time(0),
+    .op_id = log_op_id,
+    .duration_us = (log_op_id[0] != '\0') ? log_op_elapsed_us() : 0,
+    .out = out,
+  };
+
+  if (log_current_span != NULL)
+  {
+    rec.trace_id[0] = log_current_span->trace_id[0];
+    rec.trace_id[1] = log_current_span->trace_id[1];
+    rec.span_id = log_current_span->span_id;
+  }
+
+  write_log_record(&rec);
+}
+
+//############################################################################
+// emit_log_message()
+//############################################################################
+/**
+ * @brief Records an already formatted message (to the queue in
+ *        asynchronous mode, directly otherwise).
+ */
+static void emit_log_message(const char *src_file, const char *src_func,
+                             int src_line, int severity, const char *out)
+{
+  if (!async_log_event(src_file, src_func, src_line, severity, out, NULL))
+  {
+    record_log_message(src_file, src_func, src_line, severity, out);
+  }
+}
+
+//############################################################################
+// report_log_limit_site()
+//############################################################################
+/**
+ * @brief Records (and clears) the counts of suppressed messages a call site
+ *        has not yet reported. The caller holds log_limit_lock.
+ *
+ * @param[in]  repeats_only  report only the repeats of the last message
+ *                           (the rate limited count belongs to an interval
+ *                           that is still running)
+ */
+static void report_log_limit_site(log_limit_site * site, bool repeats_only)
+{
+  char out[96];
+
+  if (site->repeats > 0)
+  {
+    snprintf(out, sizeof(out), "last message repeated %" PRIu64 " time(s)",
+             site->repeats);
+    emit_log_message(site->src_file, site->src_func, site->src_line,
+                     site->severity, out);
+    site->repeats = 0;
+  }
+  if (!repeats_only && site->suppressed > 0)
+  {
+    snprintf(out, sizeof(out), "%" PRIu64 " log message(s) suppressed "
+             "(rate limit)", site->suppressed);
+    emit_log_message(site->src_file, site->src_func, site->src_line,
+                     site->severity, out);
+    site->suppressed = 0;
+  }
+}
+
+//############################################################################
+// flush_log_limit_sites()
+//############################################################################
+/**
+ * @brief Reports every call site's pending counts (run at exit).
+ */
+static void flush_log_limit_sites(void)
+{
+  pthread_mutex_lock(&log_limit_lock);
+  for (size_t i = 0; i < KMYTH_LOG_LIMIT_MAX_SITES; i++)
+  {
+    if (log_limit_sites[i].in_use)
+    {
+      report_log_limit_site(&log_limit_sites[i], false);
+    }
+  }
+  pthread_mutex_unlock(&log_limit_lock);
+}
+
+//############################################################################
+// register_log_limit_flush()
+//############################################################################
+static void register_log_limit_flush(void)
+{
+  atexit(flush_log_limit_sites);
+}
+
+//############################################################################
+// set_log_rate_limit()
+//   - valid values: severity 0-7, interval > 0 unless burst and dedup are 0
+//############################################################################
+void set_log_rate_limit(int severity, unsigned int burst,
+                        unsigned int interval, int dedup)
+{
+  bool off = (burst == 0 && !dedup);
+
+  if ((severity < 0) || (severity > LOG_DEBUG) || (!off && interval == 0))
+  {
+    // do nothing if invalid, but warn user
+    fprintf(stderr, "set_log_rate_limit(): ");
+    fprintf(stderr, "input (%d, %u, %u, %d) invalid - unchanged\n",
+            severity, burst, interval, dedup);
+    return;
+  }
+
+  struct log_settings_snapshot *next = begin_log_settings_update();
+
+  if (next == NULL)
+  {
+    return;
+  }
+
+  next->params.rate_limit[severity].burst = burst;
+  next->params.rate_limit[severity].interval = off ? 0 : interval;
+  next->params.rate_limit[severity].dedup = dedup ? 1 : 0;
+  end_log_settings_update(next);
+
+  if (!off)
+  {
+    pthread_once(&log_limit_once, register_log_limit_flush);
+  }
+}
+
+//############################################################################
+// limited_log_event()
+//############################################################################
+/**
+ * @brief Records a formatted message unless its call site has exceeded the
+ *        rate limit for its severity, or it repeats the site's last message
+ *        (see set_log_rate_limit()).
+ */
+static void limited_log_event(const char *src_file, const char *src_func,
+                              int src_line, int severity,
+                              const struct log_rate_limit *limit,
+                              const char *out)
+{
+  char line[16];
+
+  snprintf(line, sizeof(line), ":%d", src_line);
+
+  uint64_t key = log_hash(log_hash(LOG_HASH_INIT, src_file), line);
+  uint64_t msg_hash = log_hash(LOG_HASH_INIT, out);
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock(&log_limit_lock);
+
+  // find the call site, or claim a free slot for it
+  log_limit_site *site = NULL;
+
+  for (size_t i = 0; i < KMYTH_LOG_LIMIT_MAX_SITES; i++)
+  {
+    log_limit_site *slot =
+      &log_limit_sites[(key + i) % KMYTH_LOG_LIMIT_MAX_SITES];
+
+    if (!slot->in_use)
+    {
+      memset(slot, 0, sizeof(*slot));
+      slot->in_use = true;
+      slot->key = key;
+      slot->src_line = src_line;
+      snprintf(slot->src_file, sizeof(slot->src_file), "%s", src_file);
+      snprintf(slot->src_func, sizeof(slot->src_func), "%s", src_func);
+      slot->window_start = now.tv_sec;
+      site = slot;
+      break;
+    }
+    if (slot->key == key)
+    {
+      site = slot;
+      break;
+    }
+  }
+
+  // no room left to keep track of it
+  if (site == NULL)
+  {
+    emit_log_message(src_file, src_func, src_line, severity, out);
+    pthread_mutex_unlock(&log_limit_lock);
+    return;
+  }
+
+  site->severity = severity;
+
+  // a new interval: report the last one and start counting afresh
+  if (now.tv_sec - site->window_start >= (time_t) limit->interval)
+  {
+    report_log_limit_site(site, false);
+    site->window_start = now.tv_sec;
+    site->count = 0;
+    site->has_last = false;
+  }
+
+  if (limit->dedup && site->has_last && site->last_hash == msg_hash)
+  {
+    site->repeats++;
+  }
+  else if (limit->burst > 0 && site->count >= limit->burst)
+  {
+    site->suppressed++;
+  }
+  else
+  {
+    report_log_limit_site(site, true);
+    emit_log_message(src_file, src_func, src_line, severity, out);
+    site->count++;
+    site->has_last = true;
+    site->last_hash = msg_hash;
+  }
+
+  pthread_mutex_unlock(&log_limit_lock);
+}
+
+//############################################################################
+// log_event()
+//############################################################################
+void log_event(const char *src_file,
+               const char *src_func,
+               const int src_line, int severity, const char *message, ...)
+{
+  // force severity to a valid value by masking (only use three lowest bits)
+  severity = LOG_PRI(severity);
+
+  const struct log_params *settings = get_log_settings();
+
+  // nothing to do (and nothing to format) if no sink would record it
+  if (severity > settings->applog_severity_threshold &&
+      severity > settings->syslog_severity_threshold)
+  {
+    return;
+  }
+
+  // messages are formatted into a per-thread buffer, and only the rare
+  // longer ones spill to the heap
+  static _Thread_local char buf[KMYTH_LOG_INLINE_MSG_LEN + 1];
+  size_t max_len = (size_t) settings->applog_max_msg_len;
+
+  // a message without conversion specifications takes no arguments, and
+  // needs no formatting
+  bool constant = (strchr(message, '%') == NULL);
+
+  va_list args;
+
+  va_start(args, message);
+
+  // rate limited messages have to be formatted first, to spot repeats
+  const struct log_rate_limit *limit = &(settings->rate_limit[severity]);
+
+  if (limit->interval > 0)
+  {
+    char *out = format_log_message(buf, KMYTH_LOG_INLINE_MSG_LEN, max_len,
+                                   message, constant ? NULL : &args);
+
+    va_end(args);
+    limited_log_event(src_file, src_func, src_line, severity, limit, out);
+    if (out != buf)
+    {
+      free(out);
+    }
+    return;
+  }
+
+  // in asynchronous mode, the writer thread takes it from here
+  if (async_log_event(src_file, src_func, src_line, severity, message,
+                      constant ? NULL : &args))
+  {
+    va_end(args);
+    return;
+  }
+
+  // a constant message short enough is recorded as it is
+  if (constant && strnlen(message, max_len + 1) <= max_len)
+  {
+    va_end(args);
+    record_log_message(src_file, src_func, src_line, severity, message);
+    return;
+  }
+
+  char *out = format_log_message(buf, KMYTH_LOG_INLINE_MSG_LEN, max_len,
+                                 message, constant ? NULL : &args);
+
+  va_end(args);
+  record_log_message(src_file, src_func, src_line, severity, out);
+  if (out != buf)
+  {
+    free(out);
   }
 }
@@ -0,0 +1,3 @@
+#include <string.h>
+#include <stdlib.h>
+void kmyth_clear_and_free(void*p,size_t n){if(p){memset(p,0,n);free(p);}}
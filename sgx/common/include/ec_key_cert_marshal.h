@@ -43,7 +43,8 @@ extern "C"
  *                                   return, it will point to an allocated
  *                                   byte array containing the DER result.
  *                                   The calling function must free this
- *                                   memory when done with it.
+ *                                   memory (kmyth_free()) when done with
+ *                                   it.
  *
  * @param[out] ec_der_bytes_out_len  Pointer to size of the byte array
  *                                   containing the marshalled EC private
@@ -69,7 +70,8 @@ extern "C"
  *                                   parameter. On return, it will point to
  *                                   an allocated byte array containing the
  *                                   DER result. The calling function must
- *                                   free this memory when done with it.
+ *                                   free this memory (kmyth_free()) when
+ *                                   done with it.
  *
  * @param[out] ec_der_bytes_out_len  Pointer to size of the byte array
  *                                   containing the marshalled X509 EC
@@ -95,8 +97,8 @@ extern "C"
  *                                   function for this parameter. On return,
  *                                   it will point to an allocated byte array
  *                                   containing the DER result. The calling
- *                                   function must free this memory when done
- *                                   with it.
+ *                                   function must free this memory
+ *                                   (kmyth_free()) when done with it.
  *
  * @param[out] cert_dn_bytes_out_len Pointer to size of the byte array
  *                                   containing the marshalled X509_NAME bytes
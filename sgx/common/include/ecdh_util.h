@@ -25,6 +25,26 @@ extern "C"
 #include <openssl/bn.h>
 #include <openssl/kdf.h>
 #include <openssl/err.h>
+#include <openssl/sha.h>
+
+/**
+ * @brief A peer's signing certificate, set up once for use across
+ *        'retrieve key' protocol sessions: the parsed certificate, the
+ *        peer identity (subject name) it holds, its public key, and a
+ *        signature verification context already initialized with that key
+ *        (which each verification works on a copy of). The digest (SHA-256
+ *        over the DER-encoded certificate) identifies the certificate.
+ *        (Defined ahead of the local headers, which declare functions
+ *        taking it.)
+ */
+typedef struct ECPeerCert
+{
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  X509 *cert;
+  X509_NAME *identity;
+  EVP_PKEY *pubkey;
+  EVP_MD_CTX *verify_ctx;
+} ECPeerCert;
 
 #include <kmip/kmip.h>
 
@@ -59,11 +79,13 @@ extern "C"
 /**
  * @brief Specify the size (in bytes) of the desired key derivation
  *        function (KDF) output. Also specify the size for each of
- *        the two 'session keys' to be created (note that this must
- *        be <= half of the KDF output size) 
+ *        the two 'session keys' to be created, and for the session
+ *        resumption secret that follows them in the KDF output (note
+ *        that the three together must fit in the KDF output size)
  */
-#define KMYTH_ECDH_KDF_OUTPUT_SIZE 64
+#define KMYTH_ECDH_KDF_OUTPUT_SIZE 96
 #define KMYTH_ECDH_SESSION_KEY_SIZE 32
+#define KMYTH_ECDH_RESUME_SECRET_SIZE 32
 
 /**
  * @brief Creates an ephemeral elliptic curve key pair (containing both the
@@ -103,6 +125,9 @@ extern "C"
  * @param[out] shared_secret_len    Pointer to the length (in bytes) of the
  *                                  shared secret result
  *
+ * The shared secret is a session buffer, to be released with
+ * kmyth_session_free() (see kmyth_enclave_common.h).
+ *
  * @return 0 on success, 1 on error
  */
   int compute_ecdh_shared_secret(EVP_PKEY * local_eph_keypair,
@@ -137,22 +162,36 @@ extern "C"
  * @param[in]  msg2_in_len      Length (in bytes) of the input 'Server Hello'
  *                              message
  *
- * @param[out] key1_out_bytes   Pointer to first half (32 bytes, 256-bits) of
- *                              the HKDF output key bytes result (64 bytes,
- *                              512 bits). This result will be used as a
+ * @param[out] key1_out_bytes   Pointer to the first 32 bytes (256 bits) of
+ *                              the HKDF output key bytes result (96 bytes,
+ *                              768 bits). This result will be used as a
  *                              session key value (first of two session keys).
  *
  * @param[out] key1_out_len     Pointer to the length (in bytes) of the
  *                              first session key result (should be 32 bytes).
  * 
- * @param[out] key2_out_bytes   Pointer to second half (32 bytes, 256-bits) of
- *                              the HKDF output key bytes result (64 bytes,
- *                              512 bits). This result will be used as a
+ * @param[out] key2_out_bytes   Pointer to the next 32 bytes (256 bits) of
+ *                              the HKDF output key bytes result (96 bytes,
+ *                              768 bits). This result will be used as a
  *                              session key value (second of two session keys).
  *
  * @param[out] key2_out_len     Pointer to the length (in bytes) of the
  *                              second session key result (should be 32 bytes).
  * 
+ * @param[out] resume_out_bytes Pointer to the last 32 bytes of the HKDF
+ *                              output key bytes result, a secret from which
+ *                              a later session with the same peer can be
+ *                              resumed (see the 'Resume Request' message).
+ *                              Pass NULL if no resumption secret is wanted.
+ *
+ * @param[out] resume_out_len   Pointer to the length (in bytes) of the
+ *                              resumption secret result (should be 32
+ *                              bytes). May be NULL with resume_out_bytes.
+ *
+ * The two session keys are session buffers, to be released with
+ * kmyth_session_free() (see kmyth_enclave_common.h). The resumption secret
+ * outlives the session, so it is allocated on the heap.
+ * 
  * @return 0 on success, 1 on error
  */
   int compute_ecdh_session_key(unsigned char * secret_in_bytes,
@@ -164,7 +203,9 @@ extern "C"
                                unsigned char ** key1_out_bytes,
                                size_t * key1_out_len,
                                unsigned char ** key2_out_bytes,
-                               size_t * key2_out_len);
+                               size_t * key2_out_len,
+                               unsigned char ** resume_out_bytes,
+                               size_t * resume_out_len);
 
 /**
  * @brief Generates a signature over the data in an input buffer passed
@@ -182,7 +223,8 @@ extern "C"
  *                             signature computed by this function. A NULL
  *                             pointer must be passed in. This function
  *                             will allocate memory for and then populate
- *                             this buffer.
+ *                             this buffer, a session buffer to be released
+ *                             with kmyth_session_free().
  *
  * @param[out] sig_out_len     Pointer to the length (in bytes) of the
  *                             output signature
@@ -224,6 +266,56 @@ extern "C"
                        unsigned char * sig_in,
                        unsigned int sig_in_len);
 
+/**
+ * @brief Sets up an ECPeerCert for a peer's signing certificate, so that
+ *        sessions with that peer need not extract its identity and public
+ *        key, or set up signature verification, again.
+ *
+ * @param[in]  cert              Pointer to the peer's certificate (the
+ *                               ECPeerCert takes its own reference)
+ *
+ * @param[out] peer              Pointer to the ECPeerCert to set up
+ *
+ * @return 0 on success, 1 on error
+ */
+  int ec_peer_cert_prepare(X509 * cert, ECPeerCert * peer);
+
+/**
+ * @brief Frees the contents of an ECPeerCert (and zeroes it).
+ *
+ * @param[inout] peer            Pointer to the ECPeerCert to clear
+ *
+ * @return none
+ */
+  void ec_peer_cert_clear(ECPeerCert * peer);
+
+/**
+ * @brief Validates a signature over the data in an input buffer, like
+ *        ec_verify_buffer(), using a peer's prepared verification context.
+ *        The ECPeerCert is only read, so it may be shared between threads.
+ *
+ * @param[in]  peer              Pointer to the signer's ECPeerCert
+ *
+ * @param[in]  buf_in            Input buffer (pointer to byte array)
+ *                               containing the data over which
+ *                               the signature was computed.
+ *
+ * @param[in]  buf_in_len        Length (in bytes) of input data buffer
+ *
+ * @param[in]  sig_in            Pointer to byte array that holds the
+ *                               signature to be verified.
+ *
+ * @param[in]  sig_in_len        Length (in bytes) of the signature
+ *
+ * @return 0 on success (signature verification passed),
+ *         1 on error (signature verification failed)
+ */
+  int ec_peer_cert_verify(ECPeerCert * peer,
+                          unsigned char * buf_in,
+                          size_t buf_in_len,
+                          unsigned char * sig_in,
+                          unsigned int sig_in_len);
+
 #ifdef __cplusplus
 }
 #endif
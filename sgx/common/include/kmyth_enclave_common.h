@@ -16,6 +16,31 @@ extern "C"
 // maximum log message size - can use to size buffer
 #define MAX_LOG_MSG_LEN 128
 
+// items packed into one buffer for a batch ECALL each start at a multiple
+// of this many bytes, so that the enclave can use them where they are
+#define KMYTH_SGX_BATCH_ALIGN 8
+#define KMYTH_SGX_BATCH_PADDED(len) \
+  (((len) + KMYTH_SGX_BATCH_ALIGN - 1) & ~((size_t) KMYTH_SGX_BATCH_ALIGN - 1))
+
+// a blob sealed in segments (see enc_seal_data_segmented()) starts with a
+// header of KMYTH_SGX_SEGMENTED_HEADER_LEN bytes:
+//    magic "KSS1" (4) || segment size, big-endian (4) ||
+//    segment count, big-endian (4) || plaintext size, big-endian (8) ||
+//    random blob ID (16)
+// followed by each segment sealed on its own (an sgx_sealed_data_t), with
+// the header and the segment's index (big-endian, 4 bytes) as additional
+// MAC text, so that segments cannot be reordered, dropped, or moved to
+// another blob
+#define KMYTH_SGX_SEGMENTED_MAGIC "KSS1"
+#define KMYTH_SGX_SEGMENTED_MAGIC_LEN 4
+#define KMYTH_SGX_SEGMENTED_HEADER_LEN 36
+#define KMYTH_SGX_SEGMENT_MAC_TEXT_LEN (KMYTH_SGX_SEGMENTED_HEADER_LEN + 4)
+
+// default and largest segment size: the enclave holds one segment, sealed
+// and unsealed, at a time, so this bounds the enclave memory it uses
+#define KMYTH_SGX_SEGMENT_LEN (64 * 1024)
+#define KMYTH_SGX_SEGMENT_MAX_LEN (1024 * 1024)
+
 //if 'syslog.h' is not included, define its 'priority' level macros here
 #ifndef LOG_EMERG
 #define	LOG_EMERG	0
@@ -49,7 +74,24 @@ extern "C"
 #define	LOG_DEBUG	7
 #endif
 
-// macro for generic logging call
+// macro for generic logging call - inside the enclave, messages are
+// buffered and passed out in batches (see kmyth_enclave_log_util.h)
+#ifdef KMYTH_SGX
+
+#include "kmyth_enclave_log_util.h"
+
+#define kmyth_sgx_log(severity, message)\
+{\
+  const char *src_file = __FILE__;\
+  const char *src_func = __func__;\
+  const int src_line = __LINE__;\
+  int log_level = severity;\
+  const char *log_msg = message;\
+  kmyth_enclave_log_event(src_file, src_func, src_line, log_level, log_msg);\
+}
+
+#else
+
 #define kmyth_sgx_log(severity, message)\
 {\
   const char *src_file = __FILE__;\
@@ -60,6 +102,26 @@ extern "C"
   log_event_ocall(src_file, src_func, src_line, log_level, log_msg);\
 }
 
+#endif
+
+// allocation of (zeroed) buffers that live no longer than one 'retrieve
+// key' session - inside the enclave they come from the thread's session
+// arena while a session is open (see kmyth_enclave_memory_util.h)
+#ifdef KMYTH_SGX
+
+#include "kmyth_enclave_memory_util.h"
+#include "memory_util.h"
+
+#define kmyth_session_alloc(size) kmyth_enclave_session_alloc(size)
+#define kmyth_session_free(ptr, size) kmyth_enclave_session_free(ptr, size)
+
+#else
+
+#define kmyth_session_alloc(size) kmyth_calloc(1, size)
+#define kmyth_session_free(ptr, size) kmyth_clear_and_free(ptr, size)
+
+#endif
+
 #include "ec_key_cert_marshal.h"
 #include "ec_key_cert_unmarshal.h"
 #include "ecdh_util.h"
@@ -44,6 +44,28 @@ extern "C"
  */
 #define KMYTH_ECDH_MAX_MSG_SIZE 16384
 
+/**
+ * @brief Maximum size of a session ticket carried in a 'Key Response' or
+ *        'Resume Response' message (and handed back in a 'Resume Request').
+ *        Tickets are opaque to the client: only the server that issued
+ *        one can read it.
+ */
+#define KMYTH_ECDH_MAX_TICKET_SIZE 1024
+
+/**
+ * @brief Size (in bytes) of the random nonce a client puts in each
+ *        'Resume Request' message, so that every resumed session derives
+ *        keys of its own from the resumption secret it starts from
+ */
+#define KMYTH_ECDH_RESUME_NONCE_SIZE 32
+
+/**
+ * @brief Most keys one 'Key Request' (or 'Resume Request') message may
+ *        ask for. More than one are requested with a single KMIP batch
+ *        'get key' request, answered in one 'Key Response' message.
+ */
+#define KMYTH_ECDH_MAX_KEY_REQUEST_COUNT 32
+
 /**
  * @brief Struct encapasulating a "header" for these protocol messages.
  *        The header only contains a two-byte size, but the attempt is
@@ -205,11 +227,11 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 the 'Client Hello' message to be parsed
  *                                 and validated.
  * 
- * @param[in]  client_sign_cert    Pointer to X509 struct containing the
- *                                 ECDH client's signing certificate. The
- *                                 public key contained in this certificate
- *                                 is needed to validate the 'Client Hello'
- *                                 message signature.
+ * @param[in]  client_sign_cert    Pointer to ECPeerCert prepared from the
+ *                                 ECDH client's signing certificate (see
+ *                                 ec_peer_cert_prepare()). The identity and
+ *                                 public key it holds are needed to validate
+ *                                 the 'Client Hello' message and signature.
  * 
  * @param[out] client_eph_pubkey   Pointer to pointer to EVP_PKEY struct that
  *                                 this function places the parsed ephemeral
@@ -220,7 +242,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * @return 0 on success, 1 on error
  */
   int parse_client_hello_msg(ECDHMessage * msg_in,
-                             X509 * client_sign_cert,
+                             ECPeerCert * client_sign_cert,
                              EVP_PKEY ** client_eph_pubkey);
 
 /**
@@ -289,6 +311,43 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
                                EVP_PKEY * server_eph_keypair,
                                ECDHMessage * msg_out);
 
+/**
+ * @brief Prepares the part of a 'Server Hello' message that is the same in
+ *        every session (the server identity, DER formatted, after its
+ *        length), so that a server can compose each 'Server Hello' with
+ *        compose_server_hello_msg_from_template() rather than extracting
+ *        and encoding its identity again.
+ *
+ * @param[in]  server_sign_cert    Pointer to the server-side peer's signing
+ *                                 certificate (see compose_server_hello_msg())
+ *
+ * @param[out] hello_template      Pointer to a ByteBuffer that receives the
+ *                                 template (the caller frees its buffer)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int prepare_server_hello_template(X509 * server_sign_cert,
+                                    ByteBuffer * hello_template);
+
+/**
+ * @brief Same as compose_server_hello_msg(), but takes the server identity
+ *        part of the message from a template made by
+ *        prepare_server_hello_template(), so that only the ephemeral public
+ *        keys and the signature are produced per session.
+ *
+ * @param[in]  hello_template      Pointer to the ByteBuffer holding the
+ *                                 template
+ *
+ * All other parameters are as described for compose_server_hello_msg().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int compose_server_hello_msg_from_template(EVP_PKEY * server_sign_key,
+                                             ByteBuffer * hello_template,
+                                             EVP_PKEY * client_eph_pubkey,
+                                             EVP_PKEY * server_eph_keypair,
+                                             ECDHMessage * msg_out);
+
 
 /**
  * @brief Validates and then parses the 'Server Hello' message, the
@@ -318,11 +377,12 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 the 'Server Hello' message to be parsed
  *                                 and validated.
  * 
- * @param[in]  server_sign_cert    Pointer to X509 struct containing the
+ * @param[in]  server_sign_cert    Pointer to ECPeerCert prepared from the
  *                                 ECDH server-side peer's signing
- *                                 certificate. The public key contained in
- *                                 this certificate is needed to validate the
- *                                 'Server Hello' message signature.
+ *                                 certificate (see ec_peer_cert_prepare()).
+ *                                 The identity and public key it holds are
+ *                                 needed to validate the 'Server Hello'
+ *                                 message and signature.
  * 
  * @param[in]  client_eph_keypair  Pointer to EVP_PKEY struct containing the
  *                                 ephemeral elliptic curve key pair generated
@@ -343,7 +403,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * @return 0 on success, 1 on error
  */
   int parse_server_hello_msg(ECDHMessage * msg_in,
-                             X509 * server_sign_cert,
+                             ECPeerCert * server_sign_cert,
                              EVP_PKEY * client_eph_keypair,
                              EVP_PKEY ** server_eph_pubkey);
 
@@ -382,14 +442,18 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 use to encrypt its 'Key Request' message
  *                                 result.
  * 
- * @param[in]  req_key_id          Pointer to ByteBuffer struct containing
- *                                 the KMIP key identifier for the key being
- *                                 requested from the server-side peer in
- *                                 the 'Key Request' message composed by
- *                                 this function. It is used to produce a
- *                                 KMIP 'get key' request that is
- *                                 incorporated into the 'Key Request'
- *                                 message result.
+ * @param[in]  req_key_ids         Array of ByteBuffer structs containing
+ *                                 the KMIP key identifiers for the keys
+ *                                 being requested from the server-side peer
+ *                                 in the 'Key Request' message composed by
+ *                                 this function. They are used to produce a
+ *                                 KMIP 'get key' request (a batch request,
+ *                                 with one 'get' per key, when there is more
+ *                                 than one) that is incorporated into the
+ *                                 'Key Request' message result.
+ *
+ * @param[in]  req_key_id_count    Number of key identifiers in req_key_ids
+ *                                 (1 to KMYTH_ECDH_MAX_KEY_REQUEST_COUNT)
  * 
  * @param[in]  server_eph_pubkey   Pointer to public key from the server-side
  *                                 peer's public epehemeral contribution
@@ -405,7 +469,8 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  */
   int compose_key_request_msg(EVP_PKEY * client_sign_key,
                               ByteBuffer * msg_enc_key,
-                              ByteBuffer * req_key_id,
+                              ByteBuffer * req_key_ids,
+                              size_t req_key_id_count,
                               EVP_PKEY * server_eph_pubkey,
                               ECDHMessage * msg_out);
 
@@ -424,8 +489,9 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *        The elliptic curve signature (over the body of the message) is first
  *        verified (using the public key provided as an input parameter)
  * 
- * @param[in]  client_sign_cert    Pointer to X509 formatted public cert
- *                                 (paired with the ECDH client signing key)
+ * @param[in]  client_sign_cert    Pointer to ECPeerCert prepared from the
+ *                                 public cert paired with the ECDH client
+ *                                 signing key (see ec_peer_cert_prepare()),
  *                                 to be used in validating the signature
  *                                 computed over the received 'Key Request'
  *                                 message
@@ -464,7 +530,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *
  * @return 0 on success, 1 on error
  */
-  int parse_key_request_msg(X509 * client_sign_cert,
+  int parse_key_request_msg(ECPeerCert * client_sign_cert,
                            ByteBuffer * msg_dec_key,
                            ECDHMessage * msg_in,
                            EVP_PKEY * server_eph_pubkey,
@@ -478,9 +544,11 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *        following fields concatenated in the below order:
  *          - length (in bytes) of the KMIP 'get key' response
  *          - KMIP key 'get key' response bytes
+ *          - length (in bytes) of the session ticket (zero if none)
+ *          - session ticket bytes
  * 
- *        The unsigned integer "length" value have is specified as a
- *        two-byte value (uint16_t) in big-endian (network) byte order.
+ *        The unsigned integer "length" values are specified as
+ *        two-byte values (uint16_t) in big-endian (network) byte order.
  *        This is done to format this parameter in a well-defined,
  *        machine-indepenedent way that can be deterministically parsed
  *        by the message recipient.
@@ -507,6 +575,12 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 message and returned to the ECDH client
  *                                 that initiated the retrieve key protocol.
  * 
+ * @param[in]  ticket              Pointer to ByteBuffer struct containing a
+ *                                 session ticket with which the client can
+ *                                 resume this session later (see
+ *                                 compose_resume_request_msg()), or NULL
+ *                                 (or empty) if none is issued.
+ * 
  * @param[out] msg_out             Pointer to an ECDHMessage struct that the
  *                                 'Key Response' message result of this
  *                                 function can be placed into and 'returned'
@@ -517,6 +591,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
   int compose_key_response_msg(EVP_PKEY * server_sign_key,
                                ByteBuffer * msg_enc_key,
                                ByteBuffer * kmip_response,
+                               ByteBuffer * ticket,
                                ECDHMessage * msg_out);
 
 /**
@@ -526,17 +601,20 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *        following fields concatenated in the below order:
  *          - KMIP 'get key' key response size (two-byte, big-endian unsigned integer)
  *          - KMIP 'get key' response (byte array)
+ *          - session ticket size (two-byte, big-endian unsigned integer)
+ *          - session ticket (byte array, possibly empty)
  *          - message signature size (two-byte, big-endian unsigned integer)
  *          - message signature (byte array)
  * 
  *        The elliptic curve signature (over the body of the message) is first
  *        verified (using the public key provided as an input parameter)
  * 
- * @param[in]  server_sign_cert    Pointer to X509 formatted public
- *                                 certificate paired to the server-side
- *                                 signing key, to be used in validating
- *                                 the signature computed over the
- *                                 'Key Response' message being parsed
+ * @param[in]  server_sign_cert    Pointer to ECPeerCert prepared from the
+ *                                 public certificate paired to the
+ *                                 server-side signing key (see
+ *                                 ec_peer_cert_prepare()), to be used in
+ *                                 validating the signature computed over
+ *                                 the 'Key Response' message being parsed
  * 
  * @param[in]  msg_dec_key         Pointer to ByteBuffer struct containing
  *                                 a 32-byte, 256-bit symmetric message
@@ -560,14 +638,218 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 result that the retrieve key protocol's
  *                                 objective is to get from a remote server.
  *
- * @param[out] kmip_response
+ * @param[out] ticket              Pointer to ByteBuffer struct where this
+ *                                 function places the session ticket the
+ *                                 server issued (empty if none), or NULL to
+ *                                 discard it.
  *
  * @return 0 on success, 1 on error
  */
-  int parse_key_response_msg(X509 * server_sign_cert,
+  int parse_key_response_msg(ECPeerCert * server_sign_cert,
                              ByteBuffer * msg_dec_key,
                              ECDHMessage * msg_in,
-                             ByteBuffer * kmip_response);
+                             ByteBuffer * kmip_response,
+                             ByteBuffer * ticket);
+
+/**
+ * @brief Checks whether a message a server-side peer receives to start a
+ *        session is a 'Resume Request' rather than a 'Client Hello'.
+ *        (A 'Resume Request' starts with a zero where a 'Client Hello'
+ *        has the length of the client identity.)
+ *
+ * @param[in]  msg_in              Pointer to ECDHMessage struct containing
+ *                                 the received message
+ *
+ * @return true for a 'Resume Request', false otherwise
+ */
+  bool is_resume_request_msg(ECDHMessage * msg_in);
+
+/**
+ * @brief Derives the keys for a resumed session, on either side: the
+ *        session key derivation of compute_ecdh_session_key(), keyed with
+ *        the resumption secret of the session being resumed and bound to
+ *        the ticket and the client's nonce. Besides the 'Resume Request'
+ *        and 'Resume Response' keys, it yields the resumption secret that
+ *        the next ticket carries, so no two sessions share keys.
+ *
+ * @param[in]  resume_secret       Pointer to ByteBuffer struct containing
+ *                                 the resumption secret of the session
+ *                                 being resumed
+ *
+ * @param[in]  ticket              Pointer to ByteBuffer struct containing
+ *                                 the session ticket being presented
+ *
+ * @param[in]  nonce               Pointer to ByteBuffer struct containing
+ *                                 the client's nonce for this session
+ *
+ * @param[out] request_key         Pointer to ByteBuffer struct for the
+ *                                 'Resume Request' encryption key
+ *
+ * @param[out] response_key        Pointer to ByteBuffer struct for the
+ *                                 'Resume Response' encryption key
+ *
+ * @param[out] next_resume_secret  Pointer to ByteBuffer struct for the
+ *                                 resumption secret of this session
+ *
+ * @return 0 on success, 1 on error
+ */
+  int derive_resumed_session_keys(ByteBuffer * resume_secret,
+                                  ByteBuffer * ticket,
+                                  ByteBuffer * nonce,
+                                  ByteBuffer * request_key,
+                                  ByteBuffer * response_key,
+                                  ByteBuffer * next_resume_secret);
+
+/**
+ * @brief Assembles the 'Resume Request' message, with which a client that
+ *        holds a session ticket asks for a key without a new ECDH key
+ *        agreement or any signatures: a single round trip in place of the
+ *        four messages of a full session.
+ *
+ *        The body of the 'Resume Request' message contains the
+ *        following fields concatenated in the below order:
+ *          - zero (two-byte unsigned integer, see is_resume_request_msg())
+ *          - length (in bytes) of the session ticket
+ *          - session ticket bytes
+ *          - length (in bytes) of the nonce
+ *          - nonce bytes
+ *          - KMIP 'get key' request (with its two-byte length), encrypted
+ *            using the request key from derive_resumed_session_keys()
+ *
+ *        The client is authenticated by its knowledge of the resumption
+ *        secret, which only the two peers of the full session it came
+ *        from could derive.
+ *
+ * @param[in]  ticket              Pointer to ByteBuffer struct containing
+ *                                 the session ticket being presented
+ *
+ * @param[in]  nonce               Pointer to ByteBuffer struct containing
+ *                                 KMYTH_ECDH_RESUME_NONCE_SIZE fresh random
+ *                                 bytes
+ *
+ * @param[in]  msg_enc_key         Pointer to ByteBuffer struct containing
+ *                                 the request key derived from the ticket's
+ *                                 resumption secret, ticket and nonce
+ *
+ * @param[in]  req_key_ids         Array of ByteBuffer structs containing
+ *                                 the KMIP key identifiers for the keys
+ *                                 being requested (as for
+ *                                 compose_key_request_msg())
+ *
+ * @param[in]  req_key_id_count    Number of key identifiers in req_key_ids
+ *                                 (1 to KMYTH_ECDH_MAX_KEY_REQUEST_COUNT)
+ *
+ * @param[out] msg_out             Pointer to an ECDHMessage struct that the
+ *                                 'Resume Request' message result of this
+ *                                 function can be placed into
+ *
+ * @return 0 on success, 1 on error
+ */
+  int compose_resume_request_msg(ByteBuffer * ticket,
+                                 ByteBuffer * nonce,
+                                 ByteBuffer * msg_enc_key,
+                                 ByteBuffer * req_key_ids,
+                                 size_t req_key_id_count,
+                                 ECDHMessage * msg_out);
+
+/**
+ * @brief Parses the session ticket and nonce out of a 'Resume Request'
+ *        message, which the server-side peer needs to derive the session
+ *        keys before it can decrypt the rest of the message (see
+ *        decrypt_resume_request_msg()).
+ *
+ * @param[in]  msg_in              Pointer to ECDHMessage struct containing
+ *                                 the 'Resume Request' message
+ *
+ * @param[out] ticket              Pointer to ByteBuffer struct where this
+ *                                 function places a copy of the ticket
+ *
+ * @param[out] nonce               Pointer to ByteBuffer struct where this
+ *                                 function places a copy of the nonce
+ *
+ * @return 0 on success, 1 on error
+ */
+  int parse_resume_request_msg(ECDHMessage * msg_in,
+                               ByteBuffer * ticket,
+                               ByteBuffer * nonce);
+
+/**
+ * @brief Decrypts the KMIP 'get key' request carried in a 'Resume Request'
+ *        message. Successful decryption (AES-GCM) shows that the sender
+ *        holds the ticket's resumption secret.
+ *
+ * @param[in]  msg_dec_key         Pointer to ByteBuffer struct containing
+ *                                 the request key derived from the ticket's
+ *                                 resumption secret, ticket and nonce
+ *
+ * @param[in]  msg_in              Pointer to ECDHMessage struct containing
+ *                                 the 'Resume Request' message
+ *
+ * @param[out] kmip_request        Pointer to ByteBuffer struct where this
+ *                                 function places the KMIP 'get key' request
+ *
+ * @return 0 on success, 1 on error
+ */
+  int decrypt_resume_request_msg(ByteBuffer * msg_dec_key,
+                                 ECDHMessage * msg_in,
+                                 ByteBuffer * kmip_request);
+
+/**
+ * @brief Assembles the 'Resume Response' message, the server-side peer's
+ *        answer to a 'Resume Request'.
+ *
+ *        The 'Resume Response' message contains the following fields
+ *        concatenated in the below order, encrypted using the response key
+ *        from derive_resumed_session_keys():
+ *          - length (in bytes) of the KMIP 'get key' response
+ *          - KMIP 'get key' response bytes
+ *          - length (in bytes) of the next session ticket (zero if none)
+ *          - next session ticket bytes
+ *
+ * @param[in]  msg_enc_key         Pointer to ByteBuffer struct containing
+ *                                 the response key for the resumed session
+ *
+ * @param[in]  kmip_response       Pointer to ByteBuffer struct containing
+ *                                 the KMIP 'get key' response
+ *
+ * @param[in]  ticket              Pointer to ByteBuffer struct containing
+ *                                 the ticket for resuming this session, or
+ *                                 NULL (or empty) if none is issued
+ *
+ * @param[out] msg_out             Pointer to an ECDHMessage struct that the
+ *                                 'Resume Response' message result of this
+ *                                 function can be placed into
+ *
+ * @return 0 on success, 1 on error
+ */
+  int compose_resume_response_msg(ByteBuffer * msg_enc_key,
+                                  ByteBuffer * kmip_response,
+                                  ByteBuffer * ticket,
+                                  ECDHMessage * msg_out);
+
+/**
+ * @brief Decrypts and parses a 'Resume Response' message.
+ *
+ * @param[in]  msg_dec_key         Pointer to ByteBuffer struct containing
+ *                                 the response key for the resumed session
+ *
+ * @param[in]  msg_in              Pointer to ECDHMessage struct containing
+ *                                 the 'Resume Response' message
+ *
+ * @param[out] kmip_response       Pointer to ByteBuffer struct where this
+ *                                 function places the KMIP 'get key'
+ *                                 response
+ *
+ * @param[out] ticket              Pointer to ByteBuffer struct where this
+ *                                 function places the next session ticket
+ *                                 (empty if none), or NULL to discard it
+ *
+ * @return 0 on success, 1 on error
+ */
+  int parse_resume_response_msg(ByteBuffer * msg_dec_key,
+                                ECDHMessage * msg_in,
+                                ByteBuffer * kmip_response,
+                                ByteBuffer * ticket);
 
 #ifdef __cplusplus
 }
@@ -27,21 +27,15 @@ int marshal_ec_pkey_to_der(EVP_PKEY *ec_pkey_in,
 
   // Validate that a pointer to a NULL buffer pointer was passed in for
   // the binary output byte array.
-  // This will support memory allocation by the call to i2d_PrivateKey()
-  // for PKEY to DER format conversion rather than having to do the
-  // required size calculation and memory allocation beforehand.
   if (*ec_der_bytes_out != NULL)
   {
     kmyth_sgx_log(LOG_ERR, "initially non-NULL pointer to DER result buffer");
     return EXIT_FAILURE;
   }
 
-  // A copy of the pointer is needed because i2d_PrivateKey() will
-  // modify the one it is passed as a parameter.
-  unsigned char **buf_ptr = ec_der_bytes_out;
-
-  // format conversion to DER (binary) formatted output
-  int out_len = i2d_PrivateKey(ec_pkey_in, ec_der_bytes_out);
+  // Size the DER output first, so that the result buffer comes from
+  // kmyth_malloc() rather than from OpenSSL; the helpers below do the same.
+  int out_len = i2d_PrivateKey(ec_pkey_in, NULL);
 
   if (out_len <= 0)
   {
@@ -49,8 +43,24 @@ int marshal_ec_pkey_to_der(EVP_PKEY *ec_pkey_in,
     return EXIT_FAILURE;
   }
 
-  // assign ASN1 DER formatted result output parameter pointer variables
-  ec_der_bytes_out = buf_ptr;
+  *ec_der_bytes_out = kmyth_malloc((size_t) out_len);
+  if (*ec_der_bytes_out == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating DER result buffer");
+    return EXIT_FAILURE;
+  }
+
+  // i2d_PrivateKey() advances the pointer it is passed, so hand it a copy
+  unsigned char *der_ptr = *ec_der_bytes_out;
+
+  if (i2d_PrivateKey(ec_pkey_in, &der_ptr) != out_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "PKEY to DER format conversion error");
+    kmyth_free(*ec_der_bytes_out);
+    *ec_der_bytes_out = NULL;
+    return EXIT_FAILURE;
+  }
+
   *ec_der_bytes_out_len = out_len;
 
   return EXIT_SUCCESS;
@@ -65,21 +75,13 @@ int marshal_ec_x509_to_der(X509 *ec_cert_in,
 {
   // Validate that a pointer to a NULL buffer pointer was passed in for
   // the binary output byte array. Put it in that state if necessary.
-  // This will support memory allocation by the call to i2d_X509()
-  // for X509 to DER format conversion rather than having to do the
-  // required size calculation and memory allocation beforehand.
   if (*ec_der_bytes_out != NULL)
   {
     kmyth_sgx_log(LOG_ERR, "initially non-NULL pointer to DER result buffer");
     return EXIT_FAILURE;
   }
 
-  // A copy of the pointer is needed because i2d_X509 will
-  // modify the one it is passed as a parameter.
-  unsigned char **buf_ptr = ec_der_bytes_out;
-
-  // format conversion to DER (binary) formatted output
-  int out_len = i2d_X509(ec_cert_in, ec_der_bytes_out);
+  int out_len = i2d_X509(ec_cert_in, NULL);
 
   if (out_len <= 0)
   {
@@ -87,8 +89,24 @@ int marshal_ec_x509_to_der(X509 *ec_cert_in,
     return EXIT_FAILURE;
   }
 
-  // assign ASN1 DER formatted result output parameter pointer variables
-  ec_der_bytes_out = buf_ptr;
+  *ec_der_bytes_out = kmyth_malloc((size_t) out_len);
+  if (*ec_der_bytes_out == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating DER result buffer");
+    return EXIT_FAILURE;
+  }
+
+  // i2d_X509() advances the pointer it is passed, so hand it a copy
+  unsigned char *der_ptr = *ec_der_bytes_out;
+
+  if (i2d_X509(ec_cert_in, &der_ptr) != out_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "X509 to DER format conversion error");
+    kmyth_free(*ec_der_bytes_out);
+    *ec_der_bytes_out = NULL;
+    return EXIT_FAILURE;
+  }
+
   *ec_der_bytes_out_len = out_len;
 
   return EXIT_SUCCESS;
@@ -102,21 +120,13 @@ int marshal_x509_name_to_der(X509_NAME *cert_dn_in,
 {
   // Validate that a pointer to a NULL buffer pointer was passed in for
   // the binary output byte array. Put it in that state if necessary.
-  // This will support memory allocation by the call to i2d_X509()
-  // for X509 to DER format conversion rather than having to do the
-  // required size calculation and memory allocation beforehand.
   if (*cert_dn_bytes_out != NULL)
   {
     kmyth_sgx_log(LOG_ERR, "initially non-NULL pointer to DER result buffer");
     return EXIT_FAILURE;
   }
 
-  // A copy of the pointer is needed because i2d_X509_NANE will
-  // modify the one it is passed as a parameter.
-  unsigned char **buf_ptr = cert_dn_bytes_out;
-
-  // format conversion to DER (binary) formatted output
-  int out_len = i2d_X509_NAME(cert_dn_in, cert_dn_bytes_out);
+  int out_len = i2d_X509_NAME(cert_dn_in, NULL);
 
   if (out_len <= 0)
   {
@@ -124,8 +134,24 @@ int marshal_x509_name_to_der(X509_NAME *cert_dn_in,
     return EXIT_FAILURE;
   }
 
-  // assign ASN1 DER formatted result output parameter pointer variables
-  cert_dn_bytes_out = buf_ptr;
+  *cert_dn_bytes_out = kmyth_malloc((size_t) out_len);
+  if (*cert_dn_bytes_out == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating DER result buffer");
+    return EXIT_FAILURE;
+  }
+
+  // i2d_X509_NAME() advances the pointer it is passed, so hand it a copy
+  unsigned char *der_ptr = *cert_dn_bytes_out;
+
+  if (i2d_X509_NAME(cert_dn_in, &der_ptr) != out_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "X509_NAME to DER format conversion error");
+    kmyth_free(*cert_dn_bytes_out);
+    *cert_dn_bytes_out = NULL;
+    return EXIT_FAILURE;
+  }
+
   *cert_dn_bytes_out_len = out_len;
 
   return EXIT_SUCCESS;
@@ -136,7 +136,7 @@ int compute_ecdh_shared_secret(EVP_PKEY *local_eph_keypair,
   }
 
   // allocate buffer to hold shared secret
-  *shared_secret = calloc(*shared_secret_len, sizeof(unsigned char));
+  *shared_secret = kmyth_session_alloc(*shared_secret_len);
   if (*shared_secret == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating buffer for shared secret");
@@ -149,7 +149,8 @@ int compute_ecdh_shared_secret(EVP_PKEY *local_eph_keypair,
   if (retval != 1)
   {
     kmyth_sgx_log(LOG_ERR, "error deriving shared secret value");
-    kmyth_clear_and_free(*shared_secret, *shared_secret_len);
+    kmyth_session_free(*shared_secret, *shared_secret_len);
+    *shared_secret = NULL;
     *shared_secret_len = 0;
     EVP_PKEY_CTX_free(ctx);
     return EXIT_FAILURE;
@@ -172,7 +173,9 @@ int compute_ecdh_session_key(unsigned char * secret_in_bytes,
                              unsigned char ** key1_out_bytes,
                              size_t * key1_out_len,
                              unsigned char ** key2_out_bytes,
-                             size_t * key2_out_len)
+                             size_t * key2_out_len,
+                             unsigned char ** resume_out_bytes,
+                             size_t * resume_out_len)
 {
   if(secret_in_len > INT_MAX)
   {
@@ -231,17 +234,23 @@ int compute_ecdh_session_key(unsigned char * secret_in_bytes,
     EVP_PKEY_CTX_free(pctx);
     return EXIT_FAILURE;
   }
-  unsigned char *addl_info = calloc(addl_info_len, sizeof(unsigned char));
+  unsigned char *addl_info = kmyth_session_alloc(addl_info_len);
+  if (addl_info == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to allocate HKDF additional info buffer");
+    EVP_PKEY_CTX_free(pctx);
+    return EXIT_FAILURE;
+  }
   memcpy(addl_info, msg1_in_bytes, msg1_in_len);
   memcpy(addl_info+msg1_in_len, msg2_in_bytes, msg2_in_len);
   if (EVP_PKEY_CTX_add1_hkdf_info(pctx, addl_info, (int)addl_info_len) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "failed to set HKDF additional information input");
-    free(addl_info);
+    kmyth_session_free(addl_info, addl_info_len);
     EVP_PKEY_CTX_free(pctx);
     return EXIT_FAILURE;
   }
-  free(addl_info);
+  kmyth_session_free(addl_info, addl_info_len);
 
   // derive key bits
   unsigned char kdf_out[KMYTH_ECDH_KDF_OUTPUT_SIZE];
@@ -264,33 +273,57 @@ int compute_ecdh_session_key(unsigned char * secret_in_bytes,
 
   EVP_PKEY_CTX_free(pctx);
 
-  // assign first half of key bytes generated to first output session key
+  // assign first part of key bytes generated to first output session key
   *key1_out_len = KMYTH_ECDH_SESSION_KEY_SIZE;
-  if ((2 * (*key1_out_len)) > kdf_out_len)
+  if ((2 * (*key1_out_len)) + KMYTH_ECDH_RESUME_SECRET_SIZE > kdf_out_len)
   {
     kmyth_sgx_log(LOG_ERR, "KDF configuration error");
+    kmyth_clear(kdf_out, sizeof(kdf_out));
     return EXIT_FAILURE;
   }
 
-  *key1_out_bytes = calloc(*key1_out_len, sizeof(unsigned char));
+  *key1_out_bytes = kmyth_session_alloc(*key1_out_len);
   if (NULL == *key1_out_bytes)
   {
     kmyth_sgx_log(LOG_ERR, "failed to allocate buffer for session key #1");
+    kmyth_clear(kdf_out, sizeof(kdf_out));
     return EXIT_FAILURE;
   }
   memcpy(*key1_out_bytes, kdf_out, *key1_out_len);
 
-  // assign second half of key bytes generated to second output session key
+  // assign second part of key bytes generated to second output session key
   *key2_out_len = *key1_out_len;
-  *key2_out_bytes = calloc(*key2_out_len, sizeof(unsigned char));
+  *key2_out_bytes = kmyth_session_alloc(*key2_out_len);
   if (NULL == *key2_out_bytes)
   {
     kmyth_sgx_log(LOG_ERR, "failed to allocate buffer for session key #2");
-    free(*key1_out_bytes);
+    kmyth_session_free(*key1_out_bytes, *key1_out_len);
+    *key1_out_bytes = NULL;
+    kmyth_clear(kdf_out, sizeof(kdf_out));
     return EXIT_FAILURE;
   }
   memcpy(*key2_out_bytes, kdf_out+*key1_out_len, *key2_out_len);
 
+  // assign the rest to the session resumption secret, if one is wanted
+  if (resume_out_bytes != NULL)
+  {
+    *resume_out_len = KMYTH_ECDH_RESUME_SECRET_SIZE;
+    *resume_out_bytes = kmyth_calloc(*resume_out_len, sizeof(unsigned char));
+    if (NULL == *resume_out_bytes)
+    {
+      kmyth_sgx_log(LOG_ERR, "failed to allocate buffer for resume secret");
+      kmyth_session_free(*key2_out_bytes, *key2_out_len);
+      kmyth_session_free(*key1_out_bytes, *key1_out_len);
+      *key1_out_bytes = NULL;
+      *key2_out_bytes = NULL;
+      kmyth_clear(kdf_out, sizeof(kdf_out));
+      return EXIT_FAILURE;
+    }
+    memcpy(*resume_out_bytes, kdf_out + 2 * KMYTH_ECDH_SESSION_KEY_SIZE,
+           *resume_out_len);
+  }
+  kmyth_clear(kdf_out, sizeof(kdf_out));
+
   return EXIT_SUCCESS;
 }
 
@@ -335,7 +368,7 @@ int ec_sign_buffer(EVP_PKEY * ec_sign_pkey,
     EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
-  *sig_out = calloc((size_t)max_sig_len, sizeof(unsigned char));
+  *sig_out = kmyth_session_alloc((size_t) max_sig_len);
   if (*sig_out == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "malloc of signature buffer failed");
@@ -348,7 +381,8 @@ int ec_sign_buffer(EVP_PKEY * ec_sign_pkey,
                     (unsigned int *) sig_out_len, ec_sign_pkey) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "signature creation failed");
-    free(*sig_out);
+    kmyth_session_free(*sig_out, (size_t) max_sig_len);
+    *sig_out = NULL;
     EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
@@ -408,3 +442,113 @@ int ec_verify_buffer(EVP_PKEY * ec_verify_pkey,
 
   return EXIT_SUCCESS;
 }
+
+/*****************************************************************************
+ * ec_peer_cert_prepare()
+ ****************************************************************************/
+int ec_peer_cert_prepare(X509 * cert, ECPeerCert * peer)
+{
+  memset(peer, 0, sizeof(ECPeerCert));
+
+  unsigned int digest_len = 0;
+
+  if (X509_digest(cert, EVP_sha256(), peer->digest, &digest_len) != 1 ||
+      digest_len != SHA256_DIGEST_LENGTH)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to compute peer certificate digest");
+    return EXIT_FAILURE;
+  }
+
+  if (X509_up_ref(cert) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to reference peer certificate");
+    return EXIT_FAILURE;
+  }
+  peer->cert = cert;
+
+  // the subject name is an internal pointer: keep a copy of our own
+  X509_NAME *subj_name = X509_get_subject_name(cert);
+
+  if (subj_name == NULL ||
+      (peer->identity = X509_NAME_dup(subj_name)) == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "extraction of certificate's subject name failed");
+    ec_peer_cert_clear(peer);
+    return EXIT_FAILURE;
+  }
+
+  peer->pubkey = X509_get_pubkey(cert);
+  if (peer->pubkey == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
+    ec_peer_cert_clear(peer);
+    return EXIT_FAILURE;
+  }
+
+  // 'initialize' (e.g., load public key) once - each verification then
+  // starts from a copy of this context
+  peer->verify_ctx = EVP_MD_CTX_new();
+  if (peer->verify_ctx == NULL ||
+      EVP_DigestVerifyInit(peer->verify_ctx, NULL, KMYTH_ECDH_MD, NULL,
+                           peer->pubkey) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "initialization of message digest context failed");
+    ec_peer_cert_clear(peer);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * ec_peer_cert_clear()
+ ****************************************************************************/
+void ec_peer_cert_clear(ECPeerCert * peer)
+{
+  EVP_MD_CTX_free(peer->verify_ctx);
+  EVP_PKEY_free(peer->pubkey);
+  X509_NAME_free(peer->identity);
+  X509_free(peer->cert);
+
+  memset(peer, 0, sizeof(ECPeerCert));
+}
+
+/*****************************************************************************
+ * ec_peer_cert_verify()
+ ****************************************************************************/
+int ec_peer_cert_verify(ECPeerCert * peer,
+                        unsigned char *buf_in, size_t buf_in_len,
+                        unsigned char *sig_in, unsigned int sig_in_len)
+{
+  // work on a copy, leaving the prepared context as it is
+  EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+
+  if (mdctx == NULL || EVP_MD_CTX_copy_ex(mdctx, peer->verify_ctx) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "creation of message digest context failed");
+    EVP_MD_CTX_free(mdctx);
+    return EXIT_FAILURE;
+  }
+
+  // 'update' with signed data
+  if (EVP_DigestVerifyUpdate(mdctx, buf_in, buf_in_len) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR,
+                  "message digest context update with signed data failed");
+    EVP_MD_CTX_free(mdctx);
+    return EXIT_FAILURE;
+  }
+
+  // check signature
+  if (EVP_DigestVerifyFinal(mdctx, sig_in, sig_in_len) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "signature verification failed");
+    EVP_MD_CTX_free(mdctx);
+    return EXIT_FAILURE;
+  }
+
+  // done - clean-up context
+  EVP_MD_CTX_free(mdctx);
+
+  return EXIT_SUCCESS;
+}
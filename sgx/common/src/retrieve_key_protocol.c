@@ -8,6 +8,128 @@
 
 #include "retrieve_key_protocol.h"
 
+/*****************************************************************************
+ * get_msg_field()
+ ****************************************************************************/
+static int get_msg_field(ECDHMessage * msg, size_t * index, ByteBuffer * field)
+{
+  // a two-byte (big-endian) length, then that many bytes, which are copied
+  // out (an empty field gives a NULL buffer)
+  field->size = 0;
+  field->buffer = NULL;
+
+  if (*index + 2 > msg->hdr.msg_size)
+  {
+    return EXIT_FAILURE;
+  }
+  size_t len = (size_t) ((msg->body[*index] << 8) + msg->body[*index + 1]);
+
+  if (*index + 2 + len > msg->hdr.msg_size)
+  {
+    return EXIT_FAILURE;
+  }
+  *index += 2;
+
+  if (len > 0)
+  {
+    field->buffer = kmyth_malloc(len);
+    if (field->buffer == NULL)
+    {
+      return EXIT_FAILURE;
+    }
+    memcpy(field->buffer, msg->body + *index, len);
+    field->size = len;
+    *index += len;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * put_msg_field()
+ ****************************************************************************/
+static unsigned char *put_msg_field(unsigned char *buf_ptr,
+                                    unsigned char *bytes, size_t len)
+{
+  // (the caller has checked that len fits in two bytes)
+  uint16_t temp_val = htobe16((uint16_t) len);
+
+  memcpy(buf_ptr, &temp_val, 2);
+  buf_ptr += 2;
+  if (len > 0)
+  {
+    memcpy(buf_ptr, bytes, len);
+    buf_ptr += len;
+  }
+
+  return buf_ptr;
+}
+
+/*****************************************************************************
+ * build_key_request_kmip()
+ ****************************************************************************/
+static int build_key_request_kmip(ByteBuffer * req_key_ids,
+                                  size_t req_key_id_count,
+                                  unsigned char **request,
+                                  size_t *request_len)
+{
+  if (req_key_ids == NULL || req_key_id_count == 0 ||
+      req_key_id_count > KMYTH_ECDH_MAX_KEY_REQUEST_COUNT)
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid number of requested key IDs");
+    return EXIT_FAILURE;
+  }
+
+  KMIP kmip_context = { 0 };
+  kmip_init(&kmip_context, NULL, 0, KMIP_2_0);
+
+  int ret = EXIT_FAILURE;
+
+  if (req_key_id_count == 1)
+  {
+    // a single key is requested with a plain KMIP 'get key' request, so
+    // that servers without batch support still answer it
+    ret = build_kmip_get_request(&kmip_context,
+                                 req_key_ids[0].buffer,
+                                 req_key_ids[0].size,
+                                 request, request_len);
+  }
+  else
+  {
+    unsigned char *ids[KMYTH_ECDH_MAX_KEY_REQUEST_COUNT] = { NULL };
+    size_t id_lens[KMYTH_ECDH_MAX_KEY_REQUEST_COUNT] = { 0 };
+
+    for (size_t i = 0; i < req_key_id_count; i++)
+    {
+      ids[i] = req_key_ids[i].buffer;
+      id_lens[i] = req_key_ids[i].size;
+    }
+    ret = build_kmip_batch_get_request(&kmip_context,
+                                       ids, id_lens, req_key_id_count,
+                                       request, request_len);
+  }
+  kmip_destroy(&kmip_context);
+
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to build the 'KMIP Get' request");
+    kmyth_free(*request);
+    *request = NULL;
+    return EXIT_FAILURE;
+  }
+
+  // the request must fit the two-byte length field it is sent with
+  if (*request_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "KMIP 'get key' request too long");
+    kmyth_free(*request);
+    *request = NULL;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
 /*****************************************************************************
  * extract_identity_bytes_from_x509()
  ****************************************************************************/
@@ -62,16 +184,16 @@ int append_msg_signature(EVP_PKEY * sign_key,
   {
     kmyth_sgx_log(LOG_ERR, "new buffer length exceeds UINT16_MAX");
     msg->hdr.msg_size = 0;
-    free(signature_bytes);
+    kmyth_session_free(signature_bytes, signature_len);
     return EXIT_FAILURE;
   }
   
-  msg->body = realloc(msg->body, new_buf_len);
+  msg->body = kmyth_realloc(msg->body, new_buf_len);
   if (msg->body == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "realloc error for resized input buffer");
     msg->hdr.msg_size = 0;
-    free(signature_bytes);
+    kmyth_session_free(signature_bytes, signature_len);
     return EXIT_FAILURE;
   }
   
@@ -85,7 +207,7 @@ int append_msg_signature(EVP_PKEY * sign_key,
 
   // finally, append signature bytes
   memcpy(buf_ptr, signature_bytes, signature_len);
-  free(signature_bytes);
+  kmyth_session_free(signature_bytes, signature_len);
 
   return EXIT_SUCCESS;
 }
@@ -125,7 +247,7 @@ int compose_client_hello_msg(EVP_PKEY * client_sign_key,
     X509_NAME_free(client_id);
     if (client_id_bytes != NULL)
     {
-      free(client_id_bytes);
+      kmyth_free(client_id_bytes);
     }
     return EXIT_FAILURE;
   }
@@ -139,7 +261,7 @@ int compose_client_hello_msg(EVP_PKEY * client_sign_key,
   if (client_eph_ec_pubkey == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error extracting EC_KEY from EVP_PKEY struct");
-    free(client_id_bytes);
+    kmyth_free(client_id_bytes);
     return EXIT_FAILURE;
   } 
   
@@ -163,12 +285,12 @@ int compose_client_hello_msg(EVP_PKEY * client_sign_key,
   //  - Client ephemeral public key value (byte array)
   msg_out->hdr.msg_size  = (uint16_t)(2 + client_id_len + 2 + client_eph_pubkey_len);
 
-  msg_out->body = calloc(msg_out->hdr.msg_size, sizeof(unsigned char));
+  msg_out->body = kmyth_calloc(msg_out->hdr.msg_size, sizeof(unsigned char));
   if (msg_out->body == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating memory for message buffer");
     kmyth_clear_and_free(client_id_bytes, client_id_len);
-    kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
+    OPENSSL_clear_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
     return EXIT_FAILURE;
   }
 
@@ -197,7 +319,7 @@ int compose_client_hello_msg(EVP_PKEY * client_sign_key,
   memcpy(msg_out->body+index,
          client_eph_pubkey_bytes,
          client_eph_pubkey_len);
-  kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
+  OPENSSL_clear_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
 
   // append signature to tail end of message
   if (EXIT_SUCCESS != append_msg_signature(client_sign_key, msg_out))
@@ -213,7 +335,7 @@ int compose_client_hello_msg(EVP_PKEY * client_sign_key,
  * parse_client_hello_msg()
  ****************************************************************************/
 int parse_client_hello_msg(ECDHMessage * msg_in,
-                           X509 * client_sign_cert,
+                           ECPeerCert * client_sign_cert,
                            EVP_PKEY ** client_eph_pubkey)
 {
   // parse out fields in 'Client Hello' message buffer
@@ -225,7 +347,7 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   buf_index += 2;
   
   // get client identity field bytes
-  uint8_t *client_id_bytes = malloc(client_id_len);
+  uint8_t *client_id_bytes = kmyth_session_alloc(client_id_len);
   if (client_id_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating memory for client identity");
@@ -240,11 +362,11 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   buf_index += 2;
 
   // get client ephemeral contribution field bytes
-  unsigned char *client_eph_pub_bytes = malloc(client_eph_pub_len);
+  unsigned char *client_eph_pub_bytes = kmyth_session_alloc(client_eph_pub_len);
   if (client_eph_pub_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating client ephemeral byte buffer");
-    free(client_id_bytes);
+    kmyth_session_free(client_id_bytes, client_id_len);
     return EXIT_FAILURE;
   }
   memcpy(client_eph_pub_bytes, msg_in->body+buf_index, client_eph_pub_len);
@@ -260,12 +382,12 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   buf_index += 2;
 
   // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
+  uint8_t *msg_sig_bytes = kmyth_session_alloc(msg_sig_len);
   if (msg_sig_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(client_id_bytes);
-    free(client_eph_pub_bytes);
+    kmyth_session_free(client_id_bytes, client_id_len);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
     return EXIT_FAILURE;
   }
   memcpy(msg_sig_bytes, msg_in->body+buf_index, msg_sig_len);
@@ -278,67 +400,39 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
                                                  &(client_id)))
   {
     kmyth_sgx_log(LOG_ERR, "error unmarshaling client identity bytes");
-    free(client_id_bytes);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
-    return EXIT_FAILURE;
-  }
-  free(client_id_bytes);
-
-  // extract expected client identity (X509_NAME struct) from pre-loaded cert
-  X509_NAME *expected_client_id = NULL;
-
-  if (EXIT_SUCCESS != extract_identity_bytes_from_x509(client_sign_cert,
-                                                       &expected_client_id))
-  {
-    kmyth_sgx_log(LOG_ERR, "failed to extract client ID from certificate");
-    X509_NAME_free(client_id);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(client_id_bytes, client_id_len);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
+  kmyth_session_free(client_id_bytes, client_id_len);
 
   // verify that identity in 'Client Hello' message matches the client
   // certificate pre-loaded into it's peer (TLS proxy for server)
-  if (0 != X509_NAME_cmp(client_id, expected_client_id))
+  if (0 != X509_NAME_cmp(client_id, client_sign_cert->identity))
   {
     kmyth_sgx_log(LOG_ERR, "'Client Hello' - unexpected client identity");
     X509_NAME_free(client_id);
-    X509_NAME_free(expected_client_id);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
   X509_NAME_free(client_id);
-  X509_NAME_free(expected_client_id);
 
-  // extract client's public signing key (needed to verify signature over
-  // message) from X509 certificate
-  EVP_PKEY *client_sign_pubkey = X509_get_pubkey(client_sign_cert);
-  if (client_sign_pubkey == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    EVP_PKEY_free(client_sign_pubkey);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
-    return EXIT_FAILURE;
-  }
-
-  // check message signature
-  if (EXIT_SUCCESS != ec_verify_buffer(client_sign_pubkey,
-                                       msg_in->body,
-                                       msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+  // check message signature (with the client's public signing key from
+  // its pre-loaded certificate)
+  if (EXIT_SUCCESS != ec_peer_cert_verify(client_sign_cert,
+                                          msg_in->body,
+                                          msg_body_size,
+                                          msg_sig_bytes,
+                                          msg_sig_len))
   {
     kmyth_sgx_log(LOG_ERR, "signature over 'Client Hello' message invalid");
-    EVP_PKEY_free(client_sign_pubkey);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
-  EVP_PKEY_free(client_sign_pubkey);
-  free(msg_sig_bytes);
+  kmyth_session_free(msg_sig_bytes, msg_sig_len);
 
   // check that the buffer parameter for the public key (EVP_PKEY struct)
   // was not yet allocated. If it was (e.g., from a previous session), 
@@ -347,7 +441,7 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   if (*client_eph_pubkey != NULL)
   {
     kmyth_sgx_log(LOG_ERR, "resetting previously allocated EVP_PKEY struct");
-    free(*client_eph_pubkey);
+    EVP_PKEY_free(*client_eph_pubkey);
     *client_eph_pubkey = NULL;
   }
   *client_eph_pubkey = EVP_PKEY_new();
@@ -357,7 +451,7 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   if (client_eph_ec_pubkey == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error initializing output EC_KEY struct");
-    free(client_eph_pub_bytes);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
     return EXIT_FAILURE;
   } 
 
@@ -368,10 +462,10 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
                           NULL))
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of client ephemeral public key failed");
-    free(client_eph_pub_bytes);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
     return EXIT_FAILURE;
   }
-  free(client_eph_pub_bytes);
+  kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
 
   // check parsed, received ephemeral public key
   if (1 != EC_KEY_check_key(client_eph_ec_pubkey))
@@ -394,16 +488,16 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
 }                                 
 
 /*****************************************************************************
- * compose_server_hello_msg()
+ * prepare_server_hello_template()
  ****************************************************************************/
-int compose_server_hello_msg(EVP_PKEY * server_sign_key,
-                             X509 * server_sign_cert,
-                             EVP_PKEY * client_eph_pubkey,
-                             EVP_PKEY * server_eph_pubkey,
-                             ECDHMessage * msg_out)
+int prepare_server_hello_template(X509 * server_sign_cert,
+                                  ByteBuffer * hello_template)
 {
+  hello_template->buffer = NULL;
+  hello_template->size = 0;
+
   // extract server (TLS proxy) ID (subject name) bytes from cert
-  X509_NAME *server_id = X509_NAME_new();
+  X509_NAME *server_id = NULL;
 
   if (EXIT_SUCCESS != extract_identity_bytes_from_x509(server_sign_cert,
                                                        &server_id))
@@ -418,126 +512,159 @@ int compose_server_hello_msg(EVP_PKEY * server_sign_key,
 
   // marshal TLS proxy (server) ID into byte array (DER formatted) format
   unsigned char *server_id_bytes = NULL;
-  size_t server_id_len = 0;
+  int server_id_len = 0;
 
   if (EXIT_SUCCESS != marshal_x509_name_to_der(server_id,
                                                &server_id_bytes,
-                                               (int *) &server_id_len))
+                                               &server_id_len))
   {
     kmyth_sgx_log(LOG_ERR, "error marshalling ID");
     X509_NAME_free(server_id);
     if (server_id_bytes != NULL)
     {
-      free(server_id_bytes);
+      kmyth_free(server_id_bytes);
     }
     return EXIT_FAILURE;
   }
   X509_NAME_free(server_id);
 
-  // Convert client-side ephemeral public key to octet string
-  unsigned char *client_eph_pubkey_bytes = NULL;
-  size_t client_eph_pubkey_len = 0;
+  if (server_id_len <= 0 || server_id_len > UINT16_MAX - 2)
+  {
+    kmyth_sgx_log(LOG_ERR, "server ID too large");
+    kmyth_free(server_id_bytes);
+    return EXIT_FAILURE;
+  }
 
-  EC_KEY *client_eph_ec_pubkey = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  client_eph_ec_pubkey = EVP_PKEY_get1_EC_KEY(client_eph_pubkey);
-  client_eph_pubkey_len = EC_KEY_key2buf(client_eph_ec_pubkey,
-                                         POINT_CONVERSION_UNCOMPRESSED,
-                                         &client_eph_pubkey_bytes,
-                                         NULL);
-  if ((client_eph_pubkey_bytes == NULL) || (client_eph_pubkey_len == 0))
+  // the template is the leading part of every 'Server Hello' body:
+  //  - Server ID size (two-byte unsigned integer)
+  //  - Server ID value (DER-formatted X509_NAME byte array)
+  hello_template->buffer = kmyth_malloc(2 + (size_t) server_id_len);
+  if (hello_template->buffer == NULL)
   {
-    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
-    kmyth_clear_and_free(server_id_bytes, server_id_len);
-    kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
-    EC_KEY_free(client_eph_ec_pubkey);
+    kmyth_sgx_log(LOG_ERR, "error allocating 'Server Hello' template");
+    kmyth_free(server_id_bytes);
     return EXIT_FAILURE;
   }
-  EC_KEY_free(client_eph_ec_pubkey);
+  hello_template->size = 2 + (size_t) server_id_len;
 
-  // Convert server's ephemeral public key to octet string
-  unsigned char *server_eph_pubkey_bytes = NULL;
-  size_t server_eph_pubkey_len = 0;
+  uint16_t temp_val = htobe16((uint16_t) server_id_len);
 
-  EC_KEY *server_eph_ec_pubkey = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  server_eph_ec_pubkey = EVP_PKEY_get1_EC_KEY(server_eph_pubkey);
-  server_eph_pubkey_len = EC_KEY_key2buf(server_eph_ec_pubkey,
-                                         POINT_CONVERSION_UNCOMPRESSED,
-                                         &server_eph_pubkey_bytes,
-                                         NULL);
-  if ((server_eph_pubkey_bytes == NULL) || (server_eph_pubkey_len == 0))
+  memcpy(hello_template->buffer, &temp_val, 2);
+  memcpy(hello_template->buffer + 2, server_id_bytes, (size_t) server_id_len);
+  kmyth_free(server_id_bytes);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * put_eph_pubkey()
+ ****************************************************************************/
+//
+// Writes an ephemeral public key, as a two-byte length and the uncompressed
+// point, at buf (or, if buf is NULL, only works out the size that takes).
+// Returns the number of bytes (length included), or 0 on error.
+//
+static size_t put_eph_pubkey(EVP_PKEY * eph_pubkey, unsigned char *buf,
+                             size_t room)
+{
+  const EC_KEY *ec_key = EVP_PKEY_get0_EC_KEY(eph_pubkey);
+
+  if (ec_key == NULL || EC_KEY_get0_public_key(ec_key) == NULL)
   {
-    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
-    kmyth_clear_and_free(server_id_bytes, server_id_len);
-    kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
-    kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
-    EC_KEY_free(server_eph_ec_pubkey);
-    return EXIT_FAILURE;
+    return 0;
   }
-  EC_KEY_free(server_eph_ec_pubkey);
 
-  // allocate memory for 'Server Hello' message body byte array
-  //  - Server ID size (two-byte unsigned integer)
-  //  - Server ID value (DER-formatted X509_NAME byte array)
+  size_t len = EC_POINT_point2oct(EC_KEY_get0_group(ec_key),
+                                  EC_KEY_get0_public_key(ec_key),
+                                  POINT_CONVERSION_UNCOMPRESSED,
+                                  NULL, 0, NULL);
+
+  if (len == 0 || len > UINT16_MAX)
+  {
+    return 0;
+  }
+  if (buf == NULL)
+  {
+    return 2 + len;
+  }
+  if (room < 2 + len)
+  {
+    return 0;
+  }
+
+  uint16_t temp_val = htobe16((uint16_t) len);
+
+  memcpy(buf, &temp_val, 2);
+  if (EC_POINT_point2oct(EC_KEY_get0_group(ec_key),
+                         EC_KEY_get0_public_key(ec_key),
+                         POINT_CONVERSION_UNCOMPRESSED,
+                         buf + 2, len, NULL) != len)
+  {
+    return 0;
+  }
+  return 2 + len;
+}
+
+/*****************************************************************************
+ * compose_server_hello_msg_from_template()
+ ****************************************************************************/
+int compose_server_hello_msg_from_template(EVP_PKEY * server_sign_key,
+                                           ByteBuffer * hello_template,
+                                           EVP_PKEY * client_eph_pubkey,
+                                           EVP_PKEY * server_eph_pubkey,
+                                           ECDHMessage * msg_out)
+{
+  // 'Server Hello' message body:
+  //  - the template (server ID size and value)
   //  - Client ephemeral size (two-byte unsigned integer)
-  //  - Client ephemeral value (DER formatted EC_KEY byte array) 
+  //  - Client ephemeral value (octet string formatted EC point)
   //  - Server ephemeral size (two-byte unsigned integer)
-  //  - Server ephemeral value (DER formatted EC_KEY byte array)
-  // TODO: Check for overflow
-  size_t msg_out_size = 2 + server_id_len + 2 + client_eph_pubkey_len + 2 + server_eph_pubkey_len;
-  if(msg_out_size > UINT16_MAX)
+  //  - Server ephemeral value (octet string formatted EC point)
+  size_t client_eph_size = put_eph_pubkey(client_eph_pubkey, NULL, 0);
+  size_t server_eph_size = put_eph_pubkey(server_eph_pubkey, NULL, 0);
+
+  if (hello_template == NULL || hello_template->buffer == NULL ||
+      client_eph_size == 0 || server_eph_size == 0)
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid 'Server Hello' message input");
+    return EXIT_FAILURE;
+  }
+
+  size_t msg_out_size = hello_template->size + client_eph_size +
+                        server_eph_size;
+
+  if (msg_out_size > UINT16_MAX)
   {
     kmyth_sgx_log(LOG_ERR, "computed output message size too large");
-    kmyth_clear_and_free(server_id_bytes, server_id_len);
-    kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
-    kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
     return EXIT_FAILURE;
   }
-  msg_out->hdr.msg_size = (uint16_t)msg_out_size;
 
-  msg_out->body = malloc(msg_out->hdr.msg_size);
+  // the static part is copied in as is, and the ephemeral keys are encoded
+  // straight into the message body
+  msg_out->body = kmyth_malloc(msg_out_size);
   if (msg_out->body == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
-    kmyth_clear_and_free(server_id_bytes, server_id_len);
-    kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
-    kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
     return EXIT_FAILURE;
   }
+  msg_out->hdr.msg_size = (uint16_t) msg_out_size;
 
-  // initialize:
-  //   - 2-byte unsigned integer to facilitate length value format conversions
-  //   - index to newly allocated, empty message buffer
-  uint16_t temp_val = 0;
   unsigned char *buf = msg_out->body;
 
-  // insert server identity length bytes
-  temp_val = htobe16((uint16_t) server_id_len);
-  memcpy(buf, &temp_val, 2);
-  buf += 2;
-
-  // append server identity bytes
-  memcpy(buf, server_id_bytes, server_id_len);
-  free(server_id_bytes);
-  buf += server_id_len;
-
-  // append client ephemeral public key length bytes
-  temp_val = htobe16((uint16_t) client_eph_pubkey_len);
-  memcpy(buf, &temp_val, 2);
-  buf += 2;
-
-  // append client ephemeral public key bytes
-  memcpy(buf, client_eph_pubkey_bytes, client_eph_pubkey_len);
-  free(client_eph_pubkey_bytes);
-  buf += client_eph_pubkey_len;
-
-  // append server ephemeral public key length bytes
-  temp_val = htobe16((uint16_t) server_eph_pubkey_len);
-  memcpy(buf, &temp_val, 2);
-  buf += 2;
+  memcpy(buf, hello_template->buffer, hello_template->size);
+  buf += hello_template->size;
 
-  // append server ephemeral bytes
-  memcpy(buf, server_eph_pubkey_bytes, server_eph_pubkey_len);
-  kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
+  if (put_eph_pubkey(client_eph_pubkey, buf, client_eph_size)
+      != client_eph_size ||
+      put_eph_pubkey(server_eph_pubkey, buf + client_eph_size,
+                     server_eph_size) != server_eph_size)
+  {
+    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
+    kmyth_free(msg_out->body);
+    msg_out->body = NULL;
+    msg_out->hdr.msg_size = 0;
+    return EXIT_FAILURE;
+  }
 
   // append signature
   if (EXIT_SUCCESS != append_msg_signature(server_sign_key, msg_out))
@@ -547,13 +674,40 @@ int compose_server_hello_msg(EVP_PKEY * server_sign_key,
   }
 
   return EXIT_SUCCESS;
-}                                 
+}
+
+/*****************************************************************************
+ * compose_server_hello_msg()
+ ****************************************************************************/
+int compose_server_hello_msg(EVP_PKEY * server_sign_key,
+                             X509 * server_sign_cert,
+                             EVP_PKEY * client_eph_pubkey,
+                             EVP_PKEY * server_eph_pubkey,
+                             ECDHMessage * msg_out)
+{
+  ByteBuffer hello_template = { 0 };
+
+  if (EXIT_SUCCESS != prepare_server_hello_template(server_sign_cert,
+                                                    &hello_template))
+  {
+    return EXIT_FAILURE;
+  }
+
+  int ret = compose_server_hello_msg_from_template(server_sign_key,
+                                                   &hello_template,
+                                                   client_eph_pubkey,
+                                                   server_eph_pubkey,
+                                                   msg_out);
+
+  kmyth_free(hello_template.buffer);
+  return ret;
+}
 
 /*****************************************************************************
  * parse_server_hello_msg()
  ****************************************************************************/
 int parse_server_hello_msg(ECDHMessage * msg_in,
-                           X509 * server_sign_cert,
+                           ECPeerCert * server_sign_cert,
                            EVP_PKEY * client_eph_pubkey,
                            EVP_PKEY ** server_eph_pubkey)
 {
@@ -566,7 +720,7 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   buf_index += 2;
 
   // get server identity field bytes (server_id)
-  uint8_t *server_id_bytes = malloc(server_id_len);
+  uint8_t *server_id_bytes = kmyth_session_alloc(server_id_len);
   if (server_id_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating memory for server identity");
@@ -581,11 +735,11 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   buf_index += 2;
 
   // get client ephemeral contribution field bytes (client_eph_pub_bytes)
-  unsigned char *client_eph_pub_bytes = malloc(client_eph_pub_len);
+  unsigned char *client_eph_pub_bytes = kmyth_session_alloc(client_eph_pub_len);
   if (client_eph_pub_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating client ephemeral byte buffer");
-    free(server_id_bytes);
+    kmyth_session_free(server_id_bytes, server_id_len);
     return EXIT_FAILURE;
   }
   memcpy(client_eph_pub_bytes, msg_in->body+buf_index, client_eph_pub_len);
@@ -597,12 +751,12 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   buf_index += 2;
 
   // get server ephemeral contribution field bytes (server_eph_pub_bytes)
-  unsigned char *server_eph_pub_bytes = malloc(server_eph_pub_len);
+  unsigned char *server_eph_pub_bytes = kmyth_session_alloc(server_eph_pub_len);
   if (server_eph_pub_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating server ephemeral byte buffer");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
+    kmyth_session_free(server_id_bytes, server_id_len);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
     return EXIT_FAILURE;
   }
   memcpy(server_eph_pub_bytes, msg_in->body+buf_index, server_eph_pub_len);
@@ -618,13 +772,13 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   buf_index += 2;
 
   // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
+  uint8_t *msg_sig_bytes = kmyth_session_alloc(msg_sig_len);
   if (msg_sig_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
+    kmyth_session_free(server_id_bytes, server_id_len);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     return EXIT_FAILURE;
   }
   memcpy(msg_sig_bytes, msg_in->body+buf_index, msg_sig_len);
@@ -634,10 +788,10 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   if (buf_index != msg_in->hdr.msg_size)
   {
     kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(server_id_bytes, server_id_len);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
 
@@ -648,76 +802,52 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
                                                  &rcvd_server_id))
   {
     kmyth_sgx_log(LOG_ERR, "error unmarshaling server identity bytes");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
-    return EXIT_FAILURE;
-  }
-  free(server_id_bytes);
-
-  // extract expected server identity (X509_NAME struct) from pre-loaded cert
-  X509_NAME *expected_server_id = NULL;
-
-  if (EXIT_SUCCESS != extract_identity_bytes_from_x509(server_sign_cert,
-                                                       &expected_server_id))
-  {
-    kmyth_sgx_log(LOG_ERR, "failed to extract ID from certificate");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(server_id_bytes, server_id_len);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
+  kmyth_session_free(server_id_bytes, server_id_len);
 
   // verify that identity in 'Server Hello' message matches the server
   // certificate pre-loaded into it's peer (enclave client)
-  if (0 != X509_NAME_cmp(rcvd_server_id, expected_server_id))
+  if (0 != X509_NAME_cmp(rcvd_server_id, server_sign_cert->identity))
   {
     kmyth_sgx_log(LOG_ERR, "'Server Hello' - unexpected server identity");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
-    return EXIT_FAILURE;
-  }
-
-  // extract server's public signing key (needed to verify signature over
-  // message) from X509 certificate
-  EVP_PKEY *server_sign_pubkey = X509_get_pubkey(server_sign_cert);
-  if (server_sign_pubkey == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    X509_NAME_free(rcvd_server_id);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
+  X509_NAME_free(rcvd_server_id);
 
-  // check message signature
-  if (EXIT_SUCCESS != ec_verify_buffer(server_sign_pubkey,
-                                       msg_in->body,
-                                       msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+  // check message signature (with the server's public signing key from
+  // its pre-loaded certificate)
+  if (EXIT_SUCCESS != ec_peer_cert_verify(server_sign_cert,
+                                          msg_in->body,
+                                          msg_body_size,
+                                          msg_sig_bytes,
+                                          msg_sig_len))
   {
     kmyth_sgx_log(LOG_ERR, "signature over 'Server Hello' message invalid");
-    EVP_PKEY_free(server_sign_pubkey);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
 
   // done with signature, clean-up memory
-  free(msg_sig_bytes);
-  EVP_PKEY_free(server_sign_pubkey);
+  kmyth_session_free(msg_sig_bytes, msg_sig_len);
 
   // convert received client ephemeral public bytes to EVP_PKEY struct format
   EC_KEY *rcvd_client_eph_ec_pub = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
   if (rcvd_client_eph_ec_pub == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error initializing EC_KEY struct");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     return EXIT_FAILURE;
   } 
   if (1 != EC_KEY_oct2key(rcvd_client_eph_ec_pub,
@@ -726,17 +856,17 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
                           NULL))
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of client ephemeral public key failed");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
+    kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     EC_KEY_free(rcvd_client_eph_ec_pub);
     return EXIT_FAILURE;
   }
-  free(client_eph_pub_bytes);
+  kmyth_session_free(client_eph_pub_bytes, client_eph_pub_len);
   EVP_PKEY *rcvd_client_eph_pub = EVP_PKEY_new();
   if (1 != EVP_PKEY_set1_EC_KEY(rcvd_client_eph_pub, rcvd_client_eph_ec_pub))
   {
     kmyth_sgx_log(LOG_ERR, "error encapsulating EC_KEY in EVP_PKEY");
-    free(server_eph_pub_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     EC_KEY_free(rcvd_client_eph_ec_pub);
     EVP_PKEY_free(rcvd_client_eph_pub);
     return EXIT_FAILURE;
@@ -749,7 +879,7 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
                         (const EVP_PKEY *) client_eph_pubkey))
   {
     kmyth_sgx_log(LOG_ERR, "client ephemeral public mismatch");
-    free(server_eph_pub_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     EVP_PKEY_free(rcvd_client_eph_pub);
     return EXIT_FAILURE;
   }
@@ -763,11 +893,11 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
                           NULL))
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of server ephemeral public key failed");
-    free(server_eph_pub_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     EC_KEY_free(server_eph_ec_pubkey);
     return EXIT_FAILURE;
   }
-  free(server_eph_pub_bytes);
+  kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
 
   // check parsed, received ephemeral public key
   if (1 != EC_KEY_check_key(server_eph_ec_pubkey))
@@ -803,32 +933,22 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
  ****************************************************************************/
 int compose_key_request_msg(EVP_PKEY * client_sign_key,
                             ByteBuffer * msg_enc_key,
-                            ByteBuffer * req_key_id,
+                            ByteBuffer * req_key_ids,
+                            size_t req_key_id_count,
                             EVP_PKEY * server_eph_pubkey,
                             ECDHMessage * msg_out)
 {
   // create KMIP key request
-  KMIP kmip_context = { 0 };
-  kmip_init(&kmip_context, NULL, 0, KMIP_2_0);
-
   unsigned char *kmip_key_request_bytes = NULL;
   size_t kmip_key_request_len = 0;
 
-  if (EXIT_SUCCESS != build_kmip_get_request(&kmip_context,
-                                            req_key_id->buffer,
-                                            req_key_id->size,
-                                            &kmip_key_request_bytes,
-                                            &kmip_key_request_len))
+  if (EXIT_SUCCESS != build_key_request_kmip(req_key_ids,
+                                             req_key_id_count,
+                                             &kmip_key_request_bytes,
+                                             &kmip_key_request_len))
   {
-    kmyth_sgx_log(LOG_ERR, "failed to build the 'KMIP Get' request");
-    kmip_destroy(&kmip_context);
-    if (kmip_key_request_bytes != NULL)
-    {
-      free(kmip_key_request_bytes);
-    }
     return EXIT_FAILURE;
   }
-  kmip_destroy(&kmip_context);
 
   // Convert server's ephemeral public key to octet string
   unsigned char *server_eph_pubkey_bytes = NULL;
@@ -843,7 +963,7 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
   if ((server_eph_pubkey_bytes == NULL) || (server_eph_pubkey_len == 0))
   {
     kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
-    free(kmip_key_request_bytes);
+    kmyth_free(kmip_key_request_bytes);
     EC_KEY_free(server_eph_ec_pubkey);
     return EXIT_FAILURE;
   }
@@ -855,15 +975,23 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
   //  - Server ephemeral size (two-byte unsigned integer)
   //  - Server ephemeral value (DER formatted EC_KEY byte array)
   ECDHMessage pt_msg = { 0 };
-  // TODO: Check for overflow
+
+  if (2 + kmip_key_request_len + 2 + server_eph_pubkey_len >
+      KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "'Key Request' message fields too long");
+    kmyth_free(kmip_key_request_bytes);
+    OPENSSL_free(server_eph_pubkey_bytes);
+    return EXIT_FAILURE;
+  }
   pt_msg.hdr.msg_size = (uint16_t)(2 + kmip_key_request_len +
 				   2 + server_eph_pubkey_len);
-  pt_msg.body = calloc(pt_msg.hdr.msg_size, sizeof(unsigned char));
+  pt_msg.body = kmyth_calloc(pt_msg.hdr.msg_size, sizeof(unsigned char));
   if (pt_msg.body == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
-    free(kmip_key_request_bytes);
-    free(server_eph_pubkey_bytes);
+    kmyth_free(kmip_key_request_bytes);
+    OPENSSL_free(server_eph_pubkey_bytes);
     return EXIT_FAILURE;
   }
 
@@ -880,7 +1008,7 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
 
   // insert KMIP key request bytes
   memcpy(buf_ptr, kmip_key_request_bytes, kmip_key_request_len);
-  free(kmip_key_request_bytes);
+  kmyth_free(kmip_key_request_bytes);
   buf_ptr += kmip_key_request_len;
 
   // append server ephemeral public key length bytes
@@ -890,7 +1018,7 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
 
   // append server ephemeral bytes
   memcpy(buf_ptr, server_eph_pubkey_bytes, server_eph_pubkey_len);
-  free(server_eph_pubkey_bytes);
+  OPENSSL_free(server_eph_pubkey_bytes);
 
   // append signature
   if (EXIT_SUCCESS != append_msg_signature(client_sign_key, &pt_msg))
@@ -902,7 +1030,7 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
   // if output message buffer allocated, free and set to NULL
   if (msg_out->body != NULL)
   {
-    free(msg_out->body);
+    kmyth_free(msg_out->body);
     msg_out->hdr.msg_size = 0;
     msg_out->body = NULL;
   }
@@ -916,10 +1044,10 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
                                       (size_t *) &(msg_out->hdr.msg_size)))
   {
     kmyth_sgx_log(LOG_ERR, "failed to encrypt the 'Key Request' message");
-    free(pt_msg.body);
+    kmyth_free(pt_msg.body);
     return EXIT_FAILURE;
   }
-  free(pt_msg.body);
+  kmyth_free(pt_msg.body);
 
   return EXIT_SUCCESS;
 }
@@ -927,7 +1055,7 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
 /*****************************************************************************
  * parse_key_request_msg()
  ****************************************************************************/
-int parse_key_request_msg(X509 * client_sign_cert,
+int parse_key_request_msg(ECPeerCert * client_sign_cert,
                           ByteBuffer * msg_dec_key,
                           ECDHMessage * msg_in,
                           EVP_PKEY * server_eph_pubkey,
@@ -946,7 +1074,7 @@ int parse_key_request_msg(X509 * client_sign_cert,
     kmyth_sgx_log(LOG_ERR, "failed to decrypt the 'Key Request' message");
     if (pt_msg.body != NULL)
     {
-      free(pt_msg.body);
+      kmyth_free(pt_msg.body);
     }
     return EXIT_FAILURE;
   }
@@ -960,7 +1088,7 @@ int parse_key_request_msg(X509 * client_sign_cert,
   buf_index += 2;
 
   // get KMIP 'get key' request bytes
-  kmip_request->buffer = malloc(kmip_request->size);
+  kmip_request->buffer = kmyth_malloc(kmip_request->size);
   if (kmip_request->buffer == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating KMIP request byte buffer");
@@ -975,11 +1103,11 @@ int parse_key_request_msg(X509 * client_sign_cert,
   buf_index += 2;
 
   // get server-side ephemeral public key field bytes
-  unsigned char *server_eph_pub_bytes = malloc(server_eph_pub_len);
+  unsigned char *server_eph_pub_bytes = kmyth_session_alloc(server_eph_pub_len);
   if (server_eph_pub_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating server ephemeral byte buffer");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
     return EXIT_FAILURE;
   }
@@ -996,13 +1124,13 @@ int parse_key_request_msg(X509 * client_sign_cert,
   buf_index += 2;
 
   // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
+  uint8_t *msg_sig_bytes = kmyth_session_alloc(msg_sig_len);
   if (msg_sig_bytes == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     return EXIT_FAILURE;
   }
   memcpy(msg_sig_bytes, pt_msg.body+buf_index, msg_sig_len);
@@ -1012,52 +1140,40 @@ int parse_key_request_msg(X509 * client_sign_cert,
   if (buf_index != pt_msg.hdr.msg_size)
   {
     kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
 
-  // extract server's public signing key (needed to verify signature over
-  // message) from X509 certificate
-  EVP_PKEY *msg_sign_pubkey = X509_get_pubkey(client_sign_cert);
-  if (msg_sign_pubkey == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
-    return EXIT_FAILURE;
-  }
-
-  // check message signature
-  if (EXIT_SUCCESS != ec_verify_buffer(msg_sign_pubkey,
-                                       pt_msg.body,
-                                       msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+  // check message signature (with the client's public signing key from
+  // its pre-loaded certificate)
+  if (EXIT_SUCCESS != ec_peer_cert_verify(client_sign_cert,
+                                          pt_msg.body,
+                                          msg_body_size,
+                                          msg_sig_bytes,
+                                          msg_sig_len))
   {
     kmyth_sgx_log(LOG_ERR, "signature over 'Key Request' message invalid");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
+    kmyth_session_free(msg_sig_bytes, msg_sig_len);
     return EXIT_FAILURE;
   }
 
   // done with signature, clean-up memory
-  free(msg_sig_bytes);
+  kmyth_session_free(msg_sig_bytes, msg_sig_len);
 
   // convert received client ephemeral public bytes to EVP_PKEY struct format
   EC_KEY *rcvd_server_eph_ec_pub = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
   if (rcvd_server_eph_ec_pub == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error initializing EC_KEY struct");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     return EXIT_FAILURE;
   } 
   if (1 != EC_KEY_oct2key(rcvd_server_eph_ec_pub,
@@ -1066,19 +1182,19 @@ int parse_key_request_msg(X509 * client_sign_cert,
                           NULL))
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of server ephemeral public key failed");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
+    kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
     EC_KEY_free(rcvd_server_eph_ec_pub);
     return EXIT_FAILURE;
   }
-  free(server_eph_pub_bytes);
+  kmyth_session_free(server_eph_pub_bytes, server_eph_pub_len);
 
   EVP_PKEY *rcvd_server_eph_pub = EVP_PKEY_new();
   if (1 != EVP_PKEY_set1_EC_KEY(rcvd_server_eph_pub, rcvd_server_eph_ec_pub))
   {
     kmyth_sgx_log(LOG_ERR, "error encapsulating EC_KEY in EVP_PKEY");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
     EC_KEY_free(rcvd_server_eph_ec_pub);
     EVP_PKEY_free(rcvd_server_eph_pub);
@@ -1092,7 +1208,7 @@ int parse_key_request_msg(X509 * client_sign_cert,
                         (const EVP_PKEY *) server_eph_pubkey))
   {
     kmyth_sgx_log(LOG_ERR, "server ephemeral public mismatch");
-    free(kmip_request->buffer);
+    kmyth_free(kmip_request->buffer);
     kmyth_clear(kmip_request, sizeof(ByteBuffer));
     EVP_PKEY_free(rcvd_server_eph_pub);
     return EXIT_FAILURE;
@@ -1108,16 +1224,28 @@ int parse_key_request_msg(X509 * client_sign_cert,
 int compose_key_response_msg(EVP_PKEY * server_sign_key,
                              ByteBuffer * msg_enc_key,
                              ByteBuffer * kmip_response,
+                             ByteBuffer * ticket,
                              ECDHMessage * msg_out)
 {
+  size_t ticket_len = (ticket != NULL) ? ticket->size : 0;
+
   // allocate memory for 'Key Response' message body byte array
   //  - KMIP 'get key' response size (two-byte unsigned integer)
   //  - KMIP 'get key' response bytes (byte array)
+  //  - session ticket size (two-byte unsigned integer, zero if none)
+  //  - session ticket bytes (byte array)
+  if (kmip_response->size > UINT16_MAX ||
+      ticket_len > KMYTH_ECDH_MAX_TICKET_SIZE ||
+      2 + kmip_response->size + 2 + ticket_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "'Key Response' message fields too long");
+    return EXIT_FAILURE;
+  }
+
   ECDHMessage pt_msg = { { 0 }, NULL };
-  // TODO: Confirm this doesn't overflow
-  pt_msg.hdr.msg_size = (uint16_t)(2 + kmip_response->size);
+  pt_msg.hdr.msg_size = (uint16_t)(2 + kmip_response->size + 2 + ticket_len);
 
-  pt_msg.body = calloc(pt_msg.hdr.msg_size, sizeof(unsigned char));
+  pt_msg.body = kmyth_calloc(pt_msg.hdr.msg_size, sizeof(unsigned char));
   if (pt_msg.body == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
@@ -1137,6 +1265,16 @@ int compose_key_response_msg(EVP_PKEY * server_sign_key,
 
   // insert KMIP 'get key' response bytes
   memcpy(buf_ptr, kmip_response->buffer, kmip_response->size);
+  buf_ptr += kmip_response->size;
+
+  // insert session ticket size and bytes
+  temp_val = htobe16((uint16_t) ticket_len);
+  memcpy(buf_ptr, &temp_val, 2);
+  buf_ptr += 2;
+  if (ticket_len > 0)
+  {
+    memcpy(buf_ptr, ticket->buffer, ticket_len);
+  }
 
   // append signature to unencrypted 'Key Response' message
   if (EXIT_SUCCESS != append_msg_signature(server_sign_key, &pt_msg))
@@ -1149,7 +1287,7 @@ int compose_key_response_msg(EVP_PKEY * server_sign_key,
   // if output message buffer allocated, free and set to NULL
   if (msg_out->body != NULL)
   {
-    free(msg_out->body);
+    kmyth_free(msg_out->body);
     msg_out->hdr.msg_size = 0;
     msg_out->body = NULL;
   }
@@ -1174,10 +1312,11 @@ int compose_key_response_msg(EVP_PKEY * server_sign_key,
 /*****************************************************************************
  * parse_key_response_msg()
  ****************************************************************************/
-int parse_key_response_msg(X509 * server_sign_cert,
+int parse_key_response_msg(ECPeerCert * server_sign_cert,
                            ByteBuffer * msg_dec_key,
                            ECDHMessage * msg_in,
-                           ByteBuffer * kmip_response)
+                           ByteBuffer * kmip_response,
+                           ByteBuffer * ticket)
 {
   // decrypt message using input message decryption key
   ECDHMessage pt_msg = { { 0 }, NULL };
@@ -1197,85 +1336,429 @@ int parse_key_response_msg(X509 * server_sign_cert,
     return EXIT_FAILURE;
   }
 
-  // parse message body fields into variables
+  // parse message body fields into variables:
+  //   - KMIP 'get key' response
+  //   - session ticket (possibly empty)
   size_t buf_index = 0;
+  ByteBuffer rcvd_ticket = { 0, NULL };
 
-  // get size (in bytes) of KMIP 'get key' request field
-  kmip_response->size = (uint16_t)((pt_msg.body)[buf_index] << 8);
-  kmip_response->size = (uint16_t)(kmip_response->size + (pt_msg.body)[buf_index+1]);
-  buf_index += 2;
-
-  // get KMIP 'get key' response bytes
-  kmip_response->buffer = malloc(kmip_response->size);
-  if (kmip_response->buffer == NULL)
+  if (EXIT_SUCCESS != get_msg_field(&pt_msg, &buf_index, kmip_response) ||
+      EXIT_SUCCESS != get_msg_field(&pt_msg, &buf_index, &rcvd_ticket))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating KMIP response byte buffer");
+    kmyth_sgx_log(LOG_ERR, "malformed 'Key Response' message");
+    kmyth_clear_and_free(kmip_response->buffer, kmip_response->size);
+    kmyth_clear(kmip_response, sizeof(ByteBuffer));
+    kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
     return EXIT_FAILURE;
   }
-  memcpy(kmip_response->buffer, (pt_msg.body)+buf_index, kmip_response->size);
-  buf_index += kmip_response->size;
 
   // buffer index now points just past end of message body
   // capture this index so we can access message body as part of input buffer
   size_t msg_body_size = buf_index;
 
-  // get size of message signature
-  uint16_t msg_sig_len = (uint16_t)((pt_msg.body)[buf_index] << 8);
-  msg_sig_len = (uint16_t)(msg_sig_len + (pt_msg.body)[buf_index+1]);
-  buf_index += 2;
+  // get message signature
+  ByteBuffer msg_sig = { 0, NULL };
 
-  // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
-  if (msg_sig_bytes == NULL)
+  if (EXIT_SUCCESS != get_msg_field(&pt_msg, &buf_index, &msg_sig) ||
+      buf_index != pt_msg.hdr.msg_size)
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(kmip_response->buffer);
+    kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
+    kmyth_clear_and_free(kmip_response->buffer, kmip_response->size);
     kmyth_clear(kmip_response, sizeof(ByteBuffer));
+    kmyth_free(rcvd_ticket.buffer);
+    kmyth_free(msg_sig.buffer);
+    kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
     return EXIT_FAILURE;
   }
-  memcpy(msg_sig_bytes, (pt_msg.body)+buf_index, msg_sig_len);
-  buf_index += msg_sig_len;
 
-  // check that number of parsed bytes matches message length input parameter
-  if (buf_index != pt_msg.hdr.msg_size)
+  // check message signature (with the server's public signing key from
+  // its pre-loaded certificate)
+  if (EXIT_SUCCESS != ec_peer_cert_verify(server_sign_cert,
+                                          pt_msg.body,
+                                          msg_body_size,
+                                          msg_sig.buffer,
+                                          (unsigned int) msg_sig.size))
   {
-    kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
-    free(kmip_response->buffer);
+    kmyth_sgx_log(LOG_ERR, "signature over 'Key Response' message invalid");
+    kmyth_clear_and_free(kmip_response->buffer, kmip_response->size);
     kmyth_clear(kmip_response, sizeof(ByteBuffer));
-    free(msg_sig_bytes);
+    kmyth_free(rcvd_ticket.buffer);
+    kmyth_free(msg_sig.buffer);
+    kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
     return EXIT_FAILURE;
   }
 
-  // extract server's public signing key (needed to verify signature over
-  // message) from X509 certificate
-  EVP_PKEY *msg_sign_pubkey = X509_get_pubkey(server_sign_cert);
-  if (msg_sign_pubkey == NULL)
+  // done with signature and plaintext, clean-up memory
+  kmyth_free(msg_sig.buffer);
+  kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
+
+  // hand over the session ticket, if the caller wants it
+  if (ticket != NULL)
   {
-    kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    free(kmip_response->buffer);
-    kmyth_clear(kmip_response, sizeof(ByteBuffer));
-    free(msg_sig_bytes);
+    *ticket = rcvd_ticket;
+  }
+  else
+  {
+    kmyth_free(rcvd_ticket.buffer);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * is_resume_request_msg()
+ ****************************************************************************/
+bool is_resume_request_msg(ECDHMessage * msg_in)
+{
+  // a 'Client Hello' starts with the (non-zero) length of the client
+  // identity; a 'Resume Request' starts with a zero length in its place
+  return (msg_in->hdr.msg_size >= 2 &&
+          msg_in->body[0] == 0 && msg_in->body[1] == 0);
+}
+
+/*****************************************************************************
+ * derive_resumed_session_keys()
+ ****************************************************************************/
+int derive_resumed_session_keys(ByteBuffer * resume_secret,
+                                ByteBuffer * ticket,
+                                ByteBuffer * nonce,
+                                ByteBuffer * request_key,
+                                ByteBuffer * response_key,
+                                ByteBuffer * next_resume_secret)
+{
+  // the same HKDF as for a full handshake, keyed with the resumption secret
+  // rather than an ECDH shared secret and bound to the ticket and nonce
+  // (in place of the 'Client Hello' and 'Server Hello' messages)
+  if (EXIT_SUCCESS != compute_ecdh_session_key(resume_secret->buffer,
+                                               resume_secret->size,
+                                               ticket->buffer,
+                                               ticket->size,
+                                               nonce->buffer,
+                                               nonce->size,
+                                               &(request_key->buffer),
+                                               &(request_key->size),
+                                               &(response_key->buffer),
+                                               &(response_key->size),
+                                               &(next_resume_secret->buffer),
+                                               &(next_resume_secret->size)))
+  {
+    kmyth_sgx_log(LOG_ERR, "resumed session key computation failed");
     return EXIT_FAILURE;
   }
 
-  // check message signature
-  if (EXIT_SUCCESS != ec_verify_buffer(msg_sign_pubkey,
-                                       pt_msg.body,
-                                       msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * compose_resume_request_msg()
+ ****************************************************************************/
+int compose_resume_request_msg(ByteBuffer * ticket,
+                               ByteBuffer * nonce,
+                               ByteBuffer * msg_enc_key,
+                               ByteBuffer * req_key_ids,
+                               size_t req_key_id_count,
+                               ECDHMessage * msg_out)
+{
+  // create KMIP key request
+  unsigned char *kmip_key_request_bytes = NULL;
+  size_t kmip_key_request_len = 0;
+
+  if (EXIT_SUCCESS != build_key_request_kmip(req_key_ids,
+                                             req_key_id_count,
+                                             &kmip_key_request_bytes,
+                                             &kmip_key_request_len))
   {
-    kmyth_sgx_log(LOG_ERR, "signature over 'Key Request' message invalid");
-    free(kmip_response->buffer);
+    return EXIT_FAILURE;
+  }
+
+  // encrypt the KMIP key request (with its size) using the specified key
+  ECDHMessage pt_msg = { { 0 }, NULL };
+  unsigned char *enc_request = NULL;
+  size_t enc_request_len = 0;
+
+  pt_msg.hdr.msg_size = (uint16_t) (2 + kmip_key_request_len);
+  pt_msg.body = kmyth_session_alloc(pt_msg.hdr.msg_size);
+  if (pt_msg.body == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
+    kmyth_free(kmip_key_request_bytes);
+    return EXIT_FAILURE;
+  }
+  put_msg_field(pt_msg.body, kmip_key_request_bytes, kmip_key_request_len);
+  kmyth_free(kmip_key_request_bytes);
+
+  if (EXIT_SUCCESS != aes_gcm_encrypt(msg_enc_key->buffer,
+                                      msg_enc_key->size,
+                                      pt_msg.body,
+                                      pt_msg.hdr.msg_size,
+                                      &enc_request,
+                                      &enc_request_len))
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to encrypt the 'Resume Request' message");
+    kmyth_session_free(pt_msg.body, pt_msg.hdr.msg_size);
+    return EXIT_FAILURE;
+  }
+  kmyth_session_free(pt_msg.body, pt_msg.hdr.msg_size);
+
+  // allocate memory for 'Resume Request' message body byte array
+  //  - zero (two-byte unsigned integer, in place of a client identity size)
+  //  - session ticket size (two-byte unsigned integer)
+  //  - session ticket bytes (byte array)
+  //  - nonce size (two-byte unsigned integer)
+  //  - nonce bytes (byte array)
+  //  - encrypted KMIP key request (the rest of the message)
+  size_t msg_len = 2 + 2 + ticket->size + 2 + nonce->size + enc_request_len;
+
+  if (ticket->size > KMYTH_ECDH_MAX_TICKET_SIZE ||
+      nonce->size != KMYTH_ECDH_RESUME_NONCE_SIZE ||
+      msg_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "'Resume Request' message fields too long");
+    kmyth_free(enc_request);
+    return EXIT_FAILURE;
+  }
+
+  // if output message buffer allocated, free and set to NULL
+  if (msg_out->body != NULL)
+  {
+    kmyth_free(msg_out->body);
+    msg_out->hdr.msg_size = 0;
+    msg_out->body = NULL;
+  }
+
+  msg_out->body = kmyth_calloc(msg_len, sizeof(unsigned char));
+  if (msg_out->body == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
+    kmyth_free(enc_request);
+    return EXIT_FAILURE;
+  }
+  msg_out->hdr.msg_size = (uint16_t) msg_len;
+
+  unsigned char *buf_ptr = put_msg_field(msg_out->body, NULL, 0);
+
+  buf_ptr = put_msg_field(buf_ptr, ticket->buffer, ticket->size);
+  buf_ptr = put_msg_field(buf_ptr, nonce->buffer, nonce->size);
+  memcpy(buf_ptr, enc_request, enc_request_len);
+  kmyth_free(enc_request);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * parse_resume_request_msg()
+ ****************************************************************************/
+int parse_resume_request_msg(ECDHMessage * msg_in,
+                             ByteBuffer * ticket,
+                             ByteBuffer * nonce)
+{
+  ByteBuffer marker = { 0, NULL };
+  size_t buf_index = 0;
+
+  kmyth_clear(ticket, sizeof(ByteBuffer));
+  kmyth_clear(nonce, sizeof(ByteBuffer));
+
+  if (!is_resume_request_msg(msg_in) ||
+      EXIT_SUCCESS != get_msg_field(msg_in, &buf_index, &marker) ||
+      EXIT_SUCCESS != get_msg_field(msg_in, &buf_index, ticket) ||
+      EXIT_SUCCESS != get_msg_field(msg_in, &buf_index, nonce) ||
+      ticket->size == 0 ||
+      nonce->size != KMYTH_ECDH_RESUME_NONCE_SIZE ||
+      buf_index >= msg_in->hdr.msg_size)
+  {
+    kmyth_sgx_log(LOG_ERR, "malformed 'Resume Request' message");
+    kmyth_free(ticket->buffer);
+    kmyth_free(nonce->buffer);
+    kmyth_clear(ticket, sizeof(ByteBuffer));
+    kmyth_clear(nonce, sizeof(ByteBuffer));
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * decrypt_resume_request_msg()
+ ****************************************************************************/
+int decrypt_resume_request_msg(ByteBuffer * msg_dec_key,
+                               ECDHMessage * msg_in,
+                               ByteBuffer * kmip_request)
+{
+  // skip the fields parse_resume_request_msg() has already checked
+  ByteBuffer field = { 0, NULL };
+  size_t buf_index = 0;
+
+  for (int i = 0; i < 3; i++)
+  {
+    if (EXIT_SUCCESS != get_msg_field(msg_in, &buf_index, &field))
+    {
+      kmyth_sgx_log(LOG_ERR, "malformed 'Resume Request' message");
+      return EXIT_FAILURE;
+    }
+    kmyth_free(field.buffer);
+  }
+
+  // decrypt the rest of the message using the input decryption key
+  ECDHMessage pt_msg = { { 0 }, NULL };
+  size_t pt_len = 0;
+
+  if (buf_index >= msg_in->hdr.msg_size ||
+      EXIT_SUCCESS != aes_gcm_decrypt(msg_dec_key->buffer,
+                                      msg_dec_key->size,
+                                      msg_in->body + buf_index,
+                                      msg_in->hdr.msg_size - buf_index,
+                                      &(pt_msg.body),
+                                      &pt_len))
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to decrypt the 'Resume Request' message");
+    if (pt_msg.body != NULL)
+    {
+      kmyth_clear_and_free(pt_msg.body, pt_len);
+    }
+    return EXIT_FAILURE;
+  }
+  pt_msg.hdr.msg_size = (uint16_t) pt_len;
+
+  // get the KMIP 'get key' request
+  buf_index = 0;
+  if (EXIT_SUCCESS != get_msg_field(&pt_msg, &buf_index, kmip_request) ||
+      kmip_request->size == 0 || buf_index != pt_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "malformed 'Resume Request' KMIP request");
+    kmyth_clear_and_free(kmip_request->buffer, kmip_request->size);
+    kmyth_clear(kmip_request, sizeof(ByteBuffer));
+    kmyth_clear_and_free(pt_msg.body, pt_len);
+    return EXIT_FAILURE;
+  }
+  kmyth_clear_and_free(pt_msg.body, pt_len);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * compose_resume_response_msg()
+ ****************************************************************************/
+int compose_resume_response_msg(ByteBuffer * msg_enc_key,
+                                ByteBuffer * kmip_response,
+                                ByteBuffer * ticket,
+                                ECDHMessage * msg_out)
+{
+  size_t ticket_len = (ticket != NULL) ? ticket->size : 0;
+
+  // allocate memory for 'Resume Response' message body byte array
+  //  - KMIP 'get key' response size (two-byte unsigned integer)
+  //  - KMIP 'get key' response bytes (byte array)
+  //  - session ticket size (two-byte unsigned integer, zero if none)
+  //  - session ticket bytes (byte array)
+  if (kmip_response->size > UINT16_MAX ||
+      ticket_len > KMYTH_ECDH_MAX_TICKET_SIZE ||
+      2 + kmip_response->size + 2 + ticket_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "'Resume Response' message fields too long");
+    return EXIT_FAILURE;
+  }
+
+  size_t pt_len = 2 + kmip_response->size + 2 + ticket_len;
+  unsigned char *pt_body = kmyth_session_alloc(pt_len);
+
+  if (pt_body == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
+    return EXIT_FAILURE;
+  }
+
+  unsigned char *buf_ptr = put_msg_field(pt_body, kmip_response->buffer,
+                                         kmip_response->size);
+
+  put_msg_field(buf_ptr, (ticket != NULL) ? ticket->buffer : NULL,
+                ticket_len);
+
+  // if output message buffer allocated, free and set to NULL
+  if (msg_out->body != NULL)
+  {
+    kmyth_free(msg_out->body);
+    msg_out->hdr.msg_size = 0;
+    msg_out->body = NULL;
+  }
+
+  // encrypt the 'Resume Response' message using the specified key (only
+  // the client that holds the ticket's resumption secret can derive it)
+  size_t msg_len = 0;
+
+  if (EXIT_SUCCESS != aes_gcm_encrypt(msg_enc_key->buffer,
+                                      msg_enc_key->size,
+                                      pt_body,
+                                      pt_len,
+                                      &(msg_out->body),
+                                      &msg_len) ||
+      msg_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to encrypt the 'Resume Response' message");
+    kmyth_session_free(pt_body, pt_len);
+    kmyth_free(msg_out->body);
+    msg_out->body = NULL;
+    return EXIT_FAILURE;
+  }
+  msg_out->hdr.msg_size = (uint16_t) msg_len;
+  kmyth_session_free(pt_body, pt_len);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * parse_resume_response_msg()
+ ****************************************************************************/
+int parse_resume_response_msg(ByteBuffer * msg_dec_key,
+                              ECDHMessage * msg_in,
+                              ByteBuffer * kmip_response,
+                              ByteBuffer * ticket)
+{
+  // decrypt message using input message decryption key
+  ECDHMessage pt_msg = { { 0 }, NULL };
+  size_t pt_len = 0;
+
+  if (EXIT_SUCCESS != aes_gcm_decrypt(msg_dec_key->buffer,
+                                      msg_dec_key->size,
+                                      msg_in->body,
+                                      msg_in->hdr.msg_size,
+                                      &(pt_msg.body),
+                                      &pt_len))
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to decrypt the 'Resume Response' message");
+    if (pt_msg.body != NULL)
+    {
+      kmyth_clear_and_free(pt_msg.body, pt_len);
+    }
+    return EXIT_FAILURE;
+  }
+  pt_msg.hdr.msg_size = (uint16_t) pt_len;
+
+  // parse message fields: KMIP 'get key' response, session ticket
+  size_t buf_index = 0;
+  ByteBuffer rcvd_ticket = { 0, NULL };
+
+  if (EXIT_SUCCESS != get_msg_field(&pt_msg, &buf_index, kmip_response) ||
+      EXIT_SUCCESS != get_msg_field(&pt_msg, &buf_index, &rcvd_ticket) ||
+      kmip_response->size == 0 || buf_index != pt_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "malformed 'Resume Response' message");
+    kmyth_clear_and_free(kmip_response->buffer, kmip_response->size);
     kmyth_clear(kmip_response, sizeof(ByteBuffer));
-    free(msg_sig_bytes);
-    EVP_PKEY_free(msg_sign_pubkey);
+    kmyth_free(rcvd_ticket.buffer);
+    kmyth_clear_and_free(pt_msg.body, pt_len);
     return EXIT_FAILURE;
   }
+  kmyth_clear_and_free(pt_msg.body, pt_len);
 
-  // done with signature, clean-up memory
-  free(msg_sig_bytes);
-  EVP_PKEY_free(msg_sign_pubkey);
+  // hand over the session ticket, if the caller wants it
+  if (ticket != NULL)
+  {
+    *ticket = rcvd_ticket;
+  }
+  else
+  {
+    kmyth_free(rcvd_ticket.buffer);
+  }
 
   return EXIT_SUCCESS;
 }
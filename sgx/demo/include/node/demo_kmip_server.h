@@ -5,15 +5,24 @@
  * @brief Provides global constants, structs, and function declarations
  *        for the simplified demonstration KMIP server test application.
  * 
- *        The demo server will return a KMIP response containing a defined
- *        demonstration ID and value, if a valid KMIP request for a key
- *        with that same demonstration ID is received.
+ *        The demo server holds a set of keys in memory (by default, just a
+ *        defined demonstration ID and value) and answers KMIP Get requests,
+ *        single or batched, for them from concurrent TLS clients.
  */
 
 #ifndef KMYTH_DEMO_KMIP_SERVER_H
 #define KMYTH_DEMO_KMIP_SERVER_H
 
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include <kmyth/metrics.h>
 
 #include "demo_tls_util.h"
 
@@ -33,6 +42,107 @@
                           0xFF, 0x7A, 0x79, 0x1D, 0xFE, 0x0A, 0xC0, 0xCE, \
                           0xDC, 0xD3, 0x08, 0x48, 0x24, 0xE7, 0xA0, 0x08 }
 
+/**
+ * @brief Default number of worker threads serving TLS connections
+ */
+#define DEMO_KMIP_SERVER_DEFAULT_WORKERS 8
+
+/**
+ * @brief Most worker threads the server may be configured with
+ */
+#define DEMO_KMIP_SERVER_MAX_WORKERS 1024
+
+/**
+ * @brief Accepted connections that may wait for a free worker
+ */
+#define DEMO_KMIP_SERVER_BACKLOG 1024
+
+/**
+ * @brief Seconds a connection may sit idle between requests before the
+ *        server closes it
+ */
+#define DEMO_KMIP_SERVER_IDLE_TIMEOUT 30
+
+/**
+ * @brief A KMIP message starts with a TTLV header: a three byte tag, the
+ *        Structure type and the four byte length of the value
+ */
+#define DEMO_KMIP_TTLV_HEADER_LEN 8
+#define DEMO_KMIP_TTLV_TYPE_STRUCTURE 0x01
+
+/**
+ * @brief Largest KMIP request the server reads
+ */
+#define DEMO_KMIP_SERVER_MAX_REQUEST_SIZE (64 * 1024)
+
+/**
+ * @brief Latency samples kept per statistics interval (later requests in
+ *        the interval are counted, but not sampled)
+ */
+#define DEMO_KMIP_SERVER_MAX_LATENCY_SAMPLES (1024 * 1024)
+
+/**
+ * @brief One key held by the server
+ */
+typedef struct DemoKey
+{
+  unsigned char *id;
+  size_t id_len;
+  unsigned char *val;
+  size_t val_len;
+} DemoKey;
+
+/**
+ * @brief Keys held by the server, sorted by ID. The store is only written
+ *        before the workers start, so lookups need no locking.
+ */
+typedef struct DemoKeyStore
+{
+  DemoKey *keys;
+  size_t count;
+} DemoKeyStore;
+
+/**
+ * @brief Request counts and latency samples since statistics were last
+ *        reported
+ */
+typedef struct DemoServerStats
+{
+  pthread_mutex_t lock;
+  uint64_t requests;
+  uint64_t keys_served;
+  uint64_t keys_missing;
+  uint64_t errors;
+  uint64_t connections;
+  uint64_t *latencies_us;
+  size_t latency_count;
+  size_t latency_size;
+} DemoServerStats;
+
+/**
+ * @brief Accepted TLS connections waiting for a worker thread
+ */
+typedef struct DemoConnQueue
+{
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  BIO *conns[DEMO_KMIP_SERVER_BACKLOG];
+  size_t head;
+  size_t count;
+  bool closed;
+} DemoConnQueue;
+
+/**
+ * @brief A worker thread, and the socket of the connection it is serving
+ *        (guarded by the connection queue lock)
+ */
+typedef struct DemoWorker
+{
+  pthread_t thread;
+  struct DemoServer *server;
+  int fd;
+} DemoWorker;
+
 /**
  * @brief This struct consolidates configuration and state information for a
  *        very simplified KMIP server replacement 'node' used to demonstrate
@@ -43,8 +153,15 @@
 typedef struct DemoServer
 {
   TLSPeer tlsconn;
-  unsigned char demo_key_id[DEMO_OP_KEY_ID_LEN];
-  unsigned char demo_key_val[DEMO_OP_KEY_VAL_LEN];
+  char *key_file_path;
+  int worker_count;
+  int max_conns;
+  int stats_interval;
+  DemoKeyStore store;
+  DemoServerStats stats;
+  DemoConnQueue queue;
+  DemoWorker *workers;
+  int workers_started;
 } DemoServer;
 
 /**
@@ -57,6 +174,11 @@ static const struct option demo_kmip_server_longopts[] = {
   {"ca-cert", required_argument, 0, 'C'},
   // network options
   {"port", required_argument, 0, 'p'},
+  {"max-conns", required_argument, 0, 'm'},
+  // key store and load options
+  {"key-file", required_argument, 0, 'f'},
+  {"workers", required_argument, 0, 'w'},
+  {"stats-interval", required_argument, 0, 's'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
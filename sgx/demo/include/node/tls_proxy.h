@@ -8,7 +8,15 @@
 #ifndef KMYTH_TLS_PROXY_H
 #define KMYTH_TLS_PROXY_H
 
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <kmyth/metrics.h>
 
 #include "retrieve_key_protocol.h"
 
@@ -16,6 +24,8 @@
 #include "demo_tls_util.h"
 #include "tls_util.h"
 
+struct ProxyUpstreamPool;
+
 /**
  * @brief This struct consolidates complete (overall) state information
  *        required for a 'TLS Proxy' node to complete the kmyth
@@ -27,8 +37,208 @@ typedef struct TLSProxy
 {
   TLSPeer tlsconn;
   ECDHPeer ecdhconn;
+
+  // Prometheus text format file kept up to date with the proxy's metrics
+  // (NULL if not requested)
+  char *metrics_path;
+
+  // number of worker threads serving ECDH sessions from one event loop
+  // (0 forks a process per session instead)
+  int workers;
+
+  // the most ECDH sessions held open at once (by the event loop, or as
+  // forked session processes)
+  int max_sessions;
+
+  // seconds a client may take to start, and again to finish, sending each
+  // protocol message (0: no limit)
+  int stage_timeout;
+
+  // connection backlog of the listening ECDH socket (0: 1 when forking a
+  // process per session, SOMAXCONN for the event loop)
+  int backlog;
+
+  // long-lived TLS connections to the KMIP server shared by the event
+  // loop's sessions (0 gives each session a connection of its own)
+  int upstream_conns;
+
+  // the event loop's shared KMIP server connections (NULL if the session
+  // connects for itself)
+  struct ProxyUpstreamPool *upstream;
+
+  // ephemeral ECDH key pairs the event loop keeps generated ahead of use
+  // (0 has each session generate its own)
+  int ephemeral_keys;
+
+  // the event loop's ephemeral key pair pool (NULL if the session
+  // generates its own key pair)
+  ECDHKeyPool *keypool;
+
+  // session resumption: seconds for which the session tickets descended
+  // from a full ECDH session are accepted (0 issues none), and how many
+  // times that session may be resumed
+  int ticket_lifetime;
+  int ticket_resumptions;
 } TLSProxy;
 
+/**
+ * @brief Default bound on the ECDH sessions open at once
+ */
+#define PROXY_DEFAULT_MAX_SESSIONS 256
+
+/**
+ * @brief Default time, in seconds, a client has to start (and then to
+ *        finish) sending each protocol message before its session is closed
+ */
+#define PROXY_DEFAULT_STAGE_TIMEOUT 30
+
+/**
+ * @brief Limits on the session timeout and listen backlog options
+ */
+#define PROXY_MAX_STAGE_TIMEOUT 3600
+#define PROXY_MAX_BACKLOG 65535
+
+/**
+ * @brief Limits on the concurrency options
+ */
+#define PROXY_MAX_WORKERS 256
+#define PROXY_MAX_SESSIONS 65536
+#define PROXY_MAX_UPSTREAM_CONNS 64
+#define PROXY_MAX_EPHEMERAL_KEYS 4096
+
+/**
+ * @brief Limits on the session resumption options
+ */
+#define PROXY_MAX_TICKET_LIFETIME 86400
+#define PROXY_MAX_TICKET_RESUMPTIONS 65535
+
+/**
+ * @brief Default number of times a full ECDH session may be resumed (when
+ *        session tickets are issued at all)
+ */
+#define PROXY_DEFAULT_TICKET_RESUMPTIONS 16
+
+/**
+ * @brief Default number of shared KMIP server connections in event loop mode
+ */
+#define PROXY_DEFAULT_UPSTREAM_CONNS 4
+
+/**
+ * @brief Default number of ephemeral ECDH key pairs kept ready in event
+ *        loop mode
+ */
+#define PROXY_DEFAULT_EPHEMERAL_KEYS 32
+
+/**
+ * @brief Readiness events taken from epoll per wait in event loop mode
+ */
+#define PROXY_EPOLL_EVENTS 64
+
+/**
+ * @brief The part of the 'retrieve key' protocol an event loop session is
+ *        waiting for its client to send next (a 'Resume Request' comes in
+ *        place of the 'Client Hello' and needs no second message)
+ */
+typedef enum ProxySessionPhase
+{
+  PROXY_PHASE_CLIENT_HELLO,
+  PROXY_PHASE_KEY_REQUEST
+} ProxySessionPhase;
+
+/**
+ * @brief Who owns an event loop session table slot: nobody (FREE), epoll
+ *        (WAITING, for the client's next message) or a worker (RUNNING,
+ *        queued or handling that message)
+ */
+typedef enum ProxySessionState
+{
+  PROXY_SESSION_FREE,
+  PROXY_SESSION_WAITING,
+  PROXY_SESSION_RUNNING
+} ProxySessionState;
+
+/**
+ * @brief One ECDH session in the event loop's session table. The embedded
+ *        TLSProxy shares the configuration (keys, certificates, TLS
+ *        context and server address) of the listening proxy, but has its
+ *        own ECDH session state and TLS connection.
+ */
+typedef struct ProxySession
+{
+  TLSProxy conn;
+  ProxySessionState state;
+  ProxySessionPhase phase;
+  uint64_t deadline_us;
+  int number;
+} ProxySession;
+
+/**
+ * @brief One long-lived TLS connection to the KMIP server. A session holds
+ *        it (in_use) for one KMIP request and response at a time; the BIO
+ *        is NULL until the connection is first needed, and again after a
+ *        failure or once the server has closed it.
+ */
+typedef struct ProxyUpstreamConn
+{
+  BIO *bio;
+  bool in_use;
+} ProxyUpstreamConn;
+
+/**
+ * @brief The KMIP server connections shared by the event loop's sessions,
+ *        made from the listening proxy's TLS configuration and context
+ */
+typedef struct ProxyUpstreamPool
+{
+  TLSPeer *tlsconn;
+
+  // guards the in_use flags (a connection's BIO belongs to its holder)
+  pthread_mutex_t lock;
+  pthread_cond_t available;
+  ProxyUpstreamConn *conns;
+  int conn_count;
+} ProxyUpstreamPool;
+
+/**
+ * @brief State of the event loop mode: a bounded table of ECDH sessions,
+ *        an epoll instance watching the listening socket and the sessions
+ *        waiting on their clients, and a pool of worker threads fed
+ *        through a queue of sessions that have a message to read.
+ */
+typedef struct ProxyEventLoop
+{
+  TLSProxy *proxy;
+
+  int epoll_fd;
+  // eventfd the workers signal when they free a session
+  int wake_fd;
+
+  ProxySession *sessions;
+  int session_count;
+  int active_sessions;
+  int *free_slots;
+  int free_count;
+
+  // ECDH connections accepted so far, and whether more are wanted
+  int accepted;
+  bool accepting;
+
+  // guards the session states, the free slots, the queue and the epoll
+  // registrations of the sessions
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  ProxySession **queue;
+  int queue_head;
+  int queue_length;
+  bool stopping;
+
+  pthread_t *threads;
+  int thread_count;
+
+  ProxyUpstreamPool upstream;
+  ECDHKeyPool keypool;
+} ProxyEventLoop;
+
 /**
  * @brief Command-line options for the 'TLS proxy' application
  */
@@ -45,6 +255,18 @@ static const struct option proxy_longopts[] = {
   {"client-cert", required_argument, 0, 'U'},
   // Test options
   {"maxconn", required_argument, 0, 'm'},
+  // Metrics
+  {"metrics-file", required_argument, 0, 'M'},
+  // Concurrency
+  {"workers", required_argument, 0, 'w'},
+  {"max-sessions", required_argument, 0, 's'},
+  {"upstream-conns", required_argument, 0, 'k'},
+  {"ephemeral-keys", required_argument, 0, 'e'},
+  {"stage-timeout", required_argument, 0, 'S'},
+  {"backlog", required_argument, 0, 'b'},
+  // Session resumption
+  {"ticket-lifetime", required_argument, 0, 't'},
+  {"ticket-resumptions", required_argument, 0, 'T'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -9,19 +9,24 @@
 #ifndef _KMYTH_DEMO_ECDH_UTIL_H_
 #define _KMYTH_DEMO_ECDH_UTIL_H_
 
+#include <errno.h>
 #include <getopt.h>
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -30,10 +35,12 @@
 
 #include <kmyth/kmyth_log.h>
 #include <kmyth/memory_util.h>
+#include <kmyth/metrics.h>
 
 #include "aes_gcm.h"
 #include "ecdh_util.h"
 #include "kmip_util.h"
+#include "retrieve_key_protocol.h"
 #include "socket_util.h"
 
 
@@ -51,10 +58,24 @@ typedef struct ECDHConfig
   X509 *local_sign_cert;
   char *remote_sign_cert_path;
   X509 *remote_sign_cert;
+  // the remote certificate prepared once for every session's checks
+  ECPeerCert remote_peer;
+  // (server side) the local identity part of every 'Server Hello', encoded
+  // once the local certificate is loaded
+  ByteBuffer server_hello_template;
   char *port;
   char *ip;
   int session_limit;
   int listen_socket_fd;
+  // session resumption (server side): how long, in seconds, the tickets
+  // descended from one full session stay valid (0 issues none), how many
+  // times that session may be resumed, and the key tickets are sealed with
+  int ticket_lifetime;
+  int ticket_resumptions;
+  ByteBuffer ticket_key;
+  // (server side) how long, in milliseconds, a client has to send each
+  // protocol message once it has started to (0: no limit)
+  unsigned int stage_timeout_ms;
 } ECDHConfig;
 
 /**
@@ -69,6 +90,7 @@ typedef struct RetrieveKeyProtocol
   ECDHMessage key_request;
   ByteBuffer kmip_response;
   ECDHMessage key_response;
+  ByteBuffer ticket;
 } RetrieveKeyProtocol;
 
 /**
@@ -85,6 +107,13 @@ typedef struct ECDHSession
   ByteBuffer request_symkey;
   ByteBuffer response_symkey;
   RetrieveKeyProtocol proto;
+  // whether the session was resumed from a ticket (its first message was a
+  // 'Resume Request', which also carried the KMIP request), the secret the
+  // session's own ticket carries, and the limits that ticket inherits
+  bool resumed;
+  ByteBuffer resume_secret;
+  time_t ticket_issued;
+  int ticket_resumptions_left;
 } ECDHSession;
 
 /**
@@ -99,8 +128,38 @@ typedef struct ECDHPeer
 } ECDHPeer;
 
 
+/**
+ * @brief A supply of ephemeral ECDH key pairs that a background thread
+ *        generates ahead of use and keeps topped up, so that session
+ *        setup does not have to wait for key generation. Each key pair is
+ *        handed out to one session only.
+ */
+typedef struct ECDHKeyPool
+{
+  // guards the key pairs held and the stopping flag
+  pthread_mutex_t lock;
+  pthread_cond_t refill;
+  EVP_PKEY **keys;
+  int count;
+  int size;
+  bool stopping;
+
+  pthread_t thread;
+  bool started;
+} ECDHKeyPool;
+
+
 #define UNSET_FD -1
 
+/**
+ * @brief Size (in bytes) of the key session tickets are sealed with, and
+ *        of a ticket's contents before sealing (issue time, resumptions
+ *        left, client certificate digest and resumption secret)
+ */
+#define DEMO_ECDH_TICKET_KEY_SIZE 32
+#define DEMO_ECDH_TICKET_PT_SIZE (8 + 2 + SHA256_DIGEST_LENGTH + \
+                                  KMYTH_ECDH_RESUME_SECRET_SIZE)
+
 
 /**
  * @brief Initializes ECDH 'node' with the client/server role specified by
@@ -125,6 +184,19 @@ void demo_ecdh_init(bool clientMode, ECDHPeer * ecdhconn);
  */
 void demo_ecdh_cleanup(ECDHPeer * ecdhconn);
 
+/**
+ * @brief Clean-up (e.g., re-initialize) the session state of an ECDH peer:
+ *        closes the session socket (if open) and clears and frees the
+ *        session keys and protocol messages, leaving the configuration
+ *        (loaded keys and certificates) alone.
+ *
+ * @param[out] session    Pointer to ECDHSession struct being cleaned up and
+ *                        reset
+ * 
+ * @return none
+ */
+void demo_ecdh_session_cleanup(ECDHSession * session);
+
 /**
  * @brief Processing that must occur in response to an error, prior to exit.
  *
@@ -198,10 +270,15 @@ int demo_ecdh_load_remote_sign_cert(ECDHPeer * ecdhconn,
  * 
  * @param[out] msg        Pointer to ECDHMessage struct into which the
  *                        received message will be stored
+ *
+ * @param[in]  timeout_ms How long, in milliseconds, the whole message may
+ *                        take to arrive (0 for no limit beyond the
+ *                        socket's own receive timeout)
  * 
  * @return none
  */
-int demo_ecdh_recv_msg(int socket_fd, ECDHMessage * msg);
+int demo_ecdh_recv_msg(int socket_fd, ECDHMessage * msg,
+                       unsigned int timeout_ms);
 
 /**
  * @brief Send a 'retrieve key' protocol message to an ECDH peer.
@@ -218,7 +295,9 @@ int demo_ecdh_send_msg(int socket_fd, ECDHMessage * msg);
 
 /**
  * @brief Obtain a 'retrieve key' protocol 'Client Hello' message from
- *        an ECDH peer.
+ *        an ECDH peer. If the peer sends a 'Resume Request' instead, the
+ *        session is resumed (see demo_ecdh_resume_session()) and marked
+ *        as such.
  *
  * @param[inout] ecdh_svr  Pointer to ECDHPeer struct containing
  *                         configuration and state information for
@@ -228,6 +307,51 @@ int demo_ecdh_send_msg(int socket_fd, ECDHMessage * msg);
  */
 int demo_ecdh_recv_client_hello_msg(ECDHPeer * ecdh_svr);
 
+/**
+ * @brief Turn on session resumption for an ECDH server: generate the key
+ *        its session tickets are sealed with, and set their limits.
+ *
+ * @param[inout] config      Pointer to the server's ECDHConfig struct
+ *
+ * @param[in]  lifetime      Seconds for which the tickets descended from a
+ *                           full session are accepted (counted from that
+ *                           session, however often it is resumed)
+ *
+ * @param[in]  resumptions   Number of times a full session may be resumed
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+int demo_ecdh_enable_tickets(ECDHConfig * config, int lifetime,
+                             int resumptions);
+
+/**
+ * @brief Resume a session from the 'Resume Request' message received in
+ *        place of a 'Client Hello': check the ticket it presents, derive
+ *        the session keys from the ticket's resumption secret, and decrypt
+ *        the KMIP request the message carries.
+ *
+ * @param[inout] ecdh_svr  Pointer to ECDHPeer struct containing
+ *                         configuration and state information for
+ *                         a 'retrieve key' protocol session
+ * 
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error (including a
+ *         ticket that is not accepted)
+ */
+int demo_ecdh_resume_session(ECDHPeer * ecdh_svr);
+
+/**
+ * @brief Seal a session ticket with which the client can resume the
+ *        session later, if resumption is on and the session's limits
+ *        allow another resumption. (Otherwise the ticket is left empty.)
+ *
+ * @param[inout] ecdh_svr  Pointer to ECDHPeer struct containing
+ *                         configuration and state information for
+ *                         a 'retrieve key' protocol session
+ * 
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+int demo_ecdh_issue_ticket(ECDHPeer * ecdh_svr);
+
 /**
  * @brief Compose and send a 'retrieve key' 'Server Hello' protocol
  *        message to an ECDH peer.
@@ -266,4 +390,40 @@ int demo_ecdh_get_session_key(ECDHPeer * ecdh_svr);
  */
 int demo_ecdh_recv_key_request_msg(ECDHPeer * ecdh_svr);
 
+/**
+ * @brief Set up an ephemeral key pair pool and start the thread that
+ *        fills it.
+ *
+ * @param[out] pool       Pointer to ECDHKeyPool struct being set up
+ *
+ * @param[in]  size       Number of key pairs to keep ready
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+int demo_ecdh_keypool_init(ECDHKeyPool * pool, int size);
+
+/**
+ * @brief Take an ephemeral key pair for a new session: one from the pool
+ *        if it holds any (waking the thread to replace it), or else one
+ *        generated on the spot.
+ *
+ * @param[inout] pool     Pointer to ECDHKeyPool struct to take from (NULL
+ *                        to always generate a new key pair)
+ *
+ * @param[out] keypair    Pointer to the key pair, which the caller frees
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+int demo_ecdh_keypool_take(ECDHKeyPool * pool, EVP_PKEY ** keypair);
+
+/**
+ * @brief Stop the thread filling an ephemeral key pair pool and free the
+ *        key pairs left in it.
+ *
+ * @param[inout] pool     Pointer to ECDHKeyPool struct being cleaned up
+ *
+ * @return none
+ */
+void demo_ecdh_keypool_cleanup(ECDHKeyPool * pool);
+
 #endif    // _KMYTH_DEMO_ECDH_UTIL_H_
@@ -6,6 +6,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <getopt.h>
 #include <errno.h>
 #include <string.h>
@@ -29,6 +31,7 @@
 #include "socket_util.h"
 
 #include "kmyth_enclave_common.h"
+#include "enclave_util.h"
 
 #include "kmyth_sgx_retrieve_key_demo_enclave_u.h"
 
@@ -69,7 +72,7 @@ static sgx_status_t initialize_enclave(const char *enclave_fn,
 {
   sgx_status_t ret = SGX_ERROR_UNEXPECTED;
 
-  ret = sgx_create_enclave(enclave_fn, SGX_DEBUG_FLAG, NULL, NULL, eid, NULL);
+  ret = kmyth_sgx_create_enclave(enclave_fn, eid);
   return ret;
 }
 
@@ -210,14 +213,28 @@ int main(int argc, char **argv)
   }
   demo_log(LOG_DEBUG, "initialized SGX enclave - EID = 0x%016lx", eid);
 
+  // the retrieved key is kept in the enclave's unsealed data table
+  int retval = -1;
+
+  sgx_ret = kmyth_unsealed_data_table_initialize(eid, &retval);
+  if (sgx_ret != SGX_SUCCESS || retval != 0)
+  {
+    demo_log(LOG_ERR, "kmyth_unsealed_data_table_initialize() failed");
+    kmyth_free(client_ec_sign_key_bytes);
+    kmyth_free(client_ec_cert_bytes);
+    kmyth_free(server_ec_cert_bytes);
+    sgx_destroy_enclave(eid);
+    return EXIT_FAILURE;
+  }
+
   // make ECALL to retrieve key into enclave from the key server
   demo_log(LOG_DEBUG, "invoking 'retrieve key' ECALL ...");
-  int retval = -1;
 
   const char *server_host = SERVER_HOST;
   int server_host_len = strlen(server_host) + 1;
   const char *server_port = SERVER_PORT;
   int server_port_len = strlen(server_port) + 1;
+  uint64_t key_handle = 0;
 
   sgx_ret = kmyth_enclave_retrieve_key_from_server(eid,
                                                    &retval,
@@ -232,19 +249,58 @@ int main(int argc, char **argv)
                                                    server_port,
                                                    server_port_len,
                                                    (unsigned char *) KEY_ID,
-                                                   KEY_ID_LEN);
+                                                   KEY_ID_LEN,
+                                                   &key_handle);
 
-  free(client_ec_sign_key_bytes);
-  free(client_ec_cert_bytes);
-  free(server_ec_cert_bytes);
+  kmyth_free(client_ec_sign_key_bytes);
+  kmyth_free(client_ec_cert_bytes);
+  kmyth_free(server_ec_cert_bytes);
 
+  if (sgx_ret != SGX_SUCCESS || retval != EXIT_SUCCESS)
+  {
+    demo_log(LOG_ERR, "kmyth_enclave_retrieve_key_from_server() failed");
+    kmyth_unsealed_data_table_cleanup(eid, &retval);
+    sgx_destroy_enclave(eid);
+    return EXIT_FAILURE;
+  }
+
+  // use the retrieved key, by its handle, for a round trip through
+  // AES-GCM without it leaving the enclave
+  const char *message = "kmyth retrieve key demo";
+  size_t message_len = strlen(message);
+  unsigned char ciphertext[64] = { 0 };
+  size_t ciphertext_len = 0;
+  unsigned char plaintext[64] = { 0 };
+  size_t plaintext_len = 0;
+  int crypto_ret = -1;
+
+  sgx_ret = kmyth_enclave_encrypt_with_handle(eid, &crypto_ret, key_handle,
+                                              (const uint8_t *) message,
+                                              message_len, ciphertext,
+                                              sizeof(ciphertext),
+                                              &ciphertext_len);
+  if (sgx_ret == SGX_SUCCESS && crypto_ret == 0)
+  {
+    sgx_ret = kmyth_enclave_decrypt_with_handle(eid, &crypto_ret, key_handle,
+                                                ciphertext, ciphertext_len,
+                                                plaintext, sizeof(plaintext),
+                                                &plaintext_len);
+  }
+
+  bool discarded = false;
+
+  kmyth_enclave_discard_key_handle(eid, &discarded, key_handle);
+  kmyth_unsealed_data_table_cleanup(eid, &retval);
   sgx_destroy_enclave(eid);
 
-  if (sgx_ret)
+  if (sgx_ret != SGX_SUCCESS || crypto_ret != 0
+      || plaintext_len != message_len
+      || memcmp(plaintext, message, message_len) != 0)
   {
-    demo_log(LOG_ERR, "kmyth_enclave_retrieve_key_from_server() failed");
+    demo_log(LOG_ERR, "encryption with the retrieved key failed");
     return EXIT_FAILURE;
   }
+  demo_log(LOG_DEBUG, "encrypted and decrypted with the retrieved key");
 
   demo_log(LOG_DEBUG, "retrieve key demo complete");
 
@@ -1,8 +1,14 @@
 /**
  * @file demo_kmip_server.c
- * 
+ *
  * @brief A very simplified KMIP server application used only to demonstrate
  *        the kmyth use of a TLS proxy to retrieve a key from a KMIP server.
+ *
+ *        Keys are held in memory. Worker threads serve concurrent TLS
+ *        connections, each of which may carry any number of KMIP Get
+ *        requests (single or batched), and per-request latencies are
+ *        reported so that the server can be used to benchmark the proxy
+ *        and enclave path.
  */
 
 #include "demo_kmip_server.h"
@@ -13,12 +19,32 @@
 
 static unsigned char demo_op_key_val[DEMO_OP_KEY_VAL_LEN] = DEMO_OP_KEY_VAL;
 
+// set by SIGINT or SIGTERM to shut the server down
+static volatile sig_atomic_t demo_kmip_server_stop = 0;
+
 /*****************************************************************************
  * demo_kmip_server_init()
  ****************************************************************************/
 static void demo_kmip_server_init(DemoServer * demo_server)
 {
   secure_memset(demo_server, 0, sizeof(DemoServer));
+
+  demo_server->worker_count = DEMO_KMIP_SERVER_DEFAULT_WORKERS;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_free_keys()
+ ****************************************************************************/
+static void demo_kmip_server_free_keys(DemoKeyStore * store)
+{
+  for (size_t i = 0; i < store->count; i++)
+  {
+    kmyth_clear_and_free(store->keys[i].id, store->keys[i].id_len);
+    kmyth_clear_and_free(store->keys[i].val, store->keys[i].val_len);
+  }
+  free(store->keys);
+  store->keys = NULL;
+  store->count = 0;
 }
 
 /*****************************************************************************
@@ -28,6 +54,21 @@ static void demo_kmip_server_cleanup(DemoServer * demo_server)
 {
   demo_tls_cleanup(&(demo_server->tlsconn));
 
+  demo_kmip_server_free_keys(&(demo_server->store));
+
+  if (demo_server->key_file_path != NULL)
+  {
+    free(demo_server->key_file_path);
+  }
+  if (demo_server->stats.latencies_us != NULL)
+  {
+    free(demo_server->stats.latencies_us);
+  }
+  if (demo_server->workers != NULL)
+  {
+    free(demo_server->workers);
+  }
+
   demo_kmip_server_init(demo_server);
 }
 
@@ -52,11 +93,22 @@ static void demo_kmip_server_usage(const char *prog)
     "TLS Connection Information --\n"
     "  -k or --key      Local server private key PEM file name\n"
     "  -c or --cert     Local server certificate PEM file name\n"
-    "  -C or --ca       Certification Authority (CA) certificate file name"
+    "  -C or --ca       Certification Authority (CA) certificate file name\n"
     "Network Information --\n"
     "  -p or --port     The port number the server will listen on\n"
+    "  -m or --max-conns\n"
+    "                   Exit after serving this many connections\n"
+    "                   (default: serve until interrupted)\n"
+    "Key Store and Load --\n"
+    "  -f or --key-file Keys to serve, one '<ID> <hex key>' line each\n"
+    "                   (default: the single demonstration key, ID '%s')\n"
+    "  -w or --workers  Number of connections served at once (default: %d)\n"
+    "  -s or --stats-interval\n"
+    "                   Report request latencies every this many seconds\n"
+    "                   (default: only at exit)\n"
     "Misc --\n"
-    "  -h or --help     Help (displays this usage)\n\n", prog);
+    "  -h or --help     Help (displays this usage)\n\n", prog,
+    DEMO_OP_KEY_ID_STR, DEMO_KMIP_SERVER_DEFAULT_WORKERS);
 }
 
 /*****************************************************************************
@@ -79,7 +131,7 @@ static void demo_kmip_server_get_options(DemoServer * demo_server,
   demo_server->tlsconn.host = NULL;
 
   while ((options =
-          getopt_long(argc, argv, "k:c:C:p:m:h",
+          getopt_long(argc, argv, "k:c:C:p:m:f:w:s:h",
                       demo_kmip_server_longopts, &option_index)) != -1)
   {
     switch (options)
@@ -98,6 +150,19 @@ static void demo_kmip_server_get_options(DemoServer * demo_server,
     case 'p':
       demo_server->tlsconn.port = strdup(optarg);
       break;
+    case 'm':
+      demo_server->max_conns = atoi(optarg);
+      break;
+    // key store and load
+    case 'f':
+      demo_server->key_file_path = strdup(optarg);
+      break;
+    case 'w':
+      demo_server->worker_count = atoi(optarg);
+      break;
+    case 's':
+      demo_server->stats_interval = atoi(optarg);
+      break;
     // Misc
     case 'h':
       demo_kmip_server_usage(argv[0]);
@@ -109,7 +174,7 @@ static void demo_kmip_server_get_options(DemoServer * demo_server,
 }
 
 /*****************************************************************************
- * demo_kmip_server_get_options()
+ * demo_kmip_server_check_options()
  ****************************************************************************/
 static void demo_kmip_server_check_options(DemoServer * demo_server)
 {
@@ -135,6 +200,23 @@ static void demo_kmip_server_check_options(DemoServer * demo_server)
     fprintf(stderr, "file path for server's certificate required\n");
     err = true;
   }
+  if (demo_server->worker_count < 1 ||
+      demo_server->worker_count > DEMO_KMIP_SERVER_MAX_WORKERS)
+  {
+    fprintf(stderr, "worker count must be between 1 and %d\n",
+                    DEMO_KMIP_SERVER_MAX_WORKERS);
+    err = true;
+  }
+  if (demo_server->max_conns < 0)
+  {
+    fprintf(stderr, "connection limit must not be negative\n");
+    err = true;
+  }
+  if (demo_server->stats_interval < 0)
+  {
+    fprintf(stderr, "statistics interval must not be negative\n");
+    err = true;
+  }
 
   if (err)
   {
@@ -143,6 +225,209 @@ static void demo_kmip_server_check_options(DemoServer * demo_server)
   }
 }
 
+/*****************************************************************************
+ * demo_kmip_server_compare_keys()
+ ****************************************************************************/
+static int demo_kmip_server_compare_keys(const void *a, const void *b)
+{
+  const DemoKey *x = (const DemoKey *) a;
+  const DemoKey *y = (const DemoKey *) b;
+  size_t len = (x->id_len < y->id_len) ? x->id_len : y->id_len;
+  int cmp = memcmp(x->id, y->id, len);
+
+  if (cmp != 0)
+  {
+    return cmp;
+  }
+  return (x->id_len > y->id_len) - (x->id_len < y->id_len);
+}
+
+/*****************************************************************************
+ * demo_kmip_server_add_key()
+ ****************************************************************************/
+static int demo_kmip_server_add_key(DemoKeyStore * store, size_t *size,
+                                    const unsigned char *id, size_t id_len,
+                                    const unsigned char *val, size_t val_len)
+{
+  if (store->count == *size)
+  {
+    size_t new_size = (*size > 0) ? 2 * *size : 64;
+    DemoKey *keys = realloc(store->keys, new_size * sizeof(DemoKey));
+
+    if (keys == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate key store");
+      return EXIT_FAILURE;
+    }
+    store->keys = keys;
+    *size = new_size;
+  }
+
+  DemoKey *key = &(store->keys[store->count]);
+
+  key->id = malloc(id_len);
+  key->val = malloc(val_len);
+  if (key->id == NULL || key->val == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate key store entry");
+    free(key->id);
+    free(key->val);
+    return EXIT_FAILURE;
+  }
+  memcpy(key->id, id, id_len);
+  key->id_len = id_len;
+  memcpy(key->val, val, val_len);
+  key->val_len = val_len;
+  store->count++;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_parse_hex()
+ ****************************************************************************/
+static int demo_kmip_server_parse_hex(const char *hex,
+                                      unsigned char *out, size_t *out_len)
+{
+  size_t hex_len = strlen(hex);
+
+  if (hex_len == 0 || hex_len % 2 != 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  for (size_t i = 0; i < hex_len / 2; i++)
+  {
+    unsigned int byte = 0;
+
+    if (!isxdigit((unsigned char) hex[2 * i]) ||
+        !isxdigit((unsigned char) hex[2 * i + 1]) ||
+        sscanf(hex + 2 * i, "%2x", &byte) != 1)
+    {
+      return EXIT_FAILURE;
+    }
+    out[i] = (unsigned char) byte;
+  }
+  *out_len = hex_len / 2;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_load_keys()
+ ****************************************************************************/
+static int demo_kmip_server_load_keys(DemoServer * demo_server)
+{
+  DemoKeyStore *store = &(demo_server->store);
+  size_t size = 0;
+
+  // without a key file, serve just the demonstration key
+  if (demo_server->key_file_path == NULL)
+  {
+    return demo_kmip_server_add_key(store, &size,
+                                    (unsigned char *) DEMO_OP_KEY_ID_STR,
+                                    strlen(DEMO_OP_KEY_ID_STR),
+                                    demo_op_key_val, DEMO_OP_KEY_VAL_LEN);
+  }
+
+  FILE *key_file = fopen(demo_server->key_file_path, "r");
+
+  if (key_file == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to open key file (%s)",
+                       demo_server->key_file_path);
+    return EXIT_FAILURE;
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  size_t line_num = 0;
+  int ret = EXIT_SUCCESS;
+
+  while (ret == EXIT_SUCCESS && getline(&line, &line_size, key_file) != -1)
+  {
+    line_num++;
+
+    // each line is '<ID> <hex key>'; blank and '#' lines are skipped
+    char *save = NULL;
+    char *id = strtok_r(line, " \t\r\n", &save);
+
+    if (id == NULL || id[0] == '#')
+    {
+      continue;
+    }
+
+    char *hex = strtok_r(NULL, " \t\r\n", &save);
+    unsigned char val[KMYTH_TLS_MAX_MSG_SIZE / 4];
+    size_t val_len = 0;
+
+    if (hex == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL ||
+        strlen(hex) > 2 * sizeof(val) ||
+        EXIT_SUCCESS != demo_kmip_server_parse_hex(hex, val, &val_len))
+    {
+      kmyth_log(LOG_ERR, "invalid key at line %zu of key file (%s)",
+                         line_num, demo_server->key_file_path);
+      ret = EXIT_FAILURE;
+    }
+    else
+    {
+      ret = demo_kmip_server_add_key(store, &size,
+                                     (unsigned char *) id, strlen(id),
+                                     val, val_len);
+    }
+    kmyth_clear(val, sizeof(val));
+  }
+
+  if (line != NULL)
+  {
+    kmyth_clear_and_free(line, line_size);
+  }
+  fclose(key_file);
+
+  if (ret != EXIT_SUCCESS)
+  {
+    return EXIT_FAILURE;
+  }
+  if (store->count == 0)
+  {
+    kmyth_log(LOG_ERR, "no keys in key file (%s)",
+                       demo_server->key_file_path);
+    return EXIT_FAILURE;
+  }
+
+  // sort by ID for lookups, which also brings duplicates together
+  qsort(store->keys, store->count, sizeof(DemoKey),
+        demo_kmip_server_compare_keys);
+  for (size_t i = 1; i < store->count; i++)
+  {
+    if (demo_kmip_server_compare_keys(&(store->keys[i - 1]),
+                                      &(store->keys[i])) == 0)
+    {
+      kmyth_log(LOG_ERR, "duplicate key ID '%.*s' in key file (%s)",
+                         (int) store->keys[i].id_len, store->keys[i].id,
+                         demo_server->key_file_path);
+      return EXIT_FAILURE;
+    }
+  }
+
+  kmyth_log(LOG_INFO, "loaded %zu keys from %s", store->count,
+                      demo_server->key_file_path);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_find_key()
+ ****************************************************************************/
+static DemoKey *demo_kmip_server_find_key(DemoKeyStore * store,
+                                          unsigned char *id, size_t id_len)
+{
+  DemoKey target = { .id = id, .id_len = id_len };
+
+  return bsearch(&target, store->keys, store->count, sizeof(DemoKey),
+                 demo_kmip_server_compare_keys);
+}
+
 /*****************************************************************************
  * demo_kmip_server_setup()
  ****************************************************************************/
@@ -152,13 +437,12 @@ static void demo_kmip_server_setup(DemoServer *demo_server)
   demo_server->tlsconn.isClient = false;
   demo_server->tlsconn.host = NULL;
 
-  // specify demonstration key to be served
-  memcpy(demo_server->demo_key_id,
-         (unsigned char[DEMO_OP_KEY_ID_LEN]) DEMO_OP_KEY_ID,
-         DEMO_OP_KEY_ID_LEN);
-  memcpy(demo_server->demo_key_val,
-         (unsigned char[DEMO_OP_KEY_VAL_LEN]) DEMO_OP_KEY_VAL,
-         DEMO_OP_KEY_VAL_LEN);
+  // load the keys to be served
+  if (EXIT_SUCCESS != demo_kmip_server_load_keys(demo_server))
+  {
+    kmyth_log(LOG_ERR, "failed to load keys");
+    demo_kmip_server_error(demo_server);
+  }
 
   // some OpenSSL setup
   SSL_load_error_strings();
@@ -192,55 +476,98 @@ static void demo_kmip_server_setup(DemoServer *demo_server)
   }
 }
 
+/*****************************************************************************
+ * demo_kmip_server_read_full()
+ ****************************************************************************/
+static int demo_kmip_server_read_full(BIO * bio, unsigned char *buf,
+                                      size_t len)
+{
+  size_t done = 0;
+
+  while (done < len)
+  {
+    int bytes_read = BIO_read(bio, buf + done, (int) (len - done));
+
+    if (bytes_read <= 0)
+    {
+      return EXIT_FAILURE;
+    }
+    done += (size_t) bytes_read;
+  }
+
+  return EXIT_SUCCESS;
+}
+
 /*****************************************************************************
  * demo_kmip_server_receive_get_key_request()
  ****************************************************************************/
-static int demo_kmip_server_receive_get_key_request(DemoServer *demo_server,
+static int demo_kmip_server_receive_get_key_request(BIO * bio,
                                                     unsigned char **req_bytes,
                                                     size_t *req_len)
 {
-  kmyth_log(LOG_DEBUG, "waiting to accept TLS connection with client");
-  if (BIO_do_handshake(demo_server->tlsconn.bio) <= 0)
+  *req_bytes = NULL;
+  *req_len = 0;
+
+  // a KMIP request starts with its TTLV header: the tag, the Structure
+  // type and the length of the value
+  unsigned char hdr[DEMO_KMIP_TTLV_HEADER_LEN] = { 0 };
+  int bytes_read = BIO_read(bio, hdr, sizeof(hdr));
+
+  if (bytes_read <= 0)
   {
-    kmyth_log(LOG_ERR, "error completing TLS handshake");
+    // the client closed the connection (or let it sit idle) between
+    // requests
+    return EXIT_SUCCESS;
+  }
+  if (((size_t) bytes_read < sizeof(hdr) &&
+       EXIT_SUCCESS != demo_kmip_server_read_full(bio, hdr + bytes_read,
+                                                  sizeof(hdr) - bytes_read)) ||
+      hdr[0] != 0x42 || hdr[3] != DEMO_KMIP_TTLV_TYPE_STRUCTURE)
+  {
+    kmyth_log(LOG_ERR, "error reading KMIP 'get key' request header");
     return EXIT_FAILURE;
   }
-  kmyth_log(LOG_DEBUG, "TLS client connection - completed handshake");
 
-  // get KMIP 'get key' request from TLS client
-  unsigned char buf[KMYTH_TLS_MAX_MSG_SIZE] = { 0 };
+  size_t value_len = ((size_t) hdr[4] << 24) | ((size_t) hdr[5] << 16) |
+                     ((size_t) hdr[6] << 8) | hdr[7];
 
-  int bytes_read = BIO_read(demo_server->tlsconn.bio,
-                            buf,
-                            KMYTH_TLS_MAX_MSG_SIZE);
-  if (bytes_read <= 0)
+  if (value_len > DEMO_KMIP_SERVER_MAX_REQUEST_SIZE - sizeof(hdr))
   {
-    kmyth_log(LOG_ERR, "error reading KMIP 'get key' request");
+    kmyth_log(LOG_ERR, "KMIP request (%zu bytes) exceeds maximum (%d bytes)",
+                       value_len + sizeof(hdr),
+                       DEMO_KMIP_SERVER_MAX_REQUEST_SIZE);
     return EXIT_FAILURE;
   }
 
   // allocate buffer to hold received KMIP 'get key' request bytes
-  *req_len = (size_t) bytes_read;
+  *req_len = sizeof(hdr) + value_len;
   *req_bytes = malloc(*req_len);
+  if (*req_bytes == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate KMIP request buffer");
+    *req_len = 0;
+    return EXIT_FAILURE;
+  }
+  memcpy(*req_bytes, hdr, sizeof(hdr));
+
+  if (EXIT_SUCCESS != demo_kmip_server_read_full(bio,
+                                                 *req_bytes + sizeof(hdr),
+                                                 value_len))
+  {
+    kmyth_log(LOG_ERR, "error reading KMIP 'get key' request");
+    free(*req_bytes);
+    *req_bytes = NULL;
+    *req_len = 0;
+    return EXIT_FAILURE;
+  }
 
-  // copy received KMIP request from temporary buffer to newly allocated one
-  memcpy(*req_bytes, buf, bytes_read);
-  kmyth_clear(buf, bytes_read);
-
-  kmyth_log(LOG_DEBUG, "received KMIP Request: 0x%02X%02X ... %02X%02X "
-                       "(%d bytes)",
-                       (*req_bytes)[0], (*req_bytes)[1],
-                       (*req_bytes)[*req_len-2],
-                       (*req_bytes)[*req_len-1],
-                       *req_len);
-    
   return EXIT_SUCCESS;
 }
 
 int validate_kmip_get_key_request(unsigned char * kmip_key_req_bytes,
                                   size_t kmip_key_req_len,
-                                  unsigned char ** kmip_key_req_id_bytes,
-                                  size_t * kmip_key_req_id_len)
+                                  kmip_key_result ** kmip_key_req_ids,
+                                  size_t * kmip_key_req_id_count)
 {
   KMIP kmip_ctx = { 0 };
   kmip_init(&kmip_ctx, NULL, 0, KMIP_2_0);
@@ -252,68 +579,69 @@ int validate_kmip_get_key_request(unsigned char * kmip_key_req_bytes,
     return EXIT_FAILURE;
   }
 
-  if (EXIT_SUCCESS != parse_kmip_get_request(&kmip_ctx,
-                                             kmip_key_req_bytes,
-                                             kmip_key_req_len,
-                                             kmip_key_req_id_bytes,
-                                             kmip_key_req_id_len))
+  // a single Get and a batch of them are both accepted
+  if (EXIT_SUCCESS != parse_kmip_batch_get_request(&kmip_ctx,
+                                                   kmip_key_req_bytes,
+                                                   kmip_key_req_len,
+                                                   kmip_key_req_ids,
+                                                   kmip_key_req_id_count))
   {
     kmyth_log(LOG_ERR, "KMIP 'get key' request parsing failed");
     kmip_destroy(&kmip_ctx);
     return EXIT_FAILURE;
   }
 
-  if ((*kmip_key_req_id_len == 0) || (*kmip_key_req_id_bytes == NULL))
-  {
-    kmyth_log(LOG_ERR, "KMIP request specifies invalid (empty) key ID");
-    kmip_destroy(&kmip_ctx);
-    return EXIT_FAILURE;
-  }
-  char *id_str = malloc(*kmip_key_req_id_len + 1);
-  memcpy(id_str, (char *) *kmip_key_req_id_bytes, *kmip_key_req_id_len);
-  *(id_str+*kmip_key_req_id_len) = '\0';
-
-if (*kmip_key_req_id_len != strlen(DEMO_OP_KEY_ID_STR))
-  {
-    kmyth_log(LOG_ERR, "unexpected KMIP ID string length (%d instead of %d)",
-                       *kmip_key_req_id_len, strlen(DEMO_OP_KEY_ID_STR));
-    free(id_str);
-    kmip_destroy(&kmip_ctx);
-    return EXIT_FAILURE;
-  }
-
-  if (strncmp(id_str, DEMO_OP_KEY_ID_STR, *kmip_key_req_id_len) != 0)
-  {
-    kmyth_log(LOG_ERR, "unexpected KMIP ID value ('%s' instead of '%s')",
-                       id_str, DEMO_OP_KEY_ID_STR);
-    free(id_str);
-    kmip_destroy(&kmip_ctx);
-    return EXIT_FAILURE;
-  }
-
-  kmyth_log(LOG_DEBUG, "validated KMIP request for key ID = %s", id_str);
-  free(id_str);
-
   kmip_destroy(&kmip_ctx);
 
   return EXIT_SUCCESS;
 }
 
-int compose_kmip_get_key_response(unsigned char *key_id,
-                                  size_t key_id_len,
+int compose_kmip_get_key_response(DemoKeyStore * store,
+                                  kmip_key_result * req_ids,
+                                  size_t req_id_count,
+                                  size_t * keys_missing,
                                   unsigned char **response_bytes,
                                   size_t *response_len)
 {
+  // the results borrow the request's IDs and the store's keys
+  kmip_key_result *found = calloc(req_id_count, sizeof(kmip_key_result));
+
+  if (found == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate KMIP 'get key' results");
+    return EXIT_FAILURE;
+  }
+
+  *keys_missing = 0;
+  for (size_t i = 0; i < req_id_count; i++)
+  {
+    DemoKey *key = demo_kmip_server_find_key(store, req_ids[i].id,
+                                             req_ids[i].id_len);
+
+    found[i].id = req_ids[i].id;
+    found[i].id_len = req_ids[i].id_len;
+    if (key == NULL)
+    {
+      // answered with a failed batch item, and counted in the statistics
+      (*keys_missing)++;
+      continue;
+    }
+    found[i].key = key->val;
+    found[i].key_len = key->val_len;
+  }
+
   KMIP kmip_ctx = { 0 };
   kmip_init(&kmip_ctx, NULL, 0, KMIP_2_0);
 
-  if (EXIT_SUCCESS != build_kmip_get_response(&kmip_ctx,
-                                              key_id,
-                                              key_id_len,
-                                              demo_op_key_val,
-                                              DEMO_OP_KEY_VAL_LEN,
-                                              response_bytes,
-                                              response_len))
+  int ret = build_kmip_batch_get_response(&kmip_ctx,
+                                          found,
+                                          req_id_count,
+                                          response_bytes,
+                                          response_len);
+
+  free(found);
+
+  if (EXIT_SUCCESS != ret)
   {
     kmyth_log(LOG_ERR, "error building KMIP 'get key' response");
     kmip_destroy(&kmip_ctx);
@@ -323,6 +651,8 @@ int compose_kmip_get_key_response(unsigned char *key_id,
   if (*response_len > kmip_ctx.max_message_size)
   {
     kmyth_log(LOG_ERR, "KMIP response exceeds max message size");
+    kmyth_clear_and_free(*response_bytes, *response_len);
+    *response_bytes = NULL;
     kmip_destroy(&kmip_ctx);
     return EXIT_FAILURE;
   }
@@ -332,14 +662,12 @@ int compose_kmip_get_key_response(unsigned char *key_id,
   return EXIT_SUCCESS;
 }
 
-int send_kmip_get_key_response(DemoServer *server,
+int send_kmip_get_key_response(BIO * bio,
                                unsigned char *kmip_key_resp_bytes,
                                size_t kmip_key_resp_len)
 {
-  struct TLSMessageHeader tls_hdr;
-
   // send the KMIP 'get key' response bytes
-  int bytes_written = BIO_write(server->tlsconn.bio,
+  int bytes_written = BIO_write(bio,
                                 kmip_key_resp_bytes,
                                 kmip_key_resp_len);
   if (bytes_written != kmip_key_resp_len)
@@ -348,99 +676,483 @@ int send_kmip_get_key_response(DemoServer *server,
     return EXIT_FAILURE;
   }
 
-  kmyth_log(LOG_DEBUG, "returned KMIP 'get key' response (%d bytes)",
-                       bytes_written);
-
   return EXIT_SUCCESS;
 }
 
+/*****************************************************************************
+ * demo_kmip_server_record_request()
+ ****************************************************************************/
+static void demo_kmip_server_record_request(DemoServerStats * stats,
+                                            uint64_t usec,
+                                            size_t keys_served,
+                                            size_t keys_missing,
+                                            bool failed)
+{
+  pthread_mutex_lock(&(stats->lock));
 
-int main(int argc, char **argv)
+  stats->requests++;
+  stats->keys_served += keys_served;
+  stats->keys_missing += keys_missing;
+  if (failed)
+  {
+    stats->errors++;
+  }
+
+  if (stats->latency_count == stats->latency_size &&
+      stats->latency_size < DEMO_KMIP_SERVER_MAX_LATENCY_SAMPLES)
+  {
+    size_t size = (stats->latency_size > 0) ? 2 * stats->latency_size : 1024;
+    uint64_t *latencies = realloc(stats->latencies_us,
+                                  size * sizeof(uint64_t));
+
+    if (latencies != NULL)
+    {
+      stats->latencies_us = latencies;
+      stats->latency_size = size;
+    }
+  }
+  if (stats->latency_count < stats->latency_size)
+  {
+    stats->latencies_us[stats->latency_count++] = usec;
+  }
+
+  pthread_mutex_unlock(&(stats->lock));
+}
+
+/*****************************************************************************
+ * demo_kmip_server_compare_u64()
+ ****************************************************************************/
+static int demo_kmip_server_compare_u64(const void *a, const void *b)
 {
-  DemoServer demo_server;
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
 
-  // setup default logging parameters
-  set_app_name("             server ");
-  set_app_version("");
-  set_applog_path("../sgx/sgx_retrievekey_demo.log");
-  set_applog_severity_threshold(DEMO_LOG_LEVEL);
-  set_applog_output_mode(0);
+  return (x > y) - (x < y);
+}
 
-  // process command-line options
-  demo_kmip_server_get_options(&demo_server, argc, argv);
-  demo_kmip_server_check_options(&demo_server);
+/*****************************************************************************
+ * demo_kmip_server_report_stats()
+ ****************************************************************************/
+static void demo_kmip_server_report_stats(DemoServerStats * stats,
+                                          double elapsed)
+{
+  // take the interval's samples, so the workers are not held up by the
+  // sort
+  pthread_mutex_lock(&(stats->lock));
 
-  // some initializtion for demo KMIP server
-  demo_kmip_server_setup(&demo_server);
+  DemoServerStats interval = *stats;
+
+  stats->requests = 0;
+  stats->keys_served = 0;
+  stats->keys_missing = 0;
+  stats->errors = 0;
+  stats->connections = 0;
+  stats->latencies_us = NULL;
+  stats->latency_count = 0;
+  stats->latency_size = 0;
+
+  pthread_mutex_unlock(&(stats->lock));
+
+  fprintf(stdout, "connections %" PRIu64 ", requests %" PRIu64
+                  " (%.1f/s), keys %" PRIu64 ", missing %" PRIu64
+                  ", errors %" PRIu64 "\n",
+                  interval.connections, interval.requests,
+                  (elapsed > 0) ? (double) interval.requests / elapsed : 0.0,
+                  interval.keys_served, interval.keys_missing,
+                  interval.errors);
+
+  size_t n = interval.latency_count;
+
+  if (n > 0)
+  {
+    qsort(interval.latencies_us, n, sizeof(uint64_t),
+          demo_kmip_server_compare_u64);
+    fprintf(stdout, "request latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, "
+                    "max %.3f\n",
+                    interval.latencies_us[n / 2] / 1000.0,
+                    interval.latencies_us[n * 9 / 10] / 1000.0,
+                    interval.latencies_us[n * 99 / 100] / 1000.0,
+                    interval.latencies_us[n - 1] / 1000.0);
+  }
+  fflush(stdout);
+
+  free(interval.latencies_us);
+}
+
+/*****************************************************************************
+ * demo_kmip_server_serve_conn()
+ ****************************************************************************/
+static void demo_kmip_server_serve_conn(DemoServer * demo_server, BIO * bio)
+{
+  DemoServerStats *stats = &(demo_server->stats);
+
+  if (BIO_do_handshake(bio) <= 0)
+  {
+    kmyth_log(LOG_ERR, "error completing TLS handshake");
+    log_openssl_error("BIO_do_handshake()");
+    return;
+  }
+  kmyth_log(LOG_DEBUG, "TLS client connection - completed handshake");
 
-  // receive KMIP 'get key' request via client connection
-  unsigned char *kmip_req_bytes = NULL;
-  size_t kmip_req_len = 0;
+  pthread_mutex_lock(&(stats->lock));
+  stats->connections++;
+  pthread_mutex_unlock(&(stats->lock));
 
-  if (EXIT_SUCCESS != demo_kmip_server_receive_get_key_request(&demo_server,
-                                                               &kmip_req_bytes,
-                                                               &kmip_req_len))
+  // serve requests until the client closes the connection (or shutdown
+  // closes it for the client)
+  while (true)
   {
-    kmyth_log(LOG_ERR, "error receiving KMIP 'get key' request");
-    if (kmip_req_bytes != NULL)
+    unsigned char *kmip_req_bytes = NULL;
+    size_t kmip_req_len = 0;
+
+    if (EXIT_SUCCESS !=
+        demo_kmip_server_receive_get_key_request(bio,
+                                                 &kmip_req_bytes,
+                                                 &kmip_req_len))
     {
-      free(kmip_req_bytes);
+      demo_kmip_server_record_request(stats, 0, 0, 0, true);
+      break;
+    }
+    if (kmip_req_bytes == NULL)
+    {
+      break;
+    }
+
+    uint64_t start_us = kmyth_metrics_now_us();
+
+    // parse out the key IDs of the 'get key' request just received
+    kmip_key_result *req_ids = NULL;
+    size_t req_id_count = 0;
+
+    int ret = validate_kmip_get_key_request(kmip_req_bytes,
+                                            kmip_req_len,
+                                            &req_ids,
+                                            &req_id_count);
+
+    free(kmip_req_bytes);
+
+    // create KMIP 'get key' response to be returned to client
+    unsigned char *kmip_resp_bytes = NULL;
+    size_t kmip_resp_len = 0;
+    size_t keys_missing = 0;
+
+    if (EXIT_SUCCESS == ret)
+    {
+      ret = compose_kmip_get_key_response(&(demo_server->store),
+                                          req_ids,
+                                          req_id_count,
+                                          &keys_missing,
+                                          &kmip_resp_bytes,
+                                          &kmip_resp_len);
+    }
+    free_kmip_key_results(req_ids, req_id_count);
+
+    // send KMIP 'get key' response just created
+    if (EXIT_SUCCESS == ret)
+    {
+      ret = send_kmip_get_key_response(bio, kmip_resp_bytes, kmip_resp_len);
+    }
+    if (kmip_resp_bytes != NULL)
+    {
+      kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+    }
+
+    demo_kmip_server_record_request(stats,
+                                    kmyth_metrics_now_us() - start_us,
+                                    (ret == EXIT_SUCCESS) ?
+                                      req_id_count - keys_missing : 0,
+                                    keys_missing,
+                                    ret != EXIT_SUCCESS);
+    if (EXIT_SUCCESS != ret)
+    {
+      // the response to a malformed request cannot be told apart from the
+      // next one, so the connection is closed
+      kmyth_log(LOG_ERR, "failed to serve KMIP 'get key' request");
+      break;
     }
-    demo_kmip_server_error(&demo_server);
-    return EXIT_FAILURE;
   }
 
-  // validate and parse out key ID of 'get key' request just received
-  unsigned char *req_id_bytes = NULL;
-  size_t req_id_len = 0;
+  BIO_ssl_shutdown(bio);
+  kmyth_log(LOG_DEBUG, "TLS client connection - closed");
+}
+
+/*****************************************************************************
+ * demo_kmip_server_worker()
+ ****************************************************************************/
+static void *demo_kmip_server_worker(void *arg)
+{
+  DemoWorker *worker = (DemoWorker *) arg;
+  DemoServer *demo_server = worker->server;
+  DemoConnQueue *queue = &(demo_server->queue);
 
-  if (EXIT_SUCCESS != validate_kmip_get_key_request(kmip_req_bytes,
-                                                    kmip_req_len,
-                                                    &req_id_bytes,
-                                                    &req_id_len))
+  while (true)
   {
-    kmyth_log(LOG_ERR, "failed to validate KMIP 'get key' request");
-    free(kmip_req_bytes);
-    if (req_id_bytes != NULL)
+    pthread_mutex_lock(&(queue->lock));
+    while (queue->count == 0 && !queue->closed)
     {
-      free(req_id_bytes);
+      pthread_cond_wait(&(queue->ready), &(queue->lock));
     }
-    demo_kmip_server_error(&demo_server);
+    if (queue->count == 0)
+    {
+      pthread_mutex_unlock(&(queue->lock));
+      break;
+    }
+
+    BIO *bio = queue->conns[queue->head];
+
+    queue->head = (queue->head + 1) % DEMO_KMIP_SERVER_BACKLOG;
+    queue->count--;
+
+    // record the socket, so that shutdown can interrupt a blocked read
+    BIO_get_fd(bio, &(worker->fd));
+    pthread_mutex_unlock(&(queue->lock));
+
+    // a client that sits idle between requests is disconnected
+    struct timeval idle_timeout = { .tv_sec = DEMO_KMIP_SERVER_IDLE_TIMEOUT };
+
+    setsockopt(worker->fd, SOL_SOCKET, SO_RCVTIMEO,
+               &idle_timeout, sizeof(idle_timeout));
+
+    demo_kmip_server_serve_conn(demo_server, bio);
+
+    pthread_mutex_lock(&(queue->lock));
+    worker->fd = UNSET_FD;
+    pthread_mutex_unlock(&(queue->lock));
+
+    BIO_free_all(bio);
+  }
+
+  return NULL;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_handle_signal()
+ ****************************************************************************/
+static void demo_kmip_server_handle_signal(int signum)
+{
+  demo_kmip_server_stop = 1;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_start_workers()
+ ****************************************************************************/
+static int demo_kmip_server_start_workers(DemoServer * demo_server)
+{
+  pthread_mutex_init(&(demo_server->stats.lock), NULL);
+  pthread_mutex_init(&(demo_server->queue.lock), NULL);
+  pthread_cond_init(&(demo_server->queue.ready), NULL);
+
+  demo_server->workers = calloc(demo_server->worker_count,
+                                sizeof(DemoWorker));
+  if (demo_server->workers == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate worker threads");
     return EXIT_FAILURE;
   }
-  free(kmip_req_bytes);
-  
-  // create KMIP 'get key' response to be returned to client
-  unsigned char *kmip_resp_bytes = NULL;
-  size_t kmip_resp_len = 0;
 
-  if (EXIT_SUCCESS != compose_kmip_get_key_response(req_id_bytes,
-                                                    req_id_len,
-                                                    &kmip_resp_bytes,
-                                                    &kmip_resp_len))
+  // the workers leave SIGINT and SIGTERM to the accepting thread
+  sigset_t signals;
+  sigset_t old_signals;
+
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+  for (int i = 0; i < demo_server->worker_count; i++)
   {
-    kmyth_log(LOG_ERR, "failed to compose KMIP 'get key' response");
-    free(req_id_bytes);
-    if (kmip_resp_bytes != NULL)
+    DemoWorker *worker = &(demo_server->workers[i]);
+
+    worker->server = demo_server;
+    worker->fd = UNSET_FD;
+    if (0 != pthread_create(&(worker->thread), NULL,
+                            demo_kmip_server_worker, worker))
     {
-      kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+      kmyth_log(LOG_ERR, "failed to start worker thread");
+      break;
     }
-    demo_kmip_server_error(&demo_server);
-    return EXIT_FAILURE;
+    demo_server->workers_started++;
   }
-  free(req_id_bytes);
 
-  // send KMIP 'get key' response just created
-  if (EXIT_SUCCESS != send_kmip_get_key_response(&demo_server,
-                                                 kmip_resp_bytes,
-                                                 kmip_resp_len))
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  return (demo_server->workers_started == demo_server->worker_count) ?
+         EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_stop_workers()
+ ****************************************************************************/
+static void demo_kmip_server_stop_workers(DemoServer * demo_server)
+{
+  DemoConnQueue *queue = &(demo_server->queue);
+
+  pthread_mutex_lock(&(queue->lock));
+  queue->closed = true;
+
+  // when interrupted, drop waiting connections and wake workers blocked
+  // on a client; otherwise let them finish
+  if (demo_kmip_server_stop)
   {
-    kmyth_log(LOG_ERR, "error returning KMIP 'get key' response");
-    kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+    while (queue->count > 0)
+    {
+      BIO_free_all(queue->conns[queue->head]);
+      queue->head = (queue->head + 1) % DEMO_KMIP_SERVER_BACKLOG;
+      queue->count--;
+    }
+    for (int i = 0; i < demo_server->workers_started; i++)
+    {
+      if (demo_server->workers[i].fd != UNSET_FD)
+      {
+        shutdown(demo_server->workers[i].fd, SHUT_RDWR);
+      }
+    }
+  }
+  pthread_cond_broadcast(&(queue->ready));
+  pthread_mutex_unlock(&(queue->lock));
+
+  for (int i = 0; i < demo_server->workers_started; i++)
+  {
+    pthread_join(demo_server->workers[i].thread, NULL);
+  }
+  demo_server->workers_started = 0;
+
+  pthread_cond_destroy(&(queue->ready));
+  pthread_mutex_destroy(&(queue->lock));
+}
+
+/*****************************************************************************
+ * demo_kmip_server_enqueue_conn()
+ ****************************************************************************/
+static void demo_kmip_server_enqueue_conn(DemoServer * demo_server,
+                                          BIO * bio)
+{
+  DemoConnQueue *queue = &(demo_server->queue);
+
+  pthread_mutex_lock(&(queue->lock));
+  if (queue->count == DEMO_KMIP_SERVER_BACKLOG)
+  {
+    pthread_mutex_unlock(&(queue->lock));
+    kmyth_log(LOG_ERR, "too many waiting connections, refusing one");
+    BIO_free_all(bio);
+    return;
+  }
+  queue->conns[(queue->head + queue->count) % DEMO_KMIP_SERVER_BACKLOG] = bio;
+  queue->count++;
+  pthread_cond_signal(&(queue->ready));
+  pthread_mutex_unlock(&(queue->lock));
+}
+
+/*****************************************************************************
+ * demo_kmip_server_accept_loop()
+ ****************************************************************************/
+static void demo_kmip_server_accept_loop(DemoServer * demo_server)
+{
+  BIO *abio = demo_server->tlsconn.bio;
+  int accepted = 0;
+  uint64_t report_us = kmyth_metrics_now_us();
+
+  struct pollfd pfd = { .fd = (int) BIO_get_fd(abio, NULL),
+                        .events = POLLIN };
+
+  while (!demo_kmip_server_stop &&
+         (demo_server->max_conns == 0 || accepted < demo_server->max_conns))
+  {
+    int ready = poll(&pfd, 1, 1000);
+
+    if (demo_server->stats_interval > 0)
+    {
+      uint64_t now_us = kmyth_metrics_now_us();
+
+      if (now_us - report_us >= (uint64_t) demo_server->stats_interval *
+                                1000000)
+      {
+        demo_kmip_server_report_stats(&(demo_server->stats),
+                                      (double) (now_us - report_us) / 1e6);
+        report_us = now_us;
+      }
+    }
+
+    if (ready < 0 && errno != EINTR)
+    {
+      kmyth_log(LOG_ERR, "error waiting for client connections");
+      break;
+    }
+    if (ready <= 0)
+    {
+      continue;
+    }
+
+    // accept the connection; the accept BIO then holds its new BIO chain
+    if (BIO_do_accept(abio) <= 0)
+    {
+      kmyth_log(LOG_ERR, "error accepting client connection");
+      log_openssl_error("BIO_do_accept()");
+      continue;
+    }
+
+    BIO *bio = BIO_pop(abio);
+
+    if (bio == NULL)
+    {
+      continue;
+    }
+    accepted++;
+    demo_kmip_server_enqueue_conn(demo_server, bio);
+  }
+
+  demo_kmip_server_stop_workers(demo_server);
+
+  demo_kmip_server_report_stats(&(demo_server->stats),
+                                (double) (kmyth_metrics_now_us() -
+                                          report_us) / 1e6);
+  pthread_mutex_destroy(&(demo_server->stats.lock));
+}
+
+int main(int argc, char **argv)
+{
+  DemoServer demo_server;
+
+  demo_kmip_server_init(&demo_server);
+
+  // setup default logging parameters
+  set_app_name("             server ");
+  set_app_version("");
+  set_applog_path("../sgx/sgx_retrievekey_demo.log");
+  set_applog_severity_threshold(DEMO_LOG_LEVEL);
+  set_applog_output_mode(0);
+
+  // process command-line options
+  demo_kmip_server_get_options(&demo_server, argc, argv);
+  demo_kmip_server_check_options(&demo_server);
+
+  // some initializtion for demo KMIP server
+  demo_kmip_server_setup(&demo_server);
+
+  // shut down cleanly (reporting statistics) when interrupted; a client
+  // that goes away mid-response must not kill the server
+  struct sigaction action = { 0 };
+
+  action.sa_handler = demo_kmip_server_handle_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (EXIT_SUCCESS != demo_kmip_server_start_workers(&demo_server))
+  {
+    kmyth_log(LOG_ERR, "failed to start worker threads");
+    demo_kmip_server_stop = 1;
+    demo_kmip_server_stop_workers(&demo_server);
     demo_kmip_server_error(&demo_server);
-    return EXIT_FAILURE;
   }
-  kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+
+  kmyth_log(LOG_DEBUG, "serving %zu keys with %d workers",
+                       demo_server.store.count, demo_server.worker_count);
+
+  // accept TLS connections, handing each to a worker, until interrupted
+  // or the connection limit is reached
+  demo_kmip_server_accept_loop(&demo_server);
 
   demo_kmip_server_cleanup(&demo_server);
 
@@ -11,6 +11,9 @@
 
 #define NUM_POLL_FDS 2
 
+// session processes forked and not yet reaped (forking mode)
+static volatile sig_atomic_t proxy_live_sessions = 0;
+
 /*****************************************************************************
  * proxy_init()
  ****************************************************************************/
@@ -24,6 +27,13 @@ static void proxy_init(TLSProxy * proxy)
 
   // initialize proxy's TLS interface as a client
   demo_tls_init(true, &(proxy->tlsconn));
+
+  // bound on the sessions held open at once, and on how long they wait
+  proxy->max_sessions = PROXY_DEFAULT_MAX_SESSIONS;
+  proxy->stage_timeout = PROXY_DEFAULT_STAGE_TIMEOUT;
+  proxy->upstream_conns = PROXY_DEFAULT_UPSTREAM_CONNS;
+  proxy->ephemeral_keys = PROXY_DEFAULT_EPHEMERAL_KEYS;
+  proxy->ticket_resumptions = PROXY_DEFAULT_TICKET_RESUMPTIONS;
 }
 
 /*****************************************************************************
@@ -48,6 +58,19 @@ static void proxy_error(TLSProxy * proxy)
   exit(EXIT_FAILURE);
 }
 
+/*****************************************************************************
+ * proxy_write_metrics()
+ ****************************************************************************/
+static void proxy_write_metrics(TLSProxy * proxy)
+{
+  if (proxy->metrics_path != NULL &&
+      kmyth_metrics_write_file(proxy->metrics_path))
+  {
+    kmyth_log(LOG_WARNING, "unable to write metrics to %s",
+                           proxy->metrics_path);
+  }
+}
+
 /*****************************************************************************
  * proxy_usage()
  ****************************************************************************/
@@ -69,8 +92,35 @@ static void proxy_usage(const char *prog)
     "  -U or --client-cert     Local (client) certificate (for TLS connection) PEM file name\n"
     "Test Options --\n"
     "  -m or --maxconn  The number of connections the server will accept before exiting (unlimited by default, or if the value is not a positive integer).\n"
+    "Metrics --\n"
+    "  -M or --metrics-file  Keep this file up to date with the proxy's metrics (Prometheus text format).\n"
+    "Concurrency --\n"
+    "  -w or --workers       Serve the ECDH sessions from one process: an epoll event loop hands them\n"
+    "                        to this many worker threads (by default a process is forked per session).\n"
+    "  -s or --max-sessions  The most ECDH sessions held open at once; further connections wait in\n"
+    "                        the listen backlog, or are refused, until sessions finish (defaults to %d).\n"
+    "  -S or --stage-timeout  Seconds a client has to start sending each protocol message, and again\n"
+    "                        to finish sending it, before its session is closed (defaults to %d;\n"
+    "                        0 waits indefinitely).\n"
+    "  -b or --backlog       Connection backlog of the listening ECDH socket (defaults to 1, or to\n"
+    "                        SOMAXCONN with -w).\n"
+    "  -k or --upstream-conns  With -w, the number of long-lived TLS connections to the remote server\n"
+    "                        that the sessions' KMIP requests share (defaults to %d; 0 makes a\n"
+    "                        connection per session).\n"
+    "  -e or --ephemeral-keys  With -w, the number of ephemeral ECDH key pairs a background thread\n"
+    "                        keeps generated ahead of the sessions that need them (defaults to %d;\n"
+    "                        0 has each session generate its own).\n"
+    "Session Resumption --\n"
+    "  -t or --ticket-lifetime     Issue session tickets with which a client may resume a session\n"
+    "                        without a new key agreement, for this many seconds after the full\n"
+    "                        session they descend from (by default no tickets are issued).\n"
+    "  -T or --ticket-resumptions  With -t, how many times a full session may be resumed\n"
+    "                        (defaults to %d).\n"
     "Misc --\n"
-    "  -h or --help     Help (displays this usage).\n\n", prog);
+    "  -h or --help     Help (displays this usage).\n\n", prog,
+    PROXY_DEFAULT_MAX_SESSIONS, PROXY_DEFAULT_STAGE_TIMEOUT,
+    PROXY_DEFAULT_UPSTREAM_CONNS,
+    PROXY_DEFAULT_EPHEMERAL_KEYS, PROXY_DEFAULT_TICKET_RESUMPTIONS);
 }
 
 /*****************************************************************************
@@ -91,7 +141,7 @@ static void proxy_get_options(TLSProxy * proxy, int argc, char **argv)
   int option_index = 0;
 
   while ((options =
-          getopt_long(argc, argv, "r:c:u:p:I:P:C:R:U:m:h",
+          getopt_long(argc, argv, "r:c:u:p:I:P:C:R:U:m:M:w:s:S:b:k:e:t:T:h",
                       proxy_longopts, &option_index)) != -1)
   {
     switch (options)
@@ -150,6 +200,36 @@ static void proxy_get_options(TLSProxy * proxy, int argc, char **argv)
     case 'm':
       proxy->ecdhconn.config.session_limit = atoi(optarg);
       break;
+    // Metrics
+    case 'M':
+      proxy->metrics_path = strdup(optarg);
+      break;
+    // Concurrency
+    case 'w':
+      proxy->workers = atoi(optarg);
+      break;
+    case 's':
+      proxy->max_sessions = atoi(optarg);
+      break;
+    case 'S':
+      proxy->stage_timeout = atoi(optarg);
+      break;
+    case 'b':
+      proxy->backlog = atoi(optarg);
+      break;
+    case 'k':
+      proxy->upstream_conns = atoi(optarg);
+      break;
+    case 'e':
+      proxy->ephemeral_keys = atoi(optarg);
+      break;
+    // Session resumption
+    case 't':
+      proxy->ticket_lifetime = atoi(optarg);
+      break;
+    case 'T':
+      proxy->ticket_resumptions = atoi(optarg);
+      break;
     // Misc
     case 'h':
       proxy_usage(argv[0]);
@@ -179,6 +259,59 @@ static void proxy_check_options(TLSProxy * proxy)
     fprintf(stderr, "Remote port number argument (-P) is required.\n");
     err = true;
   }
+  if (proxy->workers < 0 || proxy->workers > PROXY_MAX_WORKERS)
+  {
+    fprintf(stderr, "Worker count (-w) must be 0 to %d.\n",
+                    PROXY_MAX_WORKERS);
+    err = true;
+  }
+  if (proxy->max_sessions < 1 || proxy->max_sessions > PROXY_MAX_SESSIONS)
+  {
+    fprintf(stderr, "Session limit (-s) must be 1 to %d.\n",
+                    PROXY_MAX_SESSIONS);
+    err = true;
+  }
+  if (proxy->stage_timeout < 0 ||
+      proxy->stage_timeout > PROXY_MAX_STAGE_TIMEOUT)
+  {
+    fprintf(stderr, "Stage timeout (-S) must be 0 to %d seconds.\n",
+                    PROXY_MAX_STAGE_TIMEOUT);
+    err = true;
+  }
+  if (proxy->backlog < 0 || proxy->backlog > PROXY_MAX_BACKLOG)
+  {
+    fprintf(stderr, "Listen backlog (-b) must be 0 to %d.\n",
+                    PROXY_MAX_BACKLOG);
+    err = true;
+  }
+  if (proxy->upstream_conns < 0 ||
+      proxy->upstream_conns > PROXY_MAX_UPSTREAM_CONNS)
+  {
+    fprintf(stderr, "Upstream connection count (-k) must be 0 to %d.\n",
+                    PROXY_MAX_UPSTREAM_CONNS);
+    err = true;
+  }
+  if (proxy->ephemeral_keys < 0 ||
+      proxy->ephemeral_keys > PROXY_MAX_EPHEMERAL_KEYS)
+  {
+    fprintf(stderr, "Ephemeral key pair count (-e) must be 0 to %d.\n",
+                    PROXY_MAX_EPHEMERAL_KEYS);
+    err = true;
+  }
+  if (proxy->ticket_lifetime < 0 ||
+      proxy->ticket_lifetime > PROXY_MAX_TICKET_LIFETIME)
+  {
+    fprintf(stderr, "Ticket lifetime (-t) must be 0 to %d seconds.\n",
+                    PROXY_MAX_TICKET_LIFETIME);
+    err = true;
+  }
+  if (proxy->ticket_resumptions < 1 ||
+      proxy->ticket_resumptions > PROXY_MAX_TICKET_RESUMPTIONS)
+  {
+    fprintf(stderr, "Ticket resumption count (-T) must be 1 to %d.\n",
+                    PROXY_MAX_TICKET_RESUMPTIONS);
+    err = true;
+  }
   if (err)
   {
     kmyth_log(LOG_ERR, "Invalid command-line arguments.");
@@ -216,6 +349,7 @@ static int proxy_create_ecdh_server(TLSProxy * proxy)
   ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
 
   ecdh_svr->config.listen_socket_fd = UNSET_FD;
+  ecdh_svr->config.stage_timeout_ms = (unsigned int) proxy->stage_timeout * 1000;
 
   if (ecdh_svr->config.session_limit > 0) 
   {
@@ -234,7 +368,7 @@ static int proxy_create_ecdh_server(TLSProxy * proxy)
 
   kmyth_log(LOG_DEBUG, "setting up server socket on port %s",
                        ecdh_svr->config.port);
-  if (setup_server_socket(ecdh_svr->config.port,
+  if (setup_server_socket(ecdh_svr->config.port, NULL,
                          &(ecdh_svr->config.listen_socket_fd)))
   {
     kmyth_log(LOG_ERR, "failed to setup server socket on port %s",
@@ -242,7 +376,26 @@ static int proxy_create_ecdh_server(TLSProxy * proxy)
     return EXIT_FAILURE;
   }
 
-  if (listen(ecdh_svr->config.listen_socket_fd, 1))
+  // session tickets are sealed with a key of the proxy's own (which forked
+  // session processes inherit)
+  if (proxy->ticket_lifetime > 0 &&
+      demo_ecdh_enable_tickets(&(ecdh_svr->config), proxy->ticket_lifetime,
+                               proxy->ticket_resumptions))
+  {
+    kmyth_log(LOG_ERR, "failed to set up session resumption");
+    close(ecdh_svr->config.listen_socket_fd);
+    return EXIT_FAILURE;
+  }
+
+  // an event loop takes connections in bursts, so by default let the
+  // kernel queue them
+  int backlog = proxy->backlog;
+
+  if (backlog == 0)
+  {
+    backlog = (proxy->workers > 0) ? SOMAXCONN : 1;
+  }
+  if (listen(ecdh_svr->config.listen_socket_fd, backlog))
   {
     kmyth_log(LOG_ERR, "server socket listen (for client connection) failed");
     close(ecdh_svr->config.listen_socket_fd);
@@ -260,23 +413,32 @@ static int proxy_setup_ecdh_session(TLSProxy * proxy)
   ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
   int ret = -1;
 
-  // create proxy's session-unique (ephemeral) public/private key pair
-  // (proxy contribution to ECDH key agreement)
-  ret = create_ecdh_ephemeral_keypair(&(ecdh_svr->session.local_eph_keypair));
+  // receive the 'Client Hello' message from the client (or a 'Resume
+  // Request', which completes the setup from a session ticket)
+  ret = demo_ecdh_recv_client_hello_msg(ecdh_svr);
   if (ret != EXIT_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "proxy failed to create ECDH ephemeral key pair");
+    kmyth_log(LOG_ERR, "proxy failed to receive 'Client Hello' message");
     return EXIT_FAILURE;
   }
-  kmyth_log(LOG_DEBUG, "proxy created ECDH ephemeral key pair");
+  if (ecdh_svr->session.resumed)
+  {
+    return EXIT_SUCCESS;
+  }
 
-  // exchange 'Client Hello'/'Server Hello' messages with the client
-  ret = demo_ecdh_recv_client_hello_msg(ecdh_svr);
+  // create proxy's session-unique (ephemeral) public/private key pair
+  // (proxy contribution to ECDH key agreement), or take one generated
+  // ahead of time
+  ret = demo_ecdh_keypool_take(proxy->keypool,
+                               &(ecdh_svr->session.local_eph_keypair));
   if (ret != EXIT_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "proxy failed to receive 'Client Hello' message");
+    kmyth_log(LOG_ERR, "proxy failed to create ECDH ephemeral key pair");
     return EXIT_FAILURE;
   }
+  kmyth_log(LOG_DEBUG, "proxy created ECDH ephemeral key pair");
+
+  // reply with the 'Server Hello' message
   ret = demo_ecdh_send_server_hello_msg(ecdh_svr);
   if (ret != EXIT_SUCCESS)
   {
@@ -300,45 +462,246 @@ static int proxy_setup_ecdh_session(TLSProxy * proxy)
  ****************************************************************************/
 static int proxy_get_client_key_request(TLSProxy * proxy)
 {
-  int ret = -1;
-
   ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
 
   // receive key request message from ECDH client
-  ByteBuffer *kmip_req = &(ecdh_svr->session.proto.kmip_request);
+  return demo_ecdh_recv_key_request_msg(ecdh_svr);
+}
+
+/*****************************************************************************
+ * proxy_upstream_connect()
+ ****************************************************************************/
+static int proxy_upstream_connect(ProxyUpstreamPool * pool, BIO ** bio)
+{
+  // a new connection from the proxy's TLS context and server address
+  TLSPeer tls_clnt = *(pool->tlsconn);
+
+  tls_clnt.bio = NULL;
+  if (demo_tls_config_client_connect(&tls_clnt))
+  {
+    kmyth_log(LOG_ERR, "failed to configure TLS client connection");
+    if (tls_clnt.bio != NULL)
+    {
+      BIO_free_all(tls_clnt.bio);
+    }
+    return EXIT_FAILURE;
+  }
 
-  demo_ecdh_recv_key_request_msg(ecdh_svr);
+  uint64_t start_us = kmyth_metrics_now_us();
+
+  if (demo_tls_client_connect(&tls_clnt))
+  {
+    kmyth_log(LOG_ERR, "TLS connection failed");
+    kmyth_metrics_inc(KMYTH_METRIC_TLS_HANDSHAKE_ERRORS);
+    BIO_free_all(tls_clnt.bio);
+    return EXIT_FAILURE;
+  }
+  kmyth_metrics_observe_since(KMYTH_METRIC_TLS_HANDSHAKE_TIME, start_us);
+
+  *bio = tls_clnt.bio;
 
   return EXIT_SUCCESS;
 }
 
 /*****************************************************************************
- * proxy_get_kmip_response()
+ * proxy_upstream_healthy()
  ****************************************************************************/
-static int proxy_get_kmip_response(TLSProxy * proxy)
+static bool proxy_upstream_healthy(BIO * bio)
 {
-  // create TLS connection with server
-  ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
-  TLSPeer *tls_clnt = &(proxy->tlsconn);
+  SSL *ssl = NULL;
 
-  if (demo_tls_client_connect(tls_clnt))
+  BIO_get_ssl(bio, &ssl);
+  if (ssl == NULL || (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN) ||
+      SSL_pending(ssl) > 0)
+  {
+    return false;
+  }
+
+  // between requests the server has nothing to say: anything readable is
+  // a close_notify, a reset or the end of the stream
+  struct pollfd pfd = { .fd = SSL_get_fd(ssl), .events = POLLIN };
+
+  return (pfd.fd >= 0 && poll(&pfd, 1, 0) == 0);
+}
+
+/*****************************************************************************
+ * proxy_upstream_close()
+ ****************************************************************************/
+static void proxy_upstream_close(ProxyUpstreamConn * conn)
+{
+  if (conn->bio != NULL)
+  {
+    BIO_ssl_shutdown(conn->bio);
+    BIO_free_all(conn->bio);
+    conn->bio = NULL;
+  }
+}
+
+/*****************************************************************************
+ * proxy_upstream_exchange()
+ ****************************************************************************/
+static int proxy_upstream_exchange(ProxyUpstreamPool * pool,
+                                   ByteBuffer * kmip_req,
+                                   ByteBuffer * kmip_resp)
+{
+  ProxyUpstreamConn *conn = NULL;
+
+  // take an idle connection, preferring one that is already open
+  pthread_mutex_lock(&(pool->lock));
+  while (conn == NULL)
+  {
+    for (int i = 0; i < pool->conn_count; i++)
+    {
+      ProxyUpstreamConn *idle = &(pool->conns[i]);
+
+      if (!idle->in_use &&
+          (conn == NULL || (conn->bio == NULL && idle->bio != NULL)))
+      {
+        conn = idle;
+      }
+    }
+    if (conn == NULL)
+    {
+      pthread_cond_wait(&(pool->available), &(pool->lock));
+    }
+  }
+  conn->in_use = true;
+  pthread_mutex_unlock(&(pool->lock));
+
+  int ret = EXIT_FAILURE;
+
+  // the server may close a connection between the health check and the
+  // request: a request that fails on a reused connection is retried once
+  // on a fresh one
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    bool reused = (conn->bio != NULL && proxy_upstream_healthy(conn->bio));
+
+    if (!reused)
+    {
+      proxy_upstream_close(conn);
+      if (EXIT_SUCCESS != proxy_upstream_connect(pool, &(conn->bio)))
+      {
+        break;
+      }
+    }
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_TLS_CONNECTION, reused);
+
+    if (get_resp_from_tls_server(conn->bio,
+                                 kmip_req->buffer,
+                                 kmip_req->size,
+                                 &(kmip_resp->buffer),
+                                 &(kmip_resp->size)) == 0)
+    {
+      ret = EXIT_SUCCESS;
+      break;
+    }
+
+    // the connection may be part way through an exchange: never reuse it
+    proxy_upstream_close(conn);
+    if (!reused)
+    {
+      break;
+    }
+    kmyth_log(LOG_DEBUG, "KMIP request failed on a reused connection, "
+                         "retrying on a new one");
+  }
+
+  pthread_mutex_lock(&(pool->lock));
+  conn->in_use = false;
+  pthread_cond_signal(&(pool->available));
+  pthread_mutex_unlock(&(pool->lock));
+
+  return ret;
+}
+
+/*****************************************************************************
+ * proxy_upstream_init()
+ ****************************************************************************/
+static int proxy_upstream_init(ProxyUpstreamPool * pool, TLSPeer * tlsconn,
+                               int conn_count)
+{
+  pool->tlsconn = tlsconn;
+  pthread_mutex_init(&(pool->lock), NULL);
+  pthread_cond_init(&(pool->available), NULL);
+
+  // connections are opened when first needed
+  if (conn_count == 0)
+  {
+    return EXIT_SUCCESS;
+  }
+  pool->conns = calloc(conn_count, sizeof(ProxyUpstreamConn));
+  if (pool->conns == NULL)
   {
-    kmyth_log(LOG_ERR, "TLS connection failed");
     return EXIT_FAILURE;
   }
+  pool->conn_count = conn_count;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * proxy_upstream_cleanup()
+ ****************************************************************************/
+static void proxy_upstream_cleanup(ProxyUpstreamPool * pool)
+{
+  // (no session holds a connection any more)
+  for (int i = 0; i < pool->conn_count; i++)
+  {
+    proxy_upstream_close(&(pool->conns[i]));
+  }
+  free(pool->conns);
+  pool->conns = NULL;
+  pool->conn_count = 0;
+
+  pthread_cond_destroy(&(pool->available));
+  pthread_mutex_destroy(&(pool->lock));
+}
+
+/*****************************************************************************
+ * proxy_get_kmip_response()
+ ****************************************************************************/
+static int proxy_get_kmip_response(TLSProxy * proxy)
+{
+  ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
+  TLSPeer *tls_clnt = &(proxy->tlsconn);
 
-  // send KMIP request then receive KMIP response from server
   ByteBuffer *kmip_req = &(ecdh_svr->session.proto.kmip_request);
   ByteBuffer *kmip_resp = &(ecdh_svr->session.proto.kmip_response);
 
-  if (get_resp_from_tls_server(tls_clnt->bio,
-                               kmip_req->buffer,
-                               kmip_req->size,
-                               &(kmip_resp->buffer),
-                               &(kmip_resp->size)))
+  if (proxy->upstream != NULL)
   {
-    kmyth_log(LOG_ERR, "KMIP 'get key' failed");
-    return EXIT_FAILURE;
+    // send the KMIP request over one of the event loop's shared connections
+    if (EXIT_SUCCESS != proxy_upstream_exchange(proxy->upstream,
+                                                kmip_req, kmip_resp))
+    {
+      kmyth_log(LOG_ERR, "KMIP 'get key' failed");
+      return EXIT_FAILURE;
+    }
+  }
+  else
+  {
+    // create TLS connection with server
+    uint64_t start_us = kmyth_metrics_now_us();
+
+    if (demo_tls_client_connect(tls_clnt))
+    {
+      kmyth_log(LOG_ERR, "TLS connection failed");
+      kmyth_metrics_inc(KMYTH_METRIC_TLS_HANDSHAKE_ERRORS);
+      return EXIT_FAILURE;
+    }
+    kmyth_metrics_observe_since(KMYTH_METRIC_TLS_HANDSHAKE_TIME, start_us);
+
+    // send KMIP request then receive KMIP response from server
+    if (get_resp_from_tls_server(tls_clnt->bio,
+                                 kmip_req->buffer,
+                                 kmip_req->size,
+                                 &(kmip_resp->buffer),
+                                 &(kmip_resp->size)))
+    {
+      kmyth_log(LOG_ERR, "KMIP 'get key' failed");
+      return EXIT_FAILURE;
+    }
   }
 
   kmyth_log(LOG_DEBUG, "Received KMIP response: 0x%02X%02X ... %02X%02X "
@@ -363,10 +726,29 @@ static int proxy_send_key_response_message(TLSProxy * proxy)
   ByteBuffer *kmip_resp = &(ecdh_svr->session.proto.kmip_response);
   ECDHMessage *key_resp = &(ecdh_svr->session.proto.key_response);
 
-  ret = compose_key_response_msg(ecdh_svr->config.local_sign_key,
-                                 &(ecdh_svr->session.response_symkey),
-                                 kmip_resp,
-                                 key_resp);
+  // a ticket for resuming this session goes with the response (if tickets
+  // are issued, and the session's limits allow another resumption)
+  ret = demo_ecdh_issue_ticket(ecdh_svr);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_WARNING, "sending 'Key Response' without session ticket");
+  }
+
+  if (ecdh_svr->session.resumed)
+  {
+    ret = compose_resume_response_msg(&(ecdh_svr->session.response_symkey),
+                                      kmip_resp,
+                                      &(ecdh_svr->session.proto.ticket),
+                                      key_resp);
+  }
+  else
+  {
+    ret = compose_key_response_msg(ecdh_svr->config.local_sign_key,
+                                   &(ecdh_svr->session.response_symkey),
+                                   kmip_resp,
+                                   &(ecdh_svr->session.proto.ticket),
+                                   key_resp);
+  }
   if (ret != EXIT_SUCCESS)
   {
     kmyth_log(LOG_ERR, "failed to compose 'Key Response' message");
@@ -393,13 +775,47 @@ static int proxy_send_key_response_message(TLSProxy * proxy)
   return EXIT_SUCCESS;
 }
 
+/*****************************************************************************
+ * proxy_complete_key_request()
+ ****************************************************************************/
+static bool proxy_complete_key_request(TLSProxy * proxy)
+{
+  // obtain key retrieval request from client-side of ECDH session (unless
+  // it came with the 'Resume Request' that set up the session)
+  if (!proxy->ecdhconn.session.resumed &&
+      EXIT_SUCCESS != proxy_get_client_key_request(proxy))
+  {
+    kmyth_log(LOG_DEBUG, "failed to receive 'Key Request' message");
+    return false;
+  }
+
+  // pass KMIP request to / receive KMIP response from key server over TLS
+  if (EXIT_SUCCESS != proxy_get_kmip_response(proxy))
+  {
+    kmyth_log(LOG_DEBUG, "failed to retrieve KMIP 'get key' response");
+    return false;
+  }
+
+  // return 'retrieve key' response to the client that submitted request
+  if (EXIT_SUCCESS != proxy_send_key_response_message(proxy))
+  {
+    kmyth_log(LOG_DEBUG, "failed to send 'Key Response' message");
+    return false;
+  }
+
+  return true;
+}
+
 /*****************************************************************************
  * proxy_cleanup_defunct()
  ****************************************************************************/
 static void proxy_cleanup_defunct()
 {
   /* Clean up all defunct child processes. */
-  while (waitpid(-1, NULL, WNOHANG) > 0);
+  while (waitpid(-1, NULL, WNOHANG) > 0)
+  {
+    proxy_live_sessions--;
+  }
 }
 
 /*****************************************************************************
@@ -428,46 +844,40 @@ static void proxy_handle_session(TLSProxy * proxy)
   pfds[1].fd = BIO_get_fd(tls_bio, NULL);
   pfds[1].events = POLLIN;
 
-  // wait to receive data with no timeout
+  // wait (at most the stage timeout) to receive data
   // (Note: we expect to receive a 'Client Hello' message on the ECDH
   //        interface, but no interaction should be initiated from the
   //        KMIP server on the TLS interface. Nonetheless, we monitor
   //        both interfaces.)
-  poll(pfds, NUM_POLL_FDS, -1);
+  int timeout_ms = (proxy->stage_timeout > 0) ?
+                   proxy->stage_timeout * 1000 : -1;
+
+  if (poll(pfds, NUM_POLL_FDS, timeout_ms) == 0)
+  {
+    kmyth_log(LOG_WARNING, "ECDH session timed out");
+    kmyth_metrics_inc(KMYTH_METRIC_KEY_REQUEST_ERRORS);
+    return;
+  }
 
   if (pfds[0].revents & POLLIN)
   {
     kmyth_log(LOG_DEBUG, "ECDH receive event initiates session setup");
 
-    // execute session setup (e.g., key agreement) protocol phase
+    // counted as failed unless the key response makes it to the client
+    bool served = false;
+
+    // execute session setup (e.g., key agreement) protocol phase, then
+    // serve the client's key request
     if (EXIT_SUCCESS == proxy_setup_ecdh_session(proxy))
     {
-      // obtain key retrieval request from client-side of ECDH session
-      if (EXIT_SUCCESS == proxy_get_client_key_request(proxy))
-      {
-        // pass KMIP request to / receive KMIP response from key server over TLS
-        if (EXIT_SUCCESS == proxy_get_kmip_response(proxy))
-        {
-          // return 'retrieve key' response to the client that submitted request
-          if (EXIT_SUCCESS != proxy_send_key_response_message(proxy))
-          {
-            kmyth_log(LOG_DEBUG, "failed to send 'Key Response' message");
-          }
-        }
-        else
-        {
-          kmyth_log(LOG_DEBUG, "failed to retrieve KMIP 'get key' response");
-        }
-      }
-      else
-      {
-        kmyth_log(LOG_DEBUG, "failed to receive 'Key Request' message");
-      }
+      served = proxy_complete_key_request(proxy);
     }
     else
     {
       kmyth_log(LOG_DEBUG, "failed to setup ECDH session (with client)");
     }
+    kmyth_metrics_inc(served ? KMYTH_METRIC_KEY_REQUESTS :
+                      KMYTH_METRIC_KEY_REQUEST_ERRORS);
   }
 
   if (pfds[1].revents & POLLIN)
@@ -499,17 +909,45 @@ static int proxy_manage_ecdh_client_connections(TLSProxy * proxy)
   ECDHSession *clnt_conn = &(ecdh_svr->session);
 
   int session_count = 0;
+  sigset_t sigchld_mask;
+  sigset_t wait_mask;
 
   // Register handler to automatically reap defunct child processes
   signal(SIGCHLD, proxy_cleanup_defunct);
 
+  // the live session count is only read with SIGCHLD blocked
+  sigemptyset(&sigchld_mask);
+  sigaddset(&sigchld_mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &sigchld_mask, &wait_mask);
+  sigdelset(&wait_mask, SIGCHLD);
+
   while (true)
   {
+    // while the most sessions are open, leave new connections in the
+    // listen backlog until one finishes
+    if (proxy_live_sessions >= proxy->max_sessions)
+    {
+      kmyth_log(LOG_DEBUG, "proxy at its session limit (%d)",
+                           proxy->max_sessions);
+      while (proxy_live_sessions >= proxy->max_sessions)
+      {
+        sigsuspend(&wait_mask);
+      }
+    }
+
     kmyth_log(LOG_DEBUG, "proxy (parent) listen for ECDH client connection "
                          "(session #%d)", session_count + 1);
  
+    sigprocmask(SIG_UNBLOCK, &sigchld_mask, NULL);
     clnt_conn->session_socket_fd = accept(ecdh_svr->config.listen_socket_fd,
                                           NULL, NULL);
+    int accept_errno = errno;
+
+    sigprocmask(SIG_BLOCK, &sigchld_mask, NULL);
+    if (clnt_conn->session_socket_fd == -1 && accept_errno == EINTR)
+    {
+      continue;
+    }
     if (clnt_conn->session_socket_fd == -1)
     {
       kmyth_log(LOG_ERR, "socket accept failed");
@@ -520,6 +958,13 @@ static int proxy_manage_ecdh_client_connections(TLSProxy * proxy)
     kmyth_log(LOG_DEBUG, "accepted ECDH 'client' connection (session #%d)",
                          session_count);
 
+    // small protocol messages go out at once, and a stalled client times
+    // out rather than holding its session process forever
+    if (apply_socket_options(clnt_conn->session_socket_fd, NULL))
+    {
+      kmyth_log(LOG_WARNING, "failed to set ECDH session socket options");
+    }
+
     int ret = fork();
     if (ret == -1)
     {
@@ -530,6 +975,7 @@ static int proxy_manage_ecdh_client_connections(TLSProxy * proxy)
     else if (ret == 0)
     {
       // forked child process handles accepted connection from ECDH client
+      sigprocmask(SIG_UNBLOCK, &sigchld_mask, NULL);
       close(ecdh_svr->config.listen_socket_fd);
       kmyth_log(LOG_DEBUG, "proxy (child) handling ECDH session #%d",
                            session_count);
@@ -539,6 +985,7 @@ static int proxy_manage_ecdh_client_connections(TLSProxy * proxy)
     {
       // parent process loops to accept more connections or exits
       // if session limit has been reached
+      proxy_live_sessions++;
       close(clnt_conn->session_socket_fd);
       if ((ecdh_svr->config.session_limit != 0) &&
           (session_count >= ecdh_svr->config.session_limit))
@@ -556,6 +1003,550 @@ static int proxy_manage_ecdh_client_connections(TLSProxy * proxy)
   }
 }
 
+/*****************************************************************************
+ * proxy_session_wait()
+ ****************************************************************************/
+static int proxy_session_wait(ProxyEventLoop * loop, ProxySession * session,
+                              int op)
+{
+  // (the caller holds the event loop lock)
+  struct epoll_event event = { 0 };
+
+  // one-shot, so that a session is only ever handed to one worker
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.ptr = session;
+
+  session->state = PROXY_SESSION_WAITING;
+  session->deadline_us = (loop->proxy->stage_timeout == 0) ? UINT64_MAX :
+                         kmyth_metrics_now_us() +
+                         (uint64_t) loop->proxy->stage_timeout * 1000000;
+
+  if (epoll_ctl(loop->epoll_fd, op,
+                session->conn.ecdhconn.session.session_socket_fd, &event))
+  {
+    kmyth_log(LOG_ERR, "failed to watch ECDH session #%d", session->number);
+    session->state = PROXY_SESSION_RUNNING;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * proxy_session_release()
+ ****************************************************************************/
+static void proxy_session_release(ProxyEventLoop * loop,
+                                  ProxySession * session)
+{
+  // (the caller owns the session: it is RUNNING, and so not watched)
+  int socket_fd = session->conn.ecdhconn.session.session_socket_fd;
+
+  // stop watching the socket before it is closed (and its number reused)
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, socket_fd, NULL);
+
+  // a TLS connection of the session's own (not one of the shared ones)
+  // goes with it, but its context is shared
+  if (session->conn.tlsconn.bio != NULL)
+  {
+    BIO_free_all(session->conn.tlsconn.bio);
+  }
+  demo_ecdh_session_cleanup(&(session->conn.ecdhconn.session));
+  secure_memset(&(session->conn), 0, sizeof(TLSProxy));
+
+  pthread_mutex_lock(&(loop->lock));
+  session->state = PROXY_SESSION_FREE;
+  loop->free_slots[loop->free_count++] = (int) (session - loop->sessions);
+  loop->active_sessions--;
+  pthread_mutex_unlock(&(loop->lock));
+
+  // let the event loop know, so that it can update the metrics (or finish)
+  uint64_t one = 1;
+
+  if (write(loop->wake_fd, &one, sizeof(one)) != sizeof(one))
+  {
+    kmyth_log(LOG_WARNING, "failed to signal the proxy event loop");
+  }
+}
+
+/*****************************************************************************
+ * proxy_session_run()
+ ****************************************************************************/
+static void proxy_session_run(ProxyEventLoop * loop, ProxySession * session)
+{
+  TLSProxy *conn = &(session->conn);
+
+  bool done = true;
+  bool serve = (session->phase == PROXY_PHASE_KEY_REQUEST);
+  bool served = false;
+
+  if (session->phase == PROXY_PHASE_CLIENT_HELLO)
+  {
+    kmyth_log(LOG_DEBUG, "ECDH receive event initiates session #%d setup",
+                         session->number);
+
+    if (EXIT_SUCCESS != proxy_setup_ecdh_session(conn))
+    {
+      kmyth_log(LOG_DEBUG, "failed to setup ECDH session #%d (with client)",
+                           session->number);
+    }
+    else if (conn->ecdhconn.session.resumed)
+    {
+      // a resumed session's key request came with its first message
+      serve = true;
+    }
+    else
+    {
+      // the client sends its 'Key Request' once it has derived the session
+      // keys: wait for it through epoll rather than in this worker
+      session->phase = PROXY_PHASE_KEY_REQUEST;
+      pthread_mutex_lock(&(loop->lock));
+      done = (EXIT_SUCCESS != proxy_session_wait(loop, session,
+                                                 EPOLL_CTL_MOD));
+      pthread_mutex_unlock(&(loop->lock));
+    }
+  }
+
+  if (serve && conn->upstream != NULL)
+  {
+    served = proxy_complete_key_request(conn);
+  }
+  else if (serve)
+  {
+    // the session makes its own TLS connection from the shared context
+    if (demo_tls_config_client_connect(&(conn->tlsconn)))
+    {
+      kmyth_log(LOG_ERR, "failed to configure TLS client connection");
+    }
+    else
+    {
+      served = proxy_complete_key_request(conn);
+    }
+  }
+
+  // once waiting again, the session may already be in another worker's hands
+  if (done)
+  {
+    kmyth_metrics_inc(served ? KMYTH_METRIC_KEY_REQUESTS :
+                      KMYTH_METRIC_KEY_REQUEST_ERRORS);
+    proxy_session_release(loop, session);
+  }
+}
+
+/*****************************************************************************
+ * proxy_worker_main()
+ ****************************************************************************/
+static void *proxy_worker_main(void *arg)
+{
+  ProxyEventLoop *loop = (ProxyEventLoop *) arg;
+
+  pthread_mutex_lock(&(loop->lock));
+  while (true)
+  {
+    while (loop->queue_length == 0 && !loop->stopping)
+    {
+      pthread_cond_wait(&(loop->ready), &(loop->lock));
+    }
+
+    // sessions still queued are served before stopping
+    if (loop->queue_length == 0)
+    {
+      break;
+    }
+
+    ProxySession *session = loop->queue[loop->queue_head];
+
+    loop->queue_head = (loop->queue_head + 1) % loop->session_count;
+    loop->queue_length--;
+    pthread_mutex_unlock(&(loop->lock));
+
+    proxy_session_run(loop, session);
+
+    pthread_mutex_lock(&(loop->lock));
+  }
+  pthread_mutex_unlock(&(loop->lock));
+
+  return NULL;
+}
+
+/*****************************************************************************
+ * proxy_dispatch_session()
+ ****************************************************************************/
+static void proxy_dispatch_session(ProxyEventLoop * loop,
+                                   ProxySession * session)
+{
+  pthread_mutex_lock(&(loop->lock));
+  // (the session may have been timed out since the event was collected)
+  if (session->state == PROXY_SESSION_WAITING)
+  {
+    int tail = (loop->queue_head + loop->queue_length) % loop->session_count;
+
+    // the queue holds every session at most once, so it cannot overflow
+    session->state = PROXY_SESSION_RUNNING;
+    loop->queue[tail] = session;
+    loop->queue_length++;
+    pthread_cond_signal(&(loop->ready));
+  }
+  pthread_mutex_unlock(&(loop->lock));
+}
+
+/*****************************************************************************
+ * proxy_stop_accepting()
+ ****************************************************************************/
+static void proxy_stop_accepting(ProxyEventLoop * loop)
+{
+  ECDHConfig *config = &(loop->proxy->ecdhconn.config);
+
+  if (config->listen_socket_fd != UNSET_FD)
+  {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, config->listen_socket_fd, NULL);
+    close(config->listen_socket_fd);
+    config->listen_socket_fd = UNSET_FD;
+  }
+  loop->accepting = false;
+}
+
+/*****************************************************************************
+ * proxy_accept_sessions()
+ ****************************************************************************/
+static int proxy_accept_sessions(ProxyEventLoop * loop)
+{
+  TLSProxy *proxy = loop->proxy;
+  ECDHConfig *config = &(proxy->ecdhconn.config);
+
+  // the listening socket is non-blocking: take every pending connection
+  while (loop->accepting)
+  {
+    int socket_fd = accept(config->listen_socket_fd, NULL, NULL);
+
+    if (socket_fd == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+          errno == ECONNABORTED)
+      {
+        return EXIT_SUCCESS;
+      }
+      kmyth_log(LOG_ERR, "socket accept failed");
+      return EXIT_FAILURE;
+    }
+    loop->accepted++;
+    kmyth_log(LOG_DEBUG, "accepted ECDH 'client' connection (session #%d)",
+                         loop->accepted);
+
+    if ((config->session_limit != 0) &&
+        (loop->accepted >= config->session_limit))
+    {
+      kmyth_log(LOG_DEBUG, "proxy ECDH session count reached limit (%d)",
+                           config->session_limit);
+      proxy_stop_accepting(loop);
+    }
+
+    // small protocol messages go out at once, and a stalled client times
+    // out rather than holding its worker forever
+    if (apply_socket_options(socket_fd, NULL))
+    {
+      kmyth_log(LOG_WARNING, "failed to set ECDH session socket options");
+    }
+
+    pthread_mutex_lock(&(loop->lock));
+    if (loop->free_count == 0)
+    {
+      pthread_mutex_unlock(&(loop->lock));
+      kmyth_log(LOG_WARNING, "session table full (%d sessions), refusing "
+                             "ECDH session #%d", loop->session_count,
+                             loop->accepted);
+      close(socket_fd);
+      kmyth_metrics_inc(KMYTH_METRIC_KEY_REQUEST_ERRORS);
+      continue;
+    }
+
+    ProxySession *session =
+      &(loop->sessions[loop->free_slots[--loop->free_count]]);
+
+    // share the proxy's configuration, but not its connections
+    session->conn.tlsconn = proxy->tlsconn;
+    session->conn.tlsconn.bio = NULL;
+    session->conn.ecdhconn.config = proxy->ecdhconn.config;
+    session->conn.ecdhconn.config.listen_socket_fd = UNSET_FD;
+    session->conn.ecdhconn.session.session_socket_fd = socket_fd;
+    session->conn.upstream = proxy->upstream;
+    session->conn.keypool = proxy->keypool;
+    session->phase = PROXY_PHASE_CLIENT_HELLO;
+    session->number = loop->accepted;
+    loop->active_sessions++;
+
+    int ret = proxy_session_wait(loop, session, EPOLL_CTL_ADD);
+
+    pthread_mutex_unlock(&(loop->lock));
+
+    if (ret != EXIT_SUCCESS)
+    {
+      kmyth_metrics_inc(KMYTH_METRIC_KEY_REQUEST_ERRORS);
+      proxy_session_release(loop, session);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * proxy_expire_sessions()
+ ****************************************************************************/
+static void proxy_expire_sessions(ProxyEventLoop * loop)
+{
+  uint64_t now_us = kmyth_metrics_now_us();
+
+  for (int i = 0; i < loop->session_count; i++)
+  {
+    ProxySession *session = &(loop->sessions[i]);
+    bool expired = false;
+
+    pthread_mutex_lock(&(loop->lock));
+    if (session->state == PROXY_SESSION_WAITING &&
+        session->deadline_us < now_us)
+    {
+      // claim the session, as a worker would
+      session->state = PROXY_SESSION_RUNNING;
+      expired = true;
+    }
+    pthread_mutex_unlock(&(loop->lock));
+
+    if (expired)
+    {
+      kmyth_log(LOG_WARNING, "ECDH session #%d timed out", session->number);
+      kmyth_metrics_inc(KMYTH_METRIC_KEY_REQUEST_ERRORS);
+      proxy_session_release(loop, session);
+    }
+  }
+}
+
+/*****************************************************************************
+ * proxy_event_loop_cleanup()
+ ****************************************************************************/
+static void proxy_event_loop_cleanup(ProxyEventLoop * loop)
+{
+  // stop the workers once they have served the sessions already queued
+  pthread_mutex_lock(&(loop->lock));
+  loop->stopping = true;
+  pthread_cond_broadcast(&(loop->ready));
+  pthread_mutex_unlock(&(loop->lock));
+
+  for (int i = 0; i < loop->thread_count; i++)
+  {
+    pthread_join(loop->threads[i], NULL);
+  }
+
+  // close any sessions left waiting (after an error)
+  for (int i = 0; loop->sessions != NULL && i < loop->session_count; i++)
+  {
+    if (loop->sessions[i].state != PROXY_SESSION_FREE)
+    {
+      proxy_session_release(loop, &(loop->sessions[i]));
+    }
+  }
+
+  proxy_stop_accepting(loop);
+  if (loop->wake_fd != UNSET_FD)
+  {
+    close(loop->wake_fd);
+  }
+  if (loop->epoll_fd != UNSET_FD)
+  {
+    close(loop->epoll_fd);
+  }
+
+  pthread_cond_destroy(&(loop->ready));
+  pthread_mutex_destroy(&(loop->lock));
+
+  loop->proxy->upstream = NULL;
+  proxy_upstream_cleanup(&(loop->upstream));
+
+  if (loop->proxy->keypool != NULL)
+  {
+    demo_ecdh_keypool_cleanup(loop->proxy->keypool);
+    loop->proxy->keypool = NULL;
+  }
+
+  free(loop->threads);
+  free(loop->queue);
+  free(loop->free_slots);
+  free(loop->sessions);
+}
+
+/*****************************************************************************
+ * proxy_run_event_loop()
+ ****************************************************************************/
+static int proxy_run_event_loop(TLSProxy * proxy)
+{
+  ProxyEventLoop loop;
+
+  secure_memset(&loop, 0, sizeof(ProxyEventLoop));
+  loop.proxy = proxy;
+  loop.epoll_fd = UNSET_FD;
+  loop.wake_fd = UNSET_FD;
+  loop.accepting = true;
+  loop.session_count = proxy->max_sessions;
+  pthread_mutex_init(&(loop.lock), NULL);
+  pthread_cond_init(&(loop.ready), NULL);
+
+  // a client that goes away mid-write must not take the other sessions
+  // down with it
+  signal(SIGPIPE, SIG_IGN);
+
+  int listen_fd = proxy->ecdhconn.config.listen_socket_fd;
+  int flags = fcntl(listen_fd, F_GETFL, 0);
+
+  loop.sessions = calloc(loop.session_count, sizeof(ProxySession));
+  loop.free_slots = calloc(loop.session_count, sizeof(int));
+  loop.queue = calloc(loop.session_count, sizeof(ProxySession *));
+  loop.threads = calloc(proxy->workers, sizeof(pthread_t));
+  loop.epoll_fd = epoll_create1(0);
+  loop.wake_fd = eventfd(0, EFD_NONBLOCK);
+
+  // the sessions' KMIP requests share a few long-lived server connections,
+  // so the upstream handshakes do not grow with the number of clients
+  int upstream_ret = proxy_upstream_init(&(loop.upstream), &(proxy->tlsconn),
+                                         proxy->upstream_conns);
+
+  if (proxy->upstream_conns > 0)
+  {
+    proxy->upstream = &(loop.upstream);
+  }
+
+  // key generation for the sessions' key agreement happens off their
+  // critical path, in a background thread
+  int keypool_ret = EXIT_SUCCESS;
+
+  if (proxy->ephemeral_keys > 0)
+  {
+    proxy->keypool = &(loop.keypool);
+    keypool_ret = demo_ecdh_keypool_init(proxy->keypool,
+                                         proxy->ephemeral_keys);
+  }
+
+  if (loop.sessions == NULL || loop.free_slots == NULL ||
+      upstream_ret != EXIT_SUCCESS || keypool_ret != EXIT_SUCCESS ||
+      loop.queue == NULL || loop.threads == NULL ||
+      loop.epoll_fd == -1 || loop.wake_fd == -1 || flags == -1 ||
+      fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+  {
+    kmyth_log(LOG_ERR, "failed to set up the proxy event loop");
+    loop.epoll_fd = (loop.epoll_fd == -1) ? UNSET_FD : loop.epoll_fd;
+    loop.wake_fd = (loop.wake_fd == -1) ? UNSET_FD : loop.wake_fd;
+    proxy_event_loop_cleanup(&loop);
+    return EXIT_FAILURE;
+  }
+
+  // hand out the lowest slots first
+  for (int i = loop.session_count - 1; i >= 0; i--)
+  {
+    loop.free_slots[loop.free_count++] = i;
+  }
+
+  // the listening socket is marked by a NULL pointer, the wake-up
+  // eventfd by a pointer to it, and each session by its table entry
+  struct epoll_event event = { 0 };
+
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event))
+  {
+    kmyth_log(LOG_ERR, "failed to watch the ECDH server socket");
+    proxy_event_loop_cleanup(&loop);
+    return EXIT_FAILURE;
+  }
+  event.data.ptr = &(loop.wake_fd);
+  if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.wake_fd, &event))
+  {
+    kmyth_log(LOG_ERR, "failed to watch the event loop wake-up descriptor");
+    proxy_event_loop_cleanup(&loop);
+    return EXIT_FAILURE;
+  }
+
+  for (; loop.thread_count < proxy->workers; loop.thread_count++)
+  {
+    if (pthread_create(&(loop.threads[loop.thread_count]), NULL,
+                       proxy_worker_main, &loop))
+    {
+      kmyth_log(LOG_ERR, "failed to start proxy worker thread");
+      proxy_event_loop_cleanup(&loop);
+      return EXIT_FAILURE;
+    }
+  }
+  kmyth_log(LOG_DEBUG, "proxy serving up to %d ECDH sessions with %d workers",
+                       loop.session_count, loop.thread_count);
+
+  struct epoll_event events[PROXY_EPOLL_EVENTS];
+  uint64_t next_sweep_us = kmyth_metrics_now_us() + 1000000;
+  bool finished_sessions = false;
+  int ret = EXIT_SUCCESS;
+
+  while (ret == EXIT_SUCCESS)
+  {
+    pthread_mutex_lock(&(loop.lock));
+    bool idle = (loop.active_sessions == 0);
+    pthread_mutex_unlock(&(loop.lock));
+
+    // once the session limit is reached, finish with the sessions left
+    if (!loop.accepting && idle)
+    {
+      break;
+    }
+
+    int count = epoll_wait(loop.epoll_fd, events, PROXY_EPOLL_EVENTS, 1000);
+
+    if (count == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "proxy event loop wait failed");
+      ret = EXIT_FAILURE;
+      break;
+    }
+
+    for (int i = 0; i < count && ret == EXIT_SUCCESS; i++)
+    {
+      if (events[i].data.ptr == NULL)
+      {
+        ret = proxy_accept_sessions(&loop);
+      }
+      else if (events[i].data.ptr == &(loop.wake_fd))
+      {
+        uint64_t finished = 0;
+
+        if (read(loop.wake_fd, &finished, sizeof(finished)) > 0)
+        {
+          finished_sessions = true;
+        }
+      }
+      else
+      {
+        proxy_dispatch_session(&loop, (ProxySession *) events[i].data.ptr);
+      }
+    }
+
+    // once a second: close sessions whose clients have gone quiet, and
+    // bring the metrics file up to date
+    uint64_t now_us = kmyth_metrics_now_us();
+
+    if (now_us >= next_sweep_us)
+    {
+      proxy_expire_sessions(&loop);
+      if (finished_sessions)
+      {
+        proxy_write_metrics(proxy);
+        finished_sessions = false;
+      }
+      next_sweep_us = now_us + 1000000;
+    }
+  }
+
+  proxy_event_loop_cleanup(&loop);
+
+  return ret;
+}
+
 /*****************************************************************************
  * main()
  ****************************************************************************/
@@ -578,6 +1569,18 @@ int main(int argc, char **argv)
   proxy_get_options(&proxy, argc, argv);
   proxy_check_options(&proxy);
 
+  // each session is handled by a forked child (unless worker threads serve
+  // them), so the metrics have to live in memory the children share for
+  // their figures to add up
+  if (proxy.metrics_path != NULL)
+  {
+    if (proxy.workers == 0 && kmyth_metrics_share())
+    {
+      kmyth_log(LOG_WARNING, "unable to share metrics between sessions");
+    }
+    proxy_write_metrics(&proxy);
+  }
+
   // setup proxy's TLS client interface
   if (EXIT_SUCCESS != proxy_create_tls_client(&proxy))
   {
@@ -592,6 +1595,22 @@ int main(int argc, char **argv)
     proxy_error(&proxy);
   }
 
+  // serve the ECDH client(s) from an event loop and worker threads
+  if (proxy.workers > 0)
+  {
+    if (EXIT_SUCCESS != proxy_run_event_loop(&proxy))
+    {
+      kmyth_log(LOG_ERR, "error serving ECDH client connections");
+      proxy_error(&proxy);
+    }
+    proxy_write_metrics(&proxy);
+    proxy_cleanup(&proxy);
+
+    kmyth_log(LOG_DEBUG, "normal termination ...");
+
+    return EXIT_SUCCESS;
+  }
+
   // accept connections from ECDH client(s)
   if (EXIT_SUCCESS != proxy_manage_ecdh_client_connections(&proxy))
   {
@@ -601,6 +1620,7 @@ int main(int argc, char **argv)
 
   // handle ECDH client connection - facilitate 'retrieve key' protocol
   proxy_handle_session(&proxy);
+  proxy_write_metrics(&proxy);
 
   proxy_cleanup(&proxy);
 
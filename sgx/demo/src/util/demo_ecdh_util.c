@@ -21,98 +21,127 @@ void demo_ecdh_init(bool clientMode, ECDHPeer * ecdhconn)
 }
 
 /*****************************************************************************
- * demo_ecdh_cleanup()
+ * demo_ecdh_session_cleanup()
  ****************************************************************************/
-void demo_ecdh_cleanup(ECDHPeer * ecdhconn)
+void demo_ecdh_session_cleanup(ECDHSession * session)
 {
-  // Note: These clear and free functions should all be safe to use with
-  // null pointer values.
-
   // if there is an open ECDH session socket, close it
-  if (ecdhconn->session.session_socket_fd != UNSET_FD)
+  if (session->session_socket_fd != UNSET_FD)
   {
-    close(ecdhconn->session.session_socket_fd);
+    close(session->session_socket_fd);
   }
 
-  // clear and/or free memory for loaded keys and certs
-  if (ecdhconn->config.local_sign_key != NULL)
+  // clear/free memory for 'ephemeral' session key agreement contributions
+  if (session->local_eph_keypair != NULL)
   {
-    EVP_PKEY_free(ecdhconn->config.local_sign_key);
+    EVP_PKEY_free(session->local_eph_keypair);
   }
-  if (ecdhconn->config.local_sign_cert != NULL)
+  if (session->remote_eph_pubkey != NULL)
   {
-    X509_free(ecdhconn->config.local_sign_cert);
+    EVP_PKEY_free(session->remote_eph_pubkey);
   }
-  if (ecdhconn->config.remote_sign_cert != NULL)
+
+  // clear/free memory for session secrets and keys
+  if (session->shared_secret.buffer != NULL)
   {
-    X509_free(ecdhconn->config.remote_sign_cert);
+    kmyth_clear_and_free(session->shared_secret.buffer,
+                         session->shared_secret.size);
   }
-
-  // clear/free memory for 'ephemeral' session key agreement contributions
-  if (ecdhconn->session.local_eph_keypair != NULL)
+  if (session->request_symkey.buffer != NULL)
   {
-    EVP_PKEY_free(ecdhconn->session.local_eph_keypair);
+    kmyth_clear_and_free(session->request_symkey.buffer,
+                         session->request_symkey.size);
   }
-  if (ecdhconn->session.remote_eph_pubkey != NULL)
+  if (session->response_symkey.buffer != NULL)
   {
-    EVP_PKEY_free(ecdhconn->session.remote_eph_pubkey);
+    kmyth_clear_and_free(session->response_symkey.buffer,
+                         session->response_symkey.size);
   }
-
-  // clear/free memory for session secrets and keys
-  if (ecdhconn->session.shared_secret.buffer != NULL)
+  if (session->resume_secret.buffer != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.shared_secret.buffer,
-                         ecdhconn->session.shared_secret.size);
+    kmyth_clear_and_free(session->resume_secret.buffer,
+                         session->resume_secret.size);
   }
-  if (ecdhconn->session.request_symkey.buffer != NULL)
+
+  // free and/or clear memory for protocol message state variables
+  if (session->proto.client_hello.body != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.request_symkey.buffer,
-                         ecdhconn->session.request_symkey.size);
+    kmyth_clear_and_free(session->proto.client_hello.body,
+                         session->proto.client_hello.hdr.msg_size);
   }
-  if (ecdhconn->session.response_symkey.buffer != NULL)
+
+  if (session->proto.server_hello.body != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.response_symkey.buffer,
-                         ecdhconn->session.response_symkey.size);
+    kmyth_clear_and_free(session->proto.server_hello.body,
+                         session->proto.server_hello.hdr.msg_size);
   }
 
-  // free and/or clear memory for protocol message state variables
-  if (ecdhconn->session.proto.client_hello.body != NULL)
+  if (session->proto.kmip_request.buffer != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.client_hello.body,
-                         ecdhconn->session.proto.client_hello.hdr.msg_size);
+    kmyth_clear_and_free(session->proto.kmip_request.buffer,
+                         session->proto.kmip_request.size);
   }
 
-  if (ecdhconn->session.proto.server_hello.body != NULL)
+  if (session->proto.key_request.body != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.server_hello.body,
-                         ecdhconn->session.proto.server_hello.hdr.msg_size);
+    kmyth_clear_and_free(session->proto.key_request.body,
+                         session->proto.key_request.hdr.msg_size);
   }
 
-  if (ecdhconn->session.proto.kmip_request.buffer != NULL)
+  if (session->proto.kmip_response.buffer != NULL)
+  {
+    kmyth_clear_and_free(session->proto.kmip_response.buffer,
+                         session->proto.kmip_response.size);
+  }
+  
+  if (session->proto.key_response.body != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.kmip_request.buffer,
-                         ecdhconn->session.proto.kmip_request.size);
+    kmyth_clear_and_free(session->proto.key_response.body,
+                         session->proto.key_response.hdr.msg_size);
   }
 
-  if (ecdhconn->session.proto.key_request.body != NULL)
+  if (session->proto.ticket.buffer != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.key_request.body,
-                         ecdhconn->session.proto.key_request.hdr.msg_size);
+    free(session->proto.ticket.buffer);
   }
 
-  if (ecdhconn->session.proto.kmip_response.buffer != NULL)
+  secure_memset(session, 0, sizeof(ECDHSession));
+  session->session_socket_fd = UNSET_FD;
+}
+
+/*****************************************************************************
+ * demo_ecdh_cleanup()
+ ****************************************************************************/
+void demo_ecdh_cleanup(ECDHPeer * ecdhconn)
+{
+  // Note: These clear and free functions should all be safe to use with
+  // null pointer values.
+
+  // clear and/or free memory for loaded keys and certs
+  if (ecdhconn->config.local_sign_key != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.kmip_response.buffer,
-                         ecdhconn->session.proto.kmip_response.size);
+    EVP_PKEY_free(ecdhconn->config.local_sign_key);
   }
-  
-  if (ecdhconn->session.proto.key_response.body != NULL)
+  if (ecdhconn->config.local_sign_cert != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.key_response.body,
-                         ecdhconn->session.proto.key_response.hdr.msg_size);
+    X509_free(ecdhconn->config.local_sign_cert);
   }
-  
-  demo_ecdh_init(ecdhconn, false);
+  if (ecdhconn->config.remote_sign_cert != NULL)
+  {
+    X509_free(ecdhconn->config.remote_sign_cert);
+  }
+  ec_peer_cert_clear(&(ecdhconn->config.remote_peer));
+  free(ecdhconn->config.server_hello_template.buffer);
+  if (ecdhconn->config.ticket_key.buffer != NULL)
+  {
+    kmyth_clear_and_free(ecdhconn->config.ticket_key.buffer,
+                         ecdhconn->config.ticket_key.size);
+  }
+
+  // close the session socket and clear the session state
+  demo_ecdh_session_cleanup(&(ecdhconn->session));
+
+  demo_ecdh_init(false, ecdhconn);
 }
 
 /*****************************************************************************
@@ -230,6 +259,16 @@ int demo_ecdh_load_local_sign_cert(ECDHPeer * ecdhconn,
 
   kmyth_log(LOG_DEBUG, "loaded local certificate from file (%s)",
                        local_sign_cert_path);
+
+  // a server's identity is the same in every 'Server Hello' it sends, so
+  // encode it once, here
+  if (!ecdhconn->config.isClient &&
+      prepare_server_hello_template(ecdhconn->config.local_sign_cert,
+                                    &(ecdhconn->config.server_hello_template)))
+  {
+    kmyth_log(LOG_ERR, "failed to prepare 'Server Hello' template");
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
 
@@ -265,25 +304,76 @@ int demo_ecdh_load_remote_sign_cert(ECDHPeer * ecdhconn,
   kmyth_log(LOG_DEBUG, "loaded remote certificate from file (%s)",
                        remote_sign_cert_path);
 
+  // extract the remote identity and set up signature verification now,
+  // rather than in every session
+  if (ec_peer_cert_prepare(ecdhconn->config.remote_sign_cert,
+                           &(ecdhconn->config.remote_peer)))
+  {
+    kmyth_log(LOG_ERR, "failed to prepare remote certificate (%s)",
+                       remote_sign_cert_path);
+    return EXIT_FAILURE;
+  }
+
   return EXIT_SUCCESS;
 }
 
+/*****************************************************************************
+ * recv_by_deadline()
+ ****************************************************************************/
+static int recv_by_deadline(int socket_fd, void *buf, size_t len,
+                            uint64_t deadline_us)
+{
+  if (deadline_us == 0)
+  {
+    return socket_read_full(socket_fd, buf, len);
+  }
+
+  // a client that trickles its message in a byte at a time would keep
+  // each read within the socket's receive timeout, so bound the whole
+  unsigned char *pos = (unsigned char *) buf;
+
+  while (len > 0)
+  {
+    uint64_t now_us = kmyth_metrics_now_us();
+    struct pollfd pfd = { .fd = socket_fd, .events = POLLIN };
+
+    if (now_us >= deadline_us ||
+        poll(&pfd, 1, (int) ((deadline_us - now_us + 999) / 1000)) == 0)
+    {
+      kmyth_log(LOG_WARNING, "ECDH peer too slow to send its message");
+      return 1;
+    }
+
+    ssize_t n = read(socket_fd, pos, len);
+
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    pos += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
 /*****************************************************************************
  * demo_ecdh_recv_msg()
  ****************************************************************************/
-int demo_ecdh_recv_msg(int socket_fd, ECDHMessage * msg)
+int demo_ecdh_recv_msg(int socket_fd, ECDHMessage * msg,
+                       unsigned int timeout_ms)
 {
+  uint64_t deadline_us = (timeout_ms == 0) ? 0 :
+                         kmyth_metrics_now_us() + (uint64_t) timeout_ms * 1000;
+
   // read message header (and do some sanity checks)
   uint8_t hdr_buf[sizeof(msg->hdr)];
-  ssize_t bytes_read = read(socket_fd, hdr_buf, sizeof(msg->hdr));
-  if (bytes_read == 0)
-  {
-    kmyth_log(LOG_ERR, "ECDH connection is closed");
-    return EXIT_FAILURE;
-  }
-  else if (bytes_read != sizeof(msg->hdr))
+  if (recv_by_deadline(socket_fd, hdr_buf, sizeof(msg->hdr), deadline_us))
   {
-    kmyth_log(LOG_ERR, "read invalid number of ECDH message header bytes");
+    kmyth_log(LOG_ERR, "ECDH connection closed reading message header");
     return EXIT_FAILURE;
   }
   msg->hdr.msg_size = hdr_buf[0] << 8;
@@ -302,16 +392,10 @@ int demo_ecdh_recv_msg(int socket_fd, ECDHMessage * msg)
     return EXIT_FAILURE;
   }
 
-  // receive message bytes
-  bytes_read = read(socket_fd, msg->body, msg->hdr.msg_size);
-  if (bytes_read == 0)
-  {
-    kmyth_log(LOG_ERR, "ECDH connection is closed");
-    return EXIT_FAILURE;
-  }
-  else if (bytes_read != msg->hdr.msg_size)
+  // receive message bytes (however many reads they take to arrive)
+  if (recv_by_deadline(socket_fd, msg->body, msg->hdr.msg_size, deadline_us))
   {
-    kmyth_log(LOG_ERR, "read incorrect number of ECDH message bytes");
+    kmyth_log(LOG_ERR, "ECDH connection closed reading message bytes");
     return EXIT_FAILURE;
   }
 
@@ -332,19 +416,14 @@ int demo_ecdh_send_msg(int socket_fd, ECDHMessage * msg)
   }
 
   // send message header (two-byte, unsigned, big-endian message size value)
+  // and payload (body) together, in one system call
   uint16_t hdr_buf = htons(msg->hdr.msg_size);
-  ssize_t bytes_sent = write(socket_fd, &hdr_buf, sizeof(msg->hdr));
-  if (bytes_sent != sizeof(msg->hdr))
-  {
-    kmyth_log(LOG_ERR, "sending ECDH message header failed");
-    return EXIT_FAILURE;
-  }
+  struct iovec iov[2] = { { &hdr_buf, sizeof(msg->hdr) },
+                          { msg->body, msg->hdr.msg_size } };
 
-  // send message payload (body)
-  bytes_sent = write(socket_fd, msg->body, msg->hdr.msg_size);
-  if (bytes_sent != msg->hdr.msg_size)
+  if (socket_writev_full(socket_fd, iov, 2))
   {
-    kmyth_log(LOG_ERR, "sending ECDH message payload failed");
+    kmyth_log(LOG_ERR, "sending ECDH message failed");
     return EXIT_FAILURE;
   }
 
@@ -360,13 +439,20 @@ int demo_ecdh_recv_client_hello_msg(ECDHPeer * ecdh_svr)
 
   struct ECDHMessage *msg = &(ecdh_svr->session.proto.client_hello);
 
-  ret = demo_ecdh_recv_msg(ecdh_svr->session.session_socket_fd, msg);
+  ret = demo_ecdh_recv_msg(ecdh_svr->session.session_socket_fd, msg,
+                           ecdh_svr->config.stage_timeout_ms);
   if (ret != EXIT_SUCCESS)
   {
     kmyth_log(LOG_ERR, "error receiving 'Client Hello' message");
     return EXIT_FAILURE;
   }
 
+  // a client holding a session ticket may resume a session instead
+  if (is_resume_request_msg(msg))
+  {
+    return demo_ecdh_resume_session(ecdh_svr);
+  }
+
   kmyth_log(LOG_DEBUG, "received 'Client Hello': %02X%02X ... %02X%02X "
                       "(%d bytes)",
                       msg->body[0], msg->body[1],
@@ -376,7 +462,7 @@ int demo_ecdh_recv_client_hello_msg(ECDHPeer * ecdh_svr)
 
   // validate 'Client Hello' message and parse out message fields
   ret = parse_client_hello_msg(msg,
-                               ecdh_svr->config.remote_sign_cert,
+                               &(ecdh_svr->config.remote_peer),
                                &(ecdh_svr->session.remote_eph_pubkey));
   if (ret != EXIT_SUCCESS)
   {
@@ -399,11 +485,12 @@ int demo_ecdh_send_server_hello_msg(ECDHPeer * ecdh_svr)
   ECDHMessage *msg = &(ecdh_svr->session.proto.server_hello);
 
   // compose 'Server Hello' message
-  ret = compose_server_hello_msg(ecdh_svr->config.local_sign_key,
-                                 ecdh_svr->config.local_sign_cert,
-                                 ecdh_svr->session.remote_eph_pubkey,
-                                 ecdh_svr->session.local_eph_keypair,
-                                 msg);
+  ret = compose_server_hello_msg_from_template(
+          ecdh_svr->config.local_sign_key,
+          &(ecdh_svr->config.server_hello_template),
+          ecdh_svr->session.remote_eph_pubkey,
+          ecdh_svr->session.local_eph_keypair,
+          msg);
   if (ret != EXIT_SUCCESS)
   {
     kmyth_log(LOG_ERR, "failed to create 'Server Hello' message");
@@ -460,6 +547,8 @@ int demo_ecdh_get_session_key(ECDHPeer * ecdh_svr)
   ECDHMessage *shello_msg = &(ecdh_svr->session.proto.server_hello);
   ByteBuffer *req_skey = &(ecdh_svr->session.request_symkey);
   ByteBuffer *resp_skey = &(ecdh_svr->session.response_symkey);
+  ByteBuffer *resume = &(ecdh_svr->session.resume_secret);
+  bool tickets = (ecdh_svr->config.ticket_key.buffer != NULL);
 
   ret = compute_ecdh_session_key(secret->buffer,
                                  secret->size,
@@ -470,12 +559,19 @@ int demo_ecdh_get_session_key(ECDHPeer * ecdh_svr)
                                  &(req_skey->buffer),
                                  &(req_skey->size),
                                  &(resp_skey->buffer),
-                                 &(resp_skey->size));
+                                 &(resp_skey->size),
+                                 tickets ? &(resume->buffer) : NULL,
+                                 tickets ? &(resume->size) : NULL);
   if (ret != EXIT_SUCCESS)
   {
     kmyth_log(LOG_ERR, "server computation of 'session key' results failed");
     return EXIT_FAILURE;
   }
+
+  // the tickets descended from this session inherit its limits
+  ecdh_svr->session.ticket_issued = time(NULL);
+  ecdh_svr->session.ticket_resumptions_left =
+    ecdh_svr->config.ticket_resumptions;
   kmyth_log(LOG_DEBUG, "'Key Request' key: 0x%02X%02X...%02X%02X (%ld bytes)",
                        req_skey->buffer[0], req_skey->buffer[1],
                        req_skey->buffer[req_skey->size - 2],
@@ -502,7 +598,8 @@ int demo_ecdh_recv_key_request_msg(ECDHPeer * ecdh_svr)
 
   kmyth_log(LOG_DEBUG, "waiting for 'Key Request' message");
 
-  ret = demo_ecdh_recv_msg(ecdh_svr->session.session_socket_fd, msg);
+  ret = demo_ecdh_recv_msg(ecdh_svr->session.session_socket_fd, msg,
+                           ecdh_svr->config.stage_timeout_ms);
   if (ret != EXIT_SUCCESS)
   {
     kmyth_log(LOG_ERR, "error receiving 'Key Request' message");
@@ -519,7 +616,7 @@ int demo_ecdh_recv_key_request_msg(ECDHPeer * ecdh_svr)
   // decrypt, validate message, and parse out 'Key Request' fields
   ByteBuffer *kmip_req = &(ecdh_svr->session.proto.kmip_request);
 
-  ret = parse_key_request_msg(ecdh_svr->config.remote_sign_cert,
+  ret = parse_key_request_msg(&(ecdh_svr->config.remote_peer),
                               &(ecdh_svr->session.request_symkey),
                               msg,
                               ecdh_svr->session.local_eph_keypair,
@@ -538,3 +635,341 @@ int demo_ecdh_recv_key_request_msg(ECDHPeer * ecdh_svr)
   
   return EXIT_SUCCESS;
 }
+
+/*****************************************************************************
+ * demo_ecdh_enable_tickets()
+ ****************************************************************************/
+int demo_ecdh_enable_tickets(ECDHConfig * config, int lifetime,
+                             int resumptions)
+{
+  config->ticket_key.buffer = calloc(DEMO_ECDH_TICKET_KEY_SIZE,
+                                     sizeof(unsigned char));
+  if (config->ticket_key.buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate session ticket key");
+    return EXIT_FAILURE;
+  }
+  config->ticket_key.size = DEMO_ECDH_TICKET_KEY_SIZE;
+
+  if (RAND_bytes(config->ticket_key.buffer, DEMO_ECDH_TICKET_KEY_SIZE) != 1)
+  {
+    kmyth_log(LOG_ERR, "failed to generate session ticket key");
+    kmyth_clear_and_free(config->ticket_key.buffer, config->ticket_key.size);
+    kmyth_clear(&(config->ticket_key), sizeof(ByteBuffer));
+    return EXIT_FAILURE;
+  }
+
+  config->ticket_lifetime = lifetime;
+  config->ticket_resumptions = resumptions;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_ecdh_issue_ticket()
+ ****************************************************************************/
+int demo_ecdh_issue_ticket(ECDHPeer * ecdh_svr)
+{
+  ECDHConfig *config = &(ecdh_svr->config);
+  ECDHSession *session = &(ecdh_svr->session);
+  ByteBuffer *ticket = &(session->proto.ticket);
+
+  // no ticket if resumption is off, or the session may not be resumed again
+  if (config->ticket_key.buffer == NULL ||
+      session->resume_secret.size != KMYTH_ECDH_RESUME_SECRET_SIZE ||
+      session->ticket_resumptions_left <= 0 ||
+      time(NULL) >= session->ticket_issued + config->ticket_lifetime)
+  {
+    return EXIT_SUCCESS;
+  }
+
+  // the ticket holds, sealed with the ticket key:
+  //   - time the full session it descends from was set up (8 bytes)
+  //   - resumptions left (2 bytes)
+  //   - digest of the client certificate it was issued to
+  //   - the resumption secret
+  unsigned char pt[DEMO_ECDH_TICKET_PT_SIZE];
+  unsigned char *pt_ptr = pt;
+  uint64_t issued = htobe64((uint64_t) session->ticket_issued);
+  uint16_t left = htobe16((uint16_t) session->ticket_resumptions_left);
+
+  memcpy(pt_ptr, &issued, sizeof(issued));
+  pt_ptr += sizeof(issued);
+  memcpy(pt_ptr, &left, sizeof(left));
+  pt_ptr += sizeof(left);
+  memcpy(pt_ptr, config->remote_peer.digest, SHA256_DIGEST_LENGTH);
+  pt_ptr += SHA256_DIGEST_LENGTH;
+  memcpy(pt_ptr, session->resume_secret.buffer, KMYTH_ECDH_RESUME_SECRET_SIZE);
+
+  int ret = aes_gcm_encrypt(config->ticket_key.buffer, config->ticket_key.size,
+                            pt, sizeof(pt),
+                            &(ticket->buffer), &(ticket->size));
+
+  kmyth_clear(pt, sizeof(pt));
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "failed to seal session ticket");
+    return EXIT_FAILURE;
+  }
+  kmyth_log(LOG_DEBUG, "issued session ticket (%d resumptions left)",
+                       session->ticket_resumptions_left);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_ecdh_open_ticket()
+ ****************************************************************************/
+static int demo_ecdh_open_ticket(ECDHPeer * ecdh_svr, ByteBuffer * ticket)
+{
+  ECDHConfig *config = &(ecdh_svr->config);
+  ECDHSession *session = &(ecdh_svr->session);
+
+  if (config->ticket_key.buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "session resumption is not enabled");
+    return EXIT_FAILURE;
+  }
+
+  unsigned char *pt = NULL;
+  size_t pt_len = 0;
+
+  if (aes_gcm_decrypt(config->ticket_key.buffer, config->ticket_key.size,
+                      ticket->buffer, ticket->size, &pt, &pt_len)
+      || pt_len != DEMO_ECDH_TICKET_PT_SIZE)
+  {
+    kmyth_log(LOG_ERR, "session ticket could not be opened");
+    kmyth_clear_and_free(pt, pt_len);
+    return EXIT_FAILURE;
+  }
+
+  uint64_t issued = 0;
+  uint16_t left = 0;
+  unsigned char *pt_ptr = pt;
+
+  memcpy(&issued, pt_ptr, sizeof(issued));
+  pt_ptr += sizeof(issued);
+  memcpy(&left, pt_ptr, sizeof(left));
+  pt_ptr += sizeof(left);
+  session->ticket_issued = (time_t) be64toh(issued);
+  session->ticket_resumptions_left = (int) be16toh(left);
+
+  // the ticket must be for this client, unexpired, and have a use left
+  time_t now = time(NULL);
+
+  if (memcmp(pt_ptr, config->remote_peer.digest, SHA256_DIGEST_LENGTH) ||
+      now < session->ticket_issued ||
+      now >= session->ticket_issued + config->ticket_lifetime ||
+      session->ticket_resumptions_left <= 0)
+  {
+    kmyth_log(LOG_ERR, "session ticket rejected (expired or used up)");
+    kmyth_clear_and_free(pt, pt_len);
+    return EXIT_FAILURE;
+  }
+  pt_ptr += SHA256_DIGEST_LENGTH;
+  session->ticket_resumptions_left--;
+
+  session->resume_secret.buffer = malloc(KMYTH_ECDH_RESUME_SECRET_SIZE);
+  if (session->resume_secret.buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate resumption secret");
+    kmyth_clear_and_free(pt, pt_len);
+    return EXIT_FAILURE;
+  }
+  memcpy(session->resume_secret.buffer, pt_ptr, KMYTH_ECDH_RESUME_SECRET_SIZE);
+  session->resume_secret.size = KMYTH_ECDH_RESUME_SECRET_SIZE;
+  kmyth_clear_and_free(pt, pt_len);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_ecdh_resume_session()
+ ****************************************************************************/
+int demo_ecdh_resume_session(ECDHPeer * ecdh_svr)
+{
+  ECDHSession *session = &(ecdh_svr->session);
+  ECDHMessage *msg = &(session->proto.client_hello);
+
+  ByteBuffer ticket = { 0, NULL };
+  ByteBuffer nonce = { 0, NULL };
+
+  if (parse_resume_request_msg(msg, &ticket, &nonce))
+  {
+    kmyth_log(LOG_ERR, "'Resume Request' message parse error");
+    return EXIT_FAILURE;
+  }
+
+  // check the ticket, then derive this session's keys (and the resumption
+  // secret for its own ticket) from the one it carries
+  ByteBuffer resume_secret = { 0, NULL };
+  int ret = demo_ecdh_open_ticket(ecdh_svr, &ticket);
+
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_ECDH_TICKET,
+                             ret == EXIT_SUCCESS);
+  if (ret == EXIT_SUCCESS)
+  {
+    resume_secret = session->resume_secret;
+    kmyth_clear(&(session->resume_secret), sizeof(ByteBuffer));
+    ret = derive_resumed_session_keys(&resume_secret, &ticket, &nonce,
+                                      &(session->request_symkey),
+                                      &(session->response_symkey),
+                                      &(session->resume_secret));
+  }
+  kmyth_clear_and_free(resume_secret.buffer, resume_secret.size);
+  free(ticket.buffer);
+  free(nonce.buffer);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "failed to resume session");
+    return EXIT_FAILURE;
+  }
+
+  // decrypting the KMIP request shows the client holds the secret
+  ByteBuffer *kmip_req = &(session->proto.kmip_request);
+
+  if (decrypt_resume_request_msg(&(session->request_symkey), msg, kmip_req))
+  {
+    kmyth_log(LOG_ERR, "validation/parsing of 'Resume Request' failed");
+    return EXIT_FAILURE;
+  }
+  session->resumed = true;
+
+  kmyth_log(LOG_DEBUG, "resumed session (%d resumptions left): "
+                       "KMIP Get Key Request: 0x%02X%02X...%02X%02X"
+                       " (%ld bytes)", session->ticket_resumptions_left,
+                       (kmip_req->buffer)[0], (kmip_req->buffer)[1],
+                       (kmip_req->buffer)[kmip_req->size - 2],
+                       (kmip_req->buffer)[kmip_req->size - 1],
+                       kmip_req->size);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_ecdh_keypool_refill()
+ ****************************************************************************/
+static void *demo_ecdh_keypool_refill(void *arg)
+{
+  ECDHKeyPool *pool = (ECDHKeyPool *) arg;
+
+  pthread_mutex_lock(&(pool->lock));
+  while (!pool->stopping)
+  {
+    if (pool->count == pool->size)
+    {
+      pthread_cond_wait(&(pool->refill), &(pool->lock));
+      continue;
+    }
+
+    // key generation is the slow part: leave the pool available meanwhile
+    pthread_mutex_unlock(&(pool->lock));
+
+    EVP_PKEY *keypair = NULL;
+    int ret = create_ecdh_ephemeral_keypair(&keypair);
+
+    pthread_mutex_lock(&(pool->lock));
+    if (ret != EXIT_SUCCESS)
+    {
+      // sessions fall back to generating their own key pairs
+      kmyth_log(LOG_ERR, "failed to refill ECDH ephemeral key pair pool");
+      EVP_PKEY_free(keypair);
+      break;
+    }
+    if (pool->count < pool->size)
+    {
+      pool->keys[pool->count++] = keypair;
+    }
+    else
+    {
+      EVP_PKEY_free(keypair);
+    }
+  }
+  pthread_mutex_unlock(&(pool->lock));
+
+  return NULL;
+}
+
+/*****************************************************************************
+ * demo_ecdh_keypool_init()
+ ****************************************************************************/
+int demo_ecdh_keypool_init(ECDHKeyPool * pool, int size)
+{
+  secure_memset(pool, 0, sizeof(ECDHKeyPool));
+  pthread_mutex_init(&(pool->lock), NULL);
+  pthread_cond_init(&(pool->refill), NULL);
+
+  pool->keys = calloc(size, sizeof(EVP_PKEY *));
+  if (pool->keys == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate ECDH ephemeral key pair pool");
+    return EXIT_FAILURE;
+  }
+  pool->size = size;
+
+  if (pthread_create(&(pool->thread), NULL, demo_ecdh_keypool_refill, pool))
+  {
+    kmyth_log(LOG_ERR, "failed to start ECDH ephemeral key pair thread");
+    return EXIT_FAILURE;
+  }
+  pool->started = true;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_ecdh_keypool_take()
+ ****************************************************************************/
+int demo_ecdh_keypool_take(ECDHKeyPool * pool, EVP_PKEY ** keypair)
+{
+  *keypair = NULL;
+
+  if (pool != NULL)
+  {
+    pthread_mutex_lock(&(pool->lock));
+    if (pool->count > 0)
+    {
+      *keypair = pool->keys[--pool->count];
+      pool->keys[pool->count] = NULL;
+    }
+    pthread_cond_signal(&(pool->refill));
+    pthread_mutex_unlock(&(pool->lock));
+
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_ECDH_KEYPAIR,
+                               *keypair != NULL);
+    if (*keypair != NULL)
+    {
+      return EXIT_SUCCESS;
+    }
+  }
+
+  // the pool has run dry (or there is none): generate one now
+  return create_ecdh_ephemeral_keypair(keypair);
+}
+
+/*****************************************************************************
+ * demo_ecdh_keypool_cleanup()
+ ****************************************************************************/
+void demo_ecdh_keypool_cleanup(ECDHKeyPool * pool)
+{
+  if (pool->started)
+  {
+    pthread_mutex_lock(&(pool->lock));
+    pool->stopping = true;
+    pthread_cond_signal(&(pool->refill));
+    pthread_mutex_unlock(&(pool->lock));
+
+    pthread_join(pool->thread, NULL);
+  }
+
+  for (int i = 0; i < pool->count; i++)
+  {
+    EVP_PKEY_free(pool->keys[i]);
+  }
+  free(pool->keys);
+
+  pthread_cond_destroy(&(pool->refill));
+  pthread_mutex_destroy(&(pool->lock));
+
+  secure_memset(pool, 0, sizeof(ECDHKeyPool));
+}
@@ -301,6 +301,10 @@ int demo_tls_config_server_accept(TLSPeer * tls_svr)
     return -1;
   }
 
+  // allow a restarted server to listen again while connections from its
+  // previous run are still in TIME_WAIT
+  BIO_set_bind_mode(abio, BIO_BIND_REUSEADDR);
+
   // prepend SSL BIO to any incoming connection
   BIO_set_accept_bios(abio, sbio);
 
@@ -358,15 +362,9 @@ int demo_tls_recv_msg(int socket_fd, TLSMessage * msg)
 {
   // read message header (and do some sanity checks)
   uint8_t hdr_buf[sizeof(msg->hdr)];
-  ssize_t bytes_read = read(socket_fd, hdr_buf, sizeof(msg->hdr));
-  if (bytes_read == 0)
+  if (socket_read_full(socket_fd, hdr_buf, sizeof(msg->hdr)))
   {
-    kmyth_log(LOG_ERR, "TLS connection is closed");
-    return EXIT_FAILURE;
-  }
-  else if (bytes_read != sizeof(msg->hdr))
-  {
-    kmyth_log(LOG_ERR, "read invalid number of TLS message header bytes");
+    kmyth_log(LOG_ERR, "TLS connection closed reading message header");
     return EXIT_FAILURE;
   }
   msg->hdr.msg_size = hdr_buf[0] << 8;
@@ -377,7 +375,7 @@ int demo_tls_recv_msg(int socket_fd, TLSMessage * msg)
     return EXIT_FAILURE;
   }
 
-  // allocate memory for ECDH message receive buffer
+  // allocate memory for TLS message receive buffer
   msg->body = calloc(msg->hdr.msg_size, sizeof(unsigned char));
   if (msg->body == NULL)
   {
@@ -385,16 +383,10 @@ int demo_tls_recv_msg(int socket_fd, TLSMessage * msg)
     return EXIT_FAILURE;
   }
 
-  // receive message bytes
-  bytes_read = read(socket_fd, msg->body, msg->hdr.msg_size);
-  if (bytes_read == 0)
-  {
-    kmyth_log(LOG_ERR, "TLS connection is closed");
-    return EXIT_FAILURE;
-  }
-  else if (bytes_read != msg->hdr.msg_size)
+  // receive message bytes (however many reads they take to arrive)
+  if (socket_read_full(socket_fd, msg->body, msg->hdr.msg_size))
   {
-    kmyth_log(LOG_ERR, "read incorrect number of TLS message bytes");
+    kmyth_log(LOG_ERR, "TLS connection closed reading message bytes");
     return EXIT_FAILURE;
   }
 
@@ -415,19 +407,14 @@ int demo_tls_send_msg(int socket_fd, TLSMessage * msg)
   }
 
   // send message header (two-byte, unsigned, big-endian message size value)
+  // and payload (body) together, in one system call
   uint16_t hdr_buf = htons(msg->hdr.msg_size);
-  ssize_t bytes_sent = write(socket_fd, &hdr_buf, sizeof(msg->hdr));
-  if (bytes_sent != sizeof(msg->hdr))
-  {
-    kmyth_log(LOG_ERR, "sending TLS message header failed");
-    return EXIT_FAILURE;
-  }
+  struct iovec iov[2] = { { &hdr_buf, sizeof(msg->hdr) },
+                          { msg->body, msg->hdr.msg_size } };
 
-  // send message payload (body)
-  bytes_sent = write(socket_fd, msg->body, msg->hdr.msg_size);
-  if (bytes_sent != msg->hdr.msg_size)
+  if (socket_writev_full(socket_fd, iov, 2))
   {
-    kmyth_log(LOG_ERR, "sending TLS message payload failed");
+    kmyth_log(LOG_ERR, "sending TLS message failed");
     return EXIT_FAILURE;
   }
 
@@ -0,0 +1,765 @@
+/*****************************************************************************
+* kmyth_sgx_bench.c -
+*   untrusted app that measures what the kmyth SGX ECALLs cost: the bare
+*   ECALL transition, sealing and unsealing by payload size, unsealed data
+*   table lookups by table size and thread count, and (optionally) full
+*   'retrieve key' sessions through the TLS proxy and demo KMIP server.
+*   Results are written as CSV, one row per measurement, so that runs
+*   under different SGX SDK versions or mitigation settings can be
+*   compared.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <openssl/bio.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "sgx_urts.h"
+#include "sgx_attributes.h"
+
+#include <kmyth/kmyth_log.h>
+
+#include "ec_key_cert_marshal.h"
+#include "enclave_util.h"
+
+#include "kmyth_sgx_test_enclave_u.h"
+
+#define ENCLAVE_PATH "test/enclave/kmyth_sgx_test_enclave.signed.so"
+
+#define BENCH_DEFAULT_MIN_TIME_MS 250
+#define BENCH_DEFAULT_SESSION_TIME_MS 5000
+#define BENCH_DEFAULT_MAX_SIZE 65536
+#define BENCH_DEFAULT_MAX_ENTRIES 4096
+
+// The test enclave has TCSNum 10; leave some for the switchless runtime
+#define BENCH_MAX_THREADS 8
+
+// Defaults for the 'retrieve key' sessions (those of 'make demo')
+#define BENCH_CLIENT_PRIVATE_KEY_FILE "demo/data/client_priv_test.pem"
+#define BENCH_CLIENT_PUBLIC_CERT_FILE "demo/data/client_cert_test.pem"
+#define BENCH_SERVER_PUBLIC_CERT_FILE "demo/data/proxy_cert_test.pem"
+#define BENCH_SERVER_HOST "localhost"
+#define BENCH_SERVER_PORT "7000"
+#define BENCH_KEY_ID "7"
+
+/**
+ * @brief Payload sizes (bytes) sealed and unsealed, up to --max_size
+ */
+static const uint32_t bench_sizes[] = {
+  16, 256, 4096, 65536, 1U << 20
+};
+
+/**
+ * @brief Unsealed data table sizes (entries) looked up in, up to
+ *        --max_entries
+ */
+static const size_t bench_table_sizes[] = {
+  1, 16, 256, 4096, 65536
+};
+
+/**
+ * @brief Everything a 'retrieve key' session passes into the enclave
+ */
+typedef struct
+{
+  unsigned char *client_key;
+  int client_key_len;
+  unsigned char *client_cert;
+  int client_cert_len;
+  unsigned char *server_cert;
+  int server_cert_len;
+  const char *server_host;
+  const char *server_port;
+  const char *key_id;
+} bench_session_params;
+
+/**
+ * @brief One benchmark thread: what it runs, until when, and what it did
+ */
+typedef struct
+{
+  sgx_enclave_id_t eid;
+  uint64_t deadline_ns;
+
+  // lookups: the handles to look up, starting at first
+  const uint64_t *handles;
+  size_t handle_count;
+  size_t first;
+
+  // sessions
+  const bench_session_params *session;
+
+  uint64_t completed;
+  uint64_t failures;
+} bench_worker;
+
+static FILE *bench_out = NULL;
+static const char *bench_label = "";
+
+// the test enclave's (only) OCALL of its own
+void ocall_print_table_entry(size_t size, uint8_t * data)
+{
+  printf("%lu\n", size);
+  for (size_t i = 0; i < size; i++)
+  {
+    printf("0x%02x ", data[i]);
+  }
+  printf("\n");
+  return;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -t or --time          Minimum time (milliseconds) spent on each measurement. Defaults to %d.\n"
+          " -m or --max_size      Largest payload size (bytes) sealed and unsealed. Defaults to %d.\n"
+          " -n or --max_entries   Largest unsealed data table looked up in. Defaults to %d.\n"
+          " -T or --threads       Most threads run at once (at most %d). Defaults to 4.\n"
+          " -o or --output        Write the CSV results to this file. Defaults to stdout.\n"
+          " -l or --label         Label for the first CSV column (e.g. SDK version and mitigations).\n"
+          " -r or --retrieve      Also benchmark 'retrieve key' sessions (needs tls-proxy and demo-kmip-server running).\n"
+          " -d or --session_time  Minimum time (milliseconds) spent on each session measurement. Defaults to %d.\n"
+          " -I or --host          Proxy host for -r. Defaults to %s.\n"
+          " -P or --port          Proxy port for -r. Defaults to %s.\n"
+          " -k or --key_id        Key ID requested by -r sessions. Defaults to %s.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          BENCH_DEFAULT_MIN_TIME_MS, BENCH_DEFAULT_MAX_SIZE,
+          BENCH_DEFAULT_MAX_ENTRIES, BENCH_MAX_THREADS,
+          BENCH_DEFAULT_SESSION_TIME_MS, BENCH_SERVER_HOST, BENCH_SERVER_PORT,
+          BENCH_KEY_ID);
+}
+
+const struct option longopts[] = {
+  {"time", required_argument, 0, 't'},
+  {"max_size", required_argument, 0, 'm'},
+  {"max_entries", required_argument, 0, 'n'},
+  {"threads", required_argument, 0, 'T'},
+  {"output", required_argument, 0, 'o'},
+  {"label", required_argument, 0, 'l'},
+  {"retrieve", no_argument, 0, 'r'},
+  {"session_time", required_argument, 0, 'd'},
+  {"host", required_argument, 0, 'I'},
+  {"port", required_argument, 0, 'P'},
+  {"key_id", required_argument, 0, 'k'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// now_ns()
+//############################################################################
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// report()
+//
+// Writes one CSV row. ops_per_sec is the rate of all threads together;
+// ns_per_op is the mean time one operation took its thread.
+//############################################################################
+static void report(const char *benchmark, size_t size, size_t table_entries,
+                   size_t threads, uint64_t completed, uint64_t failures,
+                   uint64_t elapsed_ns)
+{
+  double seconds = (double) elapsed_ns / 1e9;
+  double ops_per_sec = (elapsed_ns == 0) ? 0.0 :
+    (double) completed / seconds;
+  double ns_per_op = (completed == 0) ? 0.0 :
+    (double) elapsed_ns * (double) threads / (double) completed;
+
+  fprintf(bench_out, "%s,%s,%zu,%zu,%zu,%lu,%lu,%.6f,%.1f,%.1f\n",
+          bench_label, benchmark, size, table_entries, threads,
+          (unsigned long) completed, (unsigned long) failures, seconds,
+          ops_per_sec, ns_per_op);
+  fflush(bench_out);
+}
+
+//############################################################################
+// bench_ecall()
+//
+// enc_get_sealed_size() only does arithmetic, so it costs what an ECALL
+// transition costs.
+//############################################################################
+static void bench_ecall(sgx_enclave_id_t eid, uint64_t min_time_ns)
+{
+  uint64_t completed = 0;
+  uint64_t failures = 0;
+  uint64_t start = now_ns();
+  uint64_t elapsed = 0;
+
+  do
+  {
+    int ret = -1;
+    uint32_t sealed_size = 0;
+
+    if (enc_get_sealed_size(eid, &ret, 16, &sealed_size) != SGX_SUCCESS
+        || ret != 0)
+    {
+      failures++;
+    }
+    else
+    {
+      completed++;
+    }
+    elapsed = now_ns() - start;
+  }
+  while (elapsed < min_time_ns);
+
+  report("ecall", 0, 0, 1, completed, failures, elapsed);
+}
+
+//############################################################################
+// bench_seal_unseal()
+//
+// Times enc_seal_data() and kmyth_unseal_into_enclave() separately at
+// one payload size. Each unsealed entry is discarded again, outside the
+// timing, so the table stays empty.
+//############################################################################
+static int bench_seal_unseal(sgx_enclave_id_t eid, uint32_t size,
+                             uint64_t min_time_ns)
+{
+  int ret = -1;
+  uint32_t sealed_size = 0;
+
+  if (enc_get_sealed_size(eid, &ret, size, &sealed_size) != SGX_SUCCESS
+      || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "enc_get_sealed_size(%u) failed", size);
+    return EXIT_FAILURE;
+  }
+
+  uint8_t *plain = (uint8_t *) malloc(size);
+  uint8_t *sealed = (uint8_t *) malloc(sealed_size);
+
+  if (plain == NULL || sealed == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate %u byte payload", size);
+    free(plain);
+    free(sealed);
+    return EXIT_FAILURE;
+  }
+  for (uint32_t i = 0; i < size; i++)
+  {
+    plain[i] = (uint8_t) i;
+  }
+
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask = { 0, 0 };
+
+  uint64_t completed = 0;
+  uint64_t failures = 0;
+  uint64_t start = now_ns();
+  uint64_t elapsed = 0;
+
+  do
+  {
+    if (enc_seal_data(eid, &ret, plain, size, sealed, sealed_size,
+                      key_policy, attribute_mask) != SGX_SUCCESS || ret != 0)
+    {
+      failures++;
+    }
+    else
+    {
+      completed++;
+    }
+    elapsed = now_ns() - start;
+  }
+  while (elapsed < min_time_ns);
+  report("seal", size, 0, 1, completed, failures, elapsed);
+
+  if (completed == 0)
+  {
+    free(plain);
+    free(sealed);
+    return EXIT_FAILURE;
+  }
+
+  completed = 0;
+  failures = 0;
+  elapsed = 0;
+  start = now_ns();
+  do
+  {
+    uint64_t op_start = now_ns();
+    uint64_t handle = 0;
+    bool unsealed = false;
+
+    if (kmyth_unseal_into_enclave(eid, &unsealed, sealed_size, sealed,
+                                  &handle) != SGX_SUCCESS || !unsealed)
+    {
+      failures++;
+    }
+    else
+    {
+      completed++;
+    }
+    elapsed += now_ns() - op_start;
+
+    bool discarded = false;
+
+    if (unsealed)
+    {
+      kmyth_enclave_discard_key_handle(eid, &discarded, handle);
+    }
+  }
+  while (now_ns() - start < min_time_ns);
+  report("unseal", size, 0, 1, completed, failures, elapsed);
+
+  free(plain);
+  free(sealed);
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// lookup_worker()
+//############################################################################
+static void *lookup_worker(void *arg)
+{
+  bench_worker *w = (bench_worker *) arg;
+  size_t i = w->first;
+
+  do
+  {
+    uint32_t data_size = 0;
+
+    if (kmyth_sgx_test_get_data_size(w->eid, &data_size, w->handles[i])
+        != SGX_SUCCESS || data_size == 0)
+    {
+      w->failures++;
+    }
+    else
+    {
+      w->completed++;
+    }
+    i = (i + 1) % w->handle_count;
+  }
+  while (now_ns() < w->deadline_ns);
+
+  return NULL;
+}
+
+//############################################################################
+// session_worker()
+//############################################################################
+static void *session_worker(void *arg)
+{
+  bench_worker *w = (bench_worker *) arg;
+  const bench_session_params *s = w->session;
+
+  do
+  {
+    int ret = -1;
+    uint64_t handle = 0;
+
+    if (kmyth_enclave_retrieve_key_from_server(w->eid, &ret,
+                                               s->client_key,
+                                               s->client_key_len,
+                                               s->client_cert,
+                                               s->client_cert_len,
+                                               s->server_cert,
+                                               s->server_cert_len,
+                                               s->server_host,
+                                               strlen(s->server_host) + 1,
+                                               s->server_port,
+                                               strlen(s->server_port) + 1,
+                                               (unsigned char *) s->key_id,
+                                               strlen(s->key_id),
+                                               &handle) != SGX_SUCCESS
+        || ret != EXIT_SUCCESS)
+    {
+      w->failures++;
+      continue;
+    }
+    w->completed++;
+
+    bool discarded = false;
+
+    kmyth_enclave_discard_key_handle(w->eid, &discarded, handle);
+  }
+  while (now_ns() < w->deadline_ns);
+
+  return NULL;
+}
+
+//############################################################################
+// run_workers()
+//
+// Runs fn on threads threads until min_time_ns has passed and reports
+// their combined results.
+//############################################################################
+static int run_workers(const char *benchmark, void *(*fn)(void *),
+                       bench_worker * proto, size_t table_entries,
+                       size_t threads, uint64_t min_time_ns)
+{
+  pthread_t tids[BENCH_MAX_THREADS];
+  bench_worker workers[BENCH_MAX_THREADS];
+  size_t started = 0;
+  uint64_t start = now_ns();
+
+  for (size_t t = 0; t < threads; t++)
+  {
+    workers[t] = *proto;
+    workers[t].deadline_ns = start + min_time_ns;
+    // spread the threads over the table rather than all starting at once
+    // on the same entry
+    if (proto->handle_count > 0)
+    {
+      workers[t].first = (t * proto->handle_count) / threads;
+    }
+    if (pthread_create(&tids[t], NULL, fn, &workers[t]) != 0)
+    {
+      kmyth_log(LOG_ERR, "failed to start benchmark thread");
+      break;
+    }
+    started++;
+  }
+
+  uint64_t completed = 0;
+  uint64_t failures = 0;
+
+  for (size_t t = 0; t < started; t++)
+  {
+    pthread_join(tids[t], NULL);
+    completed += workers[t].completed;
+    failures += workers[t].failures;
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  if (started < threads)
+  {
+    return EXIT_FAILURE;
+  }
+  report(benchmark, 0, table_entries, threads, completed, failures, elapsed);
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// bench_lookups()
+//
+// Fills the table with entries entries, then looks them up from 1, 2,
+// 4, ... max_threads threads at once.
+//############################################################################
+static int bench_lookups(sgx_enclave_id_t eid, size_t entries,
+                         size_t max_threads, uint64_t min_time_ns)
+{
+  int ret = -1;
+  uint32_t size = 16;
+  uint32_t sealed_size = 0;
+  uint8_t plain[16] = { 0 };
+
+  if (enc_get_sealed_size(eid, &ret, size, &sealed_size) != SGX_SUCCESS
+      || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "enc_get_sealed_size(%u) failed", size);
+    return EXIT_FAILURE;
+  }
+
+  uint8_t *sealed = (uint8_t *) malloc(sealed_size);
+  uint64_t *handles = (uint64_t *) calloc(entries, sizeof(uint64_t));
+  sgx_attributes_t attribute_mask = { 0, 0 };
+
+  if (sealed == NULL || handles == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate %zu table handles", entries);
+    free(sealed);
+    free(handles);
+    return EXIT_FAILURE;
+  }
+  if (enc_seal_data(eid, &ret, plain, size, sealed, sealed_size,
+                    SGX_KEYPOLICY_MRSIGNER, attribute_mask) != SGX_SUCCESS
+      || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "enc_seal_data() failed");
+    free(sealed);
+    free(handles);
+    return EXIT_FAILURE;
+  }
+
+  // each unseal under a fresh random handle adds one entry
+  size_t filled = 0;
+
+  while (filled < entries)
+  {
+    bool unsealed = false;
+
+    if (kmyth_unseal_into_enclave(eid, &unsealed, sealed_size, sealed,
+                                  &handles[filled]) != SGX_SUCCESS
+        || !unsealed)
+    {
+      kmyth_log(LOG_ERR, "filled only %zu of %zu table entries", filled,
+                entries);
+      break;
+    }
+    filled++;
+  }
+
+  int result = (filled == entries) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  for (size_t threads = 1;
+       result == EXIT_SUCCESS && threads <= max_threads; threads *= 2)
+  {
+    bench_worker proto = { eid, 0, handles, entries, 0, NULL, 0, 0 };
+
+    result = run_workers("lookup", lookup_worker, &proto, entries, threads,
+                         min_time_ns);
+  }
+
+  for (size_t i = 0; i < filled; i++)
+  {
+    bool discarded = false;
+
+    kmyth_enclave_discard_key_handle(eid, &discarded, handles[i]);
+  }
+  free(sealed);
+  free(handles);
+
+  return result;
+}
+
+//############################################################################
+// load_session_params()
+//
+// Reads and marshals the client key and certificate and the proxy
+// certificate for the 'retrieve key' sessions.
+//############################################################################
+static int load_session_params(bench_session_params * s)
+{
+  BIO *bio = BIO_new_file(BENCH_CLIENT_PRIVATE_KEY_FILE, "r");
+  EVP_PKEY *client_key = (bio == NULL) ? NULL :
+    PEM_read_bio_PrivateKey(bio, NULL, 0, NULL);
+
+  BIO_free(bio);
+  if (client_key == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to read %s", BENCH_CLIENT_PRIVATE_KEY_FILE);
+    return EXIT_FAILURE;
+  }
+  int ret = marshal_ec_pkey_to_der(client_key, &s->client_key,
+                                   &s->client_key_len);
+
+  EVP_PKEY_free(client_key);
+  if (ret != EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "error marshalling client private key");
+    return EXIT_FAILURE;
+  }
+
+  const char *cert_files[2] = {
+    BENCH_CLIENT_PUBLIC_CERT_FILE, BENCH_SERVER_PUBLIC_CERT_FILE
+  };
+  unsigned char **cert_bytes[2] = { &s->client_cert, &s->server_cert };
+  int *cert_lens[2] = { &s->client_cert_len, &s->server_cert_len };
+
+  for (int i = 0; i < 2; i++)
+  {
+    bio = BIO_new_file(cert_files[i], "r");
+    X509 *cert = (bio == NULL) ? NULL : PEM_read_bio_X509(bio, NULL, 0, NULL);
+
+    BIO_free(bio);
+    if (cert == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to read %s", cert_files[i]);
+      return EXIT_FAILURE;
+    }
+    ret = marshal_ec_x509_to_der(cert, cert_bytes[i], cert_lens[i]);
+    X509_free(cert);
+    if (ret != EXIT_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "error marshalling %s", cert_files[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t min_time_ms = BENCH_DEFAULT_MIN_TIME_MS;
+  uint64_t session_time_ms = BENCH_DEFAULT_SESSION_TIME_MS;
+  unsigned long max_size = BENCH_DEFAULT_MAX_SIZE;
+  unsigned long max_entries = BENCH_DEFAULT_MAX_ENTRIES;
+  unsigned long max_threads = 4;
+  const char *output_path = NULL;
+  bool retrieve = false;
+  bench_session_params session = {
+    NULL, 0, NULL, 0, NULL, 0,
+    BENCH_SERVER_HOST, BENCH_SERVER_PORT, BENCH_KEY_ID
+  };
+
+  set_app_name("kmyth_enclave_bench");
+  set_app_version("");
+  set_applog_path("kmyth_enclave_bench.log");
+  set_applog_severity_threshold(LOG_WARNING);
+
+  int options;
+  int option_index = 0;
+
+  while ((options =
+          getopt_long(argc, argv, "t:m:n:T:o:l:rd:I:P:k:vh", longopts,
+                      &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 't':
+      min_time_ms = strtoull(optarg, NULL, 10);
+      break;
+    case 'm':
+      max_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      max_entries = strtoul(optarg, NULL, 10);
+      break;
+    case 'T':
+      max_threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      output_path = optarg;
+      break;
+    case 'l':
+      bench_label = optarg;
+      break;
+    case 'r':
+      retrieve = true;
+      break;
+    case 'd':
+      session_time_ms = strtoull(optarg, NULL, 10);
+      break;
+    case 'I':
+      session.server_host = optarg;
+      break;
+    case 'P':
+      session.server_port = optarg;
+      break;
+    case 'k':
+      session.key_id = optarg;
+      break;
+    case 'v':
+      set_applog_severity_threshold(LOG_DEBUG);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (min_time_ms == 0 || session_time_ms == 0 || max_threads == 0
+      || max_threads > BENCH_MAX_THREADS || strchr(bench_label, ',') != NULL)
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  bench_out = stdout;
+  if (output_path != NULL)
+  {
+    bench_out = fopen(output_path, "w");
+    if (bench_out == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to open %s", output_path);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (retrieve && load_session_params(&session) != EXIT_SUCCESS)
+  {
+    return EXIT_FAILURE;
+  }
+
+  sgx_enclave_id_t eid = 0;
+  int ret = -1;
+
+  if (kmyth_sgx_create_enclave(ENCLAVE_PATH, &eid) != SGX_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "SGX enclave init failed");
+    return EXIT_FAILURE;
+  }
+  if (kmyth_unsealed_data_table_initialize(eid, &ret) != SGX_SUCCESS
+      || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "kmyth_unsealed_data_table_initialize() failed");
+    sgx_destroy_enclave(eid);
+    return EXIT_FAILURE;
+  }
+
+  fprintf(bench_out, "label,benchmark,size,table_entries,threads,"
+          "operations,failures,seconds,ops_per_sec,ns_per_op\n");
+
+  uint64_t min_time_ns = min_time_ms * 1000000;
+  int result = EXIT_SUCCESS;
+
+  bench_ecall(eid, min_time_ns);
+
+  for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+  {
+    if (bench_sizes[i] > max_size)
+    {
+      break;
+    }
+    if (bench_seal_unseal(eid, bench_sizes[i], min_time_ns))
+    {
+      result = EXIT_FAILURE;
+    }
+  }
+
+  for (size_t i = 0;
+       i < sizeof(bench_table_sizes) / sizeof(bench_table_sizes[0]); i++)
+  {
+    if (bench_table_sizes[i] > max_entries)
+    {
+      break;
+    }
+    if (bench_lookups(eid, bench_table_sizes[i], max_threads, min_time_ns))
+    {
+      result = EXIT_FAILURE;
+    }
+  }
+
+  if (retrieve)
+  {
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+      bench_worker proto = { eid, 0, NULL, 0, 0, &session, 0, 0 };
+
+      if (run_workers("retrieve_key", session_worker, &proto, 0, threads,
+                      session_time_ms * 1000000))
+      {
+        result = EXIT_FAILURE;
+      }
+    }
+    kmyth_free(session.client_key);
+    kmyth_free(session.client_cert);
+    kmyth_free(session.server_cert);
+  }
+
+  kmyth_unsealed_data_table_cleanup(eid, &ret);
+  sgx_destroy_enclave(eid);
+  if (bench_out != stdout)
+  {
+    fclose(bench_out);
+  }
+
+  return result;
+}
@@ -10,7 +10,9 @@
 #include "sgx_attributes.h"
 
 #include "log_ocall.h"
+#include "enclave_util.h"
 #include "sgx_seal_unseal_impl.h"
+#include "kmyth_enclave_common.h"
 
 #include "kmyth_sgx_test_enclave_u.h"
 
@@ -33,7 +35,7 @@ int init_suite(void)
 {
   sgx_status_t retval;
 
-  retval = sgx_create_enclave(ENCLAVE_PATH, SGX_DEBUG_FLAG, NULL, NULL, &eid, NULL);
+  retval = kmyth_sgx_create_enclave(ENCLAVE_PATH, &eid);
   if (retval != SGX_SUCCESS)
   {
     return 1;
@@ -188,6 +190,91 @@ void test_unseal_and_export(void)
   return;
 }
 
+void test_unseal_handle_modes(void)
+{
+  uint8_t plain_data[] = "handle mode test";
+  size_t plain_size = sizeof(plain_data);
+  uint8_t *cipher_data = NULL;
+  size_t cipher_size = 0;
+  uint64_t handles[6] = { 0 };
+
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size_t;
+  bool result = false;
+
+  enc_get_sealed_size(eid, &sgx_ret_int, plain_size,
+                      (uint32_t *) & cipher_size);
+  CU_ASSERT(sgx_ret_int == 0);
+  cipher_data = (uint8_t *) malloc(cipher_size);
+  enc_seal_data(eid, &sgx_ret_int, plain_data, plain_size, cipher_data,
+                cipher_size, key_policy, attribute_mask);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  // Random handles differ each time the same blob is unsealed
+  kmyth_unseal_into_enclave(eid, &result, cipher_size, cipher_data,
+                            handles);
+  CU_ASSERT(result == true);
+  kmyth_unseal_into_enclave(eid, &result, cipher_size, cipher_data,
+                            handles + 1);
+  CU_ASSERT(result == true);
+  CU_ASSERT(handles[0] != handles[1]);
+
+  // Derived handles are the same each time
+  kmyth_unseal_into_enclave_with_handle(eid, &result, cipher_size,
+                                        cipher_data,
+                                        KMYTH_UNSEAL_HANDLE_SEALED_TAG,
+                                        handles + 2);
+  CU_ASSERT(result == true);
+  kmyth_unseal_into_enclave_with_handle(eid, &result, cipher_size,
+                                        cipher_data,
+                                        KMYTH_UNSEAL_HANDLE_SEALED_TAG,
+                                        handles + 3);
+  CU_ASSERT(result == true);
+  CU_ASSERT(handles[2] == handles[3]);
+
+  kmyth_unseal_into_enclave_with_handle(eid, &result, cipher_size,
+                                        cipher_data,
+                                        KMYTH_UNSEAL_HANDLE_CONTENT,
+                                        handles + 4);
+  CU_ASSERT(result == true);
+  kmyth_unseal_into_enclave_with_handle(eid, &result, cipher_size,
+                                        cipher_data,
+                                        KMYTH_UNSEAL_HANDLE_CONTENT,
+                                        handles + 5);
+  CU_ASSERT(result == true);
+  CU_ASSERT(handles[4] == handles[5]);
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size_t);
+  CU_ASSERT(sgx_ret_size_t == 6);
+
+  // Every entry holds the plaintext, shared handles included
+  uint8_t *decrypted = (uint8_t *) malloc(plain_size);
+
+  for (size_t i = 0; i < 6; i++)
+  {
+    kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size_t, handles[i],
+                                       plain_size, decrypted);
+    CU_ASSERT(sgx_ret_size_t == plain_size);
+    CU_ASSERT(memcmp(decrypted, plain_data, plain_size) == 0);
+  }
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  free(decrypted);
+  free(cipher_data);
+  return;
+}
+
 void test_seal_unseal_nkl(void)
 {
   const char *data = "Test of the NKL seal and unseal";
@@ -233,6 +320,193 @@ void test_seal_unseal_nkl(void)
   return;
 }
 
+void test_seal_unseal_nkl_batch(void)
+{
+  const size_t count = KMYTH_SGX_BATCH_MAX_ITEMS + 3;
+  uint8_t **inputs = (uint8_t **) calloc(count, sizeof(uint8_t *));
+  size_t *input_lens = (size_t *) calloc(count, sizeof(size_t));
+  uint8_t **outputs = (uint8_t **) calloc(count, sizeof(uint8_t *));
+  size_t *output_lens = (size_t *) calloc(count, sizeof(size_t));
+  uint64_t *handles = (uint64_t *) calloc(count, sizeof(uint64_t));
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+
+  // Items of assorted (and unaligned) sizes, spanning more than one batch
+  for (size_t i = 0; i < count; i++)
+  {
+    input_lens[i] = 1 + 3 * i;
+    inputs[i] = (uint8_t *) malloc(input_lens[i]);
+    memset(inputs[i], (int) i, input_lens[i]);
+  }
+
+  CU_ASSERT(kmyth_sgx_seal_nkl_batch(eid, inputs, input_lens, count,
+                                     outputs, output_lens, key_policy,
+                                     attribute_mask) == 0);
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  CU_ASSERT(kmyth_sgx_unseal_nkl_batch(eid, outputs, output_lens, count,
+                                       handles) == 0);
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+  CU_ASSERT(sgx_ret_size == count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t *decrypted = (uint8_t *) malloc(input_lens[i]);
+
+    kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handles[i],
+                                       input_lens[i], decrypted);
+    CU_ASSERT(sgx_ret_size == input_lens[i]);
+    CU_ASSERT(memcmp(decrypted, inputs[i], input_lens[i]) == 0);
+    free(decrypted);
+  }
+
+  // A batch with an unusable item fails as a whole
+  free(outputs[1]);
+  outputs[1] = (uint8_t *) strdup("not an nkl file");
+  output_lens[1] = strlen((char *) outputs[1]);
+  CU_ASSERT(kmyth_sgx_unseal_nkl_batch(eid, outputs, output_lens, count,
+                                       handles) == 1);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(inputs[i]);
+    free(outputs[i]);
+  }
+  free(inputs);
+  free(input_lens);
+  free(outputs);
+  free(output_lens);
+  free(handles);
+  return;
+}
+
+void test_seal_unseal_nkl_segmented(void)
+{
+  uint8_t key[32];
+  const size_t data_len = 100000;
+  const uint32_t segment_len = 4096;
+  const size_t count = (data_len - 1) / segment_len + 1;
+  uint8_t *data = (uint8_t *) malloc(data_len);
+  uint8_t *sealed_key = NULL;
+  size_t sealed_key_len = 0;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *stream = NULL;
+  size_t stream_len = 0;
+  uint64_t key_handle = 0;
+  uint64_t handle = 0;
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+
+  for (size_t i = 0; i < sizeof(key); i++)
+  {
+    key[i] = (uint8_t) (i * 7 + 1);
+  }
+  for (size_t i = 0; i < data_len; i++)
+  {
+    data[i] = (uint8_t) (i % 251);
+  }
+
+  // The key the segments are re-encrypted under, in the enclave
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+  CU_ASSERT(kmyth_sgx_seal_nkl(eid, key, sizeof(key), &sealed_key,
+                               &sealed_key_len, key_policy,
+                               attribute_mask) == 0);
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sealed_key, sealed_key_len,
+                                 &key_handle) == 0);
+
+  CU_ASSERT(kmyth_sgx_seal_nkl_segmented(eid, data, data_len, segment_len,
+                                         &sealed, &sealed_len, key_policy,
+                                         attribute_mask) == 0);
+
+  // Data sealed in segments is only unsealed one segment at a time
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sealed, sealed_len, &handle) == 1);
+  CU_ASSERT(kmyth_sgx_unseal_nkl_segmented(eid, sealed, sealed_len,
+                                           key_handle, &stream,
+                                           &stream_len) == 0);
+  CU_ASSERT(stream_len ==
+            AES_GCM_STREAM_HEADER_LEN + data_len + count * GCM_TAG_LEN);
+
+  // Decrypted in one run, the stream gives back the data
+  uint8_t *decrypted = (uint8_t *) malloc(data_len);
+  size_t decrypted_len = 0;
+
+  kmyth_enclave_stream_decrypt_with_handle(eid, &sgx_ret_int, key_handle,
+                                           stream, AES_GCM_STREAM_HEADER_LEN,
+                                           0, true,
+                                           stream + AES_GCM_STREAM_HEADER_LEN,
+                                           stream_len -
+                                           AES_GCM_STREAM_HEADER_LEN,
+                                           decrypted, data_len,
+                                           &decrypted_len);
+  CU_ASSERT(sgx_ret_int == 0);
+  CU_ASSERT(decrypted_len == data_len);
+  CU_ASSERT(memcmp(decrypted, data, data_len) == 0);
+
+  // Segments swapped with one another are refused
+  size_t raw_size = KMYTH_SGX_SEGMENTED_HEADER_LEN +
+    2 * (sizeof(sgx_sealed_data_t) + KMYTH_SGX_SEGMENT_MAC_TEXT_LEN +
+         segment_len);
+  uint8_t *raw = (uint8_t *) malloc(raw_size);
+  uint8_t *swapped = (uint8_t *) malloc(raw_size);
+  size_t raw_len = 0;
+  uint8_t *swapped_nkl = NULL;
+  size_t swapped_nkl_len = 0;
+  uint8_t *bad_stream = NULL;
+  size_t bad_stream_len = 0;
+
+  enc_seal_data_segmented(eid, &sgx_ret_int, data, 2 * segment_len,
+                          segment_len, raw, raw_size, &raw_len, key_policy,
+                          attribute_mask);
+  CU_ASSERT(sgx_ret_int == 0);
+  CU_ASSERT(raw_len == raw_size);
+
+  size_t one = (raw_size - KMYTH_SGX_SEGMENTED_HEADER_LEN) / 2;
+
+  memcpy(swapped, raw, KMYTH_SGX_SEGMENTED_HEADER_LEN);
+  memcpy(swapped + KMYTH_SGX_SEGMENTED_HEADER_LEN,
+         raw + KMYTH_SGX_SEGMENTED_HEADER_LEN + one, one);
+  memcpy(swapped + KMYTH_SGX_SEGMENTED_HEADER_LEN + one,
+         raw + KMYTH_SGX_SEGMENTED_HEADER_LEN, one);
+  CU_ASSERT(create_nkl_bytes(swapped, raw_size, &swapped_nkl,
+                             &swapped_nkl_len) == 0);
+  CU_ASSERT(kmyth_sgx_unseal_nkl_segmented(eid, swapped_nkl,
+                                           swapped_nkl_len, key_handle,
+                                           &bad_stream,
+                                           &bad_stream_len) == 1);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  free(data);
+  free(sealed_key);
+  free(sealed);
+  free(stream);
+  free(decrypted);
+  free(raw);
+  free(swapped);
+  free(swapped_nkl);
+  return;
+}
+
 int main(void)
 {
 
@@ -263,6 +537,12 @@ int main(void)
     CU_cleanup_registry();
     return CU_get_error();
   }
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test unseal handle modes",
+                          test_unseal_handle_modes))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
   if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test seal/unseal nkl",
                           test_seal_unseal_nkl))
   {
@@ -270,6 +550,21 @@ int main(void)
     return CU_get_error();
   }
 
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test batch seal/unseal nkl",
+                          test_seal_unseal_nkl_batch))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (NULL == CU_add_test(kmyth_sgx_test_suite,
+                          "Test segmented seal/unseal nkl",
+                          test_seal_unseal_nkl_segmented))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   CU_basic_run_tests();
 
   CU_cleanup_registry();
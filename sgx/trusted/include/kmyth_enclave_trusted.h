@@ -11,6 +11,7 @@ extern "C"
 #endif
 
 #include "kmyth_enclave_memory_util.h"
+#include "kmyth_enclave_log_util.h"
 
 #include "sgx_retrieve_key_impl.h"
 
@@ -24,21 +25,70 @@ extern "C"
 
 #include ENCLAVE_HEADER_TRUSTED
 
+/**
+ * @brief The kmyth_unsealed_data_table is split into this many shards (a
+ *        power of two), each behind its own lock, so that enclave threads
+ *        working on different handles rarely contend.
+ */
+#define KMYTH_UNSEAL_TABLE_SHARDS 16
+
+/**
+ * @brief Most entries the kmyth_unsealed_data_table will hold. Inserts
+ *        beyond it fail rather than grow enclave memory use without bound.
+ */
+#define KMYTH_UNSEAL_TABLE_MAX_ENTRIES 65536
+
+/**
+ * @brief Slots each shard starts with. A shard's open-addressing table
+ *        doubles whenever it becomes three quarters full.
+ */
+#define KMYTH_UNSEAL_TABLE_MIN_SLOTS 16
+
+/**
+ * @brief Random handles to draw before giving up, should each collide with
+ *        a handle already in the kmyth_unsealed_data_table
+ */
+#define KMYTH_UNSEAL_HANDLE_ATTEMPTS 4
+
+/**
+ * @brief Length of the GCM IV of a blob sealed by enc_seal_data_batch(),
+ *        which seals the whole batch under one key and so gives each item
+ *        its own IV. The IV is kept in the (otherwise zero)
+ *        aes_data.reserved field of the sgx_sealed_data_t, so such blobs
+ *        have the usual layout, but only kmyth_unseal_into_enclave() and
+ *        its variants, not sgx_unseal_data(), can unseal them.
+ */
+#define KMYTH_SEAL_BATCH_IV_LEN 12
+
   typedef struct unseal_data_s
   {
     uint64_t handle;
     size_t data_size;
     uint8_t *data;
-    struct unseal_data_s *next;
   } unseal_data_t;
 
-  extern unseal_data_t *kmyth_unsealed_data_table;
-
   size_t retrieve_from_unseal_table(uint64_t handle, uint8_t ** buf);
 
   bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
                                 uint64_t * handle);
 
+  bool insert_into_unseal_table_with_handle(uint8_t * data,
+                                            uint32_t data_size,
+                                            uint64_t handle);
+
+  bool derive_content_handle(uint32_t data_size, uint8_t * data,
+                             uint64_t * handle);
+
+  size_t peek_unseal_table_data_size(uint64_t handle);
+
+  size_t read_from_unseal_table(uint64_t handle, uint8_t * buf,
+                                size_t buf_size);
+
+  // the additional MAC text of segment number index of a blob sealed in
+  // segments: the blob's header followed by index, big-endian
+  void kmyth_segment_mac_text(const uint8_t * header, uint32_t index,
+                              uint8_t * mac_text);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,70 @@
+/**
+ * @file  kmyth_enclave_log_util.h
+ *
+ * @brief Provides the in-enclave log buffer behind kmyth_sgx_log(). Messages
+ *        are collected inside the enclave and passed out to the untrusted
+ *        logger in batches, one OCALL (enclave exit) per batch rather than
+ *        per message.
+ */
+
+#ifndef _KMYTH_ENCLAVE_LOG_UTIL_H_
+#define _KMYTH_ENCLAVE_LOG_UTIL_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Size (in bytes) of each thread's log buffer. When a message does
+ *        not fit in what is left of it, the buffer is flushed first.
+ */
+#define KMYTH_ENCLAVE_LOG_BUFFER_SIZE 8192
+
+/**
+ * @brief Longest source file or function name, and longest message, kept
+ *        with a buffered log message (longer ones are truncated)
+ */
+#define KMYTH_ENCLAVE_LOG_MAX_NAME_LEN 255
+#define KMYTH_ENCLAVE_LOG_MAX_MSG_LEN 1024
+
+/**
+ * @brief Adds a message to the calling thread's log buffer. Messages less
+ *        severe than the untrusted logger records (as last reported by it)
+ *        are discarded without leaving the enclave. Messages of severity
+ *        LOG_ERR or worse are passed out at once, along with anything
+ *        buffered before them.
+ *
+ * @param[in] src_file         Source code filename string
+ *
+ * @param[in] src_func         Function name string
+ *
+ * @param[in] src_line         Integer specifying source code line number
+ *
+ * @param[in] severity         Integer representing the severity
+ *                             level of the event to be logged.
+ *
+ * @param[in] msg              String containing the message to be logged.
+ *
+ * @return                     None
+ */
+  void kmyth_enclave_log_event(const char *src_file,
+                               const char *src_func,
+                               int src_line, int severity, const char *msg);
+
+/**
+ * @brief Passes the messages in the calling thread's log buffer out to the
+ *        untrusted logger (in one OCALL) and empties the buffer. Every ECALL
+ *        that logs must call this before returning.
+ *
+ * @return                     None
+ */
+  void kmyth_enclave_log_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                          /* _KMYTH_ENCLAVE_LOG_UTIL_H_ */
@@ -10,6 +10,14 @@
 
 #include <stddef.h>
 
+/**
+ * @brief Size of the session arena each enclave thread keeps (see
+ *        kmyth_enclave_session_begin()). A 'retrieve key' session with a
+ *        single key request needs a few kilobytes of it; larger requests
+ *        spill over to the heap.
+ */
+#define KMYTH_ENCLAVE_SESSION_ARENA_SIZE 8192
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -67,6 +75,55 @@ extern "C"
  */
   void *kmyth_enclave_secure_memset(void *v, int c, size_t n);
 
+/**
+ * @brief Opens a session on the calling thread's session arena: until
+ *        kmyth_enclave_session_end(), kmyth_enclave_session_alloc() serves
+ *        short-lived buffers (message fields, signatures, session keys)
+ *        from the arena instead of the enclave heap. The arena is
+ *        allocated on a thread's first session and kept for the next.
+ *
+ * @return                  None. Without memory for the arena, the
+ *                          session's buffers simply come from the heap.
+ */
+  void kmyth_enclave_session_begin(void);
+
+/**
+ * @brief Closes the calling thread's session, wiping everything the session
+ *        placed in the arena with one kmyth_enclave_clear() and resetting
+ *        it. No buffer from the arena may be used after this.
+ *
+ * @return                  The most arena space (in bytes) the session
+ *                          had in use at once
+ */
+  size_t kmyth_enclave_session_end(void);
+
+/**
+ * @brief Allocates a zeroed buffer that will not outlive the calling
+ *        thread's session: from the session arena when a session is open
+ *        and the buffer fits in what is left of it, else from the heap.
+ *
+ * @param[in]     size      The size of the buffer
+ *
+ * @return                  The buffer, or NULL if none could be allocated.
+ *                          It must be released with
+ *                          kmyth_enclave_session_free().
+ */
+  void *kmyth_enclave_session_alloc(size_t size);
+
+/**
+ * @brief Wipes a buffer from kmyth_enclave_session_alloc() and releases it:
+ *        heap buffers are freed, and arena space is reused at once if it
+ *        was the most recent allocation, else at the end of the session.
+ *        If a NULL pointer is handled, the function simply returns.
+ *
+ * @param[in,out] v         The buffer
+ *
+ * @param[in]     size      The size it was allocated with
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_session_free(void *v, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
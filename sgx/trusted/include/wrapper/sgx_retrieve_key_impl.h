@@ -24,10 +24,49 @@ extern "C"
 #include <kmip/kmip.h>
 
 #include "kmyth_enclave_trusted.h"
+#include "retrieve_key_protocol.h"
 
 /**
- * @brief Retrieve a designated key from a "remote" key server securely
- *        into the enclave.
+ * @brief The most ephemeral ECDH key pairs the enclave keeps generated
+ *        ahead of use (see enclave_prepare_ecdh_keypairs())
+ */
+#define ENCLAVE_ECDH_KEYPAIR_POOL_SIZE 8
+
+/**
+ * @brief The most peer certificates the enclave keeps parsed and prepared
+ *        between key retrievals (see enclave_get_peer_cert())
+ */
+#define ENCLAVE_PEER_CERT_CACHE_SIZE 8
+
+/**
+ * @brief The most servers the enclave holds a session ticket for at once.
+ *        With a ticket, a later key retrieval from the same server resumes
+ *        the session in one round trip, without a new ECDH key agreement
+ *        or any signatures.
+ */
+#define ENCLAVE_SESSION_TICKET_CACHE_SIZE 4
+
+/**
+ * @brief Forward secrecy limits on session resumption, enforced by the
+ *        enclave in addition to the server's: how long (in seconds, by the
+ *        host's clock) after a full session its tickets are used, and how
+ *        many times it is resumed. A lifetime of 0 turns resumption off.
+ *        (Build-time settings, so that they are part of the enclave's
+ *        measurement rather than something the host can change.)
+ */
+#ifndef ENCLAVE_SESSION_TICKET_LIFETIME
+#define ENCLAVE_SESSION_TICKET_LIFETIME 300
+#endif
+#ifndef ENCLAVE_SESSION_TICKET_MAX_RESUMPTIONS
+#define ENCLAVE_SESSION_TICKET_MAX_RESUMPTIONS 16
+#endif
+
+/**
+ * @brief Retrieve one or more designated keys from a "remote" key server
+ *        securely into the enclave, all in one 'Key Request' / 'Key
+ *        Response' exchange. If an earlier retrieval from the same server
+ *        left a session ticket, the session is resumed from it (falling
+ *        back to a full session should the server not accept it).
  *
  *        TODO: The parameters to this function will have to be augmented
  *              to support actual retrieval from the remote server. This
@@ -49,11 +88,12 @@ extern "C"
  *                                    implemented ECDH key agreement protocol.
  *
  * @param[in]  server_sign_cert       Pointer to remote's (server's)
- *                                    certificate, containing the server's
- *                                    public key that can be used to validate
- *                                    the signature over the server's
- *                                    'public key' contribution exchanged with
- *                                    the enclave as part of an ECDH key
+ *                                    prepared certificate, containing the
+ *                                    server's identity and the public key
+ *                                    that can be used to validate the
+ *                                    signature over the server's 'public
+ *                                    key' contribution exchanged with the
+ *                                    enclave as part of an ECDH key
  *                                    agreement protocol.
  *
  * @param[in]  server_host            String IP address or hostname used to
@@ -66,34 +106,70 @@ extern "C"
  * 
  * @param[in]  server_port_len        Length (in bytes) of server_port string.
  *
- * @param[in] req_key_id              ID string used to specify the key to be
+ * @param[in]  req_key_ids            Array of ByteBuffer structs containing
+ *                                    the ID strings of the keys to be
  *                                    retrieved (not null-terminated).
- * 
- * @param[in] req_key_id_len          Length (in bytes) of the ID string
- *                                    associated with the requested key.
  *
- * @param[out] retrieved_key_id       Pointer to the key ID string returned in
- *                                    the key server's response (not null-terminated).
- * 
- * @param[out] retrieved_key_id_len   Pointer to the length (in bytes) of the
- *                                    ID string for the retrieved key.
+ * @param[in]  req_key_id_count       Number of key IDs in req_key_ids (1 to
+ *                                    KMYTH_ECDH_MAX_KEY_REQUEST_COUNT).
  *
- * @param[out] retrieved_key          Pointer to the retrieved key result
- *                                    (byte array).
- * 
- * @param[out] retrieved_key_len      Pointer to the length (in bytes) of the
- *                                    retrieved key result.
+ * @param[out] retrieved_keys         Pointer to an array of
+ *                                    req_key_id_count results, one per key
+ *                                    in the order requested, each with the
+ *                                    key ID returned in the key server's
+ *                                    response (already checked against the
+ *                                    one requested) and the key. To be
+ *                                    freed with free_kmip_key_results().
  *
- * @return 0 on success, 1 on error
+ * @return 0 on success (every key was retrieved), 1 on error
  */
   int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
                            X509 * client_sign_cert,
-                           X509 * server_sign_cert,
+                           ECPeerCert * server_sign_cert,
                            const char *server_host, size_t server_host_len,
                            const char *server_port, size_t server_port_len,
-                           unsigned char *req_key_id, size_t req_key_id_len,
-                           uint8_t **retrieved_key_id, size_t *retrieved_key_id_len,
-                           uint8_t **retrieved_key, size_t *retrieved_key_len);
+                           ByteBuffer * req_key_ids, size_t req_key_id_count,
+                           kmip_key_result ** retrieved_keys);
+
+/**
+ * @brief Generates ephemeral ECDH key pairs ahead of use, so that later
+ *        calls to enclave_retrieve_key() can skip key generation. Meant
+ *        to be called while the enclave is otherwise idle. Each key pair
+ *        is used for one key retrieval only.
+ *
+ * @param[in]  count                  Number of key pairs to have ready
+ *                                    (at most ENCLAVE_ECDH_KEYPAIR_POOL_SIZE)
+ *
+ * @return Number of key pairs ready
+ */
+  size_t enclave_prepare_ecdh_keypairs(size_t count);
+
+/**
+ * @brief Looks up a peer certificate, by the SHA-256 digest of its DER
+ *        encoding, among those already parsed and prepared (identity,
+ *        public key and signature verification context) by earlier key
+ *        retrievals, and parses and prepares it if it is not there. The
+ *        caller hands it back with enclave_put_peer_cert() when done.
+ *
+ * @param[in]  cert_der               DER-formatted certificate
+ *
+ * @param[in]  cert_der_len           Length (in bytes) of cert_der
+ *
+ * @param[out] peer                   Pointer to the prepared certificate
+ *
+ * @return 0 on success, 1 on error
+ */
+  int enclave_get_peer_cert(uint8_t * cert_der, size_t cert_der_len,
+                            ECPeerCert ** peer);
+
+/**
+ * @brief Hands back a certificate obtained with enclave_get_peer_cert().
+ *
+ * @param[in]  peer                   Pointer to the prepared certificate
+ *
+ * @return none
+ */
+  void enclave_put_peer_cert(ECPeerCert * peer);
 
 #ifdef __cplusplus
 }
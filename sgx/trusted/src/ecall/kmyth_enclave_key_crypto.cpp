@@ -0,0 +1,401 @@
+#include <string.h>
+
+#include "sgx_trts.h"
+#include "sgx_lfence.h"
+#include "sgx_tseal.h"
+
+#include "kmyth_enclave_trusted.h"
+
+#include "cipher/aes_gcm.h"
+
+#include ENCLAVE_HEADER_TRUSTED
+
+// Longest key (AES-256) the handle ECALLs below will use
+#define KMYTH_HANDLE_KEY_MAX_LEN 32
+
+//
+// Copies the AES key held under key_handle into key (which has room for
+// KMYTH_HANDLE_KEY_MAX_LEN bytes), leaving it in the table. Returns the key
+// length, or 0 if the handle names no AES key.
+//
+static size_t handle_key(uint64_t key_handle, uint8_t * key)
+{
+  size_t key_len =
+    read_from_unseal_table(key_handle, key, KMYTH_HANDLE_KEY_MAX_LEN);
+
+  if (key_len != 16 && key_len != 24 && key_len != 32)
+  {
+    kmyth_enclave_clear(key, KMYTH_HANDLE_KEY_MAX_LEN);
+    return 0;
+  }
+  return key_len;
+}
+
+//
+// Checks the user_check buffers of the ECALLs below. The edger8r bridge
+// copies [in] and [out] parameters between untrusted and enclave memory,
+// so the ECALLs only ever see enclave copies of those; user_check buffers
+// are instead read and written in place, in untrusted memory, so each
+// ECALL checks them here and then retires the checks with sgx_lfence()
+// before any use
+//
+static int check_user_buffers(const uint8_t * in_data, size_t in_len,
+                              const uint8_t * out_data, size_t out_size)
+{
+  if (in_data == NULL || out_data == NULL)
+    return SGX_ERROR_INVALID_PARAMETER;
+  if (!sgx_is_outside_enclave(in_data, in_len)
+      || !sgx_is_outside_enclave(out_data, out_size))
+    return SGX_ERROR_INVALID_PARAMETER;
+  return 0;
+}
+
+// `out_len` is [out], an enclave copy made by the bridge; `in_data` and
+// `out_data` are user_check, and are checked below
+int kmyth_enclave_encrypt_with_handle(uint64_t key_handle,
+                                      const uint8_t * in_data, size_t in_len,
+                                      uint8_t * out_data, size_t out_size,
+                                      size_t * out_len)
+{
+  if (out_len == NULL)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *out_len = 0;
+  if (check_user_buffers(in_data, in_len, out_data, out_size))
+    return SGX_ERROR_INVALID_PARAMETER;
+  if (in_len > SIZE_MAX - GCM_IV_LEN - GCM_TAG_LEN
+      || out_size < in_len + GCM_IV_LEN + GCM_TAG_LEN)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Retire the checks of `in_data` and `out_data` before they are used
+  sgx_lfence();
+
+  uint8_t key[KMYTH_HANDLE_KEY_MAX_LEN] = { 0 };
+  size_t key_len = handle_key(key_handle, key);
+
+  if (key_len == 0)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  int ret = aes_gcm_encrypt_into(NULL, key, key_len,
+                                 (unsigned char *) in_data, in_len,
+                                 out_data, out_size, out_len);
+
+  kmyth_enclave_clear(key, sizeof(key));
+  return (ret == EXIT_SUCCESS) ? 0 : SGX_ERROR_UNEXPECTED;
+}
+
+// `out_len` is [out], an enclave copy made by the bridge; `in_data` and
+// `out_data` are user_check, and are checked below
+int kmyth_enclave_decrypt_with_handle(uint64_t key_handle,
+                                      const uint8_t * in_data, size_t in_len,
+                                      uint8_t * out_data, size_t out_size,
+                                      size_t * out_len)
+{
+  if (out_len == NULL)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *out_len = 0;
+  if (check_user_buffers(in_data, in_len, out_data, out_size))
+    return SGX_ERROR_INVALID_PARAMETER;
+  if (in_len < GCM_IV_LEN + GCM_TAG_LEN
+      || out_size < in_len - (GCM_IV_LEN + GCM_TAG_LEN))
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Retire the checks of `in_data` and `out_data` before they are used
+  sgx_lfence();
+
+  uint8_t key[KMYTH_HANDLE_KEY_MAX_LEN] = { 0 };
+  size_t key_len = handle_key(key_handle, key);
+
+  if (key_len == 0)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // a tag that does not verify leaves the plaintext part of out_data cleared
+  int ret = aes_gcm_decrypt_into(NULL, key, key_len,
+                                 (unsigned char *) in_data, in_len,
+                                 out_data, out_size, out_len);
+
+  kmyth_enclave_clear(key, sizeof(key));
+  return (ret == EXIT_SUCCESS) ? 0 : SGX_ERROR_MAC_MISMATCH;
+}
+
+// `header` is [out]: the bridge passes an enclave buffer and copies it out
+// on return
+int kmyth_enclave_stream_header(size_t chunk_len, uint8_t * header,
+                                size_t header_len)
+{
+  if (header == NULL || header_len != AES_GCM_STREAM_HEADER_LEN)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  if (aes_gcm_stream_init_header(chunk_len, header))
+    return SGX_ERROR_INVALID_PARAMETER;
+  return 0;
+}
+
+//
+// The body of the two stream ECALLs below
+//
+static int stream_with_handle(uint64_t key_handle, bool encrypt,
+                              const uint8_t * header, size_t header_len,
+                              uint32_t first_chunk, bool final,
+                              const uint8_t * in_data, size_t in_len,
+                              uint8_t * out_data, size_t out_size,
+                              size_t * out_len)
+{
+  if (header == NULL || header_len != AES_GCM_STREAM_HEADER_LEN
+      || out_len == NULL)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *out_len = 0;
+  if (check_user_buffers(in_data, in_len, out_data, out_size))
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Retire the checks of `in_data` and `out_data` before they are used
+  sgx_lfence();
+
+  uint8_t key[KMYTH_HANDLE_KEY_MAX_LEN] = { 0 };
+  size_t key_len = handle_key(key_handle, key);
+
+  if (key_len == 0)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // The chunks go straight from the caller's input buffer to its output
+  // buffer, so however large the run, only the cipher state occupies
+  // enclave memory
+  int ret = encrypt ?
+    aes_gcm_stream_encrypt_chunks(key, key_len, header, first_chunk, final,
+                                  in_data, in_len, out_data, out_size,
+                                  out_len) :
+    aes_gcm_stream_decrypt_chunks(key, key_len, header, first_chunk, final,
+                                  in_data, in_len, out_data, out_size,
+                                  out_len);
+
+  kmyth_enclave_clear(key, sizeof(key));
+  if (ret != 0)
+    return encrypt ? SGX_ERROR_INVALID_PARAMETER : SGX_ERROR_MAC_MISMATCH;
+  return 0;
+}
+
+// `header` ([in]) and `out_len` ([out]) are enclave copies made by the
+// bridge; `in_data` and `out_data` are user_check, and are checked by
+// stream_with_handle()
+int kmyth_enclave_stream_encrypt_with_handle(uint64_t key_handle,
+                                             const uint8_t * header,
+                                             size_t header_len,
+                                             uint32_t first_chunk,
+                                             bool final,
+                                             const uint8_t * in_data,
+                                             size_t in_len,
+                                             uint8_t * out_data,
+                                             size_t out_size,
+                                             size_t * out_len)
+{
+  return stream_with_handle(key_handle, true, header, header_len,
+                            first_chunk, final, in_data, in_len, out_data,
+                            out_size, out_len);
+}
+
+// `header` ([in]) and `out_len` ([out]) are enclave copies made by the
+// bridge; `in_data` and `out_data` are user_check, and are checked by
+// stream_with_handle()
+int kmyth_enclave_stream_decrypt_with_handle(uint64_t key_handle,
+                                             const uint8_t * header,
+                                             size_t header_len,
+                                             uint32_t first_chunk,
+                                             bool final,
+                                             const uint8_t * in_data,
+                                             size_t in_len,
+                                             uint8_t * out_data,
+                                             size_t out_size,
+                                             size_t * out_len)
+{
+  return stream_with_handle(key_handle, false, header, header_len,
+                            first_chunk, final, in_data, in_len, out_data,
+                            out_size, out_len);
+}
+
+//
+// Reads the big-endian value of len bytes at in
+//
+static uint64_t get_be(const uint8_t * in, size_t len)
+{
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+//
+// Unseals segment number index of a blob sealed in segments into plain,
+// checking that it is the segment expected there. sealed holds the sealed
+// segment, copied into the enclave (sgx_unseal_data() requires it).
+//
+static int unseal_segment(const uint8_t * header, uint32_t index,
+                          sgx_sealed_data_t * sealed, uint8_t * plain,
+                          uint32_t len)
+{
+  uint8_t expected[KMYTH_SGX_SEGMENT_MAC_TEXT_LEN];
+  uint8_t mac_text[KMYTH_SGX_SEGMENT_MAC_TEXT_LEN];
+  uint32_t mac_text_len = sizeof(mac_text);
+  uint32_t plain_len = len;
+
+  if (sgx_get_add_mac_txt_len(sealed) != KMYTH_SGX_SEGMENT_MAC_TEXT_LEN
+      || sgx_get_encrypt_txt_len(sealed) != len)
+    return SGX_ERROR_MAC_MISMATCH;
+
+  int sgx_ret = sgx_unseal_data(sealed, mac_text, &mac_text_len, plain,
+                                &plain_len);
+
+  if (sgx_ret != SGX_SUCCESS)
+    return sgx_ret;
+
+  kmyth_segment_mac_text(header, index, expected);
+  if (mac_text_len != KMYTH_SGX_SEGMENT_MAC_TEXT_LEN || plain_len != len
+      || memcmp(mac_text, expected, sizeof(expected)) != 0)
+  {
+    kmyth_enclave_clear(plain, len);
+    return SGX_ERROR_MAC_MISMATCH;
+  }
+  return 0;
+}
+
+// `header` ([in]) and `out_len` ([out]) are enclave copies made by the
+// bridge; `sealed_data` and `out_data` are user_check, and are checked below
+int kmyth_enclave_unseal_segmented_with_handle(uint64_t key_handle,
+                                               const uint8_t * sealed_data,
+                                               size_t sealed_len,
+                                               const uint8_t * header,
+                                               size_t header_len,
+                                               uint8_t * out_data,
+                                               size_t out_size,
+                                               size_t * out_len)
+{
+  size_t chunk_len = 0;
+
+  if (header == NULL || header_len != AES_GCM_STREAM_HEADER_LEN
+      || out_len == NULL || aes_gcm_stream_parse_header(header, &chunk_len))
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *out_len = 0;
+  if (check_user_buffers(sealed_data, sealed_len, out_data, out_size)
+      || sealed_len < KMYTH_SGX_SEGMENTED_HEADER_LEN)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Retire the checks of `sealed_data` and `out_data` before the blob's
+  // header is read
+  sgx_lfence();
+
+  // The blob's header, copied in so that it cannot change while in use
+  uint8_t blob_header[KMYTH_SGX_SEGMENTED_HEADER_LEN];
+
+  memcpy(blob_header, sealed_data, sizeof(blob_header));
+
+  uint64_t segment_len = get_be(blob_header + 4, 4);
+  uint64_t count = get_be(blob_header + 8, 4);
+  uint64_t total = get_be(blob_header + 12, 8);
+
+  // each segment becomes one chunk of the stream
+  if (memcmp(blob_header, KMYTH_SGX_SEGMENTED_MAGIC,
+             KMYTH_SGX_SEGMENTED_MAGIC_LEN) != 0
+      || segment_len == 0 || segment_len > KMYTH_SGX_SEGMENT_MAX_LEN
+      || segment_len != chunk_len || total == 0
+      || count != (total - 1) / segment_len + 1
+      || total > SIZE_MAX - count * GCM_TAG_LEN
+      || out_size < total + count * GCM_TAG_LEN)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Retire the header checks, which bound the segment reads and the writes
+  // to `out_data`, before either happens
+  sgx_lfence();
+
+  uint8_t key[KMYTH_HANDLE_KEY_MAX_LEN] = { 0 };
+  size_t key_len = handle_key(key_handle, key);
+
+  if (key_len == 0)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // Whatever the size of the blob, the enclave holds one sealed segment and
+  // its plaintext at a time: each is unsealed, encrypted out to the
+  // caller's buffer as the stream's next chunk, and cleared
+  uint32_t sealed_max =
+    sgx_calc_sealed_data_size(KMYTH_SGX_SEGMENT_MAC_TEXT_LEN,
+                              (uint32_t) segment_len);
+  sgx_sealed_data_t *sealed = (sgx_sealed_data_t *) malloc(sealed_max);
+  uint8_t *plain = (uint8_t *) malloc(segment_len);
+
+  if (sealed == NULL || plain == NULL)
+  {
+    free(sealed);
+    free(plain);
+    kmyth_enclave_clear(key, sizeof(key));
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  int ret = 0;
+  size_t in_pos = KMYTH_SGX_SEGMENTED_HEADER_LEN;
+  size_t out_pos = 0;
+
+  for (uint32_t i = 0; i < count && ret == 0; i++)
+  {
+    uint32_t len = (uint32_t) ((total - i * segment_len < segment_len) ?
+                               total - i * segment_len : segment_len);
+    uint32_t sealedsz =
+      sgx_calc_sealed_data_size(KMYTH_SGX_SEGMENT_MAC_TEXT_LEN, len);
+    size_t written = 0;
+
+    if (sealed_len - in_pos < sealedsz)
+    {
+      ret = SGX_ERROR_INVALID_PARAMETER;
+      break;
+    }
+    memcpy(sealed, sealed_data + in_pos, sealedsz);
+    in_pos += sealedsz;
+
+    ret = unseal_segment(blob_header, i, sealed, plain, len);
+    if (ret == 0
+        && aes_gcm_stream_encrypt_chunks(key, key_len, header, i,
+                                         i == count - 1, plain, len,
+                                         out_data + out_pos,
+                                         out_size - out_pos, &written))
+    {
+      ret = SGX_ERROR_UNEXPECTED;
+    }
+    kmyth_enclave_clear(plain, len);
+    out_pos += written;
+  }
+
+  // nothing may follow the last segment
+  if (ret == 0 && in_pos != sealed_len)
+  {
+    ret = SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  kmyth_enclave_clear(key, sizeof(key));
+  free(sealed);
+  free(plain);
+  if (ret != 0)
+    return ret;
+  *out_len = out_pos;
+  return 0;
+}
+
+bool kmyth_enclave_discard_key_handle(uint64_t key_handle)
+{
+  uint8_t *data = NULL;
+  size_t data_size = retrieve_from_unseal_table(key_handle, &data);
+
+  if (data == NULL)
+  {
+    return false;
+  }
+  kmyth_enclave_clear_and_free(data, data_size);
+  return true;
+}
@@ -10,20 +10,28 @@
 
 #include ENCLAVE_HEADER_TRUSTED
 
-// This is the function that gets converted into the ecall.
-int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
-                                           size_t client_private_bytes_len,
-                                           uint8_t * client_cert_bytes,
-                                           size_t client_cert_bytes_len,
-                                           uint8_t * server_cert_bytes,
-                                           size_t server_cert_bytes_len,
-                                           const char * server_host,
-                                           size_t server_host_len,
-                                           const char * server_port,
-                                           size_t server_port_len,
-                                           unsigned char *key_id,
-                                           size_t key_id_len)
+// The body of the ecalls below (which pass out the messages it logs)
+static int retrieve_keys_from_server(uint8_t * client_private_bytes,
+                                     size_t client_private_bytes_len,
+                                     uint8_t * client_cert_bytes,
+                                     size_t client_cert_bytes_len,
+                                     uint8_t * server_cert_bytes,
+                                     size_t server_cert_bytes_len,
+                                     const char * server_host,
+                                     size_t server_host_len,
+                                     const char * server_port,
+                                     size_t server_port_len,
+                                     ByteBuffer * key_ids,
+                                     size_t key_id_count,
+                                     uint64_t * key_handles)
 {
+  if (key_handles == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "no space for the retrieved key handles");
+    kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+    return EXIT_FAILURE;
+  }
+
   // unmarshal client private signing key
   EVP_PKEY *client_sign_privkey = NULL;
   int ret_val = unmarshal_ec_der_to_pkey(client_private_bytes,
@@ -43,119 +51,231 @@ int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
   // now that input client private bytes processed, clear this sensitive data
   kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
 
-  // unmarshal client cert (contains information linked to client identity)
-  X509 *client_cert = NULL;
+  // look up the client and server certs - parsed, with their identities
+  // and public keys extracted, by an earlier retrieval if it used them
+  ECPeerCert *client_cert = NULL;
 
-  ret_val = unmarshal_ec_der_to_x509(client_cert_bytes,
-                                     client_cert_bytes_len,
-                                     &client_cert);
+  ret_val = enclave_get_peer_cert(client_cert_bytes, client_cert_bytes_len,
+                                  &client_cert);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of client cert failed");
     kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
     EVP_PKEY_free(client_sign_privkey);
-    X509_free(client_cert);
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG, "unmarshalled client cert");
 
-  // unmarshal server cert (containing public key for signature verification)
-  X509 *server_cert = NULL;
+  ECPeerCert *server_cert = NULL;
 
-  ret_val = unmarshal_ec_der_to_x509(server_cert_bytes,
-                                     server_cert_bytes_len,
-                                     &server_cert);
+  ret_val = enclave_get_peer_cert(server_cert_bytes, server_cert_bytes_len,
+                                  &server_cert);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of server cert failed");
     kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
     EVP_PKEY_free(client_sign_privkey);
-    X509_free(client_cert);
-    X509_free(server_cert);
+    enclave_put_peer_cert(client_cert);
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG, "unmarshalled server cert");
 
-  unsigned char *retrieve_key_result = NULL;
-  size_t retrieve_key_result_len = 0;
-  unsigned char *retrieve_key_result_id = NULL;
-  size_t retrieve_key_result_id_len = 0;
+  kmip_key_result *retrieve_key_results = NULL;
 
   ret_val =
     enclave_retrieve_key(client_sign_privkey,
-                         client_cert,
+                         client_cert->cert,
                          server_cert,
                          server_host,
                          server_host_len,
                          server_port,
                          server_port_len,
-                         key_id,
-                         key_id_len,
-                         &retrieve_key_result_id,
-                         &retrieve_key_result_id_len,
-                         &retrieve_key_result,
-                         &retrieve_key_result_len);
+                         key_ids,
+                         key_id_count,
+                         &retrieve_key_results);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR,
                   "enclave_retrieve_key() wrapper function call failed");
     kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
     EVP_PKEY_free(client_sign_privkey);
-    X509_free(client_cert);
-    X509_free(server_cert);
-    kmyth_enclave_clear(retrieve_key_result, retrieve_key_result_len);
-    kmyth_enclave_clear(retrieve_key_result_id, retrieve_key_result_id_len);
-    free(retrieve_key_result);
-    free(retrieve_key_result_id);
+    enclave_put_peer_cert(client_cert);
+    enclave_put_peer_cert(server_cert);
     return EXIT_FAILURE;
   }
 
   // done with unmarshalled, client-side 'retrieve key' inputs (keys/certs)
   kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
   EVP_PKEY_free(client_sign_privkey);
-  X509_free(client_cert);
-  X509_free(server_cert);
+  enclave_put_peer_cert(client_cert);
+  enclave_put_peer_cert(server_cert);
 
+  // enclave_retrieve_key() succeeds only when the key server returned every
+  // requested key, under the key ID requested, which eliminates the need to
+  // return the key IDs to the ECALL caller.
   char msg[MAX_LOG_MSG_LEN] = { 0 };
 
-  snprintf(msg, MAX_LOG_MSG_LEN, "Retrieved key (ID: %.*s) into enclave",
-           (int) retrieve_key_result_id_len, retrieve_key_result_id);
-  kmyth_sgx_log(LOG_DEBUG, msg);
-
-  snprintf(msg, MAX_LOG_MSG_LEN,
-           "Retrieved key value: 0x%02X%02X..%02X%02X",
-           retrieve_key_result[0], retrieve_key_result[1],
-           retrieve_key_result[retrieve_key_result_len - 2],
-           retrieve_key_result[retrieve_key_result_len - 1]);
-  kmyth_sgx_log(LOG_DEBUG, msg);
-
-  // Verification that the Key ID received in the response from the key server
-  // matches the requested Key ID eliminates the need to return this parameter
-  // to the ECALL caller. A successful ECALL return indicates that the
-  // returned key ID matches the input value that the caller provided.
-  char rcvd_key_id[retrieve_key_result_id_len + 1] = { 0 };
-  memcpy(rcvd_key_id, retrieve_key_result_id, retrieve_key_result_id_len);
-  rcvd_key_id[retrieve_key_result_id_len] = '\0';
-
-  if (strcmp((const char*) rcvd_key_id, (const char*) key_id) != 0)
+  for (size_t i = 0; i < key_id_count; i++)
   {
-    kmyth_sgx_log(LOG_ERR, "retrieved key ID mismatches requested key ID");
-    kmyth_enclave_clear(retrieve_key_result, retrieve_key_result_len);
-    kmyth_enclave_clear(retrieve_key_result_id, retrieve_key_result_id_len);
-    free(retrieve_key_result);
-    free(retrieve_key_result_id);
+    snprintf(msg, MAX_LOG_MSG_LEN, "Retrieved key (ID: %.*s) into enclave",
+             (int) retrieve_key_results[i].id_len,
+             retrieve_key_results[i].id);
+    kmyth_sgx_log(LOG_DEBUG, msg);
+  }
+
+  // The keys stay in the enclave: each buffer is handed over to the
+  // kmyth_unsealed_data_table as it is, and only its handle goes back to
+  // the caller. Either every key is kept or none is.
+  size_t kept = 0;
+
+  while (kept < key_id_count)
+  {
+    uint8_t *key = retrieve_key_results[kept].key;
+    size_t key_len = retrieve_key_results[kept].key_len;
+
+    if (key_len == 0 || key_len > UINT32_MAX)
+    {
+      kmyth_sgx_log(LOG_ERR, "retrieved key has an invalid length");
+      break;
+    }
+
+    // the table now owns (and on failure has freed) the key buffer
+    retrieve_key_results[kept].key = NULL;
+    retrieve_key_results[kept].key_len = 0;
+    if (!insert_into_unseal_table(key, (uint32_t) key_len,
+                                  &key_handles[kept]))
+    {
+      kmyth_sgx_log(LOG_ERR, "failed to keep retrieved key in the enclave");
+      break;
+    }
+    kept++;
+  }
+  if (kept < key_id_count)
+  {
+    for (size_t i = 0; i < kept; i++)
+    {
+      uint8_t *key = NULL;
+      size_t key_len = retrieve_from_unseal_table(key_handles[i], &key);
+
+      kmyth_enclave_clear_and_free(key, key_len);
+      key_handles[i] = 0;
+    }
+    free_kmip_key_results(retrieve_key_results, key_id_count);
     return EXIT_FAILURE;
   }
-  kmyth_sgx_log(LOG_DEBUG, "Retrieved/requested key ID match");
 
-  // free memory for 'retrieve key' wrapper function results
-  // Note: probably should instead return a pointer to these buffers so they
-  //       can be cleared and freed later. Presumably the key was retrieved
-  //       for some purpose.
-  kmyth_enclave_clear(retrieve_key_result, retrieve_key_result_len);
-  kmyth_enclave_clear(retrieve_key_result_id, retrieve_key_result_id_len);
-  free(retrieve_key_result);
-  free(retrieve_key_result_id);
+  // free what remains of the 'retrieve key' wrapper function results
+  // (the key IDs)
+  free_kmip_key_results(retrieve_key_results, key_id_count);
 
   return EXIT_SUCCESS;
 }
+
+// Generates ephemeral key pairs for later retrievals while the host is idle
+size_t kmyth_enclave_prepare_ecdh_keypairs(size_t count)
+{
+  size_t ready = enclave_prepare_ecdh_keypairs(count);
+
+  kmyth_enclave_log_flush();
+
+  return ready;
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
+                                           size_t client_private_bytes_len,
+                                           uint8_t * client_cert_bytes,
+                                           size_t client_cert_bytes_len,
+                                           uint8_t * server_cert_bytes,
+                                           size_t server_cert_bytes_len,
+                                           const char * server_host,
+                                           size_t server_host_len,
+                                           const char * server_port,
+                                           size_t server_port_len,
+                                           unsigned char *key_id,
+                                           size_t key_id_len,
+                                           uint64_t * key_handle)
+{
+  ByteBuffer key_id_buf = { key_id_len, key_id };
+
+  int ret_val = retrieve_keys_from_server(client_private_bytes,
+                                          client_private_bytes_len,
+                                          client_cert_bytes,
+                                          client_cert_bytes_len,
+                                          server_cert_bytes,
+                                          server_cert_bytes_len,
+                                          server_host, server_host_len,
+                                          server_port, server_port_len,
+                                          &key_id_buf, 1, key_handle);
+
+  // pass the messages logged during the call out in one batch
+  kmyth_enclave_log_flush();
+
+  return ret_val;
+}
+
+// This is the function that gets converted into the multi-key ecall.
+int kmyth_enclave_retrieve_keys_from_server(uint8_t * client_private_bytes,
+                                            size_t client_private_bytes_len,
+                                            uint8_t * client_cert_bytes,
+                                            size_t client_cert_bytes_len,
+                                            uint8_t * server_cert_bytes,
+                                            size_t server_cert_bytes_len,
+                                            const char * server_host,
+                                            size_t server_host_len,
+                                            const char * server_port,
+                                            size_t server_port_len,
+                                            unsigned char *key_ids,
+                                            size_t key_ids_len,
+                                            size_t * key_id_lens,
+                                            size_t key_id_count,
+                                            uint64_t * key_handles)
+{
+  // split the concatenated key IDs back up by their lengths
+  ByteBuffer key_id_bufs[KMYTH_ECDH_MAX_KEY_REQUEST_COUNT] = { { 0, NULL } };
+  size_t offset = 0;
+
+  if (key_id_count == 0 || key_id_count > KMYTH_ECDH_MAX_KEY_REQUEST_COUNT)
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid number of requested key IDs");
+    kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+    kmyth_enclave_log_flush();
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < key_id_count; i++)
+  {
+    if (key_id_lens[i] == 0 || key_id_lens[i] > key_ids_len - offset)
+    {
+      kmyth_sgx_log(LOG_ERR, "key ID lengths mismatch the key IDs");
+      kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+      kmyth_enclave_log_flush();
+      return EXIT_FAILURE;
+    }
+    key_id_bufs[i].buffer = key_ids + offset;
+    key_id_bufs[i].size = key_id_lens[i];
+    offset += key_id_lens[i];
+  }
+  if (offset != key_ids_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "key ID lengths mismatch the key IDs");
+    kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+    kmyth_enclave_log_flush();
+    return EXIT_FAILURE;
+  }
+
+  int ret_val = retrieve_keys_from_server(client_private_bytes,
+                                          client_private_bytes_len,
+                                          client_cert_bytes,
+                                          client_cert_bytes_len,
+                                          server_cert_bytes,
+                                          server_cert_bytes_len,
+                                          server_host, server_host_len,
+                                          server_port, server_port_len,
+                                          key_id_bufs, key_id_count,
+                                          key_handles);
+
+  // pass the messages logged during the call out in one batch
+  kmyth_enclave_log_flush();
+
+  return ret_val;
+}
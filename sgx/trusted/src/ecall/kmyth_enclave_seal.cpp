@@ -6,6 +6,9 @@
 #include "sgx_report.h"
 #include "sgx_utils.h"
 #include "sgx_attributes.h"
+#include "sgx_tcrypto.h"
+
+#include "kmyth_enclave_trusted.h"
 
 #include ENCLAVE_HEADER_TRUSTED
 
@@ -27,13 +30,162 @@ int enc_get_sealed_size(uint32_t in_size, uint32_t * size)
   return 0;
 }
 
+//
+// Applies the defaults (and KSS additions) to a sealing key policy and
+// attribute mask.
+//
+static void seal_policy(uint16_t * key_policy,
+                        sgx_attributes_t * attribute_mask)
+{
+  // This combination is recommended by the SGX Developer Guide, so
+  // we use it as default.
+  if (attribute_mask->flags == 0)
+  {
+    attribute_mask->flags = SGX_FLAGS_INITTED | SGX_FLAGS_DEBUG;
+  }
+
+  // If the enclave uses the key separation and sharing (KSS) features
+  // we need that to be reflected in the policy of the sealing key
+  // as well.
+  const sgx_report_t *report = sgx_self_report();
+
+  if (report->body.attributes.flags & SGX_FLAGS_KSS)
+  {
+    *key_policy |=
+      (SGX_KEYPOLICY_CONFIGID | SGX_KEYPOLICY_ISVFAMILYID |
+       SGX_KEYPOLICY_ISVEXTPRODID);
+  }
+}
+
+//
+// Seals in_data into buf (inside the enclave, sealedsz bytes) and copies
+// the result out to out_data. The policy has been through seal_policy().
+//
+static int seal_one(const uint8_t * in_data, uint32_t in_size,
+                    sgx_sealed_data_t * buf, uint32_t sealedsz,
+                    uint8_t * out_data, uint16_t key_policy,
+                    sgx_attributes_t attribute_mask)
+{
+  // This 0 value is currently unused by SGX.
+  const sgx_misc_select_t misc_mask = 0;
+
+  int sgx_ret =
+    sgx_seal_data_ex(key_policy, attribute_mask, misc_mask, 0, NULL, in_size,
+                     in_data, sealedsz, buf);
+
+  if (sgx_ret != SGX_SUCCESS)
+  {
+    return sgx_ret;
+  }
+  memcpy(out_data, buf, sealedsz);
+  return 0;
+}
+
+//
+// Derives one sealing key, under a fresh random key ID, for a whole batch:
+// the single EGETKEY that sgx_seal_data_ex() would otherwise make for every
+// item. The policy has been through seal_policy().
+//
+static int batch_seal_key(uint16_t key_policy,
+                          sgx_attributes_t attribute_mask,
+                          sgx_key_request_t * key_request,
+                          sgx_key_128bit_t * key)
+{
+  if ((key_policy & (SGX_KEYPOLICY_MRENCLAVE | SGX_KEYPOLICY_MRSIGNER)) == 0)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // the request sgx_seal_data_ex() makes, so that sgx_get_key() gives the
+  // same key for it again at unseal time
+  const sgx_report_t *report = sgx_self_report();
+
+  memset(key_request, 0, sizeof(sgx_key_request_t));
+  key_request->key_name = SGX_KEYSELECT_SEAL;
+  key_request->key_policy = key_policy;
+  memcpy(&key_request->cpu_svn, &report->body.cpu_svn, sizeof(sgx_cpu_svn_t));
+  memcpy(&key_request->isv_svn, &report->body.isv_svn, sizeof(sgx_isv_svn_t));
+  key_request->config_svn = report->body.config_svn;
+  key_request->attribute_mask = attribute_mask;
+  key_request->misc_mask = 0;
+
+  int sgx_ret = sgx_read_rand(key_request->key_id.id,
+                              sizeof(key_request->key_id.id));
+
+  if (sgx_ret != SGX_SUCCESS)
+  {
+    return sgx_ret;
+  }
+  return sgx_get_key(key_request, key);
+}
+
+//
+// Seals item number index of a batch under the batch's key (in the
+// sgx_sealed_data_t layout, with no additional MAC text) into buf, and
+// copies the result out to out_data. Every item shares the key, so each
+// gets its own GCM IV, index + 1, kept in aes_data.reserved where
+// kmyth_unseal_into_enclave() finds it (sgx_seal_data() blobs have zeros
+// there, and use a zero IV under a key of their own).
+//
+static int batch_seal_one(const sgx_key_request_t * key_request,
+                          const sgx_key_128bit_t * key, size_t index,
+                          const uint8_t * in_data, uint32_t in_size,
+                          sgx_sealed_data_t * buf, uint32_t sealedsz,
+                          uint8_t * out_data)
+{
+  if (in_size == 0 || index >= UINT32_MAX)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  memset(buf, 0, sealedsz);
+  memcpy(&buf->key_request, key_request, sizeof(sgx_key_request_t));
+  buf->plain_text_offset = in_size;
+  buf->aes_data.payload_size = in_size;
+
+  uint8_t *iv = buf->aes_data.reserved;
+  uint32_t counter = (uint32_t) index + 1;
+
+  iv[KMYTH_SEAL_BATCH_IV_LEN - 4] = (uint8_t) (counter >> 24);
+  iv[KMYTH_SEAL_BATCH_IV_LEN - 3] = (uint8_t) (counter >> 16);
+  iv[KMYTH_SEAL_BATCH_IV_LEN - 2] = (uint8_t) (counter >> 8);
+  iv[KMYTH_SEAL_BATCH_IV_LEN - 1] = (uint8_t) counter;
+
+  int sgx_ret = sgx_rijndael128GCM_encrypt(key, in_data, in_size,
+                                           buf->aes_data.payload,
+                                           iv, KMYTH_SEAL_BATCH_IV_LEN,
+                                           NULL, 0,
+                                           &buf->aes_data.payload_tag);
+
+  if (sgx_ret != SGX_SUCCESS)
+  {
+    kmyth_enclave_clear(buf, sealedsz);
+    return sgx_ret;
+  }
+  memcpy(out_data, buf, sealedsz);
+  return 0;
+}
+
 // EDL checks that `in_data` is outside the enclave (speculative-safe)
 // `out_data` is user_check
 int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
                   uint32_t out_size, uint16_t key_policy,
                   sgx_attributes_t attribute_mask)
 {
-  if (in_data == NULL || out_data == NULL)
+  uint32_t sealed_size = 0;
+
+  return enc_seal_data_sized(in_data, in_size, out_data, out_size,
+                             &sealed_size, key_policy, attribute_mask);
+}
+
+// EDL checks that `in_data` and `sealed_size` are outside the enclave
+// (speculative-safe); `out_data` is user_check
+int enc_seal_data_sized(const uint8_t * in_data, uint32_t in_size,
+                        uint8_t * out_data, uint32_t out_size,
+                        uint32_t * sealed_size, uint16_t key_policy,
+                        sgx_attributes_t attribute_mask)
+{
+  if (in_data == NULL || out_data == NULL || sealed_size == NULL)
   {
     return SGX_ERROR_INVALID_PARAMETER;
   }
@@ -44,12 +196,10 @@ int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
 
   if (sealedsz == UINT32_MAX)
     return SGX_ERROR_UNEXPECTED;
+  *sealed_size = sealedsz;
   if (sealedsz > out_size)
     return SGX_ERROR_INVALID_PARAMETER;
 
-  int ret;
-  int sgx_ret;
-
   sgx_sealed_data_t *buf = (sgx_sealed_data_t *) malloc(sealedsz);
 
   if (buf == NULL)
@@ -58,40 +208,204 @@ int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
   // Retire validity check of `out_data` and checks in `malloc` against `sealedsz`, influenced by `in_size`
   sgx_lfence();
 
-  // This combination is recommended by the SGX Developer Guide, so
-  // we use it as default.
-  if (attribute_mask.flags == 0)
+  seal_policy(&key_policy, &attribute_mask);
+
+  int ret = seal_one(in_data, in_size, buf, sealedsz, out_data, key_policy,
+                     attribute_mask);
+
+  free(buf);
+  return ret;
+}
+
+// EDL checks that `in_data`, `in_sizes`, `out_sizes` and `results` are
+// outside the enclave (speculative-safe); `out_data` is user_check
+int enc_seal_data_batch(const uint8_t * in_data, size_t in_total,
+                        const uint32_t * in_sizes, size_t count,
+                        uint8_t * out_data, size_t out_total,
+                        uint32_t * out_sizes, int *results,
+                        uint16_t key_policy, sgx_attributes_t attribute_mask)
+{
+  if (in_data == NULL || in_sizes == NULL || out_data == NULL
+      || out_sizes == NULL || results == NULL || count == 0)
   {
-    attribute_mask.flags = SGX_FLAGS_INITTED | SGX_FLAGS_DEBUG;
+    return SGX_ERROR_INVALID_PARAMETER;
   }
+  if (!sgx_is_outside_enclave(out_data, out_total))
+    return SGX_ERROR_INVALID_PARAMETER;
 
-  // If the enclave uses the key separation and sharing (KSS) features
-  // we need that to be reflected in the policy of the sealing key
-  // as well.
-  const sgx_report_t *report = sgx_self_report();
+  // The items are packed back to back on both sides: check that they fit
+  // before sealing any of them, and size one enclave buffer for the
+  // largest.
+  size_t in_needed = 0;
+  size_t out_needed = 0;
+  uint32_t largest = 0;
 
-  if (report->body.attributes.flags & SGX_FLAGS_KSS)
+  for (size_t i = 0; i < count; i++)
   {
-    key_policy |=
-      (SGX_KEYPOLICY_CONFIGID | SGX_KEYPOLICY_ISVFAMILYID |
-       SGX_KEYPOLICY_ISVEXTPRODID);
+    uint32_t sealedsz = sgx_calc_sealed_data_size(0, in_sizes[i]);
+
+    if (sealedsz == UINT32_MAX)
+      return SGX_ERROR_INVALID_PARAMETER;
+    out_sizes[i] = sealedsz;
+    in_needed += in_sizes[i];
+    out_needed += sealedsz;
+    if (in_needed > in_total || out_needed > out_total)
+      return SGX_ERROR_INVALID_PARAMETER;
+    if (sealedsz > largest)
+      largest = sealedsz;
   }
 
-  // This 0 value is currently unused by SGX.
-  const sgx_misc_select_t misc_mask = 0;
+  sgx_sealed_data_t *buf = (sgx_sealed_data_t *) malloc(largest);
+
+  if (buf == NULL)
+    return SGX_ERROR_OUT_OF_MEMORY;
+
+  // Retire the size checks above before any item is sealed
+  sgx_lfence();
+
+  seal_policy(&key_policy, &attribute_mask);
+
+  sgx_key_request_t key_request;
+  sgx_key_128bit_t key;
+  int sgx_ret = batch_seal_key(key_policy, attribute_mask, &key_request,
+                               &key);
 
-  sgx_ret =
-    sgx_seal_data_ex(key_policy, attribute_mask, misc_mask, 0, NULL, in_size,
-                     in_data, sealedsz, buf);
   if (sgx_ret != SGX_SUCCESS)
   {
-    ret = sgx_ret;
-    goto Out;
+    kmyth_enclave_clear(&key, sizeof(key));
+    free(buf);
+    return sgx_ret;
   }
-  memcpy(out_data, buf, sealedsz);
-  ret = 0;
-Out:
-  if (buf)
+
+  const uint8_t *in = in_data;
+  uint8_t *out = out_data;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    results[i] = batch_seal_one(&key_request, &key, i, in, in_sizes[i],
+                                buf, out_sizes[i], out);
+    in += in_sizes[i];
+    out += out_sizes[i];
+  }
+
+  kmyth_enclave_clear(&key, sizeof(key));
+  kmyth_enclave_clear(buf, largest);
+  free(buf);
+  return 0;
+}
+
+void kmyth_segment_mac_text(const uint8_t * header, uint32_t index,
+                            uint8_t * mac_text)
+{
+  memcpy(mac_text, header, KMYTH_SGX_SEGMENTED_HEADER_LEN);
+  mac_text[KMYTH_SGX_SEGMENTED_HEADER_LEN] = (uint8_t) (index >> 24);
+  mac_text[KMYTH_SGX_SEGMENTED_HEADER_LEN + 1] = (uint8_t) (index >> 16);
+  mac_text[KMYTH_SGX_SEGMENTED_HEADER_LEN + 2] = (uint8_t) (index >> 8);
+  mac_text[KMYTH_SGX_SEGMENTED_HEADER_LEN + 3] = (uint8_t) index;
+}
+
+//
+// Writes value big-endian into len bytes at out
+//
+static void put_be(uint8_t * out, uint64_t value, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    out[len - 1 - i] = (uint8_t) (value >> (8 * i));
+  }
+}
+
+// `out_len` is [out], an enclave copy made by the bridge; `in_data` and
+// `out_data` are user_check, and are checked below
+int enc_seal_data_segmented(const uint8_t * in_data, size_t in_size,
+                            uint32_t segment_len, uint8_t * out_data,
+                            size_t out_size, size_t * out_len,
+                            uint16_t key_policy,
+                            sgx_attributes_t attribute_mask)
+{
+  if (in_data == NULL || out_data == NULL || out_len == NULL || in_size == 0
+      || segment_len == 0 || segment_len > KMYTH_SGX_SEGMENT_MAX_LEN)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *out_len = 0;
+  if (!sgx_is_outside_enclave(in_data, in_size)
+      || !sgx_is_outside_enclave(out_data, out_size))
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // every segment but the last is full; each sealed segment adds an
+  // sgx_sealed_data_t and its MAC text to the plaintext
+  size_t count = (in_size - 1) / segment_len + 1;
+  size_t overhead = sizeof(sgx_sealed_data_t) + KMYTH_SGX_SEGMENT_MAC_TEXT_LEN;
+
+  if (count > UINT32_MAX
+      || count > (SIZE_MAX - KMYTH_SGX_SEGMENTED_HEADER_LEN) / overhead
+      || in_size > SIZE_MAX - KMYTH_SGX_SEGMENTED_HEADER_LEN - count * overhead
+      || out_size < KMYTH_SGX_SEGMENTED_HEADER_LEN + count * overhead + in_size)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  uint32_t sealed_max =
+    sgx_calc_sealed_data_size(KMYTH_SGX_SEGMENT_MAC_TEXT_LEN, segment_len);
+
+  if (sealed_max == UINT32_MAX)
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  // The enclave only ever holds one segment, copied in from the caller's
+  // buffer, and its sealed form, on its way out to the caller's buffer
+  uint8_t *plain = (uint8_t *) malloc(segment_len);
+  sgx_sealed_data_t *buf = (sgx_sealed_data_t *) malloc(sealed_max);
+
+  if (plain == NULL || buf == NULL)
+  {
+    free(plain);
     free(buf);
-  return ret;
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  // Retire the checks of `in_data` and `out_data` before they are used
+  sgx_lfence();
+
+  seal_policy(&key_policy, &attribute_mask);
+
+  uint8_t header[KMYTH_SGX_SEGMENTED_HEADER_LEN];
+
+  memcpy(header, KMYTH_SGX_SEGMENTED_MAGIC, KMYTH_SGX_SEGMENTED_MAGIC_LEN);
+  put_be(header + 4, segment_len, 4);
+  put_be(header + 8, count, 4);
+  put_be(header + 12, in_size, 8);
+
+  int sgx_ret = sgx_read_rand(header + 20, 16);
+  size_t out_pos = KMYTH_SGX_SEGMENTED_HEADER_LEN;
+
+  memcpy(out_data, header, KMYTH_SGX_SEGMENTED_HEADER_LEN);
+  for (size_t i = 0; i < count && sgx_ret == SGX_SUCCESS; i++)
+  {
+    size_t in_pos = i * segment_len;
+    uint32_t len = (uint32_t) ((in_size - in_pos < segment_len) ?
+                               in_size - in_pos : segment_len);
+    uint32_t sealedsz =
+      sgx_calc_sealed_data_size(KMYTH_SGX_SEGMENT_MAC_TEXT_LEN, len);
+    uint8_t mac_text[KMYTH_SGX_SEGMENT_MAC_TEXT_LEN];
+
+    memcpy(plain, in_data + in_pos, len);
+    kmyth_segment_mac_text(header, (uint32_t) i, mac_text);
+    sgx_ret = sgx_seal_data_ex(key_policy, attribute_mask, 0,
+                               KMYTH_SGX_SEGMENT_MAC_TEXT_LEN, mac_text, len,
+                               plain, sealedsz, buf);
+    if (sgx_ret == SGX_SUCCESS)
+    {
+      memcpy(out_data + out_pos, buf, sealedsz);
+      out_pos += sealedsz;
+    }
+  }
+
+  kmyth_enclave_clear(plain, segment_len);
+  free(plain);
+  free(buf);
+  if (sgx_ret != SGX_SUCCESS)
+  {
+    return sgx_ret;
+  }
+  *out_len = out_pos;
+  return 0;
 }
@@ -7,105 +7,354 @@
 #include "sgx_trts.h"
 #include "sgx_tseal.h"
 #include "sgx_thread.h"
+#include "sgx_utils.h"
+#include "sgx_tcrypto.h"
 
 #include "kmyth_enclave_trusted.h"
 #include ENCLAVE_HEADER_TRUSTED
 
-unseal_data_t *kmyth_unsealed_data_table = NULL;
+/**
+ * @brief State of a slot in one of the kmyth_unsealed_data_table shards.
+ *        Retrieved entries leave a tombstone (UNSEAL_SLOT_DELETED) behind
+ *        so that probe sequences running through them stay intact.
+ */
+typedef enum
+{
+  UNSEAL_SLOT_EMPTY = 0,
+  UNSEAL_SLOT_FULL,
+  UNSEAL_SLOT_DELETED,
+} unseal_slot_state_t;
+
+typedef struct
+{
+  unseal_data_t entry;
+  unseal_slot_state_t state;
+} unseal_table_slot_t;
+
+/**
+ * @brief One shard of the kmyth_unsealed_data_table: an open-addressing
+ *        (linear probing) hash table keyed by handle, and its lock.
+ */
+typedef struct
+{
+  sgx_thread_mutex_t lock;
+  unseal_table_slot_t *slots;
+  size_t slot_count;            // a power of two, or 0 before first use
+  size_t entries;
+  size_t deleted;
+  uint64_t inserts;
+  uint64_t retrievals;
+  uint64_t misses;
+  uint64_t rejected;
+} unseal_table_shard_t;
+
+static unseal_table_shard_t
+  kmyth_unsealed_data_table[KMYTH_UNSEAL_TABLE_SHARDS];
 static bool kmyth_unsealed_data_table_initialized = false;
-static sgx_thread_mutex_t kmyth_unsealed_data_table_lock;
+
+// entries held across all shards, checked against the capacity limit
+static size_t kmyth_unsealed_data_table_entries = 0;
 
 /**
- * @brief Derives the data handle by taking the first 64 bits of the
- *        SHA-384 hash of the input data.
+ * @brief Derives a content handle by taking the first 64 bits of the
+ *        SHA-384 hash of the input data. This is a full pass over the
+ *        data, so it is only used by callers that opt in to it.
  *
  * @param[in] data_size The size (in bytes) of the input data.
  *
- * @param[in] data      A pointer to the sealed data.
+ * @param[in] data      A pointer to the data.
  *
  * @param[out] handle   A pointer to a uint64_t to hold the handle.
  *
  * @returns true on success, false on failure. The return value MUST be checked.
  */
-static bool derive_handle(uint32_t data_size, uint8_t * data, uint64_t * handle)
+bool derive_content_handle(uint32_t data_size, uint8_t * data,
+                           uint64_t * handle)
 {
   if (data_size == 0 || data == NULL || handle == NULL)
   {
     return false;
   }
 
-  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  unsigned char digest[EVP_MAX_MD_SIZE];
 
-  if (ctx == NULL)
+  if (EVP_Digest(data, data_size, digest, NULL, EVP_sha384(), NULL) != 1)
   {
     return false;
   }
-  if (EVP_DigestInit_ex(ctx, EVP_sha384(), NULL) != 1)
+  memcpy(handle, digest, sizeof(uint64_t));
+  kmyth_enclave_clear(digest, sizeof(digest));
+  return true;
+}
+
+/**
+ * @brief Derives a handle from a sealed blob by taking the first 64 bits of
+ *        its AES-GCM tag. The tag already depends on the whole blob (and
+ *        is checked when it is unsealed), so unsealing the same blob again
+ *        gives the same handle without another pass over the data.
+ *
+ * @param[in] data_size The size (in bytes) of the sealed blob.
+ *
+ * @param[in] data      A pointer to the sealed blob.
+ *
+ * @param[out] handle   A pointer to a uint64_t to hold the handle.
+ *
+ * @returns true on success, false on failure. The return value MUST be checked.
+ */
+static bool derive_sealed_tag_handle(size_t data_size, uint8_t * data,
+                                     uint64_t * handle)
+{
+  if (data_size < sizeof(sgx_sealed_data_t) || data == NULL || handle == NULL)
   {
-    EVP_MD_CTX_free(ctx);
     return false;
   }
-  if (EVP_DigestUpdate(ctx, data, data_size) != 1)
+
+  memcpy(handle, ((sgx_sealed_data_t *) data)->aes_data.payload_tag,
+         sizeof(uint64_t));
+  return true;
+}
+
+//
+// Handles are random, or taken from a GCM tag or a SHA-384 digest, so
+// their low bits pick the shard and the bits above them the starting slot.
+//
+static unseal_table_shard_t *unseal_table_shard(uint64_t handle)
+{
+  return &kmyth_unsealed_data_table[handle & (KMYTH_UNSEAL_TABLE_SHARDS - 1)];
+}
+
+static size_t unseal_table_start_slot(const unseal_table_shard_t * shard,
+                                      uint64_t handle)
+{
+  return (size_t) (handle / KMYTH_UNSEAL_TABLE_SHARDS) &
+    (shard->slot_count - 1);
+}
+
+/**
+ * @brief Finds the slot holding handle in a shard. The caller holds the
+ *        shard's lock.
+ *
+ * @returns the slot, or NULL if the handle is not in the shard.
+ */
+static unseal_table_slot_t *unseal_table_find(unseal_table_shard_t * shard,
+                                              uint64_t handle)
+{
+  if (shard->slot_count == 0)
   {
-    EVP_MD_CTX_free(ctx);
-    return false;
+    return NULL;
   }
 
-  unsigned char *digest = (unsigned char *) malloc(EVP_MD_size(EVP_sha384()));
+  size_t mask = shard->slot_count - 1;
+  size_t i = unseal_table_start_slot(shard, handle);
 
-  if (digest == NULL)
+  while (shard->slots[i].state != UNSEAL_SLOT_EMPTY)
   {
-    EVP_MD_CTX_free(ctx);
-    return false;
+    if (shard->slots[i].state == UNSEAL_SLOT_FULL
+        && shard->slots[i].entry.handle == handle)
+    {
+      return &shard->slots[i];
+    }
+    i = (i + 1) & mask;
   }
-  if (EVP_DigestFinal_ex(ctx, digest, NULL) != 1)
+  return NULL;
+}
+
+/**
+ * @brief Moves a shard's entries into a new table of slot_count slots,
+ *        dropping its tombstones. The caller holds the shard's lock.
+ *
+ * @returns true on success, false on failure (the shard is unchanged).
+ */
+static bool unseal_table_resize(unseal_table_shard_t * shard,
+                                size_t slot_count)
+{
+  unseal_table_slot_t *slots =
+    (unseal_table_slot_t *) calloc(slot_count, sizeof(unseal_table_slot_t));
+
+  if (slots == NULL)
   {
-    EVP_MD_CTX_free(ctx);
-    free(digest);
     return false;
   }
-  memcpy(handle, digest, sizeof(uint64_t));
-  free(digest);
+
+  unseal_table_slot_t *old_slots = shard->slots;
+  size_t old_slot_count = shard->slot_count;
+
+  shard->slots = slots;
+  shard->slot_count = slot_count;
+  shard->deleted = 0;
+
+  for (size_t i = 0; i < old_slot_count; i++)
+  {
+    if (old_slots[i].state == UNSEAL_SLOT_FULL)
+    {
+      size_t j = unseal_table_start_slot(shard, old_slots[i].entry.handle);
+
+      while (slots[j].state != UNSEAL_SLOT_EMPTY)
+      {
+        j = (j + 1) & (slot_count - 1);
+      }
+      slots[j] = old_slots[i];
+    }
+  }
+  free(old_slots);
   return true;
 }
 
 int kmyth_unsealed_data_table_initialize(void)
 {
-  if (sgx_thread_mutex_init(&kmyth_unsealed_data_table_lock, NULL))
+  for (size_t i = 0; i < KMYTH_UNSEAL_TABLE_SHARDS; i++)
   {
-    return -1;
+    unseal_table_shard_t *shard = &kmyth_unsealed_data_table[i];
+
+    memset(shard, 0, sizeof(unseal_table_shard_t));
+    if (sgx_thread_mutex_init(&shard->lock, NULL))
+    {
+      while (i-- > 0)
+      {
+        sgx_thread_mutex_destroy(&kmyth_unsealed_data_table[i].lock);
+      }
+      return -1;
+    }
   }
+  __atomic_store_n(&kmyth_unsealed_data_table_entries, 0, __ATOMIC_RELAXED);
   kmyth_unsealed_data_table_initialized = true;
   return 0;
 }
 
 int kmyth_unsealed_data_table_cleanup(void)
 {
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-  unseal_data_t *next_slot;
+  int ret = 0;
+
+  for (size_t i = 0; i < KMYTH_UNSEAL_TABLE_SHARDS; i++)
+  {
+    unseal_table_shard_t *shard = &kmyth_unsealed_data_table[i];
+
+    sgx_thread_mutex_lock(&shard->lock);
+    for (size_t j = 0; j < shard->slot_count; j++)
+    {
+      if (shard->slots[j].state == UNSEAL_SLOT_FULL)
+      {
+        kmyth_enclave_clear_and_free(shard->slots[j].entry.data,
+                                     shard->slots[j].entry.data_size);
+      }
+    }
+    free(shard->slots);
+    shard->slots = NULL;
+    shard->slot_count = 0;
+    shard->entries = 0;
+    shard->deleted = 0;
+    sgx_thread_mutex_unlock(&shard->lock);
+    if (sgx_thread_mutex_destroy(&shard->lock))
+    {
+      ret = -1;
+    }
+  }
+  __atomic_store_n(&kmyth_unsealed_data_table_entries, 0, __ATOMIC_RELAXED);
+  kmyth_unsealed_data_table_initialized = false;
+  return ret;
+}
+
+int kmyth_unsealed_data_table_stats(struct kmyth_unseal_table_stats *stats)
+{
+  if (!kmyth_unsealed_data_table_initialized || stats == NULL)
+  {
+    return -1;
+  }
+
+  memset(stats, 0, sizeof(struct kmyth_unseal_table_stats));
+  stats->max_entries = KMYTH_UNSEAL_TABLE_MAX_ENTRIES;
+  for (size_t i = 0; i < KMYTH_UNSEAL_TABLE_SHARDS; i++)
+  {
+    unseal_table_shard_t *shard = &kmyth_unsealed_data_table[i];
+
+    sgx_thread_mutex_lock(&shard->lock);
+    stats->entries += shard->entries;
+    stats->slots += shard->slot_count;
+    stats->inserts += shard->inserts;
+    stats->retrievals += shard->retrievals;
+    stats->misses += shard->misses;
+    stats->rejected += shard->rejected;
+    sgx_thread_mutex_unlock(&shard->lock);
+  }
+  return 0;
+}
+
+//
+// Unseals a blob from sgx_seal_data() or from enc_seal_data_batch() into
+// plaintext_data (*plaintext_data_size bytes, set to the plaintext length).
+// A batch blob is told apart by the non-zero IV in its aes_data.reserved
+// field (see KMYTH_SEAL_BATCH_IV_LEN), and carries no additional MAC text.
+//
+static sgx_status_t unseal_blob(size_t data_size, uint8_t * data,
+                                uint8_t * plaintext_data,
+                                uint32_t * plaintext_data_size)
+{
+  const sgx_sealed_data_t *blob = (const sgx_sealed_data_t *) data;
+  const uint8_t *iv = blob->aes_data.reserved;
+  uint8_t iv_bits = 0;
+
+  for (size_t i = 0; i < KMYTH_SEAL_BATCH_IV_LEN; i++)
+  {
+    iv_bits |= iv[i];
+  }
+  if (iv_bits == 0)
+  {
+    uint32_t mac_len = sgx_get_add_mac_txt_len(blob);
+
+    return sgx_unseal_data(blob, NULL, &mac_len, plaintext_data,
+                           plaintext_data_size);
+  }
+
+  uint32_t payload_size = blob->aes_data.payload_size;
+
+  if (blob->plain_text_offset != payload_size
+      || payload_size > *plaintext_data_size
+      || data_size - sizeof(sgx_sealed_data_t) < payload_size)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // the batch's key, derived again from the request sealed with the blob
+  sgx_key_128bit_t key;
+  sgx_status_t sgx_ret = sgx_get_key(&blob->key_request, &key);
 
-  while (slot != NULL)
+  if (sgx_ret == SGX_SUCCESS)
+  {
+    sgx_ret = sgx_rijndael128GCM_decrypt(&key, blob->aes_data.payload,
+                                         payload_size, plaintext_data,
+                                         iv, KMYTH_SEAL_BATCH_IV_LEN,
+                                         NULL, 0,
+                                         &blob->aes_data.payload_tag);
+  }
+  kmyth_enclave_clear(&key, sizeof(key));
+  if (sgx_ret != SGX_SUCCESS)
   {
-    next_slot = slot->next;
-    free(slot->data);
-    free(slot);
-    slot = next_slot;
+    kmyth_enclave_clear(plaintext_data, *plaintext_data_size);
+    return sgx_ret;
   }
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  return sgx_thread_mutex_destroy(&kmyth_unsealed_data_table_lock);
+  *plaintext_data_size = payload_size;
+  return SGX_SUCCESS;
 }
 
 bool kmyth_unseal_into_enclave(size_t data_size, uint8_t * data,
                                uint64_t * handle)
 {
+  return kmyth_unseal_into_enclave_with_handle(data_size, data,
+                                               KMYTH_UNSEAL_HANDLE_RANDOM,
+                                               handle);
+}
+
+bool kmyth_unseal_into_enclave_with_handle(size_t data_size, uint8_t * data,
+                                           enum kmyth_unseal_handle_mode
+                                           handle_mode, uint64_t * handle)
+{
 
   if (!kmyth_unsealed_data_table_initialized)
   {
     return false;
   }
 
-  if (data_size == 0 || data == NULL)
+  if (data_size < sizeof(sgx_sealed_data_t) || data == NULL)
   {
     return false;
   }
@@ -126,18 +375,198 @@ bool kmyth_unseal_into_enclave(size_t data_size, uint8_t * data,
     return false;
   }
 
-  uint32_t mac_len = sgx_get_add_mac_txt_len((sgx_sealed_data_t *) data);
-
-  if (sgx_unseal_data
-      ((sgx_sealed_data_t *) data, NULL, &mac_len, plaintext_data,
-       (uint32_t *) & plaintext_data_size) != SGX_SUCCESS)
+  if (unseal_blob(data_size, data, plaintext_data, &plaintext_data_size)
+      != SGX_SUCCESS)
   {
     free(plaintext_data);
     return false;
   }
 
-  // handle gets set in insert_into_unseal_table
-  return insert_into_unseal_table(plaintext_data, plaintext_data_size, handle);
+  uint64_t derived_handle = 0;
+
+  switch (handle_mode)
+  {
+  case KMYTH_UNSEAL_HANDLE_RANDOM:
+    // handle gets set in insert_into_unseal_table
+    return insert_into_unseal_table(plaintext_data, plaintext_data_size,
+                                    handle);
+  case KMYTH_UNSEAL_HANDLE_SEALED_TAG:
+    if (!derive_sealed_tag_handle(data_size, data, &derived_handle))
+    {
+      kmyth_enclave_clear_and_free(plaintext_data, plaintext_data_size);
+      return false;
+    }
+    break;
+  case KMYTH_UNSEAL_HANDLE_CONTENT:
+    if (!derive_content_handle(plaintext_data_size, plaintext_data,
+                               &derived_handle))
+    {
+      kmyth_enclave_clear_and_free(plaintext_data, plaintext_data_size);
+      return false;
+    }
+    break;
+  default:
+    kmyth_enclave_clear_and_free(plaintext_data, plaintext_data_size);
+    return false;
+  }
+
+  if (!insert_into_unseal_table_with_handle(plaintext_data,
+                                            plaintext_data_size,
+                                            derived_handle))
+  {
+    return false;
+  }
+  *handle = derived_handle;
+  return true;
+}
+
+// EDL copies `data` and `data_sizes` into the enclave; `handles` and
+// `results` are copied out
+size_t kmyth_unseal_into_enclave_batch(uint8_t * data, size_t data_total,
+                                       const size_t *data_sizes, size_t count,
+                                       enum kmyth_unseal_handle_mode
+                                       handle_mode, uint64_t * handles,
+                                       bool *results)
+{
+  if (data == NULL || data_sizes == NULL || handles == NULL
+      || results == NULL)
+  {
+    return 0;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    handles[i] = 0;
+    results[i] = false;
+  }
+
+  // The blobs are packed back to back in data, each padded out to
+  // KMYTH_SGX_BATCH_ALIGN bytes
+  size_t unsealed = 0;
+  size_t offset = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (data_sizes[i] > data_total - offset)
+    {
+      break;
+    }
+    results[i] = kmyth_unseal_into_enclave_with_handle(data_sizes[i],
+                                                       data + offset,
+                                                       handle_mode,
+                                                       &handles[i]);
+    if (results[i])
+    {
+      unsealed++;
+    }
+    if (data_total - offset < KMYTH_SGX_BATCH_PADDED(data_sizes[i]))
+    {
+      break;
+    }
+    offset += KMYTH_SGX_BATCH_PADDED(data_sizes[i]);
+  }
+  return unsealed;
+}
+
+/**
+ * @brief Outcome of unseal_table_add()
+ */
+typedef enum
+{
+  UNSEAL_ADD_OK = 0,
+  UNSEAL_ADD_TAKEN,
+  UNSEAL_ADD_FAILED,
+} unseal_add_result_t;
+
+/**
+ * @brief Adds an entry to the kmyth_unsealed_data_table under handle.
+ *        The table takes ownership of data only on UNSEAL_ADD_OK.
+ *
+ * @param[in] data       The plaintext data.
+ *
+ * @param[in] data_size  The size of the plaintext data.
+ *
+ * @param[in] handle     The handle for the entry.
+ *
+ * @param[in] shared     Whether the handle may already be in use by an
+ *                       entry holding the same data (content-derived
+ *                       handles). Otherwise any entry already using the
+ *                       handle is a collision.
+ *
+ * @returns UNSEAL_ADD_TAKEN if the handle collides with an entry already in
+ *          the table, UNSEAL_ADD_FAILED on other failures.
+ */
+static unseal_add_result_t unseal_table_add(uint8_t * data,
+                                            uint32_t data_size,
+                                            uint64_t handle, bool shared)
+{
+  unseal_table_shard_t *shard = unseal_table_shard(handle);
+
+  sgx_thread_mutex_lock(&shard->lock);
+
+  unseal_table_slot_t *existing = unseal_table_find(shard, handle);
+
+  if (existing != NULL
+      && (!shared || existing->entry.data_size != data_size
+          || memcmp(existing->entry.data, data, data_size) != 0))
+  {
+    sgx_thread_mutex_unlock(&shard->lock);
+    return UNSEAL_ADD_TAKEN;
+  }
+
+  // reserve room under the capacity limit
+  if (__atomic_add_fetch(&kmyth_unsealed_data_table_entries, 1,
+                         __ATOMIC_RELAXED) > KMYTH_UNSEAL_TABLE_MAX_ENTRIES)
+  {
+    __atomic_sub_fetch(&kmyth_unsealed_data_table_entries, 1,
+                       __ATOMIC_RELAXED);
+    shard->rejected++;
+    sgx_thread_mutex_unlock(&shard->lock);
+    return UNSEAL_ADD_FAILED;
+  }
+
+  // keep at most three quarters of the slots in use (tombstones included)
+  if ((shard->entries + shard->deleted + 1) * 4 > shard->slot_count * 3)
+  {
+    size_t slot_count = shard->slot_count;
+
+    if (slot_count == 0)
+    {
+      slot_count = KMYTH_UNSEAL_TABLE_MIN_SLOTS;
+    }
+    else if ((shard->entries + 1) * 4 > slot_count * 3 / 2)
+    {
+      // mostly live entries: grow, rather than just dropping tombstones
+      slot_count *= 2;
+    }
+
+    if (!unseal_table_resize(shard, slot_count))
+    {
+      __atomic_sub_fetch(&kmyth_unsealed_data_table_entries, 1,
+                         __ATOMIC_RELAXED);
+      sgx_thread_mutex_unlock(&shard->lock);
+      return UNSEAL_ADD_FAILED;
+    }
+  }
+
+  size_t i = unseal_table_start_slot(shard, handle);
+
+  while (shard->slots[i].state == UNSEAL_SLOT_FULL)
+  {
+    i = (i + 1) & (shard->slot_count - 1);
+  }
+  if (shard->slots[i].state == UNSEAL_SLOT_DELETED)
+  {
+    shard->deleted--;
+  }
+  shard->slots[i].entry.handle = handle;
+  shard->slots[i].entry.data_size = data_size;
+  shard->slots[i].entry.data = data;
+  shard->slots[i].state = UNSEAL_SLOT_FULL;
+  shard->entries++;
+  shard->inserts++;
+  sgx_thread_mutex_unlock(&shard->lock);
+  return UNSEAL_ADD_OK;
 }
 
 bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
@@ -157,35 +586,57 @@ bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
     return false;
   }
 
-  unseal_data_t *new_slot = (unseal_data_t *) malloc(sizeof(unseal_data_t));
+  // a random handle costs no pass over the data; one that happens to be in
+  // use already is simply drawn again
+  for (int attempt = 0; attempt < KMYTH_UNSEAL_HANDLE_ATTEMPTS; attempt++)
+  {
+    uint64_t new_handle = 0;
+
+    if (sgx_read_rand((unsigned char *) &new_handle, sizeof(uint64_t))
+        != SGX_SUCCESS)
+    {
+      break;
+    }
+
+    unseal_add_result_t result =
+      unseal_table_add(data, data_size, new_handle, false);
+
+    if (result == UNSEAL_ADD_OK)
+    {
+      *handle = new_handle;
+      return true;
+    }
+    if (result == UNSEAL_ADD_FAILED)
+    {
+      break;
+    }
+  }
 
-  if (new_slot == NULL)
+  kmyth_enclave_clear_and_free(data, data_size);
+  return false;
+}
+
+bool insert_into_unseal_table_with_handle(uint8_t * data,
+                                          uint32_t data_size, uint64_t handle)
+{
+  if (!kmyth_unsealed_data_table_initialized)
   {
     if (data != NULL) free(data);
     return false;
   }
 
-  if (!derive_handle(data_size, data, &new_slot->handle))
+  if (data_size == 0 || data_size == UINT32_MAX || data == NULL)
   {
     if (data != NULL) free(data);
-    free(new_slot);
     return false;
   }
 
-  new_slot->data_size = data_size;
-  new_slot->data = data;
-  if (new_slot->data == NULL)
+  // the same handle for different data is a collision, and is refused
+  if (unseal_table_add(data, data_size, handle, true) != UNSEAL_ADD_OK)
   {
-    if (data != NULL) free(data);
-    free(new_slot);
+    kmyth_enclave_clear_and_free(data, data_size);
     return false;
   }
-
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  new_slot->next = kmyth_unsealed_data_table;
-  kmyth_unsealed_data_table = new_slot;
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  *handle = new_slot->handle;
   return true;
 }
 
@@ -196,36 +647,82 @@ size_t retrieve_from_unseal_table(uint64_t handle, uint8_t ** buf)
     return 0;
   }
 
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-  unseal_data_t *prev_slot = NULL;
+  unseal_table_shard_t *shard = unseal_table_shard(handle);
 
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  while (slot != NULL && slot->handle != handle)
-  {
-    prev_slot = slot;
-    slot = slot->next;
-  }
+  sgx_thread_mutex_lock(&shard->lock);
+
+  unseal_table_slot_t *slot = unseal_table_find(shard, handle);
 
   if (slot == NULL)
   {
-    sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
+    shard->misses++;
+    sgx_thread_mutex_unlock(&shard->lock);
     return 0;
   }
 
-  if (prev_slot != NULL)
+  // the entry's buffer is handed over to the caller as it is
+  *buf = slot->entry.data;
+  size_t data_size = slot->entry.data_size;
+
+  slot->entry.data = NULL;
+  slot->entry.data_size = 0;
+  slot->state = UNSEAL_SLOT_DELETED;
+  shard->entries--;
+  shard->deleted++;
+  shard->retrievals++;
+
+  // once a shard empties, its tombstones can all go at once
+  if (shard->entries == 0)
+  {
+    memset(shard->slots, 0, shard->slot_count * sizeof(unseal_table_slot_t));
+    shard->deleted = 0;
+  }
+  sgx_thread_mutex_unlock(&shard->lock);
+
+  __atomic_sub_fetch(&kmyth_unsealed_data_table_entries, 1, __ATOMIC_RELAXED);
+  return data_size;
+}
+
+size_t peek_unseal_table_data_size(uint64_t handle)
+{
+  if (!kmyth_unsealed_data_table_initialized)
   {
-    prev_slot->next = slot->next;
+    return 0;
   }
-  else
+
+  unseal_table_shard_t *shard = unseal_table_shard(handle);
+
+  sgx_thread_mutex_lock(&shard->lock);
+
+  unseal_table_slot_t *slot = unseal_table_find(shard, handle);
+  size_t data_size = (slot != NULL) ? slot->entry.data_size : 0;
+
+  sgx_thread_mutex_unlock(&shard->lock);
+  return data_size;
+}
+
+size_t read_from_unseal_table(uint64_t handle, uint8_t * buf, size_t buf_size)
+{
+  if (!kmyth_unsealed_data_table_initialized || buf == NULL)
   {
-    kmyth_unsealed_data_table = slot->next;
+    return 0;
   }
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  *buf = (uint8_t *) malloc(slot->data_size);
-  memcpy(*buf, slot->data, slot->data_size);
-  size_t data_size = slot->data_size;
 
-  free(slot->data);
-  free(slot);
+  unseal_table_shard_t *shard = unseal_table_shard(handle);
+
+  sgx_thread_mutex_lock(&shard->lock);
+
+  unseal_table_slot_t *slot = unseal_table_find(shard, handle);
+
+  // the entry stays in the table; only a copy of its data goes out, and
+  // only if it fits
+  size_t data_size = 0;
+
+  if (slot != NULL && slot->entry.data_size <= buf_size)
+  {
+    data_size = slot->entry.data_size;
+    memcpy(buf, slot->entry.data, data_size);
+  }
+  sgx_thread_mutex_unlock(&shard->lock);
   return data_size;
 }
@@ -0,0 +1,92 @@
+/**
+ * kmyth_enclave_log_util.c:
+ *
+ * C library buffering log messages within the kmyth SGX enclave
+ */
+
+#include "kmyth_enclave_log_util.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kmyth_enclave_common.h"
+
+#include ENCLAVE_HEADER_TRUSTED
+
+// Each buffered message is packed as its source line and severity (ints),
+// followed by the null terminated source file, function and message strings
+// (the layout log_events_ocall() unpacks). An ECALL runs on one thread
+// throughout, so each thread has a buffer of its own and needs no lock.
+static __thread uint8_t log_buf[KMYTH_ENCLAVE_LOG_BUFFER_SIZE];
+static __thread size_t log_buf_len = 0;
+
+// least severe level the untrusted logger records (reported by each flush)
+static volatile int log_max_severity = LOG_DEBUG;
+
+//############################################################################
+// append_log_string()
+//############################################################################
+static void append_log_string(const char *str, size_t len)
+{
+  memcpy(log_buf + log_buf_len, str, len);
+  log_buf[log_buf_len + len] = '\0';
+  log_buf_len += len + 1;
+}
+
+//############################################################################
+// kmyth_enclave_log_event()
+//############################################################################
+void kmyth_enclave_log_event(const char *src_file,
+                             const char *src_func,
+                             int src_line, int severity, const char *msg)
+{
+  // nothing to pass out if the untrusted logger would not record it
+  if (severity > log_max_severity)
+  {
+    return;
+  }
+
+  size_t file_len = strnlen(src_file, KMYTH_ENCLAVE_LOG_MAX_NAME_LEN);
+  size_t func_len = strnlen(src_func, KMYTH_ENCLAVE_LOG_MAX_NAME_LEN);
+  size_t msg_len = strnlen(msg, KMYTH_ENCLAVE_LOG_MAX_MSG_LEN);
+  size_t record_len = 2 * sizeof(int) + file_len + func_len + msg_len + 3;
+
+  // (the length limits guarantee that a record fits in an empty buffer)
+  if (record_len > sizeof(log_buf) - log_buf_len)
+  {
+    kmyth_enclave_log_flush();
+  }
+
+  memcpy(log_buf + log_buf_len, &src_line, sizeof(int));
+  log_buf_len += sizeof(int);
+  memcpy(log_buf + log_buf_len, &severity, sizeof(int));
+  log_buf_len += sizeof(int);
+  append_log_string(src_file, file_len);
+  append_log_string(src_func, func_len);
+  append_log_string(msg, msg_len);
+
+  // errors go out at once, in case the ECALL never gets to flush
+  if (severity <= LOG_ERR)
+  {
+    kmyth_enclave_log_flush();
+  }
+}
+
+//############################################################################
+// kmyth_enclave_log_flush()
+//############################################################################
+void kmyth_enclave_log_flush(void)
+{
+  if (log_buf_len == 0)
+  {
+    return;
+  }
+
+  int max_severity = LOG_DEBUG;
+
+  if (log_events_ocall(&max_severity, log_buf, log_buf_len) == SGX_SUCCESS)
+  {
+    log_max_severity = max_severity;
+  }
+  log_buf_len = 0;
+}
@@ -6,8 +6,24 @@
 
 #include "kmyth_enclave_memory_util.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+// arena allocations are rounded up to keep every buffer aligned
+#define SESSION_ARENA_ALIGN 16
+
+typedef struct
+{
+  unsigned char *base;          // KMYTH_ENCLAVE_SESSION_ARENA_SIZE bytes
+  size_t used;
+  size_t high;                  // most of the arena in use since it was reset
+  bool open;
+} session_arena_t;
+
+// one arena per enclave thread, kept across its sessions
+static __thread session_arena_t session_arena = { NULL, 0, 0, false };
+
 //############################################################################
 // kmyth_enclave_clear()
 //############################################################################
@@ -45,3 +61,90 @@ void *kmyth_enclave_secure_memset(void *v, int c, size_t n)
 
   return v;
 }
+
+//############################################################################
+// kmyth_enclave_session_begin()
+//############################################################################
+void kmyth_enclave_session_begin(void)
+{
+  if (session_arena.base == NULL)
+  {
+    session_arena.base = calloc(1, KMYTH_ENCLAVE_SESSION_ARENA_SIZE);
+  }
+  session_arena.used = 0;
+  session_arena.high = 0;
+  session_arena.open = (session_arena.base != NULL);
+}
+
+//############################################################################
+// kmyth_enclave_session_end()
+//############################################################################
+size_t kmyth_enclave_session_end(void)
+{
+  size_t high = session_arena.high;
+
+  // everything past the high-water mark is still zero from the last reset
+  kmyth_enclave_clear(session_arena.base, high);
+  session_arena.used = 0;
+  session_arena.high = 0;
+  session_arena.open = false;
+
+  return high;
+}
+
+//############################################################################
+// kmyth_enclave_session_alloc()
+//############################################################################
+void *kmyth_enclave_session_alloc(size_t size)
+{
+  if (session_arena.open && size > 0 &&
+      size <= KMYTH_ENCLAVE_SESSION_ARENA_SIZE - session_arena.used)
+  {
+    size_t rounded = (size + SESSION_ARENA_ALIGN - 1) &
+      ~((size_t) SESSION_ARENA_ALIGN - 1);
+    void *v = session_arena.base + session_arena.used;
+
+    session_arena.used += rounded;
+    if (session_arena.used > KMYTH_ENCLAVE_SESSION_ARENA_SIZE)
+    {
+      session_arena.used = KMYTH_ENCLAVE_SESSION_ARENA_SIZE;
+    }
+    if (session_arena.used > session_arena.high)
+    {
+      session_arena.high = session_arena.used;
+    }
+    return v;
+  }
+
+  return calloc(1, (size > 0) ? size : 1);
+}
+
+//############################################################################
+// kmyth_enclave_session_free()
+//############################################################################
+void kmyth_enclave_session_free(void *v, size_t size)
+{
+  if (v == NULL)
+    return;
+
+  unsigned char *p = v;
+
+  if (session_arena.base == NULL || p < session_arena.base ||
+      p >= session_arena.base + KMYTH_ENCLAVE_SESSION_ARENA_SIZE)
+  {
+    kmyth_enclave_clear_and_free(v, size);
+    return;
+  }
+
+  // the space stays zeroed for its next use
+  kmyth_enclave_clear(v, size);
+
+  size_t offset = (size_t) (p - session_arena.base);
+  size_t rounded = (size + SESSION_ARENA_ALIGN - 1) &
+    ~((size_t) SESSION_ARENA_ALIGN - 1);
+
+  if (session_arena.open && offset + rounded >= session_arena.used)
+  {
+    session_arena.used = offset;
+  }
+}
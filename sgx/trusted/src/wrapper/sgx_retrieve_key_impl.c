@@ -6,32 +6,639 @@
 
 #include "sgx_retrieve_key_impl.h"
 
+#include "sgx_thread.h"
+
 #include "cipher/aes_gcm.h"
 
 #include "kmip_util.h"
 
+// ephemeral key pairs generated ahead of use, each handed out only once
+static EVP_PKEY *ecdh_keypair_pool[ENCLAVE_ECDH_KEYPAIR_POOL_SIZE];
+static size_t ecdh_keypair_count = 0;
+static sgx_thread_mutex_t ecdh_keypair_lock = SGX_THREAD_MUTEX_INITIALIZER;
+
+// peer certificates prepared by earlier retrievals, keyed by the digest of
+// their DER encoding; an entry in use (refs > 0) is never evicted, and one
+// that could not be cached is freed when its last user hands it back
+typedef struct PeerCertEntry
+{
+  ECPeerCert peer;
+  int refs;
+  bool cached;
+  unsigned long last_used;
+} PeerCertEntry;
+
+static PeerCertEntry *peer_cert_cache[ENCLAVE_PEER_CERT_CACHE_SIZE];
+static unsigned long peer_cert_clock = 0;
+static sgx_thread_mutex_t peer_cert_lock = SGX_THREAD_MUTEX_INITIALIZER;
+
+// session tickets left by earlier retrievals, one per server (identified by
+// a digest of its host, port and certificate); each is taken out to be
+// used once, and the resumed session leaves the next one
+typedef struct SessionTicketEntry
+{
+  uint8_t server_id[SHA256_DIGEST_LENGTH];
+  ByteBuffer ticket;
+  ByteBuffer resume_secret;
+  time_t full_session_time;
+  int resumptions;
+} SessionTicketEntry;
+
+static SessionTicketEntry session_tickets[ENCLAVE_SESSION_TICKET_CACHE_SIZE];
+static sgx_thread_mutex_t session_ticket_lock = SGX_THREAD_MUTEX_INITIALIZER;
+
 //############################################################################
-// enclave_retrieve_key()
+// find_peer_cert()
 //############################################################################
-int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
-                         X509 * client_sign_cert,
-                         X509 * server_sign_cert,
-                         const char *server_host,
-                         size_t server_host_len,
-                         const char *server_port,
-                         size_t server_port_len,
-                         unsigned char *req_key_id,
-                         size_t req_key_id_len,
-                         uint8_t **retrieved_key_id,
-                         size_t *retrieved_key_id_len,
-                         uint8_t **retrieved_key,
-                         size_t *retrieved_key_len)
+static PeerCertEntry *find_peer_cert(const uint8_t * digest)
+{
+  // (the caller holds peer_cert_lock)
+  for (size_t i = 0; i < ENCLAVE_PEER_CERT_CACHE_SIZE; i++)
+  {
+    PeerCertEntry *entry = peer_cert_cache[i];
+
+    if (entry != NULL &&
+        memcmp(entry->peer.digest, digest, SHA256_DIGEST_LENGTH) == 0)
+    {
+      entry->refs++;
+      entry->last_used = ++peer_cert_clock;
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// enclave_get_peer_cert()
+//############################################################################
+int enclave_get_peer_cert(uint8_t * cert_der, size_t cert_der_len,
+                          ECPeerCert ** peer)
+{
+  uint8_t digest[SHA256_DIGEST_LENGTH] = { 0 };
+
+  if (EVP_Digest(cert_der, cert_der_len, digest, NULL, EVP_sha256(),
+                 NULL) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to compute peer certificate digest");
+    return EXIT_FAILURE;
+  }
+
+  sgx_thread_mutex_lock(&peer_cert_lock);
+  PeerCertEntry *entry = find_peer_cert(digest);
+
+  sgx_thread_mutex_unlock(&peer_cert_lock);
+  if (entry != NULL)
+  {
+    *peer = &(entry->peer);
+    return EXIT_SUCCESS;
+  }
+
+  // not seen before (or evicted since): parse and prepare it
+  X509 *cert = NULL;
+
+  if (unmarshal_ec_der_to_x509(cert_der, cert_der_len, &cert))
+  {
+    kmyth_sgx_log(LOG_ERR, "unmarshal of peer certificate failed");
+    X509_free(cert);
+    return EXIT_FAILURE;
+  }
+
+  entry = calloc(1, sizeof(PeerCertEntry));
+  if (entry == NULL ||
+      ec_peer_cert_prepare(cert, &(entry->peer)) != EXIT_SUCCESS)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to prepare peer certificate");
+    free(entry);
+    X509_free(cert);
+    return EXIT_FAILURE;
+  }
+  X509_free(cert);
+  entry->refs = 1;
+
+  // cache it in a free slot, or in place of the least recently used entry
+  // not in use - unless another retrieval has cached it meanwhile
+  sgx_thread_mutex_lock(&peer_cert_lock);
+  PeerCertEntry *cached = find_peer_cert(entry->peer.digest);
+
+  if (cached == NULL)
+  {
+    size_t slot = ENCLAVE_PEER_CERT_CACHE_SIZE;
+
+    for (size_t i = 0; i < ENCLAVE_PEER_CERT_CACHE_SIZE; i++)
+    {
+      if (peer_cert_cache[i] == NULL)
+      {
+        slot = i;
+        break;
+      }
+      if (peer_cert_cache[i]->refs == 0 &&
+          (slot == ENCLAVE_PEER_CERT_CACHE_SIZE ||
+           peer_cert_cache[i]->last_used < peer_cert_cache[slot]->last_used))
+      {
+        slot = i;
+      }
+    }
+    if (slot < ENCLAVE_PEER_CERT_CACHE_SIZE)
+    {
+      if (peer_cert_cache[slot] != NULL)
+      {
+        ec_peer_cert_clear(&(peer_cert_cache[slot]->peer));
+        free(peer_cert_cache[slot]);
+      }
+      entry->cached = true;
+      entry->last_used = ++peer_cert_clock;
+      peer_cert_cache[slot] = entry;
+    }
+  }
+  sgx_thread_mutex_unlock(&peer_cert_lock);
+
+  if (cached != NULL)
+  {
+    ec_peer_cert_clear(&(entry->peer));
+    free(entry);
+    entry = cached;
+  }
+
+  *peer = &(entry->peer);
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// enclave_put_peer_cert()
+//############################################################################
+void enclave_put_peer_cert(ECPeerCert * peer)
+{
+  if (peer == NULL)
+  {
+    return;
+  }
+
+  // (the prepared certificate is the first member of its entry)
+  PeerCertEntry *entry = (PeerCertEntry *) peer;
+
+  sgx_thread_mutex_lock(&peer_cert_lock);
+  bool release = (--entry->refs == 0 && !entry->cached);
+
+  sgx_thread_mutex_unlock(&peer_cert_lock);
+
+  if (release)
+  {
+    ec_peer_cert_clear(&(entry->peer));
+    free(entry);
+  }
+}
+
+//############################################################################
+// enclave_prepare_ecdh_keypairs()
+//############################################################################
+size_t enclave_prepare_ecdh_keypairs(size_t count)
+{
+  if (count > ENCLAVE_ECDH_KEYPAIR_POOL_SIZE)
+  {
+    count = ENCLAVE_ECDH_KEYPAIR_POOL_SIZE;
+  }
+
+  sgx_thread_mutex_lock(&ecdh_keypair_lock);
+  while (ecdh_keypair_count < count)
+  {
+    // (a retrieval may take from the pool while this one is generated)
+    sgx_thread_mutex_unlock(&ecdh_keypair_lock);
+
+    EVP_PKEY *keypair = NULL;
+
+    if (create_ecdh_ephemeral_keypair(&keypair) != EXIT_SUCCESS)
+    {
+      kmyth_sgx_log(LOG_ERR, "ECDH ephemeral key pair generation failed");
+      EVP_PKEY_free(keypair);
+      sgx_thread_mutex_lock(&ecdh_keypair_lock);
+      break;
+    }
+
+    sgx_thread_mutex_lock(&ecdh_keypair_lock);
+    if (ecdh_keypair_count < ENCLAVE_ECDH_KEYPAIR_POOL_SIZE)
+    {
+      ecdh_keypair_pool[ecdh_keypair_count++] = keypair;
+    }
+    else
+    {
+      EVP_PKEY_free(keypair);
+    }
+  }
+  size_t ready = ecdh_keypair_count;
+
+  sgx_thread_mutex_unlock(&ecdh_keypair_lock);
+
+  return ready;
+}
+
+//############################################################################
+// take_ecdh_keypair()
+//############################################################################
+static int take_ecdh_keypair(EVP_PKEY ** keypair)
+{
+  *keypair = NULL;
+
+  sgx_thread_mutex_lock(&ecdh_keypair_lock);
+  if (ecdh_keypair_count > 0)
+  {
+    *keypair = ecdh_keypair_pool[--ecdh_keypair_count];
+    ecdh_keypair_pool[ecdh_keypair_count] = NULL;
+  }
+  sgx_thread_mutex_unlock(&ecdh_keypair_lock);
+
+  if (*keypair != NULL)
+  {
+    kmyth_sgx_log(LOG_DEBUG, "took a prepared client-side ephemeral key pair");
+    return EXIT_SUCCESS;
+  }
+
+  return create_ecdh_ephemeral_keypair(keypair);
+}
+
+//############################################################################
+// clear_session_ticket()
+//############################################################################
+static void clear_session_ticket(SessionTicketEntry * entry)
+{
+  free(entry->ticket.buffer);
+  kmyth_enclave_clear_and_free(entry->resume_secret.buffer,
+                               entry->resume_secret.size);
+  kmyth_enclave_clear(entry, sizeof(SessionTicketEntry));
+}
+
+//############################################################################
+// session_server_id()
+//############################################################################
+static int session_server_id(const char *server_host, size_t server_host_len,
+                             const char *server_port, size_t server_port_len,
+                             ECPeerCert * server_sign_cert,
+                             uint8_t * server_id)
+{
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  int ok = (ctx != NULL &&
+            EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1 &&
+            EVP_DigestUpdate(ctx, server_host, server_host_len) == 1 &&
+            EVP_DigestUpdate(ctx, "", 1) == 1 &&
+            EVP_DigestUpdate(ctx, server_port, server_port_len) == 1 &&
+            EVP_DigestUpdate(ctx, "", 1) == 1 &&
+            EVP_DigestUpdate(ctx, server_sign_cert->digest,
+                             SHA256_DIGEST_LENGTH) == 1 &&
+            EVP_DigestFinal_ex(ctx, server_id, NULL) == 1);
+
+  EVP_MD_CTX_free(ctx);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//############################################################################
+// take_session_ticket()
+//############################################################################
+static bool take_session_ticket(const uint8_t * server_id,
+                                SessionTicketEntry * entry)
+{
+  bool found = false;
+
+  sgx_thread_mutex_lock(&session_ticket_lock);
+  for (size_t i = 0; i < ENCLAVE_SESSION_TICKET_CACHE_SIZE; i++)
+  {
+    if (session_tickets[i].ticket.buffer != NULL &&
+        memcmp(session_tickets[i].server_id, server_id,
+               SHA256_DIGEST_LENGTH) == 0)
+    {
+      *entry = session_tickets[i];
+      kmyth_enclave_clear(&(session_tickets[i]), sizeof(SessionTicketEntry));
+      found = true;
+      break;
+    }
+  }
+  sgx_thread_mutex_unlock(&session_ticket_lock);
+
+  if (!found)
+  {
+    return false;
+  }
+
+  // past the enclave's own limits, the ticket is just dropped
+  time_t now = 0;
+
+  if (time_ocall(&now, &now) != SGX_SUCCESS ||
+      now < entry->full_session_time ||
+      now >= entry->full_session_time + ENCLAVE_SESSION_TICKET_LIFETIME ||
+      entry->resumptions >= ENCLAVE_SESSION_TICKET_MAX_RESUMPTIONS)
+  {
+    kmyth_sgx_log(LOG_DEBUG, "session ticket past resumption limits");
+    clear_session_ticket(entry);
+    return false;
+  }
+
+  return true;
+}
+
+//############################################################################
+// put_session_ticket()
+//############################################################################
+static void put_session_ticket(SessionTicketEntry * entry)
+{
+  // (the table takes over the entry's buffers)
+  if (ENCLAVE_SESSION_TICKET_LIFETIME <= 0 ||
+      entry->ticket.buffer == NULL ||
+      entry->resume_secret.size != KMYTH_ECDH_RESUME_SECRET_SIZE ||
+      entry->resumptions >= ENCLAVE_SESSION_TICKET_MAX_RESUMPTIONS)
+  {
+    clear_session_ticket(entry);
+    return;
+  }
+
+  // replace the server's old ticket, else fill a free slot, else replace
+  // the ticket from the longest ago full session
+  size_t slot = ENCLAVE_SESSION_TICKET_CACHE_SIZE;
+
+  sgx_thread_mutex_lock(&session_ticket_lock);
+  for (size_t i = 0; i < ENCLAVE_SESSION_TICKET_CACHE_SIZE; i++)
+  {
+    if (session_tickets[i].ticket.buffer != NULL &&
+        memcmp(session_tickets[i].server_id, entry->server_id,
+               SHA256_DIGEST_LENGTH) == 0)
+    {
+      slot = i;
+      break;
+    }
+    if (slot == ENCLAVE_SESSION_TICKET_CACHE_SIZE ||
+        (session_tickets[slot].ticket.buffer != NULL &&
+         (session_tickets[i].ticket.buffer == NULL ||
+          session_tickets[i].full_session_time <
+          session_tickets[slot].full_session_time)))
+    {
+      slot = i;
+    }
+  }
+  SessionTicketEntry old = session_tickets[slot];
+
+  session_tickets[slot] = *entry;
+  sgx_thread_mutex_unlock(&session_ticket_lock);
+
+  clear_session_ticket(&old);
+  kmyth_enclave_clear(entry, sizeof(SessionTicketEntry));
+}
+
+//############################################################################
+// resume_retrieve_key()
+//############################################################################
+static int resume_retrieve_key(SessionTicketEntry * entry,
+                               const char *server_host,
+                               size_t server_host_len,
+                               const char *server_port,
+                               size_t server_port_len,
+                               ByteBuffer * req_key_ids,
+                               size_t req_key_id_count,
+                               ByteBuffer * kmip_response)
+{
+  int ret_val;
+  sgx_status_t ret_ocall;
+
+  // derive this session's keys from the ticket's resumption secret and a
+  // fresh nonce (along with the secret the next ticket will carry)
+  uint8_t nonce_bytes[KMYTH_ECDH_RESUME_NONCE_SIZE] = { 0 };
+  ByteBuffer nonce = { sizeof(nonce_bytes), nonce_bytes };
+  ByteBuffer request_key = { 0, NULL };
+  ByteBuffer response_key = { 0, NULL };
+  ByteBuffer next_secret = { 0, NULL };
+
+  if (RAND_bytes(nonce_bytes, sizeof(nonce_bytes)) != 1 ||
+      derive_resumed_session_keys(&(entry->resume_secret),
+                                  &(entry->ticket),
+                                  &nonce,
+                                  &request_key,
+                                  &response_key,
+                                  &next_secret) != EXIT_SUCCESS)
+  {
+    kmyth_sgx_log(LOG_ERR, "resumed session key derivation failed");
+    return EXIT_FAILURE;
+  }
+
+  // compose 'Resume Request' message (ticket, nonce and encrypted request)
+  ECDHMessage resume_request_msg = { { 0 }, NULL };
+
+  ret_val = compose_resume_request_msg(&(entry->ticket),
+                                       &nonce,
+                                       &request_key,
+                                       req_key_ids,
+                                       req_key_id_count,
+                                       &resume_request_msg);
+  kmyth_enclave_session_free(request_key.buffer, request_key.size);
+  if (ret_val != EXIT_SUCCESS)
+  {
+    kmyth_sgx_log(LOG_ERR, "error creating 'Resume Request' message");
+    kmyth_enclave_session_free(response_key.buffer, response_key.size);
+    kmyth_enclave_clear_and_free(next_secret.buffer, next_secret.size);
+    return EXIT_FAILURE;
+  }
+
+  // exchange 'Resume Request' and 'Resume Response' messages
+  int socket_fd = -1;
+  ECDHMessage resume_response_msg = { { 0 }, NULL };
+  size_t resume_response_len = 0;
+
+  ret_ocall = setup_socket_ocall(&ret_val,
+                                 server_host,
+                                 server_host_len,
+                                 server_port,
+                                 server_port_len,
+                                 &socket_fd);
+  if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
+  {
+    kmyth_sgx_log(LOG_ERR, "client socket setup failed.");
+    kmyth_enclave_session_free(response_key.buffer, response_key.size);
+    kmyth_enclave_clear_and_free(next_secret.buffer, next_secret.size);
+    free(resume_request_msg.body);
+    return EXIT_FAILURE;
+  }
+
+  ret_ocall = ecdh_exchange_ocall(&ret_val,
+                                  resume_request_msg.body,
+                                  resume_request_msg.hdr.msg_size,
+                                  &(resume_response_msg.body),
+                                  &resume_response_len,
+                                  socket_fd);
+  close_socket_ocall(socket_fd);
+  free(resume_request_msg.body);
+  if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS ||
+      resume_response_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    // (also how a server that does not accept the ticket answers)
+    kmyth_sgx_log(LOG_DEBUG, "session resumption unsuccessful");
+    kmyth_enclave_session_free(response_key.buffer, response_key.size);
+    kmyth_enclave_clear_and_free(next_secret.buffer, next_secret.size);
+    free_ocall((void **) &(resume_response_msg.body));
+    return EXIT_FAILURE;
+  }
+  resume_response_msg.hdr.msg_size = (uint16_t) resume_response_len;
+
+  // decrypt and parse 'Resume Response' message fields
+  ByteBuffer next_ticket = { 0, NULL };
+
+  ret_val = parse_resume_response_msg(&response_key,
+                                      &resume_response_msg,
+                                      kmip_response,
+                                      &next_ticket);
+  kmyth_enclave_session_free(response_key.buffer, response_key.size);
+  free_ocall((void **) &(resume_response_msg.body));
+  if (ret_val != EXIT_SUCCESS)
+  {
+    kmyth_sgx_log(LOG_ERR, "'Resume Response' message parse/validate error");
+    kmyth_enclave_clear_and_free(next_secret.buffer, next_secret.size);
+    return EXIT_FAILURE;
+  }
+  kmyth_sgx_log(LOG_DEBUG, "resumed session from ticket");
+
+  // keep the next ticket (if the server issued one) for the next retrieval
+  SessionTicketEntry next = { { 0 }, next_ticket, next_secret,
+                              entry->full_session_time,
+                              entry->resumptions + 1 };
+
+  memcpy(next.server_id, entry->server_id, SHA256_DIGEST_LENGTH);
+  put_session_ticket(&next);
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// finish_retrieve_key()
+//############################################################################
+static int finish_retrieve_key(ByteBuffer * kmip_response,
+                               ByteBuffer * req_key_ids,
+                               size_t req_key_id_count,
+                               kmip_key_result ** retrieved_keys)
+{
+  int ret_val;
+
+  char lmsg[MAX_LOG_MSG_LEN] = { 0 };
+
+  snprintf(lmsg, MAX_LOG_MSG_LEN,
+           "KMIP 'get key' response = 0x%02X%02X...%02X%02X (%ld bytes)",
+           kmip_response->buffer[0],
+           kmip_response->buffer[1],
+           kmip_response->buffer[kmip_response->size-2],
+           kmip_response->buffer[kmip_response->size-1],
+           kmip_response->size);
+  kmyth_sgx_log(LOG_DEBUG, lmsg);
+
+  KMIP kmip_ctx = { 0 };
+  kmip_init(&kmip_ctx, NULL, 0, KMIP_2_0);
+
+  // a single key was requested with a plain 'get key' request, and more
+  // than one with a batch request (see compose_key_request_msg())
+  if (req_key_id_count == 1)
+  {
+    *retrieved_keys = calloc(1, sizeof(kmip_key_result));
+    ret_val = (*retrieved_keys == NULL) ||
+              parse_kmip_get_response(&kmip_ctx,
+                                      kmip_response->buffer,
+                                      kmip_response->size,
+                                      &((*retrieved_keys)->id),
+                                      &((*retrieved_keys)->id_len),
+                                      &((*retrieved_keys)->key),
+                                      &((*retrieved_keys)->key_len));
+  }
+  else
+  {
+    ret_val = parse_kmip_batch_get_response(&kmip_ctx,
+                                            kmip_response->buffer,
+                                            kmip_response->size,
+                                            req_key_id_count,
+                                            retrieved_keys);
+  }
+  kmip_destroy(&kmip_ctx);
+  kmyth_enclave_clear_and_free(kmip_response->buffer, kmip_response->size);
+  if (ret_val)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to parse the KMIP 'get key' response");
+    free_kmip_key_results(*retrieved_keys, req_key_id_count);
+    *retrieved_keys = NULL;
+    return EXIT_FAILURE;
+  }
+
+  // every requested key must have come back, under the ID it was asked for
+  for (size_t i = 0; i < req_key_id_count; i++)
+  {
+    kmip_key_result *result = &((*retrieved_keys)[i]);
+
+    if (result->id == NULL || result->key == NULL || result->key_len < 2 ||
+        result->id_len != req_key_ids[i].size ||
+        memcmp(result->id, req_key_ids[i].buffer, req_key_ids[i].size))
+    {
+      snprintf(lmsg, MAX_LOG_MSG_LEN, "key %ld of %ld (ID: %.*s) not "
+                                      "retrieved", i + 1, req_key_id_count,
+                                      (int) req_key_ids[i].size,
+                                      req_key_ids[i].buffer);
+      kmyth_sgx_log(LOG_ERR, lmsg);
+      free_kmip_key_results(*retrieved_keys, req_key_id_count);
+      *retrieved_keys = NULL;
+      return EXIT_FAILURE;
+    }
+
+    snprintf(lmsg, MAX_LOG_MSG_LEN,
+             "Received KMIP object (ID: %.*s) with key: "
+             "0x%02X%02X..%02X%02X (%ld bytes)",
+             (int) result->id_len, result->id,
+             result->key[0], result->key[1],
+             result->key[result->key_len - 2],
+             result->key[result->key_len - 1],
+             result->key_len);
+    kmyth_sgx_log(LOG_DEBUG, lmsg);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// retrieve_key_session()
+//############################################################################
+static int retrieve_key_session(EVP_PKEY * client_sign_privkey,
+                                X509 * client_sign_cert,
+                                ECPeerCert * server_sign_cert,
+                                const char *server_host,
+                                size_t server_host_len,
+                                const char *server_port,
+                                size_t server_port_len,
+                                ByteBuffer * req_key_ids,
+                                size_t req_key_id_count,
+                                kmip_key_result ** retrieved_keys)
 {
   int ret_val;
   sgx_status_t ret_ocall;
 
   char lmsg[MAX_LOG_MSG_LEN] = { 0 };
 
+  // resume an earlier session with the server, if it left a ticket
+  SessionTicketEntry ticket_entry = { { 0 }, { 0, NULL }, { 0, NULL }, 0, 0 };
+
+  if (ENCLAVE_SESSION_TICKET_LIFETIME > 0 &&
+      session_server_id(server_host, server_host_len,
+                        server_port, server_port_len,
+                        server_sign_cert, ticket_entry.server_id)
+      == EXIT_SUCCESS &&
+      take_session_ticket(ticket_entry.server_id, &ticket_entry))
+  {
+    ByteBuffer resumed_kmip_response = { 0, NULL };
+
+    ret_val = resume_retrieve_key(&ticket_entry,
+                                  server_host, server_host_len,
+                                  server_port, server_port_len,
+                                  req_key_ids, req_key_id_count,
+                                  &resumed_kmip_response);
+    clear_session_ticket(&ticket_entry);
+    if (ret_val == EXIT_SUCCESS)
+    {
+      return finish_retrieve_key(&resumed_kmip_response,
+                                 req_key_ids, req_key_id_count,
+                                 retrieved_keys);
+    }
+    kmyth_sgx_log(LOG_DEBUG, "falling back to a full session");
+  }
+
   // setup socket to support enclave connection to key server
   int enclave_client_socket_fd = -1;
 
@@ -48,9 +655,9 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   }
 
   // create public and private components of the client's ephemeral
-  // contribution to the session key
+  // contribution to the session key (or take a pair prepared earlier)
   EVP_PKEY * enclave_ephemeral_keypair = NULL;
-  ret_val = create_ecdh_ephemeral_keypair(&(enclave_ephemeral_keypair));
+  ret_val = take_ecdh_keypair(&(enclave_ephemeral_keypair));
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "client ECDH ephemeral creation failed");
@@ -155,6 +762,7 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   // generate session key result for ECDH key agreement (client side)
   ByteBuffer request_session_key = { 0, NULL };
   ByteBuffer response_session_key = { 0, NULL };
+  ByteBuffer *resume = &(ticket_entry.resume_secret);
 
   ret_val = compute_ecdh_session_key(secret.buffer,
                                      secret.size,
@@ -165,17 +773,20 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
                                      &(request_session_key.buffer),
                                      &(request_session_key.size),
                                      &(response_session_key.buffer),
-                                     &(response_session_key.size));
+                                     &(response_session_key.size),
+                                     &(resume->buffer),
+                                     &(resume->size));
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "session key computation failed");
-    kmyth_enclave_clear_and_free(secret.buffer, secret.size);
+    kmyth_enclave_session_free(secret.buffer, secret.size);
     EVP_PKEY_free(server_ephemeral_pubkey);
     free(client_hello_msg.body);
     free_ocall((void **) &(server_hello_msg.body));
+    clear_session_ticket(&ticket_entry);
     return EXIT_FAILURE;
   }
-  kmyth_enclave_clear_and_free(secret.buffer, secret.size);
+  kmyth_enclave_session_free(secret.buffer, secret.size);
   free(client_hello_msg.body);
   free_ocall((void **) &(server_hello_msg.body));
 
@@ -198,26 +809,27 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
 
   // compose 'Key Request' message (client to server request to retrieve key)
   ECDHMessage key_request_msg = { { 0 }, NULL };
-  ByteBuffer kmip_key_id = { req_key_id_len, req_key_id };
 
   ret_val = compose_key_request_msg(client_sign_privkey,
                                     &(request_session_key),
-                                    &kmip_key_id,
+                                    req_key_ids,
+                                    req_key_id_count,
                                     server_ephemeral_pubkey,
                                     &key_request_msg);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "error creating 'Key Request' message");
-    kmyth_enclave_clear_and_free(request_session_key.buffer,
-                                 request_session_key.size);
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
+    kmyth_enclave_session_free(request_session_key.buffer,
+                               request_session_key.size);
+    kmyth_enclave_session_free(response_session_key.buffer,
+                               response_session_key.size);
     EVP_PKEY_free(server_ephemeral_pubkey);
     free(key_request_msg.body);
+    clear_session_ticket(&ticket_entry);
     return EXIT_FAILURE;
   }
-  kmyth_enclave_clear_and_free(request_session_key.buffer,
-                               request_session_key.size);
+  kmyth_enclave_session_free(request_session_key.buffer,
+                             request_session_key.size);
 
   snprintf(lmsg, MAX_LOG_MSG_LEN,
            "composed Key Request: 0x%02X%02X...%02X%02X (%d bytes)",
@@ -236,9 +848,10 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "failed to send the 'Key Request' message");
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
+    kmyth_enclave_session_free(response_session_key.buffer,
+                               response_session_key.size);
     free(key_request_msg.body);
+    clear_session_ticket(&ticket_entry);
     return EXIT_FAILURE;
   }
   free(key_request_msg.body);
@@ -253,9 +866,10 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "failed to receive the 'Key Response' message");
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
+    kmyth_enclave_session_free(response_session_key.buffer,
+                               response_session_key.size);
     free_ocall((void **) &(key_response_msg.body));
+    clear_session_ticket(&ticket_entry);
     return EXIT_FAILURE;
   }
 
@@ -273,71 +887,66 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   ret_val = parse_key_response_msg(server_sign_cert,
                                    &(response_session_key),
                                    &key_response_msg,
-                                   &kmip_response);
+                                   &kmip_response,
+                                   &(ticket_entry.ticket));
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "'Key Response' message parse/validate error");
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
+    kmyth_enclave_session_free(response_session_key.buffer,
+                               response_session_key.size);
     kmyth_enclave_clear_and_free(kmip_response.buffer, kmip_response.size);
+    clear_session_ticket(&ticket_entry);
     free_ocall((void **) &(key_response_msg.body));
     return EXIT_FAILURE;
   }
-  kmyth_enclave_clear_and_free(response_session_key.buffer,
-                               response_session_key.size);
+  kmyth_enclave_session_free(response_session_key.buffer,
+                             response_session_key.size);
   free_ocall((void **) &(key_response_msg.body));
 
-  snprintf(lmsg, MAX_LOG_MSG_LEN,
-           "KMIP 'get key' response = 0x%02X%02X...%02X%02X (%ld bytes)",
-           kmip_response.buffer[0],
-           kmip_response.buffer[1],
-           kmip_response.buffer[kmip_response.size-2],
-           kmip_response.buffer[kmip_response.size-1],
-           kmip_response.size);
-  kmyth_sgx_log(LOG_DEBUG, lmsg);
-
-  KMIP kmip_ctx = { 0 };
-  kmip_init(&kmip_ctx, NULL, 0, KMIP_2_0);
-
-  ret_val = parse_kmip_get_response(&kmip_ctx,
-                                    kmip_response.buffer,
-                                    kmip_response.size,
-                                    retrieved_key_id,
-                                    retrieved_key_id_len,
-                                    (unsigned char **) retrieved_key,
-                                    retrieved_key_len);
-  kmip_destroy(&kmip_ctx);
-  if (ret_val)
-  {
-    kmyth_sgx_log(LOG_ERR, "failed to parse the KMIP 'get key' response");
-    kmyth_enclave_clear_and_free(kmip_response.buffer, kmip_response.size);
-    return EXIT_FAILURE;
-  }
-  kmyth_enclave_clear_and_free(kmip_response.buffer, kmip_response.size);
+  // keep the session ticket (if the server issued one) for the next
+  // retrieval from this server
+  time_ocall(&(ticket_entry.full_session_time),
+             &(ticket_entry.full_session_time));
+  put_session_ticket(&ticket_entry);
 
-  snprintf(lmsg, MAX_LOG_MSG_LEN, "received KMIP object with ID: %.*s "
-                                  "(length=%ld)", (int) *retrieved_key_id_len,
-                                  *retrieved_key_id, *retrieved_key_id_len);
-  kmyth_sgx_log(LOG_DEBUG, lmsg);
+  return finish_retrieve_key(&kmip_response,
+                             req_key_ids, req_key_id_count,
+                             retrieved_keys);
+}
+ 
 
-  if (*retrieved_key_id_len != req_key_id_len
-      || memcmp(*retrieved_key_id, req_key_id, req_key_id_len))
-  {
-    snprintf(lmsg, MAX_LOG_MSG_LEN, "retrieved key ID size (%ld) mismatches "
-                                    "requested (%ld)",
-                                    *retrieved_key_id_len, req_key_id_len);
-    kmyth_sgx_log(LOG_ERR, lmsg);
-    return EXIT_FAILURE;
-  }
+//############################################################################
+// enclave_retrieve_key()
+//############################################################################
+int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
+                         X509 * client_sign_cert,
+                         ECPeerCert * server_sign_cert,
+                         const char *server_host,
+                         size_t server_host_len,
+                         const char *server_port,
+                         size_t server_port_len,
+                         ByteBuffer * req_key_ids,
+                         size_t req_key_id_count,
+                         kmip_key_result ** retrieved_keys)
+{
+  // the session's short-lived buffers (shared secret, session keys,
+  // signatures, parsed message fields) come from this thread's session
+  // arena, which is wiped in one step when the session ends
+  kmyth_enclave_session_begin();
+
+  int ret_val = retrieve_key_session(client_sign_privkey, client_sign_cert,
+                                     server_sign_cert,
+                                     server_host, server_host_len,
+                                     server_port, server_port_len,
+                                     req_key_ids, req_key_id_count,
+                                     retrieved_keys);
+
+  size_t arena_used = kmyth_enclave_session_end();
+  char lmsg[MAX_LOG_MSG_LEN] = { 0 };
 
-  snprintf(lmsg, MAX_LOG_MSG_LEN,
-           "Received KMIP object with key: 0x%02X%02X..%02X%02X (%ld bytes)",
-           (*retrieved_key)[0], (*retrieved_key)[1],
-           (*retrieved_key)[*retrieved_key_len - 2],
-           (*retrieved_key)[*retrieved_key_len - 1],
-           *retrieved_key_len);
+  snprintf(lmsg, MAX_LOG_MSG_LEN, "session arena: %zu of %d bytes used",
+           arena_used, KMYTH_ENCLAVE_SESSION_ARENA_SIZE);
   kmyth_sgx_log(LOG_DEBUG, lmsg);
 
-  return EXIT_SUCCESS;
+  return ret_val;
 }
- 
@@ -8,6 +8,9 @@
 #ifndef _KMYTH_LOG_OCALL_H_
 #define _KMYTH_LOG_OCALL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <kmyth/kmyth_log.h>
 
 #ifdef __cplusplus
@@ -39,6 +42,23 @@ extern "C"
                        int severity,
                        const char *msg);
 
+/**
+ * @brief Logs a batch of messages buffered within the enclave (see
+ *        kmyth_enclave_log_util.h), so that they cost one enclave exit
+ *        rather than one each.
+ *
+ * @param[in] records          Packed messages: for each, the source line
+ *                             and severity (ints) followed by the null
+ *                             terminated source file, function and message
+ *                             strings
+ *
+ * @param[in] records_len      Length (in bytes) of records
+ *
+ * @return                     The least severe level the logger records
+ *                             (the enclave drops less severe messages)
+ */
+  int log_events_ocall(const uint8_t * records, size_t records_len);
+
 #ifdef __cplusplus
 }
 #endif
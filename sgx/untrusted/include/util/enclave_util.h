@@ -0,0 +1,49 @@
+/**
+ * @file enclave_util.h
+ *
+ * @brief Provides headers for creating the kmyth enclave, with the
+ *        switchless call runtime when it is built in
+ */
+
+#ifndef _KMYTH_ENCLAVE_UTIL_H_
+#define _KMYTH_ENCLAVE_UTIL_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "sgx_urts.h"
+
+/**
+ * @brief Untrusted worker threads serving switchless OCALLs. The
+ *        retrieve-key protocol makes one OCALL at a time per enclave
+ *        thread, and its receive OCALL can block a worker for as long as
+ *        the peer takes to answer, so this also bounds how many enclave
+ *        threads can be in the protocol without falling back to ordinary
+ *        OCALLs.
+ */
+#define KMYTH_SGX_SWITCHLESS_UWORKERS 2
+
+/**
+ * @brief Creates (loads and initializes) an enclave. When built with
+ *        KMYTH_SGX_SWITCHLESS defined, the switchless call runtime is
+ *        started with it, so OCALLs marked transition_using_threads in
+ *        the EDL are handed to untrusted worker threads rather than
+ *        leaving the enclave. Otherwise (or if no worker is free) those
+ *        OCALLs are made as ordinary OCALLs.
+ *
+ * @param[in]  enclave_fn     Enclave (signed .so) filename
+ *
+ * @param[out] eid            Enclave ID
+ *
+ * @return SGX_SUCCESS on success, an SGX error on failure
+ */
+sgx_status_t kmyth_sgx_create_enclave(const char *enclave_fn,
+                                      sgx_enclave_id_t * eid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KMYTH_ENCLAVE_UTIL_H_
@@ -17,6 +17,20 @@ extern "C"
 {
 #endif
 
+/**
+ * @brief Most items the batch wrappers pass to the enclave per ECALL
+ */
+#define KMYTH_SGX_BATCH_MAX_ITEMS 64
+
+/**
+ * @brief Most bytes of input the batch wrappers pass to the enclave per
+ *        ECALL (an item larger than this is refused by
+ *        kmyth_sgx_seal_nkl_batch() and goes alone in the unseal batch).
+ *        The enclave holds a copy of each batch, so this bounds the enclave
+ *        heap a batch uses.
+ */
+#define KMYTH_SGX_BATCH_MAX_BYTES (1024 * 1024)
+
   /**
    * @brief High-level function implementing sgx-seal using SGX.
    *
@@ -55,6 +69,158 @@ extern "C"
                            uint8_t * input,
                            size_t input_len, uint64_t * handle);
 
+  /**
+   * @brief Seals input like kmyth_sgx_seal_nkl(), but in segments, each
+   *        sealed on its own, so that the enclave never holds more than
+   *        one segment of it at a time: neither while sealing it, nor while
+   *        unsealing it with kmyth_sgx_unseal_nkl_segmented(). Meant for
+   *        inputs too large to hold in enclave memory whole.
+   *
+   * @param[in]  input             Raw bytes to be sgx-sealed
+   *
+   * @param[in]  input_len         Number of bytes in input
+   *
+   * @param[in]  segment_len       Size of each segment (0 for
+   *                               KMYTH_SGX_SEGMENT_LEN), at most
+   *                               KMYTH_SGX_SEGMENT_MAX_LEN
+   *
+   * @param[out] output            Bytes in nkl format of sealed data
+   *
+   * @param[out] output_len        Number of bytes in output
+   *
+   * key_policy and attribute_mask are as for kmyth_sgx_seal_nkl().
+   *
+   * @return 0 on success, 1 on error
+   */
+  int kmyth_sgx_seal_nkl_segmented(sgx_enclave_id_t eid,
+                                   uint8_t * input,
+                                   size_t input_len,
+                                   uint32_t segment_len,
+                                   uint8_t ** output,
+                                   size_t *output_len,
+                                   uint16_t key_policy,
+                                   sgx_attributes_t attribute_mask);
+
+  /**
+   * @brief Unseals the output of kmyth_sgx_seal_nkl_segmented() one segment
+   *        at a time, re-encrypting each segment within the enclave under a
+   *        key held there (see kmyth_enclave_unseal_segmented_with_handle()).
+   *        The plaintext only leaves the enclave encrypted, and never
+   *        occupies more than one segment of enclave memory.
+   *
+   * @param[in]  input             Raw data to be sgx-unsealed
+   *
+   * @param[in]  input_len         The size of input in bytes
+   *
+   * @param[in]  key_handle        Handle of a 16, 24, or 32 byte key in the
+   *                               enclave's unsealed data table
+   *
+   * @param[out] output            The data as an AES/GCM stream (header
+   *                               followed by one chunk per segment) under
+   *                               that key, which
+   *                               kmyth_enclave_stream_decrypt_with_handle()
+   *                               decrypts in runs (the caller frees it)
+   *
+   * @param[out] output_len        Number of bytes in output
+   *
+   * @return 0 on success, 1 on error
+   */
+  int kmyth_sgx_unseal_nkl_segmented(sgx_enclave_id_t eid,
+                                     uint8_t * input,
+                                     size_t input_len,
+                                     uint64_t key_handle,
+                                     uint8_t ** output, size_t *output_len);
+
+  /**
+   * @brief Seals several inputs like kmyth_sgx_seal_nkl(), with one ECALL
+   *        per batch of up to KMYTH_SGX_BATCH_MAX_ITEMS inputs (and
+   *        KMYTH_SGX_BATCH_MAX_BYTES) rather than two per input.
+   *
+   * @param[in]  inputs            Raw bytes of each input to be sgx-sealed
+   *
+   * @param[in]  input_lens        Number of bytes in each input
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[out] outputs           Bytes in nkl format of each sealed input
+   *                               (the caller frees each)
+   *
+   * @param[out] output_lens       Number of bytes in each output
+   *
+   * @return 0 on success, 1 on error (when no outputs are returned)
+   */
+  int kmyth_sgx_seal_nkl_batch(sgx_enclave_id_t eid,
+                               uint8_t ** inputs,
+                               size_t *input_lens,
+                               size_t count,
+                               uint8_t ** outputs,
+                               size_t *output_lens,
+                               uint16_t key_policy,
+                               sgx_attributes_t attribute_mask);
+
+  /**
+   * @brief Unseals several .nkl inputs into the enclave like
+   *        kmyth_sgx_unseal_nkl(), with one ECALL per batch
+   *
+   * @param[in]  inputs            Raw data of each input to be sgx-unsealed
+   *
+   * @param[in]  input_lens        The size of each input in bytes
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[out] handles           The handle of each unsealed input
+   *
+   * @return 0 on success, 1 on error (inputs unsealed before the error
+   *         remain in the enclave)
+   */
+  int kmyth_sgx_unseal_nkl_batch(sgx_enclave_id_t eid,
+                                 uint8_t ** inputs,
+                                 size_t *input_lens,
+                                 size_t count, uint64_t * handles);
+
+  /**
+   * @brief Moves secrets from TPM sealing to SGX sealing in memory: each
+   *        .ski input is TPM-unsealed (as by tpm2_kmyth_unseal_batch(), on
+   *        one TPM connection) and the result SGX-sealed into .nkl bytes
+   *        (as by kmyth_sgx_seal_nkl_batch()). The plaintext is never
+   *        written to a file, and only one enclave batch of it (up to
+   *        KMYTH_SGX_BATCH_MAX_ITEMS inputs) is held, then cleared, at a
+   *        time.
+   *
+   *        There is no .nkl to .ski counterpart: SGX-unsealed data is only
+   *        ever released into the enclave's unsealed data table.
+   *
+   * @param[in]  inputs            Bytes of each .ski input
+   *
+   * @param[in]  input_lens        Number of bytes in each input
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[out] outputs           Bytes in nkl format of each migrated input
+   *                               (the caller frees each)
+   *
+   * @param[out] output_lens       Number of bytes in each output
+   *
+   * The TPM authorization parameters are as described for
+   * tpm2_kmyth_unseal(); key_policy and attribute_mask as for
+   * kmyth_sgx_seal_nkl().
+   *
+   * @return 0 on success, 1 on error (when no outputs are returned)
+   */
+  int kmyth_sgx_migrate_ski_to_nkl(sgx_enclave_id_t eid,
+                                   uint8_t ** inputs,
+                                   size_t *input_lens,
+                                   size_t count,
+                                   uint8_t ** outputs,
+                                   size_t *output_lens,
+                                   uint8_t * auth_bytes,
+                                   size_t auth_bytes_len,
+                                   uint8_t * owner_auth_bytes,
+                                   size_t oa_bytes_len,
+                                   uint8_t bool_policy_or,
+                                   uint16_t key_policy,
+                                   sgx_attributes_t attribute_mask);
+
 #ifdef __cplusplus
 }
 #endif
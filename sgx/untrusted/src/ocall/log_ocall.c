@@ -7,6 +7,8 @@
 
 #include "log_ocall.h"
 
+#include <string.h>
+
 /*****************************************************************************
  * log_event_ocall
  ****************************************************************************/
@@ -18,3 +20,40 @@ void log_event_ocall(const char *src_file,
 {
   log_event(src_file, src_func, src_line, severity, msg);
 }
+
+/*****************************************************************************
+ * log_events_ocall
+ ****************************************************************************/
+int log_events_ocall(const uint8_t * records, size_t records_len)
+{
+  size_t pos = 0;
+
+  while (records_len - pos >= 2 * sizeof(int))
+  {
+    int src_line = 0;
+    int severity = 0;
+    const char *strings[3];
+
+    memcpy(&src_line, records + pos, sizeof(int));
+    pos += sizeof(int);
+    memcpy(&severity, records + pos, sizeof(int));
+    pos += sizeof(int);
+
+    // the source file, function and message (stop at a truncated record)
+    for (int i = 0; i < 3; i++)
+    {
+      const uint8_t *end = memchr(records + pos, '\0', records_len - pos);
+
+      if (end == NULL)
+      {
+        return __atomic_load_n(&kmyth_log_max_severity, __ATOMIC_RELAXED);
+      }
+      strings[i] = (const char *) (records + pos);
+      pos = (size_t) (end - records) + 1;
+    }
+
+    log_event(strings[0], strings[1], src_line, severity, "%s", strings[2]);
+  }
+
+  return __atomic_load_n(&kmyth_log_max_severity, __ATOMIC_RELAXED);
+}
@@ -31,7 +31,7 @@ int setup_socket_ocall(const char *server_host,
   kmyth_log(LOG_DEBUG, "Setting up client socket, remote host: %s, port: %s",
             server_host, server_port);
 
-  if (setup_client_socket(server_host, server_port, socket_fd))
+  if (setup_client_socket(server_host, server_port, NULL, socket_fd))
   {
     kmyth_log(LOG_ERR, "Failed to connect to the server.");
     return EXIT_FAILURE;
@@ -0,0 +1,37 @@
+/**
+ * @file  enclave_util.c
+ *
+ * @brief Provides creation of the kmyth enclave, with the switchless call
+ *        runtime when it is built in
+ */
+
+#include <stddef.h>
+
+#include "enclave_util.h"
+
+#ifdef KMYTH_SGX_SWITCHLESS
+#include "sgx_uswitchless.h"
+#endif
+
+/*****************************************************************************
+ * kmyth_sgx_create_enclave()
+ ****************************************************************************/
+sgx_status_t kmyth_sgx_create_enclave(const char *enclave_fn,
+                                      sgx_enclave_id_t * eid)
+{
+#ifdef KMYTH_SGX_SWITCHLESS
+  sgx_uswitchless_config_t us_config = SGX_USWITCHLESS_CONFIG_INITIALIZER;
+  const void *enclave_ex_p[32] = { 0 };
+
+  // only OCALLs are switchless: no trusted workers are needed
+  us_config.num_uworkers = KMYTH_SGX_SWITCHLESS_UWORKERS;
+  us_config.num_tworkers = 0;
+  enclave_ex_p[SGX_CREATE_ENCLAVE_EX_SWITCHLESS_BIT_IDX] = &us_config;
+
+  return sgx_create_enclave_ex(enclave_fn, SGX_DEBUG_FLAG, NULL, NULL, eid,
+                               NULL, SGX_CREATE_ENCLAVE_EX_SWITCHLESS,
+                               enclave_ex_p);
+#else
+  return sgx_create_enclave(enclave_fn, SGX_DEBUG_FLAG, NULL, NULL, eid, NULL);
+#endif
+}
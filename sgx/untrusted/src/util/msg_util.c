@@ -16,15 +16,9 @@ int recv_ecdh_msg(int socket_fd, unsigned char **buf, size_t *len)
   struct ECDHMessageHeader header;
 
   secure_memset(&header, 0, sizeof(header));
-  ssize_t bytes_read = read(socket_fd, &header, sizeof(header));
-  if (bytes_read <= 0)
+  if (socket_read_full(socket_fd, &header, sizeof(header)))
   {
-    kmyth_log(LOG_ERR, "ECDH connection is closed");
-    return EXIT_FAILURE;
-  }
-  else if ((size_t)bytes_read != sizeof(header))
-  {
-    kmyth_log(LOG_ERR, "read invalid number of ECDH message header bytes");
+    kmyth_log(LOG_ERR, "ECDH connection closed reading message header");
     return EXIT_FAILURE;
   }
   *len = ntohs(header.msg_size);
@@ -42,16 +36,12 @@ int recv_ecdh_msg(int socket_fd, unsigned char **buf, size_t *len)
     return EXIT_FAILURE;
   }
 
-  // receive message bytes
-  bytes_read = read(socket_fd, *buf, *len);
-  if (bytes_read <= 0)
-  {
-    kmyth_log(LOG_ERR, "ECDH connection is closed");
-    return EXIT_FAILURE;
-  }
-  else if ((size_t)bytes_read != *len)
+  // receive message bytes (however many reads they take to arrive)
+  if (socket_read_full(socket_fd, *buf, *len))
   {
-    kmyth_log(LOG_ERR, "read incorrect number of ECDH message bytes");
+    kmyth_log(LOG_ERR, "ECDH connection closed reading message bytes");
+    free(*buf);
+    *buf = NULL;
     return EXIT_FAILURE;
   }
 
@@ -74,18 +64,12 @@ int send_ecdh_msg(int socket_fd, unsigned char *buf, size_t len)
   secure_memset(&header, 0, sizeof(header));
   header.msg_size = htons(len);
 
-  ssize_t bytes_sent = write(socket_fd, &header, sizeof(header));
-  if ((bytes_sent <= 0) || ((size_t)bytes_sent != sizeof(header)))
-  {
-    kmyth_log(LOG_ERR, "sending ECDH message header failed");
-    return EXIT_FAILURE;
-  }
-
-  bytes_sent = write(socket_fd, buf, len);
+  // send the header and payload together, in one system call
+  struct iovec iov[2] = { { &header, sizeof(header) }, { buf, len } };
 
-  if ((bytes_sent <= 0) | ((size_t)bytes_sent != len))
+  if (socket_writev_full(socket_fd, iov, 2))
   {
-    kmyth_log(LOG_ERR, "sending ECDH message payload failed");
+    kmyth_log(LOG_ERR, "sending ECDH message failed");
     return EXIT_FAILURE;
   }
 
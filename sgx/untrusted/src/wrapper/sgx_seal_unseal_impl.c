@@ -13,11 +13,57 @@
 #include <string.h>
 #include <stdbool.h>
 
+#include <kmyth/kmyth.h>
 #include <kmyth/kmyth_log.h>
 #include <kmyth/formatting_tools.h>
+#include <kmyth/memory_util.h>
+
+#include "kmyth_enclave_common.h"
 
 #include ENCLAVE_HEADER_UNTRUSTED
 
+//############################################################################
+// seal_one()
+//############################################################################
+//
+// Seals input with a single ECALL: the sealed size is known up front, and
+// is reported back in case the enclave disagrees.
+//
+static int seal_one(sgx_enclave_id_t eid, uint8_t * input, size_t input_len,
+                    uint8_t ** data, size_t *data_size,
+                    uint16_t key_policy, sgx_attributes_t attribute_mask)
+{
+  uint32_t size = (uint32_t) (sizeof(sgx_sealed_data_t) + input_len);
+  uint32_t sealed_size = 0;
+  int ret = 1;
+
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    *data = (uint8_t *) malloc(size);
+    if (*data == NULL)
+    {
+      return 1;
+    }
+
+    if (enc_seal_data_sized(eid, &ret, input, (uint32_t) input_len, *data,
+                            size, &sealed_size, key_policy,
+                            attribute_mask) == SGX_SUCCESS && ret == 0)
+    {
+      *data_size = sealed_size;
+      return 0;
+    }
+
+    free(*data);
+    *data = NULL;
+    if (sealed_size <= size)
+    {
+      break;
+    }
+    size = sealed_size;
+  }
+  return 1;
+}
+
 //############################################################################
 // kmyth_sgx_seal_nkl()
 //############################################################################
@@ -27,27 +73,17 @@ int kmyth_sgx_seal_nkl(sgx_enclave_id_t eid, uint8_t * input, size_t input_len,
 {
   uint8_t *data = NULL;
   size_t data_size = 0;
-  int ret;
 
-  if(input_len > UINT32_MAX)
+  if (input_len > UINT32_MAX - sizeof(sgx_sealed_data_t))
   {
     return 1;
   }
 
-  enc_get_sealed_size(eid, &ret, (uint32_t)input_len, (uint32_t *) & data_size);
-  if (ret == 0)
+  if (seal_one(eid, input, input_len, &data, &data_size, key_policy,
+               attribute_mask))
   {
-    data = (uint8_t *) malloc(data_size);
-    if (data == NULL) return 1;
-
-    enc_seal_data(eid, &ret, input, (uint32_t)input_len, data, (uint32_t)data_size, key_policy,
-                  attribute_mask);
-    if (ret == 1)
-    {
-      kmyth_log(LOG_ERR, "error to seal data ... exiting");
-      free(data);
-      return 1;
-    }
+    kmyth_log(LOG_ERR, "error to seal data ... exiting");
+    return 1;
   }
 
   if (create_nkl_bytes(data, data_size, output, output_len))
@@ -62,10 +98,10 @@ int kmyth_sgx_seal_nkl(sgx_enclave_id_t eid, uint8_t * input, size_t input_len,
 }
 
 //############################################################################
-// kmyth_sgx_unseal_nkl()
+// decode_nkl()
 //############################################################################
-int kmyth_sgx_unseal_nkl(sgx_enclave_id_t eid, uint8_t * input,
-                         size_t input_len, uint64_t * handle)
+static int decode_nkl(uint8_t * input, size_t input_len,
+                      uint8_t ** data, size_t *data_size)
 {
   uint8_t *block = NULL;
   size_t blocksize = 0;
@@ -79,18 +115,42 @@ int kmyth_sgx_unseal_nkl(sgx_enclave_id_t eid, uint8_t * input,
     return 1;
   }
 
+  if (decodeBase64Data(block, blocksize, (unsigned char **) data, data_size))
+  {
+    kmyth_log(LOG_ERR, "error Base64 decode of block bytes ... exiting");
+    free(block);
+    return 1;
+  }
+
+  free(block);
+  return 0;
+}
+
+//############################################################################
+// kmyth_sgx_unseal_nkl()
+//############################################################################
+int kmyth_sgx_unseal_nkl(sgx_enclave_id_t eid, uint8_t * input,
+                         size_t input_len, uint64_t * handle)
+{
   uint8_t *data = NULL;
   size_t data_size = 0;
   bool ret;
 
-  if (decodeBase64Data(block, blocksize, (unsigned char **) &data, &data_size))
+  if (decode_nkl(input, input_len, &data, &data_size))
   {
-    kmyth_log(LOG_ERR, "error Base64 decode of block bytes ... exiting");
-    free(block);
     return 1;
   }
 
-  free(block);
+  if (data_size >= KMYTH_SGX_SEGMENTED_MAGIC_LEN
+      && memcmp(data, KMYTH_SGX_SEGMENTED_MAGIC,
+                KMYTH_SGX_SEGMENTED_MAGIC_LEN) == 0)
+  {
+    kmyth_log(LOG_ERR, "data sealed in segments must be unsealed with "
+              "kmyth_sgx_unseal_nkl_segmented() ... exiting");
+    free(data);
+    return 1;
+  }
+
   kmyth_unseal_into_enclave(eid, &ret, data_size, data, handle);
   if (ret == false)
   {
@@ -102,3 +162,488 @@ int kmyth_sgx_unseal_nkl(sgx_enclave_id_t eid, uint8_t * input,
   free(data);
   return 0;
 }
+
+//############################################################################
+// kmyth_sgx_seal_nkl_segmented()
+//############################################################################
+int kmyth_sgx_seal_nkl_segmented(sgx_enclave_id_t eid, uint8_t * input,
+                                 size_t input_len, uint32_t segment_len,
+                                 uint8_t ** output, size_t *output_len,
+                                 uint16_t key_policy,
+                                 sgx_attributes_t attribute_mask)
+{
+  if (input == NULL || input_len == 0 || output == NULL
+      || output_len == NULL)
+  {
+    return 1;
+  }
+  if (segment_len == 0)
+  {
+    segment_len = KMYTH_SGX_SEGMENT_LEN;
+  }
+  if (segment_len > KMYTH_SGX_SEGMENT_MAX_LEN)
+  {
+    kmyth_log(LOG_ERR, "invalid segment size (%u) ... exiting", segment_len);
+    return 1;
+  }
+
+  size_t count = (input_len - 1) / segment_len + 1;
+  size_t overhead = sizeof(sgx_sealed_data_t) + KMYTH_SGX_SEGMENT_MAC_TEXT_LEN;
+
+  if (count > UINT32_MAX
+      || count > (SIZE_MAX - KMYTH_SGX_SEGMENTED_HEADER_LEN) / overhead
+      || input_len >
+      SIZE_MAX - KMYTH_SGX_SEGMENTED_HEADER_LEN - count * overhead)
+  {
+    kmyth_log(LOG_ERR, "input too large to seal ... exiting");
+    return 1;
+  }
+
+  size_t data_size = KMYTH_SGX_SEGMENTED_HEADER_LEN + count * overhead +
+    input_len;
+  uint8_t *data = (uint8_t *) malloc(data_size);
+  size_t sealed_len = 0;
+  int ret = 1;
+
+  if (data == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating sealed data buffer ... exiting");
+    return 1;
+  }
+
+  if (enc_seal_data_segmented(eid, &ret, input, input_len, segment_len, data,
+                              data_size, &sealed_len, key_policy,
+                              attribute_mask) != SGX_SUCCESS || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "error to seal data ... exiting");
+    free(data);
+    return 1;
+  }
+
+  if (create_nkl_bytes(data, sealed_len, output, output_len))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .nkl format ... exiting");
+    free(data);
+    return 1;
+  }
+
+  free(data);
+  return 0;
+}
+
+//############################################################################
+// kmyth_sgx_unseal_nkl_segmented()
+//############################################################################
+int kmyth_sgx_unseal_nkl_segmented(sgx_enclave_id_t eid, uint8_t * input,
+                                   size_t input_len, uint64_t key_handle,
+                                   uint8_t ** output, size_t *output_len)
+{
+  if (output == NULL || output_len == NULL)
+  {
+    return 1;
+  }
+
+  uint8_t *data = NULL;
+  size_t data_size = 0;
+
+  if (decode_nkl(input, input_len, &data, &data_size))
+  {
+    return 1;
+  }
+
+  if (data_size < KMYTH_SGX_SEGMENTED_HEADER_LEN
+      || memcmp(data, KMYTH_SGX_SEGMENTED_MAGIC,
+                KMYTH_SGX_SEGMENTED_MAGIC_LEN) != 0)
+  {
+    kmyth_log(LOG_ERR, "data not sealed in segments ... exiting");
+    free(data);
+    return 1;
+  }
+
+  // the stream's chunks are the segments, so its size follows from the
+  // header (which the enclave checks again)
+  uint32_t segment_len = 0;
+  uint32_t count = 0;
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    segment_len = (segment_len << 8) | data[4 + i];
+    count = (count << 8) | data[8 + i];
+  }
+  for (size_t i = 0; i < 8; i++)
+  {
+    total = (total << 8) | data[12 + i];
+  }
+  if (segment_len == 0 || segment_len > KMYTH_SGX_SEGMENT_MAX_LEN
+      || total == 0 || total > data_size
+      || count != (total - 1) / segment_len + 1)
+  {
+    kmyth_log(LOG_ERR, "invalid segmented data header ... exiting");
+    free(data);
+    return 1;
+  }
+
+  size_t out_size = AES_GCM_STREAM_HEADER_LEN + (size_t) total +
+    (size_t) count * GCM_TAG_LEN;
+  uint8_t *out = (uint8_t *) malloc(out_size);
+  size_t chunks_len = 0;
+  int ret = 1;
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating stream buffer ... exiting");
+    free(data);
+    return 1;
+  }
+
+  if (kmyth_enclave_stream_header(eid, &ret, segment_len, out,
+                                  AES_GCM_STREAM_HEADER_LEN) != SGX_SUCCESS
+      || ret != 0
+      || kmyth_enclave_unseal_segmented_with_handle(eid, &ret, key_handle,
+                                                    data, data_size, out,
+                                                    AES_GCM_STREAM_HEADER_LEN,
+                                                    out +
+                                                    AES_GCM_STREAM_HEADER_LEN,
+                                                    out_size -
+                                                    AES_GCM_STREAM_HEADER_LEN,
+                                                    &chunks_len) !=
+      SGX_SUCCESS || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "error to unseal segmented data ... exiting");
+    free(data);
+    free(out);
+    return 1;
+  }
+
+  free(data);
+  *output = out;
+  *output_len = AES_GCM_STREAM_HEADER_LEN + chunks_len;
+  return 0;
+}
+
+//############################################################################
+// batch_length()
+//############################################################################
+//
+// How many of the count items starting at lens[0] go into the next batch:
+// at most KMYTH_SGX_BATCH_MAX_ITEMS, and no more than
+// KMYTH_SGX_BATCH_MAX_BYTES in all (though always at least one).
+//
+static size_t batch_length(const size_t *lens, size_t count)
+{
+  size_t n = 0;
+  size_t bytes = 0;
+
+  while (n < count && n < KMYTH_SGX_BATCH_MAX_ITEMS)
+  {
+    if (n > 0 && lens[n] > KMYTH_SGX_BATCH_MAX_BYTES - bytes)
+    {
+      break;
+    }
+    bytes += lens[n];
+    n++;
+  }
+  return n;
+}
+
+//############################################################################
+// kmyth_sgx_seal_nkl_batch()
+//############################################################################
+int kmyth_sgx_seal_nkl_batch(sgx_enclave_id_t eid, uint8_t ** inputs,
+                             size_t *input_lens, size_t count,
+                             uint8_t ** outputs, size_t *output_lens,
+                             uint16_t key_policy,
+                             sgx_attributes_t attribute_mask)
+{
+  if (inputs == NULL || input_lens == NULL || outputs == NULL
+      || output_lens == NULL)
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    if (inputs[i] == NULL
+        || input_lens[i] > KMYTH_SGX_BATCH_MAX_BYTES
+        || input_lens[i] > UINT32_MAX - sizeof(sgx_sealed_data_t))
+    {
+      kmyth_log(LOG_ERR, "invalid input %lu to batch seal ... exiting", i);
+      return 1;
+    }
+  }
+
+  size_t first = 0;
+
+  while (first < count)
+  {
+    size_t n = batch_length(input_lens + first, count - first);
+    size_t in_total = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+      in_total += input_lens[first + i];
+    }
+
+    size_t out_total = in_total + n * sizeof(sgx_sealed_data_t);
+    uint8_t *in_data = (uint8_t *) malloc(in_total + 1);
+    uint8_t *out_data = (uint8_t *) malloc(out_total);
+    uint32_t *in_sizes = (uint32_t *) malloc(n * sizeof(uint32_t));
+    uint32_t *out_sizes = (uint32_t *) calloc(n, sizeof(uint32_t));
+    int *results = (int *) calloc(n, sizeof(int));
+    int ret = 1;
+
+    if (in_data != NULL && out_data != NULL && in_sizes != NULL
+        && out_sizes != NULL && results != NULL)
+    {
+      size_t offset = 0;
+
+      for (size_t i = 0; i < n; i++)
+      {
+        memcpy(in_data + offset, inputs[first + i], input_lens[first + i]);
+        in_sizes[i] = (uint32_t) input_lens[first + i];
+        offset += input_lens[first + i];
+      }
+
+      if (enc_seal_data_batch(eid, &ret, in_data, in_total, in_sizes, n,
+                              out_data, out_total, out_sizes, results,
+                              key_policy, attribute_mask) != SGX_SUCCESS)
+      {
+        ret = 1;
+      }
+
+      offset = 0;
+      for (size_t i = 0; i < n && ret == 0; i++)
+      {
+        if (results[i] != 0)
+        {
+          kmyth_log(LOG_ERR, "error to seal data item %lu ... exiting",
+                    first + i);
+          ret = 1;
+        }
+        else if (create_nkl_bytes(out_data + offset, out_sizes[i],
+                                  &outputs[first + i],
+                                  &output_lens[first + i]))
+        {
+          kmyth_log(LOG_ERR, "error writing data to .nkl format ... exiting");
+          ret = 1;
+        }
+        offset += out_sizes[i];
+      }
+    }
+    else
+    {
+      kmyth_log(LOG_ERR, "error allocating batch seal buffers ... exiting");
+    }
+
+    if (in_data != NULL)
+    {
+      kmyth_clear(in_data, in_total);
+    }
+    free(in_data);
+    free(out_data);
+    free(in_sizes);
+    free(out_sizes);
+    free(results);
+
+    if (ret != 0)
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        free(outputs[i]);
+        outputs[i] = NULL;
+        output_lens[i] = 0;
+      }
+      return 1;
+    }
+    first += n;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_sgx_unseal_nkl_batch()
+//############################################################################
+int kmyth_sgx_unseal_nkl_batch(sgx_enclave_id_t eid, uint8_t ** inputs,
+                               size_t *input_lens, size_t count,
+                               uint64_t * handles)
+{
+  if (inputs == NULL || input_lens == NULL || handles == NULL)
+  {
+    return 1;
+  }
+
+  uint8_t **data = (uint8_t **) calloc(count + 1, sizeof(uint8_t *));
+  size_t *data_sizes = (size_t *) calloc(count + 1, sizeof(size_t));
+  int ret = 0;
+
+  if (data == NULL || data_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating batch unseal buffers ... exiting");
+    free(data);
+    free(data_sizes);
+    return 1;
+  }
+
+  for (size_t i = 0; i < count && ret == 0; i++)
+  {
+    handles[i] = 0;
+    ret = decode_nkl(inputs[i], input_lens[i], &data[i], &data_sizes[i]);
+  }
+
+  size_t first = 0;
+
+  while (ret == 0 && first < count)
+  {
+    size_t n = batch_length(data_sizes + first, count - first);
+    size_t data_total = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+      data_total += KMYTH_SGX_BATCH_PADDED(data_sizes[first + i]);
+    }
+
+    uint8_t *packed = (uint8_t *) calloc(data_total + 1, 1);
+    bool *results = (bool *) calloc(n, sizeof(bool));
+    size_t unsealed = 0;
+
+    if (packed != NULL && results != NULL)
+    {
+      size_t offset = 0;
+
+      for (size_t i = 0; i < n; i++)
+      {
+        memcpy(packed + offset, data[first + i], data_sizes[first + i]);
+        offset += KMYTH_SGX_BATCH_PADDED(data_sizes[first + i]);
+      }
+
+      if (kmyth_unseal_into_enclave_batch(eid, &unsealed, packed, data_total,
+                                          data_sizes + first, n,
+                                          KMYTH_UNSEAL_HANDLE_RANDOM,
+                                          handles + first,
+                                          results) != SGX_SUCCESS)
+      {
+        unsealed = 0;
+      }
+    }
+
+    if (unsealed != n)
+    {
+      kmyth_log(LOG_ERR, "error to unseal block bytes (%lu of %lu) "
+                "... exiting", n - unsealed, n);
+      ret = 1;
+    }
+
+    free(packed);
+    free(results);
+    first += n;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(data[i]);
+  }
+  free(data);
+  free(data_sizes);
+  return ret;
+}
+
+//############################################################################
+// kmyth_sgx_migrate_ski_to_nkl()
+//############################################################################
+int kmyth_sgx_migrate_ski_to_nkl(sgx_enclave_id_t eid, uint8_t ** inputs,
+                                 size_t *input_lens, size_t count,
+                                 uint8_t ** outputs, size_t *output_lens,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t bool_policy_or,
+                                 uint16_t key_policy,
+                                 sgx_attributes_t attribute_mask)
+{
+  if (inputs == NULL || input_lens == NULL || outputs == NULL
+      || output_lens == NULL)
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    kmyth_log(LOG_ERR, "error connecting to the TPM ... exiting");
+    return 1;
+  }
+
+  // At most one enclave batch of plaintext exists at a time: each run of
+  // .ski inputs is TPM-unsealed into memory, handed straight to the
+  // enclave, and cleared before the next run is unsealed
+  uint8_t *plain[KMYTH_SGX_BATCH_MAX_ITEMS] = { NULL };
+  size_t plain_lens[KMYTH_SGX_BATCH_MAX_ITEMS] = { 0 };
+  int results[KMYTH_SGX_BATCH_MAX_ITEMS] = { 0 };
+  size_t first = 0;
+  int ret = 0;
+
+  while (ret == 0 && first < count)
+  {
+    size_t n = count - first;
+
+    if (n > KMYTH_SGX_BATCH_MAX_ITEMS)
+    {
+      n = KMYTH_SGX_BATCH_MAX_ITEMS;
+    }
+
+    if (tpm2_kmyth_unseal_batch_ctx(ctx, n, inputs + first,
+                                    input_lens + first, plain, plain_lens,
+                                    results, auth_bytes, auth_bytes_len,
+                                    owner_auth_bytes, oa_bytes_len,
+                                    bool_policy_or))
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        if (results[i] != 0)
+        {
+          kmyth_log(LOG_ERR, "error to TPM-unseal input %lu ... exiting",
+                    first + i);
+          break;
+        }
+      }
+      ret = 1;
+    }
+    else if (kmyth_sgx_seal_nkl_batch(eid, plain, plain_lens, n,
+                                      outputs + first, output_lens + first,
+                                      key_policy, attribute_mask))
+    {
+      ret = 1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+      kmyth_clear_and_free(plain[i], plain_lens[i]);
+      plain[i] = NULL;
+      plain_lens[i] = 0;
+    }
+    first += n;
+  }
+
+  kmyth_ctx_destroy(&ctx);
+
+  if (ret != 0)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      free(outputs[i]);
+      outputs[i] = NULL;
+      output_lens[i] = 0;
+    }
+  }
+  return ret;
+}
@@ -6,154 +6,281 @@
 
 #include "cipher/aes_gcm.h"
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 
+#include "cipher/cipher.h"
 #include "memory_util.h"
+#include "metrics.h"
 
 //############################################################################
-// aes_gcm_encrypt()
+// gcm_evp_cipher()
 //############################################################################
-int aes_gcm_encrypt(unsigned char *key,
-                    size_t key_len,
-                    unsigned char *inData, size_t inData_len,
-                    unsigned char **outData, size_t * outData_len)
+static const EVP_CIPHER *gcm_evp_cipher(size_t key_len)
 {
+  switch (key_len)
+  {
+  case 16:
+    return kmyth_get_evp_cipher(KMYTH_EVP_AES_128_GCM);
+  case 24:
+    return kmyth_get_evp_cipher(KMYTH_EVP_AES_192_GCM);
+  case 32:
+    return kmyth_get_evp_cipher(KMYTH_EVP_AES_256_GCM);
+  default:
+    return NULL;
+  }
+}
 
+//############################################################################
+// aes_gcm_encrypt_into()
+//############################################################################
+int aes_gcm_encrypt_into(kmyth_cipher_ctx * cctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData, size_t inData_len,
+                         unsigned char *outData, size_t outData_size,
+                         size_t * outData_len)
+{
   // validate non-NULL and non-empty encryption key specified
   if (key == NULL || key_len == 0)
   {
     return 1;
   }
 
-  // validate non-NULL input plaintext buffer specified
-  if (inData == NULL)
+  // validate non-NULL input plaintext buffer within the GCM limit
+  if (inData == NULL || inData_len > GCM_MAX_DATA_LEN)
   {
     return 1;
   }
 
-  // Validate inData isn't too long
-  if (inData_len > INT_MAX)
-  {
-    return 1;
-  }
   // output data buffer (outData) will contain the concatenation of:
   //   - GCM_IV_LEN (12) byte IV
   //   - resultant ciphertext (same length as the input plaintext)
   //   - GCM_TAG_LEN (16) byte tag
-  *outData_len = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
-  if (*outData == NULL) free( *outData );
-  *outData = malloc(*outData_len);
-  if (*outData == NULL) // failed malloc
+  if (outData == NULL || outData_size < GCM_IV_LEN + inData_len + GCM_TAG_LEN)
   {
     return 1;
   }
-  unsigned char *iv = *outData;
+  unsigned char *iv = outData;
   unsigned char *ciphertext = iv + GCM_IV_LEN;
   unsigned char *tag = ciphertext + inData_len;
 
-  // variable to hold length of resulting CT - OpenSSL insists this be an int
-  int ciphertext_len = 0;
-
   // initialize the cipher context to match cipher suite being used
-  EVP_CIPHER_CTX *ctx;
+  const EVP_CIPHER *evp_cipher = gcm_evp_cipher(key_len);
+  EVP_CIPHER_CTX *ctx = NULL;
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (evp_cipher == NULL || !(ctx = kmyth_cipher_ctx_acquire(cctx)))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
     return 1;
   }
-  int init_result = 0;
 
-  switch (key_len)
+  // variables to hold length of resulting CT - the final step takes an int
+  size_t ciphertext_len = 0;
+  int len = 0;
+
+  // create the IV, set its length and then the key and IV in the cipher
+  // context, encrypt the input plaintext into the output ciphertext buffer
+  // (verifying that the CT length matches the PT length), then "finalize"
+  // (for AES/GCM no data is written) and append the AES/GCM tag value
+  if (!EVP_EncryptInit_ex(ctx, evp_cipher, NULL, NULL, NULL) ||
+      RAND_bytes(iv, GCM_IV_LEN) != 1 ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL) ||
+      !EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv) ||
+      kmyth_cipher_update(ctx, ciphertext, inData, inData_len,
+                          &ciphertext_len) ||
+      ciphertext_len != inData_len ||
+      !EVP_EncryptFinal_ex(ctx, tag, &len) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, tag))
   {
-  case 16:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
+    kmyth_cipher_ctx_release(cctx, ctx);
+    return 1;
   }
-  if (!init_result)
+
+  // now that the encryption is complete, clean-up cipher context
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  *outData_len = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_encrypt_ctx()
+//############################################################################
+int aes_gcm_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                        unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char **outData, size_t * outData_len)
+{
+  // validate non-NULL input plaintext buffer within the GCM limit
+  if (inData == NULL || inData_len > GCM_MAX_DATA_LEN)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // create the IV
-  if (RAND_bytes(iv, GCM_IV_LEN) != 1)
+  size_t out_size = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
+  unsigned char *out = kmyth_malloc(out_size);
+
+  if (out == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the IV length in the cipher context
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL))
+  if (aes_gcm_encrypt_into(cctx, key, key_len, inData, inData_len,
+                           out, out_size, outData_len))
   {
-    if (*outData != NULL) free(*outData);
+    kmyth_free(out);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the key and IV in the cipher context
-  if (!EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv))
+  *outData = out;
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_encrypt()
+//############################################################################
+int aes_gcm_encrypt(unsigned char *key,
+                    size_t key_len,
+                    unsigned char *inData, size_t inData_len,
+                    unsigned char **outData, size_t * outData_len)
+{
+  return aes_gcm_encrypt_ctx(NULL, key, key_len, inData, inData_len,
+                             outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_decrypt_into()
+//############################################################################
+int aes_gcm_decrypt_into(kmyth_cipher_ctx * cctx,
+                         unsigned char *key,
+                         size_t key_len,
+                         unsigned char *inData, size_t inData_len,
+                         unsigned char *outData, size_t outData_size,
+                         size_t * outData_len)
+{
+  // validate non-NULL and non-empty decryption key specified
+  if (key == NULL || key_len == 0)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // encrypt the input plaintext, put result in the output ciphertext buffer
-  if (!EVP_EncryptUpdate(ctx, ciphertext, &ciphertext_len, inData, (int)inData_len))
+  // validate input holding at least an IV and a tag
+  if (inData == NULL || inData_len < GCM_IV_LEN + GCM_TAG_LEN ||
+      inData_len > GCM_IV_LEN + GCM_MAX_DATA_LEN + GCM_TAG_LEN)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // verify that the resultant CT length matches the input PT length
-  if ((size_t) ciphertext_len != inData_len)
+  // output data buffer (outData) will contain only the plaintext, which
+  // is sized as the input minus the lengths of the IV and tag fields
+  size_t expected_out_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
+
+  if (outData == NULL || outData_size < expected_out_len)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // OpenSSL requires a "finalize" operation. For AES/GCM no data is written.
-  if (!EVP_EncryptFinal_ex(ctx, tag, &ciphertext_len))
+  // input data buffer (inData) will contain the concatenation of:
+  //   - GCM_IV_LEN (12) byte IV
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - GCM_TAG_LEN (16) byte tag
+  unsigned char *iv = inData;
+  unsigned char *ciphertext = inData + GCM_IV_LEN;
+  unsigned char *tag = ciphertext + expected_out_len;
+
+  // initialize the cipher context to match cipher suite being used
+  const EVP_CIPHER *evp_cipher = gcm_evp_cipher(key_len);
+  EVP_CIPHER_CTX *ctx = NULL;
+
+  if (evp_cipher == NULL || !(ctx = kmyth_cipher_ctx_acquire(cctx)))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // get the AES/GCM tag value, appending it to the output ciphertext
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, tag))
+  // variables to hold/accumulate length returned by EVP library calls
+  //   - the final step takes an int
+  int len = 0;
+  size_t plaintext_len = 0;
+
+  // set the expected tag passed in with the input data, the IV length, and
+  // then the key and IV in the cipher context, and decrypt the input
+  // ciphertext into the output plaintext buffer
+  if (!EVP_DecryptInit_ex(ctx, evp_cipher, NULL, NULL, NULL) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL) ||
+      !EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv) ||
+      kmyth_cipher_update(ctx, outData, ciphertext, expected_out_len,
+                          &plaintext_len))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_clear(outData, expected_out_len);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
-  // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  // 'Finalize' Decrypt:
+  //   - validate that resultant tag matches the expected tag passed in
+  //   - should produce no more plaintext bytes in our case
+  // and verify that the resultant PT length matches the input CT length.
+  // Unauthenticated plaintext is never left in the output buffer.
+  if (EVP_DecryptFinal_ex(ctx, outData + plaintext_len, &len) <= 0 ||
+      len < 0 || plaintext_len + (size_t) len != expected_out_len)
+  {
+    kmyth_clear(outData, expected_out_len);
+    kmyth_cipher_ctx_release(cctx, ctx);
+    return 1;
+  }
+
+  // now that the decryption is complete, clean-up cipher context used
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  *outData_len = expected_out_len;
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_decrypt_ctx()
+//############################################################################
+int aes_gcm_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                        unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char **outData, size_t * outData_len)
+{
+  // validate input holding at least an IV and a tag
+  if (inData == NULL || inData_len < GCM_IV_LEN + GCM_TAG_LEN ||
+      inData_len > GCM_IV_LEN + GCM_MAX_DATA_LEN + GCM_TAG_LEN)
+  {
+    return 1;
+  }
 
+  // Setting here to save some cleanup on error conditions.
+  *outData_len = 0;
+  *outData = NULL;
+
+  // allocate at least one byte, so an empty plaintext is still returned in
+  // a valid buffer
+  size_t out_size = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
+  unsigned char *out = kmyth_malloc((out_size == 0) ? 1 : out_size);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  if (aes_gcm_decrypt_into(cctx, key, key_len, inData, inData_len,
+                           out, out_size, outData_len))
+  {
+    kmyth_free(out);
+    return 1;
+  }
+
+  *outData = out;
   return 0;
 }
 
@@ -165,136 +292,832 @@ int aes_gcm_decrypt(unsigned char *key,
                     unsigned char *inData, size_t inData_len,
                     unsigned char **outData, size_t * outData_len)
 {
-  // validate non-NULL and non-empty decryption key specified
-  if (key == NULL || key_len == 0)
+  return aes_gcm_decrypt_ctx(NULL, key, key_len, inData, inData_len,
+                             outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_decrypt_in_place()
+//############################################################################
+int aes_gcm_decrypt_in_place(kmyth_cipher_ctx * cctx,
+                             unsigned char *key,
+                             size_t key_len,
+                             unsigned char *data, size_t data_len,
+                             size_t * plaintext_len)
+{
+  if (data == NULL || data_len < GCM_IV_LEN + GCM_TAG_LEN)
   {
     return 1;
   }
 
-  // validate non-NULL and non-empty input ciphertext buffer specified
-  if (inData == NULL || inData_len == 0)
+  // decrypt the ciphertext over itself (OpenSSL allows exactly overlapping
+  // input and output), then move the plaintext to the start of the buffer
+  // and wipe the copy of its tail left behind
+  size_t len = 0;
+
+  if (aes_gcm_decrypt_into(cctx, key, key_len, data, data_len,
+                           data + GCM_IV_LEN, data_len - GCM_IV_LEN, &len))
   {
     return 1;
   }
-  if (inData_len < GCM_IV_LEN + GCM_TAG_LEN)
+  memmove(data, data + GCM_IV_LEN, len);
+  kmyth_clear(data + len, GCM_IV_LEN);
+
+  *plaintext_len = len;
+  return 0;
+}
+
+//############################################################################
+// Streaming (segmented) AES/GCM
+//############################################################################
+
+// identifies an AES/GCM stream header (and its layout version)
+static const unsigned char stream_magic[4] = { 'K', 'G', 'S', '1' };
+
+//############################################################################
+// aes_gcm_stream_parse_header()
+//############################################################################
+int aes_gcm_stream_parse_header(const unsigned char *header,
+                                size_t *chunk_len)
+{
+  if (header == NULL || memcmp(header, stream_magic, sizeof(stream_magic)))
   {
     return 1;
   }
-  if (inData_len > INT_MAX)
+
+  *chunk_len = ((size_t) header[4] << 24) | ((size_t) header[5] << 16) |
+    ((size_t) header[6] << 8) | (size_t) header[7];
+  if (*chunk_len == 0 || *chunk_len > AES_GCM_STREAM_MAX_CHUNK_LEN ||
+      header[AES_GCM_STREAM_HEADER_LEN - 1] != 0)
   {
     return 1;
   }
-  
-  // Setting here to save some cleanup on error conditions.
-  *outData_len = 0;
-  *outData = NULL;
-  
-  size_t expected_out_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
-  // output data buffer (outData) will contain only the plaintext, which
-  // should be sized as the input minus the lengths of the IV and tag fields
 
-  // input data buffer (inData) will contain the concatenation of:
-  //   - GCM_IV_LEN (12) byte IV
-  //   - resultant ciphertext (same length as the input plaintext)
-  //   - GCM_TAG_LEN (16) byte tag
-  unsigned char *iv = inData;
-  unsigned char *ciphertext = inData + GCM_IV_LEN;
-  unsigned char *tag = ciphertext + expected_out_len;
+  return 0;
+}
+
+//############################################################################
+// stream_ctx_new()
+//############################################################################
+static EVP_CIPHER_CTX *stream_ctx_new(unsigned char *key, size_t key_len,
+                                      int encrypt)
+{
+  const EVP_CIPHER *evp_cipher = gcm_evp_cipher(key_len);
+
+  if (key == NULL || evp_cipher == NULL)
+  {
+    return NULL;
+  }
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+  if (ctx == NULL)
+  {
+    return NULL;
+  }
+
+  // the key is set (and expanded) once; each chunk only sets a new IV
+  if (!EVP_CipherInit_ex(ctx, evp_cipher, NULL, NULL, NULL, encrypt) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL) ||
+      !EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, encrypt))
+  {
+    EVP_CIPHER_CTX_free(ctx);
+    return NULL;
+  }
+
+  return ctx;
+}
+
+//############################################################################
+// stream_chunk()
+//############################################################################
+static int stream_chunk(EVP_CIPHER_CTX * ctx, int encrypt,
+                        const unsigned char *header,
+                        uint32_t counter, bool last,
+                        const unsigned char *in, size_t in_len,
+                        unsigned char *out)
+{
+  // IV = nonce prefix || chunk counter (big-endian) || final chunk flag
+  unsigned char iv[GCM_IV_LEN];
+
+  memcpy(iv, header + 8, AES_GCM_STREAM_NONCE_PREFIX_LEN);
+  iv[7] = (unsigned char) (counter >> 24);
+  iv[8] = (unsigned char) (counter >> 16);
+  iv[9] = (unsigned char) (counter >> 8);
+  iv[10] = (unsigned char) counter;
+  iv[11] = last ? 1 : 0;
+
+  // when decrypting, the input ends with the chunk's tag
+  size_t data_len = in_len;
+
+  if (!encrypt)
+  {
+    if (in_len < GCM_TAG_LEN)
+    {
+      return 1;
+    }
+    data_len -= GCM_TAG_LEN;
+  }
 
-  // variables to hold/accumulate length returned by EVP library calls
-  //   - OpenSSL insists this be an int
   int len = 0;
-  size_t plaintext_len = 0;
 
-  // initialize the cipher context to match cipher suite being used
-  EVP_CIPHER_CTX *ctx;
+  if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, encrypt) ||
+      !EVP_CipherUpdate(ctx, NULL, &len, header, AES_GCM_STREAM_HEADER_LEN))
+  {
+    return 1;
+  }
+  if (!encrypt && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+                                       GCM_TAG_LEN,
+                                       (void *) (in + data_len)))
+  {
+    return 1;
+  }
+  if (data_len > 0 &&
+      (!EVP_CipherUpdate(ctx, out, &len, in, (int) data_len) ||
+       (size_t) len != data_len))
+  {
+    return 1;
+  }
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  // for decryption, this is where the tag is verified
+  if (EVP_CipherFinal_ex(ctx, out + data_len, &len) <= 0)
+  {
+    return 1;
+  }
+  if (encrypt && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG,
+                                      GCM_TAG_LEN, out + data_len))
   {
-    free(*outData);
     return 1;
   }
-  int init_result = 0;
 
-  switch (key_len)
+  return 0;
+}
+
+//############################################################################
+// Parallel chunk processing
+//############################################################################
+
+// A batch is a run of consecutive chunks held in memory: chunk j of the
+// batch is read from in + j * in_stride and written to out + j * out_stride
+// (all chunks but the last are full). Its chunks are split into contiguous
+// slices, one per thread.
+typedef struct
+{
+  size_t chunks;
+  uint32_t counter;             // stream counter of the batch's first chunk
+  bool final;                   // whether the batch ends the stream
+  const unsigned char *in;
+  size_t in_stride;
+  size_t last_in_len;           // input length of the batch's last chunk
+  unsigned char *out;
+  size_t out_stride;
+} stream_batch;
+
+struct stream_pool;
+
+typedef struct
+{
+  struct stream_pool *pool;
+  size_t slice;
+} stream_worker_arg;
+
+// Worker threads that live for one streaming call, each with its own
+// cipher context. The calling thread processes slice 0 of every batch.
+typedef struct stream_pool
+{
+  unsigned char *key;
+  size_t key_len;
+  int encrypt;
+  const unsigned char *header;
+
+  pthread_t *threads;
+  stream_worker_arg *args;
+  size_t started;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  const stream_batch *batch;
+  unsigned long generation;
+  size_t busy;
+  bool failed;
+  bool stop;
+} stream_pool;
+
+//############################################################################
+// stream_slice()
+//############################################################################
+static int stream_slice(EVP_CIPHER_CTX * ctx, int encrypt,
+                        const unsigned char *header,
+                        const stream_batch * batch,
+                        size_t slice, size_t slices)
+{
+  size_t first = batch->chunks * slice / slices;
+  size_t end = batch->chunks * (slice + 1) / slices;
+
+  for (size_t j = first; j < end; j++)
   {
-  case 16:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
+    bool last_in_batch = (j == batch->chunks - 1);
+
+    if (stream_chunk(ctx, encrypt, header, batch->counter + (uint32_t) j,
+                     last_in_batch && batch->final,
+                     batch->in + j * batch->in_stride,
+                     last_in_batch ? batch->last_in_len : batch->in_stride,
+                     batch->out + j * batch->out_stride))
+    {
+      return 1;
+    }
   }
-  if (!init_result)
+
+  return 0;
+}
+
+//############################################################################
+// stream_worker()
+//############################################################################
+static void *stream_worker(void *arg)
+{
+  stream_worker_arg *worker = (stream_worker_arg *) arg;
+  stream_pool *pool = worker->pool;
+  EVP_CIPHER_CTX *ctx = stream_ctx_new(pool->key, pool->key_len,
+                                       pool->encrypt);
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;)
+  {
+    while (!pool->stop && pool->generation == seen)
+    {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    if (pool->stop)
+    {
+      break;
+    }
+    seen = pool->generation;
+
+    const stream_batch *batch = pool->batch;
+
+    pthread_mutex_unlock(&pool->lock);
+    int rc = (ctx == NULL) ||
+      stream_slice(ctx, pool->encrypt, pool->header, batch,
+                   worker->slice, pool->started + 1);
+
+    pthread_mutex_lock(&pool->lock);
+    if (rc)
+    {
+      pool->failed = true;
+    }
+    if (--pool->busy == 0)
+    {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  EVP_CIPHER_CTX_free(ctx);
+  return NULL;
+}
+
+//############################################################################
+// stream_pool_start()
+//############################################################################
+static void stream_pool_start(stream_pool * pool, unsigned char *key,
+                              size_t key_len, int encrypt,
+                              const unsigned char *header, size_t threads)
+{
+  memset(pool, 0, sizeof(stream_pool));
+  pool->key = key;
+  pool->key_len = key_len;
+  pool->encrypt = encrypt;
+  pool->header = header;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  if (threads < 2)
+  {
+    return;
+  }
+  pool->threads = kmyth_calloc(threads - 1, sizeof(pthread_t));
+  pool->args = kmyth_calloc(threads - 1, sizeof(stream_worker_arg));
+  if (pool->threads == NULL || pool->args == NULL)
+  {
+    return;
+  }
+
+  // if a thread cannot be created, the work is simply split fewer ways
+  for (size_t i = 0; i < threads - 1; i++)
+  {
+    pool->args[i].pool = pool;
+    pool->args[i].slice = i + 1;
+    if (pthread_create(&pool->threads[i], NULL, stream_worker,
+                       &pool->args[i]))
+    {
+      break;
+    }
+    pool->started++;
+  }
+}
+
+//############################################################################
+// stream_pool_run()
+//############################################################################
+static int stream_pool_run(stream_pool * pool, EVP_CIPHER_CTX * ctx,
+                           const stream_batch * batch)
+{
+  if (pool->started == 0)
+  {
+    return stream_slice(ctx, pool->encrypt, pool->header, batch, 0, 1);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->batch = batch;
+  pool->busy = pool->started;
+  pool->failed = false;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  int rc = stream_slice(ctx, pool->encrypt, pool->header, batch, 0,
+                        pool->started + 1);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0)
+  {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  if (pool->failed)
+  {
+    rc = 1;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return rc;
+}
+
+//############################################################################
+// stream_pool_stop()
+//############################################################################
+static void stream_pool_stop(stream_pool * pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->started; i++)
+  {
+    pthread_join(pool->threads[i], NULL);
+  }
+  kmyth_free(pool->threads);
+  kmyth_free(pool->args);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+//############################################################################
+// stream_read_chunk()
+//############################################################################
+static int stream_read_chunk(FILE * in, unsigned char *buf, size_t buf_len,
+                             size_t *read_len, bool *last)
+{
+  *read_len = fread(buf, 1, buf_len, in);
+  if (ferror(in))
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set tag to expected tag passed in with input data
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag))
+  // A full chunk is the final one only if nothing follows it
+  *last = (*read_len < buf_len);
+  if (!*last)
+  {
+    int c = fgetc(in);
+
+    if (c == EOF)
+    {
+      if (ferror(in))
+      {
+        return 1;
+      }
+      *last = true;
+    }
+    else if (ungetc(c, in) == EOF)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_stream_init_header()
+//############################################################################
+int aes_gcm_stream_init_header(size_t chunk_len, unsigned char *header)
+{
+  if (header == NULL || chunk_len == 0 ||
+      chunk_len > AES_GCM_STREAM_MAX_CHUNK_LEN)
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the IV length in the cipher context
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL))
+  memcpy(header, stream_magic, sizeof(stream_magic));
+  header[4] = (unsigned char) (chunk_len >> 24);
+  header[5] = (unsigned char) (chunk_len >> 16);
+  header[6] = (unsigned char) (chunk_len >> 8);
+  header[7] = (unsigned char) chunk_len;
+  header[AES_GCM_STREAM_HEADER_LEN - 1] = 0;
+  if (RAND_bytes(header + 8, AES_GCM_STREAM_NONCE_PREFIX_LEN) != 1)
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the key and IV in the cipher context
-  if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv))
+  return 0;
+}
+
+//############################################################################
+// stream_file()
+//############################################################################
+/**
+ * @brief Shared implementation of aes_gcm_stream_encrypt_file() and
+ *        aes_gcm_stream_decrypt_file(): reads a batch of chunks, processes
+ *        them (in parallel with more than one cipher thread) and writes
+ *        them out in order, until the final chunk.
+ */
+static int stream_file(unsigned char *key, size_t key_len, int encrypt,
+                       const unsigned char *header, FILE * in, FILE * out)
+{
+  size_t chunk_len = 0;
+
+  if (in == NULL || out == NULL ||
+      aes_gcm_stream_parse_header(header, &chunk_len))
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  *outData = malloc(expected_out_len);
-  if(*outData == NULL)
+  // one chunk at a time on a single thread, several per thread otherwise,
+  // so that the workers are not woken up for every chunk
+  size_t threads = get_cipher_threads();
+  size_t batch_chunks = (threads > 1) ?
+    threads * AES_GCM_STREAM_CHUNKS_PER_THREAD : 1;
+  size_t pt_stride = chunk_len;
+  size_t ct_stride = chunk_len + GCM_TAG_LEN;
+  size_t in_stride = encrypt ? pt_stride : ct_stride;
+  size_t out_stride = encrypt ? ct_stride : pt_stride;
+
+  EVP_CIPHER_CTX *ctx = stream_ctx_new(key, key_len, encrypt);
+  unsigned char *in_buf = kmyth_malloc(batch_chunks * in_stride);
+  unsigned char *out_buf = kmyth_malloc(batch_chunks * out_stride);
+  unsigned char *pt_buf = encrypt ? in_buf : out_buf;
+  stream_pool pool;
+  int retval = 1;
+
+  stream_pool_start(&pool, key, key_len, encrypt, header, threads);
+  if (ctx == NULL || in_buf == NULL || out_buf == NULL)
+  {
+    goto cleanup;
+  }
+
+  stream_batch batch = {.counter = 0,.in = in_buf,.in_stride = in_stride,
+    .out = out_buf,.out_stride = out_stride
+  };
+
+  for (;;)
+  {
+    size_t in_len = 0;
+
+    if (stream_read_chunk(in, in_buf, batch_chunks * in_stride, &in_len,
+                          &batch.final))
+    {
+      goto cleanup;
+    }
+
+    // A stream always ends with a (possibly empty) final chunk, so running
+    // out of encrypted input anywhere else means it was truncated. Only an
+    // empty plaintext gives an empty first read.
+    if (in_len == 0 && !encrypt)
+    {
+      goto cleanup;
+    }
+    batch.chunks = (in_len == 0) ? 1 : (in_len - 1) / in_stride + 1;
+    batch.last_in_len = in_len - (batch.chunks - 1) * in_stride;
+    if (!encrypt && batch.last_in_len < GCM_TAG_LEN)
+    {
+      goto cleanup;
+    }
+
+    // the chunk counter must never wrap (that would reuse an IV)
+    if ((uint64_t) batch.counter + batch.chunks - 1 > UINT32_MAX ||
+        (!batch.final && (uint64_t) batch.counter + batch.chunks >
+         UINT32_MAX))
+    {
+      goto cleanup;
+    }
+
+    size_t out_len = encrypt ? in_len + batch.chunks * GCM_TAG_LEN :
+      in_len - batch.chunks * GCM_TAG_LEN;
+
+    if (stream_pool_run(&pool, ctx, &batch) ||
+        fwrite(out_buf, 1, out_len, out) != out_len)
+    {
+      goto cleanup;
+    }
+    kmyth_metrics_add(encrypt ? KMYTH_METRIC_BYTES_ENCRYPTED :
+                      KMYTH_METRIC_BYTES_DECRYPTED,
+                      encrypt ? in_len : out_len);
+    if (batch.final)
+    {
+      break;
+    }
+    batch.counter += (uint32_t) batch.chunks;
+  }
+  retval = 0;
+
+cleanup:
+  stream_pool_stop(&pool);
+  EVP_CIPHER_CTX_free(ctx);
+  kmyth_clear_and_free(pt_buf, (pt_buf == NULL) ? 0 : batch_chunks *
+                       chunk_len);
+  kmyth_free(encrypt ? out_buf : in_buf);
+
+  return retval;
+}
+
+//############################################################################
+// aes_gcm_stream_encrypt_file()
+//############################################################################
+int aes_gcm_stream_encrypt_file(unsigned char *key, size_t key_len,
+                                const unsigned char *header,
+                                FILE * in, FILE * out)
+{
+  return stream_file(key, key_len, 1, header, in, out);
+}
+
+//############################################################################
+// aes_gcm_stream_decrypt_file()
+//############################################################################
+int aes_gcm_stream_decrypt_file(unsigned char *key, size_t key_len,
+                                const unsigned char *header,
+                                FILE * in, FILE * out)
+{
+  return stream_file(key, key_len, 0, header, in, out);
+}
+
+//############################################################################
+// stream_memory()
+//############################################################################
+/**
+ * @brief Processes every chunk of an in-memory stream as a single batch
+ *        (split across the cipher threads, if there is more than one).
+ */
+static int stream_memory(unsigned char *key, size_t key_len, int encrypt,
+                         const unsigned char *header, stream_batch * batch)
+{
+  size_t threads = get_cipher_threads();
+  EVP_CIPHER_CTX *ctx = stream_ctx_new(key, key_len, encrypt);
+  stream_pool pool;
+
+  if (ctx == NULL)
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
-    
-  // decrypt the input ciphertext, put result in the output plaintext buffer
-  if (!EVP_DecryptUpdate(ctx, *outData, &len, ciphertext, (int)expected_out_len) || len < 0)
+  stream_pool_start(&pool, key, key_len, encrypt, header,
+                    (threads < batch->chunks) ? threads : batch->chunks);
+
+  int retval = stream_pool_run(&pool, ctx, batch);
+
+  stream_pool_stop(&pool);
+  EVP_CIPHER_CTX_free(ctx);
+
+  return retval;
+}
+
+//############################################################################
+// aes_gcm_stream_encrypt()
+//############################################################################
+int aes_gcm_stream_encrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData, size_t inData_len,
+                           unsigned char **outData, size_t * outData_len)
+{
+  if (key == NULL || key_len == 0 || inData == NULL)
   {
-    kmyth_clear_and_free(*outData, expected_out_len);
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
-  plaintext_len += (size_t)len;
 
-  // 'Finalize' Decrypt:
-  //   - validate that resultant tag matches the expected tag passed in
-  //   - should produce no more plaintext bytes in our case
-  if (EVP_DecryptFinal_ex(ctx, *outData + plaintext_len, &len) <= 0 || len < 0)
+  // every chunk but the last is full, and there is always a final chunk
+  size_t chunk_len = AES_GCM_STREAM_CHUNK_LEN;
+  size_t chunks = (inData_len == 0) ? 1 : (inData_len - 1) / chunk_len + 1;
+
+  if (chunks - 1 > UINT32_MAX ||
+      inData_len > SIZE_MAX - AES_GCM_STREAM_HEADER_LEN -
+      chunks * GCM_TAG_LEN)
   {
-    kmyth_clear_and_free(*outData, expected_out_len);
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
-  plaintext_len += (size_t)len;
 
-  // verify that the resultant PT length matches the input CT length
-  if ((size_t)plaintext_len != expected_out_len)
+  size_t out_len = AES_GCM_STREAM_HEADER_LEN + inData_len +
+    chunks * GCM_TAG_LEN;
+  unsigned char *out = kmyth_malloc(out_len);
+
+  if (out == NULL || aes_gcm_stream_init_header(chunk_len, out))
   {
-    kmyth_clear_and_free(*outData, expected_out_len);
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_free(out);
     return 1;
   }
 
-  // now that the decryption is complete, clean-up cipher context used
+  stream_batch batch = {.chunks = chunks,.counter = 0,.final = true,
+    .in = inData,.in_stride = chunk_len,
+    .last_in_len = inData_len - (chunks - 1) * chunk_len,
+    .out = out + AES_GCM_STREAM_HEADER_LEN,
+    .out_stride = chunk_len + GCM_TAG_LEN
+  };
+
+  if (stream_memory(key, key_len, 1, out, &batch))
+  {
+    kmyth_free(out);
+    return 1;
+  }
+
+  *outData = out;
+  *outData_len = out_len;
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_stream_decrypt()
+//############################################################################
+int aes_gcm_stream_decrypt(unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData, size_t inData_len,
+                           unsigned char **outData, size_t * outData_len)
+{
+  size_t chunk_len = 0;
+
+  if (key == NULL || key_len == 0 || inData == NULL ||
+      inData_len < AES_GCM_STREAM_HEADER_LEN + GCM_TAG_LEN ||
+      aes_gcm_stream_parse_header(inData, &chunk_len))
+  {
+    return 1;
+  }
+
+  *outData = NULL;
+  *outData_len = 0;
+
+  // the plaintext is the input less the header and one tag per chunk
+  size_t body_len = inData_len - AES_GCM_STREAM_HEADER_LEN;
+  size_t chunks = (body_len - 1) / (chunk_len + GCM_TAG_LEN) + 1;
+
+  if (chunks - 1 > UINT32_MAX || body_len < chunks * GCM_TAG_LEN)
+  {
+    return 1;
+  }
+
+  size_t pt_total = body_len - chunks * GCM_TAG_LEN;
+  size_t out_size = (pt_total == 0) ? 1 : pt_total;
+  unsigned char *out = kmyth_malloc(out_size);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  stream_batch batch = {.chunks = chunks,.counter = 0,.final = true,
+    .in = inData + AES_GCM_STREAM_HEADER_LEN,
+    .in_stride = chunk_len + GCM_TAG_LEN,
+    .last_in_len = body_len - (chunks - 1) * (chunk_len + GCM_TAG_LEN),
+    .out = out,.out_stride = chunk_len
+  };
+
+  if (stream_memory(key, key_len, 0, inData, &batch))
+  {
+    kmyth_clear_and_free(out, out_size);
+    return 1;
+  }
+
+  *outData = out;
+  *outData_len = pt_total;
+  return 0;
+}
+
+//############################################################################
+// stream_chunks()
+//############################################################################
+/**
+ * @brief Shared implementation of aes_gcm_stream_encrypt_chunks() and
+ *        aes_gcm_stream_decrypt_chunks(): processes a run of consecutive
+ *        chunks on the calling thread, between the caller's buffers.
+ */
+static int stream_chunks(unsigned char *key, size_t key_len, int encrypt,
+                         const unsigned char *header, uint32_t first_chunk,
+                         bool final, const unsigned char *in, size_t in_len,
+                         unsigned char *out, size_t out_size,
+                         size_t * out_len)
+{
+  size_t chunk_len = 0;
+
+  if (in == NULL || out == NULL || out_len == NULL ||
+      aes_gcm_stream_parse_header(header, &chunk_len))
+  {
+    return 1;
+  }
+  *out_len = 0;
+
+  size_t in_stride = encrypt ? chunk_len : chunk_len + GCM_TAG_LEN;
+  size_t out_stride = encrypt ? chunk_len + GCM_TAG_LEN : chunk_len;
+  size_t chunks = 0;
+
+  // only the final chunk may be short (or, when encrypting, empty)
+  if (final)
+  {
+    chunks = (in_len == 0) ? 1 : (in_len - 1) / in_stride + 1;
+  }
+  else if (in_len > 0 && in_len % in_stride == 0)
+  {
+    chunks = in_len / in_stride;
+  }
+  else
+  {
+    return 1;
+  }
+
+  size_t last_in_len = in_len - (chunks - 1) * in_stride;
+
+  if (!encrypt && last_in_len < GCM_TAG_LEN)
+  {
+    return 1;
+  }
+
+  // the chunk counter must never wrap (that would reuse an IV)
+  if ((uint64_t) first_chunk + chunks - 1 > UINT32_MAX ||
+      (!final && (uint64_t) first_chunk + chunks > UINT32_MAX))
+  {
+    return 1;
+  }
+  if (encrypt && in_len > SIZE_MAX - chunks * GCM_TAG_LEN)
+  {
+    return 1;
+  }
+
+  size_t total = encrypt ? in_len + chunks * GCM_TAG_LEN :
+    in_len - chunks * GCM_TAG_LEN;
+
+  if (out_size < total)
+  {
+    return 1;
+  }
+
+  EVP_CIPHER_CTX *ctx = stream_ctx_new(key, key_len, encrypt);
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+
+  stream_batch batch = {.chunks = chunks,.counter = first_chunk,
+    .final = final,.in = in,.in_stride = in_stride,
+    .last_in_len = last_in_len,.out = out,.out_stride = out_stride
+  };
+  int retval = stream_slice(ctx, encrypt, header, &batch, 0, 1);
+
   EVP_CIPHER_CTX_free(ctx);
+  if (retval)
+  {
+    // nothing of a run that fails is left behind
+    kmyth_clear(out, total);
+    return 1;
+  }
 
-  *outData_len = expected_out_len;
+  *out_len = total;
   return 0;
 }
+
+//############################################################################
+// aes_gcm_stream_encrypt_chunks()
+//############################################################################
+int aes_gcm_stream_encrypt_chunks(unsigned char *key, size_t key_len,
+                                  const unsigned char *header,
+                                  uint32_t first_chunk, bool final,
+                                  const unsigned char *in, size_t in_len,
+                                  unsigned char *out, size_t out_size,
+                                  size_t * out_len)
+{
+  return stream_chunks(key, key_len, 1, header, first_chunk, final, in,
+                       in_len, out, out_size, out_len);
+}
+
+//############################################################################
+// aes_gcm_stream_decrypt_chunks()
+//############################################################################
+int aes_gcm_stream_decrypt_chunks(unsigned char *key, size_t key_len,
+                                  const unsigned char *header,
+                                  uint32_t first_chunk, bool final,
+                                  const unsigned char *in, size_t in_len,
+                                  unsigned char *out, size_t out_size,
+                                  size_t * out_len)
+{
+  return stream_chunks(key, key_len, 0, header, first_chunk, final, in,
+                       in_len, out, out_size, out_len);
+}
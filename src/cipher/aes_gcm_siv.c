@@ -0,0 +1,166 @@
+/**
+ * @file  aes_gcm_siv.c
+ *
+ * @brief Implements deterministic AES-GCM-SIV (RFC 8452) for kmyth.
+ */
+
+#include "cipher/aes_gcm_siv.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "cipher/cipher.h"
+#include "memory_util.h"
+
+//############################################################################
+// aes_gcm_siv_encrypt_ctx()
+//############################################################################
+int aes_gcm_siv_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                            unsigned char *key,
+                            size_t key_len,
+                            unsigned char *inData, size_t inData_len,
+                            unsigned char **outData, size_t * outData_len)
+{
+  // validate a non-NULL key of the (only) supported size
+  if (key == NULL || key_len != AES_GCM_SIV_KEY_LEN)
+  {
+    return 1;
+  }
+
+  // validate non-empty input plaintext that OpenSSL can take at once (the
+  // SIV construction needs the whole message in a single update)
+  if (inData == NULL || inData_len == 0 || inData_len > INT_MAX)
+  {
+    return 1;
+  }
+
+  // output data buffer (outData) will contain the concatenation of:
+  //   - AES_GCM_SIV_NONCE_LEN (12) byte nonce
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - AES_GCM_SIV_TAG_LEN (16) byte tag
+  size_t out_len = AES_GCM_SIV_NONCE_LEN + inData_len + AES_GCM_SIV_TAG_LEN;
+  unsigned char *out = kmyth_malloc(out_len);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+  unsigned char *nonce = out;
+  unsigned char *ciphertext = nonce + AES_GCM_SIV_NONCE_LEN;
+  unsigned char *tag = ciphertext + inData_len;
+
+  // the nonce is fixed, so that the output depends only on the key and
+  // the plaintext
+  memset(nonce, 0, AES_GCM_SIV_NONCE_LEN);
+
+  const EVP_CIPHER *evp_cipher =
+    kmyth_get_evp_cipher(KMYTH_EVP_AES_256_GCM_SIV);
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_acquire(cctx);
+  int len = 0;
+
+  if (ctx == NULL || evp_cipher == NULL ||
+      !EVP_EncryptInit_ex(ctx, evp_cipher, NULL, key, nonce) ||
+      !EVP_EncryptUpdate(ctx, ciphertext, &len, inData, (int) inData_len) ||
+      (size_t) len != inData_len ||
+      !EVP_EncryptFinal_ex(ctx, tag, &len) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AES_GCM_SIV_TAG_LEN,
+                           tag))
+  {
+    kmyth_cipher_ctx_release(cctx, ctx);
+    kmyth_free(out);
+    return 1;
+  }
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  *outData = out;
+  *outData_len = out_len;
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_siv_encrypt()
+//############################################################################
+int aes_gcm_siv_encrypt(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char **outData, size_t * outData_len)
+{
+  return aes_gcm_siv_encrypt_ctx(NULL, key, key_len, inData, inData_len,
+                                 outData, outData_len);
+}
+
+//############################################################################
+// aes_gcm_siv_decrypt_ctx()
+//############################################################################
+int aes_gcm_siv_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                            unsigned char *key,
+                            size_t key_len,
+                            unsigned char *inData, size_t inData_len,
+                            unsigned char **outData, size_t * outData_len)
+{
+  // validate a non-NULL key of the (only) supported size
+  if (key == NULL || key_len != AES_GCM_SIV_KEY_LEN)
+  {
+    return 1;
+  }
+
+  // validate input holding a nonce, a non-empty ciphertext and a tag
+  if (inData == NULL ||
+      inData_len <= AES_GCM_SIV_NONCE_LEN + AES_GCM_SIV_TAG_LEN ||
+      inData_len > INT_MAX)
+  {
+    return 1;
+  }
+
+  // input data buffer (inData) contains nonce||ciphertext||tag and the
+  // plaintext is as long as the ciphertext
+  size_t out_len = inData_len - (AES_GCM_SIV_NONCE_LEN + AES_GCM_SIV_TAG_LEN);
+  unsigned char *out = kmyth_malloc(out_len);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+  unsigned char *nonce = inData;
+  unsigned char *ciphertext = inData + AES_GCM_SIV_NONCE_LEN;
+  unsigned char *tag = ciphertext + out_len;
+
+  const EVP_CIPHER *evp_cipher =
+    kmyth_get_evp_cipher(KMYTH_EVP_AES_256_GCM_SIV);
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_acquire(cctx);
+  int len = 0;
+
+  // the tag is needed up front (it is the initial counter block) and is
+  // verified by the final step; on failure the plaintext is wiped
+  if (ctx == NULL || evp_cipher == NULL ||
+      !EVP_DecryptInit_ex(ctx, evp_cipher, NULL, key, nonce) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AES_GCM_SIV_TAG_LEN,
+                           tag) ||
+      !EVP_DecryptUpdate(ctx, out, &len, ciphertext, (int) out_len) ||
+      (size_t) len != out_len ||
+      EVP_DecryptFinal_ex(ctx, out + out_len, &len) <= 0)
+  {
+    kmyth_cipher_ctx_release(cctx, ctx);
+    kmyth_clear_and_free(out, out_len);
+    return 1;
+  }
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  *outData = out;
+  *outData_len = out_len;
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_siv_decrypt()
+//############################################################################
+int aes_gcm_siv_decrypt(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char **outData, size_t * outData_len)
+{
+  return aes_gcm_siv_decrypt_ctx(NULL, key, key_len, inData, inData_len,
+                                 outData, outData_len);
+}
@@ -8,16 +8,20 @@
 
 #include <openssl/evp.h>
 
+#include "cipher/cipher.h"
 #include "defines.h"
+#include "memory_util.h"
 
 //############################################################################
-// aes_keywrap_3394nopad_encrypt()
+// aes_keywrap_3394nopad_encrypt_ctx()
 //############################################################################
-int aes_keywrap_3394nopad_encrypt(unsigned char *key,
-                                  size_t key_len,
-                                  unsigned char *inData,
-                                  size_t inData_len, unsigned char **outData,
-                                  size_t * outData_len)
+int aes_keywrap_3394nopad_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      unsigned char *inData,
+                                      size_t inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len)
 {
   // validate non-NULL and non-empty encryption key specified
   if (key == NULL || key_len == 0)
@@ -46,7 +50,7 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   *outData_len = inData_len + 8;
   if (*outData == NULL)
   {
-    *outData = malloc(*outData_len);
+    *outData = kmyth_malloc(*outData_len);
     if (*outData == NULL) return 1;
   }
   // initialize the cipher context to match cipher suite being used
@@ -54,9 +58,9 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   //     wrap modes through EVP.
   EVP_CIPHER_CTX *ctx;
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (!(ctx = kmyth_cipher_ctx_acquire(cctx)))
   {
-    free(*outData);
+    kmyth_free(*outData);
     *outData = NULL;
     return 1;
   }
@@ -66,31 +70,37 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   switch (key_len)
   {
   case 16:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_128_wrap(), NULL, NULL, NULL);
+    init_result =
+      EVP_EncryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_128_WRAP),
+                         NULL, NULL, NULL);
     break;
   case 24:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_192_wrap(), NULL, NULL, NULL);
+    init_result =
+      EVP_EncryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_192_WRAP),
+                         NULL, NULL, NULL);
     break;
   case 32:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_256_wrap(), NULL, NULL, NULL);
+    init_result =
+      EVP_EncryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_256_WRAP),
+                         NULL, NULL, NULL);
     break;
   default:
     break;
   }
   if (!init_result)
   {
-    free(*outData);
+    kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   // set the encryption key in the cipher context
   if (!EVP_EncryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-    free(*outData);
+    kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
@@ -105,9 +115,9 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   // encrypt (wrap) the input PT, put result in the output CT buffer
   if (!EVP_EncryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len))
   {
-    free(*outData);
+    kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
   ciphertext_len = tmp_len;
@@ -115,9 +125,9 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   // OpenSSL requires a "finalize" operation
   if (!EVP_EncryptFinal_ex(ctx, (*outData) + ciphertext_len, &tmp_len))
   {
-    free(*outData);
+    kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
   ciphertext_len += tmp_len;
@@ -126,26 +136,42 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   // eight bytes for prepended integrity check value)
   if (ciphertext_len != *outData_len)
   {
-    free(*outData);
+    kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  kmyth_cipher_ctx_release(cctx, ctx);
 
   return 0;
 }
 
 //############################################################################
-// aes_keywrap_3394nopad_decrypt()
+// aes_keywrap_3394nopad_encrypt()
 //############################################################################
-int aes_keywrap_3394nopad_decrypt(unsigned char *key,
+int aes_keywrap_3394nopad_encrypt(unsigned char *key,
                                   size_t key_len,
                                   unsigned char *inData,
                                   size_t inData_len, unsigned char **outData,
                                   size_t * outData_len)
+{
+  return aes_keywrap_3394nopad_encrypt_ctx(NULL, key, key_len,
+                                           inData, inData_len,
+                                           outData, outData_len);
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_decrypt_ctx()
+//############################################################################
+int aes_keywrap_3394nopad_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                                      unsigned char *key,
+                                      size_t key_len,
+                                      unsigned char *inData,
+                                      size_t inData_len,
+                                      unsigned char **outData,
+                                      size_t * outData_len)
 {
   // validate non-NULL and non-empty decryption key specified
   if (key == NULL || key_len == 0)
@@ -180,7 +206,7 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   // plus prepended 8-byte integrity check value)
   if (*outData == NULL)
   {
-    *outData = malloc(inData_len);
+    *outData = kmyth_malloc(inData_len);
     if (*outData == NULL) return 1;
   }
 
@@ -189,9 +215,9 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   //     wrap modes through EVP.
   EVP_CIPHER_CTX *ctx;
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (!(ctx = kmyth_cipher_ctx_acquire(cctx)))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
     return 1;
   }
@@ -201,31 +227,37 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   switch (key_len)
   {
   case 16:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_128_wrap(), NULL, NULL, NULL);
+    init_result =
+      EVP_DecryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_128_WRAP),
+                         NULL, NULL, NULL);
     break;
   case 24:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_192_wrap(), NULL, NULL, NULL);
+    init_result =
+      EVP_DecryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_192_WRAP),
+                         NULL, NULL, NULL);
     break;
   case 32:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_256_wrap(), NULL, NULL, NULL);
+    init_result =
+      EVP_DecryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_256_WRAP),
+                         NULL, NULL, NULL);
     break;
   default:
     break;
   }
   if (!init_result)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   // set the decryption key in the cipher context
   if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
@@ -238,9 +270,9 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   // check value validated and removed) in the output plaintext buffer
   if (!EVP_DecryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
   *outData_len = (size_t)tmp_len;
@@ -248,9 +280,9 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   // "finalize" decryption
   if (!EVP_DecryptFinal_ex(ctx, *outData + *outData_len, &tmp_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
   *outData_len += (size_t)tmp_len;
@@ -259,14 +291,164 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   // the length of the 8-byte integrity check value
   if (*outData_len != inData_len - 8)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   // now that the encryption is complete, clean-up cipher context
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  return 0;
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_decrypt()
+//############################################################################
+int aes_keywrap_3394nopad_decrypt(unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData,
+                                  size_t inData_len, unsigned char **outData,
+                                  size_t * outData_len)
+{
+  return aes_keywrap_3394nopad_decrypt_ctx(NULL, key, key_len,
+                                           inData, inData_len,
+                                           outData, outData_len);
+}
+
+//############################################################################
+// keywrap_3394nopad_batch()
+//############################################################################
+static int keywrap_3394nopad_batch(unsigned char *key, size_t key_len,
+                                   size_t count, unsigned char **inData,
+                                   size_t *inData_len,
+                                   unsigned char **outData,
+                                   size_t *outData_len, int enc)
+{
+  if (key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+  if (count == 0 || inData == NULL || inData_len == NULL ||
+      outData == NULL || outData_len == NULL)
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    outData[i] = NULL;
+    outData_len[i] = 0;
+  }
+
+  const EVP_CIPHER *cipher = NULL;
+
+  switch (key_len)
+  {
+  case 16:
+    cipher = kmyth_get_evp_cipher(KMYTH_EVP_AES_128_WRAP);
+    break;
+  case 24:
+    cipher = kmyth_get_evp_cipher(KMYTH_EVP_AES_192_WRAP);
+    break;
+  case 32:
+    cipher = kmyth_get_evp_cipher(KMYTH_EVP_AES_256_WRAP);
+    break;
+  default:
+    return 1;
+  }
+
+  // the key schedule is set up once and kept for every input: re-initializing
+  // with no cipher and no key only resets the per-message state
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+  EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+  if (!EVP_CipherInit_ex(ctx, cipher, NULL, key, NULL, enc))
+  {
+    EVP_CIPHER_CTX_free(ctx);
+    return 1;
+  }
+
+  size_t i = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    // same input length rules as the single-input functions: whole
+    // semiblocks, at least two of plaintext (three of ciphertext)
+    if (inData[i] == NULL || inData_len[i] < (enc ? 16 : 24) ||
+        inData_len[i] % 8 != 0 || inData_len[i] > INT_MAX)
+    {
+      break;
+    }
+
+    size_t expected_len = enc ? inData_len[i] + 8 : inData_len[i] - 8;
+
+    outData[i] = kmyth_malloc(enc ? expected_len : inData_len[i]);
+    if (outData[i] == NULL)
+    {
+      break;
+    }
+
+    int out_len = 0;
+    int tmp_len = 0;
+
+    if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, NULL, enc) ||
+        !EVP_CipherUpdate(ctx, outData[i], &out_len, inData[i],
+                          (int) inData_len[i]) || out_len < 0 ||
+        !EVP_CipherFinal_ex(ctx, outData[i] + out_len, &tmp_len) ||
+        tmp_len < 0 || (size_t) out_len + (size_t) tmp_len != expected_len)
+    {
+      break;
+    }
+    outData_len[i] = expected_len;
+  }
   EVP_CIPHER_CTX_free(ctx);
 
+  // a single bad input fails the whole batch
+  if (i < count)
+  {
+    for (size_t j = 0; j <= i && j < count; j++)
+    {
+      if (outData[j] != NULL)
+      {
+        kmyth_clear_and_free(outData[j],
+                             enc ? inData_len[j] + 8 : inData_len[j]);
+      }
+      outData[j] = NULL;
+      outData_len[j] = 0;
+    }
+    return 1;
+  }
+
   return 0;
 }
+
+//############################################################################
+// aes_keywrap_3394nopad_encrypt_batch()
+//############################################################################
+int aes_keywrap_3394nopad_encrypt_batch(unsigned char *key, size_t key_len,
+                                        size_t count, unsigned char **inData,
+                                        size_t *inData_len,
+                                        unsigned char **outData,
+                                        size_t *outData_len)
+{
+  return keywrap_3394nopad_batch(key, key_len, count, inData, inData_len,
+                                 outData, outData_len, 1);
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_decrypt_batch()
+//############################################################################
+int aes_keywrap_3394nopad_decrypt_batch(unsigned char *key, size_t key_len,
+                                        size_t count, unsigned char **inData,
+                                        size_t *inData_len,
+                                        unsigned char **outData,
+                                        size_t *outData_len)
+{
+  return keywrap_3394nopad_batch(key, key_len, count, inData, inData_len,
+                                 outData, outData_len, 0);
+}
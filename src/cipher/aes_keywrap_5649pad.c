@@ -8,17 +8,21 @@
 
 #include <openssl/evp.h>
 
+#include "cipher/cipher.h"
 #include "defines.h"
+#include "memory_util.h"
 
 
 //##########################################################################
-// aes_keywrap_5649pad_encrypt()
+// aes_keywrap_5649pad_encrypt_ctx()
 //##########################################################################
-int aes_keywrap_5649pad_encrypt(unsigned char *key,
-                                size_t key_len,
-                                unsigned char *inData,
-                                size_t inData_len, unsigned char **outData,
-                                size_t * outData_len)
+int aes_keywrap_5649pad_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                                    unsigned char *key,
+                                    size_t key_len,
+                                    unsigned char *inData,
+                                    size_t inData_len,
+                                    unsigned char **outData,
+                                    size_t * outData_len)
 {
   // validate non-NULL and non-empty encryption key specified
   if (key == NULL || key_len == 0)
@@ -48,7 +52,7 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   *outData_len = inData_len + offset;
   if (*outData == NULL)
   {
-    *outData = malloc(*outData_len);
+    *outData = kmyth_malloc(*outData_len);
   }
   if (*outData == NULL)
   {
@@ -60,9 +64,9 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   //     wrap modes through EVP.
   EVP_CIPHER_CTX *ctx;
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (!(ctx = kmyth_cipher_ctx_acquire(cctx)))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
     return 1;
   }
@@ -73,33 +77,36 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   {
   case 16:
     init_result =
-      EVP_EncryptInit_ex(ctx, EVP_aes_128_wrap_pad(), NULL, NULL, NULL);
+      EVP_EncryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_128_WRAP_PAD),
+                         NULL, NULL, NULL);
     break;
   case 24:
     init_result =
-      EVP_EncryptInit_ex(ctx, EVP_aes_192_wrap_pad(), NULL, NULL, NULL);
+      EVP_EncryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_192_WRAP_PAD),
+                         NULL, NULL, NULL);
     break;
   case 32:
     init_result =
-      EVP_EncryptInit_ex(ctx, EVP_aes_256_wrap_pad(), NULL, NULL, NULL);
+      EVP_EncryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_256_WRAP_PAD),
+                         NULL, NULL, NULL);
     break;
   default:
     break;
   }
   if (!init_result)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   // set the encryption key in the cipher context
   if (!EVP_EncryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
@@ -114,9 +121,9 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   // encrypt (wrap) the input PT, put result in the output CT buffer
   if (!EVP_EncryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
   ciphertext_len = tmp_len;
@@ -124,9 +131,9 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   // OpenSSL requires a "finalize" operation
   if (!EVP_EncryptFinal_ex(ctx, (*outData) + ciphertext_len, &tmp_len))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
   ciphertext_len += tmp_len;
@@ -135,26 +142,42 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   // plus 4-byte IV plus 4-byte counter + any necessary padding)
   if (ciphertext_len != *outData_len)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  kmyth_cipher_ctx_release(cctx, ctx);
 
   return 0;
 }
 
 //##########################################################################
-// aes_keywrap_5649pad_decrypt()
+// aes_keywrap_5649pad_encrypt()
 //##########################################################################
-int aes_keywrap_5649pad_decrypt(unsigned char *key,
+int aes_keywrap_5649pad_encrypt(unsigned char *key,
                                 size_t key_len,
                                 unsigned char *inData,
                                 size_t inData_len, unsigned char **outData,
                                 size_t * outData_len)
+{
+  return aes_keywrap_5649pad_encrypt_ctx(NULL, key, key_len,
+                                         inData, inData_len,
+                                         outData, outData_len);
+}
+
+//##########################################################################
+// aes_keywrap_5649pad_decrypt_ctx()
+//##########################################################################
+int aes_keywrap_5649pad_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                                    unsigned char *key,
+                                    size_t key_len,
+                                    unsigned char *inData,
+                                    size_t inData_len,
+                                    unsigned char **outData,
+                                    size_t * outData_len)
 {
   // validate non-NULL and non-empty decryption key specified
   if (key == NULL || key_len == 0)
@@ -191,7 +214,7 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
   // plus any appended padding bytes)
   if (*outData == NULL)
   {
-    *outData = malloc(inData_len);
+    *outData = kmyth_malloc(inData_len);
   }
   if (*outData == NULL)
   {
@@ -202,9 +225,9 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
   // when using key wrap modes with EVP.
   EVP_CIPHER_CTX *ctx;
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (!(ctx = kmyth_cipher_ctx_acquire(cctx)))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
     return 1;
   }
@@ -216,15 +239,18 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
   {
   case 16:
     init_result =
-      EVP_DecryptInit_ex(ctx, EVP_aes_128_wrap_pad(), NULL, NULL, NULL);
+      EVP_DecryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_128_WRAP_PAD),
+                         NULL, NULL, NULL);
     break;
   case 24:
     init_result =
-      EVP_DecryptInit_ex(ctx, EVP_aes_192_wrap_pad(), NULL, NULL, NULL);
+      EVP_DecryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_192_WRAP_PAD),
+                         NULL, NULL, NULL);
     break;
   case 32:
     init_result =
-      EVP_DecryptInit_ex(ctx, EVP_aes_256_wrap_pad(), NULL, NULL, NULL);
+      EVP_DecryptInit_ex(ctx, kmyth_get_evp_cipher(KMYTH_EVP_AES_256_WRAP_PAD),
+                         NULL, NULL, NULL);
     break;
   default:
     break;
@@ -232,17 +258,17 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
 
   if (!init_result)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
@@ -250,24 +276,177 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
 
   if (!EVP_DecryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   *outData_len = (size_t)tmp_len;
   if (!EVP_DecryptFinal_ex(ctx, *outData + *outData_len, &tmp_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
+    if (*outData != NULL) kmyth_free(*outData);
     *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(cctx, ctx);
     return 1;
   }
 
   *outData_len += (size_t)tmp_len;
 
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  return 0;
+}
+
+//##########################################################################
+// aes_keywrap_5649pad_decrypt()
+//##########################################################################
+int aes_keywrap_5649pad_decrypt(unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len, unsigned char **outData,
+                                size_t * outData_len)
+{
+  return aes_keywrap_5649pad_decrypt_ctx(NULL, key, key_len,
+                                         inData, inData_len,
+                                         outData, outData_len);
+}
+
+//##########################################################################
+// keywrap_5649pad_batch()
+//##########################################################################
+static int keywrap_5649pad_batch(unsigned char *key, size_t key_len,
+                                 size_t count, unsigned char **inData,
+                                 size_t *inData_len,
+                                 unsigned char **outData,
+                                 size_t *outData_len, int enc)
+{
+  if (key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+  if (count == 0 || inData == NULL || inData_len == NULL ||
+      outData == NULL || outData_len == NULL)
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    outData[i] = NULL;
+    outData_len[i] = 0;
+  }
+
+  const EVP_CIPHER *cipher = NULL;
+
+  switch (key_len)
+  {
+  case 16:
+    cipher = kmyth_get_evp_cipher(KMYTH_EVP_AES_128_WRAP_PAD);
+    break;
+  case 24:
+    cipher = kmyth_get_evp_cipher(KMYTH_EVP_AES_192_WRAP_PAD);
+    break;
+  case 32:
+    cipher = kmyth_get_evp_cipher(KMYTH_EVP_AES_256_WRAP_PAD);
+    break;
+  default:
+    return 1;
+  }
+
+  // the key schedule is set up once and kept for every input: re-initializing
+  // with no cipher and no key only resets the per-message state
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+  EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+  if (!EVP_CipherInit_ex(ctx, cipher, NULL, key, NULL, enc))
+  {
+    EVP_CIPHER_CTX_free(ctx);
+    return 1;
+  }
+
+  size_t i = 0;
+  size_t alloc_len = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    // same input length rules as the single-input functions
+    if (inData[i] == NULL || inData_len[i] == 0 ||
+        inData_len[i] > AES_KEYWRAP_5649PAD_MAX_DATA_LEN ||
+        inData_len[i] > INT_MAX ||
+        (!enc && (inData_len[i] < 8 || inData_len[i] % 8 != 0)))
+    {
+      break;
+    }
+
+    // wrapping pads to whole semiblocks and adds one for the 4-byte IV and
+    // 4-byte length; the unwrapped data is never longer than its input
+    alloc_len = enc ? ((inData_len[i] + 7) / 8) * 8 + 8 : inData_len[i];
+    outData[i] = kmyth_malloc(alloc_len);
+    if (outData[i] == NULL)
+    {
+      break;
+    }
+
+    int out_len = 0;
+    int tmp_len = 0;
+
+    if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, NULL, enc) ||
+        !EVP_CipherUpdate(ctx, outData[i], &out_len, inData[i],
+                          (int) inData_len[i]) || out_len < 0 ||
+        !EVP_CipherFinal_ex(ctx, outData[i] + out_len, &tmp_len) ||
+        tmp_len < 0 || (enc && (size_t) (out_len + tmp_len) != alloc_len))
+    {
+      break;
+    }
+    outData_len[i] = (size_t) out_len + (size_t) tmp_len;
+  }
   EVP_CIPHER_CTX_free(ctx);
 
+  // a single bad input fails the whole batch
+  if (i < count)
+  {
+    for (size_t j = 0; j <= i && j < count; j++)
+    {
+      if (outData[j] != NULL)
+      {
+        kmyth_clear_and_free(outData[j], (j == i) ? alloc_len :
+                             (enc ? outData_len[j] : inData_len[j]));
+      }
+      outData[j] = NULL;
+      outData_len[j] = 0;
+    }
+    return 1;
+  }
+
   return 0;
 }
+
+//##########################################################################
+// aes_keywrap_5649pad_encrypt_batch()
+//##########################################################################
+int aes_keywrap_5649pad_encrypt_batch(unsigned char *key, size_t key_len,
+                                      size_t count, unsigned char **inData,
+                                      size_t *inData_len,
+                                      unsigned char **outData,
+                                      size_t *outData_len)
+{
+  return keywrap_5649pad_batch(key, key_len, count, inData, inData_len,
+                               outData, outData_len, 1);
+}
+
+//##########################################################################
+// aes_keywrap_5649pad_decrypt_batch()
+//##########################################################################
+int aes_keywrap_5649pad_decrypt_batch(unsigned char *key, size_t key_len,
+                                      size_t count, unsigned char **inData,
+                                      size_t *inData_len,
+                                      unsigned char **outData,
+                                      size_t *outData_len)
+{
+  return keywrap_5649pad_batch(key, key_len, count, inData, inData_len,
+                               outData, outData_len, 0);
+}
@@ -0,0 +1,283 @@
+/**
+ * @file  chacha20_poly1305.c
+ *
+ * @brief Implements ChaCha20-Poly1305 for kmyth.
+ */
+
+#include "cipher/chacha20_poly1305.h"
+
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "cipher/cipher.h"
+#include "memory_util.h"
+
+//############################################################################
+// chacha20_poly1305_encrypt_into()
+//############################################################################
+int chacha20_poly1305_encrypt_into(kmyth_cipher_ctx * cctx,
+                                   unsigned char *key,
+                                   size_t key_len,
+                                   unsigned char *inData, size_t inData_len,
+                                   unsigned char *outData,
+                                   size_t outData_size, size_t * outData_len)
+{
+  // validate a non-NULL key of the (only) supported size
+  if (key == NULL || key_len != CHACHA20_POLY1305_KEY_LEN)
+  {
+    return 1;
+  }
+
+  // validate non-NULL input plaintext buffer within the ChaCha20 limit
+  if (inData == NULL || inData_len > CHACHA20_POLY1305_MAX_DATA_LEN)
+  {
+    return 1;
+  }
+
+  // output data buffer (outData) will contain the concatenation of:
+  //   - CHACHA20_POLY1305_NONCE_LEN (12) byte nonce
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - CHACHA20_POLY1305_TAG_LEN (16) byte tag
+  size_t out_len = CHACHA20_POLY1305_NONCE_LEN + inData_len +
+    CHACHA20_POLY1305_TAG_LEN;
+
+  if (outData == NULL || outData_size < out_len)
+  {
+    return 1;
+  }
+  unsigned char *nonce = outData;
+  unsigned char *ciphertext = nonce + CHACHA20_POLY1305_NONCE_LEN;
+  unsigned char *tag = ciphertext + inData_len;
+
+  const EVP_CIPHER *evp_cipher =
+    kmyth_get_evp_cipher(KMYTH_EVP_CHACHA20_POLY1305);
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_acquire(cctx);
+  size_t ciphertext_len = 0;
+  int len = 0;
+
+  // a fresh random nonce for every encryption (a nonce must never be
+  // reused with the same key)
+  if (ctx == NULL || evp_cipher == NULL ||
+      RAND_bytes(nonce, CHACHA20_POLY1305_NONCE_LEN) != 1 ||
+      !EVP_EncryptInit_ex(ctx, evp_cipher, NULL, NULL, NULL) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN,
+                           CHACHA20_POLY1305_NONCE_LEN, NULL) ||
+      !EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce) ||
+      (inData_len > 0 &&
+       (kmyth_cipher_update(ctx, ciphertext, inData, inData_len,
+                            &ciphertext_len) ||
+        ciphertext_len != inData_len)) ||
+      !EVP_EncryptFinal_ex(ctx, tag, &len) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG,
+                           CHACHA20_POLY1305_TAG_LEN, tag))
+  {
+    kmyth_cipher_ctx_release(cctx, ctx);
+    return 1;
+  }
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  *outData_len = out_len;
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_encrypt_ctx()
+//############################################################################
+int chacha20_poly1305_encrypt_ctx(kmyth_cipher_ctx * cctx,
+                                  unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData, size_t inData_len,
+                                  unsigned char **outData, size_t * outData_len)
+{
+  if (inData_len > CHACHA20_POLY1305_MAX_DATA_LEN)
+  {
+    return 1;
+  }
+
+  size_t out_size = CHACHA20_POLY1305_NONCE_LEN + inData_len +
+    CHACHA20_POLY1305_TAG_LEN;
+  unsigned char *out = kmyth_malloc(out_size);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  if (chacha20_poly1305_encrypt_into(cctx, key, key_len, inData, inData_len,
+                                     out, out_size, outData_len))
+  {
+    kmyth_free(out);
+    return 1;
+  }
+
+  *outData = out;
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_encrypt()
+//############################################################################
+int chacha20_poly1305_encrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData, size_t inData_len,
+                              unsigned char **outData, size_t * outData_len)
+{
+  return chacha20_poly1305_encrypt_ctx(NULL, key, key_len, inData, inData_len,
+                                       outData, outData_len);
+}
+
+//############################################################################
+// chacha20_poly1305_decrypt_into()
+//############################################################################
+int chacha20_poly1305_decrypt_into(kmyth_cipher_ctx * cctx,
+                                   unsigned char *key,
+                                   size_t key_len,
+                                   unsigned char *inData, size_t inData_len,
+                                   unsigned char *outData,
+                                   size_t outData_size, size_t * outData_len)
+{
+  // validate a non-NULL key of the (only) supported size
+  if (key == NULL || key_len != CHACHA20_POLY1305_KEY_LEN)
+  {
+    return 1;
+  }
+
+  // validate input holding at least a nonce and a tag
+  if (inData == NULL ||
+      inData_len < CHACHA20_POLY1305_NONCE_LEN + CHACHA20_POLY1305_TAG_LEN ||
+      inData_len > CHACHA20_POLY1305_NONCE_LEN +
+      CHACHA20_POLY1305_MAX_DATA_LEN + CHACHA20_POLY1305_TAG_LEN)
+  {
+    return 1;
+  }
+
+  // input data buffer (inData) contains nonce||ciphertext||tag and the
+  // plaintext is as long as the ciphertext
+  size_t expected_out_len = inData_len - (CHACHA20_POLY1305_NONCE_LEN +
+                                          CHACHA20_POLY1305_TAG_LEN);
+
+  if (outData == NULL || outData_size < expected_out_len)
+  {
+    return 1;
+  }
+  unsigned char *nonce = inData;
+  unsigned char *ciphertext = inData + CHACHA20_POLY1305_NONCE_LEN;
+  unsigned char *tag = ciphertext + expected_out_len;
+
+  const EVP_CIPHER *evp_cipher =
+    kmyth_get_evp_cipher(KMYTH_EVP_CHACHA20_POLY1305);
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_acquire(cctx);
+  size_t plaintext_len = 0;
+  int len = 0;
+
+  // the final step verifies the tag; on failure no unauthenticated
+  // plaintext is left in the output buffer
+  if (ctx == NULL || evp_cipher == NULL ||
+      !EVP_DecryptInit_ex(ctx, evp_cipher, NULL, NULL, NULL) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN,
+                           CHACHA20_POLY1305_NONCE_LEN, NULL) ||
+      !EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG,
+                           CHACHA20_POLY1305_TAG_LEN, tag) ||
+      (expected_out_len > 0 &&
+       (kmyth_cipher_update(ctx, outData, ciphertext, expected_out_len,
+                            &plaintext_len) ||
+        plaintext_len != expected_out_len)) ||
+      EVP_DecryptFinal_ex(ctx, outData + expected_out_len, &len) <= 0)
+  {
+    kmyth_clear(outData, expected_out_len);
+    kmyth_cipher_ctx_release(cctx, ctx);
+    return 1;
+  }
+  kmyth_cipher_ctx_release(cctx, ctx);
+
+  *outData_len = expected_out_len;
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_decrypt_ctx()
+//############################################################################
+int chacha20_poly1305_decrypt_ctx(kmyth_cipher_ctx * cctx,
+                                  unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData, size_t inData_len,
+                                  unsigned char **outData, size_t * outData_len)
+{
+  if (inData == NULL ||
+      inData_len < CHACHA20_POLY1305_NONCE_LEN + CHACHA20_POLY1305_TAG_LEN)
+  {
+    return 1;
+  }
+
+  *outData = NULL;
+  *outData_len = 0;
+
+  // allocate at least one byte, so an empty plaintext is still returned in
+  // a valid buffer
+  size_t out_size = inData_len - (CHACHA20_POLY1305_NONCE_LEN +
+                                  CHACHA20_POLY1305_TAG_LEN);
+  unsigned char *out = kmyth_malloc((out_size == 0) ? 1 : out_size);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  if (chacha20_poly1305_decrypt_into(cctx, key, key_len, inData, inData_len,
+                                     out, out_size, outData_len))
+  {
+    kmyth_free(out);
+    return 1;
+  }
+
+  *outData = out;
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_decrypt()
+//############################################################################
+int chacha20_poly1305_decrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData, size_t inData_len,
+                              unsigned char **outData, size_t * outData_len)
+{
+  return chacha20_poly1305_decrypt_ctx(NULL, key, key_len, inData, inData_len,
+                                       outData, outData_len);
+}
+
+//############################################################################
+// chacha20_poly1305_decrypt_in_place()
+//############################################################################
+int chacha20_poly1305_decrypt_in_place(kmyth_cipher_ctx * cctx,
+                                       unsigned char *key,
+                                       size_t key_len,
+                                       unsigned char *data, size_t data_len,
+                                       size_t * plaintext_len)
+{
+  if (data == NULL ||
+      data_len < CHACHA20_POLY1305_NONCE_LEN + CHACHA20_POLY1305_TAG_LEN)
+  {
+    return 1;
+  }
+
+  // decrypt the ciphertext over itself, then move the plaintext to the
+  // start of the buffer and wipe the copy of its tail left behind
+  size_t len = 0;
+
+  if (chacha20_poly1305_decrypt_into(cctx, key, key_len, data, data_len,
+                                     data + CHACHA20_POLY1305_NONCE_LEN,
+                                     data_len - CHACHA20_POLY1305_NONCE_LEN,
+                                     &len))
+  {
+    return 1;
+  }
+  memmove(data, data + CHACHA20_POLY1305_NONCE_LEN, len);
+  kmyth_clear(data + len, CHACHA20_POLY1305_NONCE_LEN);
+
+  *plaintext_len = len;
+  return 0;
+}
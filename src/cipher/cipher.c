@@ -5,15 +5,29 @@
 
 #include "cipher/cipher.h"
 
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) || defined(__arm__)
+#include <sys/auxv.h>
+#endif
 
 #include <openssl/rand.h>
 #include <openssl/err.h>
 
 #include "defines.h"
+#include "kmyth_usdt.h"
+#include "memory_util.h"
+#include "metrics.h"
 #include "cipher/aes_gcm.h"
+#include "cipher/aes_gcm_siv.h"
 #include "cipher/aes_keywrap_3394nopad.h"
 #include "cipher/aes_keywrap_5649pad.h"
+#include "cipher/chacha20_poly1305.h"
 
 // Check for supported OpenSSL version
 //   - OpenSSL v1.1.x required for AES KeyWrap RFC5649 w/ padding
@@ -31,39 +45,87 @@
 const cipher_t cipher_list[] = {
   {.cipher_name = "AES/GCM/NoPadding/256",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_ctx_fn = aes_gcm_encrypt_ctx,
+   .decrypt_ctx_fn = aes_gcm_decrypt_ctx,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place},
 
   {.cipher_name = "AES/GCM/NoPadding/192",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_ctx_fn = aes_gcm_encrypt_ctx,
+   .decrypt_ctx_fn = aes_gcm_decrypt_ctx,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place},
 
   {.cipher_name = "AES/GCM/NoPadding/128",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_ctx_fn = aes_gcm_encrypt_ctx,
+   .decrypt_ctx_fn = aes_gcm_decrypt_ctx,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place},
+
+  {.cipher_name = "AES/GCM-STREAM/NoPadding/256",
+   .encrypt_fn = aes_gcm_stream_encrypt,
+   .decrypt_fn = aes_gcm_stream_decrypt},
+
+  {.cipher_name = "AES/GCM-STREAM/NoPadding/192",
+   .encrypt_fn = aes_gcm_stream_encrypt,
+   .decrypt_fn = aes_gcm_stream_decrypt},
+
+  {.cipher_name = "AES/GCM-STREAM/NoPadding/128",
+   .encrypt_fn = aes_gcm_stream_encrypt,
+   .decrypt_fn = aes_gcm_stream_decrypt},
+
+  {.cipher_name = "ChaCha20/Poly1305/NoPadding/256",
+   .encrypt_fn = chacha20_poly1305_encrypt,
+   .decrypt_fn = chacha20_poly1305_decrypt,
+   .encrypt_ctx_fn = chacha20_poly1305_encrypt_ctx,
+   .decrypt_ctx_fn = chacha20_poly1305_decrypt_ctx,
+   .decrypt_in_place_fn = chacha20_poly1305_decrypt_in_place},
+
+#ifdef KMYTH_HAVE_AES_GCM_SIV
+  {.cipher_name = "AES/GCM-SIV/NoPadding/256",
+   .encrypt_fn = aes_gcm_siv_encrypt,
+   .decrypt_fn = aes_gcm_siv_decrypt,
+   .encrypt_ctx_fn = aes_gcm_siv_encrypt_ctx,
+   .decrypt_ctx_fn = aes_gcm_siv_decrypt_ctx},
+#endif
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/256",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_3394nopad_encrypt_ctx,
+   .decrypt_ctx_fn = aes_keywrap_3394nopad_decrypt_ctx},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/192",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_3394nopad_encrypt_ctx,
+   .decrypt_ctx_fn = aes_keywrap_3394nopad_decrypt_ctx},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/128",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_3394nopad_encrypt_ctx,
+   .decrypt_ctx_fn = aes_keywrap_3394nopad_decrypt_ctx},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/256",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_5649pad_encrypt_ctx,
+   .decrypt_ctx_fn = aes_keywrap_5649pad_decrypt_ctx},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/192",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_5649pad_encrypt_ctx,
+   .decrypt_ctx_fn = aes_keywrap_5649pad_decrypt_ctx},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/128",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_ctx_fn = aes_keywrap_5649pad_encrypt_ctx,
+   .decrypt_ctx_fn = aes_keywrap_5649pad_decrypt_ctx},
 
   {.cipher_name = NULL,
    .encrypt_fn = NULL,
@@ -74,7 +136,11 @@ cipher_t kmyth_get_cipher_t_from_string(char *cipher_string)
 {
   cipher_t cipher = {.cipher_name = NULL,
     .encrypt_fn = NULL,
-    .decrypt_fn = NULL
+    .decrypt_fn = NULL,
+    .encrypt_ctx_fn = NULL,
+    .decrypt_ctx_fn = NULL,
+    .decrypt_in_place_fn = NULL,
+    .ctx = NULL
   };
 
   // if input string is NULL, just return initialized cipher_t struct
@@ -83,6 +149,12 @@ cipher_t kmyth_get_cipher_t_from_string(char *cipher_string)
     return cipher;
   }
 
+  // "auto" stands for the cipher best suited to this host
+  if (strcmp(cipher_string, KMYTH_AUTO_CIPHER) == 0)
+  {
+    cipher_string = (char *) kmyth_select_auto_cipher();
+  }
+
   // go through cipher_list looking for user-specified cipher name
   size_t i = 0;
 
@@ -128,6 +200,300 @@ size_t get_key_len_from_cipher(cipher_t cipher)
   return (size_t) key_len;
 }
 
+// OpenSSL cipher implementations, resolved once (see kmyth_get_evp_cipher())
+static const EVP_CIPHER *evp_ciphers[KMYTH_EVP_CIPHER_COUNT];
+static pthread_once_t evp_ciphers_once = PTHREAD_ONCE_INIT;
+
+static void fetch_evp_ciphers(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  static const char *const names[KMYTH_EVP_CIPHER_COUNT] = {
+    "AES-128-GCM", "AES-192-GCM", "AES-256-GCM",
+    "AES-128-WRAP", "AES-192-WRAP", "AES-256-WRAP",
+    "AES-128-WRAP-PAD", "AES-192-WRAP-PAD", "AES-256-WRAP-PAD",
+    "ChaCha20-Poly1305",
+#ifdef KMYTH_HAVE_AES_GCM_SIV
+    "AES-256-GCM-SIV"
+#else
+    NULL
+#endif
+  };
+
+  for (size_t i = 0; i < KMYTH_EVP_CIPHER_COUNT; i++)
+  {
+    if (names[i] != NULL)
+    {
+      evp_ciphers[i] = EVP_CIPHER_fetch(NULL, names[i], NULL);
+    }
+  }
+#else
+  evp_ciphers[KMYTH_EVP_AES_128_GCM] = EVP_aes_128_gcm();
+  evp_ciphers[KMYTH_EVP_AES_192_GCM] = EVP_aes_192_gcm();
+  evp_ciphers[KMYTH_EVP_AES_256_GCM] = EVP_aes_256_gcm();
+  evp_ciphers[KMYTH_EVP_AES_128_WRAP] = EVP_aes_128_wrap();
+  evp_ciphers[KMYTH_EVP_AES_192_WRAP] = EVP_aes_192_wrap();
+  evp_ciphers[KMYTH_EVP_AES_256_WRAP] = EVP_aes_256_wrap();
+  evp_ciphers[KMYTH_EVP_AES_128_WRAP_PAD] = EVP_aes_128_wrap_pad();
+  evp_ciphers[KMYTH_EVP_AES_192_WRAP_PAD] = EVP_aes_192_wrap_pad();
+  evp_ciphers[KMYTH_EVP_AES_256_WRAP_PAD] = EVP_aes_256_wrap_pad();
+  evp_ciphers[KMYTH_EVP_CHACHA20_POLY1305] = EVP_chacha20_poly1305();
+#endif
+}
+
+const EVP_CIPHER *kmyth_get_evp_cipher(kmyth_evp_cipher_id id)
+{
+  if ((size_t) id >= KMYTH_EVP_CIPHER_COUNT ||
+      pthread_once(&evp_ciphers_once, fetch_evp_ciphers))
+  {
+    return NULL;
+  }
+
+  return evp_ciphers[id];
+}
+
+struct kmyth_cipher_ctx
+{
+  EVP_CIPHER_CTX *evp_ctx;
+};
+
+int kmyth_cipher_ctx_create(kmyth_cipher_ctx ** cctx)
+{
+  if (cctx == NULL)
+  {
+    return 1;
+  }
+
+  *cctx = kmyth_calloc(1, sizeof(kmyth_cipher_ctx));
+  if (*cctx == NULL)
+  {
+    return 1;
+  }
+  (*cctx)->evp_ctx = EVP_CIPHER_CTX_new();
+  if ((*cctx)->evp_ctx == NULL)
+  {
+    kmyth_free(*cctx);
+    *cctx = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+void kmyth_cipher_ctx_destroy(kmyth_cipher_ctx ** cctx)
+{
+  if (cctx == NULL || *cctx == NULL)
+  {
+    return;
+  }
+
+  EVP_CIPHER_CTX_free((*cctx)->evp_ctx);
+  kmyth_free(*cctx);
+  *cctx = NULL;
+}
+
+EVP_CIPHER_CTX *kmyth_cipher_ctx_acquire(kmyth_cipher_ctx * cctx)
+{
+  if (cctx == NULL)
+  {
+    return EVP_CIPHER_CTX_new();
+  }
+
+  return cctx->evp_ctx;
+}
+
+void kmyth_cipher_ctx_release(kmyth_cipher_ctx * cctx,
+                              EVP_CIPHER_CTX * evp_ctx)
+{
+  if (cctx == NULL || evp_ctx != cctx->evp_ctx)
+  {
+    EVP_CIPHER_CTX_free(evp_ctx);
+    return;
+  }
+
+  EVP_CIPHER_CTX_reset(evp_ctx);
+}
+
+//############################################################################
+// kmyth_cipher_update()
+//############################################################################
+int kmyth_cipher_update(EVP_CIPHER_CTX * ctx, unsigned char *out,
+                        const unsigned char *in, size_t in_len,
+                        size_t * out_len)
+{
+  size_t done = 0;
+  size_t written = 0;
+
+  while (done < in_len)
+  {
+    size_t piece = in_len - done;
+    int len = 0;
+
+    if (piece > KMYTH_MAX_IO_CHUNK)
+    {
+      piece = KMYTH_MAX_IO_CHUNK;
+    }
+    if (!EVP_CipherUpdate(ctx, out + written, &len, in + done, (int) piece)
+        || len < 0)
+    {
+      return 1;
+    }
+    done += piece;
+    written += (size_t) len;
+  }
+
+  *out_len = written;
+  return 0;
+}
+
+// number of threads used by the streaming ciphers (see set_cipher_threads())
+static size_t cipher_threads = 1;
+
+int set_cipher_threads(size_t threads)
+{
+  if (threads == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    threads = (cpus < 1) ? 1 : (size_t) cpus;
+    if (threads > KMYTH_MAX_CIPHER_THREADS)
+    {
+      threads = KMYTH_MAX_CIPHER_THREADS;
+    }
+  }
+  if (threads > KMYTH_MAX_CIPHER_THREADS)
+  {
+    kmyth_log(LOG_ERR, "invalid cipher thread count (%zu) ... exiting",
+              threads);
+    return 1;
+  }
+  cipher_threads = threads;
+
+  return 0;
+}
+
+size_t get_cipher_threads(void)
+{
+  return cipher_threads;
+}
+
+// CPU crypto features, probed once (see kmyth_cpu_crypto_features())
+static pthread_once_t cpu_features_once = PTHREAD_ONCE_INIT;
+static unsigned int cpu_features = 0;
+
+static void probe_cpu_features(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+  {
+    if (ecx & bit_AES)
+    {
+      cpu_features |= KMYTH_CPU_AES;
+    }
+    if (ecx & bit_PCLMUL)
+    {
+      cpu_features |= KMYTH_CPU_CLMUL;
+    }
+  }
+  // leaf 7, sub-leaf 0: ECX bit 9 is VAES, bit 10 is VPCLMULQDQ
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+  {
+    if (ecx & (1U << 9))
+    {
+      cpu_features |= KMYTH_CPU_VAES;
+    }
+    if (ecx & (1U << 10))
+    {
+      cpu_features |= KMYTH_CPU_VPCLMULQDQ;
+    }
+  }
+#elif defined(__aarch64__)
+  // HWCAP_AES and HWCAP_PMULL from <asm/hwcap.h>
+  unsigned long hwcap = getauxval(AT_HWCAP);
+
+  if (hwcap & (1UL << 3))
+  {
+    cpu_features |= KMYTH_CPU_AES;
+  }
+  if (hwcap & (1UL << 4))
+  {
+    cpu_features |= KMYTH_CPU_CLMUL;
+  }
+#elif defined(__arm__)
+  // HWCAP2_AES and HWCAP2_PMULL from <asm/hwcap.h>
+  unsigned long hwcap2 = getauxval(AT_HWCAP2);
+
+  if (hwcap2 & (1UL << 0))
+  {
+    cpu_features |= KMYTH_CPU_AES;
+  }
+  if (hwcap2 & (1UL << 1))
+  {
+    cpu_features |= KMYTH_CPU_CLMUL;
+  }
+#endif
+}
+
+unsigned int kmyth_cpu_crypto_features(void)
+{
+  pthread_once(&cpu_features_once, probe_cpu_features);
+  return cpu_features;
+}
+
+void kmyth_cpu_crypto_features_string(unsigned int features, char *buf,
+                                      size_t buf_len)
+{
+#if defined(__aarch64__) || defined(__arm__)
+  const char *names[] = { "AES", "PMULL", "VAES", "VPCLMULQDQ" };
+#else
+  const char *names[] = { "AES-NI", "PCLMULQDQ", "VAES", "VPCLMULQDQ" };
+#endif
+  const unsigned int flags[] = { KMYTH_CPU_AES, KMYTH_CPU_CLMUL,
+    KMYTH_CPU_VAES, KMYTH_CPU_VPCLMULQDQ
+  };
+  size_t used = 0;
+
+  if (buf == NULL || buf_len == 0)
+  {
+    return;
+  }
+  buf[0] = '\0';
+  for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+  {
+    if ((features & flags[i]) && used < buf_len)
+    {
+      int len = snprintf(buf + used, buf_len - used, "%s%s",
+                         (used > 0) ? " " : "", names[i]);
+
+      used = (len < 0) ? buf_len : used + (size_t) len;
+    }
+  }
+  if (buf[0] == '\0')
+  {
+    snprintf(buf, buf_len, "none");
+  }
+}
+
+const char *kmyth_select_auto_cipher(void)
+{
+  unsigned int features = kmyth_cpu_crypto_features();
+
+  // GCM is only fast with both hardware AES and carry-less multiply (for
+  // GHASH); without them ChaCha20-Poly1305 is faster and constant time
+  if ((features & KMYTH_CPU_AES) && (features & KMYTH_CPU_CLMUL))
+  {
+    return "AES/GCM/NoPadding/256";
+  }
+  return "ChaCha20/Poly1305/NoPadding/256";
+}
+
+bool kmyth_cipher_is_stream(cipher_t cipher)
+{
+  return (cipher.cipher_name != NULL &&
+          cipher.encrypt_fn == aes_gcm_stream_encrypt);
+}
+
 //############################################################################
 // kmyth_encrypt_data
 //############################################################################
@@ -168,13 +534,61 @@ int kmyth_encrypt_data(unsigned char *data,
     return 1;
   }
 
+  return kmyth_encrypt_data_with_key(data, data_size, cipher_spec,
+                                     *enc_key, *enc_key_size,
+                                     enc_data, enc_data_size);
+}
+
+//############################################################################
+// kmyth_encrypt_data_with_key
+//############################################################################
+int kmyth_encrypt_data_with_key(unsigned char *data,
+                                size_t data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size,
+                                unsigned char **enc_data,
+                                size_t * enc_data_size)
+{
+  if (cipher_spec.cipher_name == NULL)
+  {
+    return 1;
+  }
+  if (data == NULL || data_size == 0)
+  {
+    return 1;
+  }
+  if (enc_data == NULL || enc_data_size == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
+  {
+    return 1;
+  }
+
   *enc_data_size = 0;
-  if (cipher_spec.encrypt_fn(*enc_key,
-                             *enc_key_size,
-                             data, data_size, enc_data, enc_data_size))
+  KMYTH_PROBE2(encrypt_data__entry, cipher_spec.cipher_name, data_size);
+
+  int retval;
+
+  if (cipher_spec.ctx != NULL && cipher_spec.encrypt_ctx_fn != NULL)
+  {
+    retval = cipher_spec.encrypt_ctx_fn(cipher_spec.ctx, key, key_size,
+                                        data, data_size,
+                                        enc_data, enc_data_size);
+  }
+  else
+  {
+    retval = cipher_spec.encrypt_fn(key, key_size,
+                                    data, data_size, enc_data, enc_data_size);
+  }
+  KMYTH_PROBE2(encrypt_data__return, retval, *enc_data_size);
+  if (retval)
   {
     return 1;
   }
+  kmyth_metrics_add(KMYTH_METRIC_BYTES_ENCRYPTED, data_size);
 
   return 0;
 }
@@ -207,11 +621,71 @@ int kmyth_decrypt_data(unsigned char *enc_data,
   }
 
   *result_size = 0;
-  if (cipher_spec.decrypt_fn(key, key_size, enc_data,
-                             enc_data_size, result, result_size))
+  KMYTH_PROBE2(decrypt_data__entry, cipher_spec.cipher_name, enc_data_size);
+
+  int retval;
+
+  if (cipher_spec.ctx != NULL && cipher_spec.decrypt_ctx_fn != NULL)
+  {
+    retval = cipher_spec.decrypt_ctx_fn(cipher_spec.ctx, key, key_size,
+                                        enc_data, enc_data_size,
+                                        result, result_size);
+  }
+  else
+  {
+    retval = cipher_spec.decrypt_fn(key, key_size, enc_data,
+                                    enc_data_size, result, result_size);
+  }
+  KMYTH_PROBE2(decrypt_data__return, retval, *result_size);
+  if (retval)
+  {
+    return 1;
+  }
+  kmyth_metrics_add(KMYTH_METRIC_BYTES_DECRYPTED, *result_size);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_data_in_place
+//############################################################################
+int kmyth_decrypt_data_in_place(unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size, size_t * result_size)
+{
+  if (enc_data == NULL || enc_data_size == 0)
+  {
+    return 1;
+  }
+  if (cipher_spec.cipher_name == NULL ||
+      cipher_spec.decrypt_in_place_fn == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
+  {
+    return 1;
+  }
+  if (result_size == NULL)
+  {
+    return 1;
+  }
+
+  *result_size = 0;
+  KMYTH_PROBE2(decrypt_data__entry, cipher_spec.cipher_name, enc_data_size);
+
+  int retval = cipher_spec.decrypt_in_place_fn(cipher_spec.ctx, key, key_size,
+                                               enc_data, enc_data_size,
+                                               result_size);
+
+  KMYTH_PROBE2(decrypt_data__return, retval, *result_size);
+  if (retval)
   {
     return 1;
   }
+  kmyth_metrics_add(KMYTH_METRIC_BYTES_DECRYPTED, *result_size);
 
   return 0;
 }
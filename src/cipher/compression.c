@@ -0,0 +1,591 @@
+/**
+ * @file  compression.c
+ *
+ * @brief Implements the optional compression stage of the seal pipeline
+ *        (zlib deflate).
+ */
+
+#include "cipher/compression.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "defines.h"
+#include "memory_util.h"
+
+// size of the buffers a compression pipe moves data through
+#define COMPRESSION_PIPE_BUF_LEN 65536
+
+// smallest output buffer kmyth_decompress_data() starts with
+#define DECOMPRESS_MIN_BUF_LEN 4096
+
+/**
+ * @brief State of a compression stage (see kmyth_compression_pipe_start()).
+ */
+struct kmyth_compression_pipe
+{
+  kmyth_compression compression;
+  bool compress;
+
+  // the caller's plaintext file, and the caller's end of the pipe
+  FILE *file;
+  FILE *pipe_end;
+
+  // the stage thread's end of the pipe, closed by the thread when done
+  int fd;
+
+  pthread_t thread;
+
+  // 0 once the thread has (de)compressed the whole file
+  int status;
+};
+
+// compression applied to sealed data (see set_compression())
+static kmyth_compression sealed_compression = KMYTH_COMPRESSION_NONE;
+
+int set_compression(kmyth_compression compression)
+{
+  if (kmyth_compression_name(compression) == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid compression algorithm (%d) ... exiting",
+              (int) compression);
+    return 1;
+  }
+  sealed_compression = compression;
+
+  return 0;
+}
+
+kmyth_compression get_compression(void)
+{
+  return sealed_compression;
+}
+
+//############################################################################
+// kmyth_compression_name()
+//############################################################################
+const char *kmyth_compression_name(kmyth_compression compression)
+{
+  switch (compression)
+  {
+  case KMYTH_COMPRESSION_NONE:
+    return KMYTH_COMPRESSION_NONE_NAME;
+  case KMYTH_COMPRESSION_DEFLATE:
+    return KMYTH_COMPRESSION_DEFLATE_NAME;
+  }
+  return NULL;
+}
+
+//############################################################################
+// kmyth_compression_from_name()
+//############################################################################
+int kmyth_compression_from_name(const char *name,
+                                kmyth_compression * compression)
+{
+  if (name == NULL || compression == NULL)
+  {
+    return 1;
+  }
+  if (strcmp(name, KMYTH_COMPRESSION_NONE_NAME) == 0)
+  {
+    *compression = KMYTH_COMPRESSION_NONE;
+    return 0;
+  }
+  if (strcmp(name, KMYTH_COMPRESSION_DEFLATE_NAME) == 0)
+  {
+    *compression = KMYTH_COMPRESSION_DEFLATE;
+    return 0;
+  }
+  return 1;
+}
+
+//############################################################################
+// zlib_step()
+//############################################################################
+/**
+ * @brief Size of the next step of a zlib stream over a buffer, whose
+ *        counts (uInt) may be narrower than size_t.
+ */
+static uInt zlib_step(size_t len)
+{
+  return (len > UINT_MAX) ? UINT_MAX : (uInt) len;
+}
+
+//############################################################################
+// kmyth_compress_data()
+//############################################################################
+int kmyth_compress_data(kmyth_compression compression,
+                        const uint8_t * in, size_t in_len,
+                        uint8_t ** out, size_t *out_len)
+{
+  if (compression != KMYTH_COMPRESSION_DEFLATE ||
+      (in == NULL && in_len > 0) || out == NULL || out_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid compression parameters ... exiting");
+    return 1;
+  }
+
+  z_stream strm;
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    kmyth_log(LOG_ERR, "unable to initialize deflate ... exiting");
+    return 1;
+  }
+
+  // deflate never needs more than its bound, so the output is a single
+  // allocation
+  size_t bound = (size_t) deflateBound(&strm, (uLong) in_len);
+  uint8_t *buf = (bound < in_len) ? NULL : kmyth_malloc(bound);
+
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate compression buffer ... exiting");
+    deflateEnd(&strm);
+    return 1;
+  }
+
+  size_t in_left = in_len;
+  size_t out_left = bound;
+  int rc = Z_OK;
+
+  strm.next_in = (Bytef *) in;
+  strm.next_out = buf;
+  while (rc == Z_OK && out_left > 0)
+  {
+    uInt in_step = zlib_step(in_left);
+    uInt out_step = zlib_step(out_left);
+
+    strm.avail_in = in_step;
+    strm.avail_out = out_step;
+    rc = deflate(&strm, (in_step == in_left) ? Z_FINISH : Z_NO_FLUSH);
+    in_left -= in_step - strm.avail_in;
+    out_left -= out_step - strm.avail_out;
+  }
+  deflateEnd(&strm);
+
+  if (rc != Z_STREAM_END)
+  {
+    kmyth_log(LOG_ERR, "deflate error (%d) ... exiting", rc);
+    kmyth_clear_and_free(buf, bound - out_left);
+    return 1;
+  }
+
+  *out = buf;
+  *out_len = bound - out_left;
+  return 0;
+}
+
+//############################################################################
+// kmyth_decompress_data()
+//############################################################################
+int kmyth_decompress_data(kmyth_compression compression,
+                          const uint8_t * in, size_t in_len,
+                          uint8_t ** out, size_t *out_len)
+{
+  if (compression != KMYTH_COMPRESSION_DEFLATE || in == NULL ||
+      in_len == 0 || out == NULL || out_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid decompression parameters ... exiting");
+    return 1;
+  }
+
+  z_stream strm;
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit(&strm) != Z_OK)
+  {
+    kmyth_log(LOG_ERR, "unable to initialize inflate ... exiting");
+    return 1;
+  }
+
+  // the size of the output is not recorded, so the buffer grows as needed
+  // (copied rather than realloc()ed, so that no stale plaintext is left in
+  // freed memory)
+  size_t cap = (in_len > SIZE_MAX / 4) ? SIZE_MAX : 4 * in_len;
+
+  if (cap < DECOMPRESS_MIN_BUF_LEN)
+  {
+    cap = DECOMPRESS_MIN_BUF_LEN;
+  }
+
+  uint8_t *buf = kmyth_malloc(cap);
+  size_t len = 0;
+  size_t in_left = in_len;
+  int rc = Z_OK;
+
+  strm.next_in = (Bytef *) in;
+  while (buf != NULL)
+  {
+    if (len == cap)
+    {
+      uint8_t *bigger = (cap > SIZE_MAX / 2) ? NULL : kmyth_malloc(2 * cap);
+
+      if (bigger != NULL)
+      {
+        memcpy(bigger, buf, len);
+        cap *= 2;
+      }
+      kmyth_clear_and_free(buf, len);
+      buf = bigger;
+      if (buf == NULL)
+      {
+        break;
+      }
+    }
+
+    uInt in_step = zlib_step(in_left);
+    uInt out_step = zlib_step(cap - len);
+
+    strm.avail_in = in_step;
+    strm.avail_out = out_step;
+    strm.next_out = buf + len;
+    rc = inflate(&strm, Z_NO_FLUSH);
+    in_left -= in_step - strm.avail_in;
+    len += out_step - strm.avail_out;
+
+    // out of input with room left to write means the stream is truncated
+    if (rc == Z_STREAM_END || (rc != Z_OK && rc != Z_BUF_ERROR) ||
+        (in_left == 0 && strm.avail_out > 0))
+    {
+      break;
+    }
+  }
+  inflateEnd(&strm);
+
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate decompression buffer ... exiting");
+    return 1;
+  }
+  if (rc != Z_STREAM_END || in_left != 0)
+  {
+    kmyth_log(LOG_ERR, "invalid compressed data (%d) ... exiting", rc);
+    kmyth_clear_and_free(buf, len);
+    return 1;
+  }
+
+  *out = buf;
+  *out_len = len;
+  return 0;
+}
+
+//############################################################################
+// write_all()
+//############################################################################
+/**
+ * @brief Writes len bytes of buf to fd, retrying short writes.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_all(int fd, const uint8_t * buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    buf += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+//############################################################################
+// compress_pipe()
+//############################################################################
+/**
+ * @brief Compresses the stage's file, read until end of file, into its
+ *        pipe.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int compress_pipe(kmyth_compression_pipe * stage,
+                         uint8_t * in_buf, uint8_t * out_buf)
+{
+  z_stream strm;
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    return 1;
+  }
+
+  int flush = Z_NO_FLUSH;
+  int rc = Z_OK;
+
+  while (flush != Z_FINISH)
+  {
+    size_t n = fread(in_buf, 1, COMPRESSION_PIPE_BUF_LEN, stage->file);
+
+    if (ferror(stage->file))
+    {
+      break;
+    }
+    flush = feof(stage->file) ? Z_FINISH : Z_NO_FLUSH;
+    strm.next_in = in_buf;
+    strm.avail_in = (uInt) n;
+
+    // deflate until it no longer fills the output buffer, which leaves no
+    // input behind
+    do
+    {
+      strm.next_out = out_buf;
+      strm.avail_out = COMPRESSION_PIPE_BUF_LEN;
+      rc = deflate(&strm, flush);
+      if (rc == Z_STREAM_ERROR ||
+          write_all(stage->fd, out_buf,
+                    COMPRESSION_PIPE_BUF_LEN - strm.avail_out))
+      {
+        deflateEnd(&strm);
+        return 1;
+      }
+    }
+    while (strm.avail_out == 0);
+  }
+  deflateEnd(&strm);
+
+  return (rc == Z_STREAM_END) ? 0 : 1;
+}
+
+//############################################################################
+// drain_pipe()
+//############################################################################
+/**
+ * @brief Reads a pipe to its end, discarding the data, so that its writer
+ *        is never blocked (or sent SIGPIPE) once its reader gives up.
+ */
+static void drain_pipe(int fd)
+{
+  uint8_t buf[512];
+  ssize_t n = 0;
+
+  while ((n = read(fd, buf, sizeof(buf))) != 0)
+  {
+    if (n < 0 && errno != EINTR)
+    {
+      break;
+    }
+  }
+}
+
+//############################################################################
+// decompress_pipe()
+//############################################################################
+/**
+ * @brief Decompresses what is written to the stage's pipe into its file.
+ *
+ * @return 0 if exactly one complete compressed stream was written, 1
+ *         otherwise
+ */
+static int decompress_pipe(kmyth_compression_pipe * stage,
+                           uint8_t * in_buf, uint8_t * out_buf)
+{
+  z_stream strm;
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit(&strm) != Z_OK)
+  {
+    return 1;
+  }
+
+  int rc = Z_OK;
+
+  while (rc != Z_STREAM_END)
+  {
+    ssize_t n = read(stage->fd, in_buf, COMPRESSION_PIPE_BUF_LEN);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      break;
+    }
+
+    strm.next_in = in_buf;
+    strm.avail_in = (uInt) n;
+    do
+    {
+      strm.next_out = out_buf;
+      strm.avail_out = COMPRESSION_PIPE_BUF_LEN;
+      rc = inflate(&strm, Z_NO_FLUSH);
+
+      size_t have = COMPRESSION_PIPE_BUF_LEN - strm.avail_out;
+
+      if ((rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) ||
+          fwrite(out_buf, 1, have, stage->file) != have)
+      {
+        inflateEnd(&strm);
+        return 1;
+      }
+    }
+    while (strm.avail_out == 0 && rc != Z_STREAM_END);
+
+    // anything after the end of the stream is an error
+    if (rc == Z_STREAM_END && strm.avail_in > 0)
+    {
+      inflateEnd(&strm);
+      return 1;
+    }
+  }
+  inflateEnd(&strm);
+
+  if (rc != Z_STREAM_END)
+  {
+    return 1;
+  }
+
+  // the end of the stream must also be the end of the pipe
+  ssize_t n = 0;
+
+  do
+  {
+    n = read(stage->fd, in_buf, 1);
+  }
+  while (n < 0 && errno == EINTR);
+
+  return (n == 0) ? 0 : 1;
+}
+
+//############################################################################
+// compression_pipe_thread()
+//############################################################################
+static void *compression_pipe_thread(void *arg)
+{
+  kmyth_compression_pipe *stage = (kmyth_compression_pipe *) arg;
+
+  // a pipe closed early must fail the write, not end the process
+  sigset_t sigpipe;
+
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+  uint8_t *in_buf = kmyth_malloc(COMPRESSION_PIPE_BUF_LEN);
+  uint8_t *out_buf = kmyth_malloc(COMPRESSION_PIPE_BUF_LEN);
+
+  stage->status = 1;
+  if (in_buf != NULL && out_buf != NULL)
+  {
+    stage->status = stage->compress ?
+      compress_pipe(stage, in_buf, out_buf) :
+      decompress_pipe(stage, in_buf, out_buf);
+  }
+  if (!stage->compress)
+  {
+    drain_pipe(stage->fd);
+  }
+
+  // closing the pipe ends the stream for the reader of a compressing stage
+  close(stage->fd);
+  stage->fd = -1;
+
+  kmyth_clear_and_free(in_buf, COMPRESSION_PIPE_BUF_LEN);
+  kmyth_clear_and_free(out_buf, COMPRESSION_PIPE_BUF_LEN);
+  return NULL;
+}
+
+//############################################################################
+// kmyth_compression_pipe_start()
+//############################################################################
+int kmyth_compression_pipe_start(kmyth_compression compression,
+                                 bool compress, FILE * file,
+                                 FILE ** pipe_end,
+                                 kmyth_compression_pipe ** stage)
+{
+  if (compression != KMYTH_COMPRESSION_DEFLATE || file == NULL ||
+      pipe_end == NULL || stage == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid compression pipe parameters ... exiting");
+    return 1;
+  }
+
+  kmyth_compression_pipe *new_stage =
+    kmyth_calloc(1, sizeof(kmyth_compression_pipe));
+  int fds[2];
+
+  if (new_stage == NULL || pipe2(fds, O_CLOEXEC) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to create compression pipe ... exiting");
+    kmyth_free(new_stage);
+    return 1;
+  }
+
+  // the thread writes the pipe when compressing and reads it otherwise
+  int caller_fd = compress ? fds[0] : fds[1];
+
+  new_stage->compression = compression;
+  new_stage->compress = compress;
+  new_stage->file = file;
+  new_stage->fd = compress ? fds[1] : fds[0];
+  new_stage->pipe_end = fdopen(caller_fd, compress ? "rb" : "wb");
+  if (new_stage->pipe_end == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to create compression pipe ... exiting");
+    close(fds[0]);
+    close(fds[1]);
+    kmyth_free(new_stage);
+    return 1;
+  }
+
+  if (pthread_create(&new_stage->thread, NULL, compression_pipe_thread,
+                     new_stage) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to start compression thread ... exiting");
+    fclose(new_stage->pipe_end);
+    close(new_stage->fd);
+    kmyth_free(new_stage);
+    return 1;
+  }
+
+  *pipe_end = new_stage->pipe_end;
+  *stage = new_stage;
+  return 0;
+}
+
+//############################################################################
+// kmyth_compression_pipe_finish()
+//############################################################################
+int kmyth_compression_pipe_finish(kmyth_compression_pipe ** stage)
+{
+  if (stage == NULL || *stage == NULL)
+  {
+    return 1;
+  }
+
+  kmyth_compression_pipe *s = *stage;
+
+  // closing the caller's end flushes what is left and ends the stream of a
+  // decompressing stage, or fails the remaining writes of a compressing one
+  int retval = (fclose(s->pipe_end) != 0);
+
+  pthread_join(s->thread, NULL);
+  if (s->status)
+  {
+    kmyth_log(LOG_ERR, "%s error ... exiting",
+              s->compress ? "compression" : "decompression");
+    retval = 1;
+  }
+
+  kmyth_free(s);
+  *stage = NULL;
+  return retval;
+}
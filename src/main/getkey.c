@@ -7,10 +7,20 @@
  * memory, to establish a connection to a key server.
  */
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
 
 #include <openssl/bio.h>
+#include <openssl/evp.h>
 #include <openssl/ssl.h>
 
 #include "defines.h"
@@ -18,8 +28,17 @@
 #include "kmyth.h"
 #include "kmyth_log.h"
 #include "memory_util.h"
+#include "metrics.h"
+#include "tpm2_interface.h"
 #include "tls_util.h"
 
+// key cache record (see load_key_cache()): magic, version, fetch time,
+// lifetime and request identity (a SHA-256 digest), then the key
+#define KMYTH_KEY_CACHE_MAGIC "KGKC"
+#define KMYTH_KEY_CACHE_VERSION 1
+#define KMYTH_KEY_CACHE_ID_LEN 32
+#define KMYTH_KEY_CACHE_HEADER_LEN (4 + 1 + 8 + 4 + KMYTH_KEY_CACHE_ID_LEN)
+
 static void usage(const char *prog)
 {
   fprintf(stdout,
@@ -33,16 +52,43 @@ static void usage(const char *prog)
           "                        Defaults to 'simple'.\n"
           "  -s or --server        Path to file containing the certificate\n"
           "                        for the CA that issued the server cert.\n"
-          "  -c or --conn_addr     The ip_address:port for the TLS connection.\n"
-          "  -m or --message       An optional message to send the key server.\n\n"
+          "  -c or --conn_addr     The ip_address:port for the TLS connection, or a comma-separated list of\n"
+          "                        equivalent key servers: connections to them are started %dms apart\n"
+          "                        and raced, the first server to answer is used, and if it can't\n"
+          "                        provide the key the others are tried.\n"
+          "  -m or --message       An optional message to send the key server. For a KMIP server, the ID of\n"
+          "                        the key to get, or a comma-separated list of IDs to get in one request\n"
+          "                        (each key is then output on a line of its own, as '<ID> <hex key>').\n"
+          "  -r or --session_cache File in which to keep TLS sessions, so later runs resume them with an\n"
+          "                        abbreviated handshake (encrypted under a key derived from the client's\n"
+          "                        private key). Defaults to $%s, else none.\n\n"
           "Output Parameters --\n"
-          "  -o or --output        Output file path to write the key. If none is selected, key will be sent to stdout.\n\n"
+          "  -o or --output        Output file path to write the key. If none is selected, key will be sent to stdout.\n"
+          "        --exec          Run this shell command with the key on a descriptor (see --fd) instead of\n"
+          "                        writing it out. The key is held in a sealed (read-only) memory file, never on\n"
+          "                        a filesystem; $%s names the descriptor, and the command's exit status is returned.\n"
+          "        --fd            Descriptor the --exec command reads the key from (defaults to %d), or, without\n"
+          "                        --exec, an open descriptor to write the key to.\n\n"
+          "Key Cache --\n"
+          "        --key_cache     File in which to keep the key, sealed to the local TPM (with -a and -w), so\n"
+          "                        later runs making the same request get it without contacting a server.\n"
+          "                        Once half its lifetime has passed, a cached key is also refreshed from the\n"
+          "                        server in the background. Defaults to $%s, else none.\n"
+          "        --key_cache_ttl Lifetime (seconds) of a cached key. Defaults to %d.\n\n"
           "Sealed Key Parameters --\n"
           "  -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest)\n"
           "  -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n\n"
           "Misc --\n"
+          "  -T or --tcti          TPM connection: auto, device[:path], abrmd, mssim[:conf] or swtpm[:conf].\n"
+          "                        Defaults to $%s, else '%s'.\n"
+          "  -x or --trace_file    Append the timing of each step (OpenTelemetry JSON) to this file.\n"
+          "        --stats         Print per-command TPM latency statistics and Kmyth metrics\n"
+          "                        (TLS handshake time, TPM errors by response code, ...) to stderr on exit.\n"
           "  -v or --verbose       Detailed logging mode to help with debugging.\n"
-          "  -h or --help          Help (displays this usage).\n\n", prog);
+          "  -h or --help          Help (displays this usage).\n\n", prog,
+          KMYTH_TLS_CONNECT_STAGGER_MS, KMYTH_TLS_SESSION_CACHE_ENV,
+          KMYTH_EXEC_FD_ENV, KMYTH_EXEC_DEFAULT_FD, KMYTH_KEY_CACHE_ENV,
+          KMYTH_KEY_CACHE_DEFAULT_TTL, KMYTH_TCTI_ENV, KMYTH_DEFAULT_TCTI);
 }
 
 int check_string_arg(const char *arg, size_t arg_len,
@@ -64,17 +110,550 @@ const struct option longopts[] = {
   {"server", required_argument, 0, 's'},
   {"conn_addr", required_argument, 0, 'c'},
   {"message", required_argument, 0, 'm'},
+  {"session_cache", required_argument, 0, 'r'},
   // Output info
   {"output", required_argument, 0, 'o'},
+  {"exec", required_argument, 0, KMYTH_EXEC_OPTION},
+  {"fd", required_argument, 0, KMYTH_FD_OPTION},
+  // Key cache
+  {"key_cache", required_argument, 0, KMYTH_KEY_CACHE_OPTION},
+  {"key_cache_ttl", required_argument, 0, KMYTH_KEY_CACHE_TTL_OPTION},
   // Sealed Key info
   {"auth_string", required_argument, 0, 'a'},
   {"owner_auth", required_argument, 0, 'w'},
   // Misc
+  {"tcti", required_argument, 0, 'T'},
+  {"trace_file", required_argument, 0, 'x'},
+  {"stats", no_argument, 0, KMYTH_STATS_OPTION},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
 };
 
+//############################################################################
+// format_key_results()
+//############################################################################
+/**
+ * @brief Formats the keys from a KMIP batch Get, one "<ID> <hex key>" line
+ *        per key, in the order they were requested.
+ *
+ * @return 0 on success, 1 if a key is missing (or on error)
+ */
+static int format_key_results(kmip_key_result * results, size_t count,
+                              unsigned char **out, size_t *out_len)
+{
+  size_t len = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (results[i].key == NULL)
+    {
+      kmyth_log(LOG_ERR, "key %zu of %zu was not returned ... exiting",
+                i + 1, count);
+      return 1;
+    }
+    len += results[i].id_len + 1 + 2 * results[i].key_len + 1;
+  }
+
+  *out = malloc(len + 1);
+  if (*out == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating key output buffer ... exiting");
+    return 1;
+  }
+
+  char *pos = (char *) *out;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    memcpy(pos, results[i].id, results[i].id_len);
+    pos += results[i].id_len;
+    *pos++ = ' ';
+    for (size_t j = 0; j < results[i].key_len; j++)
+    {
+      pos += sprintf(pos, "%02x", results[i].key[j]);
+    }
+    *pos++ = '\n';
+  }
+  *out_len = len;
+  return 0;
+}
+
+//############################################################################
+// split_list()
+//############################################################################
+/**
+ * @brief Splits a comma-separated list (in place) into its items.
+ *
+ * @return 0 on success, 1 if the list is empty or too long (or on error)
+ */
+static int split_list(char *list, size_t max_items,
+                      char **items, size_t *item_count)
+{
+  char *save = NULL;
+
+  *item_count = 0;
+  for (char *item = strtok_r(list, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save))
+  {
+    if (*item_count == max_items)
+    {
+      kmyth_log(LOG_ERR, "more than %zu items in list ... exiting",
+                max_items);
+      return 1;
+    }
+    items[(*item_count)++] = item;
+  }
+  return (*item_count == 0);
+}
+
+//############################################################################
+// get_key_from_server()
+//############################################################################
+/**
+ * @brief Retrieves the key (or, given several key IDs, the keys) from a
+ *        connected key server.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int get_key_from_server(BIO * bio, int kmip,
+                               char *message, size_t message_length,
+                               unsigned char **ids, size_t *id_lens,
+                               size_t id_count,
+                               unsigned char **key, size_t *key_size)
+{
+  if (kmip && id_count > 1)
+  {
+    // several key IDs: get them all in one request
+    kmip_key_result *results = NULL;
+
+    if (get_keys_from_kmip_server(bio, ids, id_lens, id_count, &results))
+    {
+      return 1;
+    }
+
+    int result = format_key_results(results, id_count, key, key_size);
+
+    free_kmip_key_results(results, id_count);
+    return result;
+  }
+  if (kmip && id_count == 1)
+  {
+    return get_key_from_kmip_server(bio, (char *) ids[0], id_lens[0],
+                                    key, key_size);
+  }
+  if (kmip)
+  {
+    return get_key_from_kmip_server(bio, message, message_length,
+                                    key, key_size);
+  }
+
+  // The "simple" key server is the default.
+  return get_resp_from_tls_server(bio, message, message_length,
+                                  key, key_size);
+}
+
+//############################################################################
+// unseal_client_key()
+//############################################################################
+/**
+ * @brief The unsealing of the client's private key, which runs in a thread
+ *        of its own while the main thread connects to the key server.
+ */
+typedef struct unseal_job
+{
+  pthread_t thread;
+  kmyth_log_span *parent_span;
+
+  // in
+  char *in_path;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+
+  // out (session_cache_path is set to NULL if the cache can't be used)
+  tls_deferred_key *client_key;
+  char *session_cache_path;
+  unsigned char session_cache_key[TLS_SESSION_CACHE_KEY_LEN];
+  int result;
+} unseal_job;
+
+static void *unseal_client_key(void *arg)
+{
+  unseal_job *job = (unseal_job *) arg;
+  kmyth_log_span span;
+
+  kmyth_log_span_begin_child(&span, "unseal_client_key", job->parent_span);
+
+  // Use kmyth-unseal to recover the Client Authentication Private Key (CAPK)
+  uint8_t *clientPrivateKey_data = NULL;
+  size_t clientPrivateKey_size = 0;
+
+  // use bool_policy_or = 1 to unseal objects that are sealed with a compound "policy or" policy
+  uint8_t bool_policy_or = 0;
+
+  job->result = tpm2_kmyth_unseal_file(job->in_path,
+                                       &clientPrivateKey_data,
+                                       &clientPrivateKey_size,
+                                       job->auth_bytes, job->auth_bytes_len,
+                                       job->owner_auth_bytes,
+                                       job->oa_bytes_len, bool_policy_or);
+  if (job->result)
+  {
+    kmyth_log(LOG_ERR, "Unable to unseal the certificate's private key.");
+    kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+    tls_deferred_key_set(job->client_key, NULL, 0);
+    kmyth_log_span_end(&span, 1);
+    return NULL;
+  }
+
+  // Pick up the TLS sessions earlier runs saved before handing over the
+  // key, so the handshakes can resume one (a cache that can't be read just
+  // means a full handshake)
+  if (job->session_cache_path != NULL)
+  {
+    if (tls_derive_session_cache_key(clientPrivateKey_data,
+                                     clientPrivateKey_size,
+                                     job->session_cache_key))
+    {
+      kmyth_log(LOG_WARNING, "TLS session cache disabled");
+      job->session_cache_path = NULL;
+    }
+    else if (tls_load_session_cache(job->session_cache_path,
+                                    job->session_cache_key))
+    {
+      kmyth_log(LOG_WARNING, "not resuming a saved TLS session");
+    }
+  }
+
+  tls_deferred_key_set(job->client_key, clientPrivateKey_data,
+                       clientPrivateKey_size);
+
+  // Done with unsealed key buffer, so clear and free this memory
+  kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+  kmyth_log_span_end(&span, 0);
+  return NULL;
+}
+
+//############################################################################
+// key_cache_id()
+//############################################################################
+/**
+ * @brief Computes the identity of a key request (server type, servers and
+ *        message), so that a cached key is only used for the request that
+ *        fetched it.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int key_cache_id(const char *server_type, const char *address,
+                        const char *message,
+                        unsigned char id[KMYTH_KEY_CACHE_ID_LEN])
+{
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+  const char *parts[] = { server_type, address,
+    (message == NULL) ? "" : message
+  };
+  int result = (md_ctx == NULL ||
+                EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) != 1);
+
+  // each part goes in with its terminating NUL, so parts can't run together
+  for (size_t i = 0; result == 0 && i < 3; i++)
+  {
+    result = (EVP_DigestUpdate(md_ctx, parts[i], strlen(parts[i]) + 1) != 1);
+  }
+  if (result == 0)
+  {
+    result = (EVP_DigestFinal_ex(md_ctx, id, NULL) != 1);
+  }
+  EVP_MD_CTX_free(md_ctx);
+
+  return result;
+}
+
+//############################################################################
+// load_key_cache()
+//############################################################################
+/**
+ * @brief Unseals the key cache file and returns the key in it, if it was
+ *        fetched for the same request and has not expired.
+ *
+ * @param[out] stale   Set if over half of the key's lifetime has passed
+ *
+ * @return 0 on success, 1 if there is no usable key in the cache
+ */
+static int load_key_cache(char *path, const unsigned char *id,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                          unsigned char **key, size_t *key_size,
+                          bool *stale)
+{
+  uint8_t *record = NULL;
+  size_t record_len = 0;
+
+  // no cache file yet is the normal first run, not worth a warning
+  if (access(path, F_OK) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "no key cache (%s) yet", path);
+    return 1;
+  }
+  if (tpm2_kmyth_unseal_file(path, &record, &record_len, auth_bytes,
+                             auth_bytes_len, owner_auth_bytes, oa_bytes_len,
+                             0))
+  {
+    kmyth_log(LOG_WARNING, "unable to unseal the key cache (%s)", path);
+    return 1;
+  }
+
+  // record: magic, version, fetch time (seconds since the epoch), lifetime
+  // (seconds), request identity and key, numbers in network byte order
+  if (record_len <= KMYTH_KEY_CACHE_HEADER_LEN ||
+      memcmp(record, KMYTH_KEY_CACHE_MAGIC, 4) != 0 ||
+      record[4] != KMYTH_KEY_CACHE_VERSION)
+  {
+    kmyth_log(LOG_WARNING, "invalid key cache (%s)", path);
+    kmyth_clear_and_free(record, record_len);
+    return 1;
+  }
+
+  uint64_t fetched = 0;
+  uint32_t ttl = 0;
+
+  for (size_t i = 0; i < 8; i++)
+  {
+    fetched = (fetched << 8) | record[5 + i];
+  }
+  for (size_t i = 0; i < 4; i++)
+  {
+    ttl = (ttl << 8) | record[13 + i];
+  }
+
+  uint64_t now = (uint64_t) time(NULL);
+
+  if (memcmp(record + 17, id, KMYTH_KEY_CACHE_ID_LEN) != 0)
+  {
+    kmyth_log(LOG_INFO, "cached key was fetched for another request");
+    kmyth_clear_and_free(record, record_len);
+    return 1;
+  }
+
+  // a clock set back past the fetch time does not extend the lifetime
+  if (now < fetched || now - fetched >= ttl)
+  {
+    kmyth_log(LOG_INFO, "cached key has expired");
+    kmyth_clear_and_free(record, record_len);
+    return 1;
+  }
+
+  *key_size = record_len - KMYTH_KEY_CACHE_HEADER_LEN;
+  *key = malloc(*key_size);
+  if (*key == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating cached key buffer");
+    kmyth_clear_and_free(record, record_len);
+    *key_size = 0;
+    return 1;
+  }
+  memcpy(*key, record + KMYTH_KEY_CACHE_HEADER_LEN, *key_size);
+  kmyth_clear_and_free(record, record_len);
+  *stale = (now - fetched >= ttl / 2);
+
+  return 0;
+}
+
+//############################################################################
+// save_key_cache()
+//############################################################################
+/**
+ * @brief Seals a freshly fetched key, with its request identity and
+ *        lifetime, to the local TPM and replaces the key cache file with
+ *        the result.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int save_key_cache(char *path, const unsigned char *id,
+                          uint32_t ttl, unsigned char *key, size_t key_size,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  size_t record_len = KMYTH_KEY_CACHE_HEADER_LEN + key_size;
+  uint8_t *record = malloc(record_len);
+
+  if (record == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating key cache record");
+    return 1;
+  }
+
+  uint64_t fetched = (uint64_t) time(NULL);
+
+  memcpy(record, KMYTH_KEY_CACHE_MAGIC, 4);
+  record[4] = KMYTH_KEY_CACHE_VERSION;
+  for (size_t i = 0; i < 8; i++)
+  {
+    record[5 + i] = (uint8_t) (fetched >> (56 - 8 * i));
+  }
+  for (size_t i = 0; i < 4; i++)
+  {
+    record[13 + i] = (uint8_t) (ttl >> (24 - 8 * i));
+  }
+  memcpy(record + 17, id, KMYTH_KEY_CACHE_ID_LEN);
+  memcpy(record + KMYTH_KEY_CACHE_HEADER_LEN, key, key_size);
+
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  int result = tpm2_kmyth_seal(record, record_len, &sealed, &sealed_len,
+                               auth_bytes, auth_bytes_len,
+                               owner_auth_bytes, oa_bytes_len,
+                               NULL, 0, NULL, NULL, 0);
+
+  kmyth_clear_and_free(record, record_len);
+  if (result == 0)
+  {
+    result = write_bytes_to_file_atomic(path, sealed, sealed_len);
+  }
+  kmyth_free(sealed);
+
+  return result;
+}
+
+//############################################################################
+// start_background_refresh()
+//############################################################################
+/**
+ * @brief Starts a detached process to refresh the key cache from the key
+ *        server. The process is fully detached (it is not this process's
+ *        child, and holds none of its output), so that neither this run
+ *        nor whoever reads its output waits for the refresh.
+ *
+ * @return true in the detached process, which is to fetch the key and
+ *         update the cache, false in the calling one
+ */
+static bool start_background_refresh(int outFd, int memFd)
+{
+  pid_t pid = fork();
+
+  if (pid < 0)
+  {
+    kmyth_log(LOG_WARNING, "unable to start refreshing the key cache");
+    return false;
+  }
+  if (pid > 0)
+  {
+    waitpid(pid, NULL, 0);
+    return false;
+  }
+
+  // the intermediate child exits at once, leaving the refresh to init
+  if (fork() != 0)
+  {
+    _exit(0);
+  }
+  setsid();
+
+  int nullFd = open("/dev/null", O_RDWR);
+
+  if (nullFd >= 0)
+  {
+    dup2(nullFd, STDIN_FILENO);
+    dup2(nullFd, STDOUT_FILENO);
+    dup2(nullFd, STDERR_FILENO);
+    if (nullFd > STDERR_FILENO)
+    {
+      close(nullFd);
+    }
+  }
+  if (outFd > STDERR_FILENO)
+  {
+    close(outFd);
+  }
+  if (memFd >= 0)
+  {
+    close(memFd);
+  }
+
+  return true;
+}
+
+//############################################################################
+// hand_over_key()
+//############################################################################
+/**
+ * @brief Sends the key where it was asked for: a sealed memory file for
+ *        the --exec command (returned in memFd), a descriptor, stdout or a
+ *        file.
+ */
+static void hand_over_key(unsigned char *key, size_t key_size,
+                          char *execCommand, int outFd, char *outPath,
+                          int *memFd)
+{
+  // A command reads the key from a sealed memory file, which is filled
+  // now so that no copy of the key is left here while the command runs
+  if (execCommand != NULL)
+  {
+    if (write_bytes_to_memfd(KMYTH_APP_NAME, key, key_size, memFd))
+    {
+      kmyth_log(LOG_ERR, "error handing the key to the command");
+    }
+  }
+  else if (outFd >= 0)
+  {
+    if (write_bytes_to_fd(outFd, key, key_size))
+    {
+      kmyth_log(LOG_ERR, "error writing to descriptor %d", outFd);
+    }
+  }
+  else if (outPath == NULL)
+  {
+    if (print_to_stdout(key, key_size) != 0)
+    {
+      kmyth_log(LOG_ERR, "error printing to stdout ... exiting");
+    }
+  }
+  else
+  {
+    if (write_bytes_to_file(outPath, key, key_size))
+    {
+      kmyth_log(LOG_ERR, "Error writing file: %s", outPath);
+    }
+  }
+}
+
+//############################################################################
+// run_key_command()
+//############################################################################
+/**
+ * @brief Runs the --exec command with the key on its descriptor.
+ *
+ * @return The command's exit status (1 if it could not be run)
+ */
+static int run_key_command(char *execCommand, int memFd, int outFd)
+{
+  int status = 1;
+
+  if (memFd >= 0)
+  {
+    if (run_with_fd(execCommand, memFd,
+                    (outFd < 0) ? KMYTH_EXEC_DEFAULT_FD : outFd,
+                    KMYTH_EXEC_FD_ENV, &status))
+    {
+      kmyth_log(LOG_ERR, "error running command: %s", execCommand);
+      status = 1;
+    }
+    close(memFd);
+  }
+  return status;
+}
+
+//############################################################################
+// print_stats_at_exit()
+//############################################################################
+static void print_stats_at_exit(void)
+{
+  print_tpm_stats(stderr);
+  kmyth_metrics_print_summary(stderr);
+}
+
 int main(int argc, char **argv)
 {
   // Exit early if there are no arguments
@@ -92,11 +671,16 @@ int main(int argc, char **argv)
   // Info passed through command line inputs
   char *inPath = NULL;
   char *outPath = NULL;
+  char *execCommand = NULL;
+  int outFd = -1;
   char *clientCertPath = NULL;
   char *serverType = "simple";
   char *serverCertPath = NULL;
   char *address = NULL;
   char *message = NULL;
+  char *sessionCachePath = getenv(KMYTH_TLS_SESSION_CACHE_ENV);
+  char *keyCachePath = getenv(KMYTH_KEY_CACHE_ENV);
+  unsigned long keyCacheTtl = KMYTH_KEY_CACHE_DEFAULT_TTL;
   char *authString = NULL;
   char *ownerAuthPasswd = "";
 
@@ -104,7 +688,7 @@ int main(int argc, char **argv)
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "i:l:t:s:c:m:o:a:w:vh", longopts,
+          getopt_long(argc, argv, "i:l:t:s:c:m:r:o:a:w:T:x:vh", longopts,
                       &option_index)) != -1)
     switch (options)
     {
@@ -129,11 +713,49 @@ int main(int argc, char **argv)
     case 'm':
       message = optarg;
       break;
+    case 'r':
+      sessionCachePath = optarg;
+      break;
 
       // Output info
     case 'o':
       outPath = optarg;
       break;
+    case KMYTH_EXEC_OPTION:
+      execCommand = optarg;
+      break;
+    case KMYTH_FD_OPTION:
+      {
+        char *end = NULL;
+        long fd = strtol(optarg, &end, 10);
+
+        if (end == optarg || *end != '\0' || fd < 0 || fd > INT_MAX)
+        {
+          kmyth_log(LOG_ERR, "invalid descriptor (%s) ... exiting", optarg);
+          return 1;
+        }
+        outFd = (int) fd;
+      }
+      break;
+
+      // Key cache
+    case KMYTH_KEY_CACHE_OPTION:
+      keyCachePath = optarg;
+      break;
+    case KMYTH_KEY_CACHE_TTL_OPTION:
+      {
+        char *end = NULL;
+
+        keyCacheTtl = strtoul(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || keyCacheTtl == 0 ||
+            keyCacheTtl > UINT32_MAX)
+        {
+          kmyth_log(LOG_ERR, "invalid key cache lifetime (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+      }
+      break;
 
       // Sealed Key info
     case 'a':
@@ -144,6 +766,23 @@ int main(int argc, char **argv)
       break;
 
       // Misc
+    case 'T':
+      if (set_tcti_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'x':
+      if (kmyth_log_set_span_export_path(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_STATS_OPTION:
+      set_tpm_stats(true);
+      kmyth_alloc_stats_enable(true);
+      atexit(print_stats_at_exit);
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -157,6 +796,17 @@ int main(int argc, char **argv)
       return 1;
     }
 
+  // an empty $KMYTH_TLS_SESSION_CACHE turns the session cache off, and
+  // likewise for $KMYTH_KEY_CACHE
+  if (sessionCachePath != NULL && sessionCachePath[0] == '\0')
+  {
+    sessionCachePath = NULL;
+  }
+  if (keyCachePath != NULL && keyCachePath[0] == '\0')
+  {
+    keyCachePath = NULL;
+  }
+
   //Since these originate in main() we know they are null terminated
   size_t auth_string_len = (authString == NULL) ? 0 : strlen(authString);
   size_t oa_passwd_len =
@@ -192,6 +842,16 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  // The key goes to exactly one place: a file, stdout, a command (--exec)
+  // or a descriptor (--fd)
+  if (outPath != NULL && (execCommand != NULL || outFd >= 0))
+  {
+    kmyth_log(LOG_ERR, "--exec and --fd cannot be used with -o ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
   // If configured to write to an output file, verify that path
   if (outPath != NULL)
   {
@@ -238,6 +898,49 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  // A key cached for this same request saves contacting a server at all;
+  // once it is getting old, a detached copy of this run refreshes it
+  unsigned char keyCacheId[KMYTH_KEY_CACHE_ID_LEN];
+  bool refreshOnly = false;
+
+  if (keyCachePath != NULL &&
+      key_cache_id(serverType, address, message, keyCacheId))
+  {
+    kmyth_log(LOG_WARNING, "key cache disabled");
+    keyCachePath = NULL;
+  }
+  if (keyCachePath != NULL)
+  {
+    unsigned char *cachedKey = NULL;
+    size_t cachedKey_size = 0;
+    bool stale = false;
+
+    if (load_key_cache(keyCachePath, keyCacheId, (uint8_t *) authString,
+                       auth_string_len, (uint8_t *) ownerAuthPasswd,
+                       oa_passwd_len, &cachedKey, &cachedKey_size,
+                       &stale) == 0)
+    {
+      int memFd = -1;
+
+      hand_over_key(cachedKey, cachedKey_size, execCommand, outFd, outPath,
+                    &memFd);
+      kmyth_clear_and_free(cachedKey, cachedKey_size);
+      kmyth_log(LOG_INFO, "retrieved key from key cache %s", keyCachePath);
+
+      if (stale && start_background_refresh(outFd, memFd))
+      {
+        refreshOnly = true;
+      }
+      else
+      {
+        kmyth_clear(authString, auth_string_len);
+        kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+        return (execCommand != NULL) ?
+          run_key_command(execCommand, memFd, outFd) : 0;
+      }
+    }
+  }
+
   // Compute size of user-specified optional message parameter
   size_t message_length = 0;
 
@@ -246,109 +949,169 @@ int main(int argc, char **argv)
     message_length = strlen(message);
   }
 
-  // Use kmyth-unseal to recover the Client Authentication Private Key (CAPK)
-  char *sdo_orig_fn = NULL;
-  uint8_t *clientPrivateKey_data = NULL;
-  size_t clientPrivateKey_size = 0;
+  // Split the server list and (for a KMIP server) the key ID list
+  char *servers[KMYTH_GETKEY_MAX_SERVERS];
+  size_t server_count = 0;
 
-  // use bool_policy_or = 1 to unseal objects that are sealed with a compound "policy or" policy
-  uint8_t bool_policy_or = 0;
-
-  if (tpm2_kmyth_unseal_file(inPath,
-                             &clientPrivateKey_data, &clientPrivateKey_size,
-                             (uint8_t *) authString, auth_string_len,
-                             (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                             bool_policy_or))
+  if (split_list(address, KMYTH_GETKEY_MAX_SERVERS, servers, &server_count))
   {
-    kmyth_log(LOG_ERR, "Unable to unseal the certificate's private key.");
-    kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
-    free(sdo_orig_fn);
+    kmyth_log(LOG_ERR, "invalid server address list ... exiting");
     kmyth_clear(authString, auth_string_len);
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
   }
 
-  free(sdo_orig_fn);
+  int kmip = check_string_arg(serverType, serverTypeLen, "kmip",
+                              strlen("kmip"));
+  unsigned char *ids[KMYTH_KMIP_MAX_BATCH_COUNT];
+  size_t id_lens[KMYTH_KMIP_MAX_BATCH_COUNT];
+  size_t id_count = 0;
 
-  // We no longer need authString and ownerAuthPasswd, so clear them
-  kmyth_clear(authString, auth_string_len);
-  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+  if (kmip && message != NULL)
+  {
+    if (split_list(message, KMYTH_KMIP_MAX_BATCH_COUNT, (char **) ids,
+                   &id_count))
+    {
+      kmyth_log(LOG_ERR, "invalid key ID list ... exiting");
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      return 1;
+    }
+    for (size_t i = 0; i < id_count; i++)
+    {
+      id_lens[i] = strlen((char *) ids[i]);
+    }
+  }
 
-  // Create TLS connection to the key server, using the CAPK
-  BIO *bio = NULL;
-  SSL_CTX *ctx = NULL;
+  // The steps below (unseal, TLS connection, key request) are spans of
+  // this one, so their log entries and timings can be tied to this run
+  kmyth_log_span span;
+
+  kmyth_log_span_begin(&span, "kmyth-getkey");
+
+  // The TPM unseals the Client Authentication Private Key (CAPK) while the
+  // key servers' names are looked up, TCP connections made and certificates
+  // loaded; the TLS handshakes start once the key is available.
+  unseal_job unseal = {
+    .parent_span = &span,
+    .in_path = inPath,
+    .auth_bytes = (uint8_t *) authString,
+    .auth_bytes_len = auth_string_len,
+    .owner_auth_bytes = (uint8_t *) ownerAuthPasswd,
+    .oa_bytes_len = oa_passwd_len,
+    .client_key = tls_deferred_key_new(),
+    .session_cache_path = sessionCachePath,
+    .result = 1
+  };
 
-  if (create_tls_connection(&address,
-                            clientPrivateKey_data,
-                            clientPrivateKey_size,
-                            clientCertPath, serverCertPath, &bio, &ctx) == 1)
+  if (unseal.client_key == NULL
+      || pthread_create(&unseal.thread, NULL, unseal_client_key, &unseal))
   {
-    kmyth_log(LOG_ERR, "error creating TLS connection ... exiting");
-    BIO_ssl_shutdown(bio);
-    tls_cleanup();
-    BIO_free_all(bio);
-    SSL_CTX_free(ctx);
-    kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+    kmyth_log(LOG_ERR, "error starting to unseal the client key ... exiting");
+    tls_deferred_key_free(unseal.client_key);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    kmyth_log_span_end(&span, 1);
     return 1;
   }
 
-  // Done with unsealed key buffer, so clear and free this memory
-  kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
-
-  // Now that we have a secure connection to the key server, retrieve the key
+  // Connect to the first of the key servers to answer and retrieve the
+  // key. If that server can't provide it, race the rest.
+  BIO *bio = NULL;
+  SSL_CTX *ctx = NULL;
   size_t key_size = 0;
   unsigned char *key = NULL;
+  char *server = NULL;
 
   int server_result = 1;
 
-  if (check_string_arg(serverType, serverTypeLen, "kmip", strlen("kmip")))
+  while (server_result && server_count > 0)
   {
-    server_result = get_key_from_kmip_server(bio,
-                                             message, message_length,
-                                             &key, &key_size);
+    size_t winner = 0;
+
+    if (create_tls_connection_race_deferred(servers, server_count,
+                                            unseal.client_key,
+                                            clientCertPath, serverCertPath,
+                                            KMYTH_TLS_CONNECT_STAGGER_MS,
+                                            &bio, &ctx, &winner))
+    {
+      kmyth_log(LOG_ERR, "error creating TLS connection ... exiting");
+      SSL_CTX_free(ctx);
+      ctx = NULL;
+      break;
+    }
+
+    server = servers[winner];
+    server_result = get_key_from_server(bio, kmip, message, message_length,
+                                        ids, id_lens, id_count,
+                                        &key, &key_size);
+    if (server_result)
+    {
+      kmyth_log(LOG_WARNING, "error obtaining key from %s", server);
+      BIO_ssl_shutdown(bio);
+      BIO_free_all(bio);
+      bio = NULL;
+      SSL_CTX_free(ctx);
+      ctx = NULL;
+      kmyth_clear_and_free(key, key_size);
+      key = NULL;
+      key_size = 0;
+
+      // try the other servers
+      memmove(&servers[winner], &servers[winner + 1],
+              (server_count - winner - 1) * sizeof(char *));
+      server_count--;
+    }
   }
-  else
+
+  // The unseal is over (the connection needed its result) unless every
+  // server failed first; either way, wait for it before clearing its inputs
+  pthread_join(unseal.thread, NULL);
+  tls_deferred_key_free(unseal.client_key);
+  sessionCachePath = unseal.session_cache_path;
+
+  // A refresh only updates the cache; otherwise the key is handed over
+  // first, so that sealing it to the TPM does not delay whoever waits
+  int memFd = -1;
+
+  if (server_result == 0 && !refreshOnly)
+  {
+    hand_over_key(key, key_size, execCommand, outFd, outPath, &memFd);
+  }
+  if (server_result == 0 && keyCachePath != NULL &&
+      save_key_cache(keyCachePath, keyCacheId, (uint32_t) keyCacheTtl, key,
+                     key_size, (uint8_t *) authString, auth_string_len,
+                     (uint8_t *) ownerAuthPasswd, oa_passwd_len))
   {
-    // The "simple" key server is the default.
-    server_result = get_resp_from_tls_server(bio,
-                                             message, message_length,
-                                             &key, &key_size);
+    kmyth_log(LOG_WARNING, "error saving key cache %s", keyCachePath);
   }
+  kmyth_clear(authString, auth_string_len);
+  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+
+  unsigned char *sessionCacheKey = unseal.session_cache_key;
 
   if (server_result)
   {
     kmyth_log(LOG_ERR, "error obtaining key from server ... exiting");
-    BIO_ssl_shutdown(bio);
     tls_cleanup();
-    if (BIO_reset(bio) != 0)
-    {
-      kmyth_log(LOG_ERR, "error resetting TLS BIO");
-    }
-    BIO_free_all(bio);
-    SSL_CTX_free(ctx);
-    kmyth_clear_and_free(key, key_size);
+    kmyth_clear(sessionCacheKey, TLS_SESSION_CACHE_KEY_LEN);
+    kmyth_log_span_end(&span, 1);
     return 1;
   }
 
-  if (outPath == NULL)
-  {
-    if (print_to_stdout(key, key_size) != 0)
-    {
-      kmyth_log(LOG_ERR, "error printing to stdout ... exiting");
-    }
-  }
-  else
+  // Save the session (or TLS 1.3 ticket, which arrives with the response)
+  // for the next run
+  if (sessionCachePath != NULL &&
+      tls_save_session_cache(sessionCachePath, sessionCacheKey))
   {
-    if (write_bytes_to_file(outPath, key, key_size))
-    {
-      kmyth_log(LOG_ERR, "Error writing file: %s", outPath);
-    }
+    kmyth_log(LOG_WARNING, "error saving TLS session cache");
   }
+  kmyth_clear(sessionCacheKey, TLS_SESSION_CACHE_KEY_LEN);
 
   // Done with memory holding key, clear and free it
   kmyth_clear_and_free(key, key_size);
 
-  kmyth_log(LOG_INFO, "retrieved key from %s", address);
+  kmyth_log(LOG_INFO, "retrieved key from %s", server);
 
   // Cleanup TLS connection
   BIO_ssl_shutdown(bio);
@@ -358,6 +1121,14 @@ int main(int argc, char **argv)
   }
   BIO_free_all(bio);
   SSL_CTX_free(ctx);
+  kmyth_log_span_end(&span, 0);
+
+  // The connection is closed before the command runs, however long it
+  // takes
+  if (execCommand != NULL && !refreshOnly)
+  {
+    return run_key_command(execCommand, memFd, outFd);
+  }
 
   return 0;
 }
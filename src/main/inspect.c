@@ -0,0 +1,238 @@
+/*
+ * Kmyth .ski Inspection Interface
+ *
+ * Prints the PCR selection, policy branches, authorizing key and cipher suite
+ * of .ski files without touching the TPM or decoding the encrypted data.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth_log.h"
+#include "marshalling_tools.h"
+#include "object_tools.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options] <file.ski> [<file.ski> ...]\n\n"
+          "Prints one line per file, e.g.:\n\n"
+          "  a.ski: format=text cipher=AES/GCM/NoPadding/256 sk_alg=rsa pcrs=sha256:0,7 policy_or=no\n\n"
+          "options are: \n\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog);
+}
+
+const struct option longopts[] = {
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// hash_alg_name()
+//############################################################################
+static const char *hash_alg_name(TPMI_ALG_HASH hash)
+{
+  switch (hash)
+  {
+  case TPM2_ALG_SHA1:
+    return "sha1";
+  case TPM2_ALG_SHA256:
+    return "sha256";
+  case TPM2_ALG_SHA384:
+    return "sha384";
+  case TPM2_ALG_SHA512:
+    return "sha512";
+  case TPM2_ALG_SM3_256:
+    return "sm3_256";
+  default:
+    return "unknown";
+  }
+}
+
+//############################################################################
+// print_digest()
+//############################################################################
+static void print_digest(const char *label, TPM2B_DIGEST * digest)
+{
+  printf(" %s=", label);
+  for (size_t i = 0; i < digest->size; i++)
+  {
+    printf("%02x", digest->buffer[i]);
+  }
+}
+
+//############################################################################
+// inspect_file()
+//############################################################################
+static int inspect_file(char *path)
+{
+  // only the start of the file is looked at, so it is not read in ahead
+  kmyth_file_view view;
+
+  if (peek_bytes_from_file(path, &view))
+  {
+    kmyth_log(LOG_ERR, "unable to read %s ... exiting", path);
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_header(view.data, view.data_length, &ski))
+  {
+    kmyth_log(LOG_ERR, "%s is not a valid .ski file ... exiting", path);
+    view.release(&view);
+    return 1;
+  }
+
+  printf("%s: format=%s cipher=%s", path,
+         is_ski_v2(view.data, view.data_length) ? "v2" : "text",
+         ski.cipher.cipher_name);
+  view.release(&view);
+
+  switch (ski.sk_pub.publicArea.type)
+  {
+  case TPM2_ALG_RSA:
+    printf(" sk_alg=rsa");
+    break;
+  case TPM2_ALG_ECC:
+    printf(" sk_alg=ecc");
+    break;
+  default:
+    printf(" sk_alg=unknown");
+    break;
+  }
+
+  // PCRs as <bank>:<index>,<index>... for each bank with any selected
+  bool any_pcr = false;
+
+  printf(" pcrs=");
+  for (size_t i = 0; i < ski.pcr_list.count; i++)
+  {
+    TPMS_PCR_SELECTION *sel = &ski.pcr_list.pcrSelections[i];
+    bool first = true;
+
+    for (size_t pcr = 0; pcr < 8 * (size_t) sel->sizeofSelect; pcr++)
+    {
+      if (!(sel->pcrSelect[pcr / 8] & (1 << (pcr % 8))))
+      {
+        continue;
+      }
+      if (first)
+      {
+        printf("%s%s:", any_pcr ? ";" : "", hash_alg_name(sel->hash));
+        first = false;
+        any_pcr = true;
+      }
+      else
+      {
+        printf(",");
+      }
+      printf("%zu", pcr);
+    }
+  }
+  if (!any_pcr)
+  {
+    printf("none");
+  }
+
+  if (ski.policyBranches.count > 0)
+  {
+    printf(" policy_or=yes");
+    for (uint32_t i = 0; i < ski.policyBranches.count; i++)
+    {
+      char label[16];
+
+      snprintf(label, sizeof(label), "branch%u", i + 1);
+      print_digest(label, &ski.policyBranches.digests[i]);
+    }
+  }
+  else
+  {
+    printf(" policy_or=no");
+  }
+
+  // the authorizing key is identified by its name, which is what signed
+  // policies record
+  if (ski.authorizing_key.size > 0)
+  {
+    TPM2B_NAME name = {.size = 0, };
+
+    if (compute_kmyth_object_name(&ski.authorizing_key, &name) == 0)
+    {
+      printf(" authorizing_key=");
+      for (size_t i = 0; i < name.size; i++)
+      {
+        printf("%02x", name.name[i]);
+      }
+    }
+    else
+    {
+      printf(" authorizing_key=invalid");
+    }
+  }
+  printf("\n");
+
+  free_ski(&ski);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  // If no command line arguments provided, provide usage help and exit early
+  if (argc == 1)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "hv", longopts,
+                                &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  if (optind == argc)
+  {
+    kmyth_log(LOG_ERR, "no .ski file specified ... exiting");
+    return 1;
+  }
+
+  // keep going past a bad file, so one pass covers a whole directory
+  int retval = 0;
+
+  for (int i = optind; i < argc; i++)
+  {
+    retval |= inspect_file(argv[i]);
+  }
+
+  return retval;
+}
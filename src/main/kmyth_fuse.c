@@ -0,0 +1,733 @@
+/*
+ * Kmyth FUSE Filesystem - TPM 2.0
+ *
+ * Mounts a directory of sealed files as a read-only filesystem of their
+ * plaintext: 'name.ski' in the sealed directory appears as 'name' in the
+ * mount. Files are unsealed on open, through one Kmyth context and its
+ * secret cache, and the plaintext is only ever held in (locked) memory.
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "kmyth_seal_unseal_impl.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+// streamed files open at once (each holds an open sealed reader)
+#define KMYTH_FUSE_MAX_STREAMS 64
+
+// default lifetime (seconds) of unsealed secrets and idle sealed readers
+#define KMYTH_FUSE_DEFAULT_TTL 300
+
+// default number and total size of the secrets cached by the context;
+// cached secrets are mlock()ed, so the size must fit RLIMIT_MEMLOCK
+#define KMYTH_FUSE_DEFAULT_CACHE_ENTRIES 16
+#define KMYTH_FUSE_DEFAULT_CACHE_BYTES (64 * 1024)
+
+#define KMYTH_FUSE_SKI_SUFFIX ".ski"
+
+/**
+ * @brief A sealed reader held open for a streamed file, shared by all the
+ *        handles open on the file and kept for the TTL once they close.
+ */
+typedef struct
+{
+  char name[NAME_MAX + 1];
+  kmyth_sealed_reader_t *reader;
+  time_t expires;
+  unsigned int open_count;
+  uint64_t last_used;
+} kmyth_fuse_stream;
+
+/**
+ * @brief An open file: either the whole plaintext of a .ski, or a stream.
+ */
+typedef struct
+{
+  uint8_t *data;
+  size_t data_len;
+  kmyth_fuse_stream *stream;
+} kmyth_fuse_handle;
+
+/**
+ * @brief Filesystem state. FUSE runs single-threaded (-s), since a Kmyth
+ *        context must not be used by more than one thread.
+ */
+typedef struct
+{
+  char *sealed_dir;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+  uint8_t bool_policy_or;
+  size_t cache_entries;
+  size_t cache_bytes;
+  unsigned int ttl;
+  kmyth_ctx_t *ctx;
+  kmyth_fuse_stream streams[KMYTH_FUSE_MAX_STREAMS];
+  uint64_t stream_uses;
+} kmyth_fuse_state;
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options] SEALED_DIR MOUNTPOINT\n\n"
+          "Mounts SEALED_DIR read-only at MOUNTPOINT, where each NAME.ski file reads as its plaintext NAME.\n\n"
+          "options are: \n\n"
+          " -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
+          " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -p or --policy_or     Unseal files sealed using a compound \"policy or\".\n"
+          " -C or --cache         Cache up to this many unsealed secrets in locked memory. Defaults to %d.\n"
+          " -M or --cache_bytes   Total size limit of the cached secrets. Defaults to %d.\n"
+          " -t or --ttl           Lifetime (seconds) of a cached secret or idle streamed file. Defaults to %d.\n"
+          "                       0 unseals again on every open.\n"
+          " -T or --tcti          TPM connection: auto, device[:path], abrmd, mssim[:conf] or swtpm[:conf].\n"
+          "                       Defaults to $%s, else '%s'.\n"
+          " -f or --foreground    Stay in the foreground.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          KMYTH_FUSE_DEFAULT_CACHE_ENTRIES, KMYTH_FUSE_DEFAULT_CACHE_BYTES,
+          KMYTH_FUSE_DEFAULT_TTL, KMYTH_TCTI_ENV, KMYTH_DEFAULT_TCTI);
+}
+
+const struct option longopts[] = {
+  {"auth_string", required_argument, 0, 'a'},
+  {"owner_auth", required_argument, 0, 'w'},
+  {"policy_or", no_argument, 0, 'p'},
+  {"cache", required_argument, 0, 'C'},
+  {"cache_bytes", required_argument, 0, 'M'},
+  {"ttl", required_argument, 0, 't'},
+  {"tcti", required_argument, 0, 'T'},
+  {"foreground", no_argument, 0, 'f'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// get_state()
+//############################################################################
+static kmyth_fuse_state *get_state(void)
+{
+  return (kmyth_fuse_state *) fuse_get_context()->private_data;
+}
+
+//############################################################################
+// sealed_path()
+//############################################################################
+/**
+ * @brief Maps a path in the mount ("/NAME") to its sealed file
+ *        (SEALED_DIR/NAME.ski). The mount is flat: there are no
+ *        subdirectories.
+ *
+ * @return 0 on success, -ENOENT for a path that cannot name a sealed file
+ */
+static int sealed_path(kmyth_fuse_state * state, const char *path,
+                       char *sealed, size_t sealed_size)
+{
+  const char *name = path + 1;
+
+  if (path[0] != '/' || name[0] == '\0' || strchr(name, '/') != NULL ||
+      strlen(name) > NAME_MAX - strlen(KMYTH_FUSE_SKI_SUFFIX))
+  {
+    return -ENOENT;
+  }
+
+  int len = snprintf(sealed, sealed_size, "%s/%s%s", state->sealed_dir,
+                     name, KMYTH_FUSE_SKI_SUFFIX);
+
+  return (len < 0 || (size_t) len >= sealed_size) ? -ENOENT : 0;
+}
+
+//############################################################################
+// close_stream()
+//############################################################################
+static void close_stream(kmyth_fuse_stream * stream)
+{
+  kmyth_sealed_reader_close(&stream->reader);
+  kmyth_clear(stream, sizeof(kmyth_fuse_stream));
+}
+
+//############################################################################
+// sweep_streams()
+//############################################################################
+/**
+ * @brief Closes the readers of streamed files that nothing has open and
+ *        whose TTL has passed, wiping the plaintext they hold.
+ */
+static void sweep_streams(kmyth_fuse_state * state)
+{
+  time_t now = time(NULL);
+
+  for (size_t i = 0; i < KMYTH_FUSE_MAX_STREAMS; i++)
+  {
+    kmyth_fuse_stream *s = &state->streams[i];
+
+    if (s->reader != NULL && s->open_count == 0 && now >= s->expires)
+    {
+      close_stream(s);
+    }
+  }
+}
+
+//############################################################################
+// find_stream()
+//############################################################################
+static kmyth_fuse_stream *find_stream(kmyth_fuse_state * state,
+                                      const char *name)
+{
+  for (size_t i = 0; i < KMYTH_FUSE_MAX_STREAMS; i++)
+  {
+    kmyth_fuse_stream *s = &state->streams[i];
+
+    if (s->reader != NULL && strcmp(s->name, name) == 0)
+    {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+//############################################################################
+// open_stream()
+//############################################################################
+/**
+ * @brief Returns the reader of a streamed file, opening it (and unsealing
+ *        its key) unless an open one is held.
+ *
+ * @return 0 on success, or a negative errno value
+ */
+static int open_stream(kmyth_fuse_state * state, const char *name,
+                       char *sealed, kmyth_fuse_stream ** stream)
+{
+  kmyth_fuse_stream *s = find_stream(state, name);
+
+  if (s != NULL)
+  {
+    s->open_count++;
+    s->last_used = ++state->stream_uses;
+    *stream = s;
+    return 0;
+  }
+
+  // take an empty slot, else the least recently used idle one
+  for (size_t i = 0; i < KMYTH_FUSE_MAX_STREAMS; i++)
+  {
+    kmyth_fuse_stream *c = &state->streams[i];
+
+    if (c->reader == NULL)
+    {
+      s = c;
+      break;
+    }
+    if (c->open_count == 0 && (s == NULL || c->last_used < s->last_used))
+    {
+      s = c;
+    }
+  }
+  if (s == NULL)
+  {
+    kmyth_log(LOG_WARNING, "too many streamed files open (%d)",
+              KMYTH_FUSE_MAX_STREAMS);
+    return -EMFILE;
+  }
+  if (s->reader != NULL)
+  {
+    close_stream(s);
+  }
+
+  if (kmyth_sealed_reader_open(state->ctx, sealed,
+                               state->auth_bytes, state->auth_bytes_len,
+                               state->owner_auth_bytes, state->oa_bytes_len,
+                               state->bool_policy_or, &s->reader))
+  {
+    return -EACCES;
+  }
+  snprintf(s->name, sizeof(s->name), "%s", name);
+  s->expires = time(NULL) + (time_t) state->ttl;
+  s->open_count = 1;
+  s->last_used = ++state->stream_uses;
+  *stream = s;
+  return 0;
+}
+
+//############################################################################
+// kmyth_fuse_getattr()
+//############################################################################
+static int kmyth_fuse_getattr(const char *path, struct stat *stbuf,
+                              struct fuse_file_info *fi)
+{
+  kmyth_fuse_state *state = get_state();
+
+  memset(stbuf, 0, sizeof(struct stat));
+  sweep_streams(state);
+
+  if (strcmp(path, "/") == 0)
+  {
+    stbuf->st_mode = S_IFDIR | 0555;
+    stbuf->st_nlink = 2;
+    return 0;
+  }
+
+  char sealed[PATH_MAX];
+  struct stat st;
+  int retval = sealed_path(state, path, sealed, sizeof(sealed));
+
+  if (retval)
+  {
+    return retval;
+  }
+  if (stat(sealed, &st) != 0)
+  {
+    return -errno;
+  }
+  if (!S_ISREG(st.st_mode))
+  {
+    return -ENOENT;
+  }
+
+  stbuf->st_mode = S_IFREG | (st.st_mode & 0444);
+  stbuf->st_nlink = 1;
+  stbuf->st_uid = st.st_uid;
+  stbuf->st_gid = st.st_gid;
+  stbuf->st_atim = st.st_atim;
+  stbuf->st_mtim = st.st_mtim;
+  stbuf->st_ctim = st.st_ctim;
+
+  // the plaintext size is only known once the file has been unsealed;
+  // until then it is reported as 0 (reads bypass the page cache, so they
+  // still return the whole file)
+  kmyth_fuse_handle *handle = (fi == NULL) ? NULL :
+    (kmyth_fuse_handle *) (uintptr_t) fi->fh;
+  kmyth_fuse_stream *stream = (handle != NULL) ? handle->stream :
+    find_stream(state, path + 1);
+
+  if (handle != NULL && handle->stream == NULL)
+  {
+    stbuf->st_size = (off_t) handle->data_len;
+  }
+  else if (stream != NULL)
+  {
+    stbuf->st_size = (off_t) kmyth_sealed_reader_size(stream->reader);
+  }
+  return 0;
+}
+
+//############################################################################
+// kmyth_fuse_readdir()
+//############################################################################
+static int kmyth_fuse_readdir(const char *path, void *buf,
+                              fuse_fill_dir_t filler, off_t offset,
+                              struct fuse_file_info *fi,
+                              enum fuse_readdir_flags flags)
+{
+  (void) offset;
+  (void) fi;
+  (void) flags;
+
+  if (strcmp(path, "/") != 0)
+  {
+    return -ENOENT;
+  }
+
+  kmyth_fuse_state *state = get_state();
+  DIR *dir = opendir(state->sealed_dir);
+
+  if (dir == NULL)
+  {
+    return -errno;
+  }
+  filler(buf, ".", NULL, 0, 0);
+  filler(buf, "..", NULL, 0, 0);
+
+  size_t suffix_len = strlen(KMYTH_FUSE_SKI_SUFFIX);
+  struct dirent *de = NULL;
+
+  while ((de = readdir(dir)) != NULL)
+  {
+    size_t len = strlen(de->d_name);
+    struct stat st;
+
+    if (len <= suffix_len ||
+        strcmp(de->d_name + len - suffix_len, KMYTH_FUSE_SKI_SUFFIX) != 0 ||
+        fstatat(dirfd(dir), de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+    {
+      continue;
+    }
+
+    char name[NAME_MAX + 1];
+
+    snprintf(name, sizeof(name), "%.*s", (int) (len - suffix_len),
+             de->d_name);
+    if (filler(buf, name, NULL, 0, 0))
+    {
+      break;
+    }
+  }
+  closedir(dir);
+  return 0;
+}
+
+//############################################################################
+// kmyth_fuse_open()
+//############################################################################
+static int kmyth_fuse_open(const char *path, struct fuse_file_info *fi)
+{
+  if ((fi->flags & O_ACCMODE) != O_RDONLY)
+  {
+    return -EROFS;
+  }
+
+  kmyth_fuse_state *state = get_state();
+  char sealed[PATH_MAX];
+  bool is_stream = false;
+  int retval = sealed_path(state, path, sealed, sizeof(sealed));
+
+  sweep_streams(state);
+  if (retval)
+  {
+    return retval;
+  }
+  if (tpm2_kmyth_is_stream_file(sealed, state->bool_policy_or, &is_stream))
+  {
+    return -ENOENT;
+  }
+
+  kmyth_fuse_handle *handle = calloc(1, sizeof(kmyth_fuse_handle));
+
+  if (handle == NULL)
+  {
+    return -ENOMEM;
+  }
+
+  if (is_stream)
+  {
+    retval = open_stream(state, path + 1, sealed, &handle->stream);
+  }
+  else
+  {
+    uint8_t *ski = NULL;
+    size_t ski_len = 0;
+
+    if (read_bytes_from_file(sealed, &ski, &ski_len))
+    {
+      retval = -EIO;
+    }
+    else if (tpm2_kmyth_unseal_ctx(state->ctx, ski, ski_len,
+                                   &handle->data, &handle->data_len,
+                                   state->auth_bytes, state->auth_bytes_len,
+                                   state->owner_auth_bytes,
+                                   state->oa_bytes_len,
+                                   state->bool_policy_or))
+    {
+      retval = -EACCES;
+    }
+    else if (handle->data_len > 0 &&
+             mlock(handle->data, handle->data_len) != 0)
+    {
+      kmyth_log(LOG_DEBUG, "unable to lock %s in memory", path);
+    }
+    free(ski);
+  }
+
+  if (retval)
+  {
+    kmyth_log(LOG_WARNING, "unable to unseal %s", sealed);
+    kmyth_clear_and_free(handle->data, handle->data_len);
+    free(handle);
+    return retval;
+  }
+
+  // reads go straight to this process, so no plaintext is left in the
+  // kernel's page cache
+  fi->direct_io = 1;
+  fi->keep_cache = 0;
+  fi->fh = (uint64_t) (uintptr_t) handle;
+  kmyth_log(LOG_DEBUG, "opened %s", path);
+  return 0;
+}
+
+//############################################################################
+// kmyth_fuse_read()
+//############################################################################
+static int kmyth_fuse_read(const char *path, char *buf, size_t size,
+                           off_t offset, struct fuse_file_info *fi)
+{
+  kmyth_fuse_handle *handle = (kmyth_fuse_handle *) (uintptr_t) fi->fh;
+
+  if (handle == NULL || offset < 0)
+  {
+    return -EINVAL;
+  }
+
+  if (handle->stream != NULL)
+  {
+    size_t read_len = 0;
+
+    if (kmyth_sealed_reader_pread(handle->stream->reader, (uint8_t *) buf,
+                                  size, (uint64_t) offset, &read_len))
+    {
+      kmyth_log(LOG_ERR, "error reading %s", path);
+      return -EIO;
+    }
+    return (int) read_len;
+  }
+
+  if ((uint64_t) offset >= handle->data_len)
+  {
+    return 0;
+  }
+  if (size > handle->data_len - (size_t) offset)
+  {
+    size = handle->data_len - (size_t) offset;
+  }
+  memcpy(buf, handle->data + offset, size);
+  return (int) size;
+}
+
+//############################################################################
+// kmyth_fuse_release()
+//############################################################################
+static int kmyth_fuse_release(const char *path, struct fuse_file_info *fi)
+{
+  (void) path;
+  kmyth_fuse_state *state = get_state();
+  kmyth_fuse_handle *handle = (kmyth_fuse_handle *) (uintptr_t) fi->fh;
+
+  if (handle == NULL)
+  {
+    return 0;
+  }
+
+  if (handle->stream != NULL)
+  {
+    handle->stream->open_count--;
+  }
+  else if (handle->data != NULL)
+  {
+    kmyth_clear(handle->data, handle->data_len);
+    munlock(handle->data, handle->data_len);
+    free(handle->data);
+  }
+  free(handle);
+  fi->fh = 0;
+
+  sweep_streams(state);
+  return 0;
+}
+
+//############################################################################
+// kmyth_fuse_init()
+//############################################################################
+static void *kmyth_fuse_init(struct fuse_conn_info *conn,
+                             struct fuse_config *cfg)
+{
+  (void) conn;
+  kmyth_fuse_state *state = get_state();
+
+  // sizes change from 0 once a file is unsealed, so never cache them
+  cfg->direct_io = 1;
+  cfg->kernel_cache = 0;
+  cfg->attr_timeout = 0;
+
+  // the TPM connection is made here, after FUSE has daemonized
+  if (kmyth_ctx_create(&state->ctx) ||
+      kmyth_ctx_set_secret_cache(state->ctx, state->cache_entries,
+                                 state->cache_bytes, state->ttl))
+  {
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
+    fuse_exit(fuse_get_context()->fuse);
+  }
+  return state;
+}
+
+//############################################################################
+// kmyth_fuse_destroy()
+//############################################################################
+static void kmyth_fuse_destroy(void *private_data)
+{
+  kmyth_fuse_state *state = (kmyth_fuse_state *) private_data;
+
+  for (size_t i = 0; i < KMYTH_FUSE_MAX_STREAMS; i++)
+  {
+    if (state->streams[i].reader != NULL)
+    {
+      close_stream(&state->streams[i]);
+    }
+  }
+  kmyth_ctx_destroy(&state->ctx);
+  kmyth_log(LOG_INFO, "kmyth-fuse unmounted %s", state->sealed_dir);
+}
+
+static const struct fuse_operations kmyth_fuse_ops = {
+  .getattr = kmyth_fuse_getattr,
+  .readdir = kmyth_fuse_readdir,
+  .open = kmyth_fuse_open,
+  .read = kmyth_fuse_read,
+  .release = kmyth_fuse_release,
+  .init = kmyth_fuse_init,
+  .destroy = kmyth_fuse_destroy,
+};
+
+int main(int argc, char **argv)
+{
+  // If no command line arguments provided, provide usage help and exit early
+  if (argc == 1)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Initialize parameters that might be modified by command line options
+  static kmyth_fuse_state state;
+  char *authString = NULL;
+  char *ownerAuthPasswd = "";
+  unsigned long cacheEntries = KMYTH_FUSE_DEFAULT_CACHE_ENTRIES;
+  unsigned long cacheBytes = KMYTH_FUSE_DEFAULT_CACHE_BYTES;
+  unsigned long ttl = KMYTH_FUSE_DEFAULT_TTL;
+  bool foreground = false;
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "a:w:pC:M:t:T:fvh", longopts,
+                                &option_index)) != -1)
+  {
+    char *end = NULL;
+
+    switch (options)
+    {
+    case 'a':
+      authString = optarg;
+      break;
+    case 'w':
+      ownerAuthPasswd = optarg;
+      break;
+    case 'p':
+      state.bool_policy_or = 1;
+      break;
+    case 'C':
+      cacheEntries = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || cacheEntries > 1024)
+      {
+        kmyth_log(LOG_ERR, "invalid cache size (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'M':
+      cacheBytes = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0')
+      {
+        kmyth_log(LOG_ERR, "invalid cache size (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 't':
+      ttl = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || ttl > UINT32_MAX)
+      {
+        kmyth_log(LOG_ERR, "invalid TTL (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'T':
+      if (set_tcti_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'f':
+      foreground = true;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind != 2)
+  {
+    kmyth_log(LOG_ERR, "SEALED_DIR and MOUNTPOINT must be given ... exiting");
+    return 1;
+  }
+
+  // FUSE changes directory once it daemonizes, so keep an absolute path
+  state.sealed_dir = realpath(argv[optind], NULL);
+  if (state.sealed_dir == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid sealed directory (%s) ... exiting",
+              argv[optind]);
+    return 1;
+  }
+
+  //Since these originate in main() we know they are null terminated
+  state.auth_bytes = (uint8_t *) authString;
+  state.auth_bytes_len = (authString == NULL) ? 0 : strlen(authString);
+  state.owner_auth_bytes = (uint8_t *) ownerAuthPasswd;
+  state.oa_bytes_len = strlen(ownerAuthPasswd);
+
+  // with no TTL nothing is kept unsealed past the last close
+  state.ttl = (unsigned int) ttl;
+  state.cache_entries = (ttl == 0) ? 0 : (size_t) cacheEntries;
+  state.cache_bytes = (size_t) cacheBytes;
+
+  // read-only, single-threaded (one Kmyth context), and permission checks
+  // against the sealed files' modes
+  char *fuse_argv[7];
+  int fuse_argc = 0;
+
+  fuse_argv[fuse_argc++] = argv[0];
+  fuse_argv[fuse_argc++] = "-s";
+  fuse_argv[fuse_argc++] = "-o";
+  fuse_argv[fuse_argc++] = "ro,default_permissions,fsname=kmyth,subtype=kmyth";
+  if (foreground)
+  {
+    fuse_argv[fuse_argc++] = "-f";
+  }
+  fuse_argv[fuse_argc++] = argv[optind + 1];
+  fuse_argv[fuse_argc] = NULL;
+
+  kmyth_log(LOG_INFO, "kmyth-fuse mounting %s at %s", state.sealed_dir,
+            argv[optind + 1]);
+  int retval = fuse_main(fuse_argc, fuse_argv, &kmyth_fuse_ops, &state);
+
+  kmyth_clear(state.auth_bytes, state.auth_bytes_len);
+  kmyth_clear(state.owner_auth_bytes, state.oa_bytes_len);
+  free(state.sealed_dir);
+
+  return retval;
+}
@@ -0,0 +1,770 @@
+/**
+ * @file kmyth_loadgen.c
+ * @brief A load generator for key servers: concurrent simulated clients
+ *        retrieve keys the way kmyth-getkey (over TLS, from a KMIP or
+ *        "simple" key server) or nsl-client (over an NSL session) do, for a
+ *        while and optionally at a target rate, then the handshake, request
+ *        and total latencies and the error rate are reported.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <kmip/kmip.h>
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "memory_util.h"
+#include "metrics.h"
+#include "nsl_util.h"
+#include "socket_util.h"
+#include "kmip_util.h"
+#include "tls_util.h"
+
+#define KMYTH_LOADGEN_DEFAULT_CLIENTS 8
+#define KMYTH_LOADGEN_DEFAULT_DURATION 10
+#define KMYTH_LOADGEN_DEFAULT_MESSAGE "1"
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are:\n\n"
+          "Client Information --\n"
+          "  -r or --priv         Path to the file containing the client's private key.\n"
+          "  -c or --client_cert  Path to the client's certificate (TLS).\n"
+          "Server Information --\n"
+          "  -P or --protocol     How keys are retrieved: kmip (KMIP over TLS), simple (the \"simple\"\n"
+          "                       key server over TLS) or nsl (KMIP over an NSL session).\n"
+          "                       Defaults to kmip.\n"
+          "  -i or --ip           The IP address or hostname of the server.\n"
+          "  -p or --port         The port number to connect to.\n"
+          "  -C or --ca_cert      Path to the certificate of the CA that issued the server's (TLS).\n"
+          "  -u or --pub          Path to the file containing the server's public key (NSL).\n"
+          "Load --\n"
+          "  -n or --clients      Concurrent clients. Defaults to %d.\n"
+          "  -d or --duration     Seconds to run for. Defaults to %d.\n"
+          "  -R or --rate         Sessions (connect, key requests, close) started per second, over all\n"
+          "                       clients. Defaults to 0 (each client starts the next as soon as one ends).\n"
+          "  -k or --requests     Key requests made in each session. Defaults to 1 (0 for NSL handshakes only).\n"
+          "  -m or --message      Key ID (kmip, nsl) or message (simple) of the requests. Defaults to '%s'.\n"
+          "  -o or --pool         Take TLS connections from a pool shared by the clients, as a daemon would,\n"
+          "                       rather than connecting for each session.\n"
+          "  -x or --no_resume    Forget TLS sessions before each connection, so no handshake is resumed.\n"
+          "Misc --\n" "  -h or --help         Help (displays this usage).\n\n"
+          "With -R, a session's total latency counts from when it was due to start, so a server that\n"
+          "falls behind shows in the latencies rather than in a lower request rate.\n\n",
+          prog, KMYTH_LOADGEN_DEFAULT_CLIENTS, KMYTH_LOADGEN_DEFAULT_DURATION,
+          KMYTH_LOADGEN_DEFAULT_MESSAGE);
+}
+
+const struct option longopts[] = {
+  // Client info
+  {"priv", required_argument, 0, 'r'},
+  {"client_cert", required_argument, 0, 'c'},
+  // Server info
+  {"protocol", required_argument, 0, 'P'},
+  {"ip", required_argument, 0, 'i'},
+  {"port", required_argument, 0, 'p'},
+  {"ca_cert", required_argument, 0, 'C'},
+  {"pub", required_argument, 0, 'u'},
+  // Load
+  {"clients", required_argument, 0, 'n'},
+  {"duration", required_argument, 0, 'd'},
+  {"rate", required_argument, 0, 'R'},
+  {"requests", required_argument, 0, 'k'},
+  {"message", required_argument, 0, 'm'},
+  {"pool", no_argument, 0, 'o'},
+  {"no_resume", no_argument, 0, 'x'},
+  // Misc
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+/**
+ * @brief How the simulated clients retrieve keys
+ */
+typedef enum loadgen_protocol
+{
+  LOADGEN_KMIP,
+  LOADGEN_SIMPLE,
+  LOADGEN_NSL,
+} loadgen_protocol;
+
+/**
+ * @brief Settings shared by the clients
+ */
+typedef struct loadgen_config
+{
+  loadgen_protocol protocol;
+  char *ip;
+  char *port;
+  char *server;                 // "ip:port", for TLS
+  char *priv;
+  char *pub;
+  char *client_cert;
+  char *ca_cert;
+  char *message;
+  long requests;
+  bool no_resume;
+  uint64_t interval_us;         // between a client's sessions (0: no pause)
+  uint64_t deadline_us;
+
+  // client private key (TLS), and connection pool (with -o)
+  uint8_t *priv_key;
+  size_t priv_key_len;
+  tls_conn_pool *pool;
+} loadgen_config;
+
+/**
+ * @brief Latencies recorded by one client
+ */
+typedef struct latency_series
+{
+  uint64_t *us;
+  size_t count;
+  size_t size;
+} latency_series;
+
+/**
+ * @brief One client: its thread, and its results
+ */
+typedef struct loadgen_thread
+{
+  pthread_t thread;
+  const loadgen_config *config;
+  uint64_t first_us;            // when the first session is due
+
+  uint64_t sessions;
+  uint64_t failed_sessions;
+  uint64_t resumed;
+  uint64_t key_requests;
+  uint64_t failed_requests;
+  latency_series handshake;
+  latency_series request;
+  latency_series total;
+
+  // KMIP codec for the key requests (nsl)
+  kmip_codec kmip;
+} loadgen_thread;
+
+//
+// record_latency()
+//
+static void record_latency(latency_series * series, uint64_t usec)
+{
+  if (series->count == series->size)
+  {
+    size_t size = series->size ? 2 * series->size : 1024;
+    uint64_t *us = realloc(series->us, size * sizeof(uint64_t));
+
+    if (us == NULL)
+    {
+      return;
+    }
+    series->us = us;
+    series->size = size;
+  }
+  series->us[series->count++] = usec;
+}
+
+//
+// request_key()
+//
+static int request_key(kmip_codec * kmip, int socket_fd,
+                       nsl_session * session, char *message)
+{
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+
+  int result = kmip_codec_build_get_request(kmip,
+                                            (unsigned char *) message,
+                                            strlen(message),
+                                            &request, &request_len);
+
+  if (result == 0)
+  {
+    result = nsl_send_record(socket_fd, session, NSL_RECORD_DATA,
+                             request, request_len);
+  }
+
+  nsl_record_type type = NSL_RECORD_DATA;
+  unsigned char *response = NULL;
+  size_t response_len = 0;
+
+  if (result == 0)
+  {
+    result = nsl_recv_record(socket_fd, session,
+                             &type, &response, &response_len);
+  }
+
+  unsigned char *key_id = NULL;
+  size_t key_id_len = 0;
+  unsigned char *key = NULL;
+  size_t key_len = 0;
+
+  if (result == 0)
+  {
+    result = (type != NSL_RECORD_DATA)
+      || kmip_codec_parse_get_response(kmip, response, response_len,
+                                       &key_id, &key_id_len, &key, &key_len);
+  }
+
+  kmyth_clear_and_free(response, response_len);
+  kmip_codec_reset(kmip);
+
+  return result;
+}
+
+//
+// run_nsl_session()
+//
+// One NSL session: connect, negotiate a session key, make the key requests
+// and close the session.
+//
+static int run_nsl_session(loadgen_thread * t,
+                           EVP_PKEY_CTX * public_key_ctx,
+                           EVP_PKEY_CTX * private_key_ctx)
+{
+  const loadgen_config *config = t->config;
+  int socket_fd = -1;
+  uint64_t start_us = kmyth_metrics_now_us();
+
+  if (setup_client_socket(config->ip, config->port, NULL, &socket_fd))
+  {
+    return 1;
+  }
+
+  unsigned char *session_key = NULL;
+  size_t session_key_len = 0;
+
+  if (negotiate_client_session_key(socket_fd,
+                                   public_key_ctx, private_key_ctx,
+                                   (unsigned char *) "A\0", 2,
+                                   (unsigned char *) "B\0", 2,
+                                   &session_key, &session_key_len))
+  {
+    close(socket_fd);
+    return 1;
+  }
+  record_latency(&t->handshake, kmyth_metrics_now_us() - start_us);
+
+  nsl_session session = { 0 };
+
+  nsl_session_init(&session, session_key, session_key_len, 0);
+
+  int result = 0;
+
+  for (long i = 0; i < config->requests && result == 0; i++)
+  {
+    uint64_t request_us = kmyth_metrics_now_us();
+
+    result = request_key(&t->kmip, socket_fd, &session, config->message);
+    if (result == 0)
+    {
+      record_latency(&t->request, kmyth_metrics_now_us() - request_us);
+      t->key_requests++;
+    }
+    else
+    {
+      t->failed_requests++;
+    }
+  }
+  if (result == 0)
+  {
+    result = nsl_send_record(socket_fd, &session, NSL_RECORD_CLOSE, NULL, 0);
+  }
+
+  nsl_session_clear(&session);
+  close(socket_fd);
+  return result;
+}
+
+//
+// run_tls_session()
+//
+// One TLS session, as kmyth-getkey has it: connect (or take a pooled
+// connection), make the key requests and close (or return) the connection.
+//
+static int run_tls_session(loadgen_thread * t)
+{
+  const loadgen_config *config = t->config;
+  BIO *bio = NULL;
+  SSL_CTX *ctx = NULL;
+  int result = 0;
+
+  if (config->no_resume)
+  {
+    tls_clear_session_cache();
+  }
+
+  uint64_t start_us = kmyth_metrics_now_us();
+
+  if (config->pool != NULL)
+  {
+    result = tls_conn_pool_get(config->pool, config->server,
+                               config->priv_key, config->priv_key_len,
+                               config->client_cert, config->ca_cert, &bio);
+  }
+  else
+  {
+    // create_tls_connection() splits the address it is given
+    char *server = strdup(config->server);
+
+    result = (server == NULL) ||
+      create_tls_connection(&server, config->priv_key, config->priv_key_len,
+                            config->client_cert, config->ca_cert,
+                            &bio, &ctx);
+    free(server);
+  }
+  if (result)
+  {
+    BIO_free_all(bio);
+    SSL_CTX_free(ctx);
+    return 1;
+  }
+  record_latency(&t->handshake, kmyth_metrics_now_us() - start_us);
+
+  SSL *ssl = NULL;
+
+  BIO_get_ssl(bio, &ssl);
+  if (config->pool == NULL && ssl != NULL && SSL_session_reused(ssl))
+  {
+    t->resumed++;
+  }
+
+  for (long i = 0; i < config->requests && result == 0; i++)
+  {
+    unsigned char *key = NULL;
+    size_t key_len = 0;
+    uint64_t request_us = kmyth_metrics_now_us();
+
+    if (config->protocol == LOADGEN_KMIP)
+    {
+      result = get_key_from_kmip_server(bio, config->message,
+                                        strlen(config->message),
+                                        &key, &key_len);
+    }
+    else
+    {
+      result = get_resp_from_tls_server(bio, config->message,
+                                        strlen(config->message),
+                                        &key, &key_len);
+    }
+    if (result == 0)
+    {
+      record_latency(&t->request, kmyth_metrics_now_us() - request_us);
+      t->key_requests++;
+    }
+    else
+    {
+      t->failed_requests++;
+    }
+    kmyth_clear_and_free(key, key_len);
+  }
+
+  if (config->pool != NULL)
+  {
+    tls_conn_pool_put(config->pool, bio, result == 0);
+  }
+  else
+  {
+    BIO_ssl_shutdown(bio);
+    BIO_free_all(bio);
+    SSL_CTX_free(ctx);
+  }
+  return result;
+}
+
+//
+// sleep_until()
+//
+static void sleep_until(uint64_t due_us)
+{
+  uint64_t now_us = kmyth_metrics_now_us();
+
+  if (due_us > now_us)
+  {
+    struct timespec pause = {.tv_sec = (time_t) ((due_us - now_us) / 1000000),
+      .tv_nsec = (long) ((due_us - now_us) % 1000000) * 1000
+    };
+
+    nanosleep(&pause, NULL);
+  }
+}
+
+//
+// loadgen_main()
+//
+static void *loadgen_main(void *arg)
+{
+  loadgen_thread *t = (loadgen_thread *) arg;
+  const loadgen_config *config = t->config;
+  EVP_PKEY_CTX *public_key_ctx = NULL;
+  EVP_PKEY_CTX *private_key_ctx = NULL;
+
+  // EVP contexts are not shared between threads
+  if (config->protocol == LOADGEN_NSL)
+  {
+    public_key_ctx = setup_public_evp_context(config->pub);
+    private_key_ctx = setup_private_evp_context(config->priv);
+    if (public_key_ctx == NULL || private_key_ctx == NULL
+        || kmip_codec_init(&t->kmip, KMIP_2_0, 0))
+    {
+      kmyth_log(LOG_ERR, "Failed to setup the EVP contexts and KMIP codec.");
+      t->failed_sessions++;
+      EVP_PKEY_CTX_free(public_key_ctx);
+      EVP_PKEY_CTX_free(private_key_ctx);
+      kmip_codec_free(&t->kmip);
+      return NULL;
+    }
+  }
+
+  // With a target rate, sessions are due at fixed intervals and timed from
+  // when they were due; a client that falls behind starts the next one
+  // right away rather than skipping it
+  uint64_t due_us = t->first_us;
+
+  while (due_us < config->deadline_us)
+  {
+    uint64_t start_us = due_us;
+
+    if (config->interval_us > 0)
+    {
+      sleep_until(due_us);
+      due_us += config->interval_us;
+    }
+    else
+    {
+      start_us = kmyth_metrics_now_us();
+      due_us = start_us;
+    }
+
+    int result = (config->protocol == LOADGEN_NSL) ?
+      run_nsl_session(t, public_key_ctx, private_key_ctx) :
+      run_tls_session(t);
+
+    t->sessions++;
+    if (result)
+    {
+      t->failed_sessions++;
+    }
+    else
+    {
+      record_latency(&t->total, kmyth_metrics_now_us() - start_us);
+    }
+  }
+
+  EVP_PKEY_CTX_free(public_key_ctx);
+  EVP_PKEY_CTX_free(private_key_ctx);
+  kmip_codec_free(&t->kmip);
+  return NULL;
+}
+
+//
+// compare_u64()
+//
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//
+// report_latencies()
+//
+// Merges one series of every client's latencies and prints its percentiles.
+//
+static void report_latencies(const char *name, loadgen_thread * t,
+                             long count, size_t offset)
+{
+  size_t n = 0;
+
+  for (long i = 0; i < count; i++)
+  {
+    n += ((latency_series *) ((char *) &t[i] + offset))->count;
+  }
+  if (n == 0)
+  {
+    return;
+  }
+
+  uint64_t *latencies = calloc(n, sizeof(uint64_t));
+
+  if (latencies == NULL)
+  {
+    return;
+  }
+
+  n = 0;
+  for (long i = 0; i < count; i++)
+  {
+    latency_series *series = (latency_series *) ((char *) &t[i] + offset);
+
+    if (series->count > 0)
+    {
+      memcpy(latencies + n, series->us, series->count * sizeof(uint64_t));
+      n += series->count;
+    }
+  }
+
+  qsort(latencies, n, sizeof(uint64_t), compare_u64);
+  fprintf(stdout, "%-9s latency (ms): p50 %.2f, p90 %.2f, p99 %.2f, "
+          "p99.9 %.2f, max %.2f\n", name,
+          latencies[n / 2] / 1000.0, latencies[n * 9 / 10] / 1000.0,
+          latencies[n * 99 / 100] / 1000.0, latencies[n * 999 / 1000] / 1000.0,
+          latencies[n - 1] / 1000.0);
+  free(latencies);
+}
+
+int main(int argc, char **argv)
+{
+  // Exit early if there are no arguments
+  if (1 == argc)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  loadgen_config config = {.protocol = LOADGEN_KMIP,
+    .message = KMYTH_LOADGEN_DEFAULT_MESSAGE,
+    .requests = 1
+  };
+  char *protocol = NULL;
+  bool pooled = false;
+  long clients = KMYTH_LOADGEN_DEFAULT_CLIENTS;
+  long duration = KMYTH_LOADGEN_DEFAULT_DURATION;
+  double rate = 0;
+
+  int options;
+  int option_index;
+
+  while ((options =
+          getopt_long(argc, argv, "r:c:P:i:p:C:u:n:d:R:k:m:oxh", longopts,
+                      &option_index)) != -1)
+  {
+    switch (options)
+    {
+      // Client info
+    case 'r':
+      config.priv = optarg;
+      break;
+    case 'c':
+      config.client_cert = optarg;
+      break;
+      // Server info
+    case 'P':
+      protocol = optarg;
+      break;
+    case 'i':
+      config.ip = optarg;
+      break;
+    case 'p':
+      config.port = optarg;
+      break;
+    case 'C':
+      config.ca_cert = optarg;
+      break;
+    case 'u':
+      config.pub = optarg;
+      break;
+      // Load
+    case 'n':
+      clients = strtol(optarg, NULL, 10);
+      break;
+    case 'd':
+      duration = strtol(optarg, NULL, 10);
+      break;
+    case 'R':
+      rate = strtod(optarg, NULL);
+      break;
+    case 'k':
+      config.requests = strtol(optarg, NULL, 10);
+      break;
+    case 'm':
+      config.message = optarg;
+      break;
+    case 'o':
+      pooled = true;
+      break;
+    case 'x':
+      config.no_resume = true;
+      break;
+      // Misc
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  if (protocol != NULL && strcmp(protocol, "simple") == 0)
+  {
+    config.protocol = LOADGEN_SIMPLE;
+  }
+  else if (protocol != NULL && strcmp(protocol, "nsl") == 0)
+  {
+    config.protocol = LOADGEN_NSL;
+  }
+  else if (protocol != NULL && strcmp(protocol, "kmip") != 0)
+  {
+    kmyth_log(LOG_ERR, "Invalid protocol (%s).", protocol);
+    return 1;
+  }
+
+  if (clients < 1 || clients > 4096 || duration < 1 || rate < 0
+      || config.requests < 0
+      || config.requests >= KMYTH_NSL_SESSION_MAX_REQUESTS
+      || (config.protocol != LOADGEN_NSL && config.requests == 0))
+  {
+    kmyth_log(LOG_ERR,
+              "Invalid client count, duration, rate or request count.");
+    return 1;
+  }
+  if (config.ip == NULL || config.port == NULL || config.priv == NULL
+      || (config.protocol == LOADGEN_NSL && config.pub == NULL)
+      || (config.protocol != LOADGEN_NSL
+          && (config.client_cert == NULL || config.ca_cert == NULL)))
+  {
+    kmyth_log(LOG_ERR, "Missing server address, key or certificate.");
+    return 1;
+  }
+
+  set_applog_severity_threshold(LOG_WARNING);
+
+  if (config.protocol != LOADGEN_NSL)
+  {
+    size_t server_len = strlen(config.ip) + strlen(config.port) + 2;
+
+    config.server = malloc(server_len);
+    if (config.server == NULL ||
+        read_bytes_from_file(config.priv, &config.priv_key,
+                             &config.priv_key_len))
+    {
+      kmyth_log(LOG_ERR, "Failed to load the client's private key.");
+      free(config.server);
+      return 1;
+    }
+    snprintf(config.server, server_len, "%s:%s", config.ip, config.port);
+    if (pooled)
+    {
+      config.pool = tls_conn_pool_new((size_t) clients, 0);
+      if (config.pool == NULL)
+      {
+        kmyth_log(LOG_ERR, "Failed to create the connection pool.");
+        kmyth_clear_and_free(config.priv_key, config.priv_key_len);
+        free(config.server);
+        return 1;
+      }
+    }
+  }
+
+  loadgen_thread *t = calloc((size_t) clients, sizeof(loadgen_thread));
+
+  if (t == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the client state.");
+    tls_conn_pool_free(config.pool);
+    kmyth_clear_and_free(config.priv_key, config.priv_key_len);
+    free(config.server);
+    return 1;
+  }
+
+  uint64_t start_us = kmyth_metrics_now_us();
+
+  config.deadline_us = start_us + (uint64_t) duration * 1000000;
+  if (rate > 0)
+  {
+    config.interval_us = (uint64_t) ((double) clients * 1e6 / rate);
+    if (config.interval_us == 0)
+    {
+      config.interval_us = 1;
+    }
+  }
+
+  long started = 0;
+
+  for (; started < clients; started++)
+  {
+    // spread the clients' sessions evenly over each interval
+    t[started].config = &config;
+    t[started].first_us = start_us +
+      config.interval_us * (uint64_t) started / (uint64_t) clients;
+    if (pthread_create(&t[started].thread, NULL, loadgen_main, &t[started]))
+    {
+      kmyth_log(LOG_ERR, "Failed to start a client thread.");
+      break;
+    }
+  }
+
+  uint64_t sessions = 0;
+  uint64_t failed_sessions = 0;
+  uint64_t resumed = 0;
+  uint64_t key_requests = 0;
+  uint64_t failed_requests = 0;
+
+  for (long i = 0; i < started; i++)
+  {
+    pthread_join(t[i].thread, NULL);
+    sessions += t[i].sessions;
+    failed_sessions += t[i].failed_sessions;
+    resumed += t[i].resumed;
+    key_requests += t[i].key_requests;
+    failed_requests += t[i].failed_requests;
+  }
+
+  double elapsed = (double) (kmyth_metrics_now_us() - start_us) / 1e6;
+
+  fprintf(stdout, "clients:        %ld\n", started);
+  fprintf(stdout, "elapsed:        %.2f s\n", elapsed);
+  fprintf(stdout, "sessions:       %" PRIu64 " (%.1f/s", sessions,
+          (double) sessions / elapsed);
+  if (rate > 0)
+  {
+    fprintf(stdout, ", target %.1f/s", rate);
+  }
+  fprintf(stdout, "), %" PRIu64 " failed (%.2f%%)\n", failed_sessions,
+          sessions ? 100.0 * (double) failed_sessions / (double) sessions : 0);
+  if (config.protocol != LOADGEN_NSL && !pooled)
+  {
+    fprintf(stdout, "resumed:        %" PRIu64 " TLS sessions\n", resumed);
+  }
+  if (config.requests > 0)
+  {
+    uint64_t attempts = key_requests + failed_requests;
+
+    fprintf(stdout, "key requests:   %" PRIu64 " (%.1f/s), %" PRIu64
+            " failed (%.2f%%)\n", key_requests,
+            (double) key_requests / elapsed, failed_requests,
+            attempts ? 100.0 * (double) failed_requests / (double) attempts :
+            0);
+  }
+  report_latencies(pooled ? "connect" : "handshake", t, started,
+                   offsetof(loadgen_thread, handshake));
+  report_latencies("request", t, started, offsetof(loadgen_thread, request));
+  report_latencies("total", t, started, offsetof(loadgen_thread, total));
+
+  for (long i = 0; i < clients; i++)
+  {
+    free(t[i].handshake.us);
+    free(t[i].request.us);
+    free(t[i].total.us);
+  }
+  free(t);
+  tls_conn_pool_free(config.pool);
+  kmyth_clear_and_free(config.priv_key, config.priv_key_len);
+  free(config.server);
+
+  return (started == clients && failed_sessions == 0) ? 0 : 1;
+}
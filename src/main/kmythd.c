@@ -0,0 +1,551 @@
+/*
+ * Kmyth Unseal Daemon - TPM 2.0
+ *
+ * Holds one Kmyth context (TPM connection, cached SRK handle, storage key
+ * and policy caches) and serves unseal requests from local clients over a
+ * UNIX domain socket.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "kmyth_prewarm.h"
+#include "kmythd_util.h"
+#include "memory_util.h"
+#include "metrics.h"
+#include "socket_util.h"
+#include "tpm2_interface.h"
+
+#define KMYTHD_MAX_ALLOWED_UIDS 32
+
+// errors and warnings recorded per call site and interval (seconds), so a
+// TPM outage logs a few lines a minute rather than a chain per request
+#define KMYTHD_LOG_LIMIT_BURST 10
+#define KMYTHD_LOG_LIMIT_INTERVAL 60
+
+static volatile sig_atomic_t kmythd_stop = 0;
+
+/**
+ * @brief Work of the thread unsealing the secrets of a prewarm manifest
+ *        (see kmyth_prewarm.h) into the daemon's secret cache
+ */
+typedef struct
+{
+  kmyth_ctx_t *ctx;
+
+  // held while ctx is in use, by the prewarm thread and request handling
+  pthread_mutex_t *ctx_lock;
+
+  kmyth_prewarm_item *items;
+  size_t count;
+} kmythd_prewarm;
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -S or --socket        Path of the listening socket. Defaults to $%s, else '%s'.\n"
+          " -m or --mode          Permission bits (octal) of the socket file. Defaults to 0660.\n"
+          " -u or --allow_uid     Also serve clients running as this user ID (may be repeated).\n"
+          "                       Clients running as root or as the daemon's own user are always served.\n"
+          " -C or --cache         Cache up to this many unsealed secrets in locked memory. Defaults to 0 (off).\n"
+          " -t or --ttl           Lifetime (seconds) of a cached secret. Defaults to 0 (until PCRs change).\n"
+          " -P or --prewarm       Unseal the .ski files listed in this manifest (one '[priority] path' per line)\n"
+          "                       into the cache at startup, while requests are served. Requires -C.\n"
+          " -T or --tcti          TPM connection: auto, device[:path], abrmd, mssim[:conf] or swtpm[:conf].\n"
+          "                       Defaults to $%s, else '%s'.\n"
+          " -j or --json_log      Write log entries as JSON objects (one per line).\n"
+          " -M or --metrics_file  Keep this file up to date with the daemon's metrics (Prometheus text format),\n"
+          "                       e.g., for the node_exporter textfile collector.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          KMYTHD_SOCKET_ENV, KMYTHD_DEFAULT_SOCKET_PATH,
+          KMYTH_TCTI_ENV, KMYTH_DEFAULT_TCTI);
+}
+
+const struct option longopts[] = {
+  {"socket", required_argument, 0, 'S'},
+  {"mode", required_argument, 0, 'm'},
+  {"allow_uid", required_argument, 0, 'u'},
+  {"cache", required_argument, 0, 'C'},
+  {"ttl", required_argument, 0, 't'},
+  {"prewarm", required_argument, 0, 'P'},
+  {"tcti", required_argument, 0, 'T'},
+  {"json_log", no_argument, 0, 'j'},
+  {"metrics_file", required_argument, 0, 'M'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// handle_stop_signal()
+//############################################################################
+static void handle_stop_signal(int sig)
+{
+  (void) sig;
+  kmythd_stop = 1;
+}
+
+//############################################################################
+// handle_reopen_signal()
+//############################################################################
+static void handle_reopen_signal(int sig)
+{
+  (void) sig;
+  kmyth_log_reopen();
+}
+
+//############################################################################
+// prewarm_secrets()
+//############################################################################
+static void *prewarm_secrets(void *arg)
+{
+  kmythd_prewarm *prewarm = (kmythd_prewarm *) arg;
+  size_t loaded = 0;
+  size_t warmed = 0;
+
+  // behind requests, which have a client waiting, but ahead of bulk work
+  set_tpm_priority(KMYTH_TPM_PRIORITY_NORMAL);
+
+  // entries that can't be read or parsed are skipped, the rest unsealed
+  // grouped by storage key and policy so the context's caches of both hit
+  for (size_t i = 0; i < prewarm->count; i++)
+  {
+    if (kmyth_prewarm_load(&prewarm->items[i]) == 0)
+    {
+      prewarm->items[loaded++] = prewarm->items[i];
+    }
+    else
+    {
+      kmyth_log(LOG_WARNING, "skipping prewarm manifest line %zu",
+                prewarm->items[i].line);
+      kmyth_free(prewarm->items[i].path);
+      kmyth_free(prewarm->items[i].ski);
+    }
+  }
+  prewarm->count = loaded;
+  kmyth_prewarm_order(prewarm->items, prewarm->count);
+
+  // the context is taken per entry, so a request waits for at most one
+  for (size_t i = 0; i < prewarm->count && !kmythd_stop; i++)
+  {
+    pthread_mutex_lock(prewarm->ctx_lock);
+    if (kmyth_prewarm_unseal(prewarm->ctx, &prewarm->items[i]) == 0)
+    {
+      warmed++;
+    }
+    pthread_mutex_unlock(prewarm->ctx_lock);
+  }
+
+  kmyth_log(LOG_INFO, "prewarmed %zu of %zu secrets", warmed,
+            prewarm->count);
+  return NULL;
+}
+
+//############################################################################
+// send_status()
+//############################################################################
+static void send_status(int client_fd, uint8_t status)
+{
+  kmythd_send_msg(client_fd, &status, 1);
+}
+
+//############################################################################
+// serve_client()
+//############################################################################
+static void serve_client(kmyth_ctx_t * ctx, int client_fd,
+                         uid_t * allowed_uids, size_t allowed_count)
+{
+  uid_t uid = 0;
+  pid_t pid = 0;
+
+  if (get_unix_peer_credentials(client_fd, &uid, &pid))
+  {
+    return;
+  }
+
+  bool allowed = (uid == 0 || uid == geteuid());
+
+  for (size_t i = 0; i < allowed_count && !allowed; i++)
+  {
+    allowed = (uid == allowed_uids[i]);
+  }
+  if (!allowed)
+  {
+    kmyth_log(LOG_WARNING, "refused client (uid %u, pid %d)",
+              (unsigned int) uid, (int) pid);
+    send_status(client_fd, KMYTHD_STATUS_DENIED);
+    return;
+  }
+
+  // a client that stalls must not hold up the other clients for long
+  struct timeval timeout = {.tv_sec = KMYTHD_CLIENT_TIMEOUT,.tv_usec = 0 };
+
+  setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  uint8_t *req = NULL;
+  size_t req_len = 0;
+
+  if (kmythd_recv_msg(client_fd, &req, &req_len))
+  {
+    return;
+  }
+
+  uint8_t *ski = NULL;
+  uint8_t *auth = NULL;
+  uint8_t *oa = NULL;
+  size_t ski_len = 0;
+  size_t auth_len = 0;
+  size_t oa_len = 0;
+  uint8_t flags = 0;
+
+  if (kmythd_parse_unseal_request(req, req_len, &ski, &ski_len,
+                                  &auth, &auth_len, &oa, &oa_len, &flags))
+  {
+    kmyth_clear_and_free(req, req_len);
+    send_status(client_fd, KMYTHD_STATUS_ERROR);
+    return;
+  }
+
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval = tpm2_kmyth_unseal_ctx(ctx, ski, ski_len,
+                                     &output, &output_len,
+                                     auth, auth_len, oa, oa_len,
+                                     (flags & KMYTHD_FLAG_POLICY_OR) ? 1 : 0);
+
+  // the request holds the client's authorization data
+  kmyth_clear_and_free(req, req_len);
+
+  if (retval)
+  {
+    kmyth_log(LOG_WARNING, "unseal failed for client (uid %u, pid %d)",
+              (unsigned int) uid, (int) pid);
+    kmyth_clear_and_free(output, output_len);
+    send_status(client_fd, KMYTHD_STATUS_ERROR);
+    return;
+  }
+
+  // response = status byte followed by the unsealed data
+  size_t rsp_len = output_len + 1;
+  uint8_t *rsp = malloc(rsp_len);
+
+  if (rsp == NULL)
+  {
+    kmyth_clear_and_free(output, output_len);
+    send_status(client_fd, KMYTHD_STATUS_ERROR);
+    return;
+  }
+  rsp[0] = KMYTHD_STATUS_OK;
+  memcpy(rsp + 1, output, output_len);
+  kmyth_clear_and_free(output, output_len);
+
+  if (kmythd_send_msg(client_fd, rsp, rsp_len) == 0)
+  {
+    kmyth_log(LOG_DEBUG, "served unseal for client (uid %u, pid %d)",
+              (unsigned int) uid, (int) pid);
+  }
+  kmyth_clear_and_free(rsp, rsp_len);
+}
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Initialize parameters that might be modified by command line options
+  const char *socketPath = getenv(KMYTHD_SOCKET_ENV);
+  mode_t socketMode = 0660;
+  uid_t allowed_uids[KMYTHD_MAX_ALLOWED_UIDS];
+  size_t allowed_count = 0;
+  unsigned long cacheEntries = 0;
+  unsigned long cacheTtl = 0;
+  const char *metricsPath = NULL;
+  char *prewarmPath = NULL;
+  int options;
+  int option_index;
+
+  if (socketPath == NULL)
+  {
+    socketPath = KMYTHD_DEFAULT_SOCKET_PATH;
+  }
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "S:m:u:C:t:P:T:jM:hv", longopts,
+                                &option_index)) != -1)
+  {
+    char *end = NULL;
+
+    switch (options)
+    {
+    case 'S':
+      socketPath = optarg;
+      break;
+    case 'm':
+      socketMode = (mode_t) strtoul(optarg, &end, 8);
+      if (end == optarg || *end != '\0' || socketMode > 0777)
+      {
+        kmyth_log(LOG_ERR, "invalid socket mode (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'u':
+      {
+        unsigned long uid = strtoul(optarg, &end, 10);
+
+        if (end == optarg || *end != '\0' ||
+            allowed_count == KMYTHD_MAX_ALLOWED_UIDS)
+        {
+          kmyth_log(LOG_ERR, "invalid or too many user IDs (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+        allowed_uids[allowed_count++] = (uid_t) uid;
+      }
+      break;
+    case 'C':
+      cacheEntries = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || cacheEntries > 1024)
+      {
+        kmyth_log(LOG_ERR, "invalid cache size (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 't':
+      cacheTtl = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || cacheTtl > UINT32_MAX)
+      {
+        kmyth_log(LOG_ERR, "invalid cache TTL (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'P':
+      prewarmPath = optarg;
+      break;
+    case 'T':
+      if (set_tcti_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'j':
+      set_applog_format(KMYTH_APPLOG_FORMAT_JSON);
+      break;
+    case 'M':
+      metricsPath = optarg;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  // Prewarmed secrets are only kept by the secret cache, and a bad
+  // manifest is better reported before the daemon starts listening
+  kmythd_prewarm prewarm = {.items = NULL,.count = 0 };
+
+  if (prewarmPath != NULL)
+  {
+    uint8_t *manifest = NULL;
+    size_t manifest_len = 0;
+
+    if (cacheEntries == 0)
+    {
+      kmyth_log(LOG_ERR, "prewarming requires a secret cache (-C) ... exiting");
+      return 1;
+    }
+    if (read_bytes_from_file(prewarmPath, &manifest, &manifest_len))
+    {
+      kmyth_log(LOG_ERR, "unable to read prewarm manifest %s ... exiting",
+                prewarmPath);
+      return 1;
+    }
+    if (kmyth_prewarm_parse_manifest(manifest, manifest_len,
+                                     &prewarm.items, &prewarm.count))
+    {
+      kmyth_free(manifest);
+      return 1;
+    }
+    kmyth_free(manifest);
+    if (prewarm.count > cacheEntries)
+    {
+      kmyth_log(LOG_WARNING, "prewarm manifest lists %zu secrets, but the "
+                "cache holds %lu", prewarm.count, cacheEntries);
+    }
+  }
+
+  // Stop cleanly on SIGINT/SIGTERM (no SA_RESTART, so accept() returns)
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  // Reopen the log file on SIGHUP (e.g., from logrotate's postrotate)
+  sa.sa_handler = handle_reopen_signal;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGHUP, &sa, NULL);
+
+  // Rate limit and deduplicate the error chains of a failing dependency
+  set_log_rate_limit(LOG_ERR, KMYTHD_LOG_LIMIT_BURST,
+                     KMYTHD_LOG_LIMIT_INTERVAL, 1);
+  set_log_rate_limit(LOG_WARNING, KMYTHD_LOG_LIMIT_BURST,
+                     KMYTHD_LOG_LIMIT_INTERVAL, 1);
+
+  // Keep request handling off the log I/O path; a daemon under load would
+  // rather lose a log line than stall a client
+  if (kmyth_log_start_async(KMYTH_LOG_ASYNC_DEFAULT_CAPACITY,
+                            KMYTH_LOG_OVERFLOW_DROP))
+  {
+    kmyth_log(LOG_WARNING, "asynchronous logging unavailable");
+  }
+
+  // A client is waiting on every request, so the daemon's TPM commands go
+  // ahead of other processes' bulk work (e.g., a kmyth-reseal run)
+  set_default_tpm_priority(KMYTH_TPM_PRIORITY_INTERACTIVE);
+
+  // Connect to the TPM once; every request reuses this context and its
+  // caches (SRK handle, loaded storage keys, policy digests)
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
+    return 1;
+  }
+  if (kmyth_ctx_set_secret_cache(ctx, (size_t) cacheEntries,
+                                 KMYTHD_SECRET_CACHE_MAX_BYTES,
+                                 (unsigned int) cacheTtl))
+  {
+    kmyth_prewarm_free(prewarm.items, prewarm.count);
+    kmyth_ctx_destroy(&ctx);
+    return 1;
+  }
+
+  int listen_fd = -1;
+
+  if (setup_unix_server_socket(socketPath, socketMode, &listen_fd))
+  {
+    kmyth_prewarm_free(prewarm.items, prewarm.count);
+    kmyth_ctx_destroy(&ctx);
+    return 1;
+  }
+  kmyth_log(LOG_INFO, "kmythd listening on %s", socketPath);
+
+  // Prewarm alongside request handling, so services starting at the same
+  // time aren't kept waiting for the whole manifest
+  pthread_mutex_t ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_t prewarm_thread;
+  bool prewarming = false;
+
+  prewarm.ctx = ctx;
+  prewarm.ctx_lock = &ctx_lock;
+  if (prewarm.count > 0)
+  {
+    if (pthread_create(&prewarm_thread, NULL, prewarm_secrets, &prewarm))
+    {
+      kmyth_log(LOG_WARNING, "unable to start prewarming");
+    }
+    else
+    {
+      prewarming = true;
+    }
+  }
+
+  // metrics only change while a request is served, so rewriting the file
+  // after each one keeps it current without a timer
+  if (metricsPath != NULL && kmyth_metrics_write_file(metricsPath))
+  {
+    kmyth_log(LOG_WARNING, "unable to write metrics to %s", metricsPath);
+  }
+
+  unsigned long long request_count = 0;
+
+  // Requests are served one at a time, and the prewarm thread waits its
+  // turn between entries: a Kmyth context must not be used by more than
+  // one thread at once, and the TPM serializes commands anyway
+  while (!kmythd_stop)
+  {
+    int client_fd = accept(listen_fd, NULL, NULL);
+
+    if (client_fd == -1)
+    {
+      if (errno != EINTR)
+      {
+        kmyth_log(LOG_ERR, "accept error (%s)", strerror(errno));
+      }
+      continue;
+    }
+
+    // each request is an operation, so its log entries can be grouped and
+    // timed (in the JSON log format)
+    char op_id[32];
+
+    snprintf(op_id, sizeof(op_id), "req-%llu", ++request_count);
+    kmyth_log_op_begin(op_id);
+    pthread_mutex_lock(&ctx_lock);
+    serve_client(ctx, client_fd, allowed_uids, allowed_count);
+    pthread_mutex_unlock(&ctx_lock);
+    kmyth_log_op_end();
+    close(client_fd);
+
+    if (metricsPath != NULL && kmyth_metrics_write_file(metricsPath))
+    {
+      kmyth_log(LOG_WARNING, "unable to write metrics to %s", metricsPath);
+    }
+  }
+
+  // the prewarm thread stops after its current entry
+  if (prewarming)
+  {
+    pthread_join(prewarm_thread, NULL);
+  }
+  kmyth_prewarm_free(prewarm.items, prewarm.count);
+
+  if (cacheEntries > 0)
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    kmyth_ctx_get_secret_cache_stats(ctx, &hits, &misses);
+    kmyth_log(LOG_INFO, "secret cache: %llu hits, %llu misses",
+              (unsigned long long) hits, (unsigned long long) misses);
+  }
+  kmyth_log(LOG_INFO, "kmythd shutting down");
+  close(listen_fd);
+  unlink(socketPath);
+  kmyth_ctx_destroy(&ctx);
+  kmyth_log_stop_async();
+
+  return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * Kmyth Unseal Daemon Client - TPM 2.0
+ *
+ * Unseals a .ski file by handing it to a running kmythd over its local
+ * socket, so the caller pays no TPM connection or SRK discovery cost.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth_log.h"
+#include "kmythd_util.h"
+#include "memory_util.h"
+#include "socket_util.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
+          " -i or --input         Path to file containing data the to be unsealed\n"
+          " -o or --output        Destination path for unsealed file. This or -s must be specified. Will not overwrite any\n"
+          "                       existing files unless the 'force' option is selected.\n"
+          " -f or --force         Force the overwrite of an existing output file\n"
+          " -s or --stdout        Output unencrypted result to stdout instead of file.\n"
+          " -p or --policy_or     Unseals a file sealed using a compound \"policy or\".\n"
+          " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -S or --socket        Path of the kmythd socket. Defaults to $%s, else '%s'.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          KMYTHD_SOCKET_ENV, KMYTHD_DEFAULT_SOCKET_PATH);
+}
+
+const struct option longopts[] = {
+  {"auth_string", required_argument, 0, 'a'},
+  {"input", required_argument, 0, 'i'},
+  {"output", required_argument, 0, 'o'},
+  {"force", no_argument, 0, 'f'},
+  {"policy_or", no_argument, 0, 'p'},
+  {"owner_auth", required_argument, 0, 'w'},
+  {"stdout", no_argument, 0, 's'},
+  {"socket", required_argument, 0, 'S'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// request_unseal()
+//############################################################################
+static int request_unseal(const char *socket_path,
+                          uint8_t * ski, size_t ski_len,
+                          uint8_t * auth, size_t auth_len,
+                          uint8_t * oa, size_t oa_len, uint8_t flags,
+                          uint8_t ** rsp, size_t *rsp_len)
+{
+  uint8_t *req = NULL;
+  size_t req_len = 0;
+  int socket_fd = -1;
+
+  if (kmythd_build_unseal_request(ski, ski_len, auth, auth_len, oa, oa_len,
+                                  flags, &req, &req_len))
+  {
+    return 1;
+  }
+
+  if (setup_unix_client_socket(socket_path, &socket_fd))
+  {
+    kmyth_clear_and_free(req, req_len);
+    return 1;
+  }
+
+  int retval = kmythd_send_msg(socket_fd, req, req_len);
+
+  kmyth_clear_and_free(req, req_len);
+  if (retval == 0)
+  {
+    retval = kmythd_recv_msg(socket_fd, rsp, rsp_len);
+  }
+  close(socket_fd);
+
+  return retval;
+}
+
+int main(int argc, char **argv)
+{
+  // If no command line arguments provided, provide usage help and exit early
+  if (argc == 1)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Initialize parameters that might be modified by command line options
+  char *inPath = NULL;
+  char *outPath = NULL;
+  bool stdout_flag = false;
+  char *authString = NULL;
+  char *ownerAuthPasswd = "";
+  bool forceOverwrite = false;
+  uint8_t flags = 0;
+  const char *socketPath = getenv(KMYTHD_SOCKET_ENV);
+  int options;
+  int option_index;
+
+  if (socketPath == NULL)
+  {
+    socketPath = KMYTHD_DEFAULT_SOCKET_PATH;
+  }
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "a:i:o:w:S:fhpsv", longopts,
+                                &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'a':
+      authString = optarg;
+      break;
+    case 'f':
+      forceOverwrite = true;
+      break;
+    case 'p':
+      flags |= KMYTHD_FLAG_POLICY_OR;
+      break;
+    case 'i':
+      inPath = optarg;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'w':
+      ownerAuthPasswd = optarg;
+      break;
+    case 'S':
+      socketPath = optarg;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 's':
+      stdout_flag = true;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  //Since these originate in main() we know they are null terminated
+  size_t auth_string_len = (authString == NULL) ? 0 : strlen(authString);
+  size_t oa_passwd_len =
+    (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
+
+  if (inPath == NULL || (outPath == NULL && stdout_flag == false))
+  {
+    kmyth_log(LOG_ERR,
+              "Input file and output file (or stdout) must both be specified ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  if (stdout_flag == false)
+  {
+    if (verifyOutputFilePath(outPath))
+    {
+      kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", outPath);
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      return 1;
+    }
+
+    struct stat st = { 0 };
+
+    if (!forceOverwrite && !stat(outPath, &st))
+    {
+      kmyth_log(LOG_ERR,
+                "output filename (%s) already exists ... exiting", outPath);
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      return 1;
+    }
+  }
+
+  uint8_t *ski = NULL;
+  size_t ski_len = 0;
+
+  if (verifyInputFilePath(inPath) ||
+      read_bytes_from_file(inPath, &ski, &ski_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read input file %s ... exiting", inPath);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(ski);
+    return 1;
+  }
+
+  uint8_t *rsp = NULL;
+  size_t rsp_len = 0;
+  int retval = request_unseal(socketPath, ski, ski_len,
+                              (uint8_t *) authString, auth_string_len,
+                              (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                              flags, &rsp, &rsp_len);
+
+  // We are done with authString and ownerAuthPasswd, so clear them
+  kmyth_clear(authString, auth_string_len);
+  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+  free(ski);
+
+  if (retval || rsp_len < 1 || rsp[0] != KMYTHD_STATUS_OK)
+  {
+    kmyth_log(LOG_ERR, "kmythd %s unseal request ... exiting",
+              (retval == 0 && rsp_len >= 1 && rsp[0] == KMYTHD_STATUS_DENIED)
+              ? "refused the" : "failed the");
+    kmyth_clear_and_free(rsp, rsp_len);
+    return 1;
+  }
+
+  if (stdout_flag == true)
+  {
+    retval = print_to_stdout(rsp + 1, rsp_len - 1);
+  }
+  else
+  {
+    retval = write_bytes_to_file(outPath, rsp + 1, rsp_len - 1);
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error writing unsealed data ... exiting");
+  }
+
+  kmyth_clear_and_free(rsp, rsp_len);
+  return retval;
+}
@@ -4,6 +4,7 @@
  */
 
 #include <getopt.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -27,6 +28,10 @@ static void usage(const char *prog)
           "  -i or --ip    The IP address or hostname of the server.\n"
           "  -p or --port  The port number to connect to.\n"
           "  -u or --pub  Path to the file containing the server's public key.\n"
+          "Key Information --\n"
+          "  -k or --key_ids  Comma-separated IDs of the keys to request\n"
+          "                   (default: 1). All are requested over one\n"
+          "                   session.\n"
           "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog);
 }
 
@@ -47,103 +52,66 @@ const struct option longopts[] = {
   {"ip", required_argument, 0, 'i'},
   {"port", required_argument, 0, 'p'},
   {"pub", required_argument, 0, 'u'},
+  // Key info
+  {"key_ids", required_argument, 0, 'k'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
 };
 
-int retrieve_key_with_session_key(int socket_fd,
-                                  unsigned char *session_key,
-                                  size_t session_key_len, unsigned char *key_id,
-                                  size_t key_id_len, unsigned char **key,
-                                  size_t *key_len)
+//
+// send_key_request()
+//
+static int send_key_request(int socket_fd, nsl_session * session,
+                            KMIP * kmip_context,
+                            unsigned char *key_id, size_t key_id_len)
 {
-  KMIP kmip_context = { 0 };
-  kmip_init(&kmip_context, NULL, 0, KMIP_2_0);
-
   unsigned char *key_request = NULL;
   size_t key_request_len = 0;
 
-  int result = build_kmip_get_request(&kmip_context,
+  int result = build_kmip_get_request(kmip_context,
                                       key_id, key_id_len,
                                       &key_request, &key_request_len);
 
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to build the KMIP Get request.");
-    kmip_destroy(&kmip_context);
-    return 1;
-  }
-
-  unsigned char *encrypted_request = NULL;
-  size_t encrypted_request_len = 0;
-
-  result = aes_gcm_encrypt(session_key, session_key_len,
-                           key_request, key_request_len,
-                           &encrypted_request, &encrypted_request_len);
-  kmyth_clear_and_free(key_request, key_request_len);
-  key_request = NULL;
-  if (result)
-  {
-    kmyth_log(LOG_ERR, "Failed to encrypt the KMIP key request.");
-    kmip_destroy(&kmip_context);
     return 1;
   }
 
   kmyth_log(LOG_DEBUG, "Sending request for a key with ID: %.*s", key_id_len,
             key_id);
-  ssize_t write_result =
-    write(socket_fd, encrypted_request, encrypted_request_len);
-  kmyth_clear_and_free(encrypted_request, encrypted_request_len);
-  encrypted_request = NULL;
-
-  if (write_result != encrypted_request_len)
-  {
-    kmyth_log(LOG_ERR, "Failed to fully send the key request.");
-    kmyth_log(LOG_ERR, "Expected to write %zd bytes, only wrote %zd bytes.",
-              encrypted_request_len, write_result);
-    kmip_destroy(&kmip_context);
-    return 1;
-  }
-
-  // Read response from B; decrypt with S
-  unsigned char *encrypted_response = calloc(8192, sizeof(unsigned char));
-
-  if (NULL == encrypted_response)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the encrypted response buffer.");
-    kmip_destroy(&kmip_context);
-    return 1;
-  }
-
-  size_t encrypted_response_len = 8192 * sizeof(unsigned char);
-
-  ssize_t read_result = read(socket_fd, encrypted_response, encrypted_response_len);
-
-  if (read_result <= 0)
+  result = nsl_send_record(socket_fd, session, NSL_RECORD_DATA,
+                           key_request, key_request_len);
+  kmyth_clear_and_free(key_request, key_request_len);
+  if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to read the key response.");
-    kmyth_clear_and_free(encrypted_response, encrypted_response_len);
-    kmip_destroy(&kmip_context);
+    kmyth_log(LOG_ERR, "Failed to send the key request.");
     return 1;
   }
 
-  kmyth_log(LOG_DEBUG, "Received %zd bytes.", read_result);
+  return 0;
+}
 
+//
+// read_key_response()
+//
+static int read_key_response(int socket_fd, nsl_session * session,
+                             KMIP * kmip_context,
+                             unsigned char *key_id, size_t key_id_len,
+                             unsigned char **key, size_t *key_len)
+{
+  nsl_record_type type = NSL_RECORD_DATA;
   unsigned char *response = NULL;
   size_t response_len = 0;
 
-  // We've already dealt with the possibility that read_result is negative,
-  // so the type conversion here is safe.
-  result = aes_gcm_decrypt(session_key, session_key_len,
-                           encrypted_response, (size_t)read_result,
-                           &response, &response_len);
-  kmyth_clear_and_free(encrypted_response, encrypted_response_len);
-  encrypted_response = NULL;
-  if (result)
+  int result = nsl_recv_record(socket_fd, session,
+                               &type, &response, &response_len);
+
+  if (result || type != NSL_RECORD_DATA)
   {
-    kmyth_log(LOG_ERR, "Failed to decrypt the KMIP key response.");
-    kmip_destroy(&kmip_context);
+    kmyth_log(LOG_ERR, "Failed to read the key response.");
+    kmyth_clear_and_free(response, response_len);
     return 1;
   }
 
@@ -151,24 +119,148 @@ int retrieve_key_with_session_key(int socket_fd,
   size_t received_key_id_len = 0;
 
   // Parse the key response
-  result = parse_kmip_get_response(&kmip_context,
+  result = parse_kmip_get_response(kmip_context,
                                    response, response_len,
                                    &received_key_id, &received_key_id_len,
                                    key, key_len);
   kmyth_clear_and_free(response, response_len);
-  response = NULL;
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to parse the KMIP Get response.");
-    kmip_destroy(&kmip_context);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "Received a KMIP object with ID: %.*s",
             received_key_id_len, received_key_id);
 
+  // Responses come back in request order; make sure this one is the
+  // answer to the request it is taken for
+  if (received_key_id_len != key_id_len
+      || memcmp(received_key_id, key_id, key_id_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "The key response is for another key ID.");
+    kmyth_clear_and_free(received_key_id, received_key_id_len);
+    kmyth_clear_and_free(*key, *key_len);
+    *key = NULL;
+    *key_len = 0;
+    return 1;
+  }
+
   kmyth_clear_and_free(received_key_id, received_key_id_len);
+  return 0;
+}
+
+//
+// rekey_session()
+//
+static int rekey_session(int socket_fd, nsl_session * session,
+                         EVP_PKEY_CTX * public_key_ctx,
+                         EVP_PKEY_CTX * private_key_ctx,
+                         unsigned char *id, size_t id_len,
+                         unsigned char *remote_id, size_t remote_id_len)
+{
+  kmyth_log(LOG_DEBUG, "Rekeying the session after %" PRIu64 " requests.",
+            session->requests);
+
+  if (nsl_send_record(socket_fd, session, NSL_RECORD_REKEY, NULL, 0))
+  {
+    kmyth_log(LOG_ERR, "Failed to send the rekey request.");
+    return 1;
+  }
+
+  unsigned char *session_key = NULL;
+  size_t session_key_len = 0;
+
+  if (negotiate_client_session_key(socket_fd,
+                                   public_key_ctx, private_key_ctx,
+                                   id, id_len, remote_id, remote_id_len,
+                                   &session_key, &session_key_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to negotiate a new session key.");
+    return 1;
+  }
+
+  nsl_session_init(session, session_key, session_key_len, 0);
+  return 0;
+}
+
+//
+// retrieve_keys_with_session()
+//
+// Requests are pipelined: up to KMYTH_NSL_PIPELINE_DEPTH are sent ahead of
+// their responses. When the session key reaches the end of its life, the
+// outstanding responses are read before the session is rekeyed.
+//
+static int retrieve_keys_with_session(int socket_fd, nsl_session * session,
+                                      EVP_PKEY_CTX * public_key_ctx,
+                                      EVP_PKEY_CTX * private_key_ctx,
+                                      unsigned char *id, size_t id_len,
+                                      unsigned char *remote_id,
+                                      size_t remote_id_len,
+                                      char **key_ids, size_t key_id_count)
+{
+  KMIP kmip_context = { 0 };
+  kmip_init(&kmip_context, NULL, 0, KMIP_2_0);
+
+  size_t sent = 0;
+  size_t received = 0;
+
+  while (received < key_id_count)
+  {
+    while (sent < key_id_count && sent - received < KMYTH_NSL_PIPELINE_DEPTH)
+    {
+      if (nsl_session_expired(session))
+      {
+        if (sent > received)
+        {
+          break;
+        }
+        if (rekey_session(socket_fd, session,
+                          public_key_ctx, private_key_ctx,
+                          id, id_len, remote_id, remote_id_len))
+        {
+          kmip_destroy(&kmip_context);
+          return 1;
+        }
+      }
+
+      if (send_key_request(socket_fd, session, &kmip_context,
+                           (unsigned char *) key_ids[sent],
+                           strlen(key_ids[sent])))
+      {
+        kmip_destroy(&kmip_context);
+        return 1;
+      }
+      sent++;
+    }
+
+    unsigned char *key = NULL;
+    size_t key_len = 0;
+
+    if (read_key_response(socket_fd, session, &kmip_context,
+                          (unsigned char *) key_ids[received],
+                          strlen(key_ids[received]), &key, &key_len))
+    {
+      kmyth_log(LOG_ERR, "Failed to retrieve key: %s", key_ids[received]);
+      kmip_destroy(&kmip_context);
+      return 1;
+    }
+    if (key_len > 0)
+    {
+      kmyth_log(LOG_INFO, "Received symmetric key %s: 0x%02X..%02X",
+                key_ids[received], key[0], key[key_len - 1]);
+    }
+    kmyth_clear_and_free(key, key_len);
+    received++;
+  }
+
   kmip_destroy(&kmip_context);
 
+  if (nsl_send_record(socket_fd, session, NSL_RECORD_CLOSE, NULL, 0))
+  {
+    kmyth_log(LOG_ERR, "Failed to close the session.");
+    return 1;
+  }
+
   return 0;
 }
 
@@ -185,12 +277,13 @@ int main(int argc, char **argv)
   char *ip = NULL;
   char *port = NULL;
   char *cert = NULL;
+  char *key_id_list = NULL;
 
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "r:i:p:u:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:i:p:u:k:h", longopts, &option_index)) != -1)
   {
     switch (options)
     {
@@ -208,6 +301,10 @@ int main(int argc, char **argv)
     case 'u':
       cert = optarg;
       break;
+      // Key info
+    case 'k':
+      key_id_list = optarg;
+      break;
       // Misc
     case 'h':
       usage(argv[0]);
@@ -219,13 +316,50 @@ int main(int argc, char **argv)
 
   set_applog_severity_threshold(LOG_INFO);
 
+  // Split the key ID list
+  char *key_id_buf = strdup((key_id_list != NULL) ? key_id_list : "1");
+  size_t key_id_max = 1;
+
+  for (char *c = key_id_buf; c != NULL && *c != '\0'; c++)
+  {
+    key_id_max += (*c == ',');
+  }
+
+  char **key_ids = calloc(key_id_max, sizeof(char *));
+  size_t key_id_count = 0;
+
+  if (key_id_buf == NULL || key_ids == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the key ID list.");
+    free(key_id_buf);
+    free(key_ids);
+    return 1;
+  }
+
+  char *saveptr = NULL;
+
+  for (char *tok = strtok_r(key_id_buf, ",", &saveptr); tok != NULL;
+       tok = strtok_r(NULL, ",", &saveptr))
+  {
+    key_ids[key_id_count++] = tok;
+  }
+  if (key_id_count == 0)
+  {
+    kmyth_log(LOG_ERR, "No key IDs given.");
+    free(key_id_buf);
+    free(key_ids);
+    return 1;
+  }
+
   // Create socket to B
   int socket_fd = -1;
-  int result = setup_client_socket(ip, port, &socket_fd);
+  int result = setup_client_socket(ip, port, NULL, &socket_fd);
 
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to setup socket.");
+    free(key_id_buf);
+    free(key_ids);
     return 1;
   }
 
@@ -236,6 +370,8 @@ int main(int argc, char **argv)
   {
     kmyth_log(LOG_ERR, "Failed to setup public EVP context.");
     close(socket_fd);
+    free(key_id_buf);
+    free(key_ids);
     return 1;
   }
   EVP_PKEY_CTX *private_key_ctx = setup_private_evp_context(key);
@@ -245,6 +381,8 @@ int main(int argc, char **argv)
     kmyth_log(LOG_ERR, "Failed to setup the private EVP context.");
     EVP_PKEY_CTX_free(public_key_ctx);
     close(socket_fd);
+    free(key_id_buf);
+    free(key_ids);
     return 1;
   }
 
@@ -267,35 +405,30 @@ int main(int argc, char **argv)
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to negotiate the client session key.");
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
     close(socket_fd);
+    free(key_id_buf);
+    free(key_ids);
     return 1;
   }
 
-  EVP_PKEY_CTX_free(public_key_ctx);
-  EVP_PKEY_CTX_free(private_key_ctx);
+  nsl_session session = { 0 };
 
-  // Request key K from B; encrypt message with S
-  unsigned char *key_id = (unsigned char *) "1\0";
-  size_t key_id_len = 2;
+  nsl_session_init(&session, session_key, session_key_len, 0);
 
-  unsigned char *retrieved_key = NULL;
-  size_t retrieved_key_len = 0;
+  // Request the keys from B over the session (rekeying as needed)
+  result = retrieve_keys_with_session(socket_fd, &session,
+                                      public_key_ctx, private_key_ctx,
+                                      id, id_len, remote_id, remote_id_len,
+                                      key_ids, key_id_count);
 
-  result = retrieve_key_with_session_key(socket_fd,
-                                         session_key, session_key_len,
-                                         key_id, key_id_len,
-                                         &retrieved_key, &retrieved_key_len);
-  if (result)
-  {
-    kmyth_log(LOG_ERR, "Failed to retrieve key: %.*s", key_id_len, key_id);
-    close(socket_fd);
-    return 1;
-  }
-  kmyth_log(LOG_INFO, "Received symmetric key: 0x%02X..%02X",
-            retrieved_key[0], retrieved_key[retrieved_key_len - 1]);
-
-  kmyth_clear_and_free(retrieved_key, retrieved_key_len);
+  nsl_session_clear(&session);
+  EVP_PKEY_CTX_free(public_key_ctx);
+  EVP_PKEY_CTX_free(private_key_ctx);
   close(socket_fd);
+  free(key_id_buf);
+  free(key_ids);
 
-  return 0;
+  return result;
 }
@@ -1,5 +1,24 @@
+/**
+ * @file nsl_server.c
+ * @brief A server app for testing the Needham-Schroeder-Lowe protocol
+ *
+ * One thread runs an epoll loop over non-blocking sockets, driving each
+ * client through the NSL handshake and then its session (key requests,
+ * rekeys). The RSA work of the handshake (decrypting the client's nonce
+ * request and confirmation, encrypting the nonce response) is handed to a
+ * bounded pool of worker threads, so a burst of handshakes neither stalls
+ * established sessions nor grows the number of threads.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netdb.h>
@@ -13,6 +32,17 @@
 #include "aes_gcm.h"
 #include "kmip_util.h"
 
+// most client connections served at once (further clients are turned away)
+#define NSL_SERVER_DEFAULT_MAX_CONNS 1024
+
+// most bytes queued for a client before its input is left unread until the
+// client reads some of its responses
+#define NSL_SERVER_MAX_PENDING_OUTPUT (256 * 1024)
+
+#define NSL_SERVER_MAX_EVENTS 256
+
+static volatile sig_atomic_t nsl_server_stop = 0;
+
 static void usage(const char *prog)
 {
   fprintf(stdout,
@@ -21,9 +51,15 @@ static void usage(const char *prog)
           "Server Information --\n"
           "  -r or --priv  Path to the file containing the server's private key.\n"
           "  -p or --port  The port number to connect to.\n"
+          "  -w or --workers      Threads running the handshakes' RSA operations.\n"
+          "                       Defaults to the number of online CPUs.\n"
+          "  -c or --max_clients  Most clients served at once. Defaults to %d.\n"
+          "  -R or --reuseport    Share the port with other nsl-server processes\n"
+          "                       (SO_REUSEPORT); the system spreads clients across them.\n"
           "Client Information --\n"
           "  -u or --pub  Path to the file containing the client's public key.\n"
-          "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog);
+          "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog,
+          NSL_SERVER_DEFAULT_MAX_CONNS);
 }
 
 int check_string_arg(const char *arg, size_t arg_len,
@@ -40,6 +76,9 @@ const struct option longopts[] = {
   // Server info
   {"priv", required_argument, 0, 'r'},
   {"port", required_argument, 0, 'p'},
+  {"workers", required_argument, 0, 'w'},
+  {"max_clients", required_argument, 0, 'c'},
+  {"reuseport", no_argument, 0, 'R'},
   // Client info
   {"pub", required_argument, 0, 'u'},
   // Misc
@@ -47,70 +86,348 @@ const struct option longopts[] = {
   {0, 0, 0, 0}
 };
 
-int send_key_with_session_key(int socket_fd,
-                              unsigned char *session_key,
-                              size_t session_key_len, unsigned char *key,
-                              size_t key_len)
+/**
+ * @brief Where a client connection is in the protocol
+ */
+typedef enum nsl_conn_state
+{
+  NSL_CONN_READ_REQUEST,        ///< reading the nonce request
+  NSL_CONN_RESPOND,             ///< a worker is building the nonce response
+  NSL_CONN_READ_CONFIRMATION,   ///< reading the nonce confirmation
+  NSL_CONN_FINISH,              ///< a worker is checking the confirmation
+  NSL_CONN_SESSION,             ///< reading session records
+  NSL_CONN_CLOSING,             ///< sending the last output, then closing
+} nsl_conn_state;
+
+/**
+ * @brief A client connection
+ */
+typedef struct nsl_conn
+{
+  int fd;
+  nsl_conn_state state;
+
+  // message being read: a handshake message (the size of an RSA block of
+  // the server's key), or a record prefix followed by the sealed record
+  unsigned char *in;
+  size_t in_size;
+  size_t in_len;
+  size_t in_need;
+  bool in_prefix;
+
+  // output waiting for the socket to accept it
+  unsigned char *out;
+  size_t out_size;
+  size_t out_len;
+  size_t out_off;
+
+  // handshake state, and the results a worker leaves
+  unsigned char *nonce_a;
+  size_t nonce_a_len;
+  unsigned char *nonce_b;
+  size_t nonce_b_len;
+  unsigned char *session_key;
+  size_t session_key_len;
+  unsigned char *job_out;
+  size_t job_out_len;
+  int job_result;
+
+  // set if the client hung up while a worker held the connection
+  bool detached;
+
+  nsl_session session;
+  uint32_t events;
+
+  struct nsl_conn *next_job;
+} nsl_conn;
+
+/**
+ * @brief Shared state of the event loop and the worker pool
+ */
+typedef struct nsl_server
+{
+  int epoll_fd;
+  int listen_fd;
+  int event_fd;
+  socket_options socket_opts;
+
+  EVP_PKEY_CTX *public_key_ctx;
+  EVP_PKEY_CTX *private_key_ctx;
+  size_t handshake_msg_len;
+
+  unsigned char *id;
+  size_t id_len;
+  unsigned char *key;
+  size_t key_len;
+
+  size_t conn_count;
+  size_t max_conns;
+
+  // KMIP codec for the key requests (handled on the event loop thread only)
+  kmip_codec kmip;
+
+  // jobs waiting for a worker, and jobs the workers have finished
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  nsl_conn *jobs_head;
+  nsl_conn *jobs_tail;
+  nsl_conn *done;
+  bool stopping;
+} nsl_server;
+
+//
+// handle_stop_signal()
+//
+static void handle_stop_signal(int sig)
 {
-  unsigned char *encrypted_request = calloc(8192, sizeof(unsigned char));
+  (void) sig;
+  nsl_server_stop = 1;
+}
 
-  if (NULL == encrypted_request)
+//
+// conn_free()
+//
+static void conn_free(nsl_server * server, nsl_conn * conn)
+{
+  epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  kmyth_clear_and_free(conn->in, conn->in_size);
+  kmyth_clear_and_free(conn->out, conn->out_size);
+  kmyth_clear_and_free(conn->nonce_a, conn->nonce_a_len);
+  kmyth_clear_and_free(conn->nonce_b, conn->nonce_b_len);
+  kmyth_clear_and_free(conn->session_key, conn->session_key_len);
+  kmyth_clear_and_free(conn->job_out, conn->job_out_len);
+  nsl_session_clear(&conn->session);
+  free(conn);
+  server->conn_count--;
+}
+
+//
+// conn_expect()
+//
+// Readies the input buffer for a message of need bytes.
+//
+static int conn_expect(nsl_conn * conn, size_t need)
+{
+  if (need > conn->in_size)
   {
-    kmyth_log(LOG_ERR, "Failed to allocated the encrypted request buffer.");
-    return 1;
+    kmyth_clear_and_free(conn->in, conn->in_size);
+    conn->in_size = 0;
+    conn->in = calloc(need, sizeof(unsigned char));
+    if (conn->in == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
+      return 1;
+    }
+    conn->in_size = need;
   }
+  conn->in_len = 0;
+  conn->in_need = need;
+  return 0;
+}
 
-  size_t encrypted_request_len = 8192 * sizeof(unsigned char);
+//
+// conn_queue_output()
+//
+static int conn_queue_output(nsl_conn * conn, unsigned char *data, size_t len)
+{
+  // Drop what has been sent before growing the buffer
+  if (conn->out_off > 0)
+  {
+    memmove(conn->out, conn->out + conn->out_off,
+            conn->out_len - conn->out_off);
+    conn->out_len -= conn->out_off;
+    conn->out_off = 0;
+  }
+  if (conn->out_len + len > conn->out_size)
+  {
+    size_t size = conn->out_size ? conn->out_size : 4096;
+
+    while (size < conn->out_len + len)
+    {
+      size *= 2;
+    }
+
+    unsigned char *out = calloc(size, sizeof(unsigned char));
+
+    if (out == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the output buffer.");
+      return 1;
+    }
+    if (conn->out_len > 0)
+    {
+      memcpy(out, conn->out, conn->out_len);
+    }
+    kmyth_clear_and_free(conn->out, conn->out_size);
+    conn->out = out;
+    conn->out_size = size;
+  }
+  memcpy(conn->out + conn->out_len, data, len);
+  conn->out_len += len;
+  return 0;
+}
 
-  ssize_t read_result = read(socket_fd,
-                             encrypted_request, encrypted_request_len);
+//
+// conn_update_events()
+//
+// Asks for input only while the connection is reading a message and not
+// too far behind on its output, and for output only while some is queued.
+//
+static void conn_update_events(nsl_server * server, nsl_conn * conn)
+{
+  uint32_t events = 0;
+  size_t pending = conn->out_len - conn->out_off;
 
-  if (read_result <= 0)
+  if ((conn->state == NSL_CONN_READ_REQUEST
+       || conn->state == NSL_CONN_READ_CONFIRMATION
+       || conn->state == NSL_CONN_SESSION)
+      && pending < NSL_SERVER_MAX_PENDING_OUTPUT)
   {
-    kmyth_log(LOG_ERR, "Failed to receive the key request.");
-    kmyth_clear_and_free(encrypted_request, encrypted_request_len);
-    return 1;
+    events |= EPOLLIN;
+  }
+  if (pending > 0)
+  {
+    events |= EPOLLOUT;
   }
+  if (events != conn->events)
+  {
+    struct epoll_event ev = {.events = events,.data.ptr = conn };
 
-  unsigned char *request = NULL;
-  size_t request_len = 0;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+  }
+}
 
-  // We've already dealt with the possibility that read_result is
-  // negative, so the cast here is safe.
-  int result = aes_gcm_decrypt(session_key, session_key_len,
-                               encrypted_request, (size_t)read_result,
-                               &request, &request_len);
+//
+// submit_job()
+//
+static void submit_job(nsl_server * server, nsl_conn * conn)
+{
+  pthread_mutex_lock(&server->lock);
+  conn->next_job = NULL;
+  if (server->jobs_tail != NULL)
+  {
+    server->jobs_tail->next_job = conn;
+  }
+  else
+  {
+    server->jobs_head = conn;
+  }
+  server->jobs_tail = conn;
+  pthread_cond_signal(&server->cond);
+  pthread_mutex_unlock(&server->lock);
+}
 
-  kmyth_clear_and_free(encrypted_request, encrypted_request_len);
-  encrypted_request = NULL;
-  if (result)
+//
+// run_job()
+//
+// The RSA operations of one handshake step. The server's EVP contexts are
+// shared by the workers: nsl_util only reads their keys, and runs the
+// operations on contexts prepared for each thread. The worker only touches
+// the connection's input and handshake state; the event loop may still be
+// sending its queued output.
+//
+static void run_job(nsl_server * server, nsl_conn * conn)
+{
+  if (conn->state == NSL_CONN_RESPOND)
   {
-    kmyth_log(LOG_ERR, "Failed to decrypt the KMIP key request.");
-    return 1;
+    conn->job_result = nsl_server_handshake_respond(server->public_key_ctx,
+                                                    server->private_key_ctx,
+                                                    server->id,
+                                                    server->id_len,
+                                                    conn->in, conn->in_len,
+                                                    &conn->nonce_a,
+                                                    &conn->nonce_a_len,
+                                                    &conn->nonce_b,
+                                                    &conn->nonce_b_len,
+                                                    &conn->job_out,
+                                                    &conn->job_out_len);
+  }
+  else
+  {
+    conn->job_result = nsl_server_handshake_finish(server->private_key_ctx,
+                                                   conn->in, conn->in_len,
+                                                   conn->nonce_a,
+                                                   conn->nonce_a_len,
+                                                   conn->nonce_b,
+                                                   conn->nonce_b_len,
+                                                   &conn->session_key,
+                                                   &conn->session_key_len);
+    kmyth_clear_and_free(conn->nonce_a, conn->nonce_a_len);
+    kmyth_clear_and_free(conn->nonce_b, conn->nonce_b_len);
+    conn->nonce_a = NULL;
+    conn->nonce_a_len = 0;
+    conn->nonce_b = NULL;
+    conn->nonce_b_len = 0;
   }
+}
 
-  KMIP kmip_context = { 0 };
-  kmip_init(&kmip_context, NULL, 0, KMIP_2_0);
+//
+// worker_main()
+//
+static void *worker_main(void *arg)
+{
+  nsl_server *server = (nsl_server *) arg;
 
-  if (request_len > kmip_context.max_message_size)
+  pthread_mutex_lock(&server->lock);
+  while (!server->stopping)
+  {
+    nsl_conn *conn = server->jobs_head;
+
+    if (conn == NULL)
+    {
+      pthread_cond_wait(&server->cond, &server->lock);
+      continue;
+    }
+    server->jobs_head = conn->next_job;
+    if (server->jobs_head == NULL)
+    {
+      server->jobs_tail = NULL;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    run_job(server, conn);
+
+    pthread_mutex_lock(&server->lock);
+    conn->next_job = server->done;
+    server->done = conn;
+
+    uint64_t one = 1;
+
+    if (write(server->event_fd, &one, sizeof(one)) != sizeof(one))
+    {
+      kmyth_log(LOG_ERR, "Failed to signal a finished handshake step.");
+    }
+  }
+  pthread_mutex_unlock(&server->lock);
+
+  return NULL;
+}
+
+//
+// handle_key_request()
+//
+static int handle_key_request(nsl_server * server, nsl_conn * conn,
+                              unsigned char *request, size_t request_len)
+{
+  if (request_len > (size_t) server->kmip.ctx.max_message_size)
   {
     kmyth_log(LOG_ERR, "KMIP request exceeds max message size.");
-    kmyth_clear_and_free(request, request_len);
-    kmip_destroy(&kmip_context);
     return 1;
   }
 
   unsigned char *key_id = NULL;
   size_t key_id_len = 0;
 
-  result = parse_kmip_get_request(&kmip_context,
-                                  request, request_len, &key_id, &key_id_len);
-  kmyth_clear_and_free(request, request_len);
-  request = NULL;
+  int result = kmip_codec_parse_get_request(&server->kmip,
+                                            request, request_len,
+                                            &key_id, &key_id_len);
+
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to parse the KMIP Get request.");
-    kmip_destroy(&kmip_context);
+    kmip_codec_reset(&server->kmip);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "Received a KMIP Get request for key ID: %.*s",
@@ -119,43 +436,399 @@ int send_key_with_session_key(int socket_fd,
   unsigned char *response = NULL;
   size_t response_len = 0;
 
-  result = build_kmip_get_response(&kmip_context,
-                                   key_id, key_id_len,
-                                   key, key_len, &response, &response_len);
-  kmyth_clear_and_free(key_id, key_id_len);
-  key_id = NULL;
-  kmip_destroy(&kmip_context);
+  result = kmip_codec_build_get_response(&server->kmip,
+                                         key_id, key_id_len,
+                                         server->key, server->key_len,
+                                         &response, &response_len);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to build the KMIP Get response.");
+    kmip_codec_reset(&server->kmip);
     return 1;
   }
 
-  unsigned char *encrypted_response = NULL;
-  size_t encrypted_response_len = 0;
+  unsigned char *record = NULL;
+  size_t record_len = 0;
 
-  result = aes_gcm_encrypt(session_key, session_key_len,
-                           response, response_len,
-                           &encrypted_response, &encrypted_response_len);
-  kmyth_clear_and_free(response, response_len);
-  response = NULL;
+  result = nsl_seal_record(&conn->session, NSL_RECORD_DATA,
+                           response, response_len, &record, &record_len);
+  kmip_codec_reset(&server->kmip);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to encrypt the KMIP key response.");
     return 1;
   }
 
-  ssize_t send_result = write(socket_fd,
-                              encrypted_response, encrypted_response_len);
+  result = conn_queue_output(conn, record, record_len);
+  kmyth_clear_and_free(record, record_len);
+  return result;
+}
 
-  kmyth_clear_and_free(encrypted_response, encrypted_response_len);
-  encrypted_response = NULL;
-  if (encrypted_response_len != send_result)
+//
+// handle_message()
+//
+// Acts on a complete input message. Returns 1 if the connection must be
+// dropped.
+//
+static int handle_message(nsl_server * server, nsl_conn * conn)
+{
+  switch (conn->state)
   {
-    kmyth_log(LOG_ERR, "Failed to fully send the encrypted KMIP key response.");
+  case NSL_CONN_READ_REQUEST:
+    conn->state = NSL_CONN_RESPOND;
+    submit_job(server, conn);
+    return 0;
+  case NSL_CONN_READ_CONFIRMATION:
+    conn->state = NSL_CONN_FINISH;
+    submit_job(server, conn);
+    return 0;
+  case NSL_CONN_SESSION:
+    break;
+  default:
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "Successfully sent the encrypted KMIP key response.");
+
+  // A record prefix: read the sealed record it announces
+  if (conn->in_prefix)
+  {
+    size_t sealed_len = 0;
+
+    if (nsl_record_sealed_len(conn->in, &sealed_len))
+    {
+      return 1;
+    }
+    conn->in_prefix = false;
+    return conn_expect(conn, sealed_len);
+  }
+
+  // A sealed record: the next message is the next record's prefix
+  int expired = nsl_session_expired(&conn->session);
+  nsl_record_type type = NSL_RECORD_DATA;
+  unsigned char *payload = NULL;
+  size_t payload_len = 0;
+
+  if (nsl_open_record(&conn->session, conn->in, conn->in_len,
+                      &type, &payload, &payload_len))
+  {
+    return 1;
+  }
+
+  int result = 0;
+
+  switch (type)
+  {
+  case NSL_RECORD_DATA:
+    if (expired)
+    {
+      kmyth_log(LOG_ERR, "Request over an expired session key.");
+      result = 1;
+      break;
+    }
+    result = handle_key_request(server, conn, payload, payload_len);
+    if (result == 0)
+    {
+      conn->in_prefix = true;
+      result = conn_expect(conn, NSL_RECORD_PREFIX_LEN);
+    }
+    break;
+  case NSL_RECORD_REKEY:
+    kmyth_log(LOG_DEBUG, "Rekeying a session.");
+    conn->state = NSL_CONN_READ_REQUEST;
+    result = conn_expect(conn, server->handshake_msg_len);
+    break;
+  case NSL_RECORD_CLOSE:
+    conn->state = NSL_CONN_CLOSING;
+    break;
+  }
+  kmyth_clear_and_free(payload, payload_len);
+
+  return result;
+}
+
+//
+// handle_input()
+//
+// Reads (and acts on) as many complete messages as the socket holds.
+// Returns 1 if the connection must be dropped.
+//
+static int handle_input(nsl_server * server, nsl_conn * conn)
+{
+  while (conn->state == NSL_CONN_READ_REQUEST
+         || conn->state == NSL_CONN_READ_CONFIRMATION
+         || conn->state == NSL_CONN_SESSION)
+  {
+    if (conn->out_len - conn->out_off >= NSL_SERVER_MAX_PENDING_OUTPUT)
+    {
+      return 0;
+    }
+
+    ssize_t n = read(conn->fd, conn->in + conn->in_len,
+                     conn->in_need - conn->in_len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return 0;
+    }
+    if (n <= 0)
+    {
+      kmyth_log(LOG_DEBUG, "A client disconnected.");
+      return 1;
+    }
+
+    conn->in_len += (size_t) n;
+    if (conn->in_len == conn->in_need && handle_message(server, conn))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//
+// handle_output()
+//
+// Sends as much queued output as the socket takes. Returns 1 if the
+// connection must be dropped (including a closing connection whose output
+// has all been sent).
+//
+static int handle_output(nsl_conn * conn)
+{
+  while (conn->out_off < conn->out_len)
+  {
+    ssize_t n = write(conn->fd, conn->out + conn->out_off,
+                      conn->out_len - conn->out_off);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return 0;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    conn->out_off += (size_t) n;
+  }
+  conn->out_off = 0;
+  conn->out_len = 0;
+
+  return (conn->state == NSL_CONN_CLOSING) ? 1 : 0;
+}
+
+//
+// service_conn()
+//
+// Makes what progress the socket allows. Returns 1 if the connection must
+// be dropped.
+//
+static int service_conn(nsl_server * server, nsl_conn * conn)
+{
+  if (handle_input(server, conn))
+  {
+    return 1;
+  }
+  return handle_output(conn);
+}
+
+//
+// handle_finished_jobs()
+//
+static void handle_finished_jobs(nsl_server * server)
+{
+  uint64_t count = 0;
+
+  if (read(server->event_fd, &count, sizeof(count)) != sizeof(count))
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&server->lock);
+  nsl_conn *conn = server->done;
+
+  server->done = NULL;
+  pthread_mutex_unlock(&server->lock);
+
+  while (conn != NULL)
+  {
+    nsl_conn *next = conn->next_job;
+    int drop = conn->job_result || conn->detached;
+
+    if (!drop && conn->state == NSL_CONN_RESPOND)
+    {
+      conn->state = NSL_CONN_READ_CONFIRMATION;
+      drop = conn_queue_output(conn, conn->job_out, conn->job_out_len)
+        || conn_expect(conn, server->handshake_msg_len);
+      kmyth_clear_and_free(conn->job_out, conn->job_out_len);
+      conn->job_out = NULL;
+      conn->job_out_len = 0;
+    }
+    else if (!drop)
+    {
+      nsl_session_init(&conn->session, conn->session_key,
+                       conn->session_key_len, 1);
+      conn->session_key = NULL;
+      conn->session_key_len = 0;
+      conn->state = NSL_CONN_SESSION;
+      conn->in_prefix = true;
+      drop = conn_expect(conn, NSL_RECORD_PREFIX_LEN);
+    }
+
+    if (!drop)
+    {
+      drop = service_conn(server, conn);
+    }
+    if (drop)
+    {
+      conn_free(server, conn);
+    }
+    else
+    {
+      conn_update_events(server, conn);
+    }
+    conn = next;
+  }
+}
+
+//
+// accept_clients()
+//
+static void accept_clients(nsl_server * server)
+{
+  while (1)
+  {
+    int fd = accept4(server->listen_fd, NULL, NULL,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd == -1)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        kmyth_log(LOG_ERR, "Socket accept failed (%s).", strerror(errno));
+      }
+      return;
+    }
+    if (server->conn_count >= server->max_conns)
+    {
+      kmyth_log(LOG_WARNING, "Too many clients; turning one away.");
+      close(fd);
+      continue;
+    }
+
+    // the handshake and key messages are small: send each at once
+    if (apply_socket_options(fd, &server->socket_opts))
+    {
+      kmyth_log(LOG_WARNING, "Failed to set client socket options.");
+    }
+
+    nsl_conn *conn = calloc(1, sizeof(nsl_conn));
+
+    if (conn == NULL || conn_expect(conn, server->handshake_msg_len))
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate a client connection.");
+      free(conn);
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->state = NSL_CONN_READ_REQUEST;
+    conn->events = EPOLLIN;
+
+    struct epoll_event ev = {.events = EPOLLIN,.data.ptr = conn };
+
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+    {
+      kmyth_log(LOG_ERR, "Failed to watch a client connection.");
+      kmyth_clear_and_free(conn->in, conn->in_size);
+      free(conn);
+      close(fd);
+      continue;
+    }
+    server->conn_count++;
+  }
+}
+
+//
+// run_server()
+//
+static int run_server(nsl_server * server)
+{
+  struct epoll_event events[NSL_SERVER_MAX_EVENTS];
+
+  while (!nsl_server_stop)
+  {
+    bool jobs_done = false;
+
+    int n = epoll_wait(server->epoll_fd, events, NSL_SERVER_MAX_EVENTS, -1);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "epoll_wait failed (%s).", strerror(errno));
+      return 1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+      if (events[i].data.ptr == &server->listen_fd)
+      {
+        accept_clients(server);
+        continue;
+      }
+      if (events[i].data.ptr == &server->event_fd)
+      {
+        jobs_done = true;
+        continue;
+      }
+
+      nsl_conn *conn = (nsl_conn *) events[i].data.ptr;
+      int drop = 0;
+
+      // A hangup is reported even with no events asked for; while a worker
+      // holds the connection, stop watching it and drop it when the worker
+      // is done
+      if ((conn->state == NSL_CONN_RESPOND || conn->state == NSL_CONN_FINISH)
+          && (events[i].events & (EPOLLERR | EPOLLHUP)))
+      {
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        conn->detached = true;
+        continue;
+      }
+
+      if (events[i].events & EPOLLOUT)
+      {
+        drop = handle_output(conn);
+      }
+      if (!drop)
+      {
+        drop = service_conn(server, conn);
+      }
+      if (drop)
+      {
+        conn_free(server, conn);
+      }
+      else
+      {
+        conn_update_events(server, conn);
+      }
+    }
+
+    // Last, as it may free connections that other events of this batch
+    // refer to
+    if (jobs_done)
+    {
+      handle_finished_jobs(server);
+    }
+  }
 
   return 0;
 }
@@ -172,12 +845,18 @@ int main(int argc, char **argv)
   char *key = NULL;
   char *port = NULL;
   char *cert = NULL;
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  long max_conns = NSL_SERVER_DEFAULT_MAX_CONNS;
+  socket_options socket_opts;
+
+  socket_options_init(&socket_opts);
 
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "r:p:u:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:p:w:c:Ru:h", longopts,
+                      &option_index)) != -1)
   {
     switch (options)
     {
@@ -188,6 +867,15 @@ int main(int argc, char **argv)
     case 'p':
       port = optarg;
       break;
+    case 'w':
+      workers = strtol(optarg, NULL, 10);
+      break;
+    case 'c':
+      max_conns = strtol(optarg, NULL, 10);
+      break;
+    case 'R':
+      socket_opts.reuseport = true;
+      break;
       // Client info
     case 'u':
       cert = optarg;
@@ -201,80 +889,51 @@ int main(int argc, char **argv)
     }
   }
 
-  set_applog_severity_threshold(LOG_INFO);
-
-  // Create server socket
-  kmyth_log(LOG_INFO, "Setting up server socket");
-
-  int listen_fd = -1, socket_fd = -1;
-  int result = setup_server_socket(port, &listen_fd);
-
-  if (result)
+  if (workers < 1 || workers > 1024 || max_conns < 1)
   {
-    kmyth_log(LOG_ERR, "Failed to setup server socket.");
+    kmyth_log(LOG_ERR, "Invalid worker or client count.");
     return 1;
   }
 
-  if (listen(listen_fd, 1))
-  {
-    kmyth_log(LOG_ERR, "Socket listen failed.");
-    close(listen_fd);
-    return 1;
-  }
+  set_applog_severity_threshold(LOG_INFO);
 
-  socket_fd = accept(listen_fd, NULL, NULL);
-  if (socket_fd == -1)
-  {
-    kmyth_log(LOG_ERR, "Socket accept failed.");
-    close(listen_fd);
-    return 1;
-  }
+  struct sigaction sa;
 
-  close(listen_fd);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
 
   // Load public/private keys; create EVP contexts
-  EVP_PKEY_CTX *public_key_ctx = setup_public_evp_context(cert);
+  nsl_server server = { 0 };
 
-  if (NULL == public_key_ctx)
+  server.public_key_ctx = setup_public_evp_context(cert);
+  if (NULL == server.public_key_ctx)
   {
     kmyth_log(LOG_ERR, "Failed to setup public EVP context.");
-    close(socket_fd);
     return 1;
   }
-  EVP_PKEY_CTX *private_key_ctx = setup_private_evp_context(key);
-
-  if (NULL == private_key_ctx)
+  server.private_key_ctx = setup_private_evp_context(key);
+  if (NULL == server.private_key_ctx)
   {
     kmyth_log(LOG_ERR, "Failed to setup the private EVP context.");
-    EVP_PKEY_CTX_free(public_key_ctx);
-    close(socket_fd);
+    EVP_PKEY_CTX_free(server.public_key_ctx);
     return 1;
   }
 
-  // Conduct NSL to obtain a shared session key
-  unsigned char *id = (unsigned char *) "B\0";
-  size_t id_len = 2;
-
-  unsigned char *session_key = NULL;
-  size_t session_key_len = 0;
+  // Each handshake message a client sends is one RSA block under our key
+  server.handshake_msg_len =
+    (size_t) EVP_PKEY_size(EVP_PKEY_CTX_get0_pkey(server.private_key_ctx));
 
-  result = negotiate_server_session_key(socket_fd,
-                                        public_key_ctx,
-                                        private_key_ctx,
-                                        id, id_len,
-                                        &session_key, &session_key_len);
-
-  if (result)
+  // Draw the handshakes' nonces ahead of time
+  if (nsl_nonce_pool_start())
   {
-    kmyth_log(LOG_ERR, "Failed to negotiate the server session key.");
-    close(socket_fd);
-    return 1;
+    kmyth_log(LOG_WARNING, "Nonce pool unavailable.");
   }
 
-  EVP_PKEY_CTX_free(public_key_ctx);
-  EVP_PKEY_CTX_free(private_key_ctx);
-
-  // Send key K to A; encrypt message with S
+  // Send key K to A for each request; encrypt messages with S
   uint8 static_key[16] = {
     0xD3, 0x51, 0x91, 0x0F, 0x1D, 0x79, 0x34, 0xD6,
     0xE2, 0xAE, 0x17, 0x57, 0x65, 0x64, 0xE2, 0xBC
@@ -282,17 +941,105 @@ int main(int argc, char **argv)
   kmyth_log(LOG_INFO, "Loaded symmetric key: 0x%02X..%02X", static_key[0],
             static_key[15]);
 
-  result = send_key_with_session_key(socket_fd,
-                                     session_key, session_key_len,
-                                     static_key, 16);
-  if (result)
+  server.id = (unsigned char *) "B\0";
+  server.id_len = 2;
+  server.key = static_key;
+  server.key_len = sizeof(static_key);
+  server.max_conns = (size_t) max_conns;
+  server.socket_opts = socket_opts;
+  server.listen_fd = -1;
+  server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  server.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pthread_mutex_init(&server.lock, NULL);
+  pthread_cond_init(&server.cond, NULL);
+
+  // Create server socket
+  kmyth_log(LOG_INFO, "Setting up server socket");
+
+  int result = 1;
+
+  if (server.epoll_fd == -1 || server.event_fd == -1)
   {
-    kmyth_log(LOG_ERR, "Failed to send the static key.");
-    close(socket_fd);
-    return 1;
+    kmyth_log(LOG_ERR, "Failed to create the event loop.");
   }
+  else if (kmip_codec_init(&server.kmip, KMIP_2_0, 0))
+  {
+    kmyth_log(LOG_ERR, "Failed to set up the KMIP codec.");
+  }
+  else if (setup_server_socket(port, &server.socket_opts, &server.listen_fd))
+  {
+    kmyth_log(LOG_ERR, "Failed to setup server socket.");
+  }
+  else if (listen(server.listen_fd, SOMAXCONN)
+           || fcntl(server.listen_fd, F_SETFL, O_NONBLOCK))
+  {
+    kmyth_log(LOG_ERR, "Socket listen failed.");
+  }
+  else
+  {
+    struct epoll_event ev = {.events = EPOLLIN,.data.ptr = &server.listen_fd };
+    struct epoll_event efd = {.events = EPOLLIN,.data.ptr = &server.event_fd };
 
-  close(socket_fd);
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev)
+        || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.event_fd, &efd))
+    {
+      kmyth_log(LOG_ERR, "Failed to watch the server sockets.");
+    }
+    else
+    {
+      pthread_t *threads = calloc((size_t) workers, sizeof(pthread_t));
+      long started = 0;
 
-  return 0;
+      while (threads != NULL && started < workers
+             && pthread_create(&threads[started], NULL, worker_main,
+                               &server) == 0)
+      {
+        started++;
+      }
+
+      if (started == workers)
+      {
+        kmyth_log(LOG_INFO, "Serving clients with %ld workers", workers);
+        result = run_server(&server);
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "Failed to start the worker threads.");
+      }
+
+      pthread_mutex_lock(&server.lock);
+      server.stopping = true;
+      pthread_cond_broadcast(&server.cond);
+      pthread_mutex_unlock(&server.lock);
+      for (long i = 0; i < started; i++)
+      {
+        pthread_join(threads[i], NULL);
+      }
+      free(threads);
+    }
+  }
+
+  kmyth_log(LOG_INFO, "Shutting down with %zu clients connected",
+            server.conn_count);
+
+  if (server.listen_fd != -1)
+  {
+    close(server.listen_fd);
+  }
+  if (server.event_fd != -1)
+  {
+    close(server.event_fd);
+  }
+  if (server.epoll_fd != -1)
+  {
+    close(server.epoll_fd);
+  }
+  nsl_nonce_pool_stop();
+  kmip_codec_free(&server.kmip);
+  pthread_mutex_destroy(&server.lock);
+  pthread_cond_destroy(&server.cond);
+  EVP_PKEY_CTX_free(server.public_key_ctx);
+  EVP_PKEY_CTX_free(server.private_key_ctx);
+
+  return result;
 }
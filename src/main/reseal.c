@@ -2,7 +2,10 @@
  * Kmyth Sealing Interface - TPM 2.0 version
  */
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -10,12 +13,20 @@
 #include <ctype.h>
 #include <sys/stat.h>
 #include <malloc.h>
+#include <unistd.h>
 
 #include "defines.h"
+#include "bulk_io.h"
 #include "file_io.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
+#include "kmyth_policy_authorize.h"
+#include "kmyth_reseal_plan.h"
+#include "marshalling_tools.h"
 #include "memory_util.h"
+#include "metrics.h"
+#include "storage_key_tools.h"
+#include "tpm2_interface.h"
 
 #include "cipher/cipher.h"
 
@@ -130,53 +141,530 @@ static void usage(const char *prog)
           "\nusage: %s [options] \n\n"
           "options are: \n\n"
           " -a or --auth_string     String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
-          " -i or --input           Path to file containing the data to be sealed.\n"
+          " -i or --input           Path to the .ski file to be re-sealed.\n"
+          " -d or --dir             Re-seal, in place, every .ski file in this directory (instead of -i/-o).\n"
+          " -j or --jobs            Number of files read or written at once for -d. Defaults to %d.\n"
+          "    --incremental        With -d, only re-seal the files whose policy the current PCR values\n"
+          "                         (or those given by --pcr_values) no longer satisfy.\n"
+          "    --pcr_values         File of predicted PCR values (one '<pcr> <sha256 hex>' per line), e.g. those\n"
+          "                         expected after an update. Other PCRs keep their current values. Implies\n"
+          "                         --incremental.\n"
+          "    --plan_only          With --incremental, only list the files that would be re-sealed.\n"
+          "    --policy_only        Keep the input's storage key, rewriting only the sealed wrapping key,\n"
+          "                         when the storage key does not depend on the PCR policy (storage keys\n"
+          "                         this option has to create are made so, for later policy-only re-seals).\n"
           " -o or --output          Destination path for the sealed file. Defaults to <filename>.ski in the CWD.\n"
           " -f or --force           Force the overwrite of an existing .ski file when using default output.\n"
           " -p or --pcrs_list       List of TPM platform configuration registers (PCRs) to apply to authorization policy.\n"
           "                         Defaults to no PCRs specified. Encapsulate in quotes (e.g. \"0, 1, 2\").\n"
-          " -c or --cipher          Specifies the cipher type to use. Defaults to \'%s\'\n"
+          " -c or --cipher          Specifies the cipher type to use. Defaults to the input's cipher, in which case\n"
+          "                         only the wrapping key is re-sealed (the encrypted data is kept).\n"
+          "                         Use 'auto' for the fastest authenticated cipher on this CPU (see -l).\n"
           " -e or --expected_policy Specifies an alternative digest value that can satisfy the authorization policy. \n"
+          "                         Up to 7 digests can be given, separated by commas.\n"
+          " -P or --policy_or       The input was sealed using a compound \"policy or\".\n"
           " -l or --list_ciphers    Lists all valid ciphers and exits.\n"
           " -w or --owner_auth      TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -k or --sk_alg          Storage key algorithm: rsa (RSA-2048) or ecc (ECC P-256, faster to create).\n"
+          "                         Defaults to rsa.\n"
+          " -T or --tcti            TPM connection: auto, device[:path], abrmd, mssim[:conf] or swtpm[:conf].\n"
+          "                         Defaults to $%s, else '%s'.\n"
+          "    --ski_v2             Write the compact binary .ski format (v2) instead of the text format.\n"
+          "    --authorizing_key    Re-seal to policies signed by this RSA key (PEM public key) instead of to\n"
+          "                         the current PCR values. Cannot be combined with -e.\n"
+          "    --signed_policy      Signed policy file, or directory of them, approving the current PCR state\n"
+          "                         for inputs sealed with --authorizing_key. Defaults to $%s.\n"
+          "    --priority           TPM scheduling class: interactive, normal or bulk. Defaults to $%s,\n"
+          "                         else bulk, so that other processes' unseals go first.\n"
+          "    --stats              Print per-command TPM latency statistics and Kmyth metrics\n"
+          "                         (cache hits, TPM errors by response code, allocations, ...) to stderr on exit.\n"
           " -v or --verbose         Enable detailed logging.\n"
           " -h or --help            Help (displays this usage).\n", prog,
-          cipher_list[0].cipher_name);
+          KMYTH_RESEAL_DEFAULT_JOBS, KMYTH_TCTI_ENV, KMYTH_DEFAULT_TCTI,
+          KMYTH_SIGNED_POLICY_ENV, KMYTH_TPM_PRIORITY_ENV);
 }
 
 static void list_ciphers(void)
 {
   size_t i = 0;
+  const char *auto_cipher = kmyth_select_auto_cipher();
+  char features[64];
 
+  kmyth_cpu_crypto_features_string(kmyth_cpu_crypto_features(), features,
+                                   sizeof(features));
+  fprintf(stdout, "Detected CPU crypto acceleration: %s\n", features);
   fprintf(stdout, "The following ciphers are currently supported by kmyth:\n");
   while (cipher_list[i].cipher_name != NULL)
   {
-    fprintf(stdout, "  %s%s\n", cipher_list[i].cipher_name,
-            (i == 0) ? " (default)" : "");
+    fprintf(stdout, "  %s%s%s\n", cipher_list[i].cipher_name,
+            (i == 0) ? " (default)" : "",
+            (strcmp(cipher_list[i].cipher_name, auto_cipher) == 0) ?
+            " (auto)" : "");
     i++;
   }
   fprintf(stdout,
           "To select a cipher use the '-c' option with the full cipher name.\n"
           "For example, the option '-c AES/KeyWrap/RFC5649Padding/256'\n"
           "will select AES Key Wrap with Padding as specified in RFC 5649\n"
-          "using a 256-bit key.\n");
+          "using a 256-bit key. The option '-c auto' selects the cipher\n"
+          "marked (auto), the fastest authenticated cipher for this CPU.\n");
+}
+
+/**
+ * @brief Shared state for a directory (-d) reseal. Files go through in
+ *        groups of KMYTH_RESEAL_WRITE_BATCH: while this thread re-seals one
+ *        group on the TPM, an I/O thread writes out and commits the group
+ *        before it and reads the group after it, with up to 'depth' files
+ *        in flight (see bulk_io.h).
+ */
+typedef struct
+{
+  kmyth_ctx_t *ctx;
+  char **paths;
+  size_t count;
+  size_t depth;
+  size_t done;
+  size_t failed;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+  int *pcrs;
+  size_t pcrs_len;
+  char *cipher_string;
+  char *expected_policy;
+  uint8_t bool_policy_or;
+
+  // incremental reseal: only files whose policy the predicted PCR values
+  // break are re-sealed (or, with plan_only, listed)
+  bool incremental;
+  bool plan_only;
+  kmyth_pcr_values pcr_values;
+
+  // re-sealed files waiting to replace the originals (I/O thread only)
+  kmyth_write_batch batch;
+} reseal_dir_job;
+
+/**
+ * @brief A group of files: read in, re-sealed in place (data then holds
+ *        the re-sealed .ski, and result is non-zero if the file failed),
+ *        then written out.
+ */
+typedef struct
+{
+  kmyth_bulk_file files[KMYTH_RESEAL_WRITE_BATCH];
+  size_t count;
+} reseal_group;
+
+/**
+ * @brief The work of the I/O thread while a group is re-sealed.
+ */
+typedef struct
+{
+  reseal_dir_job *job;
+
+  // group to write out and commit, and group to read in (either NULL)
+  reseal_group *write;
+  reseal_group *read;
+
+  // files of 'write' that could not be written out
+  size_t failed;
+} reseal_io_stage;
+
+//############################################################################
+// reseal_io_stage_run()
+//############################################################################
+static void *reseal_io_stage_run(void *arg)
+{
+  reseal_io_stage *stage = (reseal_io_stage *) arg;
+  reseal_dir_job *job = stage->job;
+
+  if (stage->write != NULL)
+  {
+    kmyth_bulk_file out[KMYTH_RESEAL_WRITE_BATCH];
+    size_t out_count = 0;
+    size_t failed = 0;
+
+    for (size_t i = 0; i < stage->write->count; i++)
+    {
+      if (stage->write->files[i].result == 0)
+      {
+        out[out_count++] = stage->write->files[i];
+      }
+    }
+
+    // the new files are staged next to the originals, which they replace
+    // when the batch is committed - either way, a crash leaves one or the
+    // other
+    kmyth_bulk_write_files(&job->batch, out, out_count, job->depth);
+    for (size_t i = 0; i < out_count; i++)
+    {
+      if (out[i].result != 0)
+      {
+        fprintf(stdout, "%s: FAILED (write)\n", out[i].path);
+        stage->failed++;
+      }
+    }
+    if (commit_write_batch(&job->batch, &failed))
+    {
+      kmyth_log(LOG_ERR, "%zu re-sealed file(s) could not be written out",
+                failed);
+      stage->failed += failed;
+    }
+    fflush(stdout);
+
+    for (size_t i = 0; i < stage->write->count; i++)
+    {
+      kmyth_free(stage->write->files[i].data);
+      stage->write->files[i].data = NULL;
+    }
+  }
+
+  if (stage->read != NULL)
+  {
+    kmyth_bulk_read_files(stage->read->files, stage->read->count,
+                          job->depth);
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// reseal_group_files()
+//############################################################################
+static void reseal_group_files(reseal_dir_job * job, reseal_group * group)
+{
+  for (size_t i = 0; i < group->count; i++)
+  {
+    kmyth_bulk_file *file = &group->files[i];
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+    int retval = file->result;
+
+    if (retval == 0)
+    {
+      retval = tpm2_kmyth_reseal_ctx(job->ctx, file->data, file->data_len,
+                                     &output, &output_len,
+                                     job->auth_bytes, job->auth_bytes_len,
+                                     job->owner_auth_bytes,
+                                     job->oa_bytes_len,
+                                     job->pcrs, job->pcrs_len,
+                                     job->cipher_string,
+                                     job->expected_policy,
+                                     job->bool_policy_or);
+    }
+    kmyth_free(file->data);
+    file->data = output;
+    file->data_len = output_len;
+    file->result = retval;
+
+    job->done++;
+    if (retval)
+    {
+      job->failed++;
+    }
+    fprintf(stdout, "[%zu/%zu] %s: %s\n", job->done, job->count,
+            file->path, retval ? "FAILED" : "resealed");
+    fflush(stdout);
+  }
+}
+
+//############################################################################
+// list_ski_files()
+//############################################################################
+static int list_ski_files(const char *dir_path, char ***paths, size_t *count)
+{
+  DIR *dir = opendir(dir_path);
+
+  *paths = NULL;
+  *count = 0;
+  if (dir == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open directory %s ... exiting", dir_path);
+    return 1;
+  }
+
+  struct dirent *entry = NULL;
+  size_t ext_len = KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    size_t name_len = strlen(entry->d_name);
+
+    // only regular files named *.ski (hidden files are skipped)
+    if (entry->d_name[0] == '.' || name_len <= ext_len ||
+        entry->d_name[name_len - ext_len] != '.' ||
+        strcmp(entry->d_name + name_len - ext_len + 1,
+               KMYTH_DEFAULT_SEAL_OUT_EXT) != 0)
+    {
+      continue;
+    }
+
+    size_t path_size = strlen(dir_path) + name_len + 2;
+    char *path = malloc(path_size);
+    char **new_paths = realloc(*paths, (*count + 1) * sizeof(char *));
+    struct stat st = { 0 };
+
+    if (path == NULL || new_paths == NULL)
+    {
+      kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+      free(path);
+      if (new_paths != NULL)
+      {
+        *paths = new_paths;
+      }
+      closedir(dir);
+      return 1;
+    }
+    *paths = new_paths;
+    snprintf(path, path_size, "%s/%s", dir_path, entry->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      free(path);
+      continue;
+    }
+    (*paths)[(*count)++] = path;
+  }
+
+  closedir(dir);
+  return 0;
+}
+
+//############################################################################
+// plan_reseal()
+//############################################################################
+/**
+ * @brief Narrows the files of a directory reseal down to those whose policy
+ *        the predicted PCR values no longer satisfy, looking at nothing but
+ *        their headers. Files that can't be checked are kept, so that they
+ *        are re-sealed as before.
+ */
+static int plan_reseal(reseal_dir_job * job)
+{
+  if (kmyth_pcr_values_read(job->ctx, &job->pcr_values))
+  {
+    kmyth_log(LOG_ERR, "unable to predict PCR values ... exiting");
+    return 1;
+  }
+
+  size_t kept = 0;
+  size_t signed_count = 0;
+  size_t planned = 0;
+
+  for (size_t i = 0; i < job->count; i++)
+  {
+    char *path = job->paths[i];
+    kmyth_reseal_plan_action action = KMYTH_RESEAL_PLAN_RESEAL;
+    kmyth_file_view view;
+
+    // only the header is parsed, so only its pages are read
+    if (peek_bytes_from_file(path, &view))
+    {
+      kmyth_log(LOG_WARNING, "unable to read %s, re-sealing it", path);
+    }
+    else
+    {
+      if (kmyth_reseal_plan_check(view.data, view.data_length,
+                                  &job->pcr_values, &action))
+      {
+        kmyth_log(LOG_WARNING, "unable to check the policy of %s, "
+                  "re-sealing it", path);
+        action = KMYTH_RESEAL_PLAN_RESEAL;
+      }
+      view.release(&view);
+    }
+
+    switch (action)
+    {
+    case KMYTH_RESEAL_PLAN_KEEP:
+      kept++;
+      kmyth_log(LOG_DEBUG, "%s: policy holds, not re-sealed", path);
+      free(path);
+      break;
+    case KMYTH_RESEAL_PLAN_SIGNED:
+      signed_count++;
+      fprintf(stdout, "%s: sealed to an authorizing key, needs a signed "
+              "policy instead\n", path);
+      free(path);
+      break;
+    default:
+      if (job->plan_only)
+      {
+        fprintf(stdout, "%s: would be re-sealed\n", path);
+      }
+      job->paths[planned++] = path;
+      break;
+    }
+  }
+
+  fprintf(stdout, "%zu of %zu .ski files need re-sealing (%zu unchanged, "
+          "%zu signed)\n", planned, job->count, kept, signed_count);
+  fflush(stdout);
+  job->count = planned;
+
+  return 0;
+}
+
+//############################################################################
+// reseal_directory()
+//############################################################################
+static int reseal_directory(const char *dir_path, long jobs,
+                            reseal_dir_job * job)
+{
+  if (list_ski_files(dir_path, &job->paths, &job->count))
+  {
+    for (size_t i = 0; i < job->count; i++)
+    {
+      free(job->paths[i]);
+    }
+    free(job->paths);
+    return 1;
+  }
+  if (job->count == 0)
+  {
+    kmyth_log(LOG_WARNING, "no .ski files found in %s", dir_path);
+    free(job->paths);
+    return 0;
+  }
+
+  if (kmyth_ctx_create(&job->ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
+    for (size_t i = 0; i < job->count; i++)
+    {
+      free(job->paths[i]);
+    }
+    free(job->paths);
+    return 1;
+  }
+
+  if (job->incremental)
+  {
+    int retval = plan_reseal(job);
+
+    if (retval || job->plan_only || job->count == 0)
+    {
+      kmyth_ctx_destroy(&job->ctx);
+      for (size_t i = 0; i < job->count; i++)
+      {
+        free(job->paths[i]);
+      }
+      free(job->paths);
+      return retval;
+    }
+  }
+
+  job->depth = (size_t) jobs;
+  init_write_batch(&job->batch);
+  kmyth_log(LOG_DEBUG, "directory I/O backend: %s", kmyth_bulk_io_backend());
+
+  // three groups in turn: one being read, one re-sealed, one written out
+  reseal_group groups[3];
+  size_t group_count = (job->count + KMYTH_RESEAL_WRITE_BATCH - 1) /
+    KMYTH_RESEAL_WRITE_BATCH;
+
+  // step k re-seals group k - 1 while group k - 2 is written out and group
+  // k read in; the first step only reads, the last one only writes
+  for (size_t k = 0; k <= group_count + 1; k++)
+  {
+    reseal_io_stage io = {.job = job };
+    reseal_group *current = NULL;
+
+    if (k >= 2)
+    {
+      io.write = &groups[(k - 2) % 3];
+    }
+    if (k >= 1 && k <= group_count)
+    {
+      current = &groups[(k - 1) % 3];
+    }
+    if (k < group_count)
+    {
+      size_t first = k * KMYTH_RESEAL_WRITE_BATCH;
+
+      io.read = &groups[k % 3];
+      io.read->count = job->count - first;
+      if (io.read->count > KMYTH_RESEAL_WRITE_BATCH)
+      {
+        io.read->count = KMYTH_RESEAL_WRITE_BATCH;
+      }
+      for (size_t i = 0; i < io.read->count; i++)
+      {
+        io.read->files[i].path = job->paths[first + i];
+      }
+    }
+
+    pthread_t io_thread;
+    bool threaded = (current != NULL &&
+                     pthread_create(&io_thread, NULL, reseal_io_stage_run,
+                                    &io) == 0);
+
+    if (!threaded)
+    {
+      reseal_io_stage_run(&io);
+    }
+    if (current != NULL)
+    {
+      reseal_group_files(job, current);
+    }
+    if (threaded)
+    {
+      pthread_join(io_thread, NULL);
+    }
+    job->failed += io.failed;
+  }
+  kmyth_ctx_destroy(&job->ctx);
+
+  fprintf(stdout, "resealed %zu of %zu .ski files in %s (%zu failed)\n",
+          job->count - job->failed, job->count, dir_path, job->failed);
+
+  for (size_t i = 0; i < job->count; i++)
+  {
+    free(job->paths[i]);
+  }
+  free(job->paths);
+
+  return (job->failed == 0) ? 0 : 1;
 }
 
 const struct option longopts[] = {
   {"auth_string", required_argument, 0, 'a'},
   {"input", required_argument, 0, 'i'},
+  {"dir", required_argument, 0, 'd'},
+  {"jobs", required_argument, 0, 'j'},
   {"output", required_argument, 0, 'o'},
   {"force", no_argument, 0, 'f'},
   {"pcrs_list", required_argument, 0, 'p'},
   {"owner_auth", required_argument, 0, 'w'},
   {"cipher", required_argument, 0, 'c'},
   {"expected_policy", required_argument, 0, 'e'},
+  {"policy_or", no_argument, 0, 'P'},
+  {"sk_alg", required_argument, 0, 'k'},
+  {"tcti", required_argument, 0, 'T'},
+  {"priority", required_argument, 0, KMYTH_PRIORITY_OPTION},
+  {"stats", no_argument, 0, KMYTH_STATS_OPTION},
+  {"ski_v2", no_argument, 0, KMYTH_SKI_V2_OPTION},
+  {"authorizing_key", required_argument, 0, KMYTH_AUTHORIZING_KEY_OPTION},
+  {"signed_policy", required_argument, 0, KMYTH_SIGNED_POLICY_OPTION},
+  {"incremental", no_argument, 0, KMYTH_INCREMENTAL_OPTION},
+  {"pcr_values", required_argument, 0, KMYTH_PCR_VALUES_OPTION},
+  {"plan_only", no_argument, 0, KMYTH_PLAN_ONLY_OPTION},
+  {"policy_only", no_argument, 0, KMYTH_POLICY_ONLY_OPTION},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {"list_ciphers", no_argument, 0, 'l'},
   {0, 0, 0, 0}
 };
 
+//############################################################################
+// print_stats_at_exit()
+//############################################################################
+static void print_stats_at_exit(void)
+{
+  print_tpm_stats(stderr);
+  kmyth_metrics_print_summary(stderr);
+}
+
 int main(int argc, char **argv)
 {
   // If no command line arguments provided, provide usage help and exit early
@@ -191,6 +679,13 @@ int main(int argc, char **argv)
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
 
+  // Re-sealing is maintenance work: unless told otherwise, let other
+  // processes' (e.g., kmyth-unseal, kmythd) TPM commands go first
+  if (getenv(KMYTH_TPM_PRIORITY_ENV) == NULL)
+  {
+    set_default_tpm_priority(KMYTH_TPM_PRIORITY_BULK);
+  }
+
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
   char *outPath = NULL;
@@ -201,14 +696,19 @@ int main(int argc, char **argv)
   char *cipherString = NULL;
   bool forceOverwrite = false;
   char *expected_policy = NULL;
-  uint8_t bool_trial_only = 1; // reseal forces this
+  uint8_t bool_policy_or = 0;
+  char *dirPath = NULL;
+  long jobs = KMYTH_RESEAL_DEFAULT_JOBS;
+  bool incremental = false;
+  bool planOnly = false;
+  char *pcrValuesPath = NULL;
 
   // Parse and apply command line options
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "a:e:i:o:c:p:w:fhlv", longopts,
+          getopt_long(argc, argv, "a:d:e:i:j:o:c:p:w:k:T:fhlvP", longopts,
                       &option_index)) != -1)
   {
     switch (options)
@@ -222,6 +722,23 @@ int main(int argc, char **argv)
     case 'i':
       inPath = optarg;
       break;
+    case 'd':
+      dirPath = optarg;
+      break;
+    case 'j':
+      {
+        char *end = NULL;
+
+        jobs = strtol(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || jobs < 1 ||
+            jobs > KMYTH_RESEAL_MAX_JOBS)
+        {
+          kmyth_log(LOG_ERR, "invalid number of jobs (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+      }
+      break;
     case 'o':
       // make outPath a copy of the argument for consistency with case
       // where we assign a default outPath value - always allocate memory
@@ -236,18 +753,75 @@ int main(int argc, char **argv)
     case 'f':
       forceOverwrite = true;
       break;
-    //case 'g':
-    //  bool_trial_only = 1;
-    //  break;
     case 'e':
       expected_policy = optarg;
       break;
+    case 'P':
+      bool_policy_or = 1;
+      break;
     case 'p':
       pcrsString = optarg;
       break;
     case 'w':
       ownerAuthPasswd = optarg;
       break;
+    case 'k':
+      if (set_sk_alg(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'T':
+      if (set_tcti_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_SKI_V2_OPTION:
+      set_ski_format(KMYTH_SKI_FORMAT_V2);
+      break;
+    case KMYTH_AUTHORIZING_KEY_OPTION:
+      if (set_authorizing_key(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_SIGNED_POLICY_OPTION:
+      if (set_signed_policy_path(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_INCREMENTAL_OPTION:
+      incremental = true;
+      break;
+    case KMYTH_PCR_VALUES_OPTION:
+      pcrValuesPath = optarg;
+      incremental = true;
+      break;
+    case KMYTH_PLAN_ONLY_OPTION:
+      planOnly = true;
+      incremental = true;
+      break;
+    case KMYTH_POLICY_ONLY_OPTION:
+      set_sk_reuse(true);
+      break;
+    case KMYTH_PRIORITY_OPTION:
+      {
+        kmyth_tpm_priority priority = KMYTH_TPM_PRIORITY_NORMAL;
+
+        if (parse_tpm_priority(optarg, &priority) ||
+            set_default_tpm_priority(priority))
+        {
+          return 1;
+        }
+      }
+      break;
+    case KMYTH_STATS_OPTION:
+      set_tpm_stats(true);
+      kmyth_alloc_stats_enable(true);
+      atexit(print_stats_at_exit);
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -270,10 +844,92 @@ int main(int argc, char **argv)
   size_t oa_passwd_len =
     (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
 
-  // Check that input path (file to be sealed) was specified
+  if (incremental && dirPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "--incremental, --pcr_values and --plan_only need -d "
+              "... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    return 1;
+  }
+
+  // Directory mode re-seals every .ski file found there in place
+  if (dirPath != NULL)
+  {
+    int *dir_pcrs = NULL;
+    int dir_pcrs_len = 0;
+    kmyth_pcr_values pcr_values;
+    uint8_t *manifest = NULL;
+    size_t manifest_len = 0;
+
+    memset(&pcr_values, 0, sizeof(pcr_values));
+    if (inPath != NULL || outPath != NULL)
+    {
+      kmyth_log(LOG_ERR, "-d cannot be combined with -i or -o ... exiting");
+    }
+    else if (pcrValuesPath != NULL &&
+             (read_bytes_from_file(pcrValuesPath, &manifest, &manifest_len) ||
+              kmyth_pcr_values_parse(manifest, manifest_len, &pcr_values)))
+    {
+      kmyth_log(LOG_ERR, "invalid PCR values file %s ... exiting",
+                pcrValuesPath);
+    }
+    else if (parse_pcrs_string(pcrsString, &dir_pcrs, &dir_pcrs_len) != 0 ||
+             dir_pcrs_len < 0)
+    {
+      kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+                pcrsString);
+    }
+    else
+    {
+      reseal_dir_job job = {
+        .auth_bytes = (uint8_t *) authString,
+        .auth_bytes_len = auth_string_len,
+        .owner_auth_bytes = (uint8_t *) ownerAuthPasswd,
+        .oa_bytes_len = oa_passwd_len,
+        .pcrs = dir_pcrs,
+        .pcrs_len = (size_t) dir_pcrs_len,
+        .cipher_string = cipherString,
+        .expected_policy = expected_policy,
+        .bool_policy_or = bool_policy_or,
+        .incremental = incremental,
+        .plan_only = planOnly,
+        .pcr_values = pcr_values,
+      };
+
+      free(manifest);
+
+      // every file is logged, from this thread and the I/O thread; queue
+      // it rather than have them take turns at the log file (waiting for room, so nothing is lost)
+      if (kmyth_log_start_async(KMYTH_LOG_ASYNC_DEFAULT_CAPACITY,
+                                KMYTH_LOG_OVERFLOW_BLOCK))
+      {
+        kmyth_log(LOG_WARNING, "asynchronous logging unavailable");
+      }
+
+      int retval = reseal_directory(dirPath, jobs, &job);
+
+      kmyth_log_stop_async();
+
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(dir_pcrs);
+      return retval;
+    }
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(dir_pcrs);
+    free(manifest);
+    free(outPath);
+    return 1;
+  }
+
+  // Check that input path (.ski file to be re-sealed) was specified
   if (inPath == NULL)
   {
-    kmyth_log(LOG_ERR, "no input (file to be sealed) specified ... exiting");
+    kmyth_log(LOG_ERR, "no input (file to be re-sealed) specified ... exiting");
     if (authString != NULL)
     {
       kmyth_clear(authString, auth_string_len);
@@ -369,12 +1025,27 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  uint8_t *input = NULL;
+  size_t input_length = 0;
+
+  if (verifyInputFilePath(inPath) ||
+      read_bytes_from_file(inPath, &input, &input_length))
+  {
+    kmyth_log(LOG_ERR, "unable to read input file %s ... exiting", inPath);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
+    free(outPath);
+    free(input);
+    return 1;
+  }
+
   // Call top-level "kmyth-reseal" function
-  if (tpm2_kmyth_seal_file(inPath, &output, &output_length,
-                           (uint8_t *) authString, auth_string_len,
-                           (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                           pcrs, (size_t)pcrs_len, cipherString, expected_policy,
-                           bool_trial_only))
+  if (tpm2_kmyth_reseal(input, input_length, &output, &output_length,
+                        (uint8_t *) authString, auth_string_len,
+                        (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                        pcrs, (size_t)pcrs_len, cipherString, expected_policy,
+                        bool_policy_or))
   {
     kmyth_log(LOG_ERR, "kmyth-reseal error ... exiting");
     kmyth_clear(authString, auth_string_len);
@@ -382,13 +1053,16 @@ int main(int argc, char **argv)
     free(pcrs);
     free(outPath);
     free(output);
+    free(input);
     return 1;
   }
+  free(input);
 
   kmyth_clear(authString, auth_string_len);
   kmyth_clear(ownerAuthPasswd, oa_passwd_len);
 
-  if (write_bytes_to_file(outPath, output, output_length))
+  // the output is often the input itself, so it is replaced atomically
+  if (write_bytes_to_file_atomic(outPath, output, output_length))
   {
     kmyth_log(LOG_ERR, "error writing data to .ski file ... exiting");
     free(outPath);
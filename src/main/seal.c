@@ -11,12 +11,19 @@
 #include <sys/stat.h>
 
 #include "defines.h"
+#include "bulk_io.h"
 #include "file_io.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
+#include "kmyth_policy_authorize.h"
+#include "marshalling_tools.h"
 #include "memory_util.h"
+#include "metrics.h"
+#include "storage_key_tools.h"
+#include "tpm2_interface.h"
 
 #include "cipher/cipher.h"
+#include "cipher/compression.h"
 
 /**
  * @brief The external list of valid (implemented and configured) symmetric
@@ -129,42 +136,80 @@ static void usage(const char *prog)
           "\nusage: %s [options] \n\n"
           "options are: \n\n"
           " -a or --auth_string     String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
-          " -i or --input           Path to file containing the data to be sealed.\n"
+          " -i or --input           Path to file containing the data to be sealed. May be repeated to seal\n"
+          "                         several files at once (each to <filename>.ski in the CWD).\n"
           " -o or --output          Destination path for the sealed file. Defaults to <filename>.ski in the CWD.\n"
+          "                         Only valid when sealing a single file.\n"
+          " -b or --batch           Batch mode: seal every file named after the options (in addition to any\n"
+          "                         -i files) under a single storage key. Outputs use the default names.\n"
           " -f or --force           Force the overwrite of an existing .ski file when using default output.\n"
           " -p or --pcrs_list       List of TPM platform configuration registers (PCRs) to apply to authorization policy.\n"
           "                         Defaults to no PCRs specified. Encapsulate in quotes (e.g. \"0, 1, 2\").\n"
           " -c or --cipher          Specifies the cipher type to use. Defaults to \'%s\'\n"
+          "                         Use 'auto' for the fastest authenticated cipher on this CPU (see -l).\n"
           " -g or --get_exp_policy  Retrieves the PolicyPCR digest associated with the current value of pcr registers \n"
           " -e or --expected_policy Specifies an alternative digest value that can satisfy the authorization policy. \n"
+          "                         Up to 7 digests can be given, separated by commas.\n"
           " -l or --list_ciphers    Lists all valid ciphers and exits.\n"
           " -w or --owner_auth      TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -k or --sk_alg          Storage key algorithm: rsa (RSA-2048) or ecc (ECC P-256, faster to create).\n"
+          "                         Defaults to rsa.\n"
+          " -T or --tcti            TPM connection: auto, device[:path], abrmd, mssim[:conf] or swtpm[:conf].\n"
+          "                         Defaults to $%s, else '%s'.\n"
+          "    --stream             Seal a single (large) file a chunk at a time, without reading it into memory.\n"
+          "                         Uses '%s' unless a streaming cipher is selected with -c.\n"
+          "                         '-i -' reads stdin and '-o -' writes stdout (e.g. pg_dump | kmyth-seal ...).\n"
+          "    --threads            Threads used to encrypt the chunks of a streaming cipher (0 = one per CPU).\n"
+          "                         Defaults to 1.\n"
+          "    --ski_v2             Write the compact binary .ski format (v2) instead of the text format.\n"
+          "    --compress           Compress the data before it is encrypted: '%s' (zlib) or '%s'.\n"
+          "                         Defaults to %s. Unsealing needs no option. A compressed --stream file\n"
+          "                         cannot be read at random (e.g., through kmyth-fuse).\n"
+          "    --authorizing_key    Seal to policies signed by this RSA key (PEM public key) instead of to the\n"
+          "                         current PCR values, so that approving a new PCR state (kmyth-sign-policy\n"
+          "                         on a -g digest) needs no reseal. Cannot be combined with -e.\n"
+          "    --priority           TPM scheduling class: interactive, normal or bulk. Defaults to $%s,\n"
+          "                         else normal.\n"
+          "    --stats              Print per-command TPM latency statistics and Kmyth metrics\n"
+          "                         (cache hits, TPM errors by response code, allocations, ...) to stderr on exit.\n"
           " -v or --verbose         Enable detailed logging.\n"
           " -h or --help            Help (displays this usage).\n", prog,
-          cipher_list[0].cipher_name);
+          cipher_list[0].cipher_name, KMYTH_TCTI_ENV, KMYTH_DEFAULT_TCTI,
+          KMYTH_DEFAULT_STREAM_CIPHER, KMYTH_COMPRESSION_DEFLATE_NAME,
+          KMYTH_COMPRESSION_NONE_NAME, KMYTH_COMPRESSION_NONE_NAME,
+          KMYTH_TPM_PRIORITY_ENV);
 }
 
 static void list_ciphers(void)
 {
   size_t i = 0;
+  const char *auto_cipher = kmyth_select_auto_cipher();
+  char features[64];
 
+  kmyth_cpu_crypto_features_string(kmyth_cpu_crypto_features(), features,
+                                   sizeof(features));
+  fprintf(stdout, "Detected CPU crypto acceleration: %s\n", features);
   fprintf(stdout, "The following ciphers are currently supported by kmyth:\n");
   while (cipher_list[i].cipher_name != NULL)
   {
-    fprintf(stdout, "  %s%s\n", cipher_list[i].cipher_name,
-            (i == 0) ? " (default)" : "");
+    fprintf(stdout, "  %s%s%s\n", cipher_list[i].cipher_name,
+            (i == 0) ? " (default)" : "",
+            (strcmp(cipher_list[i].cipher_name, auto_cipher) == 0) ?
+            " (auto)" : "");
     i++;
   }
   fprintf(stdout,
           "To select a cipher use the '-c' option with the full cipher name.\n"
           "For example, the option '-c AES/KeyWrap/RFC5649Padding/256'\n"
           "will select AES Key Wrap with Padding as specified in RFC 5649\n"
-          "using a 256-bit key.\n");
+          "using a 256-bit key. The option '-c auto' selects the cipher\n"
+          "marked (auto), the fastest authenticated cipher for this CPU.\n");
 }
 
 const struct option longopts[] = {
   {"auth_string", required_argument, 0, 'a'},
   {"input", required_argument, 0, 'i'},
+  {"batch", no_argument, 0, 'b'},
   {"output", required_argument, 0, 'o'},
   {"force", no_argument, 0, 'f'},
   {"pcrs_list", required_argument, 0, 'p'},
@@ -172,12 +217,243 @@ const struct option longopts[] = {
   {"cipher", required_argument, 0, 'c'},
   {"get_exp_policy", no_argument, 0, 'g'},
   {"expected_policy", required_argument, 0, 'e'},
+  {"sk_alg", required_argument, 0, 'k'},
+  {"tcti", required_argument, 0, 'T'},
+  {"stream", no_argument, 0, KMYTH_STREAM_OPTION},
+  {"threads", required_argument, 0, KMYTH_THREADS_OPTION},
+  {"priority", required_argument, 0, KMYTH_PRIORITY_OPTION},
+  {"stats", no_argument, 0, KMYTH_STATS_OPTION},
+  {"ski_v2", no_argument, 0, KMYTH_SKI_V2_OPTION},
+  {"compress", required_argument, 0, KMYTH_COMPRESS_OPTION},
+  {"authorizing_key", required_argument, 0, KMYTH_AUTHORIZING_KEY_OPTION},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {"list_ciphers", no_argument, 0, 'l'},
   {0, 0, 0, 0}
 };
 
+//############################################################################
+// print_stats_at_exit()
+//############################################################################
+static void print_stats_at_exit(void)
+{
+  print_tpm_stats(stderr);
+  kmyth_metrics_print_summary(stderr);
+}
+
+//############################################################################
+// get_default_output_path()
+//############################################################################
+static int get_default_output_path(char *inPath, bool forceOverwrite,
+                                   char **outPath)
+{
+  // Set output path to basename(inPath) with a .ski extension in the
+  // directory that the application is being run from.
+
+  // create buffer to hold default filename derived from input filename
+  char default_fn[KMYTH_MAX_DEFAULT_FILENAME_LEN + 1];
+  memset(default_fn, '\0', sizeof(default_fn));
+
+  // Initialize default filename to basename() of input path, truncating if
+  // necessary. The maximum size of this "root" value is the must allow space
+  // to add a '.' delimiter (1 byte) and the default extension
+  // (KMYTH_DEFAULT_SEAL_OUT_EXT_LEN bytes).
+  size_t max_root_len = KMYTH_MAX_DEFAULT_FILENAME_LEN;
+  max_root_len -= KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
+  strncpy(default_fn, basename(inPath), max_root_len);
+
+  // remove any leading '.'s
+  while (*default_fn == '.')
+  {
+    memmove(default_fn, default_fn + 1, sizeof(default_fn) - 1);
+  }
+
+  // ensure that this intermediate result is not an empty string
+  if (strlen(default_fn) == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid/empty default filename root ... exiting");
+    return 1;
+  }
+
+  // everything beyond first non-leading '.' is treated as extension
+  char *ext_ptr = strstr(default_fn, ".");
+  if (ext_ptr == NULL)
+  {
+    // no filename extension found - just add trailing '.'
+    strncat(default_fn, ".", 1);
+  }
+  else
+  {
+    // input fileame extension delimiter found, null everything after it
+    // The type conversion here is safe assuming inPath is not too pathological,
+    // so that's something we should think about.
+    ptrdiff_t filename_portion = ext_ptr - default_fn;
+    size_t tail_length = sizeof(default_fn) - (size_t)filename_portion;
+    memset(ext_ptr + 1, '\0', tail_length - 1);
+  }
+
+  // concatenate default filename root and extension
+  strncat(default_fn, KMYTH_DEFAULT_SEAL_OUT_EXT,
+                      KMYTH_DEFAULT_SEAL_OUT_EXT_LEN);
+
+  // Make sure default filename we constructed doesn't already exist
+  struct stat st = { 0 };
+  if (!stat(default_fn, &st) && !forceOverwrite)
+  {
+    kmyth_log(LOG_ERR,
+              "default output filename (%s) already exists ... exiting",
+              default_fn);
+    return 1;
+  }
+
+  // Go ahead and make the default value the output path
+  size_t outPath_size = strlen(default_fn) + 1;
+  *outPath = malloc(outPath_size * sizeof(char));
+  if (*outPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate output path ... exiting");
+    return 1;
+  }
+  memcpy(*outPath, default_fn, outPath_size);
+  kmyth_log(LOG_WARNING, "output file not specified, default = %s", *outPath);
+
+  return 0;
+}
+
+//############################################################################
+// seal_batch()
+//############################################################################
+static int seal_batch(char **inPaths, size_t inPaths_count, bool forceOverwrite,
+                      uint8_t * auth_bytes, size_t auth_bytes_len,
+                      uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                      int *pcrs, size_t pcrs_len, char *cipher_string,
+                      char *expected_policy)
+{
+  int retval = 1;
+  char **outPaths = calloc(inPaths_count, sizeof(char *));
+  uint8_t **inputs = calloc(inPaths_count, sizeof(uint8_t *));
+  size_t *input_lens = calloc(inPaths_count, sizeof(size_t));
+  uint8_t **outputs = calloc(inPaths_count, sizeof(uint8_t *));
+  size_t *output_lens = calloc(inPaths_count, sizeof(size_t));
+  kmyth_bulk_file *files = calloc(inPaths_count, sizeof(kmyth_bulk_file));
+
+  if (outPaths == NULL || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL || files == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate batch buffers ... exiting");
+    goto cleanup;
+  }
+
+  // validate every input and output up front, before doing any TPM work
+  for (size_t i = 0; i < inPaths_count; i++)
+  {
+    if (verifyInputFilePath(inPaths[i]))
+    {
+      kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting",
+                inPaths[i]);
+      goto cleanup;
+    }
+    if (get_default_output_path(inPaths[i], forceOverwrite, &outPaths[i]))
+    {
+      goto cleanup;
+    }
+    for (size_t j = 0; j < i; j++)
+    {
+      if (strcmp(outPaths[i], outPaths[j]) == 0)
+      {
+        kmyth_log(LOG_ERR, "inputs %s and %s both map to %s ... exiting",
+                  inPaths[j], inPaths[i], outPaths[i]);
+        goto cleanup;
+      }
+    }
+    files[i].path = inPaths[i];
+  }
+
+  // the inputs are read (and the .ski files written) many at a time, so
+  // that slow storage is not waited on once per file
+  int read_failed = kmyth_bulk_read_files(files, inPaths_count, 0);
+
+  for (size_t i = 0; i < inPaths_count; i++)
+  {
+    inputs[i] = files[i].data;
+    input_lens[i] = files[i].data_len;
+    if (files[i].result)
+    {
+      kmyth_log(LOG_ERR, "seal input data file (%s) read error ... exiting",
+                inPaths[i]);
+    }
+  }
+  if (read_failed)
+  {
+    goto cleanup;
+  }
+
+  if (tpm2_kmyth_seal_batch(inPaths_count, inputs, input_lens,
+                            outputs, output_lens,
+                            auth_bytes, auth_bytes_len,
+                            owner_auth_bytes, oa_bytes_len,
+                            pcrs, pcrs_len, cipher_string, expected_policy))
+  {
+    kmyth_log(LOG_ERR, "kmyth-seal batch error ... exiting");
+    goto cleanup;
+  }
+
+  // the .ski files are written side by side and flushed to disk together,
+  // so that none of them is left half written by a crash
+  kmyth_write_batch batch;
+
+  init_write_batch(&batch);
+  retval = 0;
+  for (size_t i = 0; i < inPaths_count; i++)
+  {
+    files[i].path = outPaths[i];
+    files[i].data = outputs[i];
+    files[i].data_len = output_lens[i];
+  }
+  if (kmyth_bulk_write_files(&batch, files, inPaths_count, 0))
+  {
+    for (size_t i = 0; i < inPaths_count; i++)
+    {
+      if (files[i].result)
+      {
+        kmyth_log(LOG_ERR, "error writing data to .ski file (%s)",
+                  outPaths[i]);
+      }
+    }
+    retval = 1;
+  }
+  if (commit_write_batch(&batch, NULL))
+  {
+    kmyth_log(LOG_ERR, "error writing out the .ski files ... exiting");
+    retval = 1;
+  }
+
+cleanup:
+  for (size_t i = 0; i < inPaths_count; i++)
+  {
+    if (outPaths != NULL)
+    {
+      free(outPaths[i]);
+    }
+    if (inputs != NULL && inputs[i] != NULL)
+    {
+      kmyth_clear_and_free(inputs[i], input_lens[i]);
+    }
+    if (outputs != NULL)
+    {
+      free(outputs[i]);
+    }
+  }
+  free(outPaths);
+  free(inputs);
+  free(input_lens);
+  free(outputs);
+  free(output_lens);
+  free(files);
+
+  return retval;
+}
+
 int main(int argc, char **argv)
 {
   // If no command line arguments provided, provide usage help and exit early
@@ -194,6 +470,9 @@ int main(int argc, char **argv)
 
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
+  char **inPaths = NULL;
+  size_t inPaths_count = 0;
+  bool batchMode = false;
   char *outPath = NULL;
   size_t outPath_size = 0;
   char *authString = NULL;
@@ -203,13 +482,14 @@ int main(int argc, char **argv)
   bool forceOverwrite = false;
   char *expected_policy = NULL;
   uint8_t bool_trial_only = 0;
+  bool streamMode = false;
 
   // Parse and apply command line options
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "a:e:i:o:c:p:w:fghlv", longopts,
+          getopt_long(argc, argv, "a:e:i:o:c:p:w:k:T:bfghlv", longopts,
                       &option_index)) != -1)
   {
     switch (options)
@@ -221,7 +501,24 @@ int main(int argc, char **argv)
       cipherString = optarg;
       break;
     case 'i':
-      inPath = optarg;
+      // -i may be repeated, each occurrence adds another file to be sealed
+      {
+        char **new_inPaths = realloc(inPaths,
+                                     (inPaths_count + 1) * sizeof(char *));
+
+        if (new_inPaths == NULL)
+        {
+          kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+          free(inPaths);
+          free(outPath);
+          return 1;
+        }
+        inPaths = new_inPaths;
+        inPaths[inPaths_count++] = optarg;
+      }
+      break;
+    case 'b':
+      batchMode = true;
       break;
     case 'o':
       // make outPath a copy of the argument for consistency with case
@@ -249,6 +546,71 @@ int main(int argc, char **argv)
     case 'w':
       ownerAuthPasswd = optarg;
       break;
+    case 'k':
+      if (set_sk_alg(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'T':
+      if (set_tcti_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_STREAM_OPTION:
+      streamMode = true;
+      break;
+    case KMYTH_THREADS_OPTION:
+      {
+        char *end = NULL;
+        unsigned long threads = strtoul(optarg, &end, 10);
+
+        if (end == optarg || *end != '\0' ||
+            set_cipher_threads((size_t) threads))
+        {
+          kmyth_log(LOG_ERR, "invalid thread count (%s) ... exiting", optarg);
+          return 1;
+        }
+      }
+      break;
+    case KMYTH_SKI_V2_OPTION:
+      set_ski_format(KMYTH_SKI_FORMAT_V2);
+      break;
+    case KMYTH_COMPRESS_OPTION:
+      {
+        kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+
+        if (kmyth_compression_from_name(optarg, &compression) ||
+            set_compression(compression))
+        {
+          kmyth_log(LOG_ERR, "invalid compression (%s) ... exiting", optarg);
+          return 1;
+        }
+      }
+      break;
+    case KMYTH_AUTHORIZING_KEY_OPTION:
+      if (set_authorizing_key(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_PRIORITY_OPTION:
+      {
+        kmyth_tpm_priority priority = KMYTH_TPM_PRIORITY_NORMAL;
+
+        if (parse_tpm_priority(optarg, &priority) ||
+            set_default_tpm_priority(priority))
+        {
+          return 1;
+        }
+      }
+      break;
+    case KMYTH_STATS_OPTION:
+      set_tpm_stats(true);
+      kmyth_alloc_stats_enable(true);
+      atexit(print_stats_at_exit);
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -266,6 +628,30 @@ int main(int argc, char **argv)
     }
   }
 
+  // In batch mode, any non-option arguments are additional files to seal
+  if (batchMode)
+  {
+    for (int i = optind; i < argc; i++)
+    {
+      char **new_inPaths = realloc(inPaths,
+                                   (inPaths_count + 1) * sizeof(char *));
+
+      if (new_inPaths == NULL)
+      {
+        kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+        free(inPaths);
+        free(outPath);
+        return 1;
+      }
+      inPaths = new_inPaths;
+      inPaths[inPaths_count++] = argv[i];
+    }
+  }
+  if (inPaths_count > 0)
+  {
+    inPath = inPaths[0];
+  }
+
   //Since these originate in main() we know they are null terminated
   size_t auth_string_len = (authString == NULL) ? 0 : strlen(authString);
   size_t oa_passwd_len =
@@ -281,78 +667,85 @@ int main(int argc, char **argv)
     }
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     free(outPath);
+    free(inPaths);
     return 1;
   }
 
-  // If output file not specified, set output path to basename(inPath) with
-  // a .ski extension in the directory that the application is being run from.
-  if (outPath == NULL)
+  // Sealing several files: outputs always take their default names, and the
+  // storage key and policy are created once and shared by the whole batch
+  if (batchMode || inPaths_count > 1)
   {
-    // create buffer to hold default filename derived from input filename
-    char default_fn[KMYTH_MAX_DEFAULT_FILENAME_LEN + 1];
-    memset(default_fn, '\0', sizeof(default_fn));
-
-    // Initialize default filename to basename() of input path, truncating if
-    // necessary. The maximum size of this "root" value is the must allow space
-    // to add a '.' delimiter (1 byte) and the default extension
-    // (KMYTH_DEFAULT_SEAL_OUT_EXT_LEN bytes).
-    size_t max_root_len = KMYTH_MAX_DEFAULT_FILENAME_LEN;
-    max_root_len -= KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
-    strncpy(default_fn, basename(inPath), max_root_len);
-
-    // remove any leading '.'s
-    while (*default_fn == '.')
+    if (outPath != NULL || bool_trial_only || streamMode)
     {
-      memmove(default_fn, default_fn + 1, sizeof(default_fn) - 1);
+      kmyth_log(LOG_ERR,
+                "-o, -g and --stream cannot be used when sealing multiple files");
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(outPath);
+      free(inPaths);
+      return 1;
     }
 
-    // ensure that this intermediate result is not an empty string
-    if (strlen(default_fn) == 0)
+    int *pcrs = NULL;
+    int pcrs_len = 0;
+
+    if (parse_pcrs_string(pcrsString, &pcrs, &pcrs_len) != 0 || pcrs_len < 0)
     {
-      kmyth_log(LOG_ERR, "invalid/empty default filename root ... exiting");
+      kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+                pcrsString);
       kmyth_clear(authString, auth_string_len);
       kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(inPaths);
       return 1;
     }
 
-    // everything beyond first non-leading '.' is treated as extension
-    char *ext_ptr = strstr(default_fn, ".");
-    if (ext_ptr == NULL)
-    {
-      // no filename extension found - just add trailing '.'
-      strncat(default_fn, ".", 1);
-    }
-    else
-    {
-      // input fileame extension delimiter found, null everything after it
-      // The type conversion here is safe assuming inPath is not too pathological,
-      // so that's something we should think about.
-      ptrdiff_t filename_portion = ext_ptr - default_fn;
-      size_t tail_length = sizeof(default_fn) - (size_t)filename_portion;
-      memset(ext_ptr + 1, '\0', tail_length);
-    }
+    int retval = seal_batch(inPaths, inPaths_count, forceOverwrite,
+                            (uint8_t *) authString, auth_string_len,
+                            (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                            pcrs, (size_t) pcrs_len, cipherString,
+                            expected_policy);
 
-    // concatenate default filename root and extension
-    strncat(default_fn, KMYTH_DEFAULT_SEAL_OUT_EXT,
-                        KMYTH_DEFAULT_SEAL_OUT_EXT_LEN);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
+    free(inPaths);
+    return retval;
+  }
+
+  // In stream mode, '-' stands for stdin (-i) or stdout (-o), so that
+  // kmyth-seal can sit in a pipeline without buffering its input or output
+  bool use_stdin = (strcmp(inPath, "-") == 0);
+  bool use_stdout = (outPath != NULL && strcmp(outPath, "-") == 0);
+
+  if ((use_stdin || use_stdout) && (!streamMode || bool_trial_only))
+  {
+    kmyth_log(LOG_ERR, "'-' (stdin/stdout) requires --stream ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    free(inPaths);
+    return 1;
+  }
+  if (use_stdin && outPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "-o must be specified when sealing stdin ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(inPaths);
+    return 1;
+  }
 
-    // Make sure default filename we constructed doesn't already exist
-    struct stat st = { 0 };
-    if (!stat(default_fn, &st) && !forceOverwrite)
+  // If output file not specified, set output path to basename(inPath) with
+  // a .ski extension in the directory that the application is being run from.
+  if (outPath == NULL)
+  {
+    if (get_default_output_path(inPath, forceOverwrite, &outPath))
     {
-      kmyth_log(LOG_ERR,
-                "default output filename (%s) already exists ... exiting",
-                default_fn);
       kmyth_clear(authString, auth_string_len);
       kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(inPaths);
       return 1;
     }
-
-    // Go ahead and make the default value the output path
-    outPath_size = strlen(default_fn);
-    outPath = malloc(outPath_size * sizeof(char));
-    memcpy(outPath, default_fn, outPath_size);
-    kmyth_log(LOG_WARNING, "output file not specified, default = %s", outPath);
   }
 
   uint8_t *output = NULL;
@@ -366,9 +759,35 @@ int main(int argc, char **argv)
     kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting", pcrsString);
     free(outPath);
     free(output);
+    free(inPaths);
     return 1;
   }
 
+  // A streamed file is encrypted straight into the output file, so it is
+  // never held in memory as a whole
+  if (streamMode && bool_trial_only == 0)
+  {
+    int retval = tpm2_kmyth_seal_stream(use_stdin ? NULL : inPath,
+                                        use_stdout ? NULL : outPath,
+                                        (uint8_t *) authString,
+                                        auth_string_len,
+                                        (uint8_t *) ownerAuthPasswd,
+                                        oa_passwd_len, pcrs,
+                                        (size_t) pcrs_len, cipherString,
+                                        expected_policy);
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "kmyth-seal error ... exiting");
+    }
+    free(pcrs);
+    free(outPath);
+    free(inPaths);
+    return retval;
+  }
+
   // Call top-level "kmyth-seal" function
   if (tpm2_kmyth_seal_file(inPath, &output, &output_length,
                            (uint8_t *) authString, auth_string_len,
@@ -382,6 +801,7 @@ int main(int argc, char **argv)
     free(pcrs);
     free(outPath);
     free(output);
+    free(inPaths);
     return 1;
   }
 
@@ -397,6 +817,7 @@ int main(int argc, char **argv)
       free(outPath);
       free(output);
       free(pcrs);
+      free(inPaths);
       return 1;
     }
   }
@@ -404,5 +825,6 @@ int main(int argc, char **argv)
   free(pcrs);
   free(outPath);
   free(output);
+  free(inPaths);
   return 0;
 }
@@ -0,0 +1,170 @@
+/*
+ * Kmyth Policy Signing Interface
+ *
+ * Signs an approval of a PCR policy digest (as reported by kmyth-seal -g)
+ * with an authorizing key, so that data sealed to that key (kmyth-seal
+ * --authorizing_key) can be unsealed in the approved PCR state. Only the
+ * private key is needed: no TPM is involved.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "formatting_tools.h"
+#include "kmyth_log.h"
+#include "kmyth_policy_authorize.h"
+#include "memory_util.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -k or --key             Path to the authorizing key (PEM RSA private key).\n"
+          " -e or --policy          Policy digest to approve, in hex (the output of kmyth-seal -g).\n"
+          " -o or --output          Destination path for the signed policy. Unsealing finds it through\n"
+          "                         --signed_policy or $%s (a file, or a directory of them).\n"
+          " -f or --force           Force the overwrite of an existing output file.\n"
+          " -v or --verbose         Enable detailed logging.\n"
+          " -h or --help            Help (displays this usage).\n", prog,
+          KMYTH_SIGNED_POLICY_ENV);
+}
+
+const struct option longopts[] = {
+  {"key", required_argument, 0, 'k'},
+  {"policy", required_argument, 0, 'e'},
+  {"output", required_argument, 0, 'o'},
+  {"force", no_argument, 0, 'f'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // If no command line arguments provided, provide usage help and exit early
+  if (argc == 1)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  char *keyPath = NULL;
+  char *policyString = NULL;
+  char *outPath = NULL;
+  bool forceOverwrite = false;
+
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "k:e:o:fhv", longopts,
+                                &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'k':
+      keyPath = optarg;
+      break;
+    case 'e':
+      policyString = optarg;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'f':
+      forceOverwrite = true;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  if (keyPath == NULL || policyString == NULL || outPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "-k, -e and -o must all be specified ... exiting");
+    return 1;
+  }
+
+  TPM2B_DIGEST approvedPolicy = {.size = 0, };
+
+  if (strlen(policyString) != 2 * KMYTH_DIGEST_SIZE ||
+      convert_string_to_digest(policyString, &approvedPolicy))
+  {
+    kmyth_log(LOG_ERR, "invalid policy digest (%s) ... exiting",
+              policyString);
+    return 1;
+  }
+
+  if (verifyOutputFilePath(outPath))
+  {
+    kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", outPath);
+    return 1;
+  }
+  if (!forceOverwrite)
+  {
+    struct stat st = { 0 };
+    if (!stat(outPath, &st))
+    {
+      kmyth_log(LOG_ERR,
+                "output filename (%s) already exists ... exiting", outPath);
+      return 1;
+    }
+  }
+
+  uint8_t *pem = NULL;
+  size_t pem_len = 0;
+
+  if (read_bytes_from_file(keyPath, &pem, &pem_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read authorizing key (%s) ... exiting",
+              keyPath);
+    return 1;
+  }
+
+  uint8_t *signedPolicy = NULL;
+  size_t signedPolicy_len = 0;
+  int retval = kmyth_sign_policy(&approvedPolicy, pem, pem_len,
+                                 &signedPolicy, &signedPolicy_len);
+
+  kmyth_clear_and_free(pem, pem_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to sign policy ... exiting");
+    return 1;
+  }
+
+  retval = write_bytes_to_file_atomic(outPath, signedPolicy,
+                                      signedPolicy_len);
+  free(signedPolicy);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error writing signed policy (%s) ... exiting",
+              outPath);
+    return 1;
+  }
+
+  return 0;
+}
@@ -3,17 +3,26 @@
  */
 
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
 
 #include "defines.h"
 #include "file_io.h"
 #include "kmyth.h"
+#include "kmyth_keyring.h"
 #include "kmyth_log.h"
+#include "kmyth_policy_authorize.h"
 #include "memory_util.h"
+#include "metrics.h"
+#include "tpm2_interface.h"
+
+#include "cipher/cipher.h"
 
 static void usage(const char *prog)
 {
@@ -26,10 +35,41 @@ static void usage(const char *prog)
           "                       existing files unless the 'force' option is selected.\n"
           " -f or --force         Force the overwrite of an existing output file\n"
           " -s or --stdout        Output unencrypted result to stdout instead of file.\n"
+          "    --exec             Run this shell command with the unsealed data on a descriptor (see --fd)\n"
+          "                       instead of writing it out. The data is held in a sealed (read-only)\n"
+          "                       memory file, never on a filesystem; $%s names the descriptor, and\n"
+          "                       the command's exit status is returned.\n"
+          "    --fd               Descriptor the --exec command reads the data from (defaults to %d), or,\n"
+          "                       without --exec, an open descriptor to write the unsealed data to.\n"
           " -p or --policy_or     Unseals a file sealed using a compound \"policy or\".\n"
           " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -T or --tcti          TPM connection: auto, device[:path], abrmd, mssim[:conf] or swtpm[:conf].\n"
+          "                       Defaults to $%s, else '%s'.\n"
+          "    --keyring          Cache the unsealed data in a kernel keyring, so that later runs (by any\n"
+          "                       process of the user) within the timeout skip the TPM and its PCR check:\n"
+          "                       user[:<seconds>], session[:<seconds>] or none. The timeout defaults to %d.\n"
+          "                       Defaults to $%s, else none.\n"
+          "    --signed_policy    Signed policy file, or directory of them, approving the current PCR state\n"
+          "                       for data sealed with --authorizing_key. Defaults to $%s.\n"
+          "    --stream           Unseal a file sealed with 'kmyth-seal --stream', a chunk at a time.\n"
+          "                       '-i -' reads it from stdin; with -s the whole pipeline runs in constant memory.\n"
+          "    --threads          Threads used to decrypt the chunks of a streaming cipher (0 = one per CPU).\n"
+          "                       Defaults to 1.\n"
+          "    --derive           Treat the input as a sealed master secret and output the key derived from it\n"
+          "                       for this label (HKDF-SHA256) instead. May be repeated: the master is unsealed\n"
+          "                       once, and the keys are output one after the other, in order.\n"
+          "    --derive_len       Length in bytes of each derived key (1 to %d). Defaults to %d.\n"
+          "    --priority         TPM scheduling class: interactive, normal or bulk. Defaults to $%s,\n"
+          "                       else interactive.\n"
+          "    --stats            Print per-command TPM latency statistics and Kmyth metrics\n"
+          "                       (cache hits, TPM errors by response code, allocations, ...) to stderr on exit.\n"
           " -v or --verbose       Enable detailed logging.\n"
-          " -h or --help          Help (displays this usage).\n", prog);
+          " -h or --help          Help (displays this usage).\n", prog,
+          KMYTH_EXEC_FD_ENV, KMYTH_EXEC_DEFAULT_FD, KMYTH_TCTI_ENV,
+          KMYTH_DEFAULT_TCTI, KMYTH_KEYRING_DEFAULT_TIMEOUT, KMYTH_KEYRING_ENV,
+          KMYTH_SIGNED_POLICY_ENV,
+          KMYTH_DERIVE_MAX_KEY_LEN,
+          KMYTH_DERIVE_DEFAULT_KEY_LEN, KMYTH_TPM_PRIORITY_ENV);
 }
 
 const struct option longopts[] = {
@@ -40,11 +80,83 @@ const struct option longopts[] = {
   {"policy_or", no_argument, 0, 'p'},
   {"owner_auth", required_argument, 0, 'w'},
   {"standard", no_argument, 0, 's'},
+  {"tcti", required_argument, 0, 'T'},
+  {"exec", required_argument, 0, KMYTH_EXEC_OPTION},
+  {"fd", required_argument, 0, KMYTH_FD_OPTION},
+  {"keyring", required_argument, 0, KMYTH_KEYRING_OPTION},
+  {"signed_policy", required_argument, 0, KMYTH_SIGNED_POLICY_OPTION},
+  {"stream", no_argument, 0, KMYTH_STREAM_OPTION},
+  {"threads", required_argument, 0, KMYTH_THREADS_OPTION},
+  {"derive", required_argument, 0, KMYTH_DERIVE_OPTION},
+  {"derive_len", required_argument, 0, KMYTH_DERIVE_LEN_OPTION},
+  {"priority", required_argument, 0, KMYTH_PRIORITY_OPTION},
+  {"stats", no_argument, 0, KMYTH_STATS_OPTION},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
 };
 
+//############################################################################
+// derive_keys()
+//############################################################################
+/**
+ * @brief Derives a key for each label from the sealed master secret in
+ *        inPath, unsealing the master only once, and returns the keys one
+ *        after the other.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int derive_keys(char *inPath, char **labels, size_t label_count,
+                       size_t key_len, uint8_t * auth_bytes,
+                       size_t auth_bytes_len, uint8_t * owner_auth_bytes,
+                       size_t oa_bytes_len, uint8_t bool_policy_or,
+                       uint8_t ** output, size_t *output_length)
+{
+  uint8_t *master = NULL;
+  size_t master_len = 0;
+
+  if (read_bytes_from_file(inPath, &master, &master_len) || master == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to read sealed master (%s) ... exiting",
+              inPath);
+    free(master);
+    return 1;
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+  uint8_t *keys = calloc(label_count, key_len);
+  int retval = (keys == NULL) || kmyth_ctx_create(&ctx);
+
+  for (size_t i = 0; retval == 0 && i < label_count; i++)
+  {
+    retval = kmyth_derive_key(ctx, master, master_len,
+                              auth_bytes, auth_bytes_len,
+                              owner_auth_bytes, oa_bytes_len,
+                              bool_policy_or, labels[i],
+                              keys + i * key_len, key_len);
+  }
+  kmyth_ctx_destroy(&ctx);
+  free(master);
+
+  if (retval)
+  {
+    kmyth_clear_and_free(keys, label_count * key_len);
+    return 1;
+  }
+  *output = keys;
+  *output_length = label_count * key_len;
+  return 0;
+}
+
+//############################################################################
+// print_stats_at_exit()
+//############################################################################
+static void print_stats_at_exit(void)
+{
+  print_tpm_stats(stderr);
+  kmyth_metrics_print_summary(stderr);
+}
+
 int main(int argc, char **argv)
 {
   // If no command line arguments provided, provide usage help and exit early
@@ -59,19 +171,32 @@ int main(int argc, char **argv)
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
 
+  // Someone is waiting on the result: unless told otherwise, go ahead of
+  // other processes' bulk TPM work (e.g., a kmyth-reseal run)
+  if (getenv(KMYTH_TPM_PRIORITY_ENV) == NULL)
+  {
+    set_default_tpm_priority(KMYTH_TPM_PRIORITY_INTERACTIVE);
+  }
+
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
   char *outPath = NULL;
   bool stdout_flag = false;
+  char *execCommand = NULL;
+  int outFd = -1;
   char *authString = NULL;
   char *ownerAuthPasswd = "";
   bool forceOverwrite = false;
   uint8_t bool_policy_or = 0;
+  bool streamMode = false;
+  char **deriveLabels = NULL;
+  size_t deriveCount = 0;
+  size_t deriveLen = KMYTH_DERIVE_DEFAULT_KEY_LEN;
   int options;
   int option_index;
 
   // Parse and apply command line options
-  while ((options = getopt_long(argc, argv, "a:i:o:w:fhpsv", longopts,
+  while ((options = getopt_long(argc, argv, "a:i:o:w:T:fhpsv", longopts,
                                 &option_index)) != -1)
   {
     switch (options)
@@ -94,6 +219,99 @@ int main(int argc, char **argv)
     case 'w':
       ownerAuthPasswd = optarg;
       break;
+    case 'T':
+      if (set_tcti_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_KEYRING_OPTION:
+      if (set_keyring_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_SIGNED_POLICY_OPTION:
+      if (set_signed_policy_path(optarg))
+      {
+        return 1;
+      }
+      break;
+    case KMYTH_EXEC_OPTION:
+      execCommand = optarg;
+      break;
+    case KMYTH_FD_OPTION:
+      {
+        char *end = NULL;
+        long fd = strtol(optarg, &end, 10);
+
+        if (end == optarg || *end != '\0' || fd < 0 || fd > INT_MAX)
+        {
+          kmyth_log(LOG_ERR, "invalid descriptor (%s) ... exiting", optarg);
+          return 1;
+        }
+        outFd = (int) fd;
+      }
+      break;
+    case KMYTH_STREAM_OPTION:
+      streamMode = true;
+      break;
+    case KMYTH_THREADS_OPTION:
+      {
+        char *end = NULL;
+        unsigned long threads = strtoul(optarg, &end, 10);
+
+        if (end == optarg || *end != '\0' ||
+            set_cipher_threads((size_t) threads))
+        {
+          kmyth_log(LOG_ERR, "invalid thread count (%s) ... exiting", optarg);
+          return 1;
+        }
+      }
+      break;
+    case KMYTH_DERIVE_OPTION:
+      // there can be no more labels than arguments
+      if (deriveLabels == NULL)
+      {
+        deriveLabels = calloc((size_t) argc, sizeof(char *));
+        if (deriveLabels == NULL)
+        {
+          return 1;
+        }
+      }
+      deriveLabels[deriveCount++] = optarg;
+      break;
+    case KMYTH_DERIVE_LEN_OPTION:
+      {
+        char *end = NULL;
+        unsigned long len = strtoul(optarg, &end, 10);
+
+        if (end == optarg || *end != '\0' || len == 0 ||
+            len > KMYTH_DERIVE_MAX_KEY_LEN)
+        {
+          kmyth_log(LOG_ERR, "invalid derived key length (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+        deriveLen = (size_t) len;
+      }
+      break;
+    case KMYTH_PRIORITY_OPTION:
+      {
+        kmyth_tpm_priority priority = KMYTH_TPM_PRIORITY_NORMAL;
+
+        if (parse_tpm_priority(optarg, &priority) ||
+            set_default_tpm_priority(priority))
+        {
+          return 1;
+        }
+      }
+      break;
+    case KMYTH_STATS_OPTION:
+      set_tpm_stats(true);
+      kmyth_alloc_stats_enable(true);
+      atexit(print_stats_at_exit);
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -116,8 +334,12 @@ int main(int argc, char **argv)
   size_t oa_passwd_len =
     (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
 
+  // The unsealed data goes to exactly one place: a file, stdout, a
+  // command (--exec) or a descriptor (--fd)
+  bool handoff = (execCommand != NULL || outFd >= 0);
+
   // Check that input path (file to be sealed) was specified
-  if (inPath == NULL || (outPath == NULL && stdout_flag == false))
+  if (inPath == NULL || (outPath == NULL && stdout_flag == false && !handoff))
   {
     kmyth_log(LOG_ERR,
               "Input file and output file (or stdout) must both be specified ... exiting");
@@ -125,7 +347,33 @@ int main(int argc, char **argv)
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
   }
-  else
+  if (handoff && (outPath != NULL || stdout_flag || streamMode))
+  {
+    kmyth_log(LOG_ERR,
+              "--exec and --fd cannot be used with -o, -s or --stream ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  // In stream mode, '-i -' reads the sealed data from stdin (a pipe)
+  bool use_stdin = (strcmp(inPath, "-") == 0);
+
+  if (use_stdin && !streamMode)
+  {
+    kmyth_log(LOG_ERR, "'-i -' (stdin) requires --stream ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (streamMode && deriveCount > 0)
+  {
+    kmyth_log(LOG_ERR, "--derive cannot be used with --stream ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (!use_stdin)
   {
     if (verifyInputFilePath(inPath))
     {
@@ -136,7 +384,7 @@ int main(int argc, char **argv)
     }
   }
   // If output to be written to file - validate that path
-  if (stdout_flag == false)
+  if (stdout_flag == false && !handoff)
   {
     // Verify output path
     if (verifyOutputFilePath(outPath))
@@ -162,14 +410,42 @@ int main(int argc, char **argv)
     }
   }
 
-  // Call top-level "kmyth-unseal" function
+  // A streamed file is decrypted straight to its destination, so it is
+  // never held in memory as a whole
+  if (streamMode)
+  {
+    int retval = tpm2_kmyth_unseal_stream(use_stdin ? NULL : inPath,
+                                          stdout_flag ? NULL : outPath,
+                                          (uint8_t *) authString,
+                                          auth_string_len,
+                                          (uint8_t *) ownerAuthPasswd,
+                                          oa_passwd_len, bool_policy_or);
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
+    }
+    return retval;
+  }
+
+  // Call top-level "kmyth-unseal" function (or derive keys from the
+  // unsealed master secret)
   uint8_t *output = NULL;
   size_t output_length = 0;
+  int retval = (deriveCount > 0) ?
+    derive_keys(inPath, deriveLabels, deriveCount, deriveLen,
+                (uint8_t *) authString, auth_string_len,
+                (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                bool_policy_or, &output, &output_length) :
+    tpm2_kmyth_unseal_file(inPath, &output, &output_length,
+                           (uint8_t *) authString, auth_string_len,
+                           (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                           bool_policy_or);
 
-  if (tpm2_kmyth_unseal_file(inPath, &output, &output_length,
-                             (uint8_t *) authString, auth_string_len,
-                             (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                             bool_policy_or))
+  free(deriveLabels);
+  if (retval)
   {
     kmyth_clear_and_free(output, output_length);
     kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
@@ -181,7 +457,40 @@ int main(int argc, char **argv)
   kmyth_clear(authString, auth_string_len);
   kmyth_clear(ownerAuthPasswd, oa_passwd_len);
 
-  if (stdout_flag == true)
+  if (execCommand != NULL)
+  {
+    // The command reads the data from a sealed memory file, which this
+    // process no longer needs its own copy of once it is filled
+    int memFd = -1;
+    int status = 1;
+
+    if (write_bytes_to_memfd(KMYTH_APP_NAME, output, output_length, &memFd))
+    {
+      kmyth_log(LOG_ERR, "error handing the unsealed data to the command");
+    }
+    kmyth_clear_and_free(output, output_length);
+    if (memFd >= 0)
+    {
+      if (run_with_fd(execCommand, memFd,
+                      (outFd < 0) ? KMYTH_EXEC_DEFAULT_FD : outFd,
+                      KMYTH_EXEC_FD_ENV, &status))
+      {
+        kmyth_log(LOG_ERR, "error running command: %s", execCommand);
+        status = 1;
+      }
+      close(memFd);
+    }
+    return status;
+  }
+
+  if (outFd >= 0)
+  {
+    if (write_bytes_to_fd(outFd, output, output_length))
+    {
+      kmyth_log(LOG_ERR, "error writing to descriptor %d", outFd);
+    }
+  }
+  else if (stdout_flag == true)
   {
     if (print_to_stdout(output, output_length))
     {
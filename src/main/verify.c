@@ -0,0 +1,499 @@
+/*
+ * Kmyth .ski Verification Interface
+ *
+ * Checks, without the TPM, that .ski files (given directly, or found by
+ * walking directories) are well-formed and undamaged, on every CPU core at
+ * once, and reports the result for each file as one JSON object per line.
+ */
+
+#include <ftw.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth_log.h"
+#include "marshalling_tools.h"
+#include "tpm2_interface.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options] <file.ski or directory> [...]\n\n"
+          "Directories are searched (recursively) for *.ski files. Prints one JSON\n"
+          "object per file, in no particular order, then a summary object, e.g.:\n\n"
+          "  {\"file\": \"a.ski\", \"status\": \"ok\", \"format\": \"text\", \"bytes\": 8130}\n"
+          "  {\"file\": \"b.ski\", \"status\": \"corrupt\", \"format\": \"v2\", \"bytes\": 2210, \"error\": \"...\"}\n"
+          "  {\"summary\": {\"files\": 2, \"ok\": 1, \"corrupt\": 1, \"unreadable\": 0, ...}}\n\n"
+          "options are: \n\n"
+          " -j or --jobs          Number of files checked at once. Defaults to the number of CPUs.\n"
+          " -o or --output        Write the results to this file instead of stdout.\n"
+          " -q or --quiet         Only report the files that fail (and the summary).\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog);
+}
+
+const struct option longopts[] = {
+  {"jobs", required_argument, 0, 'j'},
+  {"output", required_argument, 0, 'o'},
+  {"quiet", no_argument, 0, 'q'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+/**
+ * @brief Outcome of checking one file
+ */
+typedef enum
+{
+  VERIFY_OK,
+  VERIFY_CORRUPT,
+  VERIFY_UNREADABLE,
+} verify_status;
+
+/**
+ * @brief Shared state of a verification run. Worker threads take the next
+ *        unchecked file from paths, and serialize their report lines (and
+ *        totals) on lock.
+ */
+typedef struct
+{
+  char **paths;
+  size_t count;
+  size_t next;
+  pthread_mutex_t lock;
+
+  FILE *out;
+  bool quiet;
+
+  size_t ok;
+  size_t corrupt;
+  size_t unreadable;
+  uint64_t bytes;
+} verify_job;
+
+/*
+ * Files found by the directory walk (nftw() has no argument for its
+ * callback, so they are collected here)
+ */
+static char **found_paths = NULL;
+static size_t found_count = 0;
+static size_t found_size = 0;
+
+//############################################################################
+// add_path()
+//############################################################################
+static int add_path(const char *path)
+{
+  if (found_count == found_size)
+  {
+    size_t new_size = (found_size == 0) ? 1024 : 2 * found_size;
+    char **new_paths = realloc(found_paths, new_size * sizeof(char *));
+
+    if (new_paths == NULL)
+    {
+      kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+      return 1;
+    }
+    found_paths = new_paths;
+    found_size = new_size;
+  }
+
+  found_paths[found_count] = strdup(path);
+  if (found_paths[found_count] == NULL)
+  {
+    kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+    return 1;
+  }
+  found_count++;
+
+  return 0;
+}
+
+//############################################################################
+// add_walked_path()
+//############################################################################
+static int add_walked_path(const char *path, const struct stat *st,
+                           int type, struct FTW *ftw)
+{
+  const char *name = path + ftw->base;
+  size_t name_len = strlen(name);
+  size_t ext_len = KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
+
+  (void) st;
+
+  // only regular files named *.ski (hidden files are skipped)
+  if (type != FTW_F || name[0] == '.' || name_len <= ext_len ||
+      name[name_len - ext_len] != '.' ||
+      strcmp(name + name_len - ext_len + 1, KMYTH_DEFAULT_SEAL_OUT_EXT) != 0)
+  {
+    return 0;
+  }
+
+  return add_path(path);
+}
+
+//############################################################################
+// write_json_string()
+//############################################################################
+static void write_json_string(FILE * out, const char *s)
+{
+  fputc('"', out);
+  for (const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++)
+  {
+    if (*c == '"' || *c == '\\')
+    {
+      fprintf(out, "\\%c", *c);
+    }
+    else if (*c < 0x20)
+    {
+      fprintf(out, "\\u%04x", *c);
+    }
+    else
+    {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+//############################################################################
+// check_ski()
+//
+// Checks what the parser does not: that the keys are of the kind Kmyth
+// creates, and that the policy and encrypted data are present. Returns
+// NULL if all is well, else what is wrong.
+//############################################################################
+static const char *check_ski(Ski * ski)
+{
+  TPMT_PUBLIC *sk = &ski->sk_pub.publicArea;
+  TPMT_PUBLIC *wk = &ski->wk_pub.publicArea;
+
+  if (sk->type != TPM2_ALG_RSA && sk->type != TPM2_ALG_ECC)
+  {
+    return "storage key is not an RSA or ECC key";
+  }
+  if (!(sk->objectAttributes & TPMA_OBJECT_RESTRICTED) ||
+      !(sk->objectAttributes & TPMA_OBJECT_DECRYPT))
+  {
+    return "storage key is not a storage (restricted decryption) key";
+  }
+  if (wk->type != TPM2_ALG_KEYEDHASH)
+  {
+    return "wrapping key is not a sealed data object";
+  }
+  if (ski->sk_priv.size == 0 || ski->wk_priv.size == 0)
+  {
+    return "empty private area";
+  }
+  if (wk->authPolicy.size == 0)
+  {
+    return "wrapping key has no authorization policy";
+  }
+  if (ski->policyBranches.count == 1 ||
+      ski->policyBranches.count > KMYTH_MAX_POLICY_BRANCHES)
+  {
+    return "invalid number of policy branches";
+  }
+  if (ski->enc_data == NULL || ski->enc_data_size == 0)
+  {
+    return "no encrypted data";
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// verify_file()
+//############################################################################
+static verify_status verify_file(char *path, bool *v2, size_t *bytes,
+                                 const char **error)
+{
+  kmyth_file_view view;
+
+  *v2 = false;
+  *bytes = 0;
+  *error = NULL;
+
+  if (map_bytes_from_file(path, &view))
+  {
+    *error = "unable to read file";
+    return VERIFY_UNREADABLE;
+  }
+  *bytes = view.data_length;
+  *v2 = is_ski_v2(view.data, view.data_length);
+
+  // The header parser checks the delimiters (text) or section table (v2),
+  // and unpacks the PCR selection, policy branches and key areas (see
+  // unpack_public() and unpack_private()), whose TPM2B sizes must match
+  // the bytes they are stored in. A text .ski records whether it holds
+  // policy branches, which the full parse then needs to be told.
+  Ski header = get_default_ski();
+
+  if (parse_ski_header(view.data, view.data_length, &header))
+  {
+    *error = "malformed header, policy or key sections";
+    view.release(&view);
+    return VERIFY_CORRUPT;
+  }
+
+  // The full parse also decodes (base64) or bounds (v2) the encrypted
+  // data, and checks what follows it. The encrypted data of a v2 .ski is
+  // borrowed from the mapping, not copied.
+  Ski ski = get_default_ski();
+  uint8_t policy_or = (header.policyBranches.count > 0) ? 1 : 0;
+
+  free_ski(&header);
+  if (parse_ski_bytes_borrowed(view.data, view.data_length, &ski, policy_or))
+  {
+    *error = (*v2) ? "malformed encrypted data section" :
+      "malformed encrypted data section (invalid base64 or delimiters)";
+    view.release(&view);
+    return VERIFY_CORRUPT;
+  }
+
+  *error = check_ski(&ski);
+  free_ski(&ski);
+  view.release(&view);
+
+  return (*error == NULL) ? VERIFY_OK : VERIFY_CORRUPT;
+}
+
+//############################################################################
+// verify_worker()
+//############################################################################
+static void *verify_worker(void *arg)
+{
+  verify_job *job = (verify_job *) arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&job->lock);
+    size_t i = job->next++;
+
+    pthread_mutex_unlock(&job->lock);
+    if (i >= job->count)
+    {
+      break;
+    }
+
+    bool v2 = false;
+    size_t bytes = 0;
+    const char *error = NULL;
+    verify_status status = verify_file(job->paths[i], &v2, &bytes, &error);
+
+    pthread_mutex_lock(&job->lock);
+    job->bytes += bytes;
+    switch (status)
+    {
+    case VERIFY_OK:
+      job->ok++;
+      break;
+    case VERIFY_CORRUPT:
+      job->corrupt++;
+      break;
+    default:
+      job->unreadable++;
+      break;
+    }
+    if (status != VERIFY_OK || !job->quiet)
+    {
+      fprintf(job->out, "{\"file\": ");
+      write_json_string(job->out, job->paths[i]);
+      fprintf(job->out, ", \"status\": \"%s\"",
+              (status == VERIFY_OK) ? "ok" :
+              (status == VERIFY_CORRUPT) ? "corrupt" : "unreadable");
+      if (status != VERIFY_UNREADABLE)
+      {
+        fprintf(job->out, ", \"format\": \"%s\", \"bytes\": %zu",
+                v2 ? "v2" : "text", bytes);
+      }
+      if (error != NULL)
+      {
+        fprintf(job->out, ", \"error\": ");
+        write_json_string(job->out, error);
+      }
+      fprintf(job->out, "}\n");
+    }
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  // If no command line arguments provided, provide usage help and exit early
+  if (argc == 1)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Initialize parameters that might be modified by command line options
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long jobs = (cpus > 0) ? cpus : 1;
+  char *outPath = NULL;
+  bool quiet = false;
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "j:o:qhv", longopts,
+                                &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'j':
+      {
+        char *end = NULL;
+
+        jobs = strtol(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || jobs < 1 ||
+            jobs > KMYTH_VERIFY_MAX_JOBS)
+        {
+          kmyth_log(LOG_ERR, "invalid number of jobs (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+      }
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  if (optind == argc)
+  {
+    kmyth_log(LOG_ERR, "no .ski file or directory specified ... exiting");
+    return 1;
+  }
+
+  // Gather the files: those named, and the *.ski files under the
+  // directories named (symbolic links are not followed into directories)
+  int retval = 0;
+
+  for (int i = optind; i < argc && retval == 0; i++)
+  {
+    struct stat st;
+
+    if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+    {
+      if (nftw(argv[i], add_walked_path, 64, FTW_PHYS) != 0)
+      {
+        kmyth_log(LOG_ERR, "unable to search directory %s ... exiting",
+                  argv[i]);
+        retval = 1;
+      }
+    }
+    else
+    {
+      retval = add_path(argv[i]);
+    }
+  }
+
+  verify_job job = {
+    .paths = found_paths,
+    .count = found_count,
+    .next = 0,
+    .out = stdout,
+    .quiet = quiet,
+  };
+
+  if (retval == 0 && outPath != NULL)
+  {
+    job.out = fopen(outPath, "w");
+    if (job.out == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to open %s ... exiting", outPath);
+      retval = 1;
+    }
+  }
+
+  if (retval == 0)
+  {
+    pthread_mutex_init(&job.lock, NULL);
+
+    size_t workers = ((size_t) jobs < job.count) ? (size_t) jobs : job.count;
+    pthread_t *threads = calloc((workers > 0) ? workers : 1,
+                                sizeof(pthread_t));
+    size_t started = 0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (threads != NULL && started < workers &&
+           pthread_create(&threads[started], NULL, verify_worker, &job) == 0)
+    {
+      started++;
+    }
+
+    // if no thread could be started, check the files on this one
+    if (started == 0)
+    {
+      verify_worker(&job);
+    }
+    for (size_t i = 0; i < started; i++)
+    {
+      pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(threads);
+    pthread_mutex_destroy(&job.lock);
+
+    double seconds = (double) (end.tv_sec - start.tv_sec) +
+      (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fprintf(job.out, "{\"summary\": {\"files\": %zu, \"ok\": %zu, "
+            "\"corrupt\": %zu, \"unreadable\": %zu, \"bytes\": %llu, "
+            "\"jobs\": %zu, \"seconds\": %.3f}}\n", job.count, job.ok,
+            job.corrupt, job.unreadable, (unsigned long long) job.bytes,
+            (started > 0) ? started : 1, seconds);
+
+    if (job.out != stdout && fclose(job.out) != 0)
+    {
+      kmyth_log(LOG_ERR, "error writing %s ... exiting", outPath);
+      retval = 1;
+    }
+    if (job.ok != job.count)
+    {
+      retval = 1;
+    }
+  }
+
+  for (size_t i = 0; i < found_count; i++)
+  {
+    free(found_paths[i]);
+  }
+  free(found_paths);
+
+  return retval;
+}
@@ -1,15 +1,173 @@
+#include "socket_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include "defines.h"
 
+//
+// socket_options_init()
+//
+void socket_options_init(socket_options * opts)
+{
+  opts->nodelay = true;
+  opts->keepalive = true;
+  opts->keepalive_idle = KMYTH_SOCKET_KEEPALIVE_IDLE;
+  opts->connect_timeout_ms = KMYTH_SOCKET_CONNECT_TIMEOUT_MS;
+  opts->io_timeout_ms = KMYTH_SOCKET_IO_TIMEOUT_MS;
+  opts->reuseport = false;
+  opts->dual_stack = true;
+}
+
+//
+// set_int_option()
+//
+static int set_int_option(int socket_fd, int level, int name, int value)
+{
+  return setsockopt(socket_fd, level, name, &value, sizeof(value)) != 0;
+}
+
+//
+// apply_socket_options()
+//
+int apply_socket_options(int socket_fd, const socket_options * opts)
+{
+  socket_options defaults;
+
+  if (opts == NULL)
+  {
+    socket_options_init(&defaults);
+    opts = &defaults;
+  }
+
+  if (opts->nodelay && set_int_option(socket_fd, IPPROTO_TCP, TCP_NODELAY, 1))
+  {
+    kmyth_log(LOG_ERR, "Failed to set TCP_NODELAY (%s).", strerror(errno));
+    return 1;
+  }
+
+  if (opts->keepalive)
+  {
+    if (set_int_option(socket_fd, SOL_SOCKET, SO_KEEPALIVE, 1))
+    {
+      kmyth_log(LOG_ERR, "Failed to set SO_KEEPALIVE (%s).", strerror(errno));
+      return 1;
+    }
+#ifdef TCP_KEEPIDLE
+    if (opts->keepalive_idle > 0
+        && set_int_option(socket_fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                          (int) opts->keepalive_idle))
+    {
+      kmyth_log(LOG_ERR, "Failed to set TCP_KEEPIDLE (%s).", strerror(errno));
+      return 1;
+    }
+#endif
+  }
+
+  if (opts->io_timeout_ms > 0)
+  {
+    struct timeval timeout = {
+      .tv_sec = opts->io_timeout_ms / 1000,
+      .tv_usec = (opts->io_timeout_ms % 1000) * 1000
+    };
+
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout))
+        || setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                      sizeof(timeout)))
+    {
+      kmyth_log(LOG_ERR, "Failed to set socket timeouts (%s).",
+                strerror(errno));
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//
+// connect_with_timeout()
+//
+// Connects a (blocking) socket, giving up after timeout_ms (0: no limit
+// beyond the system's own).
+//
+static int connect_with_timeout(int socket_fd, const struct sockaddr *addr,
+                                socklen_t addr_len, unsigned int timeout_ms)
+{
+  if (timeout_ms == 0)
+  {
+    return connect(socket_fd, addr, addr_len) == -1;
+  }
+
+  int flags = fcntl(socket_fd, F_GETFL);
+
+  if (flags == -1 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+  {
+    return 1;
+  }
+
+  int result = connect(socket_fd, addr, addr_len);
+
+  if (result == -1 && errno == EINPROGRESS)
+  {
+    struct pollfd pfd = {.fd = socket_fd,.events = POLLOUT };
+    int ready;
+
+    do
+    {
+      ready = poll(&pfd, 1, (int) timeout_ms);
+    }
+    while (ready == -1 && errno == EINTR);
+
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+
+    if (ready == 1
+        && getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error,
+                      &error_len) == 0 && error == 0)
+    {
+      result = 0;
+    }
+    else
+    {
+      errno = (ready == 0) ? ETIMEDOUT : error;
+    }
+  }
+
+  // Back to blocking mode for the caller.
+  if (fcntl(socket_fd, F_SETFL, flags) == -1)
+  {
+    result = -1;
+  }
+
+  return result == -1;
+}
+
 //
 // setup_client_socket()
 //
-int setup_client_socket(const char *node, const char *service, int *socket_fd)
+int setup_client_socket(const char *node, const char *service,
+                        const socket_options * opts, int *socket_fd)
 {
+  socket_options defaults;
+
+  if (opts == NULL)
+  {
+    socket_options_init(&defaults);
+    opts = &defaults;
+  }
+
   // Setup socket settings and lookup the target Internet address.
   *socket_fd = -1;
 
@@ -17,9 +175,9 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd)
   struct addrinfo *result = NULL;
   struct addrinfo *rp = NULL;
 
-  hints.ai_family = AF_INET;
+  hints.ai_family = opts->dual_stack ? AF_UNSPEC : AF_INET;
   hints.ai_socktype = SOCK_STREAM;
-  hints.ai_flags = 0;
+  hints.ai_flags = opts->dual_stack ? AI_ADDRCONFIG : 0;
   hints.ai_protocol = 0;
 
   int s = getaddrinfo(node, service, &hints, &result);
@@ -41,12 +199,15 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd)
       // Socket creation failed, try the next address.
       continue;
     }
-    if (connect(*socket_fd, rp->ai_addr, rp->ai_addrlen) != -1)
+    if (connect_with_timeout(*socket_fd, rp->ai_addr, rp->ai_addrlen,
+                             opts->connect_timeout_ms) == 0)
     {
       // Socket connection succeeded, use this socket.
       break;
     }
+    kmyth_log(LOG_DEBUG, "Connection attempt failed (%s).", strerror(errno));
     close(*socket_fd);
+    *socket_fd = -1;
   }
 
   // Cleanup address information and handle errors.
@@ -57,23 +218,32 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd)
     return 1;
   }
 
+  if (apply_socket_options(*socket_fd, opts))
+  {
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
   return 0;
 }
 
 //
-// setup_server_socket()
+// bind_server_socket()
 //
-int setup_server_socket(const char *service, int *socket_fd)
+// Binds a socket to the wildcard address of one address family.
+//
+static int bind_server_socket(const char *service, int family,
+                              const socket_options * opts, int *socket_fd)
 {
   struct addrinfo hints = { 0 };
   struct addrinfo *result = NULL;
   struct addrinfo *rp = NULL;
-  int optval = 1;
 
   // Setup socket settings and lookup own Internet address.
   *socket_fd = -1;
 
-  hints.ai_family = AF_INET;
+  hints.ai_family = family;
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_flags = AI_PASSIVE;
   hints.ai_protocol = 0;
@@ -85,7 +255,7 @@ int setup_server_socket(const char *service, int *socket_fd)
 
   if (s != 0)
   {
-    kmyth_log(LOG_ERR, "Failed to lookup own Internet address: %s",
+    kmyth_log(LOG_DEBUG, "Failed to lookup own Internet address: %s",
               gai_strerror(s));
     return 1;
   }
@@ -101,11 +271,19 @@ int setup_server_socket(const char *service, int *socket_fd)
       continue;
     }
 
-    // Avoid bind errors when reusing a port soon after closing it.
-    if (setsockopt(*socket_fd, SOL_SOCKET, SO_REUSEADDR,
-                   &optval, sizeof(optval)))
+    // Avoid bind errors when reusing a port soon after closing it, share
+    // the port with other processes if asked to, and take IPv4
+    // connections on an IPv6 socket.
+    if (set_int_option(*socket_fd, SOL_SOCKET, SO_REUSEADDR, 1)
+        || (opts->reuseport
+            && set_int_option(*socket_fd, SOL_SOCKET, SO_REUSEPORT, 1))
+        || (rp->ai_family == AF_INET6
+            && set_int_option(*socket_fd, IPPROTO_IPV6, IPV6_V6ONLY, 0)))
     {
-      kmyth_log(LOG_ERR, "setsockopt error");
+      kmyth_log(LOG_ERR, "setsockopt error (%s)", strerror(errno));
+      close(*socket_fd);
+      *socket_fd = -1;
+      freeaddrinfo(result);
       return 1;
     }
 
@@ -115,15 +293,215 @@ int setup_server_socket(const char *service, int *socket_fd)
       break;
     }
     close(*socket_fd);
+    *socket_fd = -1;
   }
 
   // Cleanup address information and handle errors.
   freeaddrinfo(result);
-  if (rp == NULL)
+  return rp == NULL;
+}
+
+//
+// setup_server_socket()
+//
+int setup_server_socket(const char *service, const socket_options * opts,
+                        int *socket_fd)
+{
+  socket_options defaults;
+
+  if (opts == NULL)
+  {
+    socket_options_init(&defaults);
+    opts = &defaults;
+  }
+
+  if ((!opts->dual_stack
+       || bind_server_socket(service, AF_INET6, opts, socket_fd))
+      && bind_server_socket(service, AF_INET, opts, socket_fd))
   {
     kmyth_log(LOG_ERR, "Failed to establish bind socket.");
     return 1;
   }
 
+  // TCP_NODELAY and keepalive are inherited by accepted connections on
+  // some systems; the timeouts are left off so accept() keeps blocking.
+  socket_options listen_opts = *opts;
+
+  listen_opts.io_timeout_ms = 0;
+  if (apply_socket_options(*socket_fd, &listen_opts))
+  {
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// setup_unix_client_socket()
+//
+int setup_unix_client_socket(const char *path, int *socket_fd)
+{
+  struct sockaddr_un addr = { 0 };
+
+  *socket_fd = -1;
+  if (path == NULL || strlen(path) >= sizeof(addr.sun_path))
+  {
+    kmyth_log(LOG_ERR, "Invalid local socket path.");
+    return 1;
+  }
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  *socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (*socket_fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create local socket.");
+    return 1;
+  }
+
+  if (connect(*socket_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to connect to local socket %s.", path);
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// setup_unix_server_socket()
+//
+int setup_unix_server_socket(const char *path, mode_t mode, int *socket_fd)
+{
+  struct sockaddr_un addr = { 0 };
+
+  *socket_fd = -1;
+  if (path == NULL || strlen(path) >= sizeof(addr.sun_path))
+  {
+    kmyth_log(LOG_ERR, "Invalid local socket path.");
+    return 1;
+  }
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  // Only ever remove an existing socket, never some other kind of file.
+  struct stat st = { 0 };
+
+  if (lstat(path, &st) == 0)
+  {
+    if (!S_ISSOCK(st.st_mode))
+    {
+      kmyth_log(LOG_ERR, "%s exists and is not a socket.", path);
+      return 1;
+    }
+    unlink(path);
+  }
+
+  *socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (*socket_fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create local socket.");
+    return 1;
+  }
+
+  // Create the socket file without any group/other access, then relax the
+  // permissions to the requested mode once it exists.
+  mode_t old_mask = umask(0077);
+  int result = bind(*socket_fd, (struct sockaddr *) &addr, sizeof(addr));
+
+  umask(old_mask);
+  if (result == -1 || chmod(path, mode) == -1 || listen(*socket_fd, 16) == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to set up local socket %s.", path);
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// get_unix_peer_credentials()
+//
+int get_unix_peer_credentials(int socket_fd, uid_t * uid, pid_t * pid)
+{
+  struct ucred cred = { 0 };
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 ||
+      len != sizeof(cred))
+  {
+    kmyth_log(LOG_ERR, "Failed to get local socket peer credentials.");
+    return 1;
+  }
+
+  *uid = cred.uid;
+  *pid = cred.pid;
+  return 0;
+}
+
+//
+// socket_read_full()
+//
+int socket_read_full(int socket_fd, void *buf, size_t len)
+{
+  unsigned char *pos = (unsigned char *) buf;
+
+  while (len > 0)
+  {
+    ssize_t n = read(socket_fd, pos, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    pos += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+//
+// socket_writev_full()
+//
+int socket_writev_full(int socket_fd, struct iovec *iov, int iovcnt)
+{
+  while (iovcnt > 0)
+  {
+    ssize_t n = writev(socket_fd, iov, iovcnt);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+
+    // skip past what was written, which may end part way into a buffer
+    size_t written = (size_t) n;
+
+    while (iovcnt > 0 && written >= iov->iov_len)
+    {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (unsigned char *) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
   return 0;
 }
@@ -6,17 +6,30 @@
 
 #include "tls_util.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <kmip/kmip.h>
 #include <kmip/kmip_bio.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
 
+#include "cipher/aes_gcm.h"
 #include "defines.h"
+#include "kmyth_usdt.h"
+#include "file_io.h"
+#include "kmip_util.h"
 #include "memory_util.h"
+#include "metrics.h"
 
 // Check for supported OpenSSL version
 //   - OpenSSL v1.1.1 is a LTS version supported until 2023-09-11
@@ -30,488 +43,2792 @@ const char *PREFERRED_CIPHERS = "ECDHE-ECDSA-AES256-GCM-SHA384:"
   "ECDHE-RSA-AES256-GCM-SHA384:" "ECDHE-ECDSA-AES256-SHA384:"
   "ECDHE-RSA-AES256-SHA384";
 
+//############################################################################
+// TLS session cache
+//############################################################################
+
+// Sessions (and TLS 1.3 tickets) the key servers have handed out, by server
+// ("ip:port"), so a later connection to the same server can resume with an
+// abbreviated handshake instead of a full mutually authenticated one. The
+// cache is shared by every context in the process; a file can carry it from
+// one run of a tool to the next (see tls_save_session_cache()).
+typedef struct
+{
+  char server[TLS_SESSION_SERVER_LEN];
+  SSL_SESSION *session;
+} tls_session_entry;
+
+static tls_session_entry tls_sessions[KMYTH_TLS_SESSION_CACHE_SIZE];
+static size_t tls_session_victim = 0;
+static pthread_mutex_t tls_session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// index of the server name attached to each connection, for the callback
+// that stores the sessions it receives
+static int tls_server_index = -1;
+static pthread_once_t tls_server_index_once = PTHREAD_ONCE_INIT;
+
+// the (plaintext) cache file holds this, then one entry per server:
+// server length (2 bytes), server, session length (4 bytes), DER session
+static const unsigned char TLS_SESSION_FILE_MAGIC[4] = { 'K', 'T', 'S', '1' };
+
+static const char TLS_SESSION_KEY_LABEL[] = "kmyth TLS session cache";
+
+static void tls_server_free(void *parent, void *ptr, CRYPTO_EX_DATA * ad,
+                            int idx, long argl, void *argp)
+{
+  kmyth_free(ptr);
+}
+
+static void tls_server_index_init(void)
+{
+  tls_server_index = SSL_get_ex_new_index(0, NULL, NULL, NULL,
+                                          tls_server_free);
+}
+
+//############################################################################
+// tls_session_usable()
+//############################################################################
+static int tls_session_usable(const SSL_SESSION * session)
+{
+  return (SSL_SESSION_is_resumable(session) &&
+          SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) >
+          time(NULL));
+}
+
+//############################################################################
+// tls_session_store()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function caches a session for a server, replacing
+ * the one cached for it before (or, if the cache is full, each slot in
+ * turn).
+ * The cache takes over the caller's reference to the session.
+ * </pre>
+ */
+static void tls_session_store(const char *server, SSL_SESSION * session)
+{
+  pthread_mutex_lock(&tls_session_lock);
+
+  size_t slot = KMYTH_TLS_SESSION_CACHE_SIZE;
+
+  for (size_t i = 0; i < KMYTH_TLS_SESSION_CACHE_SIZE; i++)
+  {
+    if (tls_sessions[i].session != NULL &&
+        strcmp(tls_sessions[i].server, server) == 0)
+    {
+      slot = i;
+      break;
+    }
+    if (tls_sessions[i].session == NULL &&
+        slot == KMYTH_TLS_SESSION_CACHE_SIZE)
+    {
+      slot = i;
+    }
+  }
+  if (slot == KMYTH_TLS_SESSION_CACHE_SIZE)
+  {
+    slot = tls_session_victim;
+    tls_session_victim = (tls_session_victim + 1) %
+      KMYTH_TLS_SESSION_CACHE_SIZE;
+  }
+
+  SSL_SESSION_free(tls_sessions[slot].session);
+  snprintf(tls_sessions[slot].server, TLS_SESSION_SERVER_LEN, "%s", server);
+  tls_sessions[slot].session = session;
+
+  pthread_mutex_unlock(&tls_session_lock);
+}
+
+//############################################################################
+// tls_session_lookup()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function finds the session cached for a server,
+ * dropping it if it can no longer be resumed.
+ * </pre>
+ *
+ * @return the session (a reference the caller must free), or NULL
+ */
+static SSL_SESSION *tls_session_lookup(const char *server)
+{
+  SSL_SESSION *session = NULL;
+
+  pthread_mutex_lock(&tls_session_lock);
+  for (size_t i = 0; i < KMYTH_TLS_SESSION_CACHE_SIZE; i++)
+  {
+    if (tls_sessions[i].session == NULL ||
+        strcmp(tls_sessions[i].server, server) != 0)
+    {
+      continue;
+    }
+    if (tls_session_usable(tls_sessions[i].session))
+    {
+      session = tls_sessions[i].session;
+      SSL_SESSION_up_ref(session);
+    }
+    else
+    {
+      SSL_SESSION_free(tls_sessions[i].session);
+      tls_sessions[i].session = NULL;
+    }
+    break;
+  }
+  pthread_mutex_unlock(&tls_session_lock);
+
+  return session;
+}
+
+//############################################################################
+// tls_new_session_cb()
+//############################################################################
+/**
+ * <pre>
+ * OpenSSL calls this for each session (or TLS 1.3 ticket) a server hands
+ * out, during or after the handshake.
+ * </pre>
+ *
+ * @return 1 if the cache kept the session, 0 if not
+ */
+static int tls_new_session_cb(SSL * ssl, SSL_SESSION * session)
+{
+  const char *server = SSL_get_ex_data(ssl, tls_server_index);
+
+  if (server == NULL || !SSL_SESSION_is_resumable(session))
+  {
+    return 0;
+  }
+  tls_session_store(server, session);
+  return 1;
+}
+
+//############################################################################
+// tls_clear_session_cache()
+//############################################################################
+void tls_clear_session_cache(void)
+{
+  pthread_mutex_lock(&tls_session_lock);
+  for (size_t i = 0; i < KMYTH_TLS_SESSION_CACHE_SIZE; i++)
+  {
+    SSL_SESSION_free(tls_sessions[i].session);
+    tls_sessions[i].session = NULL;
+  }
+  tls_session_victim = 0;
+  pthread_mutex_unlock(&tls_session_lock);
+}
+
+//############################################################################
+// tls_derive_session_cache_key()
+//############################################################################
+int tls_derive_session_cache_key(unsigned char *client_private_key,
+                                 size_t client_private_key_len,
+                                 unsigned char *cache_key)
+{
+  if (client_private_key == NULL || client_private_key_len == 0 ||
+      client_private_key_len > INT_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid client private key ... exiting");
+    return 1;
+  }
+  if (cache_key == NULL)
+  {
+    kmyth_log(LOG_ERR, "no session cache key buffer ... exiting");
+    return 1;
+  }
+
+  unsigned int key_len = 0;
+
+  if (HMAC(EVP_sha256(), client_private_key, (int) client_private_key_len,
+           (const unsigned char *) TLS_SESSION_KEY_LABEL,
+           sizeof(TLS_SESSION_KEY_LABEL) - 1, cache_key, &key_len) == NULL ||
+      key_len != TLS_SESSION_CACHE_KEY_LEN)
+  {
+    kmyth_log(LOG_ERR, "error deriving session cache key: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+  return 0;
+}
+
+//############################################################################
+// tls_load_session_cache()
+//############################################################################
+int tls_load_session_cache(char *path, unsigned char *cache_key)
+{
+  if (path == NULL || cache_key == NULL)
+  {
+    kmyth_log(LOG_ERR, "no session cache path or key ... exiting");
+    return 1;
+  }
+
+  // nothing saved yet: the first connection does a full handshake
+  if (access(path, F_OK) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "no TLS session cache at %s", path);
+    return 0;
+  }
+
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  if (read_bytes_from_file(path, &sealed, &sealed_len))
+  {
+    kmyth_log(LOG_ERR, "error reading TLS session cache ... exiting");
+    return 1;
+  }
+
+  unsigned char *data = NULL;
+  size_t data_len = 0;
+
+  if (sealed == NULL ||
+      aes_gcm_decrypt(cache_key, TLS_SESSION_CACHE_KEY_LEN, sealed,
+                      sealed_len, &data, &data_len))
+  {
+    kmyth_log(LOG_ERR, "error decrypting TLS session cache ... exiting");
+    kmyth_free(sealed);
+    return 1;
+  }
+  kmyth_free(sealed);
+
+  if (data_len < sizeof(TLS_SESSION_FILE_MAGIC) ||
+      memcmp(data, TLS_SESSION_FILE_MAGIC, sizeof(TLS_SESSION_FILE_MAGIC)))
+  {
+    kmyth_log(LOG_ERR, "invalid TLS session cache ... exiting");
+    kmyth_clear_and_free(data, data_len);
+    return 1;
+  }
+
+  int retval = 0;
+  size_t pos = sizeof(TLS_SESSION_FILE_MAGIC);
+
+  while (pos < data_len)
+  {
+    if (data_len - pos < 2)
+    {
+      retval = 1;
+      break;
+    }
+
+    size_t server_len = ((size_t) data[pos] << 8) | data[pos + 1];
+
+    pos += 2;
+    if (server_len == 0 || server_len >= TLS_SESSION_SERVER_LEN ||
+        data_len - pos < server_len + 4)
+    {
+      retval = 1;
+      break;
+    }
+
+    char server[TLS_SESSION_SERVER_LEN];
+
+    memcpy(server, data + pos, server_len);
+    server[server_len] = '\0';
+    pos += server_len;
+
+    size_t der_len = ((size_t) data[pos] << 24) |
+      ((size_t) data[pos + 1] << 16) |
+      ((size_t) data[pos + 2] << 8) | data[pos + 3];
+
+    pos += 4;
+    if (der_len == 0 || der_len > LONG_MAX || data_len - pos < der_len)
+    {
+      retval = 1;
+      break;
+    }
+
+    const unsigned char *der = data + pos;
+    SSL_SESSION *session = d2i_SSL_SESSION(NULL, &der, (long) der_len);
+
+    pos += der_len;
+
+    // sessions that have expired since they were saved are left behind
+    if (session != NULL && tls_session_usable(session))
+    {
+      tls_session_store(server, session);
+    }
+    else
+    {
+      SSL_SESSION_free(session);
+    }
+  }
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "truncated TLS session cache entry ... exiting");
+  }
+  kmyth_clear_and_free(data, data_len);
+  return retval;
+}
+
+//############################################################################
+// tls_save_session_cache()
+//############################################################################
+int tls_save_session_cache(char *path, unsigned char *cache_key)
+{
+  if (path == NULL || cache_key == NULL)
+  {
+    kmyth_log(LOG_ERR, "no session cache path or key ... exiting");
+    return 1;
+  }
+
+  // size, then fill, the plaintext while holding the lock throughout
+  pthread_mutex_lock(&tls_session_lock);
+
+  size_t data_len = sizeof(TLS_SESSION_FILE_MAGIC);
+
+  for (size_t i = 0; i < KMYTH_TLS_SESSION_CACHE_SIZE; i++)
+  {
+    int der_len = 0;
+
+    if (tls_sessions[i].session != NULL &&
+        tls_session_usable(tls_sessions[i].session) &&
+        (der_len = i2d_SSL_SESSION(tls_sessions[i].session, NULL)) > 0)
+    {
+      data_len += 2 + strlen(tls_sessions[i].server) + 4 + (size_t) der_len;
+    }
+  }
+
+  unsigned char *data = kmyth_malloc(data_len);
+
+  if (data == NULL)
+  {
+    pthread_mutex_unlock(&tls_session_lock);
+    kmyth_log(LOG_ERR, "error allocating TLS session cache ... exiting");
+    return 1;
+  }
+
+  memcpy(data, TLS_SESSION_FILE_MAGIC, sizeof(TLS_SESSION_FILE_MAGIC));
+
+  size_t pos = sizeof(TLS_SESSION_FILE_MAGIC);
+
+  for (size_t i = 0; i < KMYTH_TLS_SESSION_CACHE_SIZE; i++)
+  {
+    int der_len = 0;
+
+    if (tls_sessions[i].session == NULL ||
+        !tls_session_usable(tls_sessions[i].session) ||
+        (der_len = i2d_SSL_SESSION(tls_sessions[i].session, NULL)) <= 0 ||
+        data_len - pos < 2 + strlen(tls_sessions[i].server) + 4 +
+        (size_t) der_len)
+    {
+      continue;
+    }
+
+    size_t server_len = strlen(tls_sessions[i].server);
+
+    data[pos++] = (unsigned char) (server_len >> 8);
+    data[pos++] = (unsigned char) server_len;
+    memcpy(data + pos, tls_sessions[i].server, server_len);
+    pos += server_len;
+    data[pos++] = (unsigned char) (der_len >> 24);
+    data[pos++] = (unsigned char) (der_len >> 16);
+    data[pos++] = (unsigned char) (der_len >> 8);
+    data[pos++] = (unsigned char) der_len;
+
+    unsigned char *der = data + pos;
+
+    pos += (size_t) i2d_SSL_SESSION(tls_sessions[i].session, &der);
+  }
+  pthread_mutex_unlock(&tls_session_lock);
+
+  // the sessions' master secrets are as sensitive as the keys they protect
+  unsigned char *sealed = NULL;
+  size_t sealed_len = 0;
+
+  if (aes_gcm_encrypt(cache_key, TLS_SESSION_CACHE_KEY_LEN, data, pos,
+                      &sealed, &sealed_len))
+  {
+    kmyth_log(LOG_ERR, "error encrypting TLS session cache ... exiting");
+    kmyth_clear_and_free(data, data_len);
+    return 1;
+  }
+  kmyth_clear_and_free(data, data_len);
+
+  int retval = write_bytes_to_file_atomic(path, sealed, sealed_len);
+
+  kmyth_free(sealed);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error writing TLS session cache ... exiting");
+  }
+  return retval;
+}
+
+//############################################################################
+// tls_new_conn_bio()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function creates an (unconnected) connect BIO for a
+ * server.
+ * </pre>
+ *
+ * @param[in]  server_ip   the IP address of the server
+ *
+ * @param[in]  server_port the port of the server
+ *
+ * @param[out] conn_bio    the connect BIO
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_new_conn_bio(char *server_ip, char *server_port,
+                            BIO ** conn_bio)
+{
+  if (server_ip == NULL)
+  {
+    kmyth_log(LOG_ERR, "no server IP ... exiting");
+    return 1;
+  }
+  if (server_port == NULL)
+  {
+    kmyth_log(LOG_ERR, "no server port ... exiting");
+    return 1;
+  }
+  if (conn_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no BIO structure variable ... exiting");
+    return 1;
+  }
+
+  *conn_bio = BIO_new(BIO_s_connect());
+  if (*conn_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "error getting new connect BIO: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+  if (BIO_set_conn_hostname(*conn_bio, server_ip) != 1)
+  {
+    kmyth_log(LOG_ERR, "error setting connection address: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+  if (BIO_set_conn_port(*conn_bio, server_port) != 1)
+  {
+    kmyth_log(LOG_ERR, "error setting connection port: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tls_push_ssl()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function puts a TLS (client) BIO, made with an
+ * already-established context, on top of a connect BIO: it sets the cipher
+ * list and offers the session cached for the server (if any) for
+ * resumption.
+ * </pre>
+ *
+ * @param[in]     ctx          the context to use
+ *
+ * @param[in]     server_ip    the IP address of the server
+ *
+ * @param[in]     server_port  the port of the server
+ *
+ * @param[in,out] bio          the connect BIO on input, the BIO chain (TLS
+ *                             BIO first) on success
+ *
+ * @return 0 on success, 1 on error (*bio is then unchanged)
+ */
+static int tls_push_ssl(SSL_CTX * ctx, char *server_ip, char *server_port,
+                        BIO ** bio)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "no SSL context ... exiting");
+    return 1;
+  }
+
+  BIO *ssl_bio = BIO_new_ssl(ctx, 1);
+
+  if (ssl_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "error getting new BIO chain: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  SSL *ssl;
+
+  if (BIO_get_ssl(ssl_bio, &ssl) <= 0)
+  {
+    kmyth_log(LOG_ERR, "error retrieving the BIO SSL pointer: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    BIO_free(ssl_bio);
+    return 1;
+  }
+
+  // set the list of ciphers available for negotiation with the server
+  if (SSL_set_cipher_list(ssl, PREFERRED_CIPHERS) != 1)
+  {
+    kmyth_log(LOG_ERR, "negotiate ciper list error: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    BIO_free(ssl_bio);
+    return 1;
+  }
+
+  // offer the session cached for this server, if any, for resumption
+  pthread_once(&tls_server_index_once, tls_server_index_init);
+
+  char *server = kmyth_malloc(TLS_SESSION_SERVER_LEN);
+
+  if (server != NULL)
+  {
+    snprintf(server, TLS_SESSION_SERVER_LEN, "%s:%s", server_ip, server_port);
+    if (SSL_set_ex_data(ssl, tls_server_index, server) != 1)
+    {
+      kmyth_free(server);
+      server = NULL;
+    }
+  }
+
+  SSL_SESSION *session = (server != NULL) ? tls_session_lookup(server) : NULL;
+
+  if (session != NULL)
+  {
+    if (SSL_set_session(ssl, session) != 1)
+    {
+      kmyth_log(LOG_DEBUG, "cached TLS session not usable: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+    }
+    SSL_SESSION_free(session);
+  }
+
+  *bio = BIO_push(ssl_bio, *bio);
+  return 0;
+}
+
+//############################################################################
+// tls_ctx_new_bio()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function sets up (but does not connect) a TLS BIO for
+ * a server, using an already-established context.
+ * </pre>
+ *
+ * @param[in]  server_ip   the IP address of the server
+ *
+ * @param[in]  server_port the port of the server
+ *
+ * @param[in]  ctx         the context to use
+ *
+ * @param[out] ssl_bio     the (unconnected) BIO structure for the connection
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_ctx_new_bio(char *server_ip, char *server_port,
+                           SSL_CTX * ctx, BIO ** ssl_bio)
+{
+  if (tls_new_conn_bio(server_ip, server_port, ssl_bio))
+  {
+    return 1;
+  }
+  return tls_push_ssl(ctx, server_ip, server_port, ssl_bio);
+}
+
 //############################################################################
 // tls_ctx_connect()
 //############################################################################
 /**
  * <pre>
- * This static helper function initiates a TLS connection using an
- * already-established context.
+ * This static helper function initiates a TLS connection using an
+ * already-established context.
+ * </pre>
+ *
+ * @param[in]  server_ip   the IP address of the server
+ *
+ * @param[in]  server_port the port of the server
+ *
+ * @param[in]  ctx         the context to use
+ *
+ * @param[out] ssl_bio     the BIO structure used to interface with the
+ *                         connection
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_ctx_connect(char *server_ip, char *server_port,
+                           SSL_CTX * ctx, BIO ** ssl_bio)
+{
+  if (tls_ctx_new_bio(server_ip, server_port, ctx, ssl_bio))
+  {
+    return 1;
+  }
+
+  SSL *ssl = NULL;
+
+  BIO_get_ssl(*ssl_bio, &ssl);
+
+  // verify server's X509 certificate
+  X509 *cert = SSL_get_peer_certificate(ssl);
+
+  if (cert)
+  {
+    if (SSL_get_verify_result(ssl) != X509_V_OK)
+    {
+      kmyth_log(LOG_ERR, "error verifying peer ... exiting: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+      return 1;
+    }
+    X509_free(cert);
+  }
+
+  // initiate IP socket connection with the server
+  uint64_t start_us = kmyth_metrics_now_us();
+
+  if (BIO_do_connect(*ssl_bio) <= 0)
+  {
+    kmyth_log(LOG_ERR, "TCP/IP socket connection error ... exiting");
+    kmyth_metrics_inc(KMYTH_METRIC_TLS_HANDSHAKE_ERRORS);
+    return 1;
+  }
+
+  // initiate SSL/TLS handshake with the server
+  if (BIO_do_handshake(*ssl_bio) <= 0)
+  {
+    kmyth_log(LOG_ERR, "TLS connection error ... exiting");
+    kmyth_metrics_inc(KMYTH_METRIC_TLS_HANDSHAKE_ERRORS);
+    return 1;
+  }
+  kmyth_metrics_observe_since(KMYTH_METRIC_TLS_HANDSHAKE_TIME, start_us);
+
+  int resumed = SSL_session_reused(ssl);
+
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_TLS_SESSION, resumed);
+  kmyth_log(LOG_DEBUG, "%s TLS session with %s:%s",
+            resumed ? "resumed" : "established new", server_ip, server_port);
+
+  return 0;
+}
+
+//############################################################################
+// create_tls_connection_impl()
+//############################################################################
+static int create_tls_connection_impl(char **server_ip,
+                                      unsigned char *client_private_key,
+                                      size_t client_private_key_len,
+                                      char *client_cert_path,
+                                      char *ca_cert_path,
+                                      BIO ** tls_bio, SSL_CTX ** tls_ctx)
+{
+  if (server_ip == NULL)
+  {
+    kmyth_log(LOG_ERR, "no server IP variable ... exiting");
+    return 1;
+  }
+  if (client_private_key == NULL || client_private_key_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no client private key ... exiting");
+    return 1;
+  }
+
+  if (client_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "no client cert path ... exiting");
+    return 1;
+  }
+
+  if (ca_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "no CA cert path ... exiting");
+    return 1;
+  }
+  if (tls_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no BIO structure variable ... exiting");
+    return 1;
+  }
+  if (tls_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "no SSL context variable ... exiting");
+    return 1;
+  }
+
+  if (tls_set_context
+      (client_private_key, client_private_key_len, client_cert_path,
+       ca_cert_path, tls_ctx) != 0)
+  {
+    kmyth_log(LOG_ERR, "error setting up TLS context ... exiting");
+    return 1;
+  }
+
+  // This splits the server ip_string into two, IP and trailing port portions
+  char *server_port = NULL;
+
+  server_port = strpbrk(*server_ip, ":");
+  if (server_port == NULL)
+  {
+    kmyth_log(LOG_ERR, "null port (%s) ... exiting", *server_ip);
+    return 1;
+  }
+  *server_port = '\0';
+  server_port++;
+
+  // Check the validity of the port string. Port 0 is technically valid.
+  if ((strncmp(server_port, "0\0", 2) != 0) && (atoi(server_port) == 0))
+  {
+    kmyth_log(LOG_ERR, "malformed IP string, invalid port ... exiting");
+    return 1;
+  }
+
+  if (tls_ctx_connect(*server_ip, server_port, *tls_ctx, tls_bio) != 0)
+  {
+    kmyth_log(LOG_ERR, "error connecting to server ... exiting");
+    return 1;
+  }
+  return 0;
+}
+
+//############################################################################
+// create_tls_connection()
+//############################################################################
+int create_tls_connection(char **server_ip,
+                          unsigned char *client_private_key,
+                          size_t client_private_key_len,
+                          char *client_cert_path, char *ca_cert_path,
+                          BIO ** tls_bio, SSL_CTX ** tls_ctx)
+{
+  kmyth_log_span span;
+
+  kmyth_log_span_begin(&span, "create_tls_connection");
+  KMYTH_PROBE1(tls_connect__entry, (server_ip != NULL) ? *server_ip : NULL);
+
+  int retval = create_tls_connection_impl(server_ip,
+                                          client_private_key,
+                                          client_private_key_len,
+                                          client_cert_path, ca_cert_path,
+                                          tls_bio, tls_ctx);
+
+  KMYTH_PROBE1(tls_connect__return, retval);
+  kmyth_log_span_end(&span, retval);
+  return retval;
+}
+
+//############################################################################
+// tls_new_context()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function creates a client TLS context with everything
+ * but the client's private key: the client certificate, the pinned CA
+ * certificate and the session cache.
+ * </pre>
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_new_context(char *client_cert_path, char *ca_cert_path,
+                           SSL_CTX ** ctx)
+{
+  /*
+   * This does necessary OpenSSL setup stuff. The version checking is
+   * a stub for later automatic building against 1.1.1 (current LTS
+   * version) or newer. Other versions just error out.
+   */
+  if (OPENSSL_init_ssl(0, NULL) == 0)
+  {
+    kmyth_log(LOG_ERR, "error initializing OpenSSL: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  const SSL_METHOD *ssl_method = TLS_client_method();
+
+  if (ssl_method == NULL)
+  {
+    kmyth_log(LOG_ERR, "error getting TLS method: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  *ctx = SSL_CTX_new(ssl_method);
+  if (*ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "error creating new SSL context: %s",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  /*
+   * This specifies the client certificate (which we assume is PEM formatted)
+   * used for client authentication within the TLS connection.
+   */
+  if (SSL_CTX_use_certificate_file(*ctx, client_cert_path, SSL_FILETYPE_PEM) !=
+      1)
+  {
+    kmyth_log(LOG_ERR, "SSL_CTX_use_certificate_file: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  /* pin CA certificate for client verification of server certificate */
+  if (SSL_CTX_load_verify_locations(*ctx, ca_cert_path, NULL) != 1)
+  {
+    kmyth_log(LOG_ERR, "trust store load error: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+  SSL_CTX_set_verify(*ctx, SSL_VERIFY_PEER, NULL);
+  SSL_CTX_set_verify_depth(*ctx, 1);
+
+  /*
+   * Sessions go to the process-wide cache (see tls_new_session_cb()) rather
+   * than this context's own, so they outlive it.
+   */
+  SSL_CTX_set_session_cache_mode(*ctx, SSL_SESS_CACHE_CLIENT |
+                                 SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(*ctx, tls_new_session_cb);
+
+  return 0;
+}
+
+//############################################################################
+// tls_context_use_key()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function gives a context from tls_new_context() the
+ * client's private key (PEM), checking that it matches the certificate.
+ * Connections made with the context from then on use it.
+ * </pre>
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_context_use_key(SSL_CTX * ctx,
+                               unsigned char *client_private_key,
+                               size_t client_private_key_len)
+{
+  if (client_private_key_len > INT_MAX)
+  {
+    kmyth_log(LOG_ERR, "client private key length (%lu bytes) "
+              "exceeds maximum (%d bytes) ... exiting",
+              client_private_key_len, INT_MAX);
+    return 1;
+  }
+
+  /*
+   * To negotiate the TLS connection we'll need a memory BIO to store
+   * the private key, and an EVP_PKEY structure to hold the private key
+   * object.
+   */
+
+  /*
+   * This creates the memory BIO and populates it with the client private
+   * key data.
+   */
+  BIO *private_key_mem =
+    BIO_new_mem_buf(client_private_key, (int) client_private_key_len);
+  if (private_key_mem == NULL)
+  {
+    kmyth_log(LOG_ERR, "create private key BIO error: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
+      kmyth_log(LOG_ERR, "error clearing client private key BIO");
+    BIO_free_all(private_key_mem);
+    return 1;
+  }
+
+  /*
+   * This creates the EVP_PKEY structure from the raw private key data.
+   */
+  EVP_PKEY *private_key_evp =
+    PEM_read_bio_PrivateKey(private_key_mem, NULL, 0, NULL);
+  if (private_key_evp == NULL)
+  {
+    kmyth_log(LOG_ERR, "create private key error: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
+      kmyth_log(LOG_ERR, "error clearing client private key BIO");
+    BIO_free_all(private_key_mem);
+    return 1;
+  }
+
+  /*
+   * Done with client private key BIO, so clean it up - BIO_reset clears data
+   */
+  if (BIO_reset(private_key_mem) != 1)
+    kmyth_log(LOG_ERR, "error clearing client private key BIO");
+  BIO_free_all(private_key_mem);
+
+  if (SSL_CTX_use_PrivateKey(ctx, private_key_evp) != 1)
+  {
+    kmyth_log(LOG_ERR, "SSL_CTX_use_PrivateKey: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    EVP_PKEY_free(private_key_evp);
+    return 1;
+  }
+
+  /*
+   * EVP_PKEY_free does not provide a useful return value, so we ignore it.
+   * EVP_PKEY_free clears memory before freeing it. 
+   */
+  EVP_PKEY_free(private_key_evp);
+
+  if (SSL_CTX_check_private_key(ctx) != 1)
+  {
+    kmyth_log(LOG_ERR, "private key / cert mismatch ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// Deferred client key
+//############################################################################
+
+struct tls_deferred_key
+{
+  pthread_mutex_t lock;
+  int pipe_fds[2];              // readable once the key is set (or failed)
+  int state;                    // -1 pending, 0 set, 1 failed
+  unsigned char *key;
+  size_t key_len;
+};
+
+//############################################################################
+// tls_deferred_key_new()
+//############################################################################
+tls_deferred_key *tls_deferred_key_new(void)
+{
+  tls_deferred_key *dk = kmyth_calloc(1, sizeof(tls_deferred_key));
+
+  if (dk == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating deferred key ... exiting");
+    return NULL;
+  }
+  if (pipe(dk->pipe_fds))
+  {
+    kmyth_log(LOG_ERR, "error creating deferred key pipe ... exiting");
+    kmyth_free(dk);
+    return NULL;
+  }
+  pthread_mutex_init(&dk->lock, NULL);
+  dk->state = -1;
+  return dk;
+}
+
+//############################################################################
+// tls_deferred_key_set()
+//############################################################################
+void tls_deferred_key_set(tls_deferred_key * dk,
+                          unsigned char *client_private_key,
+                          size_t client_private_key_len)
+{
+  pthread_mutex_lock(&dk->lock);
+  if (dk->state == -1)
+  {
+    dk->state = 1;
+    if (client_private_key != NULL && client_private_key_len > 0)
+    {
+      dk->key = kmyth_malloc(client_private_key_len);
+      if (dk->key != NULL)
+      {
+        memcpy(dk->key, client_private_key, client_private_key_len);
+        dk->key_len = client_private_key_len;
+        dk->state = 0;
+      }
+    }
+
+    // wake a connection waiting for the key
+    while (write(dk->pipe_fds[1], "k", 1) == -1 && errno == EINTR)
+    {
+    }
+  }
+  pthread_mutex_unlock(&dk->lock);
+}
+
+//############################################################################
+// tls_deferred_key_free()
+//############################################################################
+void tls_deferred_key_free(tls_deferred_key * dk)
+{
+  if (dk == NULL)
+  {
+    return;
+  }
+  kmyth_clear_and_free(dk->key, dk->key_len);
+  close(dk->pipe_fds[0]);
+  close(dk->pipe_fds[1]);
+  pthread_mutex_destroy(&dk->lock);
+  kmyth_free(dk);
+}
+
+//############################################################################
+// tls_deferred_key_use()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function gives a context from tls_new_context() the
+ * deferred key, if it has been set.
+ * </pre>
+ *
+ * @return 0 if the context now has the key, -1 if the key is still to
+ *         come, 1 if it won't come (or is unusable)
+ */
+static int tls_deferred_key_use(tls_deferred_key * dk, SSL_CTX * ctx)
+{
+  pthread_mutex_lock(&dk->lock);
+
+  int state = dk->state;
+
+  if (state == 0 && tls_context_use_key(ctx, dk->key, dk->key_len))
+  {
+    state = 1;
+  }
+  pthread_mutex_unlock(&dk->lock);
+  return state;
+}
+
+//############################################################################
+// TLS connection race
+//############################################################################
+
+// One server's connection attempt in create_tls_connection_race()
+typedef struct
+{
+  char ip[TLS_SESSION_SERVER_LEN];
+  char *port;
+  BIO *bio;                     // connect BIO, then TLS BIO on top of it
+  bool connected;               // TCP connection established
+  bool tls;                     // TLS BIO pushed (handshake under way)
+  short events;
+  uint64_t start_us;
+} tls_race_attempt;
+
+//############################################################################
+// tls_race_start()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function starts a non-blocking connection attempt to
+ * a server ("ip:port").
+ * </pre>
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_race_start(tls_race_attempt * attempt, const char *server)
+{
+  snprintf(attempt->ip, sizeof(attempt->ip), "%s", server);
+
+  // as for create_tls_connection(), the port follows the first ':'
+  attempt->port = strpbrk(attempt->ip, ":");
+  if (attempt->port == NULL)
+  {
+    kmyth_log(LOG_ERR, "null port (%s) ... skipping it", server);
+    return 1;
+  }
+  *attempt->port++ = '\0';
+  if ((strncmp(attempt->port, "0\0", 2) != 0) && (atoi(attempt->port) == 0))
+  {
+    kmyth_log(LOG_ERR, "malformed IP string (%s) ... skipping it", server);
+    return 1;
+  }
+
+  if (tls_new_conn_bio(attempt->ip, attempt->port, &attempt->bio))
+  {
+    BIO_free_all(attempt->bio);
+    attempt->bio = NULL;
+    return 1;
+  }
+
+  BIO_set_nbio(attempt->bio, 1);
+  kmyth_log(LOG_DEBUG, "connecting to %s", server);
+  return 0;
+}
+
+//############################################################################
+// tls_race_step()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function moves a connection attempt (TCP connect,
+ * then, once the client's key is available, the mutually authenticated
+ * TLS handshake) along as far as it can go without waiting. An attempt
+ * that fails is closed.
+ * </pre>
+ *
+ * @return 0 if the attempt has connected, -1 if it is waiting (for its
+ *         socket, for the events in attempt->events, or, connected but not
+ *         yet started on TLS, for the key), 1 if it failed
+ */
+static int tls_race_step(tls_race_attempt * attempt, SSL_CTX * ctx,
+                         bool key_ready)
+{
+  int fd = -1;
+
+  if (!attempt->connected)
+  {
+    if (BIO_do_connect(attempt->bio) <= 0)
+    {
+      if (BIO_should_retry(attempt->bio)
+          && BIO_get_fd(attempt->bio, &fd) > 0 && fd >= 0)
+      {
+        attempt->events = POLLOUT;
+        return -1;
+      }
+      goto fail;
+    }
+    attempt->connected = true;
+  }
+
+  if (!attempt->tls)
+  {
+    if (!key_ready)
+    {
+      return -1;
+    }
+    if (tls_push_ssl(ctx, attempt->ip, attempt->port, &attempt->bio))
+    {
+      goto fail;
+    }
+    attempt->tls = true;
+    attempt->start_us = kmyth_metrics_now_us();
+  }
+
+  if (BIO_do_handshake(attempt->bio) > 0)
+  {
+    return 0;
+  }
+  if (BIO_should_retry(attempt->bio) && BIO_get_fd(attempt->bio, &fd) > 0
+      && fd >= 0)
+  {
+    attempt->events = BIO_should_read(attempt->bio) ? POLLIN : POLLOUT;
+    return -1;
+  }
+
+fail:
+  kmyth_log(LOG_WARNING, "error connecting to %s:%s: %s", attempt->ip,
+            attempt->port, ERR_error_string(ERR_get_error(), NULL));
+  kmyth_metrics_inc(KMYTH_METRIC_TLS_HANDSHAKE_ERRORS);
+  BIO_free_all(attempt->bio);
+  attempt->bio = NULL;
+  return 1;
+}
+
+//############################################################################
+// tls_race_handshake_done()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function records a completed handshake (its time, and
+ * whether the session was resumed).
+ * </pre>
+ */
+static void tls_race_handshake_done(tls_race_attempt * attempt)
+{
+  kmyth_metrics_observe_since(KMYTH_METRIC_TLS_HANDSHAKE_TIME,
+                              attempt->start_us);
+
+  SSL *ssl = NULL;
+  int resumed = (BIO_get_ssl(attempt->bio, &ssl) > 0)
+    && SSL_session_reused(ssl);
+
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_TLS_SESSION, resumed);
+  kmyth_log(LOG_DEBUG, "%s TLS session with %s:%s",
+            resumed ? "resumed" : "established new", attempt->ip,
+            attempt->port);
+}
+
+//############################################################################
+// tls_race_won()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function readies the winning attempt's connection for
+ * use: its socket goes back to blocking mode, like any other connection
+ * from create_tls_connection().
+ * </pre>
+ */
+static void tls_race_won(tls_race_attempt * attempt)
+{
+  int fd = -1;
+
+  if (BIO_get_fd(attempt->bio, &fd) > 0 && fd >= 0)
+  {
+    BIO_socket_nbio(fd, 0);
+  }
+  BIO_set_nbio(BIO_next(attempt->bio), 0);
+
+  tls_race_handshake_done(attempt);
+}
+
+//############################################################################
+// create_tls_connection_race_impl()
+//############################################################################
+static int create_tls_connection_race_impl(char **servers,
+                                           size_t server_count,
+                                           tls_deferred_key * client_key,
+                                           char *client_cert_path,
+                                           char *ca_cert_path,
+                                           unsigned int stagger_ms,
+                                           BIO ** tls_bio, SSL_CTX ** tls_ctx,
+                                           size_t *winner)
+{
+  if (servers == NULL || server_count == 0)
+  {
+    kmyth_log(LOG_ERR, "no servers ... exiting");
+    return 1;
+  }
+  if (client_key == NULL)
+  {
+    kmyth_log(LOG_ERR, "no client private key ... exiting");
+    return 1;
+  }
+  if (client_cert_path == NULL || ca_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "no client or CA cert path ... exiting");
+    return 1;
+  }
+  if (tls_bio == NULL || tls_ctx == NULL || winner == NULL)
+  {
+    kmyth_log(LOG_ERR, "no BIO, SSL context or winner variable ... exiting");
+    return 1;
+  }
+
+  // everything but the key can be loaded while it is still to come
+  if (tls_new_context(client_cert_path, ca_cert_path, tls_ctx) != 0)
+  {
+    kmyth_log(LOG_ERR, "error setting up TLS context ... exiting");
+    return 1;
+  }
+
+  tls_race_attempt *attempts =
+    kmyth_calloc(server_count, sizeof(tls_race_attempt));
+  struct pollfd *pfds = kmyth_calloc(server_count + 1, sizeof(struct pollfd));
+  size_t *polled = kmyth_calloc(server_count + 1, sizeof(size_t));
+
+  if (attempts == NULL || pfds == NULL || polled == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating connection attempts ... exiting");
+    kmyth_free(attempts);
+    kmyth_free(pfds);
+    kmyth_free(polled);
+    return 1;
+  }
+
+  uint64_t deadline_us = kmyth_metrics_now_us()
+    + (uint64_t) KMYTH_TLS_CONNECT_TIMEOUT_MS * 1000;
+  uint64_t next_start_us = 0;
+  size_t next = 0;
+  size_t running = 0;
+  size_t waiting = 0;
+  size_t won = server_count;
+  int key_state = -1;
+
+  while (won == server_count)
+  {
+    uint64_t now_us = kmyth_metrics_now_us();
+
+    if (key_state == -1)
+    {
+      key_state = tls_deferred_key_use(client_key, *tls_ctx);
+      if (key_state == 1)
+      {
+        kmyth_log(LOG_ERR, "no usable client private key ... exiting");
+        break;
+      }
+      if (key_state == 0)
+      {
+        // the handshakes start now, so the clock does too (and those of
+        // servers that were waiting for the key get their turn first)
+        deadline_us = now_us + (uint64_t) KMYTH_TLS_CONNECT_TIMEOUT_MS * 1000;
+        if (waiting > 0)
+        {
+          next_start_us = now_us + (uint64_t) stagger_ms * 1000;
+        }
+        for (size_t i = 0; i < next && won == server_count; i++)
+        {
+          if (attempts[i].bio != NULL && attempts[i].connected)
+          {
+            int step = tls_race_step(&attempts[i], *tls_ctx, true);
+
+            won = (step == 0) ? i : won;
+            running -= (step >= 0);
+            next_start_us = (step > 0) ? now_us : next_start_us;
+          }
+        }
+        waiting = 0;
+        continue;
+      }
+    }
+
+    if (key_state == 0 && now_us >= deadline_us)
+    {
+      kmyth_log(LOG_ERR, "timed out connecting to the servers ... exiting");
+      break;
+    }
+
+    // start the next server's attempt once its turn comes (an attempt
+    // failing brings the next one's turn forward); while the key is still
+    // to come, a server that has accepted the connection will do
+    if (next < server_count && now_us >= next_start_us && waiting == 0)
+    {
+      size_t i = next++;
+      int step = 1;
+
+      if (tls_race_start(&attempts[i], servers[i]) == 0)
+      {
+        step = tls_race_step(&attempts[i], *tls_ctx, key_state == 0);
+      }
+      won = (step == 0) ? i : won;
+      running += (step < 0);
+      waiting += (step < 0 && attempts[i].connected && !attempts[i].tls);
+      next_start_us = (step > 0) ? now_us
+        : now_us + (uint64_t) stagger_ms * 1000;
+      continue;
+    }
+    if (running == 0 && next == server_count)
+    {
+      kmyth_log(LOG_ERR, "could not connect to any server ... exiting");
+      break;
+    }
+
+    size_t npfds = 0;
+
+    for (size_t i = 0; i < next; i++)
+    {
+      if (attempts[i].bio != NULL && !(attempts[i].connected
+                                       && !attempts[i].tls))
+      {
+        int fd = -1;
+
+        BIO_get_fd(attempts[i].bio, &fd);
+        pfds[npfds].fd = fd;
+        pfds[npfds].events = attempts[i].events;
+        pfds[npfds].revents = 0;
+        polled[npfds++] = i;
+      }
+    }
+    if (key_state == -1)
+    {
+      pfds[npfds].fd = client_key->pipe_fds[0];
+      pfds[npfds].events = POLLIN;
+      pfds[npfds].revents = 0;
+      polled[npfds++] = server_count;
+    }
+
+    uint64_t wake_us = (key_state == 0) ? deadline_us : UINT64_MAX;
+
+    if (next < server_count && waiting == 0 && next_start_us < wake_us)
+    {
+      wake_us = next_start_us;
+    }
+
+    int timeout_ms = -1;
+
+    if (wake_us != UINT64_MAX)
+    {
+      timeout_ms = (wake_us > now_us)
+        ? (int) ((wake_us - now_us + 999) / 1000) : 0;
+    }
+
+    int ready = poll(pfds, (nfds_t) npfds, timeout_ms);
+
+    if (ready < 0 && errno != EINTR)
+    {
+      kmyth_log(LOG_ERR, "error waiting for the servers ... exiting");
+      break;
+    }
+
+    for (size_t j = 0; j < npfds && ready > 0 && won == server_count; j++)
+    {
+      if (pfds[j].revents == 0 || polled[j] == server_count)
+      {
+        continue;
+      }
+
+      tls_race_attempt *attempt = &attempts[polled[j]];
+      int step = tls_race_step(attempt, *tls_ctx, key_state == 0);
+
+      won = (step == 0) ? polled[j] : won;
+      running -= (step >= 0);
+      waiting += (step < 0 && attempt->connected && !attempt->tls);
+      next_start_us = (step > 0) ? now_us : next_start_us;
+    }
+  }
+
+  // the first server to answer (and be authenticated) wins; the rest of
+  // the attempts are abandoned
+  for (size_t i = 0; i < next; i++)
+  {
+    if (i != won && attempts[i].bio != NULL)
+    {
+      BIO_free_all(attempts[i].bio);
+    }
+  }
+
+  int retval = 1;
+
+  if (won < server_count)
+  {
+    tls_race_won(&attempts[won]);
+    *tls_bio = attempts[won].bio;
+    *winner = won;
+    retval = 0;
+  }
+
+  kmyth_free(attempts);
+  kmyth_free(pfds);
+  kmyth_free(polled);
+  return retval;
+}
+
+//############################################################################
+// create_tls_connection_race()
+//############################################################################
+int create_tls_connection_race(char **servers, size_t server_count,
+                               unsigned char *client_private_key,
+                               size_t client_private_key_len,
+                               char *client_cert_path, char *ca_cert_path,
+                               unsigned int stagger_ms,
+                               BIO ** tls_bio, SSL_CTX ** tls_ctx,
+                               size_t *winner)
+{
+  if (client_private_key == NULL || client_private_key_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no client private key ... exiting");
+    return 1;
+  }
+
+  tls_deferred_key *client_key = tls_deferred_key_new();
+
+  if (client_key == NULL)
+  {
+    return 1;
+  }
+  tls_deferred_key_set(client_key, client_private_key,
+                       client_private_key_len);
+
+  int retval = create_tls_connection_race_deferred(servers, server_count,
+                                                   client_key,
+                                                   client_cert_path,
+                                                   ca_cert_path, stagger_ms,
+                                                   tls_bio, tls_ctx, winner);
+
+  tls_deferred_key_free(client_key);
+  return retval;
+}
+
+//############################################################################
+// create_tls_connection_race_deferred()
+//############################################################################
+int create_tls_connection_race_deferred(char **servers, size_t server_count,
+                                        tls_deferred_key * client_key,
+                                        char *client_cert_path,
+                                        char *ca_cert_path,
+                                        unsigned int stagger_ms,
+                                        BIO ** tls_bio, SSL_CTX ** tls_ctx,
+                                        size_t *winner)
+{
+  kmyth_log_span span;
+
+  kmyth_log_span_begin(&span, "create_tls_connection_race");
+  KMYTH_PROBE1(tls_connect__entry,
+               (servers != NULL && server_count > 0) ? servers[0] : NULL);
+
+  int retval = create_tls_connection_race_impl(servers, server_count,
+                                               client_key,
+                                               client_cert_path,
+                                               ca_cert_path, stagger_ms,
+                                               tls_bio, tls_ctx, winner);
+
+  KMYTH_PROBE1(tls_connect__return, retval);
+  kmyth_log_span_end(&span, retval);
+  return retval;
+}
+
+//############################################################################
+// tls_cleanup()
+//############################################################################
+int tls_cleanup(void)
+{
+  tls_clear_session_cache();
+
+  // OpenSSL 1.1.0 and later release their global state at exit on their
+  // own; unloading it here would pull it from under other threads still
+  // using TLS, so only older versions need (and get) the explicit cleanup
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  CONF_modules_unload(1);
+  ERR_free_strings();
+  EVP_cleanup();
+  CRYPTO_cleanup_all_ex_data();
+  SSL_COMP_free_compression_methods();
+#endif
+  return 0;
+}
+
+//############################################################################
+// tls_set_context()
+//############################################################################
+int tls_set_context(unsigned char *client_private_key,
+                    size_t client_private_key_len,
+                    char *client_cert_path, char *ca_cert_path, SSL_CTX ** ctx)
+{
+  if (client_private_key == NULL || client_private_key_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no client private key ... exiting");
+    return 1;
+  }
+
+  if (client_private_key_len > INT_MAX)
+  {
+    kmyth_log(LOG_ERR, "client private key length (%lu bytes) "
+              "exceeds maximum (%d bytes) ... exiting",
+              client_private_key_len, INT_MAX);
+    return 1;
+  }
+
+  if (client_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "no client cert path ... exiting");
+    return 1;
+  }
+
+  if (ca_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "no CA cert path ... exiting");
+    return 1;
+  }
+
+  if (tls_new_context(client_cert_path, ca_cert_path, ctx))
+  {
+    return 1;
+  }
+  return tls_context_use_key(*ctx, client_private_key, client_private_key_len);
+}
+
+//############################################################################
+// Connection pool
+//############################################################################
+
+// A pooled connection, or (with bio NULL) a free slot. A slot that is
+// in_use with bio NULL is held by a caller that is still connecting.
+typedef struct
+{
+  char server[TLS_SESSION_SERVER_LEN];
+  unsigned char identity[SHA256_DIGEST_LENGTH];
+  SSL_CTX *ctx;
+  BIO *bio;
+  time_t last_used;
+  bool in_use;
+} tls_pool_conn;
+
+struct tls_conn_pool
+{
+  pthread_mutex_t lock;
+  size_t max_conns;
+  unsigned int idle_timeout;
+  tls_pool_conn *conns;
+};
+
+//############################################################################
+// tls_pool_identity()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function digests the client identity a connection is
+ * made with (private key, certificate and trusted CA), so connections are
+ * only ever handed to callers presenting the same identity.
+ * </pre>
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_pool_identity(unsigned char *client_private_key,
+                             size_t client_private_key_len,
+                             char *client_cert_path, char *ca_cert_path,
+                             unsigned char *identity)
+{
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+  int retval = 1;
+
+  if (md_ctx != NULL &&
+      EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) == 1 &&
+      EVP_DigestUpdate(md_ctx, client_cert_path,
+                       strlen(client_cert_path) + 1) == 1 &&
+      EVP_DigestUpdate(md_ctx, ca_cert_path, strlen(ca_cert_path) + 1) == 1 &&
+      EVP_DigestUpdate(md_ctx, client_private_key,
+                       client_private_key_len) == 1 &&
+      EVP_DigestFinal_ex(md_ctx, identity, NULL) == 1)
+  {
+    retval = 0;
+  }
+  EVP_MD_CTX_free(md_ctx);
+  return retval;
+}
+
+//############################################################################
+// tls_pool_conn_healthy()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function checks that an idle connection can still
+ * carry a request: the server hasn't closed it, and nothing is waiting to
+ * be read (an idle connection has no reason to be readable, so that means
+ * an alert, a close or stray data).
+ * </pre>
+ */
+static bool tls_pool_conn_healthy(BIO * bio)
+{
+  SSL *ssl = NULL;
+
+  if (BIO_get_ssl(bio, &ssl) <= 0 || ssl == NULL ||
+      (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN) || SSL_pending(ssl) > 0)
+  {
+    return false;
+  }
+
+  struct pollfd pfd = {.fd = SSL_get_fd(ssl),.events = POLLIN };
+
+  return (pfd.fd >= 0 && poll(&pfd, 1, 0) == 0);
+}
+
+//############################################################################
+// tls_pool_conn_close()
+//############################################################################
+static void tls_pool_conn_close(tls_pool_conn * conn)
+{
+  if (conn->bio != NULL)
+  {
+    BIO_ssl_shutdown(conn->bio);
+    BIO_free_all(conn->bio);
+  }
+  SSL_CTX_free(conn->ctx);
+  conn->bio = NULL;
+  conn->ctx = NULL;
+  conn->in_use = false;
+}
+
+//############################################################################
+// tls_conn_pool_new()
+//############################################################################
+tls_conn_pool *tls_conn_pool_new(size_t max_conns, unsigned int idle_timeout)
+{
+  if (max_conns == 0)
+  {
+    kmyth_log(LOG_ERR, "connection pool must allow a connection ... exiting");
+    return NULL;
+  }
+
+  tls_conn_pool *pool = kmyth_calloc(1, sizeof(tls_conn_pool));
+
+  if (pool == NULL || (pool->conns = kmyth_calloc(max_conns,
+                                                  sizeof(tls_pool_conn))) ==
+      NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating connection pool ... exiting");
+    kmyth_free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->max_conns = max_conns;
+  pool->idle_timeout = idle_timeout;
+  return pool;
+}
+
+//############################################################################
+// tls_conn_pool_free()
+//############################################################################
+void tls_conn_pool_free(tls_conn_pool * pool)
+{
+  if (pool == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; i < pool->max_conns; i++)
+  {
+    tls_pool_conn_close(&pool->conns[i]);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  kmyth_free(pool->conns);
+  kmyth_free(pool);
+}
+
+//############################################################################
+// tls_conn_pool_get()
+//############################################################################
+int tls_conn_pool_get(tls_conn_pool * pool, char *server,
+                      unsigned char *client_private_key,
+                      size_t client_private_key_len,
+                      char *client_cert_path, char *ca_cert_path,
+                      BIO ** tls_bio)
+{
+  if (pool == NULL || server == NULL || tls_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no pool, server or BIO variable ... exiting");
+    return 1;
+  }
+  if (client_private_key == NULL || client_private_key_len == 0 ||
+      client_cert_path == NULL || ca_cert_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "incomplete client identity ... exiting");
+    return 1;
+  }
+
+  // split a copy of "ip:port" (the caller's string is left as it is)
+  char server_ip[TLS_SESSION_SERVER_LEN];
+  char *server_port = NULL;
+
+  if (strlen(server) >= sizeof(server_ip) ||
+      (server_port = strrchr(strcpy(server_ip, server), ':')) == NULL)
+  {
+    kmyth_log(LOG_ERR, "malformed server address (%s) ... exiting", server);
+    return 1;
+  }
+  *server_port++ = '\0';
+
+  unsigned char identity[SHA256_DIGEST_LENGTH];
+
+  if (tls_pool_identity(client_private_key, client_private_key_len,
+                        client_cert_path, ca_cert_path, identity))
+  {
+    kmyth_log(LOG_ERR, "error digesting client identity ... exiting");
+    return 1;
+  }
+
+  time_t now = time(NULL);
+  tls_pool_conn *slot = NULL;
+  SSL_CTX *ctx = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  for (size_t i = 0; i < pool->max_conns; i++)
+  {
+    tls_pool_conn *conn = &pool->conns[i];
+
+    if (conn->in_use || conn->bio == NULL)
+    {
+      continue;
+    }
+
+    // drop connections that have idled too long, or gone bad while idle
+    if ((pool->idle_timeout > 0 &&
+         now - conn->last_used > (time_t) pool->idle_timeout) ||
+        !tls_pool_conn_healthy(conn->bio))
+    {
+      tls_pool_conn_close(conn);
+      continue;
+    }
+
+    if (slot == NULL && strcmp(conn->server, server) == 0 &&
+        memcmp(conn->identity, identity, sizeof(identity)) == 0)
+    {
+      conn->in_use = true;
+      slot = conn;
+    }
+  }
+
+  if (slot != NULL)
+  {
+    pthread_mutex_unlock(&pool->lock);
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_TLS_CONNECTION, 1);
+    *tls_bio = slot->bio;
+    return 0;
+  }
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_TLS_CONNECTION, 0);
+
+  // no warm connection: take a free slot (or else the idle connection used
+  // longest ago), and reuse the context of one with the same identity
+  for (size_t i = 0; i < pool->max_conns; i++)
+  {
+    tls_pool_conn *conn = &pool->conns[i];
+
+    if (ctx == NULL && conn->ctx != NULL &&
+        memcmp(conn->identity, identity, sizeof(identity)) == 0)
+    {
+      ctx = conn->ctx;
+      SSL_CTX_up_ref(ctx);
+    }
+    if (conn->in_use)
+    {
+      continue;
+    }
+    if (conn->bio == NULL)
+    {
+      if (slot == NULL || slot->bio != NULL)
+      {
+        slot = conn;
+      }
+    }
+    else if (slot == NULL ||
+             (slot->bio != NULL && conn->last_used < slot->last_used))
+    {
+      slot = conn;
+    }
+  }
+  if (slot == NULL)
+  {
+    pthread_mutex_unlock(&pool->lock);
+    SSL_CTX_free(ctx);
+    kmyth_log(LOG_ERR, "all %zu pooled connections are in use ... exiting",
+              pool->max_conns);
+    return 1;
+  }
+  tls_pool_conn_close(slot);
+  slot->in_use = true;
+  pthread_mutex_unlock(&pool->lock);
+
+  // connect outside the lock, so other callers aren't held up
+  BIO *bio = NULL;
+
+  if ((ctx == NULL &&
+       tls_set_context(client_private_key, client_private_key_len,
+                       client_cert_path, ca_cert_path, &ctx)) ||
+      tls_ctx_connect(server_ip, server_port, ctx, &bio))
+  {
+    kmyth_log(LOG_ERR, "error connecting to %s ... exiting", server);
+    BIO_free_all(bio);
+    SSL_CTX_free(ctx);
+    pthread_mutex_lock(&pool->lock);
+    slot->in_use = false;
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  snprintf(slot->server, sizeof(slot->server), "%s", server);
+  memcpy(slot->identity, identity, sizeof(identity));
+  slot->ctx = ctx;
+  slot->bio = bio;
+  pthread_mutex_unlock(&pool->lock);
+
+  *tls_bio = bio;
+  return 0;
+}
+
+//############################################################################
+// tls_conn_pool_put()
+//############################################################################
+void tls_conn_pool_put(tls_conn_pool * pool, BIO * tls_bio, int reusable)
+{
+  if (pool == NULL || tls_bio == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  for (size_t i = 0; i < pool->max_conns; i++)
+  {
+    tls_pool_conn *conn = &pool->conns[i];
+
+    if (conn->bio != tls_bio || !conn->in_use)
+    {
+      continue;
+    }
+
+    // a connection left mid-exchange by a failed request can't be reused
+    if (reusable)
+    {
+      conn->in_use = false;
+      conn->last_used = time(NULL);
+    }
+    else
+    {
+      tls_pool_conn_close(conn);
+    }
+    break;
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+//############################################################################
+// wait_for_bio()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function waits until a BIO has data to read, or until
+ * a deadline passes. A BIO without a socket under it (e.g., a memory BIO)
+ * is ready until the deadline.
+ * </pre>
+ *
+ * @return 0 if there is data to read, 1 on timeout or error
+ */
+static int wait_for_bio(BIO * bio, uint64_t deadline_us)
+{
+  int fd = -1;
+
+  while (1)
+  {
+    uint64_t now_us = kmyth_metrics_now_us();
+
+    if (now_us >= deadline_us)
+    {
+      kmyth_log(LOG_ERR, "timed out waiting for the server ... exiting");
+      return 1;
+    }
+    if (BIO_pending(bio) > 0 || BIO_get_fd(bio, &fd) <= 0 || fd < 0)
+    {
+      return 0;
+    }
+
+    struct pollfd pfd = {.fd = fd,.events = POLLIN };
+    int ready = poll(&pfd, 1, (int) ((deadline_us - now_us + 999) / 1000));
+
+    if (ready > 0)
+    {
+      return 0;
+    }
+    if (ready < 0 && errno != EINTR)
+    {
+      kmyth_log(LOG_ERR, "error waiting for the server ... exiting");
+      return 1;
+    }
+  }
+}
+
+//############################################################################
+// read_bio_some()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function reads whatever a BIO has (at most len bytes),
+ * waiting (until a deadline) for it if there is nothing yet.
  * </pre>
  *
- * @param[in]  server_ip   the IP address of the server, in the form
- *                         xxx.xxx.xxx.xxx:pppp
- *
- * @param[in]  ctx         the context to use
- *
- * @param[out] ssl_bio     the BIO structure used to interface with the
- *                         connection
+ * @return number of bytes read, or 0 on error (or if the connection closed)
+ */
+static size_t read_bio_some(BIO * bio, unsigned char *buf, size_t len,
+                            uint64_t deadline_us)
+{
+  while (1)
+  {
+    if (wait_for_bio(bio, deadline_us))
+    {
+      return 0;
+    }
+
+    int got = BIO_read(bio, buf, (len > INT_MAX) ? INT_MAX : (int) len);
+
+    if (got > 0)
+    {
+      return (size_t) got;
+    }
+    if (!BIO_should_retry(bio))
+    {
+      return 0;
+    }
+  }
+}
+
+//############################################################################
+// read_bio_exact()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function reads exactly len bytes from a BIO, however
+ * many reads that takes, as long as they all finish by a deadline.
+ * </pre>
  *
- * @param[in]  verbose     if true, print extra debugging messages
+ * @return 0 on success, 1 on error (or if the connection closed first)
+ */
+static int read_bio_exact(BIO * bio, unsigned char *buf, size_t len,
+                          uint64_t deadline_us)
+{
+  size_t done = 0;
+
+  while (done < len)
+  {
+    size_t got = read_bio_some(bio, buf + done, len - done, deadline_us);
+
+    if (got == 0)
+    {
+      return 1;
+    }
+    done += got;
+  }
+  return 0;
+}
+
+//############################################################################
+// kmip_ttlv_value_len()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function recognizes the TTLV header a KMIP message
+ * starts with (a tag in the 0x42xxxx range and the Structure type).
+ * </pre>
  *
- * @return 0 on success, 1 on error
+ * @return true (with the length of the message's value) if the header is
+ *         one, false if not
  */
-static int tls_ctx_connect(char *server_ip, char *server_port,
-                           SSL_CTX * ctx, BIO ** ssl_bio)
+static bool kmip_ttlv_value_len(const unsigned char *header,
+                                size_t *value_len)
 {
-  if (server_ip == NULL)
+  if (header[0] != 0x42 || header[3] != KMIP_TTLV_TYPE_STRUCTURE)
   {
-    kmyth_log(LOG_ERR, "no server IP ... exiting");
-    return 1;
+    return false;
   }
-  if (server_port == NULL)
+  *value_len = ((size_t) header[4] << 24) | ((size_t) header[5] << 16) |
+    ((size_t) header[6] << 8) | header[7];
+  return true;
+}
+
+//############################################################################
+// read_kmip_message()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function reads one KMIP message: the TTLV header
+ * (tag, type and the length of the value), then exactly that much value,
+ * into a single buffer.
+ * </pre>
+ *
+ * @return 0 on success, 1 on error
+ */
+static int read_kmip_message(BIO * bio, size_t max_len,
+                             unsigned char **msg, size_t *msg_len)
+{
+  uint64_t deadline_us = kmyth_metrics_now_us() +
+    (uint64_t) KMYTH_TLS_READ_TIMEOUT_MS * 1000;
+  unsigned char header[KMIP_TTLV_HEADER_LEN];
+  size_t value_len = 0;
+
+  if (read_bio_exact(bio, header, sizeof(header), deadline_us))
   {
-    kmyth_log(LOG_ERR, "no server port ... exiting");
+    kmyth_log(LOG_ERR, "error reading KMIP message header: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
     return 1;
   }
-  if (ctx == NULL)
+  if (!kmip_ttlv_value_len(header, &value_len))
   {
-    kmyth_log(LOG_ERR, "no SSL context ... exiting");
+    kmyth_log(LOG_ERR, "response is not a KMIP message ... exiting");
     return 1;
   }
-  if (ssl_bio == NULL)
+  if (value_len > max_len - sizeof(header))
   {
-    kmyth_log(LOG_ERR, "no BIO structure variable ... exiting");
+    kmyth_log(LOG_ERR, "KMIP message (%zu bytes) exceeds maximum (%zu bytes) "
+              "... exiting", value_len + sizeof(header), max_len);
     return 1;
   }
 
-  *ssl_bio = BIO_new_ssl_connect(ctx);
-  if (*ssl_bio == NULL)
+  *msg_len = sizeof(header) + value_len;
+  *msg = kmyth_malloc(*msg_len);
+  if (*msg == NULL)
   {
-    kmyth_log(LOG_ERR, "error getting new BIO chain: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
+    kmyth_log(LOG_ERR, "error allocating KMIP message buffer ... exiting");
     return 1;
   }
-
-  SSL *ssl;
-
-  if (BIO_get_ssl(*ssl_bio, &ssl) <= 0)
+  memcpy(*msg, header, sizeof(header));
+  if (read_bio_exact(bio, *msg + sizeof(header), value_len, deadline_us))
   {
-    kmyth_log(LOG_ERR, "error retrieving the BIO SSL pointer: %s ... exiting",
+    kmyth_log(LOG_ERR, "error reading KMIP message: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
+    kmyth_clear_and_free(*msg, *msg_len);
+    *msg = NULL;
     return 1;
   }
-  if (BIO_set_conn_address(*ssl_bio, server_ip) != 1)
+  return 0;
+}
+
+//############################################################################
+// get_resp_from_tls_server()
+//############################################################################
+int get_resp_from_tls_server(BIO * bio,
+                             char *req, size_t req_size,
+                             unsigned char **resp, size_t * resp_size)
+{
+  // validate input
+  if (bio == NULL)
   {
-    kmyth_log(LOG_ERR, "error setting connection address: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
     return 1;
   }
-  if (BIO_set_conn_port(*ssl_bio, server_port) != 1)
+  // write message to server
+  if (req_size > 0)
   {
-    kmyth_log(LOG_ERR, "error setting connection port: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    return 1;
+    if (write_bytes_to_bio(bio, (uint8_t *) req, req_size))
+    {
+      kmyth_log(LOG_ERR, "error writing message to server ... exiting");
+      return 1;
+    }
+    if (BIO_flush(bio) != 1)
+      kmyth_log(LOG_ERR, "error flushing server message BIO");
   }
+  // A KMIP response starts by saying how long it is, so it is read in full
+  // into a buffer of exactly that size; anything else is taken as the
+  // first read returns it (the rest of the record the header came in).
+  uint64_t deadline_us = kmyth_metrics_now_us() +
+    (uint64_t) KMYTH_TLS_READ_TIMEOUT_MS * 1000;
+  unsigned char header[KMIP_TTLV_HEADER_LEN];
+  size_t recv = read_bio_some(bio, header, sizeof(header), deadline_us);
+  size_t value_len = 0;
 
-  // set the list of ciphers available for negotiation with the server
-  if (SSL_set_cipher_list(ssl, PREFERRED_CIPHERS) != 1)
+  if (recv == 0)
   {
-    kmyth_log(LOG_ERR, "negotiate ciper list error: %s ... exiting",
+    kmyth_log(LOG_ERR, "no data received: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
     return 1;
   }
 
-  // verify server's X509 certificate
-  X509 *cert = SSL_get_peer_certificate(ssl);
+  size_t buf_size = 0;
 
-  if (cert)
+  if (recv == sizeof(header) && kmip_ttlv_value_len(header, &value_len))
   {
-    if (SSL_get_verify_result(ssl) != X509_V_OK)
+    if (value_len > KMYTH_KMIP_MAX_RESPONSE_SIZE - sizeof(header))
     {
-      kmyth_log(LOG_ERR, "error verifying peer ... exiting: %s",
-                ERR_error_string(ERR_get_error(), NULL));
+      kmyth_log(LOG_ERR, "response (%zu bytes) exceeds maximum (%d bytes) "
+                "... exiting", value_len + sizeof(header),
+                KMYTH_KMIP_MAX_RESPONSE_SIZE);
       return 1;
     }
-    X509_free(cert);
+    buf_size = sizeof(header) + value_len;
   }
+  else
+  {
+    int pending = BIO_pending(bio);
 
-  // initiate IP socket connection with the server
-  if (BIO_do_connect(*ssl_bio) <= 0)
+    buf_size = recv + ((pending > 0) ? (size_t) pending : 0);
+    if (buf_size >= KMYTH_GETKEY_RX_BUFFER_SIZE)
+    {
+      kmyth_log(LOG_ERR, "receive buffer full (%zu bytes) ... exiting",
+                buf_size);
+      return 1;
+    }
+  }
+
+  unsigned char *buf = kmyth_malloc(buf_size);
+
+  if (buf == NULL)
   {
-    kmyth_log(LOG_ERR, "TCP/IP socket connection error ... exiting");
+    kmyth_log(LOG_ERR,
+              "error allocating memory for server response ... exiting");
+    secure_memset(header, 0, sizeof(header));
     return 1;
   }
+  memcpy(buf, header, recv);
+  secure_memset(header, 0, sizeof(header));
 
-  // initiate SSL/TLS handshake with the server
-  if (BIO_do_handshake(*ssl_bio) <= 0)
+  if (read_bio_exact(bio, buf + recv, buf_size - recv, deadline_us))
   {
-    kmyth_log(LOG_ERR, "TLS connection error ... exiting");
+    kmyth_log(LOG_ERR, "error reading server response ... exiting");
+    kmyth_clear_and_free(buf, buf_size);
     return 1;
   }
 
+  *resp = buf;
+  *resp_size = buf_size;
+
   return 0;
 }
 
 //############################################################################
-// create_tls_connection()
+// get_key_from_kmip_server_impl()
 //############################################################################
-int create_tls_connection(char **server_ip,
-                          unsigned char *client_private_key,
-                          size_t client_private_key_len,
-                          char *client_cert_path, char *ca_cert_path,
-                          BIO ** tls_bio, SSL_CTX ** tls_ctx)
+static int get_key_from_kmip_server_impl(BIO * bio,
+                                         char *message,
+                                         size_t message_length,
+                                         unsigned char **key,
+                                         size_t * key_size)
 {
-  if (server_ip == NULL)
+  // validate input
+  if (bio == NULL)
   {
-    kmyth_log(LOG_ERR, "no server IP variable ... exiting");
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
     return 1;
   }
-  if (client_private_key == NULL || client_private_key_len == 0)
+
+  int message_len = 0;
+
+  if (INT_MAX >= message_length)
+    message_len = (int) message_length;
+  else
   {
-    kmyth_log(LOG_ERR, "no client private key ... exiting");
+    kmyth_log(LOG_ERR, "message length exceeds INT_MAX");
     return 1;
   }
 
-  if (client_cert_path == NULL)
+  KMIP kmip_context = { 0 };
+  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+
+  int result = -1;
+  int key_len = 0;
+
+  // write message to server
+  if (message_length > 0)
   {
-    kmyth_log(LOG_ERR, "no client cert path ... exiting");
-    return 1;
+    result = kmip_bio_get_symmetric_key_with_context(&kmip_context,
+                                                     bio,
+                                                     message, message_len,
+                                                     (char **) key, &key_len);
+    if (0 != result)
+    {
+      // NOTE: There is more error information available on the KMIP context
+      // that may be useful here (e.g., stack trace, string version of the
+      // returned error code, etc).
+      kmyth_log(LOG_ERR, "error retrieving key from KMIP server");
+      kmyth_log(LOG_ERR, kmip_context.error_message);
+      kmip_destroy(&kmip_context);
+      return result;
+    }
   }
 
-  if (ca_cert_path == NULL)
+  *key_size = (size_t) key_len;
+
+  kmip_destroy(&kmip_context);
+  return 0;
+}
+
+//############################################################################
+// get_key_from_kmip_server()
+//############################################################################
+int get_key_from_kmip_server(BIO * bio,
+                             char *message, size_t message_length,
+                             unsigned char **key, size_t * key_size)
+{
+  kmyth_log_span span;
+
+  kmyth_log_span_begin(&span, "get_key_from_kmip_server");
+
+  int retval = get_key_from_kmip_server_impl(bio, message, message_length,
+                                             key, key_size);
+
+  kmyth_log_span_end(&span, retval);
+  kmyth_metrics_inc(retval ? KMYTH_METRIC_KEY_REQUEST_ERRORS :
+                    KMYTH_METRIC_KEY_REQUESTS);
+  return retval;
+}
+
+//############################################################################
+// get_keys_from_kmip_server_impl()
+//############################################################################
+static int get_keys_from_kmip_server_impl(BIO * bio,
+                                          unsigned char **ids,
+                                          size_t *id_lens, size_t id_count,
+                                          kmip_key_result ** results)
+{
+  if (bio == NULL)
   {
-    kmyth_log(LOG_ERR, "no CA cert path ... exiting");
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
     return 1;
   }
-  if (tls_bio == NULL)
+  if (results == NULL)
   {
-    kmyth_log(LOG_ERR, "no BIO structure variable ... exiting");
+    kmyth_log(LOG_ERR, "no results variable ... exiting");
     return 1;
   }
-  if (tls_ctx == NULL)
+
+  KMIP kmip_context = { 0 };
+  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+
+  if (build_kmip_batch_get_request(&kmip_context, ids, id_lens, id_count,
+                                   &request, &request_len))
   {
-    kmyth_log(LOG_ERR, "no SSL context variable ... exiting");
+    kmyth_log(LOG_ERR, "error building KMIP batch Get request ... exiting");
+    kmip_destroy(&kmip_context);
     return 1;
   }
 
-  if (tls_set_context
-      (client_private_key, client_private_key_len, client_cert_path,
-       ca_cert_path, tls_ctx) != 0)
+  if (write_bytes_to_bio(bio, request, request_len) || BIO_flush(bio) != 1)
   {
-    kmyth_log(LOG_ERR, "error setting up TLS context ... exiting");
+    kmyth_log(LOG_ERR, "error sending KMIP request ... exiting");
+    kmyth_free(request);
+    kmip_destroy(&kmip_context);
     return 1;
   }
+  kmyth_free(request);
 
-  // This splits the server ip_string into two, IP and trailing port portions
-  char *server_port = NULL;
+  unsigned char *response = NULL;
+  size_t response_len = 0;
 
-  server_port = strpbrk(*server_ip, ":");
-  if (server_port == NULL)
+  if (read_kmip_message(bio, KMYTH_KMIP_MAX_RESPONSE_SIZE,
+                        &response, &response_len))
   {
-    kmyth_log(LOG_ERR, "null port (%s) ... exiting", *server_ip);
+    kmip_destroy(&kmip_context);
     return 1;
   }
-  *server_port = '\0';
-  server_port++;
 
-  // Check the validity of the port string. Port 0 is technically valid.
-  if ((strncmp(server_port, "0\0", 2) != 0) && (atoi(server_port) == 0))
-  {
-    kmyth_log(LOG_ERR, "malformed IP string, invalid port ... exiting");
-    return 1;
-  }
+  int retval = parse_kmip_batch_get_response(&kmip_context,
+                                             response, response_len,
+                                             id_count, results);
 
-  if (tls_ctx_connect(*server_ip, server_port, *tls_ctx, tls_bio) != 0)
+  kmyth_clear_and_free(response, response_len);
+  kmip_destroy(&kmip_context);
+  return retval;
+}
+
+//############################################################################
+// get_keys_from_kmip_server()
+//############################################################################
+int get_keys_from_kmip_server(BIO * bio,
+                              unsigned char **ids, size_t *id_lens,
+                              size_t id_count, kmip_key_result ** results)
+{
+  kmyth_log_span span;
+
+  kmyth_log_span_begin(&span, "get_keys_from_kmip_server");
+
+  int retval = get_keys_from_kmip_server_impl(bio, ids, id_lens, id_count,
+                                              results);
+
+  kmyth_log_span_end(&span, retval);
+
+  // each key counts as a request, whether it came back or not
+  size_t got = 0;
+
+  for (size_t i = 0; retval == 0 && i < id_count; i++)
   {
-    kmyth_log(LOG_ERR, "error connecting to server ... exiting");
-    return 1;
+    got += ((*results)[i].key != NULL);
   }
-  return 0;
+  kmyth_metrics_add(KMYTH_METRIC_KEY_REQUESTS, got);
+  kmyth_metrics_add(KMYTH_METRIC_KEY_REQUEST_ERRORS, id_count - got);
+  return retval;
 }
 
 //############################################################################
-// tls_cleanup()
+// Asynchronous key fetches
+//############################################################################
+
+// Where a key fetch is up to
+typedef enum
+{
+  TLS_KEY_FETCH_CONNECT,        // TCP connect and TLS handshake
+  TLS_KEY_FETCH_SEND,           // writing the KMIP Get request
+  TLS_KEY_FETCH_RECV,           // reading the KMIP Get response
+  TLS_KEY_FETCH_DONE,
+  TLS_KEY_FETCH_FAILED,
+} tls_key_fetch_phase;
+
+struct tls_key_fetch
+{
+  tls_race_attempt conn;        // the connection (and the events it awaits)
+  SSL_CTX *ctx;
+  tls_key_fetch_phase phase;
+  uint64_t deadline_us;
+
+  unsigned char *request;
+  size_t request_len;
+  size_t sent;
+
+  // the response's TTLV header is read first; it sizes the response buffer
+  unsigned char header[KMIP_TTLV_HEADER_LEN];
+  unsigned char *response;
+  size_t response_len;
+  size_t received;
+
+  unsigned char *key;
+  size_t key_len;
+
+  tls_key_fetch_cb cb;
+  void *arg;
+};
+
+//############################################################################
+// tls_key_fetch_finish()
 //############################################################################
-int tls_cleanup(void)
+/**
+ * <pre>
+ * This static helper function ends a key fetch: the connection is closed,
+ * the request and response buffers cleared and freed, and the callback
+ * (if any) run.
+ * </pre>
+ *
+ * @return status
+ */
+static int tls_key_fetch_finish(tls_key_fetch * fetch, int status)
 {
-  CONF_modules_unload(1);
-  ERR_free_strings();
-  EVP_cleanup();
-  CRYPTO_cleanup_all_ex_data();
-  SSL_COMP_free_compression_methods();
-  return 0;
+  fetch->phase = status ? TLS_KEY_FETCH_FAILED : TLS_KEY_FETCH_DONE;
+  kmyth_metrics_inc(status ? KMYTH_METRIC_KEY_REQUEST_ERRORS :
+                    KMYTH_METRIC_KEY_REQUESTS);
+
+  BIO_free_all(fetch->conn.bio);
+  fetch->conn.bio = NULL;
+  kmyth_clear_and_free(fetch->request, fetch->request_len);
+  fetch->request = NULL;
+  kmyth_clear_and_free(fetch->response, fetch->response_len);
+  fetch->response = NULL;
+  secure_memset(fetch->header, 0, sizeof(fetch->header));
+
+  if (fetch->cb != NULL)
+  {
+    fetch->cb(fetch, status, fetch->key, fetch->key_len, fetch->arg);
+  }
+  return status;
 }
 
 //############################################################################
-// tls_set_context()
+// tls_key_fetch_start()
 //############################################################################
-int tls_set_context(unsigned char *client_private_key,
-                    size_t client_private_key_len,
-                    char *client_cert_path, char *ca_cert_path, SSL_CTX ** ctx)
+tls_key_fetch *tls_key_fetch_start(SSL_CTX * ctx, char *server,
+                                   unsigned char *key_id, size_t key_id_len,
+                                   unsigned int timeout_ms,
+                                   tls_key_fetch_cb cb, void *arg)
 {
-  if (client_private_key == NULL || client_private_key_len == 0)
+  if (ctx == NULL || server == NULL)
   {
-    kmyth_log(LOG_ERR, "no client private key ... exiting");
-    return 1;
+    kmyth_log(LOG_ERR, "no SSL context or server ... exiting");
+    return NULL;
   }
-
-  if (client_private_key_len > INT_MAX)
+  if (key_id == NULL || key_id_len == 0)
   {
-    kmyth_log(LOG_ERR, "client private key length (%lu bytes) "
-              "exceeds maximum (%d bytes) ... exiting",
-              client_private_key_len, INT_MAX);
-    return 1;
+    kmyth_log(LOG_ERR, "no key ID ... exiting");
+    return NULL;
   }
 
-  if (client_cert_path == NULL)
+  tls_key_fetch *fetch = kmyth_calloc(1, sizeof(tls_key_fetch));
+
+  if (fetch == NULL)
   {
-    kmyth_log(LOG_ERR, "no client cert path ... exiting");
-    return 1;
+    kmyth_log(LOG_ERR, "error allocating key fetch ... exiting");
+    return NULL;
   }
 
-  if (ca_cert_path == NULL)
+  KMIP kmip_context = { 0 };
+  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+
+  int result = build_kmip_get_request(&kmip_context, key_id, key_id_len,
+                                      &fetch->request, &fetch->request_len);
+
+  kmip_destroy(&kmip_context);
+  if (result || tls_race_start(&fetch->conn, server))
   {
-    kmyth_log(LOG_ERR, "no CA cert path ... exiting");
-    return 1;
+    kmyth_log(LOG_ERR, "error starting key fetch from %s ... exiting",
+              server);
+    kmyth_clear_and_free(fetch->request, fetch->request_len);
+    kmyth_free(fetch);
+    return NULL;
   }
 
-  /*
-   * This does necessary OpenSSL setup stuff. The version checking is
-   * a stub for later automatic building against 1.1.1 (current LTS
-   * version) or newer. Other versions just error out.
-   */
-  if (OPENSSL_init_ssl(0, NULL) == 0)
+  if (timeout_ms == 0)
   {
-    kmyth_log(LOG_ERR, "error initializing OpenSSL: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    return 1;
+    timeout_ms = KMYTH_TLS_CONNECT_TIMEOUT_MS + KMYTH_TLS_READ_TIMEOUT_MS;
   }
+  fetch->ctx = ctx;
+  fetch->phase = TLS_KEY_FETCH_CONNECT;
+  fetch->deadline_us = kmyth_metrics_now_us() + (uint64_t) timeout_ms * 1000;
+  fetch->cb = cb;
+  fetch->arg = arg;
 
-  const SSL_METHOD *ssl_method = TLS_client_method();
+  tls_key_fetch_step(fetch);
+  return fetch;
+}
 
-  if (ssl_method == NULL)
+//############################################################################
+// tls_key_fetch_step()
+//############################################################################
+int tls_key_fetch_step(tls_key_fetch * fetch)
+{
+  if (fetch == NULL)
   {
-    kmyth_log(LOG_ERR, "error getting TLS method: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
     return 1;
   }
-
-  *ctx = SSL_CTX_new(ssl_method);
-  if (*ctx == NULL)
+  if (fetch->phase == TLS_KEY_FETCH_DONE)
   {
-    kmyth_log(LOG_ERR, "error creating new SSL context: %s",
-              ERR_error_string(ERR_get_error(), NULL));
-    return 1;
+    return 0;
   }
-
-  /*
-   * To negotiate the TLS connection we'll need a memory BIO to store
-   * the private key, and an EVP_PKEY structure to hold the private key
-   * object.
-   */
-
-  /*
-   * This creates the memory BIO and populates it with the client private
-   * key data.
-   */
-  BIO *private_key_mem =
-    BIO_new_mem_buf(client_private_key, (int) client_private_key_len);
-  if (private_key_mem == NULL)
+  if (fetch->phase == TLS_KEY_FETCH_FAILED)
   {
-    kmyth_log(LOG_ERR, "create private key BIO error: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
-      kmyth_log(LOG_ERR, "error clearing client private key BIO");
-    BIO_free_all(private_key_mem);
     return 1;
   }
-
-  /*
-   * This creates the EVP_PKEY structure from the raw private key data.
-   */
-  EVP_PKEY *private_key_evp =
-    PEM_read_bio_PrivateKey(private_key_mem, NULL, 0, NULL);
-  if (private_key_evp == NULL)
+  if (kmyth_metrics_now_us() >= fetch->deadline_us)
   {
-    kmyth_log(LOG_ERR, "create private key error: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    if (BIO_reset(private_key_mem) != 1)  // BIO_reset clears all data in BIO
-      kmyth_log(LOG_ERR, "error clearing client private key BIO");
-    BIO_free_all(private_key_mem);
-    return 1;
+    kmyth_log(LOG_ERR, "timed out fetching key from %s:%s ... exiting",
+              fetch->conn.ip, fetch->conn.port);
+    return tls_key_fetch_finish(fetch, 1);
   }
 
-  /*
-   * Done with client private key BIO, so clean it up - BIO_reset clears data
-   */
-  if (BIO_reset(private_key_mem) != 1)
-    kmyth_log(LOG_ERR, "error clearing client private key BIO");
-  BIO_free_all(private_key_mem);
+  BIO *bio = fetch->conn.bio;
 
-  /*
-   * This specifies the client certificate (which we assume is PEM formatted)
-   * used for client authentication within the TLS connection.
-   */
-  if (SSL_CTX_use_certificate_file(*ctx, client_cert_path, SSL_FILETYPE_PEM) !=
-      1)
+  if (fetch->phase == TLS_KEY_FETCH_CONNECT)
   {
-    kmyth_log(LOG_ERR, "SSL_CTX_use_certificate_file: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    EVP_PKEY_free(private_key_evp); // EVP_PKEY_free also clears memory. 
-    return 1;
+    int step = tls_race_step(&fetch->conn, fetch->ctx, true);
+
+    if (step < 0)
+    {
+      return -1;
+    }
+    if (step > 0)
+    {
+      return tls_key_fetch_finish(fetch, 1);
+    }
+    tls_race_handshake_done(&fetch->conn);
+    bio = fetch->conn.bio;
+    fetch->phase = TLS_KEY_FETCH_SEND;
   }
 
-  if (SSL_CTX_use_PrivateKey(*ctx, private_key_evp) != 1)
+  while (fetch->phase == TLS_KEY_FETCH_SEND)
   {
-    kmyth_log(LOG_ERR, "SSL_CTX_use_PrivateKey: %s ... exiting",
+    size_t left = fetch->request_len - fetch->sent;
+
+    if (left == 0)
+    {
+      fetch->phase = TLS_KEY_FETCH_RECV;
+      fetch->conn.events = POLLIN;
+      break;
+    }
+
+    int n = BIO_write(bio, fetch->request + fetch->sent,
+                      (left > INT_MAX) ? INT_MAX : (int) left);
+
+    if (n > 0)
+    {
+      fetch->sent += (size_t) n;
+      continue;
+    }
+    if (BIO_should_retry(bio))
+    {
+      fetch->conn.events = BIO_should_read(bio) ? POLLIN : POLLOUT;
+      return -1;
+    }
+    kmyth_log(LOG_ERR, "error sending KMIP request to %s:%s: %s ... exiting",
+              fetch->conn.ip, fetch->conn.port,
               ERR_error_string(ERR_get_error(), NULL));
-    EVP_PKEY_free(private_key_evp);
-    return 1;
+    return tls_key_fetch_finish(fetch, 1);
   }
 
-  /*
-   * EVP_PKEY_free does not provide a useful return value, so we ignore it.
-   * EVP_PKEY_free clears memory before freeing it. 
-   */
-  EVP_PKEY_free(private_key_evp);
-
-  if (SSL_CTX_check_private_key(*ctx) != 1)
+  while (1)
   {
-    kmyth_log(LOG_ERR, "private key / cert mismatch ... exiting");
-    return 1;
+    unsigned char *buf = (fetch->response != NULL) ? fetch->response
+      : fetch->header;
+    size_t total = (fetch->response != NULL) ? fetch->response_len
+      : KMIP_TTLV_HEADER_LEN;
+
+    if (fetch->received == total && fetch->response == NULL)
+    {
+      // the header says how long the rest of the response is
+      size_t value_len = 0;
+
+      if (!kmip_ttlv_value_len(fetch->header, &value_len))
+      {
+        kmyth_log(LOG_ERR, "response is not a KMIP message ... exiting");
+        return tls_key_fetch_finish(fetch, 1);
+      }
+      if (value_len > KMYTH_KMIP_MAX_RESPONSE_SIZE - KMIP_TTLV_HEADER_LEN)
+      {
+        kmyth_log(LOG_ERR, "response (%zu bytes) exceeds maximum (%d bytes) "
+                  "... exiting", value_len + KMIP_TTLV_HEADER_LEN,
+                  KMYTH_KMIP_MAX_RESPONSE_SIZE);
+        return tls_key_fetch_finish(fetch, 1);
+      }
+      fetch->response_len = KMIP_TTLV_HEADER_LEN + value_len;
+      fetch->response = kmyth_malloc(fetch->response_len);
+      if (fetch->response == NULL)
+      {
+        kmyth_log(LOG_ERR, "error allocating KMIP response ... exiting");
+        fetch->response_len = 0;
+        return tls_key_fetch_finish(fetch, 1);
+      }
+      memcpy(fetch->response, fetch->header, KMIP_TTLV_HEADER_LEN);
+      continue;
+    }
+    if (fetch->received == total)
+    {
+      break;
+    }
+
+    size_t want = total - fetch->received;
+    int n = BIO_read(bio, buf + fetch->received,
+                     (want > INT_MAX) ? INT_MAX : (int) want);
+
+    if (n > 0)
+    {
+      fetch->received += (size_t) n;
+      continue;
+    }
+    if (BIO_should_retry(bio))
+    {
+      fetch->conn.events = BIO_should_write(bio) ? POLLOUT : POLLIN;
+      return -1;
+    }
+    kmyth_log(LOG_ERR, "error reading KMIP response from %s:%s ... exiting",
+              fetch->conn.ip, fetch->conn.port);
+    return tls_key_fetch_finish(fetch, 1);
   }
 
-  /* pin CA certificate for client verification of server certificate */
-  if (SSL_CTX_load_verify_locations(*ctx, ca_cert_path, NULL) != 1)
+  KMIP kmip_context = { 0 };
+  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+
+  unsigned char *id = NULL;
+  size_t id_len = 0;
+  int result = parse_kmip_get_response(&kmip_context,
+                                       fetch->response, fetch->response_len,
+                                       &id, &id_len,
+                                       &fetch->key, &fetch->key_len);
+
+  kmip_destroy(&kmip_context);
+  kmyth_free(id);
+  if (result)
   {
-    kmyth_log(LOG_ERR, "trust store load error: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    return 1;
+    kmyth_log(LOG_ERR, "error parsing KMIP response from %s:%s ... exiting",
+              fetch->conn.ip, fetch->conn.port);
   }
-  SSL_CTX_set_verify(*ctx, SSL_VERIFY_PEER, NULL);
-  SSL_CTX_set_verify_depth(*ctx, 1);
-
-  return 0;
+  return tls_key_fetch_finish(fetch, result);
 }
 
 //############################################################################
-// get_key_from_tls_server()
+// tls_key_fetch_poll_fd()
 //############################################################################
-int get_resp_from_tls_server(BIO * bio,
-                             char *req, size_t req_size,
-                             unsigned char **resp, size_t * resp_size)
+int tls_key_fetch_poll_fd(tls_key_fetch * fetch, short *events)
 {
-  // validate input
-  if (bio == NULL)
-  {
-    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
-    return 1;
-  }
-  if(req_size > INT_MAX)
+  int fd = -1;
+
+  if (fetch == NULL || fetch->conn.bio == NULL
+      || fetch->phase == TLS_KEY_FETCH_DONE
+      || fetch->phase == TLS_KEY_FETCH_FAILED
+      || BIO_get_fd(fetch->conn.bio, &fd) <= 0)
   {
-    kmyth_log(LOG_ERR, "message exceeds INT_MAX in size ... exiting");
-    return 1;
+    return -1;
   }
-  // write message to server
-  if (req_size > 0)
+  if (events != NULL)
   {
-    if (BIO_write(bio, req, (int)req_size) <= 0)
-    {
-      kmyth_log(LOG_ERR, "error writing message to server ... exiting");
-      return 1;
-    }
-    if (BIO_flush(bio) != 1)
-      kmyth_log(LOG_ERR, "error flushing server message BIO");
+    *events = fetch->conn.events;
   }
-  // This size is known not to exceed INT_MAX.
-  size_t buf_size = KMYTH_GETKEY_RX_BUFFER_SIZE;
-  char *buf = calloc(buf_size, sizeof(char));
+  return fd;
+}
 
-  if (buf == NULL)
+//############################################################################
+// tls_key_fetch_timeout_ms()
+//############################################################################
+int tls_key_fetch_timeout_ms(tls_key_fetch * fetch)
+{
+  if (fetch == NULL || fetch->phase == TLS_KEY_FETCH_DONE
+      || fetch->phase == TLS_KEY_FETCH_FAILED)
   {
-    kmyth_log(LOG_ERR,
-              "error allocating memory for server response ... exiting");
-    return 1;
+    return 0;
   }
 
-  int recv = BIO_read(bio, buf, (int)buf_size);
+  uint64_t now_us = kmyth_metrics_now_us();
 
-  if (0 >= recv)
+  if (now_us >= fetch->deadline_us)
   {
-    kmyth_log(LOG_ERR, "no data received: %s ... exiting",
-              ERR_error_string(ERR_get_error(), NULL));
-    free(buf);
-    return 1;
+    return 0;
   }
 
-  if (recv >= buf_size)
-  {
-    kmyth_log(LOG_ERR, "receive buffer full (%d bytes) ... exiting", recv);
-    free(buf);
-    return 1;
-  }
+  uint64_t left_ms = (fetch->deadline_us - now_us + 999) / 1000;
 
-  // recv must be non-negative, as we've already errored out if it's negative.
-  *resp_size = (size_t)recv;
-  (*resp) = malloc(*resp_size);
-  if (*resp == NULL)
+  return (left_ms > INT_MAX) ? INT_MAX : (int) left_ms;
+}
+
+//############################################################################
+// tls_key_fetch_take_key()
+//############################################################################
+int tls_key_fetch_take_key(tls_key_fetch * fetch,
+                           unsigned char **key, size_t *key_len)
+{
+  if (fetch == NULL || key == NULL || key_len == NULL
+      || fetch->phase != TLS_KEY_FETCH_DONE || fetch->key == NULL)
   {
-    kmyth_log(LOG_ERR, "error allocating correctly sized buffer ... exiting");
-    buf = secure_memset(buf, 0, buf_size);
-    free(buf);
     return 1;
   }
-  memcpy((*resp), buf, *resp_size);
-
-  buf = secure_memset(buf, 0, buf_size);
-  free(buf);
-
+  *key = fetch->key;
+  *key_len = fetch->key_len;
+  fetch->key = NULL;
+  fetch->key_len = 0;
   return 0;
 }
 
 //############################################################################
-// get_key_from_kmip_server()
+// tls_key_fetch_free()
 //############################################################################
+void tls_key_fetch_free(tls_key_fetch * fetch)
+{
+  if (fetch == NULL)
+  {
+    return;
+  }
+  BIO_free_all(fetch->conn.bio);
+  kmyth_clear_and_free(fetch->request, fetch->request_len);
+  kmyth_clear_and_free(fetch->response, fetch->response_len);
+  kmyth_clear_and_free(fetch->key, fetch->key_len);
+  kmyth_clear_and_free(fetch, sizeof(tls_key_fetch));
+}
 
-int get_key_from_kmip_server(BIO * bio,
-                             char *message, size_t message_length,
-                             unsigned char **key, size_t * key_size)
+//############################################################################
+// tls_key_fetch_run()
+//############################################################################
+int tls_key_fetch_run(tls_key_fetch ** fetches, size_t count)
 {
-  // validate input
-  if (bio == NULL)
+  if (fetches == NULL || count == 0)
   {
-    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
     return 1;
   }
 
-  int message_len = 0;
+  struct pollfd *pfds = kmyth_calloc(count, sizeof(struct pollfd));
+  size_t *polled = kmyth_calloc(count, sizeof(size_t));
 
-  if (INT_MAX >= message_length)
-    message_len = (int) message_length;
-  else
+  if (pfds == NULL || polled == NULL)
   {
-    kmyth_log(LOG_ERR, "message length exceeds INT_MAX");
+    kmyth_log(LOG_ERR, "error allocating key fetch poll set ... exiting");
+    kmyth_free(pfds);
+    kmyth_free(polled);
     return 1;
   }
 
-  KMIP kmip_context = { 0 };
-  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+  while (1)
+  {
+    size_t npfds = 0;
+    int timeout_ms = -1;
 
-  int result = -1;
-  int key_len = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      if (fetches[i] == NULL || fetches[i]->phase == TLS_KEY_FETCH_DONE
+          || fetches[i]->phase == TLS_KEY_FETCH_FAILED)
+      {
+        continue;
+      }
 
-  // write message to server
-  if (message_length > 0)
-  {
-    result = kmip_bio_get_symmetric_key_with_context(&kmip_context,
-                                                     bio,
-                                                     message, message_len,
-                                                     (char **) key, &key_len);
-    if (0 != result)
+      short events = 0;
+      int fd = tls_key_fetch_poll_fd(fetches[i], &events);
+      int left_ms = tls_key_fetch_timeout_ms(fetches[i]);
+
+      // a fetch without a socket to wait on, or out of time, is stepped
+      // straight away (which, out of time, finishes it)
+      if (fd < 0 || left_ms == 0)
+      {
+        if (tls_key_fetch_step(fetches[i]) >= 0)
+        {
+          continue;
+        }
+        fd = tls_key_fetch_poll_fd(fetches[i], &events);
+        left_ms = tls_key_fetch_timeout_ms(fetches[i]);
+        if (fd < 0)
+        {
+          continue;
+        }
+      }
+      pfds[npfds].fd = fd;
+      pfds[npfds].events = events;
+      pfds[npfds].revents = 0;
+      polled[npfds++] = i;
+      timeout_ms = (timeout_ms < 0 || left_ms < timeout_ms) ? left_ms
+        : timeout_ms;
+    }
+    if (npfds == 0)
     {
-      // NOTE: There is more error information available on the KMIP context
-      // that may be useful here (e.g., stack trace, string version of the
-      // returned error code, etc).
-      kmyth_log(LOG_ERR, "error retrieving key from KMIP server");
-      kmyth_log(LOG_ERR, kmip_context.error_message);
-      kmip_destroy(&kmip_context);
-      return result;
+      break;
+    }
+
+    int ready = poll(pfds, (nfds_t) npfds, timeout_ms);
+
+    if (ready < 0 && errno != EINTR)
+    {
+      kmyth_log(LOG_ERR, "error waiting for the servers ... exiting");
+      break;
+    }
+    for (size_t j = 0; j < npfds; j++)
+    {
+      if (pfds[j].revents != 0)
+      {
+        tls_key_fetch_step(fetches[polled[j]]);
+      }
     }
   }
 
-  *key_size = (size_t) key_len;
+  kmyth_free(pfds);
+  kmyth_free(polled);
 
-  kmip_destroy(&kmip_context);
-  return 0;
+  int retval = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    retval |= (fetches[i] == NULL || fetches[i]->phase != TLS_KEY_FETCH_DONE);
+  }
+  return retval;
 }
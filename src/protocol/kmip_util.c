@@ -5,6 +5,7 @@
 #include <kmip/kmip.h>
 
 #include "defines.h"
+#include "kmip_util.h"
 #include "memory_util.h"
 #include "aes_gcm.h"
 
@@ -25,28 +26,13 @@
 #endif
 
 //
-// build_kmip_get_request()
+// encode_get_request()
 //
-int build_kmip_get_request(KMIP * ctx,
-                           unsigned char *id, size_t id_len,
-                           unsigned char **request, size_t *request_len)
+// Encodes a KMIP Get request into the buffer set on the context, returning
+// the libkmip result (KMIP_ERROR_BUFFER_FULL if the buffer is too small).
+//
+static int encode_get_request(KMIP * ctx, unsigned char *id, size_t id_len)
 {
-  // Set up the encoding buffer.
-  size_t buffer_blocks = 1;
-  size_t buffer_block_size = 1024;
-  size_t buffer_total_size = buffer_blocks * buffer_block_size;
-
-  uint8 *encoding = calloc(buffer_blocks, buffer_block_size);
-
-  if (encoding == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
-    return 1;
-  }
-  kmip_reset(ctx);
-  kmip_set_buffer(ctx, encoding, buffer_total_size);
-
-  // Build the KMIP Get request.
   ProtocolVersion protocol_version = { 0 };
   kmip_init_protocol_version(&protocol_version, ctx->version);
 
@@ -75,7 +61,192 @@ int build_kmip_get_request(KMIP * ctx,
   message.batch_items = &batch_item;
   message.batch_count = 1;
 
-  int result = kmip_encode_request_message(ctx, &message);
+  return kmip_encode_request_message(ctx, &message);
+}
+
+//
+// encode_get_response()
+//
+// Encodes a KMIP Get response into the buffer set on the context, returning
+// the libkmip result (KMIP_ERROR_BUFFER_FULL if the buffer is too small).
+//
+static int encode_get_response(KMIP * ctx,
+                               unsigned char *id, size_t id_len,
+                               unsigned char *key, size_t key_len)
+{
+  ProtocolVersion protocol_version = { 0 };
+  kmip_init_protocol_version(&protocol_version, ctx->version);
+
+  ResponseHeader header = { 0 };
+  kmip_init_response_header(&header);
+
+  header.protocol_version = &protocol_version;
+  header.time_stamp = time(NULL);
+  header.batch_count = 1;
+
+  ByteString byte_string = { 0 };
+  byte_string.size = key_len;
+  byte_string.value = key;
+
+  KeyValue key_value = { 0 };
+  key_value.key_material = &byte_string;
+
+  KeyBlock key_block = { 0 };
+  key_block.key_format_type = KMIP_KEYFORMAT_RAW;
+  key_block.key_value = &key_value;
+
+  SymmetricKey symmetric_key = { 0 };
+  symmetric_key.key_block = &key_block;
+
+  TextString key_id = { 0 };
+  key_id.value = (char *) id;
+  key_id.size = id_len;
+
+  GetResponsePayload payload = { 0 };
+  payload.object_type = KMIP_OBJTYPE_SYMMETRIC_KEY;
+  payload.unique_identifier = &key_id;
+  payload.object = &symmetric_key;
+
+  ResponseBatchItem batch_item = { 0 };
+  batch_item.operation = KMIP_OP_GET;
+  batch_item.result_status = KMIP_STATUS_SUCCESS;
+  batch_item.response_payload = &payload;
+
+  ResponseMessage message = { 0 };
+  message.response_header = &header;
+  message.batch_items = &batch_item;
+  message.batch_count = 1;
+
+  return kmip_encode_response_message(ctx, &message);
+}
+
+//
+// decode_get_request()
+//
+// Decodes the buffer set on the context as a KMIP Get request, pointing
+// id at the requested ID inside the decoded message. On error the message
+// is freed.
+//
+static int decode_get_request(KMIP * ctx, RequestMessage * message,
+                              TextString ** id)
+{
+  // Parse the request message and handle errors.
+  int result = kmip_decode_request_message(ctx, message);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to decode the KMIP request message.");
+    kmip_free_request_message(ctx, message);
+    return 1;
+  }
+
+  if (message->request_header->batch_count != 1)
+  {
+    kmyth_log(LOG_ERR, "Received incorrect number of requests (expected 1).");
+    kmip_free_request_message(ctx, message);
+    return 1;
+  }
+
+  RequestBatchItem *batch_item = &message->batch_items[0];
+  GetRequestPayload *payload =
+    (GetRequestPayload *) batch_item->request_payload;
+
+  if (batch_item->operation != KMIP_OP_GET || payload == NULL ||
+      payload->unique_identifier == NULL)
+  {
+    kmyth_log(LOG_ERR, "Did not receive a KMIP Get request.");
+    kmip_free_request_message(ctx, message);
+    return 1;
+  }
+
+  *id = payload->unique_identifier;
+  return 0;
+}
+
+//
+// decode_get_response()
+//
+// Decodes the buffer set on the context as a KMIP Get response, pointing
+// id and key at the key ID and key inside the decoded message. On error
+// the message is freed.
+//
+static int decode_get_response(KMIP * ctx, ResponseMessage * message,
+                               TextString ** id, ByteString ** key)
+{
+  // Parse the response message and handle errors.
+  int result = kmip_decode_response_message(ctx, message);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to decode the KMIP response message.");
+    kmip_free_response_message(ctx, message);
+    return 1;
+  }
+
+  if (message->response_header->batch_count != 1)
+  {
+    kmyth_log(LOG_ERR, "Received incorrect number of responses (expected 1).");
+    kmip_free_response_message(ctx, message);
+    return 1;
+  }
+
+  ResponseBatchItem *batch_item = &message->batch_items[0];
+
+  if (batch_item->operation != KMIP_OP_GET)
+  {
+    kmyth_log(LOG_ERR, "Did not receive a KMIP Get response.");
+    kmip_free_response_message(ctx, message);
+    return 1;
+  }
+  if (batch_item->result_status != KMIP_STATUS_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "The KMIP Get request failed.");
+    kmip_free_response_message(ctx, message);
+    return 1;
+  }
+
+  GetResponsePayload *payload =
+    (GetResponsePayload *) batch_item->response_payload;
+  if (payload == NULL || payload->object_type != KMIP_OBJTYPE_SYMMETRIC_KEY)
+  {
+    kmyth_log(LOG_ERR, "The received KMIP object is not a symmetric key.");
+    kmip_free_response_message(ctx, message);
+    return 1;
+  }
+
+  SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
+  KeyBlock *key_block = symmetric_key->key_block;
+  KeyValue *key_value = key_block->key_value;
+
+  *id = payload->unique_identifier;
+  *key = key_value->key_material;
+  return 0;
+}
+
+//
+// build_kmip_get_request()
+//
+int build_kmip_get_request(KMIP * ctx,
+                           unsigned char *id, size_t id_len,
+                           unsigned char **request, size_t *request_len)
+{
+  // Set up the encoding buffer.
+  size_t buffer_blocks = 1;
+  size_t buffer_block_size = 1024;
+  size_t buffer_total_size = buffer_blocks * buffer_block_size;
+
+  uint8 *encoding = kmyth_calloc(buffer_blocks, buffer_block_size);
+
+  if (encoding == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+    return 1;
+  }
+  kmip_reset(ctx);
+  kmip_set_buffer(ctx, encoding, buffer_total_size);
+
+  // Build the KMIP Get request.
+  int result = encode_get_request(ctx, id, id_len);
 
   if (result != KMIP_OK)
   {
@@ -89,8 +260,8 @@ int build_kmip_get_request(KMIP * ctx,
   // This type conversion should be safe assuming libkmip hasn't done
   // something odd.
   *request_len = (size_t)(ctx->index - ctx->buffer);
-  *request = calloc(*request_len, sizeof(unsigned char));
-  if (request == NULL)
+  *request = kmyth_calloc(*request_len, sizeof(unsigned char));
+  if (*request == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the KMIP request buffer.");
     kmyth_clear_and_free(encoding, buffer_total_size);
@@ -116,40 +287,16 @@ int parse_kmip_get_request(KMIP * ctx,
   kmip_reset(ctx);
   kmip_set_buffer(ctx, request, request_len);
   RequestMessage message = { 0 };
+  TextString *key_id = NULL;
 
-  // Parse the request message and handle errors.
-  int result = kmip_decode_request_message(ctx, &message);
-
-  if (result != KMIP_OK)
-  {
-    kmyth_log(LOG_ERR, "Failed to decode the KMIP request message.");
-    kmip_free_request_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
-
-  if (message.request_header->batch_count != 1)
-  {
-    kmyth_log(LOG_ERR, "Received incorrect number of requests (expected 1).");
-    kmip_free_request_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
-
-  RequestBatchItem batch_item = message.batch_items[0];
-
-  if (batch_item.operation != KMIP_OP_GET)
+  if (decode_get_request(ctx, &message, &key_id))
   {
-    kmyth_log(LOG_ERR, "Did not receive a KMIP Get request.");
-    kmip_free_request_message(ctx, &message);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
 
-  GetRequestPayload *payload = (GetRequestPayload *) batch_item.request_payload;
-
   // Set up the official ID buffer and clean up.
-  *id = calloc(payload->unique_identifier->size, sizeof(unsigned char));
+  *id = kmyth_calloc(key_id->size, sizeof(unsigned char));
   if (*id == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
@@ -157,8 +304,8 @@ int parse_kmip_get_request(KMIP * ctx,
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
-  *id_len = payload->unique_identifier->size;
-  memcpy(*id, payload->unique_identifier->value, *id_len);
+  *id_len = key_id->size;
+  memcpy(*id, key_id->value, *id_len);
 
   kmip_free_request_message(ctx, &message);
   kmip_set_buffer(ctx, NULL, 0);
@@ -179,7 +326,7 @@ int build_kmip_get_response(KMIP * ctx,
   size_t buffer_block_size = 1024;
   size_t buffer_total_size = buffer_blocks * buffer_block_size;
 
-  uint8 *encoding = calloc(buffer_blocks, buffer_block_size);
+  uint8 *encoding = kmyth_calloc(buffer_blocks, buffer_block_size);
 
   if (encoding == NULL)
   {
@@ -190,50 +337,7 @@ int build_kmip_get_response(KMIP * ctx,
   kmip_set_buffer(ctx, encoding, buffer_total_size);
 
   // Build the KMIP Get response
-  ProtocolVersion protocol_version = { 0 };
-  kmip_init_protocol_version(&protocol_version, ctx->version);
-
-  ResponseHeader header = { 0 };
-  kmip_init_response_header(&header);
-
-  header.protocol_version = &protocol_version;
-  header.time_stamp = time(NULL);
-  header.batch_count = 1;
-
-  ByteString byte_string = { 0 };
-  byte_string.size = key_len;
-  byte_string.value = key;
-
-  KeyValue key_value = { 0 };
-  key_value.key_material = &byte_string;
-
-  KeyBlock key_block = { 0 };
-  key_block.key_format_type = KMIP_KEYFORMAT_RAW;
-  key_block.key_value = &key_value;
-
-  SymmetricKey symmetric_key = { 0 };
-  symmetric_key.key_block = &key_block;
-
-  TextString key_id = { 0 };
-  key_id.value = (char *) id;
-  key_id.size = id_len;
-
-  GetResponsePayload payload = { 0 };
-  payload.object_type = KMIP_OBJTYPE_SYMMETRIC_KEY;
-  payload.unique_identifier = &key_id;
-  payload.object = &symmetric_key;
-
-  ResponseBatchItem batch_item = { 0 };
-  batch_item.operation = KMIP_OP_GET;
-  batch_item.result_status = KMIP_STATUS_SUCCESS;
-  batch_item.response_payload = &payload;
-
-  ResponseMessage message = { 0 };
-  message.response_header = &header;
-  message.batch_items = &batch_item;
-  message.batch_count = 1;
-
-  int result = kmip_encode_response_message(ctx, &message);
+  int result = encode_get_response(ctx, id, id_len, key, key_len);
 
   if (result != KMIP_OK)
   {
@@ -247,8 +351,8 @@ int build_kmip_get_response(KMIP * ctx,
   // This type conversion should be safe unless libkmip has done
   // something odd.
   *response_len = (size_t)(ctx->index - ctx->buffer);
-  *response = calloc(*response_len, sizeof(unsigned char));
-  if (response == NULL)
+  *response = kmyth_calloc(*response_len, sizeof(unsigned char));
+  if (*response == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the KMIP response buffer.");
     kmyth_clear_and_free(encoding, buffer_total_size);
@@ -275,87 +379,853 @@ int parse_kmip_get_response(KMIP * ctx,
   kmip_reset(ctx);
   kmip_set_buffer(ctx, response, response_len);
   ResponseMessage message = { 0 };
+  TextString *key_id = NULL;
+  ByteString *key_material = NULL;
 
-  // Parse the response message and handle errors.
-  int result = kmip_decode_response_message(ctx, &message);
-
-  if (result != KMIP_OK)
+  if (decode_get_response(ctx, &message, &key_id, &key_material))
   {
-    kmyth_log(LOG_ERR, "Failed to decode the KMIP response message.");
-    kmip_free_response_message(ctx, &message);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
 
-  if (message.response_header->batch_count != 1)
+  // Set up the official ID and key buffers and clean up.
+  *id = kmyth_calloc(key_id->size, sizeof(unsigned char));
+  if (*id == NULL)
   {
-    kmyth_log(LOG_ERR, "Received incorrect number of responses (expected 1).");
+    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
     kmip_free_response_message(ctx, &message);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
+  *id_len = key_id->size;
 
-  ResponseBatchItem batch_item = message.batch_items[0];
+  memcpy(*id, key_id->value, *id_len);
 
-  if (batch_item.operation != KMIP_OP_GET)
+  *key = kmyth_calloc(key_material->size, sizeof(unsigned char));
+  if (*key == NULL)
   {
-    kmyth_log(LOG_ERR, "Did not receive a KMIP Get response.");
+    kmyth_log(LOG_ERR, "Failed to allocate the key buffer.");
+    kmyth_clear_and_free(*id, *id_len);
+    *id = NULL;
+    *id_len = 0;
     kmip_free_response_message(ctx, &message);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
-  if (batch_item.result_status != KMIP_STATUS_SUCCESS)
+  *key_len = key_material->size;
+  memcpy(*key, key_material->value, *key_len);
+
+  kmip_free_response_message(ctx, &message);
+  kmip_set_buffer(ctx, NULL, 0);
+
+  return 0;
+}
+
+//
+// kmip_codec_init()
+//
+int kmip_codec_init(kmip_codec * codec, enum kmip_version version,
+                    size_t buffer_size)
+{
+  if (codec == NULL)
   {
-    kmyth_log(LOG_ERR, "The KMIP Get request failed.");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    kmyth_log(LOG_ERR, "No KMIP codec to initialize.");
     return 1;
   }
+  memset(codec, 0, sizeof(kmip_codec));
 
-  GetResponsePayload *payload =
-    (GetResponsePayload *) batch_item.response_payload;
-  if (payload->object_type != KMIP_OBJTYPE_SYMMETRIC_KEY)
+  if (buffer_size == 0)
   {
-    kmyth_log(LOG_ERR, "The received KMIP object is not a symmetric key.");
-    kmip_free_response_message(ctx, &message);
+    buffer_size = KMYTH_KMIP_CODEC_BUFFER_SIZE;
+  }
+  codec->buffer = kmyth_calloc(1, buffer_size);
+  if (codec->buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+    return 1;
+  }
+  codec->buffer_size = buffer_size;
+  kmip_init(&codec->ctx, NULL, 0, version);
+
+  return 0;
+}
+
+//
+// kmip_codec_reset()
+//
+void kmip_codec_reset(kmip_codec * codec)
+{
+  if (codec == NULL || codec->buffer == NULL)
+  {
+    return;
+  }
+
+  // Only the part of the buffer used by the last message needs clearing.
+  kmyth_clear(codec->buffer, codec->encoded_len);
+  codec->encoded_len = 0;
+
+  if (codec->has_request)
+  {
+    kmip_free_request_message(&codec->ctx, &codec->request);
+    memset(&codec->request, 0, sizeof(RequestMessage));
+    codec->has_request = false;
+  }
+  if (codec->has_response)
+  {
+    kmip_free_response_message(&codec->ctx, &codec->response);
+    memset(&codec->response, 0, sizeof(ResponseMessage));
+    codec->has_response = false;
+  }
+
+  kmip_reset(&codec->ctx);
+  kmip_set_buffer(&codec->ctx, NULL, 0);
+}
+
+//
+// kmip_codec_free()
+//
+void kmip_codec_free(kmip_codec * codec)
+{
+  if (codec == NULL || codec->buffer == NULL)
+  {
+    return;
+  }
+  kmip_codec_reset(codec);
+  kmip_destroy(&codec->ctx);
+  kmyth_clear_and_free(codec->buffer, codec->buffer_size);
+  memset(codec, 0, sizeof(kmip_codec));
+}
+
+//
+// codec_start_encoding()
+//
+// Clears the last message encoded and points the context at the encoding
+// buffer, leaving any decoded message (whose contents may be part of the
+// message about to be encoded) alone.
+//
+static void codec_start_encoding(kmip_codec * codec)
+{
+  kmyth_clear(codec->buffer, codec->encoded_len);
+  codec->encoded_len = 0;
+  kmip_reset(&codec->ctx);
+  kmip_set_buffer(&codec->ctx, codec->buffer, codec->buffer_size);
+}
+
+//
+// codec_grow_buffer()
+//
+// Doubles the encoding buffer after an encoding found it too small, up to
+// the maximum KMIP message size. Returns 1 if it can not grow.
+//
+static int codec_grow_buffer(kmip_codec * codec)
+{
+  size_t max_size = (size_t) codec->ctx.max_message_size;
+
+  if (codec->buffer_size >= max_size)
+  {
+    return 1;
+  }
+
+  size_t buffer_size = 2 * codec->buffer_size;
+
+  if (buffer_size > max_size)
+  {
+    buffer_size = max_size;
+  }
+
+  uint8 *buffer = kmyth_calloc(1, buffer_size);
+
+  if (buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to grow the KMIP encoding buffer.");
+    return 1;
+  }
+
+  // The failed encoding may have written anywhere in the old buffer.
+  kmip_set_buffer(&codec->ctx, NULL, 0);
+  kmyth_clear_and_free(codec->buffer, codec->buffer_size);
+  codec->buffer = buffer;
+  codec->buffer_size = buffer_size;
+
+  return 0;
+}
+
+//
+// kmip_codec_build_get_request()
+//
+int kmip_codec_build_get_request(kmip_codec * codec,
+                                 unsigned char *id, size_t id_len,
+                                 unsigned char **request, size_t *request_len)
+{
+  if (codec == NULL || codec->buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "No KMIP codec to build the request with.");
+    return 1;
+  }
+
+  int result = KMIP_ERROR_BUFFER_FULL;
+
+  do
+  {
+    codec_start_encoding(codec);
+    result = encode_get_request(&codec->ctx, id, id_len);
+  }
+  while (result == KMIP_ERROR_BUFFER_FULL && codec_grow_buffer(codec) == 0);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to encode the KMIP key request.");
+    codec->encoded_len = codec->buffer_size;
+    kmip_set_buffer(&codec->ctx, NULL, 0);
+    return 1;
+  }
+
+  codec->encoded_len = (size_t) (codec->ctx.index - codec->ctx.buffer);
+  kmip_set_buffer(&codec->ctx, NULL, 0);
+
+  *request = codec->buffer;
+  *request_len = codec->encoded_len;
+
+  return 0;
+}
+
+//
+// kmip_codec_parse_get_request()
+//
+int kmip_codec_parse_get_request(kmip_codec * codec,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char **id, size_t *id_len)
+{
+  if (codec == NULL || codec->buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "No KMIP codec to parse the request with.");
+    return 1;
+  }
+
+  if (codec->has_request)
+  {
+    kmip_free_request_message(&codec->ctx, &codec->request);
+    memset(&codec->request, 0, sizeof(RequestMessage));
+    codec->has_request = false;
+  }
+
+  kmip_reset(&codec->ctx);
+  kmip_set_buffer(&codec->ctx, request, request_len);
+
+  TextString *key_id = NULL;
+  int result = decode_get_request(&codec->ctx, &codec->request, &key_id);
+
+  kmip_set_buffer(&codec->ctx, NULL, 0);
+  if (result)
+  {
+    memset(&codec->request, 0, sizeof(RequestMessage));
+    return 1;
+  }
+  codec->has_request = true;
+
+  *id = (unsigned char *) key_id->value;
+  *id_len = key_id->size;
+
+  return 0;
+}
+
+//
+// kmip_codec_build_get_response()
+//
+int kmip_codec_build_get_response(kmip_codec * codec,
+                                  unsigned char *id, size_t id_len,
+                                  unsigned char *key, size_t key_len,
+                                  unsigned char **response,
+                                  size_t *response_len)
+{
+  if (codec == NULL || codec->buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "No KMIP codec to build the response with.");
+    return 1;
+  }
+
+  int result = KMIP_ERROR_BUFFER_FULL;
+
+  do
+  {
+    codec_start_encoding(codec);
+    result = encode_get_response(&codec->ctx, id, id_len, key, key_len);
+  }
+  while (result == KMIP_ERROR_BUFFER_FULL && codec_grow_buffer(codec) == 0);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to encode the KMIP Get response.");
+    codec->encoded_len = codec->buffer_size;
+    kmip_set_buffer(&codec->ctx, NULL, 0);
+    return 1;
+  }
+
+  codec->encoded_len = (size_t) (codec->ctx.index - codec->ctx.buffer);
+  kmip_set_buffer(&codec->ctx, NULL, 0);
+
+  *response = codec->buffer;
+  *response_len = codec->encoded_len;
+
+  return 0;
+}
+
+//
+// kmip_codec_parse_get_response()
+//
+int kmip_codec_parse_get_response(kmip_codec * codec,
+                                  unsigned char *response,
+                                  size_t response_len,
+                                  unsigned char **id, size_t *id_len,
+                                  unsigned char **key, size_t *key_len)
+{
+  if (codec == NULL || codec->buffer == NULL)
+  {
+    kmyth_log(LOG_ERR, "No KMIP codec to parse the response with.");
+    return 1;
+  }
+
+  if (codec->has_response)
+  {
+    kmip_free_response_message(&codec->ctx, &codec->response);
+    memset(&codec->response, 0, sizeof(ResponseMessage));
+    codec->has_response = false;
+  }
+
+  kmip_reset(&codec->ctx);
+  kmip_set_buffer(&codec->ctx, response, response_len);
+
+  TextString *key_id = NULL;
+  ByteString *key_material = NULL;
+  int result = decode_get_response(&codec->ctx, &codec->response,
+                                   &key_id, &key_material);
+
+  kmip_set_buffer(&codec->ctx, NULL, 0);
+  if (result)
+  {
+    memset(&codec->response, 0, sizeof(ResponseMessage));
+    return 1;
+  }
+  codec->has_response = true;
+
+  *id = (unsigned char *) key_id->value;
+  *id_len = key_id->size;
+  *key = key_material->value;
+  *key_len = key_material->size;
+
+  return 0;
+}
+
+//
+// build_kmip_batch_get_request()
+//
+int build_kmip_batch_get_request(KMIP * ctx,
+                                 unsigned char **ids, size_t *id_lens,
+                                 size_t id_count,
+                                 unsigned char **request, size_t *request_len)
+{
+  if (ids == NULL || id_lens == NULL || id_count == 0 ||
+      id_count > KMYTH_KMIP_MAX_BATCH_COUNT)
+  {
+    kmyth_log(LOG_ERR, "Invalid number of IDs for a KMIP batch request.");
+    return 1;
+  }
+
+  RequestBatchItem *batch_items =
+    kmyth_calloc(id_count, sizeof(RequestBatchItem));
+  GetRequestPayload *payloads =
+    kmyth_calloc(id_count, sizeof(GetRequestPayload));
+  TextString *key_ids = kmyth_calloc(id_count, sizeof(TextString));
+  ByteString *item_ids = kmyth_calloc(id_count, sizeof(ByteString));
+  uint8 *item_id_values = kmyth_calloc(id_count, 4);
+
+  if (batch_items == NULL || payloads == NULL || key_ids == NULL ||
+      item_ids == NULL || item_id_values == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP batch items.");
+    kmyth_free(batch_items);
+    kmyth_free(payloads);
+    kmyth_free(key_ids);
+    kmyth_free(item_ids);
+    kmyth_free(item_id_values);
+    return 1;
+  }
+
+  // Each item needs roughly 64 bytes of TTLV framing around its ID.
+  size_t buffer_total_size = 1024;
+
+  for (size_t i = 0; i < id_count; i++)
+  {
+    key_ids[i].value = (char *) ids[i];
+    key_ids[i].size = id_lens[i];
+    payloads[i].unique_identifier = &key_ids[i];
+
+    // The server echoes each item's unique batch item ID, which ties the
+    // response items back to the request items.
+    item_id_values[4 * i] = (uint8) (i >> 24);
+    item_id_values[4 * i + 1] = (uint8) (i >> 16);
+    item_id_values[4 * i + 2] = (uint8) (i >> 8);
+    item_id_values[4 * i + 3] = (uint8) i;
+    item_ids[i].value = &item_id_values[4 * i];
+    item_ids[i].size = 4;
+
+    kmip_init_request_batch_item(&batch_items[i]);
+    batch_items[i].operation = KMIP_OP_GET;
+    batch_items[i].unique_batch_item_id = &item_ids[i];
+    batch_items[i].request_payload = &payloads[i];
+
+    buffer_total_size += id_lens[i] + 64;
+  }
+
+  ProtocolVersion protocol_version = { 0 };
+  kmip_init_protocol_version(&protocol_version, ctx->version);
+
+  RequestHeader header = { 0 };
+  kmip_init_request_header(&header);
+
+  header.protocol_version = &protocol_version;
+  header.maximum_response_size = ctx->max_message_size;
+  header.time_stamp = time(NULL);
+  header.batch_count = (int) id_count;
+
+  RequestMessage message = { 0 };
+  message.request_header = &header;
+  message.batch_items = batch_items;
+  message.batch_count = id_count;
+
+  // Encode the request, growing the buffer if the estimate fell short.
+  uint8 *encoding = NULL;
+  int result = KMIP_ERROR_BUFFER_FULL;
+
+  while (1)
+  {
+    encoding = kmyth_calloc(1, buffer_total_size);
+    if (encoding == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+      break;
+    }
+    kmip_reset(ctx);
+    kmip_set_buffer(ctx, encoding, buffer_total_size);
+    result = kmip_encode_request_message(ctx, &message);
+    if (result != KMIP_ERROR_BUFFER_FULL)
+    {
+      break;
+    }
+    kmyth_clear_and_free(encoding, buffer_total_size);
+    encoding = NULL;
+    buffer_total_size *= 2;
+  }
+
+  kmyth_free(batch_items);
+  kmyth_free(payloads);
+  kmyth_free(key_ids);
+  kmyth_free(item_ids);
+  kmyth_free(item_id_values);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to encode the KMIP batch key request.");
+    kmyth_clear_and_free(encoding, buffer_total_size);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
 
-  SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
-  KeyBlock *key_block = symmetric_key->key_block;
-  KeyValue *key_value = key_block->key_value;
-  ByteString *key_material = key_value->key_material;
+  // Set up the official request buffer and clean up.
+  *request_len = (size_t)(ctx->index - ctx->buffer);
+  *request = kmyth_calloc(*request_len, sizeof(unsigned char));
+  if (*request == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP request buffer.");
+    kmyth_clear_and_free(encoding, buffer_total_size);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+  memcpy(*request, encoding, *request_len);
 
-  // Set up the official ID and key buffers and clean up.
-  *id = calloc(payload->unique_identifier->size, sizeof(unsigned char));
-  if (*id == NULL)
+  kmyth_clear_and_free(encoding, buffer_total_size);
+  kmip_set_buffer(ctx, NULL, 0);
+
+  return 0;
+}
+
+//
+// parse_kmip_batch_get_response()
+//
+int parse_kmip_batch_get_response(KMIP * ctx,
+                                  unsigned char *response,
+                                  size_t response_len, size_t id_count,
+                                  kmip_key_result ** results)
+{
+  if (id_count == 0 || results == NULL)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
+    kmyth_log(LOG_ERR, "Invalid number of results for a KMIP batch response.");
+    return 1;
+  }
+
+  // Set up the decoding buffer and data structures.
+  kmip_reset(ctx);
+  kmip_set_buffer(ctx, response, response_len);
+  ResponseMessage message = { 0 };
+
+  // Parse the response message and handle errors.
+  int result = kmip_decode_response_message(ctx, &message);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to decode the KMIP response message.");
     kmip_free_response_message(ctx, &message);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
-  *id_len = payload->unique_identifier->size;
 
-  memcpy(*id, payload->unique_identifier->value, *id_len);
+  if (message.batch_count != id_count)
+  {
+    kmyth_log(LOG_ERR, "Received %zu responses (expected %zu).",
+              message.batch_count, id_count);
+    kmip_free_response_message(ctx, &message);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
 
-  *key = calloc(key_material->size, sizeof(unsigned char));
-  if (*key == NULL)
+  *results = kmyth_calloc(id_count, sizeof(kmip_key_result));
+  if (*results == NULL)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the key buffer.");
-    kmyth_clear_and_free(*id, *id_len);
-    *id = NULL;
-    *id_len = 0;
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP batch results.");
     kmip_free_response_message(ctx, &message);
     kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
-  *key_len = key_material->size;
-  memcpy(*key, key_material->value, *key_len);
+
+  // Items that failed are left empty; the rest are placed by the unique
+  // batch item ID the request gave them (their index).
+  for (size_t i = 0; i < message.batch_count; i++)
+  {
+    ResponseBatchItem *batch_item = &message.batch_items[i];
+    ByteString *item_id = batch_item->unique_batch_item_id;
+    size_t index = i;
+
+    if (item_id != NULL && item_id->size == 4)
+    {
+      index = ((size_t) item_id->value[0] << 24) |
+        ((size_t) item_id->value[1] << 16) |
+        ((size_t) item_id->value[2] << 8) | item_id->value[3];
+    }
+    if (index >= id_count || (*results)[index].id != NULL)
+    {
+      kmyth_log(LOG_ERR, "Received an unexpected KMIP batch item ID.");
+      free_kmip_key_results(*results, id_count);
+      *results = NULL;
+      kmip_free_response_message(ctx, &message);
+      kmip_set_buffer(ctx, NULL, 0);
+      return 1;
+    }
+
+    GetResponsePayload *payload =
+      (GetResponsePayload *) batch_item->response_payload;
+
+    if (batch_item->operation != KMIP_OP_GET ||
+        batch_item->result_status != KMIP_STATUS_SUCCESS || payload == NULL)
+    {
+      kmyth_log(LOG_ERR, "KMIP Get request %zu failed.", index);
+      continue;
+    }
+    if (payload->object_type != KMIP_OBJTYPE_SYMMETRIC_KEY)
+    {
+      kmyth_log(LOG_ERR, "KMIP object %zu is not a symmetric key.", index);
+      continue;
+    }
+
+    SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
+    ByteString *key_material =
+      symmetric_key->key_block->key_value->key_material;
+    kmip_key_result *item = &(*results)[index];
+
+    item->id =
+      kmyth_calloc(payload->unique_identifier->size, sizeof(unsigned char));
+    item->key = kmyth_calloc(key_material->size, sizeof(unsigned char));
+    if (item->id == NULL || item->key == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the ID and key buffers.");
+      free_kmip_key_results(*results, id_count);
+      *results = NULL;
+      kmip_free_response_message(ctx, &message);
+      kmip_set_buffer(ctx, NULL, 0);
+      return 1;
+    }
+    item->id_len = payload->unique_identifier->size;
+    memcpy(item->id, payload->unique_identifier->value, item->id_len);
+    item->key_len = key_material->size;
+    memcpy(item->key, key_material->value, item->key_len);
+  }
 
   kmip_free_response_message(ctx, &message);
   kmip_set_buffer(ctx, NULL, 0);
 
   return 0;
 }
+
+//
+// parse_kmip_batch_get_request()
+//
+int parse_kmip_batch_get_request(KMIP * ctx,
+                                 unsigned char *request, size_t request_len,
+                                 kmip_key_result ** ids, size_t *id_count)
+{
+  // Set up the decoding buffer and data structures.
+  kmip_reset(ctx);
+  kmip_set_buffer(ctx, request, request_len);
+  RequestMessage message = { 0 };
+
+  // Parse the request message and handle errors.
+  int result = kmip_decode_request_message(ctx, &message);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to decode the KMIP request message.");
+    kmip_free_request_message(ctx, &message);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+
+  if (message.batch_count == 0 ||
+      message.batch_count > KMYTH_KMIP_MAX_BATCH_COUNT)
+  {
+    kmyth_log(LOG_ERR, "Received %zu requests (expected 1 to %d).",
+              message.batch_count, KMYTH_KMIP_MAX_BATCH_COUNT);
+    kmip_free_request_message(ctx, &message);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+
+  *ids = kmyth_calloc(message.batch_count, sizeof(kmip_key_result));
+  if (*ids == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP batch IDs.");
+    kmip_free_request_message(ctx, &message);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+
+  for (size_t i = 0; i < message.batch_count; i++)
+  {
+    RequestBatchItem *batch_item = &message.batch_items[i];
+    GetRequestPayload *payload =
+      (GetRequestPayload *) batch_item->request_payload;
+
+    if (batch_item->operation != KMIP_OP_GET || payload == NULL ||
+        payload->unique_identifier == NULL ||
+        payload->unique_identifier->size == 0)
+    {
+      kmyth_log(LOG_ERR, "KMIP request %zu is not a Get of a key ID.", i);
+      free_kmip_key_results(*ids, message.batch_count);
+      *ids = NULL;
+      kmip_free_request_message(ctx, &message);
+      kmip_set_buffer(ctx, NULL, 0);
+      return 1;
+    }
+
+    kmip_key_result *item = &(*ids)[i];
+
+    item->id =
+      kmyth_calloc(payload->unique_identifier->size, sizeof(unsigned char));
+    if (item->id == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
+      free_kmip_key_results(*ids, message.batch_count);
+      *ids = NULL;
+      kmip_free_request_message(ctx, &message);
+      kmip_set_buffer(ctx, NULL, 0);
+      return 1;
+    }
+    item->id_len = payload->unique_identifier->size;
+    memcpy(item->id, payload->unique_identifier->value, item->id_len);
+  }
+  *id_count = message.batch_count;
+
+  kmip_free_request_message(ctx, &message);
+  kmip_set_buffer(ctx, NULL, 0);
+
+  return 0;
+}
+
+//
+// build_kmip_batch_get_response()
+//
+int build_kmip_batch_get_response(KMIP * ctx,
+                                  kmip_key_result * results, size_t count,
+                                  unsigned char **response,
+                                  size_t *response_len)
+{
+  if (results == NULL || count == 0 || count > KMYTH_KMIP_MAX_BATCH_COUNT)
+  {
+    kmyth_log(LOG_ERR, "Invalid number of keys for a KMIP batch response.");
+    return 1;
+  }
+
+  ResponseBatchItem *batch_items =
+    kmyth_calloc(count, sizeof(ResponseBatchItem));
+  GetResponsePayload *payloads =
+    kmyth_calloc(count, sizeof(GetResponsePayload));
+  TextString *key_ids = kmyth_calloc(count, sizeof(TextString));
+  SymmetricKey *symmetric_keys = kmyth_calloc(count, sizeof(SymmetricKey));
+  KeyBlock *key_blocks = kmyth_calloc(count, sizeof(KeyBlock));
+  KeyValue *key_values = kmyth_calloc(count, sizeof(KeyValue));
+  ByteString *key_materials = kmyth_calloc(count, sizeof(ByteString));
+  ByteString *item_ids = kmyth_calloc(count, sizeof(ByteString));
+  uint8 *item_id_values = kmyth_calloc(count, 4);
+
+  if (batch_items == NULL || payloads == NULL || key_ids == NULL ||
+      symmetric_keys == NULL || key_blocks == NULL || key_values == NULL ||
+      key_materials == NULL || item_ids == NULL || item_id_values == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP batch items.");
+    kmyth_free(batch_items);
+    kmyth_free(payloads);
+    kmyth_free(key_ids);
+    kmyth_free(symmetric_keys);
+    kmyth_free(key_blocks);
+    kmyth_free(key_values);
+    kmyth_free(key_materials);
+    kmyth_free(item_ids);
+    kmyth_free(item_id_values);
+    return 1;
+  }
+
+  // Each item needs roughly 160 bytes of TTLV framing around its ID and key.
+  size_t buffer_total_size = 1024;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    batch_items[i].operation = KMIP_OP_GET;
+
+    // A single item answers a plain Get, which has no batch item ID.
+    if (count > 1)
+    {
+      item_id_values[4 * i] = (uint8) (i >> 24);
+      item_id_values[4 * i + 1] = (uint8) (i >> 16);
+      item_id_values[4 * i + 2] = (uint8) (i >> 8);
+      item_id_values[4 * i + 3] = (uint8) i;
+      item_ids[i].value = &item_id_values[4 * i];
+      item_ids[i].size = 4;
+      batch_items[i].unique_batch_item_id = &item_ids[i];
+    }
+
+    if (results[i].key == NULL)
+    {
+      batch_items[i].result_status = KMIP_STATUS_OPERATION_FAILED;
+      batch_items[i].result_reason = KMIP_REASON_ITEM_NOT_FOUND;
+      buffer_total_size += 64;
+      continue;
+    }
+
+    key_materials[i].value = results[i].key;
+    key_materials[i].size = results[i].key_len;
+    key_values[i].key_material = &key_materials[i];
+    key_blocks[i].key_format_type = KMIP_KEYFORMAT_RAW;
+    key_blocks[i].key_value = &key_values[i];
+    symmetric_keys[i].key_block = &key_blocks[i];
+    key_ids[i].value = (char *) results[i].id;
+    key_ids[i].size = results[i].id_len;
+
+    payloads[i].object_type = KMIP_OBJTYPE_SYMMETRIC_KEY;
+    payloads[i].unique_identifier = &key_ids[i];
+    payloads[i].object = &symmetric_keys[i];
+
+    batch_items[i].result_status = KMIP_STATUS_SUCCESS;
+    batch_items[i].response_payload = &payloads[i];
+
+    buffer_total_size += results[i].id_len + results[i].key_len + 160;
+  }
+
+  ProtocolVersion protocol_version = { 0 };
+  kmip_init_protocol_version(&protocol_version, ctx->version);
+
+  ResponseHeader header = { 0 };
+  kmip_init_response_header(&header);
+
+  header.protocol_version = &protocol_version;
+  header.time_stamp = time(NULL);
+  header.batch_count = (int) count;
+
+  ResponseMessage message = { 0 };
+  message.response_header = &header;
+  message.batch_items = batch_items;
+  message.batch_count = count;
+
+  // Encode the response, growing the buffer if the estimate fell short.
+  uint8 *encoding = NULL;
+  int result = KMIP_ERROR_BUFFER_FULL;
+
+  while (1)
+  {
+    encoding = kmyth_calloc(1, buffer_total_size);
+    if (encoding == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+      break;
+    }
+    kmip_reset(ctx);
+    kmip_set_buffer(ctx, encoding, buffer_total_size);
+    result = kmip_encode_response_message(ctx, &message);
+    if (result != KMIP_ERROR_BUFFER_FULL)
+    {
+      break;
+    }
+    kmyth_clear_and_free(encoding, buffer_total_size);
+    encoding = NULL;
+    buffer_total_size *= 2;
+  }
+
+  kmyth_free(batch_items);
+  kmyth_free(payloads);
+  kmyth_free(key_ids);
+  kmyth_free(symmetric_keys);
+  kmyth_free(key_blocks);
+  kmyth_free(key_values);
+  kmyth_free(key_materials);
+  kmyth_free(item_ids);
+  kmyth_free(item_id_values);
+
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to encode the KMIP batch Get response.");
+    kmyth_clear_and_free(encoding, buffer_total_size);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+
+  // Set up the official response buffer and clean up.
+  *response_len = (size_t)(ctx->index - ctx->buffer);
+  *response = kmyth_calloc(*response_len, sizeof(unsigned char));
+  if (*response == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP response buffer.");
+    kmyth_clear_and_free(encoding, buffer_total_size);
+    kmip_set_buffer(ctx, NULL, 0);
+    return 1;
+  }
+  memcpy(*response, encoding, *response_len);
+
+  kmyth_clear_and_free(encoding, buffer_total_size);
+  kmip_set_buffer(ctx, NULL, 0);
+
+  return 0;
+}
+
+//
+// free_kmip_key_results()
+//
+void free_kmip_key_results(kmip_key_result * results, size_t count)
+{
+  if (results == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    kmyth_free(results[i].id);
+    kmyth_clear_and_free(results[i].key, results[i].key_len);
+  }
+  kmyth_free(results);
+}
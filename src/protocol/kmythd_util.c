@@ -0,0 +1,231 @@
+//
+// Message framing and encoding for the kmythd local socket protocol.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include "defines.h"
+#include "kmythd_util.h"
+#include "memory_util.h"
+
+//
+// write_all()
+//
+static int write_all(int socket_fd, const uint8_t * buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(socket_fd, buf, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    buf += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+//
+// read_all()
+//
+static int read_all(int socket_fd, uint8_t * buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = read(socket_fd, buf, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    buf += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+//
+// kmythd_send_msg()
+//
+int kmythd_send_msg(int socket_fd, const uint8_t * msg, size_t msg_len)
+{
+  if (msg_len > KMYTHD_MAX_MSG_LEN || (msg == NULL && msg_len > 0))
+  {
+    kmyth_log(LOG_ERR, "Invalid kmythd message.");
+    return 1;
+  }
+
+  uint32_t len_be = htonl((uint32_t) msg_len);
+
+  if (write_all(socket_fd, (uint8_t *) & len_be, sizeof(len_be)) ||
+      write_all(socket_fd, msg, msg_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to send kmythd message.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// kmythd_recv_msg()
+//
+int kmythd_recv_msg(int socket_fd, uint8_t ** msg, size_t *msg_len)
+{
+  uint32_t len_be = 0;
+
+  *msg = NULL;
+  *msg_len = 0;
+  if (read_all(socket_fd, (uint8_t *) & len_be, sizeof(len_be)))
+  {
+    kmyth_log(LOG_ERR, "Failed to receive kmythd message length.");
+    return 1;
+  }
+
+  size_t len = ntohl(len_be);
+
+  if (len > KMYTHD_MAX_MSG_LEN)
+  {
+    kmyth_log(LOG_ERR, "kmythd message too long (%zu bytes).", len);
+    return 1;
+  }
+
+  // always allocate, so an empty message still returns a buffer
+  *msg = kmyth_malloc(len + 1);
+  if (*msg == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate kmythd message buffer.");
+    return 1;
+  }
+
+  if (read_all(socket_fd, *msg, len))
+  {
+    kmyth_log(LOG_ERR, "Failed to receive kmythd message.");
+    kmyth_free(*msg);
+    *msg = NULL;
+    return 1;
+  }
+
+  *msg_len = len;
+  return 0;
+}
+
+//
+// kmythd_build_unseal_request()
+//
+int kmythd_build_unseal_request(const uint8_t * ski, size_t ski_len,
+                                const uint8_t * auth, size_t auth_len,
+                                const uint8_t * oa, size_t oa_len,
+                                uint8_t flags,
+                                uint8_t ** req, size_t *req_len)
+{
+  *req = NULL;
+  *req_len = 0;
+
+  size_t len = 1 + 3 * sizeof(uint32_t) + ski_len + auth_len + oa_len;
+
+  if (ski == NULL || ski_len == 0 || len > KMYTHD_MAX_MSG_LEN ||
+      (auth == NULL && auth_len > 0) || (oa == NULL && oa_len > 0))
+  {
+    kmyth_log(LOG_ERR, "Invalid kmythd unseal request.");
+    return 1;
+  }
+
+  uint8_t *buf = kmyth_malloc(len);
+
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate kmythd unseal request.");
+    return 1;
+  }
+
+  const uint8_t *fields[3] = { ski, auth, oa };
+  size_t field_lens[3] = { ski_len, auth_len, oa_len };
+  size_t offset = 0;
+
+  buf[offset++] = flags;
+  for (int i = 0; i < 3; i++)
+  {
+    uint32_t len_be = htonl((uint32_t) field_lens[i]);
+
+    memcpy(buf + offset, &len_be, sizeof(len_be));
+    offset += sizeof(len_be);
+    if (field_lens[i] > 0)
+    {
+      memcpy(buf + offset, fields[i], field_lens[i]);
+      offset += field_lens[i];
+    }
+  }
+
+  *req = buf;
+  *req_len = len;
+  return 0;
+}
+
+//
+// kmythd_parse_unseal_request()
+//
+int kmythd_parse_unseal_request(uint8_t * req, size_t req_len,
+                                uint8_t ** ski, size_t *ski_len,
+                                uint8_t ** auth, size_t *auth_len,
+                                uint8_t ** oa, size_t *oa_len,
+                                uint8_t * flags)
+{
+  uint8_t **fields[3] = { ski, auth, oa };
+  size_t *field_lens[3] = { ski_len, auth_len, oa_len };
+  size_t offset = 0;
+
+  if (req == NULL || req_len < 1)
+  {
+    kmyth_log(LOG_ERR, "Malformed kmythd unseal request.");
+    return 1;
+  }
+  *flags = req[offset++];
+
+  for (int i = 0; i < 3; i++)
+  {
+    uint32_t len_be = 0;
+
+    if (req_len - offset < sizeof(len_be))
+    {
+      kmyth_log(LOG_ERR, "Malformed kmythd unseal request.");
+      return 1;
+    }
+    memcpy(&len_be, req + offset, sizeof(len_be));
+    offset += sizeof(len_be);
+
+    size_t len = ntohl(len_be);
+
+    if (req_len - offset < len)
+    {
+      kmyth_log(LOG_ERR, "Malformed kmythd unseal request.");
+      return 1;
+    }
+    *fields[i] = (len > 0) ? req + offset : NULL;
+    *field_lens[i] = len;
+    offset += len;
+  }
+
+  if (offset != req_len || *ski_len == 0)
+  {
+    kmyth_log(LOG_ERR, "Malformed kmythd unseal request.");
+    return 1;
+  }
+
+  return 0;
+}
@@ -2,11 +2,16 @@
 // An implementation of the Needham-Schroeder-Lowe protocol using OpenSSL RSA.
 // 
 
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netdb.h>
 
+#include <openssl/crypto.h>
 #include <openssl/ec.h>
 #include <openssl/evp.h>
 #include <openssl/aes.h>
@@ -17,38 +22,221 @@
 #include <openssl/engine.h>
 
 #include "defines.h"
+#include "kmyth_usdt.h"
 #include "memory_util.h"
+#include "aes_gcm.h"
+#include "metrics.h"
+#include "nsl_util.h"
 
 #define NSL_NONCE_LEN 32
 #define NSL_SESSION_KEY_LEN 32
 
+// Length of the header (type, sender, sequence number) sealed at the start
+// of every session record
+#define NSL_RECORD_HEADER_LEN 10
+
+// Prepared RSA contexts kept per thread (see get_prepared_ctx())
+#define NSL_PKEY_CTX_CACHE_SIZE 8
+
+/**
+ * @brief A public key context initialized for one operation (encrypt or
+ *        decrypt) with its padding set, ready to use over and over.
+ *        The entry holds a reference to the key, so the key's address
+ *        cannot be reused for another key while it is cached.
+ */
+typedef struct nsl_prepared_ctx
+{
+  EVP_PKEY *pkey;
+  int decrypt;
+  EVP_PKEY_CTX *ctx;
+} nsl_prepared_ctx;
+
+static pthread_key_t nsl_ctx_cache_key;
+static pthread_once_t nsl_ctx_cache_once = PTHREAD_ONCE_INIT;
+static int nsl_ctx_cache_ok = 0;
+
+/**
+ * @brief Random bytes drawn ahead of time for nonces, refilled by a
+ *        background thread (see nsl_nonce_pool_start())
+ */
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  bool running;
+  bool stopping;
+  pid_t pid;
+  size_t len;
+  unsigned char bytes[NSL_NONCE_POOL_LEN];
+} nsl_nonce_pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
 //
-// encrypt_with_key_pair()
+// free_ctx_cache()
 //
-int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
-                          const unsigned char *p, size_t p_len,
-                          unsigned char **c, size_t *c_len)
+static void free_ctx_cache(void *arg)
 {
-  // Initialize the context for encryption.
-  int result = EVP_PKEY_encrypt_init(ctx);
+  nsl_prepared_ctx *cache = (nsl_prepared_ctx *) arg;
 
-  if (result == 0)
+  for (size_t i = 0; i < NSL_PKEY_CTX_CACHE_SIZE; i++)
   {
-    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for encryption.");
-    return 1;
+    EVP_PKEY_CTX_free(cache[i].ctx);
+    EVP_PKEY_free(cache[i].pkey);
+  }
+  kmyth_free(cache);
+}
+
+//
+// create_ctx_cache_key()
+//
+static void create_ctx_cache_key(void)
+{
+  nsl_ctx_cache_ok = (pthread_key_create(&nsl_ctx_cache_key,
+                                         free_ctx_cache) == 0);
+}
+
+//
+// prepare_ctx()
+//
+// A new context for pkey, initialized for the operation. RSA keys use OAEP
+// (SHA-256, with MGF1 over SHA-256).
+//
+static EVP_PKEY_CTX *prepare_ctx(EVP_PKEY * pkey, int decrypt)
+{
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to create an EVP context.");
+    return NULL;
   }
 
-  // Determine the length of the ciphertext buffer.
-  result = EVP_PKEY_encrypt(ctx, NULL, c_len, p, p_len);
+  int result = decrypt ? EVP_PKEY_decrypt_init(ctx)
+    : EVP_PKEY_encrypt_init(ctx);
+
   if (result <= 0)
   {
-    kmyth_log(LOG_ERR,
-              "Failed to determine the length of the ciphertext buffer.");
+    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for %s.",
+              decrypt ? "decryption" : "encryption");
+    EVP_PKEY_CTX_free(ctx);
+    return NULL;
+  }
+
+  if (EVP_PKEY_base_id(pkey) == EVP_PKEY_RSA
+      && (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) <= 0
+          || EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) <= 0
+          || EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) <= 0))
+  {
+    kmyth_log(LOG_ERR, "Failed to set RSA-OAEP padding.");
+    EVP_PKEY_CTX_free(ctx);
+    return NULL;
+  }
+
+  return ctx;
+}
+
+//
+// get_prepared_ctx()
+//
+// The calling thread's prepared context for the key of ctx and the given
+// operation, so that each call does not redo the initialization and
+// padding setup. An EVP_PKEY_CTX must not be used by two threads at once;
+// keeping these per thread lets a server's threads share the contexts
+// they were given.
+//
+static EVP_PKEY_CTX *get_prepared_ctx(EVP_PKEY_CTX * ctx, int decrypt)
+{
+  EVP_PKEY *pkey = EVP_PKEY_CTX_get0_pkey(ctx);
+
+  if (pkey == NULL)
+  {
+    kmyth_log(LOG_ERR, "The EVP context has no key.");
+    return NULL;
+  }
+
+  pthread_once(&nsl_ctx_cache_once, create_ctx_cache_key);
+
+  nsl_prepared_ctx *cache = NULL;
+
+  if (nsl_ctx_cache_ok)
+  {
+    cache = pthread_getspecific(nsl_ctx_cache_key);
+    if (cache == NULL)
+    {
+      cache = kmyth_calloc(NSL_PKEY_CTX_CACHE_SIZE, sizeof(nsl_prepared_ctx));
+      if (cache != NULL && pthread_setspecific(nsl_ctx_cache_key, cache))
+      {
+        kmyth_free(cache);
+        cache = NULL;
+      }
+    }
+  }
+  if (cache == NULL)
+  {
+    kmyth_log(LOG_ERR, "No EVP context cache for this thread.");
+    return NULL;
+  }
+
+  // Entries are kept most recently used first
+  size_t i = 0;
+
+  while (i < NSL_PKEY_CTX_CACHE_SIZE
+         && !(cache[i].pkey == pkey && cache[i].decrypt == decrypt))
+  {
+    i++;
+  }
+
+  nsl_prepared_ctx entry = { 0 };
+
+  if (i < NSL_PKEY_CTX_CACHE_SIZE)
+  {
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_NSL_PKEY_CTX, 1);
+    entry = cache[i];
+  }
+  else
+  {
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_NSL_PKEY_CTX, 0);
+    entry.ctx = prepare_ctx(pkey, decrypt);
+    if (entry.ctx == NULL)
+    {
+      return NULL;
+    }
+    EVP_PKEY_up_ref(pkey);
+    entry.pkey = pkey;
+    entry.decrypt = decrypt;
+
+    // Evict the least recently used entry
+    i = NSL_PKEY_CTX_CACHE_SIZE - 1;
+    EVP_PKEY_CTX_free(cache[i].ctx);
+    EVP_PKEY_free(cache[i].pkey);
+  }
+
+  memmove(&cache[1], &cache[0], i * sizeof(nsl_prepared_ctx));
+  cache[0] = entry;
+
+  return entry.ctx;
+}
+
+//
+// encrypt_with_key_pair()
+//
+int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
+                          const unsigned char *p, size_t p_len,
+                          unsigned char **c, size_t *c_len)
+{
+  EVP_PKEY_CTX *prepared = get_prepared_ctx(ctx, 0);
+
+  if (prepared == NULL)
+  {
     return 1;
   }
 
-  // Allocate the ciphertext buffer.
-  *c = calloc(*c_len, sizeof(unsigned char));
+  // The ciphertext is one block of the key's size.
+  *c_len = (size_t) EVP_PKEY_size(EVP_PKEY_CTX_get0_pkey(prepared));
+  *c = kmyth_calloc(*c_len, sizeof(unsigned char));
   if (*c == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the ciphertext buffer.");
@@ -56,10 +244,14 @@ int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
   }
 
   // Encrypt the plaintext.
-  result = EVP_PKEY_encrypt(ctx, *c, c_len, p, p_len);
-  if (result <= 0)
+  size_t buf_len = *c_len;
+
+  if (EVP_PKEY_encrypt(prepared, *c, c_len, p, p_len) <= 0)
   {
     kmyth_log(LOG_ERR, "Failed to encrypt the plaintext.");
+    kmyth_clear_and_free(*c, buf_len);
+    *c = NULL;
+    *c_len = 0;
     return 1;
   }
 
@@ -73,26 +265,16 @@ int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *c, size_t c_len,
                           unsigned char **p, size_t *p_len)
 {
-  // Initialize the context for decryption.
-  int result = EVP_PKEY_decrypt_init(ctx);
-
-  if (result == 0)
-  {
-    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for decryption.");
-    return 1;
-  }
+  EVP_PKEY_CTX *prepared = get_prepared_ctx(ctx, 1);
 
-  // Determine the length of the plaintext buffer.
-  result = EVP_PKEY_decrypt(ctx, NULL, p_len, c, c_len);
-  if (result <= 0)
+  if (prepared == NULL)
   {
-    kmyth_log(LOG_ERR,
-              "Failed to determine the length of the plaintext buffer.");
     return 1;
   }
 
-  // Allocate the plaintext buffer.
-  *p = calloc(*p_len, sizeof(unsigned char));
+  // The plaintext is shorter than the one ciphertext block.
+  *p_len = (size_t) EVP_PKEY_size(EVP_PKEY_CTX_get0_pkey(prepared));
+  *p = kmyth_calloc(*p_len, sizeof(unsigned char));
   if (*p == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the plaintext buffer.");
@@ -100,10 +282,14 @@ int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
   }
 
   // Decrypt the ciphertext.
-  result = EVP_PKEY_decrypt(ctx, *p, p_len, c, c_len);
-  if (result <= 0)
+  size_t buf_len = *p_len;
+
+  if (EVP_PKEY_decrypt(prepared, *p, p_len, c, c_len) <= 0)
   {
     kmyth_log(LOG_ERR, "Failed to decrypt the ciphertext.");
+    kmyth_clear_and_free(*p, buf_len);
+    *p = NULL;
+    *p_len = 0;
     return 1;
   }
 
@@ -132,7 +318,7 @@ int build_nonce_request(EVP_PKEY_CTX * ctx,
   unsigned char *message = NULL;
   size_t message_len = id_len + nonce_len + (2 * sizeof(size_t));
 
-  message = calloc(message_len, sizeof(unsigned char));
+  message = kmyth_calloc(message_len, sizeof(unsigned char));
   if (message == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
@@ -190,7 +376,7 @@ int parse_nonce_request(EVP_PKEY_CTX * ctx,
   // Parse out the nonce.
   memcpy(nonce_len, index, sizeof(size_t));
   index += sizeof(size_t);
-  *nonce = calloc(*nonce_len, sizeof(unsigned char));
+  *nonce = kmyth_calloc(*nonce_len, sizeof(unsigned char));
   if (*nonce == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the nonce buffer.");
@@ -207,7 +393,7 @@ int parse_nonce_request(EVP_PKEY_CTX * ctx,
   // Parse out the ID.
   memcpy(id_len, index, sizeof(size_t));
   index += sizeof(size_t);
-  *id = calloc(*id_len, sizeof(unsigned char));
+  *id = kmyth_calloc(*id_len, sizeof(unsigned char));
   if (*id == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
@@ -242,7 +428,7 @@ int build_nonce_response(EVP_PKEY_CTX * ctx,
   unsigned char *message = NULL;
   size_t message_len =
     id_len + nonce_a_len + nonce_b_len + (3 * sizeof(size_t));
-  message = calloc(message_len, sizeof(unsigned char));
+  message = kmyth_calloc(message_len, sizeof(unsigned char));
   if (message == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
@@ -318,7 +504,7 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
     kmyth_clear_and_free(message, message_len);
     return 1;
   }
-  *nonce_a = calloc(*nonce_a_len, sizeof(unsigned char));
+  *nonce_a = kmyth_calloc(*nonce_a_len, sizeof(unsigned char));
   if (*nonce_a == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the first nonce buffer.");
@@ -349,7 +535,7 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
 
     return 1;
   }
-  *nonce_b = calloc(*nonce_b_len, sizeof(unsigned char));
+  *nonce_b = kmyth_calloc(*nonce_b_len, sizeof(unsigned char));
   if (*nonce_b == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the second nonce buffer.");
@@ -370,7 +556,7 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
   // Parse out the ID.
   memcpy(id_len, index, sizeof(size_t));
   index += sizeof(size_t);
-  *id = calloc(*id_len, sizeof(unsigned char));
+  *id = kmyth_calloc(*id_len, sizeof(unsigned char));
   if (*id == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
@@ -416,7 +602,7 @@ int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
   unsigned char *message = NULL;
   size_t message_len = nonce_len + sizeof(size_t);
 
-  message = calloc(message_len, sizeof(unsigned char));
+  message = kmyth_calloc(message_len, sizeof(unsigned char));
   if (message == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
@@ -472,7 +658,7 @@ int parse_nonce_confirmation(EVP_PKEY_CTX * ctx,
   // Parse out the nonce.
   memcpy(nonce_len, index, sizeof(size_t));
   index += sizeof(size_t);
-  *nonce = calloc(*nonce_len, sizeof(unsigned char));
+  *nonce = kmyth_calloc(*nonce_len, sizeof(unsigned char));
   if (*nonce == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to allocate the nonce buffer.");
@@ -607,7 +793,7 @@ int generate_session_key(unsigned char *nonce_a, size_t nonce_a_len,
 
   // Build the combined nonce as the base for key generation.
   size_t len = nonce_a_len + nonce_b_len;
-  unsigned char *nonces = calloc(len, sizeof(unsigned char));
+  unsigned char *nonces = kmyth_calloc(len, sizeof(unsigned char));
 
   if (NULL == nonces)
   {
@@ -660,7 +846,7 @@ int generate_session_key(unsigned char *nonce_a, size_t nonce_a_len,
     return 1;
   }
 
-  *key = calloc(EVP_MAX_MD_SIZE, sizeof(unsigned char));
+  *key = kmyth_calloc(EVP_MAX_MD_SIZE, sizeof(unsigned char));
   if (NULL == key)
   {
     kmyth_log(LOG_ERR, "Failed to allocated the key buffer.");
@@ -695,6 +881,134 @@ int generate_session_key(unsigned char *nonce_a, size_t nonce_a_len,
   return 0;
 }
 
+//
+// nonce_pool_main()
+//
+static void *nonce_pool_main(void *arg)
+{
+  (void) arg;
+
+  pthread_mutex_lock(&nsl_nonce_pool.lock);
+  while (!nsl_nonce_pool.stopping)
+  {
+    if (nsl_nonce_pool.len >= NSL_NONCE_POOL_LEN / 2)
+    {
+      pthread_cond_wait(&nsl_nonce_pool.cond, &nsl_nonce_pool.lock);
+      continue;
+    }
+
+    // Draw the refill outside the lock, in one call
+    size_t want = NSL_NONCE_POOL_LEN - nsl_nonce_pool.len;
+    unsigned char fill[NSL_NONCE_POOL_LEN];
+
+    pthread_mutex_unlock(&nsl_nonce_pool.lock);
+    int ok = RAND_bytes(fill, (int) want);
+
+    pthread_mutex_lock(&nsl_nonce_pool.lock);
+
+    if (ok != 1)
+    {
+      kmyth_log(LOG_ERR, "Failed to refill the nonce pool.");
+      break;
+    }
+
+    // Others may have drawn from the pool meanwhile; it never grows
+    // except here, so the refill still fits
+    memcpy(nsl_nonce_pool.bytes + nsl_nonce_pool.len, fill, want);
+    nsl_nonce_pool.len += want;
+    OPENSSL_cleanse(fill, want);
+  }
+  pthread_mutex_unlock(&nsl_nonce_pool.lock);
+
+  return NULL;
+}
+
+//
+// nsl_nonce_pool_start()
+//
+int nsl_nonce_pool_start(void)
+{
+  pthread_mutex_lock(&nsl_nonce_pool.lock);
+  if (nsl_nonce_pool.running)
+  {
+    pthread_mutex_unlock(&nsl_nonce_pool.lock);
+    return 0;
+  }
+  nsl_nonce_pool.stopping = false;
+  nsl_nonce_pool.pid = getpid();
+  nsl_nonce_pool.len = 0;
+  if (pthread_create(&nsl_nonce_pool.thread, NULL, nonce_pool_main, NULL))
+  {
+    pthread_mutex_unlock(&nsl_nonce_pool.lock);
+    kmyth_log(LOG_ERR, "Failed to start the nonce pool thread.");
+    return 1;
+  }
+  nsl_nonce_pool.running = true;
+  pthread_mutex_unlock(&nsl_nonce_pool.lock);
+
+  return 0;
+}
+
+//
+// nsl_nonce_pool_stop()
+//
+void nsl_nonce_pool_stop(void)
+{
+  pthread_mutex_lock(&nsl_nonce_pool.lock);
+  if (!nsl_nonce_pool.running)
+  {
+    pthread_mutex_unlock(&nsl_nonce_pool.lock);
+    return;
+  }
+  nsl_nonce_pool.stopping = true;
+  pthread_cond_signal(&nsl_nonce_pool.cond);
+  pthread_mutex_unlock(&nsl_nonce_pool.lock);
+
+  pthread_join(nsl_nonce_pool.thread, NULL);
+
+  pthread_mutex_lock(&nsl_nonce_pool.lock);
+  OPENSSL_cleanse(nsl_nonce_pool.bytes, sizeof(nsl_nonce_pool.bytes));
+  nsl_nonce_pool.len = 0;
+  nsl_nonce_pool.running = false;
+  pthread_mutex_unlock(&nsl_nonce_pool.lock);
+}
+
+//
+// take_pooled_nonce()
+//
+// Moves len bytes from the pool into buf. Returns 1 if the pool is not
+// running or cannot supply them.
+//
+static int take_pooled_nonce(unsigned char *buf, size_t len)
+{
+  int result = 1;
+
+  pthread_mutex_lock(&nsl_nonce_pool.lock);
+
+  // A forked child must not hand out the bytes its parent will also use
+  if (nsl_nonce_pool.running && nsl_nonce_pool.pid != getpid())
+  {
+    OPENSSL_cleanse(nsl_nonce_pool.bytes, sizeof(nsl_nonce_pool.bytes));
+    nsl_nonce_pool.len = 0;
+    nsl_nonce_pool.running = false;
+  }
+
+  if (nsl_nonce_pool.running && nsl_nonce_pool.len >= len)
+  {
+    nsl_nonce_pool.len -= len;
+    memcpy(buf, nsl_nonce_pool.bytes + nsl_nonce_pool.len, len);
+    OPENSSL_cleanse(nsl_nonce_pool.bytes + nsl_nonce_pool.len, len);
+    result = 0;
+  }
+  if (nsl_nonce_pool.running && nsl_nonce_pool.len < NSL_NONCE_POOL_LEN / 2)
+  {
+    pthread_cond_signal(&nsl_nonce_pool.cond);
+  }
+
+  pthread_mutex_unlock(&nsl_nonce_pool.lock);
+  return result;
+}
+
 //
 // generate_nonce()
 //
@@ -709,36 +1023,38 @@ int generate_nonce(size_t desired_min_nonce_len, unsigned char **nonce,
   }
 
   *nonce_len = size * sizeof(int);
-  unsigned int *buffer = calloc(size, sizeof(int));
+  unsigned char *buffer = kmyth_calloc(size, sizeof(int));
 
   if (NULL == buffer)
   {
     kmyth_log(LOG_ERR, "Failed to allocated the nonce buffer.");
     return 1;
   }
-  unsigned int *index = buffer;
 
-  for (size_t i = 0; i < size; i++)
+  // Take the bytes from the pool if it has them, else draw them now
+  if (take_pooled_nonce(buffer, *nonce_len)
+      && RAND_bytes(buffer, (int) *nonce_len) != 1)
   {
-    *index = (unsigned int)rand();
-    index += 1;
+    kmyth_log(LOG_ERR, "Failed to generate random nonce bytes.");
+    kmyth_free(buffer);
+    return 1;
   }
 
-  *nonce = (unsigned char *) buffer;
+  *nonce = buffer;
   return 0;
 }
 
 //
-// negotiate_client_session_key()
+// negotiate_client_session_key_impl()
 //
-int negotiate_client_session_key(int socket_fd,
-                                 EVP_PKEY_CTX * public_key_ctx,
-                                 EVP_PKEY_CTX * private_key_ctx,
-                                 unsigned char *id, size_t id_len,
-                                 unsigned char *expected_id,
-                                 size_t expected_id_len,
-                                 unsigned char **session_key,
-                                 size_t *session_key_len)
+static int negotiate_client_session_key_impl(int socket_fd,
+                                             EVP_PKEY_CTX * public_key_ctx,
+                                             EVP_PKEY_CTX * private_key_ctx,
+                                             unsigned char *id, size_t id_len,
+                                             unsigned char *expected_id,
+                                             size_t expected_id_len,
+                                             unsigned char **session_key,
+                                             size_t *session_key_len)
 {
   // Generate nonce A
   unsigned char *nonce_a = NULL;
@@ -759,7 +1075,7 @@ int negotiate_client_session_key(int socket_fd,
   unsigned char *request = NULL;
   size_t request_len = 0;
 
-  unsigned char *response = calloc(8192, sizeof(unsigned char));
+  unsigned char *response = kmyth_calloc(8192, sizeof(unsigned char));
 
   if (NULL == response)
   {
@@ -786,6 +1102,7 @@ int negotiate_client_session_key(int socket_fd,
   {
     kmyth_log(LOG_ERR, "Failed to fully send nonce request message.");
     kmyth_clear_and_free(nonce_a, nonce_a_len);
+    kmyth_clear_and_free(request, request_len);
     kmyth_clear_and_free(response, response_len);
     return 1;
   }
@@ -798,6 +1115,7 @@ int negotiate_client_session_key(int socket_fd,
   {
     kmyth_log(LOG_ERR, "Failed to read the nonce response message.");
     kmyth_clear_and_free(nonce_a, nonce_a_len);
+    kmyth_clear_and_free(request, request_len);
     kmyth_clear_and_free(response, response_len);
     return 1;
   }
@@ -919,20 +1237,59 @@ int negotiate_client_session_key(int socket_fd,
 }
 
 //
-// negotiate_server_session_key()
+// negotiate_client_session_key()
 //
-int negotiate_server_session_key(int socket_fd,
+int negotiate_client_session_key(int socket_fd,
                                  EVP_PKEY_CTX * public_key_ctx,
                                  EVP_PKEY_CTX * private_key_ctx,
                                  unsigned char *id, size_t id_len,
+                                 unsigned char *expected_id,
+                                 size_t expected_id_len,
                                  unsigned char **session_key,
                                  size_t *session_key_len)
 {
-  // Generate nonce B
-  unsigned char *nonce_b = NULL;
-  size_t nonce_b_len = 0;
+  kmyth_log_span span;
+
+  kmyth_log_span_begin(&span, "negotiate_client_session_key");
+  KMYTH_PROBE1(nsl_client_handshake__entry, socket_fd);
+
+  int retval = negotiate_client_session_key_impl(socket_fd,
+                                                 public_key_ctx,
+                                                 private_key_ctx,
+                                                 id, id_len,
+                                                 expected_id,
+                                                 expected_id_len,
+                                                 session_key,
+                                                 session_key_len);
+
+  KMYTH_PROBE1(nsl_client_handshake__return, retval);
+  kmyth_log_span_end(&span, retval);
+  return retval;
+}
+
+//
+// nsl_server_handshake_respond_impl()
+//
+static int nsl_server_handshake_respond_impl(EVP_PKEY_CTX * public_key_ctx,
+                                             EVP_PKEY_CTX * private_key_ctx,
+                                             unsigned char *id,
+                                             size_t id_len,
+                                             unsigned char *request,
+                                             size_t request_len,
+                                             unsigned char **nonce_a,
+                                             size_t *nonce_a_len,
+                                             unsigned char **nonce_b,
+                                             size_t *nonce_b_len,
+                                             unsigned char **response,
+                                             size_t *response_len)
+{
+  *nonce_a = NULL;
+  *nonce_a_len = 0;
+  *nonce_b = NULL;
+  *nonce_b_len = 0;
 
-  int result = generate_nonce(NSL_NONCE_LEN, &nonce_b, &nonce_b_len);
+  // Generate nonce B
+  int result = generate_nonce(NSL_NONCE_LEN, nonce_b, nonce_b_len);
 
   if (result)
   {
@@ -940,143 +1297,597 @@ int negotiate_server_session_key(int socket_fd,
     return 1;
   }
 
-  // Conduct NSL to obtain nonce A
-  unsigned char *response = calloc(8192, sizeof(unsigned char));
+  unsigned char *received_id = NULL;
+  size_t received_id_len = 0;
 
-  if (NULL == response)
+  result = parse_nonce_request(private_key_ctx,
+                               request, request_len,
+                               nonce_a, nonce_a_len,
+                               &received_id, &received_id_len);
+  if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the response buffer.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
+    kmyth_log(LOG_ERR, "Failed to parse the nonce request.");
+    kmyth_clear_and_free(*nonce_b, *nonce_b_len);
+    *nonce_b = NULL;
+    *nonce_b_len = 0;
     return 1;
   }
-  size_t response_len = 8192;
 
-  ssize_t read_result = read(socket_fd, response, response_len);
+  kmyth_log(LOG_DEBUG, "Received nonce A: %zd bytes", *nonce_a_len);
+  kmyth_log(LOG_DEBUG, "Received ID: %.*s", received_id_len, received_id);
 
-  if (read_result <= 0)
+  kmyth_clear_and_free(received_id, received_id_len);
+
+  kmyth_log(LOG_DEBUG, "Sending nonce B: %zd", *nonce_b_len);
+
+  result = build_nonce_response(public_key_ctx,
+                                *nonce_a, *nonce_a_len,
+                                *nonce_b, *nonce_b_len,
+                                id, id_len, response, response_len);
+  if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to receive the nonce request.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(response, response_len);
+    kmyth_log(LOG_ERR, "Failed to build the nonce response.");
+    kmyth_clear_and_free(*nonce_b, *nonce_b_len);
+    kmyth_clear_and_free(*nonce_a, *nonce_a_len);
+    *nonce_a = NULL;
+    *nonce_a_len = 0;
+    *nonce_b = NULL;
+    *nonce_b_len = 0;
     return 1;
   }
 
-  unsigned char *received_nonce_a = NULL;
-  size_t received_nonce_a_len = 0;
+  return 0;
+}
 
-  unsigned char *received_id = NULL;
-  size_t received_id_len = 0;
+//
+// nsl_server_handshake_respond()
+//
+int nsl_server_handshake_respond(EVP_PKEY_CTX * public_key_ctx,
+                                 EVP_PKEY_CTX * private_key_ctx,
+                                 unsigned char *id, size_t id_len,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char **nonce_a, size_t *nonce_a_len,
+                                 unsigned char **nonce_b, size_t *nonce_b_len,
+                                 unsigned char **response,
+                                 size_t *response_len)
+{
+  KMYTH_PROBE1(nsl_server_respond__entry, request_len);
+
+  int retval = nsl_server_handshake_respond_impl(public_key_ctx,
+                                                 private_key_ctx,
+                                                 id, id_len,
+                                                 request, request_len,
+                                                 nonce_a, nonce_a_len,
+                                                 nonce_b, nonce_b_len,
+                                                 response, response_len);
+
+  KMYTH_PROBE1(nsl_server_respond__return, retval);
+  return retval;
+}
 
-  // read_result can safely be cast to size_t because we've already
-  // dealt with the case that it's negative.
-  result = parse_nonce_request(private_key_ctx,
-                               response, (size_t)read_result,
-                               &received_nonce_a, &received_nonce_a_len,
-                               &received_id, &received_id_len);
+//
+// nsl_server_handshake_finish_impl()
+//
+static int nsl_server_handshake_finish_impl(EVP_PKEY_CTX * private_key_ctx,
+                                            unsigned char *confirmation,
+                                            size_t confirmation_len,
+                                            unsigned char *nonce_a,
+                                            size_t nonce_a_len,
+                                            unsigned char *nonce_b,
+                                            size_t nonce_b_len,
+                                            unsigned char **session_key,
+                                            size_t *session_key_len)
+{
+  unsigned char *received_nonce_b = NULL;
+  size_t received_nonce_b_len = 0;
 
-  kmyth_log(LOG_DEBUG, "Received nonce A: %zd bytes", received_nonce_a_len);
-  kmyth_log(LOG_DEBUG, "Received ID: %.*s", received_id_len, received_id);
+  int result = parse_nonce_confirmation(private_key_ctx,
+                                        confirmation, confirmation_len,
+                                        &received_nonce_b,
+                                        &received_nonce_b_len);
 
-  kmyth_clear_and_free(received_id, received_id_len);
-  kmyth_clear_and_free(response, response_len);
-  response = NULL;
-  response_len = 0;
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to parse the nonce confirmation.");
+    return 1;
+  }
+  if (nonce_b_len != received_nonce_b_len)
+  {
+    kmyth_log(LOG_ERR, "The received nonce B length is invalid.");
+    kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
+    return 1;
+  }
+  if (CRYPTO_memcmp(nonce_b, received_nonce_b, nonce_b_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "The received nonce B is invalid.");
+    kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
+    return 1;
+  }
 
-  kmyth_log(LOG_DEBUG, "Sending nonce B: %zd", nonce_b_len);
+  kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
+  kmyth_log(LOG_DEBUG, "Received nonce B: %zd bytes", nonce_b_len);
 
-  result = build_nonce_response(public_key_ctx,
-                                received_nonce_a, received_nonce_a_len,
+  // Use nonces to generate shared session key S
+  result = generate_session_key(nonce_a, nonce_a_len,
                                 nonce_b, nonce_b_len,
-                                id, id_len, &response, &response_len);
+                                session_key, session_key_len);
   if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to build the nonce response.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
+    kmyth_log(LOG_ERR, "Failed to generate the session key.");
     return 1;
   }
 
-  ssize_t send_result = write(socket_fd, response, response_len);
+  return 0;
+}
 
-  if (response_len != send_result)
+//
+// nsl_server_handshake_finish()
+//
+int nsl_server_handshake_finish(EVP_PKEY_CTX * private_key_ctx,
+                                unsigned char *confirmation,
+                                size_t confirmation_len,
+                                unsigned char *nonce_a, size_t nonce_a_len,
+                                unsigned char *nonce_b, size_t nonce_b_len,
+                                unsigned char **session_key,
+                                size_t *session_key_len)
+{
+  KMYTH_PROBE1(nsl_server_finish__entry, confirmation_len);
+
+  int retval = nsl_server_handshake_finish_impl(private_key_ctx,
+                                                confirmation,
+                                                confirmation_len,
+                                                nonce_a, nonce_a_len,
+                                                nonce_b, nonce_b_len,
+                                                session_key,
+                                                session_key_len);
+
+  KMYTH_PROBE1(nsl_server_finish__return, retval);
+  return retval;
+}
+
+//
+// negotiate_server_session_key_impl()
+//
+static int negotiate_server_session_key_impl(int socket_fd,
+                                             EVP_PKEY_CTX * public_key_ctx,
+                                             EVP_PKEY_CTX * private_key_ctx,
+                                             unsigned char *id, size_t id_len,
+                                             unsigned char **session_key,
+                                             size_t *session_key_len)
+{
+  // Conduct NSL to obtain nonce A
+  unsigned char *buffer = kmyth_calloc(8192, sizeof(unsigned char));
+
+  if (NULL == buffer)
   {
-    kmyth_log(LOG_ERR, "Failed to fully send the nonce response.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(response, response_len);
+    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
     return 1;
   }
+  size_t buffer_len = 8192 * sizeof(unsigned char);
 
-  kmyth_clear_and_free(response, response_len);
+  ssize_t read_result = read(socket_fd, buffer, buffer_len);
 
-  response = calloc(8192, sizeof(unsigned char));
-  if (NULL == response)
+  if (read_result <= 0)
   {
-    kmyth_log(LOG_ERR, "Failed to re-allocate the response buffer.");
+    kmyth_log(LOG_ERR, "Failed to receive the nonce request.");
+    kmyth_clear_and_free(buffer, buffer_len);
+    return 1;
+  }
+
+  unsigned char *nonce_a = NULL;
+  size_t nonce_a_len = 0;
+  unsigned char *nonce_b = NULL;
+  size_t nonce_b_len = 0;
+  unsigned char *response = NULL;
+  size_t response_len = 0;
+
+  // read_result can safely be cast to size_t because we've already
+  // dealt with the case that it's negative.
+  int result = nsl_server_handshake_respond(public_key_ctx, private_key_ctx,
+                                            id, id_len,
+                                            buffer, (size_t) read_result,
+                                            &nonce_a, &nonce_a_len,
+                                            &nonce_b, &nonce_b_len,
+                                            &response, &response_len);
+
+  if (result)
+  {
+    kmyth_clear_and_free(buffer, buffer_len);
+    return 1;
+  }
+
+  ssize_t send_result = write(socket_fd, response, response_len);
+
+  kmyth_clear_and_free(response, response_len);
+  if (response_len != send_result)
+  {
+    kmyth_log(LOG_ERR, "Failed to fully send the nonce response.");
+    kmyth_clear_and_free(nonce_a, nonce_a_len);
     kmyth_clear_and_free(nonce_b, nonce_b_len);
+    kmyth_clear_and_free(buffer, buffer_len);
     return 1;
   }
-  response_len = 8192 * sizeof(unsigned char);
 
-  read_result = read(socket_fd, response, response_len);
+  read_result = read(socket_fd, buffer, buffer_len);
   if (read_result <= 0)
   {
     kmyth_log(LOG_ERR, "Failed to receive the nonce confirmation.");
+    kmyth_clear_and_free(nonce_a, nonce_a_len);
     kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(response, response_len);
+    kmyth_clear_and_free(buffer, buffer_len);
     return 1;
   }
 
-  unsigned char *received_nonce_b = NULL;
-  size_t received_nonce_b_len = 0;
+  result = nsl_server_handshake_finish(private_key_ctx,
+                                       buffer, (size_t) read_result,
+                                       nonce_a, nonce_a_len,
+                                       nonce_b, nonce_b_len,
+                                       session_key, session_key_len);
+  kmyth_clear_and_free(nonce_a, nonce_a_len);
+  kmyth_clear_and_free(nonce_b, nonce_b_len);
+  kmyth_clear_and_free(buffer, buffer_len);
 
-  // read_result can safely be cast to a size_t because we've already
-  // dealt with the case it's negative.
-  result = parse_nonce_confirmation(private_key_ctx,
-                                    response, (size_t)read_result,
-                                    &received_nonce_b, &received_nonce_b_len);
-  kmyth_clear_and_free(response, response_len);
-  if (result)
+  return result;
+}
+
+//
+// negotiate_server_session_key()
+//
+int negotiate_server_session_key(int socket_fd,
+                                 EVP_PKEY_CTX * public_key_ctx,
+                                 EVP_PKEY_CTX * private_key_ctx,
+                                 unsigned char *id, size_t id_len,
+                                 unsigned char **session_key,
+                                 size_t *session_key_len)
+{
+  kmyth_log_span span;
+
+  kmyth_log_span_begin(&span, "negotiate_server_session_key");
+  KMYTH_PROBE1(nsl_server_handshake__entry, socket_fd);
+
+  int retval = negotiate_server_session_key_impl(socket_fd,
+                                                 public_key_ctx,
+                                                 private_key_ctx,
+                                                 id, id_len,
+                                                 session_key,
+                                                 session_key_len);
+
+  KMYTH_PROBE1(nsl_server_handshake__return, retval);
+  kmyth_log_span_end(&span, retval);
+  return retval;
+}
+
+//
+// nsl_session_init()
+//
+void nsl_session_init(nsl_session * session,
+                      unsigned char *key, size_t key_len, int is_server)
+{
+  nsl_session_clear(session);
+
+  session->key = key;
+  session->key_len = key_len;
+  session->is_server = is_server;
+  session->send_seq = 0;
+  session->recv_seq = 0;
+  session->requests = 0;
+  session->established = time(NULL);
+}
+
+//
+// nsl_session_clear()
+//
+void nsl_session_clear(nsl_session * session)
+{
+  if (session->key != NULL)
+  {
+    kmyth_clear_and_free(session->key, session->key_len);
+  }
+  session->key = NULL;
+  session->key_len = 0;
+}
+
+//
+// nsl_session_expired()
+//
+int nsl_session_expired(nsl_session * session)
+{
+  if (session->requests >= KMYTH_NSL_SESSION_MAX_REQUESTS)
   {
-    kmyth_log(LOG_ERR, "Failed to parse the nonce confirmation.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
     return 1;
   }
-  if (nonce_b_len != received_nonce_b_len)
+  if (time(NULL) - session->established >= KMYTH_NSL_SESSION_MAX_AGE)
   {
-    kmyth_log(LOG_ERR, "The received nonce B length is invalid.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
     return 1;
   }
-  if (strncmp
-      ((const char *) nonce_b, (const char *) received_nonce_b,
-       nonce_b_len) != 0)
+  return 0;
+}
+
+//
+// write_all()
+//
+static int write_all(int socket_fd, unsigned char *buf, size_t len)
+{
+  while (len > 0)
   {
-    kmyth_log(LOG_ERR, "The received nonce B is invalid.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
+    ssize_t n = write(socket_fd, buf, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    buf += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+//
+// read_all()
+//
+static int read_all(int socket_fd, unsigned char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = read(socket_fd, buf, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    buf += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+//
+// nsl_seal_record()
+//
+int nsl_seal_record(nsl_session * session, nsl_record_type type,
+                    unsigned char *payload, size_t payload_len,
+                    unsigned char **record, size_t *record_len)
+{
+  *record = NULL;
+  *record_len = 0;
+
+  if (session->key == NULL)
+  {
+    kmyth_log(LOG_ERR, "No session key ... exiting");
+    return 1;
+  }
+  if (payload_len > NSL_MAX_RECORD_LEN - NSL_RECORD_HEADER_LEN
+      - GCM_IV_LEN - GCM_TAG_LEN)
+  {
+    kmyth_log(LOG_ERR, "Record payload too long (%zu bytes) ... exiting",
+              payload_len);
     return 1;
   }
 
-  kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
-  kmyth_log(LOG_DEBUG, "Received nonce B: %zd bytes", nonce_b_len);
+  size_t plain_len = NSL_RECORD_HEADER_LEN + payload_len;
+  size_t record_size = NSL_RECORD_PREFIX_LEN + plain_len + GCM_IV_LEN
+    + GCM_TAG_LEN;
+  unsigned char *buf = kmyth_calloc(record_size, sizeof(unsigned char));
 
-  // Use nonces to generate shared session key S
-  result = generate_session_key(received_nonce_a, received_nonce_a_len,
-                                nonce_b, nonce_b_len,
-                                session_key, session_key_len);
-  kmyth_clear_and_free(nonce_b, nonce_b_len);
-  kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the record buffer.");
+    return 1;
+  }
+
+  // Assemble the plaintext where the ciphertext goes, and seal it in place
+  unsigned char *plain = buf + NSL_RECORD_PREFIX_LEN + GCM_IV_LEN;
+
+  plain[0] = (unsigned char) type;
+  plain[1] = (unsigned char) (session->is_server ? 1 : 0);
+  for (int i = 0; i < 8; i++)
+  {
+    plain[2 + i] = (unsigned char) (session->send_seq >> (56 - 8 * i));
+  }
+  if (payload_len > 0)
+  {
+    memcpy(plain + NSL_RECORD_HEADER_LEN, payload, payload_len);
+  }
+
+  size_t sealed_len = 0;
+
+  if (aes_gcm_encrypt_into(NULL, session->key, session->key_len,
+                           plain, plain_len,
+                           buf + NSL_RECORD_PREFIX_LEN,
+                           record_size - NSL_RECORD_PREFIX_LEN, &sealed_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to encrypt the session record.");
+    kmyth_clear_and_free(buf, record_size);
+    return 1;
+  }
+
+  buf[0] = (unsigned char) (sealed_len >> 24);
+  buf[1] = (unsigned char) (sealed_len >> 16);
+  buf[2] = (unsigned char) (sealed_len >> 8);
+  buf[3] = (unsigned char) sealed_len;
+
+  session->send_seq++;
+  if (type == NSL_RECORD_DATA && !session->is_server)
+  {
+    session->requests++;
+  }
+
+  *record = buf;
+  *record_len = NSL_RECORD_PREFIX_LEN + sealed_len;
+  return 0;
+}
+
+//
+// nsl_record_sealed_len()
+//
+int nsl_record_sealed_len(unsigned char *prefix, size_t *sealed_len)
+{
+  *sealed_len = ((size_t) prefix[0] << 24) | ((size_t) prefix[1] << 16) |
+    ((size_t) prefix[2] << 8) | prefix[3];
+
+  if (*sealed_len < GCM_IV_LEN + NSL_RECORD_HEADER_LEN + GCM_TAG_LEN
+      || *sealed_len > NSL_MAX_RECORD_LEN)
+  {
+    kmyth_log(LOG_ERR, "Invalid session record length (%zu bytes).",
+              *sealed_len);
+    return 1;
+  }
+  return 0;
+}
+
+//
+// nsl_open_record()
+//
+int nsl_open_record(nsl_session * session,
+                    unsigned char *sealed, size_t sealed_len,
+                    nsl_record_type * type,
+                    unsigned char **payload, size_t *payload_len)
+{
+  *payload = NULL;
+  *payload_len = 0;
+
+  if (session->key == NULL)
+  {
+    kmyth_log(LOG_ERR, "No session key ... exiting");
+    return 1;
+  }
+
+  // Open the record in place (the plaintext moves to the buffer's start)
+  size_t plain_len = 0;
+
+  if (aes_gcm_decrypt_in_place(NULL, session->key, session->key_len,
+                               sealed, sealed_len, &plain_len)
+      || plain_len < NSL_RECORD_HEADER_LEN)
+  {
+    kmyth_log(LOG_ERR, "Failed to decrypt the session record.");
+    return 1;
+  }
+
+  unsigned char *plain = sealed;
+  uint64_t seq = 0;
+
+  for (int i = 0; i < 8; i++)
+  {
+    seq = (seq << 8) | plain[2 + i];
+  }
+  if (plain[1] != (session->is_server ? 0 : 1))
+  {
+    kmyth_log(LOG_ERR, "The session record was not sent by the peer.");
+    return 1;
+  }
+  if (seq != session->recv_seq)
+  {
+    kmyth_log(LOG_ERR, "Unexpected session record sequence number "
+              "(%" PRIu64 ", expected %" PRIu64 ").", seq, session->recv_seq);
+    return 1;
+  }
+  if (plain[0] != NSL_RECORD_DATA && plain[0] != NSL_RECORD_REKEY
+      && plain[0] != NSL_RECORD_CLOSE)
+  {
+    kmyth_log(LOG_ERR, "Unknown session record type (%u).", plain[0]);
+    return 1;
+  }
+
+  *type = (nsl_record_type) plain[0];
+  *payload_len = plain_len - NSL_RECORD_HEADER_LEN;
+  if (*payload_len > 0)
+  {
+    *payload = kmyth_malloc(*payload_len);
+    if (*payload == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the record payload.");
+      *payload_len = 0;
+      return 1;
+    }
+    memcpy(*payload, plain + NSL_RECORD_HEADER_LEN, *payload_len);
+  }
+
+  session->recv_seq++;
+  if (*type == NSL_RECORD_DATA && session->is_server)
+  {
+    session->requests++;
+  }
+  return 0;
+}
+
+//
+// nsl_send_record()
+//
+int nsl_send_record(int socket_fd, nsl_session * session,
+                    nsl_record_type type,
+                    unsigned char *payload, size_t payload_len)
+{
+  unsigned char *record = NULL;
+  size_t record_len = 0;
+
+  if (nsl_seal_record(session, type, payload, payload_len,
+                      &record, &record_len))
+  {
+    return 1;
+  }
+
+  int result = write_all(socket_fd, record, record_len);
+
+  kmyth_clear_and_free(record, record_len);
   if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to generate the session key.");
+    kmyth_log(LOG_ERR, "Failed to fully send the session record.");
     return 1;
   }
 
   return 0;
 }
+
+//
+// nsl_recv_record()
+//
+int nsl_recv_record(int socket_fd, nsl_session * session,
+                    nsl_record_type * type,
+                    unsigned char **payload, size_t *payload_len)
+{
+  *payload = NULL;
+  *payload_len = 0;
+
+  unsigned char prefix[NSL_RECORD_PREFIX_LEN];
+
+  if (read_all(socket_fd, prefix, sizeof(prefix)))
+  {
+    kmyth_log(LOG_DEBUG, "The peer closed the session.");
+    return 1;
+  }
+
+  size_t sealed_len = 0;
+
+  if (nsl_record_sealed_len(prefix, &sealed_len))
+  {
+    return 1;
+  }
+
+  unsigned char *sealed = kmyth_calloc(sealed_len, sizeof(unsigned char));
+
+  if (sealed == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the record buffer.");
+    return 1;
+  }
+  if (read_all(socket_fd, sealed, sealed_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to read the session record.");
+    kmyth_free(sealed);
+    return 1;
+  }
+
+  int result = nsl_open_record(session, sealed, sealed_len,
+                               type, payload, payload_len);
+
+  kmyth_clear_and_free(sealed, sealed_len);
+  return result;
+}
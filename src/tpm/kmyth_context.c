@@ -0,0 +1,814 @@
+/**
+ * @file  kmyth_context.c
+ *
+ * @brief Implements the reusable Kmyth context (kmyth_ctx_t) API declared
+ *        in kmyth.h.
+ */
+
+#include "kmyth_context.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <openssl/evp.h>
+
+#include "defines.h"
+#include "memory_util.h"
+#include "metrics.h"
+#include "pcrs.h"
+#include "tpm2_interface.h"
+
+//############################################################################
+// kmyth_ctx_create()
+//############################################################################
+int kmyth_ctx_create(kmyth_ctx_t ** ctx)
+{
+  return kmyth_ctx_create_tcti(ctx, NULL);
+}
+
+//############################################################################
+// kmyth_ctx_create_tcti()
+//############################################################################
+int kmyth_ctx_create_tcti(kmyth_ctx_t ** ctx, const char *tcti_spec)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL pointer to Kmyth context handle ... exiting");
+    return 1;
+  }
+  *ctx = NULL;
+
+  kmyth_ctx_t *new_ctx = kmyth_calloc(1, sizeof(kmyth_ctx_t));
+
+  if (new_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate Kmyth context ... exiting");
+    return 1;
+  }
+
+  if (kmyth_cipher_ctx_create(&new_ctx->cipher_ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate cipher context ... exiting");
+    kmyth_free(new_ctx);
+    return 1;
+  }
+
+  // secure arena is best effort: seal calls fall back to the heap
+  if (kmyth_arena_init(&new_ctx->arena, KMYTH_CTX_ARENA_SIZE))
+  {
+    kmyth_log(LOG_DEBUG, "unable to map secure arena, using the heap");
+  }
+  else if (!new_ctx->arena.locked)
+  {
+    kmyth_log(LOG_DEBUG, "unable to lock secure arena into memory");
+  }
+
+  if (init_tpm2_connection_tcti(&new_ctx->sapi_ctx, tcti_spec))
+  {
+    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
+    free_tpm2_resources(&new_ctx->sapi_ctx);
+    kmyth_arena_free(&new_ctx->arena);
+    kmyth_cipher_ctx_destroy(&new_ctx->cipher_ctx);
+    kmyth_free(new_ctx);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
+
+  *ctx = new_ctx;
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_destroy()
+//############################################################################
+int kmyth_ctx_destroy(kmyth_ctx_t ** ctx)
+{
+  // If the input context is null there's nothing to do.
+  if ((ctx == NULL) || (*ctx == NULL))
+  {
+    return 0;
+  }
+
+  kmyth_secret_cache_clear(*ctx);
+  kmyth_free((*ctx)->secret_cache);
+  kmyth_ctx_set_wrapping_key(*ctx, NULL, 0);
+  kmyth_ctx_drop_session(*ctx);
+
+  int retval = kmyth_sk_cache_clear(*ctx);
+
+  if (free_tpm2_resources(&(*ctx)->sapi_ctx))
+  {
+    retval = 1;
+  }
+  kmyth_cipher_ctx_destroy(&(*ctx)->cipher_ctx);
+  kmyth_arena_release(&(*ctx)->arena, (*ctx)->derive_master,
+                      (*ctx)->derive_master_len);
+  kmyth_arena_free(&(*ctx)->arena);
+
+  kmyth_free(*ctx);
+  *ctx = NULL;
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_set_software_policy()
+//############################################################################
+int kmyth_ctx_set_software_policy(kmyth_ctx_t * ctx, uint8_t bool_software)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+
+  ctx->software_policy = (bool_software != 0);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_set_wrapping_key()
+//############################################################################
+int kmyth_ctx_set_wrapping_key(kmyth_ctx_t * ctx, const uint8_t * key,
+                               size_t key_len)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+  if (key != NULL && key_len == 0)
+  {
+    kmyth_log(LOG_ERR, "empty wrapping key ... exiting");
+    return 1;
+  }
+
+  if (ctx->wrap_key != NULL)
+  {
+    kmyth_clear(ctx->wrap_key, ctx->wrap_key_len);
+    munlock(ctx->wrap_key, ctx->wrap_key_len);
+    kmyth_free(ctx->wrap_key);
+    ctx->wrap_key = NULL;
+    ctx->wrap_key_len = 0;
+  }
+  if (key == NULL)
+  {
+    return 0;
+  }
+
+  ctx->wrap_key = kmyth_malloc(key_len);
+  if (ctx->wrap_key == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate wrapping key ... exiting");
+    return 1;
+  }
+
+  // best effort: keep the key out of swap
+  if (mlock(ctx->wrap_key, key_len) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "unable to lock wrapping key in memory");
+  }
+  memcpy(ctx->wrap_key, key, key_len);
+  ctx->wrap_key_len = key_len;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_set_secret_cache()
+//############################################################################
+int kmyth_ctx_set_secret_cache(kmyth_ctx_t * ctx, size_t max_entries,
+                               size_t max_bytes, unsigned int ttl_seconds)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+
+  kmyth_secret_cache_clear(ctx);
+  kmyth_free(ctx->secret_cache);
+  ctx->secret_cache = NULL;
+  ctx->secret_cache_size = 0;
+
+  if (max_entries > 0)
+  {
+    ctx->secret_cache =
+      kmyth_calloc(max_entries, sizeof(kmyth_secret_cache_entry));
+    if (ctx->secret_cache == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate secret cache ... exiting");
+      return 1;
+    }
+  }
+  ctx->secret_cache_size = max_entries;
+  ctx->secret_cache_max_bytes = max_bytes;
+  ctx->secret_cache_ttl = ttl_seconds;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_get_secret_cache_stats()
+//############################################################################
+int kmyth_ctx_get_secret_cache_stats(kmyth_ctx_t * ctx,
+                                     uint64_t * hits, uint64_t * misses)
+{
+  if (ctx == NULL || hits == NULL || misses == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+
+  *hits = ctx->secret_cache_hits;
+  *misses = ctx->secret_cache_misses;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_flush_handle()
+//############################################################################
+int kmyth_flush_handle(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE handle)
+{
+  if (handle == 0)
+  {
+    return 0;
+  }
+
+  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, handle);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
+              rc, getErrorString(rc));
+    kmyth_log(LOG_ERR, "error flushing handle 0x%08X ... exiting", handle);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "flushed handle 0x%08X", handle);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_sk_cache_find()
+//############################################################################
+static kmyth_sk_cache_entry *kmyth_sk_cache_find(kmyth_ctx_t * ctx,
+                                                 TPM2B_NAME * sk_name)
+{
+  if (ctx == NULL || sk_name == NULL || sk_name->size == 0)
+  {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    kmyth_sk_cache_entry *entry = &(ctx->sk_cache[i]);
+
+    if ((entry->handle != 0 || entry->swapped_out) &&
+        (entry->name.size == sk_name->size) &&
+        (memcmp(entry->name.name, sk_name->name, sk_name->size) == 0))
+    {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_sk_cache_drop()
+//############################################################################
+static void kmyth_sk_cache_drop(kmyth_ctx_t * ctx,
+                                kmyth_sk_cache_entry * entry)
+{
+  // a swapped out SK holds no TPM resources - its saved context is simply
+  // discarded
+  kmyth_flush_handle(ctx->sapi_ctx, entry->handle);
+  memset(entry, 0, sizeof(kmyth_sk_cache_entry));
+}
+
+//############################################################################
+// kmyth_sk_cache_swap_out()
+//############################################################################
+static void kmyth_sk_cache_swap_out(kmyth_ctx_t * ctx,
+                                    kmyth_sk_cache_entry * entry)
+{
+  TSS2_RC rc = Tss2_Sys_ContextSave(ctx->sapi_ctx, entry->handle,
+                                    &(entry->saved));
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_DEBUG, "Tss2_Sys_ContextSave(): rc = 0x%08X, %s",
+              rc, getErrorString(rc));
+    kmyth_log(LOG_DEBUG, "evicting SK (handle = 0x%08X) from SK pool",
+              entry->handle);
+    kmyth_sk_cache_drop(ctx, entry);
+    return;
+  }
+
+  // the TPM keeps the object loaded after saving its context
+  kmyth_flush_handle(ctx->sapi_ctx, entry->handle);
+  kmyth_log(LOG_DEBUG, "swapped out SK (handle = 0x%08X)", entry->handle);
+  entry->handle = 0;
+  entry->swapped_out = true;
+}
+
+//############################################################################
+// kmyth_sk_cache_make_room()
+//############################################################################
+static void kmyth_sk_cache_make_room(kmyth_ctx_t * ctx,
+                                     kmyth_sk_cache_entry * keep)
+{
+  while (true)
+  {
+    kmyth_sk_cache_entry *lru = NULL;
+    size_t loaded = 0;
+
+    for (size_t i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+    {
+      kmyth_sk_cache_entry *entry = &(ctx->sk_cache[i]);
+
+      if (entry->handle == 0)
+      {
+        continue;
+      }
+      loaded++;
+      if (entry != keep && (lru == NULL || entry->last_used < lru->last_used))
+      {
+        lru = entry;
+      }
+    }
+
+    // leave a slot for the SK about to be loaded (keep), if it is not yet
+    size_t limit = (keep != NULL && keep->handle != 0) ?
+      KMYTH_SK_CACHE_LOADED_MAX : KMYTH_SK_CACHE_LOADED_MAX - 1;
+
+    if (loaded <= limit || lru == NULL)
+    {
+      return;
+    }
+    kmyth_sk_cache_swap_out(ctx, lru);
+  }
+}
+
+//############################################################################
+// kmyth_sk_cache_lookup()
+//############################################################################
+TPM2_HANDLE kmyth_sk_cache_lookup(kmyth_ctx_t * ctx, TPM2B_NAME * sk_name)
+{
+  kmyth_sk_cache_entry *entry = kmyth_sk_cache_find(ctx, sk_name);
+
+  if (entry == NULL)
+  {
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_STORAGE_KEY, 0);
+    return 0;
+  }
+  entry->last_used = ++(ctx->sk_cache_uses);
+
+  if (entry->swapped_out)
+  {
+    kmyth_sk_cache_make_room(ctx, entry);
+
+    TPM2_HANDLE handle = 0;
+    TSS2_RC rc = Tss2_Sys_ContextLoad(ctx->sapi_ctx, &(entry->saved),
+                                      &handle);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      // saved contexts do not survive a TPM reset - the caller reloads
+      kmyth_log(LOG_DEBUG, "Tss2_Sys_ContextLoad(): rc = 0x%08X, %s",
+                rc, getErrorString(rc));
+      memset(entry, 0, sizeof(kmyth_sk_cache_entry));
+      kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_STORAGE_KEY, 0);
+      return 0;
+    }
+    memset(&(entry->saved), 0, sizeof(TPMS_CONTEXT));
+    entry->swapped_out = false;
+    entry->handle = handle;
+    kmyth_log(LOG_DEBUG, "swapped in SK (handle = 0x%08X)", handle);
+  }
+  kmyth_log(LOG_DEBUG, "SK cache hit (handle = 0x%08X)", entry->handle);
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_STORAGE_KEY, 1);
+
+  return entry->handle;
+}
+
+//############################################################################
+// kmyth_sk_cache_insert()
+//############################################################################
+int kmyth_sk_cache_insert(kmyth_ctx_t * ctx,
+                          TPM2B_NAME * sk_name, TPM2_HANDLE sk_handle)
+{
+  if (ctx == NULL || sk_name == NULL || sk_name->size == 0 || sk_handle == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid SK cache entry ... exiting");
+    return 1;
+  }
+
+  // already cached - nothing to do
+  if (kmyth_sk_cache_find(ctx, sk_name) != NULL)
+  {
+    return 0;
+  }
+
+  // use an empty entry, else replace the least recently used one
+  kmyth_sk_cache_entry *entry = NULL;
+
+  for (size_t i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    kmyth_sk_cache_entry *candidate = &(ctx->sk_cache[i]);
+
+    if (candidate->handle == 0 && !candidate->swapped_out)
+    {
+      entry = candidate;
+      break;
+    }
+    if (entry == NULL || candidate->last_used < entry->last_used)
+    {
+      entry = candidate;
+    }
+  }
+
+  if (entry->handle != 0 || entry->swapped_out)
+  {
+    kmyth_log(LOG_DEBUG, "evicting SK (handle = 0x%08X) from SK pool",
+              entry->handle);
+    kmyth_sk_cache_drop(ctx, entry);
+  }
+
+  entry->name = *sk_name;
+  entry->handle = sk_handle;
+  entry->last_used = ++(ctx->sk_cache_uses);
+
+  // keep the number of loaded SKs within the transient slot budget
+  kmyth_sk_cache_make_room(ctx, entry);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_sk_cache_remove()
+//############################################################################
+void kmyth_sk_cache_remove(kmyth_ctx_t * ctx, TPM2B_NAME * sk_name)
+{
+  kmyth_sk_cache_entry *entry = kmyth_sk_cache_find(ctx, sk_name);
+
+  if (entry == NULL)
+  {
+    return;
+  }
+
+  kmyth_sk_cache_drop(ctx, entry);
+}
+
+//############################################################################
+// kmyth_sk_cache_clear()
+//############################################################################
+int kmyth_sk_cache_clear(kmyth_ctx_t * ctx)
+{
+  if (ctx == NULL)
+  {
+    return 0;
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    if (kmyth_flush_handle(ctx->sapi_ctx, ctx->sk_cache[i].handle))
+    {
+      retval = 1;
+    }
+    memset(&(ctx->sk_cache[i]), 0, sizeof(kmyth_sk_cache_entry));
+  }
+  ctx->sk_cache_uses = 0;
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_get_session()
+//############################################################################
+SESSION *kmyth_ctx_get_session(kmyth_ctx_t * ctx)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    return NULL;
+  }
+
+  if (!ctx->have_session)
+  {
+    if (create_auth_session(ctx->sapi_ctx, &ctx->session, TPM2_SE_POLICY))
+    {
+      kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+      return NULL;
+    }
+    ctx->have_session = true;
+  }
+
+  return &ctx->session;
+}
+
+//############################################################################
+// kmyth_ctx_drop_session()
+//############################################################################
+void kmyth_ctx_drop_session(kmyth_ctx_t * ctx)
+{
+  if (ctx == NULL || !ctx->have_session)
+  {
+    return;
+  }
+
+  kmyth_flush_handle(ctx->sapi_ctx, ctx->session.sessionHandle);
+  memset(&ctx->session, 0, sizeof(SESSION));
+  ctx->have_session = false;
+}
+
+//############################################################################
+// kmyth_policy_cache_lookup()
+//############################################################################
+bool kmyth_policy_cache_lookup(kmyth_ctx_t * ctx,
+                               kmyth_policy_cache_entry * key,
+                               kmyth_policy_cache_entry * result)
+{
+  if (ctx == NULL || key == NULL || result == NULL)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < KMYTH_POLICY_CACHE_SIZE; i++)
+  {
+    kmyth_policy_cache_entry *entry = &(ctx->policy_cache[i]);
+
+    if (entry->valid &&
+        pcr_selection_equal(&entry->pcrList, &key->pcrList) &&
+        (entry->pcrDigest.size == key->pcrDigest.size) &&
+        (memcmp(entry->pcrDigest.buffer, key->pcrDigest.buffer,
+                key->pcrDigest.size) == 0) &&
+        digest_list_equal(&entry->expectedBranches, &key->expectedBranches))
+    {
+      *result = *entry;
+      kmyth_log(LOG_DEBUG, "policy digest cache hit");
+      kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_POLICY, 1);
+      return true;
+    }
+  }
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_POLICY, 0);
+
+  return false;
+}
+
+//############################################################################
+// kmyth_policy_cache_insert()
+//############################################################################
+void kmyth_policy_cache_insert(kmyth_ctx_t * ctx,
+                               kmyth_policy_cache_entry * entry)
+{
+  if (ctx == NULL || entry == NULL)
+  {
+    return;
+  }
+
+  ctx->policy_cache[ctx->policy_cache_next] = *entry;
+  ctx->policy_cache[ctx->policy_cache_next].valid = true;
+  ctx->policy_cache_next =
+    (ctx->policy_cache_next + 1) % KMYTH_POLICY_CACHE_SIZE;
+}
+
+//############################################################################
+// monotonic_seconds()
+//############################################################################
+static time_t monotonic_seconds(void)
+{
+  struct timespec now = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
+
+//############################################################################
+// kmyth_secret_cache_evict()
+//############################################################################
+static void kmyth_secret_cache_evict(kmyth_ctx_t * ctx,
+                                     kmyth_secret_cache_entry * entry)
+{
+  if (entry->data != NULL)
+  {
+    kmyth_clear(entry->data, entry->data_len);
+    munlock(entry->data, entry->data_len);
+    kmyth_free(entry->data);
+    ctx->secret_cache_bytes -= entry->data_len;
+  }
+  memset(entry, 0, sizeof(kmyth_secret_cache_entry));
+}
+
+//############################################################################
+// kmyth_secret_cache_key()
+//############################################################################
+int kmyth_secret_cache_key(uint8_t * ski, size_t ski_len,
+                           TPM2B_AUTH * objAuthVal, TPM2B_AUTH * ownerAuth,
+                           TPM2B_DIGEST * key)
+{
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  unsigned int key_len = 0;
+  int retval = 1;
+
+  if (md_ctx != NULL &&
+      EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL) &&
+      EVP_DigestUpdate(md_ctx, ski, ski_len) &&
+      EVP_DigestUpdate(md_ctx, &objAuthVal->size, sizeof(objAuthVal->size)) &&
+      EVP_DigestUpdate(md_ctx, objAuthVal->buffer, objAuthVal->size) &&
+      EVP_DigestUpdate(md_ctx, &ownerAuth->size, sizeof(ownerAuth->size)) &&
+      EVP_DigestUpdate(md_ctx, ownerAuth->buffer, ownerAuth->size) &&
+      EVP_DigestFinal_ex(md_ctx, key->buffer, &key_len))
+  {
+    key->size = (uint16_t) key_len;
+    retval = 0;
+  }
+  else
+  {
+    kmyth_log(LOG_ERR, "error computing secret cache key ... exiting");
+  }
+
+  EVP_MD_CTX_destroy(md_ctx);
+  return retval;
+}
+
+//############################################################################
+// kmyth_secret_cache_lookup()
+//############################################################################
+bool kmyth_secret_cache_lookup(kmyth_ctx_t * ctx, TPM2B_DIGEST * key,
+                               uint8_t ** output, size_t *output_len)
+{
+  if (ctx == NULL || ctx->secret_cache_size == 0 || key == NULL)
+  {
+    return false;
+  }
+
+  kmyth_secret_cache_entry *entry = NULL;
+
+  for (size_t i = 0; i < ctx->secret_cache_size; i++)
+  {
+    kmyth_secret_cache_entry *e = &(ctx->secret_cache[i]);
+
+    if (e->data != NULL && e->key.size == key->size &&
+        memcmp(e->key.buffer, key->buffer, key->size) == 0)
+    {
+      entry = e;
+      break;
+    }
+  }
+
+  if (entry != NULL && entry->expires != 0 &&
+      monotonic_seconds() >= entry->expires)
+  {
+    kmyth_log(LOG_DEBUG, "secret cache entry expired");
+    kmyth_secret_cache_evict(ctx, entry);
+    entry = NULL;
+  }
+
+  // a change to the selected PCRs invalidates the entry, just as it would
+  // make the TPM refuse the unseal
+  if (entry != NULL)
+  {
+    TPM2B_DIGEST pcrDigest = {.size = 0, };
+
+    if (get_pcr_digest(ctx->sapi_ctx, entry->pcrList, &pcrDigest) ||
+        pcrDigest.size != entry->pcrDigest.size ||
+        memcmp(pcrDigest.buffer, entry->pcrDigest.buffer,
+               pcrDigest.size) != 0)
+    {
+      kmyth_log(LOG_DEBUG, "PCR values changed, secret cache entry dropped");
+      kmyth_secret_cache_evict(ctx, entry);
+      entry = NULL;
+    }
+  }
+
+  if (entry != NULL)
+  {
+    *output = kmyth_malloc(entry->data_len);
+    if (*output != NULL)
+    {
+      memcpy(*output, entry->data, entry->data_len);
+      *output_len = entry->data_len;
+      entry->last_used = ++ctx->secret_cache_uses;
+      ctx->secret_cache_hits++;
+      kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SECRET, 1);
+      kmyth_log(LOG_DEBUG, "secret cache hit");
+      return true;
+    }
+  }
+
+  ctx->secret_cache_misses++;
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SECRET, 0);
+  return false;
+}
+
+//############################################################################
+// kmyth_secret_cache_insert()
+//############################################################################
+void kmyth_secret_cache_insert(kmyth_ctx_t * ctx, TPM2B_DIGEST * key,
+                               TPML_PCR_SELECTION pcrList,
+                               uint8_t * data, size_t data_len)
+{
+  if (ctx == NULL || ctx->secret_cache_size == 0 || key == NULL ||
+      data == NULL || data_len == 0 || data_len > ctx->secret_cache_max_bytes)
+  {
+    return;
+  }
+
+  kmyth_secret_cache_entry new_entry;
+
+  memset(&new_entry, 0, sizeof(new_entry));
+  new_entry.key = *key;
+  new_entry.pcrList = pcrList;
+  if (get_pcr_digest(ctx->sapi_ctx, pcrList, &new_entry.pcrDigest))
+  {
+    return;
+  }
+
+  // drop stale entries and any previous copy of this secret
+  time_t now = monotonic_seconds();
+
+  for (size_t i = 0; i < ctx->secret_cache_size; i++)
+  {
+    kmyth_secret_cache_entry *e = &(ctx->secret_cache[i]);
+
+    if (e->data != NULL &&
+        ((e->expires != 0 && now >= e->expires) ||
+         (e->key.size == key->size &&
+          memcmp(e->key.buffer, key->buffer, key->size) == 0)))
+    {
+      kmyth_secret_cache_evict(ctx, e);
+    }
+  }
+
+  // then evict least recently used entries until the secret fits
+  kmyth_secret_cache_entry *slot = NULL;
+
+  while (true)
+  {
+    kmyth_secret_cache_entry *lru = NULL;
+
+    slot = NULL;
+    for (size_t i = 0; i < ctx->secret_cache_size; i++)
+    {
+      kmyth_secret_cache_entry *e = &(ctx->secret_cache[i]);
+
+      if (e->data == NULL)
+      {
+        slot = (slot == NULL) ? e : slot;
+      }
+      else if (lru == NULL || e->last_used < lru->last_used)
+      {
+        lru = e;
+      }
+    }
+    if (slot != NULL &&
+        ctx->secret_cache_bytes + data_len <= ctx->secret_cache_max_bytes)
+    {
+      break;
+    }
+    kmyth_secret_cache_evict(ctx, lru);
+  }
+
+  new_entry.data = kmyth_malloc(data_len);
+  if (new_entry.data == NULL)
+  {
+    return;
+  }
+  if (mlock(new_entry.data, data_len) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "unable to lock secret in memory, not cached");
+    kmyth_free(new_entry.data);
+    return;
+  }
+  memcpy(new_entry.data, data, data_len);
+  new_entry.data_len = data_len;
+  new_entry.expires = (ctx->secret_cache_ttl == 0) ? 0 :
+    now + (time_t) ctx->secret_cache_ttl;
+  new_entry.last_used = ++ctx->secret_cache_uses;
+
+  *slot = new_entry;
+  ctx->secret_cache_bytes += data_len;
+}
+
+//############################################################################
+// kmyth_secret_cache_clear()
+//############################################################################
+void kmyth_secret_cache_clear(kmyth_ctx_t * ctx)
+{
+  if (ctx == NULL || ctx->secret_cache == NULL)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < ctx->secret_cache_size; i++)
+  {
+    kmyth_secret_cache_evict(ctx, &(ctx->secret_cache[i]));
+  }
+  ctx->secret_cache_bytes = 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file  kmyth_derive.c
+ *
+ * @brief Implements kmyth_derive_key(), declared in kmyth.h: keys derived
+ *        in software (HKDF-SHA256) from a master secret sealed once.
+ */
+
+#include "kmyth_derive.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+
+#include "defines.h"
+#include "kmyth_context.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+//############################################################################
+// kmyth_hkdf_sha256()
+//############################################################################
+int kmyth_hkdf_sha256(const uint8_t * ikm, size_t ikm_len,
+                      const uint8_t * info, size_t info_len,
+                      uint8_t * out, size_t out_len)
+{
+  // OpenSSL takes the key and info lengths as int
+  if (ikm_len > INT_MAX || info_len > INT_MAX)
+  {
+    return 1;
+  }
+
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+  size_t len = out_len;
+  int retval = (pctx == NULL) ||
+    EVP_PKEY_derive_init(pctx) <= 0 ||
+    EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256()) <= 0 ||
+    EVP_PKEY_CTX_set1_hkdf_key(pctx, ikm, (int) ikm_len) <= 0 ||
+    (info_len > 0 &&
+     EVP_PKEY_CTX_add1_hkdf_info(pctx, info, (int) info_len) <= 0) ||
+    EVP_PKEY_derive(pctx, out, &len) <= 0 || len != out_len;
+
+  EVP_PKEY_CTX_free(pctx);
+  return retval;
+}
+
+//############################################################################
+// hold_derive_master()
+//############################################################################
+/**
+ * @brief Replaces the master secret held by a context with a copy of
+ *        master, taken from the context's arena where it fits.
+ *
+ * @return 0 on success, 1 on error (no master is then held)
+ */
+static int hold_derive_master(kmyth_ctx_t * ctx, TPM2B_DIGEST * cache_key,
+                              const uint8_t * master, size_t master_len)
+{
+  // the held master is the only long-lived block of the arena, so releasing
+  // it first returns its space for the new one
+  kmyth_arena_release(&ctx->arena, ctx->derive_master,
+                      ctx->derive_master_len);
+  ctx->derive_master = NULL;
+  ctx->derive_master_len = 0;
+  ctx->derive_master_key.size = 0;
+
+  uint8_t *copy = kmyth_arena_alloc(&ctx->arena, master_len);
+
+  if (copy == NULL)
+  {
+    copy = kmyth_malloc(master_len);
+    if (copy == NULL)
+    {
+      return 1;
+    }
+  }
+  memcpy(copy, master, master_len);
+
+  ctx->derive_master = copy;
+  ctx->derive_master_len = master_len;
+  ctx->derive_master_key = *cache_key;
+  return 0;
+}
+
+//############################################################################
+// kmyth_derive_key()
+//############################################################################
+int kmyth_derive_key(kmyth_ctx_t * ctx,
+                     uint8_t * sealed_master, size_t sealed_master_len,
+                     uint8_t * auth_bytes, size_t auth_bytes_len,
+                     uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                     uint8_t bool_policy_or, const char *label,
+                     uint8_t * key, size_t key_len)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+  if (sealed_master == NULL || sealed_master_len == 0 || label == NULL ||
+      key == NULL || key_len == 0 || key_len > KMYTH_DERIVE_MAX_KEY_LEN)
+  {
+    kmyth_log(LOG_ERR, "invalid key derivation parameters ... exiting");
+    return 1;
+  }
+  if (oa_bytes_len > sizeof(((TPM2B_AUTH *) NULL)->buffer))
+  {
+    kmyth_log(LOG_ERR, "owner authorization too long ... exiting");
+    return 1;
+  }
+
+  // identify the master by its .ski and authorization, as the secret cache
+  // does, so that it is only reused for a caller that could unseal it
+  TPM2B_AUTH ownerAuth = {.size = (uint16_t) oa_bytes_len, };
+  TPM2B_AUTH objAuthValue = {.size = 0, };
+  TPM2B_DIGEST cache_key = {.size = 0, };
+
+  if (oa_bytes_len > 0 && owner_auth_bytes != NULL)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, oa_bytes_len);
+  }
+  int retval = create_authVal(auth_bytes, auth_bytes_len, &objAuthValue) ||
+    kmyth_secret_cache_key(sealed_master, sealed_master_len,
+                           &objAuthValue, &ownerAuth, &cache_key);
+
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to identify master secret ... exiting");
+    return 1;
+  }
+
+  if (ctx->derive_master == NULL ||
+      ctx->derive_master_key.size != cache_key.size ||
+      memcmp(ctx->derive_master_key.buffer, cache_key.buffer,
+             cache_key.size) != 0)
+  {
+    uint8_t *master = NULL;
+    size_t master_len = 0;
+
+    if (tpm2_kmyth_unseal_ctx(ctx, sealed_master, sealed_master_len,
+                              &master, &master_len,
+                              auth_bytes, auth_bytes_len,
+                              owner_auth_bytes, oa_bytes_len,
+                              bool_policy_or))
+    {
+      kmyth_log(LOG_ERR, "unable to unseal master secret ... exiting");
+      return 1;
+    }
+    retval = hold_derive_master(ctx, &cache_key, master, master_len);
+    kmyth_clear_and_free(master, master_len);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "unable to hold master secret ... exiting");
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "unsealed master secret for key derivation");
+  }
+
+  if (kmyth_hkdf_sha256(ctx->derive_master, ctx->derive_master_len,
+                        (const uint8_t *) label, strlen(label), key,
+                        key_len))
+  {
+    kmyth_log(LOG_ERR, "HKDF key derivation error ... exiting");
+    kmyth_clear(key, key_len);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,399 @@
+/**
+ * @file  kmyth_dispatch.c
+ *
+ * @brief Implements the multi-TPM job dispatcher (tpm2_kmyth_seal_sharded()
+ *        and tpm2_kmyth_unseal_sharded()) declared in kmyth.h.
+ */
+
+#include "kmyth_dispatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+/**
+ * @brief State of one dispatch worker thread
+ */
+typedef struct
+{
+  kmyth_dispatch *dispatch;
+  size_t index;
+  pthread_t thread;
+
+  // TPM scheduling class of the thread that started the dispatch
+  kmyth_tpm_priority priority;
+} kmyth_dispatch_worker;
+
+//############################################################################
+// kmyth_dispatch_init_queues()
+//############################################################################
+int kmyth_dispatch_init_queues(kmyth_dispatch * dispatch,
+                               const size_t *affinity)
+{
+  if (dispatch == NULL || dispatch->endpoint_count == 0 ||
+      dispatch->endpoint_count > KMYTH_DISPATCH_MAX_ENDPOINTS)
+  {
+    kmyth_log(LOG_ERR, "invalid number of TPM endpoints ... exiting");
+    return 1;
+  }
+
+  dispatch->queues = kmyth_calloc(dispatch->endpoint_count,
+                                  sizeof(kmyth_dispatch_queue));
+  if (dispatch->queues == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for dispatch queues failed ... exiting");
+    return 1;
+  }
+
+  // every queue can hold every job, which keeps the bookkeeping trivial
+  size_t slots = (dispatch->count == 0) ? 1 : dispatch->count;
+
+  for (size_t i = 0; i < dispatch->endpoint_count; i++)
+  {
+    kmyth_dispatch_queue *queue = &(dispatch->queues[i]);
+
+    pthread_mutex_init(&(queue->lock), NULL);
+    queue->pinned = kmyth_calloc(slots, sizeof(size_t));
+    queue->shared = kmyth_calloc(slots, sizeof(size_t));
+    if (queue->pinned == NULL || queue->shared == NULL)
+    {
+      kmyth_log(LOG_ERR, "calloc for dispatch queue failed ... exiting");
+      dispatch->endpoint_count = i + 1;
+      kmyth_dispatch_free_queues(dispatch);
+      return 1;
+    }
+  }
+
+  size_t next_shared = 0;
+
+  for (size_t job = 0; job < dispatch->count; job++)
+  {
+    size_t endpoint = (affinity == NULL) ? KMYTH_ANY_ENDPOINT : affinity[job];
+
+    if (endpoint == KMYTH_ANY_ENDPOINT)
+    {
+      kmyth_dispatch_queue *queue = &(dispatch->queues[next_shared]);
+
+      queue->shared[queue->shared_tail++] = job;
+      next_shared = (next_shared + 1) % dispatch->endpoint_count;
+    }
+    else if (endpoint < dispatch->endpoint_count)
+    {
+      kmyth_dispatch_queue *queue = &(dispatch->queues[endpoint]);
+
+      queue->pinned[queue->pinned_count++] = job;
+    }
+    else
+    {
+      kmyth_log(LOG_ERR, "job %zu names unknown TPM endpoint %zu ... exiting",
+                job, endpoint);
+      kmyth_dispatch_free_queues(dispatch);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_dispatch_free_queues()
+//############################################################################
+void kmyth_dispatch_free_queues(kmyth_dispatch * dispatch)
+{
+  if (dispatch == NULL || dispatch->queues == NULL)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < dispatch->endpoint_count; i++)
+  {
+    pthread_mutex_destroy(&(dispatch->queues[i].lock));
+    kmyth_free(dispatch->queues[i].pinned);
+    kmyth_free(dispatch->queues[i].shared);
+  }
+  kmyth_free(dispatch->queues);
+  dispatch->queues = NULL;
+}
+
+//############################################################################
+// kmyth_dispatch_next_job()
+//############################################################################
+bool kmyth_dispatch_next_job(kmyth_dispatch * dispatch, size_t worker,
+                             bool steal, size_t *job)
+{
+  kmyth_dispatch_queue *own = &(dispatch->queues[worker]);
+  bool found = false;
+
+  pthread_mutex_lock(&(own->lock));
+  if (own->pinned_next < own->pinned_count)
+  {
+    *job = own->pinned[own->pinned_next++];
+    found = true;
+  }
+  else if (own->shared_head < own->shared_tail)
+  {
+    *job = own->shared[own->shared_head++];
+    found = true;
+  }
+  pthread_mutex_unlock(&(own->lock));
+
+  // steal from the tail of the other queues, starting with the next worker
+  // so that idle workers do not all pile onto the same victim
+  for (size_t i = 1; steal && !found && i < dispatch->endpoint_count; i++)
+  {
+    size_t victim_index = (worker + i) % dispatch->endpoint_count;
+    kmyth_dispatch_queue *victim = &(dispatch->queues[victim_index]);
+
+    pthread_mutex_lock(&(victim->lock));
+    if (victim->shared_head < victim->shared_tail)
+    {
+      *job = victim->shared[--(victim->shared_tail)];
+      found = true;
+      kmyth_log(LOG_DEBUG, "TPM endpoint %zu stole job %zu from endpoint %zu",
+                worker, *job, victim_index);
+    }
+    pthread_mutex_unlock(&(victim->lock));
+  }
+
+  return found;
+}
+
+//############################################################################
+// kmyth_dispatch_run_job()
+//############################################################################
+static void kmyth_dispatch_run_job(kmyth_dispatch * d, kmyth_ctx_t * ctx,
+                                   size_t worker, size_t job)
+{
+  if (d->op == KMYTH_DISPATCH_SEAL)
+  {
+    d->results[job] = tpm2_kmyth_seal_ctx(ctx, d->inputs[job],
+                                          d->input_lens[job],
+                                          &(d->outputs[job]),
+                                          &(d->output_lens[job]),
+                                          d->auth_bytes, d->auth_bytes_len,
+                                          d->owner_auth_bytes,
+                                          d->oa_bytes_len, d->pcrs,
+                                          d->pcrs_len, d->cipher_string,
+                                          d->expected_policy, 0);
+  }
+  else
+  {
+    d->results[job] = tpm2_kmyth_unseal_ctx(ctx, d->inputs[job],
+                                            d->input_lens[job],
+                                            &(d->outputs[job]),
+                                            &(d->output_lens[job]),
+                                            d->auth_bytes, d->auth_bytes_len,
+                                            d->owner_auth_bytes,
+                                            d->oa_bytes_len,
+                                            d->bool_policy_or);
+  }
+
+  if (d->results[job] == 0 && d->endpoints != NULL)
+  {
+    d->endpoints[job] = worker;
+  }
+  if (d->results[job] != 0)
+  {
+    kmyth_log(LOG_ERR, "job %zu failed on TPM endpoint %zu (%s)", job, worker,
+              (d->tcti_specs[worker] == NULL) ? "default" :
+              d->tcti_specs[worker]);
+    kmyth_free(d->outputs[job]);
+    d->outputs[job] = NULL;
+    d->output_lens[job] = 0;
+  }
+}
+
+//############################################################################
+// kmyth_dispatch_worker_main()
+//############################################################################
+static void *kmyth_dispatch_worker_main(void *arg)
+{
+  kmyth_dispatch_worker *worker = (kmyth_dispatch_worker *) arg;
+  kmyth_dispatch *d = worker->dispatch;
+  kmyth_ctx_t *ctx = NULL;
+  size_t job = 0;
+
+  set_tpm_priority(worker->priority);
+  if (kmyth_ctx_create_tcti(&ctx, d->tcti_specs[worker->index]))
+  {
+    // the jobs pinned here keep their failed result; the shared ones are
+    // left in the queue for the other workers to steal
+    kmyth_log(LOG_ERR, "TPM endpoint %zu (%s) unavailable", worker->index,
+              (d->tcti_specs[worker->index] == NULL) ? "default" :
+              d->tcti_specs[worker->index]);
+    return NULL;
+  }
+
+  while (kmyth_dispatch_next_job(d, worker->index, true, &job))
+  {
+    kmyth_dispatch_run_job(d, ctx, worker->index, job);
+  }
+
+  kmyth_ctx_destroy(&ctx);
+  return NULL;
+}
+
+//############################################################################
+// kmyth_dispatch_run()
+//############################################################################
+int kmyth_dispatch_run(kmyth_dispatch * dispatch)
+{
+  // a job that is never run (e.g., every endpoint is down) counts as failed
+  for (size_t i = 0; i < dispatch->count; i++)
+  {
+    dispatch->results[i] = 1;
+    dispatch->outputs[i] = NULL;
+    dispatch->output_lens[i] = 0;
+  }
+
+  kmyth_dispatch_worker *workers =
+    kmyth_calloc(dispatch->endpoint_count, sizeof(kmyth_dispatch_worker));
+
+  if (workers == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for dispatch workers failed ... exiting");
+    return 1;
+  }
+
+  size_t started = 0;
+
+  for (size_t i = 0; i < dispatch->endpoint_count; i++)
+  {
+    workers[i].dispatch = dispatch;
+    workers[i].index = i;
+    workers[i].priority = get_tpm_priority();
+    if (pthread_create(&(workers[i].thread), NULL,
+                       kmyth_dispatch_worker_main, &(workers[i])) != 0)
+    {
+      kmyth_log(LOG_ERR, "unable to start worker for TPM endpoint %zu", i);
+      break;
+    }
+    started++;
+  }
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+  }
+  kmyth_free(workers);
+
+  int retval = (started == 0) ? 1 : 0;
+
+  for (size_t i = 0; i < dispatch->count; i++)
+  {
+    retval |= (dispatch->results[i] != 0) ? 1 : 0;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_sharded()
+//############################################################################
+int tpm2_kmyth_seal_sharded(size_t endpoint_count, const char **tcti_specs,
+                            size_t count,
+                            uint8_t ** inputs, size_t *input_lens,
+                            uint8_t ** outputs, size_t *output_lens,
+                            int *results, size_t *endpoints,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len, char *cipher_string,
+                            char *expected_policy)
+{
+  if (tcti_specs == NULL || (count > 0 && (inputs == NULL ||
+                                           input_lens == NULL ||
+                                           outputs == NULL ||
+                                           output_lens == NULL ||
+                                           results == NULL)))
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+
+  kmyth_dispatch dispatch = {
+    .op = KMYTH_DISPATCH_SEAL,
+    .endpoint_count = endpoint_count,
+    .tcti_specs = tcti_specs,
+    .count = count,
+    .inputs = inputs,
+    .input_lens = input_lens,
+    .outputs = outputs,
+    .output_lens = output_lens,
+    .results = results,
+    .endpoints = endpoints,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .owner_auth_bytes = owner_auth_bytes,
+    .oa_bytes_len = oa_bytes_len,
+    .pcrs = pcrs,
+    .pcrs_len = pcrs_len,
+    .cipher_string = cipher_string,
+    .expected_policy = expected_policy,
+  };
+
+  if (kmyth_dispatch_init_queues(&dispatch, NULL))
+  {
+    return 1;
+  }
+
+  int retval = kmyth_dispatch_run(&dispatch);
+
+  kmyth_dispatch_free_queues(&dispatch);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_sharded()
+//############################################################################
+int tpm2_kmyth_unseal_sharded(size_t endpoint_count, const char **tcti_specs,
+                              size_t count,
+                              uint8_t ** inputs, size_t *input_lens,
+                              uint8_t ** outputs, size_t *output_lens,
+                              int *results, const size_t *endpoints,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              uint8_t bool_policy_or)
+{
+  if (tcti_specs == NULL || (count > 0 && (inputs == NULL ||
+                                           input_lens == NULL ||
+                                           outputs == NULL ||
+                                           output_lens == NULL ||
+                                           results == NULL)))
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+
+  kmyth_dispatch dispatch = {
+    .op = KMYTH_DISPATCH_UNSEAL,
+    .endpoint_count = endpoint_count,
+    .tcti_specs = tcti_specs,
+    .count = count,
+    .inputs = inputs,
+    .input_lens = input_lens,
+    .outputs = outputs,
+    .output_lens = output_lens,
+    .results = results,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .owner_auth_bytes = owner_auth_bytes,
+    .oa_bytes_len = oa_bytes_len,
+    .bool_policy_or = bool_policy_or,
+  };
+
+  // a .ski can only be unsealed by the TPM that sealed it, so jobs with a
+  // known endpoint are pinned there
+  if (kmyth_dispatch_init_queues(&dispatch, endpoints))
+  {
+    return 1;
+  }
+
+  int retval = kmyth_dispatch_run(&dispatch);
+
+  kmyth_dispatch_free_queues(&dispatch);
+
+  return retval;
+}
@@ -0,0 +1,479 @@
+/**
+ * @file  kmyth_envelope.c
+ *
+ * @brief Implements the envelope mode (kmyth_envelope_t) API declared in
+ *        kmyth.h: one TPM-sealed key encryption key (KEK) wrapping the
+ *        per-file data encryption keys (DEKs) of any number of files.
+ */
+
+#include "kmyth_envelope.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "cipher/aes_keywrap_5649pad.h"
+#include "defines.h"
+#include "formatting_tools.h"
+#include "memory_util.h"
+
+// Label hashed with the KEK to derive its identifier (see kek_identifier())
+#define KMYTH_ENVELOPE_KEK_ID_LABEL "kmyth envelope KEK id"
+
+//############################################################################
+// kek_identifier()
+//############################################################################
+/**
+ * @brief Computes the identifier of a KEK: the leading
+ *        KMYTH_ENVELOPE_KEK_ID_LEN bytes of SHA-256(label || KEK).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int kek_identifier(const uint8_t * kek, size_t kek_len, uint8_t * id)
+{
+  uint8_t digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+  int retval = (md_ctx == NULL) ||
+    !EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) ||
+    !EVP_DigestUpdate(md_ctx, KMYTH_ENVELOPE_KEK_ID_LABEL,
+                      strlen(KMYTH_ENVELOPE_KEK_ID_LABEL)) ||
+    !EVP_DigestUpdate(md_ctx, kek, kek_len) ||
+    !EVP_DigestFinal_ex(md_ctx, digest, &digest_len) ||
+    digest_len < KMYTH_ENVELOPE_KEK_ID_LEN;
+
+  EVP_MD_CTX_free(md_ctx);
+  if (retval)
+  {
+    return 1;
+  }
+  memcpy(id, digest, KMYTH_ENVELOPE_KEK_ID_LEN);
+  return 0;
+}
+
+//############################################################################
+// kmyth_envelope_create_kek()
+//############################################################################
+int kmyth_envelope_create_kek(kmyth_ctx_t * ctx,
+                              uint8_t ** output, size_t *output_len,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              int *pcrs, size_t pcrs_len,
+                              char *expected_policy)
+{
+  uint8_t kek[KMYTH_ENVELOPE_KEK_LEN];
+
+  if (!RAND_bytes(kek, sizeof(kek)))
+  {
+    kmyth_log(LOG_ERR, "unable to generate envelope KEK ... exiting");
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_seal_ctx(ctx, kek, sizeof(kek), output, output_len,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   pcrs, pcrs_len, NULL, expected_policy, 0);
+
+  kmyth_clear(kek, sizeof(kek));
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to seal envelope KEK ... exiting");
+  }
+  return retval;
+}
+
+//############################################################################
+// kmyth_envelope_open_kek()
+//############################################################################
+int kmyth_envelope_open_kek(const uint8_t * kek, size_t kek_len,
+                            kmyth_envelope_t ** env)
+{
+  if (env == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL pointer to envelope key handle ... exiting");
+    return 1;
+  }
+  *env = NULL;
+  if (kek == NULL || (kek_len != 16 && kek_len != 24 && kek_len != 32))
+  {
+    kmyth_log(LOG_ERR, "invalid envelope KEK ... exiting");
+    return 1;
+  }
+
+  kmyth_envelope_t *new_env = kmyth_calloc(1, sizeof(kmyth_envelope_t));
+
+  if (new_env == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate envelope key ... exiting");
+    return 1;
+  }
+
+  // secure arena is best effort: the KEK and DEKs fall back to the heap
+  if (kmyth_arena_init(&new_env->arena, KMYTH_ENVELOPE_ARENA_SIZE))
+  {
+    kmyth_log(LOG_DEBUG, "unable to map secure arena, using the heap");
+  }
+
+  new_env->kek = kmyth_arena_alloc(&new_env->arena, kek_len);
+  if (new_env->kek == NULL)
+  {
+    new_env->kek = kmyth_malloc(kek_len);
+  }
+  if (new_env->kek == NULL ||
+      kmyth_cipher_ctx_create(&new_env->cipher_ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate envelope key ... exiting");
+    kmyth_envelope_close(&new_env);
+    return 1;
+  }
+  memcpy(new_env->kek, kek, kek_len);
+  new_env->kek_len = kek_len;
+
+  if (kek_identifier(new_env->kek, new_env->kek_len, new_env->kek_id))
+  {
+    kmyth_log(LOG_ERR, "unable to identify envelope KEK ... exiting");
+    kmyth_envelope_close(&new_env);
+    return 1;
+  }
+
+  *env = new_env;
+  return 0;
+}
+
+//############################################################################
+// kmyth_envelope_open()
+//############################################################################
+int kmyth_envelope_open(kmyth_ctx_t * ctx,
+                        uint8_t * kek_ski, size_t kek_ski_len,
+                        uint8_t * auth_bytes, size_t auth_bytes_len,
+                        uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                        uint8_t bool_policy_or, kmyth_envelope_t ** env)
+{
+  if (env == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL pointer to envelope key handle ... exiting");
+    return 1;
+  }
+  *env = NULL;
+
+  uint8_t *kek = NULL;
+  size_t kek_len = 0;
+
+  if (tpm2_kmyth_unseal_ctx(ctx, kek_ski, kek_ski_len, &kek, &kek_len,
+                            auth_bytes, auth_bytes_len,
+                            owner_auth_bytes, oa_bytes_len, bool_policy_or))
+  {
+    kmyth_log(LOG_ERR, "unable to unseal envelope KEK ... exiting");
+    return 1;
+  }
+
+  int retval = kmyth_envelope_open_kek(kek, kek_len, env);
+
+  kmyth_clear_and_free(kek, kek_len);
+  return retval;
+}
+
+//############################################################################
+// kmyth_envelope_close()
+//############################################################################
+void kmyth_envelope_close(kmyth_envelope_t ** env)
+{
+  if (env == NULL || *env == NULL)
+  {
+    return;
+  }
+
+  kmyth_arena_release(&(*env)->arena, (*env)->kek, (*env)->kek_len);
+  kmyth_arena_free(&(*env)->arena);
+  kmyth_cipher_ctx_destroy(&(*env)->cipher_ctx);
+  kmyth_clear(*env, sizeof(kmyth_envelope_t));
+
+  kmyth_free(*env);
+  *env = NULL;
+}
+
+//############################################################################
+// kmyth_envelope_seal()
+//############################################################################
+int kmyth_envelope_seal(kmyth_envelope_t * env,
+                        uint8_t * input, size_t input_len,
+                        char *cipher_string,
+                        uint8_t ** output, size_t *output_len)
+{
+  if (env == NULL || input == NULL || input_len == 0 ||
+      output == NULL || output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid envelope seal parameters ... exiting");
+    return 1;
+  }
+  *output = NULL;
+  *output_len = 0;
+
+  if (cipher_string == NULL)
+  {
+    cipher_string = KMYTH_DEFAULT_CIPHER;
+  }
+  cipher_t cipher = kmyth_get_cipher_t_from_string(cipher_string);
+
+  if (cipher.cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
+    return 1;
+  }
+  cipher.ctx = env->cipher_ctx;
+
+  // encrypt the data under a fresh DEK, drawn from the arena and released
+  // (wiped) as soon as it has been wrapped
+  size_t dek_len = get_key_len_from_cipher(cipher) / 8;
+
+  if (dek_len == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid key length for %s ... exiting",
+              cipher.cipher_name);
+    return 1;
+  }
+
+  uint8_t *dek = kmyth_arena_alloc(&env->arena, dek_len);
+
+  if (dek == NULL)
+  {
+    dek = kmyth_calloc(1, dek_len);
+  }
+  if (dek == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate envelope DEK ... exiting");
+    return 1;
+  }
+
+  uint8_t *enc_data = NULL;
+  size_t enc_data_len = 0;
+  uint8_t *wrapped_dek = NULL;
+  size_t wrapped_dek_len = 0;
+  int retval = 0;
+
+  if (kmyth_encrypt_data(input, input_len, cipher, &enc_data, &enc_data_len,
+                         &dek, &dek_len))
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt enveloped data ... exiting");
+    retval = 1;
+  }
+  else if (aes_keywrap_5649pad_encrypt_ctx(env->cipher_ctx,
+                                           env->kek, env->kek_len,
+                                           dek, dek_len,
+                                           &wrapped_dek, &wrapped_dek_len))
+  {
+    kmyth_log(LOG_ERR, "unable to wrap envelope DEK ... exiting");
+    retval = 1;
+  }
+  kmyth_arena_release(&env->arena, dek, dek_len);
+  if (retval)
+  {
+    kmyth_free(enc_data);
+    return 1;
+  }
+
+  // base64 encode the binary blocks
+  uint8_t *id64 = NULL;
+  size_t id64_len = 0;
+  uint8_t *wrapped64 = NULL;
+  size_t wrapped64_len = 0;
+  uint8_t *enc64 = NULL;
+  size_t enc64_len = 0;
+
+  retval = encodeBase64Data(env->kek_id, KMYTH_ENVELOPE_KEK_ID_LEN,
+                            &id64, &id64_len) ||
+    encodeBase64Data(wrapped_dek, wrapped_dek_len,
+                     &wrapped64, &wrapped64_len) ||
+    encodeBase64Data(enc_data, enc_data_len, &enc64, &enc64_len);
+  kmyth_free(wrapped_dek);
+  kmyth_free(enc_data);
+
+  // assemble the envelope (in a single allocation, as every piece's size
+  // is known)
+  size_t cipher_name_len = strlen(cipher.cipher_name);
+  kmyth_byte_buffer out;
+
+  retval = retval ||
+    init_byte_buffer(&out, strlen(KMYTH_DELIM_ENVELOPE_KEK_ID) + id64_len +
+                     strlen(KMYTH_DELIM_CIPHER_SUITE) + cipher_name_len + 1 +
+                     strlen(KMYTH_DELIM_WRAPPED_DEK) + wrapped64_len +
+                     strlen(KMYTH_DELIM_ENC_DATA) + enc64_len +
+                     strlen(KMYTH_DELIM_END_FILE));
+  if (!retval)
+  {
+    retval =
+      append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_ENVELOPE_KEK_ID,
+                            strlen(KMYTH_DELIM_ENVELOPE_KEK_ID)) ||
+      append_to_byte_buffer(&out, id64, id64_len) ||
+      append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_CIPHER_SUITE,
+                            strlen(KMYTH_DELIM_CIPHER_SUITE)) ||
+      append_to_byte_buffer(&out, (uint8_t *) cipher.cipher_name,
+                            cipher_name_len) ||
+      append_to_byte_buffer(&out, (uint8_t *) "\n", 1) ||
+      append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_WRAPPED_DEK,
+                            strlen(KMYTH_DELIM_WRAPPED_DEK)) ||
+      append_to_byte_buffer(&out, wrapped64, wrapped64_len) ||
+      append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_ENC_DATA,
+                            strlen(KMYTH_DELIM_ENC_DATA)) ||
+      append_to_byte_buffer(&out, enc64, enc64_len) ||
+      append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_END_FILE,
+                            strlen(KMYTH_DELIM_END_FILE));
+    if (retval)
+    {
+      free_byte_buffer(&out);
+    }
+  }
+  kmyth_free(id64);
+  kmyth_free(wrapped64);
+  kmyth_free(enc64);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error creating envelope ... exiting");
+    return 1;
+  }
+
+  detach_byte_buffer(&out, output, output_len);
+  return 0;
+}
+
+//############################################################################
+// kmyth_envelope_unseal()
+//############################################################################
+int kmyth_envelope_unseal(kmyth_envelope_t * env,
+                          uint8_t * input, size_t input_len,
+                          uint8_t ** output, size_t *output_len)
+{
+  if (env == NULL || input == NULL || input_len == 0 ||
+      output == NULL || output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid envelope unseal parameters ... exiting");
+    return 1;
+  }
+  *output = NULL;
+  *output_len = 0;
+
+  // locate the blocks, as views into the input
+  uint8_t *position = input;
+  size_t remaining = input_len;
+  uint8_t *raw_id = NULL;
+  size_t raw_id_size = 0;
+  uint8_t *raw_cipher_str = NULL;
+  size_t raw_cipher_str_size = 0;
+  uint8_t *raw_wrapped = NULL;
+  size_t raw_wrapped_size = 0;
+  uint8_t *raw_enc = NULL;
+  size_t raw_enc_size = 0;
+
+  if (get_block_view(&position, &remaining, &raw_id, &raw_id_size,
+                     KMYTH_DELIM_ENVELOPE_KEK_ID,
+                     strlen(KMYTH_DELIM_ENVELOPE_KEK_ID),
+                     KMYTH_DELIM_CIPHER_SUITE,
+                     strlen(KMYTH_DELIM_CIPHER_SUITE)) ||
+      get_block_view(&position, &remaining, &raw_cipher_str,
+                     &raw_cipher_str_size, KMYTH_DELIM_CIPHER_SUITE,
+                     strlen(KMYTH_DELIM_CIPHER_SUITE),
+                     KMYTH_DELIM_WRAPPED_DEK,
+                     strlen(KMYTH_DELIM_WRAPPED_DEK)) ||
+      get_block_view(&position, &remaining, &raw_wrapped, &raw_wrapped_size,
+                     KMYTH_DELIM_WRAPPED_DEK,
+                     strlen(KMYTH_DELIM_WRAPPED_DEK),
+                     KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA)) ||
+      get_block_view(&position, &remaining, &raw_enc, &raw_enc_size,
+                     KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA),
+                     KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE)))
+  {
+    kmyth_log(LOG_ERR, "unable to parse envelope ... exiting");
+    return 1;
+  }
+  if (remaining != strlen(KMYTH_DELIM_END_FILE) ||
+      memcmp(position, KMYTH_DELIM_END_FILE, remaining))
+  {
+    kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
+    return 1;
+  }
+
+  // check that the envelope was made under this KEK
+  uint8_t *kek_id = NULL;
+  size_t kek_id_len = 0;
+
+  if (decodeBase64Data(raw_id, raw_id_size, &kek_id, &kek_id_len))
+  {
+    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    return 1;
+  }
+  int mismatch = (kek_id_len != KMYTH_ENVELOPE_KEK_ID_LEN) ||
+    memcmp(kek_id, env->kek_id, KMYTH_ENVELOPE_KEK_ID_LEN);
+
+  kmyth_free(kek_id);
+  if (mismatch)
+  {
+    kmyth_log(LOG_ERR, "envelope was made under another KEK ... exiting");
+    return 1;
+  }
+
+  // the cipher suite block ends with a newline, which is replaced by the
+  // terminator in a local copy
+  char cipher_str[128];
+
+  if (raw_cipher_str_size > sizeof(cipher_str))
+  {
+    kmyth_log(LOG_ERR, "cipher string too long ... exiting");
+    return 1;
+  }
+  memcpy(cipher_str, raw_cipher_str, raw_cipher_str_size - 1);
+  cipher_str[raw_cipher_str_size - 1] = '\0';
+
+  cipher_t cipher = kmyth_get_cipher_t_from_string(cipher_str);
+
+  if (cipher.cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "cipher_t init error ... exiting");
+    return 1;
+  }
+  cipher.ctx = env->cipher_ctx;
+
+  uint8_t *wrapped_dek = NULL;
+  size_t wrapped_dek_len = 0;
+  uint8_t *enc_data = NULL;
+  size_t enc_data_len = 0;
+
+  if (decodeBase64Data(raw_wrapped, raw_wrapped_size,
+                       &wrapped_dek, &wrapped_dek_len) ||
+      decodeBase64Data(raw_enc, raw_enc_size, &enc_data, &enc_data_len))
+  {
+    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    kmyth_free(wrapped_dek);
+    kmyth_free(enc_data);
+    return 1;
+  }
+
+  // unwrap the DEK and decrypt the data with it
+  uint8_t *dek = NULL;
+  size_t dek_len = 0;
+  int retval = 0;
+
+  if (aes_keywrap_5649pad_decrypt_ctx(env->cipher_ctx,
+                                      env->kek, env->kek_len,
+                                      wrapped_dek, wrapped_dek_len,
+                                      &dek, &dek_len))
+  {
+    kmyth_log(LOG_ERR, "unable to unwrap envelope DEK ... exiting");
+    retval = 1;
+  }
+  else if (kmyth_decrypt_data(enc_data, enc_data_len, cipher, dek, dek_len,
+                              output, output_len))
+  {
+    kmyth_log(LOG_ERR, "unable to decrypt enveloped data ... exiting");
+    *output = NULL;
+    *output_len = 0;
+    retval = 1;
+  }
+
+  kmyth_clear_and_free(dek, dek_len);
+  kmyth_free(wrapped_dek);
+  kmyth_free(enc_data);
+  return retval;
+}
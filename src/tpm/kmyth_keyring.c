@@ -0,0 +1,264 @@
+/**
+ * @file  kmyth_keyring.c
+ *
+ * @brief Implements the optional cross-process cache of unsealed data in
+ *        the Linux kernel keyring (see kmyth_keyring.h).
+ */
+
+#include "kmyth_keyring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/keyctl.h>
+#include <sys/syscall.h>
+
+#include "defines.h"
+#include "memory_util.h"
+#include "metrics.h"
+
+/**
+ * @brief Permissions of a cached entry: its possessor may read it and set
+ *        its attributes, other processes of the same user may only read
+ *        it, and no one else may even see it. The bits are those of
+ *        keyctl_setperm(3), which the kernel headers do not define.
+ */
+#define KMYTH_KEYRING_KEY_PERM 0x2b0b0000
+
+/**
+ * @brief A parsed keyring specification (see set_keyring_spec())
+ */
+typedef struct
+{
+  // special keyring ID (KEY_SPEC_*), or 0 for no caching
+  int32_t keyring;
+
+  // lifetime of each entry, in seconds
+  unsigned int timeout;
+} keyring_selection;
+
+/**
+ * @brief Selection made by set_keyring_spec() (valid if keyring_spec_set)
+ */
+static keyring_selection keyring_override = {.keyring = 0, };
+static bool keyring_spec_set = false;
+
+//############################################################################
+// parse_keyring_spec()
+//############################################################################
+/**
+ * @brief Parses a keyring specification (see set_keyring_spec()).
+ *
+ * @return 0 on success, 1 if the specification is invalid
+ */
+static int parse_keyring_spec(const char *spec, keyring_selection * selection)
+{
+  size_t name_len = strcspn(spec, ":");
+
+  selection->timeout = KMYTH_KEYRING_DEFAULT_TIMEOUT;
+  if (name_len == strlen("user") && strncmp(spec, "user", name_len) == 0)
+  {
+    selection->keyring = KEY_SPEC_USER_KEYRING;
+  }
+  else if (name_len == strlen("session") &&
+           strncmp(spec, "session", name_len) == 0)
+  {
+    selection->keyring = KEY_SPEC_SESSION_KEYRING;
+  }
+  else if (name_len == strlen("none") && strncmp(spec, "none", name_len) == 0)
+  {
+    selection->keyring = 0;
+  }
+  else
+  {
+    return 1;
+  }
+
+  if (spec[name_len] == ':')
+  {
+    const char *timeout = spec + name_len + 1;
+    char *end = NULL;
+    unsigned long seconds = strtoul(timeout, &end, 10);
+
+    // an entry that never expires would never see the PCR policy again
+    if (end == timeout || *end != '\0' || timeout[0] == '-' ||
+        seconds == 0 || seconds > UINT32_MAX)
+    {
+      return 1;
+    }
+    selection->timeout = (unsigned int) seconds;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// get_keyring_selection()
+//############################################################################
+/**
+ * @brief Retrieves the keyring selected by set_keyring_spec(), or else by
+ *        the KMYTH_KEYRING_ENV environment variable.
+ */
+static keyring_selection get_keyring_selection(void)
+{
+  if (keyring_spec_set)
+  {
+    return keyring_override;
+  }
+
+  keyring_selection selection = {.keyring = 0, };
+  const char *spec = getenv(KMYTH_KEYRING_ENV);
+
+  if (spec != NULL && spec[0] != '\0' &&
+      parse_keyring_spec(spec, &selection))
+  {
+    kmyth_log(LOG_WARNING, "ignoring invalid $%s (%s)", KMYTH_KEYRING_ENV,
+              spec);
+    selection.keyring = 0;
+  }
+  return selection;
+}
+
+//############################################################################
+// keyring_description()
+//############################################################################
+/**
+ * @brief Formats the description of the key holding the entry for a cache
+ *        key.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int keyring_description(TPM2B_DIGEST * key, char *desc,
+                               size_t desc_size)
+{
+  size_t prefix_len = strlen(KMYTH_KEYRING_DESC_PREFIX);
+
+  if (key == NULL || key->size == 0 ||
+      desc_size < prefix_len + 2 * (size_t) key->size + 1)
+  {
+    return 1;
+  }
+
+  memcpy(desc, KMYTH_KEYRING_DESC_PREFIX, prefix_len);
+  for (size_t i = 0; i < key->size; i++)
+  {
+    snprintf(desc + prefix_len + 2 * i, 3, "%02x", key->buffer[i]);
+  }
+  return 0;
+}
+
+//############################################################################
+// set_keyring_spec()
+//############################################################################
+int set_keyring_spec(const char *spec)
+{
+  if (spec == NULL)
+  {
+    keyring_spec_set = false;
+    return 0;
+  }
+
+  keyring_selection selection = {.keyring = 0, };
+
+  if (parse_keyring_spec(spec, &selection))
+  {
+    kmyth_log(LOG_ERR, "invalid keyring selection (%s) ... exiting", spec);
+    return 1;
+  }
+  keyring_override = selection;
+  keyring_spec_set = true;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_keyring_enabled()
+//############################################################################
+bool kmyth_keyring_enabled(void)
+{
+  return get_keyring_selection().keyring != 0;
+}
+
+//############################################################################
+// kmyth_keyring_lookup()
+//############################################################################
+bool kmyth_keyring_lookup(TPM2B_DIGEST * key, uint8_t ** output,
+                          size_t *output_len)
+{
+  keyring_selection selection = get_keyring_selection();
+  char desc[sizeof(KMYTH_KEYRING_DESC_PREFIX) + 2 * sizeof(key->buffer)];
+
+  if (selection.keyring == 0 || output == NULL || output_len == NULL ||
+      keyring_description(key, desc, sizeof(desc)))
+  {
+    return false;
+  }
+
+  // an expired entry is no longer found, so anything found is current
+  long id = syscall(SYS_keyctl, KEYCTL_SEARCH, selection.keyring,
+                    KMYTH_KEYRING_KEY_TYPE, desc, 0);
+  long len = (id < 0) ? -1 : syscall(SYS_keyctl, KEYCTL_READ, id, NULL, 0);
+  uint8_t *data = (len < 0) ? NULL : kmyth_malloc((size_t) len + 1);
+
+  // the entry may expire (or be replaced) between the two reads, so its
+  // size is checked again
+  if (data != NULL &&
+      syscall(SYS_keyctl, KEYCTL_READ, id, data, (size_t) len + 1) == len)
+  {
+    *output = data;
+    *output_len = (size_t) len;
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_KEYRING, 1);
+    kmyth_log(LOG_DEBUG, "keyring cache hit");
+    return true;
+  }
+
+  if (data != NULL)
+  {
+    kmyth_clear_and_free(data, (size_t) len + 1);
+  }
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_KEYRING, 0);
+  return false;
+}
+
+//############################################################################
+// kmyth_keyring_insert()
+//############################################################################
+void kmyth_keyring_insert(TPM2B_DIGEST * key, uint8_t * data,
+                          size_t data_len)
+{
+  keyring_selection selection = get_keyring_selection();
+  char desc[sizeof(KMYTH_KEYRING_DESC_PREFIX) + 2 * sizeof(key->buffer)];
+
+  if (selection.keyring == 0 || data == NULL ||
+      keyring_description(key, desc, sizeof(desc)))
+  {
+    return;
+  }
+  if (data_len > KMYTH_KEYRING_MAX_DATA)
+  {
+    kmyth_log(LOG_DEBUG, "unsealed data too large for the keyring cache");
+    return;
+  }
+
+  long id = syscall(SYS_add_key, KMYTH_KEYRING_KEY_TYPE, desc, data,
+                    data_len, selection.keyring);
+
+  if (id < 0)
+  {
+    kmyth_log(LOG_DEBUG, "unable to add keyring cache entry (%s)",
+              strerror(errno));
+    return;
+  }
+
+  // an entry that cannot be restricted or given a lifetime is not kept
+  if (syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id, selection.timeout) ||
+      syscall(SYS_keyctl, KEYCTL_SETPERM, id, KMYTH_KEYRING_KEY_PERM))
+  {
+    kmyth_log(LOG_WARNING, "unable to restrict keyring cache entry (%s)",
+              strerror(errno));
+    syscall(SYS_keyctl, KEYCTL_INVALIDATE, id);
+  }
+}
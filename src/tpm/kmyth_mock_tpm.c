@@ -0,0 +1,3198 @@
+/**
+ * @file  kmyth_mock_tpm.c
+ *
+ * @brief Implements the in-process mock TPM reached through the "mock" TCTI
+ *        (see kmyth_mock_tpm.h).
+ */
+
+#include "kmyth_mock_tpm.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
+
+#include <tss2/tss2_mu.h>
+
+#include "defines.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+/**
+ * @brief Magic value identifying a mock TCTI context
+ */
+#define KMYTH_MOCK_TCTI_MAGIC 0x6B6D7974684D434BULL
+
+/**
+ * @brief Largest command and response the mock TPM handles
+ */
+#define MOCK_MAX_COMMAND 4096
+#define MOCK_MAX_RESPONSE 4096
+
+/**
+ * @brief Most sessions (authorizations) a command can carry
+ */
+#define MOCK_MAX_AUTHS 3
+
+/**
+ * @brief Largest latency accepted in a configuration (one minute)
+ */
+#define MOCK_MAX_LATENCY_NS 60000000000ULL
+
+/**
+ * @brief Magic values at the start of the private blobs and saved contexts
+ *        the mock TPM hands out
+ */
+#define MOCK_PRIVATE_MAGIC 0x4B4D4350U  // "KMCP"
+#define MOCK_CONTEXT_MAGIC 0x4B4D4343U  // "KMCC"
+
+/**
+ * @brief Stands in for the TPM's proof value: it keys the integrity HMAC of
+ *        private blobs, saved contexts and tickets. It is fixed so that
+ *        blobs stay usable from one process to the next (which is also why
+ *        the mock protects nothing).
+ */
+static const char mock_proof[] = "kmyth mock TPM proof value";
+
+/**
+ * @brief Response codes for errors tied to a parameter, handle or session
+ *        (numbered from 1, as in the TPM 2.0 specification)
+ */
+#define MOCK_RC_P(rc, n) ((rc) + TPM2_RC_P + TPM2_RC_1 * (n))
+#define MOCK_RC_H(rc, n) ((rc) + TPM2_RC_H + TPM2_RC_1 * (n))
+#define MOCK_RC_S(rc, n) ((rc) + TPM2_RC_S + TPM2_RC_1 * (n))
+
+/**
+ * @brief Command the mock TPM answers
+ */
+typedef struct
+{
+  TPM2_CC cc;
+
+  // name used in the latency configuration (as in the TPM statistics)
+  const char *name;
+
+  // handles in the handle area, how many of them (from the first) need an
+  // authorization, and whether the response carries a handle
+  size_t handles;
+  size_t auth_handles;
+  bool rsp_handle;
+} mock_command_info;
+
+static const mock_command_info mock_commands[] = {
+  {TPM2_CC_EvictControl, "EvictControl", 2, 1, false},
+  {TPM2_CC_CreatePrimary, "CreatePrimary", 1, 1, true},
+  {TPM2_CC_Startup, "Startup", 0, 0, false},
+  {TPM2_CC_Create, "Create", 1, 1, false},
+  {TPM2_CC_Load, "Load", 1, 1, true},
+  {TPM2_CC_Unseal, "Unseal", 1, 1, false},
+  {TPM2_CC_ContextLoad, "ContextLoad", 0, 0, true},
+  {TPM2_CC_ContextSave, "ContextSave", 1, 0, false},
+  {TPM2_CC_FlushContext, "FlushContext", 0, 0, false},
+  {TPM2_CC_PolicyAuthValue, "PolicyAuthValue", 1, 0, false},
+  {TPM2_CC_PolicyOR, "PolicyOR", 1, 0, false},
+  {TPM2_CC_PolicyAuthorize, "PolicyAuthorize", 1, 0, false},
+  {TPM2_CC_LoadExternal, "LoadExternal", 0, 0, true},
+  {TPM2_CC_VerifySignature, "VerifySignature", 1, 0, false},
+  {TPM2_CC_ReadPublic, "ReadPublic", 1, 0, false},
+  {TPM2_CC_StartAuthSession, "StartAuthSession", 2, 0, true},
+  {TPM2_CC_GetCapability, "GetCapability", 0, 0, false},
+  {TPM2_CC_GetRandom, "GetRandom", 0, 0, false},
+  {TPM2_CC_PCR_Read, "PCR_Read", 0, 0, false},
+  {TPM2_CC_PolicyPCR, "PolicyPCR", 1, 0, false},
+  {TPM2_CC_PCR_Extend, "PCR_Extend", 1, 1, false},
+  {TPM2_CC_PolicyGetDigest, "PolicyGetDigest", 1, 0, false},
+};
+
+#define MOCK_COMMAND_COUNT (sizeof(mock_commands) / sizeof(mock_commands[0]))
+
+/**
+ * @brief Latency of a command
+ */
+typedef struct
+{
+  uint64_t delay_ns;
+  uint64_t jitter_ns;
+  bool set;
+} mock_latency;
+
+/**
+ * @brief Latency configuration of a connection
+ */
+typedef struct
+{
+  mock_latency latency[MOCK_COMMAND_COUNT];
+  mock_latency default_latency;
+  uint64_t seed;
+} mock_config;
+
+/**
+ * @brief Object loaded in the mock TPM (handle 0 marks a free slot)
+ */
+typedef struct
+{
+  TPM2_HANDLE handle;
+
+  // hierarchy the object belongs to
+  TPM2_HANDLE hierarchy;
+
+  TPM2B_PUBLIC public;
+  TPM2B_NAME name;
+  TPM2B_AUTH auth;
+  TPM2B_SENSITIVE_DATA data;
+
+  // loaded with LoadExternal (public part only)
+  bool external;
+} mock_object;
+
+/**
+ * @brief Policy (or trial) session of the mock TPM (handle 0 marks a free
+ *        slot)
+ */
+typedef struct
+{
+  TPM2_HANDLE handle;
+  bool trial;
+  TPM2B_NONCE nonce_tpm;
+  TPM2B_DIGEST digest;
+
+  // PolicyAuthValue was run: the authValue keys the command HMAC
+  bool auth_value_needed;
+
+  // PolicyPCR was run, when the PCR update counter was pcr_counter
+  bool pcr_checked;
+  uint32_t pcr_counter;
+} mock_session;
+
+/**
+ * @brief Mock TCTI context. The common part comes first, so that the TSS
+ *        can use it as any other TCTI context.
+ */
+typedef struct
+{
+  TSS2_TCTI_CONTEXT_COMMON_V2 common;
+
+  mock_config config;
+
+  // state of the jitter generator (xorshift64*)
+  uint64_t rng;
+
+  // transient objects and sessions of this connection
+  mock_object objects[KMYTH_MOCK_MAX_OBJECTS];
+  mock_session sessions[KMYTH_MOCK_MAX_SESSIONS];
+
+  // response to the command transmitted, and when it is due
+  bool pending;
+  struct timespec due;
+  size_t response_size;
+  uint8_t response[MOCK_MAX_RESPONSE];
+} mock_tcti_ctx;
+
+/**
+ * @brief State shared by every connection (the TPM itself): persistent
+ *        objects and PCRs
+ */
+static mock_object mock_persistent[KMYTH_MOCK_MAX_PERSISTENT];
+static uint8_t mock_pcrs[KMYTH_MOCK_PCR_COUNT][TPM2_SHA256_DIGEST_SIZE];
+static uint32_t mock_pcr_counter = 0;
+static uint64_t mock_context_sequence = 0;
+
+/**
+ * @brief Guards the shared state; commands run one at a time, as on a TPM
+ */
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// mock_command_lookup()
+//############################################################################
+static const mock_command_info *mock_command_lookup(TPM2_CC cc)
+{
+  for (size_t i = 0; i < MOCK_COMMAND_COUNT; i++)
+  {
+    if (mock_commands[i].cc == cc)
+    {
+      return &(mock_commands[i]);
+    }
+  }
+  return NULL;
+}
+
+//############################################################################
+// mock_parse_time()
+//############################################################################
+/**
+ * @brief Parses a time ("<number>[ns|us|ms|s]", default ms) into ns.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_parse_time(const char *str, uint64_t *ns)
+{
+  char *end = NULL;
+
+  errno = 0;
+  double value = strtod(str, &end);
+
+  if (end == str || errno != 0 || !(value >= 0.0))
+  {
+    return 1;
+  }
+
+  double scale = 1e6;
+
+  if (strcasecmp(end, "ns") == 0)
+  {
+    scale = 1.0;
+  }
+  else if (strcasecmp(end, "us") == 0)
+  {
+    scale = 1e3;
+  }
+  else if (strcasecmp(end, "ms") == 0 || *end == '\0')
+  {
+    scale = 1e6;
+  }
+  else if (strcasecmp(end, "s") == 0)
+  {
+    scale = 1e9;
+  }
+  else
+  {
+    return 1;
+  }
+
+  value *= scale;
+  if (value > (double) MOCK_MAX_LATENCY_NS)
+  {
+    return 1;
+  }
+  *ns = (uint64_t) value;
+
+  return 0;
+}
+
+//############################################################################
+// mock_parse_latency()
+//############################################################################
+/**
+ * @brief Parses a latency ("<time>[~<jitter>]"); the string is modified.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_parse_latency(char *str, mock_latency * latency)
+{
+  char *jitter = strchr(str, '~');
+
+  latency->jitter_ns = 0;
+  if (jitter != NULL)
+  {
+    *jitter++ = '\0';
+    if (mock_parse_time(jitter, &(latency->jitter_ns)))
+    {
+      return 1;
+    }
+  }
+  if (mock_parse_time(str, &(latency->delay_ns)))
+  {
+    return 1;
+  }
+  latency->set = true;
+
+  return 0;
+}
+
+//############################################################################
+// mock_parse_config()
+//############################################################################
+/**
+ * @brief Parses the latency configuration of a connection.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_parse_config(const char *conf, mock_config * config)
+{
+  memset(config, 0, sizeof(mock_config));
+  config->seed = 1;
+
+  if (conf == NULL || *conf == '\0')
+  {
+    return 0;
+  }
+
+  char *copy = kmyth_strdup(conf);
+
+  if (copy == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to copy mock TPM configuration ... exiting");
+    return 1;
+  }
+
+  int retval = 0;
+  char *save = NULL;
+
+  for (char *item = strtok_r(copy, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save))
+  {
+    char *value = strchr(item, '=');
+
+    if (value == NULL || value == item || value[1] == '\0')
+    {
+      kmyth_log(LOG_ERR, "invalid mock TPM setting '%s' ... exiting", item);
+      retval = 1;
+      break;
+    }
+    *value++ = '\0';
+
+    if (strcasecmp(item, "seed") == 0)
+    {
+      char *end = NULL;
+
+      errno = 0;
+      unsigned long long seed = strtoull(value, &end, 0);
+
+      if (*end != '\0' || errno != 0 || !isdigit((unsigned char) *value))
+      {
+        kmyth_log(LOG_ERR, "invalid mock TPM seed '%s' ... exiting", value);
+        retval = 1;
+        break;
+      }
+      config->seed = (uint64_t) seed;
+      continue;
+    }
+
+    mock_latency *latency = NULL;
+
+    if (strcasecmp(item, "default") == 0)
+    {
+      latency = &(config->default_latency);
+    }
+    for (size_t i = 0; latency == NULL && i < MOCK_COMMAND_COUNT; i++)
+    {
+      if (strcasecmp(item, mock_commands[i].name) == 0)
+      {
+        latency = &(config->latency[i]);
+      }
+    }
+    if (latency == NULL)
+    {
+      kmyth_log(LOG_ERR, "unknown mock TPM command '%s' ... exiting", item);
+      retval = 1;
+      break;
+    }
+    if (mock_parse_latency(value, latency))
+    {
+      kmyth_log(LOG_ERR, "invalid mock TPM latency '%s' for %s ... exiting",
+                value, item);
+      retval = 1;
+      break;
+    }
+  }
+
+  kmyth_free(copy);
+
+  return retval;
+}
+
+//############################################################################
+// mock_next_random()
+//############################################################################
+/**
+ * @brief Draws the next value of the (seeded, repeatable) jitter generator.
+ */
+static uint64_t mock_next_random(mock_tcti_ctx * ctx)
+{
+  ctx->rng ^= ctx->rng >> 12;
+  ctx->rng ^= ctx->rng << 25;
+  ctx->rng ^= ctx->rng >> 27;
+  return ctx->rng * 0x2545F4914F6CDD1DULL;
+}
+
+//############################################################################
+// mock_sample_latency()
+//############################################################################
+/**
+ * @brief Picks the latency of one run of a command, in ns.
+ */
+static uint64_t mock_sample_latency(mock_tcti_ctx * ctx, TPM2_CC cc)
+{
+  const mock_latency *latency = &(ctx->config.default_latency);
+
+  for (size_t i = 0; i < MOCK_COMMAND_COUNT; i++)
+  {
+    if (mock_commands[i].cc == cc && ctx->config.latency[i].set)
+    {
+      latency = &(ctx->config.latency[i]);
+    }
+  }
+  if (!latency->set)
+  {
+    return 0;
+  }
+  if (latency->jitter_ns == 0)
+  {
+    return latency->delay_ns;
+  }
+
+  // uniform over delay +/- jitter, never below zero
+  uint64_t span = 2 * latency->jitter_ns + 1;
+  uint64_t offset = mock_next_random(ctx) % span;
+
+  if (latency->delay_ns + offset < latency->jitter_ns)
+  {
+    return 0;
+  }
+  return latency->delay_ns + offset - latency->jitter_ns;
+}
+
+/**
+ * @brief Buffer that hashed or HMACed input is gathered in
+ */
+typedef struct
+{
+  uint8_t data[2 * MOCK_MAX_COMMAND];
+  size_t size;
+  bool overflow;
+} mock_buf;
+
+//############################################################################
+// mock_buf_add()
+//############################################################################
+static void mock_buf_add(mock_buf * buf, const void *data, size_t len)
+{
+  if (len > sizeof(buf->data) - buf->size)
+  {
+    buf->overflow = true;
+    return;
+  }
+  if (len > 0)
+  {
+    memcpy(buf->data + buf->size, data, len);
+    buf->size += len;
+  }
+}
+
+//############################################################################
+// mock_buf_add_be32()
+//############################################################################
+static void mock_buf_add_be32(mock_buf * buf, uint32_t value)
+{
+  uint8_t bytes[4] = { (uint8_t) (value >> 24), (uint8_t) (value >> 16),
+    (uint8_t) (value >> 8), (uint8_t) value
+  };
+
+  mock_buf_add(buf, bytes, sizeof(bytes));
+}
+
+//############################################################################
+// mock_buf_add_be16()
+//############################################################################
+static void mock_buf_add_be16(mock_buf * buf, uint16_t value)
+{
+  uint8_t bytes[2] = { (uint8_t) (value >> 8), (uint8_t) value };
+
+  mock_buf_add(buf, bytes, sizeof(bytes));
+}
+
+//############################################################################
+// mock_sha256()
+//############################################################################
+/**
+ * @brief Hashes data with SHA-256 into a digest of TPM2_SHA256_DIGEST_SIZE
+ *        bytes.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_sha256(const uint8_t * data, size_t len, uint8_t * digest)
+{
+  unsigned int digest_len = 0;
+
+  if (EVP_Digest(data, len, digest, &digest_len, EVP_sha256(), NULL) != 1)
+  {
+    return 1;
+  }
+  return (digest_len == TPM2_SHA256_DIGEST_SIZE) ? 0 : 1;
+}
+
+//############################################################################
+// mock_hmac()
+//############################################################################
+/**
+ * @brief Computes an HMAC-SHA-256 (TPM2_SHA256_DIGEST_SIZE bytes).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_hmac(const uint8_t * key, size_t key_len,
+                     const uint8_t * data, size_t len, uint8_t * mac)
+{
+  static const uint8_t no_key = 0;
+  unsigned int mac_len = 0;
+
+  if (key_len > INT32_MAX ||
+      HMAC(EVP_sha256(), (key_len > 0) ? key : &no_key, (int) key_len,
+           data, len, mac, &mac_len) == NULL)
+  {
+    return 1;
+  }
+  return (mac_len == TPM2_SHA256_DIGEST_SIZE) ? 0 : 1;
+}
+
+//############################################################################
+// mock_proof_hmac()
+//############################################################################
+/**
+ * @brief Computes an HMAC keyed with the mock proof value.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_proof_hmac(const mock_buf * buf, uint8_t * mac)
+{
+  if (buf->overflow)
+  {
+    return 1;
+  }
+  return mock_hmac((const uint8_t *) mock_proof, sizeof(mock_proof) - 1,
+                   buf->data, buf->size, mac);
+}
+
+//############################################################################
+// mock_name_object()
+//############################################################################
+/**
+ * @brief Computes the name of an object: its name algorithm (big-endian)
+ *        followed by the hash of its public area.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_name_object(const TPMT_PUBLIC * public, TPM2B_NAME * name)
+{
+  uint8_t marshaled[sizeof(TPMT_PUBLIC)];
+  size_t len = 0;
+
+  if (Tss2_MU_TPMT_PUBLIC_Marshal(public, marshaled, sizeof(marshaled), &len)
+      != TSS2_RC_SUCCESS)
+  {
+    return 1;
+  }
+
+  name->name[0] = (uint8_t) (public->nameAlg >> 8);
+  name->name[1] = (uint8_t) public->nameAlg;
+  if (mock_sha256(marshaled, len, name->name + 2))
+  {
+    return 1;
+  }
+  name->size = 2 + TPM2_SHA256_DIGEST_SIZE;
+
+  return 0;
+}
+
+//############################################################################
+// mock_find_object()
+//############################################################################
+/**
+ * @brief Finds a transient (this connection) or persistent object.
+ *
+ * @return The object, or NULL if the handle does not name one
+ */
+static mock_object *mock_find_object(mock_tcti_ctx * ctx, TPM2_HANDLE handle)
+{
+  mock_object *objects = ctx->objects;
+  size_t count = KMYTH_MOCK_MAX_OBJECTS;
+
+  if ((handle & TPM2_HR_RANGE_MASK) == TPM2_HR_PERSISTENT)
+  {
+    objects = mock_persistent;
+    count = KMYTH_MOCK_MAX_PERSISTENT;
+  }
+  else if ((handle & TPM2_HR_RANGE_MASK) != TPM2_HR_TRANSIENT)
+  {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (handle != 0 && objects[i].handle == handle)
+    {
+      return &(objects[i]);
+    }
+  }
+  return NULL;
+}
+
+//############################################################################
+// mock_add_object()
+//############################################################################
+/**
+ * @brief Takes a free transient object slot, giving it its handle.
+ *
+ * @return The object, or NULL if the connection holds too many objects
+ */
+static mock_object *mock_add_object(mock_tcti_ctx * ctx)
+{
+  for (size_t i = 0; i < KMYTH_MOCK_MAX_OBJECTS; i++)
+  {
+    if (ctx->objects[i].handle == 0)
+    {
+      memset(&(ctx->objects[i]), 0, sizeof(mock_object));
+      ctx->objects[i].handle = TPM2_HR_TRANSIENT + (TPM2_HANDLE) i;
+      return &(ctx->objects[i]);
+    }
+  }
+  return NULL;
+}
+
+//############################################################################
+// mock_find_session()
+//############################################################################
+static mock_session *mock_find_session(mock_tcti_ctx * ctx,
+                                       TPM2_HANDLE handle)
+{
+  for (size_t i = 0; i < KMYTH_MOCK_MAX_SESSIONS; i++)
+  {
+    if (handle != 0 && ctx->sessions[i].handle == handle)
+    {
+      return &(ctx->sessions[i]);
+    }
+  }
+  return NULL;
+}
+
+//############################################################################
+// mock_entity_name()
+//############################################################################
+/**
+ * @brief Adds the name of the entity a handle refers to (for a command
+ *        parameter hash): an object's name, or the handle itself.
+ */
+static void mock_entity_name(mock_tcti_ctx * ctx, TPM2_HANDLE handle,
+                             mock_buf * buf)
+{
+  mock_object *object = mock_find_object(ctx, handle);
+
+  if (object != NULL)
+  {
+    mock_buf_add(buf, object->name.name, object->name.size);
+  }
+  else
+  {
+    mock_buf_add_be32(buf, handle);
+  }
+}
+
+//############################################################################
+// mock_wrap()
+//############################################################################
+/**
+ * @brief Builds an integrity protected blob: magic, content, and an HMAC
+ *        (keyed with the proof value) over binding, magic and content.
+ *
+ * @return 0 on success, 1 if the blob does not fit
+ */
+static int mock_wrap(uint32_t magic, const uint8_t * binding,
+                     size_t binding_len, const uint8_t * content,
+                     size_t content_len, uint8_t * blob, size_t blob_max,
+                     uint16_t *blob_len)
+{
+  size_t len = 4 + content_len + TPM2_SHA256_DIGEST_SIZE;
+
+  if (len > blob_max || len > UINT16_MAX)
+  {
+    return 1;
+  }
+
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  mock_buf_add(&buf, binding, binding_len);
+  mock_buf_add_be32(&buf, magic);
+  mock_buf_add(&buf, content, content_len);
+
+  memcpy(blob, buf.data + binding_len, 4 + content_len);
+  if (mock_proof_hmac(&buf, blob + 4 + content_len))
+  {
+    return 1;
+  }
+  *blob_len = (uint16_t) len;
+
+  return 0;
+}
+
+//############################################################################
+// mock_unwrap()
+//############################################################################
+/**
+ * @brief Checks a blob built by mock_wrap() with the same magic and
+ *        binding, and locates its content.
+ *
+ * @return 0 if the blob is intact, 1 otherwise
+ */
+static int mock_unwrap(uint32_t magic, const uint8_t * binding,
+                       size_t binding_len, const uint8_t * blob,
+                       size_t blob_len, const uint8_t ** content,
+                       size_t *content_len)
+{
+  if (blob_len < 4 + TPM2_SHA256_DIGEST_SIZE)
+  {
+    return 1;
+  }
+
+  size_t len = blob_len - TPM2_SHA256_DIGEST_SIZE;
+  uint32_t found = ((uint32_t) blob[0] << 24) | ((uint32_t) blob[1] << 16) |
+    ((uint32_t) blob[2] << 8) | (uint32_t) blob[3];
+
+  if (found != magic)
+  {
+    return 1;
+  }
+
+  mock_buf buf = {.size = 0,.overflow = false };
+  uint8_t mac[TPM2_SHA256_DIGEST_SIZE];
+
+  mock_buf_add(&buf, binding, binding_len);
+  mock_buf_add(&buf, blob, len);
+  if (mock_proof_hmac(&buf, mac) ||
+      CRYPTO_memcmp(mac, blob + len, sizeof(mac)) != 0)
+  {
+    return 1;
+  }
+
+  *content = blob + 4;
+  *content_len = len - 4;
+
+  return 0;
+}
+
+/**
+ * @brief Command being run by the mock TPM
+ */
+typedef struct
+{
+  const mock_command_info *info;
+  TPM2_CC cc;
+  TPM2_HANDLE handles[2];
+
+  // sessions, one per handle needing an authorization
+  size_t auth_count;
+  TPMS_AUTH_COMMAND auths[MOCK_MAX_AUTHS];
+
+  // parameter area
+  const uint8_t *params;
+  size_t params_size;
+} mock_command;
+
+/**
+ * @brief Response handle and parameter area filled in by a command handler
+ */
+typedef struct
+{
+  TPM2_HANDLE handle;
+  size_t size;
+  uint8_t params[MOCK_MAX_RESPONSE];
+} mock_reply;
+
+/**
+ * @brief Unmarshals parameter n (numbered from 1) of the command into var
+ *        (a TSS2 type), returning from the handler if it is missing or
+ *        malformed. The handler keeps its parameter offset in 'off'.
+ */
+#define MOCK_UNMARSHAL(type, var, n)                                        \
+  if (Tss2_MU_##type##_Unmarshal(cmd->params, cmd->params_size, &off,       \
+                                 &(var)) != TSS2_RC_SUCCESS)                \
+  {                                                                         \
+    return MOCK_RC_P(TPM2_RC_INSUFFICIENT, n);                              \
+  }
+
+/**
+ * @brief Marshals a response parameter (a TSS2 type), returning from the
+ *        handler if the response does not fit.
+ */
+#define MOCK_MARSHAL(type, value)                                           \
+  if (Tss2_MU_##type##_Marshal(value, reply->params, sizeof(reply->params), \
+                               &(reply->size)) != TSS2_RC_SUCCESS)          \
+  {                                                                         \
+    return TPM2_RC_MEMORY;                                                  \
+  }
+
+//############################################################################
+// mock_parse_command()
+//############################################################################
+/**
+ * @brief Splits a command into its header, handle, session and parameter
+ *        areas.
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of a malformed command
+ */
+static TPM2_RC mock_parse_command(const uint8_t * command, size_t size,
+                                  mock_command * cmd)
+{
+  size_t off = 0;
+  TPM2_ST tag = 0;
+  uint32_t command_size = 0;
+
+  memset(cmd, 0, sizeof(mock_command));
+  if (Tss2_MU_UINT16_Unmarshal(command, size, &off, &tag) != TSS2_RC_SUCCESS ||
+      Tss2_MU_UINT32_Unmarshal(command, size, &off, &command_size) !=
+      TSS2_RC_SUCCESS ||
+      Tss2_MU_UINT32_Unmarshal(command, size, &off, &(cmd->cc)) !=
+      TSS2_RC_SUCCESS)
+  {
+    return TPM2_RC_COMMAND_SIZE;
+  }
+  if (tag != TPM2_ST_SESSIONS && tag != TPM2_ST_NO_SESSIONS)
+  {
+    return TPM2_RC_BAD_TAG;
+  }
+  if (command_size != size)
+  {
+    return TPM2_RC_COMMAND_SIZE;
+  }
+
+  cmd->info = mock_command_lookup(cmd->cc);
+  if (cmd->info == NULL)
+  {
+    return TPM2_RC_COMMAND_CODE;
+  }
+
+  for (size_t i = 0; i < cmd->info->handles; i++)
+  {
+    if (Tss2_MU_UINT32_Unmarshal(command, size, &off, &(cmd->handles[i])) !=
+        TSS2_RC_SUCCESS)
+    {
+      return TPM2_RC_COMMAND_SIZE;
+    }
+  }
+
+  if (tag == TPM2_ST_SESSIONS)
+  {
+    uint32_t auth_size = 0;
+
+    if (Tss2_MU_UINT32_Unmarshal(command, size, &off, &auth_size) !=
+        TSS2_RC_SUCCESS || auth_size == 0 || auth_size > size - off)
+    {
+      return TPM2_RC_AUTHSIZE;
+    }
+
+    size_t auth_end = off + auth_size;
+
+    while (off < auth_end)
+    {
+      if (cmd->auth_count == MOCK_MAX_AUTHS)
+      {
+        return TPM2_RC_AUTH_CONTEXT;
+      }
+      if (Tss2_MU_TPMS_AUTH_COMMAND_Unmarshal(command, auth_end, &off,
+                                              &(cmd->auths[cmd->auth_count]))
+          != TSS2_RC_SUCCESS)
+      {
+        return TPM2_RC_AUTHSIZE;
+      }
+      cmd->auth_count++;
+    }
+  }
+
+  if (cmd->auth_count < cmd->info->auth_handles)
+  {
+    return TPM2_RC_AUTH_MISSING;
+  }
+  if (cmd->auth_count > cmd->info->auth_handles)
+  {
+    return TPM2_RC_AUTH_CONTEXT;
+  }
+
+  cmd->params = command + off;
+  cmd->params_size = size - off;
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_auth_equal()
+//############################################################################
+/**
+ * @brief Compares two authorization values, ignoring trailing zeros as a
+ *        TPM does.
+ */
+static bool mock_auth_equal(const uint8_t * a, size_t a_len,
+                            const uint8_t * b, size_t b_len)
+{
+  while (a_len > 0 && a[a_len - 1] == 0)
+  {
+    a_len--;
+  }
+  while (b_len > 0 && b[b_len - 1] == 0)
+  {
+    b_len--;
+  }
+  return a_len == b_len && CRYPTO_memcmp(a, b, a_len) == 0;
+}
+
+//############################################################################
+// mock_session_hmac()
+//############################################################################
+/**
+ * @brief Computes a command or response HMAC of a policy session:
+ *        HMAC(key, pHash || nonce1 || nonce2 || sessionAttributes), where
+ *        pHash hashes the given parameter hash input.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_session_hmac(const TPM2B_AUTH * key, const mock_buf * p_input,
+                             const TPM2B_NONCE * nonce1,
+                             const TPM2B_NONCE * nonce2,
+                             TPMA_SESSION attributes, uint8_t * mac)
+{
+  uint8_t p_hash[TPM2_SHA256_DIGEST_SIZE];
+
+  if (p_input->overflow || mock_sha256(p_input->data, p_input->size, p_hash))
+  {
+    return 1;
+  }
+
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  mock_buf_add(&buf, p_hash, sizeof(p_hash));
+  mock_buf_add(&buf, nonce1->buffer, nonce1->size);
+  mock_buf_add(&buf, nonce2->buffer, nonce2->size);
+  mock_buf_add(&buf, &attributes, 1);
+
+  return mock_hmac(key->buffer, key->size, buf.data, buf.size, mac);
+}
+
+//############################################################################
+// mock_authorize()
+//############################################################################
+/**
+ * @brief Checks the authorization (session i) of handle i of a command, and
+ *        gives the key its response HMAC will use.
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of a failed authorization
+ */
+static TPM2_RC mock_authorize(mock_tcti_ctx * ctx, const mock_command * cmd,
+                              size_t i, TPM2B_AUTH * rsp_key)
+{
+  const TPMS_AUTH_COMMAND *auth = &(cmd->auths[i]);
+  mock_object *object = mock_find_object(ctx, cmd->handles[i]);
+  unsigned n = (unsigned) i + 1;
+
+  rsp_key->size = 0;
+
+  // password: checked for objects only (hierarchies and PCRs are open)
+  if (auth->sessionHandle == TPM2_RS_PW)
+  {
+    if (object == NULL)
+    {
+      return TPM2_RC_SUCCESS;
+    }
+    if (!(object->public.publicArea.objectAttributes &
+          TPMA_OBJECT_USERWITHAUTH))
+    {
+      return TPM2_RC_AUTH_UNAVAILABLE;
+    }
+    if (!mock_auth_equal(auth->hmac.buffer, auth->hmac.size,
+                         object->auth.buffer, object->auth.size))
+    {
+      return MOCK_RC_S(TPM2_RC_AUTH_FAIL, n);
+    }
+    return TPM2_RC_SUCCESS;
+  }
+
+  mock_session *session = mock_find_session(ctx, auth->sessionHandle);
+
+  if (session == NULL)
+  {
+    return TPM2_RC_REFERENCE_S0 + (TPM2_RC) i;
+  }
+  if (session->trial)
+  {
+    return MOCK_RC_S(TPM2_RC_ATTRIBUTES, n);
+  }
+  if (session->pcr_checked && session->pcr_counter != mock_pcr_counter)
+  {
+    return TPM2_RC_PCR_CHANGED;
+  }
+
+  const TPM2B_DIGEST *policy = NULL;
+
+  if (object != NULL)
+  {
+    policy = &(object->public.publicArea.authPolicy);
+  }
+  if (policy == NULL || policy->size != session->digest.size ||
+      CRYPTO_memcmp(policy->buffer, session->digest.buffer,
+                    policy->size) != 0)
+  {
+    return MOCK_RC_S(TPM2_RC_POLICY_FAIL, n);
+  }
+
+  if (session->auth_value_needed)
+  {
+    *rsp_key = object->auth;
+  }
+  else if (auth->hmac.size == 0)
+  {
+    return TPM2_RC_SUCCESS;
+  }
+
+  // cpHash = H(commandCode || names of the handles || parameters)
+  mock_buf cp = {.size = 0,.overflow = false };
+  uint8_t mac[TPM2_SHA256_DIGEST_SIZE];
+
+  mock_buf_add_be32(&cp, cmd->cc);
+  for (size_t h = 0; h < cmd->info->handles; h++)
+  {
+    mock_entity_name(ctx, cmd->handles[h], &cp);
+  }
+  mock_buf_add(&cp, cmd->params, cmd->params_size);
+
+  if (mock_session_hmac(rsp_key, &cp, &(auth->nonce), &(session->nonce_tpm),
+                        auth->sessionAttributes, mac) ||
+      auth->hmac.size != sizeof(mac) ||
+      CRYPTO_memcmp(auth->hmac.buffer, mac, sizeof(mac)) != 0)
+  {
+    return MOCK_RC_S(TPM2_RC_AUTH_FAIL, n);
+  }
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_new_nonce()
+//############################################################################
+static int mock_new_nonce(TPM2B_NONCE * nonce)
+{
+  nonce->size = TPM2_SHA256_DIGEST_SIZE;
+  return (RAND_bytes(nonce->buffer, nonce->size) == 1) ? 0 : 1;
+}
+
+//############################################################################
+// mock_respond_auth()
+//############################################################################
+/**
+ * @brief Builds the response authorization of session i of a command that
+ *        succeeded, and ends the policy it satisfied.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_respond_auth(mock_tcti_ctx * ctx, const mock_command * cmd,
+                             size_t i, const TPM2B_AUTH * key,
+                             const mock_reply * reply,
+                             TPMS_AUTH_RESPONSE * rsp)
+{
+  const TPMS_AUTH_COMMAND *auth = &(cmd->auths[i]);
+
+  memset(rsp, 0, sizeof(TPMS_AUTH_RESPONSE));
+  rsp->sessionAttributes = auth->sessionAttributes;
+  if (auth->sessionHandle == TPM2_RS_PW)
+  {
+    return 0;
+  }
+
+  mock_session *session = mock_find_session(ctx, auth->sessionHandle);
+
+  if (session == NULL || mock_new_nonce(&(session->nonce_tpm)))
+  {
+    return 1;
+  }
+
+  // rpHash = H(responseCode || commandCode || parameters)
+  mock_buf rp = {.size = 0,.overflow = false };
+
+  mock_buf_add_be32(&rp, TPM2_RC_SUCCESS);
+  mock_buf_add_be32(&rp, cmd->cc);
+  mock_buf_add(&rp, reply->params, reply->size);
+
+  rsp->nonce = session->nonce_tpm;
+  rsp->hmac.size = TPM2_SHA256_DIGEST_SIZE;
+  if (mock_session_hmac(key, &rp, &(session->nonce_tpm), &(auth->nonce),
+                        auth->sessionAttributes, rsp->hmac.buffer))
+  {
+    return 1;
+  }
+
+  // a policy is used up by the command it authorizes
+  memset(&(session->digest), 0, sizeof(TPM2B_DIGEST));
+  session->digest.size = TPM2_SHA256_DIGEST_SIZE;
+  session->auth_value_needed = false;
+  session->pcr_checked = false;
+  if (!(auth->sessionAttributes & TPMA_SESSION_CONTINUESESSION))
+  {
+    memset(session, 0, sizeof(mock_session));
+  }
+
+  return 0;
+}
+
+//############################################################################
+// mock_policy_extend()
+//############################################################################
+/**
+ * @brief Extends a policy digest: H(digest || commandCode || data).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_policy_extend(TPM2B_DIGEST * digest, TPM2_CC cc,
+                              const uint8_t * data, size_t len)
+{
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  mock_buf_add(&buf, digest->buffer, digest->size);
+  mock_buf_add_be32(&buf, cc);
+  mock_buf_add(&buf, data, len);
+  if (buf.overflow || mock_sha256(buf.data, buf.size, digest->buffer))
+  {
+    return 1;
+  }
+  digest->size = TPM2_SHA256_DIGEST_SIZE;
+
+  return 0;
+}
+
+//############################################################################
+// mock_pcr_digest()
+//############################################################################
+/**
+ * @brief Hashes the values of the selected PCRs (SHA-256 bank only), in
+ *        order.
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of an invalid selection
+ *         (parameter n)
+ */
+static TPM2_RC mock_pcr_digest(const TPML_PCR_SELECTION * selection,
+                               unsigned n, TPM2B_DIGEST * digest)
+{
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  for (uint32_t i = 0; i < selection->count; i++)
+  {
+    const TPMS_PCR_SELECTION *sel = &(selection->pcrSelections[i]);
+
+    for (uint32_t pcr = 0; pcr < 8U * sel->sizeofSelect; pcr++)
+    {
+      if (!(sel->pcrSelect[pcr / 8] & (1U << (pcr % 8))))
+      {
+        continue;
+      }
+      if (sel->hash != TPM2_ALG_SHA256 || pcr >= KMYTH_MOCK_PCR_COUNT)
+      {
+        return MOCK_RC_P(TPM2_RC_VALUE, n);
+      }
+      mock_buf_add(&buf, mock_pcrs[pcr], TPM2_SHA256_DIGEST_SIZE);
+    }
+  }
+
+  if (mock_sha256(buf.data, buf.size, digest->buffer))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  digest->size = TPM2_SHA256_DIGEST_SIZE;
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_policy_session()
+//############################################################################
+/**
+ * @brief Finds the policy session named by the first handle of a command.
+ */
+static mock_session *mock_policy_session(mock_tcti_ctx * ctx,
+                                         const mock_command * cmd)
+{
+  return mock_find_session(ctx, cmd->handles[0]);
+}
+
+//############################################################################
+// mock_tpm_properties()
+//############################################################################
+/**
+ * @brief Lists the TPM properties of the mock TPM, in order.
+ *
+ * @return Number of properties
+ */
+static size_t mock_tpm_properties(mock_tcti_ctx * ctx,
+                                  TPMS_TAGGED_PROPERTY * props, size_t max)
+{
+  uint32_t loaded = 0;
+  uint32_t active = 0;
+  uint32_t persistent = 0;
+
+  for (size_t i = 0; i < KMYTH_MOCK_MAX_OBJECTS; i++)
+  {
+    loaded += (ctx->objects[i].handle != 0);
+  }
+  for (size_t i = 0; i < KMYTH_MOCK_MAX_SESSIONS; i++)
+  {
+    active += (ctx->sessions[i].handle != 0);
+  }
+  for (size_t i = 0; i < KMYTH_MOCK_MAX_PERSISTENT; i++)
+  {
+    persistent += (mock_persistent[i].handle != 0);
+  }
+
+  const TPMS_TAGGED_PROPERTY all[] = {
+    {TPM2_PT_FAMILY_INDICATOR, 0x322E3000},
+    {TPM2_PT_LEVEL, 0},
+    {TPM2_PT_REVISION, 159},
+    {TPM2_PT_DAY_OF_YEAR, 1},
+    {TPM2_PT_YEAR, 2024},
+    {TPM2_PT_MANUFACTURER, ((uint32_t) 'K' << 24) | ((uint32_t) 'M' << 16) |
+     ((uint32_t) 'C' << 8) | (uint32_t) 'K'},
+    {TPM2_PT_VENDOR_STRING_1, 0x6B6D7974},  // "kmyt"
+    {TPM2_PT_VENDOR_STRING_2, 0x68206D6F},  // "h mo"
+    {TPM2_PT_VENDOR_STRING_3, 0x636B0000},  // "ck"
+    {TPM2_PT_VENDOR_STRING_4, 0},
+    {TPM2_PT_VENDOR_TPM_TYPE, 0},
+    {TPM2_PT_FIRMWARE_VERSION_1, 0},
+    {TPM2_PT_FIRMWARE_VERSION_2, 0},
+    {TPM2_PT_INPUT_BUFFER, 1024},
+    {TPM2_PT_HR_TRANSIENT_MIN, KMYTH_MOCK_MAX_OBJECTS},
+    {TPM2_PT_HR_PERSISTENT_MIN, KMYTH_MOCK_MAX_PERSISTENT},
+    {TPM2_PT_HR_LOADED_MIN, KMYTH_MOCK_MAX_OBJECTS},
+    {TPM2_PT_ACTIVE_SESSIONS_MAX, KMYTH_MOCK_MAX_SESSIONS},
+    {TPM2_PT_PCR_COUNT, KMYTH_MOCK_PCR_COUNT},
+    {TPM2_PT_PCR_SELECT_MIN, KMYTH_MOCK_PCR_COUNT / 8},
+    {TPM2_PT_CONTEXT_GAP_MAX, UINT16_MAX},
+    {TPM2_PT_NV_COUNTERS_MAX, 0},
+    {TPM2_PT_NV_INDEX_MAX, 0},
+    {TPM2_PT_MEMORY, 0},
+    {TPM2_PT_CLOCK_UPDATE, 4096},
+    {TPM2_PT_CONTEXT_HASH, TPM2_ALG_SHA256},
+    {TPM2_PT_CONTEXT_SYM, TPM2_ALG_AES},
+    {TPM2_PT_CONTEXT_SYM_SIZE, 128},
+    {TPM2_PT_ORDERLY_COUNT, 255},
+    {TPM2_PT_MAX_COMMAND_SIZE, MOCK_MAX_COMMAND},
+    {TPM2_PT_MAX_RESPONSE_SIZE, MOCK_MAX_RESPONSE},
+    {TPM2_PT_MAX_DIGEST, TPM2_SHA256_DIGEST_SIZE},
+    {TPM2_PT_PERMANENT, 0},
+    {TPM2_PT_STARTUP_CLEAR, TPMA_STARTUP_CLEAR_PHENABLE |
+     TPMA_STARTUP_CLEAR_SHENABLE | TPMA_STARTUP_CLEAR_EHENABLE |
+     TPMA_STARTUP_CLEAR_PHENABLENV | TPMA_STARTUP_CLEAR_ORDERLY},
+    {TPM2_PT_HR_NV_INDEX, 0},
+    {TPM2_PT_HR_LOADED, loaded},
+    {TPM2_PT_HR_LOADED_AVAIL, KMYTH_MOCK_MAX_OBJECTS - loaded},
+    {TPM2_PT_HR_ACTIVE, active},
+    {TPM2_PT_HR_ACTIVE_AVAIL, KMYTH_MOCK_MAX_SESSIONS - active},
+    {TPM2_PT_HR_TRANSIENT_AVAIL, KMYTH_MOCK_MAX_OBJECTS - loaded},
+    {TPM2_PT_HR_PERSISTENT, persistent},
+    {TPM2_PT_HR_PERSISTENT_AVAIL, KMYTH_MOCK_MAX_PERSISTENT - persistent},
+  };
+  size_t count = sizeof(all) / sizeof(all[0]);
+
+  if (count > max)
+  {
+    count = max;
+  }
+  memcpy(props, all, count * sizeof(TPMS_TAGGED_PROPERTY));
+
+  return count;
+}
+
+//############################################################################
+// mock_handles()
+//############################################################################
+/**
+ * @brief Lists the handles of one type in use, in order.
+ *
+ * @return Number of handles
+ */
+static size_t mock_handles(mock_tcti_ctx * ctx, TPM2_HANDLE type,
+                           TPM2_HANDLE * handles, size_t max)
+{
+  size_t count = 0;
+
+  switch (type)
+  {
+  case TPM2_HT_TRANSIENT:
+    for (size_t i = 0; i < KMYTH_MOCK_MAX_OBJECTS && count < max; i++)
+    {
+      if (ctx->objects[i].handle != 0)
+      {
+        handles[count++] = ctx->objects[i].handle;
+      }
+    }
+    break;
+  case TPM2_HT_POLICY_SESSION:
+    for (size_t i = 0; i < KMYTH_MOCK_MAX_SESSIONS && count < max; i++)
+    {
+      if (ctx->sessions[i].handle != 0)
+      {
+        handles[count++] = ctx->sessions[i].handle;
+      }
+    }
+    break;
+  case TPM2_HT_PCR:
+    for (TPM2_HANDLE i = 0; i < KMYTH_MOCK_PCR_COUNT && count < max; i++)
+    {
+      handles[count++] = i;
+    }
+    break;
+  case TPM2_HT_PERSISTENT:
+    for (size_t i = 0; i < KMYTH_MOCK_MAX_PERSISTENT && count < max; i++)
+    {
+      if (mock_persistent[i].handle == 0)
+      {
+        continue;
+      }
+
+      // insertion keeps the list in order
+      size_t k = count++;
+
+      while (k > 0 && handles[k - 1] > mock_persistent[i].handle)
+      {
+        handles[k] = handles[k - 1];
+        k--;
+      }
+      handles[k] = mock_persistent[i].handle;
+    }
+    break;
+  default:
+    break;
+  }
+
+  return count;
+}
+
+//############################################################################
+// mock_get_capability()
+//############################################################################
+static TPM2_RC mock_get_capability(mock_tcti_ctx * ctx,
+                                   const mock_command * cmd,
+                                   mock_reply * reply)
+{
+  size_t off = 0;
+  uint32_t capability = 0;
+  uint32_t property = 0;
+  uint32_t count = 0;
+
+  MOCK_UNMARSHAL(UINT32, capability, 1);
+  MOCK_UNMARSHAL(UINT32, property, 2);
+  MOCK_UNMARSHAL(UINT32, count, 3);
+
+  TPMS_CAPABILITY_DATA data;
+  TPMI_YES_NO more = TPM2_NO;
+
+  memset(&data, 0, sizeof(data));
+  data.capability = capability;
+  switch (capability)
+  {
+  case TPM2_CAP_TPM_PROPERTIES:
+    {
+      TPMS_TAGGED_PROPERTY props[64];
+      size_t total = mock_tpm_properties(ctx, props, 64);
+      TPML_TAGGED_TPM_PROPERTY *list = &(data.data.tpmProperties);
+
+      for (size_t i = 0; i < total; i++)
+      {
+        if (props[i].property < property)
+        {
+          continue;
+        }
+        if (list->count == count || list->count == TPM2_MAX_TPM_PROPERTIES)
+        {
+          more = TPM2_YES;
+          break;
+        }
+        list->tpmProperty[list->count++] = props[i];
+      }
+    }
+    break;
+  case TPM2_CAP_HANDLES:
+    {
+      TPM2_HANDLE handles[KMYTH_MOCK_MAX_OBJECTS];
+      size_t total = mock_handles(ctx, property >> TPM2_HR_SHIFT, handles,
+                                  KMYTH_MOCK_MAX_OBJECTS);
+      TPML_HANDLE *list = &(data.data.handles);
+
+      for (size_t i = 0; i < total; i++)
+      {
+        if (handles[i] < property)
+        {
+          continue;
+        }
+        if (list->count == count || list->count == TPM2_MAX_CAP_HANDLES)
+        {
+          more = TPM2_YES;
+          break;
+        }
+        list->handle[list->count++] = handles[i];
+      }
+    }
+    break;
+  case TPM2_CAP_PCR_PROPERTIES:
+    {
+      // no PCR is exempt from the update counter
+      TPML_TAGGED_PCR_PROPERTY *list = &(data.data.pcrProperties);
+
+      if (property <= TPM2_PT_PCR_NO_INCREMENT && count > 0)
+      {
+        list->pcrProperty[0].tag = TPM2_PT_PCR_NO_INCREMENT;
+        list->pcrProperty[0].sizeofSelect = KMYTH_MOCK_PCR_COUNT / 8;
+        list->count = 1;
+      }
+    }
+    break;
+  case TPM2_CAP_PCRS:
+    {
+      TPML_PCR_SELECTION *list = &(data.data.assignedPCR);
+
+      list->count = 1;
+      list->pcrSelections[0].hash = TPM2_ALG_SHA256;
+      list->pcrSelections[0].sizeofSelect = KMYTH_MOCK_PCR_COUNT / 8;
+      memset(list->pcrSelections[0].pcrSelect, 0xFF,
+             KMYTH_MOCK_PCR_COUNT / 8);
+    }
+    break;
+  default:
+    return MOCK_RC_P(TPM2_RC_VALUE, 1);
+  }
+
+  MOCK_MARSHAL(UINT8, more);
+  MOCK_MARSHAL(TPMS_CAPABILITY_DATA, &data);
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_start_auth_session()
+//############################################################################
+static TPM2_RC mock_start_auth_session(mock_tcti_ctx * ctx,
+                                       const mock_command * cmd,
+                                       mock_reply * reply)
+{
+  size_t off = 0;
+  TPM2B_NONCE nonce_caller;
+  TPM2B_ENCRYPTED_SECRET salt;
+  TPM2_SE type = 0;
+  TPMT_SYM_DEF symmetric;
+  TPMI_ALG_HASH auth_hash = 0;
+
+  MOCK_UNMARSHAL(TPM2B_NONCE, nonce_caller, 1);
+  MOCK_UNMARSHAL(TPM2B_ENCRYPTED_SECRET, salt, 2);
+  MOCK_UNMARSHAL(UINT8, type, 3);
+  MOCK_UNMARSHAL(TPMT_SYM_DEF, symmetric, 4);
+  MOCK_UNMARSHAL(UINT16, auth_hash, 5);
+
+  // unsalted, unbound policy sessions only
+  if (cmd->handles[0] != TPM2_RH_NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_VALUE, 1);
+  }
+  if (cmd->handles[1] != TPM2_RH_NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_VALUE, 2);
+  }
+  if (salt.size != 0)
+  {
+    return MOCK_RC_P(TPM2_RC_VALUE, 2);
+  }
+  if (type != TPM2_SE_POLICY && type != TPM2_SE_TRIAL)
+  {
+    return MOCK_RC_P(TPM2_RC_VALUE, 3);
+  }
+  if (auth_hash != TPM2_ALG_SHA256)
+  {
+    return MOCK_RC_P(TPM2_RC_HASH, 5);
+  }
+  if (nonce_caller.size < 16)
+  {
+    return MOCK_RC_P(TPM2_RC_SIZE, 1);
+  }
+
+  for (size_t i = 0; i < KMYTH_MOCK_MAX_SESSIONS; i++)
+  {
+    mock_session *session = &(ctx->sessions[i]);
+
+    if (session->handle != 0)
+    {
+      continue;
+    }
+    memset(session, 0, sizeof(mock_session));
+    if (mock_new_nonce(&(session->nonce_tpm)))
+    {
+      return TPM2_RC_FAILURE;
+    }
+    session->handle = TPM2_HR_POLICY_SESSION + (TPM2_HANDLE) i;
+    session->trial = (type == TPM2_SE_TRIAL);
+    session->digest.size = TPM2_SHA256_DIGEST_SIZE;
+
+    reply->handle = session->handle;
+    MOCK_MARSHAL(TPM2B_NONCE, &(session->nonce_tpm));
+
+    return TPM2_RC_SUCCESS;
+  }
+
+  return TPM2_RC_SESSION_MEMORY;
+}
+
+//############################################################################
+// mock_policy_auth_value()
+//############################################################################
+static TPM2_RC mock_policy_auth_value(mock_tcti_ctx * ctx,
+                                      const mock_command * cmd)
+{
+  mock_session *session = mock_policy_session(ctx, cmd);
+
+  if (session == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+  if (mock_policy_extend(&(session->digest), TPM2_CC_PolicyAuthValue,
+                         NULL, 0))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  session->auth_value_needed = true;
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_policy_pcr()
+//############################################################################
+static TPM2_RC mock_policy_pcr(mock_tcti_ctx * ctx, const mock_command * cmd)
+{
+  size_t off = 0;
+  TPM2B_DIGEST pcr_digest;
+  TPML_PCR_SELECTION pcrs;
+
+  MOCK_UNMARSHAL(TPM2B_DIGEST, pcr_digest, 1);
+  MOCK_UNMARSHAL(TPML_PCR_SELECTION, pcrs, 2);
+
+  mock_session *session = mock_policy_session(ctx, cmd);
+
+  if (session == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+
+  TPM2B_DIGEST current;
+  TPM2_RC rc = mock_pcr_digest(&pcrs, 2, &current);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+
+  // a trial session takes the digest given; a policy session checks it
+  if (session->trial && pcr_digest.size != 0)
+  {
+    current = pcr_digest;
+  }
+  else if (!session->trial && pcr_digest.size != 0 &&
+           (pcr_digest.size != current.size ||
+            memcmp(pcr_digest.buffer, current.buffer, current.size) != 0))
+  {
+    return MOCK_RC_P(TPM2_RC_VALUE, 1);
+  }
+
+  // extended with the marshaled selection and the PCR digest
+  uint8_t data[sizeof(TPML_PCR_SELECTION) + sizeof(TPMU_HA)];
+  size_t len = 0;
+
+  if (Tss2_MU_TPML_PCR_SELECTION_Marshal(&pcrs, data, sizeof(data), &len) !=
+      TSS2_RC_SUCCESS || len + current.size > sizeof(data))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  memcpy(data + len, current.buffer, current.size);
+  len += current.size;
+
+  if (mock_policy_extend(&(session->digest), TPM2_CC_PolicyPCR, data, len))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  session->pcr_checked = true;
+  session->pcr_counter = mock_pcr_counter;
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_policy_or()
+//############################################################################
+static TPM2_RC mock_policy_or(mock_tcti_ctx * ctx, const mock_command * cmd)
+{
+  size_t off = 0;
+  TPML_DIGEST digests;
+
+  MOCK_UNMARSHAL(TPML_DIGEST, digests, 1);
+
+  mock_session *session = mock_policy_session(ctx, cmd);
+
+  if (session == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+  if (digests.count < 2 || digests.count > 8)
+  {
+    return MOCK_RC_P(TPM2_RC_SIZE, 1);
+  }
+
+  bool found = session->trial;
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  for (uint32_t i = 0; i < digests.count; i++)
+  {
+    found = found || (digests.digests[i].size == session->digest.size &&
+                      memcmp(digests.digests[i].buffer,
+                             session->digest.buffer,
+                             session->digest.size) == 0);
+    mock_buf_add(&buf, digests.digests[i].buffer, digests.digests[i].size);
+  }
+  if (!found)
+  {
+    return MOCK_RC_P(TPM2_RC_VALUE, 1);
+  }
+
+  memset(&(session->digest), 0, sizeof(TPM2B_DIGEST));
+  session->digest.size = TPM2_SHA256_DIGEST_SIZE;
+  if (mock_policy_extend(&(session->digest), TPM2_CC_PolicyOR,
+                         buf.data, buf.size))
+  {
+    return TPM2_RC_FAILURE;
+  }
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_verified_ticket()
+//############################################################################
+/**
+ * @brief Computes the HMAC of a verification ticket:
+ *        HMAC(proof, tag || digest || keyName).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_verified_ticket(const uint8_t * digest, size_t digest_len,
+                                const TPM2B_NAME * key_name,
+                                TPM2B_DIGEST * ticket)
+{
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  mock_buf_add_be16(&buf, TPM2_ST_VERIFIED);
+  mock_buf_add(&buf, digest, digest_len);
+  mock_buf_add(&buf, key_name->name, key_name->size);
+  if (mock_proof_hmac(&buf, ticket->buffer))
+  {
+    return 1;
+  }
+  ticket->size = TPM2_SHA256_DIGEST_SIZE;
+
+  return 0;
+}
+
+//############################################################################
+// mock_policy_authorize()
+//############################################################################
+static TPM2_RC mock_policy_authorize(mock_tcti_ctx * ctx,
+                                     const mock_command * cmd)
+{
+  size_t off = 0;
+  TPM2B_DIGEST approved;
+  TPM2B_NONCE policy_ref;
+  TPM2B_NAME key_sign;
+  TPMT_TK_VERIFIED ticket;
+
+  MOCK_UNMARSHAL(TPM2B_DIGEST, approved, 1);
+  MOCK_UNMARSHAL(TPM2B_NONCE, policy_ref, 2);
+  MOCK_UNMARSHAL(TPM2B_NAME, key_sign, 3);
+  MOCK_UNMARSHAL(TPMT_TK_VERIFIED, ticket, 4);
+
+  mock_session *session = mock_policy_session(ctx, cmd);
+
+  if (session == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+
+  if (!session->trial)
+  {
+    if (approved.size != session->digest.size ||
+        memcmp(approved.buffer, session->digest.buffer, approved.size) != 0)
+    {
+      return MOCK_RC_P(TPM2_RC_VALUE, 1);
+    }
+
+    // the ticket vouches for aHash = H(approvedPolicy || policyRef)
+    mock_buf buf = {.size = 0,.overflow = false };
+    uint8_t a_hash[TPM2_SHA256_DIGEST_SIZE];
+    TPM2B_DIGEST expected;
+
+    mock_buf_add(&buf, approved.buffer, approved.size);
+    mock_buf_add(&buf, policy_ref.buffer, policy_ref.size);
+    if (buf.overflow || mock_sha256(buf.data, buf.size, a_hash) ||
+        mock_verified_ticket(a_hash, sizeof(a_hash), &key_sign, &expected))
+    {
+      return TPM2_RC_FAILURE;
+    }
+    if (ticket.tag != TPM2_ST_VERIFIED ||
+        ticket.digest.size != expected.size ||
+        CRYPTO_memcmp(ticket.digest.buffer, expected.buffer,
+                      expected.size) != 0)
+    {
+      return MOCK_RC_P(TPM2_RC_TICKET, 4);
+    }
+  }
+
+  // reset, extended with the signing key's name, then hashed with policyRef
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  memset(&(session->digest), 0, sizeof(TPM2B_DIGEST));
+  session->digest.size = TPM2_SHA256_DIGEST_SIZE;
+  if (mock_policy_extend(&(session->digest), TPM2_CC_PolicyAuthorize,
+                         key_sign.name, key_sign.size))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  mock_buf_add(&buf, session->digest.buffer, session->digest.size);
+  mock_buf_add(&buf, policy_ref.buffer, policy_ref.size);
+  if (buf.overflow || mock_sha256(buf.data, buf.size, session->digest.buffer))
+  {
+    return TPM2_RC_FAILURE;
+  }
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_fill_unique()
+//############################################################################
+/**
+ * @brief Fills the unique field of a new object: random bytes, or for a
+ *        primary object bytes derived from its template (a TPM derives
+ *        primary keys from the hierarchy seed, so the same template gives
+ *        the same key).
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of an invalid template
+ */
+static TPM2_RC mock_fill_unique(TPMT_PUBLIC * public, const uint8_t * seed)
+{
+  uint8_t *unique = NULL;
+  size_t len = 0;
+
+  switch (public->type)
+  {
+  case TPM2_ALG_RSA:
+    len = public->parameters.rsaDetail.keyBits / 8U;
+    if (len == 0 || len > TPM2_MAX_RSA_KEY_BYTES)
+    {
+      return MOCK_RC_P(TPM2_RC_KEY_SIZE, 2);
+    }
+    public->unique.rsa.size = (uint16_t) len;
+    unique = public->unique.rsa.buffer;
+    break;
+  case TPM2_ALG_ECC:
+    switch (public->parameters.eccDetail.curveID)
+    {
+    case TPM2_ECC_NIST_P256:
+      len = 32;
+      break;
+    case TPM2_ECC_NIST_P384:
+      len = 48;
+      break;
+    case TPM2_ECC_NIST_P521:
+      len = 66;
+      break;
+    default:
+      return MOCK_RC_P(TPM2_RC_CURVE, 2);
+    }
+    public->unique.ecc.x.size = (uint16_t) len;
+    public->unique.ecc.y.size = (uint16_t) len;
+    break;
+  case TPM2_ALG_KEYEDHASH:
+    len = TPM2_SHA256_DIGEST_SIZE;
+    public->unique.keyedHash.size = (uint16_t) len;
+    unique = public->unique.keyedHash.buffer;
+    break;
+  case TPM2_ALG_SYMCIPHER:
+    len = TPM2_SHA256_DIGEST_SIZE;
+    public->unique.sym.size = (uint16_t) len;
+    unique = public->unique.sym.buffer;
+    break;
+  default:
+    return MOCK_RC_P(TPM2_RC_TYPE, 2);
+  }
+
+  // bytes for the object: random, or H(seed || counter) blocks
+  uint8_t bytes[2 * 66 + TPM2_MAX_RSA_KEY_BYTES];
+  size_t total = (public->type == TPM2_ALG_ECC) ? 2 * len : len;
+
+  if (seed == NULL)
+  {
+    if (RAND_bytes(bytes, (int) total) != 1)
+    {
+      return TPM2_RC_FAILURE;
+    }
+  }
+  for (size_t done = 0; seed != NULL && done < total;
+       done += TPM2_SHA256_DIGEST_SIZE)
+  {
+    mock_buf buf = {.size = 0,.overflow = false };
+    uint8_t block[TPM2_SHA256_DIGEST_SIZE];
+    size_t take = total - done;
+
+    mock_buf_add(&buf, seed, TPM2_SHA256_DIGEST_SIZE);
+    mock_buf_add_be32(&buf, (uint32_t) (done / TPM2_SHA256_DIGEST_SIZE));
+    if (mock_sha256(buf.data, buf.size, block))
+    {
+      return TPM2_RC_FAILURE;
+    }
+    if (take > sizeof(block))
+    {
+      take = sizeof(block);
+    }
+    memcpy(bytes + done, block, take);
+  }
+
+  if (public->type == TPM2_ALG_ECC)
+  {
+    memcpy(public->unique.ecc.x.buffer, bytes, len);
+    memcpy(public->unique.ecc.y.buffer, bytes + len, len);
+    return TPM2_RC_SUCCESS;
+  }
+  if (public->type == TPM2_ALG_RSA)
+  {
+    // a modulus of the full size, and odd
+    bytes[0] |= 0x80;
+    bytes[len - 1] |= 0x01;
+  }
+  memcpy(unique, bytes, len);
+
+  return TPM2_RC_SUCCESS;
+}
+
+/**
+ * @brief Creation outputs of CreatePrimary and Create
+ */
+typedef struct
+{
+  TPM2B_CREATION_DATA data;
+  TPM2B_DIGEST hash;
+  TPMT_TK_CREATION ticket;
+} mock_creation;
+
+//############################################################################
+// mock_new_object()
+//############################################################################
+/**
+ * @brief Builds the object a CreatePrimary (parent NULL, under the
+ *        hierarchy of the first handle) or Create (under parent) command
+ *        asks for, with its creation data.
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of an invalid command
+ */
+static TPM2_RC mock_new_object(const mock_command * cmd,
+                               const mock_object * parent,
+                               mock_object * object, mock_creation * creation)
+{
+  size_t off = 0;
+  TPM2B_SENSITIVE_CREATE in_sensitive;
+  TPM2B_DATA outside_info;
+  TPML_PCR_SELECTION creation_pcr;
+
+  memset(object, 0, sizeof(mock_object));
+  memset(creation, 0, sizeof(mock_creation));
+  MOCK_UNMARSHAL(TPM2B_SENSITIVE_CREATE, in_sensitive, 1);
+  MOCK_UNMARSHAL(TPM2B_PUBLIC, object->public, 2);
+  MOCK_UNMARSHAL(TPM2B_DATA, outside_info, 3);
+  MOCK_UNMARSHAL(TPML_PCR_SELECTION, creation_pcr, 4);
+
+  TPMT_PUBLIC *public = &(object->public.publicArea);
+
+  if (public->nameAlg != TPM2_ALG_SHA256)
+  {
+    return MOCK_RC_P(TPM2_RC_HASH, 2);
+  }
+
+  object->hierarchy = (parent != NULL) ? parent->hierarchy : cmd->handles[0];
+  object->auth = in_sensitive.sensitive.userAuth;
+  object->data = in_sensitive.sensitive.data;
+
+  TPM2_RC rc;
+
+  if (parent == NULL)
+  {
+    // seed = H(proof || hierarchy || template || sensitive data)
+    uint8_t template[sizeof(TPMT_PUBLIC)];
+    size_t template_len = 0;
+    mock_buf buf = {.size = 0,.overflow = false };
+    uint8_t seed[TPM2_SHA256_DIGEST_SIZE];
+
+    if (Tss2_MU_TPMT_PUBLIC_Marshal(public, template, sizeof(template),
+                                    &template_len) != TSS2_RC_SUCCESS)
+    {
+      return MOCK_RC_P(TPM2_RC_SIZE, 2);
+    }
+    mock_buf_add(&buf, mock_proof, sizeof(mock_proof) - 1);
+    mock_buf_add_be32(&buf, object->hierarchy);
+    mock_buf_add(&buf, template, template_len);
+    mock_buf_add(&buf, object->data.buffer, object->data.size);
+    if (buf.overflow || mock_sha256(buf.data, buf.size, seed))
+    {
+      return TPM2_RC_FAILURE;
+    }
+    rc = mock_fill_unique(public, seed);
+  }
+  else
+  {
+    rc = mock_fill_unique(public, NULL);
+  }
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+  if (mock_name_object(public, &(object->name)))
+  {
+    return TPM2_RC_FAILURE;
+  }
+
+  // creation data, its hash, and a ticket binding the hash to the object
+  TPMS_CREATION_DATA *data = &(creation->data.creationData);
+
+  rc = mock_pcr_digest(&creation_pcr, 4, &(data->pcrDigest));
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+  data->pcrSelect = creation_pcr;
+  data->locality = TPMA_LOCALITY_TPM2_LOC_ZERO;
+  if (parent != NULL)
+  {
+    data->parentNameAlg = parent->public.publicArea.nameAlg;
+    data->parentName = parent->name;
+    data->parentQualifiedName = parent->name;
+  }
+  else
+  {
+    data->parentNameAlg = TPM2_ALG_NULL;
+    data->parentName.size = 4;
+    data->parentName.name[0] = (uint8_t) (object->hierarchy >> 24);
+    data->parentName.name[1] = (uint8_t) (object->hierarchy >> 16);
+    data->parentName.name[2] = (uint8_t) (object->hierarchy >> 8);
+    data->parentName.name[3] = (uint8_t) object->hierarchy;
+    data->parentQualifiedName = data->parentName;
+  }
+  data->outsideInfo = outside_info;
+
+  uint8_t marshaled[sizeof(TPMS_CREATION_DATA)];
+  size_t len = 0;
+  mock_buf buf = {.size = 0,.overflow = false };
+
+  if (Tss2_MU_TPMS_CREATION_DATA_Marshal(data, marshaled, sizeof(marshaled),
+                                         &len) != TSS2_RC_SUCCESS ||
+      mock_sha256(marshaled, len, creation->hash.buffer))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  creation->data.size = (uint16_t) len;
+  creation->hash.size = TPM2_SHA256_DIGEST_SIZE;
+
+  creation->ticket.tag = TPM2_ST_CREATION;
+  creation->ticket.hierarchy = object->hierarchy;
+  mock_buf_add_be16(&buf, TPM2_ST_CREATION);
+  mock_buf_add(&buf, object->name.name, object->name.size);
+  mock_buf_add(&buf, creation->hash.buffer, creation->hash.size);
+  if (mock_proof_hmac(&buf, creation->ticket.digest.buffer))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  creation->ticket.digest.size = TPM2_SHA256_DIGEST_SIZE;
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_storage_parent()
+//############################################################################
+/**
+ * @brief Finds the storage key (a restricted decryption key) named by the
+ *        first handle of a command.
+ *
+ * @return TPM2_RC_SUCCESS, or the response code of an invalid parent
+ */
+static TPM2_RC mock_storage_parent(mock_tcti_ctx * ctx,
+                                   const mock_command * cmd,
+                                   mock_object ** parent)
+{
+  *parent = mock_find_object(ctx, cmd->handles[0]);
+  if (*parent == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+
+  TPMA_OBJECT attributes = (*parent)->public.publicArea.objectAttributes;
+
+  if ((*parent)->external ||
+      ((*parent)->public.publicArea.type != TPM2_ALG_RSA &&
+       (*parent)->public.publicArea.type != TPM2_ALG_ECC) ||
+      !(attributes & TPMA_OBJECT_RESTRICTED) ||
+      !(attributes & TPMA_OBJECT_DECRYPT))
+  {
+    return MOCK_RC_H(TPM2_RC_TYPE, 1);
+  }
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_private_content()
+//############################################################################
+/**
+ * @brief Marshals the secret part of an object (authValue and data).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_private_content(const mock_object * object, uint8_t * buf,
+                                size_t max, size_t *len)
+{
+  *len = 0;
+  return Tss2_MU_TPM2B_AUTH_Marshal(&(object->auth), buf, max, len) !=
+    TSS2_RC_SUCCESS ||
+    Tss2_MU_TPM2B_SENSITIVE_DATA_Marshal(&(object->data), buf, max, len) !=
+    TSS2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_wrap_private()
+//############################################################################
+/**
+ * @brief Builds the private blob of an object, bound to the object's and
+ *        its parent's names.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int mock_wrap_private(const mock_object * parent,
+                             const mock_object * object,
+                             TPM2B_PRIVATE * private)
+{
+  uint8_t content[sizeof(TPM2B_AUTH) + sizeof(TPM2B_SENSITIVE_DATA)];
+  size_t len = 0;
+  mock_buf binding = {.size = 0,.overflow = false };
+
+  mock_buf_add(&binding, parent->name.name, parent->name.size);
+  mock_buf_add(&binding, object->name.name, object->name.size);
+
+  return mock_private_content(object, content, sizeof(content), &len) ||
+    mock_wrap(MOCK_PRIVATE_MAGIC, binding.data, binding.size, content, len,
+              private->buffer, sizeof(private->buffer), &(private->size));
+}
+
+//############################################################################
+// mock_create_primary()
+//############################################################################
+static TPM2_RC mock_create_primary(mock_tcti_ctx * ctx,
+                                   const mock_command * cmd,
+                                   mock_reply * reply)
+{
+  if (cmd->handles[0] != TPM2_RH_OWNER && cmd->handles[0] != TPM2_RH_NULL &&
+      cmd->handles[0] != TPM2_RH_ENDORSEMENT &&
+      cmd->handles[0] != TPM2_RH_PLATFORM)
+  {
+    return MOCK_RC_H(TPM2_RC_VALUE, 1);
+  }
+
+  mock_object object;
+  mock_creation creation;
+  TPM2_RC rc = mock_new_object(cmd, NULL, &object, &creation);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+
+  mock_object *loaded = mock_add_object(ctx);
+
+  if (loaded == NULL)
+  {
+    return TPM2_RC_OBJECT_MEMORY;
+  }
+  object.handle = loaded->handle;
+  *loaded = object;
+
+  reply->handle = loaded->handle;
+  MOCK_MARSHAL(TPM2B_PUBLIC, &(loaded->public));
+  MOCK_MARSHAL(TPM2B_CREATION_DATA, &(creation.data));
+  MOCK_MARSHAL(TPM2B_DIGEST, &(creation.hash));
+  MOCK_MARSHAL(TPMT_TK_CREATION, &(creation.ticket));
+  MOCK_MARSHAL(TPM2B_NAME, &(loaded->name));
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_create()
+//############################################################################
+static TPM2_RC mock_create(mock_tcti_ctx * ctx, const mock_command * cmd,
+                           mock_reply * reply)
+{
+  mock_object *parent = NULL;
+  TPM2_RC rc = mock_storage_parent(ctx, cmd, &parent);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+
+  mock_object object;
+  mock_creation creation;
+  TPM2B_PRIVATE private;
+
+  rc = mock_new_object(cmd, parent, &object, &creation);
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+  memset(&private, 0, sizeof(private));
+  if (mock_wrap_private(parent, &object, &private))
+  {
+    kmyth_clear(&object, sizeof(object));
+    return TPM2_RC_FAILURE;
+  }
+  kmyth_clear(&(object.auth), sizeof(object.auth));
+  kmyth_clear(&(object.data), sizeof(object.data));
+
+  MOCK_MARSHAL(TPM2B_PRIVATE, &private);
+  MOCK_MARSHAL(TPM2B_PUBLIC, &(object.public));
+  MOCK_MARSHAL(TPM2B_CREATION_DATA, &(creation.data));
+  MOCK_MARSHAL(TPM2B_DIGEST, &(creation.hash));
+  MOCK_MARSHAL(TPMT_TK_CREATION, &(creation.ticket));
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_load()
+//############################################################################
+static TPM2_RC mock_load(mock_tcti_ctx * ctx, const mock_command * cmd,
+                         mock_reply * reply)
+{
+  size_t off = 0;
+  TPM2B_PRIVATE private;
+  mock_object object;
+
+  memset(&object, 0, sizeof(object));
+  MOCK_UNMARSHAL(TPM2B_PRIVATE, private, 1);
+  MOCK_UNMARSHAL(TPM2B_PUBLIC, object.public, 2);
+
+  mock_object *parent = NULL;
+  TPM2_RC rc = mock_storage_parent(ctx, cmd, &parent);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+  if (object.public.publicArea.nameAlg != TPM2_ALG_SHA256)
+  {
+    return MOCK_RC_P(TPM2_RC_HASH, 2);
+  }
+  if (mock_name_object(&(object.public.publicArea), &(object.name)))
+  {
+    return TPM2_RC_FAILURE;
+  }
+
+  mock_buf binding = {.size = 0,.overflow = false };
+  const uint8_t *content = NULL;
+  size_t content_len = 0;
+  size_t content_off = 0;
+
+  mock_buf_add(&binding, parent->name.name, parent->name.size);
+  mock_buf_add(&binding, object.name.name, object.name.size);
+  if (mock_unwrap(MOCK_PRIVATE_MAGIC, binding.data, binding.size,
+                  private.buffer, private.size, &content, &content_len) ||
+      Tss2_MU_TPM2B_AUTH_Unmarshal(content, content_len, &content_off,
+                                   &(object.auth)) != TSS2_RC_SUCCESS ||
+      Tss2_MU_TPM2B_SENSITIVE_DATA_Unmarshal(content, content_len,
+                                             &content_off,
+                                             &(object.data)) !=
+      TSS2_RC_SUCCESS)
+  {
+    return MOCK_RC_P(TPM2_RC_INTEGRITY, 1);
+  }
+  object.hierarchy = parent->hierarchy;
+
+  mock_object *loaded = mock_add_object(ctx);
+
+  if (loaded == NULL)
+  {
+    kmyth_clear(&object, sizeof(object));
+    return TPM2_RC_OBJECT_MEMORY;
+  }
+  object.handle = loaded->handle;
+  *loaded = object;
+  kmyth_clear(&object, sizeof(object));
+
+  reply->handle = loaded->handle;
+  MOCK_MARSHAL(TPM2B_NAME, &(loaded->name));
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_unseal()
+//############################################################################
+static TPM2_RC mock_unseal(mock_tcti_ctx * ctx, const mock_command * cmd,
+                           mock_reply * reply)
+{
+  mock_object *object = mock_find_object(ctx, cmd->handles[0]);
+
+  if (object == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+  if (object->public.publicArea.type != TPM2_ALG_KEYEDHASH ||
+      object->external)
+  {
+    return MOCK_RC_H(TPM2_RC_TYPE, 1);
+  }
+
+  MOCK_MARSHAL(TPM2B_SENSITIVE_DATA, &(object->data));
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_evict_control()
+//############################################################################
+static TPM2_RC mock_evict_control(mock_tcti_ctx * ctx,
+                                  const mock_command * cmd)
+{
+  size_t off = 0;
+  TPM2_HANDLE persistent = 0;
+
+  MOCK_UNMARSHAL(UINT32, persistent, 1);
+
+  if (cmd->handles[0] != TPM2_RH_OWNER && cmd->handles[0] != TPM2_RH_PLATFORM)
+  {
+    return MOCK_RC_H(TPM2_RC_HIERARCHY, 1);
+  }
+
+  mock_object *object = mock_find_object(ctx, cmd->handles[1]);
+
+  if (object == NULL || object->external)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 2);
+  }
+
+  // a persistent object is removed
+  if ((object->handle & TPM2_HR_RANGE_MASK) == TPM2_HR_PERSISTENT)
+  {
+    if (persistent != object->handle)
+    {
+      return MOCK_RC_P(TPM2_RC_RANGE, 1);
+    }
+    kmyth_clear(object, sizeof(mock_object));
+    return TPM2_RC_SUCCESS;
+  }
+
+  // a transient object is copied to the persistent handle
+  if ((persistent & TPM2_HR_RANGE_MASK) != TPM2_HR_PERSISTENT)
+  {
+    return MOCK_RC_P(TPM2_RC_RANGE, 1);
+  }
+  if (mock_find_object(ctx, persistent) != NULL)
+  {
+    return TPM2_RC_NV_DEFINED;
+  }
+  for (size_t i = 0; i < KMYTH_MOCK_MAX_PERSISTENT; i++)
+  {
+    if (mock_persistent[i].handle == 0)
+    {
+      mock_persistent[i] = *object;
+      mock_persistent[i].handle = persistent;
+      return TPM2_RC_SUCCESS;
+    }
+  }
+
+  return TPM2_RC_NV_SPACE;
+}
+
+//############################################################################
+// mock_read_public()
+//############################################################################
+static TPM2_RC mock_read_public(mock_tcti_ctx * ctx, const mock_command * cmd,
+                                mock_reply * reply)
+{
+  mock_object *object = mock_find_object(ctx, cmd->handles[0]);
+
+  if (object == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+
+  MOCK_MARSHAL(TPM2B_PUBLIC, &(object->public));
+  MOCK_MARSHAL(TPM2B_NAME, &(object->name));
+  MOCK_MARSHAL(TPM2B_NAME, &(object->name));
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_flush_context()
+//############################################################################
+static TPM2_RC mock_flush_context(mock_tcti_ctx * ctx,
+                                  const mock_command * cmd)
+{
+  size_t off = 0;
+  TPM2_HANDLE handle = 0;
+
+  MOCK_UNMARSHAL(UINT32, handle, 1);
+
+  if ((handle & TPM2_HR_RANGE_MASK) == TPM2_HR_TRANSIENT)
+  {
+    mock_object *object = mock_find_object(ctx, handle);
+
+    if (object != NULL)
+    {
+      kmyth_clear(object, sizeof(mock_object));
+      return TPM2_RC_SUCCESS;
+    }
+  }
+
+  mock_session *session = mock_find_session(ctx, handle);
+
+  if (session != NULL)
+  {
+    memset(session, 0, sizeof(mock_session));
+    return TPM2_RC_SUCCESS;
+  }
+
+  return MOCK_RC_P(TPM2_RC_HANDLE, 1);
+}
+
+//############################################################################
+// mock_context_save()
+//############################################################################
+static TPM2_RC mock_context_save(mock_tcti_ctx * ctx, const mock_command * cmd,
+                                 mock_reply * reply)
+{
+  mock_object *object = NULL;
+
+  if ((cmd->handles[0] & TPM2_HR_RANGE_MASK) == TPM2_HR_TRANSIENT)
+  {
+    object = mock_find_object(ctx, cmd->handles[0]);
+  }
+  if (object == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+
+  // saved: public area, secrets, hierarchy and origin of the object
+  uint8_t content[sizeof(TPM2B_PUBLIC) + sizeof(TPM2B_AUTH) +
+                  sizeof(TPM2B_SENSITIVE_DATA) + 5];
+  size_t len = 0;
+  TPMS_CONTEXT saved;
+  TPM2_RC rc = TPM2_RC_SUCCESS;
+
+  memset(&saved, 0, sizeof(saved));
+  if (Tss2_MU_TPM2B_PUBLIC_Marshal(&(object->public), content,
+                                   sizeof(content), &len) != TSS2_RC_SUCCESS ||
+      Tss2_MU_TPM2B_AUTH_Marshal(&(object->auth), content, sizeof(content),
+                                 &len) != TSS2_RC_SUCCESS ||
+      Tss2_MU_TPM2B_SENSITIVE_DATA_Marshal(&(object->data), content,
+                                           sizeof(content), &len) !=
+      TSS2_RC_SUCCESS ||
+      Tss2_MU_UINT32_Marshal(object->hierarchy, content, sizeof(content),
+                             &len) != TSS2_RC_SUCCESS ||
+      Tss2_MU_UINT8_Marshal(object->external, content, sizeof(content),
+                            &len) != TSS2_RC_SUCCESS ||
+      mock_wrap(MOCK_CONTEXT_MAGIC, NULL, 0, content, len,
+                saved.contextBlob.buffer, sizeof(saved.contextBlob.buffer),
+                &(saved.contextBlob.size)))
+  {
+    rc = TPM2_RC_FAILURE;
+  }
+  kmyth_clear(content, sizeof(content));
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    return rc;
+  }
+
+  saved.sequence = ++mock_context_sequence;
+  saved.savedHandle = 0x80000000;
+  saved.hierarchy = object->hierarchy;
+  MOCK_MARSHAL(TPMS_CONTEXT, &saved);
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_context_load()
+//############################################################################
+static TPM2_RC mock_context_load(mock_tcti_ctx * ctx, const mock_command * cmd,
+                                 mock_reply * reply)
+{
+  size_t off = 0;
+  TPMS_CONTEXT saved;
+
+  MOCK_UNMARSHAL(TPMS_CONTEXT, saved, 1);
+
+  const uint8_t *content = NULL;
+  size_t content_len = 0;
+  size_t content_off = 0;
+  uint8_t external = 0;
+  mock_object object;
+
+  memset(&object, 0, sizeof(object));
+  if (mock_unwrap(MOCK_CONTEXT_MAGIC, NULL, 0, saved.contextBlob.buffer,
+                  saved.contextBlob.size, &content, &content_len) ||
+      Tss2_MU_TPM2B_PUBLIC_Unmarshal(content, content_len, &content_off,
+                                     &(object.public)) != TSS2_RC_SUCCESS ||
+      Tss2_MU_TPM2B_AUTH_Unmarshal(content, content_len, &content_off,
+                                   &(object.auth)) != TSS2_RC_SUCCESS ||
+      Tss2_MU_TPM2B_SENSITIVE_DATA_Unmarshal(content, content_len,
+                                             &content_off,
+                                             &(object.data)) !=
+      TSS2_RC_SUCCESS ||
+      Tss2_MU_UINT32_Unmarshal(content, content_len, &content_off,
+                               &(object.hierarchy)) != TSS2_RC_SUCCESS ||
+      Tss2_MU_UINT8_Unmarshal(content, content_len, &content_off,
+                              &external) != TSS2_RC_SUCCESS ||
+      mock_name_object(&(object.public.publicArea), &(object.name)))
+  {
+    kmyth_clear(&object, sizeof(object));
+    return MOCK_RC_P(TPM2_RC_INTEGRITY, 1);
+  }
+  object.external = (external != 0);
+
+  mock_object *loaded = mock_add_object(ctx);
+
+  if (loaded == NULL)
+  {
+    kmyth_clear(&object, sizeof(object));
+    return TPM2_RC_OBJECT_MEMORY;
+  }
+  object.handle = loaded->handle;
+  *loaded = object;
+  kmyth_clear(&object, sizeof(object));
+
+  reply->handle = loaded->handle;
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_load_external()
+//############################################################################
+static TPM2_RC mock_load_external(mock_tcti_ctx * ctx,
+                                  const mock_command * cmd,
+                                  mock_reply * reply)
+{
+  size_t off = 0;
+  TPM2B_SENSITIVE in_private;
+  mock_object object;
+
+  memset(&object, 0, sizeof(object));
+  MOCK_UNMARSHAL(TPM2B_SENSITIVE, in_private, 1);
+  MOCK_UNMARSHAL(TPM2B_PUBLIC, object.public, 2);
+  MOCK_UNMARSHAL(UINT32, object.hierarchy, 3);
+
+  // public keys only
+  if (in_private.size != 0)
+  {
+    return MOCK_RC_P(TPM2_RC_SIZE, 1);
+  }
+  if (object.public.publicArea.nameAlg != TPM2_ALG_SHA256)
+  {
+    return MOCK_RC_P(TPM2_RC_HASH, 2);
+  }
+  if (mock_name_object(&(object.public.publicArea), &(object.name)))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  object.external = true;
+
+  mock_object *loaded = mock_add_object(ctx);
+
+  if (loaded == NULL)
+  {
+    return TPM2_RC_OBJECT_MEMORY;
+  }
+  object.handle = loaded->handle;
+  *loaded = object;
+
+  reply->handle = loaded->handle;
+  MOCK_MARSHAL(TPM2B_NAME, &(loaded->name));
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_rsa_verify()
+//############################################################################
+/**
+ * @brief Checks an RSASSA or RSAPSS (SHA-256) signature over a digest with
+ *        the RSA public key of an object.
+ *
+ * @return 0 if the signature is valid, 1 otherwise
+ */
+static int mock_rsa_verify(const TPMT_PUBLIC * key,
+                           const TPMT_SIGNATURE * signature,
+                           const TPM2B_DIGEST * digest)
+{
+  const TPM2B_PUBLIC_KEY_RSA *sig = &(signature->signature.rsassa.sig);
+  uint32_t exponent = key->parameters.rsaDetail.exponent;
+  BIGNUM *n = BN_bin2bn(key->unique.rsa.buffer, key->unique.rsa.size, NULL);
+  BIGNUM *e = BN_new();
+  EVP_PKEY *pkey = NULL;
+  int retval = 1;
+
+  if (n == NULL || e == NULL ||
+      BN_set_word(e, (exponent == 0) ? 65537 : exponent) != 1)
+  {
+    BN_free(n);
+    BN_free(e);
+    return 1;
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+  OSSL_PARAM *params = NULL;
+  EVP_PKEY_CTX *from_ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL);
+
+  if (bld != NULL && from_ctx != NULL &&
+      OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, n) == 1 &&
+      OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, e) == 1)
+  {
+    params = OSSL_PARAM_BLD_to_param(bld);
+  }
+  if (params == NULL || EVP_PKEY_fromdata_init(from_ctx) != 1 ||
+      EVP_PKEY_fromdata(from_ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) != 1)
+  {
+    pkey = NULL;
+  }
+  OSSL_PARAM_free(params);
+  OSSL_PARAM_BLD_free(bld);
+  EVP_PKEY_CTX_free(from_ctx);
+  BN_free(n);
+  BN_free(e);
+#else
+  RSA *rsa = RSA_new();
+
+  if (rsa == NULL || RSA_set0_key(rsa, n, e, NULL) != 1)
+  {
+    RSA_free(rsa);
+    BN_free(n);
+    BN_free(e);
+    return 1;
+  }
+  pkey = EVP_PKEY_new();
+  if (pkey == NULL || EVP_PKEY_assign_RSA(pkey, rsa) != 1)
+  {
+    EVP_PKEY_free(pkey);
+    RSA_free(rsa);
+    return 1;
+  }
+#endif
+
+  EVP_PKEY_CTX *verify_ctx = (pkey != NULL) ?
+    EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+  int padding = (signature->sigAlg == TPM2_ALG_RSAPSS) ?
+    RSA_PKCS1_PSS_PADDING : RSA_PKCS1_PADDING;
+
+  if (verify_ctx != NULL &&
+      EVP_PKEY_verify_init(verify_ctx) == 1 &&
+      EVP_PKEY_CTX_set_rsa_padding(verify_ctx, padding) == 1 &&
+      (padding != RSA_PKCS1_PSS_PADDING ||
+       EVP_PKEY_CTX_set_rsa_pss_saltlen(verify_ctx,
+                                        RSA_PSS_SALTLEN_AUTO) == 1) &&
+      EVP_PKEY_CTX_set_signature_md(verify_ctx, EVP_sha256()) == 1 &&
+      EVP_PKEY_verify(verify_ctx, sig->buffer, sig->size, digest->buffer,
+                      digest->size) == 1)
+  {
+    retval = 0;
+  }
+  EVP_PKEY_CTX_free(verify_ctx);
+  EVP_PKEY_free(pkey);
+
+  return retval;
+}
+
+//############################################################################
+// mock_verify_signature()
+//############################################################################
+static TPM2_RC mock_verify_signature(mock_tcti_ctx * ctx,
+                                     const mock_command * cmd,
+                                     mock_reply * reply)
+{
+  size_t off = 0;
+  TPM2B_DIGEST digest;
+  TPMT_SIGNATURE signature;
+
+  MOCK_UNMARSHAL(TPM2B_DIGEST, digest, 1);
+  MOCK_UNMARSHAL(TPMT_SIGNATURE, signature, 2);
+
+  mock_object *key = mock_find_object(ctx, cmd->handles[0]);
+
+  if (key == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+  if (key->public.publicArea.type != TPM2_ALG_RSA)
+  {
+    return MOCK_RC_H(TPM2_RC_TYPE, 1);
+  }
+  if ((signature.sigAlg != TPM2_ALG_RSASSA &&
+       signature.sigAlg != TPM2_ALG_RSAPSS) ||
+      signature.signature.rsassa.hash != TPM2_ALG_SHA256)
+  {
+    return MOCK_RC_P(TPM2_RC_SCHEME, 2);
+  }
+  if (mock_rsa_verify(&(key->public.publicArea), &signature, &digest))
+  {
+    return MOCK_RC_P(TPM2_RC_SIGNATURE, 2);
+  }
+
+  TPMT_TK_VERIFIED ticket;
+
+  memset(&ticket, 0, sizeof(ticket));
+  ticket.tag = TPM2_ST_VERIFIED;
+  ticket.hierarchy = key->hierarchy;
+  if (mock_verified_ticket(digest.buffer, digest.size, &(key->name),
+                           &(ticket.digest)))
+  {
+    return TPM2_RC_FAILURE;
+  }
+  MOCK_MARSHAL(TPMT_TK_VERIFIED, &ticket);
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_pcr_read()
+//############################################################################
+static TPM2_RC mock_pcr_read(const mock_command * cmd, mock_reply * reply)
+{
+  size_t off = 0;
+  TPML_PCR_SELECTION selection;
+
+  MOCK_UNMARSHAL(TPML_PCR_SELECTION, selection, 1);
+
+  // up to eight values of the SHA-256 bank, the rest left for later calls
+  TPML_PCR_SELECTION read = selection;
+  TPML_DIGEST values;
+
+  memset(&values, 0, sizeof(values));
+  for (uint32_t i = 0; i < read.count; i++)
+  {
+    TPMS_PCR_SELECTION *sel = &(read.pcrSelections[i]);
+
+    for (uint32_t pcr = 0; pcr < 8U * sel->sizeofSelect; pcr++)
+    {
+      uint8_t bit = (uint8_t) (1U << (pcr % 8));
+
+      if (!(sel->pcrSelect[pcr / 8] & bit))
+      {
+        continue;
+      }
+      if (sel->hash != TPM2_ALG_SHA256 || pcr >= KMYTH_MOCK_PCR_COUNT ||
+          values.count == 8)
+      {
+        sel->pcrSelect[pcr / 8] &= (uint8_t) ~ bit;
+        continue;
+      }
+      values.digests[values.count].size = TPM2_SHA256_DIGEST_SIZE;
+      memcpy(values.digests[values.count].buffer, mock_pcrs[pcr],
+             TPM2_SHA256_DIGEST_SIZE);
+      values.count++;
+    }
+  }
+
+  MOCK_MARSHAL(UINT32, mock_pcr_counter);
+  MOCK_MARSHAL(TPML_PCR_SELECTION, &read);
+  MOCK_MARSHAL(TPML_DIGEST, &values);
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_pcr_extend()
+//############################################################################
+static TPM2_RC mock_pcr_extend(const mock_command * cmd)
+{
+  size_t off = 0;
+  TPML_DIGEST_VALUES digests;
+
+  MOCK_UNMARSHAL(TPML_DIGEST_VALUES, digests, 1);
+
+  if (cmd->handles[0] >= KMYTH_MOCK_PCR_COUNT)
+  {
+    return MOCK_RC_H(TPM2_RC_VALUE, 1);
+  }
+
+  uint8_t *pcr = mock_pcrs[cmd->handles[0]];
+
+  for (uint32_t i = 0; i < digests.count; i++)
+  {
+    if (digests.digests[i].hashAlg != TPM2_ALG_SHA256)
+    {
+      continue;
+    }
+
+    mock_buf buf = {.size = 0,.overflow = false };
+
+    mock_buf_add(&buf, pcr, TPM2_SHA256_DIGEST_SIZE);
+    mock_buf_add(&buf, digests.digests[i].digest.sha256,
+                 TPM2_SHA256_DIGEST_SIZE);
+    if (mock_sha256(buf.data, buf.size, pcr))
+    {
+      return TPM2_RC_FAILURE;
+    }
+  }
+  mock_pcr_counter++;
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_get_random()
+//############################################################################
+static TPM2_RC mock_get_random(const mock_command * cmd, mock_reply * reply)
+{
+  size_t off = 0;
+  uint16_t requested = 0;
+
+  MOCK_UNMARSHAL(UINT16, requested, 1);
+
+  TPM2B_DIGEST bytes;
+
+  bytes.size = (requested > TPM2_SHA256_DIGEST_SIZE) ?
+    TPM2_SHA256_DIGEST_SIZE : requested;
+  if (bytes.size > 0 && RAND_bytes(bytes.buffer, bytes.size) != 1)
+  {
+    return TPM2_RC_FAILURE;
+  }
+  MOCK_MARSHAL(TPM2B_DIGEST, &bytes);
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_policy_get_digest()
+//############################################################################
+static TPM2_RC mock_policy_get_digest(mock_tcti_ctx * ctx,
+                                      const mock_command * cmd,
+                                      mock_reply * reply)
+{
+  mock_session *session = mock_policy_session(ctx, cmd);
+
+  if (session == NULL)
+  {
+    return MOCK_RC_H(TPM2_RC_HANDLE, 1);
+  }
+  MOCK_MARSHAL(TPM2B_DIGEST, &(session->digest));
+
+  return TPM2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_dispatch()
+//############################################################################
+/**
+ * @brief Runs the handler of a command.
+ *
+ * @return Response code of the command
+ */
+static TPM2_RC mock_dispatch(mock_tcti_ctx * ctx, const mock_command * cmd,
+                             mock_reply * reply)
+{
+  switch (cmd->cc)
+  {
+  case TPM2_CC_EvictControl:
+    return mock_evict_control(ctx, cmd);
+  case TPM2_CC_CreatePrimary:
+    return mock_create_primary(ctx, cmd, reply);
+  case TPM2_CC_Startup:
+    return TPM2_RC_SUCCESS;
+  case TPM2_CC_Create:
+    return mock_create(ctx, cmd, reply);
+  case TPM2_CC_Load:
+    return mock_load(ctx, cmd, reply);
+  case TPM2_CC_Unseal:
+    return mock_unseal(ctx, cmd, reply);
+  case TPM2_CC_ContextLoad:
+    return mock_context_load(ctx, cmd, reply);
+  case TPM2_CC_ContextSave:
+    return mock_context_save(ctx, cmd, reply);
+  case TPM2_CC_FlushContext:
+    return mock_flush_context(ctx, cmd);
+  case TPM2_CC_PolicyAuthValue:
+    return mock_policy_auth_value(ctx, cmd);
+  case TPM2_CC_PolicyOR:
+    return mock_policy_or(ctx, cmd);
+  case TPM2_CC_PolicyAuthorize:
+    return mock_policy_authorize(ctx, cmd);
+  case TPM2_CC_LoadExternal:
+    return mock_load_external(ctx, cmd, reply);
+  case TPM2_CC_VerifySignature:
+    return mock_verify_signature(ctx, cmd, reply);
+  case TPM2_CC_ReadPublic:
+    return mock_read_public(ctx, cmd, reply);
+  case TPM2_CC_StartAuthSession:
+    return mock_start_auth_session(ctx, cmd, reply);
+  case TPM2_CC_GetCapability:
+    return mock_get_capability(ctx, cmd, reply);
+  case TPM2_CC_GetRandom:
+    return mock_get_random(cmd, reply);
+  case TPM2_CC_PCR_Read:
+    return mock_pcr_read(cmd, reply);
+  case TPM2_CC_PolicyPCR:
+    return mock_policy_pcr(ctx, cmd);
+  case TPM2_CC_PCR_Extend:
+    return mock_pcr_extend(cmd);
+  case TPM2_CC_PolicyGetDigest:
+    return mock_policy_get_digest(ctx, cmd, reply);
+  default:
+    return TPM2_RC_COMMAND_CODE;
+  }
+}
+
+//############################################################################
+// mock_set_header()
+//############################################################################
+/**
+ * @brief Writes the header of the response (tag, size, response code).
+ */
+static void mock_set_header(mock_tcti_ctx * ctx, TPM2_ST tag, TPM2_RC rc)
+{
+  size_t off = 0;
+
+  Tss2_MU_UINT16_Marshal(tag, ctx->response, MOCK_MAX_RESPONSE, &off);
+  Tss2_MU_UINT32_Marshal((uint32_t) ctx->response_size, ctx->response,
+                         MOCK_MAX_RESPONSE, &off);
+  Tss2_MU_UINT32_Marshal(rc, ctx->response, MOCK_MAX_RESPONSE, &off);
+}
+
+//############################################################################
+// mock_execute()
+//############################################################################
+/**
+ * @brief Runs a command, leaving its response in the context.
+ */
+static void mock_execute(mock_tcti_ctx * ctx, const uint8_t * command,
+                         size_t size)
+{
+  mock_command cmd;
+  mock_reply *reply = kmyth_calloc(1, sizeof(mock_reply));
+  TPM2B_AUTH keys[MOCK_MAX_AUTHS];
+  TPM2_RC rc = (reply == NULL) ? TPM2_RC_MEMORY :
+    mock_parse_command(command, size, &cmd);
+
+  for (size_t i = 0; rc == TPM2_RC_SUCCESS && i < cmd.auth_count; i++)
+  {
+    rc = mock_authorize(ctx, &cmd, i, &(keys[i]));
+  }
+  if (rc == TPM2_RC_SUCCESS)
+  {
+    rc = mock_dispatch(ctx, &cmd, reply);
+  }
+
+  // response: header, handle, parameter size (with sessions), parameters,
+  // and session authorizations
+  size_t off = 10;
+  bool sessions = (rc == TPM2_RC_SUCCESS && cmd.auth_count > 0);
+
+  if (rc == TPM2_RC_SUCCESS && cmd.info->rsp_handle)
+  {
+    rc = (Tss2_MU_UINT32_Marshal(reply->handle, ctx->response,
+                                 MOCK_MAX_RESPONSE, &off) ==
+          TSS2_RC_SUCCESS) ? TPM2_RC_SUCCESS : TPM2_RC_MEMORY;
+  }
+  if (rc == TPM2_RC_SUCCESS && sessions)
+  {
+    rc = (Tss2_MU_UINT32_Marshal((uint32_t) reply->size, ctx->response,
+                                 MOCK_MAX_RESPONSE, &off) ==
+          TSS2_RC_SUCCESS) ? TPM2_RC_SUCCESS : TPM2_RC_MEMORY;
+  }
+  if (rc == TPM2_RC_SUCCESS)
+  {
+    if (reply->size > MOCK_MAX_RESPONSE - off)
+    {
+      rc = TPM2_RC_MEMORY;
+    }
+    else
+    {
+      memcpy(ctx->response + off, reply->params, reply->size);
+      off += reply->size;
+    }
+  }
+  for (size_t i = 0; rc == TPM2_RC_SUCCESS && sessions &&
+       i < cmd.auth_count; i++)
+  {
+    TPMS_AUTH_RESPONSE auth;
+
+    if (mock_respond_auth(ctx, &cmd, i, &(keys[i]), reply, &auth) ||
+        Tss2_MU_TPMS_AUTH_RESPONSE_Marshal(&auth, ctx->response,
+                                           MOCK_MAX_RESPONSE, &off) !=
+        TSS2_RC_SUCCESS)
+    {
+      rc = TPM2_RC_FAILURE;
+    }
+  }
+
+  if (rc == TPM2_RC_SUCCESS)
+  {
+    ctx->response_size = off;
+    mock_set_header(ctx, sessions ? TPM2_ST_SESSIONS : TPM2_ST_NO_SESSIONS,
+                    rc);
+  }
+  else
+  {
+    ctx->response_size = 10;
+    mock_set_header(ctx, TPM2_ST_NO_SESSIONS, rc);
+  }
+
+  kmyth_clear(keys, sizeof(keys));
+  kmyth_clear_and_free(reply, sizeof(mock_reply));
+}
+
+//############################################################################
+// mock_tcti_transmit()
+//############################################################################
+static TSS2_RC mock_tcti_transmit(TSS2_TCTI_CONTEXT * tcti_ctx, size_t size,
+                                  uint8_t const *command)
+{
+  mock_tcti_ctx *ctx = (mock_tcti_ctx *) tcti_ctx;
+
+  if (ctx == NULL || command == NULL)
+  {
+    return TSS2_TCTI_RC_BAD_REFERENCE;
+  }
+  if (ctx->common.v1.magic != KMYTH_MOCK_TCTI_MAGIC)
+  {
+    return TSS2_TCTI_RC_BAD_CONTEXT;
+  }
+  if (ctx->pending)
+  {
+    return TSS2_TCTI_RC_BAD_SEQUENCE;
+  }
+  if (size < 10 || size > MOCK_MAX_COMMAND)
+  {
+    return TSS2_TCTI_RC_BAD_VALUE;
+  }
+
+  pthread_mutex_lock(&mock_lock);
+  mock_execute(ctx, command, size);
+  pthread_mutex_unlock(&mock_lock);
+
+  // the response is due once the injected latency has passed
+  TPM2_CC cc = ((TPM2_CC) command[6] << 24) | ((TPM2_CC) command[7] << 16) |
+    ((TPM2_CC) command[8] << 8) | (TPM2_CC) command[9];
+  uint64_t latency = mock_sample_latency(ctx, cc);
+
+  clock_gettime(CLOCK_MONOTONIC, &(ctx->due));
+  latency += (uint64_t) ctx->due.tv_nsec;
+  ctx->due.tv_sec += (time_t) (latency / 1000000000ULL);
+  ctx->due.tv_nsec = (long) (latency % 1000000000ULL);
+  ctx->pending = true;
+
+  return TSS2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_tcti_receive()
+//############################################################################
+static TSS2_RC mock_tcti_receive(TSS2_TCTI_CONTEXT * tcti_ctx, size_t *size,
+                                 uint8_t * response, int32_t timeout)
+{
+  mock_tcti_ctx *ctx = (mock_tcti_ctx *) tcti_ctx;
+
+  if (ctx == NULL || size == NULL)
+  {
+    return TSS2_TCTI_RC_BAD_REFERENCE;
+  }
+  if (ctx->common.v1.magic != KMYTH_MOCK_TCTI_MAGIC)
+  {
+    return TSS2_TCTI_RC_BAD_CONTEXT;
+  }
+  if (!ctx->pending)
+  {
+    return TSS2_TCTI_RC_BAD_SEQUENCE;
+  }
+
+  // a size query does not wait
+  if (response == NULL)
+  {
+    *size = ctx->response_size;
+    return TSS2_RC_SUCCESS;
+  }
+  if (*size < ctx->response_size)
+  {
+    *size = ctx->response_size;
+    return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+  }
+
+  // wait for the response to be due, or for the timeout (in ms)
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int64_t remaining_ns =
+    (int64_t) (ctx->due.tv_sec - now.tv_sec) * 1000000000LL +
+    (ctx->due.tv_nsec - now.tv_nsec);
+
+  if (timeout != TSS2_TCTI_TIMEOUT_BLOCK &&
+      (int64_t) timeout * 1000000LL < remaining_ns)
+  {
+    struct timespec wait = {.tv_sec = timeout / 1000,
+      .tv_nsec = (long) (timeout % 1000) * 1000000L
+    };
+
+    nanosleep(&wait, NULL);
+    return TSS2_TCTI_RC_TRY_AGAIN;
+  }
+  while (remaining_ns > 0 &&
+         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &(ctx->due),
+                         NULL) == EINTR)
+  {
+  }
+
+  memcpy(response, ctx->response, ctx->response_size);
+  *size = ctx->response_size;
+  ctx->pending = false;
+
+  return TSS2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_tcti_finalize()
+//############################################################################
+static void mock_tcti_finalize(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  mock_tcti_ctx *ctx = (mock_tcti_ctx *) tcti_ctx;
+
+  if (ctx == NULL || ctx->common.v1.magic != KMYTH_MOCK_TCTI_MAGIC)
+  {
+    return;
+  }
+
+  // transient objects and sessions go away with the connection
+  kmyth_clear(ctx, sizeof(mock_tcti_ctx));
+}
+
+//############################################################################
+// mock_tcti_cancel()
+//############################################################################
+static TSS2_RC mock_tcti_cancel(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  (void) tcti_ctx;
+  return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+//############################################################################
+// mock_tcti_get_poll_handles()
+//############################################################################
+static TSS2_RC mock_tcti_get_poll_handles(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                          TSS2_TCTI_POLL_HANDLE * handles,
+                                          size_t *num_handles)
+{
+  (void) tcti_ctx;
+  (void) handles;
+  (void) num_handles;
+  return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+//############################################################################
+// mock_tcti_set_locality()
+//############################################################################
+static TSS2_RC mock_tcti_set_locality(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                      uint8_t locality)
+{
+  (void) tcti_ctx;
+  (void) locality;
+  return TSS2_RC_SUCCESS;
+}
+
+//############################################################################
+// mock_tcti_make_sticky()
+//############################################################################
+static TSS2_RC mock_tcti_make_sticky(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                     TPM2_HANDLE * handle, uint8_t sticky)
+{
+  (void) tcti_ctx;
+  (void) handle;
+  (void) sticky;
+  return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+//############################################################################
+// kmyth_mock_tcti_init()
+//############################################################################
+TSS2_RC kmyth_mock_tcti_init(TSS2_TCTI_CONTEXT * tcti_ctx, size_t *size,
+                             const char *conf)
+{
+  if (size == NULL)
+  {
+    return TSS2_TCTI_RC_BAD_VALUE;
+  }
+
+  mock_config config;
+
+  if (mock_parse_config(conf, &config))
+  {
+    return TSS2_TCTI_RC_BAD_VALUE;
+  }
+  if (tcti_ctx == NULL)
+  {
+    *size = sizeof(mock_tcti_ctx);
+    return TSS2_RC_SUCCESS;
+  }
+  if (*size < sizeof(mock_tcti_ctx))
+  {
+    return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+  }
+
+  mock_tcti_ctx *ctx = (mock_tcti_ctx *) tcti_ctx;
+
+  memset(ctx, 0, sizeof(mock_tcti_ctx));
+  ctx->common.v1.magic = KMYTH_MOCK_TCTI_MAGIC;
+  ctx->common.v1.version = 2;
+  ctx->common.v1.transmit = mock_tcti_transmit;
+  ctx->common.v1.receive = mock_tcti_receive;
+  ctx->common.v1.finalize = mock_tcti_finalize;
+  ctx->common.v1.cancel = mock_tcti_cancel;
+  ctx->common.v1.getPollHandles = mock_tcti_get_poll_handles;
+  ctx->common.v1.setLocality = mock_tcti_set_locality;
+  ctx->common.makeSticky = mock_tcti_make_sticky;
+  ctx->config = config;
+  ctx->rng = (config.seed != 0) ? config.seed : 1;
+
+  kmyth_log(LOG_WARNING, "connected to mock TPM (sealed data is NOT "
+            "protected, for benchmarks and tests only)");
+
+  return TSS2_RC_SUCCESS;
+}
+
+//############################################################################
+// kmyth_mock_tpm_register()
+//############################################################################
+int kmyth_mock_tpm_register(void)
+{
+  return register_tcti_init(KMYTH_MOCK_TCTI_NAME, kmyth_mock_tcti_init);
+}
+
+//############################################################################
+// kmyth_mock_tpm_reset()
+//############################################################################
+void kmyth_mock_tpm_reset(void)
+{
+  pthread_mutex_lock(&mock_lock);
+  kmyth_clear(mock_persistent, sizeof(mock_persistent));
+  memset(mock_pcrs, 0, sizeof(mock_pcrs));
+  mock_pcr_counter = 0;
+  mock_context_sequence = 0;
+  pthread_mutex_unlock(&mock_lock);
+}
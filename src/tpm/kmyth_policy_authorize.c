@@ -0,0 +1,617 @@
+/**
+ * @file  kmyth_policy_authorize.c
+ *
+ * @brief Implements sealing to signed policies (see kmyth_policy_authorize.h):
+ *        authorizing key conversion, policy signing, and the signed policy
+ *        file format and lookup.
+ */
+
+#include "kmyth_policy_authorize.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include <openssl/bio.h>
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/rsa.h>
+#endif
+#include <tss2/tss2_mu.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "formatting_tools.h"
+#include "memory_util.h"
+#include "tpm/object_tools.h"
+
+/**
+ * @brief Largest file considered when looking for signed policies in a
+ *        directory (a signed policy is well under this size)
+ */
+#define KMYTH_SIGNED_POLICY_MAX_SIZE 16384
+
+/**
+ * @brief Authorizing key selected by set_authorizing_key() (valid if its
+ *        size is not zero)
+ */
+static TPM2B_PUBLIC authorizing_key = {.size = 0, };
+
+/**
+ * @brief Path selected by set_signed_policy_path() (NULL if none)
+ */
+static char *signed_policy_path = NULL;
+
+//############################################################################
+// load_pem_key()
+//############################################################################
+/**
+ * @brief Reads a PEM encoded key: a public key, or else a private key.
+ *
+ * @return the key (caller frees), or NULL on error
+ */
+static EVP_PKEY *load_pem_key(const uint8_t * pem, size_t pem_len,
+                              bool private_only)
+{
+  if (pem == NULL || pem_len == 0 || pem_len > INT_MAX)
+  {
+    return NULL;
+  }
+
+  EVP_PKEY *pkey = NULL;
+  BIO *bio = BIO_new_mem_buf(pem, (int) pem_len);
+
+  if (bio != NULL && !private_only)
+  {
+    pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+    if (pkey == NULL)
+    {
+      BIO_reset(bio);
+    }
+  }
+  if (bio != NULL && pkey == NULL)
+  {
+    pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+  }
+  BIO_free(bio);
+
+  return pkey;
+}
+
+//############################################################################
+// rsa_key_to_public()
+//############################################################################
+/**
+ * @brief Fills the TPM 2.0 public area of an RSASSA signing key from an
+ *        OpenSSL RSA key.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int rsa_key_to_public(EVP_PKEY * pkey, TPM2B_PUBLIC * key)
+{
+  if (EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA)
+  {
+    kmyth_log(LOG_ERR, "authorizing key is not an RSA key ... exiting");
+    return 1;
+  }
+
+  BIGNUM *n = NULL;
+  BIGNUM *e = NULL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // either is left NULL if it can not be retrieved
+  EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_RSA_N, &n);
+  EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_RSA_E, &e);
+#else
+  const BIGNUM *rsa_n = NULL;
+  const BIGNUM *rsa_e = NULL;
+
+  RSA_get0_key(EVP_PKEY_get0_RSA(pkey), &rsa_n, &rsa_e, NULL);
+  n = (rsa_n == NULL) ? NULL : BN_dup(rsa_n);
+  e = (rsa_e == NULL) ? NULL : BN_dup(rsa_e);
+#endif
+
+  int bits = (n == NULL) ? 0 : BN_num_bits(n);
+  TPMT_PUBLIC *area = &key->publicArea;
+  int retval = 0;
+
+  // the TPM only takes the default exponent as 0, and whole-byte moduli
+  if (n == NULL || e == NULL || !BN_is_word(e, 65537) ||
+      bits < KMYTH_AUTHORIZING_KEY_MIN_BITS || bits % 8 != 0 ||
+      (size_t) bits / 8 > sizeof(area->unique.rsa.buffer))
+  {
+    kmyth_log(LOG_ERR, "unsupported authorizing key (%d bits) ... exiting",
+              bits);
+    retval = 1;
+  }
+  else
+  {
+    memset(key, 0, sizeof(TPM2B_PUBLIC));
+    area->type = TPM2_ALG_RSA;
+    area->nameAlg = KMYTH_HASH_ALG;
+    area->objectAttributes = TPMA_OBJECT_SIGN_ENCRYPT |
+      TPMA_OBJECT_USERWITHAUTH;
+    area->authPolicy.size = 0;
+    area->parameters.rsaDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    area->parameters.rsaDetail.scheme.scheme = TPM2_ALG_RSASSA;
+    area->parameters.rsaDetail.scheme.details.rsassa.hashAlg =
+      KMYTH_HASH_ALG;
+    area->parameters.rsaDetail.keyBits = (TPMI_RSA_KEY_BITS) bits;
+    area->parameters.rsaDetail.exponent = 0;
+    area->unique.rsa.size = (uint16_t) (bits / 8);
+    if (BN_bn2binpad(n, area->unique.rsa.buffer, bits / 8) != bits / 8)
+    {
+      kmyth_log(LOG_ERR, "unable to convert authorizing key ... exiting");
+      retval = 1;
+    }
+  }
+  BN_free(n);
+  BN_free(e);
+
+  // the size of the marshalled public area marks the key as present
+  uint8_t packed[sizeof(TPMT_PUBLIC)];
+  size_t packed_size = 0;
+
+  if (retval == 0 &&
+      Tss2_MU_TPMT_PUBLIC_Marshal(area, packed, sizeof(packed),
+                                  &packed_size) != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "unable to marshal authorizing key ... exiting");
+    retval = 1;
+  }
+  key->size = (retval == 0) ? (uint16_t) packed_size : 0;
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_pem_to_authorizing_key()
+//############################################################################
+int kmyth_pem_to_authorizing_key(const uint8_t * pem, size_t pem_len,
+                                 TPM2B_PUBLIC * key)
+{
+  if (key == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL output parameter ... exiting");
+    return 1;
+  }
+  key->size = 0;
+
+  EVP_PKEY *pkey = load_pem_key(pem, pem_len, false);
+
+  if (pkey == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to read PEM authorizing key ... exiting");
+    return 1;
+  }
+
+  int retval = rsa_key_to_public(pkey, key);
+
+  EVP_PKEY_free(pkey);
+  return retval;
+}
+
+//############################################################################
+// set_authorizing_key()
+//############################################################################
+int set_authorizing_key(const char *pem_path)
+{
+  if (pem_path == NULL)
+  {
+    authorizing_key.size = 0;
+    return 0;
+  }
+
+  uint8_t *pem = NULL;
+  size_t pem_len = 0;
+  TPM2B_PUBLIC key = {.size = 0, };
+
+  if (read_bytes_from_file((char *) pem_path, &pem, &pem_len) ||
+      kmyth_pem_to_authorizing_key(pem, pem_len, &key))
+  {
+    kmyth_log(LOG_ERR, "invalid authorizing key (%s) ... exiting", pem_path);
+    kmyth_free(pem);
+    return 1;
+  }
+  kmyth_free(pem);
+  authorizing_key = key;
+
+  return 0;
+}
+
+//############################################################################
+// get_authorizing_key()
+//############################################################################
+const TPM2B_PUBLIC *get_authorizing_key(void)
+{
+  return (authorizing_key.size > 0) ? &authorizing_key : NULL;
+}
+
+//############################################################################
+// encode_signed_policy_block()
+//############################################################################
+/**
+ * @brief Appends a delimiter and its base64 encoded block to a signed
+ *        policy being assembled.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int encode_signed_policy_block(kmyth_byte_buffer * out,
+                                      const char *delim,
+                                      uint8_t * packed, size_t packed_size)
+{
+  uint8_t *b64 = NULL;
+  size_t b64_len = 0;
+
+  if (encodeBase64Data(packed, packed_size, &b64, &b64_len))
+  {
+    return 1;
+  }
+
+  int retval = append_to_byte_buffer(out, (uint8_t *) delim, strlen(delim)) ||
+    append_to_byte_buffer(out, b64, b64_len);
+
+  kmyth_free(b64);
+  return retval;
+}
+
+//############################################################################
+// kmyth_sign_policy()
+//############################################################################
+int kmyth_sign_policy(TPM2B_DIGEST * approvedPolicy,
+                      const uint8_t * pem, size_t pem_len,
+                      uint8_t ** output, size_t *output_len)
+{
+  if (approvedPolicy == NULL || approvedPolicy->size == 0 ||
+      approvedPolicy->size > sizeof(approvedPolicy->buffer) ||
+      output == NULL || output_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid policy signing parameters ... exiting");
+    return 1;
+  }
+
+  EVP_PKEY *pkey = load_pem_key(pem, pem_len, true);
+  TPM2B_PUBLIC key = {.size = 0, };
+  TPM2B_NAME keyName = {.size = 0, };
+
+  if (pkey == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to read PEM private key ... exiting");
+    return 1;
+  }
+  if (rsa_key_to_public(pkey, &key) ||
+      compute_kmyth_object_name(&key, &keyName))
+  {
+    EVP_PKEY_free(pkey);
+    return 1;
+  }
+
+  // RSASSA (PKCS#1 v1.5) over H(approvedPolicy || policyRef), with an
+  // empty policyRef, as TPM2_VerifySignature() is given at unseal
+  TPMT_SIGNATURE signature;
+  size_t sig_len = sizeof(signature.signature.rsassa.sig.buffer);
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+
+  memset(&signature, 0, sizeof(signature));
+  int retval = (md_ctx == NULL) ||
+    EVP_DigestSignInit(md_ctx, NULL, KMYTH_OPENSSL_HASH, NULL, pkey) != 1 ||
+    EVP_DigestSign(md_ctx, signature.signature.rsassa.sig.buffer, &sig_len,
+                   approvedPolicy->buffer, approvedPolicy->size) != 1;
+
+  EVP_MD_CTX_free(md_ctx);
+  EVP_PKEY_free(pkey);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to sign policy ... exiting");
+    return 1;
+  }
+  signature.sigAlg = TPM2_ALG_RSASSA;
+  signature.signature.rsassa.hash = KMYTH_HASH_ALG;
+  signature.signature.rsassa.sig.size = (uint16_t) sig_len;
+
+  // marshal each block, then assemble the file
+  uint8_t policy_data[sizeof(TPM2B_DIGEST)];
+  size_t policy_size = 0;
+  uint8_t name_data[sizeof(TPM2B_NAME)];
+  size_t name_size = 0;
+  uint8_t sig_data[sizeof(TPMT_SIGNATURE)];
+  size_t sig_size = 0;
+  kmyth_byte_buffer out;
+
+  retval =
+    Tss2_MU_TPM2B_DIGEST_Marshal(approvedPolicy, policy_data,
+                                 sizeof(policy_data), &policy_size) ||
+    Tss2_MU_TPM2B_NAME_Marshal(&keyName, name_data, sizeof(name_data),
+                               &name_size) ||
+    Tss2_MU_TPMT_SIGNATURE_Marshal(&signature, sig_data, sizeof(sig_data),
+                                   &sig_size);
+  retval = retval || init_byte_buffer(&out, 2 * (policy_size + name_size +
+                                                 sig_size) + 256);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to marshal signed policy ... exiting");
+    return 1;
+  }
+
+  retval = encode_signed_policy_block(&out, KMYTH_DELIM_APPROVED_POLICY,
+                                      policy_data, policy_size) ||
+    encode_signed_policy_block(&out, KMYTH_DELIM_AUTHORIZING_KEY_NAME,
+                               name_data, name_size) ||
+    encode_signed_policy_block(&out, KMYTH_DELIM_POLICY_SIGNATURE,
+                               sig_data, sig_size) ||
+    append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_END_FILE,
+                          strlen(KMYTH_DELIM_END_FILE));
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error creating signed policy ... exiting");
+    free_byte_buffer(&out);
+    return 1;
+  }
+
+  detach_byte_buffer(&out, output, output_len);
+  return 0;
+}
+
+//############################################################################
+// decode_signed_policy_block()
+//############################################################################
+/**
+ * @brief Base64 decodes a block of a signed policy.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int decode_signed_policy_block(uint8_t * raw, size_t raw_size,
+                                      uint8_t * packed, size_t packed_max,
+                                      size_t *packed_size)
+{
+  uint8_t *decoded = NULL;
+  size_t decoded_size = 0;
+
+  if (decodeBase64Data(raw, raw_size, &decoded, &decoded_size) ||
+      decoded_size > packed_max)
+  {
+    kmyth_free(decoded);
+    return 1;
+  }
+  memcpy(packed, decoded, decoded_size);
+  *packed_size = decoded_size;
+  kmyth_free(decoded);
+
+  return 0;
+}
+
+//############################################################################
+// parse_signed_policy()
+//############################################################################
+int parse_signed_policy(uint8_t * input, size_t input_len,
+                        TPM2B_DIGEST * approvedPolicy, TPM2B_NAME * keyName,
+                        TPMT_SIGNATURE * signature)
+{
+  if (input == NULL || approvedPolicy == NULL || keyName == NULL ||
+      signature == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL signed policy parameter ... exiting");
+    return 1;
+  }
+
+  uint8_t *position = input;
+  size_t remaining = input_len;
+  uint8_t *raw_policy = NULL;
+  size_t raw_policy_size = 0;
+  uint8_t *raw_name = NULL;
+  size_t raw_name_size = 0;
+  uint8_t *raw_sig = NULL;
+  size_t raw_sig_size = 0;
+
+  if (get_block_view(&position, &remaining, &raw_policy, &raw_policy_size,
+                     KMYTH_DELIM_APPROVED_POLICY,
+                     strlen(KMYTH_DELIM_APPROVED_POLICY),
+                     KMYTH_DELIM_AUTHORIZING_KEY_NAME,
+                     strlen(KMYTH_DELIM_AUTHORIZING_KEY_NAME)) ||
+      get_block_view(&position, &remaining, &raw_name, &raw_name_size,
+                     KMYTH_DELIM_AUTHORIZING_KEY_NAME,
+                     strlen(KMYTH_DELIM_AUTHORIZING_KEY_NAME),
+                     KMYTH_DELIM_POLICY_SIGNATURE,
+                     strlen(KMYTH_DELIM_POLICY_SIGNATURE)) ||
+      get_block_view(&position, &remaining, &raw_sig, &raw_sig_size,
+                     KMYTH_DELIM_POLICY_SIGNATURE,
+                     strlen(KMYTH_DELIM_POLICY_SIGNATURE),
+                     KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE)))
+  {
+    kmyth_log(LOG_ERR, "unable to parse signed policy ... exiting");
+    return 1;
+  }
+  if (remaining != strlen(KMYTH_DELIM_END_FILE) ||
+      memcmp(position, KMYTH_DELIM_END_FILE, remaining))
+  {
+    kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
+    return 1;
+  }
+
+  uint8_t policy_data[sizeof(TPM2B_DIGEST)];
+  size_t policy_size = 0;
+  uint8_t name_data[sizeof(TPM2B_NAME)];
+  size_t name_size = 0;
+  uint8_t sig_data[sizeof(TPMT_SIGNATURE)];
+  size_t sig_size = 0;
+  size_t policy_offset = 0;
+  size_t name_offset = 0;
+  size_t sig_offset = 0;
+
+  if (decode_signed_policy_block(raw_policy, raw_policy_size, policy_data,
+                                 sizeof(policy_data), &policy_size) ||
+      decode_signed_policy_block(raw_name, raw_name_size, name_data,
+                                 sizeof(name_data), &name_size) ||
+      decode_signed_policy_block(raw_sig, raw_sig_size, sig_data,
+                                 sizeof(sig_data), &sig_size))
+  {
+    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    return 1;
+  }
+
+  // each structure must take up its whole block
+  if (Tss2_MU_TPM2B_DIGEST_Unmarshal(policy_data, policy_size,
+                                     &policy_offset, approvedPolicy) ||
+      policy_offset != policy_size || approvedPolicy->size == 0 ||
+      Tss2_MU_TPM2B_NAME_Unmarshal(name_data, name_size, &name_offset,
+                                   keyName) ||
+      name_offset != name_size || keyName->size == 0 ||
+      Tss2_MU_TPMT_SIGNATURE_Unmarshal(sig_data, sig_size, &sig_offset,
+                                       signature) || sig_offset != sig_size)
+  {
+    kmyth_log(LOG_ERR, "unmarshal signed policy error ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// set_signed_policy_path()
+//############################################################################
+int set_signed_policy_path(const char *path)
+{
+  char *copy = NULL;
+
+  if (path != NULL)
+  {
+    copy = kmyth_strdup(path);
+    if (copy == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate signed policy path ... exiting");
+      return 1;
+    }
+  }
+  kmyth_free(signed_policy_path);
+  signed_policy_path = copy;
+
+  return 0;
+}
+
+//############################################################################
+// signed_policy_file_matches()
+//############################################################################
+/**
+ * @brief Reads a signed policy file and checks whether it approves the
+ *        given policy under the given key.
+ *
+ * @return true on a match (signature filled in), false otherwise
+ */
+static bool signed_policy_file_matches(char *path, TPM2B_DIGEST * policy,
+                                       TPM2B_NAME * keyName,
+                                       TPMT_SIGNATURE * signature)
+{
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+  TPM2B_DIGEST approved = {.size = 0, };
+  TPM2B_NAME name = {.size = 0, };
+  TPMT_SIGNATURE sig;
+
+  if (read_bytes_from_file(path, &data, &data_len))
+  {
+    return false;
+  }
+
+  bool match = data != NULL &&
+    parse_signed_policy(data, data_len, &approved, &name, &sig) == 0 &&
+    approved.size == policy->size &&
+    memcmp(approved.buffer, policy->buffer, policy->size) == 0 &&
+    name.size == keyName->size &&
+    memcmp(name.name, keyName->name, keyName->size) == 0;
+
+  kmyth_free(data);
+  if (match)
+  {
+    *signature = sig;
+  }
+  return match;
+}
+
+//############################################################################
+// kmyth_find_signed_policy()
+//############################################################################
+int kmyth_find_signed_policy(TPM2B_DIGEST * policy, TPM2B_NAME * keyName,
+                             TPMT_SIGNATURE * signature)
+{
+  if (policy == NULL || keyName == NULL || signature == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+
+  const char *path = signed_policy_path;
+
+  if (path == NULL)
+  {
+    path = getenv(KMYTH_SIGNED_POLICY_ENV);
+  }
+  if (path == NULL || path[0] == '\0')
+  {
+    kmyth_log(LOG_ERR, "data is sealed to signed policies, but no signed "
+              "policy was given ... exiting");
+    return 1;
+  }
+
+  struct stat st;
+
+  if (stat(path, &st) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to access signed policy (%s) ... exiting",
+              path);
+    return 1;
+  }
+
+  bool found = false;
+
+  if (S_ISDIR(st.st_mode))
+  {
+    DIR *dir = opendir(path);
+    struct dirent *entry = NULL;
+
+    while (dir != NULL && !found && (entry = readdir(dir)) != NULL)
+    {
+      char entry_path[PATH_MAX];
+      struct stat entry_st;
+
+      // only regular files small enough to be a signed policy are read
+      if (entry->d_name[0] == '.' ||
+          snprintf(entry_path, sizeof(entry_path), "%s/%s", path,
+                   entry->d_name) >= (int) sizeof(entry_path) ||
+          stat(entry_path, &entry_st) != 0 || !S_ISREG(entry_st.st_mode) ||
+          entry_st.st_size > KMYTH_SIGNED_POLICY_MAX_SIZE)
+      {
+        continue;
+      }
+      found = signed_policy_file_matches(entry_path, policy, keyName,
+                                         signature);
+    }
+    if (dir != NULL)
+    {
+      closedir(dir);
+    }
+  }
+  else
+  {
+    found = signed_policy_file_matches((char *) path, policy, keyName,
+                                       signature);
+  }
+
+  if (!found)
+  {
+    kmyth_log(LOG_ERR, "no signed policy approves the current PCR state "
+              "(%s) ... exiting", path);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "found signed policy approving 0x%02X..%02X",
+            policy->buffer[0], policy->buffer[policy->size - 1]);
+
+  return 0;
+}
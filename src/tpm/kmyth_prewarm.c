@@ -0,0 +1,296 @@
+/**
+ * @file  kmyth_prewarm.c
+ *
+ * @brief Implements the secret cache prewarming declared in kmyth_prewarm.h.
+ */
+
+#include "kmyth_prewarm.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "marshalling_tools.h"
+#include "memory_util.h"
+#include "object_tools.h"
+
+//############################################################################
+// kmyth_prewarm_parse_manifest()
+//############################################################################
+int kmyth_prewarm_parse_manifest(const uint8_t * manifest,
+                                 size_t manifest_len,
+                                 kmyth_prewarm_item ** items, size_t *count)
+{
+  if (items == NULL || count == NULL ||
+      (manifest == NULL && manifest_len > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid prewarm manifest arguments ... exiting");
+    return 1;
+  }
+  *items = NULL;
+  *count = 0;
+
+  kmyth_prewarm_item *list = NULL;
+  size_t listed = 0;
+  size_t capacity = 0;
+  size_t line = 0;
+  size_t pos = 0;
+
+  while (pos < manifest_len)
+  {
+    size_t end = pos;
+
+    while (end < manifest_len && manifest[end] != '\n')
+    {
+      end++;
+    }
+    line++;
+
+    // trim the line (and a trailing '\r')
+    size_t start = pos;
+    size_t stop = end;
+
+    pos = end + 1;
+    while (start < stop && isspace(manifest[start]))
+    {
+      start++;
+    }
+    while (stop > start && isspace(manifest[stop - 1]))
+    {
+      stop--;
+    }
+    if (start == stop || manifest[start] == '#')
+    {
+      continue;
+    }
+
+    long priority = KMYTH_PREWARM_DEFAULT_PRIORITY;
+
+    if (isdigit(manifest[start]) || manifest[start] == '-')
+    {
+      size_t digits = start + 1;
+
+      while (digits < stop && !isspace(manifest[digits]))
+      {
+        digits++;
+      }
+
+      // a leading number only counts as a priority when a path follows it
+      if (digits < stop)
+      {
+        char number[24] = { 0 };
+        char *number_end = NULL;
+
+        if (digits - start >= sizeof(number))
+        {
+          kmyth_log(LOG_ERR, "invalid priority on manifest line %zu "
+                    "... exiting", line);
+          kmyth_prewarm_free(list, listed);
+          return 1;
+        }
+        memcpy(number, manifest + start, digits - start);
+        errno = 0;
+        priority = strtol(number, &number_end, 10);
+        if (errno != 0 || number_end == number || *number_end != '\0')
+        {
+          kmyth_log(LOG_ERR, "invalid priority on manifest line %zu "
+                    "... exiting", line);
+          kmyth_prewarm_free(list, listed);
+          return 1;
+        }
+        start = digits;
+        while (start < stop && isspace(manifest[start]))
+        {
+          start++;
+        }
+      }
+    }
+
+    if (listed == KMYTH_PREWARM_MAX_ENTRIES)
+    {
+      kmyth_log(LOG_ERR, "prewarm manifest has more than %d entries "
+                "... exiting", KMYTH_PREWARM_MAX_ENTRIES);
+      kmyth_prewarm_free(list, listed);
+      return 1;
+    }
+    if (listed == capacity)
+    {
+      size_t grown = (capacity == 0) ? 16 : 2 * capacity;
+      kmyth_prewarm_item *resized = kmyth_realloc(list,
+                                                  grown * sizeof(*resized));
+
+      if (resized == NULL)
+      {
+        kmyth_log(LOG_ERR, "unable to allocate prewarm entries ... exiting");
+        kmyth_prewarm_free(list, listed);
+        return 1;
+      }
+      memset(resized + listed, 0, (grown - listed) * sizeof(*resized));
+      list = resized;
+      capacity = grown;
+    }
+
+    kmyth_prewarm_item *item = &list[listed];
+
+    item->path = kmyth_calloc(stop - start + 1, 1);
+    if (item->path == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate prewarm path ... exiting");
+      kmyth_prewarm_free(list, listed);
+      return 1;
+    }
+    memcpy(item->path, manifest + start, stop - start);
+    item->line = line;
+    item->priority = priority;
+    listed++;
+  }
+
+  *items = list;
+  *count = listed;
+  return 0;
+}
+
+//############################################################################
+// kmyth_prewarm_load()
+//############################################################################
+int kmyth_prewarm_load(kmyth_prewarm_item * item)
+{
+  if (item == NULL || item->path == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid prewarm entry ... exiting");
+    return 1;
+  }
+
+  if (item->ski == NULL &&
+      read_bytes_from_file(item->path, &item->ski, &item->ski_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read %s ... exiting", item->path);
+    item->ski = NULL;
+    item->ski_len = 0;
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_header(item->ski, item->ski_len, &ski))
+  {
+    kmyth_log(LOG_ERR, "unable to parse %s ... exiting", item->path);
+    free_ski(&ski);
+    return 1;
+  }
+
+  int retval = 0;
+
+  if (compute_kmyth_object_name(&ski.sk_pub, &item->sk_name))
+  {
+    kmyth_log(LOG_ERR, "unable to name the storage key of %s ... exiting",
+              item->path);
+    retval = 1;
+  }
+  item->policy = ski.wk_pub.publicArea.authPolicy;
+  item->policy_or = (ski.policyBranches.count > 0);
+
+  free_ski(&ski);
+  return retval;
+}
+
+//############################################################################
+// kmyth_prewarm_same_group()
+//############################################################################
+static int kmyth_prewarm_same_group(const kmyth_prewarm_item * a,
+                                    const kmyth_prewarm_item * b)
+{
+  return a->priority == b->priority &&
+    a->sk_name.size == b->sk_name.size &&
+    memcmp(a->sk_name.name, b->sk_name.name, a->sk_name.size) == 0 &&
+    a->policy.size == b->policy.size &&
+    memcmp(a->policy.buffer, b->policy.buffer, a->policy.size) == 0;
+}
+
+//############################################################################
+// kmyth_prewarm_order()
+//############################################################################
+void kmyth_prewarm_order(kmyth_prewarm_item * items, size_t count)
+{
+  // Manifests are small, so a stable insertion sort on priority, followed
+  // by pulling each group's later members up behind its first one, keeps
+  // the manifest order everywhere the grouping allows it.
+  for (size_t i = 1; i < count; i++)
+  {
+    kmyth_prewarm_item moving = items[i];
+    size_t j = i;
+
+    while (j > 0 && items[j - 1].priority > moving.priority)
+    {
+      items[j] = items[j - 1];
+      j--;
+    }
+    items[j] = moving;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t next = i + 1;
+
+    for (size_t k = i + 1; k < count; k++)
+    {
+      if (!kmyth_prewarm_same_group(&items[i], &items[k]))
+      {
+        continue;
+      }
+
+      kmyth_prewarm_item moving = items[k];
+
+      memmove(&items[next + 1], &items[next],
+              (k - next) * sizeof(kmyth_prewarm_item));
+      items[next] = moving;
+      next++;
+    }
+    i = next - 1;
+  }
+}
+
+//############################################################################
+// kmyth_prewarm_unseal()
+//############################################################################
+int kmyth_prewarm_unseal(kmyth_ctx_t * ctx, kmyth_prewarm_item * item)
+{
+  if (ctx == NULL || item == NULL || item->ski == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid prewarm entry ... exiting");
+    return 1;
+  }
+
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  if (tpm2_kmyth_unseal_ctx(ctx, item->ski, item->ski_len,
+                            &output, &output_len, NULL, 0, NULL, 0,
+                            item->policy_or))
+  {
+    kmyth_log(LOG_ERR, "unable to prewarm %s ... exiting", item->path);
+    return 1;
+  }
+  kmyth_clear_and_free(output, output_len);
+  return 0;
+}
+
+//############################################################################
+// kmyth_prewarm_free()
+//############################################################################
+void kmyth_prewarm_free(kmyth_prewarm_item * items, size_t count)
+{
+  if (items == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    kmyth_free(items[i].path);
+    kmyth_free(items[i].ski);
+  }
+  kmyth_free(items);
+}
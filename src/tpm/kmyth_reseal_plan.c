@@ -0,0 +1,282 @@
+/**
+ * @file  kmyth_reseal_plan.c
+ *
+ * @brief Implements the incremental reseal planning declared in
+ *        kmyth_reseal_plan.h.
+ */
+
+#include "kmyth_reseal_plan.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "formatting_tools.h"
+#include "kmyth_context.h"
+#include "kmyth_log.h"
+#include "marshalling_tools.h"
+#include "pcrs.h"
+#include "tpm2_interface.h"
+
+//############################################################################
+// kmyth_pcr_values_parse()
+//############################################################################
+int kmyth_pcr_values_parse(const uint8_t * manifest, size_t manifest_len,
+                           kmyth_pcr_values * values)
+{
+  if (values == NULL || (manifest == NULL && manifest_len > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid PCR values manifest arguments ... exiting");
+    return 1;
+  }
+
+  kmyth_pcr_values parsed = *values;
+  bool listed[KMYTH_DEFAULT_PCR_COUNT] = { false };
+  size_t line = 0;
+  size_t pos = 0;
+
+  while (pos < manifest_len)
+  {
+    size_t end = pos;
+
+    while (end < manifest_len && manifest[end] != '\n')
+    {
+      end++;
+    }
+    line++;
+
+    // trim the line (and a trailing '\r')
+    size_t start = pos;
+    size_t stop = end;
+
+    pos = end + 1;
+    while (start < stop && isspace(manifest[start]))
+    {
+      start++;
+    }
+    while (stop > start && isspace(manifest[stop - 1]))
+    {
+      stop--;
+    }
+    if (start == stop || manifest[start] == '#')
+    {
+      continue;
+    }
+
+    // PCR index
+    size_t digits = start;
+    long index = 0;
+
+    while (digits < stop && isdigit(manifest[digits]) && index < 1000)
+    {
+      index = 10 * index + (manifest[digits] - '0');
+      digits++;
+    }
+    if (digits == start || index >= KMYTH_DEFAULT_PCR_COUNT)
+    {
+      kmyth_log(LOG_ERR, "invalid PCR index on manifest line %zu ... exiting",
+                line);
+      return 1;
+    }
+
+    // separator, then exactly one SHA-256 value in hex
+    size_t hex = digits;
+
+    while (hex < stop && (isblank(manifest[hex]) || manifest[hex] == '=' ||
+                          manifest[hex] == ':'))
+    {
+      hex++;
+    }
+
+    char hex_string[2 * KMYTH_DIGEST_SIZE + 1] = { 0 };
+    bool valid = (hex > digits && stop - hex == 2 * KMYTH_DIGEST_SIZE);
+
+    for (size_t i = 0; valid && i < 2 * KMYTH_DIGEST_SIZE; i++)
+    {
+      valid = isxdigit(manifest[hex + i]);
+      hex_string[i] = (char) manifest[hex + i];
+    }
+
+    TPM2B_DIGEST digest = {.size = 0, };
+
+    if (!valid || convert_string_to_digest(hex_string, &digest))
+    {
+      kmyth_log(LOG_ERR, "invalid PCR value on manifest line %zu ... exiting",
+                line);
+      return 1;
+    }
+    if (listed[index])
+    {
+      kmyth_log(LOG_ERR, "PCR %ld listed again on manifest line %zu "
+                "... exiting", index, line);
+      return 1;
+    }
+    listed[index] = true;
+    parsed.known[index] = true;
+    memcpy(parsed.value[index], digest.buffer, KMYTH_DIGEST_SIZE);
+  }
+
+  *values = parsed;
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_values_read()
+//############################################################################
+int kmyth_pcr_values_read(kmyth_ctx_t * ctx, kmyth_pcr_values * values)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL || values == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid PCR values arguments ... exiting");
+    return 1;
+  }
+
+  int pcrs[KMYTH_DEFAULT_PCR_COUNT];
+  size_t pcrs_len = 0;
+
+  for (int i = 0; i < KMYTH_DEFAULT_PCR_COUNT; i++)
+  {
+    if (!values->known[i])
+    {
+      pcrs[pcrs_len++] = i;
+    }
+  }
+  if (pcrs_len == 0)
+  {
+    return 0;
+  }
+
+  TPML_PCR_SELECTION pcrList;
+  kmyth_pcr_snapshot_t snapshot;
+
+  if (build_pcr_selection(KMYTH_DEFAULT_PCR_COUNT, pcrs, pcrs_len, &pcrList) ||
+      kmyth_pcr_snapshot(ctx->sapi_ctx, pcrList, &snapshot))
+  {
+    kmyth_log(LOG_ERR, "unable to read current PCR values ... exiting");
+    return 1;
+  }
+  if (snapshot.count != pcrs_len)
+  {
+    kmyth_log(LOG_ERR, "expected %zu PCR values, read %u ... exiting",
+              pcrs_len, snapshot.count);
+    return 1;
+  }
+
+  // the snapshot holds the values in ascending PCR order
+  for (size_t i = 0; i < pcrs_len; i++)
+  {
+    if (snapshot.values[i].size != KMYTH_DIGEST_SIZE)
+    {
+      kmyth_log(LOG_ERR, "unexpected size of PCR %d value ... exiting",
+                pcrs[i]);
+      return 1;
+    }
+    values->known[pcrs[i]] = true;
+    memcpy(values->value[pcrs[i]], snapshot.values[i].buffer,
+           KMYTH_DIGEST_SIZE);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_reseal_plan_check()
+//############################################################################
+int kmyth_reseal_plan_check(uint8_t * ski, size_t ski_len,
+                            const kmyth_pcr_values * values,
+                            kmyth_reseal_plan_action * action)
+{
+  if (ski == NULL || values == NULL || action == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid reseal plan arguments ... exiting");
+    return 1;
+  }
+
+  Ski header = get_default_ski();
+
+  if (parse_ski_header(ski, ski_len, &header))
+  {
+    kmyth_log(LOG_ERR, "unable to parse .ski header ... exiting");
+    free_ski(&header);
+    return 1;
+  }
+
+  if (header.authorizing_key.size > 0)
+  {
+    *action = KMYTH_RESEAL_PLAN_SIGNED;
+    free_ski(&header);
+    return 0;
+  }
+
+  // gather the values of the selected PCRs, in ascending PCR order (only
+  // the SHA-256 bank kmyth-seal uses can be predicted)
+  uint8_t selected[KMYTH_DEFAULT_PCR_COUNT * KMYTH_DIGEST_SIZE];
+  size_t selected_len = 0;
+
+  for (uint32_t b = 0; b < header.pcr_list.count; b++)
+  {
+    TPMS_PCR_SELECTION *sel = &header.pcr_list.pcrSelections[b];
+
+    for (int i = 0; i < sel->sizeofSelect * 8; i++)
+    {
+      if (!(sel->pcrSelect[i / 8] & (1 << (i % 8))))
+      {
+        continue;
+      }
+      if (sel->hash != KMYTH_HASH_ALG || i >= KMYTH_DEFAULT_PCR_COUNT ||
+          header.pcr_list.count > 1)
+      {
+        kmyth_log(LOG_ERR, "PCR selection can not be predicted ... exiting");
+        free_ski(&header);
+        return 1;
+      }
+      if (!values->known[i])
+      {
+        kmyth_log(LOG_ERR, "no value for PCR %d ... exiting", i);
+        free_ski(&header);
+        return 1;
+      }
+      memcpy(selected + selected_len, values->value[i], KMYTH_DIGEST_SIZE);
+      selected_len += KMYTH_DIGEST_SIZE;
+    }
+  }
+
+  TPM2B_DIGEST pcrDigest = {.size = 0, };
+  TPM2B_DIGEST predicted = {.size = 0, };
+
+  if (compute_pcr_digest((selected_len > 0) ? selected : NULL, selected_len,
+                         &pcrDigest) ||
+      compute_policy_digest(header.pcr_list, pcrDigest, &predicted))
+  {
+    kmyth_log(LOG_ERR, "error computing policy digest ... exiting");
+    free_ski(&header);
+    return 1;
+  }
+
+  // a compound policy holds if any of its branches does
+  bool satisfied = false;
+
+  if (header.policyBranches.count > 0)
+  {
+    for (uint32_t i = 0; !satisfied && i < header.policyBranches.count; i++)
+    {
+      TPM2B_DIGEST *branch = &header.policyBranches.digests[i];
+
+      satisfied = (branch->size == predicted.size &&
+                   memcmp(branch->buffer, predicted.buffer,
+                          predicted.size) == 0);
+    }
+  }
+  else
+  {
+    TPM2B_DIGEST *policy = &header.wk_pub.publicArea.authPolicy;
+
+    satisfied = (policy->size == predicted.size &&
+                 memcmp(policy->buffer, predicted.buffer,
+                        predicted.size) == 0);
+  }
+
+  *action = satisfied ? KMYTH_RESEAL_PLAN_KEEP : KMYTH_RESEAL_PLAN_RESEAL;
+  free_ski(&header);
+  return 0;
+}
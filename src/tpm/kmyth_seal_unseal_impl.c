@@ -7,20 +7,33 @@
 
 #include "kmyth_seal_unseal_impl.h"
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
+#include <tss2/tss2_mu.h>
 
 #include "defines.h"
 #include "file_io.h"
+#include "kmyth_context.h"
+#include "kmyth_keyring.h"
+#include "kmyth_policy_authorize.h"
 #include "formatting_tools.h"
+#include "kmyth_usdt.h"
 #include "marshalling_tools.h"
 #include "memory_util.h"
+#include "metrics.h"
 #include "object_tools.h"
 #include "pcrs.h"
 #include "storage_key_tools.h"
 #include "tpm2_interface.h"
 
 
+#include "cipher/aes_gcm.h"
 #include "cipher/cipher.h"
 
 /**
@@ -43,374 +56,2190 @@ int tpm2_kmyth_seal(uint8_t * input,
                     char *cipher_string, char *expected_policy,
                     uint8_t bool_trial_only)
 {
-  if(oa_bytes_len > UINT16_MAX)
-  {
-    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
-    return 1;
-  }
-  
-  //init connection to the resource manager
-  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  kmyth_ctx_t *ctx = NULL;
 
-  if (init_tpm2_connection(&sapi_ctx))
+  if (kmyth_ctx_create(&ctx))
   {
-    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
 
-  Ski ski = get_default_ski();
+  int retval = tpm2_kmyth_seal_ctx(ctx, input, input_len,
+                                   output, output_len,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   pcrs, pcrs_len, cipher_string,
+                                   expected_policy, bool_trial_only);
 
-  //obtain cipher function
-  if (cipher_string == NULL)
-  {
-    cipher_string = KMYTH_DEFAULT_CIPHER;
-  }
-  ski.cipher = kmyth_get_cipher_t_from_string(cipher_string);
+  kmyth_ctx_destroy(&ctx);
+  return retval;
+}
 
-  if (ski.cipher.cipher_name == NULL)
+//############################################################################
+// keyring_cache_key()
+//############################################################################
+/**
+ * @brief Computes the key of an unseal request in the kernel keyring cache
+ *        (see kmyth_keyring.h), which is the secret cache key of the
+ *        request.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int keyring_cache_key(uint8_t * input, size_t input_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             TPM2B_DIGEST * key)
+{
+  TPM2B_AUTH objAuthValue = {.size = 0, };
+  TPM2B_AUTH ownerAuth = {.size = 0, };
+
+  if (oa_bytes_len > sizeof(ownerAuth.buffer))
   {
-    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
-    free_tpm2_resources(&sapi_ctx);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "cipher: %s", ski.cipher.cipher_name);
-
-  // Create owner (storage) hierarchy authorization structure
-  TPM2B_AUTH ownerAuth;
-
-  ownerAuth.size = (uint16_t)oa_bytes_len;
+  ownerAuth.size = (uint16_t) oa_bytes_len;
   if (owner_auth_bytes != NULL && oa_bytes_len > 0)
   {
     memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
   }
-  if (ownerAuth.size > 0)
-  {
-    kmyth_log(LOG_DEBUG, "TPM storage hierarchy auth string provided");
-  }
-  else if (ownerAuth.size == 0)
-  {
-    kmyth_log(LOG_DEBUG,
-              "using default (empty) auth string for TPM storage hierarchy");
-  }
-  else
-  {
-    // should never reach this code - ownerAuth.size should be:
-    //   - zero that it was initialized to
-    //   - strlen(owner_auth_password) value that is greater than zero
-    // included this case for completenes
-    kmyth_log(LOG_DEBUG,
-              "bad size: auth string for TPM storage hierarchy ... exiting");
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
-  }
 
-  // Create authorization value for new, non-primary Kmyth objects (objectAuth)
-  //   - all-zero digest (like TPM 1.2 well-known secret) by default
-  //   - hash of input authorization string if one is specified
-  TPM2B_AUTH objAuthVal = {.size = 0, };
-  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
-  {
-    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
-  }
+  int retval = create_authVal(auth_bytes, auth_bytes_len, &objAuthValue) ||
+    kmyth_secret_cache_key(input, input_len, &objAuthValue, &ownerAuth, key);
 
-  // Create a "PCR Selection" struct and populate it in accordance with
-  // the PCR values specified in user input "PCR Selection" string, if any
-  // (if the "PCR Selection" string is NULL, the "PCR Selection" struct created
-  // will specify that no PCRs were selected by the user - all-zero mask)
-  // This PCR Selection struct will be used in the authorization policy for
-  // new, non-primary Kmyth objects.
-  if (init_pcr_selection(sapi_ctx, pcrs, pcrs_len, &ski.pcr_list))
-  {
-    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+  return retval;
+}
 
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+//############################################################################
+// tpm2_kmyth_unseal()
+//############################################################################
+int tpm2_kmyth_unseal(uint8_t * input,
+                      size_t input_len,
+                      uint8_t ** output,
+                      size_t *output_len,
+                      uint8_t * auth_bytes,
+                      size_t auth_bytes_len,
+                      uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                      uint8_t bool_policy_or)
+{
+  // With a kernel keyring selected, a .ski unsealed by any process of the
+  // user within the timeout is answered without even connecting to the TPM
+  TPM2B_DIGEST keyring_key = {.size = 0, };
+
+  if (kmyth_keyring_enabled() &&
+      keyring_cache_key(input, input_len, auth_bytes, auth_bytes_len,
+                        owner_auth_bytes, oa_bytes_len, &keyring_key) == 0 &&
+      kmyth_keyring_lookup(&keyring_key, output, output_len))
+  {
+    return 0;
   }
 
-  // For all non-primary (other than SRK), Kmyth TPM 2.0 objects that we will
-  // create, we will assign TPM 2.0 policy-based enhanced authorization
-  // critera. Therefore, we will calculate the authorization policy digest that
-  // results from applying the steps of our selected authorization policy. We
-  // can then incorporate this result into the objects we create as the
-  // authorization policy digest value that must be regenerated to authorize
-  // use of these objects.
-  TPM2B_DIGEST objAuthPolicy;
+  kmyth_ctx_t *ctx = NULL;
 
-  objAuthPolicy.size = 0;
-  if (create_policy_digest(sapi_ctx, ski.pcr_list, &objAuthPolicy))
+  if (kmyth_ctx_create(&ctx))
   {
-    kmyth_log(LOG_ERR,
-              "error creating policy digest for new Kmyth object ... exiting");
-
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
     return 1;
   }
 
-  // optional argument allowing user to receive a hex dump of the policy digest,
-  // to be used to calculate a second policy for policyOR authorization
-  if (bool_trial_only == 1)
-  {
-    // size of string is 2x chars for the size of the TPM2B_DIGEST buffer + 4
-    // for TPM2B struct which encodes size in memory + 1 byte for null termination.
-    // prints to the console and finishes the program without sealing
-    // By using TPM2B_DIGEST size we're reserving a little bit more than needed but
-    // then the output_string can be reserved based on compile-time values.
-    size_t string_size = (2 * sizeof(TPM2B_DIGEST)) + 1;
-    char output_string[string_size];
-
-    convert_digest_to_string(&objAuthPolicy, output_string);
-    printf("%s", output_string);
-    return 0;
-  }
+  int retval = tpm2_kmyth_unseal_ctx(ctx, input, input_len,
+                                     output, output_len,
+                                     auth_bytes, auth_bytes_len,
+                                     owner_auth_bytes, oa_bytes_len,
+                                     bool_policy_or);
 
-  // if the user has passed in secondary policy, this indicates that they wish to use
-  // the compound policy, PolicyOR and the argument they've passed in as an alternative
-  // policy digest that can be used to satisfy the policy of the sealed data object
-  if (expected_policy != NULL)
+  kmyth_ctx_destroy(&ctx);
+  if (retval == 0 && keyring_key.size > 0)
   {
-    // digest that will hold the second auth policy branch
-    TPM2B_DIGEST policy_branch_1;
-    TPM2B_DIGEST policy_branch_2;
-
-    // assigns the previously calculated objAuthPolicy to policy branch 1
-    policy_branch_1 = objAuthPolicy;
-
-    // fills the second policy branch with a policy specified by the user
-    if (convert_string_to_digest(expected_policy, &policy_branch_2))
-    {
-      kmyth_log(LOG_ERR,
-                "failed to convert secondary policy %s to digest ... exiting",
-                expected_policy);
-      return 1;
-    }
-    TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
-    TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
-
-    // Digest to hold the policy that results from compounding objAuthPolicy and secondObjAuthPolicy
-    TPM2B_DIGEST policyOR;
-
-    policyOR.size = 0;
-
-    // TPML_DIGEST struct to hold the 2 policy branches per TPM specifications
-    TPML_DIGEST pHashList;
-
-    // initializing a new session for the policyOR
-    SESSION policySessionOR;
-
-    // creates a trial session for calculating the policyOR digest
-    create_auth_session(sapi_ctx, &policySessionOR, TPM2_SE_TRIAL);
-
-    // applies policy_or to the session 2 policy branches:
-    // objAuthPolicy = results from current pcr readings
-    // objAuthPolicy2 = a user-supplied policy for a known future state of pcrs
-    apply_policy_or(sapi_ctx, policySessionOR.sessionHandle, &policy_branch_1,
-                    &policy_branch_2, &pHashList);
-
-    // obtains the policy digest from the policyOR calculation
-    Tss2_Sys_PolicyGetDigest(sapi_ctx, policySessionOR.sessionHandle,
-                             nullCmdAuths, &policyOR, nullRspAuths);
-
-    // flushes the session from the TPM
-    Tss2_Sys_FlushContext(sapi_ctx, policySessionOR.sessionHandle);
-
-    // stores the 2 policy branches in the ski file, they will be needed for future calculations
-    // specifies the policyOR digest as the primary policy used for authorizing actions
-    ski.policyBranch1 = policy_branch_1;
-    ski.policyBranch2 = policy_branch_2;
-    objAuthPolicy = policyOR;
+    kmyth_keyring_insert(&keyring_key, *output, *output_len);
   }
+  return retval;
+}
 
-  // The storage root key (SRK) is the primary key for the storage hierarchy
-  // in the TPM.  We will first check to see if it is already loaded in
-  // persistent storage. We do this by getting the loaded persistent handle
-  // values, inspecting each of their public structures, and comparing
-  // these public area parameters against those for the SRK. None of these
-  // activities require authorization. If the key is not already loaded,
-  // though, it must be re-derived using the storage hierarchy's primary
-  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
-  TPM2_HANDLE storageRootKey_handle = 0;
+//############################################################################
+// tpm2_kmyth_reseal()
+//############################################################################
+int tpm2_kmyth_reseal(uint8_t * input,
+                      size_t input_len,
+                      uint8_t ** output,
+                      size_t *output_len,
+                      uint8_t * auth_bytes,
+                      size_t auth_bytes_len,
+                      uint8_t * owner_auth_bytes,
+                      size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                      char *cipher_string, char *expected_policy,
+                      uint8_t bool_policy_or)
+{
+  kmyth_ctx_t *ctx = NULL;
 
-  if (get_srk_handle(sapi_ctx, &storageRootKey_handle, &ownerAuth))
+  if (kmyth_ctx_create(&ctx))
   {
-    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
-
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
 
-  // We create a storage key (SK) that we will use to seal a symmetric
-  // wrapping key that we will create and use to encrypt the user input data.
-  // This storage key will be sealed to the SRK (its parent is the SRK).
-  TPM2_HANDLE storageKey_handle = 0;
+  int retval = tpm2_kmyth_reseal_ctx(ctx, input, input_len,
+                                     output, output_len,
+                                     auth_bytes, auth_bytes_len,
+                                     owner_auth_bytes, oa_bytes_len,
+                                     pcrs, pcrs_len, cipher_string,
+                                     expected_policy, bool_policy_or);
 
-  if (create_and_load_sk(sapi_ctx,
-                         storageRootKey_handle,
-                         ownerAuth,
-                         objAuthVal,
-                         ski.pcr_list,
-                         objAuthPolicy,
-                         &storageKey_handle, &ski.sk_priv, &ski.sk_pub))
-  {
-    kmyth_log(LOG_ERR, "failed to create and load a storage key ... exiting");
+  kmyth_ctx_destroy(&ctx);
+  return retval;
+}
 
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+//############################################################################
+// tpm2_kmyth_seal_file()
+//############################################################################
+int tpm2_kmyth_seal_file(char *input_path,
+                         uint8_t ** output,
+                         size_t *output_len,
+                         uint8_t * auth_bytes,
+                         size_t auth_bytes_len,
+                         uint8_t * owner_auth_bytes,
+                         size_t oa_bytes_len,
+                         int *pcrs, size_t pcrs_len, char *cipher_string,
+                         char *expected_policy, uint8_t bool_trial_only)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
     return 1;
   }
 
-  // Done with owner hierarchy authorization - SRK and SK available in TPM
-  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+  int retval = tpm2_kmyth_seal_file_ctx(ctx, input_path,
+                                        output, output_len,
+                                        auth_bytes, auth_bytes_len,
+                                        owner_auth_bytes, oa_bytes_len,
+                                        pcrs, pcrs_len, cipher_string,
+                                        expected_policy, bool_trial_only);
 
-  // Wrap input data -
-  //   - The data to be encrypted is contained in a file and the path to that
-  //     file is specified by the user.
-  //   - The encryption uses the symmetric 'cipher' specified by the user.
-  //   - The symmetric wrapping key used for encryption
-  kmyth_log(LOG_DEBUG, "wrapping input data");
-  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
-  unsigned char *wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+  kmyth_ctx_destroy(&ctx);
+  return retval;
+}
 
-  if (wrapKey == NULL)
-  {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for the wrapping key ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
-  }
+//############################################################################
+// tpm2_kmyth_unseal_file()
+//############################################################################
+int tpm2_kmyth_unseal_file(char *input_path,
+                           uint8_t ** output,
+                           size_t *output_length,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           uint8_t bool_policy_or)
+{
+  // the file is read before a context is created, so that a keyring cache
+  // hit (see tpm2_kmyth_unseal()) does not connect to the TPM
+  kmyth_file_view view;
 
-  // validate non-empty plaintext buffer specified
-  if (input_len == 0 || input == NULL)
+  if (map_bytes_from_file(input_path, &view))
   {
-    kmyth_log(LOG_ERR, "no input data ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "Unable to read file %s ... exiting", input_path);
     return 1;
   }
 
-  // encrypt (wrap) input data read in (e.g., client certificate private .pem)
-  if (kmyth_encrypt_data(input, input_len,
-                         ski.cipher, &ski.enc_data, &ski.enc_data_size,
-                         &wrapKey, &wrapKey_size))
+  int retval = tpm2_kmyth_unseal(view.data, view.data_length,
+                                 output, output_length,
+                                 auth_bytes, auth_bytes_len,
+                                 owner_auth_bytes, oa_bytes_len,
+                                 bool_policy_or);
+
+  view.release(&view);
+  if (retval)
   {
-    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "Unable to unseal contents ... exiting");
     return 1;
   }
+  return 0;
+}
 
-  kmyth_log(LOG_DEBUG, "input data wrapped");
+//############################################################################
+// tpm2_kmyth_seal_stream()
+//############################################################################
+int tpm2_kmyth_seal_stream(char *input_path,
+                           char *output_path,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes,
+                           size_t oa_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *cipher_string,
+                           char *expected_policy)
+{
+  kmyth_ctx_t *ctx = NULL;
 
-  // Seal the wrapping key to the TPM using the Storage Key (SK)
-  if (tpm2_kmyth_seal_data(sapi_ctx,
-                           wrapKey,
-                           wrapKey_size,
-                           storageKey_handle,
-                           objAuthVal,
-                           ski.pcr_list,
-                           objAuthVal,
-                           ski.pcr_list,
-                           objAuthPolicy,
-                           ski.policyBranch1,
-                           ski.policyBranch2, &ski.wk_pub, &ski.wk_priv))
+  if (kmyth_ctx_create(&ctx))
   {
-    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
-    kmyth_clear_and_free(wrapKey, wrapKey_size);
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
     return 1;
   }
 
-  // Clean-up:
-  //   - done with unencrypted wrapping key (now have sealed version)
-  //   - done with authVal
-  kmyth_clear_and_free(wrapKey, wrapKey_size);
-  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  int retval = tpm2_kmyth_seal_stream_ctx(ctx, input_path, output_path,
+                                          auth_bytes, auth_bytes_len,
+                                          owner_auth_bytes, oa_bytes_len,
+                                          pcrs, pcrs_len, cipher_string,
+                                          expected_policy);
+
+  kmyth_ctx_destroy(&ctx);
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_stream()
+//############################################################################
+int tpm2_kmyth_unseal_stream(char *input_path,
+                             char *output_path,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             uint8_t bool_policy_or)
+{
+  kmyth_ctx_t *ctx = NULL;
 
-  if (create_ski_bytes(ski, output, output_len))
+  if (kmyth_ctx_create(&ctx))
   {
-    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
     return 1;
   }
 
-  free_ski(&ski);
-  // done, so free any allocated resources that remain
-  free_tpm2_resources(&sapi_ctx);
+  int retval = tpm2_kmyth_unseal_stream_ctx(ctx, input_path, output_path,
+                                            auth_bytes, auth_bytes_len,
+                                            owner_auth_bytes, oa_bytes_len,
+                                            bool_policy_or);
 
-  return 0;
+  kmyth_ctx_destroy(&ctx);
+  return retval;
 }
 
 //############################################################################
-// tpm2_kmyth_unseal()
+// tpm2_kmyth_seal_batch()
 //############################################################################
-int tpm2_kmyth_unseal(uint8_t * input,
-                      size_t input_len,
-                      uint8_t ** output,
-                      size_t *output_len,
-                      uint8_t * auth_bytes,
-                      size_t auth_bytes_len,
-                      uint8_t * owner_auth_bytes, size_t oa_bytes_len,
-                      uint8_t bool_policy_or)
+int tpm2_kmyth_seal_batch(size_t count,
+                          uint8_t ** inputs,
+                          size_t *input_lens,
+                          uint8_t ** outputs,
+                          size_t *output_lens,
+                          uint8_t * auth_bytes,
+                          size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes,
+                          size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                          char *cipher_string, char *expected_policy)
 {
-  if(oa_bytes_len > UINT16_MAX)
-  {
-    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
-    return 1;
-  }
-  
-  // Initialize connection to TPM 2.0 resource manager
-  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  kmyth_ctx_t *ctx = NULL;
 
-  if (init_tpm2_connection(&sapi_ctx))
+  if (kmyth_ctx_create(&ctx))
   {
-    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
 
-  // Create owner (storage) hierarchy authorization structure
-  // to provide password session authorization criteria for use of:
-  //   - Storage Root Key (SRK)
-  //   - Storage Primary Seed (SPS), if necessary to re-derive SRK
-  TPM2B_AUTH ownerAuth;
+  int retval = tpm2_kmyth_seal_batch_ctx(ctx, count, inputs, input_lens,
+                                         outputs, output_lens,
+                                         auth_bytes, auth_bytes_len,
+                                         owner_auth_bytes, oa_bytes_len,
+                                         pcrs, pcrs_len, cipher_string,
+                                         expected_policy);
 
-  ownerAuth.size = (uint16_t)oa_bytes_len;
-  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
-  {
-    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
-  }
+  kmyth_ctx_destroy(&ctx);
+  return retval;
+}
 
-  if (ownerAuth.size > 0)
+//############################################################################
+// get_seal_policy()
+//############################################################################
+/**
+ * @brief Obtains the authorization policy digest for objects sealed to a
+ *        PCR selection (and, optionally, further expected policy-OR
+ *        branches), from the context's policy cache if possible.
+ *
+ * The cache is keyed by the PCR selection, a digest of the current values
+ * of the selected PCRs (so entries stop matching once those PCRs change),
+ * and the expected policy branches. On a miss, the digest is computed with
+ * TPM trial sessions or, if enabled for the context, in software.
+ *
+ * @param[in]  ctx               Kmyth context, must be initialized
+ *
+ * @param[in]  pcrList           PCR selection for the new objects' policy
+ *
+ * @param[in]  expectedBranches  Policy-OR branches following the current
+ *                               policy, or NULL (or an empty list) for a
+ *                               simple (non-compound) policy
+ *
+ * @param[out] basePolicy        PolicyAuthValue/PolicyPCR digest (also the
+ *                               first policy-OR branch)
+ *
+ * @param[out] policyBranches    All policy-OR branches (count of 0 for a
+ *                               simple policy), or NULL if not needed
+ *
+ * @param[out] authPolicy        Digest to use as the new objects' authPolicy
+ *
+ * @return 0 on success, 1 on error
+ */
+static int get_seal_policy(kmyth_ctx_t * ctx,
+                           TPML_PCR_SELECTION pcrList,
+                           TPML_DIGEST * expectedBranches,
+                           TPM2B_DIGEST * basePolicy,
+                           TPML_DIGEST * policyBranches,
+                           TPM2B_DIGEST * authPolicy)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+  kmyth_policy_cache_entry key;
+
+  memset(&key, 0, sizeof(kmyth_policy_cache_entry));
+  key.pcrList = pcrList;
+  if (expectedBranches != NULL)
+  {
+    if (expectedBranches->count >= KMYTH_MAX_POLICY_BRANCHES)
+    {
+      kmyth_log(LOG_ERR, "too many expected policies (%u, at most %d) ... "
+                "exiting", expectedBranches->count,
+                KMYTH_MAX_POLICY_BRANCHES - 1);
+      return 1;
+    }
+    key.expectedBranches = *expectedBranches;
+  }
+
+  // the current policy is the first branch, the expected ones follow it
+  TPML_DIGEST branches = {.count = 0, };
+  bool policy_or = (key.expectedBranches.count > 0);
+
+  if (policy_or)
+  {
+    branches.count = key.expectedBranches.count + 1;
+    for (uint32_t i = 0; i < key.expectedBranches.count; i++)
+    {
+      branches.digests[i + 1] = key.expectedBranches.digests[i];
+    }
+  }
+
+  // without a PCR snapshot the result can not be cached - fall back to an
+  // uncached trial session (software computation needs the PCR values)
+  bool cacheable = true;
+
+  if (get_pcr_digest(sapi_ctx, pcrList, &key.pcrDigest))
+  {
+    if (ctx->software_policy)
+    {
+      kmyth_log(LOG_ERR, "unable to read PCR values ... exiting");
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "unable to read PCR values, policy not cached");
+    cacheable = false;
+  }
+
+  kmyth_policy_cache_entry result;
+
+  if (cacheable && kmyth_policy_cache_lookup(ctx, &key, &result))
+  {
+    *basePolicy = result.basePolicy;
+    *authPolicy = result.authPolicy;
+    if (policyBranches != NULL)
+    {
+      branches.digests[0] = *basePolicy;
+      *policyBranches = branches;
+    }
+    return 0;
+  }
+
+  if (ctx->software_policy)
+  {
+    if (compute_policy_digest(pcrList, key.pcrDigest, basePolicy))
+    {
+      kmyth_log(LOG_ERR, "error computing policy digest ... exiting");
+      return 1;
+    }
+    branches.digests[0] = *basePolicy;
+    if (policy_or && compute_policy_or_digest(&branches, authPolicy))
+    {
+      kmyth_log(LOG_ERR, "error computing policy OR digest ... exiting");
+      return 1;
+    }
+  }
+  else
+  {
+    if (create_policy_digest(sapi_ctx, pcrList, basePolicy))
+    {
+      kmyth_log(LOG_ERR, "error creating policy digest ... exiting");
+      return 1;
+    }
+
+    // applies policy_or to a trial session with the policy branches:
+    // basePolicy = results from current pcr readings
+    // the others = user-supplied policies for known future states of pcrs
+    branches.digests[0] = *basePolicy;
+    if (policy_or && create_policy_or_digest(sapi_ctx, &branches, authPolicy))
+    {
+      kmyth_log(LOG_ERR, "error creating policy OR digest ... exiting");
+      return 1;
+    }
+
+    // only cache the trial result if the PCRs did not change under it
+    TPM2B_DIGEST pcrDigest_after = {.size = 0, };
+
+    if (cacheable &&
+        (get_pcr_digest(sapi_ctx, pcrList, &pcrDigest_after) ||
+         (pcrDigest_after.size != key.pcrDigest.size) ||
+         (memcmp(pcrDigest_after.buffer, key.pcrDigest.buffer,
+                 key.pcrDigest.size) != 0)))
+    {
+      kmyth_log(LOG_DEBUG, "PCR values changed, policy not cached");
+      cacheable = false;
+    }
+  }
+
+  if (!policy_or)
+  {
+    *authPolicy = *basePolicy;
+  }
+  if (policyBranches != NULL)
+  {
+    *policyBranches = branches;
+  }
+
+  if (cacheable)
+  {
+    key.basePolicy = *basePolicy;
+    key.authPolicy = *authPolicy;
+    kmyth_policy_cache_insert(ctx, &key);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_compute_policy()
+//############################################################################
+int kmyth_compute_policy(int *pcrs, size_t pcrs_len,
+                         uint8_t * pcr_values, size_t pcr_values_len,
+                         char *expected_policy, char **policy_string)
+{
+  if (policy_string == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL output parameter ... exiting");
+    return 1;
+  }
+  *policy_string = NULL;
+
+  TPML_PCR_SELECTION pcrList;
+
+  if (build_pcr_selection(KMYTH_DEFAULT_PCR_COUNT, pcrs, pcrs_len, &pcrList))
+  {
+    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
+    return 1;
+  }
+
+  // one value is needed for every selected PCR
+  size_t selected = 0;
+
+  for (int i = 0; i < pcrList.pcrSelections[0].sizeofSelect * 8; i++)
+  {
+    if (pcrList.pcrSelections[0].pcrSelect[i / 8] & (1 << (i % 8)))
+    {
+      selected++;
+    }
+  }
+  if (pcr_values_len != selected * KMYTH_DIGEST_SIZE)
+  {
+    kmyth_log(LOG_ERR, "expected %zu PCR values, got %zu bytes ... exiting",
+              selected, pcr_values_len);
+    return 1;
+  }
+
+  TPM2B_DIGEST pcrDigest = {.size = 0, };
+  TPM2B_DIGEST basePolicy = {.size = 0, };
+  TPM2B_DIGEST authPolicy = {.size = 0, };
+
+  if (compute_pcr_digest(pcr_values, pcr_values_len, &pcrDigest) ||
+      compute_policy_digest(pcrList, pcrDigest, &basePolicy))
+  {
+    kmyth_log(LOG_ERR, "error computing policy digest ... exiting");
+    return 1;
+  }
+  authPolicy = basePolicy;
+
+  if (expected_policy != NULL)
+  {
+    TPML_DIGEST expectedBranches = {.count = 0, };
+    TPML_DIGEST policyBranches = {.count = 0, };
+
+    if (convert_string_to_digest_list(expected_policy, &expectedBranches) ||
+        expectedBranches.count >= KMYTH_MAX_POLICY_BRANCHES)
+    {
+      kmyth_log(LOG_ERR, "invalid expected policies (%s) ... exiting",
+                expected_policy);
+      return 1;
+    }
+
+    // the current policy is the first branch, the expected ones follow it
+    policyBranches.count = expectedBranches.count + 1;
+    policyBranches.digests[0] = basePolicy;
+    for (uint32_t i = 0; i < expectedBranches.count; i++)
+    {
+      policyBranches.digests[i + 1] = expectedBranches.digests[i];
+    }
+    if (compute_policy_or_digest(&policyBranches, &authPolicy))
+    {
+      kmyth_log(LOG_ERR, "error computing policy OR digest ... exiting");
+      return 1;
+    }
+  }
+
+  *policy_string = kmyth_malloc((2 * (size_t) authPolicy.size) + 1);
+  if (*policy_string == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate policy string ... exiting");
+    return 1;
+  }
+  convert_digest_to_string(&authPolicy, *policy_string);
+
+  return 0;
+}
+
+//############################################################################
+// get_sk_auth_only_policy()
+//############################################################################
+/**
+ * @brief Computes the policy of storage keys (SKs) that only require their
+ *        authorization value (PolicyAuthValue alone): those of data sealed
+ *        to an authorizing key, and those created by policy-only reseals
+ *        (see set_sk_reuse()). As it does not depend on the PCR policy, use
+ *        of such an SK is authorized without it.
+ *
+ * @param[out] skAuthPolicy      Digest of the SK policy
+ *
+ * @return 0 on success, 1 on error
+ */
+static int get_sk_auth_only_policy(TPM2B_DIGEST * skAuthPolicy)
+{
+  TPML_PCR_SELECTION noPcrs = {.count = 0, };
+  TPM2B_DIGEST noPcrDigest = {.size = 0, };
+
+  return compute_policy_digest(noPcrs, noPcrDigest, skAuthPolicy);
+}
+
+//############################################################################
+// sk_is_auth_only()
+//############################################################################
+/**
+ * @brief Checks whether a storage key only requires its authorization value
+ *        (see get_sk_auth_only_policy()).
+ *
+ * @param[in]  sk_pub            Public area of the SK
+ *
+ * @return true if it does, false if its policy includes a PCR policy (or
+ *         can not be checked)
+ */
+static bool sk_is_auth_only(const TPM2B_PUBLIC * sk_pub)
+{
+  TPM2B_DIGEST authOnly = {.size = 0, };
+  const TPM2B_DIGEST *policy = &(sk_pub->publicArea.authPolicy);
+
+  if (get_sk_auth_only_policy(&authOnly))
+  {
+    return false;
+  }
+
+  return (policy->size == authOnly.size &&
+          memcmp(policy->buffer, authOnly.buffer, authOnly.size) == 0);
+}
+
+//############################################################################
+// get_authorize_seal_policy()
+//############################################################################
+/**
+ * @brief Computes the authorization policies of new Kmyth objects sealed to
+ *        an authorizing key (see set_authorizing_key()). The wrapping key
+ *        gets a PolicyAuthorize policy naming the key, so it can be unsealed
+ *        under any PCR policy the key has signed. The SK is only bound to the
+ *        authVal (PolicyAuthValue alone), as sealing must not need a signed
+ *        policy and the PCR policy is checked when the wrapping key is
+ *        unsealed.
+ *
+ * @param[in]  authorizingKey    Public area of the authorizing key
+ *
+ * @param[in]  expectedBranches  Expected policies (must be empty, as signed
+ *                               policies replace policy-OR branches)
+ *
+ * @param[out] skAuthPolicy      Digest to use as the SK's authPolicy
+ *
+ * @param[out] authPolicy        Digest to use as the wrapping key's
+ *                               authPolicy
+ *
+ * @return 0 on success, 1 on error
+ */
+static int get_authorize_seal_policy(const TPM2B_PUBLIC * authorizingKey,
+                                     TPML_DIGEST * expectedBranches,
+                                     TPM2B_DIGEST * skAuthPolicy,
+                                     TPM2B_DIGEST * authPolicy)
+{
+  if (expectedBranches->count > 0)
+  {
+    kmyth_log(LOG_ERR, "expected policies can not be combined with an "
+              "authorizing key ... exiting");
+    return 1;
+  }
+
+  TPM2B_NAME keyName = {.size = 0, };
+
+  if (get_sk_auth_only_policy(skAuthPolicy) ||
+      compute_kmyth_object_name((TPM2B_PUBLIC *) authorizingKey, &keyName) ||
+      compute_policy_authorize_digest(&keyName, authPolicy))
+  {
+    kmyth_log(LOG_ERR, "error computing PolicyAuthorize digest ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// seal_common_impl()
+//############################################################################
+/**
+ * @brief Shared implementation of tpm2_kmyth_seal_ctx() and
+ *        tpm2_kmyth_seal_batch_ctx(). The SRK lookup, storage key (SK)
+ *        creation, policy digest calculation, and SK policy session are
+ *        done once and then shared by every input, so sealing N inputs
+ *        costs a single (slow) SK TPM2_Create rather than N of them.
+ *
+ * @param[in]  count        Number of inputs (and outputs)
+ *
+ * @param[in]  inputs       Array of count plaintext buffers
+ *
+ * @param[in]  input_lens   Array of count plaintext buffer sizes
+ *
+ * @param[out] outputs      Array of count .ski byte buffers (allocated here)
+ *
+ * @param[out] output_lens  Array of count .ski byte buffer sizes
+ *
+ * @param[in]  wrap_keys    Optional (NULL for a normal seal) array of count
+ *                          existing wrapping keys. When given, inputs hold
+ *                          data already encrypted under these keys with the
+ *                          selected cipher, and only the keys are re-sealed
+ *                          (the inputs are not copied or re-encrypted).
+ *
+ * @param[in]  wrap_key_lens Array of count wrapping key sizes (ignored if
+ *                          wrap_keys is NULL)
+ *
+ * @param[in]  compression  Compression recorded in the outputs. Inputs are
+ *                          compressed with it before they are encrypted,
+ *                          unless wrap_keys is given (the inputs are then
+ *                          already compressed, if at all).
+ *
+ * @param[in]  reuse_sk     Optional (NULL unless policy-only reseals are
+ *                          enabled, see set_sk_reuse()) parsed .ski being
+ *                          resealed. Its storage key is kept if it only
+ *                          requires its authorization value; otherwise, a
+ *                          new SK with such a policy is created.
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error (no outputs are returned on error)
+ */
+static int seal_common_impl(kmyth_ctx_t * ctx,
+                            size_t count,
+                            uint8_t ** inputs,
+                            size_t *input_lens,
+                            uint8_t ** outputs,
+                            size_t *output_lens,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes,
+                            size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                            char *cipher_string, char *expected_policy,
+                            uint8_t bool_trial_only,
+                            uint8_t ** wrap_keys, size_t *wrap_key_lens,
+                            kmyth_compression compression, Ski * reuse_sk)
+{
+  if(oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+
+  Ski ski = get_default_ski();
+
+  //obtain cipher function
+  if (cipher_string == NULL)
+  {
+    cipher_string = KMYTH_DEFAULT_CIPHER;
+  }
+  ski.cipher = kmyth_get_cipher_t_from_string(cipher_string);
+
+  if (ski.cipher.cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "cipher: %s", ski.cipher.cipher_name);
+  ski.cipher.ctx = ctx->cipher_ctx;
+  ski.compression = compression;
+
+  // Create owner (storage) hierarchy authorization structure
+  TPM2B_AUTH ownerAuth;
+
+  ownerAuth.size = (uint16_t)oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+  if (ownerAuth.size > 0)
+  {
+    kmyth_log(LOG_DEBUG, "TPM storage hierarchy auth string provided");
+  }
+  else if (ownerAuth.size == 0)
+  {
+    kmyth_log(LOG_DEBUG,
+              "using default (empty) auth string for TPM storage hierarchy");
+  }
+  else
+  {
+    // should never reach this code - ownerAuth.size should be:
+    //   - zero that it was initialized to
+    //   - strlen(owner_auth_password) value that is greater than zero
+    // included this case for completenes
+    kmyth_log(LOG_DEBUG,
+              "bad size: auth string for TPM storage hierarchy ... exiting");
+    return 1;
+  }
+
+  // Create authorization value for new, non-primary Kmyth objects (objectAuth)
+  //   - all-zero digest (like TPM 1.2 well-known secret) by default
+  //   - hash of input authorization string if one is specified
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // Create a "PCR Selection" struct and populate it in accordance with
+  // the PCR values specified in user input "PCR Selection" string, if any
+  // (if the "PCR Selection" string is NULL, the "PCR Selection" struct created
+  // will specify that no PCRs were selected by the user - all-zero mask)
+  // This PCR Selection struct will be used in the authorization policy for
+  // new, non-primary Kmyth objects.
+  if (init_pcr_selection(sapi_ctx, pcrs, pcrs_len, &ski.pcr_list))
+  {
+    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
+
+    // clear potential 'auth' data, free TPM resources before exiting early
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // if the user has passed in expected policies, this indicates that they
+  // wish to use the compound policy, PolicyOR, and the (comma-separated)
+  // digests they've passed in as alternative policies that can be used to
+  // satisfy the policy of the sealed data object (not needed if only the
+  // policy digest is requested)
+  TPML_DIGEST expected_branches = {.count = 0, };
+
+  if (expected_policy != NULL && bool_trial_only != 1)
+  {
+    // fills the later policy branches with the policies specified by the user
+    if (convert_string_to_digest_list(expected_policy, &expected_branches))
+    {
+      kmyth_log(LOG_ERR,
+                "failed to convert expected policies %s to digests ... "
+                "exiting", expected_policy);
+      kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+      kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+      return 1;
+    }
+  }
+
+  // For all non-primary (other than SRK), Kmyth TPM 2.0 objects that we will
+  // create, we will assign TPM 2.0 policy-based enhanced authorization
+  // critera. Therefore, we will calculate the authorization policy digest that
+  // results from applying the steps of our selected authorization policy. We
+  // can then incorporate this result into the objects we create as the
+  // authorization policy digest value that must be regenerated to authorize
+  // use of these objects. Repeated seals to the same PCR state reuse the
+  // digest cached in the Kmyth context.
+  // A trial-only request just reports the digest, so it is computed in
+  // software from the current PCR values rather than with trial sessions.
+  // Any policy-OR branches go in the .ski, as they are needed to satisfy
+  // the policy at unseal (objAuthPolicy is then the policyOR digest).
+  // Data sealed to an authorizing key instead gets a PolicyAuthorize policy
+  // (see get_authorize_seal_policy()); the trial digest is then the PCR
+  // policy the key's owner is to sign.
+  TPM2B_DIGEST basePolicy;
+  TPM2B_DIGEST objAuthPolicy;
+  TPM2B_DIGEST trialPcrDigest = {.size = 0, };
+  TPM2B_DIGEST skAuthPolicy = {.size = 0, };
+  TPML_PCR_SELECTION skPcrList = ski.pcr_list;
+  const TPM2B_PUBLIC *authorizingKey =
+    (bool_trial_only == 1) ? NULL : get_authorizing_key();
+
+  basePolicy.size = 0;
+  objAuthPolicy.size = 0;
+  if ((bool_trial_only == 1) ?
+      (get_pcr_digest(sapi_ctx, ski.pcr_list, &trialPcrDigest) ||
+       compute_policy_digest(ski.pcr_list, trialPcrDigest, &basePolicy)) :
+      (authorizingKey != NULL) ?
+      get_authorize_seal_policy(authorizingKey, &expected_branches,
+                                &skAuthPolicy, &objAuthPolicy) :
+      get_seal_policy(ctx, ski.pcr_list, &expected_branches,
+                      &basePolicy, &ski.policyBranches, &objAuthPolicy))
+  {
+    kmyth_log(LOG_ERR,
+              "error creating policy digest for new Kmyth object ... exiting");
+
+    // clear potential 'auth' data, free TPM resources before exiting early
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // optional argument allowing user to receive a hex dump of the policy digest,
+  // to be used to calculate a second policy for policyOR authorization
+  if (bool_trial_only == 1)
+  {
+    // size of string is 2x chars for the size of the TPM2B_DIGEST buffer + 4
+    // for TPM2B struct which encodes size in memory + 1 byte for null termination.
+    // prints to the console and finishes the program without sealing
+    // By using TPM2B_DIGEST size we're reserving a little bit more than needed but
+    // then the output_string can be reserved based on compile-time values.
+    size_t string_size = (2 * sizeof(TPM2B_DIGEST)) + 1;
+    char output_string[string_size];
+
+    convert_digest_to_string(&basePolicy, output_string);
+    printf("%s", output_string);
+    return 0;
+  }
+
+  // an SK that only requires its authVal is authorized without the PCR
+  // policy (and its branches) - see get_sk_auth_only_policy()
+  TPML_DIGEST skPolicyBranches = ski.policyBranches;
+
+  if (authorizingKey != NULL)
+  {
+    ski.authorizing_key = *authorizingKey;
+    skPcrList.count = 0;
+  }
+  else if (reuse_sk != NULL)
+  {
+    if (get_sk_auth_only_policy(&skAuthPolicy))
+    {
+      kmyth_log(LOG_ERR, "error computing storage key policy ... exiting");
+      kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+      kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+      return 1;
+    }
+    skPcrList.count = 0;
+    skPolicyBranches.count = 0;
+  }
+  else
+  {
+    skAuthPolicy = objAuthPolicy;
+  }
+
+  // The storage root key (SRK) is the primary key for the storage hierarchy
+  // in the TPM.  We will first check to see if it is already loaded in
+  // persistent storage. We do this by getting the loaded persistent handle
+  // values, inspecting each of their public structures, and comparing
+  // these public area parameters against those for the SRK. None of these
+  // activities require authorization. If the key is not already loaded,
+  // though, it must be re-derived using the storage hierarchy's primary
+  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
+  TPM2_HANDLE storageRootKey_handle = 0;
+
+  if (get_srk_handle(sapi_ctx, &storageRootKey_handle, &ownerAuth))
+  {
+    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+
+    // clear potential 'auth' data, free TPM resources before exiting early
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
+
+  // We create a storage key (SK) that we will use to seal a symmetric
+  // wrapping key that we will create and use to encrypt the user input data.
+  // This storage key will be sealed to the SRK (its parent is the SRK).
+  // A policy-only reseal instead keeps the SK of its input, if that SK's
+  // policy does not depend on the PCR policy, and just loads it (creating
+  // an SK is by far the slowest command of a seal).
+  TPM2_HANDLE storageKey_handle = 0;
+  bool keep_sk = (reuse_sk != NULL && sk_is_auth_only(&reuse_sk->sk_pub));
+  int sk_failed = 0;
+
+  if (keep_sk)
+  {
+    TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+
+    kmyth_log(LOG_DEBUG, "keeping storage key, only the policy changes");
+    ski.sk_pub = reuse_sk->sk_pub;
+    ski.sk_priv = reuse_sk->sk_priv;
+    sk_failed = load_kmyth_object(sapi_ctx,
+                                  (SESSION *) NULL,
+                                  storageRootKey_handle,
+                                  ownerAuth,
+                                  emptyPcrList,
+                                  &ski.sk_priv, &ski.sk_pub,
+                                  &storageKey_handle);
+  }
+  else
+  {
+    if (reuse_sk != NULL)
+    {
+      kmyth_log(LOG_INFO, "storage key is bound to the old PCR policy, "
+                "creating a new one");
+    }
+    sk_failed = create_and_load_sk(sapi_ctx,
+                                   storageRootKey_handle,
+                                   ownerAuth,
+                                   objAuthVal,
+                                   skPcrList,
+                                   skAuthPolicy,
+                                   get_sk_alg(),
+                                   &storageKey_handle,
+                                   &ski.sk_priv, &ski.sk_pub);
+  }
+  if (sk_failed)
+  {
+    kmyth_log(LOG_ERR, "failed to %s a storage key ... exiting",
+              keep_sk ? "load" : "create and load");
+
+    // clear potential 'auth' data, free TPM resources before exiting early
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // Done with owner hierarchy authorization - SRK and SK available in TPM
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  // Get the TPM 2.0 policy session that authorizes use of the SK to create
+  // each sealed wrapping key object. The context's session is continued
+  // across the whole batch (and later calls); its policy is re-applied for
+  // every create because the TPM resets a policy session's digest after
+  // each use.
+  SESSION *sealData_session = kmyth_ctx_get_session(ctx);
+
+  if (sealData_session == NULL)
+  {
+    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    kmyth_flush_handle(sapi_ctx, storageKey_handle);
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < count && retval == 0; i++)
+  {
+    // every item shares the SK and policy, but gets its own wrapping key
+    Ski item = ski;
+
+    item.enc_data = NULL;
+    item.enc_data_size = 0;
+    retval = 1;
+
+    // validate non-empty input buffer specified
+    if (input_lens[i] == 0 || inputs[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "no input data (item %zu) ... exiting", i);
+      break;
+    }
+
+    size_t wrapKey_size = get_key_len_from_cipher(item.cipher) / 8;
+    unsigned char *wrapKey = NULL;
+
+    if (wrap_keys != NULL)
+    {
+      // Re-wrap: the input is already encrypted under an existing wrapping
+      // key, so the .ski borrows it as is and only the key is re-sealed.
+      if (wrap_keys[i] == NULL || wrap_key_lens[i] != wrapKey_size)
+      {
+        kmyth_log(LOG_ERR, "invalid wrapping key (item %zu) ... exiting", i);
+        break;
+      }
+      wrapKey = wrap_keys[i];
+      item.enc_data = inputs[i];
+      item.enc_data_size = input_lens[i];
+      item.enc_data_borrowed = true;
+    }
+    else
+    {
+      // Wrap input data -
+      //   - The data to be encrypted is contained in a file and the path to
+      //     that file is specified by the user.
+      //   - The encryption uses the symmetric 'cipher' specified by the user.
+      //   - The symmetric wrapping key used for encryption comes from the
+      //     context's secure (locked) arena when possible, and is wiped
+      //     and handed back once it is sealed
+      kmyth_log(LOG_DEBUG, "wrapping input data (item %zu)", i);
+      wrapKey = kmyth_arena_alloc(&ctx->arena, wrapKey_size);
+      if (wrapKey == NULL)
+      {
+        wrapKey = kmyth_calloc(wrapKey_size, sizeof(unsigned char));
+      }
+      if (wrapKey == NULL)
+      {
+        kmyth_log(LOG_ERR,
+                  "unable to allocate memory for the wrapping key ... exiting");
+        break;
+      }
+
+      // compressed data is what gets encrypted, as ciphertext does not
+      // compress
+      uint8_t *plaintext = inputs[i];
+      size_t plaintext_len = input_lens[i];
+
+      if (item.compression != KMYTH_COMPRESSION_NONE &&
+          kmyth_compress_data(item.compression, inputs[i], input_lens[i],
+                              &plaintext, &plaintext_len))
+      {
+        kmyth_log(LOG_ERR, "unable to compress data (item %zu) ... exiting",
+                  i);
+        kmyth_arena_release(&ctx->arena, wrapKey, wrapKey_size);
+        break;
+      }
+
+      // encrypt (wrap) input data read in (e.g., client certificate key .pem)
+      // under a fresh random key, or under the context's wrapping key if
+      // one is set (see kmyth_ctx_set_wrapping_key())
+      int wrap_failed = 0;
+
+      if (ctx->wrap_key != NULL)
+      {
+        if (ctx->wrap_key_len != wrapKey_size)
+        {
+          kmyth_log(LOG_ERR, "wrapping key does not fit cipher %s ... exiting",
+                    item.cipher.cipher_name);
+          wrap_failed = 1;
+        }
+        else
+        {
+          memcpy(wrapKey, ctx->wrap_key, wrapKey_size);
+          wrap_failed = kmyth_encrypt_data_with_key(plaintext, plaintext_len,
+                                                    item.cipher, wrapKey,
+                                                    wrapKey_size,
+                                                    &item.enc_data,
+                                                    &item.enc_data_size);
+        }
+      }
+      else
+      {
+        wrap_failed = kmyth_encrypt_data(plaintext, plaintext_len,
+                                         item.cipher, &item.enc_data,
+                                         &item.enc_data_size, &wrapKey,
+                                         &wrapKey_size);
+      }
+      if (plaintext != inputs[i])
+      {
+        kmyth_clear_and_free(plaintext, plaintext_len);
+      }
+      if (wrap_failed)
+      {
+        kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
+        kmyth_arena_release(&ctx->arena, wrapKey, wrapKey_size);
+        free_ski(&item);
+        break;
+      }
+
+      kmyth_log(LOG_DEBUG, "input data wrapped");
+    }
+
+    // Seal the wrapping key to the TPM using the Storage Key (SK)
+    int seal_failed = tpm2_kmyth_seal_data_session(sapi_ctx,
+                                                   sealData_session,
+                                                   wrapKey,
+                                                   wrapKey_size,
+                                                   storageKey_handle,
+                                                   objAuthVal,
+                                                   skPcrList,
+                                                   skPolicyBranches,
+                                                   objAuthVal,
+                                                   item.pcr_list,
+                                                   objAuthPolicy,
+                                                   item.policyBranches,
+                                                   &item.wk_pub,
+                                                   &item.wk_priv);
+
+    // done with unencrypted wrapping key (now have sealed version), unless
+    // it belongs to the caller
+    if (wrap_keys == NULL)
+    {
+      kmyth_arena_release(&ctx->arena, wrapKey, wrapKey_size);
+    }
+
+    if (seal_failed)
+    {
+      // the session's policy state is unknown after a failed command
+      kmyth_log(LOG_ERR, "unable to seal data ... exiting");
+      kmyth_ctx_drop_session(ctx);
+    }
+    else
+    {
+      kmyth_alloc_phase phase =
+        kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_OUTPUT);
+
+      if (create_ski_bytes(item, &outputs[i], &output_lens[i]))
+      {
+        kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
+      }
+      else
+      {
+        retval = 0;
+      }
+      kmyth_alloc_set_phase(phase);
+    }
+
+    free_ski(&item);
+  }
+
+  // Clean-up:
+  //   - done with authVal
+  //   - done with the storage key, so flush it (the TPM connection stays
+  //     open, so it would otherwise remain loaded); the policy session is
+  //     kept by the context for the next call
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  if (kmyth_flush_handle(sapi_ctx, storageKey_handle))
+  {
+    kmyth_log(LOG_ERR, "error flushing storage key ... exiting");
+    retval = 1;
+  }
+
+  // all or nothing - do not hand back a partial batch
+  if (retval)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      kmyth_free(outputs[i]);
+      outputs[i] = NULL;
+      output_lens[i] = 0;
+    }
+  }
+
+  return retval;
+}
+
+//############################################################################
+// seal_common()
+//############################################################################
+static int seal_common(kmyth_ctx_t * ctx,
+                       size_t count,
+                       uint8_t ** inputs,
+                       size_t *input_lens,
+                       uint8_t ** outputs,
+                       size_t *output_lens,
+                       uint8_t * auth_bytes,
+                       size_t auth_bytes_len,
+                       uint8_t * owner_auth_bytes,
+                       size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                       char *cipher_string, char *expected_policy,
+                       uint8_t bool_trial_only,
+                       uint8_t ** wrap_keys, size_t *wrap_key_lens,
+                       kmyth_compression compression, Ski * reuse_sk)
+{
+  uint64_t start_us = kmyth_metrics_now_us();
+  int retval = seal_common_impl(ctx, count, inputs, input_lens,
+                                outputs, output_lens,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                pcrs, pcrs_len, cipher_string,
+                                expected_policy, bool_trial_only,
+                                wrap_keys, wrap_key_lens, compression,
+                                reuse_sk);
+
+  // a trial run computes the policy digest but seals nothing
+  if (retval)
+  {
+    kmyth_metrics_inc(KMYTH_METRIC_SEAL_ERRORS);
+  }
+  else if (!bool_trial_only)
+  {
+    kmyth_metrics_add(KMYTH_METRIC_SEALS, count);
+    kmyth_metrics_observe_since(KMYTH_METRIC_SEAL_TIME, start_us);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_ctx()
+//############################################################################
+int tpm2_kmyth_seal_ctx(kmyth_ctx_t * ctx,
+                        uint8_t * input,
+                        size_t input_len,
+                        uint8_t ** output,
+                        size_t *output_len,
+                        uint8_t * auth_bytes,
+                        size_t auth_bytes_len,
+                        uint8_t * owner_auth_bytes,
+                        size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                        char *cipher_string, char *expected_policy,
+                        uint8_t bool_trial_only)
+{
+  return seal_common(ctx, 1, &input, &input_len, output, output_len,
+                     auth_bytes, auth_bytes_len,
+                     owner_auth_bytes, oa_bytes_len,
+                     pcrs, pcrs_len, cipher_string, expected_policy,
+                     bool_trial_only, NULL, NULL, get_compression(), NULL);
+}
+
+//############################################################################
+// tpm2_kmyth_seal_batch_ctx()
+//############################################################################
+int tpm2_kmyth_seal_batch_ctx(kmyth_ctx_t * ctx,
+                              size_t count,
+                              uint8_t ** inputs,
+                              size_t *input_lens,
+                              uint8_t ** outputs,
+                              size_t *output_lens,
+                              uint8_t * auth_bytes,
+                              size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes,
+                              size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                              char *cipher_string, char *expected_policy)
+{
+  if (count == 0 || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid batch seal input/output arrays ... exiting");
+    return 1;
+  }
+
+  return seal_common(ctx, count, inputs, input_lens, outputs, output_lens,
+                     auth_bytes, auth_bytes_len,
+                     owner_auth_bytes, oa_bytes_len,
+                     pcrs, pcrs_len, cipher_string, expected_policy, 0,
+                     NULL, NULL, get_compression(), NULL);
+}
+
+//############################################################################
+// load_cached_storage_key()
+//############################################################################
+/**
+ * @brief Loads the storage key (SK) described by a parsed .ski under the
+ *        SRK and, if it has a valid name, hands it to the context's SK cache.
+ *
+ * @param[in]  ctx        Kmyth context, must be initialized
+ *
+ * @param[in]  ski        Parsed .ski holding the SK public/private blobs
+ *
+ * @param[in]  ownerAuth  Owner (storage) hierarchy authorization
+ *
+ * @param[in]  sk_name    Name of the SK (zero size if it is not cacheable)
+ *
+ * @param[out] sk_handle  Transient handle of the loaded SK
+ *
+ * @return 0 on success, 1 on error
+ */
+static int load_cached_storage_key(kmyth_ctx_t * ctx,
+                                   Ski * ski,
+                                   TPM2B_AUTH ownerAuth,
+                                   TPM2B_NAME * sk_name,
+                                   TPM2_HANDLE * sk_handle)
+{
+  // The storage root key (SRK) is the primary key for the storage hierarchy
+  // in the TPM.  We will first check to see if it is already loaded in
+  // persistent storage. We do this by getting the loaded persistent handle
+  // values, inspecting each of their their public structures, and comparing
+  // these public area parameters against those for the SRK. None of these
+  // activities require authorization. If the key is not already loaded,
+  // though, it must be re-derived using the storage hierarchy's primary
+  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
+  TPM2_HANDLE storageRootKey_handle = 0;
+
+  if (get_srk_handle(ctx->sapi_ctx, &storageRootKey_handle, &ownerAuth))
+  {
+    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
+
+  TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+  if (load_kmyth_object(ctx->sapi_ctx,
+                        (SESSION *) NULL,
+                        storageRootKey_handle,
+                        ownerAuth,
+                        emptyPcrList,
+                        &ski->sk_priv, &ski->sk_pub, sk_handle))
+  {
+    kmyth_log(LOG_ERR, "error loading storage key ... exiting");
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "loaded %s SK at handle = 0x%08X",
+            (ski->sk_pub.publicArea.type == TPM2_ALG_ECC) ? "ECC" : "RSA",
+            *sk_handle);
+
+  // failing to cache is not fatal - the caller then flushes the SK itself
+  if (sk_name->size > 0 && kmyth_sk_cache_insert(ctx, sk_name, *sk_handle))
+  {
+    kmyth_log(LOG_DEBUG, "unable to cache SK (handle = 0x%08X)", *sk_handle);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Resources held by a .ski unseal between unseal_ski_start() and
+ *        unseal_ski_finish(), while its TPM2_Unseal command is pending.
+ */
+typedef struct
+{
+  // session started for this unseal only (used if the caller supplied none)
+  SESSION own_session;
+  bool have_own_session;
+
+  // session authorizing the pending unseal
+  SESSION *session;
+
+  // storage key to flush when done (zero if it is owned by the SK cache)
+  TPM2_HANDLE sk_flush_handle;
+
+  // loaded sealed data object (wrapping key) being unsealed
+  TPM2_HANDLE sdo_handle;
+
+  // state of the submitted TPM2_Unseal command
+  ASYNC_UNSEAL unseal;
+} ski_unseal_state;
+
+//############################################################################
+// authorize_ski_policy()
+//############################################################################
+/**
+ * @brief Obtains the signed approval of the PCR policy the current PCR
+ *        values satisfy, for a .ski sealed to an authorizing key: finds the
+ *        matching signed policy (see kmyth_find_signed_policy()) and has the
+ *        TPM check its signature.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int authorize_ski_policy(TSS2_SYS_CONTEXT * sapi_ctx, Ski * ski,
+                                POLICY_AUTHORIZATION * authorization)
+{
+  TPM2B_DIGEST pcrDigest = {.size = 0, };
+  TPM2B_DIGEST currentPolicy = {.size = 0, };
+  TPM2B_NAME keyName = {.size = 0, };
+  TPMT_SIGNATURE signature;
+
+  if (get_pcr_digest(sapi_ctx, ski->pcr_list, &pcrDigest) ||
+      compute_policy_digest(ski->pcr_list, pcrDigest, &currentPolicy) ||
+      compute_kmyth_object_name(&ski->authorizing_key, &keyName))
+  {
+    kmyth_log(LOG_ERR, "error computing current PCR policy ... exiting");
+    return 1;
+  }
+
+  if (kmyth_find_signed_policy(&currentPolicy, &keyName, &signature) ||
+      verify_policy_signature(sapi_ctx, &ski->authorizing_key,
+                              &currentPolicy, &signature, authorization))
+  {
+    kmyth_log(LOG_ERR, "unable to authorize current PCR policy ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// start_wrapping_key_unseal()
+//############################################################################
+/**
+ * @brief Loads the wrapping key of a parsed .ski under an already loaded
+ *        storage key (SK) and submits its unseal, either with a
+ *        caller-provided policy session or, if none is given, with a session
+ *        started just for this unseal (flushed by unseal_ski_finish()).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int start_wrapping_key_unseal(TSS2_SYS_CONTEXT * sapi_ctx,
+                                     SESSION * session,
+                                     TPM2_HANDLE sk_handle,
+                                     Ski * ski,
+                                     TPM2B_AUTH objAuthValue,
+                                     ski_unseal_state * state)
+{
+  // Authorization for the use of all non-primary (other than SRK), Kmyth
+  // TPM 2.0 objects utilizes policy-based enhanced authorization critera.
+  // An empty authorization policy digest is passed here as the policy
+  // session itself is (re)built from the .ski PCR selection and branches.
+  TPM2B_DIGEST objAuthPolicy;
+
+  objAuthPolicy.size = 0;
+
+  // data sealed to signed policies needs a checked approval of the PCR
+  // policy it is unsealed under
+  POLICY_AUTHORIZATION authorization;
+  bool authorized = (ski->authorizing_key.size > 0);
+
+  if (authorized && authorize_ski_policy(sapi_ctx, ski, &authorization))
+  {
+    return 1;
+  }
+
+  state->have_own_session = false;
+  state->session = session;
+  if (session == NULL)
+  {
+    if (create_auth_session(sapi_ctx, &state->own_session, TPM2_SE_POLICY))
+    {
+      kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+      return 1;
+    }
+    state->have_own_session = true;
+    state->session = &state->own_session;
+  }
+
+  if (tpm2_kmyth_unseal_data_start(sapi_ctx,
+                                   state->session,
+                                   sk_handle,
+                                   ski->wk_pub,
+                                   ski->wk_priv,
+                                   objAuthValue,
+                                   ski->pcr_list, objAuthPolicy,
+                                   ski->policyBranches,
+                                   authorized ? &authorization : NULL,
+                                   sk_is_auth_only(&ski->sk_pub),
+                                   &state->sdo_handle, &state->unseal))
+  {
+    if (state->have_own_session)
+    {
+      kmyth_flush_handle(sapi_ctx, state->own_session.sessionHandle);
+      state->have_own_session = false;
+    }
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unseal_ski_start()
+//############################################################################
+/**
+ * @brief Starts unsealing the wrapping key held by a parsed .ski, reusing
+ *        the context's cached storage key (SK) if it has one for this .ski.
+ *        On success the TPM2_Unseal command is left pending and
+ *        unseal_ski_finish() must be called before any other TPM command.
+ *
+ * @param[in]  ctx             Kmyth context, must be initialized
+ *
+ * @param[in]  session         Policy session to authorize the unseal with,
+ *                             or NULL to start (and flush) a new one
+ *
+ * @param[in]  ski             Parsed .ski to be unsealed
+ *
+ * @param[in]  ownerAuth       Owner (storage) hierarchy authorization
+ *
+ * @param[in]  objAuthValue    Authorization value for the Kmyth objects
+ *
+ * @param[out] state           Resources held by the pending unseal
+ *
+ * @param[out] session_failed  Set if a command authorized by the supplied
+ *                             session failed, leaving its policy state
+ *                             unknown (the caller should replace it)
+ *
+ * @return 0 on success, 1 on error
+ */
+static int unseal_ski_start(kmyth_ctx_t * ctx,
+                            SESSION * session,
+                            Ski * ski,
+                            TPM2B_AUTH ownerAuth,
+                            TPM2B_AUTH objAuthValue,
+                            ski_unseal_state * state, bool *session_failed)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+
+  memset(state, 0, sizeof(ski_unseal_state));
+
+  // The Storage Key (SK) will be used by the TPM to unseal the wrapping key.
+  // Loading it requires the SRK (and possibly owner hierarchy authorization),
+  // so an SK that this context has already loaded is reused when its name
+  // (a digest of the .ski sk_pub) matches. The name will not be computable
+  // for an SK with an unexpected name algorithm - that SK is simply loaded
+  // and flushed per call, as before.
+  TPM2B_NAME sk_name = {.size = 0, };
+
+  if (compute_kmyth_object_name(&ski->sk_pub, &sk_name))
+  {
+    kmyth_log(LOG_DEBUG, "SK name unavailable, SK will not be cached");
+    sk_name.size = 0;
+  }
+
+  TPM2_HANDLE storageKey_handle = kmyth_sk_cache_lookup(ctx, &sk_name);
+  bool sk_from_cache = (storageKey_handle != 0);
+
+  if (!sk_from_cache && load_cached_storage_key(ctx, ski, ownerAuth,
+                                                &sk_name, &storageKey_handle))
+  {
+    kmyth_log(LOG_ERR, "error loading storage key ... exiting");
+    return 1;
+  }
+  bool sk_cached = (kmyth_sk_cache_lookup(ctx, &sk_name) != 0);
+
+  int unseal_rc = start_wrapping_key_unseal(sapi_ctx, session,
+                                            storageKey_handle, ski,
+                                            objAuthValue, state);
+
+  if (unseal_rc && session != NULL)
+  {
+    *session_failed = true;
+  }
+
+  // A cached SK handle can go stale (e.g., if it was evicted by another
+  // client of the resource manager), which shows up as a failure to load
+  // the wrapping key under it. Drop it, reload the SK, and retry once
+  // (with a fresh session, as the state of a failed one is unknown).
+  if (unseal_rc && sk_from_cache)
+  {
+    kmyth_log(LOG_DEBUG, "unseal with cached SK failed, reloading SK");
+    kmyth_sk_cache_remove(ctx, &sk_name);
+    storageKey_handle = 0;
+    if (load_cached_storage_key(ctx, ski, ownerAuth,
+                                &sk_name, &storageKey_handle))
+    {
+      kmyth_log(LOG_ERR, "error reloading storage key ... exiting");
+      return 1;
+    }
+    sk_cached = (kmyth_sk_cache_lookup(ctx, &sk_name) != 0);
+    unseal_rc = start_wrapping_key_unseal(sapi_ctx, NULL, storageKey_handle,
+                                          ski, objAuthValue, state);
+  }
+
+  // a cached SK stays loaded (owned by the context); any other SK is ours
+  state->sk_flush_handle = sk_cached ? 0 : storageKey_handle;
+
+  if (unseal_rc)
+  {
+    kmyth_log(LOG_ERR, "error unsealing data ... exiting");
+    kmyth_flush_handle(sapi_ctx, state->sk_flush_handle);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unseal_ski_finish()
+//############################################################################
+/**
+ * @brief Completes an unseal started by unseal_ski_start(), returning the
+ *        wrapping key and releasing the TPM resources the unseal held.
+ *
+ * @param[in]  sapi_ctx        System API (SAPI) context the unseal was
+ *                             started on
+ *
+ * @param[in]  state           Resources held by the pending unseal
+ *
+ * @param[out] key             Unsealed wrapping key (allocated here)
+ *
+ * @param[out] key_len         Size of the unsealed wrapping key
+ *
+ * @param[out] session_failed  Set if the unseal authorized by the caller's
+ *                             session failed (see unseal_ski_start())
+ *
+ * @return 0 on success, 1 on error
+ */
+static int unseal_ski_finish(TSS2_SYS_CONTEXT * sapi_ctx,
+                             ski_unseal_state * state,
+                             uint8_t ** key, size_t *key_len,
+                             bool *session_failed)
+{
+  int retval = tpm2_kmyth_unseal_data_finish(sapi_ctx, state->sdo_handle,
+                                             &state->unseal, key, key_len);
+
+  if (retval && !state->have_own_session)
+  {
+    *session_failed = true;
+  }
+
+  if (state->have_own_session &&
+      kmyth_flush_handle(sapi_ctx, state->own_session.sessionHandle))
+  {
+    retval = 1;
+  }
+
+  if (kmyth_flush_handle(sapi_ctx, state->sk_flush_handle))
+  {
+    kmyth_log(LOG_ERR, "error flushing storage key ... exiting");
+    retval = 1;
+  }
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error unsealing data ... exiting");
+    kmyth_clear_and_free(*key, *key_len);
+    *key = NULL;
+    *key_len = 0;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// decrypt_ski_impl()
+//############################################################################
+/**
+ * @brief Decrypts the data held by a parsed .ski with its unsealed
+ *        wrapping key. This needs no TPM access, so it can run while the
+ *        TPM is busy with another item's unseal. The key is always cleared
+ *        and freed.
+ *
+ *        If the cipher can decrypt in place and the .ski owns its encrypted
+ *        data, that buffer is decrypted over itself and handed over as the
+ *        output (the .ski no longer holds encrypted data afterwards), so a
+ *        large payload is never held in memory twice. Borrowed encrypted
+ *        data (see parse_ski_bytes_borrowed()) is only read, never
+ *        written, and is decrypted into a new buffer. Data compressed
+ *        before it was sealed is then decompressed into a new buffer.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int decrypt_ski_impl(kmyth_ctx_t * ctx,
+                            Ski * ski,
+                            uint8_t * key, size_t key_len,
+                            uint8_t ** output, size_t *output_len)
+{
+  // decrypt with the context's reusable cipher state
+  cipher_t cipher = ski->cipher;
+
+  cipher.ctx = ctx->cipher_ctx;
+
+  int retval = 0;
+
+  if (cipher.decrypt_in_place_fn != NULL && !ski->enc_data_borrowed)
+  {
+    size_t plaintext_len = 0;
+
+    retval = kmyth_decrypt_data_in_place((unsigned char *) ski->enc_data,
+                                         ski->enc_data_size, cipher,
+                                         (unsigned char *) key, key_len,
+                                         &plaintext_len);
+    if (retval == 0)
+    {
+      *output = ski->enc_data;
+      *output_len = plaintext_len;
+      ski->enc_data = NULL;
+      ski->enc_data_size = 0;
+    }
+  }
+  else
+  {
+    retval = kmyth_decrypt_data((unsigned char *) ski->enc_data,
+                                ski->enc_data_size,
+                                cipher,
+                                (unsigned char *) key, key_len,
+                                output, output_len);
+  }
+
+  kmyth_clear_and_free(key, key_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
+    return 1;
+  }
+
+  // data compressed before it was sealed is handed out decompressed
+  if (ski->compression != KMYTH_COMPRESSION_NONE)
+  {
+    uint8_t *compressed = *output;
+    size_t compressed_len = *output_len;
+
+    retval = kmyth_decompress_data(ski->compression, compressed,
+                                   compressed_len, output, output_len);
+    kmyth_clear_and_free(compressed, compressed_len);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "error decompressing data ... exiting");
+      *output = NULL;
+      *output_len = 0;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// decrypt_ski()
+//############################################################################
+/**
+ * @brief Same as decrypt_ski_impl(), with the allocations counted in the
+ *        decrypt phase.
+ */
+static int decrypt_ski(kmyth_ctx_t * ctx,
+                       Ski * ski,
+                       uint8_t * key, size_t key_len,
+                       uint8_t ** output, size_t *output_len)
+{
+  kmyth_alloc_phase phase = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_DECRYPT);
+  int retval = decrypt_ski_impl(ctx, ski, key, key_len, output, output_len);
+
+  kmyth_alloc_set_phase(phase);
+  return retval;
+}
+
+//############################################################################
+// unseal_ski()
+//############################################################################
+/**
+ * @brief Unseals and decrypts the data held by a parsed .ski (see
+ *        unseal_ski_start() for the parameters).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int unseal_ski(kmyth_ctx_t * ctx,
+                      SESSION * session,
+                      Ski * ski,
+                      TPM2B_AUTH ownerAuth,
+                      TPM2B_AUTH objAuthValue,
+                      uint8_t ** output, size_t *output_len,
+                      bool *session_failed)
+{
+  ski_unseal_state state;
+
+  if (unseal_ski_start(ctx, session, ski, ownerAuth, objAuthValue,
+                       &state, session_failed))
+  {
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (unseal_ski_finish(ctx->sapi_ctx, &state, &key, &key_len,
+                        session_failed))
+  {
+    return 1;
+  }
+
+  return decrypt_ski(ctx, ski, key, key_len, output, output_len);
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_ctx_impl()
+//############################################################################
+static int tpm2_kmyth_unseal_ctx_impl(kmyth_ctx_t * ctx,
+                                      uint8_t * input,
+                                      size_t input_len,
+                                      uint8_t ** output,
+                                      size_t *output_len,
+                                      uint8_t * auth_bytes,
+                                      size_t auth_bytes_len,
+                                      uint8_t * owner_auth_bytes,
+                                      size_t oa_bytes_len,
+                                      uint8_t bool_policy_or)
+{
+  if(oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+  // Create owner (storage) hierarchy authorization structure
+  // to provide password session authorization criteria for use of:
+  //   - Storage Root Key (SRK)
+  //   - Storage Primary Seed (SPS), if necessary to re-derive SRK
+  TPM2B_AUTH ownerAuth;
+
+  ownerAuth.size = (uint16_t)oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  if (ownerAuth.size > 0)
+  {
+    kmyth_log(LOG_DEBUG, "auth string for TPM storage hierarchy specified");
+  }
+  // Create authorization value (authVal) to provide policy session
+  // authorization criteria for use of:
+  //   - Storage Key (SK) TPM object
+  //   - Sealed Data (wrapping key) TPM object
+  // The authVal is set to:
+  //   - all-zero digest (like TPM 1.2 well-known secret) by default
+  //   - hash of input authorization string if one is specified
+  TPM2B_AUTH objAuthValue;
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // With the optional secret cache enabled, a repeated unseal of the same
+  // .ski (with the same authorization) is answered without the TPM unseal
+  TPM2B_DIGEST cache_key = {.size = 0, };
+
+  if (ctx->secret_cache_size > 0 &&
+      kmyth_secret_cache_key(input, input_len, &objAuthValue, &ownerAuth,
+                             &cache_key) == 0 &&
+      kmyth_secret_cache_lookup(ctx, &cache_key, output, output_len))
+  {
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 0;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes_borrowed(input, input_len, &ski, bool_policy_or))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // Authorize with the context's continued policy session (falling back to
+  // a session started just for this unseal if none is available)
+  bool session_failed = false;
+  int retval = unseal_ski(ctx, kmyth_ctx_get_session(ctx), &ski, ownerAuth,
+                          objAuthValue, output, output_len, &session_failed);
+
+  if (session_failed)
+  {
+    kmyth_ctx_drop_session(ctx);
+  }
+
+  if (retval == 0 && cache_key.size > 0)
+  {
+    kmyth_alloc_phase phase = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_OUTPUT);
+
+    kmyth_secret_cache_insert(ctx, &cache_key, ski.pcr_list,
+                              *output, *output_len);
+    kmyth_alloc_set_phase(phase);
+  }
+
+  // done, so free any allocated resources that remain
+  free_ski(&ski);
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_ctx()
+//############################################################################
+int tpm2_kmyth_unseal_ctx(kmyth_ctx_t * ctx,
+                          uint8_t * input,
+                          size_t input_len,
+                          uint8_t ** output,
+                          size_t *output_len,
+                          uint8_t * auth_bytes,
+                          size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                          uint8_t bool_policy_or)
+{
+  kmyth_log_span span;
+  uint64_t start_us = kmyth_metrics_now_us();
+
+  kmyth_log_span_begin(&span, "tpm2_kmyth_unseal_ctx");
+
+  int retval = tpm2_kmyth_unseal_ctx_impl(ctx, input, input_len,
+                                          output, output_len,
+                                          auth_bytes, auth_bytes_len,
+                                          owner_auth_bytes, oa_bytes_len,
+                                          bool_policy_or);
+
+  kmyth_log_span_end(&span, retval);
+  if (retval)
+  {
+    kmyth_metrics_inc(KMYTH_METRIC_UNSEAL_ERRORS);
+  }
+  else
+  {
+    kmyth_metrics_inc(KMYTH_METRIC_UNSEALS);
+    kmyth_metrics_observe_since(KMYTH_METRIC_UNSEAL_TIME, start_us);
+  }
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_reseal_ctx()
+//############################################################################
+int tpm2_kmyth_reseal_ctx(kmyth_ctx_t * ctx,
+                          uint8_t * input,
+                          size_t input_len,
+                          uint8_t ** output,
+                          size_t *output_len,
+                          uint8_t * auth_bytes,
+                          size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes,
+                          size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                          char *cipher_string, char *expected_policy,
+                          uint8_t bool_policy_or)
+{
+  if(oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+
+  TPM2B_AUTH ownerAuth;
+
+  ownerAuth.size = (uint16_t)oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  TPM2B_AUTH objAuthValue;
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes_borrowed(input, input_len, &ski, bool_policy_or))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // Recover the wrapping key on this context's connection (the SRK handle
+  // found here is cached, so the seal below does not look it up again)
+  ski_unseal_state state;
+  bool session_failed = false;
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (unseal_ski_start(ctx, kmyth_ctx_get_session(ctx), &ski, ownerAuth,
+                       objAuthValue, &state, &session_failed) ||
+      unseal_ski_finish(ctx->sapi_ctx, &state, &key, &key_len,
+                        &session_failed))
+  {
+    kmyth_log(LOG_ERR, "unable to unseal wrapping key ... exiting");
+    if (session_failed)
+    {
+      kmyth_ctx_drop_session(ctx);
+    }
+    free_ski(&ski);
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  int retval = 0;
+
+  // resolve "auto" first, so that it also keeps a payload already
+  // encrypted with the cipher it stands for
+  if (cipher_string != NULL && strcmp(cipher_string, KMYTH_AUTO_CIPHER) == 0)
+  {
+    cipher_string = (char *) kmyth_select_auto_cipher();
+  }
+
+  // a policy-only reseal keeps the storage key where it can (see
+  // set_sk_reuse())
+  Ski *reuse_sk = get_sk_reuse() ? &ski : NULL;
+
+  if (cipher_string == NULL ||
+      strcmp(cipher_string, ski.cipher.cipher_name) == 0)
+  {
+    // Same data key and cipher: re-seal only the wrapping key under a new
+    // storage key and policy, carrying the encrypted payload over as is
+    kmyth_log(LOG_DEBUG, "re-wrapping key, encrypted data unchanged");
+    retval = seal_common(ctx, 1, &ski.enc_data, &ski.enc_data_size,
+                         output, output_len, auth_bytes, auth_bytes_len,
+                         owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                         ski.cipher.cipher_name, expected_policy, 0,
+                         &key, &key_len, ski.compression, reuse_sk);
+    kmyth_clear_and_free(key, key_len);
+  }
+  else
+  {
+    // A new cipher needs the data re-encrypted under a new wrapping key
+    uint8_t *data = NULL;
+    size_t data_len = 0;
+
+    kmyth_log(LOG_DEBUG, "cipher changed, re-encrypting data");
+    if (decrypt_ski(ctx, &ski, key, key_len, &data, &data_len))
+    {
+      free_ski(&ski);
+      return 1;
+    }
+    retval = seal_common(ctx, 1, &data, &data_len, output, output_len,
+                         auth_bytes, auth_bytes_len,
+                         owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                         cipher_string, expected_policy, 0, NULL, NULL,
+                         ski.compression, reuse_sk);
+    kmyth_clear_and_free(data, data_len);
+  }
+
+  free_ski(&ski);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to re-seal data ... exiting");
+  }
+
+  return retval;
+}
+
+//############################################################################
+// ski_same_policy()
+//############################################################################
+/**
+ * @brief Checks whether two parsed .ski inputs are unsealed under the same
+ *        authorization policy (PCR selection, policy-OR branches and
+ *        authorizing key), and can therefore share a single policy session.
+ *
+ * @return true if the policies match, false otherwise
+ */
+static bool ski_same_policy(Ski * a, Ski * b)
+{
+  if (!pcr_selection_equal(&a->pcr_list, &b->pcr_list))
+  {
+    return false;
+  }
+
+  // both are sealed to the same authorizing key, or neither is
+  uint8_t a_key[sizeof(TPM2B_PUBLIC)];
+  size_t a_key_size = 0;
+  uint8_t b_key[sizeof(TPM2B_PUBLIC)];
+  size_t b_key_size = 0;
+
+  if (a->authorizing_key.size != b->authorizing_key.size ||
+      (a->authorizing_key.size > 0 &&
+       (Tss2_MU_TPM2B_PUBLIC_Marshal(&a->authorizing_key, a_key,
+                                     sizeof(a_key), &a_key_size) ||
+        Tss2_MU_TPM2B_PUBLIC_Marshal(&b->authorizing_key, b_key,
+                                     sizeof(b_key), &b_key_size) ||
+        a_key_size != b_key_size || memcmp(a_key, b_key, a_key_size) != 0)))
+  {
+    return false;
+  }
+
+  return digest_list_equal(&a->policyBranches, &b->policyBranches);
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_batch()
+//############################################################################
+int tpm2_kmyth_unseal_batch(size_t count,
+                            uint8_t ** inputs,
+                            size_t *input_lens,
+                            uint8_t ** outputs,
+                            size_t *output_lens,
+                            int *results,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            uint8_t bool_policy_or)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
   {
-    kmyth_log(LOG_DEBUG, "auth string for TPM storage hierarchy specified");
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
+    for (size_t i = 0; results != NULL && i < count; i++)
+    {
+      results[i] = 1;
+    }
+    return 1;
   }
-  // Create authorization value (authVal) to provide policy session
-  // authorization criteria for use of:
-  //   - Storage Key (SK) TPM object
-  //   - Sealed Data (wrapping key) TPM object
-  // The authVal is set to:
-  //   - all-zero digest (like TPM 1.2 well-known secret) by default
-  //   - hash of input authorization string if one is specified
+
+  int retval = tpm2_kmyth_unseal_batch_ctx(ctx, count, inputs, input_lens,
+                                           outputs, output_lens, results,
+                                           auth_bytes, auth_bytes_len,
+                                           owner_auth_bytes, oa_bytes_len,
+                                           bool_policy_or);
+
+  kmyth_ctx_destroy(&ctx);
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_batch_ctx()
+//############################################################################
+int tpm2_kmyth_unseal_batch_ctx(kmyth_ctx_t * ctx,
+                                size_t count,
+                                uint8_t ** inputs,
+                                size_t *input_lens,
+                                uint8_t ** outputs,
+                                size_t *output_lens,
+                                int *results,
+                                uint8_t * auth_bytes,
+                                size_t auth_bytes_len,
+                                uint8_t * owner_auth_bytes,
+                                size_t oa_bytes_len, uint8_t bool_policy_or)
+{
+  if (count == 0 || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL || results == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid batch unseal input/output arrays ... exiting");
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    results[i] = 1;
+  }
+
+  if (oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+
+  // owner (storage) hierarchy and object authorization are common to the
+  // whole batch (see tpm2_kmyth_unseal_ctx())
+  TPM2B_AUTH ownerAuth;
+
+  ownerAuth.size = (uint16_t) oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
   TPM2B_AUTH objAuthValue;
 
   if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
@@ -418,194 +2247,702 @@ int tpm2_kmyth_unseal(uint8_t * input,
     kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
     kmyth_clear(objAuthValue.buffer, objAuthValue.size);
     kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
     return 1;
   }
 
-  // The storage root key (SRK) is the primary key for the storage hierarchy
-  // in the TPM.  We will first check to see if it is already loaded in
-  // persistent storage. We do this by getting the loaded persistent handle
-  // values, inspecting each of their their public structures, and comparing
-  // these public area parameters against those for the SRK. None of these
-  // activities require authorization. If the key is not already loaded,
-  // though, it must be re-derived using the storage hierarchy's primary
-  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
-  TPM2_HANDLE storageRootKey_handle = 0;
+  Ski *skis = kmyth_calloc(count, sizeof(Ski));
+  bool *done = kmyth_calloc(count, sizeof(bool));
 
-  if (get_srk_handle(sapi_ctx, &storageRootKey_handle, &ownerAuth))
+  if (skis == NULL || done == NULL)
   {
-    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "unable to allocate batch state ... exiting");
+    kmyth_free(skis);
+    kmyth_free(done);
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
 
-  Ski ski = get_default_ski();
+  // parse everything up front - a malformed .ski only fails its own item
+  for (size_t i = 0; i < count; i++)
+  {
+    skis[i] = get_default_ski();
+    if (parse_ski_bytes_borrowed(inputs[i], input_lens[i], &skis[i],
+                                 bool_policy_or))
+    {
+      kmyth_log(LOG_ERR, "error parsing ski (batch item %zu)", i);
+      done[i] = true;
+    }
+  }
 
-  if (parse_ski_bytes(input, input_len, &ski, bool_policy_or))
+  // Unseal the items one policy group at a time. All items share the
+  // context's continued policy session (saving a start/flush per item), and
+  // items sealed under the same storage key share the loaded SK through the
+  // context's SK cache. Each item's TPM2_Unseal is submitted asynchronously
+  // so that decrypting the previous item overlaps the TPM's work on it.
+  for (size_t lead = 0; lead < count; lead++)
   {
-    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
+    if (done[lead])
+    {
+      continue;
+    }
+
+    SESSION *session = NULL;
+
+    // wrapping key of the last unsealed item, not yet used for decryption
+    size_t prev = lead;
+    uint8_t *prev_key = NULL;
+    size_t prev_key_len = 0;
+
+    for (size_t i = lead; i < count; i++)
+    {
+      if (done[i] || !ski_same_policy(&skis[lead], &skis[i]))
+      {
+        continue;
+      }
+      done[i] = true;
+
+      if (session == NULL)
+      {
+        session = kmyth_ctx_get_session(ctx);
+        if (session == NULL)
+        {
+          kmyth_log(LOG_ERR, "error starting auth policy session (item %zu)",
+                    i);
+          continue;
+        }
+      }
+
+      bool session_failed = false;
+      ski_unseal_state state;
+      int unseal_rc = unseal_ski_start(ctx, session, &skis[i], ownerAuth,
+                                       objAuthValue, &state, &session_failed);
+
+      // While the TPM processes this item's unseal, decrypt the previous
+      // item with the wrapping key it already returned.
+      if (prev_key != NULL)
+      {
+        if (decrypt_ski(ctx, &skis[prev], prev_key, prev_key_len,
+                        &outputs[prev], &output_lens[prev]) == 0)
+        {
+          results[prev] = 0;
+        }
+        else
+        {
+          kmyth_log(LOG_ERR, "error decrypting batch item %zu", prev);
+        }
+        prev_key = NULL;
+        prev_key_len = 0;
+      }
+
+      if (unseal_rc == 0)
+      {
+        unseal_rc = unseal_ski_finish(sapi_ctx, &state, &prev_key,
+                                      &prev_key_len, &session_failed);
+      }
+
+      if (unseal_rc == 0)
+      {
+        prev = i;
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "error unsealing batch item %zu", i);
+      }
+
+      // a failed command leaves the session's policy state unknown, so
+      // replace it before unsealing the rest of the group
+      if (session_failed)
+      {
+        kmyth_ctx_drop_session(ctx);
+        session = NULL;
+      }
+    }
+
+    if (prev_key != NULL)
+    {
+      if (decrypt_ski(ctx, &skis[prev], prev_key, prev_key_len,
+                      &outputs[prev], &output_lens[prev]) == 0)
+      {
+        results[prev] = 0;
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "error decrypting batch item %zu", prev);
+      }
+    }
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free_ski(&skis[i]);
+    if (results[i])
+    {
+      retval = 1;
+    }
+    kmyth_metrics_inc(results[i] ? KMYTH_METRIC_UNSEAL_ERRORS :
+                      KMYTH_METRIC_UNSEALS);
+  }
+  kmyth_free(skis);
+  kmyth_free(done);
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_file_ctx()
+//############################################################################
+int tpm2_kmyth_seal_file_ctx(kmyth_ctx_t * ctx,
+                             char *input_path,
+                             uint8_t ** output,
+                             size_t *output_len,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes,
+                             size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len, char *cipher_string,
+                             char *expected_policy, uint8_t bool_trial_only)
+{
+
+  // Verify input path exists with read permissions
+  if (verifyInputFilePath(input_path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", input_path);
     return 1;
   }
 
-  // The Storage Key (SK) will be used by the TPM to unseal the wrapping key.
-  // We have obtained its public and encrypted private blobs from
-  // the input .ski file and will now load the SK into the TPM.
-  TPM2_HANDLE storageKey_handle = 0;
-  TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
-  if (load_kmyth_object(sapi_ctx,
-                        (SESSION *) NULL,
-                        storageRootKey_handle,
-                        ownerAuth,
-                        emptyPcrList,
-                        &ski.sk_priv, &ski.sk_pub, &storageKey_handle))
+  // The file is mapped rather than copied, so sealing a large file does
+  // not hold a second, heap copy of it
+  kmyth_file_view view;
+
+  if (map_bytes_from_file(input_path, &view))
   {
-    kmyth_log(LOG_ERR, "error loading storage key ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "read in %zu bytes of data to be wrapped",
+            view.data_length);
+
+  // validate non-empty plaintext buffer specified
+  if (view.data_length == 0 || view.data == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    view.release(&view);
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_seal_ctx(ctx, view.data, view.data_length,
+                                   output, output_len,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   pcrs, pcrs_len, cipher_string,
+                                   expected_policy, bool_trial_only);
+
+  view.release(&view);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "Failed to kmyth-seal data ... exiting");
+    return (1);
+  }
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_file_ctx()
+//############################################################################
+int tpm2_kmyth_unseal_file_ctx(kmyth_ctx_t * ctx,
+                               char *input_path,
+                               uint8_t ** output,
+                               size_t *output_length,
+                               uint8_t * auth_bytes,
+                               size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len, uint8_t bool_policy_or)
+{
+
+  // the parsed .ski borrows the encrypted data of a binary .ski from the
+  // mapping (never writing to it), so the payload is not copied
+  kmyth_file_view view;
+
+  if (map_bytes_from_file(input_path, &view))
+  {
+    kmyth_log(LOG_ERR, "Unable to read file %s ... exiting", input_path);
+    return (1);
+  }
+
+  int retval = tpm2_kmyth_unseal_ctx(ctx, view.data, view.data_length,
+                                     output, output_length,
+                                     auth_bytes, auth_bytes_len,
+                                     owner_auth_bytes, oa_bytes_len,
+                                     bool_policy_or);
+
+  view.release(&view);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "Unable to unseal contents ... exiting");
+    return (1);
+  }
+  return 0;
+}
+
+//############################################################################
+// close_stream_input()
+//############################################################################
+/**
+ * @brief Closes the input of a stream seal or unseal, unless it is stdin
+ *        (which belongs to the caller).
+ *
+ * @param[in]  in          Input stream, or NULL
+ */
+static void close_stream_input(FILE * in)
+{
+  if (in != NULL && in != stdin)
+  {
+    fclose(in);
+  }
+}
+
+//############################################################################
+// tpm2_kmyth_seal_stream_ctx()
+//############################################################################
+int tpm2_kmyth_seal_stream_ctx(kmyth_ctx_t * ctx,
+                               char *input_path,
+                               char *output_path,
+                               uint8_t * auth_bytes,
+                               size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len,
+                               int *pcrs, size_t pcrs_len,
+                               char *cipher_string, char *expected_policy)
+{
+  // there is a single streaming cipher, so it is also the "auto" choice
+  if (cipher_string == NULL || strcmp(cipher_string, KMYTH_AUTO_CIPHER) == 0)
+  {
+    cipher_string = KMYTH_DEFAULT_STREAM_CIPHER;
+  }
+  cipher_t cipher = kmyth_get_cipher_t_from_string(cipher_string);
+
+  if (!kmyth_cipher_is_stream(cipher))
+  {
+    kmyth_log(LOG_ERR, "%s is not a streaming cipher ... exiting",
+              cipher_string);
+    return 1;
+  }
+
+  // a NULL path stands for stdin / stdout, so that the tool can sit in a
+  // pipeline: neither side is ever held in memory as a whole
+  if (input_path != NULL && verifyInputFilePath(input_path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", input_path);
+    return 1;
+  }
+  if (output_path != NULL && verifyOutputFilePath(output_path))
+  {
+    kmyth_log(LOG_ERR, "invalid output path ... exiting");
+    return 1;
+  }
+
+  // The wrapping key is created here, rather than by the cipher, so that
+  // the .ski (which only carries the stream header as its encrypted data)
+  // can be sealed before the data is streamed
+  size_t key_len = get_key_len_from_cipher(cipher) / 8;
+  uint8_t header[AES_GCM_STREAM_HEADER_LEN];
+  uint8_t *key = kmyth_arena_alloc(&ctx->arena, key_len);
+
+  // the heap is the fallback when the context's secure arena is unusable
+  if (key == NULL)
+  {
+    key = kmyth_calloc(key_len, 1);
+  }
+
+  if (key == NULL || RAND_bytes(key, (int) key_len) != 1 ||
+      aes_gcm_stream_init_header(AES_GCM_STREAM_CHUNK_LEN, header))
+  {
+    kmyth_log(LOG_ERR, "unable to create wrapping key ... exiting");
+    kmyth_arena_release(&ctx->arena, key, key_len);
+    return 1;
+  }
+
+  uint8_t *header_ptr = header;
+  size_t header_len = sizeof(header);
+  uint8_t *ski_bytes = NULL;
+  size_t ski_len = 0;
+  kmyth_compression compression = get_compression();
+
+  if (seal_common(ctx, 1, &header_ptr, &header_len, &ski_bytes, &ski_len,
+                  auth_bytes, auth_bytes_len, owner_auth_bytes, oa_bytes_len,
+                  pcrs, pcrs_len, cipher_string, expected_policy, 0,
+                  &key, &key_len, compression, NULL))
+  {
+    kmyth_log(LOG_ERR, "unable to seal stream wrapping key ... exiting");
+    kmyth_arena_release(&ctx->arena, key, key_len);
+    return 1;
+  }
+
+  // the .ski goes out first, then each chunk as soon as it is encrypted
+  // (the last one, flagged as final, acts as the trailer). Compression, if
+  // any, runs on its own thread ahead of the cipher threads.
+  FILE *in = (input_path == NULL) ? stdin : fopen(input_path, "rb");
+  FILE *out = (output_path == NULL) ? stdout : fopen(output_path, "wb");
+  FILE *plain_in = in;
+  kmyth_compression_pipe *deflater = NULL;
+  int retval = 1;
+
+  if (in == NULL || out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open stream input/output ... exiting");
+  }
+  else if (compression != KMYTH_COMPRESSION_NONE &&
+           kmyth_compression_pipe_start(compression, true, in, &plain_in,
+                                        &deflater))
+  {
+    kmyth_log(LOG_ERR, "unable to compress %s ... exiting",
+              (input_path == NULL) ? "stdin" : input_path);
+  }
+  else if (fwrite(ski_bytes, 1, ski_len, out) != ski_len ||
+           aes_gcm_stream_encrypt_file(key, key_len, header, plain_in, out))
+  {
+    kmyth_log(LOG_ERR, "error encrypting %s ... exiting",
+              (input_path == NULL) ? "stdin" : input_path);
+  }
+  else
+  {
+    retval = 0;
+  }
+  if (deflater != NULL && kmyth_compression_pipe_finish(&deflater))
+  {
+    retval = 1;
+  }
+  kmyth_arena_release(&ctx->arena, key, key_len);
+  kmyth_free(ski_bytes);
+
+  close_stream_input(in);
+  if (out == stdout)
+  {
+    // what was already written cannot be taken back, but without its final
+    // chunk it will not unseal
+    if (fflush(stdout) != 0)
+    {
+      kmyth_log(LOG_ERR, "error writing to stdout ... exiting");
+      retval = 1;
+    }
+  }
+  else if (out != NULL)
+  {
+    if (fclose(out) != 0)
+    {
+      kmyth_log(LOG_ERR, "error writing %s ... exiting", output_path);
+      retval = 1;
+    }
+    if (retval)
+    {
+      unlink(output_path);
+    }
+  }
+
+  return retval;
+}
+
+//############################################################################
+// read_stream_ski()
+//############################################################################
+/**
+ * @brief Reads the .ski section at the start of a streamed sealed file,
+ *        leaving the file positioned at the first encrypted chunk.
+ *
+ * @param[in]  in          Streamed sealed file
+ *
+ * @param[out] ski_bytes   The .ski section (allocated here)
+ *
+ * @param[out] ski_len     Size of the .ski section
+ *
+ * @return 0 on success, 1 on error
+ */
+static int read_stream_ski(FILE * in, uint8_t ** ski_bytes, size_t *ski_len)
+{
+  size_t end_len = strlen(KMYTH_DELIM_END_FILE);
+  uint8_t *buf = kmyth_malloc(KMYTH_STREAM_MAX_SKI_LEN);
+  size_t len = 0;
+
+  if (buf == NULL)
+  {
+    return 1;
+  }
+
+  // a binary .ski gives its own length in its header
+  len = fread(buf, 1, KMYTH_SKI_V2_MAGIC_LEN, in);
+  if (is_ski_v2(buf, len))
+  {
+    size_t total = 0;
+
+    len += fread(buf + len, 1, KMYTH_SKI_V2_HEADER_LEN - len, in);
+    if (get_ski_v2_length(buf, len, &total) ||
+        total > KMYTH_STREAM_MAX_SKI_LEN ||
+        fread(buf + len, 1, total - len, in) != total - len)
+    {
+      kmyth_free(buf);
+      return 1;
+    }
+    *ski_bytes = buf;
+    *ski_len = total;
+    return 0;
+  }
+
+  // a text .ski ends at the first file end delimiter (its base64 blocks
+  // can never contain one)
+  while (len < KMYTH_STREAM_MAX_SKI_LEN)
+  {
+    int c = fgetc(in);
+
+    if (c == EOF)
+    {
+      break;
+    }
+    buf[len++] = (uint8_t) c;
+    if (c == '\n' && len >= end_len &&
+        memcmp(buf + len - end_len, KMYTH_DELIM_END_FILE, end_len) == 0)
+    {
+      *ski_bytes = buf;
+      *ski_len = len;
+      return 0;
+    }
+  }
+
+  kmyth_free(buf);
+  return 1;
+}
+
+//############################################################################
+// tpm2_kmyth_is_stream_file()
+//############################################################################
+int tpm2_kmyth_is_stream_file(char *input_path, uint8_t bool_policy_or,
+                              bool *is_stream)
+{
+  FILE *in = fopen(input_path, "rb");
+
+  if (in == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open %s ... exiting", input_path);
+    return 1;
+  }
+
+  uint8_t *ski_bytes = NULL;
+  size_t ski_len = 0;
+  Ski ski = get_default_ski();
+
+  // a plain .ski too large to be the head of a stream is not one
+  *is_stream = (read_stream_ski(in, &ski_bytes, &ski_len) == 0 &&
+                parse_ski_bytes(ski_bytes, ski_len, &ski,
+                                bool_policy_or) == 0 &&
+                kmyth_cipher_is_stream(ski.cipher));
+
+  kmyth_free(ski_bytes);
+  free_ski(&ski);
+  fclose(in);
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_stream_key()
+//############################################################################
+int tpm2_kmyth_unseal_stream_key(kmyth_ctx_t * ctx, FILE * in,
+                                 const char *input_name,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t bool_policy_or,
+                                 uint8_t * header,
+                                 kmyth_compression * compression,
+                                 uint8_t ** key, size_t *key_len)
+{
+  if (oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "loaded SK at handle = 0x%08X", storageKey_handle);
 
-  // Authorization for the use of all non-primary (other than SRK), Kmyth
-  // TPM 2.0 objects utilizes policy-based enhanced authorization critera.
-  // Therefore, we will calculate the authorization policy digest that
-  // results from applying the steps of our selected authorization policy.
-  // We pass this result to the kmyth_unseal_data() function where it is
-  // used in theinto the objects we create as the
-  // authorization policy digest value that must be regenerated to authorize
-  // use of these objects.
-  TPM2B_DIGEST objAuthPolicy;
+  uint8_t *ski_bytes = NULL;
+  size_t ski_len = 0;
 
-  objAuthPolicy.size = 0;
+  if (read_stream_ski(in, &ski_bytes, &ski_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read .ski from %s ... exiting", input_name);
+    return 1;
+  }
 
-  uint8_t *key = NULL;
-  size_t key_len;
+  Ski ski = get_default_ski();
 
-  // Perform "unseal" to recover data
-  if (tpm2_kmyth_unseal_data(sapi_ctx,
-                             storageKey_handle,
-                             ski.wk_pub,
-                             ski.wk_priv,
-                             objAuthValue,
-                             ski.pcr_list, objAuthPolicy, ski.policyBranch1,
-                             ski.policyBranch2, &key, &key_len))
+  if (parse_ski_bytes(ski_bytes, ski_len, &ski, bool_policy_or) ||
+      !kmyth_cipher_is_stream(ski.cipher) ||
+      ski.enc_data_size != AES_GCM_STREAM_HEADER_LEN)
   {
-    kmyth_log(LOG_ERR, "error unsealing data ... exiting");
+    kmyth_log(LOG_ERR, "%s is not a streamed .ski file ... exiting",
+              input_name);
+    kmyth_free(ski_bytes);
     free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
-    kmyth_clear(key, key_len);
     return 1;
   }
+  kmyth_free(ski_bytes);
+
+  // Unseal the wrapping key (authorization as for tpm2_kmyth_unseal_ctx())
+  TPM2B_AUTH ownerAuth;
+  TPM2B_AUTH objAuthValue = {.size = 0, };
 
-  if (kmyth_decrypt_data((unsigned char *) ski.enc_data,
-                         ski.enc_data_size,
-                         ski.cipher,
-                         (unsigned char *) key, key_len, output, output_len))
+  ownerAuth.size = (uint16_t) oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
   {
-    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  int retval = 1;
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+  }
+  else
+  {
+    ski_unseal_state state;
+    bool session_failed = false;
+
+    if (unseal_ski_start(ctx, kmyth_ctx_get_session(ctx), &ski, ownerAuth,
+                         objAuthValue, &state, &session_failed) == 0 &&
+        unseal_ski_finish(ctx->sapi_ctx, &state, key, key_len,
+                          &session_failed) == 0)
+    {
+      retval = 0;
+    }
+    if (session_failed)
+    {
+      kmyth_ctx_drop_session(ctx);
+    }
+  }
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  if (retval)
+  {
+    kmyth_metrics_inc(KMYTH_METRIC_UNSEAL_ERRORS);
     free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
-    kmyth_clear(key, key_len);
     return 1;
   }
+  kmyth_metrics_inc(KMYTH_METRIC_UNSEALS);
 
-  // done, so free any allocated resources that remain
+  memcpy(header, ski.enc_data, AES_GCM_STREAM_HEADER_LEN);
+  *compression = ski.compression;
   free_ski(&ski);
-  free_tpm2_resources(&sapi_ctx);
-  kmyth_clear(key, key_len);
-
   return 0;
 }
 
 //############################################################################
-// tpm2_kmyth_seal_file()
+// tpm2_kmyth_unseal_stream_ctx()
 //############################################################################
-int tpm2_kmyth_seal_file(char *input_path,
-                         uint8_t ** output,
-                         size_t *output_len,
-                         uint8_t * auth_bytes,
-                         size_t auth_bytes_len,
-                         uint8_t * owner_auth_bytes,
-                         size_t oa_bytes_len,
-                         int *pcrs, size_t pcrs_len, char *cipher_string,
-                         char *expected_policy, uint8_t bool_trial_only)
+int tpm2_kmyth_unseal_stream_ctx(kmyth_ctx_t * ctx,
+                                 char *input_path,
+                                 char *output_path,
+                                 uint8_t * auth_bytes,
+                                 size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t bool_policy_or)
 {
-
-  // Verify input path exists with read permissions
-  if (verifyInputFilePath(input_path))
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid Kmyth context ... exiting");
+    return 1;
+  }
+  if (input_path != NULL && verifyInputFilePath(input_path))
   {
     kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", input_path);
     return 1;
   }
-
-  uint8_t *data = NULL;
-  size_t data_len = 0;
-
-  if (read_bytes_from_file(input_path, &data, &data_len))
+  if (output_path != NULL && verifyOutputFilePath(output_path))
   {
-    kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
-    if (data != NULL) free(data);
+    kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", output_path);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "read in %d bytes of data to be wrapped", data_len);
 
-  // validate non-empty plaintext buffer specified
-  if (data_len == 0 || data == NULL)
+  // the .ski is read from the front of the stream and the chunks straight
+  // after it, so the input may be a pipe (stdin when input_path is NULL)
+  const char *input_name = (input_path == NULL) ? "stdin" : input_path;
+  FILE *in = (input_path == NULL) ? stdin : fopen(input_path, "rb");
+  uint8_t header[AES_GCM_STREAM_HEADER_LEN];
+  kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+  int retval = 0;
+
+  if (in == NULL)
   {
-    kmyth_log(LOG_ERR, "no input data ... exiting");
-    if (data != NULL) free(data);
+    kmyth_log(LOG_ERR, "unable to read .ski from %s ... exiting", input_name);
     return 1;
   }
-
-  if (tpm2_kmyth_seal(data, data_len,
-                      output, output_len,
-                      auth_bytes, auth_bytes_len,
-                      owner_auth_bytes, oa_bytes_len,
-                      pcrs, pcrs_len, cipher_string, expected_policy,
-                      bool_trial_only))
+  if (tpm2_kmyth_unseal_stream_key(ctx, in, input_name,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   bool_policy_or, header, &compression,
+                                   &key, &key_len))
   {
-    kmyth_log(LOG_ERR, "Failed to kmyth-seal data ... exiting");
-    if (data != NULL) free(data);
-    return (1);
+    close_stream_input(in);
+    return 1;
   }
-  if (data != NULL) free(data);
-  return 0;
-}
 
-//############################################################################
-// tpm2_kmyth_unseal_file()
-//############################################################################
-int tpm2_kmyth_unseal_file(char *input_path,
-                           uint8_t ** output,
-                           size_t *output_length,
-                           uint8_t * auth_bytes,
-                           size_t auth_bytes_len,
-                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
-                           uint8_t bool_policy_or)
-{
+  // Decrypt the chunks that follow the .ski (through a decompression stage
+  // running alongside the cipher threads if the plaintext was compressed)
+  FILE *out = (output_path == NULL) ? stdout : fopen(output_path, "wb");
+  FILE *plain_out = out;
+  kmyth_compression_pipe *inflater = NULL;
 
-  uint8_t *data = NULL;
-  size_t data_length = 0;
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open %s ... exiting", output_path);
+    retval = 1;
+  }
+  else if (compression != KMYTH_COMPRESSION_NONE &&
+           kmyth_compression_pipe_start(compression, false, out, &plain_out,
+                                        &inflater))
+  {
+    retval = 1;
+  }
+  else if (aes_gcm_stream_decrypt_file(key, key_len, header, in, plain_out))
+  {
+    kmyth_log(LOG_ERR, "error decrypting %s ... exiting", input_name);
+    retval = 1;
+  }
+  if (inflater != NULL && kmyth_compression_pipe_finish(&inflater))
+  {
+    retval = 1;
+  }
+  kmyth_clear_and_free(key, key_len);
+  close_stream_input(in);
 
-  if (read_bytes_from_file(input_path, &data, &data_length))
+  if (out != NULL && out != stdout)
   {
-    kmyth_log(LOG_ERR, "Unable to read file %s ... exiting", input_path);
-    return (1);
+    if (fclose(out) != 0)
+    {
+      kmyth_log(LOG_ERR, "error writing %s ... exiting", output_path);
+      retval = 1;
+    }
+
+    // never leave behind a partial (unauthenticated) result
+    if (retval)
+    {
+      unlink(output_path);
+    }
   }
-  if (tpm2_kmyth_unseal(data, data_length,
-                        output, output_length, auth_bytes, auth_bytes_len,
-                        owner_auth_bytes, oa_bytes_len, bool_policy_or))
+  else if (out == stdout && fflush(stdout) != 0)
   {
-    kmyth_log(LOG_ERR, "Unable to unseal contents ... exiting");
-    if (data != NULL) free(data);
-    return (1);
+    retval = 1;
   }
 
-  if (data != NULL) free(data);
-  return 0;
+  return retval;
 }
 
 //############################################################################
@@ -620,9 +2957,68 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                          TPM2B_AUTH sdo_authVal,
                          TPML_PCR_SELECTION sdo_pcrList,
                          TPM2B_DIGEST sdo_authPolicy,
-                         TPM2B_DIGEST sdo_policyBranch1,
-                         TPM2B_DIGEST sdo_policyBranch2,
+                         TPML_DIGEST sdo_policyBranches,
                          TPM2B_PUBLIC * sdo_public, TPM2B_PRIVATE * sdo_private)
+{
+  // Start a TPM 2.0 policy session that we will use to authorize the use of
+  // storage key (SK) to create the sealed wrapping key object
+  SESSION sealData_session;
+
+  if (create_auth_session(sapi_ctx, &sealData_session, TPM2_SE_POLICY))
+  {
+    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+    return 1;
+  }
+
+  if (tpm2_kmyth_seal_data_session(sapi_ctx, &sealData_session,
+                                   sdo_data, sdo_dataSize,
+                                   sk_handle, sk_authVal, sk_pcrList,
+                                   sdo_policyBranches,
+                                   sdo_authVal, sdo_pcrList, sdo_authPolicy,
+                                   sdo_policyBranches,
+                                   sdo_public, sdo_private))
+  {
+    kmyth_flush_handle(sapi_ctx, sealData_session.sessionHandle);
+    return 1;
+  }
+
+  // Clean-up: done with the policy authorization session setup to enable
+  //           creation of the sealed data object, so flush it from the TPM
+  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, sealData_session.sessionHandle);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
+              rc, getErrorString(rc));
+    kmyth_log(LOG_ERR,
+              "error flushing policy session (handle = 0x%08X) ... exiting",
+              sealData_session.sessionHandle);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG,
+            "flushed policy authorization session (handle = 0x%08X)",
+            sealData_session.sessionHandle);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_data_session_impl()
+//############################################################################
+static int tpm2_kmyth_seal_data_session_impl(TSS2_SYS_CONTEXT * sapi_ctx,
+                                             SESSION * sealData_session,
+                                             uint8_t * sdo_data,
+                                             size_t sdo_dataSize,
+                                             TPM2_HANDLE sk_handle,
+                                             TPM2B_AUTH sk_authVal,
+                                             TPML_PCR_SELECTION sk_pcrList,
+                                             TPML_DIGEST sk_policyBranches,
+                                             TPM2B_AUTH sdo_authVal,
+                                             TPML_PCR_SELECTION sdo_pcrList,
+                                             TPM2B_DIGEST sdo_authPolicy,
+                                             TPML_DIGEST sdo_policyBranches,
+                                             TPM2B_PUBLIC * sdo_public,
+                                             TPM2B_PRIVATE * sdo_private)
 {
   // Create and set up sensitive data input for new sealed data object:
   //   - The authVal (hash of user specifed authorization string or default
@@ -654,40 +3050,25 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
-  // Start a TPM 2.0 policy session that we will use to authorize the use of
-  // storage key (SK) to create the sealed wrapping key object
-  SESSION sealData_session;
-
-  if (create_auth_session(sapi_ctx, &sealData_session, TPM2_SE_POLICY))
-  {
-    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
-    return 1;
-  }
-
   // Apply policy to session context, in preparation for the "create" command
-  if (apply_policy(sapi_ctx, sealData_session.sessionHandle, sk_pcrList))
+  if (apply_policy(sapi_ctx, sealData_session->sessionHandle, sk_pcrList))
   {
     kmyth_log(LOG_ERR, "error applying policy to session context ... exiting");
     return 1;
   }
 
-  // if both policy branches have a size, policyor digest should be calculated
-  if (sdo_policyBranch1.size != 0 && sdo_policyBranch2.size != 0)
+  // if there are policy branches, the policyor digest should be calculated
+  if (sk_policyBranches.count > 0 &&
+      apply_policy_or(sapi_ctx, sealData_session->sessionHandle,
+                      &sk_policyBranches))
   {
-    TPML_DIGEST pHashList;
-
-    for (size_t i = 0; i < 8; i++)
-    {
-      pHashList.digests[i].size = 0;
-    }
-
-    apply_policy_or(sapi_ctx, sealData_session.sessionHandle,
-                    &sdo_policyBranch1, &sdo_policyBranch2, &pHashList);
+    kmyth_log(LOG_ERR, "error applying policy OR to session ... exiting");
+    return 1;
   }
 
   // create sealed data object
   if (create_kmyth_object(sapi_ctx,
-                          &sealData_session,
+                          sealData_session,
                           sk_handle,
                           sk_authVal,
                           sk_pcrList,
@@ -701,26 +3082,43 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
   }
   kmyth_log(LOG_DEBUG, "created sealed data (wrapping key) object");
 
-  // Clean-up: done with the policy authorization session setup to enable
-  //           creation of the sealed data object, so flush it from the TPM
-  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, sealData_session.sessionHandle);
-
-  if (rc != TSS2_RC_SUCCESS)
-  {
-    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
-    kmyth_log(LOG_ERR,
-              "error flushing policy session (handle = 0x%08X) ... exiting",
-              sealData_session.sessionHandle);
-    return 1;
-  }
-  kmyth_log(LOG_DEBUG,
-            "flushed policy authorization session (handle = 0x%08X)",
-            sealData_session.sessionHandle);
-
   return 0;
 }
 
+//############################################################################
+// tpm2_kmyth_seal_data_session()
+//############################################################################
+int tpm2_kmyth_seal_data_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 SESSION * sealData_session,
+                                 uint8_t * sdo_data,
+                                 size_t sdo_dataSize,
+                                 TPM2_HANDLE sk_handle,
+                                 TPM2B_AUTH sk_authVal,
+                                 TPML_PCR_SELECTION sk_pcrList,
+                                 TPML_DIGEST sk_policyBranches,
+                                 TPM2B_AUTH sdo_authVal,
+                                 TPML_PCR_SELECTION sdo_pcrList,
+                                 TPM2B_DIGEST sdo_authPolicy,
+                                 TPML_DIGEST sdo_policyBranches,
+                                 TPM2B_PUBLIC * sdo_public,
+                                 TPM2B_PRIVATE * sdo_private)
+{
+  KMYTH_PROBE2(seal_data__entry, sk_handle, sdo_dataSize);
+
+  int retval = tpm2_kmyth_seal_data_session_impl(sapi_ctx, sealData_session,
+                                                 sdo_data, sdo_dataSize,
+                                                 sk_handle, sk_authVal,
+                                                 sk_pcrList,
+                                                 sk_policyBranches,
+                                                 sdo_authVal,
+                                                 sdo_pcrList, sdo_authPolicy,
+                                                 sdo_policyBranches,
+                                                 sdo_public, sdo_private);
+
+  KMYTH_PROBE1(seal_data__return, retval);
+  return retval;
+}
+
 //############################################################################
 // tpm2_kmyth_unseal_data()
 //############################################################################
@@ -731,8 +3129,8 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                            TPM2B_AUTH authVal,
                            TPML_PCR_SELECTION pcrList,
                            TPM2B_DIGEST authPolicy,
-                           TPM2B_DIGEST policyBranch1,
-                           TPM2B_DIGEST policyBranch2,
+                           TPML_DIGEST policyBranches,
+                           POLICY_AUTHORIZATION * authorization,
                            uint8_t ** result, size_t *result_size)
 {
   // Start a TPM 2.0 policy session that we will use to authorize the use of
@@ -747,10 +3145,108 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
+  if (tpm2_kmyth_unseal_data_session(sapi_ctx, &unsealData_session,
+                                     sk_handle, sdo_public, sdo_private,
+                                     authVal, pcrList, authPolicy,
+                                     policyBranches, authorization,
+                                     result, result_size))
+  {
+    kmyth_flush_handle(sapi_ctx, unsealData_session.sessionHandle);
+    return 1;
+  }
+
+  // Clean-up: done with the policy authorization session setup to enable
+  //           loading and unsealing of the sealed data object, so
+  //           flush it from the TPM
+  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx,
+                                     unsealData_session.sessionHandle);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
+              rc, getErrorString(rc));
+    kmyth_log(LOG_ERR,
+              "error flushing policy session (handle = 0x%08X) ... exiting",
+              unsealData_session.sessionHandle);
+    kmyth_clear_and_free(*result, *result_size);
+    *result = NULL;
+    *result_size = 0;
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "flushed policy auth session (handle = 0x%08X)",
+            unsealData_session.sessionHandle);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_data_session()
+//############################################################################
+int tpm2_kmyth_unseal_data_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                   SESSION * unsealData_session,
+                                   TPM2_HANDLE sk_handle,
+                                   TPM2B_PUBLIC sdo_public,
+                                   TPM2B_PRIVATE sdo_private,
+                                   TPM2B_AUTH authVal,
+                                   TPML_PCR_SELECTION pcrList,
+                                   TPM2B_DIGEST authPolicy,
+                                   TPML_DIGEST policyBranches,
+                                   POLICY_AUTHORIZATION * authorization,
+                                   uint8_t ** result, size_t *result_size)
+{
+  TPM2_HANDLE sdo_handle = 0;
+  ASYNC_UNSEAL pending;
+
+  if (tpm2_kmyth_unseal_data_start(sapi_ctx, unsealData_session,
+                                   sk_handle, sdo_public, sdo_private,
+                                   authVal, pcrList, authPolicy,
+                                   policyBranches, authorization, false,
+                                   &sdo_handle, &pending))
+  {
+    return 1;
+  }
+
+  return tpm2_kmyth_unseal_data_finish(sapi_ctx, sdo_handle, &pending,
+                                       result, result_size);
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_data_start_impl()
+//############################################################################
+static int tpm2_kmyth_unseal_data_start_impl(TSS2_SYS_CONTEXT * sapi_ctx,
+                                             SESSION * unsealData_session,
+                                             TPM2_HANDLE sk_handle,
+                                             TPM2B_PUBLIC sdo_public,
+                                             TPM2B_PRIVATE sdo_private,
+                                             TPM2B_AUTH authVal,
+                                             TPML_PCR_SELECTION pcrList,
+                                             TPM2B_DIGEST authPolicy,
+                                             TPML_DIGEST policyBranches,
+                                             POLICY_AUTHORIZATION *
+                                             authorization,
+                                             bool sk_auth_only,
+                                             TPM2_HANDLE * sdo_handle,
+                                             ASYNC_UNSEAL * pending)
+{
+  *sdo_handle = 0;
+
+  // The storage key of data sealed to signed policies (or by a policy-only
+  // reseal) only requires the authorization value (the PCR policy gates
+  // the unseal itself)
+  TPML_PCR_SELECTION sk_pcrList = pcrList;
+  TPML_DIGEST sk_policyBranches = policyBranches;
+
+  if (authorization != NULL || sk_auth_only)
+  {
+    sk_pcrList.count = 0;
+    sk_policyBranches.count = 0;
+  }
+
   // Apply policy to session context, in preparation for the "load" command
   if (unseal_apply_policy
-      (sapi_ctx, unsealData_session.sessionHandle, pcrList,
-       policyBranch1, policyBranch2))
+      (sapi_ctx, unsealData_session->sessionHandle, sk_pcrList,
+       sk_policyBranches, NULL))
   {
     kmyth_log(LOG_ERR, "apply policy to session context error ... exiting");
     return 1;
@@ -758,62 +3254,128 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
 
   // Load sealed data object into the TPM so that we can unseal it
   // It gets loaded under the storage key (authEntity for this command)
-  TPM2_HANDLE sdo_handle = 0;
-
   if (load_kmyth_object(sapi_ctx,
-                        &unsealData_session,
+                        unsealData_session,
                         sk_handle,
                         authVal,
-                        pcrList, &sdo_private, &sdo_public, &sdo_handle))
+                        sk_pcrList, &sdo_private, &sdo_public, sdo_handle))
   {
     kmyth_log(LOG_ERR, "load error: sealed data object ... exiting");
-    Tss2_Sys_FlushContext(sapi_ctx, unsealData_session.sessionHandle);
+    *sdo_handle = 0;
     return 1;
   }
   kmyth_log(LOG_DEBUG, "loaded sealed data object at handle = 0x%08X",
-            sdo_handle);
+            *sdo_handle);
+
+  // Submit the unseal of the data object just loaded into the TPM (e.g.,
+  // sealed wrap key) - tpm2_kmyth_unseal_data_finish() collects the result
+  if (unseal_kmyth_object_start(sapi_ctx,
+                                unsealData_session,
+                                *sdo_handle, authVal, policyBranches,
+                                authorization, pcrList, pending))
+  {
+    kmyth_log(LOG_ERR, "error unsealing ... exiting");
+    kmyth_flush_handle(sapi_ctx, *sdo_handle);
+    *sdo_handle = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_data_start()
+//############################################################################
+int tpm2_kmyth_unseal_data_start(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 SESSION * unsealData_session,
+                                 TPM2_HANDLE sk_handle,
+                                 TPM2B_PUBLIC sdo_public,
+                                 TPM2B_PRIVATE sdo_private,
+                                 TPM2B_AUTH authVal,
+                                 TPML_PCR_SELECTION pcrList,
+                                 TPM2B_DIGEST authPolicy,
+                                 TPML_DIGEST policyBranches,
+                                 POLICY_AUTHORIZATION * authorization,
+                                 bool sk_auth_only,
+                                 TPM2_HANDLE * sdo_handle,
+                                 ASYNC_UNSEAL * pending)
+{
+  KMYTH_PROBE1(unseal_data__entry, sk_handle);
+
+  int retval = tpm2_kmyth_unseal_data_start_impl(sapi_ctx,
+                                                 unsealData_session,
+                                                 sk_handle, sdo_public,
+                                                 sdo_private, authVal,
+                                                 pcrList, authPolicy,
+                                                 policyBranches,
+                                                 authorization, sk_auth_only,
+                                                 sdo_handle, pending);
+
+  KMYTH_PROBE2(unseal_data__submit, retval, *sdo_handle);
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_data_finish_impl()
+//############################################################################
+static int tpm2_kmyth_unseal_data_finish_impl(TSS2_SYS_CONTEXT * sapi_ctx,
+                                              TPM2_HANDLE sdo_handle,
+                                              ASYNC_UNSEAL * pending,
+                                              uint8_t ** result,
+                                              size_t *result_size)
+{
+  *result = NULL;
+  *result_size = 0;
 
-  // Unseal the data object just loaded into the TPM (e.g., sealed wrap key)
   TPM2B_SENSITIVE_DATA unseal_sensitive = {.size = 0, };
-  if (unseal_kmyth_object(sapi_ctx,
-                          &unsealData_session,
-                          sdo_handle, authVal, policyBranch1, policyBranch2,
-                          pcrList, &unseal_sensitive))
+  if (unseal_kmyth_object_finish(sapi_ctx, pending, &unseal_sensitive))
   {
     kmyth_log(LOG_ERR, "error unsealing ... exiting");
 
     // overwrite any potentially unsealed data before exiting early due
     // to failed unseal
     kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
+    kmyth_flush_handle(sapi_ctx, sdo_handle);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "unsealed data object (handle = 0x%08X)", sdo_handle);
 
-  // Clean-up: done with the policy authorization session setup to enable
-  //           loading and unsealing of the sealed data object, so
-  //           flush it from the TPM
-  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx,
-                                     unsealData_session.sessionHandle);
-
-  if (rc != TSS2_RC_SUCCESS)
+  // Clean-up: the sealed data object is no longer needed once unsealed
+  if (kmyth_flush_handle(sapi_ctx, sdo_handle))
   {
-    kmyth_log(LOG_ERR,
-              "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
-    kmyth_log(LOG_ERR,
-              "error flushing policy session (handle = 0x%08X) ... exiting",
-              unsealData_session.sessionHandle);
+    kmyth_log(LOG_ERR, "error flushing sealed data object ... exiting");
     kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "flushed policy auth session (handle = 0x%08X)",
-            unsealData_session.sessionHandle);
 
   *result_size = unseal_sensitive.size;
-  *result = (uint8_t *) malloc(*result_size);
+  *result = (uint8_t *) kmyth_malloc(*result_size);
+  if (*result == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate unseal result ... exiting");
+    kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
+    *result_size = 0;
+    return 1;
+  }
 
   memcpy(*result, unseal_sensitive.buffer, *result_size);
   kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
 
   return 0;
 }
+
+//############################################################################
+// tpm2_kmyth_unseal_data_finish()
+//############################################################################
+int tpm2_kmyth_unseal_data_finish(TSS2_SYS_CONTEXT * sapi_ctx,
+                                  TPM2_HANDLE sdo_handle,
+                                  ASYNC_UNSEAL * pending,
+                                  uint8_t ** result, size_t *result_size)
+{
+  int retval = tpm2_kmyth_unseal_data_finish_impl(sapi_ctx, sdo_handle,
+                                                  pending, result,
+                                                  result_size);
+
+  KMYTH_PROBE3(unseal_data__return, retval, sdo_handle, *result_size);
+  return retval;
+}
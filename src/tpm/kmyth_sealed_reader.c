@@ -0,0 +1,382 @@
+/**
+ * @file  kmyth_sealed_reader.c
+ *
+ * @brief Implements the random access reader of streamed sealed files
+ *        (kmyth_sealed_reader_t) declared in kmyth.h.
+ */
+
+#include "kmyth_sealed_reader.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth_seal_unseal_impl.h"
+#include "memory_util.h"
+
+//############################################################################
+// read_chunk_bytes()
+//############################################################################
+/**
+ * @brief Reads len bytes of the sealed file at offset into buf, retrying
+ *        short reads.
+ *
+ * @return 0 on success, 1 on error (including end of file)
+ */
+static int read_chunk_bytes(FILE * file, uint8_t * buf, size_t len,
+                            uint64_t offset)
+{
+  int fd = fileno(file);
+
+  while (len > 0)
+  {
+    ssize_t n = pread(fd, buf, len, (off_t) offset);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    buf += n;
+    len -= (size_t) n;
+    offset += (uint64_t) n;
+  }
+  return 0;
+}
+
+//############################################################################
+// free_chunk()
+//############################################################################
+/**
+ * @brief Wipes and frees the plaintext buffer of a cache entry, leaving the
+ *        entry empty.
+ */
+static void free_chunk(kmyth_reader_chunk * chunk, size_t chunk_len)
+{
+  if (chunk->data != NULL)
+  {
+    kmyth_clear(chunk->data, chunk_len);
+    munlock(chunk->data, chunk_len);
+    kmyth_free(chunk->data);
+  }
+  chunk->data = NULL;
+  chunk->data_len = 0;
+}
+
+//############################################################################
+// get_chunk()
+//############################################################################
+/**
+ * @brief Returns the plaintext of chunk index of the stream, from the
+ *        reader's cache if it holds it, and otherwise read from the file
+ *        and decrypted into the least recently used cache entry.
+ *
+ * @return the cache entry holding the chunk, or NULL on error
+ */
+static kmyth_reader_chunk *get_chunk(kmyth_sealed_reader_t * reader,
+                                     uint64_t index)
+{
+  kmyth_reader_chunk *entry = NULL;
+
+  for (size_t i = 0; i < KMYTH_READER_CACHE_CHUNKS; i++)
+  {
+    kmyth_reader_chunk *c = &reader->cache[i];
+
+    if (c->data != NULL && c->index == index)
+    {
+      c->last_used = ++reader->cache_uses;
+      return c;
+    }
+    if (entry == NULL || c->data == NULL ||
+        (entry->data != NULL && c->last_used < entry->last_used))
+    {
+      entry = c;
+    }
+  }
+
+  if (entry->data == NULL)
+  {
+    entry->data = kmyth_malloc(reader->chunk_len);
+    if (entry->data == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate chunk buffer ... exiting");
+      return NULL;
+    }
+
+    // keep plaintext out of swap where the memory lock limit allows
+    if (mlock(entry->data, reader->chunk_len) != 0)
+    {
+      kmyth_log(LOG_DEBUG, "unable to lock chunk buffer in memory");
+    }
+  }
+  else
+  {
+    kmyth_clear(entry->data, entry->data_len);
+  }
+  entry->data_len = 0;
+  entry->last_used = 0;
+
+  bool final = (index == reader->chunks - 1);
+  uint64_t stride = (uint64_t) reader->chunk_len + GCM_TAG_LEN;
+  uint64_t enc_offset = reader->data_offset + index * stride;
+  size_t enc_len = final ?
+    (size_t) (reader->size - index * reader->chunk_len) + GCM_TAG_LEN :
+    (size_t) stride;
+
+  if (read_chunk_bytes(reader->file, reader->enc_chunk, enc_len,
+                       enc_offset) ||
+      aes_gcm_stream_decrypt_chunks(reader->key, reader->key_len,
+                                    reader->header, (uint32_t) index, final,
+                                    reader->enc_chunk, enc_len,
+                                    entry->data, reader->chunk_len,
+                                    &entry->data_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read or decrypt chunk %lu ... exiting",
+              (unsigned long) index);
+
+    // empty the entry, so that it cannot be mistaken for its old chunk
+    free_chunk(entry, reader->chunk_len);
+    return NULL;
+  }
+
+  entry->index = (uint32_t) index;
+  entry->last_used = ++reader->cache_uses;
+  return entry;
+}
+
+//############################################################################
+// kmyth_sealed_reader_open()
+//############################################################################
+int kmyth_sealed_reader_open(kmyth_ctx_t * ctx, char *input_path,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             uint8_t bool_policy_or,
+                             kmyth_sealed_reader_t ** reader)
+{
+  if (reader == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL pointer to sealed reader handle ... exiting");
+    return 1;
+  }
+  *reader = NULL;
+  if (input_path == NULL || verifyInputFilePath(input_path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting",
+              (input_path == NULL) ? "NULL" : input_path);
+    return 1;
+  }
+
+  kmyth_sealed_reader_t *new_reader =
+    kmyth_calloc(1, sizeof(kmyth_sealed_reader_t));
+
+  if (new_reader == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate sealed reader ... exiting");
+    return 1;
+  }
+
+  // secure arena is best effort: the key falls back to the heap
+  if (kmyth_arena_init(&new_reader->arena, KMYTH_READER_ARENA_SIZE))
+  {
+    kmyth_log(LOG_DEBUG, "unable to map secure arena, using the heap");
+  }
+
+  new_reader->file = fopen(input_path, "rb");
+  if (new_reader->file == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open %s ... exiting", input_path);
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+
+  kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (tpm2_kmyth_unseal_stream_key(ctx, new_reader->file, input_path,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   bool_policy_or, new_reader->header,
+                                   &compression, &key, &key_len))
+  {
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+
+  // the chunks of a compressed stream do not map to plaintext offsets, so
+  // it can only be unsealed from the start (see tpm2_kmyth_unseal_stream())
+  if (compression != KMYTH_COMPRESSION_NONE)
+  {
+    kmyth_log(LOG_ERR, "%s is a compressed stream, which cannot be read at "
+              "random ... exiting", input_path);
+    kmyth_clear_and_free(key, key_len);
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+
+  new_reader->key = kmyth_arena_alloc(&new_reader->arena, key_len);
+  if (new_reader->key == NULL)
+  {
+    new_reader->key = kmyth_malloc(key_len);
+  }
+  if (new_reader->key != NULL)
+  {
+    memcpy(new_reader->key, key, key_len);
+    new_reader->key_len = key_len;
+  }
+  kmyth_clear_and_free(key, key_len);
+  if (new_reader->key == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate sealed reader ... exiting");
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+
+  // the chunks follow the .ski, and every one but the final one holds
+  // chunk_len bytes of plaintext, so their number and the plaintext size
+  // follow from the size of the file
+  struct stat st;
+  off_t data_offset = ftello(new_reader->file);
+
+  if (data_offset < 0 || fstat(fileno(new_reader->file), &st) ||
+      aes_gcm_stream_parse_header(new_reader->header,
+                                  &new_reader->chunk_len) ||
+      st.st_size < data_offset + GCM_TAG_LEN)
+  {
+    kmyth_log(LOG_ERR, "invalid stream in %s ... exiting", input_path);
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+
+  uint64_t enc_len = (uint64_t) (st.st_size - data_offset);
+  uint64_t stride = (uint64_t) new_reader->chunk_len + GCM_TAG_LEN;
+
+  new_reader->data_offset = (uint64_t) data_offset;
+  new_reader->chunks = (enc_len - 1) / stride + 1;
+  if (new_reader->chunks - 1 > UINT32_MAX ||
+      enc_len - (new_reader->chunks - 1) * stride < GCM_TAG_LEN)
+  {
+    kmyth_log(LOG_ERR, "invalid stream in %s ... exiting", input_path);
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+  new_reader->size = enc_len - new_reader->chunks * GCM_TAG_LEN;
+
+  new_reader->enc_chunk = kmyth_malloc(stride);
+  if (new_reader->enc_chunk == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate sealed reader ... exiting");
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+
+  // the final chunk is the only one whose IV marks it final, so decrypting
+  // it now proves the file has not been truncated (or extended) and that
+  // the size reported is that of the plaintext sealed
+  if (get_chunk(new_reader, new_reader->chunks - 1) == NULL)
+  {
+    kmyth_log(LOG_ERR, "%s is truncated or altered ... exiting", input_path);
+    kmyth_sealed_reader_close(&new_reader);
+    return 1;
+  }
+
+  *reader = new_reader;
+  return 0;
+}
+
+//############################################################################
+// kmyth_sealed_reader_size()
+//############################################################################
+uint64_t kmyth_sealed_reader_size(kmyth_sealed_reader_t * reader)
+{
+  return (reader == NULL) ? 0 : reader->size;
+}
+
+//############################################################################
+// kmyth_sealed_reader_pread()
+//############################################################################
+int kmyth_sealed_reader_pread(kmyth_sealed_reader_t * reader,
+                              uint8_t * buf, size_t len, uint64_t offset,
+                              size_t *read_len)
+{
+  if (reader == NULL || read_len == NULL || (buf == NULL && len > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid sealed reader parameters ... exiting");
+    return 1;
+  }
+  *read_len = 0;
+
+  if (offset >= reader->size)
+  {
+    return 0;
+  }
+  if (len > reader->size - offset)
+  {
+    len = (size_t) (reader->size - offset);
+  }
+
+  size_t done = 0;
+
+  while (done < len)
+  {
+    uint64_t pos = offset + done;
+    kmyth_reader_chunk *chunk = get_chunk(reader, pos / reader->chunk_len);
+
+    if (chunk == NULL)
+    {
+      kmyth_clear(buf, done);
+      return 1;
+    }
+
+    size_t chunk_off = (size_t) (pos % reader->chunk_len);
+    size_t n = chunk->data_len - chunk_off;
+
+    if (n > len - done)
+    {
+      n = len - done;
+    }
+    memcpy(buf + done, chunk->data + chunk_off, n);
+    done += n;
+  }
+
+  *read_len = done;
+  return 0;
+}
+
+//############################################################################
+// kmyth_sealed_reader_close()
+//############################################################################
+void kmyth_sealed_reader_close(kmyth_sealed_reader_t ** reader)
+{
+  if (reader == NULL || *reader == NULL)
+  {
+    return;
+  }
+
+  kmyth_sealed_reader_t *r = *reader;
+
+  for (size_t i = 0; i < KMYTH_READER_CACHE_CHUNKS; i++)
+  {
+    free_chunk(&r->cache[i], r->chunk_len);
+  }
+  kmyth_free(r->enc_chunk);
+  kmyth_arena_release(&r->arena, r->key, r->key_len);
+  kmyth_arena_free(&r->arena);
+  if (r->file != NULL)
+  {
+    fclose(r->file);
+  }
+  kmyth_clear(r, sizeof(kmyth_sealed_reader_t));
+
+  kmyth_free(r);
+  *reader = NULL;
+}
@@ -14,120 +14,288 @@
 #include <openssl/evp.h>
 #include <tss2/tss2_mu.h>
 
+#include "base64_codec.h"
 #include "defines.h"
+#include "kmyth_usdt.h"
+#include "memory_util.h"
+#include "tpm/tpm2_interface.h"
 
 //############################################################################
-// parse_ski_bytes
+// policy_branch_delim()
 //############################################################################
-int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
-                    uint8_t bool_policy_or)
+/**
+ * @brief Formats the delimiter starting the block of a policy branch in a
+ *        text .ski (the first two are KMYTH_DELIM_POLICY_BRANCH_1 and
+ *        KMYTH_DELIM_POLICY_BRANCH_2).
+ *
+ * @param[in]  number      Number of the branch, starting at 1
+ *
+ * @param[out] delim       Buffer receiving the delimiter
+ *
+ * @param[in]  delim_size  Size of the buffer
+ */
+static void policy_branch_delim(uint32_t number, char *delim,
+                                size_t delim_size)
 {
+  snprintf(delim, delim_size, KMYTH_DELIM_POLICY_BRANCH_N, number);
+}
 
-  if (input == NULL)
+// room for a decoded text .ski block holding a marshalled 'type': at most
+// its in-memory size, plus the slack kmyth_base64_decoded_max_size() leaves
+// for the line breaks of the encoding
+#define TEXT_BLOCK_ROOM(type) (sizeof(type) + sizeof(type) / 16 + 4)
+
+//############################################################################
+// put_text_block()
+//############################################################################
+/**
+ * @brief Writes a delimiter and the base64 encoding of a block to a text
+ *        .ski being created, directly at its position in the output.
+ *
+ * @param[in/out] position  Output position, advanced past the block (the
+ *                          caller sized the output for it)
+ *
+ * @param[in]     delim     Delimiter starting the block
+ *
+ * @param[in]     raw       Bytes to be encoded
+ *
+ * @param[in]     raw_size  Number of bytes to be encoded
+ */
+static void put_text_block(uint8_t ** position, const char *delim,
+                           const uint8_t * raw, size_t raw_size)
+{
+  size_t delim_len = strlen(delim);
+
+  memcpy(*position, delim, delim_len);
+  *position += delim_len;
+  *position += kmyth_base64_encode(raw, raw_size, *position);
+}
+
+//############################################################################
+// put_text_line()
+//############################################################################
+/**
+ * @brief Writes a delimiter and a string, ending with a newline, to a text
+ *        .ski being created.
+ *
+ * @param[in/out] position  Output position, advanced past the line
+ *
+ * @param[in]     delim     Delimiter starting the block
+ *
+ * @param[in]     str       String making up the block
+ */
+static void put_text_line(uint8_t ** position, const char *delim,
+                          const char *str)
+{
+  size_t delim_len = strlen(delim);
+  size_t str_len = strlen(str);
+
+  memcpy(*position, delim, delim_len);
+  memcpy(*position + delim_len, str, str_len);
+  (*position)[delim_len + str_len] = '\n';
+  *position += delim_len + str_len + 1;
+}
+
+//############################################################################
+// decode_text_block()
+//############################################################################
+/**
+ * @brief Base64 decodes a block of a text .ski (other than the encrypted
+ *        data) into a buffer of the caller's, so no allocation is needed.
+ *
+ * @param[in]  raw_data      Encoded block
+ *
+ * @param[in]  raw_size      Size of the encoded block
+ *
+ * @param[out] decoded       Buffer receiving the decoded block
+ *
+ * @param[in]  decoded_room  Size of that buffer
+ *
+ * @param[out] decoded_size  Size of the decoded block
+ *
+ * @return 0 on success, 1 on error (including a block too large for the
+ *         structure it holds)
+ */
+static int decode_text_block(uint8_t * raw_data, size_t raw_size,
+                             uint8_t * decoded, size_t decoded_room,
+                             size_t *decoded_size)
+{
+  if (raw_data == NULL || raw_size == 0 ||
+      kmyth_base64_decoded_max_size(raw_size) > decoded_room ||
+      kmyth_base64_decode(raw_data, raw_size, decoded, decoded_size))
   {
-    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
     return 1;
   }
 
-  uint8_t *position = input;
-  size_t remaining = input_length;
-  Ski temp_ski = get_default_ski();
+  return 0;
+}
 
-  // read in (parse out) 'raw' (encoded) PCR selection list block
+//############################################################################
+// decode_authorizing_key()
+//############################################################################
+/**
+ * @brief Decodes and unmarshals the authorizing key block of a text .ski.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int decode_authorizing_key(uint8_t * raw_data, size_t raw_size,
+                                  TPM2B_PUBLIC * key)
+{
+  uint8_t decoded[TEXT_BLOCK_ROOM(TPM2B_PUBLIC)];
+  size_t decoded_size = 0;
+  size_t offset = 0;
+
+  if (decode_text_block(raw_data, raw_size, decoded, sizeof(decoded),
+                        &decoded_size))
+  {
+    return 1;
+  }
+
+  TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(decoded, decoded_size, &offset,
+                                              key);
+
+  if (rc != TSS2_RC_SUCCESS || offset != decoded_size || key->size == 0)
+  {
+    kmyth_log(LOG_ERR, "unmarshal authorizing key error ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// parse_ski_text_header()
+//############################################################################
+/**
+ * @brief Parses the blocks of a text .ski that precede its encrypted data,
+ *        leaving position at the ENC DATA delimiter. The 'raw' (encoded)
+ *        blocks are located in place, as views into the input.
+ *
+ * @param[in/out] position       Current position in the .ski bytes
+ *
+ * @param[in/out] remaining      Number of bytes left from position
+ *
+ * @param[out]    ski            Receives every field but the encrypted
+ *                               data (possibly partially filled on error)
+ *
+ * @param[in]     bool_policy_or Whether the .ski holds policy branches
+ *
+ * @return 0 on success, 1 on error
+ */
+static int parse_ski_text_header(uint8_t ** position, size_t *remaining,
+                                 Ski * ski, uint8_t bool_policy_or)
+{
   uint8_t *raw_pcr_select_list_data = NULL;
   size_t raw_pcr_select_list_size = 0;
 
-  uint8_t *raw_pb_1_data = NULL;
-  size_t raw_pb_1_size = 0;
-  uint8_t *raw_pb_2_data = NULL;
-  size_t raw_pb_2_size = 0;
+  uint8_t *raw_pb_data[KMYTH_MAX_POLICY_BRANCHES] = { NULL };
+  size_t raw_pb_size[KMYTH_MAX_POLICY_BRANCHES] = { 0 };
+  uint32_t pb_count = 0;
 
+  // read in (parse out) 'raw' (encoded) PCR selection list block
   if (bool_policy_or == 1)
   {
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pcr_select_list_data,
-                        &raw_pcr_select_list_size,
-                        KMYTH_DELIM_PCR_SELECTION_LIST,
-                        strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
-                        KMYTH_DELIM_POLICY_BRANCH_1,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_1)))
+    char delim[sizeof(KMYTH_DELIM_POLICY_BRANCH_N)];
+
+    policy_branch_delim(1, delim, sizeof(delim));
+    if (get_block_view(position,
+                       remaining,
+                       &raw_pcr_select_list_data,
+                       &raw_pcr_select_list_size,
+                       KMYTH_DELIM_PCR_SELECTION_LIST,
+                       strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                       delim, strlen(delim)))
     {
       kmyth_log(LOG_ERR, "get PCR selection list error ... exiting");
-      free(raw_pcr_select_list_data);
       return 1;
     }
 
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pb_1_data,
-                        &raw_pb_1_size,
-                        KMYTH_DELIM_POLICY_BRANCH_1,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_1),
-                        KMYTH_DELIM_POLICY_BRANCH_2,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_2)))
+    // each policy branch block ends where the next delimiter starts: either
+    // the next branch's, or (after the last branch) the storage key public
+    // block's, which is checked when that block is read
+    do
     {
-      kmyth_log(LOG_ERR, "get policy branch 1 error ... exiting");
-      free(raw_pcr_select_list_data);
-      free(raw_pb_1_data);
-      return 1;
+      policy_branch_delim(pb_count + 1, delim, sizeof(delim));
+      if (get_block_view(position,
+                         remaining,
+                         &raw_pb_data[pb_count],
+                         &raw_pb_size[pb_count],
+                         delim, strlen(delim),
+                         KMYTH_DELIM_PREFIX, strlen(KMYTH_DELIM_PREFIX)))
+      {
+        kmyth_log(LOG_ERR, "get policy branch %u error ... exiting",
+                  pb_count + 1);
+        return 1;
+      }
+      pb_count++;
+      policy_branch_delim(pb_count + 1, delim, sizeof(delim));
     }
+    while (pb_count < KMYTH_MAX_POLICY_BRANCHES &&
+           *remaining >= strlen(delim) &&
+           memcmp(*position, delim, strlen(delim)) == 0);
 
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pb_2_data,
-                        &raw_pb_2_size,
-                        KMYTH_DELIM_POLICY_BRANCH_2,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_2),
-                        KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                        strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)))
+    if (pb_count < KMYTH_MIN_POLICY_BRANCHES)
     {
-      kmyth_log(LOG_ERR, "get policy branch 2 error ... exiting");
-      free(raw_pcr_select_list_data);
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      kmyth_log(LOG_ERR, "too few policy branches (%u) ... exiting",
+                pb_count);
       return 1;
     }
-
   }
   else
   {
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pcr_select_list_data,
-                        &raw_pcr_select_list_size,
-                        KMYTH_DELIM_PCR_SELECTION_LIST,
-                        strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
-                        KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                        strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)))
+    if (get_block_view(position,
+                       remaining,
+                       &raw_pcr_select_list_data,
+                       &raw_pcr_select_list_size,
+                       KMYTH_DELIM_PCR_SELECTION_LIST,
+                       strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                       KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                       strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)))
     {
       kmyth_log(LOG_ERR, "get PCR selection list error ... exiting");
-      free(raw_pcr_select_list_data);
       return 1;
     }
+
+    // the authorizing key of data sealed to signed policies ends the PCR
+    // selection list block
+    uint8_t *raw_auth_key_data = memmem(raw_pcr_select_list_data,
+                                        raw_pcr_select_list_size,
+                                        KMYTH_DELIM_AUTHORIZING_KEY,
+                                        strlen(KMYTH_DELIM_AUTHORIZING_KEY));
+
+    if (raw_auth_key_data != NULL)
+    {
+      uint8_t *raw_pcr_block_end = raw_pcr_select_list_data +
+        raw_pcr_select_list_size;
+
+      raw_pcr_select_list_size = (size_t) (raw_auth_key_data -
+                                           raw_pcr_select_list_data);
+      raw_auth_key_data += strlen(KMYTH_DELIM_AUTHORIZING_KEY);
+      if (decode_authorizing_key(raw_auth_key_data,
+                                 (size_t) (raw_pcr_block_end -
+                                           raw_auth_key_data),
+                                 &ski->authorizing_key))
+      {
+        return 1;
+      }
+    }
   }
 
   // read in (parse out) 'raw' (encoded) public data block for the storage key
   uint8_t *raw_sk_pub_data = NULL;
   size_t raw_sk_pub_size = 0;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sk_pub_data,
-                      &raw_sk_pub_size,
-                      KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC),
-                      KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE)))
+  if (get_block_view(position,
+                     remaining,
+                     &raw_sk_pub_data,
+                     &raw_sk_pub_size,
+                     KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                     strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC),
+                     KMYTH_DELIM_STORAGE_KEY_PRIVATE,
+                     strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE)))
   {
     kmyth_log(LOG_ERR, "get storage key public error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
@@ -135,24 +303,16 @@ int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
   uint8_t *raw_sk_priv_data = NULL;
   size_t raw_sk_priv_size = 0;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sk_priv_data,
-                      &raw_sk_priv_size,
-                      KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE),
-                      KMYTH_DELIM_CIPHER_SUITE,
-                      strlen(KMYTH_DELIM_CIPHER_SUITE)))
+  if (get_block_view(position,
+                     remaining,
+                     &raw_sk_priv_data,
+                     &raw_sk_priv_size,
+                     KMYTH_DELIM_STORAGE_KEY_PRIVATE,
+                     strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE),
+                     KMYTH_DELIM_CIPHER_SUITE,
+                     strlen(KMYTH_DELIM_CIPHER_SUITE)))
   {
     kmyth_log(LOG_ERR, "get storage key private error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
@@ -160,692 +320,1145 @@ int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
   uint8_t *raw_cipher_str_data = NULL;
   size_t raw_cipher_str_size = 0;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_cipher_str_data,
-                      &raw_cipher_str_size,
-                      KMYTH_DELIM_CIPHER_SUITE,
-                      strlen(KMYTH_DELIM_CIPHER_SUITE),
-                      KMYTH_DELIM_SYM_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_SYM_KEY_PUBLIC)))
+  if (get_block_view(position,
+                     remaining,
+                     &raw_cipher_str_data,
+                     &raw_cipher_str_size,
+                     KMYTH_DELIM_CIPHER_SUITE,
+                     strlen(KMYTH_DELIM_CIPHER_SUITE),
+                     KMYTH_DELIM_SYM_KEY_PUBLIC,
+                     strlen(KMYTH_DELIM_SYM_KEY_PUBLIC)))
   {
     kmyth_log(LOG_ERR, "get cipher string error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_cipher_str_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
-  // create cipher suite struct
-  raw_cipher_str_data[raw_cipher_str_size - 1] = '\0';
-  temp_ski.cipher =
-    kmyth_get_cipher_t_from_string((char *) raw_cipher_str_data);
-  if (temp_ski.cipher.cipher_name == NULL)
+  // the compression of compressed data ends the cipher suite block
+  uint8_t *raw_compression_data = memmem(raw_cipher_str_data,
+                                         raw_cipher_str_size,
+                                         KMYTH_DELIM_COMPRESSION,
+                                         strlen(KMYTH_DELIM_COMPRESSION));
+  size_t raw_compression_size = 0;
+
+  if (raw_compression_data != NULL)
+  {
+    uint8_t *raw_cipher_block_end = raw_cipher_str_data + raw_cipher_str_size;
+
+    raw_cipher_str_size = (size_t) (raw_compression_data -
+                                    raw_cipher_str_data);
+    raw_compression_data += strlen(KMYTH_DELIM_COMPRESSION);
+    raw_compression_size = (size_t) (raw_cipher_block_end -
+                                     raw_compression_data);
+  }
+
+  // create cipher suite struct (the block ends with a newline, which is
+  // replaced by the terminator in a local copy, as input is not modified)
+  char cipher_str[128];
+
+  if (raw_cipher_str_size == 0 || raw_cipher_str_size > sizeof(cipher_str))
+  {
+    kmyth_log(LOG_ERR, "invalid cipher string length ... exiting");
+    return 1;
+  }
+  memcpy(cipher_str, raw_cipher_str_data, raw_cipher_str_size - 1);
+  cipher_str[raw_cipher_str_size - 1] = '\0';
+  ski->cipher = kmyth_get_cipher_t_from_string(cipher_str);
+  if (ski->cipher.cipher_name == NULL)
   {
     kmyth_log(LOG_ERR, "cipher_t init error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_cipher_str_data);
-    if (bool_policy_or == 1)
+    return 1;
+  }
+
+  ski->compression = KMYTH_COMPRESSION_NONE;
+  if (raw_compression_data != NULL)
+  {
+    char compression_str[32];
+
+    if (raw_compression_size == 0 ||
+        raw_compression_size > sizeof(compression_str))
     {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      kmyth_log(LOG_ERR, "invalid compression string length ... exiting");
+      return 1;
+    }
+    memcpy(compression_str, raw_compression_data, raw_compression_size - 1);
+    compression_str[raw_compression_size - 1] = '\0';
+    if (kmyth_compression_from_name(compression_str, &ski->compression) ||
+        ski->compression == KMYTH_COMPRESSION_NONE)
+    {
+      kmyth_log(LOG_ERR, "unsupported compression (%s) ... exiting",
+                compression_str);
+      return 1;
     }
-
-    return 1;
   }
-  free(raw_cipher_str_data);
-  raw_cipher_str_data = NULL;
+
   // read in (parse out) 'raw' (encoded) public data block for the wrapping key
   uint8_t *raw_sym_pub_data = NULL;
   size_t raw_sym_pub_size = 0;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sym_pub_data,
-                      &raw_sym_pub_size,
-                      KMYTH_DELIM_SYM_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_SYM_KEY_PUBLIC),
-                      KMYTH_DELIM_SYM_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_SYM_KEY_PRIVATE)))
+  if (get_block_view(position,
+                     remaining,
+                     &raw_sym_pub_data,
+                     &raw_sym_pub_size,
+                     KMYTH_DELIM_SYM_KEY_PUBLIC,
+                     strlen(KMYTH_DELIM_SYM_KEY_PUBLIC),
+                     KMYTH_DELIM_SYM_KEY_PRIVATE,
+                     strlen(KMYTH_DELIM_SYM_KEY_PRIVATE)))
   {
     kmyth_log(LOG_ERR, "get symmetric key public error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
   // read in (parse out) raw (encoded) private data block for the wrapping key
-  unsigned char *raw_sym_priv_data = NULL;
+  uint8_t *raw_sym_priv_data = NULL;
   size_t raw_sym_priv_size = 0;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sym_priv_data,
-                      &raw_sym_priv_size,
-                      KMYTH_DELIM_SYM_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_SYM_KEY_PRIVATE),
-                      KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA)))
+  if (get_block_view(position,
+                     remaining,
+                     &raw_sym_priv_data,
+                     &raw_sym_priv_size,
+                     KMYTH_DELIM_SYM_KEY_PRIVATE,
+                     strlen(KMYTH_DELIM_SYM_KEY_PRIVATE),
+                     KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA)))
   {
     kmyth_log(LOG_ERR, "get symmetric key private error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
-  // read in (parse out) raw (encoded) encrypted data block
-  unsigned char *raw_enc_data = NULL;
+  // decode the blocks into buffers on the stack (each holds a marshalled
+  // TPM structure of bounded size)
+  uint8_t decoded_pcr_select_list_data[TEXT_BLOCK_ROOM(TPML_PCR_SELECTION)];
+  size_t decoded_pcr_select_list_size = 0;
+  uint8_t decoded_pb_data[KMYTH_MAX_POLICY_BRANCHES]
+    [TEXT_BLOCK_ROOM(TPM2B_DIGEST)];
+  size_t decoded_pb_size[KMYTH_MAX_POLICY_BRANCHES] = { 0 };
+  uint8_t decoded_sk_pub_data[TEXT_BLOCK_ROOM(TPM2B_PUBLIC)];
+  size_t decoded_sk_pub_size = 0;
+  uint8_t decoded_sk_priv_data[TEXT_BLOCK_ROOM(TPM2B_PRIVATE)];
+  size_t decoded_sk_priv_size = 0;
+  uint8_t decoded_sym_pub_data[TEXT_BLOCK_ROOM(TPM2B_PUBLIC)];
+  size_t decoded_sym_pub_size = 0;
+  uint8_t decoded_sym_priv_data[TEXT_BLOCK_ROOM(TPM2B_PRIVATE)];
+  size_t decoded_sym_priv_size = 0;
+
+  int retval = 0;
+
+  retval |= decode_text_block(raw_pcr_select_list_data,
+                              raw_pcr_select_list_size,
+                              decoded_pcr_select_list_data,
+                              sizeof(decoded_pcr_select_list_data),
+                              &decoded_pcr_select_list_size);
+  for (uint32_t i = 0; i < pb_count; i++)
+  {
+    retval |= decode_text_block(raw_pb_data[i], raw_pb_size[i],
+                                decoded_pb_data[i],
+                                sizeof(decoded_pb_data[i]),
+                                &decoded_pb_size[i]);
+  }
+  retval |= decode_text_block(raw_sk_pub_data, raw_sk_pub_size,
+                              decoded_sk_pub_data,
+                              sizeof(decoded_sk_pub_data),
+                              &decoded_sk_pub_size);
+  retval |= decode_text_block(raw_sk_priv_data, raw_sk_priv_size,
+                              decoded_sk_priv_data,
+                              sizeof(decoded_sk_priv_data),
+                              &decoded_sk_priv_size);
+  retval |= decode_text_block(raw_sym_pub_data, raw_sym_pub_size,
+                              decoded_sym_pub_data,
+                              sizeof(decoded_sym_pub_data),
+                              &decoded_sym_pub_size);
+  retval |= decode_text_block(raw_sym_priv_data, raw_sym_priv_size,
+                              decoded_sym_priv_data,
+                              sizeof(decoded_sym_priv_data),
+                              &decoded_sym_priv_size);
+  if (retval)
+  {
+    return 1;
+  }
+
+  retval = unmarshal_skiObjects(&ski->pcr_list,
+                                decoded_pcr_select_list_data,
+                                decoded_pcr_select_list_size, 0,
+                                &ski->sk_pub,
+                                decoded_sk_pub_data,
+                                decoded_sk_pub_size, 0,
+                                &ski->sk_priv,
+                                decoded_sk_priv_data,
+                                decoded_sk_priv_size, 0,
+                                &ski->wk_pub,
+                                decoded_sym_pub_data,
+                                decoded_sym_pub_size, 0,
+                                &ski->wk_priv,
+                                decoded_sym_priv_data,
+                                decoded_sym_priv_size, 0,
+                                NULL, NULL, 0, 0, NULL, NULL, 0, 0);
+  for (uint32_t i = 0; i < pb_count; i++)
+  {
+    retval |= unpack_digest(&ski->policyBranches.digests[i],
+                            decoded_pb_data[i], decoded_pb_size[i], 0);
+  }
+  ski->policyBranches.count = pb_count;
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
+  }
+
+  return retval;
+}
+
+//############################################################################
+// parse_ski_text()
+//############################################################################
+/**
+ * @brief Parses a whole text .ski, for parse_ski_bytes() and
+ *        parse_ski_bytes_borrowed(). The encrypted data is base64 decoded
+ *        into a buffer owned by the output.
+ */
+static int parse_ski_text(uint8_t * input, size_t input_length, Ski * output,
+                          uint8_t bool_policy_or)
+{
+  uint8_t *position = input;
+  size_t remaining = input_length;
+  Ski temp_ski = get_default_ski();
+
+  if (parse_ski_text_header(&position, &remaining, &temp_ski, bool_policy_or))
+  {
+    return 1;
+  }
+
+  // read in (parse out) raw (encoded) encrypted data block - located in place
+  // too, so the (possibly very large) block is never copied before it is
+  // decoded
+  uint8_t *raw_enc_data = NULL;
   size_t raw_enc_size = 0;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_enc_data, &raw_enc_size,
-                      KMYTH_DELIM_ENC_DATA,
-                      strlen(KMYTH_DELIM_ENC_DATA),
-                      KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE)))
+  if (get_block_view(&position,
+                     &remaining,
+                     &raw_enc_data, &raw_enc_size,
+                     KMYTH_DELIM_ENC_DATA,
+                     strlen(KMYTH_DELIM_ENC_DATA),
+                     KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE)))
   {
     kmyth_log(LOG_ERR, "getting encrypted data error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    free(raw_enc_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
-  if (strncmp
-      ((char *) position, KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE))
-      || remaining != strlen(KMYTH_DELIM_END_FILE))
+  if (remaining != strlen(KMYTH_DELIM_END_FILE) ||
+      memcmp(position, KMYTH_DELIM_END_FILE, remaining))
   {
     kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    free(raw_enc_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
-  //We are done with position. It was marking our place in input, which is freed by the caller
-  position = NULL;
+  // decode the encrypted data block
+  if (decodeBase64Data(raw_enc_data,
+                       raw_enc_size, &temp_ski.enc_data,
+                       &temp_ski.enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    return 1;
+  }
 
-  int retval = 0;
+  *output = temp_ski;
+  return 0;
+}
 
-  // decode PCR selection list struct
-  uint8_t *decoded_pcr_select_list_data = NULL;
-  size_t decoded_pcr_select_list_size = 0;
-  size_t decoded_pcr_select_list_offset = 0;
-
-  retval |= decodeBase64Data(raw_pcr_select_list_data,
-                             raw_pcr_select_list_size,
-                             &decoded_pcr_select_list_data,
-                             &decoded_pcr_select_list_size);
-  free(raw_pcr_select_list_data);
-  raw_pcr_select_list_data = NULL;
-
-  uint8_t *decoded_policy_branch_1_data = NULL;
-  size_t decoded_policy_branch_1_size = 0;
-  size_t decoded_policy_branch_1_offset = 0;
-  uint8_t *decoded_policy_branch_2_data = NULL;
-  size_t decoded_policy_branch_2_size = 0;
-  size_t decoded_policy_branch_2_offset = 0;
+//############################################################################
+// parse_ski_bytes
+//############################################################################
+int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
+                    uint8_t bool_policy_or)
+{
 
-  if (bool_policy_or == 1)
+  if (input == NULL)
   {
-    // decode policy 1 branch struct
-    retval |= decodeBase64Data(raw_pb_1_data,
-                               raw_pb_1_size,
-                               &decoded_policy_branch_1_data,
-                               &decoded_policy_branch_1_size);
-
-    // decode policy 2 branch struct
-    retval |= decodeBase64Data(raw_pb_2_data,
-                               raw_pb_2_size,
-                               &decoded_policy_branch_2_data,
-                               &decoded_policy_branch_2_size);
-  }
-  free(raw_pb_1_data);
-  raw_pb_1_data = NULL;
-  free(raw_pb_2_data);
-  raw_pb_2_data = NULL;
-
-  // decode public data block for storage key
-  uint8_t *decoded_sk_pub_data = NULL;
-  size_t decoded_sk_pub_size = 0;
-  size_t decoded_sk_pub_offset = 0;
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
 
-  retval |= decodeBase64Data(raw_sk_pub_data,
-                             raw_sk_pub_size,
-                             &decoded_sk_pub_data, &decoded_sk_pub_size);
-  free(raw_sk_pub_data);
-  raw_sk_pub_data = NULL;
+  KMYTH_PROBE1(parse_ski__entry, input_length);
 
-  // decode encrypted private data block for storage key
-  uint8_t *decoded_sk_priv_data = NULL;
-  size_t decoded_sk_priv_size = 0;
-  size_t decoded_sk_priv_offset = 0;
+  kmyth_alloc_phase phase = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_PARSE);
+  int retval;
 
-  retval |= decodeBase64Data(raw_sk_priv_data,
-                             raw_sk_priv_size,
-                             &decoded_sk_priv_data, &decoded_sk_priv_size);
-  free(raw_sk_priv_data);
-  raw_sk_priv_data = NULL;
+  // binary .ski files start with a magic number a text one never has
+  if (is_ski_v2(input, input_length))
+  {
+    retval = parse_ski_bytes_v2(input, input_length, output);
+  }
+  else
+  {
+    retval = parse_ski_text(input, input_length, output, bool_policy_or);
+  }
 
-  // decode public data block for symmetric wrapping key
-  uint8_t *decoded_sym_pub_data = NULL;
-  size_t decoded_sym_pub_size = 0;
-  size_t decoded_sym_pub_offset = 0;
+  kmyth_alloc_set_phase(phase);
+  KMYTH_PROBE1(parse_ski__return, retval);
+  return retval;
+}
 
-  retval |= decodeBase64Data(raw_sym_pub_data,
-                             raw_sym_pub_size,
-                             &decoded_sym_pub_data, &decoded_sym_pub_size);
-  free(raw_sym_pub_data);
-  raw_sym_pub_data = NULL;
+// format written by create_ski_bytes() (see set_ski_format())
+static kmyth_ski_format ski_format = KMYTH_SKI_FORMAT_TEXT;
 
-  // decode encrypted private data block for symmetric wrapping key
-  uint8_t *decoded_sym_priv_data = NULL;
-  size_t decoded_sym_priv_size = 0;
-  size_t decoded_sym_priv_offset = 0;
+//############################################################################
+// create_ski_bytes
+//############################################################################
+int create_ski_bytes(Ski input, uint8_t ** output, size_t *output_length)
+{
+  if (ski_format == KMYTH_SKI_FORMAT_V2)
+  {
+    return create_ski_bytes_v2(input, output, output_length);
+  }
 
-  retval |= decodeBase64Data(raw_sym_priv_data,
-                             raw_sym_priv_size,
-                             &decoded_sym_priv_data, &decoded_sym_priv_size);
-  free(raw_sym_priv_data);
-  raw_sym_priv_data = NULL;
+  if(input.sk_pub.size < 0 || input.sk_priv.size < 0 || input.wk_pub.size < 0 || input.wk_priv.size < 0)
+  {
+    kmyth_log(LOG_ERR, "ski file should not have negative field sizes.");
+    return 1;
+  }
 
-  // decode the encrypted data block
-  retval |= decodeBase64Data(raw_enc_data,
-                             raw_enc_size, &temp_ski.enc_data,
-                             &temp_ski.enc_data_size);
-  free(raw_enc_data);
-  raw_enc_data = NULL;
+  // if the user has elected to use policyOR, all policy digests are written
+  // to the ski file for future calculations
+  if (input.policyBranches.count > 0 &&
+      !valid_policy_branches(&input.policyBranches))
+  {
+    kmyth_log(LOG_ERR, "invalid policy branch list ... exiting");
+    return 1;
+  }
+  if (input.policyBranches.count > 0 && input.authorizing_key.size > 0)
+  {
+    kmyth_log(LOG_ERR, "policy branches and an authorizing key cannot be "
+              "combined ... exiting");
+    return 1;
+  }
 
-  if (retval)
+  // validate that all data to be written is non-NULL and non-empty
+  const char *compression_name = NULL;
+
+  if (input.compression != KMYTH_COMPRESSION_NONE)
   {
-    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    compression_name = kmyth_compression_name(input.compression);
   }
-  else
+  if (input.cipher.cipher_name == NULL ||
+      strlen(input.cipher.cipher_name) == 0 ||
+      (input.compression != KMYTH_COMPRESSION_NONE &&
+       compression_name == NULL) ||
+      input.enc_data == NULL || input.enc_data_size == 0)
+  {
+    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
+    return 1;
+  }
+  // the encoded form (a third larger, plus newlines) must fit in a size_t
+  if (input.enc_data_size > SIZE_MAX / 2)
+  {
+    kmyth_log(LOG_ERR, "encrypted data too large ... exiting");
+    return 1;
+  }
+
+  // marshal data contained in TPM sized buffers (TPM2B_PUBLIC / TPM2B_PRIVATE)
+  // and structs (TPML_PCR_SELECTION) into buffers on the stack - each
+  // marshals to at most its in-memory size
+  // Note: must account for two extra bytes to include the buffer's size value
+  //       in the TPM2B_* sized buffer cases
+  uint8_t pcr_select_buf[sizeof(TPML_PCR_SELECTION)] = { 0 };
+  uint8_t sk_pub_buf[sizeof(TPM2B_PUBLIC)];
+  uint8_t sk_priv_buf[sizeof(TPM2B_PRIVATE)];
+  uint8_t wk_pub_buf[sizeof(TPM2B_PUBLIC)];
+  uint8_t wk_priv_buf[sizeof(TPM2B_PRIVATE)];
+  uint8_t pb_data[KMYTH_MAX_POLICY_BRANCHES][sizeof(TPM2B_DIGEST)];
+  uint8_t ak_data[sizeof(TPM2B_PUBLIC)];
+  size_t ak_size = 0;
+
+  uint8_t *pcr_select_data = pcr_select_buf;
+  size_t pcr_select_size = sizeof(pcr_select_buf);
+  uint8_t *sk_pub_data = sk_pub_buf;
+  size_t sk_pub_size = (size_t) input.sk_pub.size + 2;
+  uint8_t *sk_priv_data = sk_priv_buf;
+  size_t sk_priv_size = (size_t) input.sk_priv.size + 2;
+  uint8_t *wk_pub_data = wk_pub_buf;
+  size_t wk_pub_size = (size_t) input.wk_pub.size + 2;
+  uint8_t *wk_priv_data = wk_priv_buf;
+  size_t wk_priv_size = (size_t) input.wk_priv.size + 2;
+
+  if (sk_pub_size > sizeof(sk_pub_buf) ||
+      sk_priv_size > sizeof(sk_priv_buf) ||
+      wk_pub_size > sizeof(wk_pub_buf) ||
+      wk_priv_size > sizeof(wk_priv_buf) ||
+      marshal_skiObjects(&input.pcr_list,
+                         &pcr_select_data,
+                         &pcr_select_size, 0,
+                         &input.sk_pub,
+                         &sk_pub_data,
+                         &sk_pub_size, 0,
+                         &input.sk_priv,
+                         &sk_priv_data,
+                         &sk_priv_size, 0,
+                         &input.wk_pub,
+                         &wk_pub_data,
+                         &wk_pub_size, 0,
+                         &input.wk_priv,
+                         &wk_priv_data,
+                         &wk_priv_size, 0,
+                         NULL, NULL, NULL, 0, NULL, NULL, NULL, 0))
   {
-    retval = unmarshal_skiObjects(&temp_ski.pcr_list,
-                                  decoded_pcr_select_list_data,
-                                  decoded_pcr_select_list_size,
-                                  decoded_pcr_select_list_offset,
-                                  &temp_ski.sk_pub,
-                                  decoded_sk_pub_data,
-                                  decoded_sk_pub_size,
-                                  decoded_sk_pub_offset,
-                                  &temp_ski.sk_priv,
-                                  decoded_sk_priv_data,
-                                  decoded_sk_priv_size,
-                                  decoded_sk_priv_offset,
-                                  &temp_ski.wk_pub,
-                                  decoded_sym_pub_data,
-                                  decoded_sym_pub_size,
-                                  decoded_sym_pub_offset,
-                                  &temp_ski.wk_priv,
-                                  decoded_sym_priv_data,
-                                  decoded_sym_priv_size,
-                                  decoded_sym_priv_offset,
-                                  &temp_ski.policyBranch1,
-                                  decoded_policy_branch_1_data,
-                                  decoded_policy_branch_1_size,
-                                  decoded_policy_branch_1_offset,
-                                  &temp_ski.policyBranch2,
-                                  decoded_policy_branch_2_data,
-                                  decoded_policy_branch_2_size,
-                                  decoded_policy_branch_2_offset);
-    if (retval)
+    kmyth_log(LOG_ERR, "unable to marshal data for ski file ... exiting");
+    return 1;
+  }
+
+  // policy branches are only written for a compound policyOR, and the
+  // authorizing key for data sealed to signed policies
+  for (uint32_t i = 0; i < input.policyBranches.count; i++)
+  {
+    if (pack_digest(&input.policyBranches.digests[i], pb_data[i],
+                    (size_t) input.policyBranches.digests[i].size + 2, 0))
     {
-      kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
+      kmyth_log(LOG_ERR, "error packing policy branch %u ... exiting",
+                i + 1);
+      return 1;
     }
   }
+  if (input.authorizing_key.size > 0 &&
+      Tss2_MU_TPM2B_PUBLIC_Marshal(&input.authorizing_key, ak_data,
+                                   sizeof(ak_data), &ak_size))
+  {
+    kmyth_log(LOG_ERR, "error packing authorizing key ... exiting");
+    return 1;
+  }
 
-  free(decoded_pcr_select_list_data);
-  free(decoded_sk_pub_data);
-  free(decoded_sk_priv_data);
-  free(decoded_sym_pub_data);
-  free(decoded_sym_priv_data);
-  if (bool_policy_or == 1)
+  // every section's size is now known: compute the exact size of the .ski,
+  // so that each section is base64 encoded straight into its place in a
+  // single allocation
+  char pb_delim[sizeof(KMYTH_DELIM_POLICY_BRANCH_N)];
+  size_t out_size = strlen(KMYTH_DELIM_PCR_SELECTION_LIST) +
+    kmyth_base64_encoded_size(pcr_select_size) +
+    strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC) +
+    kmyth_base64_encoded_size(sk_pub_size) +
+    strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE) +
+    kmyth_base64_encoded_size(sk_priv_size) +
+    strlen(KMYTH_DELIM_CIPHER_SUITE) + strlen(input.cipher.cipher_name) + 1 +
+    strlen(KMYTH_DELIM_SYM_KEY_PUBLIC) +
+    kmyth_base64_encoded_size(wk_pub_size) +
+    strlen(KMYTH_DELIM_SYM_KEY_PRIVATE) +
+    kmyth_base64_encoded_size(wk_priv_size) +
+    strlen(KMYTH_DELIM_ENC_DATA) +
+    kmyth_base64_encoded_size(input.enc_data_size) +
+    strlen(KMYTH_DELIM_END_FILE);
+
+  if (ak_size > 0)
   {
-    free(decoded_policy_branch_1_data);
-    free(decoded_policy_branch_2_data);
+    out_size += strlen(KMYTH_DELIM_AUTHORIZING_KEY) +
+      kmyth_base64_encoded_size(ak_size);
   }
-  *output = temp_ski;
-  return retval;
+  for (uint32_t i = 0; i < input.policyBranches.count; i++)
+  {
+    policy_branch_delim(i + 1, pb_delim, sizeof(pb_delim));
+    out_size += strlen(pb_delim) +
+      kmyth_base64_encoded_size((size_t) input.policyBranches.digests[i].
+                                size + 2);
+  }
+  // compressed data names its compression at the end of the cipher suite
+  if (compression_name != NULL)
+  {
+    out_size += strlen(KMYTH_DELIM_COMPRESSION) + strlen(compression_name) +
+      1;
+  }
+
+  uint8_t *out = (uint8_t *) kmyth_malloc(out_size);
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate ski string ... exiting");
+    return 1;
+  }
+
+  uint8_t *position = out;
+
+  put_text_block(&position, KMYTH_DELIM_PCR_SELECTION_LIST, pcr_select_data,
+                 pcr_select_size);
+  if (ak_size > 0)
+  {
+    put_text_block(&position, KMYTH_DELIM_AUTHORIZING_KEY, ak_data, ak_size);
+  }
+  for (uint32_t i = 0; i < input.policyBranches.count; i++)
+  {
+    policy_branch_delim(i + 1, pb_delim, sizeof(pb_delim));
+    put_text_block(&position, pb_delim, pb_data[i],
+                   (size_t) input.policyBranches.digests[i].size + 2);
+  }
+  put_text_block(&position, KMYTH_DELIM_STORAGE_KEY_PUBLIC, sk_pub_data,
+                 sk_pub_size);
+  put_text_block(&position, KMYTH_DELIM_STORAGE_KEY_PRIVATE, sk_priv_data,
+                 sk_priv_size);
+  put_text_line(&position, KMYTH_DELIM_CIPHER_SUITE,
+                input.cipher.cipher_name);
+  if (compression_name != NULL)
+  {
+    put_text_line(&position, KMYTH_DELIM_COMPRESSION, compression_name);
+  }
+  put_text_block(&position, KMYTH_DELIM_SYM_KEY_PUBLIC, wk_pub_data,
+                 wk_pub_size);
+  put_text_block(&position, KMYTH_DELIM_SYM_KEY_PRIVATE, wk_priv_data,
+                 wk_priv_size);
+  put_text_block(&position, KMYTH_DELIM_ENC_DATA, input.enc_data,
+                 input.enc_data_size);
+  memcpy(position, KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE));
+  position += strlen(KMYTH_DELIM_END_FILE);
+
+  if ((size_t) (position - out) != out_size)
+  {
+    kmyth_log(LOG_ERR, "error creating ski string ... exiting");
+    kmyth_free(out);
+    return 1;
+  }
+
+  *output = out;
+  *output_length = out_size;
+
+  return 0;
 }
 
 //############################################################################
-// create_ski_bytes
+// set_ski_format()
 //############################################################################
-int create_ski_bytes(Ski input, uint8_t ** output, size_t *output_length)
+int set_ski_format(kmyth_ski_format format)
 {
-  if(input.sk_pub.size < 0 || input.sk_priv.size < 0 || input.wk_pub.size < 0 || input.wk_priv.size < 0 || input.policyBranch1.size < 0 || input.policyBranch2.size < 0)
+  if (format != KMYTH_SKI_FORMAT_TEXT && format != KMYTH_SKI_FORMAT_V2)
   {
-    kmyth_log(LOG_ERR, "ski file should not have negative field sizes.");
+    kmyth_log(LOG_ERR, "invalid .ski format (%d) ... exiting", (int) format);
     return 1;
   }
-  // marshal data contained in TPM sized buffers (TPM2B_PUBLIC / TPM2B_PRIVATE)
-  // and structs (TPML_PCR_SELECTION)
-  // Note: must account for two extra bytes to include the buffer's size value
-  //       in the TPM2B_* sized buffer cases
-  size_t pcr_select_size = sizeof(input.pcr_list);
-  size_t pcr_select_offset = 0;
-  uint8_t *pcr_select_data =
-    (uint8_t *) calloc(pcr_select_size, sizeof(uint8_t));
+  ski_format = format;
+
+  return 0;
+}
+
+//############################################################################
+// get_ski_format()
+//############################################################################
+kmyth_ski_format get_ski_format(void)
+{
+  return ski_format;
+}
 
-  // boolean to indicate whether the user has elected to use policyOR which
-  // requires writing both policy digests to the ski file for future calculations
-  uint8_t bool_policy_or = 0;
+//############################################################################
+// is_ski_v2()
+//############################################################################
+bool is_ski_v2(const uint8_t * input, size_t input_length)
+{
+  return (input != NULL && input_length >= KMYTH_SKI_V2_MAGIC_LEN &&
+          memcmp(input, KMYTH_SKI_V2_MAGIC, KMYTH_SKI_V2_MAGIC_LEN) == 0);
+}
 
-  if (pcr_select_data == NULL)
+// big-endian field helpers for the binary .ski header and section table
+static void put_be(uint8_t * out, uint64_t value, size_t len)
+{
+  for (size_t i = len; i > 0; i--)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for PCR select data ... exiting");
+    out[i - 1] = (uint8_t) (value & 0xff);
+    value >>= 8;
+  }
+}
+
+static uint64_t get_be(const uint8_t * in, size_t len)
+{
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+//############################################################################
+// get_ski_v2_length()
+//############################################################################
+int get_ski_v2_length(const uint8_t * header, size_t header_length,
+                      size_t *ski_length)
+{
+  if (header_length < KMYTH_SKI_V2_HEADER_LEN ||
+      !is_ski_v2(header, header_length) || ski_length == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid binary .ski header ... exiting");
+    return 1;
+  }
+  if (get_be(header + 4, 2) != KMYTH_SKI_V2_VERSION)
+  {
+    kmyth_log(LOG_ERR, "unsupported .ski version (%u) ... exiting",
+              (unsigned int) get_be(header + 4, 2));
     return 1;
   }
 
-  size_t sk_pub_size = (size_t)input.sk_pub.size + 2;
-  size_t sk_pub_offset = 0;
-  uint8_t *sk_pub_data = (uint8_t *) malloc(sk_pub_size);
+  uint64_t table_len = get_be(header + 8, 4);
+  uint64_t payload_len = get_be(header + 12, 8);
 
-  if (sk_pub_data == NULL)
+  if (payload_len > SIZE_MAX - KMYTH_SKI_V2_HEADER_LEN - table_len)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for storage key public data ... exiting");
-    free(pcr_select_data);
+    kmyth_log(LOG_ERR, "binary .ski too large ... exiting");
     return 1;
   }
+  *ski_length = (size_t) (KMYTH_SKI_V2_HEADER_LEN + table_len + payload_len);
+
+  return 0;
+}
 
-  size_t sk_priv_size = (size_t)input.sk_priv.size + 2;
-  size_t sk_priv_offset = 0;
-  uint8_t *sk_priv_data = (uint8_t *) malloc(sk_priv_size);
+//############################################################################
+// parse_ski_v2_sections()
+//############################################################################
+/**
+ * @brief Parses the fixed header and the section table of a binary .ski,
+ *        which need not be followed by (all of) its payload.
+ *
+ * @param[in]  input          The bytes in binary .ski format
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] ski            Receives every field but the encrypted data
+ *                            (possibly partially filled on error)
+ *
+ * @return 0 on success, 1 on error
+ */
+static int parse_ski_v2_sections(uint8_t * input, size_t input_length,
+                                 Ski * ski)
+{
+  size_t ski_length = 0;
 
-  if (sk_priv_data == NULL)
+  if (get_ski_v2_length(input, input_length, &ski_length))
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for storage key private data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
     return 1;
   }
 
-  size_t wk_pub_size = (size_t)input.wk_pub.size + 2;
-  size_t wk_pub_offset = 0;
-  uint8_t *wk_pub_data = (uint8_t *) malloc(wk_pub_size);
+  size_t count = (size_t) get_be(input + 6, 2);
+  size_t table_len = (size_t) get_be(input + 8, 4);
+  uint8_t *table = input + KMYTH_SKI_V2_HEADER_LEN;
 
-  if (wk_pub_data == NULL)
+  if (table_len > input_length - KMYTH_SKI_V2_HEADER_LEN)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for wrapping key public data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
+    kmyth_log(LOG_ERR, "truncated .ski section table ... exiting");
+    return 1;
+  }
+  if (get_be(input + 12, 8) == 0)
+  {
+    kmyth_log(LOG_ERR, "binary .ski holds no encrypted data ... exiting");
     return 1;
   }
 
-  size_t wk_priv_size = (size_t)input.wk_priv.size + 2;
-  size_t wk_priv_offset = 0;
-  uint8_t *wk_priv_data = (uint8_t *) malloc(wk_priv_size);
+  unsigned int seen = 0;
+  size_t pos = 0;
+  TSS2_RC rc = 0;
 
-  if (wk_priv_data == NULL)
+  for (size_t i = 0; i < count; i++)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for wrapping key private data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
+    if (table_len - pos < KMYTH_SKI_V2_SECTION_HEADER_LEN)
+    {
+      kmyth_log(LOG_ERR, "truncated .ski section table ... exiting");
+      return 1;
+    }
+
+    unsigned int type = (unsigned int) get_be(table + pos, 2);
+    size_t len = (size_t) get_be(table + pos + 2, 4);
+    uint8_t *value = table + pos + KMYTH_SKI_V2_SECTION_HEADER_LEN;
+    size_t offset = 0;
+
+    pos += KMYTH_SKI_V2_SECTION_HEADER_LEN;
+    if (len > table_len - pos)
+    {
+      kmyth_log(LOG_ERR, "truncated .ski section (type %u) ... exiting",
+                type);
+      return 1;
+    }
+    pos += len;
+
+    if (type < KMYTH_SKI_V2_PCR_SELECTION_LIST ||
+        type > KMYTH_SKI_V2_AUTHORIZING_KEY || (seen & (1U << type)))
+    {
+      kmyth_log(LOG_ERR, "unknown or repeated .ski section (type %u) ... "
+                "exiting", type);
+      return 1;
+    }
+    seen |= 1U << type;
+
+    // each TPM 2.0 structure must take up its whole section
+    switch (type)
+    {
+    case KMYTH_SKI_V2_PCR_SELECTION_LIST:
+      rc = Tss2_MU_TPML_PCR_SELECTION_Unmarshal(value, len, &offset,
+                                                &ski->pcr_list);
+      break;
+    case KMYTH_SKI_V2_POLICY_BRANCH_1:
+      rc = Tss2_MU_TPM2B_DIGEST_Unmarshal(value, len, &offset,
+                                          &ski->policyBranches.digests[0]);
+      break;
+    case KMYTH_SKI_V2_POLICY_BRANCH_2:
+      rc = Tss2_MU_TPM2B_DIGEST_Unmarshal(value, len, &offset,
+                                          &ski->policyBranches.digests[1]);
+      break;
+    case KMYTH_SKI_V2_POLICY_BRANCHES:
+      rc = Tss2_MU_TPML_DIGEST_Unmarshal(value, len, &offset,
+                                         &ski->policyBranches);
+      break;
+    case KMYTH_SKI_V2_AUTHORIZING_KEY:
+      rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(value, len, &offset,
+                                          &ski->authorizing_key);
+      if (rc == 0 && ski->authorizing_key.size == 0)
+      {
+        kmyth_log(LOG_ERR, "empty .ski authorizing key ... exiting");
+        return 1;
+      }
+      break;
+    case KMYTH_SKI_V2_STORAGE_KEY_PUBLIC:
+      rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(value, len, &offset,
+                                          &ski->sk_pub);
+      break;
+    case KMYTH_SKI_V2_STORAGE_KEY_PRIVATE:
+      rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(value, len, &offset,
+                                           &ski->sk_priv);
+      break;
+    case KMYTH_SKI_V2_SYM_KEY_PUBLIC:
+      rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(value, len, &offset,
+                                          &ski->wk_pub);
+      break;
+    case KMYTH_SKI_V2_SYM_KEY_PRIVATE:
+      rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(value, len, &offset,
+                                           &ski->wk_priv);
+      break;
+    case KMYTH_SKI_V2_CIPHER_SUITE:
+      {
+        char name[128];
+
+        if (len == 0 || len >= sizeof(name))
+        {
+          kmyth_log(LOG_ERR, "invalid .ski cipher suite ... exiting");
+          return 1;
+        }
+        memcpy(name, value, len);
+        name[len] = '\0';
+        ski->cipher = kmyth_get_cipher_t_from_string(name);
+        if (ski->cipher.cipher_name == NULL)
+        {
+          kmyth_log(LOG_ERR, "cipher_t init error ... exiting");
+          return 1;
+        }
+        offset = len;
+      }
+      break;
+    case KMYTH_SKI_V2_COMPRESSION:
+      {
+        char name[32];
+
+        if (len == 0 || len >= sizeof(name))
+        {
+          kmyth_log(LOG_ERR, "invalid .ski compression ... exiting");
+          return 1;
+        }
+        memcpy(name, value, len);
+        name[len] = '\0';
+        if (kmyth_compression_from_name(name, &ski->compression) ||
+            ski->compression == KMYTH_COMPRESSION_NONE)
+        {
+          kmyth_log(LOG_ERR, "unsupported compression (%s) ... exiting",
+                    name);
+          return 1;
+        }
+        offset = len;
+      }
+      break;
+    }
+    if (rc != 0 || offset != len)
+    {
+      kmyth_log(LOG_ERR, "unmarshal .ski section (type %u) error: 0x%08X ... "
+                "exiting", type, rc);
+      return 1;
+    }
+  }
+
+  unsigned int required = (1U << KMYTH_SKI_V2_PCR_SELECTION_LIST) |
+    (1U << KMYTH_SKI_V2_STORAGE_KEY_PUBLIC) |
+    (1U << KMYTH_SKI_V2_STORAGE_KEY_PRIVATE) |
+    (1U << KMYTH_SKI_V2_CIPHER_SUITE) |
+    (1U << KMYTH_SKI_V2_SYM_KEY_PUBLIC) | (1U << KMYTH_SKI_V2_SYM_KEY_PRIVATE);
+  unsigned int branches = (1U << KMYTH_SKI_V2_POLICY_BRANCH_1) |
+    (1U << KMYTH_SKI_V2_POLICY_BRANCH_2);
+  unsigned int branch_list = 1U << KMYTH_SKI_V2_POLICY_BRANCHES;
+  unsigned int authorizing_key = 1U << KMYTH_SKI_V2_AUTHORIZING_KEY;
+
+  if (pos != table_len || (seen & required) != required ||
+      ((seen & branches) != 0 && (seen & branches) != branches) ||
+      ((seen & branches) != 0 && (seen & branch_list) != 0) ||
+      ((seen & (branches | branch_list)) != 0 &&
+       (seen & authorizing_key) != 0))
+  {
+    kmyth_log(LOG_ERR, "malformed .ski section table ... exiting");
+    return 1;
+  }
+  if ((seen & branches) != 0)
+  {
+    ski->policyBranches.count = 2;
+  }
+  if ((seen & (branches | branch_list)) != 0 &&
+      !valid_policy_branches(&ski->policyBranches))
+  {
+    kmyth_log(LOG_ERR, "invalid .ski policy branches ... exiting");
     return 1;
   }
 
-  size_t p_branch_1_size = 0;
-  size_t p_branch_1_offset = 0;
-  uint8_t *p_branch_1_data = NULL;
+  return 0;
+}
 
-  size_t p_branch_2_size = 0;
-  size_t p_branch_2_offset = 0;
-  uint8_t *p_branch_2_data = NULL;
+//############################################################################
+// parse_ski_v2()
+//############################################################################
+/**
+ * @brief Parses a whole binary (v2) .ski, for parse_ski_bytes_v2()
+ *        (borrow false: the payload is copied) and
+ *        parse_ski_bytes_borrowed() (borrow true: enc_data points at the
+ *        payload in input).
+ */
+static int parse_ski_v2(uint8_t * input, size_t input_length, Ski * output,
+                        bool borrow)
+{
+  size_t ski_length = 0;
 
-  // if both policy branches are present, includes
-  // policy branch info to be marshalled to ski file
-  if (input.policyBranch1.size > 0 && input.policyBranch2.size > 0)
+  if (output == NULL || get_ski_v2_length(input, input_length, &ski_length))
+  {
+    return 1;
+  }
+  if (ski_length != input_length)
   {
-    bool_policy_or = 1;
+    kmyth_log(LOG_ERR, "binary .ski length mismatch ... exiting");
+    return 1;
+  }
+
+  size_t table_len = (size_t) get_be(input + 8, 4);
+  size_t payload_len = (size_t) get_be(input + 12, 8);
+  uint8_t *payload = input + KMYTH_SKI_V2_HEADER_LEN + table_len;
+  Ski temp_ski = get_default_ski();
 
-    p_branch_1_size = (size_t)input.policyBranch1.size + 2;
-    p_branch_1_data = (uint8_t *) malloc(p_branch_1_size);
+  if (parse_ski_v2_sections(input, input_length, &temp_ski))
+  {
+    return 1;
+  }
 
-    if (p_branch_1_data == NULL)
+  // the payload is stored as is, so it can be used where it lies
+  if (borrow)
+  {
+    temp_ski.enc_data = payload;
+    temp_ski.enc_data_borrowed = true;
+  }
+  else
+  {
+    temp_ski.enc_data = kmyth_malloc(payload_len);
+    if (temp_ski.enc_data == NULL)
     {
-      kmyth_log(LOG_ERR,
-                "unable to allocate memory for policy data ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
+      kmyth_log(LOG_ERR, "unable to allocate encrypted data ... exiting");
       return 1;
     }
+    memcpy(temp_ski.enc_data, payload, payload_len);
+  }
+  temp_ski.enc_data_size = payload_len;
+
+  *output = temp_ski;
+  return 0;
+}
+
+//############################################################################
+// parse_ski_bytes_v2()
+//############################################################################
+int parse_ski_bytes_v2(uint8_t * input, size_t input_length, Ski * output)
+{
+  return parse_ski_v2(input, input_length, output, false);
+}
+
+//############################################################################
+// parse_ski_bytes_borrowed()
+//############################################################################
+int parse_ski_bytes_borrowed(uint8_t * input, size_t input_length,
+                             Ski * output, uint8_t bool_policy_or)
+{
+  if (input == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
+
+  KMYTH_PROBE1(parse_ski__entry, input_length);
+
+  kmyth_alloc_phase phase = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_PARSE);
+  int retval;
+
+  if (is_ski_v2(input, input_length))
+  {
+    retval = parse_ski_v2(input, input_length, output, true);
+  }
+  else
+  {
+    retval = parse_ski_text(input, input_length, output, bool_policy_or);
+  }
+
+  kmyth_alloc_set_phase(phase);
+  KMYTH_PROBE1(parse_ski__return, retval);
+  return retval;
+}
+
+//############################################################################
+// parse_ski_header()
+//############################################################################
+int parse_ski_header(uint8_t * input, size_t input_length, Ski * output)
+{
+  if (input == NULL || output == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
 
-    p_branch_2_size = (size_t)input.policyBranch2.size + 2;
-    p_branch_2_data = (uint8_t *) malloc(p_branch_2_size);
+  Ski temp_ski = get_default_ski();
 
-    if (p_branch_2_data == NULL)
+  if (is_ski_v2(input, input_length))
+  {
+    if (parse_ski_v2_sections(input, input_length, &temp_ski))
     {
-      kmyth_log(LOG_ERR,
-                "unable to allocate memory for policy data ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
-      free(p_branch_1_data);
       return 1;
     }
+    *output = temp_ski;
+    return 0;
+  }
 
+  // the policy branches, if any, come between the PCR selection list and
+  // the storage key public block
+  uint8_t *sk_pub = memmem(input, input_length,
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC));
+
+  if (sk_pub == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to find the storage key public block ... "
+              "exiting");
+    return 1;
   }
 
-  if (marshal_skiObjects(&input.pcr_list,
-                         &pcr_select_data,
-                         &pcr_select_size,
-                         pcr_select_offset,
-                         &input.sk_pub,
-                         &sk_pub_data,
-                         &sk_pub_size,
-                         sk_pub_offset,
-                         &input.sk_priv,
-                         &sk_priv_data,
-                         &sk_priv_size,
-                         sk_priv_offset,
-                         &input.wk_pub,
-                         &wk_pub_data,
-                         &wk_pub_size,
-                         wk_pub_offset,
-                         &input.wk_priv,
-                         &wk_priv_data,
-                         &wk_priv_size,
-                         wk_priv_offset,
-                         &input.policyBranch1,
-                         &p_branch_1_data,
-                         &p_branch_1_size,
-                         p_branch_1_offset,
-                         &input.policyBranch2,
-                         &p_branch_2_data, &p_branch_2_size, p_branch_2_offset))
+  uint8_t bool_policy_or = memmem(input, (size_t) (sk_pub - input),
+                                  KMYTH_DELIM_POLICY_BRANCH_1,
+                                  strlen(KMYTH_DELIM_POLICY_BRANCH_1)) != NULL;
+  uint8_t *position = input;
+  size_t remaining = input_length;
+
+  if (parse_ski_text_header(&position, &remaining, &temp_ski, bool_policy_or))
   {
-    kmyth_log(LOG_ERR, "unable to marshal data for ski file ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    free(wk_priv_data);
-    free(p_branch_1_data);
-    free(p_branch_2_data);
     return 1;
   }
 
-  // validate that all data to be written is non-NULL and non-empty
-  if (pcr_select_data == NULL ||
-      pcr_select_size == 0 ||
-      sk_pub_data == NULL ||
-      sk_pub_size == 0 ||
-      sk_priv_data == NULL ||
-      sk_priv_size == 0 ||
-      wk_pub_data == NULL ||
-      wk_pub_size == 0 ||
-      wk_priv_data == NULL ||
-      wk_priv_size == 0 ||
+  *output = temp_ski;
+  return 0;
+}
+
+//############################################################################
+// create_ski_bytes_v2()
+//############################################################################
+int create_ski_bytes_v2(Ski input, uint8_t ** output, size_t *output_length)
+{
+  if (output == NULL || output_length == NULL ||
+      input.sk_pub.size == 0 || input.sk_priv.size == 0 ||
+      input.wk_pub.size == 0 || input.wk_priv.size == 0 ||
       input.cipher.cipher_name == NULL ||
       strlen(input.cipher.cipher_name) == 0 ||
       input.enc_data == NULL || input.enc_data_size == 0)
   {
     kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    free(wk_priv_data);
-    free(p_branch_1_data);
-    free(p_branch_2_data);
-    return 1;
-  }
-
-  //Encode each portion of the file in base64
-  uint8_t *pcr64_select_data = NULL;
-  size_t pcr64_select_size = 0;
-  uint8_t *sk64_pub_data = NULL;
-  size_t sk64_pub_size = 0;
-  uint8_t *sk64_priv_data = NULL;
-  size_t sk64_priv_size = 0;
-  uint8_t *wk64_pub_data = NULL;
-  size_t wk64_pub_size = 0;
-  uint8_t *wk64_priv_data = NULL;
-  size_t wk64_priv_size = 0;
-  uint8_t *enc64_data = NULL;
-  size_t enc64_data_size = 0;
-  //uint8_t *policy64_data = NULL;
-  //size_t policy64_data_size = 0;
-  uint8_t *p_branch_1_64_data = NULL;
-  size_t p_branch_1_64_data_size = 0;
-  uint8_t *p_branch_2_64_data = NULL;
-  size_t p_branch_2_64_data_size = 0;
-
-  // only used if policy branches are present for compound policyOR
-  if (p_branch_1_data != NULL && p_branch_2_data != NULL)
+    return 1;
+  }
+
+  // policy branches are only written for a compound "policy or": two of
+  // them as two sections (readable by versions limited to two branches),
+  // more as a single list section
+  uint32_t branch_count = input.policyBranches.count;
+  size_t name_len = strlen(input.cipher.cipher_name);
+  const char *compression_name = NULL;
+  size_t compression_len = 0;
+  size_t count = (branch_count == 0) ? 6 : (branch_count == 2) ? 8 : 7;
+
+  if (branch_count > 0 && !valid_policy_branches(&input.policyBranches))
   {
-    if (encodeBase64Data
-        (pcr_select_data, pcr_select_size, &pcr64_select_data,
-         &pcr64_select_size)
-        || encodeBase64Data(sk_pub_data, sk_pub_size, &sk64_pub_data,
-                            &sk64_pub_size)
-        || encodeBase64Data(sk_priv_data, sk_priv_size, &sk64_priv_data,
-                            &sk64_priv_size)
-        || encodeBase64Data(wk_pub_data, wk_pub_size, &wk64_pub_data,
-                            &wk64_pub_size)
-        || encodeBase64Data(wk_priv_data, wk_priv_size, &wk64_priv_data,
-                            &wk64_priv_size)
-        || encodeBase64Data(input.enc_data, input.enc_data_size, &enc64_data,
-                            &enc64_data_size)
-        || encodeBase64Data(p_branch_1_data, p_branch_1_size,
-                            &p_branch_1_64_data, &p_branch_1_64_data_size)
-        || encodeBase64Data(p_branch_2_data, p_branch_2_size,
-                            &p_branch_2_64_data, &p_branch_2_64_data_size))
+    kmyth_log(LOG_ERR, "invalid policy branch list ... exiting");
+    return 1;
+  }
+  if (branch_count > 0 && input.authorizing_key.size > 0)
+  {
+    kmyth_log(LOG_ERR, "policy branches and an authorizing key cannot be "
+              "combined ... exiting");
+    return 1;
+  }
+
+  // the authorizing key section is only written for data sealed to signed
+  // policies
+  if (input.authorizing_key.size > 0)
+  {
+    count++;
+  }
+
+  // the compression section is only written for compressed data
+  if (input.compression != KMYTH_COMPRESSION_NONE)
+  {
+    compression_name = kmyth_compression_name(input.compression);
+    if (compression_name == NULL)
     {
-      kmyth_log(LOG_ERR, "error base64 encoding ski string ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
-      free(pcr64_select_data);
-      free(sk64_pub_data);
-      free(sk64_priv_data);
-      free(wk64_pub_data);
-      free(wk64_priv_data);
-      free(enc64_data);
-      free(p_branch_1_data);
-      free(p_branch_2_data);
+      kmyth_log(LOG_ERR, "invalid compression ... exiting");
       return 1;
     }
+    compression_len = strlen(compression_name);
+    count++;
   }
-  // else condition: policy branches are not written to ski file
-  else
+
+  // upper bound of the section table: every TPM 2.0 structure marshals to
+  // at most its in-memory size
+  size_t table_max = count * KMYTH_SKI_V2_SECTION_HEADER_LEN +
+    sizeof(TPML_PCR_SELECTION) + 3 * sizeof(TPM2B_PUBLIC) +
+    2 * sizeof(TPM2B_PRIVATE) + sizeof(TPML_DIGEST) + name_len +
+    compression_len;
+
+  if (input.enc_data_size >
+      SIZE_MAX - KMYTH_SKI_V2_HEADER_LEN - table_max)
   {
-    if (encodeBase64Data
-        (pcr_select_data, pcr_select_size, &pcr64_select_data,
-         &pcr64_select_size)
-        || encodeBase64Data(sk_pub_data, sk_pub_size, &sk64_pub_data,
-                            &sk64_pub_size)
-        || encodeBase64Data(sk_priv_data, sk_priv_size, &sk64_priv_data,
-                            &sk64_priv_size)
-        || encodeBase64Data(wk_pub_data, wk_pub_size, &wk64_pub_data,
-                            &wk64_pub_size)
-        || encodeBase64Data(wk_priv_data, wk_priv_size, &wk64_priv_data,
-                            &wk64_priv_size)
-        || encodeBase64Data(input.enc_data, input.enc_data_size, &enc64_data,
-                            &enc64_data_size))
+    kmyth_log(LOG_ERR, "encrypted data too large ... exiting");
+    return 1;
+  }
+
+  uint8_t *out = kmyth_malloc(KMYTH_SKI_V2_HEADER_LEN + table_max +
+                              input.enc_data_size);
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate .ski buffer ... exiting");
+    return 1;
+  }
+
+  uint8_t *table = out + KMYTH_SKI_V2_HEADER_LEN;
+  size_t pos = 0;
+  TSS2_RC rc = 0;
+
+  // sections in the order of the text format
+  unsigned int types[9];
+  size_t n = 0;
+
+  types[n++] = KMYTH_SKI_V2_PCR_SELECTION_LIST;
+  if (branch_count == 2)
+  {
+    types[n++] = KMYTH_SKI_V2_POLICY_BRANCH_1;
+    types[n++] = KMYTH_SKI_V2_POLICY_BRANCH_2;
+  }
+  else if (branch_count > 2)
+  {
+    types[n++] = KMYTH_SKI_V2_POLICY_BRANCHES;
+  }
+  if (input.authorizing_key.size > 0)
+  {
+    types[n++] = KMYTH_SKI_V2_AUTHORIZING_KEY;
+  }
+  types[n++] = KMYTH_SKI_V2_STORAGE_KEY_PUBLIC;
+  types[n++] = KMYTH_SKI_V2_STORAGE_KEY_PRIVATE;
+  types[n++] = KMYTH_SKI_V2_CIPHER_SUITE;
+  if (compression_name != NULL)
+  {
+    types[n++] = KMYTH_SKI_V2_COMPRESSION;
+  }
+  types[n++] = KMYTH_SKI_V2_SYM_KEY_PUBLIC;
+  types[n++] = KMYTH_SKI_V2_SYM_KEY_PRIVATE;
+
+  for (size_t i = 0; i < n && rc == 0; i++)
+  {
+    uint8_t *value = table + pos + KMYTH_SKI_V2_SECTION_HEADER_LEN;
+    size_t room = table_max - pos - KMYTH_SKI_V2_SECTION_HEADER_LEN;
+    size_t len = 0;
+
+    switch (types[i])
     {
-      kmyth_log(LOG_ERR, "error base64 encoding ski string ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
-      free(pcr64_select_data);
-      free(sk64_pub_data);
-      free(sk64_priv_data);
-      free(wk64_pub_data);
-      free(wk64_priv_data);
-      free(enc64_data);
-      free(p_branch_1_data);
-      free(p_branch_2_data);
-      return 1;
+    case KMYTH_SKI_V2_PCR_SELECTION_LIST:
+      rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(&input.pcr_list, value, room,
+                                              &len);
+      break;
+    case KMYTH_SKI_V2_POLICY_BRANCH_1:
+      rc = Tss2_MU_TPM2B_DIGEST_Marshal(&input.policyBranches.digests[0],
+                                        value, room, &len);
+      break;
+    case KMYTH_SKI_V2_POLICY_BRANCH_2:
+      rc = Tss2_MU_TPM2B_DIGEST_Marshal(&input.policyBranches.digests[1],
+                                        value, room, &len);
+      break;
+    case KMYTH_SKI_V2_POLICY_BRANCHES:
+      rc = Tss2_MU_TPML_DIGEST_Marshal(&input.policyBranches, value, room,
+                                       &len);
+      break;
+    case KMYTH_SKI_V2_AUTHORIZING_KEY:
+      rc = Tss2_MU_TPM2B_PUBLIC_Marshal(&input.authorizing_key, value, room,
+                                        &len);
+      break;
+    case KMYTH_SKI_V2_STORAGE_KEY_PUBLIC:
+      rc = Tss2_MU_TPM2B_PUBLIC_Marshal(&input.sk_pub, value, room, &len);
+      break;
+    case KMYTH_SKI_V2_STORAGE_KEY_PRIVATE:
+      rc = Tss2_MU_TPM2B_PRIVATE_Marshal(&input.sk_priv, value, room, &len);
+      break;
+    case KMYTH_SKI_V2_CIPHER_SUITE:
+      memcpy(value, input.cipher.cipher_name, name_len);
+      len = name_len;
+      break;
+    case KMYTH_SKI_V2_COMPRESSION:
+      memcpy(value, compression_name, compression_len);
+      len = compression_len;
+      break;
+    case KMYTH_SKI_V2_SYM_KEY_PUBLIC:
+      rc = Tss2_MU_TPM2B_PUBLIC_Marshal(&input.wk_pub, value, room, &len);
+      break;
+    case KMYTH_SKI_V2_SYM_KEY_PRIVATE:
+      rc = Tss2_MU_TPM2B_PRIVATE_Marshal(&input.wk_priv, value, room, &len);
+      break;
     }
+    put_be(table + pos, types[i], 2);
+    put_be(table + pos + 2, len, 4);
+    pos += KMYTH_SKI_V2_SECTION_HEADER_LEN + len;
   }
-
-  free(pcr_select_data);
-  pcr_select_data = NULL;
-  free(sk_pub_data);
-  sk_pub_data = NULL;
-  free(sk_priv_data);
-  sk_priv_data = NULL;
-  free(wk_pub_data);
-  wk_pub_data = NULL;
-  free(wk_priv_data);
-  wk_priv_data = NULL;
-  free(p_branch_1_data);
-  p_branch_1_data = NULL;
-  free(p_branch_2_data);
-  p_branch_2_data = NULL;
-
-  //At this point the data is all formatted, it's time to create the string
-  uint8_t *out = NULL;
-  size_t out_length = 0;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_PCR_SELECTION_LIST,
-         strlen(KMYTH_DELIM_PCR_SELECTION_LIST));
-  concat(&out, &out_length, pcr64_select_data, pcr64_select_size);
-  free(pcr64_select_data);
-  pcr64_select_data = NULL;
-
-  // if policyOR is used, includes policy branch information in ski file
-  if (bool_policy_or == 1)
+  if (rc != 0)
   {
-    concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_POLICY_BRANCH_1,
-           strlen(KMYTH_DELIM_POLICY_BRANCH_1));
-    concat(&out, &out_length, p_branch_1_64_data, p_branch_1_64_data_size);
-    free(p_branch_1_64_data);
-    p_branch_1_64_data = NULL;
-
-    concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_POLICY_BRANCH_2,
-           strlen(KMYTH_DELIM_POLICY_BRANCH_2));
-    concat(&out, &out_length, p_branch_2_64_data, p_branch_2_64_data_size);
-    free(p_branch_2_64_data);
-    p_branch_2_64_data = NULL;
-  }
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-         strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC));
-  concat(&out, &out_length, sk64_pub_data, sk64_pub_size);
-  free(sk64_pub_data);
-  sk64_pub_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-         strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE));
-  concat(&out, &out_length, sk64_priv_data, sk64_priv_size);
-  free(sk64_priv_data);
-  sk64_priv_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_CIPHER_SUITE,
-         strlen(KMYTH_DELIM_CIPHER_SUITE));
-  concat(&out, &out_length, (uint8_t *) input.cipher.cipher_name,
-         strlen(input.cipher.cipher_name));
-  concat(&out, &out_length, (uint8_t *) "\n", 1);
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_SYM_KEY_PUBLIC,
-         strlen(KMYTH_DELIM_SYM_KEY_PUBLIC));
-  concat(&out, &out_length, wk64_pub_data, wk64_pub_size);
-  free(wk64_pub_data);
-  wk64_pub_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_SYM_KEY_PRIVATE,
-         strlen(KMYTH_DELIM_SYM_KEY_PRIVATE));
-  concat(&out, &out_length, wk64_priv_data, wk64_priv_size);
-  free(wk64_priv_data);
-  wk64_priv_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_ENC_DATA,
-         strlen(KMYTH_DELIM_ENC_DATA));
-  concat(&out, &out_length, enc64_data, enc64_data_size);
-  free(enc64_data);
-  enc64_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_END_FILE,
-         strlen(KMYTH_DELIM_END_FILE));
+    kmyth_log(LOG_ERR, "unable to marshal data for ski file: 0x%08X ... "
+              "exiting", rc);
+    kmyth_free(out);
+    return 1;
+  }
+
+  memcpy(out, KMYTH_SKI_V2_MAGIC, KMYTH_SKI_V2_MAGIC_LEN);
+  put_be(out + 4, KMYTH_SKI_V2_VERSION, 2);
+  put_be(out + 6, n, 2);
+  put_be(out + 8, pos, 4);
+  put_be(out + 12, input.enc_data_size, 8);
+  memcpy(table + pos, input.enc_data, input.enc_data_size);
 
   *output = out;
-  *output_length = out_length;
+  *output_length = KMYTH_SKI_V2_HEADER_LEN + pos + input.enc_data_size;
 
   return 0;
 }
 
 void free_ski(Ski * ski)
 {
-  free(ski->enc_data);
+  if (!ski->enc_data_borrowed)
+  {
+    kmyth_free(ski->enc_data);
+  }
   ski->enc_data = NULL;
   ski->enc_data_size = 0;
+  ski->enc_data_borrowed = false;
 }
 
 Ski get_default_ski(void)
 {
   Ski ret = {
     .pcr_list = {.count = 0,},
-    .policyBranch1 = {.size = 0,},
-    .policyBranch2 = {.size = 0,},
+    .policyBranches = {.count = 0,},
+    .authorizing_key = {.size = 0,},
     .sk_priv = {.size = 0,},
     .cipher = {.cipher_name = NULL,},
+    .compression = KMYTH_COMPRESSION_NONE,
     .wk_pub = {.size = 0},
     .wk_priv = {.size = 0},
     .enc_data = NULL,
-    .enc_data_size = 0
+    .enc_data_size = 0,
+    .enc_data_borrowed = false
   };
   return (ret);
 
@@ -1267,15 +1880,17 @@ int unpack_digest(TPM2B_DIGEST * digest_out,
 //############################################################################
 int unpack_uint32_to_str(uint32_t uint_value, char **str_repr)
 {
-  if (asprintf(str_repr, "%c%c%c%c",
-               ((uint8_t *) & uint_value)[3],
-               ((uint8_t *) & uint_value)[2],
-               ((uint8_t *) & uint_value)[1],
-               ((uint8_t *) & uint_value)[0]) < 0)
+  *str_repr = kmyth_malloc(5);
+  if (*str_repr == NULL)
   {
     kmyth_log(LOG_ERR, "error unpacking uint32 to string ... exiting");
     return 1;
   }
+  for (int i = 0; i < 4; i++)
+  {
+    (*str_repr)[i] = (char) ((uint8_t *) & uint_value)[3 - i];
+  }
+  (*str_repr)[4] = '\0';
 
   return 0;
 }
@@ -10,7 +10,12 @@
 
 #include <string.h>
 
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <tss2/tss2_mu.h>
+
 #include "defines.h"
+#include "memory_util.h"
 #include "tpm2_interface.h"
 
 //############################################################################
@@ -845,10 +850,37 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                         SESSION * unsealObjectAuthSession,
                         TPM2_HANDLE object_handle,
                         TPM2B_AUTH object_auth,
-                        TPM2B_DIGEST policyBranch1,
-                        TPM2B_DIGEST policyBranch2,
+                        TPML_DIGEST policyBranches,
+                        POLICY_AUTHORIZATION * authorization,
                         TPML_PCR_SELECTION object_pcrList,
                         TPM2B_SENSITIVE_DATA * object_sensitive)
+{
+  ASYNC_UNSEAL pending;
+
+  if (unseal_kmyth_object_start(sapi_ctx,
+                                unsealObjectAuthSession,
+                                object_handle,
+                                object_auth,
+                                policyBranches, authorization,
+                                object_pcrList, &pending))
+  {
+    return 1;
+  }
+
+  return unseal_kmyth_object_finish(sapi_ctx, &pending, object_sensitive);
+}
+
+//############################################################################
+// unseal_kmyth_object_start()
+//############################################################################
+int unseal_kmyth_object_start(TSS2_SYS_CONTEXT * sapi_ctx,
+                              SESSION * unsealObjectAuthSession,
+                              TPM2_HANDLE object_handle,
+                              TPM2B_AUTH object_auth,
+                              TPML_DIGEST policyBranches,
+                              POLICY_AUTHORIZATION * authorization,
+                              TPML_PCR_SELECTION object_pcrList,
+                              ASYNC_UNSEAL * pending)
 {
   kmyth_log(LOG_DEBUG, "unsealing TPM object (handle = 0x%08X)", object_handle);
 
@@ -860,13 +892,17 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
   TSS2L_SYS_AUTH_COMMAND *nullCmdAuths = NULL;  // no auth for command
   TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL; // no auth, no rsp
 
-  // Declare command / response authorization structs used for object load
+  // Declare command authorization struct used for object unseal (the
+  // response authorization struct is kept in the pending command state)
   TSS2L_SYS_AUTH_COMMAND unsealObjectCmdAuths;
-  TSS2L_SYS_AUTH_RESPONSE unsealObjectRspAuths;
+
+  pending->session = unsealObjectAuthSession;
+  pending->object_handle = object_handle;
+  pending->object_auth.size = 0;
 
   // The TPM command code is used in the authorization hash computation
   // Initialize to invalid value, actual value obtained from sys-api context
-  TPM2_CC unseal_object_command_code = 0;
+  pending->command_code = 0;
 
   // Complete the steps to prepare the SAPI context for successful policy
   // authorization of the Tss2_Sys_Unseal() command. Unsealing a TPM object
@@ -880,7 +916,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
   // Apply policy to session context, in preparation for the "unseal" command
   if (unseal_apply_policy
       (sapi_ctx, unsealObjectAuthSession->sessionHandle, object_pcrList,
-       policyBranch1, policyBranch2))
+       policyBranches, authorization))
   {
     kmyth_log(LOG_ERR, "error applying policy to session context ... exiting");
     return 1;
@@ -950,7 +986,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
 
   // read command code
   rc = Tss2_Sys_GetCommandCode(sapi_ctx,
-                               (uint8_t *) & unseal_object_command_code);
+                               (uint8_t *) & pending->command_code);
   if (rc != TSS2_RC_SUCCESS)
   {
     kmyth_log(LOG_ERR, "Tss2_Sys_GetCommandCode(): rc = 0x%08X, %s ... exiting",
@@ -960,13 +996,13 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
 
   // prepare command and response authorization structures
   if (init_policy_cmd_auth(unsealObjectAuthSession,
-                           unseal_object_command_code,
+                           pending->command_code,
                            object_name,
                            object_auth,
                            cmdParams,
                            cmdParams_size,
                            object_pcrList,
-                           &unsealObjectCmdAuths, &unsealObjectRspAuths))
+                           &unsealObjectCmdAuths, &pending->rspAuths))
   {
     kmyth_log(LOG_ERR, "error preparing Tss2_Sys_Unseal() auth ... exiting");
     return 1;
@@ -982,17 +1018,61 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
-  // Unseal the object
-  kmyth_log(LOG_DEBUG, "unsealing TPM object ...");
-  rc = Tss2_Sys_Unseal(sapi_ctx, object_handle, &unsealObjectCmdAuths,
-                       object_sensitive, &unsealObjectRspAuths);
+  // Submit the unseal command - the response is collected (and checked)
+  // by unseal_kmyth_object_finish(), so the caller can overlap other work
+  // with the TPM's processing of the command
+  kmyth_log(LOG_DEBUG, "submitting TPM object unseal ...");
+  pending->object_auth = object_auth;
+  rc = Tss2_Sys_ExecuteAsync(sapi_ctx);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_ExecuteAsync(): rc = 0x%08X, %s ... exiting",
+              rc, getErrorString(rc));
+    kmyth_clear(pending->object_auth.buffer, pending->object_auth.size);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unseal_kmyth_object_finish()
+//############################################################################
+int unseal_kmyth_object_finish(TSS2_SYS_CONTEXT * sapi_ctx,
+                               ASYNC_UNSEAL * pending,
+                               TPM2B_SENSITIVE_DATA * object_sensitive)
+{
+  // wait for the TPM to finish the unseal submitted earlier
+  TSS2_RC rc = Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_ExecuteFinish(): rc = 0x%08X, %s ... exiting",
+              rc, getErrorString(rc));
+    kmyth_clear(pending->object_auth.buffer, pending->object_auth.size);
+    return 1;
+  }
+
+  rc = Tss2_Sys_GetRspAuths(sapi_ctx, &pending->rspAuths);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_Unseal(): rc = 0x%08X, %s ... exiting",
+    kmyth_log(LOG_ERR, "Tss2_Sys_GetRspAuths(): rc = 0x%08X, %s ... exiting",
               rc, getErrorString(rc));
+    kmyth_clear(pending->object_auth.buffer, pending->object_auth.size);
     return 1;
   }
 
+  rc = Tss2_Sys_Unseal_Complete(sapi_ctx, object_sensitive);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_Unseal_Complete(): rc = 0x%08X, %s ... exiting",
+              rc, getErrorString(rc));
+    kmyth_clear(pending->object_auth.buffer, pending->object_auth.size);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "unsealed TPM object (handle = 0x%08X)",
+            pending->object_handle);
+
   // The TPM response parameters buffer is contained in the sys-api context
   // These stack based variables are assigned as a pointer to that buffer
   // and the length of that buffer, and do not need to be freed (the buffer
@@ -1007,14 +1087,20 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
   {
     kmyth_log(LOG_ERR, "Tss2_Sys_GetRpBuffer(): rc = 0x%08X, %s ... exiting",
               rc, getErrorString(rc));
+    kmyth_clear(pending->object_auth.buffer, pending->object_auth.size);
     return 1;
   }
 
   // check HMAC in response authorization structure
-  if (check_response_auth(unsealObjectAuthSession,
-                          unseal_object_command_code,
-                          rspParams,
-                          rspParams_size, object_auth, &unsealObjectRspAuths))
+  int auth_check = check_response_auth(pending->session,
+                                       pending->command_code,
+                                       rspParams,
+                                       rspParams_size,
+                                       pending->object_auth,
+                                       &pending->rspAuths);
+
+  kmyth_clear(pending->object_auth.buffer, pending->object_auth.size);
+  if (auth_check)
   {
     kmyth_log(LOG_ERR, "response auth check failed ... exiting");
     return 1;
@@ -1023,3 +1109,55 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
 
   return 0;
 }
+
+//############################################################################
+// compute_kmyth_object_name()
+//############################################################################
+int compute_kmyth_object_name(TPM2B_PUBLIC * object_public,
+                              TPM2B_NAME * object_name)
+{
+  if (object_public == NULL || object_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+  object_name->size = 0;
+
+  // Kmyth objects are always created with KMYTH_HASH_ALG as the nameAlg
+  if (object_public->publicArea.nameAlg != KMYTH_HASH_ALG)
+  {
+    kmyth_log(LOG_ERR, "unsupported object nameAlg (0x%04X) ... exiting",
+              object_public->publicArea.nameAlg);
+    return 1;
+  }
+
+  uint8_t public_bytes[sizeof(TPMT_PUBLIC)];
+  size_t public_size = 0;
+  TSS2_RC rc = Tss2_MU_TPMT_PUBLIC_Marshal(&(object_public->publicArea),
+                                           public_bytes,
+                                           sizeof(public_bytes),
+                                           &public_size);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_MU_TPMT_PUBLIC_Marshal(): rc = 0x%08X, %s",
+              rc, getErrorString(rc));
+    return 1;
+  }
+
+  // name = nameAlg (big-endian) || H_nameAlg(marshalled public area)
+  uint16_t name_alg = htons(KMYTH_HASH_ALG);
+  unsigned int digest_size = 0;
+
+  memcpy(object_name->name, &name_alg, sizeof(name_alg));
+  if (!EVP_Digest(public_bytes, public_size,
+                  object_name->name + sizeof(name_alg), &digest_size,
+                  KMYTH_OPENSSL_HASH, NULL))
+  {
+    kmyth_log(LOG_ERR, "error computing object name digest ... exiting");
+    return 1;
+  }
+  object_name->size = (uint16_t) (sizeof(name_alg) + digest_size);
+
+  return 0;
+}
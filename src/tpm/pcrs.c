@@ -26,12 +26,27 @@ int init_pcr_selection(TSS2_SYS_CONTEXT * sapi_ctx,
   // Get the total number of PCRs from the TPM
   int numPCRs = -1;
 
-  if (get_pcr_count(sapi_ctx, &numPCRs) || numPCRs < 0 || numPCRs > UINT8_MAX)
+  if (get_pcr_count(sapi_ctx, &numPCRs))
   {
     kmyth_log(LOG_ERR, "unable to retrieve PCR count ... exiting");
     return 1;
   }
 
+  return build_pcr_selection(numPCRs, pcrs, pcrs_len, pcrs_struct);
+}
+
+//############################################################################
+// build_pcr_selection()
+//############################################################################
+int build_pcr_selection(int numPCRs, int *pcrs, size_t pcrs_len,
+                        TPML_PCR_SELECTION * pcrs_struct)
+{
+  if (numPCRs < 0 || numPCRs > UINT8_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid PCR count (%d) ... exiting", numPCRs);
+    return 1;
+  }
+
   // initialize pcrs_struct to a "no PCRs selected" state
   // One set of PCR registers for our TPM
   // Each selection "mask" is 8 bits)
@@ -87,18 +102,408 @@ int init_pcr_selection(TSS2_SYS_CONTEXT * sapi_ctx,
 //############################################################################
 int get_pcr_count(TSS2_SYS_CONTEXT * sapi_ctx, int *pcrCount)
 {
-  // query TPM 2.0 to obtain the count of available PCRs
-  TPMS_CAPABILITY_DATA capData;
+  // obtain the count of available PCRs (a fixed property, so it is only
+  // queried from the TPM once per connection)
+  uint32_t count = 0;
 
-  if (get_tpm2_properties
-      (sapi_ctx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_PCR_COUNT, TPM2_PT_GROUP,
-       &capData))
+  if (get_tpm2_fixed_property(sapi_ctx, TPM2_PT_PCR_COUNT, &count))
   {
     kmyth_log(LOG_ERR, "error obtaining PCR count from TPM ... exiting");
     return 1;
   }
-  *pcrCount = (int) capData.data.tpmProperties.tpmProperty[0].value;
+  *pcrCount = (int) count;
   kmyth_log(LOG_DEBUG, "count of available PCRs (TPM2_PT_PCR_COUNT) = %d",
             *pcrCount);
   return 0;
 }
+
+//############################################################################
+// pcr_selection_empty()
+//############################################################################
+/**
+ * @brief Checks whether a PCR selection selects no PCR at all.
+ *
+ * @return true if no PCR is selected
+ */
+static bool pcr_selection_empty(const TPML_PCR_SELECTION * pcrList)
+{
+  for (uint32_t i = 0; i < pcrList->count; i++)
+  {
+    for (int j = 0; j < pcrList->pcrSelections[i].sizeofSelect; j++)
+    {
+      if (pcrList->pcrSelections[i].pcrSelect[j] != 0)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//############################################################################
+// read_pcr_values()
+//############################################################################
+/**
+ * @brief Reads the values of the selected PCRs into a snapshot (without
+ *        its digest), one TPM2_PCR_Read per TPML_DIGEST worth of values.
+ *
+ * @return 0 on success, 1 on error, 2 if the PCR update counter moved
+ *         between two reads (the values may then not belong together)
+ */
+static int read_pcr_values(TSS2_SYS_CONTEXT * sapi_ctx,
+                           TPML_PCR_SELECTION * pcrList,
+                           kmyth_pcr_snapshot_t * snapshot)
+{
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+
+  // The TPM returns at most a TPML_DIGEST worth of PCR values per read, in
+  // selection order, so keep reading (and removing the PCRs returned from
+  // the remaining selection) until every selected PCR has been read.
+  TPML_PCR_SELECTION remaining = *pcrList;
+  bool first = true;
+
+  snapshot->count = 0;
+  while (!pcr_selection_empty(&remaining))
+  {
+    uint32_t pcrUpdateCounter = 0;
+    TPML_PCR_SELECTION pcrsRead = {.count = 0, };
+    TPML_DIGEST pcrValues = {.count = 0, };
+    TSS2_RC rc = Tss2_Sys_PCR_Read(sapi_ctx, nullCmdAuths, &remaining,
+                                   &pcrUpdateCounter, &pcrsRead, &pcrValues,
+                                   nullRspAuths);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "Tss2_Sys_PCR_Read(): rc = 0x%08X, %s ... exiting",
+                rc, getErrorString(rc));
+      return 1;
+    }
+
+    // a response returning nothing would otherwise loop forever
+    if (pcrValues.count == 0)
+    {
+      kmyth_log(LOG_ERR, "TPM returned no PCR values ... exiting");
+      return 1;
+    }
+
+    if (first)
+    {
+      snapshot->pcrUpdateCounter = pcrUpdateCounter;
+      first = false;
+    }
+    else if (pcrUpdateCounter != snapshot->pcrUpdateCounter)
+    {
+      return 2;
+    }
+
+    if (pcrValues.count > KMYTH_PCR_SNAPSHOT_MAX_VALUES - snapshot->count)
+    {
+      kmyth_log(LOG_ERR, "more than %d PCRs selected ... exiting",
+                KMYTH_PCR_SNAPSHOT_MAX_VALUES);
+      return 1;
+    }
+    for (uint32_t i = 0; i < pcrValues.count; i++)
+    {
+      snapshot->values[snapshot->count++] = pcrValues.digests[i];
+    }
+
+    for (uint32_t i = 0; i < pcrsRead.count; i++)
+    {
+      for (uint32_t k = 0; k < remaining.count; k++)
+      {
+        if (remaining.pcrSelections[k].hash != pcrsRead.pcrSelections[i].hash)
+        {
+          continue;
+        }
+        for (int j = 0; j < pcrsRead.pcrSelections[i].sizeofSelect &&
+             j < remaining.pcrSelections[k].sizeofSelect; j++)
+        {
+          remaining.pcrSelections[k].pcrSelect[j] &=
+            (uint8_t) ~ pcrsRead.pcrSelections[i].pcrSelect[j];
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// hash_pcr_values()
+//############################################################################
+/**
+ * @brief Computes the digest of the values of a snapshot, in order.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int hash_pcr_values(kmyth_pcr_snapshot_t * snapshot)
+{
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  unsigned int digest_size = KMYTH_DIGEST_SIZE;
+  int retval = (md_ctx == NULL) ||
+    !EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL);
+
+  for (uint32_t i = 0; retval == 0 && i < snapshot->count; i++)
+  {
+    retval = !EVP_DigestUpdate(md_ctx, snapshot->values[i].buffer,
+                               snapshot->values[i].size);
+  }
+  if (retval == 0 &&
+      !EVP_DigestFinal_ex(md_ctx, snapshot->digest.buffer, &digest_size))
+  {
+    retval = 1;
+  }
+  EVP_MD_CTX_destroy(md_ctx);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error hashing PCR values ... exiting");
+    return 1;
+  }
+  snapshot->digest.size = (uint16_t) digest_size;
+  return 0;
+}
+
+//############################################################################
+// get_pcr_digest()
+//############################################################################
+int get_pcr_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                   TPML_PCR_SELECTION pcrList, TPM2B_DIGEST * pcrDigest)
+{
+  if (pcrDigest == NULL)
+  {
+    kmyth_log(LOG_ERR, "no buffer available to store digest ... exiting");
+    return 1;
+  }
+
+  kmyth_pcr_snapshot_t snapshot;
+
+  if (kmyth_pcr_snapshot(sapi_ctx, pcrList, &snapshot))
+  {
+    return 1;
+  }
+  *pcrDigest = snapshot.digest;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_snapshot()
+//############################################################################
+int kmyth_pcr_snapshot(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPML_PCR_SELECTION pcrList,
+                       kmyth_pcr_snapshot_t * snapshot)
+{
+  if (snapshot == NULL)
+  {
+    kmyth_log(LOG_ERR, "no PCR snapshot provided ... exiting");
+    return 1;
+  }
+
+  memset(snapshot, 0, sizeof(kmyth_pcr_snapshot_t));
+  snapshot->pcrList = pcrList;
+
+  int retval = 2;
+
+  for (int attempt = 0; retval == 2 && attempt < MAX_RETRIES; attempt++)
+  {
+    retval = read_pcr_values(sapi_ctx, &pcrList, snapshot);
+    if (retval == 2)
+    {
+      kmyth_log(LOG_DEBUG, "PCRs updated while being read, reading again");
+    }
+  }
+  if (retval == 2)
+  {
+    kmyth_log(LOG_ERR, "PCRs kept changing while being read ... exiting");
+  }
+  if (retval != 0 || hash_pcr_values(snapshot))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// check_uncounted_pcrs()
+//############################################################################
+/**
+ * @brief Finds out whether a snapshot's selection holds a PCR whose
+ *        updates the TPM's PCR update counter does not count
+ *        (TPM2_PT_PCR_NO_INCREMENT).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int check_uncounted_pcrs(TSS2_SYS_CONTEXT * sapi_ctx,
+                                kmyth_pcr_snapshot_t * snapshot)
+{
+  TPMS_CAPABILITY_DATA capData;
+
+  if (get_tpm2_properties(sapi_ctx, TPM2_CAP_PCR_PROPERTIES,
+                          TPM2_PT_PCR_NO_INCREMENT, 1, &capData))
+  {
+    kmyth_log(LOG_ERR, "unable to get PCR properties ... exiting");
+    return 1;
+  }
+
+  TPML_TAGGED_PCR_PROPERTY *props = &(capData.data.pcrProperties);
+
+  snapshot->uncounted = false;
+  for (uint32_t i = 0; i < props->count; i++)
+  {
+    TPMS_TAGGED_PCR_SELECT *prop = &(props->pcrProperty[i]);
+
+    if (prop->tag != TPM2_PT_PCR_NO_INCREMENT)
+    {
+      continue;
+    }
+
+    // the property applies to the PCR index in every bank
+    for (uint32_t k = 0; k < snapshot->pcrList.count; k++)
+    {
+      TPMS_PCR_SELECTION *sel = &(snapshot->pcrList.pcrSelections[k]);
+
+      for (int j = 0; j < sel->sizeofSelect && j < prop->sizeofSelect; j++)
+      {
+        if (sel->pcrSelect[j] & prop->pcrSelect[j])
+        {
+          snapshot->uncounted = true;
+        }
+      }
+    }
+  }
+  snapshot->uncounted_checked = true;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_snapshot_refresh()
+//############################################################################
+int kmyth_pcr_snapshot_refresh(TSS2_SYS_CONTEXT * sapi_ctx,
+                               kmyth_pcr_snapshot_t * snapshot,
+                               bool *changed)
+{
+  if (snapshot == NULL || changed == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+
+  // nothing selected, nothing to change
+  *changed = false;
+  if (pcr_selection_empty(&(snapshot->pcrList)))
+  {
+    return 0;
+  }
+
+  if (!snapshot->uncounted_checked &&
+      check_uncounted_pcrs(sapi_ctx, snapshot))
+  {
+    return 1;
+  }
+
+  // reading an empty selection only returns the update counter
+  if (!snapshot->uncounted)
+  {
+    TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+    TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+    TPML_PCR_SELECTION none = {.count = 0, };
+    uint32_t pcrUpdateCounter = 0;
+    TPML_PCR_SELECTION pcrsRead = {.count = 0, };
+    TPML_DIGEST pcrValues = {.count = 0, };
+    TSS2_RC rc = Tss2_Sys_PCR_Read(sapi_ctx, nullCmdAuths, &none,
+                                   &pcrUpdateCounter, &pcrsRead, &pcrValues,
+                                   nullRspAuths);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "Tss2_Sys_PCR_Read(): rc = 0x%08X, %s ... exiting",
+                rc, getErrorString(rc));
+      return 1;
+    }
+    if (pcrUpdateCounter == snapshot->pcrUpdateCounter)
+    {
+      return 0;
+    }
+  }
+
+  // some PCR was updated (maybe not one of these) - compare the values
+  kmyth_pcr_snapshot_t fresh;
+
+  if (kmyth_pcr_snapshot(sapi_ctx, snapshot->pcrList, &fresh))
+  {
+    return 1;
+  }
+  *changed = (fresh.digest.size != snapshot->digest.size ||
+              memcmp(fresh.digest.buffer, snapshot->digest.buffer,
+                     fresh.digest.size) != 0);
+  fresh.uncounted_checked = true;
+  fresh.uncounted = snapshot->uncounted;
+  *snapshot = fresh;
+
+  return 0;
+}
+
+//############################################################################
+// compute_pcr_digest()
+//############################################################################
+int compute_pcr_digest(uint8_t * pcr_values, size_t pcr_values_len,
+                       TPM2B_DIGEST * pcrDigest)
+{
+  if (pcrDigest == NULL || (pcr_values == NULL && pcr_values_len > 0))
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+  if (pcr_values_len % KMYTH_DIGEST_SIZE != 0)
+  {
+    kmyth_log(LOG_ERR, "PCR values length (%zu) not a multiple of %d bytes",
+              pcr_values_len, KMYTH_DIGEST_SIZE);
+    return 1;
+  }
+
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  unsigned int digest_size = KMYTH_DIGEST_SIZE;
+
+  if (md_ctx == NULL ||
+      !EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL) ||
+      (pcr_values_len > 0 &&
+       !EVP_DigestUpdate(md_ctx, pcr_values, pcr_values_len)) ||
+      !EVP_DigestFinal_ex(md_ctx, pcrDigest->buffer, &digest_size))
+  {
+    kmyth_log(LOG_ERR, "error hashing PCR values ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+  EVP_MD_CTX_destroy(md_ctx);
+  pcrDigest->size = (uint16_t) digest_size;
+
+  return 0;
+}
+
+//############################################################################
+// pcr_selection_equal()
+//############################################################################
+bool pcr_selection_equal(TPML_PCR_SELECTION * a, TPML_PCR_SELECTION * b)
+{
+  if (a->count != b->count)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < a->count; i++)
+  {
+    TPMS_PCR_SELECTION *sa = &(a->pcrSelections[i]);
+    TPMS_PCR_SELECTION *sb = &(b->pcrSelections[i]);
+
+    if ((sa->hash != sb->hash) || (sa->sizeofSelect != sb->sizeofSelect) ||
+        (memcmp(sa->pcrSelect, sb->pcrSelect, sa->sizeofSelect) != 0))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -8,15 +8,279 @@
 
 #include "storage_key_tools.h"
 
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <arpa/inet.h>
 #include <openssl/evp.h>
 
 #include "defines.h"
+#include "memory_util.h"
+#include "metrics.h"
 #include "object_tools.h"
 #include "tpm2_interface.h"
 
+/*
+ * Process-level cache of the verified SRK handle (zero means "not cached")
+ */
+static TPM2_HANDLE srk_handle_cache = 0;
+
+/*
+ * Guards srk_handle_cache, which Kmyth contexts used from different threads
+ * share. Lookups are still validated against each TPM (check_if_srk()).
+ */
+static pthread_mutex_t srk_handle_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Path of the optional SRK handle hint file. Until set_srk_hint_path() is
+ * called, the KMYTH_SRK_HINT_ENV environment variable is consulted.
+ */
+static char *srk_hint_path = NULL;
+static bool srk_hint_path_set = false;
+
+/*
+ * Public key algorithm used for newly created storage keys (see set_sk_alg())
+ */
+static TPMI_ALG_PUBLIC sk_alg_selected = KMYTH_KEY_PUBKEY_ALG;
+
+/*
+ * Whether reseals keep storage keys where possible (see set_sk_reuse())
+ */
+static bool sk_reuse_enabled = false;
+
+//############################################################################
+// store_srk_handle_cache()
+//############################################################################
+static void store_srk_handle_cache(TPM2_HANDLE srk_handle)
+{
+  pthread_mutex_lock(&srk_handle_cache_lock);
+  srk_handle_cache = srk_handle;
+  pthread_mutex_unlock(&srk_handle_cache_lock);
+}
+
+//############################################################################
+// get_srk_hint_path()
+//############################################################################
+static const char *get_srk_hint_path(void)
+{
+  if (srk_hint_path_set)
+  {
+    return srk_hint_path;
+  }
+  return getenv(KMYTH_SRK_HINT_ENV);
+}
+
+//############################################################################
+// set_srk_hint_path()
+//############################################################################
+int set_srk_hint_path(const char *path)
+{
+  kmyth_free(srk_hint_path);
+  srk_hint_path = NULL;
+  srk_hint_path_set = true;
+
+  if (path == NULL)
+  {
+    return 0;
+  }
+
+  srk_hint_path = kmyth_strdup(path);
+  if (srk_hint_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to copy SRK hint file path ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// set_sk_alg()
+//############################################################################
+int set_sk_alg(const char *alg_name)
+{
+  if (alg_name == NULL)
+  {
+    sk_alg_selected = KMYTH_KEY_PUBKEY_ALG;
+    return 0;
+  }
+
+  if (strcmp(alg_name, "rsa") == 0)
+  {
+    sk_alg_selected = TPM2_ALG_RSA;
+  }
+  else if (strcmp(alg_name, "ecc") == 0)
+  {
+    sk_alg_selected = TPM2_ALG_ECC;
+  }
+  else
+  {
+    kmyth_log(LOG_ERR, "invalid storage key algorithm (%s) ... exiting",
+              alg_name);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// get_sk_alg()
+//############################################################################
+TPMI_ALG_PUBLIC get_sk_alg(void)
+{
+  return sk_alg_selected;
+}
+
+//############################################################################
+// set_sk_reuse()
+//############################################################################
+void set_sk_reuse(bool enable)
+{
+  sk_reuse_enabled = enable;
+}
+
+//############################################################################
+// get_sk_reuse()
+//############################################################################
+bool get_sk_reuse(void)
+{
+  return sk_reuse_enabled;
+}
+
+//############################################################################
+// read_srk_hint_file()
+//############################################################################
+static TPM2_HANDLE read_srk_hint_file(void)
+{
+  const char *path = get_srk_hint_path();
+
+  if (path == NULL)
+  {
+    return 0;
+  }
+
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL)
+  {
+    kmyth_log(LOG_DEBUG, "no SRK hint file found at %s", path);
+    return 0;
+  }
+
+  unsigned int hint = 0;
+
+  if (fscanf(file, "%x", &hint) != 1)
+  {
+    hint = 0;
+  }
+  fclose(file);
+
+  // only a handle in the persistent range is a plausible SRK hint
+  if ((hint < TPM2_PERSISTENT_FIRST) || (hint > TPM2_PERSISTENT_LAST))
+  {
+    kmyth_log(LOG_DEBUG, "ignoring invalid SRK hint in %s", path);
+    return 0;
+  }
+
+  return (TPM2_HANDLE) hint;
+}
+
+//############################################################################
+// get_cached_srk_handle()
+//############################################################################
+int get_cached_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPM2_HANDLE * srk_handle)
+{
+  *srk_handle = 0;
+
+  if (sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "SAPI context not initialized ... exiting");
+    return 1;
+  }
+
+  pthread_mutex_lock(&srk_handle_cache_lock);
+  TPM2_HANDLE candidate = srk_handle_cache;
+
+  pthread_mutex_unlock(&srk_handle_cache_lock);
+
+  if (candidate == 0)
+  {
+    candidate = read_srk_hint_file();
+  }
+  if (candidate == 0)
+  {
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SRK, 0);
+    return 0;
+  }
+
+  // A single ReadPublic confirms the candidate still references the SRK.
+  // If the handle was evicted or re-used, check_if_srk() either fails or
+  // reports a mismatch - both are treated as a cache miss.
+  bool isSRK = false;
+
+  if (check_if_srk(sapi_ctx, candidate, &isSRK) || !isSRK)
+  {
+    kmyth_log(LOG_DEBUG, "cached SRK handle (0x%08X) is stale", candidate);
+    store_srk_handle_cache(0);
+    kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SRK, 0);
+    return 0;
+  }
+
+  store_srk_handle_cache(candidate);
+  *srk_handle = candidate;
+  kmyth_log(LOG_DEBUG, "using cached SRK handle (0x%08X)", candidate);
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SRK, 1);
+
+  return 0;
+}
+
+//############################################################################
+// set_cached_srk_handle()
+//############################################################################
+int set_cached_srk_handle(TPM2_HANDLE srk_handle)
+{
+  store_srk_handle_cache(srk_handle);
+
+  const char *path = get_srk_hint_path();
+
+  if (path == NULL || srk_handle == 0)
+  {
+    return 0;
+  }
+
+  FILE *file = fopen(path, "w");
+
+  if (file == NULL)
+  {
+    kmyth_log(LOG_WARNING, "unable to write SRK hint file %s", path);
+    return 1;
+  }
+  if (fprintf(file, "0x%08X\n", srk_handle) < 0)
+  {
+    kmyth_log(LOG_WARNING, "error writing SRK hint file %s", path);
+    fclose(file);
+    return 1;
+  }
+  if (fclose(file))
+  {
+    kmyth_log(LOG_WARNING, "error closing SRK hint file %s", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// clear_cached_srk_handle()
+//############################################################################
+void clear_cached_srk_handle(void)
+{
+  store_srk_handle_cache(0);
+}
+
 //############################################################################
 // get_srk_handle()
 //############################################################################
@@ -24,6 +288,18 @@ int get_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
                    TPM2_HANDLE * srk_handle,
                    TPM2B_AUTH * storage_hierarchy_auth)
 {
+  // Try the cached (or hinted) SRK handle first - when it is still valid
+  // this costs a single ReadPublic instead of a full persistent handle scan
+  if (get_cached_srk_handle(sapi_ctx, srk_handle))
+  {
+    kmyth_log(LOG_ERR, "error checking cached SRK handle ... exiting");
+    return 1;
+  }
+  if (*srk_handle != 0)
+  {
+    return 0;
+  }
+
   // Get the list of objects in TPM persistent storage and check them all
   // against the SRK criteria. Upon return from get_existing_srk_handle(),
   // the srk_handle parameter passed to get_existing_srk_handle() is either
@@ -54,6 +330,10 @@ int get_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
     }
   }
 
+  // Remember the handle so subsequent lookups can skip the scan (failure to
+  // write the optional hint file is logged, but is not fatal)
+  set_cached_srk_handle(*srk_handle);
+
   return 0;
 }
 
@@ -492,9 +772,17 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
                        TPM2B_AUTH sk_authVal,
                        TPML_PCR_SELECTION sk_pcrList,
                        TPM2B_DIGEST sk_authPolicy,
+                       TPMI_ALG_PUBLIC sk_alg,
                        TPM2_HANDLE * sk_handle,
                        TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public)
 {
+  if (sk_alg != TPM2_ALG_RSA && sk_alg != TPM2_ALG_ECC)
+  {
+    kmyth_log(LOG_ERR, "unsupported SK algorithm (0x%04X) ... exiting",
+              sk_alg);
+    return 1;
+  }
+
   // Create and set up sensitive data input for new storage key object:
   //   - The authVal (hash of user specified authorization string or default
   //     all-zero hash) is passed into this function by the caller
@@ -524,6 +812,20 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
+  // The default key template uses KMYTH_KEY_PUBKEY_ALG (shared with the
+  // SRK). Rework the algorithm-specific fields if another type was requested.
+  if (sk_template.publicArea.type != sk_alg)
+  {
+    sk_template.publicArea.type = sk_alg;
+    if (init_kmyth_object_parameters(sk_alg,
+                                     &(sk_template.publicArea.parameters)) ||
+        init_kmyth_object_unique(sk_alg, &(sk_template.publicArea.unique)))
+    {
+      kmyth_log(LOG_ERR, "SK template algorithm error ... exiting");
+      return 1;
+    }
+  }
+
   // Create new storage key
   SESSION *nullSession = NULL;  // SRK (parent) auth is not policy based
   TPM2_HANDLE unusedHandle = 0; // creating SK, not loading
@@ -7,17 +7,31 @@
 
 #include "tpm2_interface.h"
 
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <arpa/inet.h>
+#include <sys/file.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <openssl/rand.h>
 
+#include <tss2/tss2_mu.h>
 #include <tss2/tss2_rc.h>
-#include <tss2/tss2-tcti-tabrmd.h>
 
 #include "defines.h"
+#include "kmyth_usdt.h"
+#include "memory_util.h"
+#include "metrics.h"
+#include "tpm/kmyth_mock_tpm.h"
 #include "tpm/marshalling_tools.h"
 
 /*
@@ -30,128 +44,1485 @@ const char *simulator_manufacturers[] = { "IBM",  // https://sourceforge.net/pro
   NULL
 };
 
+/**
+ * @brief Signature shared by the Tss2_Tcti_*_Init() functions
+ */
+typedef TSS2_RC(*tcti_init_fn) (TSS2_TCTI_CONTEXT *, size_t *, const char *);
+
+/**
+ * @brief A TCTI that can be selected by name with set_tcti_spec(). The
+ *        tss2 TCTI libraries are not linked in: each is loaded (dlopen) the
+ *        first time its TCTI is initialized, so that a process which never
+ *        talks to a TPM (e.g., a CLI run with -h) does not pay for loading
+ *        them, or for the D-Bus and GLib libraries tpm2-abrmd pulls in.
+ */
+typedef struct
+{
+  const char *name;
+
+  // shared library and initialization function (NULL library: built in)
+  const char *library;
+  const char *symbol;
+  tcti_init_fn init;
+} tcti_option;
+
+/**
+ * @brief TCTIs selectable by name ("auto" is handled separately). Note that
+ *        the list must be NULL terminated. The mock TPM is not part of the
+ *        library: only the programs it is linked into (kmyth-test and
+ *        kmyth-bench) can select it, once they have registered it with
+ *        register_tcti_init().
+ */
+static const tcti_option tcti_options[] = {
+  {"device", "libtss2-tcti-device.so.0", "Tss2_Tcti_Device_Init", NULL},
+  {"abrmd", "libtss2-tcti-tabrmd.so.0", "Tss2_Tcti_Tabrmd_Init", NULL},
+  {"mssim", "libtss2-tcti-mssim.so.0", "Tss2_Tcti_Mssim_Init", NULL},
+  {"swtpm", "libtss2-tcti-swtpm.so.0", "Tss2_Tcti_Swtpm_Init", NULL},
+  {KMYTH_MOCK_TCTI_NAME, NULL, NULL, NULL},
+  {NULL, NULL, NULL, NULL}
+};
+
+/**
+ * @brief Initialization functions of the TCTI libraries loaded so far, and
+ *        of the TCTIs registered with register_tcti_init() (in the order of
+ *        tcti_options), guarded by tcti_load_lock. A library, once loaded,
+ *        stays loaded for the life of the process.
+ */
+static tcti_init_fn tcti_loaded[sizeof(tcti_options) / sizeof(tcti_options[0])];
+static pthread_mutex_t tcti_load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief TCTI specification set by set_tcti_spec() (NULL if not set)
+ */
+static char *tcti_spec_override = NULL;
+
+/**
+ * @brief Guards tcti_spec_override, which connections opened on other
+ *        threads read while set_tcti_spec() may replace it
+ */
+static pthread_mutex_t tcti_spec_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Number of TPM 2.0 command codes that statistics are kept for
+ */
+#define KMYTH_TPM_STATS_CC_COUNT (TPM2_CC_LAST - TPM2_CC_FIRST + 1)
+
+/**
+ * @brief Magic value identifying the statistics TCTI layer
+ */
+#define KMYTH_STATS_TCTI_MAGIC 0x6B6D797468535453ULL
+
+/**
+ * @brief Thread waiting for its turn in a TPM submission queue
+ */
+typedef struct tpm_waiter
+{
+  struct tpm_waiter *next;
+
+  // when the thread started waiting
+  struct timespec since;
+
+  // set (and signalled) when the thread is handed the turn
+  pthread_cond_t handed;
+  bool granted;
+} tpm_waiter;
+
+/**
+ * @brief Submission queue of one TPM. Connections opened (in any thread)
+ *        with the same TCTI specification take turns to have a command in
+ *        flight, so that TPM commands are serialized while the rest of
+ *        each operation (cipher, encoding, file I/O) runs in parallel on
+ *        the calling threads. Waiting commands are served by scheduling
+ *        class (see kmyth_tpm_priority), in arrival order within a class.
+ */
+typedef struct tpm_queue
+{
+  struct tpm_queue *next;
+
+  // resolved TCTI specification identifying the TPM
+  char *tcti_spec;
+
+  // whether a connection has the turn, and who waits for it, per class
+  pthread_mutex_t lock;
+  bool busy;
+  tpm_waiter *head[KMYTH_TPM_PRIORITY_COUNT];
+
+  // lock file shared with the other processes using this TPM (-1 if not
+  // available): the turn holder keeps a shared lock on it through gate_fd
+  // unless its command is bulk, and bulk commands wait until an exclusive
+  // lock could be taken through probe_fd (see wait_tpm_gate())
+  int gate_fd;
+  int probe_fd;
+  bool gate_held;
+} tpm_queue;
+
+/**
+ * @brief Queues of the TPMs connected to so far (kept for the life of the
+ *        process)
+ */
+static tpm_queue *tpm_queues = NULL;
+
+/**
+ * @brief Guards the tpm_queues list
+ */
+static pthread_mutex_t tpm_queues_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Scheduling class chosen with set_tpm_priority() by the calling
+ *        thread (-1 if it has not chosen one)
+ */
+static __thread int tpm_thread_priority = -1;
+
+/**
+ * @brief Scheduling class set by set_default_tpm_priority() (-1 if not set)
+ */
+static int tpm_default_priority = -1;
+
+/**
+ * @brief Longest wait behind more urgent commands, in milliseconds, per
+ *        scheduling class (0 for no bound)
+ */
+static unsigned int tpm_max_wait_ms[KMYTH_TPM_PRIORITY_COUNT] = {
+  0, KMYTH_DEFAULT_NORMAL_MAX_WAIT_MS, KMYTH_DEFAULT_BULK_MAX_WAIT_MS
+};
+
+/**
+ * @brief Names of the scheduling classes, indexed by kmyth_tpm_priority
+ */
+static const char *tpm_priority_names[KMYTH_TPM_PRIORITY_COUNT] = {
+  "interactive", "normal", "bulk"
+};
+
+/**
+ * @brief How often a bulk command checks whether other processes still
+ *        have TPM work, and how long they must have had none before it
+ *        goes ahead (bridging the gap between their consecutive commands)
+ */
+#define KMYTH_TPM_GATE_POLL_MS 1
+#define KMYTH_TPM_GATE_QUIET_MS 5
+
+/**
+ * @brief TCTI layer installed by init_tpm2_connection(). It forwards every
+ *        call to the TCTI it wraps, holding the TPM's turn in its
+ *        submission queue from each command to its response, counting
+ *        failed commands by response code (see metrics.h) and, while
+ *        statistics are enabled (see set_tpm_stats()), timing each
+ *        command/response pair on the way.
+ */
+typedef struct
+{
+  // common TCTI header - must come first
+  TSS2_TCTI_CONTEXT_COMMON_V2 common;
+
+  // TCTI actually used to talk to the TPM (owned by this layer)
+  TSS2_TCTI_CONTEXT *inner;
+
+  // submission queue of the TPM, and whether this connection has the turn
+  tpm_queue *queue;
+  bool has_turn;
+
+  // whether this connection keeps per-command latency statistics
+  bool timed;
+
+  // command in flight (transmitted, response not yet received)
+  TPM2_CC pending_cc;
+  bool pending;
+  struct timespec start;
+} stats_tcti_ctx;
+
+/**
+ * @brief Whether new connections are instrumented (see set_tpm_stats())
+ */
+static bool tpm_stats_enabled = false;
+
+/**
+ * @brief Collected statistics, indexed by (command code - TPM2_CC_FIRST)
+ */
+static kmyth_tpm_cmd_stats tpm_stats[KMYTH_TPM_STATS_CC_COUNT];
+
+/**
+ * @brief Guards tpm_stats, which instrumented connections in different
+ *        threads update concurrently
+ */
+static pthread_mutex_t tpm_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Names of the TPM commands Kmyth issues, for print_tpm_stats()
+ */
+static const struct
+{
+  TPM2_CC cc;
+  const char *name;
+} tpm_cc_names[] = {
+  {TPM2_CC_EvictControl, "EvictControl"},
+  {TPM2_CC_CreatePrimary, "CreatePrimary"},
+  {TPM2_CC_Startup, "Startup"},
+  {TPM2_CC_Create, "Create"},
+  {TPM2_CC_Load, "Load"},
+  {TPM2_CC_Unseal, "Unseal"},
+  {TPM2_CC_ContextLoad, "ContextLoad"},
+  {TPM2_CC_ContextSave, "ContextSave"},
+  {TPM2_CC_FlushContext, "FlushContext"},
+  {TPM2_CC_PolicyAuthValue, "PolicyAuthValue"},
+  {TPM2_CC_PolicyOR, "PolicyOR"},
+  {TPM2_CC_PolicyAuthorize, "PolicyAuthorize"},
+  {TPM2_CC_LoadExternal, "LoadExternal"},
+  {TPM2_CC_VerifySignature, "VerifySignature"},
+  {TPM2_CC_ReadPublic, "ReadPublic"},
+  {TPM2_CC_StartAuthSession, "StartAuthSession"},
+  {TPM2_CC_GetCapability, "GetCapability"},
+  {TPM2_CC_GetRandom, "GetRandom"},
+  {TPM2_CC_PCR_Read, "PCR_Read"},
+  {TPM2_CC_PolicyPCR, "PolicyPCR"},
+  {TPM2_CC_PCR_Extend, "PCR_Extend"},
+  {TPM2_CC_PolicyGetDigest, "PolicyGetDigest"},
+  {TPM2_CC_CreateLoaded, "CreateLoaded"},
+  {0, NULL}
+};
+
+/**
+ * @brief Fixed TPM properties (TPM2_PT_FIXED group) read from one TPM
+ *        connection, identified by its SAPI context
+ */
+typedef struct
+{
+  TSS2_SYS_CONTEXT *sapi_ctx;
+  TPML_TAGGED_TPM_PROPERTY fixed;
+} tpm2_cap_cache_entry;
+
+/**
+ * @brief Capability cache (an empty entry has a NULL sapi_ctx)
+ */
+static tpm2_cap_cache_entry cap_cache[KMYTH_CAP_CACHE_SIZE];
+
+/**
+ * @brief Next capability cache entry to replace when the cache is full
+ */
+static size_t cap_cache_next = 0;
+
+/**
+ * @brief Guards the capability cache, which connections used from
+ *        different threads (e.g., by kmyth_dispatch_*()) share
+ */
+static pthread_mutex_t cap_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// elapsed_us()
+//############################################################################
+static uint64_t elapsed_us(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int64_t us = ((int64_t) now.tv_sec - (int64_t) start->tv_sec) * 1000000 +
+    ((int64_t) now.tv_nsec - (int64_t) start->tv_nsec) / 1000;
+
+  return (us < 0) ? 0 : (uint64_t) us;
+}
+
+//############################################################################
+// record_tpm_stat()
+//############################################################################
+static void record_tpm_stat(TPM2_CC cc, uint64_t us, bool failed)
+{
+  if (cc < TPM2_CC_FIRST || cc > TPM2_CC_LAST)
+  {
+    return;
+  }
+
+  kmyth_tpm_cmd_stats *stat = &(tpm_stats[cc - TPM2_CC_FIRST]);
+  size_t bucket = 0;
+
+  while ((bucket < KMYTH_TPM_STATS_BUCKETS - 1) && ((us >> (bucket + 1)) > 0))
+  {
+    bucket++;
+  }
+
+  pthread_mutex_lock(&tpm_stats_lock);
+  stat->commandCode = cc;
+  stat->count++;
+  stat->errors += failed ? 1 : 0;
+  stat->total_us += us;
+  stat->max_us = (us > stat->max_us) ? us : stat->max_us;
+  stat->histogram[bucket]++;
+  pthread_mutex_unlock(&tpm_stats_lock);
+}
+
+//############################################################################
+// open_tpm_gate()
+//############################################################################
+/**
+ * @brief Opens (creating it if needed) the lock file shared by the
+ *        processes using the TPM reached through the given TCTI
+ *        specification.
+ *
+ * @return File descriptor, or -1 if the file is not available (or not
+ *         needed, as for the mock TPM)
+ */
+static int open_tpm_gate(const char *tcti_spec)
+{
+  size_t name_len = strcspn(tcti_spec, ":");
+
+  // each process has a mock TPM of its own, there is nothing to share
+  if (name_len == strlen(KMYTH_MOCK_TCTI_NAME) &&
+      strncmp(tcti_spec, KMYTH_MOCK_TCTI_NAME, name_len) == 0)
+  {
+    return -1;
+  }
+
+  const char *dir = getenv(KMYTH_TPM_GATE_DIR_ENV);
+
+  if (dir == NULL || *dir == '\0')
+  {
+    dir = KMYTH_DEFAULT_TPM_GATE_DIR;
+  }
+
+  // FNV-1a hash of the specification keeps the file name short and safe
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (const char *c = tcti_spec; *c != '\0'; c++)
+  {
+    hash = (hash ^ (uint8_t) * c) * 0x100000001b3ULL;
+  }
+
+  char path[PATH_MAX];
+
+  if (snprintf(path, sizeof(path), "%s/kmyth-tpm-%016" PRIx64 ".lock", dir,
+               hash) >= (int) sizeof(path))
+  {
+    return -1;
+  }
+
+  // a file created by another user is opened without O_CREAT, which a
+  // sticky directory such as /tmp may refuse (fs.protected_regular)
+  int fd = -1;
+
+  for (int attempt = 0; fd < 0 && attempt < 2; attempt++)
+  {
+    fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT)
+    {
+      fd = open(path, O_RDONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                0644);
+    }
+    if (fd < 0 && errno != EEXIST)
+    {
+      break;
+    }
+  }
+  if (fd < 0)
+  {
+    kmyth_log(LOG_DEBUG, "TPM scheduling lock file %s not available, bulk "
+              "work will not yield to other processes", path);
+  }
+
+  return fd;
+}
+
+//############################################################################
+// get_tpm_queue()
+//############################################################################
+static tpm_queue *get_tpm_queue(const char *tcti_spec)
+{
+  pthread_mutex_lock(&tpm_queues_lock);
+
+  tpm_queue *queue = tpm_queues;
+
+  while (queue != NULL && strcmp(queue->tcti_spec, tcti_spec) != 0)
+  {
+    queue = queue->next;
+  }
+
+  if (queue == NULL)
+  {
+    queue = kmyth_calloc(1, sizeof(tpm_queue));
+    if (queue != NULL &&
+        (queue->tcti_spec = kmyth_strdup(tcti_spec)) == NULL)
+    {
+      kmyth_free(queue);
+      queue = NULL;
+    }
+    if (queue != NULL)
+    {
+      pthread_mutex_init(&(queue->lock), NULL);
+      queue->gate_fd = open_tpm_gate(tcti_spec);
+      queue->probe_fd = (queue->gate_fd < 0) ? -1 :
+        open_tpm_gate(tcti_spec);
+      if (queue->probe_fd < 0 && queue->gate_fd >= 0)
+      {
+        close(queue->gate_fd);
+        queue->gate_fd = -1;
+      }
+      queue->next = tpm_queues;
+      tpm_queues = queue;
+    }
+  }
+
+  pthread_mutex_unlock(&tpm_queues_lock);
+
+  return queue;
+}
+
+//############################################################################
+// wait_tpm_gate()
+//############################################################################
+/**
+ * @brief Waits until no other process has had interactive or normal work
+ *        in flight on the TPM for KMYTH_TPM_GATE_QUIET_MS, or until the
+ *        bulk command that started waiting at 'start' has waited as long
+ *        as bulk commands may wait.
+ */
+static void wait_tpm_gate(tpm_queue * queue, const struct timespec *start)
+{
+  if (queue->probe_fd < 0)
+  {
+    return;
+  }
+
+  unsigned int max_wait_ms =
+    __atomic_load_n(&(tpm_max_wait_ms[KMYTH_TPM_PRIORITY_BULK]),
+                    __ATOMIC_RELAXED);
+  struct timespec quiet_since;
+  bool contended = false;
+  bool quiet = false;
+  const struct timespec poll = {.tv_sec = 0,
+    .tv_nsec = KMYTH_TPM_GATE_POLL_MS * 1000000L
+  };
+
+  while (max_wait_ms == 0 || elapsed_us(start) < max_wait_ms * 1000ULL)
+  {
+    if (flock(queue->probe_fd, LOCK_EX | LOCK_NB) == 0)
+    {
+      flock(queue->probe_fd, LOCK_UN);
+      if (!contended)
+      {
+        return;
+      }
+      if (!quiet)
+      {
+        clock_gettime(CLOCK_MONOTONIC, &quiet_since);
+        quiet = true;
+      }
+      else if (elapsed_us(&quiet_since) >= KMYTH_TPM_GATE_QUIET_MS * 1000ULL)
+      {
+        return;
+      }
+    }
+    else if (errno == EWOULDBLOCK || errno == EINTR)
+    {
+      contended = true;
+      quiet = false;
+    }
+    else
+    {
+      return;
+    }
+    nanosleep(&poll, NULL);
+  }
+}
+
+//############################################################################
+// next_tpm_waiter()
+//############################################################################
+/**
+ * @brief Removes and returns the waiter to hand the turn to next (call
+ *        with queue->lock held): the longest waiting of those that waited
+ *        longer than their class allows, else the oldest of the most
+ *        urgent class.
+ *
+ * @return Next waiter, or NULL if none
+ */
+static tpm_waiter *next_tpm_waiter(tpm_queue * queue)
+{
+  int chosen = -1;
+
+  for (int i = 0; i < KMYTH_TPM_PRIORITY_COUNT; i++)
+  {
+    tpm_waiter *waiter = queue->head[i];
+    unsigned int max_wait_ms =
+      __atomic_load_n(&(tpm_max_wait_ms[i]), __ATOMIC_RELAXED);
+
+    if (waiter == NULL || max_wait_ms == 0 ||
+        elapsed_us(&(waiter->since)) < max_wait_ms * 1000ULL)
+    {
+      continue;
+    }
+    if (chosen < 0 ||
+        elapsed_us(&(waiter->since)) >
+        elapsed_us(&(queue->head[chosen]->since)))
+    {
+      chosen = i;
+    }
+  }
+  for (int i = 0; chosen < 0 && i < KMYTH_TPM_PRIORITY_COUNT; i++)
+  {
+    if (queue->head[i] != NULL)
+    {
+      chosen = i;
+    }
+  }
+  if (chosen < 0)
+  {
+    return NULL;
+  }
+
+  tpm_waiter *waiter = queue->head[chosen];
+
+  queue->head[chosen] = waiter->next;
+
+  return waiter;
+}
+
+//############################################################################
+// take_tpm_turn()
+//############################################################################
+static void take_tpm_turn(stats_tcti_ctx * stats_ctx)
+{
+  if (stats_ctx->has_turn)
+  {
+    return;
+  }
+
+  tpm_queue *queue = stats_ctx->queue;
+  kmyth_tpm_priority priority = get_tpm_priority();
+  struct timespec since;
+
+  // bulk work defers to other processes before queueing, so as not to hold
+  // up this process's more urgent work while it waits - the time spent
+  // counts towards its maximum wait in the queue as well
+  clock_gettime(CLOCK_MONOTONIC, &since);
+  if (priority == KMYTH_TPM_PRIORITY_BULK)
+  {
+    wait_tpm_gate(queue, &since);
+  }
+
+  pthread_mutex_lock(&(queue->lock));
+  if (!queue->busy)
+  {
+    queue->busy = true;
+  }
+  else
+  {
+    tpm_waiter waiter = {.since = since,.granted = false };
+
+    // each class is kept in order of when its commands started waiting
+    tpm_waiter **link = &(queue->head[priority]);
+
+    while (*link != NULL &&
+           ((*link)->since.tv_sec < since.tv_sec ||
+            ((*link)->since.tv_sec == since.tv_sec &&
+             (*link)->since.tv_nsec <= since.tv_nsec)))
+    {
+      link = &((*link)->next);
+    }
+    waiter.next = *link;
+    *link = &waiter;
+    pthread_cond_init(&(waiter.handed), NULL);
+
+    // give_up_tpm_turn() leaves the queue busy when it hands over the turn
+    while (!waiter.granted)
+    {
+      pthread_cond_wait(&(waiter.handed), &(queue->lock));
+    }
+    pthread_cond_destroy(&(waiter.handed));
+  }
+  pthread_mutex_unlock(&(queue->lock));
+
+  // while this process has the TPM, other processes' bulk work waits (the
+  // queue serializes the turn holders, so one lock serves them all)
+  if (priority != KMYTH_TPM_PRIORITY_BULK && queue->gate_fd >= 0)
+  {
+    while (flock(queue->gate_fd, LOCK_SH) != 0 && errno == EINTR)
+    {
+    }
+    queue->gate_held = true;
+  }
+
+  stats_ctx->has_turn = true;
+}
+
+//############################################################################
+// give_up_tpm_turn()
+//############################################################################
+static void give_up_tpm_turn(stats_tcti_ctx * stats_ctx)
+{
+  if (!stats_ctx->has_turn)
+  {
+    return;
+  }
+
+  tpm_queue *queue = stats_ctx->queue;
+
+  if (queue->gate_held)
+  {
+    flock(queue->gate_fd, LOCK_UN);
+    queue->gate_held = false;
+  }
+
+  pthread_mutex_lock(&(queue->lock));
+
+  tpm_waiter *waiter = next_tpm_waiter(queue);
+
+  if (waiter != NULL)
+  {
+    waiter->granted = true;
+    pthread_cond_signal(&(waiter->handed));
+  }
+  else
+  {
+    queue->busy = false;
+  }
+  pthread_mutex_unlock(&(queue->lock));
+
+  stats_ctx->has_turn = false;
+}
+
+//############################################################################
+// stats_tcti_transmit()
+//############################################################################
+static TSS2_RC stats_tcti_transmit(TSS2_TCTI_CONTEXT * tcti_ctx, size_t size,
+                                   uint8_t const *command)
+{
+  stats_tcti_ctx *stats_ctx = (stats_tcti_ctx *) tcti_ctx;
+
+  // wait for the TPM before timing, so that only the TPM's time is counted
+  take_tpm_turn(stats_ctx);
+
+  // command header: tag (2 bytes), size (4 bytes), command code (4 bytes)
+  if (command != NULL && size >= 10)
+  {
+    stats_ctx->pending_cc = ((TPM2_CC) command[6] << 24) |
+      ((TPM2_CC) command[7] << 16) |
+      ((TPM2_CC) command[8] << 8) | (TPM2_CC) command[9];
+    stats_ctx->pending = true;
+    KMYTH_PROBE2(tpm_command__entry, stats_ctx->pending_cc, size);
+    if (stats_ctx->timed)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &(stats_ctx->start));
+    }
+  }
+
+  TSS2_RC rc = Tss2_Tcti_Transmit(stats_ctx->inner, size, command);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    give_up_tpm_turn(stats_ctx);
+  }
+  if (rc != TSS2_RC_SUCCESS && stats_ctx->pending)
+  {
+    KMYTH_PROBE2(tpm_command__return, stats_ctx->pending_cc, rc);
+    kmyth_metrics_tpm_error(rc);
+    if (stats_ctx->timed)
+    {
+      record_tpm_stat(stats_ctx->pending_cc,
+                      elapsed_us(&(stats_ctx->start)), true);
+    }
+    stats_ctx->pending = false;
+  }
+
+  return rc;
+}
+
+//############################################################################
+// stats_tcti_receive()
+//############################################################################
+static TSS2_RC stats_tcti_receive(TSS2_TCTI_CONTEXT * tcti_ctx, size_t *size,
+                                  uint8_t * response, int32_t timeout)
+{
+  stats_tcti_ctx *stats_ctx = (stats_tcti_ctx *) tcti_ctx;
+  TSS2_RC rc = Tss2_Tcti_Receive(stats_ctx->inner, size, response, timeout);
+
+  // a size query (NULL response) or poll timeout does not end the command
+  if (rc == TSS2_TCTI_RC_TRY_AGAIN ||
+      (rc == TSS2_RC_SUCCESS && response == NULL))
+  {
+    return rc;
+  }
+  give_up_tpm_turn(stats_ctx);
+
+  if (!stats_ctx->pending)
+  {
+    return rc;
+  }
+
+  // response header: tag (2 bytes), size (4 bytes), response code (4 bytes)
+  TSS2_RC response_rc = rc;
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    response_rc = (*size < 10) ? TSS2_TCTI_RC_MALFORMED_RESPONSE :
+      ((TSS2_RC) response[6] << 24) | ((TSS2_RC) response[7] << 16) |
+      ((TSS2_RC) response[8] << 8) | (TSS2_RC) response[9];
+  }
+  KMYTH_PROBE2(tpm_command__return, stats_ctx->pending_cc, response_rc);
+  if (response_rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_metrics_tpm_error(response_rc);
+  }
+
+  if (stats_ctx->timed)
+  {
+    record_tpm_stat(stats_ctx->pending_cc, elapsed_us(&(stats_ctx->start)),
+                    response_rc != TSS2_RC_SUCCESS);
+  }
+  stats_ctx->pending = false;
+
+  return rc;
+}
+
+//############################################################################
+// stats_tcti_finalize()
+//############################################################################
+static void stats_tcti_finalize(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  stats_tcti_ctx *stats_ctx = (stats_tcti_ctx *) tcti_ctx;
+
+  give_up_tpm_turn(stats_ctx);
+  if (stats_ctx->inner != NULL)
+  {
+    Tss2_Tcti_Finalize(stats_ctx->inner);
+    kmyth_free(stats_ctx->inner);
+    stats_ctx->inner = NULL;
+  }
+}
+
+//############################################################################
+// stats_tcti_cancel()
+//############################################################################
+static TSS2_RC stats_tcti_cancel(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  stats_tcti_ctx *stats_ctx = (stats_tcti_ctx *) tcti_ctx;
+
+  stats_ctx->pending = false;
+
+  TSS2_RC rc = Tss2_Tcti_Cancel(stats_ctx->inner);
+
+  give_up_tpm_turn(stats_ctx);
+
+  return rc;
+}
+
+//############################################################################
+// stats_tcti_get_poll_handles()
+//############################################################################
+static TSS2_RC stats_tcti_get_poll_handles(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                           TSS2_TCTI_POLL_HANDLE * handles,
+                                           size_t *num_handles)
+{
+  return Tss2_Tcti_GetPollHandles(((stats_tcti_ctx *) tcti_ctx)->inner,
+                                  handles, num_handles);
+}
+
+//############################################################################
+// stats_tcti_set_locality()
+//############################################################################
+static TSS2_RC stats_tcti_set_locality(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                       uint8_t locality)
+{
+  return Tss2_Tcti_SetLocality(((stats_tcti_ctx *) tcti_ctx)->inner,
+                               locality);
+}
+
+//############################################################################
+// stats_tcti_make_sticky()
+//############################################################################
+static TSS2_RC stats_tcti_make_sticky(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                      TPM2_HANDLE * handle, uint8_t sticky)
+{
+  return Tss2_Tcti_MakeSticky(((stats_tcti_ctx *) tcti_ctx)->inner,
+                              handle, sticky);
+}
+
+//############################################################################
+// wrap_tcti_stats()
+//############################################################################
+static int wrap_tcti_stats(TSS2_TCTI_CONTEXT ** tcti_ctx,
+                           const char *tcti_spec)
+{
+  stats_tcti_ctx *stats_ctx = kmyth_calloc(1, sizeof(stats_tcti_ctx));
+
+  if (stats_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for stats TCTI context failed ... exiting");
+    return 1;
+  }
+
+  stats_ctx->queue = get_tpm_queue(tcti_spec);
+  if (stats_ctx->queue == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to find TPM command queue ... exiting");
+    kmyth_free(stats_ctx);
+    return 1;
+  }
+
+  stats_ctx->common.v1.magic = KMYTH_STATS_TCTI_MAGIC;
+  stats_ctx->common.v1.version = 2;
+  stats_ctx->common.v1.transmit = stats_tcti_transmit;
+  stats_ctx->common.v1.receive = stats_tcti_receive;
+  stats_ctx->common.v1.finalize = stats_tcti_finalize;
+  stats_ctx->common.v1.cancel = stats_tcti_cancel;
+  stats_ctx->common.v1.getPollHandles = stats_tcti_get_poll_handles;
+  stats_ctx->common.v1.setLocality = stats_tcti_set_locality;
+  stats_ctx->common.makeSticky = stats_tcti_make_sticky;
+  stats_ctx->inner = *tcti_ctx;
+  stats_ctx->timed = tpm_stats_enabled;
+
+  // free_tpm2_resources() finalizes and frees this layer as it would any
+  // other TCTI context, which releases the wrapped one as well
+  *tcti_ctx = (TSS2_TCTI_CONTEXT *) stats_ctx;
+  if (stats_ctx->timed)
+  {
+    kmyth_log(LOG_DEBUG, "TPM command statistics enabled for new connection");
+  }
+
+  return 0;
+}
+
+//############################################################################
+// resolve_tcti_spec()
+//############################################################################
+static char *resolve_tcti_spec(const char *tcti_spec)
+{
+  // caller's choice, then explicit selection, then environment, then default
+  if (tcti_spec != NULL)
+  {
+    return kmyth_strdup(tcti_spec);
+  }
+
+  char *spec = NULL;
+
+  pthread_mutex_lock(&tcti_spec_lock);
+  if (tcti_spec_override != NULL)
+  {
+    spec = kmyth_strdup(tcti_spec_override);
+    pthread_mutex_unlock(&tcti_spec_lock);
+    return spec;
+  }
+  pthread_mutex_unlock(&tcti_spec_lock);
+
+  const char *env_spec = getenv(KMYTH_TCTI_ENV);
+
+  if (env_spec == NULL || *env_spec == '\0')
+  {
+    env_spec = KMYTH_DEFAULT_TCTI;
+  }
+
+  return kmyth_strdup(env_spec);
+}
+
+//############################################################################
+// init_tpm2_connection()
+//############################################################################
+int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
+{
+  return init_tpm2_connection_tcti(sapi_ctx, NULL);
+}
+
+//############################################################################
+// init_tpm2_connection_tcti()
+//############################################################################
+int init_tpm2_connection_tcti(TSS2_SYS_CONTEXT ** sapi_ctx,
+                              const char *tcti_spec)
+{
+  // Verify that SAPI context is uninitialized (NULL) -
+  // TCTI context must be initialized first 
+  if (*sapi_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "SAPI context passed in must be NULL ... exiting");
+    return 1;
+  }
+
+  // Step 1: Initialize TCTI context for connection to resource manager,
+  //         joining the submission queue of the TPM it leads to
+  char *spec = resolve_tcti_spec(tcti_spec);
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+
+  if (spec == NULL || init_tcti_spec(&tcti_ctx, spec))
+  {
+    kmyth_free(spec);
+    kmyth_log(LOG_ERR, "unable to initialize TCTI context ... exiting");
+    return 1;
+  }
+
+  if (wrap_tcti_stats(&tcti_ctx, spec))
+  {
+    kmyth_free(spec);
+    Tss2_Tcti_Finalize(tcti_ctx);
+    kmyth_free(tcti_ctx);
+    kmyth_log(LOG_ERR, "unable to instrument TCTI context ... exiting");
+    return 1;
+  }
+  kmyth_free(spec);
+
+  // Step 2: Initialize SAPI context with TCTI context
+  if (init_sapi(sapi_ctx, tcti_ctx))
+  {
+    // If SAPI initialization fails: 
+    //   - sapi_ctx is freed by init_sapi()
+    //   - tcti_ctx must still be cleaned up
+    Tss2_Tcti_Finalize(tcti_ctx);
+    kmyth_free(tcti_ctx);
+    kmyth_log(LOG_ERR, "unable to initialize SAPI context ... exiting");
+    return 1;
+  }
+
+  // Step 3: Start TPM. The hardware takes care of this if using a
+  //         hardware TPM so we only invoke if emulator being used.
+  bool tpmTypeIsEmulator = false;
+
+  if (get_tpm2_impl_type(*sapi_ctx, &tpmTypeIsEmulator))
+  {
+    // On failure, clean up initialization remnants to this point
+    Tss2_Sys_Finalize(*sapi_ctx);
+    kmyth_free(*sapi_ctx);
+    Tss2_Tcti_Finalize(tcti_ctx);
+    kmyth_free(tcti_ctx);
+    kmyth_log(LOG_ERR, "cannot determine TPM impl type (HW/emul) ... exiting");
+    return 1;
+  }
+  else
+  {
+    if (tpmTypeIsEmulator)
+    {
+      if (startup_tpm2(sapi_ctx))
+      {
+        // On failure, clean up initialization remnants to this point
+        clear_tpm2_capability_cache(*sapi_ctx);
+        Tss2_Sys_Finalize(*sapi_ctx);
+        kmyth_free(*sapi_ctx);
+        Tss2_Tcti_Finalize(tcti_ctx);
+        kmyth_free(tcti_ctx);
+        kmyth_log(LOG_ERR, "unable to start TPM 2.0 ... exiting");
+        return 1;
+      }
+      else
+      {
+        kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 emulator");
+      }
+    }
+    else
+    {
+      kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 device (HW)");
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// set_tcti_spec()
+//############################################################################
+int set_tcti_spec(const char *tcti_spec)
+{
+  if (tcti_spec != NULL)
+  {
+    size_t name_len = strcspn(tcti_spec, ":");
+    bool known = (strncmp(tcti_spec, "auto", name_len) == 0 &&
+                  name_len == strlen("auto"));
+
+    size_t index = 0;
+
+    while (!known && tcti_options[index].name != NULL)
+    {
+      known = (name_len == strlen(tcti_options[index].name) &&
+               strncmp(tcti_spec, tcti_options[index].name, name_len) == 0);
+      index += known ? 0 : 1;
+    }
+    if (!known)
+    {
+      kmyth_log(LOG_ERR, "unrecognized TCTI (%s) ... exiting", tcti_spec);
+      return 1;
+    }
+
+    // a built-in TCTI (the mock TPM) must also have been registered
+    if (tcti_options[index].name != NULL &&
+        tcti_options[index].library == NULL)
+    {
+      pthread_mutex_lock(&tcti_load_lock);
+      bool registered = (tcti_loaded[index] != NULL);
+
+      pthread_mutex_unlock(&tcti_load_lock);
+      if (!registered)
+      {
+        kmyth_log(LOG_ERR, "%s TCTI not available in this program ... "
+                  "exiting", tcti_options[index].name);
+        return 1;
+      }
+    }
+  }
+
+  char *new_spec = NULL;
+
+  if (tcti_spec != NULL)
+  {
+    new_spec = kmyth_strdup(tcti_spec);
+    if (new_spec == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to save TCTI selection ... exiting");
+      return 1;
+    }
+  }
+  pthread_mutex_lock(&tcti_spec_lock);
+
+  char *old_spec = tcti_spec_override;
+
+  tcti_spec_override = new_spec;
+  pthread_mutex_unlock(&tcti_spec_lock);
+  kmyth_free(old_spec);
+
+  return 0;
+}
+
+//############################################################################
+// set_tpm_priority()
+//############################################################################
+kmyth_tpm_priority set_tpm_priority(kmyth_tpm_priority priority)
+{
+  kmyth_tpm_priority previous = get_tpm_priority();
+
+  if (priority >= KMYTH_TPM_PRIORITY_INTERACTIVE &&
+      priority < KMYTH_TPM_PRIORITY_COUNT)
+  {
+    tpm_thread_priority = (int) priority;
+  }
+
+  return previous;
+}
+
+//############################################################################
+// set_default_tpm_priority()
+//############################################################################
+int set_default_tpm_priority(kmyth_tpm_priority priority)
+{
+  if (priority < KMYTH_TPM_PRIORITY_INTERACTIVE ||
+      priority >= KMYTH_TPM_PRIORITY_COUNT)
+  {
+    kmyth_log(LOG_ERR, "unknown TPM priority (%d) ... exiting", priority);
+    return 1;
+  }
+  __atomic_store_n(&tpm_default_priority, (int) priority, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+//############################################################################
+// get_tpm_priority()
+//############################################################################
+kmyth_tpm_priority get_tpm_priority(void)
+{
+  if (tpm_thread_priority >= 0)
+  {
+    return (kmyth_tpm_priority) tpm_thread_priority;
+  }
+
+  int priority = __atomic_load_n(&tpm_default_priority, __ATOMIC_RELAXED);
+
+  if (priority >= 0)
+  {
+    return (kmyth_tpm_priority) priority;
+  }
+
+  kmyth_tpm_priority env_priority = KMYTH_TPM_PRIORITY_NORMAL;
+  const char *env_name = getenv(KMYTH_TPM_PRIORITY_ENV);
+
+  if (env_name != NULL && *env_name != '\0' &&
+      parse_tpm_priority(env_name, &env_priority))
+  {
+    env_priority = KMYTH_TPM_PRIORITY_NORMAL;
+  }
+
+  return env_priority;
+}
+
 //############################################################################
-// init_tpm2_connection()
+// set_tpm_priority_max_wait()
 //############################################################################
-int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
+int set_tpm_priority_max_wait(kmyth_tpm_priority priority,
+                              unsigned int max_wait_ms)
 {
-  // Verify that SAPI context is uninitialized (NULL) -
-  // TCTI context must be initialized first 
-  if (*sapi_ctx != NULL)
+  if (priority != KMYTH_TPM_PRIORITY_NORMAL &&
+      priority != KMYTH_TPM_PRIORITY_BULK)
   {
-    kmyth_log(LOG_ERR, "SAPI context passed in must be NULL ... exiting");
+    kmyth_log(LOG_ERR, "no maximum wait for TPM priority (%d) ... exiting",
+              priority);
     return 1;
   }
+  __atomic_store_n(&(tpm_max_wait_ms[priority]), max_wait_ms,
+                   __ATOMIC_RELAXED);
 
-  // Step 1: Initialize TCTI context for connection to resource manager
-  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+  return 0;
+}
 
-  if (init_tcti_abrmd(&tcti_ctx))
+//############################################################################
+// parse_tpm_priority()
+//############################################################################
+int parse_tpm_priority(const char *name, kmyth_tpm_priority * priority)
+{
+  for (int i = 0; name != NULL && i < KMYTH_TPM_PRIORITY_COUNT; i++)
   {
-    kmyth_log(LOG_ERR, "unable to initialize TCTI context ... exiting");
-    return 1;
+    if (strcmp(name, tpm_priority_names[i]) == 0)
+    {
+      *priority = (kmyth_tpm_priority) i;
+      return 0;
+    }
   }
 
-  // Step 2: Initialize SAPI context with TCTI context
-  if (init_sapi(sapi_ctx, tcti_ctx))
+  kmyth_log(LOG_ERR, "unknown TPM priority (%s) ... exiting",
+            (name == NULL) ? "NULL" : name);
+  return 1;
+}
+
+//############################################################################
+// set_tpm_stats()
+//############################################################################
+void set_tpm_stats(bool enable)
+{
+  tpm_stats_enabled = enable;
+}
+
+//############################################################################
+// reset_tpm_stats()
+//############################################################################
+void reset_tpm_stats(void)
+{
+  pthread_mutex_lock(&tpm_stats_lock);
+  memset(tpm_stats, 0, sizeof(tpm_stats));
+  pthread_mutex_unlock(&tpm_stats_lock);
+}
+
+//############################################################################
+// get_tpm_stats()
+//############################################################################
+int get_tpm_stats(kmyth_tpm_cmd_stats ** stats, size_t *stats_count)
+{
+  if (stats == NULL || stats_count == NULL)
   {
-    // If SAPI initialization fails: 
-    //   - sapi_ctx is freed by init_sapi()
-    //   - tcti_ctx must still be cleaned up
-    Tss2_Tcti_Finalize(tcti_ctx);
-    free(tcti_ctx);
-    kmyth_log(LOG_ERR, "unable to initialize SAPI context ... exiting");
+    kmyth_log(LOG_ERR, "NULL output parameter ... exiting");
     return 1;
   }
+  *stats = NULL;
+  *stats_count = 0;
 
-  // Step 3: Start TPM. The hardware takes care of this if using a
-  //         hardware TPM so we only invoke if emulator being used.
-  bool tpmTypeIsEmulator = false;
+  // take a consistent snapshot, then report from it
+  kmyth_tpm_cmd_stats snapshot[KMYTH_TPM_STATS_CC_COUNT];
+  size_t count = 0;
 
-  if (get_tpm2_impl_type(*sapi_ctx, &tpmTypeIsEmulator))
+  pthread_mutex_lock(&tpm_stats_lock);
+  memcpy(snapshot, tpm_stats, sizeof(snapshot));
+  pthread_mutex_unlock(&tpm_stats_lock);
+
+  for (size_t i = 0; i < KMYTH_TPM_STATS_CC_COUNT; i++)
   {
-    // On failure, clean up initialization remnants to this point
-    Tss2_Sys_Finalize(*sapi_ctx);
-    free(*sapi_ctx);
-    Tss2_Tcti_Finalize(tcti_ctx);
-    free(tcti_ctx);
-    kmyth_log(LOG_ERR, "cannot determine TPM impl type (HW/emul) ... exiting");
+    count += (snapshot[i].count > 0) ? 1 : 0;
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  *stats = kmyth_calloc(count, sizeof(kmyth_tpm_cmd_stats));
+  if (*stats == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for TPM statistics failed ... exiting");
     return 1;
   }
-  else
+  for (size_t i = 0; i < KMYTH_TPM_STATS_CC_COUNT; i++)
   {
-    if (tpmTypeIsEmulator)
+    if (snapshot[i].count > 0)
     {
-      if (startup_tpm2(sapi_ctx))
+      (*stats)[(*stats_count)++] = snapshot[i];
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// get_tpm_cc_name()
+//############################################################################
+const char *get_tpm_cc_name(TPM2_CC commandCode)
+{
+  for (size_t i = 0; tpm_cc_names[i].name != NULL; i++)
+  {
+    if (tpm_cc_names[i].cc == commandCode)
+    {
+      return tpm_cc_names[i].name;
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// print_tpm_stats()
+//############################################################################
+void print_tpm_stats(FILE * out)
+{
+  kmyth_tpm_cmd_stats *stats = NULL;
+  size_t stats_count = 0;
+
+  if (out == NULL || get_tpm_stats(&stats, &stats_count))
+  {
+    return;
+  }
+
+  fprintf(out, "%-18s %10s %8s %12s %12s\n", "TPM command", "calls",
+          "errors", "avg (us)", "max (us)");
+  for (size_t i = 0; i < stats_count; i++)
+  {
+    const char *name = get_tpm_cc_name(stats[i].commandCode);
+    char cc_string[11];
+
+    if (name == NULL)
+    {
+      snprintf(cc_string, sizeof(cc_string), "0x%08X", stats[i].commandCode);
+      name = cc_string;
+    }
+
+    fprintf(out, "%-18s %10llu %8llu %12llu %12llu\n", name,
+            (unsigned long long) stats[i].count,
+            (unsigned long long) stats[i].errors,
+            (unsigned long long) (stats[i].total_us / stats[i].count),
+            (unsigned long long) stats[i].max_us);
+
+    // histogram: lower bound of each non-empty bucket and its count
+    fprintf(out, "  ");
+    for (size_t b = 0; b < KMYTH_TPM_STATS_BUCKETS; b++)
+    {
+      if (stats[i].histogram[b] > 0)
       {
-        // On failure, clean up initialization remnants to this point
-        Tss2_Sys_Finalize(*sapi_ctx);
-        free(*sapi_ctx);
-        Tss2_Tcti_Finalize(tcti_ctx);
-        free(tcti_ctx);
-        kmyth_log(LOG_ERR, "unable to start TPM 2.0 ... exiting");
-        return 1;
+        fprintf(out, " %lluus+:%llu",
+                (b == 0) ? 0ULL : (1ULL << b),
+                (unsigned long long) stats[i].histogram[b]);
       }
-      else
+    }
+    fprintf(out, "\n");
+  }
+
+  kmyth_free(stats);
+}
+
+//############################################################################
+// load_tcti_init()
+//############################################################################
+static tcti_init_fn load_tcti_init(size_t index)
+{
+  const tcti_option *option = &tcti_options[index];
+
+  pthread_mutex_lock(&tcti_load_lock);
+
+  tcti_init_fn init = tcti_loaded[index];
+
+  if (init == NULL && option->library == NULL)
+  {
+    kmyth_log(LOG_ERR, "%s TCTI not available in this program ... exiting",
+              option->name);
+  }
+  else if (init == NULL)
+  {
+    void *library = dlopen(option->library, RTLD_NOW | RTLD_LOCAL);
+    void *symbol = (library != NULL) ? dlsym(library, option->symbol) : NULL;
+
+    if (symbol == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to load %s TCTI (%s) ... exiting",
+                option->name, dlerror());
+      if (library != NULL)
       {
-        kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 emulator");
+        dlclose(library);
       }
     }
     else
     {
-      kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 device (HW)");
+      // (assigned through an object pointer, the way POSIX has dlsym()
+      // results converted to function pointers)
+      *(void **) (&init) = symbol;
+      tcti_loaded[index] = init;
+      kmyth_log(LOG_DEBUG, "loaded %s", option->library);
     }
   }
+  pthread_mutex_unlock(&tcti_load_lock);
 
-  return 0;
+  return init;
 }
 
 //############################################################################
-// init_tcti_abrmd()
+// register_tcti_init()
 //############################################################################
-int init_tcti_abrmd(TSS2_TCTI_CONTEXT ** tcti_ctx)
+int register_tcti_init(const char *name,
+                       TSS2_RC(*init) (TSS2_TCTI_CONTEXT *, size_t *,
+                                       const char *))
 {
-  // TCTI context must be passed in uninitialized (NULL)
-  if (*tcti_ctx != NULL)
+  if (name == NULL || init == NULL)
+  {
+    kmyth_log(LOG_ERR, "no TCTI name or initialization function ... exiting");
+    return 1;
+  }
+
+  // only the built-in TCTIs (no library) are registered
+  for (size_t index = 0; tcti_options[index].name != NULL; index++)
+  {
+    if (tcti_options[index].library == NULL &&
+        strcmp(name, tcti_options[index].name) == 0)
+    {
+      pthread_mutex_lock(&tcti_load_lock);
+      tcti_loaded[index] = init;
+      pthread_mutex_unlock(&tcti_load_lock);
+      return 0;
+    }
+  }
+
+  kmyth_log(LOG_ERR, "unrecognized built-in TCTI (%s) ... exiting", name);
+  return 1;
+}
+
+//############################################################################
+// init_tcti_by_name()
+//############################################################################
+static int init_tcti_by_name(const char *name, size_t name_len,
+                             const char *conf, TSS2_TCTI_CONTEXT ** tcti_ctx)
+{
+  size_t index = 0;
+
+  while (tcti_options[index].name != NULL &&
+         (name_len != strlen(tcti_options[index].name) ||
+          strncmp(name, tcti_options[index].name, name_len) != 0))
+  {
+    index++;
+  }
+  if (tcti_options[index].name == NULL)
+  {
+    kmyth_log(LOG_ERR, "unrecognized TCTI (%.*s) ... exiting",
+              (int) name_len, name);
+    return 1;
+  }
+
+  tcti_init_fn init = load_tcti_init(index);
+
+  if (init == NULL)
   {
-    kmyth_log(LOG_ERR, "TCTI context passed in not NULL ... exiting");
     return 1;
   }
 
-  // We are using the default TCTI bus. Initial Tss2_Tcti_Tabrmd_Init() call
-  // returns memory space needed for TCTI context.
+  // First Tss2_Tcti_*_Init() call returns memory space needed for the context
   size_t size;
-  TSS2_RC rc;
+  TSS2_RC rc = init(NULL, &size, conf);
 
-  rc = Tss2_Tcti_Tabrmd_Init(NULL, &size, NULL);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Tcti_Tabrmd_Init(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
+    kmyth_log(LOG_ERR, "TCTI (%.*s) init: rc = 0x%08X, %s", (int) name_len,
+              name, rc, getErrorString(rc));
     return 1;
   }
 
-  // Now that we know how much space we need, allocate memory for TCTI context
-  *tcti_ctx = (TSS2_TCTI_CONTEXT *) calloc(1, size);
+  *tcti_ctx = (TSS2_TCTI_CONTEXT *) kmyth_calloc(1, size);
   if (*tcti_ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "calloc for res mgr TCTI context failed ... exiting");
+    kmyth_log(LOG_ERR, "calloc for TCTI context failed ... exiting");
     return 1;
   }
 
-  // Second Tss2_Tcti_Tabrmd_Init() call actually initializes the TCTI context
-  rc = Tss2_Tcti_Tabrmd_Init(*tcti_ctx, &size, NULL);
+  // Second Tss2_Tcti_*_Init() call actually initializes the TCTI context
+  rc = init(*tcti_ctx, &size, conf);
   if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Tcti_Tabrmd_Init(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
-    free(*tcti_ctx);
+    kmyth_log(LOG_ERR, "TCTI (%.*s) init: rc = 0x%08X, %s", (int) name_len,
+              name, rc, getErrorString(rc));
+    kmyth_free(*tcti_ctx);
+    *tcti_ctx = NULL;
     return 1;
   }
+  kmyth_log(LOG_DEBUG, "initialized %.*s TCTI", (int) name_len, name);
 
   return 0;
 }
 
+//############################################################################
+// init_tcti_resolved()
+//############################################################################
+static int init_tcti_resolved(TSS2_TCTI_CONTEXT ** tcti_ctx, const char *spec)
+{
+  size_t name_len = strcspn(spec, ":");
+  const char *conf = (spec[name_len] == ':') ? spec + name_len + 1 : NULL;
+
+  if (conf != NULL && *conf == '\0')
+  {
+    conf = NULL;
+  }
+
+  if (name_len != strlen("auto") || strncmp(spec, "auto", name_len) != 0)
+  {
+    return init_tcti_by_name(spec, name_len, conf, tcti_ctx);
+  }
+
+  // Auto-detection: prefer the in-kernel resource manager, which avoids a
+  // D-Bus round trip to tpm2-abrmd for every command, when we can use it
+  if (access(KMYTH_TPMRM_DEVICE, R_OK | W_OK) == 0)
+  {
+    if (init_tcti_by_name("device", strlen("device"),
+                          KMYTH_TPMRM_DEVICE, tcti_ctx) == 0)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_DEBUG, "%s unusable, falling back to abrmd",
+              KMYTH_TPMRM_DEVICE);
+  }
+
+  return init_tcti_abrmd(tcti_ctx);
+}
+
+//############################################################################
+// init_tcti()
+//############################################################################
+int init_tcti(TSS2_TCTI_CONTEXT ** tcti_ctx)
+{
+  return init_tcti_spec(tcti_ctx, NULL);
+}
+
+//############################################################################
+// init_tcti_spec()
+//############################################################################
+int init_tcti_spec(TSS2_TCTI_CONTEXT ** tcti_ctx, const char *tcti_spec)
+{
+  // TCTI context must be passed in uninitialized (NULL)
+  if (*tcti_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "TCTI context passed in not NULL ... exiting");
+    return 1;
+  }
+
+  char *spec = resolve_tcti_spec(tcti_spec);
+
+  if (spec == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to copy TCTI selection ... exiting");
+    return 1;
+  }
+
+  int retval = init_tcti_resolved(tcti_ctx, spec);
+
+  kmyth_free(spec);
+
+  return retval;
+}
+
+//############################################################################
+// init_tcti_abrmd()
+//############################################################################
+int init_tcti_abrmd(TSS2_TCTI_CONTEXT ** tcti_ctx)
+{
+  // TCTI context must be passed in uninitialized (NULL)
+  if (*tcti_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "TCTI context passed in not NULL ... exiting");
+    return 1;
+  }
+
+  // We are using the default TCTI bus
+  return init_tcti_by_name("abrmd", strlen("abrmd"), NULL, tcti_ctx);
+}
+
 //############################################################################
 // init_sapi()
 //############################################################################
@@ -189,7 +1560,7 @@ int init_sapi(TSS2_SYS_CONTEXT ** sapi_ctx, TSS2_TCTI_CONTEXT * tcti_ctx)
     kmyth_log(LOG_ERR, "maximum size for SAPI context is zero ... exiting");
     return 1;
   }
-  *sapi_ctx = (TSS2_SYS_CONTEXT *) calloc(1, size);
+  *sapi_ctx = (TSS2_SYS_CONTEXT *) kmyth_calloc(1, size);
   if (*sapi_ctx == NULL)
   {
     kmyth_log(LOG_ERR, "memory allocation for SAPI context failed ... exiting");
@@ -204,7 +1575,7 @@ int init_sapi(TSS2_SYS_CONTEXT ** sapi_ctx, TSS2_TCTI_CONTEXT * tcti_ctx)
   {
     kmyth_log(LOG_ERR, "Tss2_Sys_Initialize(): rc = 0x%08X, %s", rc,
               getErrorString(rc));
-    free(sapi_ctx);
+    kmyth_free(sapi_ctx);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "initialized SAPI context");
@@ -283,21 +1654,22 @@ int free_tpm2_resources(TSS2_SYS_CONTEXT ** sapi_ctx)
   // If TCTI context is NULL, no need to "finalize"
   if (tcti_ctx == NULL)
   {
-    free(*sapi_ctx);
-    free(tcti_ctx);
+    kmyth_free(*sapi_ctx);
+    kmyth_free(tcti_ctx);
     kmyth_log(LOG_ERR, "NULL TCTI context - can't finalize");
     retval = 1;
   }
 
   // Clean up higher-level SAPI context, first
+  clear_tpm2_capability_cache(*sapi_ctx);
   Tss2_Sys_Finalize(*sapi_ctx);
-  free(*sapi_ctx);
+  kmyth_free(*sapi_ctx);
   *sapi_ctx = NULL;
   kmyth_log(LOG_DEBUG, "cleaned up SAPI context");
 
   // Clean up TCTI context
   Tss2_Tcti_Finalize(tcti_ctx);
-  free(tcti_ctx);
+  kmyth_free(tcti_ctx);
   kmyth_log(LOG_DEBUG, "cleaned up TCTI context");
 
   return retval;
@@ -388,46 +1760,140 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
 //############################################################################
 int get_tpm2_impl_type(TSS2_SYS_CONTEXT * sapi_ctx, bool *isEmulator)
 {
-  TPMS_CAPABILITY_DATA capData;
+  uint32_t manufacturer = 0;
+
+  if (get_tpm2_fixed_property(sapi_ctx, TPM2_PT_MANUFACTURER, &manufacturer))
+  {
+    kmyth_log(LOG_ERR, "unable to get TPM2_PT_MANUFACTURER "
+              "property from TPM ... exiting");
+    return 1;
+  }
+
+  // obtain string representation of TPM2_PT_MANUFACTURER property
+  char *manufacturer_str;
+
+  if (unpack_uint32_to_str(manufacturer, &manufacturer_str))
+  {
+    kmyth_log(LOG_ERR, "unable to get vendor string ... exiting");
+    return 1;
+  }
+
+  // Check the manufacturer string against the known simulator manufacturer strings.
+  size_t i = 0;
+
+  *isEmulator = false;
+  while ((simulator_manufacturers[i] != NULL) && (*isEmulator == false))
+  {
+    if (strncmp
+        (manufacturer_str, simulator_manufacturers[i],
+         strlen(simulator_manufacturers[i])) == 0)
+    {
+      *isEmulator = true;
+    }
+    i++;
+  }
+
+  // finished with manufacturer_str
+  kmyth_free(manufacturer_str);
+
+  return 0;
+}
+
+//############################################################################
+// get_tpm2_fixed_property()
+//############################################################################
+int get_tpm2_fixed_property(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2_PT property, uint32_t * value)
+{
+  if (sapi_ctx == NULL || value == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+
+  // work on a copy of the cached properties so that the lock is not held
+  // while waiting on the TPM
+  TPML_TAGGED_TPM_PROPERTY fixed = {.count = 0, };
+  bool cached = false;
+
+  pthread_mutex_lock(&cap_cache_lock);
+  for (size_t i = 0; i < KMYTH_CAP_CACHE_SIZE && !cached; i++)
+  {
+    if (cap_cache[i].sapi_ctx == sapi_ctx)
+    {
+      fixed = cap_cache[i].fixed;
+      cached = true;
+    }
+  }
+  pthread_mutex_unlock(&cap_cache_lock);
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_CAPABILITY, cached);
+
+  // not cached yet - read the whole fixed property group in one command
+  if (!cached)
+  {
+    TPMS_CAPABILITY_DATA capData;
+
+    if (get_tpm2_properties(sapi_ctx,
+                            TPM2_CAP_TPM_PROPERTIES,
+                            TPM2_PT_FIXED, TPM2_MAX_TPM_PROPERTIES, &capData))
+    {
+      kmyth_log(LOG_ERR, "unable to get fixed TPM properties ... exiting");
+      return 1;
+    }
+    fixed = capData.data.tpmProperties;
+
+    pthread_mutex_lock(&cap_cache_lock);
+
+    // prefer an empty entry, otherwise replace the oldest one
+    tpm2_cap_cache_entry *entry = NULL;
+
+    for (size_t i = 0; i < KMYTH_CAP_CACHE_SIZE && entry == NULL; i++)
+    {
+      if (cap_cache[i].sapi_ctx == NULL || cap_cache[i].sapi_ctx == sapi_ctx)
+      {
+        entry = &(cap_cache[i]);
+      }
+    }
+    if (entry == NULL)
+    {
+      entry = &(cap_cache[cap_cache_next]);
+      cap_cache_next = (cap_cache_next + 1) % KMYTH_CAP_CACHE_SIZE;
+    }
 
-  if (get_tpm2_properties(sapi_ctx,
-                          TPM2_CAP_TPM_PROPERTIES,
-                          TPM2_PT_MANUFACTURER, TPM2_PT_GROUP, &capData))
-  {
-    kmyth_log(LOG_ERR, "unable to get TPM2_PT_MANUFACTURER "
-              "property from TPM ... exiting");
-    return 1;
+    entry->sapi_ctx = sapi_ctx;
+    entry->fixed = fixed;
+    pthread_mutex_unlock(&cap_cache_lock);
+    kmyth_log(LOG_DEBUG, "cached %u fixed TPM properties", fixed.count);
   }
 
-  // obtain string representation of TPM2_PT_MANUFACTURER property
-  char *manufacturer_str;
-
-  if (unpack_uint32_to_str(capData.data.tpmProperties.tpmProperty[0].value,
-                           &manufacturer_str))
+  for (uint32_t i = 0; i < fixed.count; i++)
   {
-    kmyth_log(LOG_ERR, "unable to get vendor string ... exiting");
-    return 1;
+    if (fixed.tpmProperty[i].property == property)
+    {
+      *value = fixed.tpmProperty[i].value;
+      return 0;
+    }
   }
 
-  // Check the manufacturer string against the known simulator manufacturer strings.
-  size_t i = 0;
+  kmyth_log(LOG_ERR, "TPM did not report property 0x%08X ... exiting",
+            property);
+  return 1;
+}
 
-  *isEmulator = false;
-  while ((simulator_manufacturers[i] != NULL) && (*isEmulator == false))
+//############################################################################
+// clear_tpm2_capability_cache()
+//############################################################################
+void clear_tpm2_capability_cache(TSS2_SYS_CONTEXT * sapi_ctx)
+{
+  pthread_mutex_lock(&cap_cache_lock);
+  for (size_t i = 0; i < KMYTH_CAP_CACHE_SIZE; i++)
   {
-    if (strncmp
-        (manufacturer_str, simulator_manufacturers[i],
-         strlen(simulator_manufacturers[i])) == 0)
+    if (cap_cache[i].sapi_ctx == sapi_ctx)
     {
-      *isEmulator = true;
+      memset(&(cap_cache[i]), 0, sizeof(tpm2_cap_cache_entry));
     }
-    i++;
   }
-
-  // finished with manufacturer_str
-  free(manufacturer_str);
-
-  return 0;
+  pthread_mutex_unlock(&cap_cache_lock);
 }
 
 //############################################################################
@@ -969,6 +2435,314 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
   return 0;
 }
 
+//############################################################################
+// create_policy_or_digest()
+//############################################################################
+int create_policy_or_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPML_DIGEST * policyBranches,
+                            TPM2B_DIGEST * policyDigest_out)
+{
+  // creates a trial session for calculating the policyOR digest
+  SESSION policySessionOR;
+
+  if (create_auth_session(sapi_ctx, &policySessionOR, TPM2_SE_TRIAL))
+  {
+    kmyth_log(LOG_ERR, "error creating auth session ... exiting");
+    return 1;
+  }
+
+  if (apply_policy_or(sapi_ctx, policySessionOR.sessionHandle,
+                      policyBranches))
+  {
+    kmyth_log(LOG_ERR, "error applying policy OR to session ... exiting");
+    Tss2_Sys_FlushContext(sapi_ctx, policySessionOR.sessionHandle);
+    return 1;
+  }
+
+  // obtains the policy digest from the policyOR calculation
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+
+  policyDigest_out->size = 0;
+  TPM2_RC rc = Tss2_Sys_PolicyGetDigest(sapi_ctx,
+                                        policySessionOR.sessionHandle,
+                                        nullCmdAuths,
+                                        policyDigest_out,
+                                        nullRspAuths);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_Sys_PolicyGetDigest(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    Tss2_Sys_FlushContext(sapi_ctx, policySessionOR.sessionHandle);
+    return 1;
+  }
+
+  // done with trial session, so flush it from the TPM
+  rc = Tss2_Sys_FlushContext(sapi_ctx, policySessionOR.sessionHandle);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// extend_policy_digest()
+//############################################################################
+/**
+ * @brief Updates a policy digest the way the TPM does for a policy command:
+ *        policyDigest = H(policyDigest || commandCode || params)
+ *
+ * @return 0 if success, 1 if error.
+ */
+static int extend_policy_digest(TPM2B_DIGEST * policyDigest,
+                                TPM2_CC cmdCode,
+                                uint8_t * params, size_t params_size)
+{
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+
+  if (!EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  {
+    kmyth_log(LOG_ERR, "error setting up digest context ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+
+  // the command code is hashed in TPM (big-endian) byte order
+  uint32_t cmdCode_be = htonl(cmdCode);
+
+  if (!EVP_DigestUpdate(md_ctx, policyDigest->buffer, policyDigest->size) ||
+      !EVP_DigestUpdate(md_ctx, (uint8_t *) & cmdCode_be, sizeof(cmdCode_be))
+      || !EVP_DigestUpdate(md_ctx, params, params_size))
+  {
+    kmyth_log(LOG_ERR, "error hashing policy command ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+
+  unsigned int digest_size = KMYTH_DIGEST_SIZE;
+
+  if (!EVP_DigestFinal_ex(md_ctx, policyDigest->buffer, &digest_size))
+  {
+    kmyth_log(LOG_ERR, "error finalizing digest ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+  EVP_MD_CTX_destroy(md_ctx);
+  policyDigest->size = (uint16_t) digest_size;
+
+  return 0;
+}
+
+//############################################################################
+// compute_policy_digest()
+//############################################################################
+int compute_policy_digest(TPML_PCR_SELECTION pcrList,
+                          TPM2B_DIGEST pcrDigest,
+                          TPM2B_DIGEST * policyDigest_out)
+{
+  if (policyDigest_out == NULL)
+  {
+    kmyth_log(LOG_ERR, "no buffer available to store digest ... exiting");
+    return 1;
+  }
+
+  // a policy session starts out with an all-zero digest
+  policyDigest_out->size = KMYTH_DIGEST_SIZE;
+  memset(policyDigest_out->buffer, 0, KMYTH_DIGEST_SIZE);
+
+  // TPM2_PolicyAuthValue() has no parameters
+  if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyAuthValue,
+                           NULL, 0))
+  {
+    return 1;
+  }
+
+  // apply_policy() only adds TPM2_PolicyPCR() for a non-empty list
+  if (pcrList.count > 0)
+  {
+    // TPM2_PolicyPCR() hashes the marshalled PCR selection and PCR digest
+    uint8_t params[sizeof(TPML_PCR_SELECTION) + sizeof(TPM2B_DIGEST)];
+    size_t params_size = 0;
+    TSS2_RC rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(&pcrList, params,
+                                                    sizeof(params),
+                                                    &params_size);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "Tss2_MU_TPML_PCR_SELECTION_Marshal(): "
+                "rc = 0x%08X, %s ... exiting", rc, getErrorString(rc));
+      return 1;
+    }
+    memcpy(params + params_size, pcrDigest.buffer, pcrDigest.size);
+    params_size += pcrDigest.size;
+
+    if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyPCR,
+                             params, params_size))
+    {
+      return 1;
+    }
+  }
+  kmyth_log(LOG_DEBUG, "authPolicy (computed): 0x%02X..%02X",
+            policyDigest_out->buffer[0],
+            policyDigest_out->buffer[policyDigest_out->size - 1]);
+
+  return 0;
+}
+
+//############################################################################
+// compute_policy_or_digest()
+//############################################################################
+int compute_policy_or_digest(TPML_DIGEST * policyBranches,
+                             TPM2B_DIGEST * policyDigest_out)
+{
+  if (policyBranches == NULL || policyDigest_out == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+  if (!valid_policy_branches(policyBranches))
+  {
+    kmyth_log(LOG_ERR, "invalid policy branch list ... exiting");
+    return 1;
+  }
+
+  // TPM2_PolicyOR() resets the digest to zero, then hashes the branches
+  uint8_t params[KMYTH_MAX_POLICY_BRANCHES *
+                 sizeof(policyBranches->digests[0].buffer)];
+  size_t params_size = 0;
+
+  for (uint32_t i = 0; i < policyBranches->count; i++)
+  {
+    memcpy(params + params_size, policyBranches->digests[i].buffer,
+           policyBranches->digests[i].size);
+    params_size += policyBranches->digests[i].size;
+  }
+
+  policyDigest_out->size = KMYTH_DIGEST_SIZE;
+  memset(policyDigest_out->buffer, 0, KMYTH_DIGEST_SIZE);
+
+  return extend_policy_digest(policyDigest_out, TPM2_CC_PolicyOR,
+                              params, params_size);
+}
+
+//############################################################################
+// compute_policy_authorize_digest()
+//############################################################################
+int compute_policy_authorize_digest(TPM2B_NAME * keySign,
+                                    TPM2B_DIGEST * policyDigest_out)
+{
+  if (keySign == NULL || keySign->size == 0 ||
+      keySign->size > sizeof(keySign->name) || policyDigest_out == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid input parameter ... exiting");
+    return 1;
+  }
+
+  // TPM2_PolicyAuthorize() resets the digest to zero, hashes in the key
+  // name, then hashes the result again with the (empty) policyRef
+  policyDigest_out->size = KMYTH_DIGEST_SIZE;
+  memset(policyDigest_out->buffer, 0, KMYTH_DIGEST_SIZE);
+  if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyAuthorize,
+                           keySign->name, keySign->size))
+  {
+    return 1;
+  }
+
+  unsigned int digest_size = KMYTH_DIGEST_SIZE;
+
+  if (!EVP_Digest(policyDigest_out->buffer, policyDigest_out->size,
+                  policyDigest_out->buffer, &digest_size,
+                  KMYTH_OPENSSL_HASH, NULL))
+  {
+    kmyth_log(LOG_ERR, "error hashing policyRef ... exiting");
+    return 1;
+  }
+  policyDigest_out->size = (uint16_t) digest_size;
+
+  return 0;
+}
+
+//############################################################################
+// verify_policy_signature()
+//############################################################################
+int verify_policy_signature(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2B_PUBLIC * authorizingKey,
+                            TPM2B_DIGEST * approvedPolicy,
+                            TPMT_SIGNATURE * signature,
+                            POLICY_AUTHORIZATION * authorization)
+{
+  if (authorizingKey == NULL || approvedPolicy == NULL ||
+      approvedPolicy->size == 0 || signature == NULL ||
+      authorization == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input parameter ... exiting");
+    return 1;
+  }
+
+  // the signature covers aHash = H(approvedPolicy || policyRef), with an
+  // empty policyRef
+  TPM2B_DIGEST aHash = {.size = 0, };
+  unsigned int aHash_size = KMYTH_DIGEST_SIZE;
+
+  if (!EVP_Digest(approvedPolicy->buffer, approvedPolicy->size,
+                  aHash.buffer, &aHash_size, KMYTH_OPENSSL_HASH, NULL))
+  {
+    kmyth_log(LOG_ERR, "error hashing approved policy ... exiting");
+    return 1;
+  }
+  aHash.size = (uint16_t) aHash_size;
+
+  // only the public part is loaded, under a hierarchy other than the NULL
+  // one, as tickets produced for the NULL hierarchy are never valid
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  TPM2_HANDLE keyHandle = 0;
+
+  authorization->keySign.size = 0;
+  TPM2_RC rc = Tss2_Sys_LoadExternal(sapi_ctx, nullCmdAuths, NULL,
+                                     authorizingKey, TPM2_RH_OWNER,
+                                     &keyHandle, &authorization->keySign,
+                                     nullRspAuths);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_LoadExternal(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  rc = Tss2_Sys_VerifySignature(sapi_ctx, keyHandle, nullCmdAuths, &aHash,
+                                signature, &authorization->checkTicket,
+                                nullRspAuths);
+
+  TPM2_RC flush_rc = Tss2_Sys_FlushContext(sapi_ctx, keyHandle);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_VerifySignature(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+  if (flush_rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s", flush_rc,
+              getErrorString(flush_rc));
+    return 1;
+  }
+  authorization->approvedPolicy = *approvedPolicy;
+  kmyth_log(LOG_DEBUG, "verified signed policy 0x%02X..%02X",
+            approvedPolicy->buffer[0],
+            approvedPolicy->buffer[approvedPolicy->size - 1]);
+
+  return 0;
+}
+
 //############################################################################
 // create_auth_session
 //############################################################################
@@ -1151,7 +2925,8 @@ int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
 int unseal_apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
                         TPM2_HANDLE policySessionHandle,
                         TPML_PCR_SELECTION policySession_pcrList,
-                        TPM2B_DIGEST policy1, TPM2B_DIGEST policy2)
+                        TPML_DIGEST policyBranches,
+                        POLICY_AUTHORIZATION * authorization)
 {
 
   if (apply_policy(sapi_ctx, policySessionHandle, policySession_pcrList))
@@ -1159,16 +2934,16 @@ int unseal_apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
-  TPML_DIGEST pHashList = {.count = 0 };
-  for (size_t i = 0; i < 8; i++)
+  if (policyBranches.count > 0 &&
+      apply_policy_or(sapi_ctx, policySessionHandle, &policyBranches))
   {
-    pHashList.digests[i].size = 0;
+    return 1;
   }
 
-  if (policy1.size != 0 && policy2.size != 0)
+  if (authorization != NULL &&
+      apply_policy_authorize(sapi_ctx, policySessionHandle, authorization))
   {
-    apply_policy_or(sapi_ctx, policySessionHandle, &policy1, &policy2,
-                    &pHashList);
+    return 1;
   }
   return 0;
 }
@@ -1177,37 +2952,111 @@ int unseal_apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
 // apply_policy_or()
 //############################################################################
 int apply_policy_or(TSS2_SYS_CONTEXT * sapi_ctx,
-                    TPM2_HANDLE policySessionHandle, TPM2B_DIGEST * policy1,
-                    TPM2B_DIGEST * policy2, TPML_DIGEST * pHashList)
+                    TPM2_HANDLE policySessionHandle,
+                    TPML_DIGEST * policyBranches)
 {
-  // Apply authorization value (AuthValue) policy command
+  if (policyBranches == NULL || !valid_policy_branches(policyBranches))
+  {
+    kmyth_log(LOG_ERR, "invalid policy branch list ... exiting");
+    return 1;
+  }
+
   TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
   TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
 
-  // initializing all digests to empty buffers
-  for (size_t i; i < 8; i++)
+  TPM2_RC rc =
+    Tss2_Sys_PolicyOR(sapi_ctx, policySessionHandle, nullCmdAuths,
+                      policyBranches, nullRspAuths);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_PolicyOR(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "applied PCR policyOR (%u branches) to session "
+            "context", policyBranches->count);
+  return 0;
+}
+
+//############################################################################
+// apply_policy_authorize()
+//############################################################################
+int apply_policy_authorize(TSS2_SYS_CONTEXT * sapi_ctx,
+                           TPM2_HANDLE policySessionHandle,
+                           POLICY_AUTHORIZATION * authorization)
+{
+  if (authorization == NULL)
   {
-    pHashList->digests[0].size = 0;
+    kmyth_log(LOG_ERR, "NULL policy authorization ... exiting");
+    return 1;
   }
 
-  pHashList->count = 2;
-  pHashList->digests[0] = *policy1;
-  pHashList->digests[1] = *policy2;
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  TPM2B_NONCE policyRef = {.size = 0, };
 
-  TPM2_RC rc =
-    Tss2_Sys_PolicyOR(sapi_ctx, policySessionHandle, nullCmdAuths, pHashList,
-                      nullRspAuths);
+  TPM2_RC rc = Tss2_Sys_PolicyAuthorize(sapi_ctx, policySessionHandle,
+                                        nullCmdAuths,
+                                        &authorization->approvedPolicy,
+                                        &policyRef, &authorization->keySign,
+                                        &authorization->checkTicket,
+                                        nullRspAuths);
 
   if (rc != TPM2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_PolicyOR(): rc = 0x%08X, %s", rc,
+    kmyth_log(LOG_ERR, "Tss2_Sys_PolicyAuthorize(): rc = 0x%08X, %s", rc,
               getErrorString(rc));
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "applied PCR policyOR to session context");
+  kmyth_log(LOG_DEBUG, "applied PolicyAuthorize to session context");
   return 0;
 }
 
+//############################################################################
+// valid_policy_branches()
+//############################################################################
+bool valid_policy_branches(const TPML_DIGEST * policyBranches)
+{
+  if (policyBranches->count < KMYTH_MIN_POLICY_BRANCHES ||
+      policyBranches->count > KMYTH_MAX_POLICY_BRANCHES)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < policyBranches->count; i++)
+  {
+    if (policyBranches->digests[i].size == 0 ||
+        policyBranches->digests[i].size >
+        sizeof(policyBranches->digests[i].buffer))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//############################################################################
+// digest_list_equal()
+//############################################################################
+bool digest_list_equal(const TPML_DIGEST * a, const TPML_DIGEST * b)
+{
+  if (a->count != b->count || a->count > KMYTH_MAX_POLICY_BRANCHES)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < a->count; i++)
+  {
+    if (a->digests[i].size != b->digests[i].size ||
+        a->digests[i].size > sizeof(a->digests[i].buffer) ||
+        memcmp(a->digests[i].buffer, b->digests[i].buffer,
+               a->digests[i].size) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
 //############################################################################
 // create_caller_nonce()
 //############################################################################
@@ -0,0 +1,579 @@
+/*
+ * Kmyth Cipher Benchmark
+ *
+ * Runs every cipher in cipher_list[] through kmyth_encrypt_data() and
+ * kmyth_decrypt_data() over a range of payload sizes and reports the
+ * throughput, cycles per byte and heap allocations per operation of each,
+ * as a table and (optionally) as JSON. No TPM is needed.
+ *
+ * With --huge_pages, the payloads (plaintext and ciphertext) are held in a
+ * secure arena backed by huge pages where available, instead of on the
+ * heap, so that running both ways shows the gain for large payloads.
+ */
+
+#include <getopt.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#else
+#define BENCH_HAVE_CYCLES 0
+#endif
+
+#include "defines.h"
+#include "cipher/cipher.h"
+#include "kmyth_log.h"
+#include "memory_util.h"
+
+#define BENCH_DEFAULT_MIN_TIME_MS 250
+#define BENCH_DEFAULT_MAX_SIZE (1UL << 30)
+
+extern const cipher_t cipher_list[];
+
+/**
+ * @brief Payload sizes (bytes) benchmarked, up to the --max_size limit
+ */
+static const size_t bench_sizes[] = {
+  32, 256, 4096, 65536, 1UL << 20, 16UL << 20, 256UL << 20, 1UL << 30
+};
+
+/**
+ * @brief Results of benchmarking one operation of one cipher at one size
+ */
+typedef struct
+{
+  const char *cipher_name;
+  const char *op;
+  size_t size;
+
+  size_t completed;
+  size_t failures;
+  uint64_t total_ns;
+  uint64_t cycles;
+  uint64_t allocations;
+} bench_result;
+
+//############################################################################
+// Heap allocation counting
+//
+// The benchmark replaces malloc(), calloc() and realloc() for the whole
+// process (the Kmyth libraries and OpenSSL included) with versions that
+// count the calls before handing them to the C library.
+//############################################################################
+static atomic_ullong bench_allocations = 0;
+
+#ifdef __GLIBC__
+#define BENCH_HAVE_ALLOC_COUNT 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+  atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+#else
+#define BENCH_HAVE_ALLOC_COUNT 0
+#endif
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -c or --cipher        Only benchmark this cipher (may be repeated). Defaults to every cipher.\n"
+          " -t or --time          Minimum time (milliseconds) spent on each operation and size. Defaults to %d.\n"
+          " -m or --max_size      Largest payload size (bytes) benchmarked. Defaults to %lu.\n"
+          " -o or --output        Also write the results as JSON to this file ('-' for stdout).\n"
+          " -H or --huge_pages    Hold the payloads in a huge page backed arena instead of on the heap.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          BENCH_DEFAULT_MIN_TIME_MS, BENCH_DEFAULT_MAX_SIZE);
+}
+
+const struct option longopts[] = {
+  {"cipher", required_argument, 0, 'c'},
+  {"time", required_argument, 0, 't'},
+  {"max_size", required_argument, 0, 'm'},
+  {"output", required_argument, 0, 'o'},
+  {"huge_pages", no_argument, 0, 'H'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// pages_name()
+//############################################################################
+static const char *pages_name(const kmyth_arena * arena)
+{
+  if (arena == NULL)
+  {
+    return "heap";
+  }
+  switch (arena->pages)
+  {
+  case KMYTH_ARENA_PAGES_HUGETLB:
+    return "hugetlb";
+  case KMYTH_ARENA_PAGES_TRANSPARENT:
+    return "transparent";
+  default:
+    return "base";
+  }
+}
+
+//############################################################################
+// now_ns()
+//############################################################################
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// now_cycles()
+//############################################################################
+static uint64_t now_cycles(void)
+{
+#if BENCH_HAVE_CYCLES
+  // time stamp counter: reference cycles at the nominal CPU frequency
+  return (uint64_t) __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+//############################################################################
+// mb_per_sec()
+//############################################################################
+static double mb_per_sec(bench_result * r)
+{
+  return (r->total_ns == 0) ? 0.0 :
+    (double) r->size * (double) r->completed * 1000.0 / (double) r->total_ns;
+}
+
+//############################################################################
+// cycles_per_byte()
+//############################################################################
+static double cycles_per_byte(bench_result * r)
+{
+  return (r->completed == 0) ? 0.0 :
+    (double) r->cycles / ((double) r->size * (double) r->completed);
+}
+
+//############################################################################
+// allocs_per_op()
+//############################################################################
+static double allocs_per_op(bench_result * r)
+{
+  return (r->completed == 0) ? 0.0 :
+    (double) r->allocations / (double) r->completed;
+}
+
+//############################################################################
+// bench_encrypt()
+//############################################################################
+static int bench_encrypt(cipher_t cipher, uint8_t * input, size_t size,
+                         uint8_t * key, size_t key_len,
+                         uint64_t min_time_ns, bench_result * result)
+{
+  uint64_t start = now_ns();
+  uint64_t allocs = atomic_load(&bench_allocations);
+  uint64_t cycles = now_cycles();
+
+  do
+  {
+    uint8_t *enc_data = NULL;
+    size_t enc_data_len = 0;
+    size_t enc_key_len = key_len;
+
+    if (kmyth_encrypt_data(input, size, cipher, &enc_data, &enc_data_len,
+                           &key, &enc_key_len))
+    {
+      result->failures++;
+      break;
+    }
+    free(enc_data);
+    result->completed++;
+  }
+  while (now_ns() - start < min_time_ns);
+
+  result->cycles = now_cycles() - cycles;
+  result->allocations = atomic_load(&bench_allocations) - allocs;
+  result->total_ns = now_ns() - start;
+
+  return (result->failures > 0);
+}
+
+//############################################################################
+// bench_decrypt()
+//############################################################################
+static int bench_decrypt(cipher_t cipher, uint8_t * input, size_t size,
+                         uint8_t * key, size_t key_len, kmyth_arena * arena,
+                         uint64_t min_time_ns, bench_result * result)
+{
+  // untimed: the ciphertext decrypted by the timed iterations
+  uint8_t *enc_data = NULL;
+  size_t enc_data_len = 0;
+  size_t enc_key_len = key_len;
+
+  if (kmyth_encrypt_data(input, size, cipher, &enc_data, &enc_data_len,
+                         &key, &enc_key_len))
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt %zu bytes with %s ... exiting",
+              size, cipher.cipher_name);
+    result->failures++;
+    return 1;
+  }
+
+  // with an arena, decrypt from a copy of the ciphertext held in it
+  uint8_t *held = kmyth_arena_alloc(arena, enc_data_len);
+
+  if (held != NULL)
+  {
+    memcpy(held, enc_data, enc_data_len);
+    free(enc_data);
+    enc_data = held;
+  }
+
+  uint64_t start = now_ns();
+  uint64_t allocs = atomic_load(&bench_allocations);
+  uint64_t cycles = now_cycles();
+  bool mismatch = false;
+
+  do
+  {
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+
+    if (kmyth_decrypt_data(enc_data, enc_data_len, cipher, key, key_len,
+                           &output, &output_len))
+    {
+      result->failures++;
+      break;
+    }
+    if (result->completed == 0)
+    {
+      mismatch = (output_len != size || memcmp(output, input, size) != 0);
+    }
+    free(output);
+    result->completed++;
+  }
+  while (now_ns() - start < min_time_ns);
+
+  result->cycles = now_cycles() - cycles;
+  result->allocations = atomic_load(&bench_allocations) - allocs;
+  result->total_ns = now_ns() - start;
+  if (held != NULL)
+  {
+    kmyth_arena_release(arena, held, enc_data_len);
+  }
+  else
+  {
+    free(enc_data);
+  }
+
+  if (mismatch)
+  {
+    kmyth_log(LOG_ERR, "%s decrypted data does not match ... exiting",
+              cipher.cipher_name);
+    result->failures++;
+  }
+
+  return (result->failures > 0);
+}
+
+//############################################################################
+// print_results()
+//############################################################################
+static void print_results(bench_result * results, size_t count)
+{
+  fprintf(stdout, "%-34s %-8s %11s %8s %10s %10s %10s %7s\n", "cipher",
+          "op", "size (B)", "ops", "MB/s", "cycles/B", "allocs/op",
+          "failed");
+  for (size_t i = 0; i < count; i++)
+  {
+    bench_result *r = &(results[i]);
+
+    fprintf(stdout, "%-34s %-8s %11zu %8zu %10.1f ", r->cipher_name, r->op,
+            r->size, r->completed, mb_per_sec(r));
+    if (BENCH_HAVE_CYCLES)
+    {
+      fprintf(stdout, "%10.2f ", cycles_per_byte(r));
+    }
+    else
+    {
+      fprintf(stdout, "%10s ", "-");
+    }
+    if (BENCH_HAVE_ALLOC_COUNT)
+    {
+      fprintf(stdout, "%10.1f ", allocs_per_op(r));
+    }
+    else
+    {
+      fprintf(stdout, "%10s ", "-");
+    }
+    fprintf(stdout, "%7zu\n", r->failures);
+  }
+}
+
+//############################################################################
+// write_json_results()
+//############################################################################
+static int write_json_results(const char *path, uint64_t min_time_ms,
+                              const char *pages, bench_result * results,
+                              size_t count)
+{
+  FILE *out = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open %s ... exiting", path);
+    return 1;
+  }
+
+  fprintf(out, "{\n  \"version\": \"%s\",\n", KMYTH_VERSION);
+  fprintf(out, "  \"min_time_ms\": %llu,\n",
+          (unsigned long long) min_time_ms);
+  fprintf(out, "  \"pages\": \"%s\",\n", pages);
+  fprintf(out, "  \"cycles\": %s,\n  \"allocations\": %s,\n",
+          BENCH_HAVE_CYCLES ? "true" : "false",
+          BENCH_HAVE_ALLOC_COUNT ? "true" : "false");
+  fprintf(out, "  \"results\": [");
+  for (size_t i = 0; i < count; i++)
+  {
+    bench_result *r = &(results[i]);
+
+    fprintf(out, "%s\n    {\"cipher\": \"%s\", \"op\": \"%s\", "
+            "\"size\": %zu, \"completed\": %zu, \"failures\": %zu, "
+            "\"total_ns\": %llu, \"mb_per_sec\": %.3f, "
+            "\"cycles_per_byte\": %.3f, \"allocs_per_op\": %.2f}",
+            (i == 0) ? "" : ",", r->cipher_name, r->op, r->size,
+            r->completed, r->failures, (unsigned long long) r->total_ns,
+            mb_per_sec(r), cycles_per_byte(r), allocs_per_op(r));
+  }
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout && fclose(out) != 0)
+  {
+    kmyth_log(LOG_ERR, "error writing %s ... exiting", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Initialize parameters that might be modified by command line options
+  const char *cipherNames[32];
+  size_t cipherNameCount = 0;
+  unsigned long minTimeMs = BENCH_DEFAULT_MIN_TIME_MS;
+  unsigned long maxSize = BENCH_DEFAULT_MAX_SIZE;
+  char *outPath = NULL;
+  bool hugePages = false;
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "c:t:m:o:Hhv", longopts,
+                                &option_index)) != -1)
+  {
+    char *end = NULL;
+
+    switch (options)
+    {
+    case 'c':
+      if (kmyth_get_cipher_t_from_string(optarg).cipher_name == NULL ||
+          cipherNameCount == sizeof(cipherNames) / sizeof(cipherNames[0]))
+      {
+        kmyth_log(LOG_ERR, "invalid or too many ciphers (%s) ... exiting",
+                  optarg);
+        return 1;
+      }
+      cipherNames[cipherNameCount++] = optarg;
+      break;
+    case 't':
+      minTimeMs = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0')
+      {
+        kmyth_log(LOG_ERR, "invalid minimum time (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'm':
+      maxSize = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || maxSize < bench_sizes[0])
+      {
+        kmyth_log(LOG_ERR, "invalid maximum size (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'H':
+      hugePages = true;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  size_t size_count = 0;
+
+  while (size_count < sizeof(bench_sizes) / sizeof(bench_sizes[0]) &&
+         bench_sizes[size_count] <= maxSize)
+  {
+    size_count++;
+  }
+
+  size_t cipher_count = 0;
+
+  while (cipher_list[cipher_count].cipher_name != NULL)
+  {
+    cipher_count++;
+  }
+
+  // every size is a prefix of one input buffer; with --huge_pages, the
+  // arena also has room for the ciphertext of the largest size (plus
+  // whatever IV and tag the ciphers add)
+  size_t input_len = bench_sizes[size_count - 1];
+  kmyth_arena arena_storage;
+  kmyth_arena *arena = NULL;
+  uint8_t *input = NULL;
+
+  if (hugePages)
+  {
+    if (kmyth_arena_init(&arena_storage, 2 * input_len + 4096))
+    {
+      kmyth_log(LOG_ERR, "unable to map benchmark arena ... exiting");
+      return 1;
+    }
+    arena = &arena_storage;
+    input = kmyth_arena_alloc(arena, input_len);
+  }
+  else
+  {
+    input = malloc(input_len);
+  }
+
+  if (input == NULL)
+  {
+    kmyth_log(LOG_ERR, "allocation for benchmark input failed ... exiting");
+    kmyth_arena_free(arena);
+    return 1;
+  }
+  for (size_t i = 0; i < input_len; i++)
+  {
+    input[i] = (uint8_t) (i * 31 + 7);
+  }
+
+  bench_result *results = calloc(cipher_count * size_count * 2,
+                                 sizeof(bench_result));
+
+  if (results == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for benchmark results failed ... exiting");
+    kmyth_arena_release(arena, input, input_len);
+    kmyth_arena_free(arena);
+    return 1;
+  }
+
+  size_t count = 0;
+  int retval = 0;
+  uint64_t min_time_ns = (uint64_t) minTimeMs * 1000000;
+
+  for (size_t c = 0; c < cipher_count; c++)
+  {
+    cipher_t cipher = cipher_list[c];
+    bool selected = (cipherNameCount == 0);
+
+    for (size_t i = 0; i < cipherNameCount && !selected; i++)
+    {
+      selected = (strcmp(cipherNames[i], cipher.cipher_name) == 0);
+    }
+    if (!selected)
+    {
+      continue;
+    }
+
+    uint8_t key[32];
+    size_t key_len = get_key_len_from_cipher(cipher) / 8;
+
+    for (size_t s = 0; s < size_count; s++)
+    {
+      bench_result *enc = &(results[count++]);
+      bench_result *dec = &(results[count++]);
+
+      enc->cipher_name = dec->cipher_name = cipher.cipher_name;
+      enc->size = dec->size = bench_sizes[s];
+      enc->op = "encrypt";
+      dec->op = "decrypt";
+
+      // a failing cipher or size is reported, but does not stop the others
+      if (bench_encrypt(cipher, input, bench_sizes[s], key, key_len,
+                        min_time_ns, enc) ||
+          bench_decrypt(cipher, input, bench_sizes[s], key, key_len, arena,
+                        min_time_ns, dec))
+      {
+        retval = 1;
+      }
+    }
+    kmyth_clear(key, sizeof(key));
+  }
+
+  fprintf(stdout, "payload pages: %s\n", pages_name(arena));
+  print_results(results, count);
+  if (outPath != NULL &&
+      write_json_results(outPath, (uint64_t) minTimeMs, pages_name(arena),
+                         results, count))
+  {
+    retval = 1;
+  }
+
+  free(results);
+  kmyth_arena_release(arena, input, input_len);
+  kmyth_arena_free(arena);
+
+  return retval;
+}
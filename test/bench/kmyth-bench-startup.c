@@ -0,0 +1,381 @@
+/*
+ * Kmyth CLI Start-up Benchmark
+ *
+ * Repeatedly runs the Kmyth command line tools with arguments that do no
+ * TPM, network or file work (e.g., -h), and reports the wall clock time
+ * of each run (process creation, dynamic loading and initialization
+ * through exit), as a table and (optionally) as JSON. No TPM is needed.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "defines.h"
+#include "kmyth_log.h"
+
+#define BENCH_DEFAULT_ITERATIONS 200
+#define BENCH_DEFAULT_BIN_DIR "bin"
+
+extern char **environ;
+
+/**
+ * @brief A command line timed: tool (in the binary directory) and its
+ *        arguments
+ */
+typedef struct
+{
+  const char *tool;
+  const char *args[3];
+} bench_case;
+
+static const bench_case bench_cases[] = {
+  {"kmyth-seal", {"-h", NULL}},
+  {"kmyth-seal", {"-l", NULL}},
+  {"kmyth-unseal", {"-h", NULL}},
+  {"kmyth-getkey", {"-h", NULL}},
+  {NULL, {NULL}}
+};
+
+/**
+ * @brief Results of benchmarking one command line
+ */
+typedef struct
+{
+  char name[64];
+
+  // per-run wall clock times (microseconds), sorted once the runs complete
+  uint64_t *latency_us;
+  size_t completed;
+  size_t failures;
+} bench_result;
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -n or --iterations    Number of timed runs of each command line. Defaults to %d.\n"
+          " -b or --bin_dir       Directory holding the Kmyth tools. Defaults to '%s'.\n"
+          " -o or --output        Also write the results as JSON to this file ('-' for stdout).\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          BENCH_DEFAULT_ITERATIONS, BENCH_DEFAULT_BIN_DIR);
+}
+
+const struct option longopts[] = {
+  {"iterations", required_argument, 0, 'n'},
+  {"bin_dir", required_argument, 0, 'b'},
+  {"output", required_argument, 0, 'o'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// now_us()
+//############################################################################
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+//############################################################################
+// compare_u64()
+//############################################################################
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//############################################################################
+// percentile_us()
+//############################################################################
+static uint64_t percentile_us(bench_result * result, unsigned int pct)
+{
+  if (result->completed == 0)
+  {
+    return 0;
+  }
+
+  // nearest-rank percentile of the sorted latencies
+  size_t rank = (result->completed * pct + 99) / 100;
+
+  return result->latency_us[(rank == 0) ? 0 : rank - 1];
+}
+
+//############################################################################
+// mean_us()
+//############################################################################
+static double mean_us(bench_result * result)
+{
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < result->completed; i++)
+  {
+    total += result->latency_us[i];
+  }
+
+  return (result->completed == 0) ? 0.0 :
+    (double) total / (double) result->completed;
+}
+
+//############################################################################
+// run_once()
+//
+// Runs a command line to completion, with its output discarded. Returns 0
+// if it exited with status 0.
+//############################################################################
+static int run_once(char *path, char **argv,
+                    posix_spawn_file_actions_t * actions)
+{
+  pid_t pid;
+  int status = 0;
+
+  if (posix_spawn(&pid, path, actions, NULL, argv, environ) != 0)
+  {
+    return 1;
+  }
+  if (waitpid(pid, &status, 0) != pid)
+  {
+    return 1;
+  }
+
+  return !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+//############################################################################
+// bench_command()
+//############################################################################
+static int bench_command(const char *bin_dir, const bench_case * c,
+                         size_t iterations,
+                         posix_spawn_file_actions_t * actions,
+                         bench_result * result)
+{
+  char path[4096];
+  char *argv[4] = { path, NULL, NULL, NULL };
+
+  snprintf(path, sizeof(path), "%s/%s", bin_dir, c->tool);
+  snprintf(result->name, sizeof(result->name), "%s", c->tool);
+  for (size_t i = 0; i < 2 && c->args[i] != NULL; i++)
+  {
+    argv[i + 1] = (char *) c->args[i];
+    strncat(result->name, " ", sizeof(result->name) -
+            strlen(result->name) - 1);
+    strncat(result->name, c->args[i], sizeof(result->name) -
+            strlen(result->name) - 1);
+  }
+
+  result->latency_us = calloc(iterations, sizeof(uint64_t));
+  if (result->latency_us == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for latencies failed ... exiting");
+    return 1;
+  }
+
+  // one untimed run, so that every timed run finds the tool's pages (and
+  // those of the libraries it loads) in the page cache
+  if (run_once(path, argv, actions))
+  {
+    kmyth_log(LOG_ERR, "unable to run %s ... exiting", result->name);
+    result->failures++;
+    return 1;
+  }
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    uint64_t start = now_us();
+
+    if (run_once(path, argv, actions))
+    {
+      result->failures++;
+      continue;
+    }
+    result->latency_us[result->completed++] = now_us() - start;
+  }
+  qsort(result->latency_us, result->completed, sizeof(uint64_t), compare_u64);
+
+  return (result->failures > 0);
+}
+
+//############################################################################
+// print_results()
+//############################################################################
+static void print_results(bench_result * results, size_t count)
+{
+  fprintf(stdout, "%-24s %10s %10s %10s %10s %8s\n", "command", "mean (us)",
+          "min (us)", "p50 (us)", "p99 (us)", "failed");
+  for (size_t i = 0; i < count; i++)
+  {
+    bench_result *r = &(results[i]);
+
+    fprintf(stdout, "%-24s %10.0f %10llu %10llu %10llu %8zu\n", r->name,
+            mean_us(r),
+            (unsigned long long) ((r->completed > 0) ? r->latency_us[0] : 0),
+            (unsigned long long) percentile_us(r, 50),
+            (unsigned long long) percentile_us(r, 99), r->failures);
+  }
+}
+
+//############################################################################
+// write_json_results()
+//############################################################################
+static int write_json_results(const char *path, size_t iterations,
+                              bench_result * results, size_t count)
+{
+  FILE *out = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open %s ... exiting", path);
+    return 1;
+  }
+
+  fprintf(out, "{\n  \"version\": \"%s\",\n", KMYTH_VERSION);
+  fprintf(out, "  \"iterations\": %zu,\n", iterations);
+  fprintf(out, "  \"commands\": [");
+  for (size_t i = 0; i < count; i++)
+  {
+    bench_result *r = &(results[i]);
+
+    fprintf(out, "%s\n    {\"command\": \"%s\", \"completed\": %zu, "
+            "\"failures\": %zu, \"mean_us\": %.1f, \"min_us\": %llu, "
+            "\"p50_us\": %llu, \"p99_us\": %llu}", (i == 0) ? "" : ",",
+            r->name, r->completed, r->failures, mean_us(r),
+            (unsigned long long) ((r->completed > 0) ? r->latency_us[0] : 0),
+            (unsigned long long) percentile_us(r, 50),
+            (unsigned long long) percentile_us(r, 99));
+  }
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout && fclose(out) != 0)
+  {
+    kmyth_log(LOG_ERR, "error writing %s ... exiting", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Initialize parameters that might be modified by command line options
+  unsigned long iterations = BENCH_DEFAULT_ITERATIONS;
+  char *binDir = BENCH_DEFAULT_BIN_DIR;
+  char *outPath = NULL;
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "n:b:o:hv", longopts,
+                                &option_index)) != -1)
+  {
+    char *end = NULL;
+
+    switch (options)
+    {
+    case 'n':
+      iterations = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || iterations == 0)
+      {
+        kmyth_log(LOG_ERR, "invalid iteration count (%s) ... exiting",
+                  optarg);
+        return 1;
+      }
+      break;
+    case 'b':
+      binDir = optarg;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  // the tools' output (usage text) goes nowhere
+  posix_spawn_file_actions_t actions;
+
+  if (posix_spawn_file_actions_init(&actions) != 0 ||
+      posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                       O_WRONLY, 0) != 0 ||
+      posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+                                       O_WRONLY, 0) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to set up tool output ... exiting");
+    return 1;
+  }
+
+  size_t count = 0;
+
+  while (bench_cases[count].tool != NULL)
+  {
+    count++;
+  }
+
+  bench_result *results = calloc(count, sizeof(bench_result));
+
+  if (results == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for benchmark results failed ... exiting");
+    posix_spawn_file_actions_destroy(&actions);
+    return 1;
+  }
+
+  int retval = 0;
+
+  // a failing command line is reported, but does not stop the others
+  for (size_t i = 0; i < count; i++)
+  {
+    if (bench_command(binDir, &(bench_cases[i]), iterations, &actions,
+                      &(results[i])))
+    {
+      retval = 1;
+    }
+  }
+
+  print_results(results, count);
+  if (outPath != NULL &&
+      write_json_results(outPath, iterations, results, count))
+  {
+    retval = 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(results[i].latency_us);
+  }
+  free(results);
+  posix_spawn_file_actions_destroy(&actions);
+
+  return retval;
+}
@@ -0,0 +1,588 @@
+/*
+ * Kmyth TPM Benchmark - TPM 2.0
+ *
+ * Repeatedly runs the Kmyth seal, unseal, reseal, SRK lookup and policy
+ * session operations against the configured TPM (or simulator) and reports
+ * throughput, latency percentiles, the per-TPM-command cost and the heap
+ * allocations (by phase, and peak memory) of each operation, as a table and
+ * (optionally) as JSON.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defines.h"
+#include "kmyth.h"
+#include "kmyth_context.h"
+#include "kmyth_log.h"
+#include "kmyth_mock_tpm.h"
+#include "memory_util.h"
+#include "storage_key_tools.h"
+#include "tpm2_interface.h"
+
+#define BENCH_DEFAULT_ITERATIONS 100
+#define BENCH_DEFAULT_WARMUP 1
+#define BENCH_DEFAULT_INPUT_SIZE 32
+
+/**
+ * @brief Results of benchmarking one operation
+ */
+typedef struct
+{
+  const char *name;
+
+  // per-iteration latencies (microseconds), sorted once the run completes
+  uint64_t *latency_us;
+  size_t completed;
+  size_t failures;
+
+  // wall clock time for all iterations
+  uint64_t total_us;
+
+  // TPM commands issued by the timed iterations
+  kmyth_tpm_cmd_stats *tpm_stats;
+  size_t tpm_stats_count;
+
+  // Kmyth heap allocations made by the timed iterations (by phase, then in
+  // total), and the most heap memory an iteration added
+  kmyth_alloc_stats alloc_stats[KMYTH_ALLOC_PHASE_COUNT + 1];
+  uint64_t alloc_peak_bytes;
+} bench_result;
+
+/**
+ * @brief State shared by the benchmarked operations
+ */
+typedef struct
+{
+  kmyth_ctx_t *ctx;
+  uint8_t *input;
+  size_t input_len;
+
+  // .ski produced by the setup seal, input to the unseal/reseal benchmarks
+  uint8_t *ski;
+  size_t ski_len;
+} bench_state;
+
+typedef int (*bench_op_fn) (bench_state * state);
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -n or --iterations    Number of timed iterations of each operation. Defaults to %d.\n"
+          " -w or --warmup        Number of untimed iterations run first. Defaults to %d.\n"
+          " -s or --size          Size (bytes) of the data sealed. Defaults to %d.\n"
+          " -o or --output        Also write the results as JSON to this file ('-' for stdout).\n"
+          " -T or --tcti          TPM connection: auto, device[:path], abrmd, mssim[:conf], swtpm[:conf] or mock[:conf].\n"
+          "                       Defaults to $%s, else '%s'.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          BENCH_DEFAULT_ITERATIONS, BENCH_DEFAULT_WARMUP,
+          BENCH_DEFAULT_INPUT_SIZE, KMYTH_TCTI_ENV, KMYTH_DEFAULT_TCTI);
+}
+
+const struct option longopts[] = {
+  {"iterations", required_argument, 0, 'n'},
+  {"warmup", required_argument, 0, 'w'},
+  {"size", required_argument, 0, 's'},
+  {"output", required_argument, 0, 'o'},
+  {"tcti", required_argument, 0, 'T'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+//############################################################################
+// now_us()
+//############################################################################
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+//############################################################################
+// compare_u64()
+//############################################################################
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//############################################################################
+// percentile_us()
+//############################################################################
+static uint64_t percentile_us(bench_result * result, unsigned int pct)
+{
+  if (result->completed == 0)
+  {
+    return 0;
+  }
+
+  // nearest-rank percentile of the sorted latencies
+  size_t rank = (result->completed * pct + 99) / 100;
+
+  return result->latency_us[(rank == 0) ? 0 : rank - 1];
+}
+
+//############################################################################
+// tpm_us_per_op()
+//############################################################################
+static double tpm_us_per_op(bench_result * result)
+{
+  uint64_t tpm_us = 0;
+
+  for (size_t i = 0; i < result->tpm_stats_count; i++)
+  {
+    tpm_us += result->tpm_stats[i].total_us;
+  }
+
+  return (result->completed == 0) ? 0.0 :
+    (double) tpm_us / (double) result->completed;
+}
+
+//############################################################################
+// bench_seal()
+//############################################################################
+static int bench_seal(bench_state * state)
+{
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval = tpm2_kmyth_seal_ctx(state->ctx, state->input, state->input_len,
+                                   &output, &output_len,
+                                   NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0);
+
+  kmyth_free(output);
+  return retval;
+}
+
+//############################################################################
+// bench_unseal()
+//############################################################################
+static int bench_unseal(bench_state * state)
+{
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval = tpm2_kmyth_unseal_ctx(state->ctx, state->ski, state->ski_len,
+                                     &output, &output_len,
+                                     NULL, 0, NULL, 0, 0);
+
+  if (retval == 0 && (output_len != state->input_len ||
+                      memcmp(output, state->input, output_len) != 0))
+  {
+    kmyth_log(LOG_ERR, "unsealed data does not match ... exiting");
+    retval = 1;
+  }
+  kmyth_clear_and_free(output, output_len);
+  return retval;
+}
+
+//############################################################################
+// bench_reseal()
+//############################################################################
+static int bench_reseal(bench_state * state)
+{
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval = tpm2_kmyth_reseal_ctx(state->ctx, state->ski, state->ski_len,
+                                     &output, &output_len,
+                                     NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                     0);
+
+  kmyth_free(output);
+  return retval;
+}
+
+//############################################################################
+// bench_srk_lookup()
+//############################################################################
+static int bench_srk_lookup(bench_state * state)
+{
+  TPM2_HANDLE srk_handle = 0;
+  TPM2B_AUTH ownerAuth = {.size = 0, };
+
+  return get_srk_handle(state->ctx->sapi_ctx, &srk_handle, &ownerAuth);
+}
+
+//############################################################################
+// bench_policy_session()
+//############################################################################
+static int bench_policy_session(bench_state * state)
+{
+  SESSION session;
+
+  if (create_auth_session(state->ctx->sapi_ctx, &session, TPM2_SE_POLICY))
+  {
+    return 1;
+  }
+
+  return kmyth_flush_handle(state->ctx->sapi_ctx, session.sessionHandle);
+}
+
+//############################################################################
+// run_benchmark()
+//############################################################################
+static int run_benchmark(bench_state * state, const char *name,
+                         bench_op_fn op, size_t warmup, size_t iterations,
+                         bench_result * result)
+{
+  memset(result, 0, sizeof(bench_result));
+  result->name = name;
+  result->latency_us = calloc(iterations, sizeof(uint64_t));
+  if (result->latency_us == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for %s latencies failed ... exiting", name);
+    return 1;
+  }
+
+  for (size_t i = 0; i < warmup; i++)
+  {
+    op(state);
+  }
+
+  reset_tpm_stats();
+  kmyth_alloc_stats_reset();
+
+  uint64_t live_bytes = kmyth_alloc_live_bytes();
+  uint64_t start = now_us();
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    uint64_t op_start = now_us();
+
+    if (op(state))
+    {
+      result->failures++;
+      continue;
+    }
+    result->latency_us[result->completed++] = now_us() - op_start;
+  }
+  result->total_us = now_us() - start;
+
+  for (size_t p = 0; p <= KMYTH_ALLOC_PHASE_COUNT; p++)
+  {
+    kmyth_alloc_get_stats((kmyth_alloc_phase) p, &(result->alloc_stats[p]));
+  }
+  if (result->alloc_stats[KMYTH_ALLOC_PHASE_COUNT].peak_bytes > live_bytes)
+  {
+    result->alloc_peak_bytes =
+      result->alloc_stats[KMYTH_ALLOC_PHASE_COUNT].peak_bytes - live_bytes;
+  }
+
+  qsort(result->latency_us, result->completed, sizeof(uint64_t), compare_u64);
+
+  return get_tpm_stats(&(result->tpm_stats), &(result->tpm_stats_count));
+}
+
+//############################################################################
+// print_results()
+//############################################################################
+static void print_results(bench_result * results, size_t count)
+{
+  fprintf(stdout, "%-15s %10s %10s %10s %10s %10s %8s\n", "operation",
+          "ops/sec", "p50 (us)", "p99 (us)", "tpm (us)", "host (us)",
+          "failed");
+  for (size_t i = 0; i < count; i++)
+  {
+    bench_result *r = &(results[i]);
+    double ops = (r->total_us == 0) ? 0.0 :
+      (double) r->completed * 1000000.0 / (double) r->total_us;
+    double mean = (r->completed == 0) ? 0.0 :
+      (double) r->total_us / (double) r->completed;
+    double tpm = tpm_us_per_op(r);
+
+    fprintf(stdout, "%-15s %10.1f %10llu %10llu %10.0f %10.0f %8zu\n",
+            r->name, ops, (unsigned long long) percentile_us(r, 50),
+            (unsigned long long) percentile_us(r, 99), tpm,
+            (mean > tpm) ? mean - tpm : 0.0, r->failures);
+
+    // per-phase (TPM command) breakdown of one operation
+    for (size_t j = 0; j < r->tpm_stats_count && r->completed > 0; j++)
+    {
+      kmyth_tpm_cmd_stats *cmd = &(r->tpm_stats[j]);
+      const char *cmd_name = get_tpm_cc_name(cmd->commandCode);
+
+      fprintf(stdout, "    %-20s %6.1f calls/op %10.0f us/op\n",
+              (cmd_name == NULL) ? "(other)" : cmd_name,
+              (double) cmd->count / (double) r->completed,
+              (double) cmd->total_us / (double) r->completed);
+    }
+
+    // heap allocations of one operation, and the most memory it held
+    kmyth_alloc_stats *total = &(r->alloc_stats[KMYTH_ALLOC_PHASE_COUNT]);
+
+    if (total->allocs == 0 || r->completed == 0)
+    {
+      continue;
+    }
+    fprintf(stdout, "    %-20s %6.1f allocs/op %9.0f bytes/op, peak %llu "
+            "bytes\n", "(heap)",
+            (double) total->allocs / (double) (r->completed + r->failures),
+            (double) total->bytes / (double) (r->completed + r->failures),
+            (unsigned long long) r->alloc_peak_bytes);
+    for (size_t p = 0; p < KMYTH_ALLOC_PHASE_COUNT; p++)
+    {
+      kmyth_alloc_stats *phase = &(r->alloc_stats[p]);
+
+      if (phase->allocs == 0)
+      {
+        continue;
+      }
+      fprintf(stdout, "      %-18s %6.1f allocs/op %9.0f bytes/op\n",
+              kmyth_alloc_phase_name((kmyth_alloc_phase) p),
+              (double) phase->allocs / (double) (r->completed + r->failures),
+              (double) phase->bytes / (double) (r->completed + r->failures));
+    }
+  }
+}
+
+//############################################################################
+// write_json_results()
+//############################################################################
+static int write_json_results(const char *path, size_t iterations,
+                              size_t input_len, bench_result * results,
+                              size_t count)
+{
+  FILE *out = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open %s ... exiting", path);
+    return 1;
+  }
+
+  fprintf(out, "{\n  \"version\": \"%s\",\n", KMYTH_VERSION);
+  fprintf(out, "  \"iterations\": %zu,\n  \"input_size\": %zu,\n",
+          iterations, input_len);
+  fprintf(out, "  \"operations\": [\n");
+  for (size_t i = 0; i < count; i++)
+  {
+    bench_result *r = &(results[i]);
+    double ops = (r->total_us == 0) ? 0.0 :
+      (double) r->completed * 1000000.0 / (double) r->total_us;
+
+    fprintf(out, "    {\n      \"name\": \"%s\",\n", r->name);
+    fprintf(out, "      \"completed\": %zu,\n      \"failures\": %zu,\n",
+            r->completed, r->failures);
+    fprintf(out, "      \"ops_per_sec\": %.3f,\n", ops);
+    fprintf(out, "      \"p50_us\": %llu,\n      \"p99_us\": %llu,\n",
+            (unsigned long long) percentile_us(r, 50),
+            (unsigned long long) percentile_us(r, 99));
+    fprintf(out, "      \"min_us\": %llu,\n      \"max_us\": %llu,\n",
+            (unsigned long long) ((r->completed > 0) ? r->latency_us[0] : 0),
+            (unsigned long long) ((r->completed > 0) ?
+                                  r->latency_us[r->completed - 1] : 0));
+    fprintf(out, "      \"tpm_us_per_op\": %.1f,\n", tpm_us_per_op(r));
+    fprintf(out, "      \"peak_alloc_bytes\": %llu,\n",
+            (unsigned long long) r->alloc_peak_bytes);
+    fprintf(out, "      \"allocations\": {");
+    for (size_t p = 0; p <= KMYTH_ALLOC_PHASE_COUNT; p++)
+    {
+      fprintf(out, "%s\n        \"%s\": {\"allocs\": %llu, \"bytes\": %llu}",
+              (p == 0) ? "" : ",",
+              kmyth_alloc_phase_name((kmyth_alloc_phase) p),
+              (unsigned long long) r->alloc_stats[p].allocs,
+              (unsigned long long) r->alloc_stats[p].bytes);
+    }
+    fprintf(out, "\n      },\n");
+    fprintf(out, "      \"tpm_commands\": [");
+    for (size_t j = 0; j < r->tpm_stats_count; j++)
+    {
+      kmyth_tpm_cmd_stats *cmd = &(r->tpm_stats[j]);
+      const char *cmd_name = get_tpm_cc_name(cmd->commandCode);
+
+      fprintf(out, "%s\n        {\"command\": \"%s\", \"code\": %u, "
+              "\"calls\": %llu, \"errors\": %llu, \"total_us\": %llu, "
+              "\"max_us\": %llu}", (j == 0) ? "" : ",",
+              (cmd_name == NULL) ? "" : cmd_name, cmd->commandCode,
+              (unsigned long long) cmd->count,
+              (unsigned long long) cmd->errors,
+              (unsigned long long) cmd->total_us,
+              (unsigned long long) cmd->max_us);
+    }
+    fprintf(out, "%s]\n    }%s\n", (r->tpm_stats_count == 0) ? "" : "\n      ",
+            (i + 1 < count) ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+
+  if (out != stdout && fclose(out) != 0)
+  {
+    kmyth_log(LOG_ERR, "error writing %s ... exiting", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // The mock TPM is linked into this program, not the library, and can
+  // only be selected (-T mock) once registered
+  if (kmyth_mock_tpm_register())
+  {
+    return 1;
+  }
+
+  // Initialize parameters that might be modified by command line options
+  unsigned long iterations = BENCH_DEFAULT_ITERATIONS;
+  unsigned long warmup = BENCH_DEFAULT_WARMUP;
+  unsigned long inputSize = BENCH_DEFAULT_INPUT_SIZE;
+  char *outPath = NULL;
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "n:w:s:o:T:hv", longopts,
+                                &option_index)) != -1)
+  {
+    char *end = NULL;
+
+    switch (options)
+    {
+    case 'n':
+      iterations = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || iterations == 0)
+      {
+        kmyth_log(LOG_ERR, "invalid iteration count (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'w':
+      warmup = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0')
+      {
+        kmyth_log(LOG_ERR, "invalid warmup count (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 's':
+      inputSize = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || inputSize == 0)
+      {
+        kmyth_log(LOG_ERR, "invalid input size (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'T':
+      if (set_tcti_spec(optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  // The per-command breakdown comes from the TPM statistics layer, which
+  // must be in place before the connection is opened; allocations are
+  // counted from the start too, so that every block freed was counted
+  set_tpm_stats(true);
+  kmyth_alloc_stats_enable(true);
+
+  bench_state state = {.ctx = NULL, };
+
+  if (kmyth_ctx_create(&state.ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
+    return 1;
+  }
+
+  state.input_len = (size_t) inputSize;
+  state.input = malloc(state.input_len);
+  if (state.input == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc for benchmark input failed ... exiting");
+    kmyth_ctx_destroy(&state.ctx);
+    return 1;
+  }
+  for (size_t i = 0; i < state.input_len; i++)
+  {
+    state.input[i] = (uint8_t) i;
+  }
+
+  if (tpm2_kmyth_seal_ctx(state.ctx, state.input, state.input_len,
+                          &state.ski, &state.ski_len,
+                          NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0))
+  {
+    kmyth_log(LOG_ERR, "unable to seal benchmark input ... exiting");
+    free(state.input);
+    kmyth_ctx_destroy(&state.ctx);
+    return 1;
+  }
+
+  static const struct
+  {
+    const char *name;
+    bench_op_fn op;
+  } benchmarks[] = {
+    {"seal", bench_seal},
+    {"unseal", bench_unseal},
+    {"reseal", bench_reseal},
+    {"srk_lookup", bench_srk_lookup},
+    {"policy_session", bench_policy_session},
+  };
+  size_t count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+  bench_result results[sizeof(benchmarks) / sizeof(benchmarks[0])];
+  int retval = 0;
+
+  memset(results, 0, sizeof(results));
+  for (size_t i = 0; i < count; i++)
+  {
+    // a failing operation is reported, but does not stop the others
+    if (run_benchmark(&state, benchmarks[i].name, benchmarks[i].op,
+                      (size_t) warmup, (size_t) iterations, &results[i]) ||
+        results[i].failures > 0)
+    {
+      retval = 1;
+    }
+  }
+
+  print_results(results, count);
+  if (outPath != NULL &&
+      write_json_results(outPath, (size_t) iterations, state.input_len,
+                         results, count))
+  {
+    retval = 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(results[i].latency_us);
+    free(results[i].tpm_stats);
+  }
+  kmyth_free(state.ski);
+  free(state.input);
+  kmyth_ctx_destroy(&state.ctx);
+
+  return retval;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file  aes_gcm_siv_test.h
+ *
+ * Provides unit tests for the kmyth AES-GCM-SIV cipher functionality
+ * implemented in tpm2/src/cipher/aes_gcm_siv.c
+ */
+
+#ifndef AES_GCM_SIV_TEST_H
+#define AES_GCM_SIV_TEST_H
+
+/**
+ * This function adds all of the tests contained in aes_gcm_siv_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'testrunner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the AES-GCM-SIV tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int aes_gcm_siv_add_tests(CU_pSuite suite);
+
+//--------------------- Tests ------------------------------------------------
+
+/**
+ * Tests encryption and decryption against known-answer vectors
+ */
+void test_aes_gcm_siv_vectors(void);
+
+/**
+ * Tests that encryption is deterministic and that changes to the key,
+ * ciphertext or tag break decryption
+ */
+void test_aes_gcm_siv_deterministic(void);
+
+/**
+ * Tests that the interface rejects invalid parameters
+ */
+void test_aes_gcm_siv_parameter_limits(void);
+
+#endif
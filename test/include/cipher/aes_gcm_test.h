@@ -149,4 +149,40 @@ void test_gcm_cipher_modification(void);
  */
 void test_gcm_parameter_limits(void);
 
+/**
+ * Tests encryption/decryption into caller-supplied buffers and in place
+ */
+void test_gcm_into_in_place(void);
+
+/**
+ * Test that the streaming (chunked) AES/GCM mode round trips inputs of
+ * every size class (empty, partial, exact and multiple chunks), and that
+ * each stream gets a fresh header.
+ */
+void test_gcm_stream_encrypt_decrypt(void);
+
+/**
+ * Test that modified, truncated, reordered, or wrongly keyed AES/GCM
+ * streams fail to decrypt.
+ */
+void test_gcm_stream_modification(void);
+
+/**
+ * Test the file (chunk at a time) form of the AES/GCM stream functions and
+ * its compatibility with the in-memory form.
+ */
+void test_gcm_stream_file(void);
+
+/**
+ * Test that streams processed by several threads (see set_cipher_threads())
+ * match those processed by one, and still detect modification.
+ */
+void test_gcm_stream_threads(void);
+
+/**
+ * Test that AES/GCM streams encrypted and decrypted a run of chunks at a
+ * time, between caller buffers, match the in-memory form.
+ */
+void test_gcm_stream_chunks(void);
+
 #endif
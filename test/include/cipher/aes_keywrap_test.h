@@ -114,6 +114,12 @@ int get_aes_keywrap_vector_from_file(FILE * fid,
  */
 void test_aes_keywrap_parameters(void);
 
+/**
+ * Tests wrapping and unwrapping batches of inputs under one key, for both
+ * RFC 3394 and RFC 5649 key wrap
+ */
+void test_aes_keywrap_batch(void);
+
 /**
  * Runs set of test vectors for AES key wrap/unwrap through kmyth
  * implementation of this cipher functionality and validates
@@ -0,0 +1,55 @@
+/**
+ * @file  chacha20_poly1305_test.h
+ *
+ * Provides unit tests for the kmyth ChaCha20-Poly1305 cipher functionality
+ * implemented in tpm2/src/cipher/chacha20_poly1305.c
+ */
+
+#ifndef CHACHA20_POLY1305_TEST_H
+#define CHACHA20_POLY1305_TEST_H
+
+/**
+ * This function adds all of the tests contained in chacha20_poly1305_test.c
+ * to a test suite parameter passed in by the caller. This allows a top-level
+ * 'testrunner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the ChaCha20-Poly1305 tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int chacha20_poly1305_add_tests(CU_pSuite suite);
+
+//--------------------- Tests ------------------------------------------------
+
+/**
+ * Tests decryption against known-answer vectors derived from RFC 8439
+ */
+void test_chacha20_poly1305_decrypt_vectors(void);
+
+/**
+ * Tests basic encryption/decryption functionality
+ */
+void test_chacha20_poly1305_encrypt_decrypt(void);
+
+/**
+ * Tests that changes to the key, nonce, ciphertext or tag break decryption
+ */
+void test_chacha20_poly1305_modification(void);
+
+/**
+ * Tests decryption in place and into caller-supplied buffers
+ */
+void test_chacha20_poly1305_in_place(void);
+
+/**
+ * Tests that the interface rejects invalid parameters
+ */
+void test_chacha20_poly1305_parameter_limits(void);
+
+/**
+ * Tests that the cipher can be selected by name for .ski files
+ */
+void test_chacha20_poly1305_cipher_lookup(void);
+
+#endif
@@ -99,4 +99,25 @@ void test_kmyth_encrypt_data(void);
  */
 void test_kmyth_decrypt_data(void);
 
+/**
+ * Tests for encrypting data under a caller-supplied key in
+ * kmyth_encrypt_data_with_key()
+ */
+void test_kmyth_encrypt_data_with_key(void);
+
+/**
+ * Tests for decrypting data in place in kmyth_decrypt_data_in_place()
+ */
+void test_kmyth_decrypt_data_in_place(void);
+
+/**
+ * Tests for the CPU crypto probe and the "auto" cipher selection
+ */
+void test_kmyth_cipher_auto(void);
+
+/**
+ * Tests for the cached OpenSSL ciphers and reusable cipher contexts
+ */
+void test_kmyth_cipher_ctx(void);
+
 #endif
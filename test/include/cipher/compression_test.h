@@ -0,0 +1,46 @@
+/**
+ * @file  compression_test.h
+ *
+ * Provides unit tests for the kmyth compression stage implemented in
+ * tpm2/src/cipher/compression.c
+ */
+
+#ifndef COMPRESSION_TEST_H
+#define COMPRESSION_TEST_H
+
+/**
+ * This function adds all of the tests contained in compression_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'testrunner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the compression tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int compression_add_tests(CU_pSuite suite);
+
+//--------------------- Tests ------------------------------------------------
+
+/**
+ * Tests the compression names and the process-wide setting
+ */
+void test_compression_names(void);
+
+/**
+ * Tests whole-buffer compression and decompression
+ */
+void test_compress_decompress(void);
+
+/**
+ * Tests that truncated, extended or altered compressed data is rejected
+ */
+void test_decompress_invalid(void);
+
+/**
+ * Tests compression and decompression through a pipe, as used by the
+ * streaming ciphers
+ */
+void test_compression_pipe(void);
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * @file  socket_util_test.h
+ *
+ * Provides unit tests for the socket utility functions implemented in
+ * src/network/socket_util.c
+ */
+
+#ifndef SOCKET_UTIL_TEST__H
+#define SOCKET_UTIL_TEST__H
+
+/**
+ * This function adds all of the tests contained in socket_util_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of the
+ *                    socket utility tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int socket_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for reading a whole message in socket_read_full()
+ */
+void test_socket_read_full(void);
+
+/**
+ * Tests for writing several buffers at once in socket_writev_full()
+ */
+void test_socket_writev_full(void);
+
+#endif
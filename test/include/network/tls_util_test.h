@@ -29,11 +29,35 @@ int tls_util_add_tests(CU_pSuite suite);
  */
 void test_create_tls_connection(void);
 
+/**
+ * Tests for racing connections to several servers in
+ * create_tls_connection_race()
+ */
+void test_create_tls_connection_race(void);
+
+/**
+ * Tests for racing connections while the client key is still being
+ * produced in create_tls_connection_race_deferred()
+ */
+void test_create_tls_connection_race_deferred(void);
+
 /**
  * Tests for TLS context setup functionality in tls_set_context()
  */
 void test_tls_set_context(void);
 
+/**
+ * Tests for the TLS session cache (tls_derive_session_cache_key(),
+ * tls_load_session_cache() and tls_save_session_cache())
+ */
+void test_tls_session_cache(void);
+
+/**
+ * Tests for the TLS connection pool (tls_conn_pool_new(),
+ * tls_conn_pool_get(), tls_conn_pool_put() and tls_conn_pool_free())
+ */
+void test_tls_conn_pool(void);
+
 /**
  * Tests for getting a key from a TLS server in get_key_from_tls_server()
  */
@@ -44,4 +68,10 @@ void test_get_resp_from_tls_server(void);
  */
 void test_get_key_from_kmip_server(void);
 
+/**
+ * Tests for asynchronous key fetches (tls_key_fetch_start(),
+ * tls_key_fetch_step(), tls_key_fetch_run() and the rest)
+ */
+void test_tls_key_fetch(void);
+
 #endif
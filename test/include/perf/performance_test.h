@@ -0,0 +1,69 @@
+/**
+ * @file  performance_test.h
+ *
+ * Provides performance regression tests for the Kmyth hot paths: .ski
+ * parsing, base64 coding, .ski block extraction and AES/GCM.
+ *
+ * Each test measures the best throughput (MB/s) of a hot path over a few
+ * timed samples, and fails when it falls below the path's baseline by
+ * more than the tolerance. The baselines built into
+ * test/src/perf/performance_test.c are deliberately low floors, which any
+ * reasonable build host clears and which only catch gross regressions
+ * (e.g., an accidentally quadratic parser). For finer checks, baselines
+ * recorded on the machine running the tests are used instead:
+ *
+ *   - KMYTH_PERF_RECORD=<file> writes the throughputs measured by this run
+ *     to file, as one "<name> <MB/s>" line per hot path
+ *   - KMYTH_PERF_BASELINES=<file> reads the baselines from such a file
+ *     (hot paths it does not list keep the built-in floor)
+ *   - KMYTH_PERF_TOLERANCE=<fraction> sets how much slower than its
+ *     baseline a hot path may be before its test fails (defaults to 0.25)
+ */
+
+#ifndef PERFORMANCE_TEST_H
+#define PERFORMANCE_TEST_H
+
+#include <CUnit/CUnit.h>
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/perf/performance_test.c to a test suite parameter passed in by
+ * the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the performance tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int performance_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests - check the throughput of the hot paths against their baselines
+//
+// format for test names is test_perf_<function_name>()
+//****************************************************************************
+
+/**
+ * Tests the throughput of parse_ski_bytes() on a 100 MiB (text) .ski
+ */
+void test_perf_parse_ski_bytes(void);
+
+/**
+ * Tests the throughput of encodeBase64Data() and decodeBase64Data()
+ */
+void test_perf_base64(void);
+
+/**
+ * Tests the throughput of get_block_bytes() extracting the encrypted data
+ * block of a 100 MiB .ski
+ */
+void test_perf_get_block_bytes(void);
+
+/**
+ * Tests the throughput of aes_gcm_encrypt() and aes_gcm_decrypt() at
+ * several payload sizes
+ */
+void test_perf_aes_gcm(void);
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * @file  kmyth_context_test.h
+ *
+ * Provides unit tests for the reusable Kmyth context functions
+ * implemented in tpm2/src/tpm/kmyth_context.c
+ */
+
+#ifndef KMYTH_CONTEXT_TEST_H
+#define KMYTH_CONTEXT_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_context_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    Kmyth context tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_context_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_context.h and the *_ctx functions in kmyth.h,
+//  format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_kmyth_ctx_create_destroy(void);
+void test_kmyth_flush_handle(void);
+void test_tpm2_kmyth_seal_unseal_ctx(void);
+void test_kmyth_sk_cache(void);
+void test_kmyth_policy_cache(void);
+void test_kmyth_secret_cache(void);
+void test_kmyth_ctx_session(void);
+void test_kmyth_derive_key(void);
+
+#endif
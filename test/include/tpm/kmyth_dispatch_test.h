@@ -0,0 +1,33 @@
+/**
+ * @file  kmyth_dispatch_test.h
+ *
+ * Provides unit tests for the multi-TPM job dispatcher implemented in
+ * tpm2/src/tpm/kmyth_dispatch.c
+ */
+
+#ifndef KMYTH_DISPATCH_TEST_H
+#define KMYTH_DISPATCH_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_dispatch_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    Kmyth dispatch tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_dispatch_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_dispatch.h and the *_sharded functions in
+//  kmyth.h, format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_kmyth_dispatch_init_queues(void);
+void test_kmyth_dispatch_next_job(void);
+void test_kmyth_ctx_create_tcti(void);
+void test_tpm2_kmyth_seal_unseal_sharded(void);
+
+#endif
@@ -0,0 +1,33 @@
+/**
+ * @file  kmyth_envelope_test.h
+ *
+ * Provides unit tests for the envelope mode functions implemented in
+ * tpm2/src/tpm/kmyth_envelope.c
+ */
+
+#ifndef KMYTH_ENVELOPE_TEST_H
+#define KMYTH_ENVELOPE_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_envelope_test.c to
+ * a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    envelope mode tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_envelope_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_envelope.h and the kmyth_envelope_*()
+//  functions in kmyth.h, format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_kmyth_envelope_seal_unseal(void);
+void test_kmyth_envelope_wrong_kek(void);
+void test_kmyth_envelope_tampered(void);
+void test_kmyth_envelope_tpm_kek(void);
+
+#endif
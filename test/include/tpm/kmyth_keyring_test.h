@@ -0,0 +1,30 @@
+/**
+ * @file  kmyth_keyring_test.h
+ *
+ * Provides unit tests for the kernel keyring cache functions implemented in
+ * tpm2/src/tpm/kmyth_keyring.c
+ */
+
+#ifndef KMYTH_KEYRING_TEST_H
+#define KMYTH_KEYRING_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_keyring_test.c to
+ * a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    kernel keyring cache tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_keyring_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_keyring.h, format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_set_keyring_spec(void);
+void test_kmyth_keyring_insert_lookup(void);
+
+#endif
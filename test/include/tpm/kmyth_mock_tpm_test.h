@@ -0,0 +1,31 @@
+/**
+ * @file  kmyth_mock_tpm_test.h
+ *
+ * Provides unit tests for the mock TPM implemented in
+ * tpm2/src/tpm/kmyth_mock_tpm.c
+ */
+
+#ifndef KMYTH_MOCK_TPM_TEST_H
+#define KMYTH_MOCK_TPM_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_mock_tpm_test.c to
+ * a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    Kmyth mock TPM tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_mock_tpm_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_mock_tpm.h, format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_kmyth_mock_tcti_init(void);
+void test_kmyth_mock_tpm_latency(void);
+void test_kmyth_mock_tpm_seal_unseal(void);
+
+#endif
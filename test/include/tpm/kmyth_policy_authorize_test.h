@@ -0,0 +1,33 @@
+/**
+ * @file  kmyth_policy_authorize_test.h
+ *
+ * Provides unit tests for the signed policy functions implemented in
+ * tpm2/src/tpm/kmyth_policy_authorize.c
+ */
+
+#ifndef KMYTH_POLICY_AUTHORIZE_TEST_H
+#define KMYTH_POLICY_AUTHORIZE_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * kmyth_policy_authorize_test.c to a test suite parameter passed in by the
+ * caller. This allows a top-level 'test-runner' application to include them
+ * in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    signed policy tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_policy_authorize_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_policy_authorize.h, format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_kmyth_pem_to_authorizing_key(void);
+void test_set_authorizing_key(void);
+void test_kmyth_sign_policy(void);
+void test_kmyth_find_signed_policy(void);
+
+#endif
@@ -0,0 +1,30 @@
+/**
+ * @file  kmyth_prewarm_test.h
+ *
+ * Provides unit tests for the secret cache prewarming implemented in
+ * tpm2/src/tpm/kmyth_prewarm.c
+ */
+
+#ifndef KMYTH_PREWARM_TEST_H
+#define KMYTH_PREWARM_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_prewarm_test.c to a
+ * test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    Kmyth prewarm tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_prewarm_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_prewarm.h, format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_kmyth_prewarm_parse_manifest(void);
+void test_kmyth_prewarm_order(void);
+
+#endif
@@ -0,0 +1,30 @@
+/**
+ * @file  kmyth_reseal_plan_test.h
+ *
+ * Provides unit tests for the incremental reseal planning implemented in
+ * tpm2/src/tpm/kmyth_reseal_plan.c
+ */
+
+#ifndef KMYTH_RESEAL_PLAN_TEST_H
+#define KMYTH_RESEAL_PLAN_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_reseal_plan_test.c
+ * to a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will use to add
+ *                    Kmyth reseal plan tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_reseal_plan_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+//  Tests for functions in kmyth_reseal_plan.h, format for test names is:
+//    test_function_name()
+//****************************************************************************
+void test_kmyth_pcr_values_parse(void);
+void test_kmyth_reseal_plan_check(void);
+
+#endif
@@ -26,8 +26,14 @@ int kmyth_seal_unseal_impl_add_tests(CU_pSuite suite);
 //********************************************************************************
 void test_tpm2_kmyth_seal(void);
 void test_tpm2_kmyth_unseal(void);
+void test_tpm2_kmyth_seal_batch(void);
+void test_tpm2_kmyth_unseal_batch(void);
+void test_tpm2_kmyth_reseal(void);
 void test_tpm2_kmyth_seal_file(void);
 void test_tpm2_kmyth_unseal_file(void);
 void test_tpm2_kmyth_seal_data(void);
 void test_tpm2_kmyth_unseal_data(void);
+void test_kmyth_compute_policy(void);
+void test_tpm2_kmyth_seal_unseal_stream(void);
+void test_kmyth_sealed_reader(void);
 #endif
@@ -105,6 +105,10 @@ void test_pack_unpack_private(void);
 void test_unpack_uint32_to_str(void);
 void test_parse_ski_bytes(void);
 void test_create_ski_bytes(void);
+void test_ski_bytes_v2(void);
+void test_ski_compression(void);
+void test_parse_ski_header(void);
+void test_parse_ski_bytes_borrowed(void);
 void test_free_ski(void);
 void test_get_default_ski(void);
 void test_verifyPackUnpackDigest(void);
@@ -49,4 +49,9 @@ void test_init_kmyth_object_parameters(void);
  */
 void test_init_kmyth_object_unique(void);
 
+/**
+ * Tests for offline object name computation in compute_kmyth_object_name()
+ */
+void test_compute_kmyth_object_name(void);
+
 #endif
@@ -25,8 +25,10 @@ int storage_key_tools_add_tests(CU_pSuite suite);
 //****************************************************************************
 void test_get_srk_handle(void);
 void test_get_existing_srk_handle(void);
+void test_get_cached_srk_handle(void);
 void test_check_if_srk(void);
 void test_put_srk_into_persistent_storage(void);
 void test_create_and_load_sk(void);
+void test_set_sk_alg(void);
 
 #endif
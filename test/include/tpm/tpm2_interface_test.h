@@ -25,11 +25,16 @@ int tpm2_interface_add_tests(CU_pSuite suite);
 //****************************************************************************
 void test_init_tpm2_connection(void);
 void test_init_tcti_abrmd(void);
+void test_set_tcti_spec(void);
+void test_set_tpm_priority(void);
+void test_set_tpm_stats(void);
 void test_init_sapi(void);
 void test_free_tpm2_resources(void);
 void test_startup_tpm2(void);
 void test_get_tpm2_properties(void);
 void test_get_tpm2_impl_type(void);
+void test_get_tpm2_fixed_property(void);
+void test_compute_policy_digest(void);
 void test_getErrorString(void);
 void test_init_password_cmd_auth(void);
 void test_init_policy_cmd_auth(void);
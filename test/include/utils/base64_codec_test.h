@@ -0,0 +1,45 @@
+/**
+ * @file  base64_codec_test.h
+ *
+ * Provides unit tests for the kmyth base64 codec implemented in
+ * utils/src/base64_codec.c
+ */
+
+#ifndef BASE64_CODEC_TEST_H
+#define BASE64_CODEC_TEST_H
+
+#include <CUnit/CUnit.h>
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/base64_codec_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the base64 codec tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int base64_codec_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests - validate functionality in utils/src/base64_codec.c
+//
+// format for test names is test_<function_name>()
+//****************************************************************************
+
+/**
+ * Tests that kmyth_base64_encode() matches OpenSSL's line-broken encoding,
+ * for the vectorized and the scalar code
+ */
+void test_kmyth_base64_encode(void);
+
+/**
+ * Tests kmyth_base64_decode() round trips, whitespace handling and the
+ * rejection of invalid symbols and padding, for the vectorized and the
+ * scalar code
+ */
+void test_kmyth_base64_decode(void);
+
+#endif
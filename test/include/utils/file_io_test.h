@@ -43,16 +43,59 @@ void test_verifyOutputFilePath(void);
  */
 void test_read_bytes_from_file(void);
 
+/**
+ * Tests for the functionality to map the bytes of a generic file as a
+ * read-only view implemented in function map_bytes_from_file()
+ */
+void test_map_bytes_from_file(void);
+
 /**
  * Tests for the functionality to write bytes to a generic file implemented
  * in function write_bytes_to_file()
  */
 void test_write_bytes_to_file(void);
 
+/**
+ * Tests for the functionality to replace a file atomically implemented
+ * in function write_bytes_to_file_atomic()
+ */
+void test_write_bytes_to_file_atomic(void);
+
+/**
+ * Tests for the group commit of atomic file writes implemented in
+ * functions add_to_write_batch(), commit_write_batch() and
+ * abort_write_batch()
+ */
+void test_write_batch(void);
+
+/**
+ * Tests for the bulk file reads and writes implemented in functions
+ * kmyth_bulk_read_files() and kmyth_bulk_write_files()
+ */
+void test_bulk_io(void);
+
+/**
+ * Tests for the functionality to write a whole buffer to a BIO
+ * implemented in function write_bytes_to_bio()
+ */
+void test_write_bytes_to_bio(void);
+
 /**
  * Tests for the functionality to print information to the STDOUT stream
  * implemented in function print_to_stdout()
  */
 void test_print_to_stdout(void);
 
+/**
+ * Tests for the functionality to hand data over in a sealed memory file
+ * implemented in functions write_bytes_to_memfd() and write_bytes_to_fd()
+ */
+void test_write_bytes_to_memfd(void);
+
+/**
+ * Tests for the functionality to run a command with a descriptor
+ * implemented in function run_with_fd()
+ */
+void test_run_with_fd(void);
+
 #endif
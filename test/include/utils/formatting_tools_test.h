@@ -30,10 +30,12 @@ int formatting_tools_add_tests(CU_pSuite suite);
 // format for test names is test_<function_name>()
 //****************************************************************************
 void test_get_block_bytes(void);
+void test_get_block_view(void);
 void test_create_nkl_bytes(void);
 void test_encodeBase64Data(void);
 void test_decodeBase64Data(void);
 void test_concat(void);
+void test_byte_buffer(void);
 void test_verifyStringDigestConversion(void);
 
 #endif
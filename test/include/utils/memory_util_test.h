@@ -43,4 +43,25 @@ void test_kmyth_clear_and_free(void);
  */
 void test_secure_memset(void);
 
+/**
+ * Tests for the secure arena allocator implemented in functions
+ * kmyth_arena_init(), kmyth_arena_alloc(), kmyth_arena_release(),
+ * kmyth_arena_reset() and kmyth_arena_free()
+ */
+void test_kmyth_arena(void);
+
+/**
+ * Tests for the allocation hooks set by kmyth_set_allocator() and used by
+ * kmyth_malloc(), kmyth_calloc(), kmyth_realloc(), kmyth_free() and
+ * kmyth_strdup()
+ */
+void test_kmyth_set_allocator(void);
+
+/**
+ * Tests for the allocation accounting implemented in functions
+ * kmyth_alloc_stats_enable(), kmyth_alloc_set_phase(),
+ * kmyth_alloc_get_stats() and kmyth_alloc_stats_reset()
+ */
+void test_kmyth_alloc_stats(void);
+
 #endif
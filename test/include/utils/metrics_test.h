@@ -0,0 +1,44 @@
+/**
+ * @file  metrics_test.h
+ *
+ * Provides unit tests for the kmyth metrics registry implemented in
+ * utils/src/metrics.c
+ */
+
+#ifndef METRICS_TEST_H
+#define METRICS_TEST_H
+
+#include <CUnit/CUnit.h>
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/metrics_test.c to a test suite parameter passed in by the
+ * caller. This allows a top-level 'test-runner' application to include them
+ * in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the metrics tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int metrics_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests - validate functionality in utils/src/metrics.c
+//
+// format for test names is test_<function_name>()
+//****************************************************************************
+
+/**
+ * Tests that counters, cache lookups and TPM errors (including the shared
+ * "other" slot once every response code slot is taken) are counted
+ */
+void test_kmyth_metrics_counters(void);
+
+/**
+ * Tests that kmyth_metrics_write_prometheus() produces cumulative histogram
+ * buckets and a count and sum that match the recorded durations
+ */
+void test_kmyth_metrics_write_prometheus(void);
+
+#endif
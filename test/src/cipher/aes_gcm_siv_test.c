@@ -0,0 +1,286 @@
+//############################################################################
+// aes_gcm_siv_test.c
+//
+// Tests for kmyth AES-GCM-SIV functionality in
+// tpm2/src/cipher/aes_gcm_siv.c
+//
+// AES-GCM-SIV needs OpenSSL 3.2 or newer; with an older OpenSSL the tests
+// only check that the cipher is unavailable.
+//############################################################################
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <CUnit/CUnit.h>
+
+#include "aes_gcm_siv_test.h"
+#include "aes_gcm_siv.h"
+#include "cipher.h"
+
+//----------------------------------------------------------------------------
+// Known-answer vectors: the first AES-256-GCM-SIV vectors of RFC 8452
+// appendix C.2 without additional authenticated data (nonce 03000000...),
+// and one under the all-zero nonce kmyth encrypts with. Each input is
+// formatted nonce||ciphertext||tag.
+//----------------------------------------------------------------------------
+static const char *aes_gcm_siv_vector_keys[] = {
+  "0100000000000000000000000000000000000000000000000000000000000000",
+  "0100000000000000000000000000000000000000000000000000000000000000",
+  "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+};
+
+static const char *aes_gcm_siv_vector_plaintexts[] = {
+  "0100000000000000",
+  "0100000000000000000000000000000002000000000000000000000000000000",
+  "4b6d7974682064657465726d696e6973746963207365616c",
+};
+
+static const char *aes_gcm_siv_vector_inputs[] = {
+  "030000000000000000000000"
+    "c2ef328e5c71c83b" "843122130f7364b761e0b97427e3df28",
+  "030000000000000000000000"
+    "4a6a9db4c8c6549201b9edb53006cba821ec9cf850948a7c86c68ac7539d027f"
+    "e819e63abcd020b006a976397632eb5d",
+  "000000000000000000000000"
+    "6c47181a167444b5177132c207fcca5da74ceddcbca86cc6"
+    "9528e4749d9ff4559c54512e3e914978",
+};
+
+//----------------------------------------------------------------------------
+// hex_to_bytes()
+//----------------------------------------------------------------------------
+static size_t hex_to_bytes(const char *hex, unsigned char *bytes)
+{
+  size_t len = strlen(hex) / 2;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned int byte = 0;
+
+    sscanf(hex + 2 * i, "%2x", &byte);
+    bytes[i] = (unsigned char) byte;
+  }
+  return len;
+}
+
+//----------------------------------------------------------------------------
+// aes_gcm_siv_available()
+//----------------------------------------------------------------------------
+static int aes_gcm_siv_available(void)
+{
+  cipher_t cipher =
+    kmyth_get_cipher_t_from_string("AES/GCM-SIV/NoPadding/256");
+
+#ifdef KMYTH_HAVE_AES_GCM_SIV
+  CU_ASSERT(cipher.cipher_name != NULL);
+  CU_ASSERT(cipher.encrypt_fn == aes_gcm_siv_encrypt);
+  CU_ASSERT(cipher.decrypt_fn == aes_gcm_siv_decrypt);
+  CU_ASSERT(get_key_len_from_cipher(cipher) == 256);
+  return (cipher.cipher_name != NULL);
+#else
+  CU_ASSERT(cipher.cipher_name == NULL);
+  return 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// aes_gcm_siv_add_tests()
+//----------------------------------------------------------------------------
+int aes_gcm_siv_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Test AES-GCM-SIV known-answer vectors",
+                          test_aes_gcm_siv_vectors))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES-GCM-SIV deterministic encryption",
+                          test_aes_gcm_siv_deterministic))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES-GCM-SIV parameter limits",
+                          test_aes_gcm_siv_parameter_limits))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_aes_gcm_siv_vectors()
+//----------------------------------------------------------------------------
+void test_aes_gcm_siv_vectors(void)
+{
+  if (!aes_gcm_siv_available())
+  {
+    return;
+  }
+
+  size_t count = sizeof(aes_gcm_siv_vector_keys) /
+    sizeof(aes_gcm_siv_vector_keys[0]);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    unsigned char key[AES_GCM_SIV_KEY_LEN];
+    unsigned char plaintext[64];
+    unsigned char input[128];
+
+    size_t key_len = hex_to_bytes(aes_gcm_siv_vector_keys[i], key);
+    size_t plaintext_len = hex_to_bytes(aes_gcm_siv_vector_plaintexts[i],
+                                        plaintext);
+    size_t input_len = hex_to_bytes(aes_gcm_siv_vector_inputs[i], input);
+
+    unsigned char *output = NULL;
+    size_t output_len = 0;
+
+    CU_ASSERT(aes_gcm_siv_decrypt(key, key_len, input, input_len,
+                                  &output, &output_len) == 0);
+    CU_ASSERT(output_len == plaintext_len);
+    CU_ASSERT(output != NULL &&
+              memcmp(output, plaintext, plaintext_len) == 0);
+    free(output);
+
+    // the vector under the zero nonce is exactly what kmyth produces
+    unsigned char zero_nonce[AES_GCM_SIV_NONCE_LEN] = { 0 };
+
+    if (memcmp(input, zero_nonce, AES_GCM_SIV_NONCE_LEN) == 0)
+    {
+      output = NULL;
+      CU_ASSERT(aes_gcm_siv_encrypt(key, key_len, plaintext, plaintext_len,
+                                    &output, &output_len) == 0);
+      CU_ASSERT(output_len == input_len);
+      CU_ASSERT(output != NULL && memcmp(output, input, input_len) == 0);
+      free(output);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_aes_gcm_siv_deterministic()
+//----------------------------------------------------------------------------
+void test_aes_gcm_siv_deterministic(void)
+{
+  if (!aes_gcm_siv_available())
+  {
+    return;
+  }
+
+  unsigned char key[AES_GCM_SIV_KEY_LEN];
+  unsigned char plaintext[1000];
+
+  memset(key, 0x5A, sizeof(key));
+  for (size_t i = 0; i < sizeof(plaintext); i++)
+  {
+    plaintext[i] = (unsigned char) (i * 7);
+  }
+
+  // the same key and plaintext always give the same output
+  unsigned char *first = NULL;
+  unsigned char *second = NULL;
+  size_t first_len = 0;
+  size_t second_len = 0;
+
+  CU_ASSERT(aes_gcm_siv_encrypt(key, sizeof(key), plaintext,
+                                sizeof(plaintext), &first, &first_len) == 0);
+  CU_ASSERT(aes_gcm_siv_encrypt(key, sizeof(key), plaintext,
+                                sizeof(plaintext), &second,
+                                &second_len) == 0);
+  CU_ASSERT(first_len == sizeof(plaintext) + AES_GCM_SIV_NONCE_LEN +
+            AES_GCM_SIV_TAG_LEN);
+  CU_ASSERT(second_len == first_len);
+  CU_ASSERT(memcmp(first, second, first_len) == 0);
+  free(second);
+
+  // so does the cipher layer, given the same key
+  cipher_t cipher =
+    kmyth_get_cipher_t_from_string("AES/GCM-SIV/NoPadding/256");
+
+  second = NULL;
+  CU_ASSERT(kmyth_encrypt_data_with_key(plaintext, sizeof(plaintext), cipher,
+                                        key, sizeof(key), &second,
+                                        &second_len) == 0);
+  CU_ASSERT(second_len == first_len);
+  CU_ASSERT(memcmp(first, second, first_len) == 0);
+  free(second);
+
+  // a different plaintext changes the whole output, tag included
+  plaintext[0] ^= 1;
+  second = NULL;
+  CU_ASSERT(aes_gcm_siv_encrypt(key, sizeof(key), plaintext,
+                                sizeof(plaintext), &second,
+                                &second_len) == 0);
+  CU_ASSERT(memcmp(first + first_len - AES_GCM_SIV_TAG_LEN,
+                   second + second_len - AES_GCM_SIV_TAG_LEN,
+                   AES_GCM_SIV_TAG_LEN) != 0);
+  free(second);
+  plaintext[0] ^= 1;
+
+  // changes to the key, ciphertext or tag break decryption
+  unsigned char *output = NULL;
+  size_t output_len = 0;
+
+  key[0] ^= 1;
+  CU_ASSERT(aes_gcm_siv_decrypt(key, sizeof(key), first, first_len,
+                                &output, &output_len) == 1);
+  key[0] ^= 1;
+  first[AES_GCM_SIV_NONCE_LEN] ^= 1;
+  CU_ASSERT(aes_gcm_siv_decrypt(key, sizeof(key), first, first_len,
+                                &output, &output_len) == 1);
+  first[AES_GCM_SIV_NONCE_LEN] ^= 1;
+  first[first_len - 1] ^= 1;
+  CU_ASSERT(aes_gcm_siv_decrypt(key, sizeof(key), first, first_len,
+                                &output, &output_len) == 1);
+  first[first_len - 1] ^= 1;
+
+  CU_ASSERT(aes_gcm_siv_decrypt(key, sizeof(key), first, first_len,
+                                &output, &output_len) == 0);
+  CU_ASSERT(output_len == sizeof(plaintext));
+  CU_ASSERT(output != NULL &&
+            memcmp(output, plaintext, sizeof(plaintext)) == 0);
+  free(output);
+  free(first);
+}
+
+//----------------------------------------------------------------------------
+// test_aes_gcm_siv_parameter_limits()
+//----------------------------------------------------------------------------
+void test_aes_gcm_siv_parameter_limits(void)
+{
+  unsigned char key[AES_GCM_SIV_KEY_LEN] = { 0 };
+  unsigned char data[AES_GCM_SIV_NONCE_LEN + AES_GCM_SIV_TAG_LEN + 1] = { 0 };
+  unsigned char *output = NULL;
+  size_t output_len = 0;
+
+  // these fail whether or not the cipher is available
+  CU_ASSERT(aes_gcm_siv_encrypt(NULL, sizeof(key), data, sizeof(data),
+                                &output, &output_len) == 1);
+  CU_ASSERT(aes_gcm_siv_encrypt(key, 16, data, sizeof(data),
+                                &output, &output_len) == 1);
+  CU_ASSERT(aes_gcm_siv_encrypt(key, sizeof(key), NULL, sizeof(data),
+                                &output, &output_len) == 1);
+  CU_ASSERT(aes_gcm_siv_encrypt(key, sizeof(key), data, 0,
+                                &output, &output_len) == 1);
+  CU_ASSERT(aes_gcm_siv_encrypt(key, sizeof(key), data,
+                                (size_t) INT_MAX + 1,
+                                &output, &output_len) == 1);
+  CU_ASSERT(output == NULL);
+
+  CU_ASSERT(aes_gcm_siv_decrypt(NULL, sizeof(key), data, sizeof(data),
+                                &output, &output_len) == 1);
+  CU_ASSERT(aes_gcm_siv_decrypt(key, 24, data, sizeof(data),
+                                &output, &output_len) == 1);
+  CU_ASSERT(aes_gcm_siv_decrypt(key, sizeof(key), NULL, sizeof(data),
+                                &output, &output_len) == 1);
+  CU_ASSERT(aes_gcm_siv_decrypt(key, sizeof(key), data, sizeof(data) - 1,
+                                &output, &output_len) == 1);
+  CU_ASSERT(output == NULL);
+
+  // an all-zero input does not authenticate
+  CU_ASSERT(aes_gcm_siv_decrypt(key, sizeof(key), data, sizeof(data),
+                                &output, &output_len) == 1);
+  CU_ASSERT(output == NULL);
+}
@@ -12,6 +12,7 @@
 #include "aes_gcm_test.h"
 #include "cipher_test.h"
 #include "aes_gcm.h"
+#include "cipher.h"
 
 //----------------------------------------------------------------------------
 // aes_gcm_add_tests()
@@ -61,6 +62,42 @@ int aes_gcm_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Test AES/GCM caller buffers and in-place",
+                          test_gcm_into_in_place))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM stream encryption/decryption",
+                          test_gcm_stream_encrypt_decrypt))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM stream modification",
+                          test_gcm_stream_modification))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM stream file encryption",
+                          test_gcm_stream_file))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM stream with several threads",
+                          test_gcm_stream_threads))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM stream runs of chunks",
+                          test_gcm_stream_chunks))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -760,3 +797,447 @@ void test_gcm_parameter_limits(void)
   free(outData);
   free(key);
 }
+
+//----------------------------------------------------------------------------
+// test_gcm_into_in_place()
+//----------------------------------------------------------------------------
+void test_gcm_into_in_place(void)
+{
+  unsigned char key[32] = { 0 };
+  unsigned char plaintext[100];
+  unsigned char buf[GCM_IV_LEN + sizeof(plaintext) + GCM_TAG_LEN];
+  unsigned char decrypt[sizeof(plaintext)];
+  size_t buf_len = 0;
+  size_t decrypt_len = 0;
+
+  for (size_t i = 0; i < sizeof(plaintext); i++)
+  {
+    plaintext[i] = (unsigned char) i;
+  }
+
+  // the caller's buffer must hold the IV, ciphertext and tag
+  CU_ASSERT(aes_gcm_encrypt_into(NULL, key, sizeof(key), plaintext,
+                                 sizeof(plaintext), buf, sizeof(buf) - 1,
+                                 &buf_len) == 1);
+  CU_ASSERT(aes_gcm_encrypt_into(NULL, key, sizeof(key), plaintext,
+                                 sizeof(plaintext), buf, sizeof(buf),
+                                 &buf_len) == 0);
+  CU_ASSERT(buf_len == sizeof(buf));
+
+  // decrypt into a separate buffer, which must hold the plaintext
+  CU_ASSERT(aes_gcm_decrypt_into(NULL, key, sizeof(key), buf, buf_len,
+                                 decrypt, sizeof(decrypt) - 1,
+                                 &decrypt_len) == 1);
+  CU_ASSERT(aes_gcm_decrypt_into(NULL, key, sizeof(key), buf, buf_len,
+                                 decrypt, sizeof(decrypt), &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == sizeof(plaintext));
+  CU_ASSERT(memcmp(decrypt, plaintext, sizeof(plaintext)) == 0);
+
+  // the result matches the allocating interface
+  unsigned char *out = NULL;
+  size_t out_len = 0;
+
+  CU_ASSERT(aes_gcm_decrypt(key, sizeof(key), buf, buf_len,
+                            &out, &out_len) == 0);
+  CU_ASSERT(out_len == sizeof(plaintext));
+  CU_ASSERT(out != NULL && memcmp(out, plaintext, sizeof(plaintext)) == 0);
+  free(out);
+
+  // decrypt in place: the plaintext ends up at the start of the buffer and
+  // no copy of it is left behind after it
+  CU_ASSERT(aes_gcm_decrypt_in_place(NULL, key, sizeof(key), buf, buf_len,
+                                     &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == sizeof(plaintext));
+  CU_ASSERT(memcmp(buf, plaintext, sizeof(plaintext)) == 0);
+  for (size_t i = 0; i < GCM_IV_LEN; i++)
+  {
+    CU_ASSERT(buf[sizeof(plaintext) + i] == 0);
+  }
+
+  // encrypt in place (the plaintext already sits after the IV) and check
+  // that a tampered buffer fails to decrypt in place
+  memmove(buf + GCM_IV_LEN, buf, sizeof(plaintext));
+  CU_ASSERT(aes_gcm_encrypt_into(NULL, key, sizeof(key), buf + GCM_IV_LEN,
+                                 sizeof(plaintext), buf, sizeof(buf),
+                                 &buf_len) == 0);
+  CU_ASSERT(memcmp(buf + GCM_IV_LEN, plaintext, sizeof(plaintext)) != 0);
+  buf[buf_len - 1] ^= 1;
+  CU_ASSERT(aes_gcm_decrypt_in_place(NULL, key, sizeof(key), buf, buf_len,
+                                     &decrypt_len) == 1);
+  buf[buf_len - 1] ^= 1;
+  CU_ASSERT(aes_gcm_decrypt_in_place(NULL, key, sizeof(key), buf, buf_len,
+                                     &decrypt_len) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_encrypt_decrypt()
+//----------------------------------------------------------------------------
+void test_gcm_stream_encrypt_decrypt(void)
+{
+  unsigned char key[32] = { 0 };
+  size_t chunk = AES_GCM_STREAM_CHUNK_LEN;
+
+  // empty, partial chunk, exact chunk(s), and chunk boundary +/- 1 inputs
+  size_t sizes[] = { 0, 1, chunk - 1, chunk, chunk + 1, 3 * chunk,
+    3 * chunk + 100
+  };
+  unsigned char *plaintext = malloc(3 * chunk + 100);
+
+  CU_ASSERT(plaintext != NULL);
+  for (size_t i = 0; i < 3 * chunk + 100; i++)
+  {
+    plaintext[i] = (unsigned char) i;
+  }
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    unsigned char *ciphertext = NULL;
+    unsigned char *decrypt = NULL;
+    size_t ciphertext_len = 0;
+    size_t decrypt_len = 0;
+    size_t chunks = (sizes[i] == 0) ? 1 : (sizes[i] - 1) / chunk + 1;
+
+    CU_ASSERT(aes_gcm_stream_encrypt(key, sizeof(key), plaintext, sizes[i],
+                                     &ciphertext, &ciphertext_len) == 0);
+    CU_ASSERT(ciphertext_len ==
+              AES_GCM_STREAM_HEADER_LEN + sizes[i] + chunks * GCM_TAG_LEN);
+    CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                     ciphertext_len, &decrypt,
+                                     &decrypt_len) == 0);
+    CU_ASSERT(decrypt_len == sizes[i]);
+    CU_ASSERT(memcmp(plaintext, decrypt, sizes[i]) == 0);
+    free(ciphertext);
+    free(decrypt);
+  }
+
+  // headers (and so chunk nonces) are never repeated
+  unsigned char header_a[AES_GCM_STREAM_HEADER_LEN];
+  unsigned char header_b[AES_GCM_STREAM_HEADER_LEN];
+
+  CU_ASSERT(aes_gcm_stream_init_header(chunk, header_a) == 0);
+  CU_ASSERT(aes_gcm_stream_init_header(chunk, header_b) == 0);
+  CU_ASSERT(memcmp(header_a, header_b, sizeof(header_a)) != 0);
+  CU_ASSERT(aes_gcm_stream_init_header(0, header_a) == 1);
+  CU_ASSERT(aes_gcm_stream_init_header(AES_GCM_STREAM_MAX_CHUNK_LEN + 1,
+                                       header_a) == 1);
+
+  free(plaintext);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_modification()
+//----------------------------------------------------------------------------
+void test_gcm_stream_modification(void)
+{
+  unsigned char key[16] = { 0 };
+  size_t chunk = AES_GCM_STREAM_CHUNK_LEN;
+  size_t chunk_ct = chunk + GCM_TAG_LEN;
+  size_t plaintext_len = 3 * chunk;
+  unsigned char *plaintext = calloc(plaintext_len, 1);
+  unsigned char *ciphertext = NULL;
+  unsigned char *decrypt = NULL;
+  size_t ciphertext_len = 0;
+  size_t decrypt_len = 0;
+
+  CU_ASSERT(aes_gcm_stream_encrypt(key, sizeof(key), plaintext,
+                                   plaintext_len, &ciphertext,
+                                   &ciphertext_len) == 0);
+
+  // a modified header (it is authenticated with every chunk) fails
+  ciphertext[AES_GCM_STREAM_HEADER_LEN - 2] ^= 0x1;
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len, &decrypt,
+                                   &decrypt_len) == 1);
+  ciphertext[AES_GCM_STREAM_HEADER_LEN - 2] ^= 0x1;
+
+  // a modified chunk fails
+  ciphertext[AES_GCM_STREAM_HEADER_LEN + chunk_ct + 5] ^= 0x1;
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len, &decrypt,
+                                   &decrypt_len) == 1);
+  ciphertext[AES_GCM_STREAM_HEADER_LEN + chunk_ct + 5] ^= 0x1;
+
+  // dropping the final chunk (truncation at a chunk boundary) fails
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len - chunk_ct, &decrypt,
+                                   &decrypt_len) == 1);
+
+  // truncation within a chunk fails
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len - 1, &decrypt,
+                                   &decrypt_len) == 1);
+
+  // swapping two chunks fails
+  unsigned char *swap = malloc(chunk_ct);
+
+  memcpy(swap, ciphertext + AES_GCM_STREAM_HEADER_LEN, chunk_ct);
+  memcpy(ciphertext + AES_GCM_STREAM_HEADER_LEN,
+         ciphertext + AES_GCM_STREAM_HEADER_LEN + chunk_ct, chunk_ct);
+  memcpy(ciphertext + AES_GCM_STREAM_HEADER_LEN + chunk_ct, swap, chunk_ct);
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len, &decrypt,
+                                   &decrypt_len) == 1);
+  memcpy(ciphertext + AES_GCM_STREAM_HEADER_LEN + chunk_ct,
+         ciphertext + AES_GCM_STREAM_HEADER_LEN, chunk_ct);
+  memcpy(ciphertext + AES_GCM_STREAM_HEADER_LEN, swap, chunk_ct);
+
+  // the restored stream still decrypts, but not under a different key
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len, &decrypt,
+                                   &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  free(decrypt);
+  decrypt = NULL;
+  key[0] ^= 0x1;
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len, &decrypt,
+                                   &decrypt_len) == 1);
+
+  free(swap);
+  free(plaintext);
+  free(ciphertext);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_file()
+//----------------------------------------------------------------------------
+void test_gcm_stream_file(void)
+{
+  unsigned char key[32] = { 0 };
+  unsigned char header[AES_GCM_STREAM_HEADER_LEN];
+  size_t plaintext_len = 2 * AES_GCM_STREAM_CHUNK_LEN + 7;
+  unsigned char *plaintext = malloc(plaintext_len);
+  unsigned char *result = malloc(plaintext_len + 1);
+
+  for (size_t i = 0; i < plaintext_len; i++)
+  {
+    plaintext[i] = (unsigned char) (i * 7);
+  }
+
+  FILE *in = tmpfile();
+  FILE *enc = tmpfile();
+  FILE *out = tmpfile();
+
+  CU_ASSERT(in != NULL && enc != NULL && out != NULL);
+  CU_ASSERT(fwrite(plaintext, 1, plaintext_len, in) == plaintext_len);
+  rewind(in);
+
+  // chunks written to a file decrypt both from the file and in memory
+  CU_ASSERT(aes_gcm_stream_init_header(AES_GCM_STREAM_CHUNK_LEN, header) ==
+            0);
+  CU_ASSERT(aes_gcm_stream_encrypt_file(key, sizeof(key), header, in, enc) ==
+            0);
+
+  size_t enc_len = (size_t) ftell(enc);
+  unsigned char *stream = malloc(AES_GCM_STREAM_HEADER_LEN + enc_len);
+
+  memcpy(stream, header, AES_GCM_STREAM_HEADER_LEN);
+  rewind(enc);
+  CU_ASSERT(fread(stream + AES_GCM_STREAM_HEADER_LEN, 1, enc_len, enc) ==
+            enc_len);
+
+  unsigned char *decrypt = NULL;
+  size_t decrypt_len = 0;
+
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), stream,
+                                   AES_GCM_STREAM_HEADER_LEN + enc_len,
+                                   &decrypt, &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  CU_ASSERT(memcmp(decrypt, plaintext, plaintext_len) == 0);
+
+  rewind(enc);
+  CU_ASSERT(aes_gcm_stream_decrypt_file(key, sizeof(key), header, enc, out)
+            == 0);
+  CU_ASSERT((size_t) ftell(out) == plaintext_len);
+  rewind(out);
+  CU_ASSERT(fread(result, 1, plaintext_len + 1, out) == plaintext_len);
+  CU_ASSERT(memcmp(result, plaintext, plaintext_len) == 0);
+
+  // a different header (nonce prefix) fails
+  rewind(enc);
+  header[9] ^= 0x1;
+  CU_ASSERT(aes_gcm_stream_decrypt_file(key, sizeof(key), header, enc, out)
+            == 1);
+
+  // an empty input still produces (and requires) a final chunk
+  FILE *empty = tmpfile();
+
+  rewind(enc);
+  CU_ASSERT(aes_gcm_stream_init_header(AES_GCM_STREAM_CHUNK_LEN, header) ==
+            0);
+  CU_ASSERT(aes_gcm_stream_encrypt_file(key, sizeof(key), header, empty,
+                                        enc) == 0);
+  CU_ASSERT(aes_gcm_stream_decrypt_file(key, sizeof(key), header, empty,
+                                        out) == 1);
+
+  fclose(empty);
+  fclose(in);
+  fclose(enc);
+  fclose(out);
+  free(stream);
+  free(decrypt);
+  free(result);
+  free(plaintext);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_threads()
+//----------------------------------------------------------------------------
+void test_gcm_stream_threads(void)
+{
+  unsigned char key[24] = { 0 };
+  size_t plaintext_len = 70 * AES_GCM_STREAM_CHUNK_LEN + 3;
+  unsigned char *plaintext = malloc(plaintext_len);
+
+  for (size_t i = 0; i < plaintext_len; i++)
+  {
+    plaintext[i] = (unsigned char) (i >> 3);
+  }
+
+  CU_ASSERT(set_cipher_threads(KMYTH_MAX_CIPHER_THREADS + 1) == 1);
+  CU_ASSERT(get_cipher_threads() == 1);
+
+  // encrypted with several threads (more chunks than one batch holds),
+  // decrypted with one, and the other way around
+  unsigned char *ciphertext = NULL;
+  unsigned char *decrypt = NULL;
+  size_t ciphertext_len = 0;
+  size_t decrypt_len = 0;
+
+  CU_ASSERT(set_cipher_threads(3) == 0);
+  CU_ASSERT(get_cipher_threads() == 3);
+  CU_ASSERT(aes_gcm_stream_encrypt(key, sizeof(key), plaintext,
+                                   plaintext_len, &ciphertext,
+                                   &ciphertext_len) == 0);
+  CU_ASSERT(set_cipher_threads(1) == 0);
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len, &decrypt,
+                                   &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  CU_ASSERT(memcmp(decrypt, plaintext, plaintext_len) == 0);
+  free(decrypt);
+  decrypt = NULL;
+
+  FILE *enc = tmpfile();
+  FILE *out = tmpfile();
+  size_t body_len = ciphertext_len - AES_GCM_STREAM_HEADER_LEN;
+
+  CU_ASSERT(fwrite(ciphertext + AES_GCM_STREAM_HEADER_LEN, 1, body_len, enc)
+            == body_len);
+  rewind(enc);
+  CU_ASSERT(set_cipher_threads(4) == 0);
+  CU_ASSERT(aes_gcm_stream_decrypt_file(key, sizeof(key), ciphertext, enc,
+                                        out) == 0);
+  CU_ASSERT((size_t) ftell(out) == plaintext_len);
+
+  // a modified chunk handled by a worker thread still fails
+  ciphertext[ciphertext_len - 2 * AES_GCM_STREAM_CHUNK_LEN] ^= 0x1;
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), ciphertext,
+                                   ciphertext_len, &decrypt,
+                                   &decrypt_len) == 1);
+
+  CU_ASSERT(set_cipher_threads(1) == 0);
+  fclose(enc);
+  fclose(out);
+  free(ciphertext);
+  free(plaintext);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_chunks()
+//----------------------------------------------------------------------------
+void test_gcm_stream_chunks(void)
+{
+  unsigned char key[16] = { 0 };
+  size_t chunk = AES_GCM_STREAM_CHUNK_LEN;
+  size_t ct_chunk = chunk + GCM_TAG_LEN;
+  size_t plaintext_len = 5 * chunk + 11;
+  unsigned char *plaintext = malloc(plaintext_len);
+  unsigned char *stream = malloc(AES_GCM_STREAM_HEADER_LEN + plaintext_len +
+                                 6 * GCM_TAG_LEN);
+  unsigned char *result = malloc(plaintext_len);
+  size_t out_len = 0;
+
+  for (size_t i = 0; i < plaintext_len; i++)
+  {
+    plaintext[i] = (unsigned char) (i * 3);
+  }
+
+  // encrypted as runs of two, three, and the final one chunk, the stream
+  // decrypts in memory as a whole
+  unsigned char *header = stream;
+  unsigned char *body = stream + AES_GCM_STREAM_HEADER_LEN;
+
+  CU_ASSERT(aes_gcm_stream_init_header(chunk, header) == 0);
+  CU_ASSERT(aes_gcm_stream_encrypt_chunks(key, sizeof(key), header, 0, false,
+                                          plaintext, 2 * chunk, body,
+                                          2 * ct_chunk, &out_len) == 0);
+  CU_ASSERT(out_len == 2 * ct_chunk);
+  CU_ASSERT(aes_gcm_stream_encrypt_chunks(key, sizeof(key), header, 2, false,
+                                          plaintext + 2 * chunk, 3 * chunk,
+                                          body + 2 * ct_chunk, 3 * ct_chunk,
+                                          &out_len) == 0);
+  CU_ASSERT(aes_gcm_stream_encrypt_chunks(key, sizeof(key), header, 5, true,
+                                          plaintext + 5 * chunk, 11,
+                                          body + 5 * ct_chunk,
+                                          11 + GCM_TAG_LEN, &out_len) == 0);
+  CU_ASSERT(out_len == 11 + GCM_TAG_LEN);
+
+  size_t stream_len = AES_GCM_STREAM_HEADER_LEN + plaintext_len +
+    6 * GCM_TAG_LEN;
+  unsigned char *decrypt = NULL;
+  size_t decrypt_len = 0;
+
+  CU_ASSERT(aes_gcm_stream_decrypt(key, sizeof(key), stream, stream_len,
+                                   &decrypt, &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  CU_ASSERT(memcmp(decrypt, plaintext, plaintext_len) == 0);
+
+  // and decrypts a run at a time, split differently
+  CU_ASSERT(aes_gcm_stream_decrypt_chunks(key, sizeof(key), header, 0, false,
+                                          body, 4 * ct_chunk, result,
+                                          4 * chunk, &out_len) == 0);
+  CU_ASSERT(out_len == 4 * chunk);
+  CU_ASSERT(aes_gcm_stream_decrypt_chunks(key, sizeof(key), header, 4, true,
+                                          body + 4 * ct_chunk,
+                                          ct_chunk + 11 + GCM_TAG_LEN,
+                                          result + 4 * chunk, chunk + 11,
+                                          &out_len) == 0);
+  CU_ASSERT(out_len == chunk + 11);
+  CU_ASSERT(memcmp(result, plaintext, plaintext_len) == 0);
+
+  // a run given the wrong position, or not marked final when it is (or
+  // the other way around), fails and leaves no plaintext behind
+  CU_ASSERT(aes_gcm_stream_decrypt_chunks(key, sizeof(key), header, 1, false,
+                                          body, ct_chunk, result, chunk,
+                                          &out_len) == 1);
+  CU_ASSERT(out_len == 0);
+  CU_ASSERT(result[1] == 0);
+  CU_ASSERT(aes_gcm_stream_decrypt_chunks(key, sizeof(key), header, 0, true,
+                                          body, ct_chunk, result, chunk,
+                                          &out_len) == 1);
+  CU_ASSERT(aes_gcm_stream_decrypt_chunks(key, sizeof(key), header, 5, false,
+                                          body + 5 * ct_chunk,
+                                          11 + GCM_TAG_LEN, result, chunk,
+                                          &out_len) == 1);
+
+  // only a final run may hold a partial chunk, and the output must fit
+  CU_ASSERT(aes_gcm_stream_encrypt_chunks(key, sizeof(key), header, 0, false,
+                                          plaintext, chunk + 1, body,
+                                          2 * ct_chunk, &out_len) == 1);
+  CU_ASSERT(aes_gcm_stream_encrypt_chunks(key, sizeof(key), header, 0, false,
+                                          plaintext, 0, body, ct_chunk,
+                                          &out_len) == 1);
+  CU_ASSERT(aes_gcm_stream_encrypt_chunks(key, sizeof(key), header, 0, true,
+                                          plaintext, chunk, body,
+                                          ct_chunk - 1, &out_len) == 1);
+  CU_ASSERT(aes_gcm_stream_encrypt_chunks(key, sizeof(key), header,
+                                          UINT32_MAX, false, plaintext,
+                                          chunk, body, ct_chunk,
+                                          &out_len) == 1);
+
+  free(decrypt);
+  free(result);
+  free(stream);
+  free(plaintext);
+}
@@ -33,6 +33,13 @@ int aes_keywrap_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite,
+                          "Test Kmyth AES key wrap/unwrap batches",
+                          test_aes_keywrap_batch))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite,
                           "Run AES key wrap test vectors",
                           test_aes_keywrap_vectors))
@@ -296,6 +303,118 @@ void test_aes_keywrap_parameters(void)
   free(inData);
 }
 
+//----------------------------------------------------------------------------
+// test_aes_keywrap_batch()
+//----------------------------------------------------------------------------
+void test_aes_keywrap_batch(void)
+{
+  typedef int (*single_fn) (unsigned char *, size_t, unsigned char *, size_t,
+                            unsigned char **, size_t *);
+  typedef int (*batch_fn) (unsigned char *, size_t, size_t, unsigned char **,
+                           size_t *, unsigned char **, size_t *);
+  const struct
+  {
+    single_fn encrypt;
+    batch_fn encrypt_batch;
+    batch_fn decrypt_batch;
+    size_t length_step;
+  } modes[] = {
+    {aes_keywrap_3394nopad_encrypt, aes_keywrap_3394nopad_encrypt_batch,
+     aes_keywrap_3394nopad_decrypt_batch, 8},
+    {aes_keywrap_5649pad_encrypt, aes_keywrap_5649pad_encrypt_batch,
+     aes_keywrap_5649pad_decrypt_batch, 5},
+  };
+  const size_t key_lens[] = { 16, 24, 32 };
+
+  unsigned char key[32];
+  unsigned char plain[8][80];
+  unsigned char *inData[8];
+  size_t inData_len[8];
+  unsigned char *wrapped[8];
+  size_t wrapped_len[8];
+  unsigned char *unwrapped[8];
+  size_t unwrapped_len[8];
+  size_t count = 8;
+
+  for (size_t i = 0; i < sizeof(key); i++)
+  {
+    key[i] = (unsigned char) (0xA0 + i);
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    memset(plain[i], (int) i + 1, sizeof(plain[i]));
+    inData[i] = plain[i];
+  }
+
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+  {
+    // inputs of different lengths, all valid for the mode
+    for (size_t i = 0; i < count; i++)
+    {
+      inData_len[i] = 16 + i * modes[m].length_step;
+    }
+
+    for (size_t k = 0; k < sizeof(key_lens) / sizeof(key_lens[0]); k++)
+    {
+      CU_ASSERT(modes[m].encrypt_batch(key, key_lens[k], count, inData,
+                                       inData_len, wrapped,
+                                       wrapped_len) == 0);
+
+      // key wrap is deterministic: each output matches a single wrap
+      for (size_t i = 0; i < count; i++)
+      {
+        unsigned char *single = NULL;
+        size_t single_len = 0;
+
+        CU_ASSERT(modes[m].encrypt(key, key_lens[k], inData[i],
+                                   inData_len[i], &single,
+                                   &single_len) == 0);
+        CU_ASSERT(single_len == wrapped_len[i]);
+        CU_ASSERT(memcmp(single, wrapped[i], single_len) == 0);
+        free(single);
+      }
+
+      CU_ASSERT(modes[m].decrypt_batch(key, key_lens[k], count, wrapped,
+                                       wrapped_len, unwrapped,
+                                       unwrapped_len) == 0);
+      for (size_t i = 0; i < count; i++)
+      {
+        CU_ASSERT(unwrapped_len[i] == inData_len[i]);
+        CU_ASSERT(memcmp(unwrapped[i], inData[i], inData_len[i]) == 0);
+        free(unwrapped[i]);
+      }
+
+      // one tampered input fails the whole batch, with no outputs returned
+      wrapped[count - 1][0] ^= 0x01;
+      CU_ASSERT(modes[m].decrypt_batch(key, key_lens[k], count, wrapped,
+                                       wrapped_len, unwrapped,
+                                       unwrapped_len) == 1);
+      for (size_t i = 0; i < count; i++)
+      {
+        CU_ASSERT(unwrapped[i] == NULL && unwrapped_len[i] == 0);
+        free(wrapped[i]);
+      }
+    }
+
+    // invalid parameters are rejected
+    CU_ASSERT(modes[m].encrypt_batch(NULL, 16, count, inData, inData_len,
+                                     wrapped, wrapped_len) == 1);
+    CU_ASSERT(modes[m].encrypt_batch(key, 20, count, inData, inData_len,
+                                     wrapped, wrapped_len) == 1);
+    CU_ASSERT(modes[m].encrypt_batch(key, 16, 0, inData, inData_len,
+                                     wrapped, wrapped_len) == 1);
+    CU_ASSERT(modes[m].encrypt_batch(key, 16, count, inData, inData_len,
+                                     NULL, wrapped_len) == 1);
+    inData_len[count / 2] = 0;
+    CU_ASSERT(modes[m].encrypt_batch(key, 16, count, inData, inData_len,
+                                     wrapped, wrapped_len) == 1);
+    for (size_t i = 0; i < count; i++)
+    {
+      CU_ASSERT(wrapped[i] == NULL && wrapped_len[i] == 0);
+    }
+  }
+}
+
 //----------------------------------------------------------------------------
 // test_aes_keywrap_vectors()
 //----------------------------------------------------------------------------
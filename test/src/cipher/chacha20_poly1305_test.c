@@ -0,0 +1,325 @@
+//############################################################################
+// chacha20_poly1305_test.c
+//
+// Tests for kmyth ChaCha20-Poly1305 functionality in
+// tpm2/src/cipher/chacha20_poly1305.c
+//############################################################################
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <CUnit/CUnit.h>
+
+#include "chacha20_poly1305_test.h"
+#include "chacha20_poly1305.h"
+#include "cipher.h"
+
+//----------------------------------------------------------------------------
+// Known-answer vectors: the key, nonce, and plaintext of RFC 8439 section
+// 2.8.2 (ciphertext as published there) with no additional authenticated
+// data, since kmyth does not use AAD, and an all-zero key/nonce with an
+// empty plaintext. Each input is formatted nonce||ciphertext||tag.
+//----------------------------------------------------------------------------
+static const char *chacha20_poly1305_vector_keys[] = {
+  "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f",
+  "0000000000000000000000000000000000000000000000000000000000000000",
+};
+
+static const char *chacha20_poly1305_vector_inputs[] = {
+  "070000004041424344454647"
+    "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+    "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+    "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+    "3ff4def08e4b7a9de576d26586cec64b6116" "6a23a4681fd59456aea1d29f82477216",
+  "000000000000000000000000" "4eb972c9a8fb3a1b382bb4d36f5ffad1",
+};
+
+static const char *chacha20_poly1305_vector_plaintexts[] = {
+  "Ladies and Gentlemen of the class of '99: If I could offer you only "
+    "one tip for the future, sunscreen would be it.",
+  "",
+};
+
+//----------------------------------------------------------------------------
+// hex_to_bytes()
+//----------------------------------------------------------------------------
+static size_t hex_to_bytes(const char *hex, unsigned char *bytes)
+{
+  size_t len = strlen(hex) / 2;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned int byte = 0;
+
+    sscanf(hex + 2 * i, "%2x", &byte);
+    bytes[i] = (unsigned char) byte;
+  }
+  return len;
+}
+
+//----------------------------------------------------------------------------
+// chacha20_poly1305_add_tests()
+//----------------------------------------------------------------------------
+int chacha20_poly1305_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Test ChaCha20-Poly1305 decryption vectors",
+                          test_chacha20_poly1305_decrypt_vectors))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test ChaCha20-Poly1305 encryption/decryption",
+                          test_chacha20_poly1305_encrypt_decrypt))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test ChaCha20-Poly1305 modification",
+                          test_chacha20_poly1305_modification))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test ChaCha20-Poly1305 in-place decryption",
+                          test_chacha20_poly1305_in_place))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test ChaCha20-Poly1305 parameter limits",
+                          test_chacha20_poly1305_parameter_limits))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test ChaCha20-Poly1305 cipher lookup",
+                          test_chacha20_poly1305_cipher_lookup))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_decrypt_vectors()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_decrypt_vectors(void)
+{
+  size_t count = sizeof(chacha20_poly1305_vector_keys) /
+    sizeof(chacha20_poly1305_vector_keys[0]);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    unsigned char key[CHACHA20_POLY1305_KEY_LEN];
+    unsigned char input[512];
+    unsigned char *output = NULL;
+    size_t output_len = 0;
+    const char *expected = chacha20_poly1305_vector_plaintexts[i];
+
+    size_t key_len = hex_to_bytes(chacha20_poly1305_vector_keys[i], key);
+    size_t input_len = hex_to_bytes(chacha20_poly1305_vector_inputs[i], input);
+
+    CU_ASSERT(chacha20_poly1305_decrypt(key, key_len, input, input_len,
+                                        &output, &output_len) == 0);
+    CU_ASSERT(output_len == strlen(expected));
+    CU_ASSERT(output != NULL &&
+              memcmp(output, expected, strlen(expected)) == 0);
+    free(output);
+
+    // the same vector must fail once its tag is altered
+    output = NULL;
+    input[input_len - 1] ^= 1;
+    CU_ASSERT(chacha20_poly1305_decrypt(key, key_len, input, input_len,
+                                        &output, &output_len) == 1);
+    CU_ASSERT(output == NULL);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_encrypt_decrypt()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_encrypt_decrypt(void)
+{
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN] = { 0 };
+  size_t lens[] = { 0, 1, 16, 1000 };
+
+  for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+  {
+    unsigned char *plaintext = calloc(lens[i] + 1, 1);
+    unsigned char *ciphertext = NULL;
+    unsigned char *decrypt = NULL;
+    size_t ciphertext_len = 0;
+    size_t decrypt_len = 0;
+
+    for (size_t j = 0; j < lens[i]; j++)
+    {
+      plaintext[j] = (unsigned char) j;
+    }
+
+    CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), plaintext, lens[i],
+                                        &ciphertext, &ciphertext_len) == 0);
+    CU_ASSERT(ciphertext_len == lens[i] + CHACHA20_POLY1305_NONCE_LEN +
+              CHACHA20_POLY1305_TAG_LEN);
+    CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                        ciphertext_len, &decrypt,
+                                        &decrypt_len) == 0);
+    CU_ASSERT(decrypt_len == lens[i]);
+    CU_ASSERT(memcmp(plaintext, decrypt, lens[i]) == 0);
+
+    free(plaintext);
+    free(ciphertext);
+    free(decrypt);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_modification()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_modification(void)
+{
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN] = { 0 };
+  unsigned char plaintext[32] = { 0 };
+  unsigned char *ciphertext = NULL;
+  unsigned char *decrypt = NULL;
+  size_t ciphertext_len = 0;
+  size_t decrypt_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), plaintext,
+                                      sizeof(plaintext), &ciphertext,
+                                      &ciphertext_len) == 0);
+
+  // flip a single bit of the key, the nonce, the ciphertext and the tag in
+  // turn: each one must break decryption
+  size_t offsets[] = { 0, CHACHA20_POLY1305_NONCE_LEN,
+    ciphertext_len - 1
+  };
+
+  key[0] ^= 1;
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                      ciphertext_len, &decrypt,
+                                      &decrypt_len) == 1);
+  key[0] ^= 1;
+
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+  {
+    ciphertext[offsets[i]] ^= 1;
+    CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                        ciphertext_len, &decrypt,
+                                        &decrypt_len) == 1);
+    ciphertext[offsets[i]] ^= 1;
+  }
+
+  // with everything restored, decryption succeeds again
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                      ciphertext_len, &decrypt,
+                                      &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == sizeof(plaintext));
+
+  free(ciphertext);
+  free(decrypt);
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_in_place()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_in_place(void)
+{
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN];
+  unsigned char input[512];
+  const char *expected = chacha20_poly1305_vector_plaintexts[0];
+  size_t expected_len = strlen(expected);
+  size_t plaintext_len = 0;
+
+  size_t key_len = hex_to_bytes(chacha20_poly1305_vector_keys[0], key);
+  size_t input_len = hex_to_bytes(chacha20_poly1305_vector_inputs[0], input);
+
+  // a tampered input fails and its ciphertext is wiped
+  input[input_len - 1] ^= 1;
+  CU_ASSERT(chacha20_poly1305_decrypt_in_place(NULL, key, key_len, input,
+                                               input_len,
+                                               &plaintext_len) == 1);
+  for (size_t i = 0; i < expected_len; i++)
+  {
+    CU_ASSERT(input[CHACHA20_POLY1305_NONCE_LEN + i] == 0);
+  }
+
+  // the known answer decrypts in place to the start of the buffer
+  input_len = hex_to_bytes(chacha20_poly1305_vector_inputs[0], input);
+  CU_ASSERT(chacha20_poly1305_decrypt_in_place(NULL, key, key_len, input,
+                                               input_len,
+                                               &plaintext_len) == 0);
+  CU_ASSERT(plaintext_len == expected_len);
+  CU_ASSERT(memcmp(input, expected, expected_len) == 0);
+
+  // encrypting into a caller buffer round trips through decrypt_into
+  unsigned char buf[CHACHA20_POLY1305_NONCE_LEN + 114 +
+                    CHACHA20_POLY1305_TAG_LEN];
+  unsigned char out[114];
+  size_t buf_len = 0;
+  size_t out_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_encrypt_into(NULL, key, key_len, input,
+                                           expected_len, buf, sizeof(buf) - 1,
+                                           &buf_len) == 1);
+  CU_ASSERT(chacha20_poly1305_encrypt_into(NULL, key, key_len, input,
+                                           expected_len, buf, sizeof(buf),
+                                           &buf_len) == 0);
+  CU_ASSERT(buf_len == sizeof(buf));
+  CU_ASSERT(chacha20_poly1305_decrypt_into(NULL, key, key_len, buf, buf_len,
+                                           out, sizeof(out) - 1,
+                                           &out_len) == 1);
+  CU_ASSERT(chacha20_poly1305_decrypt_into(NULL, key, key_len, buf, buf_len,
+                                           out, sizeof(out), &out_len) == 0);
+  CU_ASSERT(out_len == expected_len);
+  CU_ASSERT(memcmp(out, expected, expected_len) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_parameter_limits()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_parameter_limits(void)
+{
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN] = { 0 };
+  unsigned char data[CHACHA20_POLY1305_NONCE_LEN +
+                     CHACHA20_POLY1305_TAG_LEN] = { 0 };
+  unsigned char *out = NULL;
+  size_t out_len = 0;
+
+  // only 256-bit keys are defined for ChaCha20
+  CU_ASSERT(chacha20_poly1305_encrypt(NULL, sizeof(key), data, sizeof(data),
+                                      &out, &out_len) == 1);
+  CU_ASSERT(chacha20_poly1305_encrypt(key, 16, data, sizeof(data),
+                                      &out, &out_len) == 1);
+  CU_ASSERT(chacha20_poly1305_decrypt(key, 16, data, sizeof(data),
+                                      &out, &out_len) == 1);
+
+  // missing or oversized input
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), NULL, sizeof(data),
+                                      &out, &out_len) == 1);
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), data,
+                                      (size_t) INT_MAX + 1, &out,
+                                      &out_len) == 1);
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), NULL, sizeof(data),
+                                      &out, &out_len) == 1);
+
+  // decryption input must at least hold a nonce and a tag
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), data,
+                                      sizeof(data) - 1, &out, &out_len) == 1);
+  CU_ASSERT(out == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_cipher_lookup()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_cipher_lookup(void)
+{
+  cipher_t cipher =
+    kmyth_get_cipher_t_from_string("ChaCha20/Poly1305/NoPadding/256");
+
+  CU_ASSERT(cipher.cipher_name != NULL);
+  CU_ASSERT(cipher.encrypt_fn == chacha20_poly1305_encrypt);
+  CU_ASSERT(cipher.decrypt_fn == chacha20_poly1305_decrypt);
+  CU_ASSERT(get_key_len_from_cipher(cipher) == 256);
+}
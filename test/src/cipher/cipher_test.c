@@ -6,12 +6,16 @@
 // Tests for cipher utility functions in tpm2/src/cipher/cipher.c
 //############################################################################
 
+#include <string.h>
 #include <CUnit/CUnit.h>
 
 #include "cipher/aes_gcm.h"
+#include "cipher/aes_gcm_siv.h"
 #include "cipher/cipher.h"
 #include "cipher_test.h"
 
+extern const cipher_t cipher_list[];
+
 //############ General Utilities supporting Cipher Testing ###################
 
 //----------------------------------------------------------------------------
@@ -70,6 +74,30 @@ int cipher_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "kmyth_encrypt_data_with_key() Tests",
+                          test_kmyth_encrypt_data_with_key))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_decrypt_data_in_place() Tests",
+                          test_kmyth_decrypt_data_in_place))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Automatic Cipher Selection Tests",
+                          test_kmyth_cipher_auto))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_cipher_ctx Tests",
+                          test_kmyth_cipher_ctx))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -427,3 +455,241 @@ void test_kmyth_decrypt_data(void)
   free(key_g);
   free(results_g);
 }
+
+//----------------------------------------------------------------------------
+// test_kmyth_encrypt_data_with_key
+//----------------------------------------------------------------------------
+void test_kmyth_encrypt_data_with_key(void)
+{
+  unsigned char data[40];
+  unsigned char key[32];
+  unsigned char *first = NULL;
+  unsigned char *second = NULL;
+  size_t first_size = 0;
+  size_t second_size = 0;
+  cipher_t cipher =
+    kmyth_get_cipher_t_from_string("AES/KeyWrap/RFC5649Padding/256");
+
+  memset(data, 0xA5, sizeof(data));
+  memset(key, 0x17, sizeof(key));
+
+  // invalid parameters are rejected
+  CU_ASSERT(kmyth_encrypt_data_with_key(NULL, sizeof(data), cipher, key,
+                                        sizeof(key), &first,
+                                        &first_size) == 1);
+  CU_ASSERT(kmyth_encrypt_data_with_key(data, sizeof(data), cipher, NULL,
+                                        sizeof(key), &first,
+                                        &first_size) == 1);
+  CU_ASSERT(kmyth_encrypt_data_with_key(data, sizeof(data), cipher, key,
+                                        sizeof(key), NULL,
+                                        &first_size) == 1);
+  CU_ASSERT(kmyth_encrypt_data_with_key(data, sizeof(data),
+                                        kmyth_get_cipher_t_from_string(NULL),
+                                        key, sizeof(key), &first,
+                                        &first_size) == 1);
+  CU_ASSERT(first == NULL);
+
+  // the caller's key is used as is: a deterministic cipher gives the same
+  // result every time, and the key decrypts it
+  CU_ASSERT(kmyth_encrypt_data_with_key(data, sizeof(data), cipher, key,
+                                        sizeof(key), &first,
+                                        &first_size) == 0);
+  CU_ASSERT(kmyth_encrypt_data_with_key(data, sizeof(data), cipher, key,
+                                        sizeof(key), &second,
+                                        &second_size) == 0);
+  CU_ASSERT(first_size == second_size);
+  CU_ASSERT(memcmp(first, second, first_size) == 0);
+
+  unsigned char *result = NULL;
+  size_t result_size = 0;
+
+  CU_ASSERT(kmyth_decrypt_data(first, first_size, cipher, key, sizeof(key),
+                               &result, &result_size) == 0);
+  CU_ASSERT(result_size == sizeof(data));
+  CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+
+  free(result);
+  free(second);
+  free(first);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_cipher_auto
+//----------------------------------------------------------------------------
+void test_kmyth_cipher_auto(void)
+{
+  unsigned int features = kmyth_cpu_crypto_features();
+  const char *auto_name = kmyth_select_auto_cipher();
+  char buf[64];
+
+  // the probe is stable and only reports known flags
+  CU_ASSERT(kmyth_cpu_crypto_features() == features);
+  CU_ASSERT((features & ~(unsigned int) (KMYTH_CPU_AES | KMYTH_CPU_CLMUL |
+                                         KMYTH_CPU_VAES |
+                                         KMYTH_CPU_VPCLMULQDQ)) == 0);
+
+  // the automatic choice is an authenticated cipher from cipher_list, GCM
+  // exactly when AES and carry-less multiply are both accelerated
+  CU_ASSERT(auto_name != NULL);
+  if ((features & KMYTH_CPU_AES) && (features & KMYTH_CPU_CLMUL))
+  {
+    CU_ASSERT(strcmp(auto_name, "AES/GCM/NoPadding/256") == 0);
+  }
+  else
+  {
+    CU_ASSERT(strcmp(auto_name, "ChaCha20/Poly1305/NoPadding/256") == 0);
+  }
+
+  // "auto" resolves to the concrete cipher, which is what gets recorded
+  cipher_t cipher = kmyth_get_cipher_t_from_string(KMYTH_AUTO_CIPHER);
+
+  CU_ASSERT(cipher.cipher_name != NULL);
+  CU_ASSERT(strcmp(cipher.cipher_name, auto_name) == 0);
+  CU_ASSERT(cipher.decrypt_in_place_fn != NULL);
+
+  // feature formatting
+  kmyth_cpu_crypto_features_string(0, buf, sizeof(buf));
+  CU_ASSERT(strcmp(buf, "none") == 0);
+  kmyth_cpu_crypto_features_string(KMYTH_CPU_VAES | KMYTH_CPU_VPCLMULQDQ, buf,
+                                   sizeof(buf));
+  CU_ASSERT(strcmp(buf, "VAES VPCLMULQDQ") == 0);
+  kmyth_cpu_crypto_features_string(KMYTH_CPU_AES | KMYTH_CPU_CLMUL, buf,
+                                   sizeof(buf));
+  CU_ASSERT(strstr(buf, "AES") == buf);
+  kmyth_cpu_crypto_features_string(KMYTH_CPU_AES | KMYTH_CPU_CLMUL |
+                                   KMYTH_CPU_VAES | KMYTH_CPU_VPCLMULQDQ, buf,
+                                   4);
+  CU_ASSERT(strlen(buf) < 4);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_decrypt_data_in_place
+//----------------------------------------------------------------------------
+void test_kmyth_decrypt_data_in_place(void)
+{
+  unsigned char data[64];
+  unsigned char key[32] = { 0 };
+  unsigned char *enc_data = NULL;
+  size_t enc_data_size = 0;
+  size_t result_size = 0;
+  cipher_t cipher = kmyth_get_cipher_t_from_string("AES/GCM/NoPadding/256");
+
+  memset(data, 0x3C, sizeof(data));
+  CU_ASSERT(aes_gcm_encrypt(key, sizeof(key), data, sizeof(data),
+                            &enc_data, &enc_data_size) == 0);
+
+  // invalid parameters are rejected
+  CU_ASSERT(kmyth_decrypt_data_in_place(NULL, enc_data_size, cipher, key,
+                                        sizeof(key), &result_size) == 1);
+  CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, enc_data_size, cipher,
+                                        NULL, sizeof(key),
+                                        &result_size) == 1);
+  CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, enc_data_size, cipher, key,
+                                        sizeof(key), NULL) == 1);
+
+  // ciphers without in-place decryption are rejected
+  cipher_t keywrap =
+    kmyth_get_cipher_t_from_string("AES/KeyWrap/RFC5649Padding/256");
+
+  CU_ASSERT(keywrap.decrypt_in_place_fn == NULL);
+  CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, enc_data_size, keywrap,
+                                        key, sizeof(key),
+                                        &result_size) == 1);
+
+  // a valid AES/GCM input decrypts over itself
+  CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, enc_data_size, cipher, key,
+                                        sizeof(key), &result_size) == 0);
+  CU_ASSERT(result_size == sizeof(data));
+  CU_ASSERT(memcmp(enc_data, data, sizeof(data)) == 0);
+
+  free(enc_data);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_cipher_ctx
+//----------------------------------------------------------------------------
+void test_kmyth_cipher_ctx(void)
+{
+  // Every cipher implementation resolves (AES-GCM-SIV only where OpenSSL
+  // provides it), and to the same object each time
+  for (size_t i = 0; i < KMYTH_EVP_CIPHER_COUNT; i++)
+  {
+    const EVP_CIPHER *evp_cipher =
+      kmyth_get_evp_cipher((kmyth_evp_cipher_id) i);
+
+#ifndef KMYTH_HAVE_AES_GCM_SIV
+    if (i == KMYTH_EVP_AES_256_GCM_SIV)
+    {
+      CU_ASSERT(evp_cipher == NULL);
+      continue;
+    }
+#endif
+    CU_ASSERT(evp_cipher != NULL);
+    CU_ASSERT(evp_cipher == kmyth_get_evp_cipher((kmyth_evp_cipher_id) i));
+  }
+  CU_ASSERT(kmyth_get_evp_cipher(KMYTH_EVP_CIPHER_COUNT) == NULL);
+
+  CU_ASSERT(kmyth_cipher_ctx_create(NULL) == 1);
+
+  kmyth_cipher_ctx *cctx = NULL;
+
+  CU_ASSERT(kmyth_cipher_ctx_create(&cctx) == 0);
+  CU_ASSERT(cctx != NULL);
+
+  // One context serves every cipher, one call after another, including
+  // after a failed (tampered) decryption, and its results interoperate
+  // with the context-free functions
+  unsigned char data[32];
+
+  memset(data, 0xA5, sizeof(data));
+  for (size_t round = 0; round < 2; round++)
+  {
+    for (size_t i = 0; cipher_list[i].cipher_name != NULL; i++)
+    {
+      cipher_t cipher = cipher_list[i];
+
+      if (cipher.encrypt_ctx_fn == NULL)
+      {
+        continue;
+      }
+      cipher.ctx = cctx;
+
+      size_t key_len = get_key_len_from_cipher(cipher) / 8;
+      unsigned char *key = calloc(key_len, 1);
+      unsigned char *enc_data = NULL;
+      size_t enc_data_len = 0;
+      unsigned char *dec_data = NULL;
+      size_t dec_data_len = 0;
+
+      CU_ASSERT(kmyth_encrypt_data(data, sizeof(data), cipher, &enc_data,
+                                   &enc_data_len, &key, &key_len) == 0);
+      CU_ASSERT(cipher.decrypt_fn(key, key_len, enc_data, enc_data_len,
+                                  &dec_data, &dec_data_len) == 0);
+      CU_ASSERT(dec_data_len == sizeof(data));
+      CU_ASSERT(dec_data != NULL &&
+                memcmp(dec_data, data, sizeof(data)) == 0);
+      free(dec_data);
+      dec_data = NULL;
+
+      enc_data[enc_data_len - 1] ^= 1;
+      CU_ASSERT(kmyth_decrypt_data(enc_data, enc_data_len, cipher, key,
+                                   key_len, &dec_data, &dec_data_len) == 1);
+      dec_data = NULL;          // released by the failed decryption
+      enc_data[enc_data_len - 1] ^= 1;
+
+      CU_ASSERT(kmyth_decrypt_data(enc_data, enc_data_len, cipher, key,
+                                   key_len, &dec_data, &dec_data_len) == 0);
+      CU_ASSERT(dec_data_len == sizeof(data));
+      CU_ASSERT(dec_data != NULL &&
+                memcmp(dec_data, data, sizeof(data)) == 0);
+
+      free(dec_data);
+      free(enc_data);
+      free(key);
+    }
+  }
+
+  kmyth_cipher_ctx_destroy(&cctx);
+  CU_ASSERT(cctx == NULL);
+  kmyth_cipher_ctx_destroy(&cctx);
+}
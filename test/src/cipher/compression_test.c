@@ -0,0 +1,299 @@
+//############################################################################
+// compression_test.c
+//
+// Tests for the kmyth compression stage in tpm2/src/cipher/compression.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "compression_test.h"
+#include "cipher/compression.h"
+
+// size of the test data, large enough to span several pipe buffers
+#define COMPRESSION_TEST_DATA_LEN (300 * 1024)
+
+//----------------------------------------------------------------------------
+// make_test_data()
+//----------------------------------------------------------------------------
+static uint8_t *make_test_data(size_t len)
+{
+  uint8_t *data = malloc(len);
+  const char *line = "{\"name\": \"kmyth\", \"sealed\": true, \"id\": ";
+
+  for (size_t i = 0; data != NULL && i < len; i++)
+  {
+    // text-like data, with a varying number so it is not all one repeat
+    data[i] = (i % 64 < strlen(line)) ? (uint8_t) line[i % 64] :
+      (uint8_t) ('0' + (i / 64) % 10);
+  }
+  return data;
+}
+
+//----------------------------------------------------------------------------
+// read_all()
+//----------------------------------------------------------------------------
+static size_t read_all(FILE * in, uint8_t * buf, size_t size)
+{
+  size_t len = 0;
+  size_t n = 0;
+
+  while (len < size && (n = fread(buf + len, 1, size - len, in)) > 0)
+  {
+    len += n;
+  }
+  return len;
+}
+
+//----------------------------------------------------------------------------
+// compression_add_tests()
+//----------------------------------------------------------------------------
+int compression_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Test compression names",
+                          test_compression_names))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test compression/decompression",
+                          test_compress_decompress))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test invalid compressed data",
+                          test_decompress_invalid))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test compression pipe",
+                          test_compression_pipe))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_compression_names()
+//----------------------------------------------------------------------------
+void test_compression_names(void)
+{
+  kmyth_compression compression = KMYTH_COMPRESSION_NONE;
+
+  CU_ASSERT(kmyth_compression_from_name(KMYTH_COMPRESSION_DEFLATE_NAME,
+                                        &compression) == 0);
+  CU_ASSERT(compression == KMYTH_COMPRESSION_DEFLATE);
+  CU_ASSERT(strcmp(kmyth_compression_name(compression),
+                   KMYTH_COMPRESSION_DEFLATE_NAME) == 0);
+  CU_ASSERT(kmyth_compression_from_name(KMYTH_COMPRESSION_NONE_NAME,
+                                        &compression) == 0);
+  CU_ASSERT(compression == KMYTH_COMPRESSION_NONE);
+  CU_ASSERT(kmyth_compression_from_name("zstd", &compression) == 1);
+  CU_ASSERT(kmyth_compression_from_name(NULL, &compression) == 1);
+  CU_ASSERT(kmyth_compression_name((kmyth_compression) 42) == NULL);
+
+  // sealed data is not compressed unless asked for
+  CU_ASSERT(get_compression() == KMYTH_COMPRESSION_NONE);
+  CU_ASSERT(set_compression(KMYTH_COMPRESSION_DEFLATE) == 0);
+  CU_ASSERT(get_compression() == KMYTH_COMPRESSION_DEFLATE);
+  CU_ASSERT(set_compression((kmyth_compression) 42) == 1);
+  CU_ASSERT(get_compression() == KMYTH_COMPRESSION_DEFLATE);
+  CU_ASSERT(set_compression(KMYTH_COMPRESSION_NONE) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_compress_decompress()
+//----------------------------------------------------------------------------
+void test_compress_decompress(void)
+{
+  size_t lens[] = { 0, 1, 1000, COMPRESSION_TEST_DATA_LEN };
+  uint8_t *data = make_test_data(COMPRESSION_TEST_DATA_LEN);
+
+  CU_ASSERT_FATAL(data != NULL);
+  for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+  {
+    uint8_t *compressed = NULL;
+    size_t compressed_len = 0;
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+
+    CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_DEFLATE, data, lens[i],
+                                  &compressed, &compressed_len) == 0);
+    CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_DEFLATE, compressed,
+                                    compressed_len, &output,
+                                    &output_len) == 0);
+    CU_ASSERT(output_len == lens[i]);
+    CU_ASSERT(output != NULL && memcmp(output, data, lens[i]) == 0);
+
+    // repetitive data shrinks well below its size
+    if (lens[i] >= 1000)
+    {
+      CU_ASSERT(compressed_len < lens[i] / 4);
+    }
+    free(compressed);
+    free(output);
+  }
+
+  // KMYTH_COMPRESSION_NONE is not an algorithm to run
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+
+  CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_NONE, data, 10,
+                                &out, &out_len) == 1);
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_NONE, data, 10,
+                                  &out, &out_len) == 1);
+  CU_ASSERT(out == NULL);
+
+  free(data);
+}
+
+//----------------------------------------------------------------------------
+// test_decompress_invalid()
+//----------------------------------------------------------------------------
+void test_decompress_invalid(void)
+{
+  uint8_t *data = make_test_data(COMPRESSION_TEST_DATA_LEN);
+  uint8_t *compressed = NULL;
+  size_t compressed_len = 0;
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT_FATAL(data != NULL);
+  CU_ASSERT_FATAL(kmyth_compress_data(KMYTH_COMPRESSION_DEFLATE, data,
+                                      COMPRESSION_TEST_DATA_LEN, &compressed,
+                                      &compressed_len) == 0);
+
+  // truncated
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_DEFLATE, compressed,
+                                  compressed_len - 1, &output,
+                                  &output_len) == 1);
+  CU_ASSERT(output == NULL);
+
+  // followed by more data
+  uint8_t *extended = malloc(compressed_len + 1);
+
+  CU_ASSERT_FATAL(extended != NULL);
+  memcpy(extended, compressed, compressed_len);
+  extended[compressed_len] = 0;
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_DEFLATE, extended,
+                                  compressed_len + 1, &output,
+                                  &output_len) == 1);
+  CU_ASSERT(output == NULL);
+  free(extended);
+
+  // altered checksum
+  compressed[compressed_len - 1] ^= 1;
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_DEFLATE, compressed,
+                                  compressed_len, &output, &output_len) == 1);
+  CU_ASSERT(output == NULL);
+
+  // not compressed at all
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_DEFLATE, data, 100,
+                                  &output, &output_len) == 1);
+  CU_ASSERT(output == NULL);
+
+  free(compressed);
+  free(data);
+}
+
+//----------------------------------------------------------------------------
+// test_compression_pipe()
+//----------------------------------------------------------------------------
+void test_compression_pipe(void)
+{
+  uint8_t *data = make_test_data(COMPRESSION_TEST_DATA_LEN);
+  uint8_t *compressed = malloc(COMPRESSION_TEST_DATA_LEN);
+  uint8_t *output = malloc(COMPRESSION_TEST_DATA_LEN + 1);
+  FILE *plain = tmpfile();
+  FILE *pipe_end = NULL;
+  kmyth_compression_pipe *stage = NULL;
+
+  CU_ASSERT_FATAL(data != NULL && compressed != NULL && output != NULL &&
+                  plain != NULL);
+  CU_ASSERT_FATAL(fwrite(data, 1, COMPRESSION_TEST_DATA_LEN, plain) ==
+                  COMPRESSION_TEST_DATA_LEN);
+  rewind(plain);
+
+  // compress: the caller reads the compressed file from the pipe
+  CU_ASSERT_FATAL(kmyth_compression_pipe_start(KMYTH_COMPRESSION_DEFLATE,
+                                               true, plain, &pipe_end,
+                                               &stage) == 0);
+
+  size_t compressed_len = read_all(pipe_end, compressed,
+                                   COMPRESSION_TEST_DATA_LEN);
+
+  CU_ASSERT(kmyth_compression_pipe_finish(&stage) == 0);
+  CU_ASSERT(stage == NULL);
+  CU_ASSERT(compressed_len > 0 &&
+            compressed_len < COMPRESSION_TEST_DATA_LEN / 4);
+  fclose(plain);
+
+  // the stream decompresses as a whole buffer too
+  uint8_t *whole = NULL;
+  size_t whole_len = 0;
+
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_DEFLATE, compressed,
+                                  compressed_len, &whole, &whole_len) == 0);
+  CU_ASSERT(whole_len == COMPRESSION_TEST_DATA_LEN);
+  CU_ASSERT(whole != NULL && memcmp(whole, data, whole_len) == 0);
+  free(whole);
+
+  // decompress: the caller writes the compressed file to the pipe
+  plain = tmpfile();
+  CU_ASSERT_FATAL(plain != NULL);
+  CU_ASSERT_FATAL(kmyth_compression_pipe_start(KMYTH_COMPRESSION_DEFLATE,
+                                               false, plain, &pipe_end,
+                                               &stage) == 0);
+  CU_ASSERT(fwrite(compressed, 1, compressed_len, pipe_end) ==
+            compressed_len);
+  CU_ASSERT(kmyth_compression_pipe_finish(&stage) == 0);
+  rewind(plain);
+  CU_ASSERT(read_all(plain, output, COMPRESSION_TEST_DATA_LEN + 1) ==
+            COMPRESSION_TEST_DATA_LEN);
+  CU_ASSERT(memcmp(output, data, COMPRESSION_TEST_DATA_LEN) == 0);
+  fclose(plain);
+
+  // a truncated stream, or one followed by more data, fails (after being
+  // read to its end, so the writer is never blocked)
+  plain = tmpfile();
+  CU_ASSERT_FATAL(plain != NULL);
+  CU_ASSERT_FATAL(kmyth_compression_pipe_start(KMYTH_COMPRESSION_DEFLATE,
+                                               false, plain, &pipe_end,
+                                               &stage) == 0);
+  fwrite(compressed, 1, compressed_len / 2, pipe_end);
+  CU_ASSERT(kmyth_compression_pipe_finish(&stage) == 1);
+  fclose(plain);
+
+  plain = tmpfile();
+  CU_ASSERT_FATAL(plain != NULL);
+  CU_ASSERT_FATAL(kmyth_compression_pipe_start(KMYTH_COMPRESSION_DEFLATE,
+                                               false, plain, &pipe_end,
+                                               &stage) == 0);
+  fwrite(compressed, 1, compressed_len, pipe_end);
+  fwrite(data, 1, COMPRESSION_TEST_DATA_LEN, pipe_end);
+  CU_ASSERT(kmyth_compression_pipe_finish(&stage) == 1);
+  fclose(plain);
+
+  // a compressing stage whose reader gives up early ends without blocking
+  plain = tmpfile();
+  CU_ASSERT_FATAL(plain != NULL);
+  fwrite(data, 1, COMPRESSION_TEST_DATA_LEN, plain);
+  rewind(plain);
+  CU_ASSERT_FATAL(kmyth_compression_pipe_start(KMYTH_COMPRESSION_DEFLATE,
+                                               true, plain, &pipe_end,
+                                               &stage) == 0);
+  CU_ASSERT(fread(output, 1, 10, pipe_end) == 10);
+  kmyth_compression_pipe_finish(&stage);
+  CU_ASSERT(stage == NULL);
+  fclose(plain);
+
+  free(output);
+  free(compressed);
+  free(data);
+}
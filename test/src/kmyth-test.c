@@ -18,14 +18,30 @@
 #include "object_tools_test.h"
 #include "marshalling_tools_test.h"
 #include "formatting_tools_test.h"
+#include "base64_codec_test.h"
+#include "metrics_test.h"
 #include "tls_util_test.h"
+#include "socket_util_test.h"
 #include "aes_gcm_test.h"
 #include "aes_keywrap_test.h"
+#include "chacha20_poly1305_test.h"
+#include "aes_gcm_siv_test.h"
 #include "tpm2_interface_test.h"
 #include "storage_key_tools_test.h"
 #include "pcrs_test.h"
 #include "kmyth_seal_unseal_impl_test.h"
+#include "kmyth_context_test.h"
+#include "kmyth_dispatch_test.h"
+#include "kmyth_prewarm_test.h"
+#include "kmyth_mock_tpm.h"
+#include "kmyth_mock_tpm_test.h"
+#include "kmyth_reseal_plan_test.h"
+#include "kmyth_envelope_test.h"
+#include "kmyth_keyring_test.h"
+#include "kmyth_policy_authorize_test.h"
 #include "cipher_test.h"
+#include "compression_test.h"
+#include "performance_test.h"
 
 /**
  * Use trivial (do nothing) init_suite and clean_suite functionality
@@ -45,6 +61,13 @@ int clean_suite(void)
 //----------------------------------------------------------------------------
 int main(int argc, char **argv)
 {
+  // The mock TPM is linked into the tests, not the library, and must be
+  // registered before the tests select it
+  if (kmyth_mock_tpm_register())
+  {
+    return EXIT_FAILURE;
+  }
+
   // Initialize CUnit test registry
   if (CUE_SUCCESS != CU_initialize_registry())
   {
@@ -148,6 +171,38 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure utility base64 codec test suite
+  CU_pSuite base64_codec_test_suite = NULL;
+
+  base64_codec_test_suite = CU_add_suite("Utility Base64 Codec Test Suite",
+                                         init_suite, clean_suite);
+  if (NULL == base64_codec_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (base64_codec_add_tests(base64_codec_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure utility metrics test suite
+  CU_pSuite metrics_test_suite = NULL;
+
+  metrics_test_suite = CU_add_suite("Utility Metrics Test Suite",
+                                    init_suite, clean_suite);
+  if (NULL == metrics_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (metrics_add_tests(metrics_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure TLS utility test suite
   CU_pSuite tls_utility_test_suite = NULL;
 
@@ -164,6 +219,22 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure socket utility test suite
+  CU_pSuite socket_utility_test_suite = NULL;
+
+  socket_utility_test_suite = CU_add_suite("Socket Utility Test Suite",
+                                           init_suite, clean_suite);
+  if (NULL == socket_utility_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (socket_util_add_tests(socket_utility_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure the AES/GCM cipher test suite
   CU_pSuite aes_gcm_test_suite = NULL;
 
@@ -196,6 +267,38 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure the ChaCha20-Poly1305 cipher test suite
+  CU_pSuite chacha20_poly1305_test_suite = NULL;
+
+  chacha20_poly1305_test_suite = CU_add_suite("ChaCha20-Poly1305 Cipher Test Suite",
+                                              init_suite, clean_suite);
+  if (NULL == chacha20_poly1305_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (chacha20_poly1305_add_tests(chacha20_poly1305_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure the AES-GCM-SIV cipher test suite
+  CU_pSuite aes_gcm_siv_test_suite = NULL;
+
+  aes_gcm_siv_test_suite = CU_add_suite("AES-GCM-SIV Cipher Test Suite",
+                                        init_suite, clean_suite);
+  if (NULL == aes_gcm_siv_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (aes_gcm_siv_add_tests(aes_gcm_siv_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure the tpm2 interface test suite
   CU_pSuite tpm2_interface_test_suite = NULL;
 
@@ -227,6 +330,151 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure seal/unseal implementation test suite
+  CU_pSuite kmyth_seal_unseal_impl_test_suite = NULL;
+
+  kmyth_seal_unseal_impl_test_suite =
+    CU_add_suite("Kmyth Seal/Unseal Implementation Test Suite", init_suite,
+                 clean_suite);
+  if (NULL == kmyth_seal_unseal_impl_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_seal_unseal_impl_add_tests(kmyth_seal_unseal_impl_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth context test suite
+  CU_pSuite kmyth_context_test_suite = NULL;
+
+  kmyth_context_test_suite = CU_add_suite("Kmyth Context Test Suite",
+                                          init_suite, clean_suite);
+  if (NULL == kmyth_context_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_context_add_tests(kmyth_context_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth dispatch test suite
+  CU_pSuite kmyth_dispatch_test_suite = NULL;
+
+  kmyth_dispatch_test_suite = CU_add_suite("Kmyth Dispatch Test Suite",
+                                           init_suite, clean_suite);
+  if (NULL == kmyth_dispatch_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_dispatch_add_tests(kmyth_dispatch_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth prewarm test suite
+  CU_pSuite kmyth_prewarm_test_suite = NULL;
+
+  kmyth_prewarm_test_suite = CU_add_suite("Kmyth Prewarm Test Suite",
+                                          init_suite, clean_suite);
+  if (NULL == kmyth_prewarm_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_prewarm_add_tests(kmyth_prewarm_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth mock TPM test suite
+  CU_pSuite kmyth_mock_tpm_test_suite = NULL;
+
+  kmyth_mock_tpm_test_suite = CU_add_suite("Kmyth Mock TPM Test Suite",
+                                           init_suite, clean_suite);
+  if (NULL == kmyth_mock_tpm_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_mock_tpm_add_tests(kmyth_mock_tpm_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth reseal plan test suite
+  CU_pSuite kmyth_reseal_plan_test_suite = NULL;
+
+  kmyth_reseal_plan_test_suite = CU_add_suite("Kmyth Reseal Plan Test Suite",
+                                              init_suite, clean_suite);
+  if (NULL == kmyth_reseal_plan_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_reseal_plan_add_tests(kmyth_reseal_plan_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth envelope test suite
+  CU_pSuite kmyth_envelope_test_suite = NULL;
+
+  kmyth_envelope_test_suite = CU_add_suite("Kmyth Envelope Test Suite",
+                                           init_suite, clean_suite);
+  if (NULL == kmyth_envelope_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_envelope_add_tests(kmyth_envelope_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth keyring test suite
+  CU_pSuite kmyth_keyring_test_suite = NULL;
+
+  kmyth_keyring_test_suite = CU_add_suite("Kmyth Keyring Test Suite",
+                                          init_suite, clean_suite);
+  if (NULL == kmyth_keyring_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_keyring_add_tests(kmyth_keyring_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure Kmyth signed policy test suite
+  CU_pSuite kmyth_policy_authorize_test_suite = NULL;
+
+  kmyth_policy_authorize_test_suite =
+    CU_add_suite("Kmyth Signed Policy Test Suite", init_suite, clean_suite);
+  if (NULL == kmyth_policy_authorize_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_policy_authorize_add_tests(kmyth_policy_authorize_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure cipher utility test suite
   CU_pSuite cipher_test_suite = NULL;
 
@@ -243,6 +491,38 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure compression test suite
+  CU_pSuite compression_test_suite = NULL;
+
+  compression_test_suite = CU_add_suite("Compression Test Suite", init_suite,
+                                        clean_suite);
+  if (NULL == compression_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (compression_add_tests(compression_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure performance regression test suite
+  CU_pSuite performance_test_suite = NULL;
+
+  performance_test_suite = CU_add_suite("Performance Test Suite", init_suite,
+                                        clean_suite);
+  if (NULL == performance_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (performance_add_tests(performance_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Run tests using basic interface
   CU_basic_run_tests();
 
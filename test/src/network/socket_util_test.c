@@ -0,0 +1,137 @@
+//############################################################################
+// socket_util_test.c
+//
+// Tests for socket utility functions in src/network/socket_util.c
+//############################################################################
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <CUnit/CUnit.h>
+
+#include "socket_util_test.h"
+#include "socket_util.h"
+
+//----------------------------------------------------------------------------
+// socket_util_add_tests()
+//----------------------------------------------------------------------------
+int socket_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "socket_read_full() Tests",
+                          test_socket_read_full))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "socket_writev_full() Tests",
+                          test_socket_writev_full))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_socket_read_full()
+//----------------------------------------------------------------------------
+void test_socket_read_full(void)
+{
+  int fds[2] = { -1, -1 };
+
+  CU_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+  // A message that arrives in pieces is read whole
+  unsigned char buf[8] = { 0 };
+
+  CU_ASSERT(write(fds[1], "abc", 3) == 3);
+  CU_ASSERT(write(fds[1], "defgh", 5) == 5);
+  CU_ASSERT(socket_read_full(fds[0], buf, 8) == 0);
+  CU_ASSERT(memcmp(buf, "abcdefgh", 8) == 0);
+
+  // A zero length read needs nothing from the socket
+  CU_ASSERT(socket_read_full(fds[0], buf, 0) == 0);
+
+  // A connection closed part way through the message is an error
+  CU_ASSERT(write(fds[1], "abc", 3) == 3);
+  close(fds[1]);
+  CU_ASSERT(socket_read_full(fds[0], buf, 8) == 1);
+
+  close(fds[0]);
+}
+
+//----------------------------------------------------------------------------
+// test_socket_writev_full()
+//----------------------------------------------------------------------------
+typedef struct reader_arg
+{
+  int fd;
+  unsigned char *buf;
+  size_t len;
+  int result;
+} reader_arg;
+
+static void *reader_main(void *arg)
+{
+  reader_arg *r = (reader_arg *) arg;
+
+  r->result = socket_read_full(r->fd, r->buf, r->len);
+  return NULL;
+}
+
+void test_socket_writev_full(void)
+{
+  int fds[2] = { -1, -1 };
+
+  CU_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+  // A header and payload arrive together, in order
+  unsigned char header[2] = { 0x00, 0x05 };
+  struct iovec iov[2] = { { header, 2 }, { "hello", 5 } };
+  unsigned char buf[7] = { 0 };
+
+  CU_ASSERT(socket_writev_full(fds[1], iov, 2) == 0);
+  CU_ASSERT(socket_read_full(fds[0], buf, 7) == 0);
+  CU_ASSERT(memcmp(buf, "\x00\x05hello", 7) == 0);
+
+  // A payload larger than the socket buffer takes several partial writes,
+  // some ending part way into a buffer, and still arrives intact
+  size_t big_len = 4 * 1024 * 1024;
+  unsigned char *big = malloc(big_len);
+  unsigned char *got = calloc(2 + big_len, 1);
+
+  CU_ASSERT_FATAL(big != NULL && got != NULL);
+  for (size_t i = 0; i < big_len; i++)
+  {
+    big[i] = (unsigned char) (i * 7);
+  }
+
+  reader_arg r = { fds[0], got, 2 + big_len, -1 };
+  pthread_t reader;
+
+  CU_ASSERT_FATAL(pthread_create(&reader, NULL, reader_main, &r) == 0);
+
+  struct iovec big_iov[3] = { { header, 2 }, { NULL, 0 }, { big, big_len } };
+
+  CU_ASSERT(socket_writev_full(fds[1], big_iov, 3) == 0);
+  pthread_join(reader, NULL);
+  CU_ASSERT(r.result == 0);
+  CU_ASSERT(memcmp(got, header, 2) == 0);
+  CU_ASSERT(memcmp(got + 2, big, big_len) == 0);
+
+  free(big);
+  free(got);
+
+  // Writing to a closed connection is an error
+  close(fds[0]);
+  struct iovec closed_iov[1] = { { header, 2 } };
+
+  signal(SIGPIPE, SIG_IGN);
+  CU_ASSERT(socket_writev_full(fds[1], closed_iov, 1) == 1);
+
+  close(fds[1]);
+}
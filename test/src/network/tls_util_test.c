@@ -6,6 +6,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
 #include <CUnit/CUnit.h>
 #include <openssl/ssl.h>
 
@@ -23,12 +27,36 @@ int tls_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "create_tls_connection_race() Tests",
+                          test_create_tls_connection_race))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "create_tls_connection_race_deferred() Tests",
+                          test_create_tls_connection_race_deferred))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "tls_set_context() Tests",
                           test_tls_set_context))
   {
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "TLS session cache Tests",
+                          test_tls_session_cache))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "TLS connection pool Tests",
+                          test_tls_conn_pool))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "get_resp_from_tls_server() Tests",
                           test_get_resp_from_tls_server))
   {
@@ -41,6 +69,12 @@ int tls_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Asynchronous key fetch Tests",
+                          test_tls_key_fetch))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -97,6 +131,107 @@ void test_create_tls_connection(void)
   SSL_CTX_free(tls_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_create_tls_connection_race()
+//----------------------------------------------------------------------------
+void test_create_tls_connection_race(void)
+{
+  char *servers[] = { "127.0.0.1:5696", "127.0.0.2:5696" };
+  unsigned char *client_private_key = (unsigned char *) "1234";
+  size_t client_private_key_len = 5;
+  char *client_cert_path = "/path/to/client/cert";
+  char *ca_cert_path = "/path/to/ca/cert";
+  BIO *tls_bio = NULL;
+  SSL_CTX *tls_ctx = NULL;
+  size_t winner = 0;
+
+  // A null or empty server list should produce an error
+  CU_ASSERT(create_tls_connection_race(NULL, 2, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, 250,
+                                       &tls_bio, &tls_ctx, &winner) == 1);
+  CU_ASSERT(create_tls_connection_race(servers, 0, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, 250,
+                                       &tls_bio, &tls_ctx, &winner) == 1);
+
+  // A null or empty client private key should produce an error
+  CU_ASSERT(create_tls_connection_race(servers, 2, NULL,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, 250,
+                                       &tls_bio, &tls_ctx, &winner) == 1);
+  CU_ASSERT(create_tls_connection_race(servers, 2, client_private_key, 0,
+                                       client_cert_path, ca_cert_path, 250,
+                                       &tls_bio, &tls_ctx, &winner) == 1);
+
+  // Null certificate paths should produce an error
+  CU_ASSERT(create_tls_connection_race(servers, 2, client_private_key,
+                                       client_private_key_len, NULL,
+                                       ca_cert_path, 250,
+                                       &tls_bio, &tls_ctx, &winner) == 1);
+  CU_ASSERT(create_tls_connection_race(servers, 2, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, NULL, 250,
+                                       &tls_bio, &tls_ctx, &winner) == 1);
+
+  // Null output variables should produce an error
+  CU_ASSERT(create_tls_connection_race(servers, 2, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, 250,
+                                       NULL, &tls_ctx, &winner) == 1);
+  CU_ASSERT(create_tls_connection_race(servers, 2, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, 250,
+                                       &tls_bio, NULL, &winner) == 1);
+  CU_ASSERT(create_tls_connection_race(servers, 2, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, 250,
+                                       &tls_bio, &tls_ctx, NULL) == 1);
+
+  // An unusable client identity fails before any server is contacted
+  CU_ASSERT(create_tls_connection_race(servers, 2, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, 250,
+                                       &tls_bio, &tls_ctx, &winner) == 1);
+  CU_ASSERT(tls_bio == NULL);
+
+  SSL_CTX_free(tls_ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_create_tls_connection_race_deferred()
+//----------------------------------------------------------------------------
+void test_create_tls_connection_race_deferred(void)
+{
+  char *servers[] = { "127.0.0.1:5696", "127.0.0.2:5696" };
+  char *client_cert_path = "/path/to/client/cert";
+  char *ca_cert_path = "/path/to/ca/cert";
+  BIO *tls_bio = NULL;
+  SSL_CTX *tls_ctx = NULL;
+  size_t winner = 0;
+
+  tls_deferred_key *client_key = tls_deferred_key_new();
+
+  CU_ASSERT(client_key != NULL);
+
+  // A null deferred key should produce an error
+  CU_ASSERT(create_tls_connection_race_deferred(servers, 2, NULL,
+                                                client_cert_path,
+                                                ca_cert_path, 250, &tls_bio,
+                                                &tls_ctx, &winner) == 1);
+
+  // A key whose producer failed should produce an error, and no connection
+  tls_deferred_key_set(client_key, NULL, 0);
+  CU_ASSERT(create_tls_connection_race_deferred(servers, 2, client_key,
+                                                client_cert_path,
+                                                ca_cert_path, 250, &tls_bio,
+                                                &tls_ctx, &winner) == 1);
+  CU_ASSERT(tls_bio == NULL);
+
+  SSL_CTX_free(tls_ctx);
+  tls_deferred_key_free(client_key);
+}
+
 //----------------------------------------------------------------------------
 // test_tls_set_context()
 //----------------------------------------------------------------------------
@@ -131,6 +266,131 @@ void test_tls_set_context(void)
   free(non_null_ptr);
 }
 
+//----------------------------------------------------------------------------
+// test_tls_session_cache()
+//----------------------------------------------------------------------------
+void test_tls_session_cache(void)
+{
+  unsigned char client_private_key[] = "client private key";
+  unsigned char key[TLS_SESSION_CACHE_KEY_LEN] = { 0 };
+  unsigned char other_key[TLS_SESSION_CACHE_KEY_LEN] = { 0 };
+
+  // Invalid inputs should produce an error
+  CU_ASSERT(tls_derive_session_cache_key(NULL, 1, key) == 1);
+  CU_ASSERT(tls_derive_session_cache_key(client_private_key, 0, key) == 1);
+  CU_ASSERT(tls_derive_session_cache_key(client_private_key,
+                                         sizeof(client_private_key),
+                                         NULL) == 1);
+  CU_ASSERT(tls_load_session_cache(NULL, key) == 1);
+  CU_ASSERT(tls_save_session_cache(NULL, key) == 1);
+
+  // The key depends only on the client private key
+  CU_ASSERT(tls_derive_session_cache_key(client_private_key,
+                                         sizeof(client_private_key),
+                                         key) == 0);
+  CU_ASSERT(tls_derive_session_cache_key(client_private_key,
+                                         sizeof(client_private_key),
+                                         other_key) == 0);
+  CU_ASSERT(memcmp(key, other_key, sizeof(key)) == 0);
+  client_private_key[0] ^= 1;
+  CU_ASSERT(tls_derive_session_cache_key(client_private_key,
+                                         sizeof(client_private_key),
+                                         other_key) == 0);
+  CU_ASSERT(memcmp(key, other_key, sizeof(key)) != 0);
+
+  char cache_path[] = "/tmp/kmyth_tls_sessions_XXXXXX";
+  int fd = mkstemp(cache_path);
+
+  CU_ASSERT(fd >= 0);
+  close(fd);
+
+  // A missing cache file is not an error
+  unlink(cache_path);
+  CU_ASSERT(tls_load_session_cache(cache_path, key) == 0);
+
+  // A saved cache can be read back only with the key it was saved under
+  tls_clear_session_cache();
+  CU_ASSERT(tls_save_session_cache(cache_path, key) == 0);
+  CU_ASSERT(tls_load_session_cache(cache_path, key) == 0);
+  CU_ASSERT(tls_load_session_cache(cache_path, other_key) == 1);
+
+  unlink(cache_path);
+  tls_clear_session_cache();
+}
+
+//----------------------------------------------------------------------------
+// test_tls_conn_pool()
+//----------------------------------------------------------------------------
+void test_tls_conn_pool(void)
+{
+  char *server = "127.0.0.1:5696";
+  unsigned char *client_private_key = (unsigned char *) "1234";
+  size_t client_private_key_len = 5;
+  char *client_cert_path = "/path/to/client/cert";
+  char *ca_cert_path = "/path/to/ca/cert";
+  BIO *tls_bio = NULL;
+
+  // A pool must allow at least one connection
+  CU_ASSERT(tls_conn_pool_new(0, 0) == NULL);
+
+  tls_conn_pool *pool = tls_conn_pool_new(2, 60);
+
+  CU_ASSERT(pool != NULL);
+
+  // A null pool should produce an error
+  CU_ASSERT(tls_conn_pool_get(NULL, server, client_private_key,
+                              client_private_key_len, client_cert_path,
+                              ca_cert_path, &tls_bio) == 1);
+
+  // A null server should produce an error
+  CU_ASSERT(tls_conn_pool_get(pool, NULL, client_private_key,
+                              client_private_key_len, client_cert_path,
+                              ca_cert_path, &tls_bio) == 1);
+
+  // A server address without a port should produce an error
+  CU_ASSERT(tls_conn_pool_get(pool, "127.0.0.1", client_private_key,
+                              client_private_key_len, client_cert_path,
+                              ca_cert_path, &tls_bio) == 1);
+
+  // A null or empty client private key should produce an error
+  CU_ASSERT(tls_conn_pool_get(pool, server, NULL,
+                              client_private_key_len, client_cert_path,
+                              ca_cert_path, &tls_bio) == 1);
+  CU_ASSERT(tls_conn_pool_get(pool, server, client_private_key,
+                              0, client_cert_path,
+                              ca_cert_path, &tls_bio) == 1);
+
+  // Null certificate paths should produce an error
+  CU_ASSERT(tls_conn_pool_get(pool, server, client_private_key,
+                              client_private_key_len, NULL,
+                              ca_cert_path, &tls_bio) == 1);
+  CU_ASSERT(tls_conn_pool_get(pool, server, client_private_key,
+                              client_private_key_len, client_cert_path,
+                              NULL, &tls_bio) == 1);
+
+  // A null BIO variable should produce an error
+  CU_ASSERT(tls_conn_pool_get(pool, server, client_private_key,
+                              client_private_key_len, client_cert_path,
+                              ca_cert_path, NULL) == 1);
+
+  // A failed connection leaves no BIO behind
+  CU_ASSERT(tls_conn_pool_get(pool, server, client_private_key,
+                              client_private_key_len, client_cert_path,
+                              ca_cert_path, &tls_bio) == 1);
+  CU_ASSERT(tls_bio == NULL);
+
+  // Returning a connection the pool doesn't hold is ignored
+  BIO *bio = BIO_new(BIO_s_mem());
+
+  tls_conn_pool_put(pool, bio, 1);
+  tls_conn_pool_put(pool, NULL, 1);
+  tls_conn_pool_put(NULL, bio, 1);
+  BIO_free_all(bio);
+
+  tls_conn_pool_free(pool);
+  tls_conn_pool_free(NULL);
+}
+
 //----------------------------------------------------------------------------
 // test_get_resp_from_tls_server()
 //----------------------------------------------------------------------------
@@ -146,6 +406,34 @@ void test_get_resp_from_tls_server(void)
   CU_ASSERT(get_resp_from_tls_server((BIO *) NULL,
                                      message, message_length, &key, &key_size));
 
+  // A KMIP (TTLV) response is read in full, however many reads it takes
+  unsigned char kmip_resp[] = { 0x42, 0x00, 0x7b, 0x01, 0x00, 0x00, 0x00, 0x08,
+    0x42, 0x00, 0x69, 0x01, 0x00, 0x00, 0x00, 0x00
+  };
+
+  BIO_set_mem_eof_return(bio, 0);
+  BIO_write(bio, kmip_resp, sizeof(kmip_resp));
+  CU_ASSERT(get_resp_from_tls_server(bio, NULL, 0, &key, &key_size) == 0);
+  CU_ASSERT(key_size == sizeof(kmip_resp));
+  CU_ASSERT(key != NULL && memcmp(key, kmip_resp, key_size) == 0);
+  free(key);
+  key = NULL;
+
+  // A truncated KMIP response should produce an error
+  BIO_write(bio, kmip_resp, sizeof(kmip_resp) - 1);
+  CU_ASSERT(get_resp_from_tls_server(bio, NULL, 0, &key, &key_size) == 1);
+
+  // Any other response is taken as it is
+  BIO_write(bio, "raw key bytes", 13);
+  CU_ASSERT(get_resp_from_tls_server(bio, NULL, 0, &key, &key_size) == 0);
+  CU_ASSERT(key_size == 13);
+  CU_ASSERT(key != NULL && memcmp(key, "raw key bytes", key_size) == 0);
+  free(key);
+  key = NULL;
+
+  // No response at all should produce an error
+  CU_ASSERT(get_resp_from_tls_server(bio, NULL, 0, &key, &key_size) == 1);
+
   // Cleanup
   BIO_free_all(bio);
 }
@@ -179,3 +467,88 @@ void test_get_key_from_kmip_server(void)
   // Cleanup
   BIO_free_all(bio);
 }
+
+//----------------------------------------------------------------------------
+// count_key_fetch_failures()
+//----------------------------------------------------------------------------
+static void count_key_fetch_failures(tls_key_fetch * fetch, int status,
+                                     unsigned char *key, size_t key_len,
+                                     void *arg)
+{
+  (void) fetch;
+  (void) key;
+  (void) key_len;
+  if (status)
+  {
+    (*(int *) arg)++;
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_tls_key_fetch()
+//----------------------------------------------------------------------------
+void test_tls_key_fetch(void)
+{
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  unsigned char *key_id = (unsigned char *) "1";
+  unsigned char *key = NULL;
+  size_t key_len = 0;
+  int failures = 0;
+
+  CU_ASSERT_FATAL(ctx != NULL);
+
+  // Invalid arguments should produce an error
+  CU_ASSERT(tls_key_fetch_start(NULL, "127.0.0.1:5696", key_id, 1, 0,
+                                NULL, NULL) == NULL);
+  CU_ASSERT(tls_key_fetch_start(ctx, NULL, key_id, 1, 0, NULL, NULL) == NULL);
+  CU_ASSERT(tls_key_fetch_start(ctx, "127.0.0.1:5696", NULL, 1, 0,
+                                NULL, NULL) == NULL);
+  CU_ASSERT(tls_key_fetch_start(ctx, "127.0.0.1:5696", key_id, 0, 0,
+                                NULL, NULL) == NULL);
+  CU_ASSERT(tls_key_fetch_start(ctx, "127.0.0.1", key_id, 1, 0,
+                                NULL, NULL) == NULL);
+  CU_ASSERT(tls_key_fetch_step(NULL) == 1);
+  CU_ASSERT(tls_key_fetch_poll_fd(NULL, NULL) == -1);
+  CU_ASSERT(tls_key_fetch_run(NULL, 1) == 1);
+
+  // A server that never answers times the fetches out, each one failing
+  // (and running its callback) once
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET };
+  socklen_t addr_len = sizeof(addr);
+  char server[32];
+
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CU_ASSERT_FATAL(listen_fd >= 0);
+  CU_ASSERT_FATAL(bind(listen_fd, (struct sockaddr *) &addr, addr_len) == 0);
+  CU_ASSERT_FATAL(listen(listen_fd, 8) == 0);
+  CU_ASSERT_FATAL(getsockname(listen_fd, (struct sockaddr *) &addr,
+                              &addr_len) == 0);
+  snprintf(server, sizeof(server), "127.0.0.1:%d", ntohs(addr.sin_port));
+
+  tls_key_fetch *fetches[4];
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    fetches[i] = tls_key_fetch_start(ctx, server, key_id, 1, 200,
+                                     count_key_fetch_failures, &failures);
+    CU_ASSERT(fetches[i] != NULL);
+  }
+  CU_ASSERT(tls_key_fetch_poll_fd(fetches[0], NULL) >= 0);
+  CU_ASSERT(tls_key_fetch_timeout_ms(fetches[0]) > 0);
+  CU_ASSERT(tls_key_fetch_run(fetches, 4) == 1);
+  CU_ASSERT(failures == 4);
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    CU_ASSERT(tls_key_fetch_step(fetches[i]) == 1);
+    CU_ASSERT(tls_key_fetch_poll_fd(fetches[i], NULL) == -1);
+    CU_ASSERT(tls_key_fetch_timeout_ms(fetches[i]) == 0);
+    CU_ASSERT(tls_key_fetch_take_key(fetches[i], &key, &key_len) == 1);
+    tls_key_fetch_free(fetches[i]);
+  }
+  CU_ASSERT(failures == 4);
+
+  close(listen_fd);
+  SSL_CTX_free(ctx);
+}
@@ -0,0 +1,476 @@
+//############################################################################
+// performance_test.c
+//
+// Performance regression tests for the Kmyth hot paths (see
+// test/include/perf/performance_test.h for the baselines and tolerance)
+//############################################################################
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <CUnit/CUnit.h>
+
+#include "performance_test.h"
+#include "aes_gcm.h"
+#include "formatting_tools.h"
+#include "marshalling_tools.h"
+#include "memory_util.h"
+
+// a valid text .ski (defined in test/src/tpm/marshalling_tools_test.c)
+extern const char *CONST_SKI_BYTES;
+
+// a hot path is timed over PERF_SAMPLES samples, each repeating it for at
+// least PERF_SAMPLE_NS, and the best throughput of any sample is kept
+#define PERF_SAMPLES 3
+#define PERF_SAMPLE_NS 50000000ULL
+
+#define PERF_DEFAULT_TOLERANCE 0.25
+
+#define PERF_LARGE_SKI_SIZE (100UL * 1024 * 1024)
+#define PERF_BASE64_SIZE (16UL * 1024 * 1024)
+
+/**
+ * @brief Built-in baselines (MB/s): floors well below what an unoptimized
+ *        build reaches on a modest host, so that the default run only
+ *        catches gross regressions
+ */
+typedef struct
+{
+  const char *name;
+  double mb_per_sec;
+} perf_baseline;
+
+static const perf_baseline perf_default_baselines[] = {
+  {"parse_ski_bytes/100MiB", 20.0},
+  {"encodeBase64Data/16MiB", 20.0},
+  {"decodeBase64Data/16MiB", 20.0},
+  {"get_block_bytes/100MiB", 100.0},
+  {"aes_gcm_encrypt/4KiB", 10.0},
+  {"aes_gcm_decrypt/4KiB", 10.0},
+  {"aes_gcm_encrypt/1MiB", 50.0},
+  {"aes_gcm_decrypt/1MiB", 50.0},
+  {"aes_gcm_encrypt/64MiB", 50.0},
+  {"aes_gcm_decrypt/64MiB", 50.0},
+  {NULL, 0.0}
+};
+
+/**
+ * @brief One run of a hot path: returns 0 on success, 1 on error
+ */
+typedef int (*perf_op_fn) (void *arg);
+
+//----------------------------------------------------------------------------
+// performance_add_tests()
+//----------------------------------------------------------------------------
+int performance_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "parse_ski_bytes() Performance Tests",
+                          test_perf_parse_ski_bytes))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Base64 Coding Performance Tests",
+                          test_perf_base64))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "get_block_bytes() Performance Tests",
+                          test_perf_get_block_bytes))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "AES/GCM Performance Tests",
+                          test_perf_aes_gcm))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// perf_now_ns()
+//----------------------------------------------------------------------------
+static uint64_t perf_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+//----------------------------------------------------------------------------
+// perf_baseline_for()
+//
+// Returns the baseline of a hot path: from the KMYTH_PERF_BASELINES file
+// when it lists the path, else the built-in one (0.0 if there is none)
+//----------------------------------------------------------------------------
+static double perf_baseline_for(const char *name)
+{
+  const char *path = getenv("KMYTH_PERF_BASELINES");
+  FILE *file = (path != NULL) ? fopen(path, "r") : NULL;
+
+  if (file != NULL)
+  {
+    char line[256];
+    char entry[128];
+    double value = 0.0;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+      if (line[0] != '#' && sscanf(line, "%127s %lf", entry, &value) == 2 &&
+          strcmp(entry, name) == 0)
+      {
+        fclose(file);
+        return value;
+      }
+    }
+    fclose(file);
+  }
+
+  for (size_t i = 0; perf_default_baselines[i].name != NULL; i++)
+  {
+    if (strcmp(perf_default_baselines[i].name, name) == 0)
+    {
+      return perf_default_baselines[i].mb_per_sec;
+    }
+  }
+
+  return 0.0;
+}
+
+//----------------------------------------------------------------------------
+// perf_tolerance()
+//----------------------------------------------------------------------------
+static double perf_tolerance(void)
+{
+  const char *value = getenv("KMYTH_PERF_TOLERANCE");
+  char *end = NULL;
+  double tolerance = (value != NULL) ? strtod(value, &end) : -1.0;
+
+  if (value == NULL || end == value || *end != '\0' || tolerance < 0.0 ||
+      tolerance >= 1.0)
+  {
+    return PERF_DEFAULT_TOLERANCE;
+  }
+
+  return tolerance;
+}
+
+//----------------------------------------------------------------------------
+// perf_check()
+//
+// Measures the throughput of a hot path, records it if asked to
+// (KMYTH_PERF_RECORD), and checks it against the path's baseline
+//----------------------------------------------------------------------------
+static void perf_check(const char *name, perf_op_fn op, void *arg,
+                       size_t bytes)
+{
+  double best = 0.0;
+
+  for (int s = 0; s < PERF_SAMPLES; s++)
+  {
+    uint64_t start = perf_now_ns();
+    uint64_t elapsed = 0;
+    size_t runs = 0;
+
+    do
+    {
+      if (op(arg))
+      {
+        CU_FAIL("hot path failed");
+        return;
+      }
+      runs++;
+      elapsed = perf_now_ns() - start;
+    }
+    while (elapsed < PERF_SAMPLE_NS);
+
+    // bytes per nanosecond, times 1000, is MB (10^6 bytes) per second
+    double mb_per_sec = (double) bytes * (double) runs * 1000.0 /
+      (double) elapsed;
+
+    if (mb_per_sec > best)
+    {
+      best = mb_per_sec;
+    }
+  }
+
+  const char *record = getenv("KMYTH_PERF_RECORD");
+
+  if (record != NULL)
+  {
+    FILE *file = fopen(record, "a");
+
+    CU_ASSERT(file != NULL);
+    if (file != NULL)
+    {
+      fprintf(file, "%s %.1f\n", name, best);
+      fclose(file);
+    }
+  }
+
+  double baseline = perf_baseline_for(name);
+  double limit = baseline * (1.0 - perf_tolerance());
+
+  if (best < limit)
+  {
+    fprintf(stdout, "\n  %s: %.1f MB/s, below %.1f MB/s (baseline %.1f)\n",
+            name, best, limit, baseline);
+  }
+  CU_ASSERT(best >= limit);
+}
+
+//----------------------------------------------------------------------------
+// perf_fill()
+//----------------------------------------------------------------------------
+static void perf_fill(uint8_t * buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    buf[i] = (uint8_t) (i * 31 + (i >> 13));
+  }
+}
+
+//----------------------------------------------------------------------------
+// perf_large_ski()
+//
+// Creates a text .ski holding PERF_LARGE_SKI_SIZE bytes of encrypted data
+// (with the keys of CONST_SKI_BYTES)
+//----------------------------------------------------------------------------
+static int perf_large_ski(uint8_t ** ski_bytes, size_t *ski_bytes_len)
+{
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, strlen(CONST_SKI_BYTES),
+                      &ski, 0))
+  {
+    return 1;
+  }
+
+  uint8_t *enc_data = kmyth_malloc(PERF_LARGE_SKI_SIZE);
+
+  if (enc_data == NULL)
+  {
+    free_ski(&ski);
+    return 1;
+  }
+  perf_fill(enc_data, PERF_LARGE_SKI_SIZE);
+  kmyth_free(ski.enc_data);
+  ski.enc_data = enc_data;
+  ski.enc_data_size = PERF_LARGE_SKI_SIZE;
+
+  kmyth_ski_format format = get_ski_format();
+  int retval = set_ski_format(KMYTH_SKI_FORMAT_TEXT) ||
+    create_ski_bytes(ski, ski_bytes, ski_bytes_len);
+
+  set_ski_format(format);
+  free_ski(&ski);
+
+  return retval;
+}
+
+//----------------------------------------------------------------------------
+// test_perf_parse_ski_bytes()
+//----------------------------------------------------------------------------
+typedef struct
+{
+  uint8_t *bytes;
+  size_t len;
+} perf_ski_arg;
+
+static int perf_parse_ski(void *arg)
+{
+  perf_ski_arg *ski = arg;
+  Ski output = get_default_ski();
+  int retval = parse_ski_bytes(ski->bytes, ski->len, &output, 0);
+
+  retval = retval || (output.enc_data_size != PERF_LARGE_SKI_SIZE);
+  free_ski(&output);
+
+  return retval;
+}
+
+void test_perf_parse_ski_bytes(void)
+{
+  perf_ski_arg ski = { NULL, 0 };
+
+  CU_ASSERT_FATAL(perf_large_ski(&ski.bytes, &ski.len) == 0);
+  perf_check("parse_ski_bytes/100MiB", perf_parse_ski, &ski, ski.len);
+  free(ski.bytes);
+}
+
+//----------------------------------------------------------------------------
+// test_perf_base64()
+//----------------------------------------------------------------------------
+typedef struct
+{
+  uint8_t *in;
+  size_t in_len;
+  size_t out_len;
+} perf_coding_arg;
+
+static int perf_encode_base64(void *arg)
+{
+  perf_coding_arg *coding = arg;
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  int retval = encodeBase64Data(coding->in, coding->in_len, &out, &out_len);
+
+  retval = retval || (out_len != coding->out_len);
+  free(out);
+
+  return retval;
+}
+
+static int perf_decode_base64(void *arg)
+{
+  perf_coding_arg *coding = arg;
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  int retval = decodeBase64Data(coding->in, coding->in_len, &out, &out_len);
+
+  retval = retval || (out_len != coding->out_len);
+  free(out);
+
+  return retval;
+}
+
+void test_perf_base64(void)
+{
+  uint8_t *raw = malloc(PERF_BASE64_SIZE);
+  uint8_t *encoded = NULL;
+  size_t encoded_len = 0;
+
+  CU_ASSERT_FATAL(raw != NULL);
+  perf_fill(raw, PERF_BASE64_SIZE);
+  CU_ASSERT_FATAL(encodeBase64Data(raw, PERF_BASE64_SIZE, &encoded,
+                                   &encoded_len) == 0);
+
+  // throughput is measured on the raw (decoded) size both ways
+  perf_coding_arg encode = { raw, PERF_BASE64_SIZE, encoded_len };
+  perf_coding_arg decode = { encoded, encoded_len, PERF_BASE64_SIZE };
+
+  perf_check("encodeBase64Data/16MiB", perf_encode_base64, &encode,
+             PERF_BASE64_SIZE);
+  perf_check("decodeBase64Data/16MiB", perf_decode_base64, &decode,
+             PERF_BASE64_SIZE);
+
+  free(encoded);
+  free(raw);
+}
+
+//----------------------------------------------------------------------------
+// test_perf_get_block_bytes()
+//----------------------------------------------------------------------------
+static int perf_get_block(void *arg)
+{
+  perf_ski_arg *block = arg;
+  char *contents = (char *) block->bytes;
+  size_t remaining = block->len;
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  int retval = get_block_bytes(&contents, &remaining, &out, &out_len,
+                               KMYTH_DELIM_ENC_DATA,
+                               strlen(KMYTH_DELIM_ENC_DATA),
+                               KMYTH_DELIM_END_FILE,
+                               strlen(KMYTH_DELIM_END_FILE));
+
+  free(out);
+
+  return retval;
+}
+
+void test_perf_get_block_bytes(void)
+{
+  uint8_t *ski_bytes = NULL;
+  size_t ski_bytes_len = 0;
+
+  CU_ASSERT_FATAL(perf_large_ski(&ski_bytes, &ski_bytes_len) == 0);
+
+  // start at the encrypted data block, as parse_ski_bytes() reaches it
+  uint8_t *enc_block = (uint8_t *) strstr((char *) ski_bytes,
+                                          KMYTH_DELIM_ENC_DATA);
+
+  CU_ASSERT_FATAL(enc_block != NULL);
+
+  perf_ski_arg block = { enc_block,
+    ski_bytes_len - (size_t) (enc_block - ski_bytes)
+  };
+
+  perf_check("get_block_bytes/100MiB", perf_get_block, &block, block.len);
+  free(ski_bytes);
+}
+
+//----------------------------------------------------------------------------
+// test_perf_aes_gcm()
+//----------------------------------------------------------------------------
+typedef struct
+{
+  unsigned char *key;
+  unsigned char *in;
+  size_t in_len;
+  bool encrypt;
+} perf_gcm_arg;
+
+static int perf_aes_gcm(void *arg)
+{
+  perf_gcm_arg *gcm = arg;
+  unsigned char *out = NULL;
+  size_t out_len = 0;
+  int retval = gcm->encrypt ?
+    aes_gcm_encrypt(gcm->key, 32, gcm->in, gcm->in_len, &out, &out_len) :
+    aes_gcm_decrypt(gcm->key, 32, gcm->in, gcm->in_len, &out, &out_len);
+
+  free(out);
+
+  return retval;
+}
+
+void test_perf_aes_gcm(void)
+{
+  static const struct
+  {
+    size_t size;
+    const char *encrypt_name;
+    const char *decrypt_name;
+  } sizes[] = {
+    {4096, "aes_gcm_encrypt/4KiB", "aes_gcm_decrypt/4KiB"},
+    {1UL << 20, "aes_gcm_encrypt/1MiB", "aes_gcm_decrypt/1MiB"},
+    {64UL << 20, "aes_gcm_encrypt/64MiB", "aes_gcm_decrypt/64MiB"},
+  };
+  unsigned char key[32];
+  unsigned char *plaintext = malloc(64UL << 20);
+
+  CU_ASSERT_FATAL(plaintext != NULL);
+  perf_fill(key, sizeof(key));
+  perf_fill(plaintext, 64UL << 20);
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    unsigned char *ciphertext = NULL;
+    size_t ciphertext_len = 0;
+
+    CU_ASSERT_FATAL(aes_gcm_encrypt(key, sizeof(key), plaintext,
+                                    sizes[i].size, &ciphertext,
+                                    &ciphertext_len) == 0);
+
+    perf_gcm_arg encrypt = { key, plaintext, sizes[i].size, true };
+    perf_gcm_arg decrypt = { key, ciphertext, ciphertext_len, false };
+
+    perf_check(sizes[i].encrypt_name, perf_aes_gcm, &encrypt,
+               sizes[i].size);
+    perf_check(sizes[i].decrypt_name, perf_aes_gcm, &decrypt,
+               sizes[i].size);
+    free(ciphertext);
+  }
+
+  free(plaintext);
+}
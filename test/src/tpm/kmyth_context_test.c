@@ -0,0 +1,592 @@
+//############################################################################
+// kmyth_context_test.c
+//
+// Tests for the reusable Kmyth context functions in
+// tpm2/src/tpm/kmyth_context.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth.h"
+#include "kmyth_context.h"
+#include "tpm2_interface.h"
+
+#include "kmyth_context_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_context_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_context_add_tests(CU_pSuite suite)
+{
+  // If we're running on hardware we don't do these tests
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  bool emulator = true;
+
+  get_tpm2_impl_type(sapi_ctx, &emulator);
+  free_tpm2_resources(&sapi_ctx);
+  if (!emulator)
+  {
+    return 0;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_ctx_create()/destroy() Tests",
+                          test_kmyth_ctx_create_destroy))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_flush_handle() Tests",
+                          test_kmyth_flush_handle))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "tpm2_kmyth_seal_ctx()/unseal_ctx() Tests",
+                          test_tpm2_kmyth_seal_unseal_ctx))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_sk_cache_*() Tests",
+                          test_kmyth_sk_cache))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_policy_cache_*() Tests",
+                          test_kmyth_policy_cache))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_secret_cache_*() Tests",
+                          test_kmyth_secret_cache))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_ctx_get/drop_session() Tests",
+                          test_kmyth_ctx_session))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_derive_key() Tests",
+                          test_kmyth_derive_key))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_ctx_create_destroy()
+//----------------------------------------------------------------------------
+void test_kmyth_ctx_create_destroy(void)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  // NULL handle pointer should be rejected
+  CU_ASSERT(kmyth_ctx_create(NULL) == 1);
+
+  // Valid create should produce a context with an open SAPI connection
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(ctx != NULL);
+  CU_ASSERT(ctx->sapi_ctx != NULL);
+
+  // Destroy should release the context and NULL the handle
+  CU_ASSERT(kmyth_ctx_destroy(&ctx) == 0);
+  CU_ASSERT(ctx == NULL);
+
+  // Destroying a NULL context is a no-op
+  CU_ASSERT(kmyth_ctx_destroy(&ctx) == 0);
+  CU_ASSERT(kmyth_ctx_destroy(NULL) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_flush_handle()
+//----------------------------------------------------------------------------
+void test_kmyth_flush_handle(void)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // A zero handle means "nothing loaded" and is ignored
+  CU_ASSERT(kmyth_flush_handle(ctx->sapi_ctx, 0) == 0);
+
+  // A handle that is not loaded cannot be flushed
+  CU_ASSERT(kmyth_flush_handle(ctx->sapi_ctx, TPM2_TRANSIENT_FIRST) == 1);
+
+  kmyth_ctx_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_unseal_ctx()
+//----------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_unseal_ctx(void)
+{
+  uint8_t input[] = "Reusable context test data";
+  size_t input_len = sizeof(input);
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *unsealed = NULL;
+  size_t unsealed_len = 0;
+
+  // NULL context should be rejected
+  CU_ASSERT(tpm2_kmyth_seal_ctx(NULL, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(NULL, input, input_len,
+                                  &unsealed, &unsealed_len,
+                                  NULL, 0, NULL, 0, 0) == 1);
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Repeated seal/unseal round trips over the same open connection
+  for (int i = 0; i < 3; i++)
+  {
+    CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len,
+                                  &sealed, &sealed_len,
+                                  NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                  0) == 0);
+    CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len,
+                                    &unsealed, &unsealed_len,
+                                    NULL, 0, NULL, 0, 0) == 0);
+    CU_ASSERT(unsealed_len == input_len);
+    CU_ASSERT(memcmp(unsealed, input, input_len) == 0);
+    free(sealed);
+    sealed = NULL;
+    free(unsealed);
+    unsealed = NULL;
+  }
+
+  kmyth_ctx_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_sk_cache()
+//----------------------------------------------------------------------------
+void test_kmyth_sk_cache(void)
+{
+  kmyth_ctx_t *ctx = NULL;
+  TPM2B_NAME name = {.size = 4,.name = {0x00, 0x0B, 0x01, 0x02} };
+  TPM2B_NAME other = {.size = 4,.name = {0x00, 0x0B, 0x03, 0x04} };
+  TPM2B_NAME empty = {.size = 0, };
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Nothing is cached in a fresh context
+  CU_ASSERT(kmyth_sk_cache_lookup(ctx, &name) == 0);
+  CU_ASSERT(kmyth_sk_cache_lookup(ctx, &empty) == 0);
+  CU_ASSERT(kmyth_sk_cache_lookup(NULL, &name) == 0);
+
+  // Invalid entries should be rejected
+  CU_ASSERT(kmyth_sk_cache_insert(NULL, &name, TPM2_TRANSIENT_FIRST) == 1);
+  CU_ASSERT(kmyth_sk_cache_insert(ctx, &empty, TPM2_TRANSIENT_FIRST) == 1);
+  CU_ASSERT(kmyth_sk_cache_insert(ctx, &name, 0) == 1);
+
+  // Cached handles are found by name only
+  CU_ASSERT(kmyth_sk_cache_insert(ctx, &name, TPM2_TRANSIENT_FIRST) == 0);
+  CU_ASSERT(kmyth_sk_cache_lookup(ctx, &name) == TPM2_TRANSIENT_FIRST);
+  CU_ASSERT(kmyth_sk_cache_lookup(ctx, &other) == 0);
+
+  // Removing an entry empties it (flushing a bogus handle fails silently)
+  kmyth_sk_cache_remove(ctx, &name);
+  CU_ASSERT(kmyth_sk_cache_lookup(ctx, &name) == 0);
+  kmyth_sk_cache_remove(ctx, &other);
+
+  // Repeated unseals of the same .ski leave exactly one SK cached
+  uint8_t input[] = "SK cache test data";
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *unsealed = NULL;
+  size_t unsealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, sizeof(input),
+                                &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  for (int i = 0; i < 3; i++)
+  {
+    CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len,
+                                    &unsealed, &unsealed_len,
+                                    NULL, 0, NULL, 0, 0) == 0);
+    CU_ASSERT(unsealed_len == sizeof(input));
+    CU_ASSERT(memcmp(unsealed, input, sizeof(input)) == 0);
+    free(unsealed);
+    unsealed = NULL;
+  }
+
+  TPM2_HANDLE cached = 0;
+  size_t cached_count = 0;
+
+  for (size_t i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    if (ctx->sk_cache[i].handle != 0)
+    {
+      cached = ctx->sk_cache[i].handle;
+      cached_count++;
+    }
+  }
+  CU_ASSERT(cached_count == 1);
+
+  // A stale cached handle is recovered from by reloading the SK
+  CU_ASSERT(kmyth_flush_handle(ctx->sapi_ctx, cached) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len,
+                                  &unsealed, &unsealed_len,
+                                  NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(unsealed_len == sizeof(input));
+  free(unsealed);
+  free(sealed);
+
+  // Unsealing .ski files with more distinct SKs than may stay loaded swaps
+  // the least recently used ones out, and back in when they are used again
+  uint8_t *skis[KMYTH_SK_CACHE_LOADED_MAX + 1] = { NULL };
+  size_t ski_lens[KMYTH_SK_CACHE_LOADED_MAX + 1] = { 0 };
+  size_t loaded_count = 0;
+  size_t swapped_count = 0;
+
+  for (size_t i = 0; i <= KMYTH_SK_CACHE_LOADED_MAX; i++)
+  {
+    CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, sizeof(input),
+                                  &skis[i], &ski_lens[i],
+                                  NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                  0) == 0);
+    CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, skis[i], ski_lens[i],
+                                    &unsealed, &unsealed_len,
+                                    NULL, 0, NULL, 0, 0) == 0);
+    free(unsealed);
+    unsealed = NULL;
+  }
+  for (size_t i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    loaded_count += (ctx->sk_cache[i].handle != 0) ? 1 : 0;
+    swapped_count += ctx->sk_cache[i].swapped_out ? 1 : 0;
+  }
+  CU_ASSERT(loaded_count <= KMYTH_SK_CACHE_LOADED_MAX);
+  CU_ASSERT(swapped_count >= 1);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, skis[0], ski_lens[0],
+                                  &unsealed, &unsealed_len,
+                                  NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(unsealed_len == sizeof(input));
+  CU_ASSERT(memcmp(unsealed, input, sizeof(input)) == 0);
+  free(unsealed);
+  for (size_t i = 0; i <= KMYTH_SK_CACHE_LOADED_MAX; i++)
+  {
+    free(skis[i]);
+  }
+
+  // Clearing flushes and empties every entry
+  CU_ASSERT(kmyth_sk_cache_clear(ctx) == 0);
+  for (size_t i = 0; i < KMYTH_SK_CACHE_SIZE; i++)
+  {
+    CU_ASSERT(ctx->sk_cache[i].handle == 0);
+    CU_ASSERT(!ctx->sk_cache[i].swapped_out);
+  }
+
+  kmyth_ctx_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_policy_cache()
+//----------------------------------------------------------------------------
+void test_kmyth_policy_cache(void)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_set_software_policy(NULL, 1) == 1);
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Nothing is cached in a fresh context
+  kmyth_policy_cache_entry key;
+  kmyth_policy_cache_entry result;
+
+  memset(&key, 0, sizeof(key));
+  key.pcrDigest.size = 2;
+  CU_ASSERT(!kmyth_policy_cache_lookup(ctx, &key, &result));
+  CU_ASSERT(!kmyth_policy_cache_lookup(NULL, &key, &result));
+
+  // Entries only match on all of selection, PCR digest, and branch
+  key.basePolicy.size = 1;
+  key.authPolicy.size = 1;
+  kmyth_policy_cache_insert(ctx, &key);
+  CU_ASSERT(kmyth_policy_cache_lookup(ctx, &key, &result));
+  CU_ASSERT(result.authPolicy.size == 1);
+  key.pcrDigest.buffer[0] = 0xFF;
+  CU_ASSERT(!kmyth_policy_cache_lookup(ctx, &key, &result));
+  key.pcrDigest.buffer[0] = 0x00;
+  key.expectedBranches.count = 1;
+  key.expectedBranches.digests[0].size = 2;
+  CU_ASSERT(!kmyth_policy_cache_lookup(ctx, &key, &result));
+  memset(ctx->policy_cache, 0, sizeof(ctx->policy_cache));
+  ctx->policy_cache_next = 0;
+
+  // Repeated seals to the same PCR state compute the policy only once, and
+  // the trial session and software computations agree
+  uint8_t input[] = "Policy cache test data";
+  int pcrs[1] = { 0 };
+
+  for (uint8_t software = 0; software < 2; software++)
+  {
+    CU_ASSERT(kmyth_ctx_set_software_policy(ctx, software) == 0);
+    for (int i = 0; i < 2; i++)
+    {
+      uint8_t *sealed = NULL;
+      size_t sealed_len = 0;
+      uint8_t *unsealed = NULL;
+      size_t unsealed_len = 0;
+
+      CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, sizeof(input),
+                                    &sealed, &sealed_len,
+                                    NULL, 0, NULL, 0, pcrs, 1, NULL, NULL,
+                                    0) == 0);
+      CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len,
+                                      &unsealed, &unsealed_len,
+                                      NULL, 0, NULL, 0, 0) == 0);
+      CU_ASSERT(unsealed_len == sizeof(input));
+      CU_ASSERT(memcmp(unsealed, input, sizeof(input)) == 0);
+      free(sealed);
+      free(unsealed);
+    }
+
+    CU_ASSERT(ctx->policy_cache_next == 1);
+    CU_ASSERT(ctx->policy_cache[0].valid);
+    CU_ASSERT(!ctx->policy_cache[1].valid);
+    if (software == 0)
+    {
+      // drop the trial session result so software mode must recompute it
+      result = ctx->policy_cache[0];
+      memset(ctx->policy_cache, 0, sizeof(ctx->policy_cache));
+      ctx->policy_cache_next = 0;
+    }
+  }
+  CU_ASSERT(result.authPolicy.size == ctx->policy_cache[0].authPolicy.size);
+  CU_ASSERT(memcmp(result.authPolicy.buffer,
+                   ctx->policy_cache[0].authPolicy.buffer,
+                   result.authPolicy.size) == 0);
+
+  kmyth_ctx_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_secret_cache()
+//----------------------------------------------------------------------------
+void test_kmyth_secret_cache(void)
+{
+  kmyth_ctx_t *ctx = NULL;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  CU_ASSERT(kmyth_ctx_set_secret_cache(NULL, 1, 64, 0) == 1);
+  CU_ASSERT(kmyth_ctx_get_secret_cache_stats(NULL, &hits, &misses) == 1);
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Disabled by default - nothing is stored or found
+  TPM2B_DIGEST key_a = {.size = 2,.buffer = {0x0A, 0x0A} };
+  TPM2B_DIGEST key_b = {.size = 2,.buffer = {0x0B, 0x0B} };
+  TPML_PCR_SELECTION no_pcrs = {.count = 0, };
+  uint8_t secret[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+
+  kmyth_secret_cache_insert(ctx, &key_a, no_pcrs, secret, sizeof(secret));
+  CU_ASSERT(!kmyth_secret_cache_lookup(ctx, &key_a, &out, &out_len));
+
+  // A one-entry cache keeps only the most recent secret
+  CU_ASSERT(kmyth_ctx_set_secret_cache(ctx, 1, 64, 0) == 0);
+  kmyth_secret_cache_insert(ctx, &key_a, no_pcrs, secret, sizeof(secret));
+  CU_ASSERT(kmyth_secret_cache_lookup(ctx, &key_a, &out, &out_len));
+  CU_ASSERT(out_len == sizeof(secret));
+  CU_ASSERT(out != NULL && memcmp(out, secret, sizeof(secret)) == 0);
+  free(out);
+  out = NULL;
+  kmyth_secret_cache_insert(ctx, &key_b, no_pcrs, secret, sizeof(secret));
+  CU_ASSERT(!kmyth_secret_cache_lookup(ctx, &key_a, &out, &out_len));
+  CU_ASSERT(kmyth_secret_cache_lookup(ctx, &key_b, &out, &out_len));
+  free(out);
+  out = NULL;
+  CU_ASSERT(kmyth_ctx_get_secret_cache_stats(ctx, &hits, &misses) == 0);
+  CU_ASSERT(hits == 2 && misses == 1);
+
+  // Secrets larger than the size limit are not cached
+  CU_ASSERT(kmyth_ctx_set_secret_cache(ctx, 4, sizeof(secret) - 1, 0) == 0);
+  kmyth_secret_cache_insert(ctx, &key_a, no_pcrs, secret, sizeof(secret));
+  CU_ASSERT(!kmyth_secret_cache_lookup(ctx, &key_a, &out, &out_len));
+
+  // Repeated unseals of the same .ski are served from the cache, but only
+  // with the right authorization
+  uint8_t input[] = "Secret cache test data";
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(kmyth_ctx_set_secret_cache(ctx, 4, 1024, 60) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, sizeof(input),
+                                &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &out, &out_len,
+                                    NULL, 0, NULL, 0, 0) == 0);
+    CU_ASSERT(out_len == sizeof(input));
+    CU_ASSERT(out != NULL && memcmp(out, input, sizeof(input)) == 0);
+    free(out);
+    out = NULL;
+  }
+  CU_ASSERT(kmyth_ctx_get_secret_cache_stats(ctx, &hits, &misses) == 0);
+  CU_ASSERT(hits == 1 && misses == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &out, &out_len,
+                                  (uint8_t *) "wrong", 5, NULL, 0, 0) == 1);
+  free(out);
+  free(sealed);
+
+  kmyth_ctx_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_ctx_session()
+//----------------------------------------------------------------------------
+void test_kmyth_ctx_session(void)
+{
+  uint8_t input[] = "Continued session test data";
+  size_t input_len = sizeof(input);
+  uint8_t auth[] = "right";
+  uint8_t wrong[] = "wrong";
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_get_session(NULL) == NULL);
+  kmyth_ctx_drop_session(NULL);
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(!ctx->have_session);
+
+  // The session is started on first use and then kept
+  SESSION *session = kmyth_ctx_get_session(ctx);
+
+  CU_ASSERT(session != NULL);
+  CU_ASSERT(ctx->have_session);
+  TPM2_HANDLE handle = session->sessionHandle;
+
+  CU_ASSERT(kmyth_ctx_get_session(ctx) == session);
+
+  // Seal and unseal calls continue the same session
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                auth, sizeof(auth), NULL, 0, NULL, 0, NULL,
+                                NULL, 0) == 0);
+  CU_ASSERT(ctx->have_session);
+  CU_ASSERT(ctx->session.sessionHandle == handle);
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &out, &out_len,
+                                    auth, sizeof(auth), NULL, 0, 0) == 0);
+    CU_ASSERT(out_len == input_len);
+    CU_ASSERT(memcmp(out, input, input_len) == 0);
+    free(out);
+    out = NULL;
+    CU_ASSERT(ctx->have_session);
+    CU_ASSERT(ctx->session.sessionHandle == handle);
+  }
+
+  // A failed authorization drops the session, and the next call recovers
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &out, &out_len,
+                                  wrong, sizeof(wrong), NULL, 0, 0) == 1);
+  CU_ASSERT(!ctx->have_session);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &out, &out_len,
+                                  auth, sizeof(auth), NULL, 0, 0) == 0);
+  CU_ASSERT(ctx->have_session);
+  free(out);
+  out = NULL;
+
+  // Dropping the session flushes it from the TPM
+  handle = ctx->session.sessionHandle;
+  kmyth_ctx_drop_session(ctx);
+  CU_ASSERT(!ctx->have_session);
+  CU_ASSERT(kmyth_flush_handle(ctx->sapi_ctx, handle) == 1);
+
+  free(sealed);
+  kmyth_ctx_destroy(&ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_derive_key()
+//----------------------------------------------------------------------------
+void test_kmyth_derive_key(void)
+{
+  uint8_t master[] = "Sealed master secret for derived keys";
+  uint8_t other_master[] = "Another master secret";
+  uint8_t auth[] = "derive";
+  kmyth_ctx_t *ctx = NULL;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *other_sealed = NULL;
+  size_t other_sealed_len = 0;
+  uint8_t key_a[32] = { 0 };
+  uint8_t key_a2[32] = { 0 };
+  uint8_t key_b[32] = { 0 };
+  uint8_t key_long[64] = { 0 };
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, master, sizeof(master),
+                                &sealed, &sealed_len, auth, sizeof(auth),
+                                NULL, 0, NULL, 0, NULL, NULL, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, other_master, sizeof(other_master),
+                                &other_sealed, &other_sealed_len,
+                                auth, sizeof(auth), NULL, 0, NULL, 0, NULL,
+                                NULL, 0) == 0);
+
+  // Invalid parameters should be rejected
+  CU_ASSERT(kmyth_derive_key(NULL, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, "a", key_a, sizeof(key_a)) == 1);
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, NULL, key_a, sizeof(key_a)) == 1);
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, "a", key_a, 0) == 1);
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, "a", key_a,
+                             KMYTH_DERIVE_MAX_KEY_LEN + 1) == 1);
+
+  // The wrong authorization fails and holds no master
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, NULL, 0, NULL, 0, 0,
+                             "a", key_a, sizeof(key_a)) == 1);
+  CU_ASSERT(ctx->derive_master == NULL);
+
+  // The first call unseals the master, later calls reuse it
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, "a", key_a, sizeof(key_a)) == 0);
+  CU_ASSERT(ctx->derive_master != NULL);
+  CU_ASSERT(ctx->derive_master_len == sizeof(master));
+
+  uint8_t *held = ctx->derive_master;
+
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, "a", key_a2, sizeof(key_a2)) == 0);
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, "b", key_b, sizeof(key_b)) == 0);
+  CU_ASSERT(kmyth_derive_key(ctx, sealed, sealed_len, auth, sizeof(auth),
+                             NULL, 0, 0, "a", key_long,
+                             sizeof(key_long)) == 0);
+  CU_ASSERT(ctx->derive_master == held);
+
+  // The same label gives the same key, another label an independent one,
+  // and a longer key starts with the shorter one (HKDF-Expand)
+  CU_ASSERT(memcmp(key_a, key_a2, sizeof(key_a)) == 0);
+  CU_ASSERT(memcmp(key_a, key_b, sizeof(key_a)) != 0);
+  CU_ASSERT(memcmp(key_a, key_long, sizeof(key_a)) == 0);
+
+  // Another master replaces the one held
+  CU_ASSERT(kmyth_derive_key(ctx, other_sealed, other_sealed_len,
+                             auth, sizeof(auth), NULL, 0, 0, "a",
+                             key_a2, sizeof(key_a2)) == 0);
+  CU_ASSERT(ctx->derive_master_len == sizeof(other_master));
+  CU_ASSERT(memcmp(key_a, key_a2, sizeof(key_a)) != 0);
+
+  free(sealed);
+  free(other_sealed);
+  kmyth_ctx_destroy(&ctx);
+}
@@ -0,0 +1,245 @@
+//############################################################################
+// kmyth_dispatch_test.c
+//
+// Tests for the multi-TPM job dispatcher in tpm2/src/tpm/kmyth_dispatch.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth.h"
+#include "kmyth_context.h"
+#include "kmyth_dispatch.h"
+#include "tpm2_interface.h"
+
+#include "kmyth_dispatch_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_dispatch_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_dispatch_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_dispatch_init_queues() Tests",
+                          test_kmyth_dispatch_init_queues))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_dispatch_next_job() Tests",
+                          test_kmyth_dispatch_next_job))
+  {
+    return 1;
+  }
+
+  // If we're running on hardware we don't do the TPM tests
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  bool emulator = true;
+
+  get_tpm2_impl_type(sapi_ctx, &emulator);
+  free_tpm2_resources(&sapi_ctx);
+  if (!emulator)
+  {
+    return 0;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_ctx_create_tcti() Tests",
+                          test_kmyth_ctx_create_tcti))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "tpm2_kmyth_seal/unseal_sharded() Tests",
+                          test_tpm2_kmyth_seal_unseal_sharded))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_dispatch_init_queues()
+//----------------------------------------------------------------------------
+void test_kmyth_dispatch_init_queues(void)
+{
+  kmyth_dispatch d = {.endpoint_count = 0,.count = 4 };
+
+  // Need at least one endpoint, and no more than the maximum
+  CU_ASSERT(kmyth_dispatch_init_queues(&d, NULL) == 1);
+  d.endpoint_count = KMYTH_DISPATCH_MAX_ENDPOINTS + 1;
+  CU_ASSERT(kmyth_dispatch_init_queues(&d, NULL) == 1);
+  CU_ASSERT(kmyth_dispatch_init_queues(NULL, NULL) == 1);
+
+  // Jobs without an affinity are dealt out round robin
+  d.endpoint_count = 2;
+  CU_ASSERT(kmyth_dispatch_init_queues(&d, NULL) == 0);
+  CU_ASSERT(d.queues[0].shared_tail == 2);
+  CU_ASSERT(d.queues[1].shared_tail == 2);
+  CU_ASSERT(d.queues[0].shared[0] == 0);
+  CU_ASSERT(d.queues[1].shared[0] == 1);
+  CU_ASSERT(d.queues[0].pinned_count == 0);
+  kmyth_dispatch_free_queues(&d);
+  CU_ASSERT(d.queues == NULL);
+
+  // Jobs with an affinity are pinned to that endpoint
+  size_t affinity[] = { 1, KMYTH_ANY_ENDPOINT, 1, KMYTH_ANY_ENDPOINT };
+
+  CU_ASSERT(kmyth_dispatch_init_queues(&d, affinity) == 0);
+  CU_ASSERT(d.queues[1].pinned_count == 2);
+  CU_ASSERT(d.queues[1].pinned[0] == 0);
+  CU_ASSERT(d.queues[1].pinned[1] == 2);
+  CU_ASSERT(d.queues[0].shared_tail == 1);
+  CU_ASSERT(d.queues[1].shared_tail == 1);
+  kmyth_dispatch_free_queues(&d);
+
+  // An affinity for an unknown endpoint is an error
+  affinity[2] = 2;
+  CU_ASSERT(kmyth_dispatch_init_queues(&d, affinity) == 1);
+  CU_ASSERT(d.queues == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_dispatch_next_job()
+//----------------------------------------------------------------------------
+void test_kmyth_dispatch_next_job(void)
+{
+  size_t affinity[] = { 0, KMYTH_ANY_ENDPOINT, KMYTH_ANY_ENDPOINT,
+    KMYTH_ANY_ENDPOINT, 1, KMYTH_ANY_ENDPOINT
+  };
+  kmyth_dispatch d = {.endpoint_count = 2,.count = 6 };
+  size_t job = 0;
+
+  // Queues: endpoint 0 pinned {0}, shared {1, 3, 5}
+  //         endpoint 1 pinned {4}, shared {2}
+  CU_ASSERT(kmyth_dispatch_init_queues(&d, affinity) == 0);
+
+  // Pinned jobs come first, then the worker's own shared jobs in order
+  CU_ASSERT(kmyth_dispatch_next_job(&d, 1, true, &job));
+  CU_ASSERT(job == 4);
+  CU_ASSERT(kmyth_dispatch_next_job(&d, 1, true, &job));
+  CU_ASSERT(job == 2);
+
+  // Without stealing, an idle worker gets nothing
+  CU_ASSERT(!kmyth_dispatch_next_job(&d, 1, false, &job));
+
+  // With stealing, it takes from the tail of the other queue
+  CU_ASSERT(kmyth_dispatch_next_job(&d, 1, true, &job));
+  CU_ASSERT(job == 5);
+
+  // The owner still takes its remaining jobs from the head
+  CU_ASSERT(kmyth_dispatch_next_job(&d, 0, true, &job));
+  CU_ASSERT(job == 0);
+  CU_ASSERT(kmyth_dispatch_next_job(&d, 0, true, &job));
+  CU_ASSERT(job == 1);
+  CU_ASSERT(kmyth_dispatch_next_job(&d, 0, true, &job));
+  CU_ASSERT(job == 3);
+
+  // Every job was handed out exactly once
+  CU_ASSERT(!kmyth_dispatch_next_job(&d, 0, true, &job));
+  CU_ASSERT(!kmyth_dispatch_next_job(&d, 1, true, &job));
+  kmyth_dispatch_free_queues(&d);
+
+  // Pinned jobs are never stolen
+  size_t pinned[] = { 0, 0 };
+
+  d.count = 2;
+  CU_ASSERT(kmyth_dispatch_init_queues(&d, pinned) == 0);
+  CU_ASSERT(!kmyth_dispatch_next_job(&d, 1, true, &job));
+  CU_ASSERT(kmyth_dispatch_next_job(&d, 0, true, &job));
+  CU_ASSERT(job == 0);
+  kmyth_dispatch_free_queues(&d);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_ctx_create_tcti()
+//----------------------------------------------------------------------------
+void test_kmyth_ctx_create_tcti(void)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  // NULL handle pointer should be rejected
+  CU_ASSERT(kmyth_ctx_create_tcti(NULL, NULL) == 1);
+
+  // A NULL specification selects the process default TCTI
+  CU_ASSERT(kmyth_ctx_create_tcti(&ctx, NULL) == 0);
+  CU_ASSERT(ctx != NULL);
+  CU_ASSERT(ctx->sapi_ctx != NULL);
+  kmyth_ctx_destroy(&ctx);
+
+  // An unknown TCTI cannot be loaded
+  CU_ASSERT(kmyth_ctx_create_tcti(&ctx, "no-such-tcti") == 1);
+  CU_ASSERT(ctx == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_unseal_sharded()
+//----------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_unseal_sharded(void)
+{
+  uint8_t data[4][16] = { "shard test 0", "shard test 1", "shard test 2",
+    "shard test 3"
+  };
+  uint8_t *inputs[4];
+  size_t input_lens[4];
+  uint8_t *sealed[4] = { NULL };
+  size_t sealed_lens[4] = { 0 };
+  uint8_t *unsealed[4] = { NULL };
+  size_t unsealed_lens[4] = { 0 };
+  int results[4] = { 0 };
+  size_t endpoints[4] = { 0 };
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    inputs[i] = data[i];
+    input_lens[i] = sizeof(data[i]);
+  }
+
+  // Two workers on the default TPM: jobs are shared between them
+  const char *specs[] = { NULL, NULL };
+
+  CU_ASSERT(tpm2_kmyth_seal_sharded(2, specs, 4, inputs, input_lens,
+                                    sealed, sealed_lens, results, endpoints,
+                                    NULL, 0, NULL, 0, NULL, 0, NULL,
+                                    NULL) == 0);
+  for (size_t i = 0; i < 4; i++)
+  {
+    CU_ASSERT(results[i] == 0);
+    CU_ASSERT(endpoints[i] < 2);
+  }
+
+  // Unseal with the affinities returned by the seal
+  CU_ASSERT(tpm2_kmyth_unseal_sharded(2, specs, 4, sealed, sealed_lens,
+                                      unsealed, unsealed_lens, results,
+                                      endpoints, NULL, 0, NULL, 0, 0) == 0);
+  for (size_t i = 0; i < 4; i++)
+  {
+    CU_ASSERT(results[i] == 0);
+    CU_ASSERT(unsealed_lens[i] == input_lens[i]);
+    CU_ASSERT(memcmp(unsealed[i], inputs[i], input_lens[i]) == 0);
+    free(unsealed[i]);
+    unsealed[i] = NULL;
+  }
+
+  // A dead endpoint's shared jobs are stolen, but its pinned jobs fail
+  const char *bad_specs[] = { NULL, "no-such-tcti" };
+  size_t affinity[] = { KMYTH_ANY_ENDPOINT, 1, KMYTH_ANY_ENDPOINT,
+    KMYTH_ANY_ENDPOINT
+  };
+
+  CU_ASSERT(tpm2_kmyth_unseal_sharded(2, bad_specs, 4, sealed, sealed_lens,
+                                      unsealed, unsealed_lens, results,
+                                      affinity, NULL, 0, NULL, 0, 0) == 1);
+  CU_ASSERT(results[0] == 0);
+  CU_ASSERT(results[1] == 1);
+  CU_ASSERT(unsealed[1] == NULL);
+  CU_ASSERT(results[2] == 0);
+  CU_ASSERT(results[3] == 0);
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    free(sealed[i]);
+    free(unsealed[i]);
+  }
+}
@@ -0,0 +1,254 @@
+//############################################################################
+// kmyth_envelope_test.c
+//
+// Tests for the envelope mode functions in
+// tpm2/src/tpm/kmyth_envelope.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "formatting_tools.h"
+#include "kmyth.h"
+#include "kmyth_envelope.h"
+#include "tpm2_interface.h"
+
+#include "kmyth_envelope_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_envelope_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_envelope_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_envelope_seal()/unseal() Tests",
+                          test_kmyth_envelope_seal_unseal))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_envelope_unseal() wrong KEK Tests",
+                          test_kmyth_envelope_wrong_kek))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_envelope_unseal() tamper Tests",
+                          test_kmyth_envelope_tampered))
+  {
+    return 1;
+  }
+
+  // If we're running on hardware we don't do the TPM test
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  bool emulator = true;
+
+  get_tpm2_impl_type(sapi_ctx, &emulator);
+  free_tpm2_resources(&sapi_ctx);
+  if (!emulator)
+  {
+    return 0;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_envelope_create_kek()/open() Tests",
+                          test_kmyth_envelope_tpm_kek))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_envelope_seal_unseal()
+//----------------------------------------------------------------------------
+void test_kmyth_envelope_seal_unseal(void)
+{
+  uint8_t kek[KMYTH_ENVELOPE_KEK_LEN] = { 0x11, 0x22, 0x33 };
+  uint8_t input[] = "Envelope test data";
+  size_t input_len = sizeof(input);
+  kmyth_envelope_t *env = NULL;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *unsealed = NULL;
+  size_t unsealed_len = 0;
+
+  // invalid KEKs and parameters should be rejected
+  CU_ASSERT(kmyth_envelope_open_kek(NULL, sizeof(kek), &env) == 1);
+  CU_ASSERT(kmyth_envelope_open_kek(kek, 20, &env) == 1);
+  CU_ASSERT(env == NULL);
+  CU_ASSERT(kmyth_envelope_seal(NULL, input, input_len, NULL,
+                                &sealed, &sealed_len) == 1);
+  CU_ASSERT(kmyth_envelope_unseal(NULL, input, input_len,
+                                  &unsealed, &unsealed_len) == 1);
+
+  CU_ASSERT(kmyth_envelope_open_kek(kek, sizeof(kek), &env) == 0);
+  CU_ASSERT(kmyth_envelope_seal(env, NULL, 0, NULL,
+                                &sealed, &sealed_len) == 1);
+  CU_ASSERT(kmyth_envelope_seal(env, input, input_len, "NoSuchCipher",
+                                &sealed, &sealed_len) == 1);
+
+  // many files under one KEK, each with its own DEK
+  char *ciphers[] = { NULL, "AES/GCM/NoPadding/128",
+    "ChaCha20/Poly1305/NoPadding/256"
+  };
+  uint8_t *first = NULL;
+  size_t first_len = 0;
+
+  for (size_t i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); i++)
+  {
+    CU_ASSERT(kmyth_envelope_seal(env, input, input_len, ciphers[i],
+                                  &sealed, &sealed_len) == 0);
+    CU_ASSERT(kmyth_envelope_unseal(env, sealed, sealed_len,
+                                    &unsealed, &unsealed_len) == 0);
+    CU_ASSERT(unsealed_len == input_len);
+    CU_ASSERT(unsealed != NULL && memcmp(unsealed, input, input_len) == 0);
+    free(unsealed);
+    unsealed = NULL;
+    if (first == NULL)
+    {
+      first = sealed;
+      first_len = sealed_len;
+    }
+    else
+    {
+      free(sealed);
+    }
+    sealed = NULL;
+  }
+
+  // the same input sealed again gets a new DEK
+  CU_ASSERT(kmyth_envelope_seal(env, input, input_len, NULL,
+                                &sealed, &sealed_len) == 0);
+  CU_ASSERT(sealed_len != first_len
+            || memcmp(sealed, first, first_len) != 0);
+  free(sealed);
+  free(first);
+
+  kmyth_envelope_close(&env);
+  CU_ASSERT(env == NULL);
+  kmyth_envelope_close(&env);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_envelope_wrong_kek()
+//----------------------------------------------------------------------------
+void test_kmyth_envelope_wrong_kek(void)
+{
+  uint8_t kek[KMYTH_ENVELOPE_KEK_LEN] = { 0x01 };
+  uint8_t other_kek[KMYTH_ENVELOPE_KEK_LEN] = { 0x02 };
+  uint8_t input[] = "Envelope test data";
+  kmyth_envelope_t *env = NULL;
+  kmyth_envelope_t *other_env = NULL;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *unsealed = NULL;
+  size_t unsealed_len = 0;
+
+  CU_ASSERT(kmyth_envelope_open_kek(kek, sizeof(kek), &env) == 0);
+  CU_ASSERT(kmyth_envelope_open_kek(other_kek, sizeof(other_kek),
+                                    &other_env) == 0);
+  CU_ASSERT(kmyth_envelope_seal(env, input, sizeof(input), NULL,
+                                &sealed, &sealed_len) == 0);
+
+  CU_ASSERT(kmyth_envelope_unseal(other_env, sealed, sealed_len,
+                                  &unsealed, &unsealed_len) == 1);
+  CU_ASSERT(unsealed == NULL);
+  CU_ASSERT(unsealed_len == 0);
+
+  free(sealed);
+  kmyth_envelope_close(&env);
+  kmyth_envelope_close(&other_env);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_envelope_tampered()
+//----------------------------------------------------------------------------
+void test_kmyth_envelope_tampered(void)
+{
+  uint8_t kek[KMYTH_ENVELOPE_KEK_LEN] = { 0x03 };
+  uint8_t input[] = "Envelope test data";
+  kmyth_envelope_t *env = NULL;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *unsealed = NULL;
+  size_t unsealed_len = 0;
+
+  CU_ASSERT(kmyth_envelope_open_kek(kek, sizeof(kek), &env) == 0);
+  CU_ASSERT(kmyth_envelope_seal(env, input, sizeof(input), NULL,
+                                &sealed, &sealed_len) == 0);
+
+  // truncated envelope
+  CU_ASSERT(kmyth_envelope_unseal(env, sealed, sealed_len - 1,
+                                  &unsealed, &unsealed_len) == 1);
+
+  // altered wrapped DEK, then altered encrypted data (one base64 character
+  // replaced by another)
+  char *blocks[] = { KMYTH_DELIM_WRAPPED_DEK, KMYTH_DELIM_ENC_DATA };
+
+  for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+  {
+    uint8_t *block = (uint8_t *) strstr((char *) sealed, blocks[i]);
+
+    CU_ASSERT_FATAL(block != NULL);
+    block += strlen(blocks[i]) + 2;
+
+    uint8_t saved = *block;
+
+    *block = (saved == 'A') ? 'B' : 'A';
+    CU_ASSERT(kmyth_envelope_unseal(env, sealed, sealed_len,
+                                    &unsealed, &unsealed_len) == 1);
+    CU_ASSERT(unsealed == NULL);
+    *block = saved;
+  }
+
+  // restored envelope still opens
+  CU_ASSERT(kmyth_envelope_unseal(env, sealed, sealed_len,
+                                  &unsealed, &unsealed_len) == 0);
+  free(unsealed);
+
+  free(sealed);
+  kmyth_envelope_close(&env);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_envelope_tpm_kek()
+//----------------------------------------------------------------------------
+void test_kmyth_envelope_tpm_kek(void)
+{
+  uint8_t input[] = "Envelope test data";
+  kmyth_ctx_t *ctx = NULL;
+  kmyth_envelope_t *env = NULL;
+  uint8_t *kek_ski = NULL;
+  size_t kek_ski_len = 0;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *unsealed = NULL;
+  size_t unsealed_len = 0;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(kmyth_envelope_create_kek(ctx, &kek_ski, &kek_ski_len,
+                                      NULL, 0, NULL, 0, NULL, 0, NULL) == 0);
+
+  // data enveloped under one opening of the KEK opens under the next
+  CU_ASSERT(kmyth_envelope_open(ctx, kek_ski, kek_ski_len, NULL, 0, NULL, 0,
+                                0, &env) == 0);
+  CU_ASSERT(kmyth_envelope_seal(env, input, sizeof(input), NULL,
+                                &sealed, &sealed_len) == 0);
+  kmyth_envelope_close(&env);
+
+  CU_ASSERT(kmyth_envelope_open(ctx, kek_ski, kek_ski_len, NULL, 0, NULL, 0,
+                                0, &env) == 0);
+  CU_ASSERT(kmyth_envelope_unseal(env, sealed, sealed_len,
+                                  &unsealed, &unsealed_len) == 0);
+  CU_ASSERT(unsealed_len == sizeof(input));
+  CU_ASSERT(unsealed != NULL
+            && memcmp(unsealed, input, sizeof(input)) == 0);
+  kmyth_envelope_close(&env);
+
+  free(unsealed);
+  free(sealed);
+  free(kek_ski);
+  kmyth_ctx_destroy(&ctx);
+}
@@ -0,0 +1,143 @@
+//############################################################################
+// kmyth_keyring_test.c
+//
+// Tests for the kernel keyring cache functions in
+// tpm2/src/tpm/kmyth_keyring.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "defines.h"
+#include "kmyth_keyring.h"
+
+#include "kmyth_keyring_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_keyring_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_keyring_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "set_keyring_spec() Tests",
+                          test_set_keyring_spec))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_keyring_insert()/lookup() Tests",
+                          test_kmyth_keyring_insert_lookup))
+  {
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_set_keyring_spec()
+//----------------------------------------------------------------------------
+void test_set_keyring_spec(void)
+{
+  char *saved_env = getenv(KMYTH_KEYRING_ENV);
+
+  // nothing is cached unless asked for
+  unsetenv(KMYTH_KEYRING_ENV);
+  CU_ASSERT(set_keyring_spec(NULL) == 0);
+  CU_ASSERT(!kmyth_keyring_enabled());
+
+  // valid selections
+  CU_ASSERT(set_keyring_spec("user") == 0);
+  CU_ASSERT(kmyth_keyring_enabled());
+  CU_ASSERT(set_keyring_spec("session:5") == 0);
+  CU_ASSERT(kmyth_keyring_enabled());
+  CU_ASSERT(set_keyring_spec("none") == 0);
+  CU_ASSERT(!kmyth_keyring_enabled());
+
+  // invalid selections are rejected, leaving the selection as it was
+  CU_ASSERT(set_keyring_spec("process") == 1);
+  CU_ASSERT(set_keyring_spec("users") == 1);
+  CU_ASSERT(set_keyring_spec("user:") == 1);
+  CU_ASSERT(set_keyring_spec("user:0") == 1);
+  CU_ASSERT(set_keyring_spec("user:-5") == 1);
+  CU_ASSERT(set_keyring_spec("user:5s") == 1);
+  CU_ASSERT(!kmyth_keyring_enabled());
+
+  // without a selection, the environment decides (an invalid value turns
+  // caching off)
+  CU_ASSERT(set_keyring_spec(NULL) == 0);
+  setenv(KMYTH_KEYRING_ENV, "session:30", 1);
+  CU_ASSERT(kmyth_keyring_enabled());
+  setenv(KMYTH_KEYRING_ENV, "bogus", 1);
+  CU_ASSERT(!kmyth_keyring_enabled());
+
+  // a selection overrides the environment
+  CU_ASSERT(set_keyring_spec("none") == 0);
+  setenv(KMYTH_KEYRING_ENV, "user", 1);
+  CU_ASSERT(!kmyth_keyring_enabled());
+
+  CU_ASSERT(set_keyring_spec(NULL) == 0);
+  if (saved_env != NULL)
+  {
+    setenv(KMYTH_KEYRING_ENV, saved_env, 1);
+  }
+  else
+  {
+    unsetenv(KMYTH_KEYRING_ENV);
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_keyring_insert_lookup()
+//----------------------------------------------------------------------------
+void test_kmyth_keyring_insert_lookup(void)
+{
+  TPM2B_DIGEST key = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_DIGEST other_key = {.size = KMYTH_DIGEST_SIZE, };
+  uint8_t data[] = "unsealed test data";
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  // random cache keys, so earlier runs leave nothing to find
+  FILE *urandom = fopen("/dev/urandom", "rb");
+
+  CU_ASSERT_FATAL(urandom != NULL);
+  CU_ASSERT_FATAL(fread(key.buffer, 1, key.size, urandom) == key.size);
+  CU_ASSERT_FATAL(fread(other_key.buffer, 1, other_key.size, urandom) ==
+                  other_key.size);
+  fclose(urandom);
+
+  // with no keyring selected, nothing is cached
+  CU_ASSERT(set_keyring_spec("none") == 0);
+  kmyth_keyring_insert(&key, data, sizeof(data));
+  CU_ASSERT(!kmyth_keyring_lookup(&key, &output, &output_len));
+
+  // the session keyring returns what was put in it, under its key only
+  CU_ASSERT(set_keyring_spec("session:30") == 0);
+  CU_ASSERT(!kmyth_keyring_lookup(&key, &output, &output_len));
+  kmyth_keyring_insert(&key, data, sizeof(data));
+  CU_ASSERT(kmyth_keyring_lookup(&key, &output, &output_len));
+  CU_ASSERT(output_len == sizeof(data));
+  CU_ASSERT(output != NULL && memcmp(output, data, sizeof(data)) == 0);
+  free(output);
+  output = NULL;
+  CU_ASSERT(!kmyth_keyring_lookup(&other_key, &output, &output_len));
+  CU_ASSERT(output == NULL);
+
+  // data too large for a key is not cached
+  uint8_t *large = calloc(KMYTH_KEYRING_MAX_DATA + 1, 1);
+
+  CU_ASSERT_FATAL(large != NULL);
+  kmyth_keyring_insert(&other_key, large, KMYTH_KEYRING_MAX_DATA + 1);
+  CU_ASSERT(!kmyth_keyring_lookup(&other_key, &output, &output_len));
+  free(large);
+
+  // invalid parameters
+  TPM2B_DIGEST empty_key = {.size = 0, };
+
+  kmyth_keyring_insert(&empty_key, data, sizeof(data));
+  CU_ASSERT(!kmyth_keyring_lookup(&empty_key, &output, &output_len));
+  CU_ASSERT(!kmyth_keyring_lookup(NULL, &output, &output_len));
+  CU_ASSERT(!kmyth_keyring_lookup(&key, NULL, &output_len));
+
+  CU_ASSERT(set_keyring_spec(NULL) == 0);
+}
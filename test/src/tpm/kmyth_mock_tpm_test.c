@@ -0,0 +1,198 @@
+//############################################################################
+// kmyth_mock_tpm_test.c
+//
+// Tests for the mock TPM in tpm2/src/tpm/kmyth_mock_tpm.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth.h"
+#include "kmyth_mock_tpm.h"
+#include "tpm2_interface.h"
+
+#include "kmyth_mock_tpm_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_mock_tpm_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_mock_tpm_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_mock_tcti_init() Tests",
+                          test_kmyth_mock_tcti_init))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "Mock TPM Latency Tests",
+                          test_kmyth_mock_tpm_latency))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "Mock TPM Seal/Unseal Tests",
+                          test_kmyth_mock_tpm_seal_unseal))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_mock_tcti_init()
+//----------------------------------------------------------------------------
+void test_kmyth_mock_tcti_init(void)
+{
+  size_t size = 0;
+
+  // valid configurations (names are case-insensitive, unit defaults to ms)
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, NULL) == TSS2_RC_SUCCESS);
+  CU_ASSERT(size > 0);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "") == TSS2_RC_SUCCESS);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size,
+                                 "default=2ms,Create=150ms~20ms,"
+                                 "unseal=25,PolicyPCR=1.5us,seed=7") ==
+            TSS2_RC_SUCCESS);
+
+  // invalid configurations
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "Bogus=1ms") ==
+            TSS2_TCTI_RC_BAD_VALUE);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "Unseal") ==
+            TSS2_TCTI_RC_BAD_VALUE);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "Unseal=") ==
+            TSS2_TCTI_RC_BAD_VALUE);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "Unseal=-1ms") ==
+            TSS2_TCTI_RC_BAD_VALUE);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "Unseal=5min") ==
+            TSS2_TCTI_RC_BAD_VALUE);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "Unseal=5ms~x") ==
+            TSS2_TCTI_RC_BAD_VALUE);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, &size, "seed=abc") ==
+            TSS2_TCTI_RC_BAD_VALUE);
+  CU_ASSERT(kmyth_mock_tcti_init(NULL, NULL, NULL) ==
+            TSS2_TCTI_RC_BAD_VALUE);
+
+  // a context smaller than the size reported is refused
+  size_t small = 8;
+  uint8_t buf[8];
+
+  CU_ASSERT(kmyth_mock_tcti_init((TSS2_TCTI_CONTEXT *) buf, &small, NULL) ==
+            TSS2_TCTI_RC_INSUFFICIENT_BUFFER);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_mock_tpm_latency()
+//----------------------------------------------------------------------------
+void test_kmyth_mock_tpm_latency(void)
+{
+  size_t size = 0;
+  const char *conf = "GetRandom=20ms";
+
+  CU_ASSERT_FATAL(kmyth_mock_tcti_init(NULL, &size, conf) == TSS2_RC_SUCCESS);
+
+  TSS2_TCTI_CONTEXT *tcti_ctx = calloc(1, size);
+
+  CU_ASSERT_FATAL(tcti_ctx != NULL);
+  CU_ASSERT_FATAL(kmyth_mock_tcti_init(tcti_ctx, &size, conf) ==
+                  TSS2_RC_SUCCESS);
+
+  // TPM2_GetRandom(16): tag, size, command code, bytesRequested
+  const uint8_t command[] = { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0C,
+    0x00, 0x00, 0x01, 0x7B, 0x00, 0x10
+  };
+  uint8_t response[64];
+  size_t response_len = sizeof(response);
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  CU_ASSERT(Tss2_Tcti_Transmit(tcti_ctx, sizeof(command), command) ==
+            TSS2_RC_SUCCESS);
+
+  // a poll before the latency has passed finds no response
+  CU_ASSERT(Tss2_Tcti_Receive(tcti_ctx, &response_len, response, 0) ==
+            TSS2_TCTI_RC_TRY_AGAIN);
+
+  // a blocking receive waits it out
+  response_len = sizeof(response);
+  CU_ASSERT(Tss2_Tcti_Receive(tcti_ctx, &response_len, response,
+                              TSS2_TCTI_TIMEOUT_BLOCK) == TSS2_RC_SUCCESS);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000L +
+    (end.tv_nsec - start.tv_nsec) / 1000000L;
+
+  CU_ASSERT(elapsed_ms >= 20);
+
+  // response: header (success), then a TPM2B of 16 random bytes
+  CU_ASSERT(response_len == 10 + 2 + 16);
+  CU_ASSERT(response[6] == 0 && response[7] == 0 &&
+            response[8] == 0 && response[9] == 0);
+  CU_ASSERT(response[10] == 0 && response[11] == 16);
+
+  // an unknown command is answered with an error
+  const uint8_t unknown[] = { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0A,
+    0x00, 0x00, 0x01, 0xFF
+  };
+
+  response_len = sizeof(response);
+  CU_ASSERT(Tss2_Tcti_Transmit(tcti_ctx, sizeof(unknown), unknown) ==
+            TSS2_RC_SUCCESS);
+  CU_ASSERT(Tss2_Tcti_Receive(tcti_ctx, &response_len, response,
+                              TSS2_TCTI_TIMEOUT_BLOCK) == TSS2_RC_SUCCESS);
+  CU_ASSERT(response_len == 10);
+  CU_ASSERT(response[8] == 0x01 && response[9] == 0x43);
+
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_mock_tpm_seal_unseal()
+//----------------------------------------------------------------------------
+void test_kmyth_mock_tpm_seal_unseal(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  bool isEmulator = true;
+
+  kmyth_mock_tpm_reset();
+  CU_ASSERT_FATAL(set_tcti_spec(KMYTH_MOCK_TCTI_NAME) == 0);
+
+  // the mock TPM passes for hardware (no TPM2_Startup needed)
+  CU_ASSERT(init_tpm2_connection(&sapi_ctx) == 0);
+  CU_ASSERT(get_tpm2_impl_type(sapi_ctx, &isEmulator) == 0);
+  CU_ASSERT(isEmulator == false);
+  free_tpm2_resources(&sapi_ctx);
+
+  // the full seal and unseal paths run against it
+  uint8_t input[] = "mock TPM round trip";
+  uint8_t auth[] = "password";
+  int pcrs[] = { 0, 7 };
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &output, &output_len,
+                            auth, sizeof(auth) - 1, NULL, 0, pcrs, 2, NULL,
+                            NULL, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal(output, output_len, &plaintext, &plaintext_len,
+                              auth, sizeof(auth) - 1, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == sizeof(input));
+  CU_ASSERT(plaintext != NULL &&
+            memcmp(plaintext, input, sizeof(input)) == 0);
+  free(plaintext);
+  plaintext = NULL;
+
+  // the policy is enforced: a wrong authorization fails
+  uint8_t wrong[] = "passw0rd";
+
+  CU_ASSERT(tpm2_kmyth_unseal(output, output_len, &plaintext, &plaintext_len,
+                              wrong, sizeof(wrong) - 1, NULL, 0, 0) != 0);
+  free(plaintext);
+  free(output);
+
+  CU_ASSERT(set_tcti_spec(NULL) == 0);
+  kmyth_mock_tpm_reset();
+}
@@ -0,0 +1,395 @@
+//############################################################################
+// kmyth_policy_authorize_test.c
+//
+// Tests for the signed policy functions in
+// tpm2/src/tpm/kmyth_policy_authorize.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth_policy_authorize.h"
+#include "object_tools.h"
+
+#include "kmyth_policy_authorize_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_policy_authorize_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_policy_authorize_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_pem_to_authorizing_key() Tests",
+                          test_kmyth_pem_to_authorizing_key))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "set_authorizing_key() Tests",
+                          test_set_authorizing_key))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_sign_policy() Tests",
+                          test_kmyth_sign_policy))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_find_signed_policy() Tests",
+                          test_kmyth_find_signed_policy))
+  {
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// generate_pem_key()
+//
+// Generates an RSA key of the given size, PEM encoded (the private key, or
+// only its public part). The caller frees the result.
+//----------------------------------------------------------------------------
+static char *generate_pem_key(int bits, int private_key, size_t *pem_len)
+{
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+  EVP_PKEY *pkey = NULL;
+  BIO *bio = BIO_new(BIO_s_mem());
+  char *pem = NULL;
+
+  if (ctx != NULL && bio != NULL &&
+      EVP_PKEY_keygen_init(ctx) == 1 &&
+      EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, bits) == 1 &&
+      EVP_PKEY_keygen(ctx, &pkey) == 1 &&
+      (private_key ?
+       PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0, NULL, NULL) :
+       PEM_write_bio_PUBKEY(bio, pkey)) == 1)
+  {
+    char *data = NULL;
+    long len = BIO_get_mem_data(bio, &data);
+
+    pem = malloc((size_t) len);
+    if (pem != NULL)
+    {
+      memcpy(pem, data, (size_t) len);
+      *pem_len = (size_t) len;
+    }
+  }
+
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(ctx);
+  BIO_free(bio);
+  return pem;
+}
+
+//----------------------------------------------------------------------------
+// public_pem_of()
+//
+// Re-encodes the public part of a PEM private key. The caller frees the
+// result.
+//----------------------------------------------------------------------------
+static char *public_pem_of(char *private_pem, size_t private_pem_len,
+                           size_t *pem_len)
+{
+  BIO *in = BIO_new_mem_buf(private_pem, (int) private_pem_len);
+  BIO *out = BIO_new(BIO_s_mem());
+  EVP_PKEY *pkey = (in == NULL) ? NULL :
+    PEM_read_bio_PrivateKey(in, NULL, NULL, NULL);
+  char *pem = NULL;
+
+  if (pkey != NULL && out != NULL && PEM_write_bio_PUBKEY(out, pkey) == 1)
+  {
+    char *data = NULL;
+    long len = BIO_get_mem_data(out, &data);
+
+    pem = malloc((size_t) len);
+    if (pem != NULL)
+    {
+      memcpy(pem, data, (size_t) len);
+      *pem_len = (size_t) len;
+    }
+  }
+
+  EVP_PKEY_free(pkey);
+  BIO_free(in);
+  BIO_free(out);
+  return pem;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_pem_to_authorizing_key()
+//----------------------------------------------------------------------------
+void test_kmyth_pem_to_authorizing_key(void)
+{
+  size_t priv_len = 0;
+  char *priv = generate_pem_key(2048, 1, &priv_len);
+  size_t pub_len = 0;
+  char *pub = (priv == NULL) ? NULL : public_pem_of(priv, priv_len, &pub_len);
+
+  CU_ASSERT_FATAL(priv != NULL && pub != NULL);
+
+  // a public key gives an RSASSA/SHA-256 signing key
+  TPM2B_PUBLIC from_pub = {.size = 0, };
+
+  CU_ASSERT(kmyth_pem_to_authorizing_key((uint8_t *) pub, pub_len,
+                                         &from_pub) == 0);
+  CU_ASSERT(from_pub.size > 0);
+  CU_ASSERT(from_pub.publicArea.type == TPM2_ALG_RSA);
+  CU_ASSERT(from_pub.publicArea.nameAlg == KMYTH_HASH_ALG);
+  CU_ASSERT(from_pub.publicArea.parameters.rsaDetail.keyBits == 2048);
+  CU_ASSERT(from_pub.publicArea.parameters.rsaDetail.scheme.scheme ==
+            TPM2_ALG_RSASSA);
+  CU_ASSERT(from_pub.publicArea.unique.rsa.size == 256);
+
+  // only the public part of a private key is used, so both give the same
+  // key (and so the same name)
+  TPM2B_PUBLIC from_priv = {.size = 0, };
+  TPM2B_NAME pub_name = {.size = 0, };
+  TPM2B_NAME priv_name = {.size = 0, };
+
+  CU_ASSERT(kmyth_pem_to_authorizing_key((uint8_t *) priv, priv_len,
+                                         &from_priv) == 0);
+  CU_ASSERT(compute_kmyth_object_name(&from_pub, &pub_name) == 0);
+  CU_ASSERT(compute_kmyth_object_name(&from_priv, &priv_name) == 0);
+  CU_ASSERT(pub_name.size > 0 && pub_name.size == priv_name.size);
+  CU_ASSERT(memcmp(pub_name.name, priv_name.name, pub_name.size) == 0);
+
+  // keys that are not PEM, or too small, are rejected
+  TPM2B_PUBLIC key = {.size = 0, };
+  size_t small_len = 0;
+  char *small = generate_pem_key(1024, 0, &small_len);
+
+  CU_ASSERT(kmyth_pem_to_authorizing_key((uint8_t *) "not a key", 9,
+                                         &key) == 1);
+  CU_ASSERT(kmyth_pem_to_authorizing_key((uint8_t *) pub, pub_len / 2,
+                                         &key) == 1);
+  CU_ASSERT(small != NULL);
+  CU_ASSERT(kmyth_pem_to_authorizing_key((uint8_t *) small, small_len,
+                                         &key) == 1);
+  CU_ASSERT(kmyth_pem_to_authorizing_key(NULL, 0, &key) == 1);
+
+  free(small);
+  free(priv);
+  free(pub);
+}
+
+//----------------------------------------------------------------------------
+// test_set_authorizing_key()
+//----------------------------------------------------------------------------
+void test_set_authorizing_key(void)
+{
+  size_t pub_len = 0;
+  char *pub = generate_pem_key(2048, 0, &pub_len);
+  char pub_path[] = "/tmp/kmyth_authorizing_key_XXXXXX";
+  int fd = mkstemp(pub_path);
+
+  CU_ASSERT_FATAL(pub != NULL && fd >= 0);
+  CU_ASSERT(write(fd, pub, pub_len) == (ssize_t) pub_len);
+  close(fd);
+
+  // data is sealed to its PCR policy unless a key is selected
+  CU_ASSERT(set_authorizing_key(NULL) == 0);
+  CU_ASSERT(get_authorizing_key() == NULL);
+
+  CU_ASSERT(set_authorizing_key(pub_path) == 0);
+  CU_ASSERT(get_authorizing_key() != NULL);
+  CU_ASSERT(get_authorizing_key()->publicArea.type == TPM2_ALG_RSA);
+
+  // an invalid key leaves the selection as it was
+  CU_ASSERT(set_authorizing_key("/nonexistent/kmyth/key.pem") == 1);
+  CU_ASSERT(get_authorizing_key() != NULL);
+
+  CU_ASSERT(set_authorizing_key(NULL) == 0);
+  CU_ASSERT(get_authorizing_key() == NULL);
+
+  unlink(pub_path);
+  free(pub);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_sign_policy()
+//----------------------------------------------------------------------------
+void test_kmyth_sign_policy(void)
+{
+  size_t priv_len = 0;
+  char *priv = generate_pem_key(2048, 1, &priv_len);
+  size_t pub_len = 0;
+  char *pub = (priv == NULL) ? NULL : public_pem_of(priv, priv_len, &pub_len);
+
+  CU_ASSERT_FATAL(priv != NULL && pub != NULL);
+
+  TPM2B_DIGEST policy = {.size = KMYTH_DIGEST_SIZE, };
+
+  for (size_t i = 0; i < KMYTH_DIGEST_SIZE; i++)
+  {
+    policy.buffer[i] = (uint8_t) i;
+  }
+
+  uint8_t *signed_policy = NULL;
+  size_t signed_policy_len = 0;
+
+  CU_ASSERT(kmyth_sign_policy(&policy, (uint8_t *) priv, priv_len,
+                              &signed_policy, &signed_policy_len) == 0);
+  CU_ASSERT_FATAL(signed_policy != NULL);
+
+  // the file records the approved policy and the name of the signing key
+  TPM2B_DIGEST approved = {.size = 0, };
+  TPM2B_NAME key_name = {.size = 0, };
+  TPMT_SIGNATURE signature;
+  TPM2B_PUBLIC key = {.size = 0, };
+  TPM2B_NAME expected_name = {.size = 0, };
+
+  CU_ASSERT(parse_signed_policy(signed_policy, signed_policy_len, &approved,
+                                &key_name, &signature) == 0);
+  CU_ASSERT(approved.size == policy.size);
+  CU_ASSERT(memcmp(approved.buffer, policy.buffer, policy.size) == 0);
+  CU_ASSERT(kmyth_pem_to_authorizing_key((uint8_t *) pub, pub_len,
+                                         &key) == 0);
+  CU_ASSERT(compute_kmyth_object_name(&key, &expected_name) == 0);
+  CU_ASSERT(key_name.size == expected_name.size);
+  CU_ASSERT(memcmp(key_name.name, expected_name.name, key_name.size) == 0);
+  CU_ASSERT(signature.sigAlg == TPM2_ALG_RSASSA);
+  CU_ASSERT(signature.signature.rsassa.hash == KMYTH_HASH_ALG);
+  CU_ASSERT(signature.signature.rsassa.sig.size == 256);
+
+  // the signature is a PKCS#1 v1.5 SHA-256 signature of the policy
+  BIO *bio = BIO_new_mem_buf(pub, (int) pub_len);
+  EVP_PKEY *pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+
+  CU_ASSERT(pkey != NULL && md_ctx != NULL);
+  CU_ASSERT(EVP_DigestVerifyInit(md_ctx, NULL, EVP_sha256(), NULL,
+                                 pkey) == 1);
+  CU_ASSERT(EVP_DigestVerify(md_ctx, signature.signature.rsassa.sig.buffer,
+                             signature.signature.rsassa.sig.size,
+                             policy.buffer, policy.size) == 1);
+  EVP_MD_CTX_free(md_ctx);
+  EVP_PKEY_free(pkey);
+  BIO_free(bio);
+
+  // a truncated or altered file is rejected
+  CU_ASSERT(parse_signed_policy(signed_policy, signed_policy_len / 2,
+                                &approved, &key_name, &signature) == 1);
+  signed_policy[0] = '#';
+  CU_ASSERT(parse_signed_policy(signed_policy, signed_policy_len, &approved,
+                                &key_name, &signature) == 1);
+  free(signed_policy);
+  signed_policy = NULL;
+
+  // signing takes the private key, and a policy to approve
+  CU_ASSERT(kmyth_sign_policy(&policy, (uint8_t *) pub, pub_len,
+                              &signed_policy, &signed_policy_len) == 1);
+  CU_ASSERT(signed_policy == NULL);
+  policy.size = 0;
+  CU_ASSERT(kmyth_sign_policy(&policy, (uint8_t *) priv, priv_len,
+                              &signed_policy, &signed_policy_len) == 1);
+  CU_ASSERT(signed_policy == NULL);
+
+  free(priv);
+  free(pub);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_find_signed_policy()
+//----------------------------------------------------------------------------
+void test_kmyth_find_signed_policy(void)
+{
+  char *saved_env = getenv(KMYTH_SIGNED_POLICY_ENV);
+  size_t priv_len = 0;
+  char *priv = generate_pem_key(2048, 1, &priv_len);
+  TPM2B_PUBLIC key = {.size = 0, };
+  TPM2B_NAME key_name = {.size = 0, };
+
+  CU_ASSERT_FATAL(priv != NULL);
+  CU_ASSERT(kmyth_pem_to_authorizing_key((uint8_t *) priv, priv_len,
+                                         &key) == 0);
+  CU_ASSERT(compute_kmyth_object_name(&key, &key_name) == 0);
+
+  // approve two policies, each in its own file in a directory that also
+  // holds an unrelated file
+  char dir[] = "/tmp/kmyth_signed_policies_XXXXXX";
+  char path_a[sizeof(dir) + 16];
+  char path_b[sizeof(dir) + 16];
+  char path_other[sizeof(dir) + 16];
+  TPM2B_DIGEST policy_a = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_DIGEST policy_b = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_DIGEST policy_c = {.size = KMYTH_DIGEST_SIZE, };
+
+  memset(policy_a.buffer, 0xaa, KMYTH_DIGEST_SIZE);
+  memset(policy_b.buffer, 0xbb, KMYTH_DIGEST_SIZE);
+  memset(policy_c.buffer, 0xcc, KMYTH_DIGEST_SIZE);
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(path_a, sizeof(path_a), "%s/a.policy", dir);
+  snprintf(path_b, sizeof(path_b), "%s/b.policy", dir);
+  snprintf(path_other, sizeof(path_other), "%s/README", dir);
+
+  uint8_t *signed_policy = NULL;
+  size_t signed_policy_len = 0;
+
+  CU_ASSERT(kmyth_sign_policy(&policy_a, (uint8_t *) priv, priv_len,
+                              &signed_policy, &signed_policy_len) == 0);
+  CU_ASSERT(write_bytes_to_file(path_a, signed_policy,
+                                signed_policy_len) == 0);
+  free(signed_policy);
+  CU_ASSERT(kmyth_sign_policy(&policy_b, (uint8_t *) priv, priv_len,
+                              &signed_policy, &signed_policy_len) == 0);
+  CU_ASSERT(write_bytes_to_file(path_b, signed_policy,
+                                signed_policy_len) == 0);
+  free(signed_policy);
+  CU_ASSERT(write_bytes_to_file(path_other, (uint8_t *) "not a policy\n",
+                                13) == 0);
+
+  TPMT_SIGNATURE signature;
+
+  // nothing is found without a path
+  unsetenv(KMYTH_SIGNED_POLICY_ENV);
+  CU_ASSERT(set_signed_policy_path(NULL) == 0);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_a, &key_name, &signature) == 1);
+
+  // a single file only approves its own policy
+  CU_ASSERT(set_signed_policy_path(path_a) == 0);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_a, &key_name, &signature) == 0);
+  CU_ASSERT(signature.sigAlg == TPM2_ALG_RSASSA);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_b, &key_name, &signature) == 1);
+
+  // a directory approves any policy one of its files does
+  CU_ASSERT(set_signed_policy_path(dir) == 0);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_a, &key_name, &signature) == 0);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_b, &key_name, &signature) == 0);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_c, &key_name, &signature) == 1);
+
+  // approvals by another key do not count
+  TPM2B_NAME other_name = key_name;
+
+  other_name.name[other_name.size - 1] ^= 0x01;
+  CU_ASSERT(kmyth_find_signed_policy(&policy_a, &other_name,
+                                     &signature) == 1);
+
+  // without a selection, the environment decides
+  CU_ASSERT(set_signed_policy_path(NULL) == 0);
+  setenv(KMYTH_SIGNED_POLICY_ENV, path_b, 1);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_b, &key_name, &signature) == 0);
+  CU_ASSERT(kmyth_find_signed_policy(&policy_a, &key_name, &signature) == 1);
+
+  if (saved_env != NULL)
+  {
+    setenv(KMYTH_SIGNED_POLICY_ENV, saved_env, 1);
+  }
+  else
+  {
+    unsetenv(KMYTH_SIGNED_POLICY_ENV);
+  }
+
+  unlink(path_a);
+  unlink(path_b);
+  unlink(path_other);
+  rmdir(dir);
+  free(priv);
+}
@@ -0,0 +1,124 @@
+//############################################################################
+// kmyth_prewarm_test.c
+//
+// Tests for the secret cache prewarming in tpm2/src/tpm/kmyth_prewarm.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth_prewarm.h"
+
+#include "kmyth_prewarm_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_prewarm_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_prewarm_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_prewarm_parse_manifest() Tests",
+                          test_kmyth_prewarm_parse_manifest))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_prewarm_order() Tests",
+                          test_kmyth_prewarm_order))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_prewarm_parse_manifest()
+//----------------------------------------------------------------------------
+void test_kmyth_prewarm_parse_manifest(void)
+{
+  const char *manifest = "# boot secrets\n"
+    "10 /etc/kmyth/db.ski\n"
+    "\n"
+    "  /etc/kmyth/web.ski  \r\n"
+    "-5\t/etc/kmyth/first.ski\n" "7 /etc/kmyth/with space.ski";
+  kmyth_prewarm_item *items = NULL;
+  size_t count = 0;
+
+  CU_ASSERT(kmyth_prewarm_parse_manifest((const uint8_t *) manifest,
+                                         strlen(manifest), &items,
+                                         &count) == 0);
+  CU_ASSERT(count == 4);
+  CU_ASSERT(strcmp(items[0].path, "/etc/kmyth/db.ski") == 0);
+  CU_ASSERT(items[0].priority == 10);
+  CU_ASSERT(items[0].line == 2);
+  CU_ASSERT(strcmp(items[1].path, "/etc/kmyth/web.ski") == 0);
+  CU_ASSERT(items[1].priority == KMYTH_PREWARM_DEFAULT_PRIORITY);
+  CU_ASSERT(items[1].line == 4);
+  CU_ASSERT(strcmp(items[2].path, "/etc/kmyth/first.ski") == 0);
+  CU_ASSERT(items[2].priority == -5);
+  CU_ASSERT(strcmp(items[3].path, "/etc/kmyth/with space.ski") == 0);
+  CU_ASSERT(items[3].priority == 7);
+  kmyth_prewarm_free(items, count);
+
+  // A leading number without a path after it is the path
+  manifest = "2024.ski\n";
+  CU_ASSERT(kmyth_prewarm_parse_manifest((const uint8_t *) manifest,
+                                         strlen(manifest), &items,
+                                         &count) == 0);
+  CU_ASSERT(count == 1);
+  CU_ASSERT(strcmp(items[0].path, "2024.ski") == 0);
+  CU_ASSERT(items[0].priority == KMYTH_PREWARM_DEFAULT_PRIORITY);
+  kmyth_prewarm_free(items, count);
+
+  // Empty manifests are fine, invalid priorities are not
+  CU_ASSERT(kmyth_prewarm_parse_manifest(NULL, 0, &items, &count) == 0);
+  CU_ASSERT(count == 0);
+  CU_ASSERT(items == NULL);
+  manifest = "1x /etc/kmyth/db.ski\n";
+  CU_ASSERT(kmyth_prewarm_parse_manifest((const uint8_t *) manifest,
+                                         strlen(manifest), &items,
+                                         &count) == 1);
+  manifest = "99999999999999999999999 /etc/kmyth/db.ski\n";
+  CU_ASSERT(kmyth_prewarm_parse_manifest((const uint8_t *) manifest,
+                                         strlen(manifest), &items,
+                                         &count) == 1);
+  CU_ASSERT(kmyth_prewarm_parse_manifest((const uint8_t *) manifest,
+                                         strlen(manifest), NULL,
+                                         &count) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_prewarm_order()
+//----------------------------------------------------------------------------
+void test_kmyth_prewarm_order(void)
+{
+  // Entries 0 and 2 share a storage key and policy, 4 uses the same key
+  // under another policy, and 1 and 3 use other keys
+  kmyth_prewarm_item items[6] = { 0 };
+  uint8_t sk[] = { 'A', 'B', 'A', 'C', 'A', 'A' };
+  long priority[] = { 5, 5, 5, 5, 5, 1 };
+
+  for (size_t i = 0; i < 6; i++)
+  {
+    items[i].line = i;
+    items[i].priority = priority[i];
+    items[i].sk_name.size = 1;
+    items[i].sk_name.name[0] = sk[i];
+    items[i].policy.size = 1;
+    items[i].policy.buffer[0] = 'p';
+  }
+  items[4].policy.buffer[0] = 'q';
+
+  kmyth_prewarm_order(items, 6);
+
+  // Priority first, then groups in order of first appearance
+  size_t expected[] = { 5, 0, 2, 1, 3, 4 };
+
+  for (size_t i = 0; i < 6; i++)
+  {
+    CU_ASSERT(items[i].line == expected[i]);
+  }
+
+  kmyth_prewarm_order(NULL, 0);
+}
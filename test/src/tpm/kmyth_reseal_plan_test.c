@@ -0,0 +1,224 @@
+//############################################################################
+// kmyth_reseal_plan_test.c
+//
+// Tests for the incremental reseal planning in
+// tpm2/src/tpm/kmyth_reseal_plan.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth.h"
+#include "kmyth_mock_tpm.h"
+#include "kmyth_reseal_plan.h"
+#include "tpm2_interface.h"
+
+#include "kmyth_reseal_plan_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_reseal_plan_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_reseal_plan_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_pcr_values_parse() Tests",
+                          test_kmyth_pcr_values_parse))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_reseal_plan_check() Tests",
+                          test_kmyth_reseal_plan_check))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_pcr_values_parse()
+//----------------------------------------------------------------------------
+void test_kmyth_pcr_values_parse(void)
+{
+  const char *manifest = "# after the firmware update\n"
+    "0 00000000000000000000000000000000"
+    "00000000000000000000000000000001\n"
+    "\n"
+    "  7=ABCDEF0123456789abcdef0123456789"
+    "abcdef0123456789abcdef0123456789  \r\n"
+    "23:\tffffffffffffffffffffffffffffffff"
+    "ffffffffffffffffffffffffffffffff";
+  kmyth_pcr_values values;
+
+  memset(&values, 0, sizeof(values));
+  CU_ASSERT(kmyth_pcr_values_parse((const uint8_t *) manifest,
+                                   strlen(manifest), &values) == 0);
+  CU_ASSERT(values.known[0] && values.known[7] && values.known[23]);
+  CU_ASSERT(!values.known[1] && !values.known[8]);
+  CU_ASSERT(values.value[0][KMYTH_DIGEST_SIZE - 1] == 0x01);
+  CU_ASSERT(values.value[7][0] == 0xAB && values.value[7][1] == 0xCD);
+  CU_ASSERT(values.value[23][KMYTH_DIGEST_SIZE - 1] == 0xFF);
+
+  // an empty manifest changes nothing
+  kmyth_pcr_values before = values;
+
+  CU_ASSERT(kmyth_pcr_values_parse(NULL, 0, &values) == 0);
+  CU_ASSERT(memcmp(&before, &values, sizeof(values)) == 0);
+
+  // invalid manifests are rejected, leaving the values as they were
+  const char *invalid[] = {
+    "24 00000000000000000000000000000000"
+      "00000000000000000000000000000000",
+    "x 00000000000000000000000000000000"
+      "00000000000000000000000000000000",
+    "1 0000000000000000000000000000000000000000000000000000000000000000",
+    "1 00000000000000000000000000000000"
+      "0000000000000000000000000000000",
+    "1 00000000000000000000000000000000"
+      "000000000000000000000000000000000",
+    "1 00000000000000000000000000000000"
+      "0000000000000000000000000000000g",
+    "1",
+    "100000000000000000000000000000000"
+      "00000000000000000000000000000000",
+    "1 00000000000000000000000000000000"
+      "00000000000000000000000000000000\n"
+      "1 00000000000000000000000000000000"
+      "00000000000000000000000000000001",
+  };
+
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+  {
+    // (the third one is valid, as a check that the others fail for the
+    // reason intended)
+    int expected = (i == 2) ? 0 : 1;
+
+    values = before;
+    CU_ASSERT(kmyth_pcr_values_parse((const uint8_t *) invalid[i],
+                                     strlen(invalid[i]), &values) ==
+              expected);
+    if (expected)
+    {
+      CU_ASSERT(memcmp(&before, &values, sizeof(values)) == 0);
+    }
+  }
+
+  CU_ASSERT(kmyth_pcr_values_parse((const uint8_t *) manifest,
+                                   strlen(manifest), NULL) == 1);
+  CU_ASSERT(kmyth_pcr_values_parse(NULL, 1, &values) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_reseal_plan_check()
+//----------------------------------------------------------------------------
+void test_kmyth_reseal_plan_check(void)
+{
+  // seal on the mock TPM, whose PCRs all start out zero
+  kmyth_mock_tpm_reset();
+  CU_ASSERT_FATAL(set_tcti_spec(KMYTH_MOCK_TCTI_NAME) == 0);
+
+  uint8_t input[] = "reseal plan";
+  int pcrs[] = { 0, 7 };
+  uint8_t *bound = NULL;
+  size_t bound_len = 0;
+  uint8_t *unbound = NULL;
+  size_t unbound_len = 0;
+  uint8_t *branched = NULL;
+  size_t branched_len = 0;
+
+  // an expected policy: that of PCRs 0 and 7 once PCR 7 reads all ones
+  uint8_t future_values[2 * KMYTH_DIGEST_SIZE];
+  char *future_policy = NULL;
+
+  memset(future_values, 0, KMYTH_DIGEST_SIZE);
+  memset(future_values + KMYTH_DIGEST_SIZE, 0xFF, KMYTH_DIGEST_SIZE);
+  CU_ASSERT_FATAL(kmyth_compute_policy(pcrs, 2, future_values,
+                                       sizeof(future_values), NULL,
+                                       &future_policy) == 0);
+
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &bound, &bound_len,
+                            NULL, 0, NULL, 0, pcrs, 2, NULL, NULL, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &unbound, &unbound_len,
+                            NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &branched, &branched_len,
+                            NULL, 0, NULL, 0, pcrs, 2, NULL, future_policy,
+                            0) == 0);
+
+  // the current PCR values satisfy every policy
+  kmyth_ctx_t *ctx = NULL;
+  kmyth_pcr_values values;
+  kmyth_reseal_plan_action action = KMYTH_RESEAL_PLAN_RESEAL;
+
+  memset(&values, 0, sizeof(values));
+  CU_ASSERT_FATAL(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(kmyth_pcr_values_read(ctx, &values) == 0);
+  kmyth_ctx_destroy(&ctx);
+  for (int i = 0; i < KMYTH_DEFAULT_PCR_COUNT; i++)
+  {
+    CU_ASSERT(values.known[i]);
+  }
+
+  kmyth_pcr_values current = values;
+
+  CU_ASSERT(kmyth_reseal_plan_check(bound, bound_len, &values, &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_KEEP);
+  action = KMYTH_RESEAL_PLAN_RESEAL;
+  CU_ASSERT(kmyth_reseal_plan_check(unbound, unbound_len, &values,
+                                    &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_KEEP);
+  action = KMYTH_RESEAL_PLAN_RESEAL;
+  CU_ASSERT(kmyth_reseal_plan_check(branched, branched_len, &values,
+                                    &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_KEEP);
+
+  // a change to an unselected PCR breaks nothing
+  const char *pcr1 = "1 11111111111111111111111111111111"
+    "11111111111111111111111111111111";
+
+  CU_ASSERT(kmyth_pcr_values_parse((const uint8_t *) pcr1, strlen(pcr1),
+                                   &values) == 0);
+  CU_ASSERT(kmyth_reseal_plan_check(bound, bound_len, &values, &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_KEEP);
+
+  // the expected PCR 7 value breaks the single policy only
+  const char *pcr7 = "7 ffffffffffffffffffffffffffffffff"
+    "ffffffffffffffffffffffffffffffff";
+
+  CU_ASSERT(kmyth_pcr_values_parse((const uint8_t *) pcr7, strlen(pcr7),
+                                   &values) == 0);
+  CU_ASSERT(kmyth_reseal_plan_check(bound, bound_len, &values, &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_RESEAL);
+  CU_ASSERT(kmyth_reseal_plan_check(unbound, unbound_len, &values,
+                                    &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_KEEP);
+  CU_ASSERT(kmyth_reseal_plan_check(branched, branched_len, &values,
+                                    &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_KEEP);
+
+  // any other value breaks the compound policy too
+  const char *other7 = "7 22222222222222222222222222222222"
+    "22222222222222222222222222222222";
+
+  values = current;
+  CU_ASSERT(kmyth_pcr_values_parse((const uint8_t *) other7, strlen(other7),
+                                   &values) == 0);
+  CU_ASSERT(kmyth_reseal_plan_check(branched, branched_len, &values,
+                                    &action) == 0);
+  CU_ASSERT(action == KMYTH_RESEAL_PLAN_RESEAL);
+
+  // a selected PCR without a value, or an invalid .ski, can't be checked
+  memset(&values, 0, sizeof(values));
+  CU_ASSERT(kmyth_reseal_plan_check(bound, bound_len, &values, &action) == 1);
+  CU_ASSERT(kmyth_reseal_plan_check(unbound, unbound_len, &values,
+                                    &action) == 0);
+  CU_ASSERT(kmyth_reseal_plan_check(bound, 16, &current, &action) == 1);
+  CU_ASSERT(kmyth_reseal_plan_check(NULL, 0, &current, &action) == 1);
+
+  free(bound);
+  free(unbound);
+  free(branched);
+  free(future_policy);
+  CU_ASSERT(set_tcti_spec(NULL) == 0);
+  kmyth_mock_tpm_reset();
+}
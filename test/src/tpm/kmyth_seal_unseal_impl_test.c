@@ -7,10 +7,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 #include <CUnit/CUnit.h>
 
+#include "defines.h"
 #include "kmyth.h"
 #include "pcrs.h"
+#include "file_io.h"
 #include "formatting_tools.h"
 #include "marshalling_tools.h"
 #include "storage_key_tools.h"
@@ -45,6 +51,24 @@ int kmyth_seal_unseal_impl_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_seal_batch() Tests",
+                  test_tpm2_kmyth_seal_batch))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_unseal_batch() Tests",
+                  test_tpm2_kmyth_unseal_batch))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_reseal() Tests",
+                  test_tpm2_kmyth_reseal))
+  {
+    return 1;
+  }
   if (NULL ==
       CU_add_test(suite, "tpm2_kmyth_seal_file() Tests",
                   test_tpm2_kmyth_seal_file))
@@ -70,6 +94,24 @@ int kmyth_seal_unseal_impl_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_compute_policy() Tests",
+                  test_kmyth_compute_policy))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_seal_stream()/unseal_stream() Tests",
+                  test_tpm2_kmyth_seal_unseal_stream))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_sealed_reader_pread() Tests",
+                  test_kmyth_sealed_reader))
+  {
+    return 1;
+  }
   return 0;
 }
 
@@ -183,6 +225,317 @@ void test_tpm2_kmyth_unseal(void)
   // tests for tpm2_kmyth_seal.
 }
 
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_batch
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_batch(void)
+{
+  uint8_t input0[8] = { 0x00 };
+  uint8_t input1[5] = { 0x01, 0x02, 0x03, 0x04, 0x05 };
+  uint8_t input2[12] = { 0xFF };
+
+  uint8_t *inputs[3] = { input0, input1, input2 };
+  size_t input_lens[3] = { sizeof(input0), sizeof(input1), sizeof(input2) };
+
+  uint8_t *outputs[3] = { NULL };
+  size_t output_lens[3] = { 0 };
+
+  // Check that an empty batch is rejected
+  CU_ASSERT(tpm2_kmyth_seal_batch(0, inputs, input_lens, outputs, output_lens,
+                                  NULL, 0, NULL, 0, NULL, 0, NULL,
+                                  NULL) == 1);
+
+  // Check that an invalid item fails the whole batch and nothing is returned
+  input_lens[1] = 0;
+  CU_ASSERT(tpm2_kmyth_seal_batch(3, inputs, input_lens, outputs, output_lens,
+                                  NULL, 0, NULL, 0, NULL, 0, NULL,
+                                  NULL) == 1);
+  for (size_t i = 0; i < 3; i++)
+  {
+    CU_ASSERT(outputs[i] == NULL);
+    CU_ASSERT(output_lens[i] == 0);
+  }
+  input_lens[1] = sizeof(input1);
+
+  // Check that a valid batch produces one unsealable .ski per input, all
+  // sharing the same storage key
+  CU_ASSERT(tpm2_kmyth_seal_batch(3, inputs, input_lens, outputs, output_lens,
+                                  NULL, 0, NULL, 0, NULL, 0, NULL,
+                                  NULL) == 0);
+
+  Ski ski0 = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes(outputs[0], output_lens[0], &ski0, 0) == 0);
+  for (size_t i = 0; i < 3; i++)
+  {
+    uint8_t *plaintext = NULL;
+    size_t plaintext_len = 0;
+    Ski ski = get_default_ski();
+
+    CU_ASSERT(tpm2_kmyth_unseal(outputs[i], output_lens[i],
+                                &plaintext, &plaintext_len,
+                                NULL, 0, NULL, 0, 0) == 0);
+    CU_ASSERT(plaintext_len == input_lens[i]);
+    CU_ASSERT(memcmp(plaintext, inputs[i], input_lens[i]) == 0);
+
+    CU_ASSERT(parse_ski_bytes(outputs[i], output_lens[i], &ski, 0) == 0);
+    CU_ASSERT(ski.sk_pub.size == ski0.sk_pub.size);
+    CU_ASSERT(memcmp(&ski.sk_pub, &ski0.sk_pub, sizeof(TPM2B_PUBLIC)) == 0);
+
+    free_ski(&ski);
+    free(plaintext);
+    free(outputs[i]);
+  }
+  free_ski(&ski0);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_unseal_batch
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_unseal_batch(void)
+{
+  uint8_t input0[8] = { 0x00 };
+  uint8_t input1[5] = { 0x01, 0x02, 0x03, 0x04, 0x05 };
+
+  uint8_t *inputs[2] = { input0, input1 };
+  size_t input_lens[2] = { sizeof(input0), sizeof(input1) };
+
+  uint8_t *sealed[2] = { NULL };
+  size_t sealed_lens[2] = { 0 };
+
+  CU_ASSERT(tpm2_kmyth_seal_batch(2, inputs, input_lens, sealed, sealed_lens,
+                                  NULL, 0, NULL, 0, NULL, 0, NULL,
+                                  NULL) == 0);
+
+  // batch: two valid items (one repeated) around a bogus one
+  uint8_t bogus[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+  uint8_t *ski_inputs[4] = { sealed[0], bogus, sealed[1], sealed[0] };
+  size_t ski_lens[4] = { sealed_lens[0], sizeof(bogus), sealed_lens[1],
+    sealed_lens[0]
+  };
+  uint8_t *outputs[4] = { NULL };
+  size_t output_lens[4] = { 0 };
+  int results[4] = { 0 };
+
+  // Check that invalid batch arguments are rejected
+  CU_ASSERT(tpm2_kmyth_unseal_batch(0, ski_inputs, ski_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_batch(4, ski_inputs, ski_lens, outputs,
+                                    output_lens, NULL, NULL, 0, NULL, 0,
+                                    0) == 1);
+
+  // Check that one bad item is reported without failing the others
+  CU_ASSERT(tpm2_kmyth_unseal_batch(4, ski_inputs, ski_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(results[0] == 0);
+  CU_ASSERT(results[1] == 1);
+  CU_ASSERT(results[2] == 0);
+  CU_ASSERT(results[3] == 0);
+  CU_ASSERT(outputs[1] == NULL);
+  CU_ASSERT(output_lens[1] == 0);
+  CU_ASSERT(output_lens[0] == sizeof(input0));
+  CU_ASSERT(memcmp(outputs[0], input0, sizeof(input0)) == 0);
+  CU_ASSERT(output_lens[2] == sizeof(input1));
+  CU_ASSERT(memcmp(outputs[2], input1, sizeof(input1)) == 0);
+  CU_ASSERT(output_lens[3] == sizeof(input0));
+  CU_ASSERT(memcmp(outputs[3], input0, sizeof(input0)) == 0);
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    free(outputs[i]);
+    outputs[i] = NULL;
+  }
+
+  // Check that an all-valid batch succeeds
+  CU_ASSERT(tpm2_kmyth_unseal_batch(2, sealed, sealed_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 0);
+  CU_ASSERT(results[0] == 0);
+  CU_ASSERT(results[1] == 0);
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    free(outputs[i]);
+    outputs[i] = NULL;
+  }
+
+  // Check that interleaved policy groups are each unsealed (and decrypted)
+  // completely, including the last item of each group
+  int pcrs[1] = { 0 };
+  uint8_t *pcr_sealed = NULL;
+  size_t pcr_sealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal(input1, sizeof(input1), &pcr_sealed,
+                            &pcr_sealed_len, NULL, 0, NULL, 0, pcrs, 1,
+                            NULL, NULL, 0) == 0);
+
+  uint8_t *mixed_inputs[4] = { sealed[0], pcr_sealed, sealed[1], pcr_sealed };
+  size_t mixed_lens[4] = { sealed_lens[0], pcr_sealed_len, sealed_lens[1],
+    pcr_sealed_len
+  };
+
+  CU_ASSERT(tpm2_kmyth_unseal_batch(4, mixed_inputs, mixed_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 0);
+  for (size_t i = 0; i < 4; i++)
+  {
+    CU_ASSERT(results[i] == 0);
+  }
+  CU_ASSERT(output_lens[0] == sizeof(input0));
+  CU_ASSERT(memcmp(outputs[0], input0, sizeof(input0)) == 0);
+  for (size_t i = 1; i < 4; i++)
+  {
+    CU_ASSERT(output_lens[i] == sizeof(input1));
+    CU_ASSERT(memcmp(outputs[i], input1, sizeof(input1)) == 0);
+  }
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    free(outputs[i]);
+  }
+  free(pcr_sealed);
+  for (size_t i = 0; i < 2; i++)
+  {
+    free(sealed[i]);
+  }
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_reseal
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_reseal(void)
+{
+  uint8_t input[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &sealed, &sealed_len,
+                            NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0) == 0);
+
+  // Check that a reseal with the same cipher keeps the encrypted data but
+  // uses a new storage key and wrapping key object
+  uint8_t *resealed = NULL;
+  size_t resealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_reseal(sealed, sealed_len, &resealed, &resealed_len,
+                              NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0) == 0);
+
+  Ski old_ski = get_default_ski();
+  Ski new_ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes(sealed, sealed_len, &old_ski, 0) == 0);
+  CU_ASSERT(parse_ski_bytes(resealed, resealed_len, &new_ski, 0) == 0);
+  CU_ASSERT(new_ski.enc_data_size == old_ski.enc_data_size);
+  CU_ASSERT(memcmp(new_ski.enc_data, old_ski.enc_data,
+                   old_ski.enc_data_size) == 0);
+  CU_ASSERT(memcmp(&new_ski.sk_pub, &old_ski.sk_pub,
+                   sizeof(TPM2B_PUBLIC)) != 0);
+  free_ski(&new_ski);
+
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal(resealed, resealed_len,
+                              &plaintext, &plaintext_len,
+                              NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == sizeof(input));
+  CU_ASSERT(memcmp(plaintext, input, sizeof(input)) == 0);
+  free(plaintext);
+  free(resealed);
+
+  // Check that a reseal to a new cipher re-encrypts the data
+  resealed = NULL;
+  resealed_len = 0;
+  CU_ASSERT(tpm2_kmyth_reseal(sealed, sealed_len, &resealed, &resealed_len,
+                              NULL, 0, NULL, 0, NULL, 0,
+                              "AES/KeyWrap/RFC5649Padding/256", NULL,
+                              0) == 0);
+  CU_ASSERT(parse_ski_bytes(resealed, resealed_len, &new_ski, 0) == 0);
+  CU_ASSERT(strcmp(new_ski.cipher.cipher_name,
+                   "AES/KeyWrap/RFC5649Padding/256") == 0);
+  free_ski(&new_ski);
+
+  plaintext = NULL;
+  plaintext_len = 0;
+  CU_ASSERT(tpm2_kmyth_unseal(resealed, resealed_len,
+                              &plaintext, &plaintext_len,
+                              NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == sizeof(input));
+  CU_ASSERT(memcmp(plaintext, input, sizeof(input)) == 0);
+  free(plaintext);
+  free(resealed);
+
+  // Check that the wrong authorization is rejected and returns nothing
+  resealed = NULL;
+  resealed_len = 0;
+  CU_ASSERT(tpm2_kmyth_reseal(sealed, sealed_len, &resealed, &resealed_len,
+                              (uint8_t *) "wrong", 5, NULL, 0, NULL, 0, NULL,
+                              NULL, 0) == 1);
+  CU_ASSERT(resealed == NULL);
+
+  // Check that a policy-only reseal of data sealed to PCRs has to replace
+  // the storage key (it shares the old policy), but gives the new one a
+  // policy that a later policy-only reseal, to other PCRs, can keep
+  int pcrs[] = { 0, 7 };
+  uint8_t *pcr_sealed = NULL;
+  size_t pcr_sealed_len = 0;
+  uint8_t *first = NULL;
+  size_t first_len = 0;
+  Ski pcr_ski = get_default_ski();
+  Ski first_ski = get_default_ski();
+
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &pcr_sealed,
+                            &pcr_sealed_len, NULL, 0, NULL, 0, pcrs, 1, NULL,
+                            NULL, 0) == 0);
+  set_sk_reuse(true);
+  CU_ASSERT(tpm2_kmyth_reseal(pcr_sealed, pcr_sealed_len, &first,
+                              &first_len, NULL, 0, NULL, 0, pcrs, 1, NULL,
+                              NULL, 0) == 0);
+  CU_ASSERT(parse_ski_bytes(pcr_sealed, pcr_sealed_len, &pcr_ski, 0) == 0);
+  CU_ASSERT(parse_ski_bytes(first, first_len, &first_ski, 0) == 0);
+  CU_ASSERT(memcmp(&first_ski.sk_pub, &pcr_ski.sk_pub,
+                   sizeof(TPM2B_PUBLIC)) != 0);
+
+  resealed = NULL;
+  resealed_len = 0;
+  CU_ASSERT(tpm2_kmyth_reseal(first, first_len, &resealed, &resealed_len,
+                              NULL, 0, NULL, 0, pcrs, 2, NULL, NULL, 0) == 0);
+  CU_ASSERT(parse_ski_bytes(resealed, resealed_len, &new_ski, 0) == 0);
+  CU_ASSERT(memcmp(&new_ski.sk_pub, &first_ski.sk_pub,
+                   sizeof(TPM2B_PUBLIC)) == 0);
+  CU_ASSERT(memcmp(&new_ski.sk_priv, &first_ski.sk_priv,
+                   sizeof(TPM2B_PRIVATE)) == 0);
+  CU_ASSERT(memcmp(&new_ski.wk_pub.publicArea.authPolicy,
+                   &first_ski.wk_pub.publicArea.authPolicy,
+                   sizeof(TPM2B_DIGEST)) != 0);
+  CU_ASSERT(memcmp(&new_ski.pcr_list, &first_ski.pcr_list,
+                   sizeof(TPML_PCR_SELECTION)) != 0);
+  CU_ASSERT(new_ski.enc_data_size == first_ski.enc_data_size);
+  CU_ASSERT(memcmp(new_ski.enc_data, first_ski.enc_data,
+                   first_ski.enc_data_size) == 0);
+  free_ski(&new_ski);
+  set_sk_reuse(false);
+
+  plaintext = NULL;
+  plaintext_len = 0;
+  CU_ASSERT(tpm2_kmyth_unseal(resealed, resealed_len,
+                              &plaintext, &plaintext_len,
+                              NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == sizeof(input));
+  CU_ASSERT(memcmp(plaintext, input, sizeof(input)) == 0);
+  free(plaintext);
+  free(resealed);
+
+  free_ski(&first_ski);
+  free_ski(&pcr_ski);
+  free(first);
+  free(pcr_sealed);
+  free_ski(&old_ski);
+  free(sealed);
+}
+
 //--------------------------------------------------------------------------------
 // test_tpm2_kmyth_seal_file
 //--------------------------------------------------------------------------------
@@ -260,8 +613,7 @@ void test_tpm2_kmyth_seal_data(void)
   init_pcr_selection(sapi_ctx, NULL, 0, &ski.pcr_list);
 
   TPM2B_DIGEST authPolicy = {.size = 0 };
-  TPM2B_DIGEST policyBranch1 = {.size = 0 };
-  TPM2B_DIGEST policyBranch2 = {.size = 0 };
+  TPML_DIGEST policyBranches = {.count = 0 };
   create_policy_digest(sapi_ctx, ski.pcr_list, &authPolicy);
 
   TPM2_HANDLE srk_handle = 0;
@@ -271,7 +623,8 @@ void test_tpm2_kmyth_seal_data(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, authVal, authVal, ski.pcr_list,
-                     authPolicy, &sk_handle, &ski.sk_priv, &ski.sk_pub);
+                     authPolicy, KMYTH_KEY_PUBKEY_ALG, &sk_handle,
+                     &ski.sk_priv, &ski.sk_pub);
 
   uint8_t data[8] = { 0 };
   size_t data_len = 8;
@@ -280,35 +633,35 @@ void test_tpm2_kmyth_seal_data(void)
   CU_ASSERT(tpm2_kmyth_seal_data
             (sapi_ctx, data, data_len, sk_handle, authVal, ski.pcr_list,
              authVal, ski.pcr_list,
-	     authPolicy, policyBranch1, policyBranch2,
+	     authPolicy, policyBranches,
 	     &ski.wk_pub, &ski.wk_priv) == 0);
 
   // Check failure with NULL context.
   CU_ASSERT(tpm2_kmyth_seal_data
             (NULL, data, data_len, sk_handle, authVal, ski.pcr_list, authVal,
              ski.pcr_list,
-	     authPolicy, policyBranch1, policyBranch2,
+	     authPolicy, policyBranches,
 	     &ski.wk_pub, &ski.wk_priv) == 1);
 
   // Failure with NULL data.
   CU_ASSERT(tpm2_kmyth_seal_data
             (sapi_ctx, NULL, data_len, sk_handle, authVal, ski.pcr_list,
              authVal, ski.pcr_list,
-	     authPolicy, policyBranch1, policyBranch2,
+	     authPolicy, policyBranches,
 	     &ski.wk_pub, &ski.wk_priv) == 1);
 
   // Failure with length 0 data
   CU_ASSERT(tpm2_kmyth_seal_data
             (sapi_ctx, data, 0, sk_handle, authVal, ski.pcr_list, authVal,
              ski.pcr_list,
-	     authPolicy, policyBranch1, policyBranch2,
+	     authPolicy, policyBranches,
 	     &ski.wk_pub, &ski.wk_priv) == 1);
 
   // Failure with NULL length 0 data
   CU_ASSERT(tpm2_kmyth_seal_data
             (sapi_ctx, NULL, 0, sk_handle, authVal, ski.pcr_list, authVal,
              ski.pcr_list,
-	     authPolicy, policyBranch1, policyBranch2,
+	     authPolicy, policyBranches,
 	     &ski.wk_pub, &ski.wk_priv) == 1);
 
   free_tpm2_resources(&sapi_ctx);
@@ -330,8 +683,7 @@ void test_tpm2_kmyth_unseal_data(void)
   init_pcr_selection(sapi_ctx, NULL, 0, &ski.pcr_list);
 
   TPM2B_DIGEST authPolicy = {.size = 0 };
-  TPM2B_DIGEST policyBranch1 = {.size = 0 };
-  TPM2B_DIGEST policyBranch2 = {.size = 0 };
+  TPML_DIGEST policyBranches = {.count = 0 };
   create_policy_digest(sapi_ctx, ski.pcr_list, &authPolicy);
 
   TPM2_HANDLE srk_handle = 0;
@@ -341,14 +693,15 @@ void test_tpm2_kmyth_unseal_data(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, authVal, authVal, ski.pcr_list,
-                     authPolicy, &sk_handle, &ski.sk_priv, &ski.sk_pub);
+                     authPolicy, KMYTH_KEY_PUBKEY_ALG, &sk_handle,
+                     &ski.sk_priv, &ski.sk_pub);
 
   uint8_t input_data[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
   size_t input_data_len = 8;
 
   tpm2_kmyth_seal_data(sapi_ctx, input_data, input_data_len, sk_handle, authVal,
                        ski.pcr_list, authVal, ski.pcr_list,
-		       authPolicy, policyBranch1, policyBranch2,
+		       authPolicy, policyBranches,
                        &ski.wk_pub, &ski.wk_priv);
 
   uint8_t *output_data = NULL;
@@ -358,7 +711,7 @@ void test_tpm2_kmyth_unseal_data(void)
   CU_ASSERT(tpm2_kmyth_unseal_data
             (sapi_ctx, sk_handle, ski.wk_pub, ski.wk_priv, authVal,
              ski.pcr_list,
-	     authPolicy, policyBranch1, policyBranch2,
+	     authPolicy, policyBranches, NULL,
 	     &output_data, &output_data_len) == 0);
   CU_ASSERT(output_data_len == 8);
   CU_ASSERT(memcmp(output_data, input_data, 8) == 0);
@@ -370,9 +723,319 @@ void test_tpm2_kmyth_unseal_data(void)
   // Check failure with NULL context.
   CU_ASSERT(tpm2_kmyth_unseal_data
             (NULL, sk_handle, ski.wk_pub, ski.wk_priv, authVal, ski.pcr_list,
-             authPolicy, policyBranch1, policyBranch2,
+             authPolicy, policyBranches, NULL,
 	     &output_data, &output_data_len) == 1);
   CU_ASSERT(output_data_len == 0);
 
   free_tpm2_resources(&sapi_ctx);
 }
+
+//--------------------------------------------------------------------------------
+// test_kmyth_compute_policy
+//--------------------------------------------------------------------------------
+void test_kmyth_compute_policy(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+
+  char *policy = NULL;
+  char *trial = NULL;
+  int pcrs[2] = { 0, 7 };
+  uint8_t values[2 * KMYTH_DIGEST_SIZE];
+
+  // Invalid arguments are rejected
+  CU_ASSERT(kmyth_compute_policy(NULL, 0, NULL, 0, NULL, NULL) == 1);
+  CU_ASSERT(kmyth_compute_policy(pcrs, 2, values, KMYTH_DIGEST_SIZE, NULL,
+                                 &policy) == 1);
+  CU_ASSERT(policy == NULL);
+  int bad_pcr = KMYTH_DEFAULT_PCR_COUNT;
+
+  CU_ASSERT(kmyth_compute_policy(&bad_pcr, 1, values, KMYTH_DIGEST_SIZE,
+                                 NULL, &policy) == 1);
+
+  // Without PCRs the digest matches a trial-only seal
+  CU_ASSERT(kmyth_compute_policy(NULL, 0, NULL, 0, NULL, &policy) == 0);
+  CU_ASSERT(policy != NULL && strlen(policy) == 2 * KMYTH_DIGEST_SIZE);
+
+  TPML_PCR_SELECTION pcrList;
+  TPM2B_DIGEST expected = {.size = 0, };
+  char expected_string[(2 * KMYTH_DIGEST_SIZE) + 1];
+
+  CU_ASSERT(init_pcr_selection(sapi_ctx, NULL, 0, &pcrList) == 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrList, &expected) == 0);
+  convert_digest_to_string(&expected, expected_string);
+  CU_ASSERT(strcmp(policy, expected_string) == 0);
+  free(policy);
+  policy = NULL;
+
+  // With PCRs, the values read from the TPM give the trial session's digest
+  TPML_PCR_SELECTION pcrsRead = {.count = 0, };
+  TPML_DIGEST pcrValues = {.count = 0, };
+  uint32_t pcrUpdateCounter = 0;
+
+  CU_ASSERT(init_pcr_selection(sapi_ctx, pcrs, 2, &pcrList) == 0);
+  CU_ASSERT(Tss2_Sys_PCR_Read(sapi_ctx, NULL, &pcrList, &pcrUpdateCounter,
+                              &pcrsRead, &pcrValues, NULL) == TSS2_RC_SUCCESS);
+  CU_ASSERT(pcrValues.count == 2);
+  memcpy(values, pcrValues.digests[0].buffer, KMYTH_DIGEST_SIZE);
+  memcpy(values + KMYTH_DIGEST_SIZE, pcrValues.digests[1].buffer,
+         KMYTH_DIGEST_SIZE);
+  CU_ASSERT(kmyth_compute_policy(pcrs, 2, values, sizeof(values), NULL,
+                                 &policy) == 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrList, &expected) == 0);
+  convert_digest_to_string(&expected, expected_string);
+  CU_ASSERT(strcmp(policy, expected_string) == 0);
+
+  // A compound policy matches the trial session's PolicyOR digest, for one
+  // or more expected policies
+  TPML_DIGEST branches = {.count = 0, };
+  TPM2B_DIGEST compound = {.size = 0, };
+  char expected_list[KMYTH_MAX_POLICY_BRANCHES *
+                     (2 * KMYTH_DIGEST_SIZE + 1)] = "";
+
+  CU_ASSERT(kmyth_compute_policy(NULL, 0, NULL, 0, NULL, &trial) == 0);
+  branches.digests[0] = expected;
+  for (branches.count = KMYTH_MIN_POLICY_BRANCHES;
+       branches.count <= KMYTH_MAX_POLICY_BRANCHES; branches.count++)
+  {
+    CU_ASSERT(convert_string_to_digest(trial,
+                                       &branches.digests[branches.count -
+                                                         1]) == 0);
+    if (branches.count > KMYTH_MIN_POLICY_BRANCHES)
+    {
+      strcat(expected_list, ",");
+    }
+    strcat(expected_list, trial);
+    free(policy);
+    policy = NULL;
+    CU_ASSERT(kmyth_compute_policy(pcrs, 2, values, sizeof(values),
+                                   expected_list, &policy) == 0);
+    CU_ASSERT(create_policy_or_digest(sapi_ctx, &branches, &compound) == 0);
+    convert_digest_to_string(&compound, expected_string);
+    CU_ASSERT(policy != NULL && strcmp(policy, expected_string) == 0);
+  }
+
+  // The current policy and eight expected ones do not fit a PolicyOR
+  strcat(expected_list, ",");
+  strcat(expected_list, trial);
+  free(policy);
+  policy = NULL;
+  CU_ASSERT(kmyth_compute_policy(pcrs, 2, values, sizeof(values),
+                                 expected_list, &policy) != 0);
+  CU_ASSERT(policy == NULL);
+
+  free(policy);
+  free(trial);
+  free_tpm2_resources(&sapi_ctx);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_unseal_stream
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_unseal_stream(void)
+{
+  char plain_path[] = "/tmp/kmyth_stream_plainXXXXXX";
+  char sealed_path[] = "/tmp/kmyth_stream_sealedXXXXXX";
+  char result_path[] = "/tmp/kmyth_stream_resultXXXXXX";
+  int plain_fd = mkstemp(plain_path);
+  int sealed_fd = mkstemp(sealed_path);
+  int result_fd = mkstemp(result_path);
+
+  CU_ASSERT(plain_fd != -1 && sealed_fd != -1 && result_fd != -1);
+  close(sealed_fd);
+  close(result_fd);
+
+  // several chunks, so the unseal has to stream across chunk boundaries
+  size_t plain_len = 3 * 65536 + 11;
+  uint8_t *plain = malloc(plain_len);
+
+  for (size_t i = 0; i < plain_len; i++)
+  {
+    plain[i] = (uint8_t) (i * 13);
+  }
+  CU_ASSERT(write(plain_fd, plain, plain_len) == (ssize_t) plain_len);
+  close(plain_fd);
+
+  // Only streaming ciphers and valid paths are accepted
+  CU_ASSERT(tpm2_kmyth_seal_stream(plain_path, sealed_path, NULL, 0, NULL, 0,
+                                   NULL, 0, "AES/GCM/NoPadding/256",
+                                   NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_seal_stream("fake input path", sealed_path, NULL, 0,
+                                   NULL, 0, NULL, 0, NULL, NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_stream("fake input path", result_path, NULL, 0,
+                                     NULL, 0, 0) == 1);
+
+  // Seal and unseal round trip
+  CU_ASSERT(tpm2_kmyth_seal_stream(plain_path, sealed_path, NULL, 0, NULL, 0,
+                                   NULL, 0, NULL, NULL) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(sealed_path, result_path, NULL, 0,
+                                     NULL, 0, 0) == 0);
+
+  uint8_t *result = NULL;
+  size_t result_len = 0;
+
+  CU_ASSERT(read_bytes_from_file(result_path, &result, &result_len) == 0);
+  CU_ASSERT(result_len == plain_len);
+  CU_ASSERT(result != NULL && memcmp(result, plain, plain_len) == 0);
+  free(result);
+  result = NULL;
+
+  // Seal from a pipe to stdout, then unseal from stdin (NULL paths)
+  int pipe_fds[2];
+
+  CU_ASSERT(pipe(pipe_fds) == 0);
+  pid_t writer = fork();
+
+  if (writer == 0)
+  {
+    close(pipe_fds[0]);
+    size_t written = 0;
+
+    while (written < plain_len)
+    {
+      ssize_t n = write(pipe_fds[1], plain + written, plain_len - written);
+
+      if (n <= 0)
+      {
+        _exit(1);
+      }
+      written += (size_t) n;
+    }
+    _exit(0);
+  }
+  close(pipe_fds[1]);
+
+  int saved_stdin = dup(STDIN_FILENO);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int sealed_out = open(sealed_path, O_WRONLY | O_TRUNC);
+
+  fflush(stdout);
+  dup2(pipe_fds[0], STDIN_FILENO);
+  dup2(sealed_out, STDOUT_FILENO);
+  clearerr(stdin);
+  CU_ASSERT(tpm2_kmyth_seal_stream(NULL, NULL, NULL, 0, NULL, 0, NULL, 0,
+                                   NULL, NULL) == 0);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(sealed_out);
+  close(pipe_fds[0]);
+  waitpid(writer, NULL, 0);
+
+  int sealed_in = open(sealed_path, O_RDONLY);
+
+  dup2(sealed_in, STDIN_FILENO);
+  clearerr(stdin);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(NULL, result_path, NULL, 0, NULL, 0,
+                                     0) == 0);
+  dup2(saved_stdin, STDIN_FILENO);
+  clearerr(stdin);
+  close(sealed_in);
+  close(saved_stdin);
+  close(saved_stdout);
+
+  CU_ASSERT(read_bytes_from_file(result_path, &result, &result_len) == 0);
+  CU_ASSERT(result_len == plain_len);
+  CU_ASSERT(result != NULL && memcmp(result, plain, plain_len) == 0);
+  free(result);
+  result = NULL;
+
+  // A streamed file is not a plain .ski
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_file(sealed_path, &output, &output_len, NULL, 0,
+                                   NULL, 0, 0) == 1);
+
+  // A truncated sealed file fails and leaves no output behind
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(read_bytes_from_file(sealed_path, &sealed, &sealed_len) == 0);
+  CU_ASSERT(write_bytes_to_file(sealed_path, sealed, sealed_len - 1) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(sealed_path, result_path, NULL, 0,
+                                     NULL, 0, 0) == 1);
+  CU_ASSERT(access(result_path, F_OK) == -1);
+
+  free(sealed);
+  free(plain);
+  unlink(plain_path);
+  unlink(sealed_path);
+  unlink(result_path);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_sealed_reader
+//--------------------------------------------------------------------------------
+void test_kmyth_sealed_reader(void)
+{
+  char plain_path[] = "/tmp/kmyth_reader_plainXXXXXX";
+  char sealed_path[] = "/tmp/kmyth_reader_sealedXXXXXX";
+  int plain_fd = mkstemp(plain_path);
+  int sealed_fd = mkstemp(sealed_path);
+
+  CU_ASSERT(plain_fd != -1 && sealed_fd != -1);
+  close(sealed_fd);
+
+  size_t plain_len = 3 * 65536 + 11;
+  uint8_t *plain = malloc(plain_len);
+
+  for (size_t i = 0; i < plain_len; i++)
+  {
+    plain[i] = (uint8_t) (i * 7);
+  }
+  CU_ASSERT(write(plain_fd, plain, plain_len) == (ssize_t) plain_len);
+  close(plain_fd);
+  CU_ASSERT(tpm2_kmyth_seal_stream(plain_path, sealed_path, NULL, 0, NULL, 0,
+                                   NULL, 0, NULL, NULL) == 0);
+
+  kmyth_ctx_t *ctx = NULL;
+  kmyth_sealed_reader_t *reader = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(kmyth_sealed_reader_open(ctx, "fake input path", NULL, 0, NULL, 0,
+                                     0, &reader) == 1);
+  CU_ASSERT(reader == NULL);
+  CU_ASSERT(kmyth_sealed_reader_open(ctx, sealed_path, NULL, 0, NULL, 0, 0,
+                                     &reader) == 0);
+  CU_ASSERT(kmyth_sealed_reader_size(reader) == plain_len);
+
+  // ranges within a chunk, across chunk boundaries, and up to (or past)
+  // the end of the plaintext
+  uint64_t offsets[] = { 0, 100, 65536 - 5, 2 * 65536 - 1, plain_len - 11,
+    plain_len - 1, plain_len, plain_len + 100
+  };
+  size_t lens[] = { 1, 1000, 10, 65538, 11, 10, 10, 10 };
+  uint8_t *buf = malloc(65538);
+
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+  {
+    size_t read_len = 0;
+    size_t expected = (offsets[i] >= plain_len) ? 0 :
+      (lens[i] < plain_len - offsets[i]) ? lens[i] : plain_len - offsets[i];
+
+    CU_ASSERT(kmyth_sealed_reader_pread(reader, buf, lens[i], offsets[i],
+                                        &read_len) == 0);
+    CU_ASSERT(read_len == expected);
+    CU_ASSERT(expected == 0 ||
+              memcmp(buf, plain + offsets[i], expected) == 0);
+  }
+  kmyth_sealed_reader_close(&reader);
+  CU_ASSERT(reader == NULL);
+
+  // a truncated file does not open
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(read_bytes_from_file(sealed_path, &sealed, &sealed_len) == 0);
+  CU_ASSERT(write_bytes_to_file(sealed_path, sealed, sealed_len - 1) == 0);
+  CU_ASSERT(kmyth_sealed_reader_open(ctx, sealed_path, NULL, 0, NULL, 0, 0,
+                                     &reader) == 1);
+
+  kmyth_ctx_destroy(&ctx);
+  free(sealed);
+  free(buf);
+  free(plain);
+  unlink(plain_path);
+  unlink(sealed_path);
+}
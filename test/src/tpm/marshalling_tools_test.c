@@ -116,6 +116,29 @@ int marshalling_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Binary (v2) .ski Tests", test_ski_bytes_v2))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, ".ski Compression Tests",
+                          test_ski_compression))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "parse_ski_header() Tests", test_parse_ski_header))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "parse_ski_bytes_borrowed() Tests",
+                          test_parse_ski_bytes_borrowed))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "free_ski() Tests", test_free_ski))
   {
     return 1;
@@ -1771,6 +1794,338 @@ void test_create_ski_bytes(void)
   CU_ASSERT(sb_len == 0);
 }
 
+//----------------------------------------------------------------------------
+// test_ski_bytes_v2
+//----------------------------------------------------------------------------
+void test_ski_bytes_v2(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                            &ski, 0) == 0);
+
+  // the binary form is smaller than the text form and carries the
+  // encrypted data as is
+  uint8_t *v2 = NULL;
+  size_t v2_len = 0;
+  size_t total_len = 0;
+
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 0);
+  CU_ASSERT(v2_len < ski_bytes_len);
+  CU_ASSERT(is_ski_v2(v2, v2_len));
+  CU_ASSERT(!is_ski_v2((uint8_t *) CONST_SKI_BYTES, ski_bytes_len));
+  CU_ASSERT(get_ski_v2_length(v2, KMYTH_SKI_V2_HEADER_LEN, &total_len) == 0);
+  CU_ASSERT(total_len == v2_len);
+  CU_ASSERT(memcmp(v2 + v2_len - ski.enc_data_size, ski.enc_data,
+                   ski.enc_data_size) == 0);
+
+  // parse_ski_bytes() detects the format, and the parsed struct converts
+  // back into the original text .ski
+  Ski ski2 = get_default_ski();
+  uint8_t *text = NULL;
+  size_t text_len = 0;
+
+  CU_ASSERT(parse_ski_bytes(v2, v2_len, &ski2, 1) == 0);
+  CU_ASSERT(ski2.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(ski2.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+  CU_ASSERT(strcmp(ski2.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(ski2.sk_pub.size == ski.sk_pub.size);
+  CU_ASSERT(ski2.wk_priv.size == ski.wk_priv.size);
+  CU_ASSERT(ski2.policyBranches.count == 0);
+  CU_ASSERT(create_ski_bytes(ski2, &text, &text_len) == 0);
+  CU_ASSERT(text_len == ski_bytes_len);
+  CU_ASSERT(memcmp(text, CONST_SKI_BYTES, text_len) == 0);
+  free(text);
+  free_ski(&ski2);
+
+  // set_ski_format() switches create_ski_bytes() to the binary form
+  CU_ASSERT(get_ski_format() == KMYTH_SKI_FORMAT_TEXT);
+  CU_ASSERT(set_ski_format(KMYTH_SKI_FORMAT_V2) == 0);
+  CU_ASSERT(create_ski_bytes(ski, &text, &text_len) == 0);
+  CU_ASSERT(text_len == v2_len);
+  CU_ASSERT(memcmp(text, v2, v2_len) == 0);
+  free(text);
+  CU_ASSERT(set_ski_format((kmyth_ski_format) 7) == 1);
+  CU_ASSERT(set_ski_format(KMYTH_SKI_FORMAT_TEXT) == 0);
+
+  // truncated, extended or corrupted input is rejected
+  uint8_t *bad = malloc(v2_len + 1);
+
+  memcpy(bad, v2, v2_len);
+  bad[v2_len] = 0;
+  CU_ASSERT(parse_ski_bytes(bad, v2_len - 1, &ski2, 0) == 1);
+  CU_ASSERT(parse_ski_bytes(bad, v2_len + 1, &ski2, 0) == 1);
+  CU_ASSERT(parse_ski_bytes(bad, KMYTH_SKI_V2_HEADER_LEN - 1, &ski2, 0) == 1);
+
+  // unsupported version
+  bad[5] = KMYTH_SKI_V2_VERSION + 1;
+  CU_ASSERT(parse_ski_bytes(bad, v2_len, &ski2, 0) == 1);
+  bad[5] = KMYTH_SKI_V2_VERSION;
+  CU_ASSERT(parse_ski_bytes(bad, v2_len, &ski2, 0) == 0);
+  free_ski(&ski2);
+
+  // missing section (count lowered by one)
+  bad[7]--;
+  CU_ASSERT(parse_ski_bytes(bad, v2_len, &ski2, 0) == 1);
+  bad[7]++;
+
+  // unknown and repeated section types (first one is the PCR list)
+  bad[KMYTH_SKI_V2_HEADER_LEN + 1] = 0x7f;
+  CU_ASSERT(parse_ski_bytes(bad, v2_len, &ski2, 0) == 1);
+  bad[KMYTH_SKI_V2_HEADER_LEN + 1] = KMYTH_SKI_V2_SYM_KEY_PRIVATE;
+  CU_ASSERT(parse_ski_bytes(bad, v2_len, &ski2, 0) == 1);
+  bad[KMYTH_SKI_V2_HEADER_LEN + 1] = KMYTH_SKI_V2_PCR_SELECTION_LIST;
+
+  // section length running past the table
+  bad[KMYTH_SKI_V2_HEADER_LEN + 2] = 0xff;
+  CU_ASSERT(parse_ski_bytes(bad, v2_len, &ski2, 0) == 1);
+
+  free(bad);
+  free(v2);
+
+  // empty sections cannot be written
+  CU_ASSERT(create_ski_bytes_v2(get_default_ski(), &v2, &v2_len) == 1);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_ski_compression
+//----------------------------------------------------------------------------
+void test_ski_compression(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                            &ski, 0) == 0);
+  CU_ASSERT(ski.compression == KMYTH_COMPRESSION_NONE);
+
+  // the compression ends the cipher suite block of a text .ski, and
+  // survives a round trip through both formats
+  uint8_t *text = NULL;
+  size_t text_len = 0;
+  uint8_t *v2 = NULL;
+  size_t v2_len = 0;
+  Ski ski2 = get_default_ski();
+
+  ski.compression = KMYTH_COMPRESSION_DEFLATE;
+  CU_ASSERT(create_ski_bytes(ski, &text, &text_len) == 0);
+  CU_ASSERT(text_len == ski_bytes_len + strlen(KMYTH_DELIM_COMPRESSION) +
+            strlen(KMYTH_COMPRESSION_DEFLATE_NAME) + 1);
+  const char *block = KMYTH_DELIM_CIPHER_SUITE "AES/GCM/NoPadding/256\n"
+    KMYTH_DELIM_COMPRESSION KMYTH_COMPRESSION_DEFLATE_NAME "\n"
+    KMYTH_DELIM_SYM_KEY_PUBLIC;
+
+  CU_ASSERT(memmem(text, text_len, block, strlen(block)) != NULL);
+  CU_ASSERT(parse_ski_bytes(text, text_len, &ski2, 0) == 0);
+  CU_ASSERT(ski2.compression == KMYTH_COMPRESSION_DEFLATE);
+  CU_ASSERT(strcmp(ski2.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  free_ski(&ski2);
+
+  CU_ASSERT(parse_ski_header(text, text_len, &ski2) == 0);
+  CU_ASSERT(ski2.compression == KMYTH_COMPRESSION_DEFLATE);
+
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 0);
+  CU_ASSERT(parse_ski_bytes(v2, v2_len, &ski2, 0) == 0);
+  CU_ASSERT(ski2.compression == KMYTH_COMPRESSION_DEFLATE);
+  free_ski(&ski2);
+
+  // an unknown compression is rejected rather than ignored
+  uint8_t *name = memmem(text, text_len, KMYTH_COMPRESSION_DEFLATE_NAME,
+                         strlen(KMYTH_COMPRESSION_DEFLATE_NAME));
+
+  CU_ASSERT(name != NULL);
+  name[0] = 'x';
+  CU_ASSERT(parse_ski_bytes(text, text_len, &ski2, 0) == 1);
+
+  name = memmem(v2, v2_len, KMYTH_COMPRESSION_DEFLATE_NAME,
+                strlen(KMYTH_COMPRESSION_DEFLATE_NAME));
+  CU_ASSERT(name != NULL);
+  name[0] = 'x';
+  CU_ASSERT(parse_ski_bytes(v2, v2_len, &ski2, 0) == 1);
+
+  free(text);
+  free(v2);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_parse_ski_header
+//----------------------------------------------------------------------------
+void test_parse_ski_header(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+  Ski header = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                            &ski, 0) == 0);
+
+  // everything but the encrypted data is parsed
+  CU_ASSERT(parse_ski_header((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                             &header) == 0);
+  CU_ASSERT(header.enc_data == NULL);
+  CU_ASSERT(header.enc_data_size == 0);
+  CU_ASSERT(strcmp(header.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(memcmp(&header.pcr_list, &ski.pcr_list, sizeof(ski.pcr_list))
+            == 0);
+  CU_ASSERT(header.sk_pub.size == ski.sk_pub.size);
+  CU_ASSERT(header.wk_priv.size == ski.wk_priv.size);
+  CU_ASSERT(header.policyBranches.count == 0);
+
+  // a prefix reaching the encrypted data is enough, a shorter one is not
+  size_t enc_offset = (size_t) (strstr(CONST_SKI_BYTES, KMYTH_DELIM_ENC_DATA)
+                                - CONST_SKI_BYTES);
+
+  header = get_default_ski();
+  CU_ASSERT(parse_ski_header((uint8_t *) CONST_SKI_BYTES,
+                             enc_offset + strlen(KMYTH_DELIM_ENC_DATA),
+                             &header) == 0);
+  CU_ASSERT(header.wk_priv.size == ski.wk_priv.size);
+  CU_ASSERT(parse_ski_header((uint8_t *) CONST_SKI_BYTES, enc_offset - 1,
+                             &header) == 1);
+  CU_ASSERT(parse_ski_header(NULL, ski_bytes_len, &header) == 1);
+
+  // the same holds for the binary format
+  uint8_t *v2 = NULL;
+  size_t v2_len = 0;
+
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 0);
+  header = get_default_ski();
+  CU_ASSERT(parse_ski_header(v2, v2_len - ski.enc_data_size, &header) == 0);
+  CU_ASSERT(header.enc_data == NULL);
+  CU_ASSERT(strcmp(header.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(header.wk_priv.size == ski.wk_priv.size);
+  CU_ASSERT(parse_ski_header(v2, KMYTH_SKI_V2_HEADER_LEN + 1, &header) == 1);
+  free(v2);
+
+  // policy branches (two, as written by older versions, up to the most a
+  // PolicyOR takes) are found without being asked for, in either format
+  uint8_t *text = NULL;
+  size_t text_len = 0;
+  uint32_t counts[] = { KMYTH_MIN_POLICY_BRANCHES, 5,
+    KMYTH_MAX_POLICY_BRANCHES
+  };
+
+  for (uint32_t i = 0; i < KMYTH_MAX_POLICY_BRANCHES; i++)
+  {
+    ski.policyBranches.digests[i].size = 32;
+    memset(ski.policyBranches.digests[i].buffer, 0x11 * (int) (i + 1), 32);
+  }
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+  {
+    ski.policyBranches.count = counts[c];
+    CU_ASSERT(create_ski_bytes(ski, &text, &text_len) == 0);
+    CU_ASSERT((strstr((char *) text, KMYTH_DELIM_POLICY_BRANCH_2) != NULL));
+    header = get_default_ski();
+    CU_ASSERT(parse_ski_header(text, text_len, &header) == 0);
+    CU_ASSERT(digest_list_equal(&header.policyBranches,
+                                &ski.policyBranches));
+    free(text);
+
+    CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 0);
+    header = get_default_ski();
+    CU_ASSERT(parse_ski_header(v2, v2_len, &header) == 0);
+    CU_ASSERT(digest_list_equal(&header.policyBranches,
+                                &ski.policyBranches));
+    free(v2);
+  }
+
+  // a single branch, or an empty one, is not a valid PolicyOR
+  ski.policyBranches.count = 1;
+  CU_ASSERT(create_ski_bytes(ski, &text, &text_len) == 1);
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 1);
+  ski.policyBranches.count = 3;
+  ski.policyBranches.digests[1].size = 0;
+  CU_ASSERT(create_ski_bytes(ski, &text, &text_len) == 1);
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 1);
+
+  // an authorizing key (any public area will do here) is found in either
+  // format, but it replaces policy branches rather than adding to them
+  ski.policyBranches.count = 0;
+  ski.authorizing_key = ski.sk_pub;
+  CU_ASSERT(create_ski_bytes(ski, &text, &text_len) == 0);
+  CU_ASSERT(strstr((char *) text, KMYTH_DELIM_AUTHORIZING_KEY) != NULL);
+  header = get_default_ski();
+  CU_ASSERT(parse_ski_header(text, text_len, &header) == 0);
+  CU_ASSERT(header.authorizing_key.size == ski.sk_pub.size);
+  CU_ASSERT(header.authorizing_key.publicArea.type ==
+            ski.sk_pub.publicArea.type);
+  CU_ASSERT(memcmp(&header.authorizing_key.publicArea.unique,
+                   &ski.sk_pub.publicArea.unique,
+                   sizeof(ski.sk_pub.publicArea.unique)) == 0);
+  CU_ASSERT(memcmp(&header.pcr_list, &ski.pcr_list, sizeof(ski.pcr_list))
+            == 0);
+  free(text);
+
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 0);
+  header = get_default_ski();
+  CU_ASSERT(parse_ski_header(v2, v2_len, &header) == 0);
+  CU_ASSERT(header.authorizing_key.size == ski.sk_pub.size);
+  CU_ASSERT(memcmp(&header.authorizing_key.publicArea.unique,
+                   &ski.sk_pub.publicArea.unique,
+                   sizeof(ski.sk_pub.publicArea.unique)) == 0);
+  free(v2);
+
+  ski.policyBranches.count = 3;
+  ski.policyBranches.digests[1].size = 32;
+  CU_ASSERT(create_ski_bytes(ski, &text, &text_len) == 1);
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 1);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_parse_ski_bytes_borrowed
+//----------------------------------------------------------------------------
+void test_parse_ski_bytes_borrowed(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+  Ski borrowed = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                            &ski, 0) == 0);
+  CU_ASSERT(!ski.enc_data_borrowed);
+
+  // a text .ski still gets a decoded copy of its encrypted data
+  CU_ASSERT(parse_ski_bytes_borrowed((uint8_t *) CONST_SKI_BYTES,
+                                     ski_bytes_len, &borrowed, 0) == 0);
+  CU_ASSERT(!borrowed.enc_data_borrowed);
+  CU_ASSERT(borrowed.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(borrowed.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+  free_ski(&borrowed);
+
+  // the encrypted data of a binary .ski is used where it lies
+  uint8_t *v2 = NULL;
+  size_t v2_len = 0;
+
+  CU_ASSERT(create_ski_bytes_v2(ski, &v2, &v2_len) == 0);
+  borrowed = get_default_ski();
+  CU_ASSERT(parse_ski_bytes_borrowed(v2, v2_len, &borrowed, 0) == 0);
+  CU_ASSERT(borrowed.enc_data_borrowed);
+  CU_ASSERT(borrowed.enc_data == v2 + v2_len - ski.enc_data_size);
+  CU_ASSERT(borrowed.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(borrowed.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+  CU_ASSERT(strcmp(borrowed.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(borrowed.wk_priv.size == ski.wk_priv.size);
+
+  // freeing the struct lets go of the borrowed data without freeing it
+  free_ski(&borrowed);
+  CU_ASSERT(borrowed.enc_data == NULL);
+  CU_ASSERT(borrowed.enc_data_size == 0);
+  CU_ASSERT(!borrowed.enc_data_borrowed);
+  CU_ASSERT(memcmp(v2 + v2_len - ski.enc_data_size, ski.enc_data,
+                   ski.enc_data_size) == 0);
+
+  // malformed input is rejected as by parse_ski_bytes()
+  CU_ASSERT(parse_ski_bytes_borrowed(NULL, v2_len, &borrowed, 0) == 1);
+  CU_ASSERT(parse_ski_bytes_borrowed(v2, v2_len - 1, &borrowed, 0) == 1);
+
+  free(v2);
+  free_ski(&ski);
+}
+
 //----------------------------------------------------------------------------
 // test_free_ski
 //----------------------------------------------------------------------------
@@ -1801,8 +2156,10 @@ void test_get_default_ski(void)
   CU_ASSERT(ski.sk_priv.size == 0);
   CU_ASSERT(ski.wk_pub.size == 0);
   CU_ASSERT(ski.wk_priv.size == 0);
+  CU_ASSERT(ski.compression == KMYTH_COMPRESSION_NONE);
   CU_ASSERT(ski.enc_data == NULL);
   CU_ASSERT(ski.enc_data_size == 0);
+  CU_ASSERT(!ski.enc_data_borrowed);
 }
 
 //----------------------------------------------------------------------------
@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <CUnit/CUnit.h>
 
 #include "defines.h"
@@ -44,6 +45,11 @@ int object_tools_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "compute_kmyth_object_name() Tests",
+                          test_compute_kmyth_object_name))
+  {
+    return 1;
+  }
 
   return 0;
 }
@@ -236,3 +242,48 @@ void test_init_kmyth_object_unique(void)
   CU_ASSERT(init_kmyth_object_unique(objectType, &objectUnique) == 0);
   CU_ASSERT(objectUnique.keyedHash.size == 0);
 }
+
+//----------------------------------------------------------------------------
+// test_compute_kmyth_object_name
+//----------------------------------------------------------------------------
+void test_compute_kmyth_object_name(void)
+{
+  TPM2B_DIGEST emptyAuthPolicy = { 0 };
+  TPM2B_PUBLIC objPublic = { 0 };
+  TPM2B_NAME objName = { 0 };
+  TPM2B_NAME objName2 = { 0 };
+
+  CU_ASSERT(init_kmyth_object_template(true, emptyAuthPolicy,
+                                       &objPublic.publicArea) == 0);
+  CU_ASSERT(init_kmyth_object_attributes(true,
+                                         &objPublic.publicArea.
+                                         objectAttributes) == 0);
+  CU_ASSERT(init_kmyth_object_parameters(objPublic.publicArea.type,
+                                         &objPublic.publicArea.
+                                         parameters) == 0);
+
+  // Null inputs should produce an error
+  CU_ASSERT(compute_kmyth_object_name(NULL, &objName) == 1);
+  CU_ASSERT(compute_kmyth_object_name(&objPublic, NULL) == 1);
+
+  // A valid public area yields nameAlg (big endian) followed by its digest
+  CU_ASSERT(compute_kmyth_object_name(&objPublic, &objName) == 0);
+  CU_ASSERT(objName.size > 2);
+  CU_ASSERT(objName.name[0] == ((KMYTH_HASH_ALG >> 8) & 0xFF));
+  CU_ASSERT(objName.name[1] == (KMYTH_HASH_ALG & 0xFF));
+
+  // The name is deterministic ...
+  CU_ASSERT(compute_kmyth_object_name(&objPublic, &objName2) == 0);
+  CU_ASSERT(objName.size == objName2.size);
+  CU_ASSERT(memcmp(objName.name, objName2.name, objName.size) == 0);
+
+  // ... and changes when the public area does
+  objPublic.publicArea.authPolicy.size = 4;
+  memset(objPublic.publicArea.authPolicy.buffer, 0xAB, 4);
+  CU_ASSERT(compute_kmyth_object_name(&objPublic, &objName2) == 0);
+  CU_ASSERT(memcmp(objName.name, objName2.name, objName.size) != 0);
+
+  // An unsupported name algorithm should produce an error
+  objPublic.publicArea.nameAlg = TPM2_ALG_NULL;
+  CU_ASSERT(compute_kmyth_object_name(&objPublic, &objName2) == 1);
+}
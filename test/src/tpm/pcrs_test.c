@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <CUnit/CUnit.h>
 
 #include "tpm2_interface.h"
@@ -27,6 +28,11 @@ int pcrs_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "kmyth_pcr_snapshot() Tests",
+                          test_kmyth_pcr_snapshot))
+  {
+    return 1;
+  }
 
   return 0;
 }
@@ -103,3 +109,61 @@ void test_get_pcr_count(void)
   //Test NULL context
   CU_ASSERT(get_pcr_count(NULL, &count) == 1);
 }
+
+//----------------------------------------------------------------------------
+// test_kmyth_pcr_snapshot
+//----------------------------------------------------------------------------
+void test_kmyth_pcr_snapshot(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  bool emulator = true;
+
+  get_tpm2_impl_type(sapi_ctx, &emulator);
+  if (!emulator)
+  {
+    return;
+  }
+
+  int count = 0;
+
+  CU_ASSERT_FATAL(get_pcr_count(sapi_ctx, &count) == 0);
+  CU_ASSERT_FATAL(count > 0 && count <= KMYTH_PCR_SNAPSHOT_MAX_VALUES);
+
+  int pcrs[KMYTH_PCR_SNAPSHOT_MAX_VALUES] = { };
+  TPML_PCR_SELECTION pcrs_struct = {.count = 0, };
+  kmyth_pcr_snapshot_t snapshot;
+  TPM2B_DIGEST digest = {.size = 0, };
+  bool changed = true;
+
+  //All PCRs selected, more than a single TPM2_PCR_Read returns
+  for (int i = 0; i < count; i++)
+  {
+    pcrs[i] = i;
+  }
+  CU_ASSERT(init_pcr_selection(sapi_ctx, pcrs, (size_t) count,
+                               &pcrs_struct) == 0);
+  CU_ASSERT(kmyth_pcr_snapshot(sapi_ctx, pcrs_struct, &snapshot) == 0);
+  CU_ASSERT(snapshot.count == (uint32_t) count);
+  CU_ASSERT(get_pcr_digest(sapi_ctx, pcrs_struct, &digest) == 0);
+  CU_ASSERT(digest.size == snapshot.digest.size);
+  CU_ASSERT(memcmp(digest.buffer, snapshot.digest.buffer, digest.size) == 0);
+
+  //Nothing extended since, so nothing changed
+  CU_ASSERT(kmyth_pcr_snapshot_refresh(sapi_ctx, &snapshot, &changed) == 0);
+  CU_ASSERT(changed == false);
+  CU_ASSERT(snapshot.count == (uint32_t) count);
+
+  //No PCRs selected
+  CU_ASSERT(init_pcr_selection(sapi_ctx, NULL, 0, &pcrs_struct) == 0);
+  CU_ASSERT(kmyth_pcr_snapshot(sapi_ctx, pcrs_struct, &snapshot) == 0);
+  CU_ASSERT(snapshot.count == 0);
+  CU_ASSERT(kmyth_pcr_snapshot_refresh(sapi_ctx, &snapshot, &changed) == 0);
+  CU_ASSERT(changed == false);
+
+  //NULL parameters
+  CU_ASSERT(kmyth_pcr_snapshot(sapi_ctx, pcrs_struct, NULL) == 1);
+  CU_ASSERT(kmyth_pcr_snapshot_refresh(sapi_ctx, NULL, &changed) == 1);
+  CU_ASSERT(kmyth_pcr_snapshot_refresh(sapi_ctx, &snapshot, NULL) == 1);
+}
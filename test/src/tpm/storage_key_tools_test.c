@@ -6,8 +6,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <CUnit/CUnit.h>
 
+#include "defines.h"
 #include "tpm2_interface.h"
 
 #include "storage_key_tools_test.h"
@@ -39,6 +41,11 @@ int storage_key_tools_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "get_cached_srk_handle() Tests",
+                          test_get_cached_srk_handle))
+  {
+    return 1;
+  }
   if (NULL == CU_add_test(suite, "check_if_srk() Tests", test_check_if_srk))
   {
     return 1;
@@ -53,6 +60,10 @@ int storage_key_tools_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "set_sk_alg() Tests", test_set_sk_alg))
+  {
+    return 1;
+  }
   return 0;
 }
 
@@ -97,6 +108,55 @@ void test_get_existing_srk_handle(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_get_cached_srk_handle
+//----------------------------------------------------------------------------
+void test_get_cached_srk_handle(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPM2_HANDLE srk_handle = 0;
+  TPM2_HANDLE cached_handle = 0;
+  TPM2B_AUTH owner_auth = {.size = 0, };
+
+  init_tpm2_connection(&sapi_ctx);
+  set_srk_hint_path(NULL);
+  clear_cached_srk_handle();
+
+  //NULL context
+  CU_ASSERT(get_cached_srk_handle(NULL, &cached_handle) != 0);
+
+  //Empty cache reports no handle
+  CU_ASSERT(get_cached_srk_handle(sapi_ctx, &cached_handle) == 0);
+  CU_ASSERT(cached_handle == 0);
+
+  //A full lookup populates the cache
+  CU_ASSERT(get_srk_handle(sapi_ctx, &srk_handle, &owner_auth) == 0);
+  CU_ASSERT(get_cached_srk_handle(sapi_ctx, &cached_handle) == 0);
+  CU_ASSERT(cached_handle == srk_handle);
+
+  //A stale cached handle is discarded rather than returned
+  set_cached_srk_handle(TPM2_PERSISTENT_LAST);
+  CU_ASSERT(get_cached_srk_handle(sapi_ctx, &cached_handle) == 0);
+  CU_ASSERT(cached_handle == 0);
+
+  //The hint file seeds an empty cache
+  char hint_path[] = "/tmp/kmyth_srk_hint_XXXXXX";
+  int fd = mkstemp(hint_path);
+
+  CU_ASSERT(fd >= 0);
+  close(fd);
+  CU_ASSERT(set_srk_hint_path(hint_path) == 0);
+  CU_ASSERT(set_cached_srk_handle(srk_handle) == 0);
+  clear_cached_srk_handle();
+  CU_ASSERT(get_cached_srk_handle(sapi_ctx, &cached_handle) == 0);
+  CU_ASSERT(cached_handle == srk_handle);
+
+  unlink(hint_path);
+  set_srk_hint_path(NULL);
+  clear_cached_srk_handle();
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_check_if_srk
 //----------------------------------------------------------------------------
@@ -127,7 +187,8 @@ void test_check_if_srk(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth, pcrs_struct,
-                     auth_policy, &sk_handle, &sk_priv, &sk_pub);
+                     auth_policy, KMYTH_KEY_PUBKEY_ALG, &sk_handle, &sk_priv,
+                     &sk_pub);
   CU_ASSERT(check_if_srk(sapi_ctx, sk_handle, &is_srk) == 0);
   CU_ASSERT(!is_srk);
 
@@ -220,19 +281,64 @@ void test_create_and_load_sk(void)
   TPM2_HANDLE sk_handle = 0;
 
   CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
-                               pcrs_struct, auth_policy, &sk_handle, &sk_priv,
-                               &sk_pub) == 0);
+                               pcrs_struct, auth_policy, TPM2_ALG_RSA,
+                               &sk_handle, &sk_priv, &sk_pub) == 0);
   CU_ASSERT(sk_handle != 0);
   CU_ASSERT(sk_handle != srk_handle);
+  CU_ASSERT(sk_pub.publicArea.type == TPM2_ALG_RSA);
+  Tss2_Sys_FlushContext(sapi_ctx, sk_handle);
 
-  //Invalid context
+  //Valid ECC storage key
+  TPM2B_PRIVATE ecc_priv = {.size = 0, };
+  TPM2B_PUBLIC ecc_pub = {.size = 0, };
+  sk_handle = 0;
+  CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
+                               pcrs_struct, auth_policy, TPM2_ALG_ECC,
+                               &sk_handle, &ecc_priv, &ecc_pub) == 0);
+  CU_ASSERT(sk_handle != 0);
+  CU_ASSERT(ecc_pub.publicArea.type == TPM2_ALG_ECC);
+  CU_ASSERT(ecc_pub.publicArea.parameters.eccDetail.curveID ==
+            TPM2_ECC_NIST_P256);
+  Tss2_Sys_FlushContext(sapi_ctx, sk_handle);
+
+  //Unsupported storage key algorithm
   TPM2B_PRIVATE invalid_priv = {.size = 0, };
   TPM2B_PUBLIC invalid_pub = {.size = 0, };
   sk_handle = 0;
+  CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
+                               pcrs_struct, auth_policy, TPM2_ALG_KEYEDHASH,
+                               &sk_handle, &invalid_priv, &invalid_pub) != 0);
+  CU_ASSERT(sk_handle == 0 && invalid_priv.size == 0 && invalid_pub.size == 0);
+
+  //Invalid context
+  sk_handle = 0;
   CU_ASSERT(create_and_load_sk(NULL, srk_handle, owner_auth, obj_auth,
-                               pcrs_struct, auth_policy, &sk_handle,
-                               &invalid_priv, &invalid_pub) != 0);
+                               pcrs_struct, auth_policy, TPM2_ALG_RSA,
+                               &sk_handle, &invalid_priv, &invalid_pub) != 0);
   CU_ASSERT(sk_handle == 0 && invalid_priv.size == 0 && invalid_pub.size == 0);
 
   free_tpm2_resources(&sapi_ctx);
 }
+
+//----------------------------------------------------------------------------
+// test_set_sk_alg
+//----------------------------------------------------------------------------
+void test_set_sk_alg(void)
+{
+  //Default matches the SRK algorithm
+  CU_ASSERT(set_sk_alg(NULL) == 0);
+  CU_ASSERT(get_sk_alg() == KMYTH_KEY_PUBKEY_ALG);
+
+  //Valid algorithm names
+  CU_ASSERT(set_sk_alg("ecc") == 0);
+  CU_ASSERT(get_sk_alg() == TPM2_ALG_ECC);
+  CU_ASSERT(set_sk_alg("rsa") == 0);
+  CU_ASSERT(get_sk_alg() == TPM2_ALG_RSA);
+
+  //Invalid name leaves the current selection unchanged
+  CU_ASSERT(set_sk_alg("ecc") == 0);
+  CU_ASSERT(set_sk_alg("dsa") != 0);
+  CU_ASSERT(get_sk_alg() == TPM2_ALG_ECC);
+
+  set_sk_alg(NULL);
+}
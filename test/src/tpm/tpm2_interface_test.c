@@ -45,6 +45,26 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "set_tcti_spec()/init_tcti() Tests",
+                  test_set_tcti_spec))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "set_tpm_priority() Tests", test_set_tpm_priority))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "set_tpm_stats()/get_tpm_stats() Tests",
+                  test_set_tpm_stats))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "init_sapi() Tests", test_init_sapi))
   {
     return 1;
@@ -75,6 +95,20 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "get_tpm2_fixed_property() Tests",
+                  test_get_tpm2_fixed_property))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "compute_policy_digest() Tests",
+                  test_compute_policy_digest))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "getErrorString() Tests", test_getErrorString))
   {
     return 1;
@@ -213,6 +247,146 @@ void test_init_tcti_abrmd(void)
   free(tcti_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_set_tcti_spec
+//----------------------------------------------------------------------------
+void test_set_tcti_spec(void)
+{
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+
+  // Unrecognized TCTI names should be rejected
+  CU_ASSERT(set_tcti_spec("bogus") == 1);
+  CU_ASSERT(set_tcti_spec("abrmdx") == 1);
+  CU_ASSERT(set_tcti_spec("") == 1);
+
+  // Recognized names, with or without configuration, should be accepted
+  CU_ASSERT(set_tcti_spec("auto") == 0);
+  CU_ASSERT(set_tcti_spec("device:/dev/tpmrm0") == 0);
+  CU_ASSERT(set_tcti_spec("mssim:host=localhost,port=2321") == 0);
+  CU_ASSERT(set_tcti_spec("swtpm") == 0);
+  CU_ASSERT(set_tcti_spec("mock:default=1ms") == 0);
+
+  // An explicit abrmd selection should behave like init_tcti_abrmd()
+  CU_ASSERT(set_tcti_spec("abrmd") == 0);
+  CU_ASSERT(init_tcti(&tcti_ctx) == 0);
+  CU_ASSERT(tcti_ctx != NULL);
+
+  // Must have null tcti_ctx to init
+  CU_ASSERT(init_tcti(&tcti_ctx) != 0);
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+  tcti_ctx = NULL;
+
+  // A device TCTI for a nonexistent device should fail cleanly
+  CU_ASSERT(set_tcti_spec("device:/nonexistent/tpm") == 0);
+  CU_ASSERT(init_tcti(&tcti_ctx) == 1);
+  CU_ASSERT(tcti_ctx == NULL);
+
+  // Revert to the environment/default selection for the remaining tests
+  CU_ASSERT(set_tcti_spec(NULL) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_set_tpm_priority
+//----------------------------------------------------------------------------
+void test_set_tpm_priority(void)
+{
+  kmyth_tpm_priority priority = KMYTH_TPM_PRIORITY_BULK;
+
+  // Class names should parse, anything else should be rejected
+  CU_ASSERT(parse_tpm_priority("interactive", &priority) == 0);
+  CU_ASSERT(priority == KMYTH_TPM_PRIORITY_INTERACTIVE);
+  CU_ASSERT(parse_tpm_priority("bulk", &priority) == 0);
+  CU_ASSERT(priority == KMYTH_TPM_PRIORITY_BULK);
+  CU_ASSERT(parse_tpm_priority("normal", &priority) == 0);
+  CU_ASSERT(priority == KMYTH_TPM_PRIORITY_NORMAL);
+  CU_ASSERT(parse_tpm_priority("urgent", &priority) == 1);
+  CU_ASSERT(parse_tpm_priority(NULL, &priority) == 1);
+
+  // The default class applies until the thread chooses its own
+  CU_ASSERT(set_default_tpm_priority(KMYTH_TPM_PRIORITY_BULK) == 0);
+  CU_ASSERT(get_tpm_priority() == KMYTH_TPM_PRIORITY_BULK);
+  CU_ASSERT(set_default_tpm_priority((kmyth_tpm_priority) 7) == 1);
+  CU_ASSERT(get_tpm_priority() == KMYTH_TPM_PRIORITY_BULK);
+
+  // The thread's choice overrides the default, and reports the previous one
+  CU_ASSERT(set_tpm_priority(KMYTH_TPM_PRIORITY_INTERACTIVE) ==
+            KMYTH_TPM_PRIORITY_BULK);
+  CU_ASSERT(get_tpm_priority() == KMYTH_TPM_PRIORITY_INTERACTIVE);
+  CU_ASSERT(set_default_tpm_priority(KMYTH_TPM_PRIORITY_NORMAL) == 0);
+  CU_ASSERT(get_tpm_priority() == KMYTH_TPM_PRIORITY_INTERACTIVE);
+  CU_ASSERT(set_tpm_priority(KMYTH_TPM_PRIORITY_NORMAL) ==
+            KMYTH_TPM_PRIORITY_INTERACTIVE);
+
+  // Interactive commands, the most urgent, have no bound
+  CU_ASSERT(set_tpm_priority_max_wait(KMYTH_TPM_PRIORITY_INTERACTIVE, 10)
+            == 1);
+  CU_ASSERT(set_tpm_priority_max_wait(KMYTH_TPM_PRIORITY_NORMAL,
+                                      KMYTH_DEFAULT_NORMAL_MAX_WAIT_MS) == 0);
+  CU_ASSERT(set_tpm_priority_max_wait(KMYTH_TPM_PRIORITY_BULK,
+                                      KMYTH_DEFAULT_BULK_MAX_WAIT_MS) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_set_tpm_stats
+//----------------------------------------------------------------------------
+void test_set_tpm_stats(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  kmyth_tpm_cmd_stats *stats = NULL;
+  size_t stats_count = 0;
+
+  // NULL output parameters should be rejected
+  CU_ASSERT(get_tpm_stats(NULL, &stats_count) == 1);
+  CU_ASSERT(get_tpm_stats(&stats, NULL) == 1);
+
+  // Nothing is recorded for connections that are not instrumented
+  reset_tpm_stats();
+  CU_ASSERT(init_tpm2_connection(&sapi_ctx) == 0);
+  CU_ASSERT(get_tpm_stats(&stats, &stats_count) == 0);
+  CU_ASSERT(stats == NULL && stats_count == 0);
+  free_tpm2_resources(&sapi_ctx);
+
+  // Commands on an instrumented connection are counted by command code
+  TPM2B_DIGEST random_bytes = {.size = 0, };
+
+  set_tpm_stats(true);
+  CU_ASSERT(init_tpm2_connection(&sapi_ctx) == 0);
+  reset_tpm_stats();
+  CU_ASSERT(Tss2_Sys_GetRandom(sapi_ctx, NULL, 16, &random_bytes, NULL) ==
+            TSS2_RC_SUCCESS);
+  CU_ASSERT(Tss2_Sys_GetRandom(sapi_ctx, NULL, 16, &random_bytes, NULL) ==
+            TSS2_RC_SUCCESS);
+  CU_ASSERT(get_tpm_stats(&stats, &stats_count) == 0);
+  CU_ASSERT(stats_count == 1);
+  if (stats_count == 1)
+  {
+    CU_ASSERT(stats[0].commandCode == TPM2_CC_GetRandom);
+    CU_ASSERT(stats[0].count == 2);
+    CU_ASSERT(stats[0].errors == 0);
+    CU_ASSERT(stats[0].max_us <= stats[0].total_us);
+
+    uint64_t bucket_total = 0;
+
+    for (size_t i = 0; i < KMYTH_TPM_STATS_BUCKETS; i++)
+    {
+      bucket_total += stats[0].histogram[i];
+    }
+    CU_ASSERT(bucket_total == 2);
+  }
+  free(stats);
+  stats = NULL;
+
+  // The instrumented TCTI is torn down like any other
+  CU_ASSERT(free_tpm2_resources(&sapi_ctx) == 0);
+  set_tpm_stats(false);
+
+  // Reset discards everything collected
+  reset_tpm_stats();
+  CU_ASSERT(get_tpm_stats(&stats, &stats_count) == 0);
+  CU_ASSERT(stats == NULL && stats_count == 0);
+}
+
 //----------------------------------------------------------------------------
 // test_init_sapi
 //----------------------------------------------------------------------------
@@ -323,6 +497,113 @@ void test_get_tpm2_impl_type(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_get_tpm2_fixed_property
+//----------------------------------------------------------------------------
+void test_get_tpm2_fixed_property(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+
+  //Valid test - the cached value must match a direct query
+  TPMS_CAPABILITY_DATA cap_data;
+  uint32_t pcr_count = 0;
+
+  CU_ASSERT(get_tpm2_properties
+            (sapi_ctx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_PCR_COUNT,
+             TPM2_PT_GROUP, &cap_data) == 0);
+  CU_ASSERT(get_tpm2_fixed_property(sapi_ctx, TPM2_PT_PCR_COUNT,
+                                    &pcr_count) == 0);
+  CU_ASSERT(pcr_count == cap_data.data.tpmProperties.tpmProperty[0].value);
+
+  //Repeated lookups answer the same from the cache
+  uint32_t value = 0;
+
+  CU_ASSERT(get_tpm2_fixed_property(sapi_ctx, TPM2_PT_PCR_COUNT, &value) == 0);
+  CU_ASSERT(value == pcr_count);
+
+  //Clearing the cache re-reads the properties
+  clear_tpm2_capability_cache(sapi_ctx);
+  value = 0;
+  CU_ASSERT(get_tpm2_fixed_property(sapi_ctx, TPM2_PT_PCR_COUNT, &value) == 0);
+  CU_ASSERT(value == pcr_count);
+
+  //Properties outside the fixed group are not reported
+  CU_ASSERT(get_tpm2_fixed_property(sapi_ctx, TPM2_PT_HR_PERSISTENT_AVAIL,
+                                    &value) != 0);
+
+  //NULL input
+  CU_ASSERT(get_tpm2_fixed_property(NULL, TPM2_PT_PCR_COUNT, &value) != 0);
+  CU_ASSERT(get_tpm2_fixed_property(sapi_ctx, TPM2_PT_PCR_COUNT, NULL) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_compute_policy_digest
+//----------------------------------------------------------------------------
+void test_compute_policy_digest(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+
+  int pcrs[2] = { 0, 7 };
+  TPML_PCR_SELECTION pcrList;
+  TPM2B_DIGEST pcrDigest = {.size = 0, };
+  TPM2B_DIGEST trial = {.size = 0, };
+  TPM2B_DIGEST computed = {.size = 0, };
+
+  //Software computation matches the trial session, with and without PCRs
+  for (size_t n = 0; n < 3; n++)
+  {
+    CU_ASSERT(init_pcr_selection(sapi_ctx, n ? pcrs : NULL, n,
+                                 &pcrList) == 0);
+    CU_ASSERT(get_pcr_digest(sapi_ctx, pcrList, &pcrDigest) == 0);
+    CU_ASSERT(create_policy_digest(sapi_ctx, pcrList, &trial) == 0);
+    CU_ASSERT(compute_policy_digest(pcrList, pcrDigest, &computed) == 0);
+    CU_ASSERT(computed.size == trial.size);
+    CU_ASSERT(memcmp(computed.buffer, trial.buffer, trial.size) == 0);
+  }
+
+  //Same for the compound (policy OR) digest, from two to eight branches
+  TPML_DIGEST branches = {.count = 0, };
+  TPM2B_DIGEST trial_or = {.size = 0, };
+  TPM2B_DIGEST computed_or = {.size = 0, };
+
+  branches.digests[0] = trial;
+  for (uint32_t i = 1; i < KMYTH_MAX_POLICY_BRANCHES; i++)
+  {
+    branches.digests[i].size = KMYTH_DIGEST_SIZE;
+    memset(branches.digests[i].buffer, 0xA0 + (int) i, KMYTH_DIGEST_SIZE);
+  }
+  for (branches.count = KMYTH_MIN_POLICY_BRANCHES;
+       branches.count <= KMYTH_MAX_POLICY_BRANCHES; branches.count++)
+  {
+    CU_ASSERT(create_policy_or_digest(sapi_ctx, &branches, &trial_or) == 0);
+    CU_ASSERT(compute_policy_or_digest(&branches, &computed_or) == 0);
+    CU_ASSERT(computed_or.size == trial_or.size);
+    CU_ASSERT(memcmp(computed_or.buffer, trial_or.buffer,
+                     trial_or.size) == 0);
+  }
+
+  //Too few or too many branches, or an empty one
+  branches.count = 1;
+  CU_ASSERT(compute_policy_or_digest(&branches, &computed_or) != 0);
+  branches.count = KMYTH_MAX_POLICY_BRANCHES + 1;
+  CU_ASSERT(compute_policy_or_digest(&branches, &computed_or) != 0);
+  branches.count = 3;
+  branches.digests[2].size = 0;
+  CU_ASSERT(compute_policy_or_digest(&branches, &computed_or) != 0);
+
+  //NULL input
+  CU_ASSERT(compute_policy_digest(pcrList, pcrDigest, NULL) != 0);
+  CU_ASSERT(compute_policy_or_digest(NULL, &computed_or) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_getErrorString
 //----------------------------------------------------------------------------
@@ -781,28 +1062,29 @@ void test_unseal_apply_policy(void)
   init_tpm2_connection(&sapi_ctx);
   TPML_PCR_SELECTION pcrs_struct = {.count = 0, };
 
-  TPM2B_DIGEST policy1;
-  TPM2B_DIGEST policy2;
+  TPML_DIGEST policyBranches = {.count = 2, };
+  TPM2B_DIGEST *policy1 = &policyBranches.digests[0];
+  TPM2B_DIGEST *policy2 = &policyBranches.digests[1];
 
-  policy1.size = 0;
-  policy2.size = 0;
+  policy1->size = 0;
+  policy2->size = 0;
 
   int pcrs[1] = { };
   pcrs[0] = 23;
   init_pcr_selection(sapi_ctx, pcrs, 1, &pcrs_struct);
-  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &policy1) == 0);
-  CU_ASSERT(policy1.size != 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, policy1) == 0);
+  CU_ASSERT(policy1->size != 0);
 
   if (system("tpm2_pcrextend 23:sha256=0000000000000000000000000000000000000000000000000000000000000001") != -1)
   {
     init_pcr_selection(sapi_ctx, pcrs, 1, &pcrs_struct);
-    CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &policy2) == 0);
-    CU_ASSERT(policy2.size != 0);
+    CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, policy2) == 0);
+    CU_ASSERT(policy2->size != 0);
 
     SESSION unsealData_session;
     CU_ASSERT(create_auth_session(sapi_ctx, &unsealData_session, TPM2_SE_POLICY) == 0);
     init_pcr_selection(sapi_ctx, pcrs, 1, &pcrs_struct);
-    CU_ASSERT(unseal_apply_policy(sapi_ctx, unsealData_session.sessionHandle, pcrs_struct, policy1, policy2) == 0);
+    CU_ASSERT(unseal_apply_policy(sapi_ctx, unsealData_session.sessionHandle, pcrs_struct, policyBranches, NULL) == 0);
     system("tpm2_pcrreset 23");
   }
   else
@@ -826,31 +1108,31 @@ void test_apply_policy_or(void)
   TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
   TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
 
-  TPM2B_DIGEST policy1;
-  TPM2B_DIGEST policy2;
+  TPML_DIGEST policyBranches = {.count = 2, };
+  TPM2B_DIGEST *policy1 = &policyBranches.digests[0];
+  TPM2B_DIGEST *policy2 = &policyBranches.digests[1];
   TPM2B_DIGEST policyOR;
 
-  policy1.size = 0;
-  policy2.size = 0;
+  policy1->size = 0;
+  policy2->size = 0;
   policyOR.size = 0;
 
   int pcrs[1] = { };
   pcrs[0] = 23;
   init_pcr_selection(sapi_ctx, pcrs, 1, &pcrs_struct);
-  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &policy1) == 0);
-  CU_ASSERT(policy1.size != 0);
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, policy1) == 0);
+  CU_ASSERT(policy1->size != 0);
 
   if (system("tpm2_pcrextend 23:sha256=0000000000000000000000000000000000000000000000000000000000000001") != -1)
   {
     init_pcr_selection(sapi_ctx, pcrs, 1, &pcrs_struct);
-    CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &policy2) == 0);
-    CU_ASSERT(policy2.size != 0);
+    CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, policy2) == 0);
+    CU_ASSERT(policy2->size != 0);
 
-    TPML_DIGEST pHashList;
     SESSION policySessionOR;
     create_auth_session(sapi_ctx, &policySessionOR, TPM2_SE_TRIAL);
-    CU_ASSERT(apply_policy_or(sapi_ctx, policySessionOR.sessionHandle, &policy1,
-                    &policy2, &pHashList) == 0);
+    CU_ASSERT(apply_policy_or(sapi_ctx, policySessionOR.sessionHandle,
+                              &policyBranches) == 0);
     CU_ASSERT(Tss2_Sys_PolicyGetDigest(sapi_ctx, policySessionOR.sessionHandle,
                              nullCmdAuths, &policyOR, nullRspAuths) == 0);
     CU_ASSERT(policyOR.size != 0);
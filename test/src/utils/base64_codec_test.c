@@ -0,0 +1,188 @@
+//############################################################################
+// base64_codec_test.c
+//
+// Tests for the kmyth base64 codec in utils/src/base64_codec.c
+//
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "base64_codec_test.h"
+#include "base64_codec.h"
+
+//----------------------------------------------------------------------------
+// base64_codec_add_tests()
+//----------------------------------------------------------------------------
+int base64_codec_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_base64_encode() Tests",
+                          test_kmyth_base64_encode))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_base64_decode() Tests",
+                          test_kmyth_base64_decode))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// reference_encode()
+//
+// Encodes with OpenSSL, in lines of 64 symbols each ending with a newline
+//----------------------------------------------------------------------------
+static size_t reference_encode(const uint8_t * raw, size_t raw_len,
+                               uint8_t * out)
+{
+  size_t out_len = 0;
+
+  for (size_t i = 0; i < raw_len; i += 48)
+  {
+    size_t chunk = (raw_len - i < 48) ? raw_len - i : 48;
+
+    out_len += (size_t) EVP_EncodeBlock(out + out_len, raw + i, (int) chunk);
+    out[out_len++] = '\n';
+  }
+  return out_len;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_base64_encode
+//----------------------------------------------------------------------------
+void test_kmyth_base64_encode(void)
+{
+  size_t max_len = 1024;
+  uint8_t *raw = malloc(max_len);
+  uint8_t *expected = malloc(2 * max_len);
+  uint8_t *encoded = malloc(2 * max_len);
+
+  RAND_bytes(raw, (int) max_len);
+
+  //Empty input encodes to nothing
+  CU_ASSERT(kmyth_base64_encoded_size(0) == 0);
+
+  //Every length (covering all line and vector block boundaries), with and
+  //without the vectorized code
+  for (int simd = 0; simd < 2; simd++)
+  {
+    kmyth_base64_set_simd(simd == 1);
+    for (size_t len = 1; len <= max_len; len++)
+    {
+      size_t expected_len = reference_encode(raw, len, expected);
+
+      CU_ASSERT(kmyth_base64_encoded_size(len) == expected_len);
+      CU_ASSERT(kmyth_base64_encode(raw, len, encoded) == expected_len);
+      CU_ASSERT(memcmp(encoded, expected, expected_len) == 0);
+    }
+  }
+  kmyth_base64_set_simd(true);
+
+  //Every 6-bit value, in every position of a symbol group
+  uint8_t all[192];
+
+  for (size_t i = 0; i < sizeof(all); i++)
+  {
+    all[i] = (uint8_t) (i * 85 + (i >> 2));
+  }
+  CU_ASSERT(kmyth_base64_encode(all, sizeof(all), encoded) ==
+            reference_encode(all, sizeof(all), expected));
+  CU_ASSERT(memcmp(encoded, expected, kmyth_base64_encoded_size(sizeof(all)))
+            == 0);
+
+  free(raw);
+  free(expected);
+  free(encoded);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_base64_decode
+//----------------------------------------------------------------------------
+void test_kmyth_base64_decode(void)
+{
+  size_t max_len = 1024;
+  uint8_t *raw = malloc(max_len);
+  uint8_t *encoded = malloc(2 * max_len);
+  uint8_t *decoded = malloc(max_len + 8);
+  size_t decoded_len = 0;
+
+  RAND_bytes(raw, (int) max_len);
+
+  for (int simd = 0; simd < 2; simd++)
+  {
+    kmyth_base64_set_simd(simd == 1);
+
+    //Round trip of every length
+    for (size_t len = 1; len <= max_len; len++)
+    {
+      size_t encoded_len = kmyth_base64_encode(raw, len, encoded);
+
+      CU_ASSERT(kmyth_base64_decoded_max_size(encoded_len) >= len);
+      CU_ASSERT(kmyth_base64_decode(encoded, encoded_len, decoded,
+                                    &decoded_len) == 0);
+      CU_ASSERT(decoded_len == len);
+      CU_ASSERT(memcmp(decoded, raw, len) == 0);
+    }
+
+    //Whitespace anywhere is skipped, even within a group of symbols
+    const char *spaced = " QU\tJD\r\nREVG  R0hJ\n SktM\n";
+
+    CU_ASSERT(kmyth_base64_decode((const uint8_t *) spaced, strlen(spaced),
+                                  decoded, &decoded_len) == 0);
+    CU_ASSERT(decoded_len == 12);
+    CU_ASSERT(memcmp(decoded, "ABCDEFGHIJKL", 12) == 0);
+
+    //Padding
+    CU_ASSERT(kmyth_base64_decode((const uint8_t *) "QQ==\n", 5, decoded,
+                                  &decoded_len) == 0);
+    CU_ASSERT(decoded_len == 1 && decoded[0] == 'A');
+    CU_ASSERT(kmyth_base64_decode((const uint8_t *) "QUI=\n", 5, decoded,
+                                  &decoded_len) == 0);
+    CU_ASSERT(decoded_len == 2 && memcmp(decoded, "AB", 2) == 0);
+    CU_ASSERT(kmyth_base64_decode((const uint8_t *) "QUI", 3, decoded,
+                                  &decoded_len) == 1);
+    CU_ASSERT(kmyth_base64_decode((const uint8_t *) "QUI==", 5, decoded,
+                                  &decoded_len) == 1);
+    CU_ASSERT(kmyth_base64_decode((const uint8_t *) "Q===", 4, decoded,
+                                  &decoded_len) == 1);
+    CU_ASSERT(kmyth_base64_decode((const uint8_t *) "QQ==QUJD", 8, decoded,
+                                  &decoded_len) == 1);
+
+    //A single invalid byte anywhere in a long input is rejected (this
+    //exercises the validation of the vectorized code in every lane)
+    size_t encoded_len = kmyth_base64_encode(raw, 200, encoded);
+    const uint8_t bad[] = { '-', '*', '.', ':', '@', '[', '`', '{', 0x00,
+      0x7F, 0x80, 0xFF
+    };
+
+    for (size_t pos = 0; pos < encoded_len; pos++)
+    {
+      if (encoded[pos] == '\n' || encoded[pos] == '=')
+      {
+        continue;
+      }
+      uint8_t saved = encoded[pos];
+
+      for (size_t b = 0; b < sizeof(bad); b++)
+      {
+        encoded[pos] = bad[b];
+        CU_ASSERT(kmyth_base64_decode(encoded, encoded_len, decoded,
+                                      &decoded_len) == 1);
+      }
+      encoded[pos] = saved;
+    }
+  }
+  kmyth_base64_set_simd(true);
+
+  free(raw);
+  free(encoded);
+  free(decoded);
+}
@@ -6,13 +6,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <CUnit/CUnit.h>
 
 #include "file_io_test.h"
 #include "file_io.h"
+#include "bulk_io.h"
 
 //----------------------------------------------------------------------------
 // file_io_add_tests()
@@ -37,18 +41,58 @@ int file_io_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "map_bytes_from_file() Tests",
+                          test_map_bytes_from_file))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "write_bytes_to_file() Tests",
                           test_write_bytes_to_file))
   {
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "write_bytes_to_file_atomic() Tests",
+                          test_write_bytes_to_file_atomic))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_write_batch Tests",
+                          test_write_batch))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Bulk File I/O Tests", test_bulk_io))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "write_bytes_to_bio() Tests",
+                          test_write_bytes_to_bio))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "print_to_stdout() Tests",
                           test_print_to_stdout))
   {
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "write_bytes_to_memfd() Tests",
+                          test_write_bytes_to_memfd))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "run_with_fd() Tests", test_run_with_fd))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -156,6 +200,47 @@ void test_read_bytes_from_file(void)
   free(testdata);
 }
 
+//----------------------------------------------------------------------------
+// test_map_bytes_from_file()
+//----------------------------------------------------------------------------
+void test_map_bytes_from_file(void)
+{
+  uint8_t *testfile_data = (uint8_t *) "123 & ABC !!";
+  size_t testfile_size = strlen((char *) testfile_data);
+  kmyth_file_view view;
+
+  // NULL parameters and non-existent files should result in error
+  CU_ASSERT(map_bytes_from_file(NULL, &view) == 1);
+  CU_ASSERT(map_bytes_from_file("testfile", NULL) == 1);
+  remove("testfile");
+  CU_ASSERT(map_bytes_from_file("testfile", &view) == 1);
+
+  // An empty file gives an empty view, which can still be released
+  FILE *fp = fopen("testfile", "w");
+
+  fclose(fp);
+  CU_ASSERT(map_bytes_from_file("testfile", &view) == 0);
+  CU_ASSERT(view.data == NULL);
+  CU_ASSERT(view.data_length == 0);
+  CU_ASSERT(view.release != NULL);
+  view.release(&view);
+
+  // A regular file is mapped, and its view matches the file contents
+  fp = fopen("testfile", "w");
+  fwrite(testfile_data, 1, testfile_size, fp);
+  fclose(fp);
+  CU_ASSERT(map_bytes_from_file("testfile", &view) == 0);
+  CU_ASSERT(view.map_base != NULL);
+  CU_ASSERT(view.data_length == testfile_size);
+  CU_ASSERT(memcmp(view.data, testfile_data, testfile_size) == 0);
+  view.release(&view);
+  CU_ASSERT(view.data == NULL);
+  CU_ASSERT(view.data_length == 0);
+  CU_ASSERT(view.map_base == NULL);
+
+  remove("testfile");
+}
+
 //----------------------------------------------------------------------------
 // test_write_bytes_to_file()
 //----------------------------------------------------------------------------
@@ -198,6 +283,258 @@ void test_write_bytes_to_file(void)
   remove("testfile");
 }
 
+//----------------------------------------------------------------------------
+// count_dir_entries()
+//----------------------------------------------------------------------------
+static size_t count_dir_entries(const char *path)
+{
+  DIR *dir = opendir(path);
+  size_t count = 0;
+
+  if (dir == NULL)
+  {
+    return 0;
+  }
+  while (readdir(dir) != NULL)
+  {
+    count++;
+  }
+  closedir(dir);
+
+  // not counting '.' and '..'
+  return count - 2;
+}
+
+//----------------------------------------------------------------------------
+// test_write_bytes_to_file_atomic()
+//----------------------------------------------------------------------------
+void test_write_bytes_to_file_atomic(void)
+{
+  uint8_t *testdata1 = (uint8_t *) "Testing 123 ...";
+  size_t testdata1_len = strlen((char *) testdata1);
+  uint8_t *testdata2 = (uint8_t *) "And now for something different!\n";
+  size_t testdata2_len = strlen((char *) testdata2);
+  char dir[] = "/tmp/kmyth_atomicXXXXXX";
+  char path[64];
+
+  CU_ASSERT(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/testfile", dir);
+
+  // Trying to write to NULL or invalid output paths should result in error
+  CU_ASSERT(write_bytes_to_file_atomic(NULL, testdata1, testdata1_len) == 1);
+  CU_ASSERT(write_bytes_to_file_atomic("/nonexistent/testfile", testdata1,
+                                       testdata1_len) == 1);
+
+  // A new file gets owner-only permissions and no temporary file remains
+  uint8_t *filedata = NULL;
+  size_t filedata_len = 0;
+  struct stat st;
+
+  CU_ASSERT(write_bytes_to_file_atomic(path, testdata1, testdata1_len) == 0);
+  CU_ASSERT(read_bytes_from_file(path, &filedata, &filedata_len) == 0);
+  CU_ASSERT(filedata_len == testdata1_len);
+  CU_ASSERT(memcmp(filedata, testdata1, filedata_len) == 0);
+  free(filedata);
+  CU_ASSERT(stat(path, &st) == 0 && (st.st_mode & 0777) == 0600);
+  CU_ASSERT(count_dir_entries(dir) == 1);
+
+  // Replacing an existing file keeps its permissions
+  chmod(path, 0640);
+  CU_ASSERT(write_bytes_to_file_atomic(path, testdata2, testdata2_len) == 0);
+  CU_ASSERT(read_bytes_from_file(path, &filedata, &filedata_len) == 0);
+  CU_ASSERT(filedata_len == testdata2_len);
+  CU_ASSERT(memcmp(filedata, testdata2, filedata_len) == 0);
+  free(filedata);
+  CU_ASSERT(stat(path, &st) == 0 && (st.st_mode & 0777) == 0640);
+  CU_ASSERT(count_dir_entries(dir) == 1);
+
+  remove(path);
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// test_write_batch()
+//----------------------------------------------------------------------------
+void test_write_batch(void)
+{
+  uint8_t *testdata1 = (uint8_t *) "Testing 123 ...";
+  size_t testdata1_len = strlen((char *) testdata1);
+  uint8_t *testdata2 = (uint8_t *) "And now for something different!\n";
+  size_t testdata2_len = strlen((char *) testdata2);
+  char dir[] = "/tmp/kmyth_batchXXXXXX";
+  char paths[40][64];
+  kmyth_write_batch batch;
+  size_t failed = 1;
+
+  CU_ASSERT(mkdtemp(dir) != NULL);
+  for (size_t i = 0; i < 40; i++)
+  {
+    snprintf(paths[i], sizeof(paths[i]), "%s/file%zu", dir, i);
+  }
+  CU_ASSERT(write_bytes_to_file(paths[0], testdata1, testdata1_len) == 0);
+
+  // Nothing changes at the output paths until the batch is committed
+  init_write_batch(&batch);
+  for (size_t i = 0; i < 40; i++)
+  {
+    CU_ASSERT(add_to_write_batch(&batch, paths[i], testdata2,
+                                 testdata2_len) == 0);
+  }
+  CU_ASSERT(add_to_write_batch(&batch, NULL, testdata2, testdata2_len) == 1);
+  CU_ASSERT(batch.count == 40);
+  CU_ASSERT(access(paths[1], F_OK) == -1);
+
+  uint8_t *filedata = NULL;
+  size_t filedata_len = 0;
+
+  CU_ASSERT(read_bytes_from_file(paths[0], &filedata, &filedata_len) == 0);
+  CU_ASSERT(filedata_len == testdata1_len);
+  free(filedata);
+
+  // Committing puts every file in place and removes the temporary ones
+  CU_ASSERT(commit_write_batch(&batch, &failed) == 0);
+  CU_ASSERT(failed == 0);
+  CU_ASSERT(batch.count == 0);
+  CU_ASSERT(count_dir_entries(dir) == 40);
+  for (size_t i = 0; i < 40; i++)
+  {
+    CU_ASSERT(read_bytes_from_file(paths[i], &filedata, &filedata_len) == 0);
+    CU_ASSERT(filedata_len == testdata2_len);
+    CU_ASSERT(memcmp(filedata, testdata2, filedata_len) == 0);
+    free(filedata);
+  }
+
+  // Aborting leaves the output paths as they were
+  CU_ASSERT(add_to_write_batch(&batch, paths[0], testdata1,
+                               testdata1_len) == 0);
+  abort_write_batch(&batch);
+  CU_ASSERT(batch.count == 0);
+  CU_ASSERT(count_dir_entries(dir) == 40);
+  CU_ASSERT(read_bytes_from_file(paths[0], &filedata, &filedata_len) == 0);
+  CU_ASSERT(filedata_len == testdata2_len);
+  free(filedata);
+
+  // An empty batch commits trivially
+  CU_ASSERT(commit_write_batch(&batch, NULL) == 0);
+
+  for (size_t i = 0; i < 40; i++)
+  {
+    remove(paths[i]);
+  }
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// test_bulk_io()
+//----------------------------------------------------------------------------
+void test_bulk_io(void)
+{
+  char dir[] = "/tmp/kmyth_bulkXXXXXX";
+  char paths[40][64];
+  char contents[40][64];
+  kmyth_bulk_file files[41];
+  kmyth_write_batch batch;
+
+  CU_ASSERT(mkdtemp(dir) != NULL);
+  for (size_t i = 0; i < 40; i++)
+  {
+    snprintf(paths[i], sizeof(paths[i]), "%s/file%zu", dir, i);
+    snprintf(contents[i], sizeof(contents[i]), "contents of file %zu", i);
+    files[i].path = paths[i];
+    files[i].data = (uint8_t *) contents[i];
+    files[i].data_len = (i == 7) ? 0 : strlen(contents[i]);
+  }
+
+  // Writes join the batch, and take effect when it is committed
+  init_write_batch(&batch);
+  CU_ASSERT(kmyth_bulk_write_files(&batch, files, 40, 4) == 0);
+  CU_ASSERT(batch.count == 40);
+  CU_ASSERT(access(paths[0], F_OK) == -1);
+  CU_ASSERT(commit_write_batch(&batch, NULL) == 0);
+  CU_ASSERT(count_dir_entries(dir) == 40);
+
+  // Reads give every file's contents, and fail only for the missing file
+  for (size_t i = 0; i < 40; i++)
+  {
+    files[i].data = NULL;
+  }
+  files[40].path = "/tmp/kmyth_bulk_nonexistent";
+  CU_ASSERT(kmyth_bulk_read_files(files, 41, 4) == 1);
+  for (size_t i = 0; i < 40; i++)
+  {
+    CU_ASSERT(files[i].result == 0);
+    if (i == 7)
+    {
+      CU_ASSERT(files[i].data == NULL && files[i].data_len == 0);
+      continue;
+    }
+    CU_ASSERT(files[i].data_len == strlen(contents[i]));
+    CU_ASSERT(files[i].data != NULL &&
+              memcmp(files[i].data, contents[i], files[i].data_len) == 0);
+    free(files[i].data);
+  }
+  CU_ASSERT(files[40].result == 1);
+  CU_ASSERT(files[40].data == NULL);
+
+  // A file that can't be written is left out of the batch
+  files[0].path = "/tmp/kmyth_bulk_nonexistent/file";
+  files[0].data = (uint8_t *) contents[0];
+  files[0].data_len = strlen(contents[0]);
+  CU_ASSERT(kmyth_bulk_write_files(&batch, files, 1, 0) == 1);
+  CU_ASSERT(files[0].result == 1);
+  CU_ASSERT(batch.count == 0);
+  CU_ASSERT(kmyth_bulk_write_files(NULL, files, 1, 0) == 1);
+
+  // Nothing to do succeeds
+  CU_ASSERT(kmyth_bulk_read_files(NULL, 0, 0) == 0);
+
+  for (size_t i = 0; i < 40; i++)
+  {
+    remove(paths[i]);
+  }
+  rmdir(dir);
+}
+
+//----------------------------------------------------------------------------
+// test_write_bytes_to_bio()
+//----------------------------------------------------------------------------
+void test_write_bytes_to_bio(void)
+{
+  size_t testdata_len = 3 * 1024 * 1024 + 5;
+  uint8_t *testdata = malloc(testdata_len);
+
+  CU_ASSERT(testdata != NULL);
+  for (size_t i = 0; i < testdata_len; i++)
+  {
+    testdata[i] = (uint8_t) (i * 7);
+  }
+
+  // NULL BIO, or NULL data of non-zero length, should error
+  BIO *bio = BIO_new(BIO_s_mem());
+
+  CU_ASSERT(write_bytes_to_bio(NULL, testdata, testdata_len) == 1);
+  CU_ASSERT(write_bytes_to_bio(bio, NULL, 1) == 1);
+
+  // writing nothing succeeds and writes nothing
+  char *bio_data = NULL;
+
+  CU_ASSERT(write_bytes_to_bio(bio, NULL, 0) == 0);
+  CU_ASSERT(BIO_get_mem_data(bio, &bio_data) == 0);
+
+  // all of the data ends up in the BIO
+  CU_ASSERT(write_bytes_to_bio(bio, testdata, testdata_len) == 0);
+  CU_ASSERT((size_t) BIO_get_mem_data(bio, &bio_data) == testdata_len);
+  CU_ASSERT(memcmp(bio_data, testdata, testdata_len) == 0);
+  BIO_free(bio);
+
+  // a BIO that cannot be written to should error
+  bio = BIO_new_mem_buf(testdata, 16);
+  CU_ASSERT(write_bytes_to_bio(bio, testdata, 16) == 1);
+  BIO_free(bio);
+
+  free(testdata);
+}
+
 //----------------------------------------------------------------------------
 // test_print_to_stdout()
 //----------------------------------------------------------------------------
@@ -247,3 +584,96 @@ void test_print_to_stdout(void)
   dup2(saved_stdout_fd, STDOUT_FILENO);
   close(saved_stdout_fd);
 }
+
+//----------------------------------------------------------------------------
+// test_write_bytes_to_memfd()
+//----------------------------------------------------------------------------
+void test_write_bytes_to_memfd(void)
+{
+  uint8_t testdata[] = "sealed in memory";
+  size_t testdata_len = sizeof(testdata) - 1;
+  uint8_t buf[64] = { 0 };
+  int fd = -1;
+
+  // NULL name, descriptor or data of non-zero length should error
+  CU_ASSERT(write_bytes_to_memfd(NULL, testdata, testdata_len, &fd) == 1);
+  CU_ASSERT(write_bytes_to_memfd("test", testdata, testdata_len, NULL) == 1);
+  CU_ASSERT(write_bytes_to_memfd("test", NULL, 1, &fd) == 1);
+  CU_ASSERT(fd == -1);
+
+  // the data can be read back from the start
+  CU_ASSERT(write_bytes_to_memfd("test", testdata, testdata_len, &fd) == 0);
+  CU_ASSERT(fd >= 0);
+  CU_ASSERT(read(fd, buf, sizeof(buf)) == (ssize_t) testdata_len);
+  CU_ASSERT(memcmp(buf, testdata, testdata_len) == 0);
+
+  // but can be neither changed, resized nor unsealed
+  CU_ASSERT(pwrite(fd, "X", 1, 0) == -1);
+  CU_ASSERT(ftruncate(fd, 0) == -1);
+  CU_ASSERT(ftruncate(fd, 1024) == -1);
+  CU_ASSERT(fcntl(fd, F_GET_SEALS) ==
+            (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL));
+
+  // and it is not passed on to other programs by default
+  CU_ASSERT((fcntl(fd, F_GETFD) & FD_CLOEXEC) != 0);
+  close(fd);
+
+  // writing nothing gives an empty memory file
+  CU_ASSERT(write_bytes_to_memfd("test", NULL, 0, &fd) == 0);
+  CU_ASSERT(read(fd, buf, sizeof(buf)) == 0);
+  close(fd);
+
+  // write_bytes_to_fd() writes all of the data to a descriptor
+  int fds[2];
+
+  CU_ASSERT_FATAL(pipe(fds) == 0);
+  CU_ASSERT(write_bytes_to_fd(-1, testdata, testdata_len) == 1);
+  CU_ASSERT(write_bytes_to_fd(fds[1], NULL, 1) == 1);
+  CU_ASSERT(write_bytes_to_fd(fds[1], testdata, testdata_len) == 0);
+  close(fds[1]);
+  CU_ASSERT(read(fds[0], buf, sizeof(buf)) == (ssize_t) testdata_len);
+  CU_ASSERT(memcmp(buf, testdata, testdata_len) == 0);
+  close(fds[0]);
+}
+
+//----------------------------------------------------------------------------
+// test_run_with_fd()
+//----------------------------------------------------------------------------
+void test_run_with_fd(void)
+{
+  uint8_t testdata[] = "secret";
+  int fd = -1;
+  int status = -1;
+
+  CU_ASSERT_FATAL(write_bytes_to_memfd("test", testdata, sizeof(testdata) - 1,
+                                       &fd) == 0);
+
+  // invalid parameters should error
+  CU_ASSERT(run_with_fd(NULL, fd, 3, NULL, &status) == 1);
+  CU_ASSERT(run_with_fd("true", -1, 3, NULL, &status) == 1);
+  CU_ASSERT(run_with_fd("true", fd, -1, NULL, &status) == 1);
+  CU_ASSERT(run_with_fd("true", fd, 3, NULL, NULL) == 1);
+
+  // the command finds the data on the descriptor it was given, which the
+  // environment variable names
+  CU_ASSERT(run_with_fd("test \"$(cat <&5)\" = secret", fd, 5, NULL,
+                        &status) == 0);
+  CU_ASSERT(status == 0);
+  CU_ASSERT(run_with_fd("test \"$KMYTH_TEST_FD\" = 7 && "
+                        "test \"$(cat <&7)\" = secret", fd, 7,
+                        "KMYTH_TEST_FD", &status) == 0);
+  CU_ASSERT(status == 0);
+
+  // the descriptor may already be the one the command uses
+  CU_ASSERT(run_with_fd("test \"$(cat <&$KMYTH_TEST_FD)\" = secret", fd, fd,
+                        "KMYTH_TEST_FD", &status) == 0);
+  CU_ASSERT(status == 0);
+
+  // the command's exit status (or the signal that ended it) is returned
+  CU_ASSERT(run_with_fd("exit 42", fd, 3, NULL, &status) == 0);
+  CU_ASSERT(status == 42);
+  CU_ASSERT(run_with_fd("kill -TERM $$", fd, 3, NULL, &status) == 0);
+  CU_ASSERT(status == 128 + SIGTERM);
+
+  close(fd);
+}
@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <CUnit/CUnit.h>
 #include <openssl/rand.h>
 
@@ -27,6 +28,12 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "get_block_view() Tests", test_get_block_view))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "create_nkl_bytes() Tests", test_create_nkl_bytes))
   {
@@ -50,6 +57,11 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "kmyth_byte_buffer Tests", test_byte_buffer))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "verifyStringDigestConversion() Tests",
                           test_verifyStringDigestConversion))
   {
@@ -226,6 +238,100 @@ AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n";
   free(sb);
 }
 
+//----------------------------------------------------------------------------
+// test_get_block_view
+//----------------------------------------------------------------------------
+void test_get_block_view(void)
+{
+  const char *blocks = "-----PCR SELECTION LIST-----\nAAAA\n"
+    "-----STORAGE KEY PUBLIC-----\nBBBB-BB\n-----FILE END-----\n";
+  size_t blocks_len = strlen(blocks);
+  uint8_t *sb = malloc(blocks_len);
+
+  memcpy(sb, blocks, blocks_len);
+
+  uint8_t *position = sb;
+  size_t remaining = blocks_len;
+  uint8_t *view = NULL;
+  size_t view_size = 0;
+
+  //Valid parse test: the block is returned in place, not copied
+  CU_ASSERT(get_block_view(&position, &remaining, &view, &view_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)) == 0);
+  CU_ASSERT(view == sb + strlen(KMYTH_DELIM_PCR_SELECTION_LIST));
+  CU_ASSERT(view_size == strlen("AAAA\n"));
+  CU_ASSERT(position == view + view_size);
+  CU_ASSERT(remaining == blocks_len - (size_t) (position - sb));
+
+  //A lone '-' inside a block does not end it
+  CU_ASSERT(get_block_view(&position, &remaining, &view, &view_size,
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC),
+                           KMYTH_DELIM_END_FILE,
+                           strlen(KMYTH_DELIM_END_FILE)) == 0);
+  CU_ASSERT(view_size == strlen("BBBB-BB\n"));
+  CU_ASSERT(memcmp(view, "BBBB-BB\n", view_size) == 0);
+  CU_ASSERT(remaining == strlen(KMYTH_DELIM_END_FILE));
+  CU_ASSERT(memcmp(position, KMYTH_DELIM_END_FILE, remaining) == 0);
+
+  //Invalid first delim, outputs left unchanged
+  position = sb + 1;
+  remaining = blocks_len - 1;
+  view = NULL;
+  view_size = 0;
+  CU_ASSERT(get_block_view(&position, &remaining, &view, &view_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)) == 1);
+  CU_ASSERT(position == sb + 1);
+  CU_ASSERT(view == NULL);
+
+  //Next delim missing (only the start of it is present)
+  position = sb;
+  remaining = strlen(KMYTH_DELIM_PCR_SELECTION_LIST) + strlen("AAAA\n") + 10;
+  CU_ASSERT(get_block_view(&position, &remaining, &view, &view_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)) == 1);
+  CU_ASSERT(position == sb);
+  CU_ASSERT(view == NULL);
+
+  //Fewer bytes remaining than the delimiter itself
+  remaining = strlen(KMYTH_DELIM_PCR_SELECTION_LIST) - 1;
+  CU_ASSERT(get_block_view(&position, &remaining, &view, &view_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)) == 1);
+  free(sb);
+
+  //Large block: the delimiter is found at the very end
+  size_t big_len = 1 << 20;
+  size_t total = strlen(KMYTH_DELIM_ENC_DATA) + big_len +
+    strlen(KMYTH_DELIM_END_FILE);
+  uint8_t *big = malloc(total);
+
+  memcpy(big, KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA));
+  memset(big + strlen(KMYTH_DELIM_ENC_DATA), 'A', big_len);
+  memcpy(big + strlen(KMYTH_DELIM_ENC_DATA) + big_len, KMYTH_DELIM_END_FILE,
+         strlen(KMYTH_DELIM_END_FILE));
+  position = big;
+  remaining = total;
+  CU_ASSERT(get_block_view(&position, &remaining, &view, &view_size,
+                           KMYTH_DELIM_ENC_DATA,
+                           strlen(KMYTH_DELIM_ENC_DATA),
+                           KMYTH_DELIM_END_FILE,
+                           strlen(KMYTH_DELIM_END_FILE)) == 0);
+  CU_ASSERT(view_size == big_len);
+  CU_ASSERT(remaining == strlen(KMYTH_DELIM_END_FILE));
+  free(big);
+}
+
 //----------------------------------------------------------------------------
 // test_create_nkl_bytes
 //----------------------------------------------------------------------------
@@ -379,9 +485,8 @@ uint8_t RAW_PCR[] = { 0, 0, 0, 1, 0, 11, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   CU_ASSERT(decodeBase64Data(NULL, strlen(RAW_PCR64), &pcr, &pcr_len) == 1);
   CU_ASSERT(decodeBase64Data((uint8_t *) RAW_PCR64, 0, &pcr, &pcr_len) == 1);
 
-  //INT_MAX+1
-  CU_ASSERT(decodeBase64Data
-            ((uint8_t *) RAW_PCR64, INT_MAX+(size_t)1, &pcr, &pcr_len) == 1);
+  //Test input that is not valid base64
+  CU_ASSERT(decodeBase64Data((uint8_t *) "AB!D\n", 5, &pcr, &pcr_len) == 1);
   CU_ASSERT(pcr == NULL);
   CU_ASSERT(pcr_len == 0);
 
@@ -451,6 +556,61 @@ void test_concat(void)
   free(dest);
 }
 
+//----------------------------------------------------------------------------
+// test_byte_buffer()
+//----------------------------------------------------------------------------
+void test_byte_buffer(void)
+{
+  kmyth_byte_buffer buf;
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+
+  //Appends past the initial capacity grow the buffer
+  CU_ASSERT(init_byte_buffer(&buf, 4) == 0);
+  CU_ASSERT(buf.capacity == 4);
+  CU_ASSERT(append_to_byte_buffer(&buf, (uint8_t *) "green", 5) == 0);
+  CU_ASSERT(append_to_byte_buffer(&buf, (uint8_t *) "chile", 5) == 0);
+  CU_ASSERT(buf.length == 10);
+  CU_ASSERT(buf.capacity >= 10);
+  CU_ASSERT(memcmp(buf.data, "greenchile", 10) == 0);
+
+  //Empty input appends nothing
+  CU_ASSERT(append_to_byte_buffer(&buf, NULL, 5) == 0);
+  CU_ASSERT(append_to_byte_buffer(&buf, (uint8_t *) "x", 0) == 0);
+  CU_ASSERT(buf.length == 10);
+
+  //Overflow is rejected and leaves the buffer untouched
+  CU_ASSERT(append_to_byte_buffer(&buf, (uint8_t *) "x", SIZE_MAX - 1) == 1);
+  CU_ASSERT(buf.length == 10);
+
+  //Detaching hands the contents over and empties the buffer
+  detach_byte_buffer(&buf, &out, &out_len);
+  CU_ASSERT(out_len == 10);
+  CU_ASSERT(memcmp(out, "greenchile", 10) == 0);
+  CU_ASSERT(buf.data == NULL && buf.length == 0 && buf.capacity == 0);
+  free(out);
+
+  //Growth doubles the capacity, so many small appends reallocate rarely
+  CU_ASSERT(init_byte_buffer(&buf, 0) == 0);
+  CU_ASSERT(buf.data == NULL);
+  size_t grows = 0;
+
+  for (size_t i = 0; i < 4096; i++)
+  {
+    size_t capacity = buf.capacity;
+
+    CU_ASSERT(append_to_byte_buffer(&buf, (uint8_t *) "ab", 2) == 0);
+    if (buf.capacity != capacity)
+    {
+      grows++;
+    }
+  }
+  CU_ASSERT(buf.length == 8192);
+  CU_ASSERT(grows <= 14);
+  free_byte_buffer(&buf);
+  CU_ASSERT(buf.data == NULL && buf.length == 0 && buf.capacity == 0);
+}
+
 //----------------------------------------------------------------------------
 // test_verifyStringDigestConversion()
 //----------------------------------------------------------------------------
@@ -492,5 +652,37 @@ void test_verifyStringDigestConversion(void)
   {
     CU_ASSERT(test_digest.buffer[i] == converted_digest.buffer[i]);
   }
+
+  // test comma-separated list conversion, up to a full TPML_DIGEST
+  size_t max_count = sizeof(((TPML_DIGEST *) NULL)->digests) /
+    sizeof(TPM2B_DIGEST);
+  char list_string[(max_count + 1) * ((KMYTH_DIGEST_SIZE * 2) + 1)];
+  TPML_DIGEST converted_list;
+
+  strcpy(list_string, test_string);
+  for (size_t n = 1; n <= max_count; n++)
+  {
+    CU_ASSERT(convert_string_to_digest_list(list_string,
+                                            &converted_list) == 0);
+    CU_ASSERT(converted_list.count == n);
+    for (size_t i = 0; i < converted_list.count; i++)
+    {
+      CU_ASSERT(converted_list.digests[i].size == test_digest.size);
+      CU_ASSERT(memcmp(converted_list.digests[i].buffer, test_digest.buffer,
+                       test_digest.size) == 0);
+    }
+    strcat(list_string, ",");
+    strcat(list_string, test_string);
+  }
+
+  // too many, empty or short entries are rejected
+  CU_ASSERT(convert_string_to_digest_list(list_string, &converted_list) == 1);
+  snprintf(list_string, sizeof(list_string), "%s,", test_string);
+  CU_ASSERT(convert_string_to_digest_list(list_string, &converted_list) == 1);
+  snprintf(list_string, sizeof(list_string), "%s,%.10s", test_string,
+           test_string);
+  CU_ASSERT(convert_string_to_digest_list(list_string, &converted_list) == 1);
+  CU_ASSERT(convert_string_to_digest_list("", &converted_list) == 1);
+  CU_ASSERT(convert_string_to_digest_list(NULL, &converted_list) == 1);
 }
 
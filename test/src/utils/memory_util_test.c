@@ -9,6 +9,9 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 #include <CUnit/CUnit.h>
 
 #include "memory_util_test.h"
@@ -30,6 +33,24 @@ int memory_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Kmyth Secure Arena Tests",
+                          test_kmyth_arena))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Kmyth Allocator Hook Tests",
+                          test_kmyth_set_allocator))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Kmyth Allocation Accounting Tests",
+                          test_kmyth_alloc_stats))
+  {
+    return 1;
+  }
+
 //  if (NULL == CU_add_test(suite, "Kmyth Secure Memory Set Tests",
 //                          test_secure_memset))
 //  {
@@ -146,3 +167,290 @@ void test_secure_memset(void)
   CU_ASSERT(result);
   free(tmp1);
 }
+
+//----------------------------------------------------------------------------
+// test_kmyth_arena()
+//----------------------------------------------------------------------------
+void test_kmyth_arena(void)
+{
+  kmyth_arena arena;
+
+  // invalid parameters are rejected, and an empty arena hands out nothing
+  CU_ASSERT(kmyth_arena_init(NULL, 64) == 1);
+  CU_ASSERT(kmyth_arena_init(&arena, 0) == 1);
+  CU_ASSERT(arena.base == NULL);
+  CU_ASSERT(kmyth_arena_alloc(&arena, 16) == NULL);
+  CU_ASSERT(kmyth_arena_alloc(NULL, 16) == NULL);
+  kmyth_arena_reset(&arena);
+  kmyth_arena_free(&arena);
+
+  // the size is rounded up to whole pages, and the region is page aligned
+  long page = sysconf(_SC_PAGESIZE);
+
+  CU_ASSERT(kmyth_arena_init(&arena, 100) == 0);
+  CU_ASSERT(arena.base != NULL);
+  CU_ASSERT(arena.size == (size_t) page);
+  CU_ASSERT((uintptr_t) arena.base % (uintptr_t) page == 0);
+  CU_ASSERT(arena.used == 0);
+
+  // blocks are aligned, zeroed, and belong to the arena
+  unsigned char *a = kmyth_arena_alloc(&arena, 5);
+  unsigned char *b = kmyth_arena_alloc(&arena, 32);
+  bool zeroed = true;
+
+  CU_ASSERT(a != NULL && b != NULL);
+  CU_ASSERT((uintptr_t) b % KMYTH_ARENA_ALIGN == 0);
+  CU_ASSERT(b >= a + 5);
+  CU_ASSERT(kmyth_arena_contains(&arena, a));
+  CU_ASSERT(kmyth_arena_contains(&arena, b + 31));
+  CU_ASSERT(!kmyth_arena_contains(&arena, arena.base + arena.size));
+  CU_ASSERT(!kmyth_arena_contains(&arena, &arena));
+  for (size_t i = 0; i < 32; i++)
+  {
+    zeroed = zeroed && (b[i] == 0);
+  }
+  CU_ASSERT(zeroed);
+
+  // releasing the last block wipes it and gives its space back
+  memset(b, 0xff, 32);
+  size_t used = arena.used;
+
+  kmyth_arena_release(&arena, b, 32);
+  CU_ASSERT(arena.used < used);
+  CU_ASSERT(kmyth_arena_alloc(&arena, 32) == b);
+  zeroed = true;
+  for (size_t i = 0; i < 32; i++)
+  {
+    zeroed = zeroed && (b[i] == 0);
+  }
+  CU_ASSERT(zeroed);
+
+  // releasing an earlier block only wipes it
+  memset(a, 0xff, 5);
+  used = arena.used;
+  kmyth_arena_release(&arena, a, 5);
+  CU_ASSERT(arena.used == used);
+  CU_ASSERT(a[0] == 0 && a[4] == 0);
+
+  // a block that does not fit is refused, leaving the arena as it was
+  CU_ASSERT(kmyth_arena_alloc(&arena, arena.size) == NULL);
+  CU_ASSERT(arena.used == used);
+
+  // heap blocks are handed to kmyth_clear_and_free()
+  kmyth_arena_release(&arena, malloc(16), 16);
+  kmyth_arena_release(&arena, NULL, 16);
+
+  // a reset wipes every block and frees the whole region
+  memset(b, 0xff, 32);
+  kmyth_arena_reset(&arena);
+  CU_ASSERT(arena.used == 0);
+  CU_ASSERT(b[0] == 0 && b[31] == 0);
+  CU_ASSERT(kmyth_arena_alloc(&arena, arena.size) == arena.base);
+
+  kmyth_arena_free(&arena);
+  CU_ASSERT(arena.base == NULL);
+  CU_ASSERT(arena.size == 0);
+
+  // a large arena is backed by huge pages when the platform has them, and
+  // falls back to regular pages otherwise
+  CU_ASSERT(kmyth_arena_init(&arena, KMYTH_HUGE_PAGE_SIZE + 1) == 0);
+  CU_ASSERT(arena.base != NULL);
+  if (arena.pages == KMYTH_ARENA_PAGES_BASE)
+  {
+    CU_ASSERT(arena.size % (size_t) page == 0);
+    CU_ASSERT(arena.size >= KMYTH_HUGE_PAGE_SIZE + 1);
+  }
+  else
+  {
+    CU_ASSERT(arena.size == 2 * KMYTH_HUGE_PAGE_SIZE);
+    CU_ASSERT((uintptr_t) arena.base % KMYTH_HUGE_PAGE_SIZE == 0);
+  }
+  a = kmyth_arena_alloc(&arena, arena.size);
+  CU_ASSERT(a == arena.base);
+  if (a != NULL)
+  {
+    memset(a, 0xff, arena.size);
+    CU_ASSERT(a[arena.size - 1] == 0xff);
+  }
+  kmyth_arena_free(&arena);
+  CU_ASSERT(arena.base == NULL);
+  CU_ASSERT(arena.pages == KMYTH_ARENA_PAGES_BASE);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_set_allocator()
+//----------------------------------------------------------------------------
+
+// counts the calls made through the hooks (passed as their user data)
+typedef struct
+{
+  int allocs;
+  int reallocs;
+  int frees;
+} alloc_counts;
+
+static void *counting_alloc(size_t size, void *user_data)
+{
+  ((alloc_counts *) user_data)->allocs++;
+  return malloc(size);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *user_data)
+{
+  ((alloc_counts *) user_data)->reallocs++;
+  return realloc(ptr, size);
+}
+
+static void counting_free(void *ptr, void *user_data)
+{
+  ((alloc_counts *) user_data)->frees++;
+  free(ptr);
+}
+
+void test_kmyth_set_allocator(void)
+{
+  alloc_counts counts = { 0, 0, 0 };
+
+  // the hooks are set all together, or not at all
+  CU_ASSERT(kmyth_set_allocator(counting_alloc, NULL, counting_free,
+                                &counts) == 1);
+  CU_ASSERT(kmyth_set_allocator(NULL, NULL, counting_free, &counts) == 1);
+
+  // a partial set leaves the C library in place
+  void *v = kmyth_malloc(8);
+
+  CU_ASSERT(v != NULL);
+  kmyth_free(v);
+  CU_ASSERT(counts.allocs == 0 && counts.frees == 0);
+
+  // every allocation goes through the hooks once they are set
+  CU_ASSERT(kmyth_set_allocator(counting_alloc, counting_realloc,
+                                counting_free, &counts) == 0);
+
+  unsigned char *p = kmyth_malloc(16);
+
+  CU_ASSERT(p != NULL);
+  CU_ASSERT(counts.allocs == 1);
+  p = kmyth_realloc(p, 32);
+  CU_ASSERT(p != NULL);
+  CU_ASSERT(counts.reallocs == 1);
+  kmyth_clear_and_free(p, 32);
+  CU_ASSERT(counts.frees == 1);
+
+  // kmyth_calloc() zeroes what the hook returns, and checks for overflow
+  unsigned char *z = kmyth_calloc(4, 8);
+  bool zeroed = (z != NULL);
+
+  for (size_t i = 0; z != NULL && i < 32; i++)
+  {
+    zeroed = zeroed && (z[i] == 0);
+  }
+  CU_ASSERT(zeroed);
+  CU_ASSERT(counts.allocs == 2);
+  kmyth_free(z);
+  CU_ASSERT(kmyth_calloc(SIZE_MAX, 2) == NULL);
+  CU_ASSERT(counts.allocs == 2);
+
+  // kmyth_strdup() copies through the hooks too
+  char *str = kmyth_strdup("kmyth");
+
+  CU_ASSERT(str != NULL && strcmp(str, "kmyth") == 0);
+  CU_ASSERT(counts.allocs == 3);
+  CU_ASSERT(kmyth_strdup(NULL) == NULL);
+  kmyth_free(str);
+
+  // a NULL pointer never reaches the free hook
+  kmyth_free(NULL);
+  CU_ASSERT(counts.frees == 3);
+
+  // passing no hooks restores the C library
+  CU_ASSERT(kmyth_set_allocator(NULL, NULL, NULL, NULL) == 0);
+  v = kmyth_malloc(8);
+  kmyth_free(v);
+  CU_ASSERT(counts.allocs == 3 && counts.frees == 3);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_alloc_stats()
+//----------------------------------------------------------------------------
+void test_kmyth_alloc_stats(void)
+{
+  kmyth_alloc_stats stats;
+
+  // nothing is counted until accounting is turned on
+  CU_ASSERT(!kmyth_alloc_stats_enabled());
+  kmyth_alloc_stats_reset();
+  kmyth_free(kmyth_malloc(64));
+  kmyth_alloc_get_stats(KMYTH_ALLOC_PHASE_COUNT, &stats);
+  CU_ASSERT(stats.allocs == 0 && stats.frees == 0);
+
+#ifdef __GLIBC__
+  CU_ASSERT(kmyth_alloc_stats_enable(true) == 0);
+  CU_ASSERT(kmyth_alloc_stats_enabled());
+
+  uint64_t live = kmyth_alloc_live_bytes();
+
+  // allocations go to the thread's current phase, and phases nest
+  kmyth_alloc_phase outer = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_READ);
+  unsigned char *a = kmyth_malloc(1000);
+  kmyth_alloc_phase prev = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_DECRYPT);
+  unsigned char *b = kmyth_calloc(10, 100);
+
+  CU_ASSERT(prev == KMYTH_ALLOC_PHASE_READ);
+  b = kmyth_realloc(b, 4000);
+  CU_ASSERT(kmyth_alloc_set_phase(prev) == KMYTH_ALLOC_PHASE_DECRYPT);
+  CU_ASSERT(kmyth_alloc_set_phase(outer) == KMYTH_ALLOC_PHASE_READ);
+  CU_ASSERT(a != NULL && b != NULL);
+
+  kmyth_alloc_get_stats(KMYTH_ALLOC_PHASE_READ, &stats);
+  CU_ASSERT(stats.allocs == 1 && stats.bytes >= 1000);
+  kmyth_alloc_get_stats(KMYTH_ALLOC_PHASE_DECRYPT, &stats);
+  CU_ASSERT(stats.allocs == 2 && stats.bytes >= 5000);
+  CU_ASSERT(stats.peak_bytes >= live + 5000);
+  CU_ASSERT(kmyth_alloc_live_bytes() >= live + 5000);
+
+  // releases lower the live bytes, not the peaks
+  kmyth_clear_and_free(b, 4000);
+  kmyth_free(a);
+  CU_ASSERT(kmyth_alloc_live_bytes() == live);
+  kmyth_alloc_get_stats(KMYTH_ALLOC_PHASE_COUNT, &stats);
+  CU_ASSERT(stats.allocs == 3 && stats.frees == 2);
+  CU_ASSERT(stats.peak_bytes >= live + 5000);
+
+  // a reset starts the overall peak again from the live bytes
+  kmyth_alloc_stats_reset();
+  kmyth_alloc_get_stats(KMYTH_ALLOC_PHASE_COUNT, &stats);
+  CU_ASSERT(stats.allocs == 0 && stats.bytes == 0);
+  CU_ASSERT(stats.peak_bytes == live);
+  kmyth_alloc_get_stats(KMYTH_ALLOC_PHASE_DECRYPT, &stats);
+  CU_ASSERT(stats.peak_bytes == 0);
+
+  // invalid phases are ignored
+  CU_ASSERT(kmyth_alloc_set_phase((kmyth_alloc_phase) 99) ==
+            KMYTH_ALLOC_PHASE_OTHER);
+  CU_ASSERT(kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_OTHER) ==
+            KMYTH_ALLOC_PHASE_OTHER);
+  kmyth_alloc_get_stats((kmyth_alloc_phase) 99, &stats);
+  CU_ASSERT(stats.allocs == 0 && stats.peak_bytes == 0);
+  CU_ASSERT(strcmp(kmyth_alloc_phase_name(KMYTH_ALLOC_PHASE_DECODE),
+                   "decode") == 0);
+  CU_ASSERT(strcmp(kmyth_alloc_phase_name(KMYTH_ALLOC_PHASE_COUNT),
+                   "total") == 0);
+
+  // accounting is not available on top of allocation hooks
+  alloc_counts counts = { 0, 0, 0 };
+
+  CU_ASSERT(kmyth_set_allocator(counting_alloc, counting_realloc,
+                                counting_free, &counts) == 0);
+  CU_ASSERT(!kmyth_alloc_stats_enabled());
+  CU_ASSERT(kmyth_set_allocator(NULL, NULL, NULL, NULL) == 0);
+  CU_ASSERT(kmyth_alloc_stats_enable(false) == 0);
+  CU_ASSERT(kmyth_set_allocator(counting_alloc, counting_realloc,
+                                counting_free, &counts) == 0);
+  CU_ASSERT(kmyth_alloc_stats_enable(true) == 1);
+  CU_ASSERT(kmyth_set_allocator(NULL, NULL, NULL, NULL) == 0);
+#endif
+
+  kmyth_alloc_stats_enable(false);
+  kmyth_alloc_stats_reset();
+}
@@ -0,0 +1,143 @@
+//############################################################################
+// metrics_test.c
+//
+// Tests for the kmyth metrics registry in utils/src/metrics.c
+//
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "metrics_test.h"
+#include "metrics.h"
+
+//----------------------------------------------------------------------------
+// metrics_add_tests()
+//----------------------------------------------------------------------------
+int metrics_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_metrics counter Tests",
+                          test_kmyth_metrics_counters))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_metrics_write_prometheus() Tests",
+                          test_kmyth_metrics_write_prometheus))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_counters
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_counters(void)
+{
+  kmyth_metrics_reset();
+
+  //Plain counters
+  kmyth_metrics_inc(KMYTH_METRIC_SEALS);
+  kmyth_metrics_add(KMYTH_METRIC_SEALS, 2);
+  kmyth_metrics_add(KMYTH_METRIC_BYTES_ENCRYPTED, 4096);
+  CU_ASSERT(kmyth_metrics_get(KMYTH_METRIC_SEALS) == 3);
+  CU_ASSERT(kmyth_metrics_get(KMYTH_METRIC_BYTES_ENCRYPTED) == 4096);
+  CU_ASSERT(kmyth_metrics_get(KMYTH_METRIC_UNSEALS) == 0);
+
+  //Out of range identifiers are ignored
+  kmyth_metrics_inc(KMYTH_METRIC_COUNTER_COUNT);
+  CU_ASSERT(kmyth_metrics_get(KMYTH_METRIC_COUNTER_COUNT) == 0);
+
+  //Cache hits and misses are kept apart
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SRK, 1);
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SRK, 1);
+  kmyth_metrics_cache_lookup(KMYTH_METRIC_CACHE_SRK, 0);
+  CU_ASSERT(kmyth_metrics_get_cache(KMYTH_METRIC_CACHE_SRK, 1) == 2);
+  CU_ASSERT(kmyth_metrics_get_cache(KMYTH_METRIC_CACHE_SRK, 0) == 1);
+  CU_ASSERT(kmyth_metrics_get_cache(KMYTH_METRIC_CACHE_POLICY, 1) == 0);
+
+  //TPM errors are counted by response code
+  kmyth_metrics_tpm_error(0x0000098E);
+  kmyth_metrics_tpm_error(0x0000098E);
+  kmyth_metrics_tpm_error(0x00000184);
+  CU_ASSERT(kmyth_metrics_get_tpm_error(0x0000098E) == 2);
+  CU_ASSERT(kmyth_metrics_get_tpm_error(0x00000184) == 1);
+  CU_ASSERT(kmyth_metrics_get_tpm_error(0x00000101) == 0);
+
+  //Once every slot is taken, new codes share the "other" count
+  for (uint32_t rc = 1; rc <= KMYTH_METRICS_MAX_TPM_RCS; rc++)
+  {
+    kmyth_metrics_tpm_error(0x00010000 + rc);
+  }
+  CU_ASSERT(kmyth_metrics_get_tpm_error(0x0000098E) == 2);
+  CU_ASSERT(kmyth_metrics_get_tpm_error(0x00010000 +
+                                        KMYTH_METRICS_MAX_TPM_RCS) == 0);
+
+  //Reset clears everything, including the response code slots
+  kmyth_metrics_reset();
+  CU_ASSERT(kmyth_metrics_get(KMYTH_METRIC_SEALS) == 0);
+  CU_ASSERT(kmyth_metrics_get_cache(KMYTH_METRIC_CACHE_SRK, 1) == 0);
+  CU_ASSERT(kmyth_metrics_get_tpm_error(0x0000098E) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_write_prometheus
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_write_prometheus(void)
+{
+  kmyth_metrics_reset();
+
+  kmyth_metrics_observe(KMYTH_METRIC_TLS_HANDSHAKE_TIME, 50);
+  kmyth_metrics_observe(KMYTH_METRIC_TLS_HANDSHAKE_TIME, 2000);
+  kmyth_metrics_observe(KMYTH_METRIC_TLS_HANDSHAKE_TIME, 60000000);
+  kmyth_metrics_tpm_error(0x0000098E);
+
+  uint64_t sum_us = 0;
+
+  CU_ASSERT(kmyth_metrics_get_histogram(KMYTH_METRIC_TLS_HANDSHAKE_TIME,
+                                        &sum_us) == 3);
+  CU_ASSERT(sum_us == 60002050);
+
+  char *text = NULL;
+  size_t text_len = 0;
+  FILE *out = open_memstream(&text, &text_len);
+
+  CU_ASSERT(out != NULL);
+  if (out == NULL)
+  {
+    return;
+  }
+  CU_ASSERT(kmyth_metrics_write_prometheus(out) == 0);
+  fclose(out);
+
+  //Buckets are cumulative, and +Inf catches what no finite bucket holds
+  const char *expected[] = {
+    "# TYPE kmyth_tls_handshake_duration_seconds histogram\n",
+    "kmyth_tls_handshake_duration_seconds_bucket{le=\"0.000100\"} 1\n",
+    "kmyth_tls_handshake_duration_seconds_bucket{le=\"0.001000\"} 1\n",
+    "kmyth_tls_handshake_duration_seconds_bucket{le=\"0.005000\"} 2\n",
+    "kmyth_tls_handshake_duration_seconds_bucket{le=\"10.000000\"} 2\n",
+    "kmyth_tls_handshake_duration_seconds_bucket{le=\"+Inf\"} 3\n",
+    "kmyth_tls_handshake_duration_seconds_sum 60.002050\n",
+    "kmyth_tls_handshake_duration_seconds_count 3\n",
+    "kmyth_tpm_errors_total{rc=\"0x0000098E\"} 1\n",
+    "kmyth_tpm_errors_total{rc=\"other\"} 0\n",
+    "# TYPE kmyth_seals_total counter\nkmyth_seals_total 0\n",
+    NULL
+  };
+
+  for (size_t i = 0; expected[i] != NULL; i++)
+  {
+    CU_ASSERT(strstr(text, expected[i]) != NULL);
+  }
+  free(text);
+
+  //A NULL stream is rejected
+  CU_ASSERT(kmyth_metrics_write_prometheus(NULL) == 1);
+
+  kmyth_metrics_reset();
+}
@@ -0,0 +1,102 @@
+/**
+ * @file  base64_codec.h
+ *
+ * @brief Provides the base64 codec behind encodeBase64Data() and
+ *        decodeBase64Data(): a table driven scalar implementation and, on
+ *        x86-64 CPUs with AVX2, a vectorized one selected at run time.
+ *
+ *        The encoded form is the one produced by OpenSSL's base64 BIO (the
+ *        format of .ski and .nkl blocks): lines of 64 symbols, each ending
+ *        with a newline, including the last (shorter) one.
+ */
+
+#ifndef BASE64_CODEC_H
+#define BASE64_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Number of base64 symbols per line of encoded output
+#define KMYTH_BASE64_LINE_LEN 64
+
+/**
+ * @brief Computes the size of the base64 encoding of raw_size bytes,
+ *        newlines included.
+ *
+ * @param[in]  raw_size      Number of bytes to be encoded
+ *
+ * @return Size, in bytes, of the encoded output (0 if raw_size is 0)
+ */
+size_t kmyth_base64_encoded_size(size_t raw_size);
+
+/**
+ * @brief Computes an upper bound on the size of the data decoded from
+ *        encoded_size base64 symbols (including any whitespace).
+ *
+ * @param[in]  encoded_size  Number of bytes of base64 input
+ *
+ * @return Size, in bytes, that an output buffer for
+ *         kmyth_base64_decode() must have
+ */
+size_t kmyth_base64_decoded_max_size(size_t encoded_size);
+
+/**
+ * @brief Base64 encodes a buffer, breaking the output into lines of
+ *        KMYTH_BASE64_LINE_LEN symbols.
+ *
+ * @param[in]  raw           Bytes to be encoded
+ *
+ * @param[in]  raw_size      Number of bytes to be encoded
+ *
+ * @param[out] encoded       Output buffer of (at least)
+ *                           kmyth_base64_encoded_size(raw_size) bytes
+ *
+ * @return Number of bytes written to encoded
+ */
+size_t kmyth_base64_encode(const uint8_t * raw, size_t raw_size,
+                           uint8_t * encoded);
+
+/**
+ * @brief Decodes base64 data. Whitespace (including the line breaks) is
+ *        skipped anywhere in the input; the data must be padded to a
+ *        multiple of four symbols and nothing but whitespace may follow
+ *        the padding.
+ *
+ * @param[in]  encoded       Base64 symbols to be decoded
+ *
+ * @param[in]  encoded_size  Number of bytes of input
+ *
+ * @param[out] raw           Output buffer of (at least)
+ *                           kmyth_base64_decoded_max_size(encoded_size)
+ *                           bytes
+ *
+ * @param[out] raw_size      Number of bytes decoded - passed as a pointer
+ *                           to the length value
+ *
+ * @return 0 on success, 1 if the input is not valid base64
+ */
+int kmyth_base64_decode(const uint8_t * encoded, size_t encoded_size,
+                        uint8_t * raw, size_t *raw_size);
+
+/**
+ * @brief Enables or disables the vectorized implementation (enabled by
+ *        default). Both implementations produce identical results; this is
+ *        meant for testing and benchmarking the scalar one.
+ *
+ * @param[in]  enable        Whether the vectorized code may be used
+ *
+ * @return true if the vectorized code is now in use (it is only used on a
+ *         CPU that supports it), false otherwise
+ */
+bool kmyth_base64_set_simd(bool enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BASE64_CODEC_H */
@@ -0,0 +1,106 @@
+/**
+ * @file  bulk_io.h
+ *
+ * @brief Provides bulk file input and output for the Kmyth tools that work
+ *        on many files at once (e.g., 'kmyth-seal -o DIR' and
+ *        'kmyth-reseal -d'). Many file reads, or many writes of temporary
+ *        files for a kmyth_write_batch, are kept in flight at once, so that
+ *        the latency of the filesystem (e.g., on network storage) is not
+ *        paid once per file.
+ *
+ *        Linux io_uring is used where the kernel supports it (through its
+ *        system calls, without liburing), unless KMYTH_NO_IO_URING is
+ *        defined ('make KMYTH_IO_URING=0'). Otherwise a pool of threads
+ *        runs the plain file_io.h functions.
+ */
+
+#ifndef BULK_IO_H
+#define BULK_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of files kept in flight when the caller gives no depth
+ */
+#define KMYTH_BULK_IO_DEFAULT_DEPTH 16
+
+/**
+ * @brief Maximum number of files kept in flight
+ */
+#define KMYTH_BULK_IO_MAX_DEPTH 256
+
+/**
+ * @brief One file of a bulk read or write
+ */
+typedef struct
+{
+  // path of the file (not modified)
+  char *path;
+
+  // file contents: filled in by kmyth_bulk_read_files() (to be released
+  // with kmyth_free(), NULL for an empty file), given to
+  // kmyth_bulk_write_files()
+  uint8_t *data;
+  size_t data_len;
+
+  // 0 once the file was read or joined the batch, 1 on error
+  int result;
+} kmyth_bulk_file;
+
+/**
+ * @brief Reads whole files, up to depth of them at once. Each file gets the
+ *        result read_bytes_from_file() would give it.
+ *
+ * @param[in,out] files   The files to read (path set, data and data_len
+ *                        filled in)
+ *
+ * @param[in]     count   Number of files
+ *
+ * @param[in]     depth   Most files in flight at once (0 for
+ *                        KMYTH_BULK_IO_DEFAULT_DEPTH)
+ *
+ * @return 0 if every file was read, 1 if any failed (see the results)
+ */
+int kmyth_bulk_read_files(kmyth_bulk_file * files, size_t count,
+                          size_t depth);
+
+/**
+ * @brief Writes the data of each file to a temporary file next to it, up
+ *        to depth of them at once, and adds the writes to a batch as
+ *        add_to_write_batch() would. Nothing changes at the output paths
+ *        until the batch is committed.
+ *
+ * @param[in/out] batch   The batch the writes join
+ *
+ * @param[in,out] files   The files to write (path and data set)
+ *
+ * @param[in]     count   Number of files
+ *
+ * @param[in]     depth   Most files in flight at once (0 for
+ *                        KMYTH_BULK_IO_DEFAULT_DEPTH)
+ *
+ * @return 0 if every file joined the batch, 1 if any failed (see the
+ *         results; the others are in the batch)
+ */
+int kmyth_bulk_write_files(kmyth_write_batch * batch, kmyth_bulk_file * files,
+                           size_t count, size_t depth);
+
+/**
+ * @brief Names the backend bulk file I/O runs on.
+ *
+ * @return "io_uring" or "threads"
+ */
+const char *kmyth_bulk_io_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BULK_IO_H */
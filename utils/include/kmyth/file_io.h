@@ -11,6 +11,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <openssl/bio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -59,6 +61,66 @@ int verifyOutputFilePath(char *path);
 int read_bytes_from_file(char *input_path, uint8_t ** data,
                          size_t * data_length);
 
+/**
+ * @brief A read-only view of the contents of a file (see
+ *        map_bytes_from_file()).
+ */
+typedef struct kmyth_file_view kmyth_file_view;
+
+struct kmyth_file_view
+{
+  // file contents (NULL for an empty file) - must not be written to
+  uint8_t *data;
+  size_t data_length;
+
+  // releases the view (never NULL for a view set up by
+  // map_bytes_from_file(), and a no-op for an empty file)
+  void (*release)(kmyth_file_view * view);
+
+  // mapping backing the view, NULL if the contents were read into the heap
+  void *map_base;
+  size_t map_length;
+};
+
+/**
+ * @brief Maps the contents of a file, located at input_path, into memory
+ *        as a read-only view, instead of copying them into a heap buffer
+ *        like read_bytes_from_file() does. The pages are prefaulted
+ *        (MAP_POPULATE, where available) and marked for sequential access
+ *        (and, from KMYTH_HUGE_PAGE_SIZE bytes on, for huge pages where the
+ *        kernel supports them for files), and files of any size that fits
+ *        in memory can be mapped. Inputs
+ *        that cannot be mapped (e.g., pipes) are read with
+ *        read_bytes_from_file() instead, behind the same interface.
+ *
+ *        The file should not be modified while it is mapped.
+ *
+ * @param[in]  input_path  String representing the path to the file being read
+ *
+ * @param[out] view        The view of the file contents - passed as a
+ *                         pointer to the view, which the caller releases
+ *                         with view->release(view) when it is no longer
+ *                         needed (on success only)
+ *
+ * @return 0 if success, 1 if error
+ */
+int map_bytes_from_file(char *input_path, kmyth_file_view * view);
+
+/**
+ * @brief Same as map_bytes_from_file(), but for callers that only look at
+ *        a small part of the file (e.g., the header of a large .ski): the
+ *        mapping is neither prefaulted nor read ahead, so only the pages
+ *        actually touched are read from disk.
+ *
+ * @param[in]  input_path  String representing the path to the file being read
+ *
+ * @param[out] view        The view of the file contents (see
+ *                         map_bytes_from_file())
+ *
+ * @return 0 if success, 1 if error
+ */
+int peek_bytes_from_file(char *input_path, kmyth_file_view * view);
+
 /**
  * @brief Verifies output_path is valid, then writes bytes to file
  * 
@@ -74,6 +136,145 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
 int write_bytes_to_file(char *output_path,
                         uint8_t * bytes, size_t bytes_length);
 
+/**
+ * @brief Verifies output_path is valid, then replaces the file atomically:
+ *        the bytes go to a temporary file in the same directory, which is
+ *        flushed to disk and renamed over output_path, and the directory is
+ *        flushed too. After a crash, output_path holds either its previous
+ *        contents or the new ones, never part of them.
+ *
+ *        A replaced file keeps its permissions; a new one is created with
+ *        owner-only permissions.
+ *
+ * @param[in]  output_path         String containing the path to the
+ *                                 output file
+ *
+ * @param[in]  bytes               Bytes to be written
+ *
+ * @param[in]  bytes_length        Number of bytes to be written
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_bytes_to_file_atomic(char *output_path,
+                               uint8_t * bytes, size_t bytes_length);
+
+/**
+ * @brief A group of atomic file writes that are made durable together (see
+ *        add_to_write_batch() and commit_write_batch()), so that writing
+ *        many files costs one flush per file and one per directory rather
+ *        than two per file. Not safe for concurrent use; callers
+ *        sharing a batch between threads must serialize access to it.
+ */
+typedef struct kmyth_write_batch
+{
+  // final and temporary paths of the files written so far
+  char **paths;
+  char **tmp_paths;
+  size_t count;
+  size_t capacity;
+} kmyth_write_batch;
+
+/**
+ * @brief Sets up an empty write batch.
+ *
+ * @param[out] batch       The batch to initialize
+ */
+void init_write_batch(kmyth_write_batch * batch);
+
+/**
+ * @brief Verifies output_path is valid and writes the bytes to a temporary
+ *        file next to it, without waiting for the disk. Nothing changes at
+ *        output_path until the batch is committed.
+ *
+ * @param[in/out] batch        The batch the write joins
+ *
+ * @param[in]     output_path  String containing the path to the output file
+ *
+ * @param[in]     bytes        Bytes to be written
+ *
+ * @param[in]     bytes_length Number of bytes to be written
+ *
+ * @return 0 if success, 1 if error (the batch is left as it was)
+ */
+int add_to_write_batch(kmyth_write_batch * batch, char *output_path,
+                       uint8_t * bytes, size_t bytes_length);
+
+/**
+ * @brief First half of add_to_write_batch(), for callers that write the
+ *        temporary file themselves (e.g., asynchronously): verifies
+ *        output_path and creates the temporary file next to it.
+ *
+ * @param[in]  output_path  String containing the path to the output file
+ *
+ * @param[out] tmp_path     Path of the temporary file, handed on to
+ *                          close_write_batch_file()
+ *
+ * @param[out] fd           Descriptor of the temporary file, open for
+ *                          writing
+ *
+ * @return 0 if success, 1 if error
+ */
+int open_write_batch_file(char *output_path, char **tmp_path, int *fd);
+
+/**
+ * @brief Second half of add_to_write_batch(): closes a temporary file from
+ *        open_write_batch_file() and, if it was written successfully, adds
+ *        it to the batch. Otherwise (or on error) the temporary file is
+ *        removed. Either way, tmp_path is taken over.
+ *
+ * @param[in/out] batch        The batch the write joins
+ *
+ * @param[in]     output_path  String containing the path to the output file
+ *
+ * @param[in]     tmp_path     Temporary file path from open_write_batch_file()
+ *
+ * @param[in]     fd           Temporary file descriptor
+ *
+ * @param[in]     write_failed Non-zero if writing the data failed
+ *
+ * @return 0 if success, 1 if error
+ */
+int close_write_batch_file(kmyth_write_batch * batch, char *output_path,
+                           char *tmp_path, int fd, int write_failed);
+
+/**
+ * @brief Puts every file of a batch in place, with the guarantees of
+ *        write_bytes_to_file_atomic(): the data of every temporary file is
+ *        flushed to disk, then each one is renamed over its output path,
+ *        and each directory involved is flushed once. The batch is
+ *        empty afterwards, whatever the outcome.
+ *
+ * @param[in/out] batch        The batch to commit
+ *
+ * @param[out]    failed_count The number of files that could not be put
+ *                             in place (may be NULL)
+ *
+ * @return 0 if every file was committed, 1 otherwise
+ */
+int commit_write_batch(kmyth_write_batch * batch, size_t * failed_count);
+
+/**
+ * @brief Drops every file of a batch, removing the temporary files, and
+ *        leaves it empty. The output paths are left untouched.
+ *
+ * @param[in/out] batch        The batch to abort
+ */
+void abort_write_batch(kmyth_write_batch * batch);
+
+/**
+ * @brief Writes all of a buffer to a BIO. Unlike a single BIO_write(), the
+ *        length is not limited to INT_MAX and short writes are retried.
+ *
+ * @param[in]  bio             The BIO to write to
+ *
+ * @param[in]  bytes           The data to be written
+ *
+ * @param[in]  bytes_length    The number of bytes to be written
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_bytes_to_bio(BIO * bio, const uint8_t * bytes, size_t bytes_length);
+
 /**
  * @brief Prints raw bytes to standard out.
  * 
@@ -86,6 +287,68 @@ int write_bytes_to_file(char *output_path,
 int print_to_stdout(unsigned char *plain_text_data,
                     size_t plain_text_data_size);
 
+/**
+ * @brief Writes all of a buffer to an open file descriptor (e.g., one a
+ *        parent process handed down), retrying short writes.
+ *
+ * @param[in]  fd                  The descriptor to write to
+ *
+ * @param[in]  bytes               Bytes to be written
+ *
+ * @param[in]  bytes_length        Number of bytes to be written
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_bytes_to_fd(int fd, const uint8_t * bytes, size_t bytes_length);
+
+/**
+ * @brief Copies bytes into an anonymous memory file (memfd) and seals it,
+ *        so that they can be handed to another process as a descriptor
+ *        without ever reaching a filesystem. The seals forbid any write,
+ *        resize or further sealing, so whoever reads the descriptor sees
+ *        exactly these bytes. The memory is released when the last
+ *        descriptor for it is closed.
+ *
+ * @param[in]  name                Name of the memory file (only shown under
+ *                                 /proc, for debugging)
+ *
+ * @param[in]  bytes               Bytes to be written
+ *
+ * @param[in]  bytes_length        Number of bytes to be written
+ *
+ * @param[out] fd                  Descriptor of the memory file, positioned
+ *                                 at its start and closed on exec (see
+ *                                 run_with_fd())
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_bytes_to_memfd(const char *name, const uint8_t * bytes,
+                         size_t bytes_length, int *fd);
+
+/**
+ * @brief Runs a shell command with a descriptor of this process available
+ *        to it as child_fd, and waits for it to end. A descriptor that
+ *        can seek (e.g., a memory file) is read by the command from its
+ *        start. No other descriptor opened close-on-exec is passed on.
+ *
+ * @param[in]  command             The command, run with '/bin/sh -c'
+ *
+ * @param[in]  fd                  The descriptor to pass on
+ *
+ * @param[in]  child_fd            The descriptor number it gets in the
+ *                                 command
+ *
+ * @param[in]  fd_env              Name of an environment variable set to
+ *                                 child_fd for the command (may be NULL)
+ *
+ * @param[out] exit_status         The exit status of the command, or 128
+ *                                 plus the signal that ended it
+ *
+ * @return 0 if the command ran (whatever its exit status), 1 if error
+ */
+int run_with_fd(const char *command, int fd, int child_fd,
+                const char *fd_env, int *exit_status);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,13 @@ extern "C" {
  *           each one is used for parsing a kmyth-seal'd file.
  */
 
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Common start of every delimiter (never found in base64 data)
+ */
+#define KMYTH_DELIM_PREFIX "-----"
+
 /** 
  * @ingroup block_delim
  *
@@ -44,6 +51,23 @@ extern "C" {
  */
 #define KMYTH_DELIM_POLICY_BRANCH_2 "-----POLICY BRANCH 2-----\n"
 
+/**
+ * @ingroup block_delim
+ *
+ * @brief   printf() format of the delimiter of policy branch number %u used
+ *          in a compound policy, PolicyOR (branches after the second one
+ *          follow it in order)
+ */
+#define KMYTH_DELIM_POLICY_BRANCH_N "-----POLICY BRANCH %u-----\n"
+
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the public key that authorizes signed PCR policies,
+ *          which ends the PCR selection list block of data sealed to them
+ */
+#define KMYTH_DELIM_AUTHORIZING_KEY "-----POLICY AUTHORIZING KEY-----\n"
+
 /** 
  * @ingroup block_delim
  *
@@ -66,6 +90,16 @@ extern "C" {
  */
 #define KMYTH_DELIM_CIPHER_SUITE "-----CIPHER SUITE-----\n"
 
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the block containing the name of the compression
+ *          applied to the data before it was encrypted. Only present, at
+ *          the end of the CIPHER SUITE block, for compressed data, so that
+ *          a parser unaware of it rejects the cipher suite.
+ */
+#define KMYTH_DELIM_COMPRESSION "-----COMPRESSION-----\n"
+
 /** 
  * @ingroup block_delim
  *
@@ -109,6 +143,80 @@ extern "C" {
  */
 #define KMYTH_DELIM_END_NKL "-----NKL END-----\n"
 
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the block identifying the key encryption key of an
+ *          envelope (see kmyth_envelope_seal())
+ */
+#define KMYTH_DELIM_ENVELOPE_KEK_ID "-----ENVELOPE KEK ID-----\n"
+
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of an envelope's wrapped data key block
+ */
+#define KMYTH_DELIM_WRAPPED_DEK "-----WRAPPED DEK-----\n"
+
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of a signed policy's approved policy digest
+ *          block
+ */
+#define KMYTH_DELIM_APPROVED_POLICY "-----APPROVED POLICY-----\n"
+
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of a signed policy's signing key name block
+ */
+#define KMYTH_DELIM_AUTHORIZING_KEY_NAME "-----AUTHORIZING KEY NAME-----\n"
+
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of a signed policy's signature block
+ */
+#define KMYTH_DELIM_POLICY_SIGNATURE "-----POLICY SIGNATURE-----\n"
+
+/**
+ * @brief Locates the next "block" in the data read from a block file, if the
+ *        delimiter for the current file block matches the expected delimiter
+ *        value, without copying it.
+ *
+ * The block is returned as a view into the input buffer, which must outlive
+ * it. The search for the next delimiter is linear in the size of the block.
+ *
+ * @param[in/out] contents   Data buffer containing the (remaining) contents
+ *                           of a block file - passed as a pointer to the
+ *                           address of the data buffer (advanced to the next
+ *                           delimiter by this function)
+ *
+ * @param[in/out] remaining  Count of bytes remaining in data buffer -
+ *                           passed as a pointer to the count value (updated by
+ *                           this function)
+ *
+ * @param[out] block         Set to the start of the block data, within
+ *                           contents (not allocated, do not free)
+ *
+ * @param[out] blocksize     Size, in bytes, of the block - passed as a
+ *                           pointer to the length value
+ *
+ * @param[in]  delim         String value representing the expected delimiter
+ *
+ * @param[in] delim_len      Length of the expected delimeter
+ * @param[in] next_delim     String value representing the next expected
+ *                           delimiter.
+ * @param[in] next_delim_len Length of the next expected delimeter
+ * @return 0 on success, 1 on failure
+ */
+int get_block_view(uint8_t ** contents,
+                   size_t * remaining, uint8_t ** block,
+                   size_t * blocksize,
+                   char *delim, size_t delim_len,
+                   char *next_delim, size_t next_delim_len);
+
 /**
  * @brief Retrieves the contents of the next "block" in the data read from a 
  *         block file, if the delimiter for the current file block matches the
@@ -129,8 +237,9 @@ extern "C" {
  *                           this function)
  *
  * @param[out] block         Data buffer for the .ski file "block"
- *                           retrieved - passed as a pointer to the
- *                           address of the output buffer
+ *                           retrieved (a copy, see get_block_view()) -
+ *                           passed as a pointer to the address of the
+ *                           output buffer (any previous buffer is freed)
  *
  * @param[out] blocksize     Size, in bytes, of the .ski file "block" retrieved -
  *                           passed as a pointer to the length value
@@ -231,6 +340,70 @@ int decodeBase64Data(unsigned char *base64_data,
 int concat(uint8_t ** dest, size_t * dest_length, uint8_t * input,
            size_t input_length);
 
+/**
+ * @brief A growable byte array. Appends double its capacity when it runs
+ *        out, so building it up piece by piece takes amortized linear time
+ *        (unlike repeated concat() calls, which reallocate every time), and
+ *        a capacity hint that covers the final size makes it a single
+ *        allocation.
+ */
+typedef struct kmyth_byte_buffer
+{
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+} kmyth_byte_buffer;
+
+/**
+ * @brief Sets up an empty byte buffer.
+ *
+ * @param[out] buf              The buffer to initialize
+ *
+ * @param[in]  capacity_hint    Number of bytes to allocate up front
+ *                              (0 defers allocation to the first append)
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_byte_buffer(kmyth_byte_buffer * buf, size_t capacity_hint);
+
+/**
+ * @brief Appends bytes to a byte buffer, growing it if needed. On error,
+ *        the buffer is left as it was.
+ *
+ * @param[in/out] buf           The buffer appended to
+ *
+ * @param[in]     input         The bytes to append (as with concat(),
+ *                              NULL or empty input appends nothing)
+ *
+ * @param[in]     input_length  The number of bytes to append
+ *
+ * @return 0 if success, 1 if error
+ */
+int append_to_byte_buffer(kmyth_byte_buffer * buf, const uint8_t * input,
+                          size_t input_length);
+
+/**
+ * @brief Hands the contents of a byte buffer over to the caller, who frees
+ *        them, and leaves the buffer empty.
+ *
+ * @param[in/out] buf           The buffer to detach the contents from
+ *
+ * @param[out]    data          The contents - passed as a pointer to the
+ *                              address of the output buffer
+ *
+ * @param[out]    data_length   The number of bytes in data - passed as a
+ *                              pointer to the length value
+ */
+void detach_byte_buffer(kmyth_byte_buffer * buf, uint8_t ** data,
+                        size_t * data_length);
+
+/**
+ * @brief Frees the contents of a byte buffer and leaves it empty.
+ *
+ * @param[in/out] buf           The buffer to free
+ */
+void free_byte_buffer(kmyth_byte_buffer * buf);
+
 
 /**
  * @brief Converts hexadecimal string representation to the TPM2B digest, a serialized
@@ -244,6 +417,19 @@ int concat(uint8_t ** dest, size_t * dest_length, uint8_t * input,
  */
 int convert_string_to_digest(char *str, TPM2B_DIGEST * digest);
 
+/**
+ * @brief Converts a comma-separated list of hexadecimal digest strings (see
+ *        convert_string_to_digest()) to a list of TPM2B digests
+ *
+ * @param[in]  str              The string representation of the digests
+ *
+ * @param[out] list             The converted digests, in the order given
+ *
+ * @return 0 if success, 1 if error (including more digests than a
+ *         TPML_DIGEST holds)
+ */
+int convert_string_to_digest_list(char *str, TPML_DIGEST * list);
+
 /**
  * @brief Converts a serialized and compressed version of a TPM2B's digest to its hexadecimal
  *        string representation
@@ -8,6 +8,7 @@
 #ifndef MEMORY_UTIL_H
 #define MEMORY_UTIL_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -31,7 +32,8 @@ extern "C" {
 void kmyth_clear(void *v, size_t size);
 
 /**
- * @brief Wipes the memory in a designated pointer, then frees the pointer. Utilizes kmyth_clear.
+ * @brief Wipes the memory in a designated pointer, then frees the pointer with kmyth_free().
+ *         Utilizes kmyth_clear.
  *         If the size is incorrectly specified, behavior can be unpredictable. If a NULL pointer 
  *         is handled, the function simply returns.
  *
@@ -56,6 +58,306 @@ void kmyth_clear_and_free(void *v, size_t size);
  */
 void *secure_memset(void *v, int c, size_t n);
 
+/**
+ * @brief Allocation hooks (see kmyth_set_allocator()). Each is passed the
+ *        user_data given to kmyth_set_allocator(). They have the semantics
+ *        of malloc(), realloc() and free() respectively.
+ */
+typedef void *(*kmyth_alloc_fn) (size_t size, void *user_data);
+typedef void *(*kmyth_realloc_fn) (void *ptr, size_t size, void *user_data);
+typedef void (*kmyth_free_fn) (void *ptr, void *user_data);
+
+/**
+ * @brief Routes the heap allocations of the Kmyth libraries (libkmyth-tpm,
+ *        libkmyth-utils and the SGX common code) to caller-supplied hooks,
+ *        e.g., an arena, a pool or an mlocked region. Memory that a Kmyth
+ *        function hands to its caller comes from these hooks, and must be
+ *        released with kmyth_free() (or kmyth_clear_and_free()). Memory
+ *        allocated by other libraries (OpenSSL, TSS2, libkmip) is not
+ *        affected.
+ *
+ *        The hooks are process wide. They must be set before any other
+ *        Kmyth call, and not changed while memory allocated with the
+ *        previous ones is still in use.
+ *
+ * @param[in] alloc_fn      Allocation hook
+ *
+ * @param[in] realloc_fn    Reallocation hook
+ *
+ * @param[in] free_fn       Release hook
+ *
+ * @param[in] user_data     Passed to every hook call (may be NULL)
+ *
+ * @return 0 on success, 1 if only some of the hooks are given (passing
+ *         NULL for all three restores malloc(), realloc() and free())
+ */
+int kmyth_set_allocator(kmyth_alloc_fn alloc_fn, kmyth_realloc_fn realloc_fn,
+                        kmyth_free_fn free_fn, void *user_data);
+
+/**
+ * @brief Same as malloc(), through the hooks set by kmyth_set_allocator()
+ */
+void *kmyth_malloc(size_t size);
+
+/**
+ * @brief Same as calloc(), through the hooks set by kmyth_set_allocator()
+ */
+void *kmyth_calloc(size_t count, size_t size);
+
+/**
+ * @brief Same as realloc(), through the hooks set by kmyth_set_allocator()
+ */
+void *kmyth_realloc(void *ptr, size_t size);
+
+/**
+ * @brief Same as free(), through the hooks set by kmyth_set_allocator()
+ */
+void kmyth_free(void *ptr);
+
+/**
+ * @brief Same as strdup(), through the hooks set by kmyth_set_allocator()
+ */
+char *kmyth_strdup(const char *str);
+
+/**
+ * @brief Phases that the Kmyth heap allocations are attributed to. A
+ *        thread's allocations go to the phase it last entered (see
+ *        kmyth_alloc_set_phase()); the library marks reading input files,
+ *        parsing .ski data, base64 decoding, decrypting (and decompressing)
+ *        and writing or caching output.
+ */
+typedef enum
+{
+  KMYTH_ALLOC_PHASE_OTHER,
+  KMYTH_ALLOC_PHASE_READ,
+  KMYTH_ALLOC_PHASE_PARSE,
+  KMYTH_ALLOC_PHASE_DECODE,
+  KMYTH_ALLOC_PHASE_DECRYPT,
+  KMYTH_ALLOC_PHASE_OUTPUT,
+  KMYTH_ALLOC_PHASE_COUNT
+} kmyth_alloc_phase;
+
+/**
+ * @brief Allocation figures, for one phase or for all of them
+ */
+typedef struct
+{
+  // allocations (kmyth_realloc() included) and releases
+  uint64_t allocs;
+  uint64_t frees;
+
+  // bytes handed out by the allocations
+  uint64_t bytes;
+
+  // most bytes live at once (in all Kmyth heap memory, including what
+  // other phases allocated) at an allocation made in the phase
+  uint64_t peak_bytes;
+} kmyth_alloc_stats;
+
+/**
+ * @brief Turns allocation accounting on or off. While it is on, every
+ *        kmyth_malloc(), kmyth_calloc(), kmyth_realloc() and kmyth_free()
+ *        (and so every function built on them) is counted, with the size
+ *        the C library reports for the block. Accounting only covers the C
+ *        library allocator: it is unavailable once kmyth_set_allocator()
+ *        has installed hooks, and on platforms without
+ *        malloc_usable_size().
+ *
+ *        Blocks allocated before accounting was turned on are not counted
+ *        when they are released, so turn it on before the work to measure.
+ *
+ * @param[in] enable        true to count allocations, false to stop
+ *
+ * @return 0 on success, 1 if accounting is unavailable
+ */
+int kmyth_alloc_stats_enable(bool enable);
+
+/**
+ * @brief Tells whether allocation accounting is on.
+ *
+ * @return true if kmyth_alloc_stats_enable(true) succeeded (and accounting
+ *         was not turned off since)
+ */
+bool kmyth_alloc_stats_enabled(void);
+
+/**
+ * @brief Attributes the calling thread's allocations to a phase, until the
+ *        next call. Phases nest by restoring the previous one:
+ *
+ *          kmyth_alloc_phase prev = kmyth_alloc_set_phase(PHASE);
+ *          ...
+ *          kmyth_alloc_set_phase(prev);
+ *
+ * @param[in] phase         Phase to enter
+ *
+ * @return The phase the thread was in
+ */
+kmyth_alloc_phase kmyth_alloc_set_phase(kmyth_alloc_phase phase);
+
+/**
+ * @brief Reads the allocation figures of a phase.
+ *
+ * @param[in]  phase        Phase to read, or KMYTH_ALLOC_PHASE_COUNT for
+ *                          the figures of all phases together
+ *
+ * @param[out] stats        The figures (all zero for an invalid phase)
+ */
+void kmyth_alloc_get_stats(kmyth_alloc_phase phase, kmyth_alloc_stats * stats);
+
+/**
+ * @brief Returns the number of Kmyth heap bytes currently live (allocated
+ *        since accounting was turned on and not yet released).
+ *
+ * @return Live bytes
+ */
+uint64_t kmyth_alloc_live_bytes(void);
+
+/**
+ * @brief Sets every allocation figure back to zero. The live byte count
+ *        is kept, and the overall peak starts again from it (so the overall
+ *        peak read later, less the live bytes now, is the most the work in
+ *        between added).
+ */
+void kmyth_alloc_stats_reset(void);
+
+/**
+ * @brief Returns the name of an allocation phase (e.g., "decrypt").
+ *
+ * @param[in] phase         Phase
+ *
+ * @return Static string ("total" for KMYTH_ALLOC_PHASE_COUNT)
+ */
+const char *kmyth_alloc_phase_name(kmyth_alloc_phase phase);
+
+/**
+ * @brief Alignment of the blocks handed out by kmyth_arena_alloc()
+ */
+#define KMYTH_ARENA_ALIGN 16
+
+/**
+ * @brief Size of a huge page (the x86-64 and aarch64 default). Arenas and
+ *        file mappings at least this large are backed by huge pages where
+ *        the platform allows it, which spares multi-GB payloads most of
+ *        their TLB misses and page faults.
+ */
+#define KMYTH_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+/**
+ * @brief The pages backing the region of a secure arena
+ */
+typedef enum
+{
+  // regular pages
+  KMYTH_ARENA_PAGES_BASE = 0,
+
+  // regular mapping the kernel was asked to back by transparent huge
+  // pages (MADV_HUGEPAGE), as far as it is able to
+  KMYTH_ARENA_PAGES_TRANSPARENT,
+
+  // explicit huge pages from the reserved pool (MAP_HUGETLB)
+  KMYTH_ARENA_PAGES_HUGETLB,
+} kmyth_arena_pages;
+
+/**
+ * @brief A secure arena: a fixed-size, page-aligned memory region, locked
+ *        into RAM (mlock) and excluded from core dumps (MADV_DONTDUMP)
+ *        where the platform allows it, from which short-lived secrets
+ *        (keys, plaintext) are carved in order. Memory returned to the
+ *        arena is always wiped.
+ */
+typedef struct
+{
+  // start and size of the mapped region (NULL and 0 when not initialized)
+  unsigned char *base;
+  size_t size;
+
+  // number of bytes in use, from the start of the region
+  size_t used;
+
+  // region is locked into RAM (mlock() is best effort)
+  bool locked;
+
+  // pages backing the region
+  kmyth_arena_pages pages;
+} kmyth_arena;
+
+/**
+ * @brief Maps the region of a secure arena. Failing to lock it into RAM
+ *        (e.g., because of RLIMIT_MEMLOCK) is not an error, see
+ *        kmyth_arena.locked.
+ *
+ *        An arena of at least KMYTH_HUGE_PAGE_SIZE bytes is first mapped
+ *        from explicit huge pages; when none are reserved it falls back to
+ *        a huge page aligned regular mapping advised to use transparent
+ *        huge pages, and then to regular pages alone (see
+ *        kmyth_arena.pages).
+ *
+ * @param[out] arena     The arena to initialize
+ *
+ * @param[in]  size      Minimum size of the arena in bytes, rounded up to
+ *                       a whole number of pages (of huge pages, for a
+ *                       huge page backed arena)
+ *
+ * @return 0 on success, 1 on error (the arena is then left empty, and
+ *         every kmyth_arena_alloc() from it fails)
+ */
+int kmyth_arena_init(kmyth_arena * arena, size_t size);
+
+/**
+ * @brief Wipes and unmaps the region of a secure arena. Every block taken
+ *        from it becomes invalid. An empty arena is ignored.
+ *
+ * @param[in,out] arena  The arena to release
+ */
+void kmyth_arena_free(kmyth_arena * arena);
+
+/**
+ * @brief Takes a zeroed block from a secure arena.
+ *
+ * @param[in,out] arena  The arena to allocate from
+ *
+ * @param[in]     size   Size of the block in bytes
+ *
+ * @return Pointer to the block (aligned to KMYTH_ARENA_ALIGN), or NULL if
+ *         the arena is empty or has no room left; callers then fall back
+ *         to the heap (see kmyth_arena_release())
+ */
+void *kmyth_arena_alloc(kmyth_arena * arena, size_t size);
+
+/**
+ * @brief Wipes every block of a secure arena and makes its whole region
+ *        available again. Every block taken from it becomes invalid.
+ *
+ * @param[in,out] arena  The arena to reset
+ */
+void kmyth_arena_reset(kmyth_arena * arena);
+
+/**
+ * @brief Tells whether a pointer lies within the region of a secure arena.
+ *
+ * @param[in]  arena     The arena
+ *
+ * @param[in]  v         The pointer
+ *
+ * @return true if v points into the arena, false otherwise
+ */
+bool kmyth_arena_contains(const kmyth_arena * arena, const void *v);
+
+/**
+ * @brief Returns a block to where it came from: a block of the arena is
+ *        wiped (and its space reclaimed if it is the last one taken, so
+ *        that blocks released in reverse order of allocation can be reused
+ *        without a reset), anything else is handed to
+ *        kmyth_clear_and_free(). A NULL pointer is ignored.
+ *
+ * @param[in,out] arena  The arena v may have been taken from (may be NULL)
+ *
+ * @param[in,out] v      The block to release
+ *
+ * @param[in]     size   The size of the block
+ */
+void kmyth_arena_release(kmyth_arena * arena, void *v, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
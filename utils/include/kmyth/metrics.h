@@ -0,0 +1,236 @@
+/**
+ * @file  metrics.h
+ *
+ * @brief Provides the in-process metrics registry updated by the Kmyth
+ *        libraries: counters, TPM error counts (by response code), cache
+ *        hit/miss counts and fixed-bucket latency histograms.
+ *
+ *        Every update is a single relaxed atomic add, so the calls can sit
+ *        on hot paths and be made from any thread. The registry can be
+ *        written out in the Prometheus text exposition format (e.g., for
+ *        the node_exporter textfile collector) or as a short summary.
+ *
+ *        While allocation accounting is on (see kmyth_alloc_stats_enable()
+ *        in memory_util.h), its per-phase figures are written out as well.
+ *        They are kept per process, even after kmyth_metrics_share().
+ */
+
+#ifndef KMYTH_METRICS_H
+#define KMYTH_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Plain counters
+ */
+typedef enum
+{
+  KMYTH_METRIC_SEALS,
+  KMYTH_METRIC_SEAL_ERRORS,
+  KMYTH_METRIC_UNSEALS,
+  KMYTH_METRIC_UNSEAL_ERRORS,
+  KMYTH_METRIC_BYTES_ENCRYPTED,
+  KMYTH_METRIC_BYTES_DECRYPTED,
+  KMYTH_METRIC_KEY_REQUESTS,
+  KMYTH_METRIC_KEY_REQUEST_ERRORS,
+  KMYTH_METRIC_TLS_HANDSHAKE_ERRORS,
+  KMYTH_METRIC_COUNTER_COUNT
+} kmyth_metric_counter;
+
+/**
+ * @brief Caches whose hits and misses are counted
+ */
+typedef enum
+{
+  KMYTH_METRIC_CACHE_SRK,
+  KMYTH_METRIC_CACHE_CAPABILITY,
+  KMYTH_METRIC_CACHE_STORAGE_KEY,
+  KMYTH_METRIC_CACHE_POLICY,
+  KMYTH_METRIC_CACHE_SECRET,
+  KMYTH_METRIC_CACHE_TLS_SESSION,
+  KMYTH_METRIC_CACHE_TLS_CONNECTION,
+  KMYTH_METRIC_CACHE_NSL_PKEY_CTX,
+  KMYTH_METRIC_CACHE_ECDH_KEYPAIR,
+  KMYTH_METRIC_CACHE_ECDH_TICKET,
+  KMYTH_METRIC_CACHE_KEYRING,
+  KMYTH_METRIC_CACHE_COUNT
+} kmyth_metric_cache;
+
+/**
+ * @brief Latency histograms
+ */
+typedef enum
+{
+  KMYTH_METRIC_SEAL_TIME,
+  KMYTH_METRIC_UNSEAL_TIME,
+  KMYTH_METRIC_TLS_HANDSHAKE_TIME,
+  KMYTH_METRIC_HISTOGRAM_COUNT
+} kmyth_metric_histogram;
+
+/// Number of distinct TPM response codes counted separately (any further
+/// codes are counted together, as rc="other")
+#define KMYTH_METRICS_MAX_TPM_RCS 32
+
+/// Number of finite histogram buckets (upper bounds from 100 us to 10 s)
+#define KMYTH_METRICS_HISTOGRAM_BUCKETS 12
+
+/**
+ * @brief Adds to a counter.
+ *
+ * @param[in]  counter  Counter to update
+ *
+ * @param[in]  n        Amount to add
+ */
+void kmyth_metrics_add(kmyth_metric_counter counter, uint64_t n);
+
+/**
+ * @brief Adds one to a counter.
+ *
+ * @param[in]  counter  Counter to update
+ */
+void kmyth_metrics_inc(kmyth_metric_counter counter);
+
+/**
+ * @brief Counts a TPM command that failed.
+ *
+ * @param[in]  rc       TPM (TSS2) response code of the command
+ */
+void kmyth_metrics_tpm_error(uint32_t rc);
+
+/**
+ * @brief Counts a cache lookup.
+ *
+ * @param[in]  cache    Cache that was looked in
+ *
+ * @param[in]  hit      Non-zero if the lookup found what it wanted
+ */
+void kmyth_metrics_cache_lookup(kmyth_metric_cache cache, int hit);
+
+/**
+ * @brief Reads the monotonic clock, for use with
+ *        kmyth_metrics_observe_since().
+ *
+ * @return Microseconds since an arbitrary (fixed) point in time
+ */
+uint64_t kmyth_metrics_now_us(void);
+
+/**
+ * @brief Records a duration in a histogram.
+ *
+ * @param[in]  histogram  Histogram to update
+ *
+ * @param[in]  usec       Duration, in microseconds
+ */
+void kmyth_metrics_observe(kmyth_metric_histogram histogram, uint64_t usec);
+
+/**
+ * @brief Records the time elapsed since start_us in a histogram.
+ *
+ * @param[in]  histogram  Histogram to update
+ *
+ * @param[in]  start_us   Value returned by kmyth_metrics_now_us() when the
+ *                        timed operation began
+ */
+void kmyth_metrics_observe_since(kmyth_metric_histogram histogram,
+                                 uint64_t start_us);
+
+/**
+ * @brief Returns the current value of a counter.
+ *
+ * @param[in]  counter  Counter to read
+ *
+ * @return Counter value
+ */
+uint64_t kmyth_metrics_get(kmyth_metric_counter counter);
+
+/**
+ * @brief Returns the number of times a cache lookup hit or missed.
+ *
+ * @param[in]  cache    Cache to read
+ *
+ * @param[in]  hit      Non-zero for the hit count, zero for the miss count
+ *
+ * @return Lookup count
+ */
+uint64_t kmyth_metrics_get_cache(kmyth_metric_cache cache, int hit);
+
+/**
+ * @brief Returns the number of failed TPM commands with a response code.
+ *
+ * @param[in]  rc       TPM (TSS2) response code
+ *
+ * @return Number of failures counted under rc (0 if it was never seen, or
+ *         if it arrived after KMYTH_METRICS_MAX_TPM_RCS other codes)
+ */
+uint64_t kmyth_metrics_get_tpm_error(uint32_t rc);
+
+/**
+ * @brief Returns the number of durations recorded in a histogram and their
+ *        sum.
+ *
+ * @param[in]  histogram  Histogram to read
+ *
+ * @param[out] sum_us     Sum of the recorded durations, in microseconds
+ *                        (may be NULL)
+ *
+ * @return Number of recorded durations
+ */
+uint64_t kmyth_metrics_get_histogram(kmyth_metric_histogram histogram,
+                                     uint64_t * sum_us);
+
+/**
+ * @brief Sets every metric back to zero (meant for tests and for tools
+ *        that report per-run figures), allocation figures included (see
+ *        kmyth_alloc_stats_reset()).
+ */
+void kmyth_metrics_reset(void);
+
+/**
+ * @brief Moves the registry into memory shared with the child processes
+ *        forked from here on, so that a server that forks a child per
+ *        session still keeps a single set of figures. Call it once, before
+ *        forking and before any other thread uses the registry.
+ *
+ * @return 0 on success, 1 on error (the registry stays process-local)
+ */
+int kmyth_metrics_share(void);
+
+/**
+ * @brief Writes every metric in the Prometheus text exposition format.
+ *
+ * @param[in]  out      Stream to write to
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_metrics_write_prometheus(FILE * out);
+
+/**
+ * @brief Replaces a file with the current metrics in the Prometheus text
+ *        exposition format. The new contents are written to a temporary
+ *        file that is then renamed over path, so that a scraper never sees
+ *        a partly written file.
+ *
+ * @param[in]  path     Path of the file to write
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_metrics_write_file(const char *path);
+
+/**
+ * @brief Writes a short, human readable summary of the non-zero metrics
+ *        (as printed by the --stats option of the command line tools).
+ *
+ * @param[in]  out      Stream to write to
+ */
+void kmyth_metrics_print_summary(FILE * out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KMYTH_METRICS_H */
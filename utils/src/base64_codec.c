@@ -0,0 +1,411 @@
+/**
+ * base64_codec.c:
+ *
+ * C library containing the base64 codec supporting Kmyth (see
+ * base64_codec.h). The vectorized code follows the well known AVX2 base64
+ * algorithms of W. Mula and D. Lemire: 24 bytes are encoded into 32 symbols
+ * (and 32 symbols decoded into 24 bytes) per step, with lookups done by
+ * byte shuffles.
+ */
+
+#include "base64_codec.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KMYTH_BASE64_AVX2 1
+#include <immintrin.h>
+#endif
+
+/// Number of raw bytes encoded on each line of output
+#define RAW_BYTES_PER_LINE ((KMYTH_BASE64_LINE_LEN / 4) * 3)
+
+// marks, in the decoding table, bytes that are not base64 symbols
+#define DEC_WHITESPACE 0x40
+#define DEC_PAD 0x41
+#define DEC_INVALID 0xFF
+
+static const uint8_t enc_table[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const uint8_t dec_table[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x40, 0x40, 0x40, 0x40, 0x40, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B,
+  0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0x41, 0xFF, 0xFF,
+  0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+  0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+  0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+  0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20,
+  0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30,
+  0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// whether the vectorized code may be used (see kmyth_base64_set_simd())
+static bool simd_enabled = true;
+
+//############################################################################
+// use_avx2()
+//############################################################################
+static bool use_avx2(void)
+{
+#ifdef KMYTH_BASE64_AVX2
+  __builtin_cpu_init();
+  return simd_enabled && __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+//############################################################################
+// encode_group()
+//############################################################################
+static inline void encode_group(const uint8_t * in, uint8_t * out)
+{
+  uint32_t v = ((uint32_t) in[0] << 16) | ((uint32_t) in[1] << 8) | in[2];
+
+  out[0] = enc_table[(v >> 18) & 0x3F];
+  out[1] = enc_table[(v >> 12) & 0x3F];
+  out[2] = enc_table[(v >> 6) & 0x3F];
+  out[3] = enc_table[v & 0x3F];
+}
+
+#ifdef KMYTH_BASE64_AVX2
+//############################################################################
+// encode_block_avx2()
+//############################################################################
+__attribute__((target("avx2")))
+static inline void encode_block_avx2(const uint8_t * in, uint8_t * out)
+{
+  // each 128-bit lane gets 12 input bytes (and reads 4 more, unused)
+  __m256i v =
+    _mm256_inserti128_si256(_mm256_castsi128_si256
+                            (_mm_loadu_si128((const __m128i *) in)),
+                            _mm_loadu_si128((const __m128i *) (in + 12)), 1);
+
+  // spread every 3 bytes (a, b, c) over a 32-bit word as (b, a, c, b)
+  v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                              7, 6, 8, 7, 10, 9, 11, 10,
+                                              1, 0, 2, 1, 4, 3, 5, 4,
+                                              7, 6, 8, 7, 10, 9, 11, 10));
+
+  // move each 6-bit index to the low bits of its own byte
+  __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00));
+  __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+  __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0));
+  __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+  __m256i idx = _mm256_or_si256(t1, t3);
+
+  // translate indices to symbols by adding the offset of their range
+  __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+                                 -4, -4, -4, -4, -19, -16, 0, 0,
+                                 65, 71, -4, -4, -4, -4, -4, -4,
+                                 -4, -4, -4, -4, -19, -16, 0, 0);
+  __m256i range = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+  __m256i lower = _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25));
+
+  range = _mm256_sub_epi8(range, lower);
+  _mm256_storeu_si256((__m256i *) out,
+                      _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, range)));
+}
+
+//############################################################################
+// decode_block_avx2()
+//############################################################################
+__attribute__((target("avx2")))
+static inline bool decode_block_avx2(const uint8_t * in, uint8_t * out)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1A,
+                                          0x1B, 0x1B, 0x1B, 0x1A,
+                                          0x15, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1A,
+                                          0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02,
+                                          0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02,
+                                          0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+
+  __m256i str = _mm256_loadu_si256((const __m256i *) in);
+
+  // classify every byte by its nibbles: any byte outside the alphabet
+  // (whitespace and padding included) has a bit set in both lookups
+  __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+  __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+  __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+  __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+
+  if (!_mm256_testz_si256(lo, hi))
+  {
+    return false;
+  }
+
+  // translate symbols to 6-bit values ('/' is the one odd case)
+  __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+  __m256i roll =
+    _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+
+  str = _mm256_add_epi8(str, roll);
+
+  // pack 4 x 6 bits into 3 bytes, then the 12 bytes of each lane together
+  __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+
+  merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+  merged = _mm256_shuffle_epi8(merged,
+                               _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                                8, 14, 13, 12, -1, -1, -1, -1,
+                                                2, 1, 0, 6, 5, 4, 10, 9,
+                                                8, 14, 13, 12, -1, -1, -1,
+                                                -1));
+  merged = _mm256_permutevar8x32_epi32(merged,
+                                       _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7,
+                                                         7));
+
+  // all 32 bytes are stored; only the first 24 are output
+  _mm256_storeu_si256((__m256i *) out, merged);
+  return true;
+}
+#endif
+
+//############################################################################
+// kmyth_base64_encoded_size()
+//############################################################################
+size_t kmyth_base64_encoded_size(size_t raw_size)
+{
+  size_t symbols = ((raw_size + 2) / 3) * 4;
+
+  return symbols + (symbols + KMYTH_BASE64_LINE_LEN - 1) /
+    KMYTH_BASE64_LINE_LEN;
+}
+
+//############################################################################
+// kmyth_base64_decoded_max_size()
+//############################################################################
+size_t kmyth_base64_decoded_max_size(size_t encoded_size)
+{
+  return (encoded_size / 4) * 3;
+}
+
+//############################################################################
+// kmyth_base64_encode()
+//############################################################################
+size_t kmyth_base64_encode(const uint8_t * raw, size_t raw_size,
+                           uint8_t * encoded)
+{
+  uint8_t *out = encoded;
+
+#ifdef KMYTH_BASE64_AVX2
+  bool avx2 = use_avx2();
+#endif
+
+  // full lines: the vector code reads 4 bytes past the 48 it encodes, so
+  // it is only used while that much input remains
+  while (raw_size >= RAW_BYTES_PER_LINE)
+  {
+#ifdef KMYTH_BASE64_AVX2
+    if (avx2 && raw_size >= RAW_BYTES_PER_LINE + 4)
+    {
+      encode_block_avx2(raw, out);
+      encode_block_avx2(raw + 24, out + 32);
+    }
+    else
+#endif
+    {
+      for (size_t i = 0; i < RAW_BYTES_PER_LINE / 3; i++)
+      {
+        encode_group(raw + 3 * i, out + 4 * i);
+      }
+    }
+    out += KMYTH_BASE64_LINE_LEN;
+    *out++ = '\n';
+    raw += RAW_BYTES_PER_LINE;
+    raw_size -= RAW_BYTES_PER_LINE;
+  }
+
+  // last, partial line (padded to a multiple of four symbols)
+  if (raw_size > 0)
+  {
+    while (raw_size >= 3)
+    {
+      encode_group(raw, out);
+      out += 4;
+      raw += 3;
+      raw_size -= 3;
+    }
+    if (raw_size > 0)
+    {
+      uint8_t tail[3] = { raw[0], (raw_size == 2) ? raw[1] : 0, 0 };
+
+      encode_group(tail, out);
+      out[3] = '=';
+      if (raw_size == 1)
+      {
+        out[2] = '=';
+      }
+      out += 4;
+    }
+    *out++ = '\n';
+  }
+
+  return (size_t) (out - encoded);
+}
+
+//############################################################################
+// kmyth_base64_decode()
+//############################################################################
+int kmyth_base64_decode(const uint8_t * encoded, size_t encoded_size,
+                        uint8_t * raw, size_t *raw_size)
+{
+  size_t in = 0;
+  size_t out = 0;
+  uint32_t acc = 0;
+  unsigned int pending = 0;
+
+#ifdef KMYTH_BASE64_AVX2
+  bool avx2 = use_avx2();
+  size_t capacity = kmyth_base64_decoded_max_size(encoded_size);
+#endif
+
+  while (in < encoded_size)
+  {
+#ifdef KMYTH_BASE64_AVX2
+    // whole blocks of 32 symbols (no whitespace or padding) are decoded with
+    // vector code; it stores 32 bytes, so near the end of the output buffer
+    // the 24 valid ones are copied out of a scratch block instead
+    if (avx2 && pending == 0 && encoded_size - in >= 32)
+    {
+      if (out + 32 <= capacity)
+      {
+        if (decode_block_avx2(encoded + in, raw + out))
+        {
+          in += 32;
+          out += 24;
+          continue;
+        }
+      }
+      else
+      {
+        uint8_t block[32];
+
+        if (decode_block_avx2(encoded + in, block))
+        {
+          memcpy(raw + out, block, 24);
+          in += 32;
+          out += 24;
+          continue;
+        }
+      }
+    }
+#endif
+
+    uint8_t v = dec_table[encoded[in++]];
+
+    if (v < 64)
+    {
+      acc = (acc << 6) | v;
+      if (++pending == 4)
+      {
+        raw[out++] = (uint8_t) (acc >> 16);
+        raw[out++] = (uint8_t) (acc >> 8);
+        raw[out++] = (uint8_t) acc;
+        acc = 0;
+        pending = 0;
+      }
+    }
+    else if (v == DEC_WHITESPACE)
+    {
+      continue;
+    }
+    else if (v == DEC_PAD)
+    {
+      // one '=' completes a group of three symbols, two a group of two
+      if (pending < 2)
+      {
+        return 1;
+      }
+      unsigned int pads = 1;
+
+      while (in < encoded_size)
+      {
+        v = dec_table[encoded[in++]];
+        if (v == DEC_PAD)
+        {
+          pads++;
+        }
+        else if (v != DEC_WHITESPACE)
+        {
+          return 1;
+        }
+      }
+      if (pending + pads != 4)
+      {
+        return 1;
+      }
+      if (pending == 2)
+      {
+        raw[out++] = (uint8_t) (acc >> 4);
+      }
+      else
+      {
+        raw[out++] = (uint8_t) (acc >> 10);
+        raw[out++] = (uint8_t) (acc >> 2);
+      }
+      pending = 0;
+    }
+    else
+    {
+      return 1;
+    }
+  }
+
+  // the input must end on a complete group of four symbols
+  if (pending != 0)
+  {
+    return 1;
+  }
+
+  *raw_size = out;
+  return 0;
+}
+
+//############################################################################
+// kmyth_base64_set_simd()
+//############################################################################
+bool kmyth_base64_set_simd(bool enable)
+{
+  simd_enabled = enable;
+  return use_avx2();
+}
@@ -0,0 +1,715 @@
+/**
+ * bulk_io.c:
+ *
+ * C library providing bulk file input and output (many files in flight at
+ * once) for Kmyth applications using TPM 2.0.
+ */
+
+#include "bulk_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "defines.h"
+
+#include "memory_util.h"
+
+#if defined(__linux__) && !defined(KMYTH_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define KMYTH_BULK_IO_URING 1
+#endif
+#endif
+#endif
+
+//############################################################################
+// bulk_depth()
+//############################################################################
+static size_t bulk_depth(size_t depth, size_t count)
+{
+  if (depth == 0)
+  {
+    depth = KMYTH_BULK_IO_DEFAULT_DEPTH;
+  }
+  if (depth > KMYTH_BULK_IO_MAX_DEPTH)
+  {
+    depth = KMYTH_BULK_IO_MAX_DEPTH;
+  }
+  return (depth < count) ? depth : count;
+}
+
+//############################################################################
+// bulk_result()
+//############################################################################
+static int bulk_result(kmyth_bulk_file * files, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    if (files[i].result != 0)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Thread pool backend: each thread takes the next file and runs the plain
+ * file_io.h functions on it. Writes only join the batch under the lock.
+ */
+typedef struct
+{
+  kmyth_bulk_file *files;
+  size_t count;
+  size_t next;
+
+  // NULL when reading
+  kmyth_write_batch *batch;
+  pthread_mutex_t lock;
+} bulk_pool;
+
+//############################################################################
+// pool_worker()
+//############################################################################
+static void *pool_worker(void *arg)
+{
+  bulk_pool *pool = (bulk_pool *) arg;
+  size_t i;
+
+  while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED))
+         < pool->count)
+  {
+    kmyth_bulk_file *file = &pool->files[i];
+
+    if (pool->batch == NULL)
+    {
+      file->result = read_bytes_from_file(file->path, &file->data,
+                                          &file->data_len);
+      continue;
+    }
+
+    char *tmp_path = NULL;
+    int fd = -1;
+
+    if (open_write_batch_file(file->path, &tmp_path, &fd))
+    {
+      file->result = 1;
+      continue;
+    }
+
+    int write_failed = write_bytes_to_fd(fd, file->data, file->data_len);
+
+    pthread_mutex_lock(&pool->lock);
+    file->result = close_write_batch_file(pool->batch, file->path, tmp_path,
+                                          fd, write_failed);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return NULL;
+}
+
+//############################################################################
+// pool_io()
+//############################################################################
+static void pool_io(kmyth_bulk_file * files, size_t count, size_t depth,
+                    kmyth_write_batch * batch)
+{
+  bulk_pool pool = {.files = files,.count = count,.next = 0,.batch = batch };
+  pthread_t threads[KMYTH_BULK_IO_MAX_DEPTH];
+  size_t started = 0;
+
+  pthread_mutex_init(&pool.lock, NULL);
+
+  // the calling thread is one of the workers
+  while (started + 1 < depth &&
+         pthread_create(&threads[started], NULL, pool_worker, &pool) == 0)
+  {
+    started++;
+  }
+  pool_worker(&pool);
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool.lock);
+}
+
+#ifdef KMYTH_BULK_IO_URING
+
+/*
+ * io_uring backend: one thread keeps up to depth files in flight on a
+ * ring, each with at most one request queued at a time. A file is opened
+ * (a read with IORING_OP_OPENAT, a write through open_write_batch_file()),
+ * transferred in chunks of at most KMYTH_MAX_IO_CHUNK bytes, then closed.
+ */
+typedef struct
+{
+  int fd;
+
+  // submission queue ring, its entries, and completion queue ring
+  void *sq_ring;
+  size_t sq_ring_len;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned sq_entries;
+
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+
+  void *cq_ring;
+  size_t cq_ring_len;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  // requests queued but not yet submitted
+  unsigned queued;
+} bulk_ring;
+
+typedef struct
+{
+  kmyth_bulk_file *file;
+  int fd;
+  bool opening;
+
+  // bytes to transfer and transferred so far, and the current chunk
+  size_t len;
+  size_t done;
+  struct iovec iov;
+
+  // temporary file of a write
+  char *tmp_path;
+} bulk_slot;
+
+//############################################################################
+// ring_free()
+//############################################################################
+static void ring_free(bulk_ring * ring)
+{
+  if (ring->sqes != NULL)
+  {
+    munmap(ring->sqes, ring->sqes_len);
+  }
+  if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+  {
+    munmap(ring->cq_ring, ring->cq_ring_len);
+  }
+  if (ring->sq_ring != NULL)
+  {
+    munmap(ring->sq_ring, ring->sq_ring_len);
+  }
+  if (ring->fd >= 0)
+  {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(bulk_ring));
+  ring->fd = -1;
+}
+
+//############################################################################
+// ring_init()
+//############################################################################
+static int ring_init(bulk_ring * ring, unsigned entries)
+{
+  struct io_uring_params params;
+
+  memset(ring, 0, sizeof(bulk_ring));
+  memset(&params, 0, sizeof(params));
+
+  ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+  {
+    // not supported by this kernel, or not allowed (e.g., by seccomp)
+    ring->fd = -1;
+    return 1;
+  }
+
+  ring->sq_ring_len = params.sq_off.array + params.sq_entries *
+    sizeof(unsigned);
+  ring->cq_ring_len = params.cq_off.cqes + params.cq_entries *
+    sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cq_ring_len > ring->sq_ring_len)
+    {
+      ring->sq_ring_len = ring->cq_ring_len;
+    }
+    ring->cq_ring_len = ring->sq_ring_len;
+  }
+
+  void *sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+
+  if (sq_ring == MAP_FAILED)
+  {
+    ring_free(ring);
+    return 1;
+  }
+  ring->sq_ring = sq_ring;
+
+  void *cq_ring = sq_ring;
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+    {
+      ring_free(ring);
+      return 1;
+    }
+  }
+  ring->cq_ring = cq_ring;
+
+  ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  void *sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (sqes == MAP_FAILED)
+  {
+    ring_free(ring);
+    return 1;
+  }
+  ring->sqes = sqes;
+
+  unsigned char *sq = sq_ring;
+  unsigned char *cq = cq_ring;
+
+  ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+  ring->sq_entries = params.sq_entries;
+  ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return 0;
+}
+
+//############################################################################
+// ring_queue()
+//############################################################################
+static void ring_queue(bulk_ring * ring, uint8_t opcode, int fd,
+                       const void *addr, uint32_t len, uint64_t offset,
+                       uint32_t flags, uint64_t user_data)
+{
+  // a slot has at most one request queued or in flight, and the ring has
+  // at least as many entries as there are slots, so there is always room
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) addr;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->open_flags = flags;
+  sqe->user_data = user_data;
+  ring->sq_array[index] = index;
+
+  // the kernel must see the entry filled in before the new tail
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+}
+
+//############################################################################
+// ring_submit_and_wait()
+//############################################################################
+static int ring_submit_and_wait(bulk_ring * ring)
+{
+  for (;;)
+  {
+    long ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+
+    if (ret >= 0)
+    {
+      ring->queued -= (unsigned) ret;
+      return 0;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+      return 1;
+    }
+  }
+}
+
+//############################################################################
+// slot_queue_transfer()
+//############################################################################
+static void slot_queue_transfer(bulk_ring * ring, bulk_slot * slot,
+                                uint64_t user_data, bool writing)
+{
+  size_t chunk = slot->len - slot->done;
+
+  if (chunk > KMYTH_MAX_IO_CHUNK)
+  {
+    chunk = KMYTH_MAX_IO_CHUNK;
+  }
+  slot->iov.iov_base = slot->file->data + slot->done;
+  slot->iov.iov_len = chunk;
+  ring_queue(ring, writing ? IORING_OP_WRITEV : IORING_OP_READV, slot->fd,
+             &slot->iov, 1, slot->done, 0, user_data);
+}
+
+//############################################################################
+// slot_finish()
+//############################################################################
+static void slot_finish(bulk_slot * slot, kmyth_write_batch * batch,
+                        int failed)
+{
+  kmyth_bulk_file *file = slot->file;
+
+  if (batch != NULL)
+  {
+    file->result = close_write_batch_file(batch, file->path, slot->tmp_path,
+                                          slot->fd, failed);
+  }
+  else
+  {
+    if (slot->fd >= 0)
+    {
+      close(slot->fd);
+    }
+    if (failed)
+    {
+      kmyth_free(file->data);
+      file->data = NULL;
+      file->data_len = 0;
+    }
+    file->result = failed;
+  }
+  slot->file = NULL;
+}
+
+//############################################################################
+// slot_opened()
+//
+// Starts reading a file once it is open. Returns true if the file is
+// finished (empty or failed).
+//############################################################################
+static bool slot_opened(bulk_ring * ring, bulk_slot * slot, uint64_t user_data)
+{
+  kmyth_bulk_file *file = slot->file;
+  struct stat st;
+
+  if (fstat(slot->fd, &st) == -1)
+  {
+    kmyth_log(LOG_ERR,
+              "input file (%s) stats could not be retrieved ... exiting",
+              file->path);
+    slot_finish(slot, NULL, 1);
+    return true;
+  }
+  if (st.st_size <= 0)
+  {
+    slot_finish(slot, NULL, 0);
+    return true;
+  }
+  if ((uintmax_t) st.st_size > SIZE_MAX)
+  {
+    kmyth_log(LOG_ERR, "input file (%s) too large ... exiting", file->path);
+    slot_finish(slot, NULL, 1);
+    return true;
+  }
+
+  kmyth_alloc_phase phase = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_READ);
+
+  file->data = kmyth_malloc((size_t) st.st_size);
+  kmyth_alloc_set_phase(phase);
+  if (file->data == NULL)
+  {
+    kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+    slot_finish(slot, NULL, 1);
+    return true;
+  }
+  file->data_len = (size_t) st.st_size;
+  slot->len = file->data_len;
+  slot->done = 0;
+  slot_queue_transfer(ring, slot, user_data, false);
+  return false;
+}
+
+//############################################################################
+// slot_start()
+//
+// Starts on a file. Returns true if the file is already finished.
+//############################################################################
+static bool slot_start(bulk_ring * ring, bulk_slot * slot,
+                       kmyth_bulk_file * file, kmyth_write_batch * batch,
+                       uint64_t user_data)
+{
+  memset(slot, 0, sizeof(bulk_slot));
+  slot->file = file;
+  slot->fd = -1;
+
+  if (batch == NULL)
+  {
+    file->data = NULL;
+    file->data_len = 0;
+    slot->opening = true;
+    ring_queue(ring, IORING_OP_OPENAT, AT_FDCWD, file->path, 0, 0,
+               O_RDONLY | O_CLOEXEC, user_data);
+    return false;
+  }
+
+  if (file->data == NULL && file->data_len > 0)
+  {
+    kmyth_log(LOG_ERR, "NULL data for %s ... exiting", file->path);
+    file->result = 1;
+    slot->file = NULL;
+    return true;
+  }
+  if (open_write_batch_file(file->path, &slot->tmp_path, &slot->fd))
+  {
+    file->result = 1;
+    slot->file = NULL;
+    return true;
+  }
+  slot->len = file->data_len;
+  if (slot->len == 0)
+  {
+    slot_finish(slot, batch, 0);
+    return true;
+  }
+  slot_queue_transfer(ring, slot, user_data, true);
+  return false;
+}
+
+//############################################################################
+// slot_complete()
+//
+// Handles the completion of a slot's request. Returns true if the file is
+// finished.
+//############################################################################
+static bool slot_complete(bulk_ring * ring, bulk_slot * slot, int32_t res,
+                          kmyth_write_batch * batch, uint64_t user_data)
+{
+  kmyth_bulk_file *file = slot->file;
+
+  if (slot->opening)
+  {
+    slot->opening = false;
+    if (res == -EINVAL)
+    {
+      // IORING_OP_OPENAT needs Linux 5.6: open the file here instead
+      res = open(file->path, O_RDONLY | O_CLOEXEC);
+      res = (res < 0) ? -errno : res;
+    }
+    if (res < 0)
+    {
+      kmyth_log(LOG_ERR, "error opening input file: %s ... exiting",
+                file->path);
+      slot_finish(slot, NULL, 1);
+      return true;
+    }
+    slot->fd = res;
+    return slot_opened(ring, slot, user_data);
+  }
+
+  if (res == -EINTR || res == -EAGAIN)
+  {
+    slot_queue_transfer(ring, slot, user_data, batch != NULL);
+    return false;
+  }
+  if (res <= 0)
+  {
+    // an error, or the end of a file that shrank since it was opened
+    if (batch == NULL)
+    {
+      kmyth_log(LOG_ERR, "file size = %zu bytes, bytes read = %zu "
+                "... exiting", slot->len, slot->done);
+    }
+    slot_finish(slot, batch, 1);
+    return true;
+  }
+
+  slot->done += (size_t) res;
+  if (slot->done < slot->len)
+  {
+    slot_queue_transfer(ring, slot, user_data, batch != NULL);
+    return false;
+  }
+  slot_finish(slot, batch, 0);
+  return true;
+}
+
+//############################################################################
+// ring_io()
+//############################################################################
+static void ring_io(bulk_ring * ring, kmyth_bulk_file * files, size_t count,
+                    size_t depth, kmyth_write_batch * batch)
+{
+  bulk_slot slots[KMYTH_BULK_IO_MAX_DEPTH];
+  size_t free_slots[KMYTH_BULK_IO_MAX_DEPTH];
+  size_t free_count = depth;
+  size_t next = 0;
+  size_t in_flight = 0;
+
+  for (size_t i = 0; i < depth; i++)
+  {
+    free_slots[i] = depth - 1 - i;
+    slots[i].file = NULL;
+  }
+
+  while (next < count || in_flight > 0)
+  {
+    while (next < count && free_count > 0)
+    {
+      size_t s = free_slots[free_count - 1];
+
+      if (!slot_start(ring, &slots[s], &files[next++], batch, s))
+      {
+        free_count--;
+        in_flight++;
+      }
+    }
+    if (in_flight == 0)
+    {
+      continue;
+    }
+
+    if (ring_submit_and_wait(ring))
+    {
+      // the files in flight are abandoned: their buffers and descriptors
+      // may still be in use by the kernel, so they are left alone
+      kmyth_log(LOG_ERR, "io_uring_enter failed (%s) ... exiting",
+                strerror(errno));
+      for (size_t s = 0; s < depth; s++)
+      {
+        if (slots[s].file != NULL)
+        {
+          slots[s].file->result = 1;
+          if (batch == NULL)
+          {
+            slots[s].file->data = NULL;
+            slots[s].file->data_len = 0;
+          }
+        }
+      }
+      for (; next < count; next++)
+      {
+        files[next].result = 1;
+      }
+      return;
+    }
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      size_t s = (size_t) cqe->user_data;
+
+      if (slot_complete(ring, &slots[s], cqe->res, batch, s))
+      {
+        free_slots[free_count++] = s;
+        in_flight--;
+      }
+      head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+
+#endif /* KMYTH_BULK_IO_URING */
+
+//############################################################################
+// bulk_io()
+//############################################################################
+static int bulk_io(kmyth_bulk_file * files, size_t count, size_t depth,
+                   kmyth_write_batch * batch)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (files == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL file list ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    files[i].result = 1;
+    if (batch == NULL)
+    {
+      files[i].data = NULL;
+      files[i].data_len = 0;
+    }
+  }
+  depth = bulk_depth(depth, count);
+
+#ifdef KMYTH_BULK_IO_URING
+  bulk_ring ring;
+
+  if (ring_init(&ring, (unsigned) depth) == 0)
+  {
+    ring_io(&ring, files, count, depth, batch);
+    ring_free(&ring);
+    return bulk_result(files, count);
+  }
+#endif
+
+  pool_io(files, count, depth, batch);
+  return bulk_result(files, count);
+}
+
+//############################################################################
+// kmyth_bulk_read_files()
+//############################################################################
+int kmyth_bulk_read_files(kmyth_bulk_file * files, size_t count, size_t depth)
+{
+  return bulk_io(files, count, depth, NULL);
+}
+
+//############################################################################
+// kmyth_bulk_write_files()
+//############################################################################
+int kmyth_bulk_write_files(kmyth_write_batch * batch, kmyth_bulk_file * files,
+                           size_t count, size_t depth)
+{
+  if (batch == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL write batch ... exiting");
+    return 1;
+  }
+  return bulk_io(files, count, depth, batch);
+}
+
+//############################################################################
+// kmyth_bulk_io_backend()
+//############################################################################
+const char *kmyth_bulk_io_backend(void)
+{
+#ifdef KMYTH_BULK_IO_URING
+  bulk_ring ring;
+
+  if (ring_init(&ring, 1) == 0)
+  {
+    ring_free(&ring);
+    return "io_uring";
+  }
+#endif
+  return "threads";
+}
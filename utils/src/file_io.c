@@ -7,12 +7,18 @@
 
 #include "file_io.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <openssl/bio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "defines.h"
 
@@ -71,9 +77,9 @@ int verifyOutputFilePath(char *path)
   }
 
   // check that specified output path directory exists
-  char *path_copy = "\0";
+  char *path_copy = kmyth_strdup(path);
 
-  if (asprintf(&path_copy, "%s", path) < 0)
+  if (path_copy == NULL)
   {
     kmyth_log(LOG_ERR, "unable to copy output file path ... exiting");
     return 1;
@@ -82,7 +88,7 @@ int verifyOutputFilePath(char *path)
   if (stat(dirname(path_copy), &buffer))
   {
     kmyth_log(LOG_ERR, "output path (%s) not found ... exiting", path);
-    free(path_copy);
+    kmyth_free(path_copy);
     return 1;
   }
 
@@ -91,10 +97,10 @@ int verifyOutputFilePath(char *path)
   {
     kmyth_log(LOG_ERR, "output directory (%s) not valid ... exiting",
               dirname(path_copy));
-    free(path_copy);
+    kmyth_free(path_copy);
     return 1;
   }
-  free(path_copy);
+  kmyth_free(path_copy);
 
   // check that specified output path is a regular file if it exists
   if (!stat(path, &buffer))
@@ -162,7 +168,7 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
     return 1;
   }
 
-  if (st.st_size <= 0 || st.st_size > INT_MAX)
+  if (st.st_size <= 0)
   {
     if (!BIO_free(bio))
     {
@@ -172,10 +178,22 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
     *data = NULL;
     return 0;
   }
+  if ((uintmax_t) st.st_size > SIZE_MAX)
+  {
+    kmyth_log(LOG_ERR, "input file (%s) too large ... exiting", input_path);
+    if (!BIO_free(bio))
+    {
+      kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
+    }
+    return 1;
+  }
   size_t input_size = (size_t)st.st_size;
 
   // Create data buffer and read file into it
-  *data = (uint8_t *) malloc(input_size);
+  kmyth_alloc_phase phase = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_READ);
+
+  *data = (uint8_t *) kmyth_malloc(input_size);
+  kmyth_alloc_set_phase(phase);
   if (*data == NULL)
   {
     kmyth_log(LOG_ERR, "could not allocate memory to read file ... exiting");
@@ -185,22 +203,45 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
     }
     return 1;
   }
-  int length_read = BIO_read(bio, *data, (int)input_size);
-  if (length_read <= 0)
+
+  // BIO_read() takes an int length, so a large file is read in pieces
+  size_t length_read = 0;
+
+  while (length_read < input_size)
+  {
+    size_t piece = input_size - length_read;
+
+    if (piece > KMYTH_MAX_IO_CHUNK)
+    {
+      piece = KMYTH_MAX_IO_CHUNK;
+    }
+
+    int got = BIO_read(bio, *data + length_read, (int) piece);
+
+    if (got <= 0)
+    {
+      break;
+    }
+    length_read += (size_t) got;
+  }
+  if (length_read == 0)
   {
     kmyth_log(LOG_ERR, "no data read from input file ... exiting");
+    kmyth_free(*data);
+    *data = NULL;
     if (!BIO_free(bio))
     {
       kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
     }
     return 1;
   }
-  
 
-  if ((size_t)length_read != input_size)
+  if (length_read != input_size)
   {
-    kmyth_log(LOG_ERR, "file size = %d bytes, buffer size = %d bytes "
-              "... exiting", input_size, *data_length);
+    kmyth_log(LOG_ERR, "file size = %zu bytes, bytes read = %zu "
+              "... exiting", input_size, length_read);
+    kmyth_free(*data);
+    *data = NULL;
     if (!BIO_free(bio))
     {
       kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
@@ -212,10 +253,135 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
     kmyth_log(LOG_ERR, "error freeing BIO ... exiting");
     return 1;
   }
-  *data_length = (size_t)length_read;
+  *data_length = length_read;
   return 0;
 }
 
+//############################################################################
+// release_file_view()
+//############################################################################
+static void release_file_view(kmyth_file_view * view)
+{
+  if (view == NULL)
+  {
+    return;
+  }
+  if (view->map_base != NULL)
+  {
+    munmap(view->map_base, view->map_length);
+  }
+  else
+  {
+    kmyth_free(view->data);
+  }
+  view->data = NULL;
+  view->data_length = 0;
+  view->map_base = NULL;
+  view->map_length = 0;
+}
+
+//############################################################################
+// map_file()
+//############################################################################
+/**
+ * @brief Sets up a view of a file for map_bytes_from_file() (prefaulted,
+ *        sequential read ahead) or peek_bytes_from_file() (pages faulted
+ *        in on first access only, no read ahead).
+ */
+static int map_file(char *input_path, kmyth_file_view * view, bool whole)
+{
+  if (input_path == NULL || view == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input file or view ... exiting");
+    return 1;
+  }
+  view->data = NULL;
+  view->data_length = 0;
+  view->release = release_file_view;
+  view->map_base = NULL;
+  view->map_length = 0;
+
+  int fd = open(input_path, O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1)
+  {
+    kmyth_log(LOG_ERR, "error opening input file: %s ... exiting", input_path);
+    return 1;
+  }
+
+  // Only regular files of known, non-zero size are mapped; anything
+  // else (an empty file included) goes through read_bytes_from_file()
+  struct stat st;
+
+  if (fstat(fd, &st) == -1)
+  {
+    kmyth_log(LOG_ERR,
+              "input file (%s) stats could not be retrieved ... exiting",
+              input_path);
+    close(fd);
+    return 1;
+  }
+
+  void *map = MAP_FAILED;
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (uintmax_t) st.st_size <= SIZE_MAX)
+  {
+    int flags = MAP_PRIVATE;
+
+#ifdef MAP_POPULATE
+    // fault the whole file in up front: it is about to be read through
+    if (whole)
+    {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, flags, fd, 0);
+  }
+  close(fd);
+
+  if (map == MAP_FAILED)
+  {
+    if (read_bytes_from_file(input_path, &view->data, &view->data_length))
+    {
+      release_file_view(view);
+      return 1;
+    }
+    return 0;
+  }
+  madvise(map, (size_t) st.st_size, whole ? MADV_SEQUENTIAL : MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+  // a large file read through is worth huge pages in the page cache, where
+  // the kernel supports them for file mappings (best effort)
+  if (whole && (size_t) st.st_size >= KMYTH_HUGE_PAGE_SIZE)
+  {
+    madvise(map, (size_t) st.st_size, MADV_HUGEPAGE);
+  }
+#endif
+
+  view->data = map;
+  view->data_length = (size_t) st.st_size;
+  view->map_base = map;
+  view->map_length = (size_t) st.st_size;
+  return 0;
+}
+
+//############################################################################
+// map_bytes_from_file()
+//############################################################################
+int map_bytes_from_file(char *input_path, kmyth_file_view * view)
+{
+  return map_file(input_path, view, true);
+}
+
+//############################################################################
+// peek_bytes_from_file()
+//############################################################################
+int peek_bytes_from_file(char *input_path, kmyth_file_view * view)
+{
+  return map_file(input_path, view, false);
+}
+
 //############################################################################
 // write_bytes_to_file
 //############################################################################
@@ -249,15 +415,455 @@ int write_bytes_to_file(char *output_path, uint8_t * bytes, size_t bytes_length)
 }
 
 //############################################################################
-// print_to_stdout()
+// create_temp_file()
 //############################################################################
-int print_to_stdout(unsigned char *data, size_t data_size)
+/**
+ * @brief Creates a temporary file next to path (so that it can be renamed
+ *        over it), with the permissions of the file at path if there is
+ *        one, owner-only ones otherwise.
+ */
+static int create_temp_file(const char *path, char **tmp_path, int *fd)
 {
-  if(data_size > INT_MAX)
+  size_t tmp_size = strlen(path) + sizeof(".XXXXXX");
+
+  *tmp_path = kmyth_malloc(tmp_size);
+  if (*tmp_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+    return 1;
+  }
+  snprintf(*tmp_path, tmp_size, "%s.XXXXXX", path);
+
+  *fd = mkstemp(*tmp_path);
+  if (*fd < 0)
   {
-    kmyth_log(LOG_ERR, "data size exceeds INT_MAX ... exiting");
+    kmyth_log(LOG_ERR, "unable to create temporary file for %s ... exiting",
+              path);
+    kmyth_free(*tmp_path);
+    *tmp_path = NULL;
     return 1;
   }
+
+  struct stat st;
+
+  if (stat(path, &st) == 0)
+  {
+    fchmod(*fd, st.st_mode & 07777);
+  }
+  return 0;
+}
+
+//############################################################################
+// write_all()
+//############################################################################
+static int write_all(int fd, const uint8_t * bytes, size_t bytes_length)
+{
+  size_t written = 0;
+
+  while (written < bytes_length)
+  {
+    ssize_t n = write(fd, bytes + written, bytes_length - written);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    written += (size_t) n;
+  }
+  return 0;
+}
+
+//############################################################################
+// open_parent_directory()
+//############################################################################
+static int open_parent_directory(const char *path)
+{
+  char *path_copy = kmyth_strdup(path);
+
+  if (path_copy == NULL)
+  {
+    return -1;
+  }
+
+  int fd = open(dirname(path_copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  kmyth_free(path_copy);
+  return fd;
+}
+
+//############################################################################
+// sync_parent_directory()
+//############################################################################
+/**
+ * @brief Flushes the directory holding path, which makes a rename into
+ *        it durable.
+ */
+static int sync_parent_directory(const char *path)
+{
+  int fd = open_parent_directory(path);
+
+  if (fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to open the directory of %s ... exiting",
+              path);
+    return 1;
+  }
+
+  int retval = (fsync(fd) != 0);
+
+  close(fd);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to flush the directory of %s ... exiting",
+              path);
+  }
+  return retval;
+}
+
+//############################################################################
+// write_bytes_to_file_atomic()
+//############################################################################
+int write_bytes_to_file_atomic(char *output_path, uint8_t * bytes,
+                               size_t bytes_length)
+{
+  if (verifyOutputFilePath(output_path))
+  {
+    kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", output_path);
+    return 1;
+  }
+
+  char *tmp_path = NULL;
+  int fd = -1;
+
+  if (create_temp_file(output_path, &tmp_path, &fd))
+  {
+    return 1;
+  }
+
+  int write_failed = (write_all(fd, bytes, bytes_length) || fsync(fd) != 0);
+
+  if (close(fd) != 0 || write_failed)
+  {
+    kmyth_log(LOG_ERR, "error writing temporary file for %s ... exiting",
+              output_path);
+    unlink(tmp_path);
+    kmyth_free(tmp_path);
+    return 1;
+  }
+
+  // rename() replaces the original in one step, so a crash never leaves a
+  // partially written file behind
+  if (rename(tmp_path, output_path) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to replace %s ... exiting", output_path);
+    unlink(tmp_path);
+    kmyth_free(tmp_path);
+    return 1;
+  }
+  kmyth_free(tmp_path);
+
+  return sync_parent_directory(output_path);
+}
+
+//############################################################################
+// init_write_batch()
+//############################################################################
+void init_write_batch(kmyth_write_batch * batch)
+{
+  batch->paths = NULL;
+  batch->tmp_paths = NULL;
+  batch->count = 0;
+  batch->capacity = 0;
+}
+
+//############################################################################
+// open_write_batch_file()
+//############################################################################
+int open_write_batch_file(char *output_path, char **tmp_path, int *fd)
+{
+  if (verifyOutputFilePath(output_path))
+  {
+    kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", output_path);
+    return 1;
+  }
+  return create_temp_file(output_path, tmp_path, fd);
+}
+
+//############################################################################
+// close_write_batch_file()
+//############################################################################
+int close_write_batch_file(kmyth_write_batch * batch, char *output_path,
+                           char *tmp_path, int fd, int write_failed)
+{
+#ifdef SYNC_FILE_RANGE_WRITE
+  // start writeback now, so the data is mostly on disk by commit time
+  if (!write_failed)
+  {
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+  }
+#endif
+
+  if (close(fd) != 0 || write_failed)
+  {
+    kmyth_log(LOG_ERR, "error writing temporary file for %s ... exiting",
+              output_path);
+    unlink(tmp_path);
+    kmyth_free(tmp_path);
+    return 1;
+  }
+
+  if (batch->count == batch->capacity)
+  {
+    size_t new_capacity = (batch->capacity == 0) ? 16 : 2 * batch->capacity;
+    char **new_paths =
+      kmyth_realloc(batch->paths, new_capacity * sizeof(char *));
+
+    if (new_paths != NULL)
+    {
+      batch->paths = new_paths;
+    }
+
+    char **new_tmp_paths = (new_paths == NULL) ? NULL :
+      kmyth_realloc(batch->tmp_paths, new_capacity * sizeof(char *));
+
+    if (new_tmp_paths == NULL)
+    {
+      kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+      unlink(tmp_path);
+      kmyth_free(tmp_path);
+      return 1;
+    }
+    batch->tmp_paths = new_tmp_paths;
+    batch->capacity = new_capacity;
+  }
+
+  char *path = kmyth_strdup(output_path);
+
+  if (path == NULL)
+  {
+    kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+    unlink(tmp_path);
+    kmyth_free(tmp_path);
+    return 1;
+  }
+
+  batch->paths[batch->count] = path;
+  batch->tmp_paths[batch->count] = tmp_path;
+  batch->count++;
+  return 0;
+}
+
+//############################################################################
+// add_to_write_batch()
+//############################################################################
+int add_to_write_batch(kmyth_write_batch * batch, char *output_path,
+                       uint8_t * bytes, size_t bytes_length)
+{
+  char *tmp_path = NULL;
+  int fd = -1;
+
+  if (open_write_batch_file(output_path, &tmp_path, &fd))
+  {
+    return 1;
+  }
+
+  return close_write_batch_file(batch, output_path, tmp_path, fd,
+                                write_all(fd, bytes, bytes_length));
+}
+
+//############################################################################
+// clear_write_batch()
+//############################################################################
+static void clear_write_batch(kmyth_write_batch * batch)
+{
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    kmyth_free(batch->paths[i]);
+    kmyth_free(batch->tmp_paths[i]);
+  }
+  kmyth_free(batch->paths);
+  kmyth_free(batch->tmp_paths);
+  init_write_batch(batch);
+}
+
+//############################################################################
+// same_parent_directory()
+//############################################################################
+static bool same_parent_directory(const char *a, const char *b)
+{
+  const char *a_end = strrchr(a, '/');
+  const char *b_end = strrchr(b, '/');
+  size_t a_len = (a_end == NULL) ? 0 : (size_t) (a_end - a);
+  size_t b_len = (b_end == NULL) ? 0 : (size_t) (b_end - b);
+
+  return a_len == b_len && strncmp(a, b, a_len) == 0;
+}
+
+//############################################################################
+// commit_write_batch()
+//############################################################################
+int commit_write_batch(kmyth_write_batch * batch, size_t * failed_count)
+{
+  // per file: whether it is the first one in its directory (which then
+  // stands for the directory), and whether it failed
+  bool *dir_leader = kmyth_calloc(batch->count + 1, sizeof(bool));
+  bool *failed = kmyth_calloc(batch->count + 1, sizeof(bool));
+  size_t failed_total = 0;
+
+  if (dir_leader == NULL || failed == NULL)
+  {
+    kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+    kmyth_free(dir_leader);
+    kmyth_free(failed);
+    if (failed_count != NULL)
+    {
+      *failed_count = batch->count;
+    }
+    abort_write_batch(batch);
+    return 1;
+  }
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    dir_leader[i] = true;
+    for (size_t j = 0; j < i && dir_leader[i]; j++)
+    {
+      dir_leader[i] = !(dir_leader[j] &&
+                        same_parent_directory(batch->paths[i],
+                                              batch->paths[j]));
+    }
+  }
+
+  // flush the data of every temporary file before any rename, so that a
+  // rename can never reach the disk ahead of the contents it points to
+  // (the writeback started when each file was closed has usually done most
+  // of the work by now); only the batch's own files are flushed, so the
+  // cost does not depend on other writers to the same file system
+  bool flushed = true;
+
+  for (size_t i = 0; i < batch->count && flushed; i++)
+  {
+    int fd = open(batch->tmp_paths[i], O_RDONLY | O_CLOEXEC);
+
+    flushed = (fd >= 0 && fdatasync(fd) == 0);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+
+  if (!flushed)
+  {
+    kmyth_log(LOG_ERR, "unable to flush %zu file(s) to disk ... exiting",
+              batch->count);
+    kmyth_free(dir_leader);
+    kmyth_free(failed);
+    if (failed_count != NULL)
+    {
+      *failed_count = batch->count;
+    }
+    abort_write_batch(batch);
+    return 1;
+  }
+
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    if (rename(batch->tmp_paths[i], batch->paths[i]) != 0)
+    {
+      kmyth_log(LOG_ERR, "unable to replace %s ... exiting", batch->paths[i]);
+      unlink(batch->tmp_paths[i]);
+      failed[i] = true;
+    }
+  }
+
+  // then make the renames durable, once per directory (a file whose
+  // directory could not be flushed is in place, but may not survive a
+  // crash, so it counts as failed)
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    if (dir_leader[i] && sync_parent_directory(batch->paths[i]))
+    {
+      for (size_t j = i; j < batch->count; j++)
+      {
+        if (same_parent_directory(batch->paths[i], batch->paths[j]))
+        {
+          failed[j] = true;
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    failed_total += failed[i] ? 1 : 0;
+  }
+  kmyth_free(dir_leader);
+  kmyth_free(failed);
+  if (failed_count != NULL)
+  {
+    *failed_count = failed_total;
+  }
+  clear_write_batch(batch);
+
+  return (failed_total == 0) ? 0 : 1;
+}
+
+//############################################################################
+// abort_write_batch()
+//############################################################################
+void abort_write_batch(kmyth_write_batch * batch)
+{
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    unlink(batch->tmp_paths[i]);
+  }
+  clear_write_batch(batch);
+}
+
+//############################################################################
+// write_bytes_to_bio()
+//############################################################################
+int write_bytes_to_bio(BIO * bio, const uint8_t * bytes, size_t bytes_length)
+{
+  if (bio == NULL || (bytes == NULL && bytes_length > 0))
+  {
+    kmyth_log(LOG_ERR, "NULL BIO or data ... exiting");
+    return 1;
+  }
+
+  // BIO_write() takes an int length and may write less than it is given
+  size_t written = 0;
+
+  while (written < bytes_length)
+  {
+    size_t piece = bytes_length - written;
+
+    if (piece > KMYTH_MAX_IO_CHUNK)
+    {
+      piece = KMYTH_MAX_IO_CHUNK;
+    }
+
+    int put = BIO_write(bio, bytes + written, (int) piece);
+
+    if (put <= 0)
+    {
+      kmyth_log(LOG_ERR, "error writing data to BIO ... exiting");
+      return 1;
+    }
+    written += (size_t) put;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// print_to_stdout()
+//############################################################################
+int print_to_stdout(unsigned char *data, size_t data_size)
+{
   BIO *bdata;
 
   // Create unbuffered file BIO attached to stdout
@@ -269,7 +875,7 @@ int print_to_stdout(unsigned char *data, size_t data_size)
   }
 
   // Write out data
-  if (BIO_write(bdata, data, (int)data_size) != (int)data_size)
+  if (write_bytes_to_bio(bdata, data, data_size))
   {
     kmyth_log(LOG_ERR, "error writing data to file BIO ... exiting");
     BIO_free_all(bdata);
@@ -280,3 +886,125 @@ int print_to_stdout(unsigned char *data, size_t data_size)
   BIO_free_all(bdata);
   return 0;
 }
+
+//############################################################################
+// write_bytes_to_fd()
+//############################################################################
+int write_bytes_to_fd(int fd, const uint8_t * bytes, size_t bytes_length)
+{
+  if (fd < 0 || (bytes == NULL && bytes_length > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid descriptor or NULL data ... exiting");
+    return 1;
+  }
+  if (write_all(fd, bytes, bytes_length))
+  {
+    kmyth_log(LOG_ERR, "error writing to descriptor %d ... exiting", fd);
+    return 1;
+  }
+  return 0;
+}
+
+//############################################################################
+// write_bytes_to_memfd()
+//############################################################################
+int write_bytes_to_memfd(const char *name, const uint8_t * bytes,
+                         size_t bytes_length, int *fd)
+{
+  if (name == NULL || fd == NULL || (bytes == NULL && bytes_length > 0))
+  {
+    kmyth_log(LOG_ERR, "NULL name, data or descriptor ... exiting");
+    return 1;
+  }
+
+  int mem_fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  if (mem_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to create memory file (%s) ... exiting",
+              strerror(errno));
+    return 1;
+  }
+
+  // once written, the contents can be neither changed nor resized, by the
+  // reader or anyone else, and the seals themselves are final
+  if (write_all(mem_fd, bytes, bytes_length) ||
+      fcntl(mem_fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) ||
+      lseek(mem_fd, 0, SEEK_SET) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to fill memory file (%s) ... exiting",
+              strerror(errno));
+    close(mem_fd);
+    return 1;
+  }
+
+  *fd = mem_fd;
+  return 0;
+}
+
+//############################################################################
+// run_with_fd()
+//############################################################################
+int run_with_fd(const char *command, int fd, int child_fd,
+                const char *fd_env, int *exit_status)
+{
+  if (command == NULL || fd < 0 || child_fd < 0 || exit_status == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid command or descriptor ... exiting");
+    return 1;
+  }
+
+  char fd_str[16];
+
+  snprintf(fd_str, sizeof(fd_str), "%d", child_fd);
+  fflush(NULL);
+
+  pid_t pid = fork();
+
+  if (pid < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to start command (%s) ... exiting",
+              strerror(errno));
+    return 1;
+  }
+
+  if (pid == 0)
+  {
+    // dup2() leaves the new descriptor open across exec; a descriptor that
+    // is already in place needs its close-on-exec flag cleared instead
+    if ((fd == child_fd) ?
+        fcntl(fd, F_SETFD, 0) : (dup2(fd, child_fd) < 0))
+    {
+      _exit(127);
+    }
+
+    // the command reads a seekable descriptor (a memory file) from its
+    // start, even if it was read before (a pipe cannot seek and is left as
+    // it is)
+    lseek(child_fd, 0, SEEK_SET);
+    if (fd_env != NULL && setenv(fd_env, fd_str, 1))
+    {
+      _exit(127);
+    }
+    execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+    _exit(127);
+  }
+
+  int status = 0;
+
+  while (waitpid(pid, &status, 0) < 0)
+  {
+    if (errno != EINTR)
+    {
+      kmyth_log(LOG_ERR, "unable to wait for command (%s) ... exiting",
+                strerror(errno));
+      return 1;
+    }
+  }
+
+  // as a shell reports it: the exit code, or 128 + the terminating signal
+  *exit_status = WIFEXITED(status) ? WEXITSTATUS(status) :
+    128 + WTERMSIG(status);
+  return 0;
+}
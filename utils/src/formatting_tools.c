@@ -7,85 +7,124 @@
 #include "formatting_tools.h"
 #include "tpm2_interface.h"
 
+#include <limits.h>
 #include <string.h>
 #include <malloc.h>
 
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
-#include <openssl/evp.h>
-
+#include "base64_codec.h"
 #include "defines.h"
+#include "memory_util.h"
 #include <stdio.h>
 
 //############################################################################
-// get_block_bytes()
+// get_block_view()
 //############################################################################
-int get_block_bytes(char **contents,
-                    size_t * remaining,
-                    uint8_t ** block, size_t * blocksize,
-                    char *delim, size_t delim_len,
-                    char *next_delim, size_t next_delim_len)
+int get_block_view(uint8_t ** contents,
+                   size_t * remaining,
+                   uint8_t ** block, size_t * blocksize,
+                   char *delim, size_t delim_len,
+                   char *next_delim, size_t next_delim_len)
 {
   // check that next (current) block begins with expected delimiter
-  if (strncmp(*contents, delim, delim_len))
+  if (delim_len > *remaining || memcmp(*contents, delim, delim_len))
   {
     kmyth_log(LOG_ERR, "unexpected delimiter ... exiting");
     return 1;
   }
-  *contents += delim_len;
-  (*remaining) -= delim_len;
+  uint8_t *start = *contents + delim_len;
+  size_t left = *remaining - delim_len;
 
-  // find the end of the block 
-  size_t size = 0;
-
-  if (next_delim_len > *remaining)
+  if (next_delim_len == 0 || next_delim_len > left)
   {
     kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
     return 1;
   }
-  while (strncmp(*contents + size, next_delim, next_delim_len))
+
+  // find the end of the block: delimiters start with a character that never
+  // occurs in base64 data, so memchr() skips each block in a single pass and
+  // the delimiter itself is only compared where that character is found
+  uint8_t *end = NULL;
+  uint8_t *scan = start;
+  size_t scan_left = left - next_delim_len + 1;
+
+  while (scan_left > 0 &&
+         (scan = memchr(scan, next_delim[0], scan_left)) != NULL)
   {
-    size++;
-    if (size + next_delim_len > *remaining)
+    if (memcmp(scan, next_delim, next_delim_len) == 0)
     {
-      kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
-      return 1;
+      end = scan;
+      break;
     }
+    scan++;
+    scan_left = left - next_delim_len + 1 - (size_t) (scan - start);
+  }
+  if (end == NULL)
+  {
+    kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
+    return 1;
   }
 
   // check that the block is not empty
+  size_t size = (size_t) (end - start);
+
   if (size == 0)
   {
     kmyth_log(LOG_ERR, "empty block ... exiting");
     return 1;
   }
 
-  else
+  // update output parameters before exiting
+  //   - *block      : start of the block data, within the input buffer
+  //   - *blocksize  : block data size (for block just parsed)
+  //   - *contents   : pointer to start of next block in .ski file buffer
+  //   - *remaining  : count of bytes yet to be parsed in .ski file buffer
+  *block = start;
+  *blocksize = size;
+  *contents = end;
+  *remaining = left - size;
+
+  return 0;
+}
+
+//############################################################################
+// get_block_bytes()
+//############################################################################
+int get_block_bytes(char **contents,
+                    size_t * remaining,
+                    uint8_t ** block, size_t * blocksize,
+                    char *delim, size_t delim_len,
+                    char *next_delim, size_t next_delim_len)
+{
+  uint8_t *position = (uint8_t *) * contents;
+  size_t left = *remaining;
+  uint8_t *view = NULL;
+  size_t size = 0;
+
+  if (get_block_view(&position, &left, &view, &size,
+                     delim, delim_len, next_delim, next_delim_len))
   {
-    if (*block != NULL) free(*block); // since looping, should free previous block allocation
-                                      // (inefficient, yes, but easy-to-code, otherwise must
-                                      //  calculate size and re-allocate)
+    return 1;
+  }
 
-    // allocate enough memory for output parameter to hold parsed block data
-    //   - must be allocated here because size is calculated here
-    //   - must be freed by caller because data must be passed back
-    *block = (uint8_t *) malloc(size);
-    if (*block == NULL)
-    {
-      kmyth_log(LOG_ERR, "malloc (%d bytes) error ... exiting", size);
-      return 1;
-    }
+  // since looping, should free previous block allocation
+  if (*block != NULL)
+  {
+    kmyth_free(*block);
+  }
 
-    // update output parameters before exiting
-    //   - *block      : block data (for block just parsed)
-    //   - *blocksize  : block data size (for block just parsed)
-    //   - *contents   : pointer to start of next block in .ski file buffer
-    //   - *remaining  : count of bytes yet to be parsed in .ski file buffer
-    memcpy(*block, *contents, size);
-    *blocksize = size;
-    *contents += size;
-    *remaining -= size;
+  // allocate enough memory for output parameter to hold parsed block data
+  //   - must be allocated here because size is calculated here
+  //   - must be freed by caller because data must be passed back
+  *block = (uint8_t *) kmyth_malloc(size);
+  if (*block == NULL)
+  {
+    kmyth_log(LOG_ERR, "kmyth_malloc (%zu bytes) error ... exiting", size);
+    return 1;
   }
+  memcpy(*block, view, size);
+  *blocksize = size;
+  *contents = (char *) position;
+  *remaining = left;
 
   return 0;
 }
@@ -110,26 +149,31 @@ int create_nkl_bytes(uint8_t * input, size_t input_length,
   if (encodeBase64Data(input, input_length, &nkl_data, &nkl_data_size))
   {
     kmyth_log(LOG_ERR, "error base64 encoding nkl string ... exiting");
-    free(nkl_data);
+    kmyth_free(nkl_data);
     return 1;
   }
 
   //At this point the data is all formatted, it's time to create the string
-
-  uint8_t *out = NULL;
-  size_t out_length = 0;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_NKL_DATA,
-         strlen(KMYTH_DELIM_NKL_DATA));
-  concat(&out, &out_length, nkl_data, nkl_data_size);
-  free(nkl_data);
+  //(in a single allocation, as every piece's size is known)
+  kmyth_byte_buffer out;
+
+  if (init_byte_buffer(&out, strlen(KMYTH_DELIM_NKL_DATA) + nkl_data_size +
+                       strlen(KMYTH_DELIM_END_NKL)) ||
+      append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_NKL_DATA,
+                            strlen(KMYTH_DELIM_NKL_DATA)) ||
+      append_to_byte_buffer(&out, nkl_data, nkl_data_size) ||
+      append_to_byte_buffer(&out, (uint8_t *) KMYTH_DELIM_END_NKL,
+                            strlen(KMYTH_DELIM_END_NKL)))
+  {
+    kmyth_log(LOG_ERR, "error creating nkl string ... exiting");
+    free_byte_buffer(&out);
+    kmyth_free(nkl_data);
+    return 1;
+  }
+  kmyth_free(nkl_data);
   nkl_data = NULL;
 
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_END_NKL,
-         strlen(KMYTH_DELIM_END_NKL));
-
-  *output = out;
-  *output_length = out_length;
+  detach_byte_buffer(&out, output, output_length);
 
   return 0;
 }
@@ -147,81 +191,33 @@ int encodeBase64Data(uint8_t * raw_data,
     kmyth_log(LOG_ERR, "no input data ... exiting");
     return 1;
   }
-  if(raw_data_size > INT_MAX)
+  // the encoded form (a third larger, plus newlines) must fit in a size_t
+  if (raw_data_size > SIZE_MAX / 2)
   {
     kmyth_log(LOG_ERR, "raw data too large ... exiting");
     return 1;
   }
 
-  BIO *bio_mem = NULL;
-  BIO *bio64 = NULL;
-  BUF_MEM *bioptr = NULL;
-
-  // create a base64 encoding filter BIO
-  if ((bio64 = BIO_new(BIO_f_base64())) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create base64 filter BIO error ... exiting");
-    return 1;
-  }
-
-  // create a 'sink' BIO to write to memory
-  if ((bio_mem = BIO_new(BIO_s_mem())) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create read/write memory sink BIO error" "... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-
-  // assemble the BIO chain in the order bio64 -> bio_mem
-  bio64 = BIO_push(bio64, bio_mem);
-
-  // write the input 'raw data' to the BIO chain
-  if (BIO_write(bio64, raw_data, (int)raw_data_size) != (int)raw_data_size)
-  {
-    kmyth_log(LOG_ERR, "BIO_write() error ... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-
-  // ensure all written data is flushed all the way through chain
-  if (BIO_flush(bio64) != 1)
-  {
-    kmyth_log(LOG_ERR, "BIO_flush() error ... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-
-  // compute memory size of encoded data
-  BIO_get_mem_ptr(bio64, &bioptr);
-  if (bioptr == NULL)
-  {
-    kmyth_log(LOG_ERR, "no underlying BIO_MEM structure ... exiting");
-    BIO_free_all(bio64);
-    return 1;
-  }
-  *base64_data_size = bioptr->length;
-
   // allocate memory for 'base64_data' output parameter
   //   - memory allocated here because the encoded data size is known here
   //   - memory must be freed by the caller because the data passed back
-  *base64_data = (uint8_t *) malloc(*base64_data_size + 1);
+  size_t encoded_size = kmyth_base64_encoded_size(raw_data_size);
+
+  *base64_data = (uint8_t *) kmyth_malloc(encoded_size + 1);
   if (*base64_data == NULL)
   {
-    kmyth_log(LOG_ERR, "malloc error (%lu bytes) ... exiting",
-              base64_data_size);
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "malloc error (%zu bytes) ... exiting",
+              encoded_size + 1);
     return 1;
   }
 
-  // copy encoded data to output parameter and terminate with newline and
-  // null terminator
-  memcpy(*base64_data, bioptr->data, (*base64_data_size) - 1);
-  (*base64_data)[(*base64_data_size) - 1] = '\n';
+  // encode (in lines of 64 symbols, each terminated with a newline) and add
+  // a null terminator
+  *base64_data_size = kmyth_base64_encode(raw_data, raw_data_size,
+                                          *base64_data);
   (*base64_data)[(*base64_data_size)] = '\0';
   kmyth_log(LOG_DEBUG, "encoded %lu bytes into %lu base-64 symbols",
             raw_data_size, *base64_data_size - 1);
-  // clean-up
-  BIO_free_all(bio64);
   return 0;
 }
 
@@ -239,60 +235,29 @@ int decodeBase64Data(uint8_t * base64_data,
     return 1;
   }
 
-  // check that size of input doesn't exceed limits, return error if it does
-  if (base64_data_size > INT_MAX)
-  {
-    kmyth_log(LOG_ERR,
-              "encoded data length (%lu bytes) > max (%d bytes) ... exiting",
-              base64_data_size, INT_MAX);
-    return 1;
-  }
+  // allocate memory for decoded result (plus a null terminator)
+  size_t max_size = kmyth_base64_decoded_max_size(base64_data_size);
+  kmyth_alloc_phase phase = kmyth_alloc_set_phase(KMYTH_ALLOC_PHASE_DECODE);
 
-  // allocate memory for decoded result - size of encoded input is worst case
-  *raw_data = (uint8_t *) malloc(base64_data_size);
+  *raw_data = (uint8_t *) kmyth_malloc(max_size + 1);
+  kmyth_alloc_set_phase(phase);
   if (*raw_data == NULL)
   {
-    kmyth_log(LOG_ERR, "malloc error (%lu bytes) for b64 decode ... exiting",
-              base64_data_size);
-    return 1;
-  }
-
-  // create a base64 decoding filter BIO
-  BIO *bio64 = NULL;
-
-  if ((bio64 = BIO_new(BIO_f_base64())) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create base64 filter BIO error ... exiting");
-    return 1;
-  }
-
-  // create a 'source' BIO to read from memory
-  BIO *bio_mem = NULL;
-
-  if ((bio_mem = BIO_new_mem_buf(base64_data, (int)base64_data_size)) == NULL)
-  {
-    kmyth_log(LOG_ERR, "create source BIO error ... exiting");
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "malloc error (%zu bytes) for b64 decode ... exiting",
+              max_size + 1);
     return 1;
   }
 
-  // assemble the BIO chain to base64 decode data read from memory
-  bio64 = BIO_push(bio64, bio_mem);
-  // read encoded data through chain, into 'raw_data' decoded output parameter
-  // and terminate with newline
-  int bytes_read = BIO_read(bio64, *raw_data, (int)base64_data_size);
-
-  if (bytes_read < 0)
+  // decode into 'raw_data' output parameter and terminate with a null
+  if (kmyth_base64_decode(base64_data, base64_data_size, *raw_data,
+                          raw_data_size))
   {
-    kmyth_log(LOG_ERR, "error reading bytes from BIO chain ... exiting");
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "invalid base64 data ... exiting");
+    kmyth_free(*raw_data);
+    *raw_data = NULL;
     return 1;
   }
-
-  (*raw_data)[bytes_read] = '\0';
-  *raw_data_size = (size_t)bytes_read;
-  // clean-up
-  BIO_free_all(bio64);
+  (*raw_data)[*raw_data_size] = '\0';
   return 0;
 }
 
@@ -317,7 +282,7 @@ int concat(uint8_t ** dest, size_t * dest_length, uint8_t * input,
     return (1);
   }
 
-  if ((new_dest = (uint8_t *) realloc(*dest, new_dest_len)) == NULL)
+  if ((new_dest = (uint8_t *) kmyth_realloc(*dest, new_dest_len)) == NULL)
   {
     kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
     return (1);
@@ -329,6 +294,98 @@ int concat(uint8_t ** dest, size_t * dest_length, uint8_t * input,
   return (0);
 }
 
+//############################################################################
+// init_byte_buffer()
+//############################################################################
+int init_byte_buffer(kmyth_byte_buffer * buf, size_t capacity_hint)
+{
+  buf->data = NULL;
+  buf->length = 0;
+  buf->capacity = 0;
+
+  if (capacity_hint == 0)
+  {
+    return 0;
+  }
+  buf->data = kmyth_malloc(capacity_hint);
+  if (buf->data == NULL)
+  {
+    kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+    return 1;
+  }
+  buf->capacity = capacity_hint;
+  return 0;
+}
+
+//############################################################################
+// append_to_byte_buffer()
+//############################################################################
+int append_to_byte_buffer(kmyth_byte_buffer * buf, const uint8_t * input,
+                          size_t input_length)
+{
+  if (input == NULL || input_length == 0) //nothing to append
+  {
+    return 0;
+  }
+  if (input_length > SIZE_MAX - buf->length)  //if we have an overflow
+  {
+    kmyth_log(LOG_ERR, "Maximum array size exceeded ... exiting");
+    return 1;
+  }
+
+  size_t needed = buf->length + input_length;
+
+  if (needed > buf->capacity)
+  {
+    // double (at least), so the total copying stays linear in the length
+    size_t new_capacity = (buf->capacity > SIZE_MAX / 2) ?
+      SIZE_MAX : 2 * buf->capacity;
+
+    if (new_capacity < needed)
+    {
+      new_capacity = needed;
+    }
+
+    uint8_t *new_data = kmyth_realloc(buf->data, new_capacity);
+
+    if (new_data == NULL)
+    {
+      kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+      return 1;
+    }
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+  }
+
+  memcpy(buf->data + buf->length, input, input_length);
+  buf->length = needed;
+  return 0;
+}
+
+//############################################################################
+// detach_byte_buffer()
+//############################################################################
+void detach_byte_buffer(kmyth_byte_buffer * buf, uint8_t ** data,
+                        size_t * data_length)
+{
+  *data = buf->data;
+  *data_length = buf->length;
+  buf->data = NULL;
+  buf->length = 0;
+  buf->capacity = 0;
+}
+
+//############################################################################
+// free_byte_buffer()
+//############################################################################
+void free_byte_buffer(kmyth_byte_buffer * buf)
+{
+  kmyth_free(buf->data);
+  buf->data = NULL;
+  buf->length = 0;
+  buf->capacity = 0;
+}
+
 //############################################################################
 // convert_string_to_digest()
 //############################################################################
@@ -354,7 +411,8 @@ int convert_string_to_digest(char *str, TPM2B_DIGEST * digest)
 
   // initializes buffer with all proper hexadexcimal values from str input
   unsigned long ul;
-  unsigned char *expectedPolicyBuffer = (unsigned char *) malloc( KMYTH_DIGEST_SIZE + 1 );
+  unsigned char *expectedPolicyBuffer =
+    (unsigned char *) kmyth_malloc(KMYTH_DIGEST_SIZE + 1);
   if( expectedPolicyBuffer == NULL )
   {
     kmyth_log(LOG_ERR, "unable to reserve intermediate buffer ... exiting");
@@ -373,10 +431,57 @@ int convert_string_to_digest(char *str, TPM2B_DIGEST * digest)
   // converts the byte array into a TPM2B_DIGEST struct
   memcpy(digest->buffer, expectedPolicyBuffer, KMYTH_DIGEST_SIZE);
   digest->size = KMYTH_DIGEST_SIZE;
-  free( expectedPolicyBuffer );
+  kmyth_free( expectedPolicyBuffer );
   return 0;
 }
 
+//############################################################################
+// convert_string_to_digest_list()
+//############################################################################
+int convert_string_to_digest_list(char *str, TPML_DIGEST * list)
+{
+  if (str == NULL || list == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid digest list argument ... exiting");
+    return 1;
+  }
+
+  size_t max_count = sizeof(list->digests) / sizeof(list->digests[0]);
+  char digest_str[2 * KMYTH_DIGEST_SIZE + 1];
+  char *next = str;
+
+  list->count = 0;
+  while (1)
+  {
+    size_t len = strcspn(next, ",");
+
+    if (list->count == max_count)
+    {
+      kmyth_log(LOG_ERR, "more than %zu digests in list ... exiting",
+                max_count);
+      return 1;
+    }
+    if (len != 2 * KMYTH_DIGEST_SIZE)
+    {
+      kmyth_log(LOG_ERR, "invalid input string length ... exiting");
+      return 1;
+    }
+    memcpy(digest_str, next, len);
+    digest_str[len] = '\0';
+    if (convert_string_to_digest(digest_str, &list->digests[list->count]))
+    {
+      return 1;
+    }
+    list->count++;
+
+    if (next[len] == '\0')
+    {
+      return 0;
+    }
+    next += len + 1;
+  }
+}
+
 //############################################################################
 // convert_digest_to_string()
 //############################################################################
@@ -9,6 +9,327 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#define KMYTH_ALLOC_STATS_SUPPORTED 1
+#endif
+
+// allocation hooks set by kmyth_set_allocator() (NULL: the C library)
+static kmyth_alloc_fn alloc_hook = NULL;
+static kmyth_realloc_fn realloc_hook = NULL;
+static kmyth_free_fn free_hook = NULL;
+static void *hook_user_data = NULL;
+
+// allocation accounting (see kmyth_alloc_stats_enable()): the figures of
+// each phase, then those of all phases at index KMYTH_ALLOC_PHASE_COUNT,
+// updated with relaxed atomics like the metrics registry
+static bool alloc_stats_on = false;
+static kmyth_alloc_stats alloc_stats[KMYTH_ALLOC_PHASE_COUNT + 1];
+static int64_t alloc_live_bytes = 0;
+
+#ifdef KMYTH_ALLOC_STATS_SUPPORTED
+static __thread kmyth_alloc_phase alloc_phase = KMYTH_ALLOC_PHASE_OTHER;
+#endif
+
+static const char *const alloc_phase_names[KMYTH_ALLOC_PHASE_COUNT + 1] = {
+  "other", "read", "parse", "decode", "decrypt", "output", "total"
+};
+
+//############################################################################
+// alloc_stats_counting()
+//############################################################################
+static inline bool alloc_stats_counting(void)
+{
+  return __atomic_load_n(&alloc_stats_on, __ATOMIC_RELAXED) &&
+    alloc_hook == NULL;
+}
+
+//############################################################################
+// alloc_stats_raise_peak()
+//############################################################################
+static void alloc_stats_raise_peak(uint64_t * peak, uint64_t live)
+{
+  uint64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+  while (live > seen &&
+         !__atomic_compare_exchange_n(peak, &seen, live, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+}
+
+//############################################################################
+// alloc_stats_record()
+//############################################################################
+/**
+ * @brief Counts an allocation of 'size' bytes (replacing a block of
+ *        'replaced' bytes, for a reallocation) in the current phase.
+ */
+static void alloc_stats_record(size_t size, size_t replaced)
+{
+#ifdef KMYTH_ALLOC_STATS_SUPPORTED
+  kmyth_alloc_stats *phase = &alloc_stats[alloc_phase];
+  kmyth_alloc_stats *total = &alloc_stats[KMYTH_ALLOC_PHASE_COUNT];
+  int64_t live = __atomic_add_fetch(&alloc_live_bytes,
+                                    (int64_t) size - (int64_t) replaced,
+                                    __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&phase->allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&phase->bytes, size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total->allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total->bytes, size, __ATOMIC_RELAXED);
+  if (live > 0)
+  {
+    alloc_stats_raise_peak(&phase->peak_bytes, (uint64_t) live);
+    alloc_stats_raise_peak(&total->peak_bytes, (uint64_t) live);
+  }
+#else
+  (void) size;
+  (void) replaced;
+#endif
+}
+
+//############################################################################
+// alloc_stats_record_free()
+//############################################################################
+static void alloc_stats_record_free(size_t size)
+{
+#ifdef KMYTH_ALLOC_STATS_SUPPORTED
+  __atomic_sub_fetch(&alloc_live_bytes, (int64_t) size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&alloc_stats[alloc_phase].frees, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&alloc_stats[KMYTH_ALLOC_PHASE_COUNT].frees, 1,
+                     __ATOMIC_RELAXED);
+#else
+  (void) size;
+#endif
+}
+
+//############################################################################
+// alloc_stats_block_size()
+//############################################################################
+static size_t alloc_stats_block_size(void *ptr)
+{
+#ifdef KMYTH_ALLOC_STATS_SUPPORTED
+  return (ptr == NULL) ? 0 : malloc_usable_size(ptr);
+#else
+  (void) ptr;
+  return 0;
+#endif
+}
+
+//############################################################################
+// kmyth_set_allocator()
+//############################################################################
+int kmyth_set_allocator(kmyth_alloc_fn alloc_fn, kmyth_realloc_fn realloc_fn,
+                        kmyth_free_fn free_fn, void *user_data)
+{
+  bool all = (alloc_fn != NULL && realloc_fn != NULL && free_fn != NULL);
+  bool none = (alloc_fn == NULL && realloc_fn == NULL && free_fn == NULL);
+
+  if (!all && !none)
+    return 1;
+
+  alloc_hook = alloc_fn;
+  realloc_hook = realloc_fn;
+  free_hook = free_fn;
+  hook_user_data = none ? NULL : user_data;
+  return 0;
+}
+
+//############################################################################
+// kmyth_malloc()
+//############################################################################
+void *kmyth_malloc(size_t size)
+{
+  if (alloc_hook != NULL)
+    return alloc_hook(size, hook_user_data);
+
+  void *v = malloc(size);
+
+  if (v != NULL && alloc_stats_counting())
+    alloc_stats_record(alloc_stats_block_size(v), 0);
+  return v;
+}
+
+//############################################################################
+// kmyth_calloc()
+//############################################################################
+void *kmyth_calloc(size_t count, size_t size)
+{
+  if (alloc_hook == NULL)
+  {
+    void *v = calloc(count, size);
+
+    if (v != NULL && alloc_stats_counting())
+      alloc_stats_record(alloc_stats_block_size(v), 0);
+    return v;
+  }
+
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+
+  void *v = alloc_hook(count * size, hook_user_data);
+
+  if (v != NULL)
+    memset(v, 0, count * size);
+  return v;
+}
+
+//############################################################################
+// kmyth_realloc()
+//############################################################################
+void *kmyth_realloc(void *ptr, size_t size)
+{
+  if (realloc_hook != NULL)
+    return realloc_hook(ptr, size, hook_user_data);
+
+  if (!alloc_stats_counting())
+    return realloc(ptr, size);
+
+  size_t replaced = alloc_stats_block_size(ptr);
+  void *v = realloc(ptr, size);
+
+  if (v != NULL)
+    alloc_stats_record(alloc_stats_block_size(v), replaced);
+  else if (size == 0 && ptr != NULL)
+    alloc_stats_record_free(replaced);
+  return v;
+}
+
+//############################################################################
+// kmyth_free()
+//############################################################################
+void kmyth_free(void *ptr)
+{
+  if (free_hook == NULL)
+  {
+    if (ptr != NULL && alloc_stats_counting())
+      alloc_stats_record_free(alloc_stats_block_size(ptr));
+    free(ptr);
+    return;
+  }
+  if (ptr != NULL)
+    free_hook(ptr, hook_user_data);
+}
+
+//############################################################################
+// kmyth_strdup()
+//############################################################################
+char *kmyth_strdup(const char *str)
+{
+  if (str == NULL)
+    return NULL;
+
+  size_t len = strlen(str) + 1;
+  char *copy = kmyth_malloc(len);
+
+  if (copy != NULL)
+    memcpy(copy, str, len);
+  return copy;
+}
+
+//############################################################################
+// kmyth_alloc_stats_enable()
+//############################################################################
+int kmyth_alloc_stats_enable(bool enable)
+{
+#ifdef KMYTH_ALLOC_STATS_SUPPORTED
+  if (enable && alloc_hook != NULL)
+    return 1;
+
+  __atomic_store_n(&alloc_stats_on, enable, __ATOMIC_RELAXED);
+  return 0;
+#else
+  return enable ? 1 : 0;
+#endif
+}
+
+//############################################################################
+// kmyth_alloc_stats_enabled()
+//############################################################################
+bool kmyth_alloc_stats_enabled(void)
+{
+  return alloc_stats_counting();
+}
+
+//############################################################################
+// kmyth_alloc_set_phase()
+//############################################################################
+kmyth_alloc_phase kmyth_alloc_set_phase(kmyth_alloc_phase phase)
+{
+#ifdef KMYTH_ALLOC_STATS_SUPPORTED
+  kmyth_alloc_phase previous = alloc_phase;
+
+  if (phase >= KMYTH_ALLOC_PHASE_OTHER && phase < KMYTH_ALLOC_PHASE_COUNT)
+    alloc_phase = phase;
+  return previous;
+#else
+  (void) phase;
+  return KMYTH_ALLOC_PHASE_OTHER;
+#endif
+}
+
+//############################################################################
+// kmyth_alloc_get_stats()
+//############################################################################
+void kmyth_alloc_get_stats(kmyth_alloc_phase phase, kmyth_alloc_stats * stats)
+{
+  if (stats == NULL)
+    return;
+
+  memset(stats, 0, sizeof(kmyth_alloc_stats));
+  if (phase < KMYTH_ALLOC_PHASE_OTHER || phase > KMYTH_ALLOC_PHASE_COUNT)
+    return;
+
+  stats->allocs = __atomic_load_n(&alloc_stats[phase].allocs,
+                                  __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&alloc_stats[phase].frees, __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n(&alloc_stats[phase].bytes, __ATOMIC_RELAXED);
+  stats->peak_bytes = __atomic_load_n(&alloc_stats[phase].peak_bytes,
+                                      __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_alloc_live_bytes()
+//############################################################################
+uint64_t kmyth_alloc_live_bytes(void)
+{
+  int64_t live = __atomic_load_n(&alloc_live_bytes, __ATOMIC_RELAXED);
+
+  return (live > 0) ? (uint64_t) live : 0;
+}
+
+//############################################################################
+// kmyth_alloc_stats_reset()
+//############################################################################
+void kmyth_alloc_stats_reset(void)
+{
+  uint64_t live = kmyth_alloc_live_bytes();
+
+  for (size_t i = 0; i <= KMYTH_ALLOC_PHASE_COUNT; i++)
+  {
+    __atomic_store_n(&alloc_stats[i].allocs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&alloc_stats[i].frees, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&alloc_stats[i].bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&alloc_stats[i].peak_bytes,
+                     (i == KMYTH_ALLOC_PHASE_COUNT) ? live : 0,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+//############################################################################
+// kmyth_alloc_phase_name()
+//############################################################################
+const char *kmyth_alloc_phase_name(kmyth_alloc_phase phase)
+{
+  if (phase < KMYTH_ALLOC_PHASE_OTHER || phase > KMYTH_ALLOC_PHASE_COUNT)
+    return "unknown";
+  return alloc_phase_names[phase];
+}
 
 //############################################################################
 // kmyth_clear()
@@ -32,7 +353,7 @@ void kmyth_clear_and_free(void *v, size_t size)
   if (v == NULL)
     return;
   kmyth_clear(v, size);
-  free(v);
+  kmyth_free(v);
 }
 
 //############################################################################
@@ -48,3 +369,203 @@ void *secure_memset(void *v, int c, size_t n)
 
   return v;
 }
+
+//############################################################################
+// map_huge_region()
+//############################################################################
+/**
+ * @brief Maps a region of size bytes (a multiple of KMYTH_HUGE_PAGE_SIZE)
+ *        backed by huge pages: explicit ones if any are reserved, else a
+ *        huge page aligned regular mapping advised to use transparent huge
+ *        pages (the kernel only collapses aligned ranges).
+ *
+ * @return The region, or MAP_FAILED if huge pages are not available
+ */
+static void *map_huge_region(size_t size, kmyth_arena_pages * pages)
+{
+#ifdef MAP_HUGETLB
+  void *huge = mmap(NULL, size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (huge != MAP_FAILED)
+  {
+    *pages = KMYTH_ARENA_PAGES_HUGETLB;
+    return huge;
+  }
+#endif
+
+#ifdef MADV_HUGEPAGE
+  if (size > SIZE_MAX - KMYTH_HUGE_PAGE_SIZE)
+    return MAP_FAILED;
+
+  // over-map by one huge page, then trim to an aligned region
+  size_t span = size + KMYTH_HUGE_PAGE_SIZE;
+  unsigned char *map = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (map == MAP_FAILED)
+    return MAP_FAILED;
+
+  uintptr_t start = ((uintptr_t) map + KMYTH_HUGE_PAGE_SIZE - 1) &
+    ~((uintptr_t) KMYTH_HUGE_PAGE_SIZE - 1);
+  size_t head = start - (uintptr_t) map;
+
+  if (head > 0)
+    munmap(map, head);
+  if (span - head > size)
+    munmap((unsigned char *) start + size, span - head - size);
+
+  if (madvise((void *) start, size, MADV_HUGEPAGE) == 0)
+  {
+    *pages = KMYTH_ARENA_PAGES_TRANSPARENT;
+    return (void *) start;
+  }
+  munmap((void *) start, size);
+#endif
+
+  (void) pages;
+  return MAP_FAILED;
+}
+
+//############################################################################
+// kmyth_arena_init()
+//############################################################################
+int kmyth_arena_init(kmyth_arena * arena, size_t size)
+{
+  if (arena == NULL)
+    return 1;
+
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+  arena->locked = false;
+  arena->pages = KMYTH_ARENA_PAGES_BASE;
+
+  long page = sysconf(_SC_PAGESIZE);
+  size_t page_size = (page > 0) ? (size_t) page : 4096;
+
+  if (size == 0 || size > SIZE_MAX - KMYTH_HUGE_PAGE_SIZE)
+    return 1;
+
+  // anonymous mappings are page aligned and zero filled
+  void *base = MAP_FAILED;
+  kmyth_arena_pages pages = KMYTH_ARENA_PAGES_BASE;
+
+  if (size >= KMYTH_HUGE_PAGE_SIZE)
+  {
+    size_t huge_size = (size + KMYTH_HUGE_PAGE_SIZE - 1) /
+      KMYTH_HUGE_PAGE_SIZE * KMYTH_HUGE_PAGE_SIZE;
+
+    base = map_huge_region(huge_size, &pages);
+    if (base != MAP_FAILED)
+      size = huge_size;
+  }
+  if (base == MAP_FAILED)
+  {
+    pages = KMYTH_ARENA_PAGES_BASE;
+    size = (size + page_size - 1) / page_size * page_size;
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+
+  if (base == MAP_FAILED)
+    return 1;
+
+  // keep the secrets out of swap and out of core dumps where possible
+  arena->locked = (mlock(base, size) == 0);
+#ifdef MADV_DONTDUMP
+  madvise(base, size, MADV_DONTDUMP);
+#endif
+
+  arena->base = base;
+  arena->size = size;
+  arena->pages = pages;
+  return 0;
+}
+
+//############################################################################
+// kmyth_arena_free()
+//############################################################################
+void kmyth_arena_free(kmyth_arena * arena)
+{
+  if (arena == NULL || arena->base == NULL)
+    return;
+
+  kmyth_arena_reset(arena);
+  if (arena->locked)
+    munlock(arena->base, arena->size);
+  munmap(arena->base, arena->size);
+
+  arena->base = NULL;
+  arena->size = 0;
+  arena->locked = false;
+  arena->pages = KMYTH_ARENA_PAGES_BASE;
+}
+
+//############################################################################
+// kmyth_arena_alloc()
+//############################################################################
+void *kmyth_arena_alloc(kmyth_arena * arena, size_t size)
+{
+  if (arena == NULL || arena->base == NULL || size == 0)
+    return NULL;
+
+  // the region is page aligned, so aligned offsets give aligned blocks
+  size_t start = (arena->used + KMYTH_ARENA_ALIGN - 1) &
+    ~((size_t) KMYTH_ARENA_ALIGN - 1);
+
+  if (start > arena->size || size > arena->size - start)
+    return NULL;
+
+  // released and reset blocks are wiped, so the block is already zeroed
+  arena->used = start + size;
+  return arena->base + start;
+}
+
+//############################################################################
+// kmyth_arena_reset()
+//############################################################################
+void kmyth_arena_reset(kmyth_arena * arena)
+{
+  if (arena == NULL || arena->base == NULL)
+    return;
+
+  kmyth_clear(arena->base, arena->used);
+  arena->used = 0;
+}
+
+//############################################################################
+// kmyth_arena_contains()
+//############################################################################
+bool kmyth_arena_contains(const kmyth_arena * arena, const void *v)
+{
+  if (arena == NULL || arena->base == NULL || v == NULL)
+    return false;
+
+  const unsigned char *p = v;
+
+  return (p >= arena->base && p < arena->base + arena->size);
+}
+
+//############################################################################
+// kmyth_arena_release()
+//############################################################################
+void kmyth_arena_release(kmyth_arena * arena, void *v, size_t size)
+{
+  if (v == NULL)
+    return;
+
+  if (!kmyth_arena_contains(arena, v))
+  {
+    kmyth_clear_and_free(v, size);
+    return;
+  }
+
+  kmyth_clear(v, size);
+
+  // the last block taken can be given back (alignment padding before it
+  // was never handed out, so it is still zero)
+  unsigned char *p = v;
+
+  if (p + size == arena->base + arena->used)
+    arena->used = (size_t) (p - arena->base);
+}
@@ -0,0 +1,626 @@
+/**
+ * metrics.c:
+ *
+ * C library containing the in-process metrics registry supporting Kmyth
+ * (see metrics.h). All metrics live in one fixed-size structure of 64-bit
+ * counters, so an update is a relaxed atomic add with no allocation and no
+ * lock, and a (loosely consistent) snapshot can be read at any time.
+ */
+
+#include "metrics.h"
+#include "memory_util.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+/**
+ * @brief Upper bounds (in microseconds) of the finite histogram buckets
+ */
+static const uint64_t bucket_bounds_us[KMYTH_METRICS_HISTOGRAM_BUCKETS] = {
+  100, 500, 1000, 5000, 10000, 50000, 100000, 250000, 500000, 1000000,
+  5000000, 10000000
+};
+
+typedef struct
+{
+  const char *name;
+  const char *help;
+  const char *summary;
+} metric_desc;
+
+static const metric_desc counter_desc[KMYTH_METRIC_COUNTER_COUNT] = {
+  {"kmyth_seals_total", "Inputs sealed.", "seals"},
+  {"kmyth_seal_errors_total", "Seal calls that failed.", "seal errors"},
+  {"kmyth_unseals_total", "Inputs unsealed.", "unseals"},
+  {"kmyth_unseal_errors_total", "Unseals that failed.", "unseal errors"},
+  {"kmyth_encrypted_bytes_total", "Plaintext bytes encrypted.",
+   "bytes encrypted"},
+  {"kmyth_decrypted_bytes_total", "Plaintext bytes decrypted.",
+   "bytes decrypted"},
+  {"kmyth_key_requests_total", "Keys retrieved from a key server.",
+   "key requests"},
+  {"kmyth_key_request_errors_total", "Key retrievals that failed.",
+   "key request errors"},
+  {"kmyth_tls_handshake_errors_total", "TLS connections that failed.",
+   "TLS handshake errors"}
+};
+
+static const char *const cache_names[KMYTH_METRIC_CACHE_COUNT] = {
+  "srk", "capability", "storage_key", "policy", "secret", "tls_session",
+  "tls_connection", "nsl_pkey_ctx", "ecdh_keypair", "ecdh_ticket", "keyring"
+};
+
+static const metric_desc histogram_desc[KMYTH_METRIC_HISTOGRAM_COUNT] = {
+  {"kmyth_seal_duration_seconds", "Time taken by seal calls.", "seal time"},
+  {"kmyth_unseal_duration_seconds", "Time taken by unseal calls.",
+   "unseal time"},
+  {"kmyth_tls_handshake_duration_seconds",
+   "Time taken to connect to a TLS server (TCP connect and handshake).",
+   "TLS handshake time"}
+};
+
+typedef struct
+{
+  uint64_t buckets[KMYTH_METRICS_HISTOGRAM_BUCKETS + 1];
+  uint64_t count;
+  uint64_t sum_us;
+} metrics_histogram;
+
+typedef struct
+{
+  uint64_t counters[KMYTH_METRIC_COUNTER_COUNT];
+  uint64_t cache_hits[KMYTH_METRIC_CACHE_COUNT];
+  uint64_t cache_misses[KMYTH_METRIC_CACHE_COUNT];
+
+  // TPM response codes are claimed (0 -> rc) on first use; rc 0 is
+  // success, so it never needs a slot of its own
+  uint32_t tpm_rcs[KMYTH_METRICS_MAX_TPM_RCS];
+  uint64_t tpm_errors[KMYTH_METRICS_MAX_TPM_RCS];
+  uint64_t tpm_errors_other;
+
+  metrics_histogram histograms[KMYTH_METRIC_HISTOGRAM_COUNT];
+} metrics_registry;
+
+static metrics_registry local_registry;
+
+/**
+ * @brief Registry in use: local_registry, unless kmyth_metrics_share()
+ *        has moved it into shared memory
+ */
+static metrics_registry *registry = &local_registry;
+
+//############################################################################
+// metrics_add()
+//############################################################################
+static inline void metrics_add(uint64_t * value, uint64_t n)
+{
+  __atomic_fetch_add(value, n, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// metrics_load()
+//############################################################################
+static inline uint64_t metrics_load(const uint64_t * value)
+{
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_metrics_add()
+//############################################################################
+void kmyth_metrics_add(kmyth_metric_counter counter, uint64_t n)
+{
+  if (counter < KMYTH_METRIC_COUNTER_COUNT)
+  {
+    metrics_add(&(registry->counters[counter]), n);
+  }
+}
+
+//############################################################################
+// kmyth_metrics_inc()
+//############################################################################
+void kmyth_metrics_inc(kmyth_metric_counter counter)
+{
+  kmyth_metrics_add(counter, 1);
+}
+
+//############################################################################
+// find_tpm_rc_slot()
+//############################################################################
+/**
+ * @brief Finds the slot counting rc, claiming a free one if rc has not
+ *        been seen before.
+ *
+ * @return Slot index, or -1 if every slot belongs to another code
+ */
+static int find_tpm_rc_slot(uint32_t rc, bool claim)
+{
+  for (int i = 0; i < KMYTH_METRICS_MAX_TPM_RCS; i++)
+  {
+    uint32_t seen = __atomic_load_n(&(registry->tpm_rcs[i]), __ATOMIC_ACQUIRE);
+
+    if (seen == 0 && claim)
+    {
+      uint32_t expected = 0;
+
+      if (__atomic_compare_exchange_n(&(registry->tpm_rcs[i]), &expected, rc,
+                                      false, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_ACQUIRE))
+      {
+        return i;
+      }
+      seen = expected;
+    }
+    if (seen == rc)
+    {
+      return i;
+    }
+    if (seen == 0)
+    {
+      return -1;
+    }
+  }
+
+  return -1;
+}
+
+//############################################################################
+// kmyth_metrics_tpm_error()
+//############################################################################
+void kmyth_metrics_tpm_error(uint32_t rc)
+{
+  int slot = (rc == 0) ? -1 : find_tpm_rc_slot(rc, true);
+
+  if (slot < 0)
+  {
+    metrics_add(&(registry->tpm_errors_other), 1);
+  }
+  else
+  {
+    metrics_add(&(registry->tpm_errors[slot]), 1);
+  }
+}
+
+//############################################################################
+// kmyth_metrics_cache_lookup()
+//############################################################################
+void kmyth_metrics_cache_lookup(kmyth_metric_cache cache, int hit)
+{
+  if (cache < KMYTH_METRIC_CACHE_COUNT)
+  {
+    metrics_add(hit ? &(registry->cache_hits[cache]) :
+                &(registry->cache_misses[cache]), 1);
+  }
+}
+
+//############################################################################
+// kmyth_metrics_now_us()
+//############################################################################
+uint64_t kmyth_metrics_now_us(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+//############################################################################
+// kmyth_metrics_observe()
+//############################################################################
+void kmyth_metrics_observe(kmyth_metric_histogram histogram, uint64_t usec)
+{
+  if (histogram >= KMYTH_METRIC_HISTOGRAM_COUNT)
+  {
+    return;
+  }
+
+  metrics_histogram *h = &(registry->histograms[histogram]);
+  size_t bucket = 0;
+
+  // buckets hold the count for their own range only; the cumulative counts
+  // Prometheus expects are added up when the metrics are written out
+  while (bucket < KMYTH_METRICS_HISTOGRAM_BUCKETS &&
+         usec > bucket_bounds_us[bucket])
+  {
+    bucket++;
+  }
+  metrics_add(&(h->buckets[bucket]), 1);
+  metrics_add(&(h->count), 1);
+  metrics_add(&(h->sum_us), usec);
+}
+
+//############################################################################
+// kmyth_metrics_observe_since()
+//############################################################################
+void kmyth_metrics_observe_since(kmyth_metric_histogram histogram,
+                                 uint64_t start_us)
+{
+  uint64_t now = kmyth_metrics_now_us();
+
+  kmyth_metrics_observe(histogram, (now > start_us) ? now - start_us : 0);
+}
+
+//############################################################################
+// kmyth_metrics_get()
+//############################################################################
+uint64_t kmyth_metrics_get(kmyth_metric_counter counter)
+{
+  if (counter >= KMYTH_METRIC_COUNTER_COUNT)
+  {
+    return 0;
+  }
+  return metrics_load(&(registry->counters[counter]));
+}
+
+//############################################################################
+// kmyth_metrics_get_cache()
+//############################################################################
+uint64_t kmyth_metrics_get_cache(kmyth_metric_cache cache, int hit)
+{
+  if (cache >= KMYTH_METRIC_CACHE_COUNT)
+  {
+    return 0;
+  }
+  return metrics_load(hit ? &(registry->cache_hits[cache]) :
+                      &(registry->cache_misses[cache]));
+}
+
+//############################################################################
+// kmyth_metrics_get_tpm_error()
+//############################################################################
+uint64_t kmyth_metrics_get_tpm_error(uint32_t rc)
+{
+  int slot = (rc == 0) ? -1 : find_tpm_rc_slot(rc, false);
+
+  return (slot < 0) ? 0 : metrics_load(&(registry->tpm_errors[slot]));
+}
+
+//############################################################################
+// kmyth_metrics_get_histogram()
+//############################################################################
+uint64_t kmyth_metrics_get_histogram(kmyth_metric_histogram histogram,
+                                     uint64_t * sum_us)
+{
+  if (histogram >= KMYTH_METRIC_HISTOGRAM_COUNT)
+  {
+    return 0;
+  }
+
+  metrics_histogram *h = &(registry->histograms[histogram]);
+
+  if (sum_us != NULL)
+  {
+    *sum_us = metrics_load(&(h->sum_us));
+  }
+  return metrics_load(&(h->count));
+}
+
+//############################################################################
+// kmyth_metrics_reset()
+//############################################################################
+void kmyth_metrics_reset(void)
+{
+  memset(registry, 0, sizeof(metrics_registry));
+  kmyth_alloc_stats_reset();
+}
+
+//############################################################################
+// kmyth_metrics_share()
+//############################################################################
+int kmyth_metrics_share(void)
+{
+  if (registry != &local_registry)
+  {
+    return 0;
+  }
+
+  metrics_registry *shared = mmap(NULL, sizeof(metrics_registry),
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (shared == MAP_FAILED)
+  {
+    return 1;
+  }
+  memcpy(shared, &local_registry, sizeof(metrics_registry));
+  registry = shared;
+
+  return 0;
+}
+
+//############################################################################
+// write_help()
+//############################################################################
+static void write_help(FILE * out, const char *name, const char *help,
+                       const char *type)
+{
+  fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+//############################################################################
+// write_seconds()
+//############################################################################
+static void write_seconds(FILE * out, uint64_t usec)
+{
+  fprintf(out, "%llu.%06llu", (unsigned long long) (usec / 1000000),
+          (unsigned long long) (usec % 1000000));
+}
+
+//############################################################################
+// write_alloc_stats_prometheus()
+//############################################################################
+/**
+ * @brief Writes the allocation accounting figures (see
+ *        kmyth_alloc_stats_enable()), by phase.
+ */
+static void write_alloc_stats_prometheus(FILE * out)
+{
+  static const struct
+  {
+    const char *name;
+    const char *help;
+    const char *type;
+  } alloc_desc[] = {
+    {"kmyth_alloc_total", "Kmyth heap allocations, by phase.", "counter"},
+    {"kmyth_alloc_bytes_total", "Bytes allocated on the Kmyth heap, by phase.",
+     "counter"},
+    {"kmyth_alloc_phase_peak_bytes",
+     "Most Kmyth heap bytes live at once, at an allocation in the phase.",
+     "gauge"},
+  };
+  kmyth_alloc_stats stats[KMYTH_ALLOC_PHASE_COUNT + 1];
+
+  for (size_t p = 0; p <= KMYTH_ALLOC_PHASE_COUNT; p++)
+  {
+    kmyth_alloc_get_stats((kmyth_alloc_phase) p, &stats[p]);
+  }
+
+  for (size_t i = 0; i < sizeof(alloc_desc) / sizeof(alloc_desc[0]); i++)
+  {
+    write_help(out, alloc_desc[i].name, alloc_desc[i].help, alloc_desc[i].type);
+    for (size_t p = 0; p < KMYTH_ALLOC_PHASE_COUNT; p++)
+    {
+      uint64_t value = (i == 0) ? stats[p].allocs :
+        (i == 1) ? stats[p].bytes : stats[p].peak_bytes;
+
+      fprintf(out, "%s{phase=\"%s\"} %llu\n", alloc_desc[i].name,
+              kmyth_alloc_phase_name((kmyth_alloc_phase) p),
+              (unsigned long long) value);
+    }
+  }
+
+  write_help(out, "kmyth_alloc_peak_bytes",
+             "Most Kmyth heap bytes live at once.", "gauge");
+  fprintf(out, "kmyth_alloc_peak_bytes %llu\n",
+          (unsigned long long) stats[KMYTH_ALLOC_PHASE_COUNT].peak_bytes);
+  write_help(out, "kmyth_alloc_live_bytes", "Kmyth heap bytes live now.",
+             "gauge");
+  fprintf(out, "kmyth_alloc_live_bytes %llu\n",
+          (unsigned long long) kmyth_alloc_live_bytes());
+}
+
+//############################################################################
+// kmyth_metrics_write_prometheus()
+//############################################################################
+int kmyth_metrics_write_prometheus(FILE * out)
+{
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < KMYTH_METRIC_COUNTER_COUNT; i++)
+  {
+    write_help(out, counter_desc[i].name, counter_desc[i].help, "counter");
+    fprintf(out, "%s %llu\n", counter_desc[i].name,
+            (unsigned long long) metrics_load(&(registry->counters[i])));
+  }
+
+  write_help(out, "kmyth_tpm_errors_total",
+             "TPM commands that failed, by response code.", "counter");
+  for (size_t i = 0; i < KMYTH_METRICS_MAX_TPM_RCS; i++)
+  {
+    uint32_t rc = __atomic_load_n(&(registry->tpm_rcs[i]), __ATOMIC_ACQUIRE);
+
+    if (rc == 0)
+    {
+      break;
+    }
+    fprintf(out, "kmyth_tpm_errors_total{rc=\"0x%08X\"} %llu\n", rc,
+            (unsigned long long) metrics_load(&(registry->tpm_errors[i])));
+  }
+  fprintf(out, "kmyth_tpm_errors_total{rc=\"other\"} %llu\n",
+          (unsigned long long) metrics_load(&(registry->tpm_errors_other)));
+
+  write_help(out, "kmyth_cache_hits_total", "Cache lookups that hit.",
+             "counter");
+  for (size_t i = 0; i < KMYTH_METRIC_CACHE_COUNT; i++)
+  {
+    fprintf(out, "kmyth_cache_hits_total{cache=\"%s\"} %llu\n",
+            cache_names[i],
+            (unsigned long long) metrics_load(&(registry->cache_hits[i])));
+  }
+  write_help(out, "kmyth_cache_misses_total", "Cache lookups that missed.",
+             "counter");
+  for (size_t i = 0; i < KMYTH_METRIC_CACHE_COUNT; i++)
+  {
+    fprintf(out, "kmyth_cache_misses_total{cache=\"%s\"} %llu\n",
+            cache_names[i],
+            (unsigned long long) metrics_load(&(registry->cache_misses[i])));
+  }
+
+  for (size_t i = 0; i < KMYTH_METRIC_HISTOGRAM_COUNT; i++)
+  {
+    const char *name = histogram_desc[i].name;
+    metrics_histogram *h = &(registry->histograms[i]);
+    uint64_t cumulative = 0;
+
+    write_help(out, name, histogram_desc[i].help, "histogram");
+    for (size_t b = 0; b < KMYTH_METRICS_HISTOGRAM_BUCKETS; b++)
+    {
+      cumulative += metrics_load(&(h->buckets[b]));
+      fprintf(out, "%s_bucket{le=\"", name);
+      write_seconds(out, bucket_bounds_us[b]);
+      fprintf(out, "\"} %llu\n", (unsigned long long) cumulative);
+    }
+    cumulative += metrics_load(&(h->buckets[KMYTH_METRICS_HISTOGRAM_BUCKETS]));
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+            (unsigned long long) cumulative);
+    fprintf(out, "%s_sum ", name);
+    write_seconds(out, metrics_load(&(h->sum_us)));
+    // reported from the buckets so that it always matches le="+Inf"
+    fprintf(out, "\n%s_count %llu\n", name, (unsigned long long) cumulative);
+  }
+
+  if (kmyth_alloc_stats_enabled())
+  {
+    write_alloc_stats_prometheus(out);
+  }
+
+  return ferror(out) ? 1 : 0;
+}
+
+//############################################################################
+// kmyth_metrics_write_file()
+//############################################################################
+int kmyth_metrics_write_file(const char *path)
+{
+  if (path == NULL)
+  {
+    return 1;
+  }
+
+  // the temporary name is per process, as forked children may write too
+  size_t tmp_len = strlen(path) + 32;
+  char *tmp_path = kmyth_malloc(tmp_len);
+
+  if (tmp_path == NULL)
+  {
+    return 1;
+  }
+  snprintf(tmp_path, tmp_len, "%s.tmp.%ld", path, (long) getpid());
+
+  FILE *out = fopen(tmp_path, "w");
+  int retval = 1;
+
+  if (out != NULL)
+  {
+    retval = kmyth_metrics_write_prometheus(out);
+    if (fclose(out) != 0)
+    {
+      retval = 1;
+    }
+    if (retval == 0 && rename(tmp_path, path) != 0)
+    {
+      retval = 1;
+    }
+    if (retval)
+    {
+      unlink(tmp_path);
+    }
+  }
+  kmyth_free(tmp_path);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_metrics_print_summary()
+//############################################################################
+void kmyth_metrics_print_summary(FILE * out)
+{
+  if (out == NULL)
+  {
+    return;
+  }
+
+  fprintf(out, "kmyth stats:\n");
+  for (size_t i = 0; i < KMYTH_METRIC_COUNTER_COUNT; i++)
+  {
+    uint64_t value = metrics_load(&(registry->counters[i]));
+
+    if (value > 0)
+    {
+      fprintf(out, "  %-28s %llu\n", counter_desc[i].summary,
+              (unsigned long long) value);
+    }
+  }
+
+  for (size_t i = 0; i < KMYTH_METRIC_CACHE_COUNT; i++)
+  {
+    uint64_t hits = metrics_load(&(registry->cache_hits[i]));
+    uint64_t misses = metrics_load(&(registry->cache_misses[i]));
+    char label[64];
+
+    if (hits + misses > 0)
+    {
+      snprintf(label, sizeof(label), "%s cache", cache_names[i]);
+      fprintf(out, "  %-28s %llu hits, %llu misses\n", label,
+              (unsigned long long) hits, (unsigned long long) misses);
+    }
+  }
+
+  for (size_t i = 0; i < KMYTH_METRICS_MAX_TPM_RCS; i++)
+  {
+    uint32_t rc = __atomic_load_n(&(registry->tpm_rcs[i]), __ATOMIC_ACQUIRE);
+    char label[64];
+
+    if (rc == 0)
+    {
+      break;
+    }
+    snprintf(label, sizeof(label), "TPM errors (rc 0x%08X)", rc);
+    fprintf(out, "  %-28s %llu\n", label,
+            (unsigned long long) metrics_load(&(registry->tpm_errors[i])));
+  }
+  if (metrics_load(&(registry->tpm_errors_other)) > 0)
+  {
+    fprintf(out, "  %-28s %llu\n", "TPM errors (other rc)",
+            (unsigned long long) metrics_load(&(registry->tpm_errors_other)));
+  }
+
+  for (size_t i = 0; i < KMYTH_METRIC_HISTOGRAM_COUNT; i++)
+  {
+    metrics_histogram *h = &(registry->histograms[i]);
+    uint64_t count = metrics_load(&(h->count));
+    uint64_t sum_us = metrics_load(&(h->sum_us));
+
+    if (count > 0)
+    {
+      fprintf(out, "  %-28s %llu calls, %.3f ms total, %.3f ms mean\n",
+              histogram_desc[i].summary, (unsigned long long) count,
+              (double) sum_us / 1000.0, (double) sum_us / 1000.0 /
+              (double) count);
+    }
+  }
+
+  kmyth_alloc_stats total;
+
+  kmyth_alloc_get_stats(KMYTH_ALLOC_PHASE_COUNT, &total);
+  if (!kmyth_alloc_stats_enabled() || total.allocs == 0)
+  {
+    return;
+  }
+  for (size_t p = 0; p <= KMYTH_ALLOC_PHASE_COUNT; p++)
+  {
+    kmyth_alloc_stats stats;
+    char label[64];
+
+    kmyth_alloc_get_stats((kmyth_alloc_phase) p, &stats);
+    if (stats.allocs == 0)
+    {
+      continue;
+    }
+    snprintf(label, sizeof(label), "allocations (%s)",
+             kmyth_alloc_phase_name((kmyth_alloc_phase) p));
+    fprintf(out, "  %-28s %llu, %llu bytes, peak %llu bytes live\n", label,
+            (unsigned long long) stats.allocs,
+            (unsigned long long) stats.bytes,
+            (unsigned long long) stats.peak_bytes);
+  }
+}